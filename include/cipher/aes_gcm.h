@@ -8,6 +8,8 @@
 
 #include <stdlib.h>
 
+#include "cipher/cipher.h"
+
 /// Length of the AES/GCM tag.
 /// We hard code 16 byte tags, which is the longest length supported by AES/GCM
 #define GCM_TAG_LEN 16
@@ -84,4 +86,138 @@ int aes_gcm_decrypt(unsigned char *key,
                     size_t inData_len, unsigned char **outData,
                     size_t * outData_len);
 
+/**
+ * @brief Same as aes_gcm_encrypt_with_ctx(), but writes the IV||CT||tag
+ *        output into a caller-provided buffer (see cipher_into). A call
+ *        with a NULL outData sets *outData_len to
+ *        GCM_IV_LEN + inData_len + GCM_TAG_LEN.
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_encrypt_into(kmyth_cipher_ctx * cipher_ctx,
+                         unsigned char *key,
+                         size_t key_len,
+                         unsigned char *inData,
+                         size_t inData_len,
+                         unsigned char *outData, size_t * outData_len);
+
+/**
+ * @brief Same as aes_gcm_decrypt_with_ctx(), but writes the plaintext into
+ *        a caller-provided buffer (see cipher_into). A call with a NULL
+ *        outData sets *outData_len to inData_len - GCM_IV_LEN - GCM_TAG_LEN.
+ *        If the tag does not verify, outData is cleared.
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_decrypt_into(kmyth_cipher_ctx * cipher_ctx,
+                         unsigned char *key,
+                         size_t key_len,
+                         unsigned char *inData,
+                         size_t inData_len,
+                         unsigned char *outData, size_t * outData_len);
+
+/**
+ * @brief Decrypts an IV||CT||tag buffer in place (see cipher_in_place), so
+ *        no second buffer the size of the data is needed. The plaintext is
+ *        written over the ciphertext and, only once the tag has verified,
+ *        moved to the start of the buffer. On error the buffer contents are
+ *        lost (any unauthenticated plaintext is cleared).
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_decrypt_in_place(kmyth_cipher_ctx * cipher_ctx,
+                             unsigned char *key,
+                             size_t key_len,
+                             unsigned char *data,
+                             size_t data_len, size_t * plaintext_len);
+
+/**
+ * @brief Same as aes_gcm_encrypt(), but draws the OpenSSL cipher
+ *        context from a caller supplied pool, so that repeated calls
+ *        (e.g., in a batch key wrapping loop) reuse it. The remaining
+ *        parameters are the same as for aes_gcm_encrypt().
+ *
+ * @param[in]  cipher_ctx  Context pool (NULL for a single-use context)
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_encrypt_with_ctx(kmyth_cipher_ctx * cipher_ctx,
+                             unsigned char *key,
+                             size_t key_len,
+                             unsigned char *inData,
+                             size_t inData_len,
+                             unsigned char **outData,
+                             size_t * outData_len);
+
+/**
+ * @brief Same as aes_gcm_decrypt(), but draws the OpenSSL cipher
+ *        context from a caller supplied pool, so that repeated calls
+ *        (e.g., in a batch key wrapping loop) reuse it. The remaining
+ *        parameters are the same as for aes_gcm_decrypt().
+ *
+ * @param[in]  cipher_ctx  Context pool (NULL for a single-use context)
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_decrypt_with_ctx(kmyth_cipher_ctx * cipher_ctx,
+                             unsigned char *key,
+                             size_t key_len,
+                             unsigned char *inData,
+                             size_t inData_len,
+                             unsigned char **outData,
+                             size_t * outData_len);
+
+/**
+ * @brief Encrypts a batch of inputs under a single key, producing for each
+ *        the same IV||ciphertext||tag output as aes_gcm_encrypt() (with a
+ *        fresh random IV per input). The key schedule is computed once
+ *        for the whole batch.
+ *
+ * @param[in]  cipher_ctx  Context pool (NULL for a single-use context)
+ *
+ * @param[in]  key         The hex bytes containing the key
+ *
+ * @param[in]  key_len     The length of the key in bytes
+ *                         (must be 16, 24, or 32)
+ *
+ * @param[in]  count       Number of inputs in the batch
+ *
+ * @param[in]  inData      Array (of count) plaintext input buffers
+ *
+ * @param[in]  inData_len  Array (of count) plaintext input lengths
+ *
+ * @param[out] outData     Array (of count) to hold the output buffers
+ *                         (NULL for any input that failed)
+ *
+ * @param[out] outData_len Array (of count) to hold the output lengths
+ *
+ * @param[out] status      Array (of count) to hold the per-input result
+ *                         (0 on success, 1 on error)
+ *
+ * @return 0 if every input was encrypted, 1 otherwise
+ */
+int aes_gcm_encrypt_batch(kmyth_cipher_ctx * cipher_ctx,
+                          unsigned char *key,
+                          size_t key_len,
+                          size_t count,
+                          unsigned char **inData,
+                          size_t * inData_len,
+                          unsigned char **outData,
+                          size_t * outData_len, int *status);
+
+/**
+ * @brief Decrypts a batch of IV||ciphertext||tag inputs under a single
+ *        key. Parameters are as for aes_gcm_encrypt_batch().
+ *
+ * @return 0 if every input was decrypted (and authenticated), 1 otherwise
+ */
+int aes_gcm_decrypt_batch(kmyth_cipher_ctx * cipher_ctx,
+                          unsigned char *key,
+                          size_t key_len,
+                          size_t count,
+                          unsigned char **inData,
+                          size_t * inData_len,
+                          unsigned char **outData,
+                          size_t * outData_len, int *status);
+
 #endif
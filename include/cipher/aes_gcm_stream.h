@@ -0,0 +1,219 @@
+/**
+ * @file aes_gcm_stream.h
+ *
+ * @brief Provides a segmented (streaming) AES GCM construction for kmyth,
+ *        built on OpenSSL's AES GCM implementation.
+ *
+ * <pre>
+ * The input is split into fixed-size segments, each encrypted and
+ * authenticated independently under a nonce derived from a random per-
+ * message prefix, the segment index, and a 'last segment' flag. This lets
+ * large inputs be encrypted or decrypted with memory bounded by the segment
+ * size, while still detecting reordered, dropped, or truncated segments.
+ *
+ * The encrypted data block has the form
+ *    header||segment_0||...||segment_(n-1)
+ * where
+ *      header    = nonce prefix (7 bytes) || segment length (4 bytes, BE)
+ *      segment_i = ciphertext_i || tag_i (16 bytes)
+ *      nonce_i   = nonce prefix || i (4 bytes, BE) || last flag (1 byte)
+ * and the header is authenticated (as AAD) with every segment.
+ * </pre>
+ */
+#ifndef AES_GCM_STREAM_H
+#define AES_GCM_STREAM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cipher/cipher.h"
+
+/// Plaintext length, in bytes, of every segment except (possibly) the last.
+#define GCM_STREAM_SEGMENT_LEN 65536
+
+/// Upper bound accepted for the segment length recorded in a header, so that
+/// a malformed header cannot request an arbitrarily large segment buffer.
+#define GCM_STREAM_MAX_SEGMENT_LEN (1 << 24)
+
+/// Length of the random nonce prefix shared by all segments of a message.
+#define GCM_STREAM_NONCE_PREFIX_LEN 7
+
+/// Length of the header preceding the first segment.
+#define GCM_STREAM_HEADER_LEN (GCM_STREAM_NONCE_PREFIX_LEN + 4)
+
+/// Upper bound on the number of threads an in-memory encryption or
+/// decryption is spread over (see aes_gcm_stream_set_threads()).
+#define GCM_STREAM_MAX_THREADS 64
+
+/**
+ * @brief Sets the number of threads (including the calling one) that the
+ *        in-memory functions below spread the segments of each input over.
+ *        The segments are independent, so they are encrypted or decrypted
+ *        concurrently, each into its fixed place in the output. Inputs of
+ *        fewer segments use fewer threads. The stream (_file) functions are
+ *        unaffected. Defaults to 1.
+ *
+ * @param[in]  threads  Thread count, clamped to [1, GCM_STREAM_MAX_THREADS]
+ *
+ * @return None
+ */
+void aes_gcm_stream_set_threads(unsigned int threads);
+
+/**
+ * @brief Encrypts an in-memory buffer with segmented AES GCM. Provides the
+ *        cipher_t encrypt interface for the "AES/GCM-Stream" cipher suite.
+ *
+ * @param[in]  key         The hex bytes containing the key -
+ *                         pass in pointer to key buffer
+ *
+ * @param[in]  key_len     The length of the key in bytes
+ *                         (must be 16, 24, or 32)
+ *
+ * @param[in]  inData      The plaintext data to be encrypted -
+ *                         pass in pointer to input plaintext data buffer
+ *
+ * @param[in]  inData_len  The length, in bytes, of the plaintext data
+ *
+ * @param[out] outData     The output (header and segments) -
+ *                         pass in pointer to address of ciphertext buffer
+ *
+ * @param[out] outData_len The length in bytes of outData -
+ *                         pass as pointer to length value
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_stream_encrypt(unsigned char *key,
+                           size_t key_len,
+                           unsigned char *inData,
+                           size_t inData_len, unsigned char **outData,
+                           size_t * outData_len);
+
+/**
+ * @brief Decrypts an in-memory buffer produced by aes_gcm_stream_encrypt()
+ *        or aes_gcm_stream_encrypt_file(). Provides the cipher_t decrypt
+ *        interface for the "AES/GCM-Stream" cipher suite.
+ *
+ * @param[in]  key         The hex bytes containing the key -
+ *                         pass in pointer to key buffer
+ *
+ * @param[in]  key_len     The length of the key in bytes
+ *                         (must be 16, 24, or 32)
+ *
+ * @param[in]  inData      The header and segments -
+ *                         pass in pointer to input values
+ *
+ * @param[in]  inData_len  The length in bytes of inData
+ *
+ * @param[out] outData     The output plaintext -
+ *                         passed as pointer to address of output buffer
+ *
+ * @param[out] outData_len The length in bytes of outData
+ *                         passed as pointer to length value
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_stream_decrypt(unsigned char *key,
+                           size_t key_len,
+                           unsigned char *inData,
+                           size_t inData_len, unsigned char **outData,
+                           size_t * outData_len);
+
+/**
+ * @brief Same as aes_gcm_stream_encrypt(), but writes the header and
+ *        segments into a caller-provided buffer (see cipher_into). A call
+ *        with a NULL outData sets *outData_len to the header length plus
+ *        inData_len plus one tag length per segment. The segmented
+ *        construction does not use a context pool, so cipher_ctx is
+ *        ignored.
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_stream_encrypt_into(kmyth_cipher_ctx * cipher_ctx,
+                                unsigned char *key,
+                                size_t key_len,
+                                unsigned char *inData,
+                                size_t inData_len,
+                                unsigned char *outData, size_t * outData_len);
+
+/**
+ * @brief Same as aes_gcm_stream_decrypt(), but writes the plaintext into a
+ *        caller-provided buffer (see cipher_into). A call with a NULL
+ *        outData parses the header and sets *outData_len to the plaintext
+ *        length. If any segment fails to authenticate, outData is cleared.
+ *        cipher_ctx is ignored.
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_stream_decrypt_into(kmyth_cipher_ctx * cipher_ctx,
+                                unsigned char *key,
+                                size_t key_len,
+                                unsigned char *inData,
+                                size_t inData_len,
+                                unsigned char *outData, size_t * outData_len);
+
+/**
+ * @brief Decrypts part of an in-memory buffer produced by
+ *        aes_gcm_stream_encrypt() (see cipher_range). Only the segments
+ *        covering the plaintext range are decrypted and authenticated, so
+ *        the cost grows with the range length rather than the input length.
+ *        Truncation of segments after the range is not detected. If a
+ *        segment fails to authenticate, outData is cleared. cipher_ctx is
+ *        ignored.
+ *
+ * @return 0 on success, 1 on error (including a range that extends past
+ *         the end of the plaintext)
+ */
+int aes_gcm_stream_decrypt_range(kmyth_cipher_ctx * cipher_ctx,
+                                 unsigned char *key,
+                                 size_t key_len,
+                                 unsigned char *inData,
+                                 size_t inData_len,
+                                 size_t offset,
+                                 unsigned char *outData, size_t outData_len);
+
+/**
+ * @brief Encrypts everything readable from an input stream with segmented
+ *        AES GCM, writing the result to an output stream. Only one segment
+ *        is held in memory at a time.
+ *
+ * @param[in]  key         The hex bytes containing the key -
+ *                         pass in pointer to key buffer
+ *
+ * @param[in]  key_len     The length of the key in bytes
+ *                         (must be 16, 24, or 32)
+ *
+ * @param[in]  in          Stream containing the plaintext (read to EOF)
+ *
+ * @param[in]  out         Stream the header and segments are written to
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_stream_encrypt_file(unsigned char *key, size_t key_len,
+                                FILE * in, FILE * out);
+
+/**
+ * @brief Decrypts segmented AES GCM data from an input stream, writing the
+ *        plaintext to an output stream. Only one segment is held in memory
+ *        at a time, and each segment is written only after its tag has been
+ *        verified.
+ *
+ *        On error, segments preceding the failure may already have been
+ *        written to the output stream; the caller must discard the output.
+ *
+ * @param[in]  key         The hex bytes containing the key -
+ *                         pass in pointer to key buffer
+ *
+ * @param[in]  key_len     The length of the key in bytes
+ *                         (must be 16, 24, or 32)
+ *
+ * @param[in]  in          Stream containing the header and segments
+ *                         (read to EOF)
+ *
+ * @param[in]  out         Stream the recovered plaintext is written to
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_stream_decrypt_file(unsigned char *key, size_t key_len,
+                                FILE * in, FILE * out);
+
+#endif
@@ -8,6 +8,8 @@
 
 #include <stdlib.h>
 
+#include "cipher/cipher.h"
+
 /**
  * @brief This function uses OpenSSL to perform AES key wrap without padding
  *        (RFC 3394).
@@ -66,4 +68,74 @@ int aes_keywrap_3394nopad_decrypt(unsigned char *key,
                                   size_t inData_len, unsigned char **outData,
                                   size_t * outData_len);
 
+/**
+ * @brief Same as aes_keywrap_3394nopad_encrypt(), but draws the OpenSSL cipher
+ *        context from a caller supplied pool, so that repeated calls
+ *        (e.g., in a batch key wrapping loop) reuse it. The remaining
+ *        parameters are the same as for aes_keywrap_3394nopad_encrypt().
+ *
+ * @param[in]  cipher_ctx  Context pool (NULL for a single-use context)
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_keywrap_3394nopad_encrypt_with_ctx(kmyth_cipher_ctx * cipher_ctx,
+                                           unsigned char *key,
+                                           size_t key_len,
+                                           unsigned char *inData,
+                                           size_t inData_len,
+                                           unsigned char **outData,
+                                           size_t * outData_len);
+
+/**
+ * @brief Same as aes_keywrap_3394nopad_decrypt(), but draws the OpenSSL cipher
+ *        context from a caller supplied pool, so that repeated calls
+ *        (e.g., in a batch key wrapping loop) reuse it. The remaining
+ *        parameters are the same as for aes_keywrap_3394nopad_decrypt().
+ *
+ * @param[in]  cipher_ctx  Context pool (NULL for a single-use context)
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_keywrap_3394nopad_decrypt_with_ctx(kmyth_cipher_ctx * cipher_ctx,
+                                           unsigned char *key,
+                                           size_t key_len,
+                                           unsigned char *inData,
+                                           size_t inData_len,
+                                           unsigned char **outData,
+                                           size_t * outData_len);
+
+/**
+ * @brief Same as aes_keywrap_3394nopad_encrypt_with_ctx(), but writes the
+ *        wrapped output into a caller-provided buffer (see cipher_into). A
+ *        call with a NULL outData sets *outData_len to
+ *        inData_len + 8.
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_keywrap_3394nopad_encrypt_into(kmyth_cipher_ctx * cipher_ctx,
+                                       unsigned char *key,
+                                       size_t key_len,
+                                       unsigned char *inData,
+                                       size_t inData_len,
+                                       unsigned char *outData,
+                                       size_t * outData_len);
+
+/**
+ * @brief Same as aes_keywrap_3394nopad_decrypt_with_ctx(), but writes the
+ *        plaintext into a caller-provided buffer (see cipher_into). A call
+ *        with a NULL outData sets *outData_len to
+ *        inData_len (the plaintext itself is eight bytes shorter, but OpenSSL
+ *        may write up to the input length into outData).
+ *        If the input does not unwrap, outData is cleared.
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_keywrap_3394nopad_decrypt_into(kmyth_cipher_ctx * cipher_ctx,
+                                       unsigned char *key,
+                                       size_t key_len,
+                                       unsigned char *inData,
+                                       size_t inData_len,
+                                       unsigned char *outData,
+                                       size_t * outData_len);
+
 #endif
@@ -9,6 +9,8 @@
 
 #include <stdlib.h>
 
+#include "cipher/cipher.h"
+
 /// @brief Upper limit on size of input data to be encrypted (4 GB).
 #define AES_KEYWRAP_5649PAD_MAX_DATA_LEN 0x100000000
 
@@ -70,4 +72,74 @@ int aes_keywrap_5649pad_decrypt(unsigned char *key,
                                 size_t inData_len, unsigned char **outData,
                                 size_t * outData_len);
 
+/**
+ * @brief Same as aes_keywrap_5649pad_encrypt(), but draws the OpenSSL cipher
+ *        context from a caller supplied pool, so that repeated calls
+ *        (e.g., in a batch key wrapping loop) reuse it. The remaining
+ *        parameters are the same as for aes_keywrap_5649pad_encrypt().
+ *
+ * @param[in]  cipher_ctx  Context pool (NULL for a single-use context)
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_keywrap_5649pad_encrypt_with_ctx(kmyth_cipher_ctx * cipher_ctx,
+                                         unsigned char *key,
+                                         size_t key_len,
+                                         unsigned char *inData,
+                                         size_t inData_len,
+                                         unsigned char **outData,
+                                         size_t * outData_len);
+
+/**
+ * @brief Same as aes_keywrap_5649pad_decrypt(), but draws the OpenSSL cipher
+ *        context from a caller supplied pool, so that repeated calls
+ *        (e.g., in a batch key wrapping loop) reuse it. The remaining
+ *        parameters are the same as for aes_keywrap_5649pad_decrypt().
+ *
+ * @param[in]  cipher_ctx  Context pool (NULL for a single-use context)
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_keywrap_5649pad_decrypt_with_ctx(kmyth_cipher_ctx * cipher_ctx,
+                                         unsigned char *key,
+                                         size_t key_len,
+                                         unsigned char *inData,
+                                         size_t inData_len,
+                                         unsigned char **outData,
+                                         size_t * outData_len);
+
+/**
+ * @brief Same as aes_keywrap_5649pad_encrypt_with_ctx(), but writes the
+ *        wrapped output into a caller-provided buffer (see cipher_into). A
+ *        call with a NULL outData sets *outData_len to
+ *        the input length rounded up to a multiple of eight, plus eight.
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_keywrap_5649pad_encrypt_into(kmyth_cipher_ctx * cipher_ctx,
+                                     unsigned char *key,
+                                     size_t key_len,
+                                     unsigned char *inData,
+                                     size_t inData_len,
+                                     unsigned char *outData,
+                                     size_t * outData_len);
+
+/**
+ * @brief Same as aes_keywrap_5649pad_decrypt_with_ctx(), but writes the
+ *        plaintext into a caller-provided buffer (see cipher_into). A call
+ *        with a NULL outData sets *outData_len to
+ *        inData_len (the plaintext is at most this long, its actual
+ *        length is only known once the input is unwrapped).
+ *        If the input does not unwrap, outData is cleared.
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_keywrap_5649pad_decrypt_into(kmyth_cipher_ctx * cipher_ctx,
+                                     unsigned char *key,
+                                     size_t key_len,
+                                     unsigned char *inData,
+                                     size_t inData_len,
+                                     unsigned char *outData,
+                                     size_t * outData_len);
+
 #endif
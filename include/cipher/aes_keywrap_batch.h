@@ -0,0 +1,111 @@
+/**
+ * @file  aes_keywrap_batch.h
+ *
+ * @brief Provides batch AES Key Wrap (RFC 3394) and AES Key Wrap with
+ *        Padding (RFC 5649) for kmyth.
+ *
+ * The batch functions wrap (or unwrap) a set of inputs under a single key.
+ * Rather than running each key wrap to completion in turn, they advance a
+ * group of inputs together, one wrapping step at a time, so that each step
+ * is a single multi-block AES-ECB operation. The AES block operations of
+ * one key wrap depend on each other, but those of different inputs do not,
+ * so this keeps the AES-NI (or other hardware AES) pipeline full. The
+ * results are identical to those of the single-input functions.
+ */
+#ifndef AES_KEYWRAP_BATCH_H
+#define AES_KEYWRAP_BATCH_H
+
+#include <stdlib.h>
+
+#include "cipher/cipher.h"
+
+/// Number of inputs advanced together by the batch key wrap functions.
+#define AES_KEYWRAP_BATCH_LANES 64
+
+/**
+ * @brief Wraps a batch of inputs using AES key wrap without padding
+ *        (RFC 3394), producing the same results as
+ *        aes_keywrap_3394nopad_encrypt() would for each input.
+ *
+ * @param[in]  cipher_ctx  Context pool to draw the OpenSSL AES context from
+ *                         (NULL for a single-use context)
+ *
+ * @param[in]  key         The hex bytes containing the key
+ *
+ * @param[in]  key_len     The length (in bytes) of the AES key
+ *                         (must be 16, 24, or 32)
+ *
+ * @param[in]  count       Number of inputs in the batch
+ *
+ * @param[in]  inData      Array (of count) plaintext input buffers
+ *
+ * @param[in]  inData_len  Array (of count) plaintext input lengths
+ *
+ * @param[out] outData     Array (of count) to hold the output ciphertext
+ *                         buffers (NULL for any input that failed)
+ *
+ * @param[out] outData_len Array (of count) to hold the output lengths
+ *
+ * @param[out] status      Array (of count) to hold the per-input result
+ *                         (0 on success, 1 on error)
+ *
+ * @return 0 if every input was processed successfully, 1 otherwise
+ */
+int aes_keywrap_3394nopad_encrypt_batch(kmyth_cipher_ctx * cipher_ctx,
+                                        unsigned char *key,
+                                        size_t key_len,
+                                        size_t count,
+                                        unsigned char **inData,
+                                        size_t * inData_len,
+                                        unsigned char **outData,
+                                        size_t * outData_len, int *status);
+
+/**
+ * @brief Unwraps a batch of inputs using AES key unwrap without padding
+ *        (RFC 3394). Parameters are as for
+ *        aes_keywrap_3394nopad_encrypt_batch().
+ *
+ * @return 0 if every input was processed successfully, 1 otherwise
+ */
+int aes_keywrap_3394nopad_decrypt_batch(kmyth_cipher_ctx * cipher_ctx,
+                                        unsigned char *key,
+                                        size_t key_len,
+                                        size_t count,
+                                        unsigned char **inData,
+                                        size_t * inData_len,
+                                        unsigned char **outData,
+                                        size_t * outData_len, int *status);
+
+/**
+ * @brief Wraps a batch of inputs using AES key wrap with padding
+ *        (RFC 5649). Parameters are as for
+ *        aes_keywrap_3394nopad_encrypt_batch().
+ *
+ * @return 0 if every input was processed successfully, 1 otherwise
+ */
+int aes_keywrap_5649pad_encrypt_batch(kmyth_cipher_ctx * cipher_ctx,
+                                      unsigned char *key,
+                                      size_t key_len,
+                                      size_t count,
+                                      unsigned char **inData,
+                                      size_t * inData_len,
+                                      unsigned char **outData,
+                                      size_t * outData_len, int *status);
+
+/**
+ * @brief Unwraps a batch of inputs using AES key unwrap with padding
+ *        (RFC 5649). Parameters are as for
+ *        aes_keywrap_3394nopad_encrypt_batch().
+ *
+ * @return 0 if every input was processed successfully, 1 otherwise
+ */
+int aes_keywrap_5649pad_decrypt_batch(kmyth_cipher_ctx * cipher_ctx,
+                                      unsigned char *key,
+                                      size_t key_len,
+                                      size_t count,
+                                      unsigned char **inData,
+                                      size_t * inData_len,
+                                      unsigned char **outData,
+                                      size_t * outData_len, int *status);
+
+#endif
@@ -9,10 +9,17 @@
 #define CIPHER_H
 
 #include <stddef.h>
+#include <stdio.h>
+
+#include <openssl/evp.h>
 
 // default cipher option used if the user does not specify symmetric cipher
 #define KMYTH_DEFAULT_CIPHER "AES/GCM/NoPadding/256"
 
+// default cipher option used when sealing a stream (the cipher must be
+// able to encrypt incrementally, see encrypt_stream_fn)
+#define KMYTH_DEFAULT_STREAM_CIPHER "AES/GCM-Stream/NoPadding/256"
+
 /**
  * All data encryption methods must be implemented with encrypt/decrypt
  * functions matching this declaration.
@@ -45,6 +52,175 @@ typedef int (*cipher) (unsigned char *key,
                        size_t inData_len,
                        unsigned char **outData, size_t * outData_len);
 
+/**
+ * kmyth_cipher_ctx:
+ *
+ * A pool of initialized OpenSSL cipher contexts, holding (at most) one
+ * context per cipher algorithm, key size, and direction. Passing a pool to
+ * the *_with_ctx() cipher functions lets a loop that encrypts or decrypts
+ * many inputs (e.g., wrapping a batch of keys) skip the per-call context
+ * allocation and cipher setup. A pool may only be used by one thread at a
+ * time. Pooled contexts retain the most recent key schedule until reused
+ * or until the pool is released with kmyth_cipher_ctx_free().
+ */
+typedef struct kmyth_cipher_ctx kmyth_cipher_ctx;
+
+/**
+ * Encrypt/decrypt functions that can reuse the cipher contexts held in a
+ * kmyth_cipher_ctx pool match this declaration. The parameters following
+ * cipher_ctx are the same as those of the cipher function type above.
+ *
+ * @param[in]  cipher_ctx  Context pool to draw an OpenSSL cipher context
+ *                         from (NULL to use a single-use context)
+ *
+ * @return 0 on success, 1 on error.
+ */
+typedef int (*cipher_with_ctx) (kmyth_cipher_ctx * cipher_ctx,
+                                unsigned char *key,
+                                size_t key_len,
+                                unsigned char *inData,
+                                size_t inData_len,
+                                unsigned char **outData,
+                                size_t * outData_len);
+
+/**
+ * Encrypt/decrypt functions that write into a caller-provided output buffer
+ * match this declaration. As with OpenSSL's one-shot functions, a call with
+ * a NULL outData is a length query: only the input length (and, where the
+ * output length depends on it, the input's header) is checked, no key is
+ * needed, and *outData_len is set to the largest output the call can
+ * produce. The parameters before outData are the same as those of the
+ * cipher_with_ctx type above.
+ * @param[out]    outData     Output buffer (NULL to query the output length)
+ * @param[in,out] outData_len On input, the size of outData (ignored for a
+ *                            query). On output, the number of bytes written
+ *                            (or, for a query, the maximum output length).
+ * @return 0 on success, 1 on error (including an outData that is too small)
+ */
+typedef int (*cipher_into) (kmyth_cipher_ctx * cipher_ctx,
+                            unsigned char *key,
+                            size_t key_len,
+                            unsigned char *inData,
+                            size_t inData_len,
+                            unsigned char *outData, size_t * outData_len);
+
+/**
+ * Decrypt functions that overwrite their input with the plaintext match this
+ * declaration. The plaintext is only left in the buffer once the input has
+ * been authenticated; on error the buffer holds no plaintext, but its
+ * original contents are lost.
+ *
+ * @param[in]     cipher_ctx    Context pool (NULL for a single-use context)
+ *
+ * @param[in]     key           The key bytes
+ *
+ * @param[in]     key_len       The length of the key in bytes
+ *
+ * @param[in,out] data          The input ciphertext, replaced by the output
+ *                              plaintext (starting at data[0])
+ *
+ * @param[in]     data_len      The length of the input in bytes
+ *
+ * @param[out]    plaintext_len The length of the output plaintext in bytes
+ *
+ * @return 0 on success, 1 on error.
+ */
+typedef int (*cipher_in_place) (kmyth_cipher_ctx * cipher_ctx,
+                                unsigned char *key,
+                                size_t key_len,
+                                unsigned char *data,
+                                size_t data_len, size_t * plaintext_len);
+
+/**
+ * Decrypt functions that recover a byte range of the plaintext, without
+ * decrypting (or authenticating) the parts of the input that lie outside
+ * of it, match this declaration.
+ *
+ * @param[in]  cipher_ctx  Context pool (NULL for a single-use context)
+ *
+ * @param[in]  key         The key bytes
+ *
+ * @param[in]  key_len     The length of the key in bytes
+ *
+ * @param[in]  inData      The input ciphertext
+ *
+ * @param[in]  inData_len  The length of the input in bytes
+ *
+ * @param[in]  offset      Offset, in bytes, of the range in the plaintext
+ *
+ * @param[out] outData     Output buffer for the range
+ *
+ * @param[in]  outData_len The length of the range (and of outData) in bytes
+ *
+ * @return 0 on success, 1 on error (including a range that extends past
+ *         the end of the plaintext)
+ */
+typedef int (*cipher_range) (kmyth_cipher_ctx * cipher_ctx,
+                             unsigned char *key,
+                             size_t key_len,
+                             unsigned char *inData,
+                             size_t inData_len,
+                             size_t offset,
+                             unsigned char *outData, size_t outData_len);
+
+/**
+ * Batch encrypt/decrypt functions, which process a set of inputs under a
+ * single key (reusing its key schedule), match this declaration.
+ *
+ * @param[in]  cipher_ctx  Context pool to draw an OpenSSL cipher context
+ *                         from (NULL to use a single-use context)
+ *
+ * @param[in]  key         The hex bytes containing the key -
+ *                         pass in pointer to key buffer
+ *
+ * @param[in]  key_len     The length of the key in bytes
+ *
+ * @param[in]  count       The number of inputs
+ *
+ * @param[in]  inData      Array (of count) input data buffers
+ *
+ * @param[in]  inData_len  Array (of count) input data lengths
+ *
+ * @param[out] outData     Array (of count) to receive the output data
+ *                         buffers (NULL for any input that failed)
+ *
+ * @param[out] outData_len Array (of count) to receive the output lengths
+ *
+ * @param[out] status      Array (of count) to receive the result for each
+ *                         input (0 on success, 1 on error)
+ *
+ * @return 0 if every input was processed successfully, 1 otherwise.
+ */
+typedef int (*cipher_batch) (kmyth_cipher_ctx * cipher_ctx,
+                             unsigned char *key,
+                             size_t key_len,
+                             size_t count,
+                             unsigned char **inData,
+                             size_t * inData_len,
+                             unsigned char **outData,
+                             size_t * outData_len, int *status);
+
+/**
+ * Stream encrypt/decrypt functions, which process everything readable from
+ * an input stream without holding all of it in memory, match this
+ * declaration. The ciphertext must be self-delimiting (its end must be
+ * authenticated), as it is read until EOF.
+ *
+ * @param[in]  key         The hex bytes containing the key -
+ *                         pass in pointer to key buffer
+ *
+ * @param[in]  key_len     The length of the key in bytes
+ *
+ * @param[in]  in          Stream the input is read from (to EOF)
+ *
+ * @param[in]  out         Stream the output is written to
+ *
+ * @return 0 on success, 1 on error (on error, output already written to
+ *         out must be discarded)
+ */
+typedef int (*cipher_stream) (unsigned char *key,
+                              size_t key_len, FILE * in, FILE * out);
+
 /**
  * cipher_t:
  *
@@ -64,6 +240,66 @@ typedef struct
 
   /** @brief A pointer to the appropriate decryption function. */
   cipher decrypt_fn;
+
+  /**
+   * @brief A pointer to the context reusing encryption function
+   *        (NULL if the algorithm does not support a context pool)
+   */
+  cipher_with_ctx encrypt_ctx_fn;
+
+  /**
+   * @brief A pointer to the context reusing decryption function
+   *        (NULL if the algorithm does not support a context pool)
+   */
+  cipher_with_ctx decrypt_ctx_fn;
+
+  /**
+   * @brief A pointer to the encryption function writing into a
+   *        caller-provided buffer
+   */
+  cipher_into encrypt_into_fn;
+
+  /**
+   * @brief A pointer to the decryption function writing into a
+   *        caller-provided buffer
+   */
+  cipher_into decrypt_into_fn;
+
+  /**
+   * @brief A pointer to the in-place decryption function
+   *        (NULL if the algorithm cannot decrypt in place)
+   */
+  cipher_in_place decrypt_in_place_fn;
+
+  /**
+   * @brief A pointer to the range decryption function
+   *        (NULL if the algorithm must decrypt its whole input)
+   */
+  cipher_range decrypt_range_fn;
+
+  /**
+   * @brief A pointer to the batch encryption function
+   *        (NULL if the algorithm has no batch implementation)
+   */
+  cipher_batch encrypt_batch_fn;
+
+  /**
+   * @brief A pointer to the batch decryption function
+   *        (NULL if the algorithm has no batch implementation)
+   */
+  cipher_batch decrypt_batch_fn;
+
+  /**
+   * @brief A pointer to the stream encryption function
+   *        (NULL if the algorithm cannot encrypt a stream incrementally)
+   */
+  cipher_stream encrypt_stream_fn;
+
+  /**
+   * @brief A pointer to the stream decryption function
+   *        (NULL if the algorithm cannot decrypt a stream incrementally)
+   */
+  cipher_stream decrypt_stream_fn;
 } cipher_t;
 
 /**
@@ -147,4 +383,279 @@ int kmyth_decrypt_data(unsigned char *enc_data,
                        size_t key_size,
                        unsigned char **result, size_t * result_size);
 
+/**
+ * @brief Creates an empty cipher context pool. Contexts are created on
+ *        first use by the *_with_ctx() cipher functions.
+ *
+ * @return Newly allocated pool (release with kmyth_cipher_ctx_free()),
+ *         or NULL on error
+ */
+kmyth_cipher_ctx *kmyth_cipher_ctx_new(void);
+
+/**
+ * @brief Releases a cipher context pool and all of the OpenSSL cipher
+ *        contexts (including any key material) that it holds.
+ *
+ * @param[in]  cipher_ctx    Pool to be released (NULL is ignored)
+ *
+ * @return None
+ */
+void kmyth_cipher_ctx_free(kmyth_cipher_ctx * cipher_ctx);
+
+/**
+ * @brief Gets an OpenSSL cipher context initialized (without a key or IV)
+ *        for the specified cipher and direction.
+ *
+ * @param[in]  cipher_ctx    Pool to draw the context from. If NULL, a new
+ *                           single-use context is created.
+ *
+ * @param[in]  evp_cipher    OpenSSL cipher (e.g., EVP_aes_256_gcm())
+ *
+ * @param[in]  enc           1 for encryption, 0 for decryption
+ *
+ * @return The cipher context (return it with kmyth_cipher_ctx_put()),
+ *         or NULL on error
+ */
+EVP_CIPHER_CTX *kmyth_cipher_ctx_get(kmyth_cipher_ctx * cipher_ctx,
+                                     const EVP_CIPHER * evp_cipher, int enc);
+
+/**
+ * @brief Returns an OpenSSL cipher context obtained from
+ *        kmyth_cipher_ctx_get(). Pooled contexts are kept for reuse,
+ *        single-use contexts are freed.
+ *
+ * @param[in]  cipher_ctx    Pool the context was drawn from (or NULL)
+ *
+ * @param[in]  ctx           The OpenSSL cipher context
+ *
+ * @return None
+ */
+void kmyth_cipher_ctx_put(kmyth_cipher_ctx * cipher_ctx,
+                          EVP_CIPHER_CTX * ctx);
+
+/**
+ * @brief Runs a cipher function that writes into a caller-provided buffer
+ *        (see cipher_into) with a newly allocated output buffer: the
+ *        output length is queried, a buffer of that size allocated, and
+ *        the function called to fill it. This is how the allocating
+ *        (cipher_with_ctx) form of each cipher is implemented.
+ *
+ * @param[in]  into_fn       The cipher function to run
+ *
+ * @param[in]  cipher_ctx    Context pool (NULL for single-use contexts)
+ *
+ * @param[out] outData       Newly allocated output buffer (the caller frees
+ *                           it). Left unchanged on error.
+ *
+ * @param[out] outData_len   Number of output bytes. Left unchanged on error.
+ *
+ * The remaining parameters are passed through to into_fn.
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_cipher_into_alloc(cipher_into into_fn,
+                            kmyth_cipher_ctx * cipher_ctx,
+                            unsigned char *key,
+                            size_t key_len,
+                            unsigned char *inData,
+                            size_t inData_len,
+                            unsigned char **outData, size_t * outData_len);
+
+/**
+ * @brief Same as kmyth_encrypt_data(), but reuses the OpenSSL cipher
+ *        contexts held in the specified pool when the cipher supports it.
+ *
+ * @param[in]  cipher_ctx    Context pool (NULL behaves as
+ *                           kmyth_encrypt_data())
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_encrypt_data_with_ctx(kmyth_cipher_ctx * cipher_ctx,
+                                unsigned char *data,
+                                size_t data_size,
+                                cipher_t enc_cipher,
+                                unsigned char **enc_data,
+                                size_t * enc_data_size,
+                                unsigned char **enc_key,
+                                size_t * enc_key_size);
+
+/**
+ * @brief Same as kmyth_decrypt_data(), but reuses the OpenSSL cipher
+ *        contexts held in the specified pool when the cipher supports it.
+ *
+ * @param[in]  cipher_ctx    Context pool (NULL behaves as
+ *                           kmyth_decrypt_data())
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_decrypt_data_with_ctx(kmyth_cipher_ctx * cipher_ctx,
+                                unsigned char *enc_data,
+                                size_t enc_data_size,
+                                cipher_t cipher_spec,
+                                unsigned char *key,
+                                size_t key_size,
+                                unsigned char **result,
+                                size_t * result_size);
+
+/**
+ * @brief Same as kmyth_encrypt_data_with_ctx(), but writes the encrypted
+ *        result into a caller-provided buffer (e.g., a slot in a larger
+ *        output, or memory the caller reuses) instead of allocating it.
+ *
+ * @param[in]     enc_data      Output buffer. If NULL, no key is generated
+ *                              and enc_data_size is set to the size of the
+ *                              buffer needed for data_size input bytes.
+ *
+ * @param[in,out] enc_data_size On input, the size of enc_data. On output,
+ *                              the number of bytes written (or the size
+ *                              needed, for a length query).
+ *
+ * The remaining parameters are the same as for kmyth_encrypt_data().
+ *
+ * @return 0 on success, 1 on error (including a buffer that is too small)
+ */
+int kmyth_encrypt_data_into(kmyth_cipher_ctx * cipher_ctx,
+                            unsigned char *data,
+                            size_t data_size,
+                            cipher_t enc_cipher,
+                            unsigned char *enc_data,
+                            size_t * enc_data_size,
+                            unsigned char **enc_key, size_t * enc_key_size);
+
+/**
+ * @brief Same as kmyth_decrypt_data_with_ctx(), but writes the decrypted
+ *        result into a caller-provided buffer (e.g., locked memory from
+ *        kmyth_secure_alloc()) instead of allocating it.
+ *
+ * @param[in]     result        Output buffer. If NULL, result_size is set to
+ *                              the largest plaintext enc_data can decrypt to
+ *                              (no key is needed for this query).
+ *
+ * @param[in,out] result_size   On input, the size of result. On output, the
+ *                              number of bytes written (or the size needed,
+ *                              for a length query).
+ *
+ * The remaining parameters are the same as for kmyth_decrypt_data(). If
+ * decryption fails, result is cleared.
+ *
+ * @return 0 on success, 1 on error (including a buffer that is too small)
+ */
+int kmyth_decrypt_data_into(kmyth_cipher_ctx * cipher_ctx,
+                            unsigned char *enc_data,
+                            size_t enc_data_size,
+                            cipher_t cipher_spec,
+                            unsigned char *key,
+                            size_t key_size,
+                            unsigned char *result, size_t * result_size);
+
+/**
+ * @brief Same as kmyth_decrypt_data_with_ctx(), but decrypts enc_data in
+ *        place (see cipher_in_place) instead of into a new buffer, halving
+ *        the memory needed to decrypt a large input. Only ciphers with a
+ *        decrypt_in_place_fn support this.
+ *
+ * @param[in,out] enc_data      Input ciphertext, replaced by the plaintext
+ *
+ * @param[out]    result_size   Size, in bytes, of the plaintext now at the
+ *                              start of enc_data
+ *
+ * The remaining parameters are the same as for kmyth_decrypt_data().
+ *
+ * @return 0 on success, 1 on error (including an unsupported cipher)
+ */
+int kmyth_decrypt_data_in_place(kmyth_cipher_ctx * cipher_ctx,
+                                unsigned char *enc_data,
+                                size_t enc_data_size,
+                                cipher_t cipher_spec,
+                                unsigned char *key,
+                                size_t key_size, size_t * result_size);
+
+/**
+ * @brief Decrypts the byte range [offset, offset + result_size) of the
+ *        plaintext of enc_data into a caller-provided buffer. Ciphers with
+ *        a decrypt_range_fn (the segmented AES/GCM-Stream ciphers) only
+ *        decrypt the parts of enc_data covering the range; for the others,
+ *        the whole input is decrypted into a temporary (locked) buffer and
+ *        the range copied from it.
+ *
+ * @param[in]  offset           Offset, in bytes, of the range in the
+ *                              plaintext
+ *
+ * @param[out] result           Output buffer for the range
+ *
+ * @param[in]  result_size      Size, in bytes, of the range (and of result)
+ *
+ * The remaining parameters are the same as for kmyth_decrypt_data(). If
+ * decryption fails, result is cleared.
+ *
+ * @return 0 on success, 1 on error (including a range that extends past
+ *         the end of the plaintext)
+ */
+int kmyth_decrypt_data_range(kmyth_cipher_ctx * cipher_ctx,
+                             unsigned char *enc_data,
+                             size_t enc_data_size,
+                             cipher_t cipher_spec,
+                             unsigned char *key,
+                             size_t key_size,
+                             size_t offset,
+                             unsigned char *result, size_t result_size);
+
+/**
+ * @brief Encrypts a batch of inputs under a single, caller supplied key
+ *        (e.g., to re-wrap a set of keys under one key encryption key).
+ *        Ciphers with a batch implementation reuse one key schedule and
+ *        OpenSSL context for the whole batch; for the others, each input
+ *        is encrypted in turn.
+ *
+ * @param[in]  cipher_ctx     Context pool (NULL for single-use contexts)
+ *
+ * @param[in]  count          Number of inputs
+ *
+ * @param[in]  data           Array (of count) plaintext input buffers
+ *
+ * @param[in]  data_sizes     Array (of count) plaintext input sizes
+ *
+ * @param[in]  cipher_spec    Struct (cipher_t) specifying cipher to use
+ *
+ * @param[in]  key            Encryption key
+ *
+ * @param[in]  key_size       Size, in bytes, of the key
+ *
+ * @param[out] enc_data       Array (of count) to receive the ciphertext
+ *                            buffers (NULL for any input that failed)
+ *
+ * @param[out] enc_data_sizes Array (of count) to receive ciphertext sizes
+ *
+ * @param[out] status         Array (of count) to receive the per-input
+ *                            result (0 on success, 1 on error)
+ *
+ * @return 0 if every input was encrypted, 1 otherwise
+ */
+int kmyth_encrypt_data_batch(kmyth_cipher_ctx * cipher_ctx,
+                             size_t count,
+                             unsigned char **data,
+                             size_t * data_sizes,
+                             cipher_t cipher_spec,
+                             unsigned char *key,
+                             size_t key_size,
+                             unsigned char **enc_data,
+                             size_t * enc_data_sizes, int *status);
+
+/**
+ * @brief Decrypts a batch of inputs encrypted under a single key.
+ *        Parameters are as for kmyth_encrypt_data_batch(), with the
+ *        ciphertexts as input and the plaintexts as output.
+ *
+ * @return 0 if every input was decrypted, 1 otherwise
+ */
+int kmyth_decrypt_data_batch(kmyth_cipher_ctx * cipher_ctx,
+                             size_t count,
+                             unsigned char **enc_data,
+                             size_t * enc_data_sizes,
+                             cipher_t cipher_spec,
+                             unsigned char *key,
+                             size_t key_size,
+                             unsigned char **result,
+                             size_t * result_sizes, int *status);
+
 #endif /* CIPHER_H */
@@ -0,0 +1,49 @@
+/**
+ * @file  random_pool.h
+ *
+ * @brief Provides the per-thread random pool from which kmyth draws its
+ *        nonces, IVs and salts.
+ *
+ * Each thread keeps a block of RANDOM_POOL_BLOCK_LEN bytes generated by one
+ * call to the OpenSSL DRBG (itself a per-thread instance, reseeded from the
+ * primary DRBG), and hands out the small values it needs from that block,
+ * so that a batch of seals makes one DRBG call per block rather than several
+ * per file. Bytes are cleared from the block as they are handed out, so no
+ * value is ever handed out twice, and a child process discards the blocks
+ * it inherits across fork().
+ *
+ * The pool is meant for values that are not secret (they are stored or
+ * sent in the clear alongside the data they protect). Keys are generated
+ * directly from the OpenSSL private DRBG (RAND_priv_bytes()) instead, so
+ * that no key material sits in a pool waiting to be used.
+ */
+#ifndef RANDOM_POOL_H
+#define RANDOM_POOL_H
+
+#include <stddef.h>
+
+/// Number of random bytes generated at a time into each thread's pool.
+#define RANDOM_POOL_BLOCK_LEN 4096
+
+/// Largest request served from the pool (larger ones go to the DRBG).
+#define RANDOM_POOL_MAX_REQUEST 256
+
+/**
+ * @brief Fills a buffer with random bytes from the calling thread's pool,
+ *        refilling the pool from the OpenSSL DRBG when it runs out.
+ *
+ * @param[out] buf  Buffer to fill
+ *
+ * @param[in]  len  Number of random bytes wanted
+ *
+ * @return 0 on success, 1 on error
+ */
+int random_pool_bytes(unsigned char *buf, size_t len);
+
+/**
+ * @brief Clears and discards the calling thread's pool, so that the next
+ *        request is served from a freshly generated block.
+ */
+void random_pool_discard(void);
+
+#endif
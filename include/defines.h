@@ -169,7 +169,10 @@
  * According to section 19.6.9 in Part 1 of the TPM 2.0 specification
  * (as of version 1.46, dated 17 November 2017), the symmetric algorithm
  * for parameter encryption/decryption using an unbound and unsalted session
- * is typically TPM2_ALG_NULL. This is how Kmyth is currently configured.
+ * is typically TPM2_ALG_NULL. This is how Kmyth is configured by default.
+ * When parameter encryption is enabled (see KMYTH_TPM_PARAM_ENC_ENV), Kmyth
+ * instead uses a session salted to the SRK, with TPM2_ALG_AES and the key
+ * length and mode below.
  *
  * @brief Kmyth symmetric algorithm for parameter encryption selection
  */
@@ -304,8 +307,279 @@
 #define KMYTH_KDF TPM2_ALG_KDF1_SP800_108
 
 /**
- * @brief kmyth-getkey receive buffer size (in bytes)
+ * A Kmyth TPM context (see kmyth.h) keeps the storage keys (SKs) it loads
+ * to unseal .ski files resident in the TPM, so that .ski files sharing an
+ * SK (e.g., created by the same seal batch) do not each pay for a TPM2_Load
+ * of the SK. When the cache is full the least recently used SK is flushed.
+ *
+ * Each cached SK occupies a transient object slot for the life of the
+ * context, so this should stay well below the resource manager's
+ * per-connection transient object limit.
+ *
+ * @brief Kmyth TPM context storage key cache size (number of SKs)
+ */
+#define KMYTH_SK_CACHE_SIZE 4
+
+/**
+ * Before a storage key (SK) is flushed from a Kmyth TPM context's cache,
+ * its TPM context is saved (TPM2_ContextSave), so that if it is needed
+ * again it is restored with a TPM2_ContextLoad, which skips the integrity
+ * check and decryption of the private area that a TPM2_Load repeats. Saved
+ * contexts occupy no TPM slot, so many more SKs can be kept this way than
+ * stay loaded. When this cache is full the least recently used one is
+ * dropped.
+ *
+ * @brief Kmyth TPM context saved storage key context cache size
+ */
+#define KMYTH_SK_SAVED_CACHE_SIZE 32
+
+/**
+ * A PCR snapshot (see pcrs.h) holds the values of the selected PCRs, read
+ * in as few TPM2_PCR_Read() commands as the TPM allows, so that they can be
+ * reused (e.g., by every seal in a batch) for as long as the TPM's PCR
+ * update counter is unchanged.
+ *
+ * @brief Maximum number of PCR values held in a PCR snapshot
+ */
+#define KMYTH_PCR_SNAPSHOT_MAX 64
+
+/**
+ * Data sealed into an NV index (see nv_tools.h) is stored in the first free
+ * index of this range, unless an index is specified. The range is the start
+ * of the one the TCG handle registry reserves for indices defined by the
+ * platform owner.
+ *
+ * @brief First and last NV index handles Kmyth allocates from
+ */
+#define KMYTH_NV_INDEX_FIRST 0x01800000
+#define KMYTH_NV_INDEX_LAST 0x0180FFFF
+
+/**
+ * Jobs submitted to a TPM job queue (see kmyth_tpm_queue_open()) are run by
+ * its worker threads on one shared TPM context. The context serializes the
+ * TPM commands of the workers, so with more than one worker the encryption
+ * and (un)marshalling of one job overlap the TPM commands of another.
+ *
+ * @brief Default (and maximum) number of TPM job queue worker threads
+ */
+#define KMYTH_TPM_QUEUE_WORKERS 2
+#define KMYTH_TPM_QUEUE_MAX_WORKERS 64
+
+/**
+ * get_srk_handle() first looks for the SRK at the persistent handle it is
+ * configured with (see set_srk_handle()), or else at the handle recorded in
+ * a state file when the SRK was last found, and only lists and checks every
+ * persistent object when the SRK is not there. The recorded handle is only
+ * a hint: it is checked against the SRK criteria before it is used. The
+ * state file is written if its directory exists.
+ *
+ * @brief Default path of the file recording the SRK's persistent handle
+ */
+#define KMYTH_SRK_STATE_FILE "/var/lib/kmyth/srk_handle"
+
+/**
+ * @brief Environment variable configuring the SRK's persistent handle
+ *        (e.g., 0x81000001), when set_srk_handle() has not been called
+ */
+#define KMYTH_SRK_HANDLE_ENV "KMYTH_SRK_HANDLE"
+
+/**
+ * @brief Environment variable overriding KMYTH_SRK_STATE_FILE (an empty
+ *        value disables the state file), when set_srk_state_file() has not
+ *        been called
+ */
+#define KMYTH_SRK_STATE_FILE_ENV "KMYTH_SRK_STATE_FILE"
+
+/**
+ * The Kmyth tools read default command line options from a configuration
+ * file (see config_file.h), in sections that apply to every tool, to one
+ * tool, or to a profile selected with KMYTH_PROFILE_ENV. The file is
+ * optional.
+ *
+ * @brief Default path of the Kmyth configuration file
+ */
+#define KMYTH_CONFIG_FILE "/etc/kmyth/kmyth.conf"
+
+/**
+ * @brief Environment variable overriding KMYTH_CONFIG_FILE (an empty value
+ *        disables the configuration file)
+ */
+#define KMYTH_CONFIG_FILE_ENV "KMYTH_CONFIG"
+
+/**
+ * @brief Environment variable naming the configuration file profile (the
+ *        section whose settings are applied after the [default] and tool
+ *        sections) used by the Kmyth tools
+ */
+#define KMYTH_PROFILE_ENV "KMYTH_PROFILE"
+
+/**
+ * @brief Environment variable selecting the TCTI (the transport to the TPM)
+ *        when set_tcti_config() has not been called, as a Tss2_TctiLdr
+ *        configuration string (e.g., "device:/dev/tpmrm0"). Kmyth connects
+ *        through tpm2-abrmd if it is not set.
+ */
+#define KMYTH_TCTI_ENV "KMYTH_TCTI"
+
+/**
+ * @brief TPM device opened by the boot build of kmyth-unseal
+ *        (kmyth-unseal-boot) when no TCTI is configured: the kernel
+ *        resource manager, as tpm2-abrmd is not running that early
+ */
+#define KMYTH_BOOT_TPM_DEVICE "/dev/tpmrm0"
+
+/**
+ * @brief Environment variable enabling TPM parameter encryption (any value
+ *        other than empty or "0"): the sensitive data sealed into, and
+ *        unsealed from, the TPM is AES CFB encrypted on its way to and from
+ *        the TPM, under a policy session salted to the SRK
+ */
+#define KMYTH_TPM_PARAM_ENC_ENV "KMYTH_TPM_PARAM_ENC"
+
+/**
+ * @brief Environment variable enabling the PCR policy pre-flight check of
+ *        unseal operations (any value other than empty or "0"): an unseal
+ *        whose policy the current PCR values cannot satisfy fails before
+ *        any TPM object is loaded or policy session started
+ */
+#define KMYTH_TPM_PREFLIGHT_ENV "KMYTH_TPM_PREFLIGHT"
+
+/**
+ * @brief Environment variable limiting the instruction set extensions that
+ *        Kmyth's vectorized kernels may use, read when libkmyth-utils is
+ *        loaded: one of the levels accepted by kmyth_cpu_set_limit() (e.g.,
+ *        "scalar" or "avx2")
+ */
+#define KMYTH_CPU_FEATURES_ENV "KMYTH_CPU_FEATURES"
+
+/**
+ * @brief Environment variable turning off io_uring for the batched file
+ *        reads and writes of bulk operations ("0"), read when they are
+ *        first used: files are then read and written one at a time
+ */
+#define KMYTH_IO_URING_ENV "KMYTH_IO_URING"
+
+/**
+ * @brief Environment variable selecting how large buffers are backed by
+ *        huge pages ("off", "transparent" or "explicit", see
+ *        kmyth_set_huge_pages()), read when they are first allocated
+ */
+#define KMYTH_HUGE_PAGES_ENV "KMYTH_HUGE_PAGES"
+
+/**
+ * @brief Largest input file (in bytes) of a bulk seal (-m or -d) that is
+ *        read, and whose .ski is written, in a batch with other inputs:
+ *        larger inputs are mapped and written one at a time, so that a
+ *        batch's memory use stays bounded
+ */
+#define KMYTH_BATCH_IO_MAX_INPUT_SIZE (1024 * 1024)
+
+/**
+ * A low level keeps compression (a few hundred MB/s per core) from
+ * becoming the slowest stage of a seal, while still shrinking typical
+ * configuration files and database dumps several times over.
+ *
+ * @brief zstd compression level used for data compressed before sealing
+ */
+#define KMYTH_ZSTD_LEVEL 3
+
+/**
+ * @brief kmyth-getkey receive buffer size (in bytes) for keys from a
+ *        'simple' key server: the largest TLS record plaintext, so a key
+ *        sent in one record is always received whole
+ */
+#define KMYTH_GETKEY_RX_BUFFER_SIZE 16384
+
+/**
+ * @brief Largest KMIP message (in bytes) kmyth-getkey accepts from a KMIP
+ *        server (large enough for a full batch of KMIP Get responses)
+ */
+#define KMYTH_KMIP_MAX_MESSAGE_SIZE 65536
+
+/**
+ * @brief Default time (in milliseconds) allowed for a TCP connection to a
+ *        server to be made, over all of its addresses
+ */
+#define KMYTH_CONNECT_TIMEOUT_MS 10000
+
+/**
+ * @brief Default time (in milliseconds) allowed for a TLS handshake with a
+ *        server, once connected
+ */
+#define KMYTH_HANDSHAKE_TIMEOUT_MS 10000
+
+/**
+ * While connecting, a new attempt (to the next address, or the next server)
+ * is started whenever the attempts already started have been pending this
+ * long, and the first to connect is used ("happy eyeballs", RFC 8305).
+ *
+ * @brief Delay (in milliseconds) between staggered connection attempts
+ */
+#define KMYTH_CONNECT_ATTEMPT_DELAY_MS 250
+
+/**
+ * @brief Largest number of server endpoints raced in one connection
+ */
+#define KMYTH_MAX_SERVER_ENDPOINTS 8
+
+/**
+ * @brief Default path of the kmyth-unsealerd local (AF_UNIX) socket
+ */
+#define KMYTH_UNSEALERD_SOCKET_PATH "/run/kmyth/unsealerd.sock"
+
+/**
+ * @brief Environment variable holding the number of the file descriptor
+ *        through which kmyth-unseal -F passes the unsealed data to the
+ *        command it runs
+ */
+#define KMYTH_SECRET_FD_ENV "KMYTH_SECRET_FD"
+
+/**
+ * @brief Environment variable holding the size (in bytes) of the unsealed
+ *        data kmyth-unseal -F passes to the command it runs
+ */
+#define KMYTH_SECRET_SIZE_ENV "KMYTH_SECRET_SIZE"
+
+/**
+ * @brief Default number of kmyth-unsealerd worker threads (connections
+ *        served at once)
+ */
+#define KMYTH_UNSEALERD_WORKERS 4
+
+/**
+ * A kmyth-unsealerd connection that is idle (or stalls in the middle of a
+ * message) for this long is dropped, so a slow or stuck client cannot hold
+ * a worker.
+ *
+ * @brief kmyth-unsealerd socket send/receive timeout (in seconds)
+ */
+#define KMYTH_UNSEALERD_IO_TIMEOUT 10
+
+/**
+ * @brief Largest kmyth-unsealerd message body (in bytes) that is accepted
+ */
+#define KMYTH_UNSEALERD_MAX_MESSAGE_SIZE (64 * 1024 * 1024)
+
+/**
+ * kmyth-unsealerd keeps the data it unseals in a cache (held in locked
+ * memory), so repeated requests for the same .ski file and authorization
+ * string are answered without touching the TPM. The cache is bounded in
+ * size, entry count, and time: an entry is served for at most the TTL
+ * after it was unsealed, so a change in PCR state (or a revoked .ski) is
+ * honored within that time.
+ *
+ * @brief kmyth-unsealerd default unsealed data cache size (in bytes)
+ */
+#define KMYTH_UNSEALERD_CACHE_SIZE (1024 * 1024)
+
+/**
+ * @brief kmyth-unsealerd unsealed data cache entry limit
+ */
+#define KMYTH_UNSEALERD_CACHE_ENTRIES 256
+
+/**
+ * @brief kmyth-unsealerd default unsealed data cache TTL (in seconds)
  */
-#define KMYTH_GETKEY_RX_BUFFER_SIZE 256
+#define KMYTH_UNSEALERD_CACHE_TTL 300
 
 #endif // DEFINES_H
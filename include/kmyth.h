@@ -8,15 +8,1035 @@
 #ifndef KMYTH_H
 #define KMYTH_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C"
 {
 #endif
+
+/**
+ * @brief Identifies a .ski file format. kmyth-unseal accepts either format;
+ *        the format only needs to be chosen when sealing.
+ */
+  typedef enum kmyth_ski_format
+  {
+    KMYTH_SKI_FORMAT_TEXT = 0,  ///< base64 blocks between text delimiters
+    KMYTH_SKI_FORMAT_BINARY,    ///< length-prefixed binary blocks (.ski v2)
+  } kmyth_ski_format;
+
+/**
+ * @brief Identifies the algorithm of the storage key (SK) created to seal
+ *        data. kmyth-unseal accepts either, as the SK public area stored in
+ *        the .ski file records its algorithm.
+ */
+  typedef enum kmyth_sk_alg
+  {
+    KMYTH_SK_ALG_RSA = 0,       ///< RSA, KMYTH_RSA_KEY_LEN bits
+    KMYTH_SK_ALG_ECC,           ///< ECC, KMYTH_ECC_CURVE (much faster to create)
+  } kmyth_sk_alg;
+
+/**
+ * @brief Identifies the compression applied to data before it is sealed.
+ *        kmyth-unseal accepts any of them, as the .ski records the one
+ *        used (only the binary format can, so compressed data is always
+ *        sealed to a binary .ski).
+ */
+  typedef enum kmyth_compression
+  {
+    KMYTH_COMPRESSION_NONE = 0, ///< data is encrypted as it is
+    KMYTH_COMPRESSION_ZSTD,     ///< data is compressed with zstd first
+  } kmyth_compression;
+
+/**
+ * @brief Opaque handle for a reusable Kmyth TPM 2.0 context.
+ *
+ * A context holds an open connection to the TPM 2.0 resource manager
+ * (TCTI and SAPI contexts), the TPM owner (storage) hierarchy authorization,
+ * and the handle of the storage root key (SRK). Callers that seal or unseal
+ * many items can open one context, perform any number of
+ * kmyth_tpm_context_seal() and kmyth_tpm_context_unseal() calls, and then
+ * close it, so the connection setup and SRK lookup are done only once.
+ *
+ * The seal and unseal calls may be made concurrently from multiple threads
+ * on one context: their TPM commands are serialized on the shared
+ * connection, while the symmetric encryption and (un)marshalling run in
+ * parallel. Opening, closing, and setting the .ski format of a context must
+ * not run concurrently with any other call on it.
+ *
+ * Separate contexts share no TPM state, so threads that would otherwise
+ * contend on one connection can each use their own (see
+ * kmyth_tpm_context_thread()).
+ */
+  typedef struct kmyth_tpm_context kmyth_tpm_context;
+
+/**
+ * @brief Opens a reusable Kmyth TPM 2.0 context.
+ *
+ * @param[in]  owner_auth_bytes  TPM owner (storage) hierarchy password.
+ *                               EmptyAuth by default, but, if it has been
+ *                               changed (e.g., by tpm2_takeownership), user
+ *                               must provide via this parameter.
+ *
+ * @param[in]  oa_bytes_len      Number of bytes in owner_auth_bytes
+ *
+ * @param[out] ctx               Newly allocated context (passed as pointer
+ *                               to the context pointer). Must be released
+ *                               with kmyth_tpm_context_close().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_tpm_context_open(uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                             kmyth_tpm_context ** ctx);
+
+/**
+ * @brief Closes a Kmyth TPM 2.0 context, clearing any authorization data
+ *        it holds and releasing its TPM resources.
+ *
+ * @param[in/out] ctx            Context to be closed (passed as pointer to
+ *                               the context pointer). Set to NULL on return.
+ *                               A NULL context is ignored.
+ *
+ * @return None
+ */
+  void kmyth_tpm_context_close(kmyth_tpm_context ** ctx);
+
+/**
+ * @brief Returns the calling thread's Kmyth TPM 2.0 context, opening it on
+ *        first use.
+ *
+ * Each thread gets its own TPM connection, which is reused by later calls
+ * from that thread and closed automatically when the thread exits. A call
+ * with a different owner authorization than the existing context was
+ * opened with closes that context and opens a new one.
+ *
+ * @param[in]  owner_auth_bytes  TPM owner (storage) hierarchy password
+ *                               (see kmyth_tpm_context_open())
+ *
+ * @param[in]  oa_bytes_len      Number of bytes in owner_auth_bytes
+ *
+ * @param[out] ctx               The calling thread's context (passed as
+ *                               pointer to the context pointer). Owned by
+ *                               the thread - must not be passed to
+ *                               kmyth_tpm_context_close() or used after
+ *                               the thread exits.
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_tpm_context_thread(uint8_t * owner_auth_bytes,
+                               size_t oa_bytes_len, kmyth_tpm_context ** ctx);
+
+/**
+ * @brief Closes the calling thread's Kmyth TPM 2.0 context, if it has one,
+ *        before the thread exits (see kmyth_tpm_context_thread()).
+ *
+ * @return None
+ */
+  void kmyth_tpm_context_thread_close(void);
+
+/**
+ * @brief Selects the .ski format produced by subsequent seal operations on
+ *        a Kmyth TPM 2.0 context. Contexts produce KMYTH_SKI_FORMAT_TEXT
+ *        until this is called.
+ *
+ *        The binary format avoids the base64 expansion (one third) and the
+ *        encode/decode pass, so is preferable for large payloads.
+ *
+ * @param[in]  ctx               Open Kmyth TPM context
+ *                               (see kmyth_tpm_context_open())
+ *
+ * @param[in]  format            The .ski format to produce
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_tpm_context_set_ski_format(kmyth_tpm_context * ctx,
+                                       kmyth_ski_format format);
+
+/**
+ * @brief Selects the algorithm of the storage keys (SKs) created by
+ *        subsequent seal operations on a Kmyth TPM 2.0 context. Contexts
+ *        create KMYTH_KEY_PUBKEY_ALG (RSA) SKs until this is called.
+ *
+ *        TPM RSA key generation can take seconds, while ECC key generation
+ *        typically takes tens of milliseconds, so ECC SKs make sealing
+ *        much faster.
+ *
+ * @param[in]  ctx               Open Kmyth TPM context
+ *                               (see kmyth_tpm_context_open())
+ *
+ * @param[in]  alg               The SK algorithm to use
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_tpm_context_set_sk_alg(kmyth_tpm_context * ctx, kmyth_sk_alg alg);
+
+/**
+ * @brief Selects a storage key (SK) pool directory for subsequent seal
+ *        operations on a Kmyth TPM 2.0 context. A seal then takes a
+ *        pre-created SK matching its algorithm, PCR policy and
+ *        authorization string from the pool, needing only a TPM2_Load
+ *        rather than a key generation, and creates its own SK only if the
+ *        pool holds no matching SK. See kmyth_tpm_context_fill_sk_pool().
+ *
+ * @param[in]  ctx               Open Kmyth TPM context
+ *                               (see kmyth_tpm_context_open())
+ *
+ * @param[in]  pool_dir          Path of the pool directory, or NULL to stop
+ *                               using a pool
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_tpm_context_set_sk_pool(kmyth_tpm_context * ctx,
+                                    const char *pool_dir);
+
+/**
+ * @brief Creates storage keys (SKs), under the SRK, in a Kmyth TPM 2.0
+ *        context's SK pool (see kmyth_tpm_context_set_sk_pool()), until it
+ *        holds the requested number of SKs for seals with the context's SK
+ *        algorithm and the specified authorization string and PCRs. This is
+ *        meant to be run when the TPM is idle, ahead of the seals that will
+ *        use the SKs.
+ *
+ *        The pooled SKs are bound to the current values of the selected
+ *        PCRs, so they only serve seals made before any of these change.
+ *
+ * @param[in]  ctx               Open Kmyth TPM context, with an SK pool
+ *
+ * @param[in]  auth_bytes        Authorization string of the seals the SKs
+ *                               are for (NULL for the default)
+ *
+ * @param[in]  auth_bytes_len    Length of auth_bytes
+ *
+ * @param[in]  pcrs              PCRs of the seals the SKs are for
+ *
+ * @param[in]  pcrs_len          Number of PCRs in pcrs
+ *
+ * @param[in]  count             Number of matching SKs the pool should hold
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_tpm_context_fill_sk_pool(kmyth_tpm_context * ctx,
+                                     uint8_t * auth_bytes,
+                                     size_t auth_bytes_len,
+                                     int *pcrs, size_t pcrs_len,
+                                     size_t count);
+
+/**
+ * @brief Enables or disables TPM parameter encryption for subsequent seal
+ *        and unseal operations on a Kmyth TPM 2.0 context. When enabled,
+ *        the policy session authorizing the TPM commands is salted to the
+ *        SRK, and the sensitive data passed to TPM2_Create() and returned
+ *        by TPM2_Unseal() is AES CFB encrypted between the host and the
+ *        TPM, so it cannot be read off the bus to a discrete TPM. The
+ *        setting defaults to the KMYTH_TPM_PARAM_ENC environment variable
+ *        (enabled if set to anything other than empty or "0").
+ *
+ * @param[in]  ctx               Open Kmyth TPM context
+ *                               (see kmyth_tpm_context_open())
+ *
+ * @param[in]  enable            true to encrypt the sensitive parameters,
+ *                               false to send them in the clear
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_tpm_context_set_param_encryption(kmyth_tpm_context * ctx,
+                                             bool enable);
+
+/**
+ * @brief Enables or disables the PCR policy pre-flight check of subsequent
+ *        unseal operations on a Kmyth TPM 2.0 context. When enabled, the
+ *        policy digest of the .ski is recomputed on the host from the
+ *        current PCR values before anything is loaded into the TPM, and
+ *        an unseal that the TPM would refuse fails right away. The
+ *        setting defaults to the KMYTH_TPM_PREFLIGHT environment variable
+ *        (enabled if set to anything other than empty or "0").
+ *
+ * @param[in]  ctx               Open Kmyth TPM context
+ *                               (see kmyth_tpm_context_open())
+ *
+ * @param[in]  enable            true to check the PCR policy first,
+ *                               false to leave it to the TPM
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_tpm_context_set_policy_preflight(kmyth_tpm_context * ctx,
+                                             bool enable);
+
+/**
+ * @brief Selects the compression applied to data before it is encrypted by
+ *        subsequent seal operations on a Kmyth TPM 2.0 context (to each
+ *        payload of a bundle, and block by block to a stream). Contexts
+ *        do not compress until this is called.
+ *
+ *        Compressible data (configuration files, database dumps) seals to
+ *        a much smaller .ski, and, where reading and writing it is the
+ *        bottleneck, faster. The compression is recorded in the .ski,
+ *        which is always written in the binary format while compression
+ *        is selected, and reversed on unseal. Compressed data cannot be
+ *        sealed or unsealed into a caller-provided buffer, or unsealed a
+ *        range at a time.
+ *
+ * @param[in]  ctx               Open Kmyth TPM context
+ *                               (see kmyth_tpm_context_open())
+ *
+ * @param[in]  compression       The compression to apply
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_tpm_context_set_compression(kmyth_tpm_context * ctx,
+                                        kmyth_compression compression);
+
+/**
+ * @brief Implements kmyth-seal using an already open TPM 2.0 context.
+ *
+ * @param[in]  ctx               Open Kmyth TPM context
+ *                               (see kmyth_tpm_context_open())
+ *
+ * @param[in]  input             Raw bytes to be kmyth-sealed
+ *
+ * @param[in]  input_len         Number of bytes in input
+ *
+ * @param[out] output            Bytes in ski format of sealed data
+ *
+ * @param[out] output_len        Number of bytes in output
+ *
+ * @param[in]  auth_bytes        Authorization bytes to be applied to the
+ *                               Kmyth TPM objects (i.e, storage key and sealed
+ *                               wrapping key) created by kmyth-seal
+ *
+ * @param[in]  auth_bytes_len    Number of bytes in auth_bytes
+ *
+ * @param[in]  pcrs              Array containing PCR index selections, if any,
+ *                               to apply to the authorization policy for Kmyth
+ *                               TPM objects created by kmyth-seal.
+ *
+ * @param[in]  pcrs_len          The length of pcrs
+ *
+ * @param[in]  cipher_string     String indicating the symmetric cipher to use
+ *                               for encrypting the input data. Must be NULL
+ *                               or '\0' terminated
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_tpm_context_seal(kmyth_tpm_context * ctx,
+                             uint8_t * input, size_t input_len,
+                             uint8_t ** output, size_t * output_len,
+                             uint8_t * auth_bytes, size_t auth_bytes_len,
+                             int *pcrs, size_t pcrs_len, char *cipher_string);
+
+/**
+ * @brief Implements kmyth-unseal using an already open TPM 2.0 context.
+ *
+ * @param[in]  ctx               Open Kmyth TPM context
+ *                               (see kmyth_tpm_context_open())
+ *
+ * @param[in]  input             Bytes in .ski format to be kmyth-unsealed
+ *
+ * @param[in]  input_len         The size of input in bytes
+ *
+ * @param[out] output            The recovered plaintext data
+ *
+ * @param[out] output_len        The size of the output data
+ *
+ * @param[in]  auth_bytes        Authorization bytes applied to the Kmyth TPM
+ *                               objects (i.e, storage key and sealed data)
+ *                               when they were created by kmyth-seal
+ *
+ * @param[in]  auth_bytes_len    Number of bytes in auth_bytes
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_tpm_context_unseal(kmyth_tpm_context * ctx,
+                               uint8_t * input, size_t input_len,
+                               uint8_t ** output, size_t * output_len,
+                               uint8_t * auth_bytes, size_t auth_bytes_len);
+
+/**
+ * @brief Checks, without unsealing it, whether the current PCR values
+ *        satisfy the authorization policy of a .ski. Only the TPM objects
+ *        of the .ski are parsed and nothing is loaded into the TPM: the
+ *        policy digest is recomputed on the host from the PCR values.
+ *
+ *        A .ski only records the combined policy digest, so when the
+ *        policy is not satisfied the PCRs the policy covers are returned,
+ *        as those that may have changed, and their current values logged.
+ *
+ * @param[in]  ctx               Open Kmyth TPM context
+ *                               (see kmyth_tpm_context_open())
+ *
+ * @param[in]  input             Bytes in .ski format to be checked
+ *
+ * @param[in]  input_len         The size of input in bytes
+ *
+ * @param[out] satisfied         true if the .ski can be unsealed with the
+ *                               current PCR values
+ *
+ * @param[out] pcrs              The indices of the PCRs in the policy, if it
+ *                               is not satisfied (NULL otherwise, release
+ *                               with free())
+ *
+ * @param[out] pcrs_len          The number of entries in pcrs
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_tpm_context_check_policy(kmyth_tpm_context * ctx,
+                                     uint8_t * input, size_t input_len,
+                                     bool *satisfied,
+                                     int **pcrs, size_t *pcrs_len);
+
+/**
+ * @brief Reseals a .ski under a new authorization value and PCR policy,
+ *        without decrypting its data. Only the wrapping key is unsealed,
+ *        and sealed again under a new storage key; the encrypted data is
+ *        copied to the new .ski as it is stored (in the same format).
+ *
+ * @param[in]  ctx                Open Kmyth TPM context
+ *                                (see kmyth_tpm_context_open())
+ *
+ * @param[in]  input              Bytes in .ski format to be resealed
+ *
+ * @param[in]  input_len          The size of input in bytes
+ *
+ * @param[out] output             Bytes in .ski format of the resealed data
+ *
+ * @param[out] output_len         The size of output in bytes
+ *
+ * @param[in]  auth_bytes         Authorization bytes the .ski was sealed with
+ *
+ * @param[in]  auth_bytes_len     Number of bytes in auth_bytes
+ *
+ * @param[in]  new_auth_bytes     Authorization bytes to be applied to the
+ *                                new Kmyth TPM objects
+ *
+ * @param[in]  new_auth_bytes_len Number of bytes in new_auth_bytes
+ *
+ * @param[in]  pcrs               Array containing the new PCR index
+ *                                selections, if any
+ *
+ * @param[in]  pcrs_len           The length of pcrs
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_tpm_context_reseal(kmyth_tpm_context * ctx,
+                               uint8_t * input, size_t input_len,
+                               uint8_t ** output, size_t * output_len,
+                               uint8_t * auth_bytes, size_t auth_bytes_len,
+                               uint8_t * new_auth_bytes,
+                               size_t new_auth_bytes_len,
+                               int *pcrs, size_t pcrs_len);
+
+/**
+ * @brief Reseals a .ski file in place (see kmyth_tpm_context_reseal()).
+ *        The resealed .ski is written to a temporary file that then
+ *        replaces the original (with rename()), so a crash never leaves a
+ *        partly rewritten .ski, and other hard links to the original are
+ *        left as they were.
+ *
+ * @param[in]  ctx                Open Kmyth TPM context
+ *                                (see kmyth_tpm_context_open())
+ *
+ * @param[in]  path               Path to the .ski file to be resealed
+ *
+ * @param[in]  auth_bytes         Authorization bytes the .ski was sealed with
+ *
+ * @param[in]  auth_bytes_len     Number of bytes in auth_bytes
+ *
+ * @param[in]  new_auth_bytes     Authorization bytes to be applied to the
+ *                                new Kmyth TPM objects
+ *
+ * @param[in]  new_auth_bytes_len Number of bytes in new_auth_bytes
+ *
+ * @param[in]  pcrs               Array containing the new PCR index
+ *                                selections, if any
+ *
+ * @param[in]  pcrs_len           The length of pcrs
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_tpm_context_reseal_file(kmyth_tpm_context * ctx, char *path,
+                                    uint8_t * auth_bytes,
+                                    size_t auth_bytes_len,
+                                    uint8_t * new_auth_bytes,
+                                    size_t new_auth_bytes_len,
+                                    int *pcrs, size_t pcrs_len);
+
+/**
+ * @brief Reseals a list of .ski files in place, as a batch (see
+ *        kmyth_tpm_context_reseal_file()). The files are resealed grouped
+ *        by the storage key they were sealed under, so each one is loaded
+ *        once, and all of them under one new storage key. Worker threads
+ *        read and write the files while another's wrapping key is being
+ *        resealed by the TPM. A file that cannot be resealed is logged and
+ *        left as it is, and the others are still resealed.
+ *
+ * @param[in]  ctx                Open Kmyth TPM context
+ *                                (see kmyth_tpm_context_open())
+ *
+ * @param[in]  paths              Paths to the .ski files to be resealed
+ *
+ * @param[in]  path_count         Number of entries in paths
+ *
+ * @param[in]  job_count          Number of worker threads (at least 1)
+ *
+ * @param[in]  auth_bytes         Authorization bytes the .ski files were
+ *                                sealed with
+ *
+ * @param[in]  auth_bytes_len     Number of bytes in auth_bytes
+ *
+ * @param[in]  new_auth_bytes     Authorization bytes to be applied to the
+ *                                new Kmyth TPM objects
+ *
+ * @param[in]  new_auth_bytes_len Number of bytes in new_auth_bytes
+ *
+ * @param[in]  pcrs               Array containing the new PCR index
+ *                                selections, if any
+ *
+ * @param[in]  pcrs_len           The length of pcrs
+ *
+ * @return 0 on success, 1 on error (including any file not resealed)
+ */
+  int kmyth_tpm_context_reseal_files(kmyth_tpm_context * ctx,
+                                     char **paths, size_t path_count,
+                                     size_t job_count,
+                                     uint8_t * auth_bytes,
+                                     size_t auth_bytes_len,
+                                     uint8_t * new_auth_bytes,
+                                     size_t new_auth_bytes_len,
+                                     int *pcrs, size_t pcrs_len);
+
+/**
+ * @brief Seals a small secret (e.g., a disk unlock key) into a TPM NV index
+ *        instead of a .ski. The index is defined, under owner authorization,
+ *        with the Kmyth authorization policy (the authorization bytes and
+ *        PCR criteria), and holds the secret itself: it is read back with
+ *        a single TPM2_NV_Read(), without loading any TPM object or
+ *        decrypting any data (see kmyth_tpm_context_unseal_nv()).
+ *
+ *        The secret can be at most the TPM's NV buffer size (typically 1024
+ *        bytes). The index uses TPM NV memory until it is undefined (see
+ *        kmyth_tpm_context_undefine_nv()).
+ *
+ * @param[in]  ctx               Open Kmyth TPM context
+ *                               (see kmyth_tpm_context_open())
+ *
+ * @param[in]  input             Secret to be sealed
+ *
+ * @param[in]  input_len         The size of input in bytes
+ *
+ * @param[in/out] nv_index       The NV index to define (it must not be
+ *                               defined yet), or 0 for the first free index
+ *                               from 0x01800000, which is returned
+ *
+ * @param[in]  auth_bytes        Authorization bytes to be applied to the
+ *                               NV index
+ *
+ * @param[in]  auth_bytes_len    Number of bytes in auth_bytes
+ *
+ * @param[in]  pcrs              Array containing PCR index selections,
+ *                               if any
+ *
+ * @param[in]  pcrs_len          The length of pcrs
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_tpm_context_seal_nv(kmyth_tpm_context * ctx,
+                                uint8_t * input, size_t input_len,
+                                uint32_t * nv_index,
+                                uint8_t * auth_bytes, size_t auth_bytes_len,
+                                int *pcrs, size_t pcrs_len);
+
+/**
+ * @brief Unseals a secret sealed into a TPM NV index (see
+ *        kmyth_tpm_context_seal_nv()) with a single TPM2_NV_Read(). The
+ *        index only records the policy digest, so the PCRs it was sealed to
+ *        are passed in again.
+ *
+ * @param[in]  ctx               Open Kmyth TPM context
+ *                               (see kmyth_tpm_context_open())
+ *
+ * @param[in]  nv_index          The NV index the secret was sealed into
+ *
+ * @param[out] output            The recovered secret
+ *
+ * @param[out] output_len        The size of the output data
+ *
+ * @param[in]  auth_bytes        Authorization bytes applied to the NV index
+ *                               when the secret was sealed
+ *
+ * @param[in]  auth_bytes_len    Number of bytes in auth_bytes
+ *
+ * @param[in]  pcrs              Array containing the PCR index selections
+ *                               the secret was sealed to, if any
+ *
+ * @param[in]  pcrs_len          The length of pcrs
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_tpm_context_unseal_nv(kmyth_tpm_context * ctx,
+                                  uint32_t nv_index,
+                                  uint8_t ** output, size_t * output_len,
+                                  uint8_t * auth_bytes, size_t auth_bytes_len,
+                                  int *pcrs, size_t pcrs_len);
+
+/**
+ * @brief Undefines an NV index a secret was sealed into (see
+ *        kmyth_tpm_context_seal_nv()), under owner authorization, erasing
+ *        the secret and releasing its NV memory.
+ *
+ * @param[in]  ctx               Open Kmyth TPM context
+ *                               (see kmyth_tpm_context_open())
+ *
+ * @param[in]  nv_index          The NV index to undefine
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_tpm_context_undefine_nv(kmyth_tpm_context * ctx,
+                                    uint32_t nv_index);
+
+/**
+ * @brief Same as kmyth_tpm_context_seal(), but writes the .ski bytes into a
+ *        caller-provided buffer (e.g., a reused buffer or a mapped file)
+ *        instead of allocating one.
+ *
+ * @param[out]    output         Output buffer. If NULL, nothing is sealed
+ *                               and output_len is set to an upper bound on
+ *                               the size of the .ski for this input.
+ *
+ * @param[in,out] output_len     On input, the size of output. On output,
+ *                               the number of .ski bytes written (or the
+ *                               upper bound, for a size query).
+ *
+ * The remaining parameters are the same as for kmyth_tpm_context_seal().
+ *
+ * @return 0 on success, 1 on error (including a buffer that is too small)
+ */
+  int kmyth_tpm_context_seal_into(kmyth_tpm_context * ctx,
+                                  uint8_t * input, size_t input_len,
+                                  uint8_t * output, size_t * output_len,
+                                  uint8_t * auth_bytes, size_t auth_bytes_len,
+                                  int *pcrs, size_t pcrs_len,
+                                  char *cipher_string);
+
+/**
+ * @brief Same as kmyth_tpm_context_seal(), but through a content-addressed
+ *        .ski store (see ski_store.h): if the store already holds a .ski
+ *        of the same data sealed with the same parameters, and it can still
+ *        be unsealed (its storage key loads under the current SRK and, for
+ *        a PCR policy, the current PCR values satisfy it), that .ski is
+ *        reused and nothing is sealed. Otherwise the data is sealed and the
+ *        new .ski added to (or replaced in) the store.
+ *
+ * @param[in]  store_dir         Path of the store directory (created if it
+ *                               does not exist)
+ *
+ * @param[out] ski_path          Path of the stored .ski (release with
+ *                               free()), e.g. to be linked to with
+ *                               ski_store_link()
+ *
+ * @param[out] reused            true if an existing .ski was reused
+ *
+ * The remaining parameters are the same as for kmyth_tpm_context_seal().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_tpm_context_seal_stored(kmyth_tpm_context * ctx,
+                                    const char *store_dir,
+                                    uint8_t * input, size_t input_len,
+                                    char **ski_path, bool *reused,
+                                    uint8_t * auth_bytes,
+                                    size_t auth_bytes_len,
+                                    int *pcrs, size_t pcrs_len,
+                                    char *cipher_string);
+
+/**
+ * @brief Same as kmyth_tpm_context_unseal(), but decrypts the recovered
+ *        plaintext straight into a caller-provided buffer (e.g., locked
+ *        memory) instead of allocating one.
+ *
+ * @param[out]    output         Output buffer. If NULL, nothing is unsealed
+ *                               (and no TPM access is made) and output_len
+ *                               is set to the largest plaintext the .ski can
+ *                               hold. ctx may be NULL for this query.
+ *
+ * @param[in,out] output_len     On input, the size of output. On output,
+ *                               the number of plaintext bytes written (or
+ *                               the size needed, for a size query).
+ *
+ * The remaining parameters are the same as for kmyth_tpm_context_unseal().
+ * If decryption fails, output is cleared.
+ *
+ * @return 0 on success, 1 on error (including a buffer that is too small)
+ */
+  int kmyth_tpm_context_unseal_into(kmyth_tpm_context * ctx,
+                                    uint8_t * input, size_t input_len,
+                                    uint8_t * output, size_t * output_len,
+                                    uint8_t * auth_bytes,
+                                    size_t auth_bytes_len);
+
+/**
+ * @brief Gets the compression recorded in a .ski (no TPM access is made
+ *        and nothing is decoded), e.g., to pick between
+ *        kmyth_tpm_context_unseal_into(), which rejects compressed data,
+ *        and kmyth_tpm_context_unseal().
+ *
+ * @param[in]  input             Bytes in .ski format
+ *
+ * @param[in]  input_len         The size of input in bytes
+ *
+ * @param[out] compression       The compression applied to the sealed data
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ski_get_compression(uint8_t * input, size_t input_len,
+                                kmyth_compression * compression);
+
+/**
+ * @brief Same as kmyth_tpm_context_unseal_into(), but recovers only the
+ *        byte range [offset, offset + *output_len) of the plaintext (e.g.,
+ *        one entry of a large sealed keystore). With an AES/GCM-Stream
+ *        cipher, only the segments covering the range are decrypted, so
+ *        the decryption cost grows with the range length rather than the
+ *        payload length; other ciphers decrypt the whole payload to a
+ *        locked temporary buffer and copy the range from it.
+ *
+ * @param[in]     offset         Offset, in bytes, of the range in the
+ *                               plaintext
+ *
+ * @param[out]    output         Output buffer for the range. If NULL,
+ *                               nothing is unsealed (and no TPM access is
+ *                               made) and output_len is set to the size of
+ *                               the whole plaintext. ctx may be NULL for
+ *                               this query.
+ *
+ * @param[in,out] output_len     The size of the range (and of output). Set
+ *                               to the plaintext size for a size query.
+ *
+ * The remaining parameters are the same as for kmyth_tpm_context_unseal().
+ * If decryption fails, output is cleared.
+ *
+ * @return 0 on success, 1 on error (including a range that extends past
+ *         the end of the plaintext)
+ */
+  int kmyth_tpm_context_unseal_range(kmyth_tpm_context * ctx,
+                                     uint8_t * input, size_t input_len,
+                                     size_t offset,
+                                     uint8_t * output, size_t * output_len,
+                                     uint8_t * auth_bytes,
+                                     size_t auth_bytes_len);
+
+/**
+ * @brief Implements kmyth-seal of several inputs into a single multi-payload
+ *        (bundle) .ski using an already open TPM 2.0 context. All inputs
+ *        share one storage key and one sealed wrapping key, so only one
+ *        storage key is created no matter how many inputs are sealed.
+ *
+ * @param[in]  ctx               Open Kmyth TPM context
+ *                               (see kmyth_tpm_context_open())
+ *
+ * @param[in]  inputs            Array of inputs to be kmyth-sealed
+ *
+ * @param[in]  input_lens        Array of input sizes, in bytes
+ *
+ * @param[in]  input_count       Number of inputs
+ *
+ * @param[out] output            Bytes in ski format of sealed bundle
+ *
+ * @param[out] output_len        Number of bytes in output
+ *
+ * @param[in]  auth_bytes        Authorization bytes to be applied to the
+ *                               Kmyth TPM objects (i.e, storage key and sealed
+ *                               wrapping key) created by kmyth-seal
+ *
+ * @param[in]  auth_bytes_len    Number of bytes in auth_bytes
+ *
+ * @param[in]  pcrs              Array containing PCR index selections, if any,
+ *                               to apply to the authorization policy for Kmyth
+ *                               TPM objects created by kmyth-seal.
+ *
+ * @param[in]  pcrs_len          The length of pcrs
+ *
+ * @param[in]  cipher_string     String indicating the symmetric cipher to use
+ *                               for encrypting the input data. Must be NULL
+ *                               or '\0' terminated
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_tpm_context_seal_bundle(kmyth_tpm_context * ctx,
+                                    uint8_t ** inputs, size_t * input_lens,
+                                    size_t input_count,
+                                    uint8_t ** output, size_t * output_len,
+                                    uint8_t * auth_bytes,
+                                    size_t auth_bytes_len,
+                                    int *pcrs, size_t pcrs_len,
+                                    char *cipher_string);
+
+/**
+ * @brief Implements kmyth-unseal of a multi-payload (bundle) .ski using an
+ *        already open TPM 2.0 context. A standard .ski is accepted as well
+ *        and yields a single output.
+ *
+ * @param[in]  ctx               Open Kmyth TPM context
+ *                               (see kmyth_tpm_context_open())
+ *
+ * @param[in]  input             Bytes in .ski format to be kmyth-unsealed
+ *
+ * @param[in]  input_len         The size of input in bytes
+ *
+ * @param[out] outputs           Newly allocated array of recovered payloads,
+ *                               in the order they were sealed. Each payload
+ *                               and the array itself must be freed by the
+ *                               caller.
+ *
+ * @param[out] output_lens       Newly allocated array of payload sizes
+ *
+ * @param[out] output_count      Number of payloads recovered
+ *
+ * @param[in]  auth_bytes        Authorization bytes applied to the Kmyth TPM
+ *                               objects when they were created by kmyth-seal
+ *
+ * @param[in]  auth_bytes_len    Number of bytes in auth_bytes
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_tpm_context_unseal_bundle(kmyth_tpm_context * ctx,
+                                      uint8_t * input, size_t input_len,
+                                      uint8_t *** outputs,
+                                      size_t ** output_lens,
+                                      size_t * output_count,
+                                      uint8_t * auth_bytes,
+                                      size_t auth_bytes_len);
+
+/**
+ * @brief Kmyth-seals everything readable from an input stream (e.g., a
+ *        pipe), writing the .ski to an output stream as the data is
+ *        encrypted - neither the plaintext nor the .ski is ever held in
+ *        memory in full. The wrapping key is created and sealed before any
+ *        input is read.
+ *
+ *        The output is a binary format .ski (whatever the context's .ski
+ *        format) written as a stream: its encrypted data size is not
+ *        recorded, the data instead runs to the end of the .ski. Any
+ *        kmyth-unseal function accepts it. The cipher must be able to
+ *        encrypt incrementally (an AES/GCM-Stream cipher).
+ *
+ * @param[in]  ctx               Open Kmyth TPM context
+ *                               (see kmyth_tpm_context_open())
+ *
+ * @param[in]  input             Stream the data to be sealed is read from
+ *                               (to EOF)
+ *
+ * @param[in]  output            Stream the .ski is written to. On error,
+ *                               anything already written to it must be
+ *                               discarded.
+ *
+ * @param[in]  cipher_string     String indicating the symmetric cipher to
+ *                               use (NULL for the default stream cipher,
+ *                               AES/GCM-Stream/NoPadding/256)
+ *
+ * The remaining parameters are the same as for kmyth_tpm_context_seal().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_tpm_context_seal_stream(kmyth_tpm_context * ctx,
+                                    FILE * input, FILE * output,
+                                    uint8_t * auth_bytes,
+                                    size_t auth_bytes_len,
+                                    int *pcrs, size_t pcrs_len,
+                                    char *cipher_string);
+
+/**
+ * @brief Kmyth-unseals a .ski read from an input stream, writing the
+ *        recovered data to an output stream. A binary format .ski sealed
+ *        with an AES/GCM-Stream cipher is decrypted as it is read, one
+ *        authenticated segment at a time; any other .ski is read in full
+ *        and unsealed as by kmyth_tpm_context_unseal().
+ *
+ * @param[in]  ctx               Open Kmyth TPM context
+ *                               (see kmyth_tpm_context_open())
+ *
+ * @param[in]  input             Stream the .ski is read from (to EOF)
+ *
+ * @param[in]  output            Stream the recovered data is written to.
+ *                               Only authenticated data is written, but
+ *                               on error the data already written is
+ *                               incomplete and must be discarded.
+ *
+ * The remaining parameters are the same as for kmyth_tpm_context_unseal().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_tpm_context_unseal_stream(kmyth_tpm_context * ctx,
+                                      FILE * input, FILE * output,
+                                      uint8_t * auth_bytes,
+                                      size_t auth_bytes_len);
+
+/**
+ * @brief Opaque handle for an asynchronous TPM job queue.
+ *
+ * Seal and unseal jobs submitted to a queue return at once and are run, in
+ * submission order, by the queue's worker threads on one Kmyth TPM
+ * context. The context serializes the workers' TPM commands, so with more
+ * than one worker the encryption and (un)marshalling of one job overlap
+ * the TPM commands of another, and no thread that submits jobs ever waits
+ * on the TPM. A job's completion is reported either through its callback
+ * or, for jobs submitted without one, by kmyth_tpm_queue_reap() once the
+ * queue's eventfd (see kmyth_tpm_queue_fd()) is readable.
+ */
+  typedef struct kmyth_tpm_queue kmyth_tpm_queue;
+
+/**
+ * @brief Called, on a queue worker thread, when a job finishes.
+ *
+ * @param[in]  arg               The argument given when the job was
+ *                               submitted
+ *
+ * @param[in]  result            0 if the job succeeded, 1 if it failed
+ *
+ * @param[in]  output            The .ski bytes (seal) or plaintext (unseal)
+ *                               produced by the job, or NULL if it failed.
+ *                               Owned by the callback, which must clear
+ *                               and free() it.
+ *
+ * @param[in]  output_len        Number of bytes in output
+ *
+ * The callback must not close the queue it is called from.
+ */
+  typedef void (*kmyth_tpm_job_done)(void *arg, int result,
+                                     uint8_t * output, size_t output_len);
+
+/**
+ * @brief Opens an asynchronous TPM job queue on an open Kmyth TPM 2.0
+ *        context.
+ *
+ * @param[in]  ctx               Open Kmyth TPM context
+ *                               (see kmyth_tpm_context_open()). Still owned
+ *                               by the caller; it must stay open until the
+ *                               queue is closed, and must not be
+ *                               reconfigured while the queue is open.
+ *
+ * @param[in]  worker_count      Number of worker threads (0 for the
+ *                               default, KMYTH_TPM_QUEUE_WORKERS)
+ *
+ * @param[out] queue             Newly allocated queue (passed as pointer to
+ *                               the queue pointer). Must be released with
+ *                               kmyth_tpm_queue_close().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_tpm_queue_open(kmyth_tpm_context * ctx, size_t worker_count,
+                           kmyth_tpm_queue ** queue);
+
+/**
+ * @brief Closes an asynchronous TPM job queue. Further submissions are
+ *        refused, jobs that a worker is running are finished, and jobs
+ *        that no worker has started fail: their callbacks are called (on
+ *        the closing thread) with a result of 1, and jobs without a
+ *        callback are discarded. Completions that were never reaped are
+ *        then cleared and discarded.
+ *
+ * @param[in/out] queue          Queue to be closed (passed as pointer to
+ *                               the queue pointer). Set to NULL on return.
+ *                               A NULL queue is ignored.
+ *
+ * @return None
+ */
+  void kmyth_tpm_queue_close(kmyth_tpm_queue ** queue);
+
+/**
+ * @brief Submits a kmyth_tpm_context_seal() job to a queue.
+ *
+ * @param[in]  queue             Open TPM job queue
+ *
+ * @param[in]  input             Raw bytes to be kmyth-sealed. Not copied:
+ *                               must stay valid until the job completes.
+ *
+ * @param[in]  done              Completion callback, or NULL to report the
+ *                               completion through kmyth_tpm_queue_reap()
+ *
+ * @param[in]  arg               Passed back with the job's completion
+ *
+ * The remaining parameters are the same as for kmyth_tpm_context_seal(),
+ * and are copied.
+ *
+ * @return 0 if the job was submitted, 1 on error (including a queue that
+ *         is being closed)
+ */
+  int kmyth_tpm_queue_seal(kmyth_tpm_queue * queue,
+                           uint8_t * input, size_t input_len,
+                           uint8_t * auth_bytes, size_t auth_bytes_len,
+                           int *pcrs, size_t pcrs_len, char *cipher_string,
+                           kmyth_tpm_job_done done, void *arg);
+
+/**
+ * @brief Submits a kmyth_tpm_context_unseal() job to a queue.
+ *
+ * @param[in]  queue             Open TPM job queue
+ *
+ * @param[in]  input             Bytes in .ski format to be kmyth-unsealed.
+ *                               Not copied: must stay valid until the job
+ *                               completes.
+ *
+ * @param[in]  done              Completion callback, or NULL to report the
+ *                               completion through kmyth_tpm_queue_reap()
+ *
+ * @param[in]  arg               Passed back with the job's completion
+ *
+ * The remaining parameters are the same as for kmyth_tpm_context_unseal(),
+ * and are copied.
+ *
+ * @return 0 if the job was submitted, 1 on error (including a queue that
+ *         is being closed)
+ */
+  int kmyth_tpm_queue_unseal(kmyth_tpm_queue * queue,
+                             uint8_t * input, size_t input_len,
+                             uint8_t * auth_bytes, size_t auth_bytes_len,
+                             kmyth_tpm_job_done done, void *arg);
+
+/**
+ * @brief Provides a queue's completion eventfd, for registration with an
+ *        event loop (e.g., epoll). It is readable while any job submitted
+ *        without a callback has completed but not been reaped, and must
+ *        only be polled, never read.
+ *
+ * @param[in]  queue             Open TPM job queue
+ *
+ * @return the eventfd file descriptor, or -1 if queue is NULL
+ */
+  int kmyth_tpm_queue_fd(const kmyth_tpm_queue * queue);
+
+/**
+ * @brief Hands over the oldest completion of a job submitted without a
+ *        callback, if there is one. Never blocks.
+ *
+ * @param[in]  queue             Open TPM job queue
+ *
+ * @param[out] arg               The argument given when the job was
+ *                               submitted
+ *
+ * @param[out] result            0 if the job succeeded, 1 if it failed
+ *
+ * @param[out] output            The .ski bytes (seal) or plaintext (unseal)
+ *                               produced by the job, or NULL if it failed
+ *                               (to be cleared and freed by the caller)
+ *
+ * @param[out] output_len        Number of bytes in output
+ *
+ * @return 0 if a completion was handed over, 1 if none is waiting (or on
+ *         error)
+ */
+  int kmyth_tpm_queue_reap(kmyth_tpm_queue * queue, void **arg, int *result,
+                           uint8_t ** output, size_t *output_len);
+
 /**
  * @brief High-level function implementing kmyth-seal using TPM 2.0.
  *
+ * Opens and closes its own TPM context, so it may be called from several
+ * threads at once. Threads making many calls should instead reuse a context
+ * (see kmyth_tpm_context_thread() and kmyth_tpm_context_seal()).
+ *
  * @param[in]  input             Raw bytes to be kmyth-sealed
  *
  * @param[in]  input_len         Number of bytes in input
@@ -63,6 +1083,9 @@ extern "C"
 /**
  * @brief High-level function implementing kmyth-unseal using TPM 2.0.
  *
+ * Opens and closes its own TPM context, so it may be called from several
+ * threads at once. Threads making many calls should instead reuse a context
+ * (see kmyth_tpm_context_thread() and kmyth_tpm_context_unseal()).
  *
  * @param[in]  input             Raw data to be kmyth-sealed
  *
@@ -92,6 +1115,122 @@ extern "C"
                         uint8_t * auth_bytes, size_t auth_bytes_len,
                         uint8_t * owner_auth_bytes, size_t oa_bytes_len);
 
+/**
+ * @brief Same as tpm2_kmyth_seal(), but writes the .ski bytes into a
+ *        caller-provided buffer (see kmyth_tpm_context_seal_into()).
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_seal_into(uint8_t * input, size_t input_len,
+                           uint8_t * output, size_t * output_len,
+                           uint8_t * auth_bytes, size_t auth_bytes_len,
+                           uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                           int *pcrs, size_t pcrs_len, char *cipher_string);
+
+/**
+ * @brief Same as tpm2_kmyth_unseal(), but decrypts into a caller-provided
+ *        buffer (see kmyth_tpm_context_unseal_into()). A size query (NULL
+ *        output) does not open a TPM context.
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_unseal_into(uint8_t * input, size_t input_len,
+                             uint8_t * output, size_t * output_len,
+                             uint8_t * auth_bytes, size_t auth_bytes_len,
+                             uint8_t * owner_auth_bytes, size_t oa_bytes_len);
+
+/**
+ * @brief Same as tpm2_kmyth_unseal(), but recovers only a byte range of
+ *        the plaintext into a caller-provided buffer (see
+ *        kmyth_tpm_context_unseal_range()). A size query (NULL output) does
+ *        not open a TPM context.
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_unseal_range(uint8_t * input, size_t input_len,
+                              size_t offset,
+                              uint8_t * output, size_t * output_len,
+                              uint8_t * auth_bytes, size_t auth_bytes_len,
+                              uint8_t * owner_auth_bytes,
+                              size_t oa_bytes_len);
+
+/**
+ * @brief High-level function implementing kmyth-seal of several inputs into
+ *        a single multi-payload (bundle) .ski using TPM 2.0.
+ *
+ * @param[in]  inputs            Array of inputs to be kmyth-sealed
+ *
+ * @param[in]  input_lens        Array of input sizes, in bytes
+ *
+ * @param[in]  input_count       Number of inputs
+ *
+ * @param[out] output            Bytes in ski format of sealed bundle
+ *
+ * @param[out] output_len        Number of bytes in output
+ *
+ * @param[in]  auth_bytes        Authorization bytes to be applied to the
+ *                               Kmyth TPM objects (i.e, storage key and sealed
+ *                               wrapping key) created by kmyth-seal
+ *
+ * @param[in]  auth_bytes_len    Number of bytes in auth_bytes
+ *
+ * @param[in]  owner_auth_bytes  TPM owner (storage) hierarchy password.
+ *                               EmptyAuth by default, but, if it has been
+ *                               changed (e.g., by tpm2_takeownership), user
+ *                               must provide via this parameter.
+ *
+ * @param[in]  oa_bytes_len      Number of bytes in owner_auth_bytes
+ *
+ * @param[in]  pcrs              Array containing PCR index selections, if any
+ *
+ * @param[in]  pcrs_len          The length of pcrs
+ *
+ * @param[in]  cipher_string     String indicating the symmetric cipher to use
+ *                               for encrypting the input data. Must be NULL
+ *                               or '\0' terminated
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_seal_bundle(uint8_t ** inputs, size_t * input_lens,
+                             size_t input_count,
+                             uint8_t ** output, size_t * output_len,
+                             uint8_t * auth_bytes, size_t auth_bytes_len,
+                             uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                             int *pcrs, size_t pcrs_len, char *cipher_string);
+
+/**
+ * @brief High-level function implementing kmyth-unseal of a multi-payload
+ *        (bundle) .ski using TPM 2.0.
+ *
+ * @param[in]  input             Bytes in .ski format to be kmyth-unsealed
+ *
+ * @param[in]  input_len         The size of input in bytes
+ *
+ * @param[out] outputs           Newly allocated array of recovered payloads
+ *                               (see kmyth_tpm_context_unseal_bundle())
+ *
+ * @param[out] output_lens       Newly allocated array of payload sizes
+ *
+ * @param[out] output_count      Number of payloads recovered
+ *
+ * @param[in]  auth_bytes        Authorization bytes applied to the Kmyth TPM
+ *                               objects when they were created by kmyth-seal
+ *
+ * @param[in]  auth_bytes_len    Number of bytes in auth_bytes
+ *
+ * @param[in]  owner_auth_bytes  TPM owner (storage) hierarchy password
+ *
+ * @param[in]  oa_bytes_len      Number of bytes in owner_auth_bytes
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_unseal_bundle(uint8_t * input, size_t input_len,
+                               uint8_t *** outputs, size_t ** output_lens,
+                               size_t * output_count,
+                               uint8_t * auth_bytes, size_t auth_bytes_len,
+                               uint8_t * owner_auth_bytes,
+                               size_t oa_bytes_len);
+
 /**
  * @brief High-level function implementing kmyth-seal for files using TPM 2.0.
  *        The kmyth-seal input data is read from the specified file.
@@ -135,6 +1274,46 @@ extern "C"
                            uint8_t * owner_auth_bytes, size_t oa_bytes_len,
                            int *pcrs, size_t pcrs_len, char *cipher_string);
 
+/**
+ * @brief Seals data held in memory (e.g., a key just retrieved from a key
+ *        server) using TPM 2.0, and writes only the resulting .ski data out,
+ *        so the data itself is never written in the clear.
+ *
+ * @param[in]  input             Data to be sealed
+ *
+ * @param[in]  input_len         Length, in bytes, of input
+ *
+ * @param[in]  output_path       Path the .ski data is written to, or NULL
+ *                               to write it to stdout
+ *
+ * @param[in]  auth_bytes        Authorization bytes to be applied to the
+ *                               Kmyth TPM objects created (see
+ *                               tpm2_kmyth_seal())
+ *
+ * @param[in]  auth_bytes_len    Number of bytes in auth_bytes
+ *
+ * @param[in]  owner_auth_bytes  TPM owner (storage) hierarchy password
+ *
+ * @param[in]  oa_bytes_len      Number of bytes in owner_auth_bytes
+ *
+ * @param[in]  pcrs              Array containing PCRs, if any, to apply
+ *                               to the authorization policy
+ *
+ * @param[in]  pcrs_len          The length of pcrs
+ *
+ * @param[in]  cipher_string     String indicating the symmetric cipher to use
+ *                               for encrypting the input data. Must be NULL
+ *                               or '\0' terminated
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_seal_to_file(uint8_t * input, size_t input_len,
+                              char *output_path,
+                              uint8_t * auth_bytes, size_t auth_bytes_len,
+                              uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                              int *pcrs, size_t pcrs_len,
+                              char *cipher_string);
+
 /**
  * @brief High-level function implementing kmyth-unseal for files using TPM 2.0.
  *        The kmyth-unseal input data is read from the specified file.
@@ -166,6 +1345,28 @@ extern "C"
                              uint8_t ** output, size_t * output_length,
                              uint8_t * auth_bytes, size_t auth_bytes_len,
                              uint8_t * owner_auth_bytes, size_t oa_bytes_len);
+
+/**
+ * @brief High-level function implementing kmyth-seal for streams using
+ *        TPM 2.0 (see kmyth_tpm_context_seal_stream()).
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_seal_stream(FILE * input, FILE * output,
+                             uint8_t * auth_bytes, size_t auth_bytes_len,
+                             uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                             int *pcrs, size_t pcrs_len, char *cipher_string);
+
+/**
+ * @brief High-level function implementing kmyth-unseal for streams using
+ *        TPM 2.0 (see kmyth_tpm_context_unseal_stream()).
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_unseal_stream(FILE * input, FILE * output,
+                               uint8_t * auth_bytes, size_t auth_bytes_len,
+                               uint8_t * owner_auth_bytes,
+                               size_t oa_bytes_len);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,573 @@
+/**
+ * @file  kmyth.hpp
+ *
+ * @brief Provides header-only C++ wrappers (C++20) for the Kmyth TPM 2.0
+ *        seal/unseal library declared in kmyth.h.
+ *
+ * The wrapper types own their resources and are move-only:
+ *   - TpmContext   an open kmyth_tpm_context, closed on destruction
+ *   - SealedBlob   .ski bytes produced by a seal
+ *   - SecureBuffer locked, wiped-on-release memory (kmyth_secure_alloc())
+ *                  holding unsealed plaintext
+ *
+ * Inputs are taken as std::span and passed straight to the library, and
+ * outputs are written through the caller-provided buffer variants of the
+ * library calls (kmyth_tpm_context_seal_into(), etc.) into either a span
+ * the caller owns or a SealedBlob / SecureBuffer sized for it, so no data
+ * is copied on the way in or out. Compressed data cannot be written to a
+ * caller-provided buffer, so for it seal() and unseal() take over the
+ * buffer the allocating library call returns instead. Library errors are
+ * thrown as kmyth::Error.
+ */
+
+#ifndef KMYTH_HPP
+#define KMYTH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <utility>
+
+#include "kmyth.h"
+#include "memory_util.h"
+
+namespace kmyth
+{
+
+/**
+ * @brief Thrown when a Kmyth library call fails. Details of the failure
+ *        are written to the Kmyth log.
+ */
+  class Error : public std::runtime_error
+  {
+  public:
+    using std::runtime_error::runtime_error;
+  };
+
+/**
+ * @brief Plaintext buffer allocated with kmyth_secure_alloc(): locked in
+ *        RAM, excluded from core dumps, and wiped when released (except
+ *        for compressed plaintext, see TpmContext::unseal()).
+ */
+  class SecureBuffer
+  {
+    friend class TpmContext;
+
+  public:
+    SecureBuffer() noexcept = default;
+
+    /**
+     * @brief Allocates a buffer of the given size (throws std::bad_alloc
+     *        if the secure allocation fails).
+     */
+    explicit SecureBuffer(std::size_t size) : capacity_(size), size_(size)
+    {
+      if (size > 0)
+      {
+        data_ = static_cast<std::uint8_t *>(kmyth_secure_alloc(size));
+        if (data_ == nullptr)
+        {
+          throw std::bad_alloc();
+        }
+      }
+    }
+
+    SecureBuffer(const SecureBuffer &) = delete;
+    SecureBuffer &operator=(const SecureBuffer &) = delete;
+
+    SecureBuffer(SecureBuffer &&other) noexcept
+      : data_(std::exchange(other.data_, nullptr)),
+        capacity_(std::exchange(other.capacity_, 0)),
+        size_(std::exchange(other.size_, 0)),
+        secure_(std::exchange(other.secure_, true))
+    {
+    }
+
+    SecureBuffer &operator=(SecureBuffer &&other) noexcept
+    {
+      if (this != &other)
+      {
+        reset();
+        data_ = std::exchange(other.data_, nullptr);
+        capacity_ = std::exchange(other.capacity_, 0);
+        size_ = std::exchange(other.size_, 0);
+        secure_ = std::exchange(other.secure_, true);
+      }
+      return *this;
+    }
+
+    ~SecureBuffer()
+    {
+      reset();
+    }
+
+    /**
+     * @brief Wipes and releases the buffer, leaving it empty.
+     */
+    void reset() noexcept
+    {
+      if (secure_)
+      {
+        kmyth_secure_free(data_, capacity_);
+      }
+      else
+      {
+        kmyth_clear_and_free(data_, capacity_);
+      }
+      data_ = nullptr;
+      capacity_ = 0;
+      size_ = 0;
+      secure_ = true;
+    }
+
+    /**
+     * @brief Shrinks the visible size (e.g., to the number of bytes a call
+     *        actually wrote). The allocation itself is kept.
+     */
+    void truncate(std::size_t size) noexcept
+    {
+      if (size < size_)
+      {
+        size_ = size;
+      }
+    }
+
+    std::uint8_t *data() noexcept
+    {
+      return data_;
+    }
+    const std::uint8_t *data() const noexcept
+    {
+      return data_;
+    }
+    std::size_t size() const noexcept
+    {
+      return size_;
+    }
+    bool empty() const noexcept
+    {
+      return size_ == 0;
+    }
+    std::span<std::uint8_t> span() noexcept
+    {
+      return { data_, size_ };
+    }
+    std::span<const std::uint8_t> span() const noexcept
+    {
+      return { data_, size_ };
+    }
+
+  private:
+    // takes over plaintext the library allocated with malloc(), which is
+    // not locked in RAM but is still wiped when released
+    SecureBuffer(std::uint8_t *data, std::size_t size) noexcept
+      : data_(data), capacity_(size), size_(size), secure_(false)
+    {
+    }
+
+    std::uint8_t *data_ = nullptr;
+    std::size_t capacity_ = 0;
+    std::size_t size_ = 0;
+    bool secure_ = true;
+  };
+
+/**
+ * @brief Sealed (.ski) bytes. Not secret, so kept in ordinary memory.
+ */
+  class SealedBlob
+  {
+    friend class TpmContext;
+
+  public:
+    SealedBlob() noexcept = default;
+
+    /**
+     * @brief Allocates an uninitialized blob of the given size (throws
+     *        std::bad_alloc if the allocation fails).
+     */
+    explicit SealedBlob(std::size_t size) : size_(size)
+    {
+      if (size > 0)
+      {
+        data_.reset(static_cast<std::uint8_t *>(std::malloc(size)));
+        if (data_ == nullptr)
+        {
+          throw std::bad_alloc();
+        }
+      }
+    }
+
+    SealedBlob(const SealedBlob &) = delete;
+    SealedBlob &operator=(const SealedBlob &) = delete;
+
+    SealedBlob(SealedBlob &&other) noexcept
+      : data_(std::move(other.data_)), size_(std::exchange(other.size_, 0))
+    {
+    }
+
+    SealedBlob &operator=(SealedBlob &&other) noexcept
+    {
+      data_ = std::move(other.data_);
+      size_ = std::exchange(other.size_, 0);
+      return *this;
+    }
+
+    /**
+     * @brief Shrinks the visible size (e.g., to the number of .ski bytes a
+     *        seal actually wrote). The allocation itself is kept.
+     */
+    void truncate(std::size_t size) noexcept
+    {
+      if (size < size_)
+      {
+        size_ = size;
+      }
+    }
+
+    std::uint8_t *data() noexcept
+    {
+      return data_.get();
+    }
+    const std::uint8_t *data() const noexcept
+    {
+      return data_.get();
+    }
+    std::size_t size() const noexcept
+    {
+      return size_;
+    }
+    bool empty() const noexcept
+    {
+      return size_ == 0;
+    }
+    std::span<std::uint8_t> span() noexcept
+    {
+      return { data_.get(), size_ };
+    }
+    std::span<const std::uint8_t> span() const noexcept
+    {
+      return { data_.get(), size_ };
+    }
+
+  private:
+    struct Free
+    {
+      void operator()(std::uint8_t *data) const noexcept
+      {
+        std::free(data);
+      }
+    };
+
+    // takes over .ski bytes the library allocated with malloc()
+    SealedBlob(std::uint8_t *data, std::size_t size) noexcept
+      : data_(data), size_(size)
+    {
+    }
+
+    std::unique_ptr<std::uint8_t, Free> data_;
+    std::size_t size_ = 0;
+  };
+
+/**
+ * @brief Optional parameters of a seal (see kmyth_tpm_context_seal()).
+ */
+  struct SealOptions
+  {
+    std::span<const std::uint8_t> auth = {};    ///< object authorization
+    std::span<const int> pcrs = {};     ///< PCR indices for the policy
+    const char *cipher = nullptr;       ///< cipher name (NULL for default)
+  };
+
+  namespace detail
+  {
+    // the C API takes non-const pointers to inputs it only reads
+    inline std::uint8_t *in(std::span<const std::uint8_t> s) noexcept
+    {
+      return const_cast<std::uint8_t *>(s.data());
+    }
+
+    inline void check(int retval, const char *call)
+    {
+      if (retval != 0)
+      {
+        throw Error(call);
+      }
+    }
+  }
+
+/**
+ * @brief Owning handle for a Kmyth TPM 2.0 context (see kmyth_tpm_context
+ *        in kmyth.h for what it holds and its thread-safety rules).
+ */
+  class TpmContext
+  {
+  public:
+    /**
+     * @brief Opens a context (see kmyth_tpm_context_open()).
+     *
+     * @param[in] owner_auth  TPM owner (storage) hierarchy password, if it
+     *                        is not EmptyAuth
+     */
+    explicit TpmContext(std::span<const std::uint8_t> owner_auth = {})
+    {
+      detail::check(kmyth_tpm_context_open(detail::in(owner_auth),
+                                           owner_auth.size(), &ctx_),
+                    "kmyth_tpm_context_open");
+    }
+
+    TpmContext(const TpmContext &) = delete;
+    TpmContext &operator=(const TpmContext &) = delete;
+
+    TpmContext(TpmContext &&other) noexcept
+      : ctx_(std::exchange(other.ctx_, nullptr)),
+        compression_(std::exchange(other.compression_,
+                                   KMYTH_COMPRESSION_NONE))
+    {
+    }
+
+    TpmContext &operator=(TpmContext &&other) noexcept
+    {
+      if (this != &other)
+      {
+        kmyth_tpm_context_close(&ctx_);
+        ctx_ = std::exchange(other.ctx_, nullptr);
+        compression_ = std::exchange(other.compression_,
+                                     KMYTH_COMPRESSION_NONE);
+      }
+      return *this;
+    }
+
+    ~TpmContext()
+    {
+      kmyth_tpm_context_close(&ctx_);
+    }
+
+    /**
+     * @brief Returns the underlying C context, for calls not wrapped here.
+     *        The TpmContext keeps ownership. Set the compression with
+     *        set_compression() rather than through this, so that seal()
+     *        knows about it.
+     */
+    kmyth_tpm_context *get() const noexcept
+    {
+      return ctx_;
+    }
+
+    void set_ski_format(kmyth_ski_format format)
+    {
+      detail::check(kmyth_tpm_context_set_ski_format(ctx_, format),
+                    "kmyth_tpm_context_set_ski_format");
+    }
+
+    void set_sk_alg(kmyth_sk_alg alg)
+    {
+      detail::check(kmyth_tpm_context_set_sk_alg(ctx_, alg),
+                    "kmyth_tpm_context_set_sk_alg");
+    }
+
+    /**
+     * @brief Selects the compression (see
+     *        kmyth_tpm_context_set_compression()). While one is selected,
+     *        sealed_size() and seal_into() fail, and seal() falls back to
+     *        kmyth_tpm_context_seal().
+     */
+    void set_compression(kmyth_compression compression)
+    {
+      detail::check(kmyth_tpm_context_set_compression(ctx_, compression),
+                    "kmyth_tpm_context_set_compression");
+      compression_ = compression;
+    }
+
+    void set_param_encryption(bool enable)
+    {
+      detail::check(kmyth_tpm_context_set_param_encryption(ctx_, enable),
+                    "kmyth_tpm_context_set_param_encryption");
+    }
+
+    void set_policy_preflight(bool enable)
+    {
+      detail::check(kmyth_tpm_context_set_policy_preflight(ctx_, enable),
+                    "kmyth_tpm_context_set_policy_preflight");
+    }
+
+    /**
+     * @brief Returns an upper bound on the size of the .ski that sealing
+     *        input with these options produces (no TPM access is made).
+     */
+    std::size_t sealed_size(std::span<const std::uint8_t> input,
+                            const SealOptions &opts = {}) const
+    {
+      std::size_t size = 0;
+
+      detail::check(seal_into_raw(detail::in(input), input.size(), nullptr,
+                                  &size, opts),
+                    "kmyth_tpm_context_seal_into");
+      return size;
+    }
+
+    /**
+     * @brief Seals input into a caller-owned buffer (see
+     *        kmyth_tpm_context_seal_into()).
+     *
+     * @return Number of .ski bytes written to output
+     */
+    std::size_t seal_into(std::span<const std::uint8_t> input,
+                          std::span<std::uint8_t> output,
+                          const SealOptions &opts = {}) const
+    {
+      std::size_t size = output.size();
+
+      detail::check(seal_into_raw(detail::in(input), input.size(),
+                                  output.data(), &size, opts),
+                    "kmyth_tpm_context_seal_into");
+      return size;
+    }
+
+    /**
+     * @brief Seals input into a new SealedBlob. With compression selected,
+     *        the size of the .ski is not known up front, so the blob takes
+     *        over the buffer kmyth_tpm_context_seal() allocates: this path
+     *        makes one allocation, as the uncompressed one does.
+     */
+    SealedBlob seal(std::span<const std::uint8_t> input,
+                    const SealOptions &opts = {}) const
+    {
+      if (compression_ != KMYTH_COMPRESSION_NONE)
+      {
+        std::uint8_t *output = nullptr;
+        std::size_t output_len = 0;
+
+        detail::check(kmyth_tpm_context_seal(ctx_, detail::in(input),
+                                             input.size(), &output,
+                                             &output_len,
+                                             detail::in(opts.auth),
+                                             opts.auth.size(),
+                                             const_cast<int *>(opts.pcrs.
+                                                               data()),
+                                             opts.pcrs.size(),
+                                             const_cast<char *>(opts.
+                                                                cipher)),
+                      "kmyth_tpm_context_seal");
+        return SealedBlob(output, output_len);
+      }
+
+      SealedBlob blob(sealed_size(input, opts));
+
+      blob.truncate(seal_into(input, blob.span(), opts));
+      return blob;
+    }
+
+    /**
+     * @brief Returns the size of the largest plaintext a .ski can hold
+     *        (no TPM access is made). Fails for a compressed .ski.
+     */
+    static std::size_t unsealed_size(std::span<const std::uint8_t> ski)
+    {
+      std::size_t size = 0;
+
+      detail::check(kmyth_tpm_context_unseal_into(nullptr, detail::in(ski),
+                                                  ski.size(), nullptr,
+                                                  &size, nullptr, 0),
+                    "kmyth_tpm_context_unseal_into");
+      return size;
+    }
+
+    /**
+     * @brief Unseals a .ski into a caller-owned buffer (see
+     *        kmyth_tpm_context_unseal_into()). Fails for a compressed .ski.
+     *
+     * @return Number of plaintext bytes written to output
+     */
+    std::size_t unseal_into(std::span<const std::uint8_t> ski,
+                            std::span<std::uint8_t> output,
+                            std::span<const std::uint8_t> auth = {}) const
+    {
+      std::size_t size = output.size();
+
+      detail::check(kmyth_tpm_context_unseal_into(ctx_, detail::in(ski),
+                                                  ski.size(), output.data(),
+                                                  &size, detail::in(auth),
+                                                  auth.size()),
+                    "kmyth_tpm_context_unseal_into");
+      return size;
+    }
+
+    /**
+     * @brief Unseals a .ski into a new SecureBuffer. The size of compressed
+     *        plaintext is only known once it is decompressed, so for a
+     *        compressed .ski the buffer takes over the one
+     *        kmyth_tpm_context_unseal() allocates instead: this path makes
+     *        one allocation, as the uncompressed one does, but that
+     *        allocation is ordinary heap memory, not locked in RAM. It is
+     *        still wiped when released.
+     */
+    SecureBuffer unseal(std::span<const std::uint8_t> ski,
+                        std::span<const std::uint8_t> auth = {}) const
+    {
+      kmyth_compression compression = KMYTH_COMPRESSION_NONE;
+
+      detail::check(kmyth_ski_get_compression(detail::in(ski), ski.size(),
+                                              &compression),
+                    "kmyth_ski_get_compression");
+      if (compression != KMYTH_COMPRESSION_NONE)
+      {
+        std::uint8_t *output = nullptr;
+        std::size_t output_len = 0;
+
+        detail::check(kmyth_tpm_context_unseal(ctx_, detail::in(ski),
+                                               ski.size(), &output,
+                                               &output_len, detail::in(auth),
+                                               auth.size()),
+                      "kmyth_tpm_context_unseal");
+        return SecureBuffer(output, output_len);
+      }
+
+      SecureBuffer plaintext(unsealed_size(ski));
+
+      plaintext.truncate(unseal_into(ski, plaintext.span(), auth));
+      return plaintext;
+    }
+
+    /**
+     * @brief Unseals the plaintext range [offset, offset + output.size())
+     *        of a .ski into a caller-owned buffer (see
+     *        kmyth_tpm_context_unseal_range()).
+     */
+    void unseal_range(std::span<const std::uint8_t> ski,
+                      std::size_t offset, std::span<std::uint8_t> output,
+                      std::span<const std::uint8_t> auth = {}) const
+    {
+      std::size_t size = output.size();
+
+      detail::check(kmyth_tpm_context_unseal_range(ctx_, detail::in(ski),
+                                                   ski.size(), offset,
+                                                   output.data(), &size,
+                                                   detail::in(auth),
+                                                   auth.size()),
+                    "kmyth_tpm_context_unseal_range");
+    }
+
+  private:
+    int seal_into_raw(std::uint8_t *input, std::size_t input_len,
+                      std::uint8_t *output, std::size_t *output_len,
+                      const SealOptions &opts) const
+    {
+      return kmyth_tpm_context_seal_into(ctx_, input, input_len, output,
+                                         output_len, detail::in(opts.auth),
+                                         opts.auth.size(),
+                                         const_cast<int *>(opts.pcrs.data()),
+                                         opts.pcrs.size(),
+                                         const_cast<char *>(opts.cipher));
+    }
+
+    kmyth_tpm_context *ctx_ = nullptr;
+    kmyth_compression compression_ = KMYTH_COMPRESSION_NONE;
+  };
+
+}
+
+#endif                          /* KMYTH_HPP */
@@ -7,9 +7,13 @@
 #ifndef SOCKET_UTIL_H
 #define SOCKET_UTIL_H
 
+#include <sys/types.h>
+
 /**
  * <pre>
- * This function sets up a client socket for sending messages.
+ * This function sets up a client socket for sending messages. The host's
+ * addresses (IPv4 and IPv6) are raced as described for
+ * setup_client_socket_any(), within KMYTH_CONNECT_TIMEOUT_MS.
  * </pre>
  *
  * @param[in]  node       The IP address or hostname to connect to.
@@ -22,6 +26,72 @@
  */
 int setup_client_socket(const char *node, const char *service, int *socket_fd);
 
+/**
+ * <pre>
+ * This function sets up a client socket connected to whichever of several
+ * equivalent servers (e.g., replicated key servers) answers first. All of
+ * the servers' addresses are raced ("happy eyeballs", RFC 8305): a new
+ * connection attempt is started every KMYTH_CONNECT_ATTEMPT_DELAY_MS (or as
+ * soon as the pending attempts fail), a server's addresses alternate
+ * between IPv6 and IPv4, and the servers take turns. The first attempt to
+ * connect is kept and the others are abandoned, so a dead address or server
+ * costs one attempt delay rather than a full TCP timeout.
+ * </pre>
+ *
+ * @param[in]  nodes       The IP addresses or hostnames to connect to.
+ *
+ * @param[in]  services    The port number or service for each node.
+ *
+ * @param[in]  count       The number of servers (at most
+ *                         KMYTH_MAX_SERVER_ENDPOINTS).
+ *
+ * @param[in]  timeout_ms  The time (in milliseconds) allowed for a
+ *                         connection to be made.
+ *
+ * @param[out] socket_fd   The new (blocking) socket file descriptor.
+ *
+ * @param[out] index       The index of the server connected to.
+ *
+ * @return 0 on success, 1 on error
+ */
+int setup_client_socket_any(const char **nodes, const char **services,
+                            size_t count, int timeout_ms,
+                            int *socket_fd, size_t *index);
+
+/**
+ * <pre>
+ * This function starts connecting a non-blocking client socket, for use
+ * with an external event loop. The socket is returned as soon as the
+ * connection is in progress: once it polls writable, finish_client_socket()
+ * reports whether the connection was made. The socket remains non-blocking.
+ *
+ * The address is looked up with getaddrinfo(), which may wait on a DNS
+ * query for a host name, so callers that must never stall should pass a
+ * numeric address.
+ * </pre>
+ *
+ * @param[in]  node       The IP address or hostname to connect to.
+ *
+ * @param[in]  service    The port number or service to connect to.
+ *
+ * @param[out] socket_fd  The new (connecting) socket file descriptor.
+ *
+ * @return 0 on success, 1 on error
+ */
+int start_client_socket(const char *node, const char *service, int *socket_fd);
+
+/**
+ * <pre>
+ * This function completes a connection started by start_client_socket(),
+ * once the socket has polled writable.
+ * </pre>
+ *
+ * @param[in]  socket_fd  The connecting socket file descriptor.
+ *
+ * @return 0 if the socket is connected, 1 if the connection failed
+ */
+int finish_client_socket(int socket_fd);
+
 /**
  * <pre>
  * This function sets up a server socket for receiving connections.
@@ -35,4 +105,53 @@ int setup_client_socket(const char *node, const char *service, int *socket_fd);
  */
 int setup_server_socket(const char *service, int *socket_fd);
 
+/**
+ * <pre>
+ * This function sets up a listening local (AF_UNIX) stream socket. A stale
+ * socket left at the path (e.g., by a daemon that did not exit cleanly) is
+ * replaced, but any other existing file is not.
+ * </pre>
+ *
+ * @param[in]  path       The filesystem path to bind the socket to.
+ *
+ * @param[in]  mode       The permission bits for the socket file.
+ *
+ * @param[out] socket_fd  The new socket file descriptor.
+ *
+ * @return 0 on success, 1 on error
+ */
+int setup_unix_server_socket(const char *path, mode_t mode, int *socket_fd);
+
+/**
+ * <pre>
+ * This function connects a local (AF_UNIX) stream socket to a server.
+ * </pre>
+ *
+ * @param[in]  path       The filesystem path of the server socket.
+ *
+ * @param[out] socket_fd  The new socket file descriptor.
+ *
+ * @return 0 on success, 1 on error
+ */
+int setup_unix_client_socket(const char *path, int *socket_fd);
+
+/**
+ * <pre>
+ * This function retrieves the credentials, as recorded by the kernel when
+ * the connection was made, of the process at the other end of a connected
+ * local (AF_UNIX) socket.
+ * </pre>
+ *
+ * @param[in]  socket_fd  The connected socket file descriptor.
+ *
+ * @param[out] uid        The peer's effective user ID.
+ *
+ * @param[out] gid        The peer's effective group ID.
+ *
+ * @param[out] pid        The peer's process ID.
+ *
+ * @return 0 on success, 1 on error
+ */
+int get_peer_credentials(int socket_fd, uid_t * uid, gid_t * gid, pid_t * pid);
+
 #endif
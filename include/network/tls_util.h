@@ -7,6 +7,8 @@
 #ifndef TLS_UTIL_H
 #define TLS_UTIL_H
 
+#include <stdbool.h>
+
 /* // OpenSSL libraries for TLS connection */
 #include <openssl/bio.h>
 
@@ -76,9 +78,144 @@ int tls_set_context(unsigned char *client_private_key,
                     size_t client_private_key_len,
                     char *client_cert_path, char *ca_cert_path, SSL_CTX ** ctx);
 
+/// Largest number of servers a tls_client keeps a resumable session for.
+#define TLS_CLIENT_MAX_SESSIONS 16
+
 /**
  * <pre>
- * This function handles generic OpenSSL cleanup boilerplate.
+ * Opaque handle for a reusable TLS client. It holds an SSL_CTX configured
+ * once (so the client key and certificates are parsed once), a cache of
+ * resumable TLS sessions keyed on server address (optionally persisted to
+ * a file between runs), and one keep-alive connection. A tls_client must
+ * not be used by more than one thread at a time.
+ * </pre>
+ */
+typedef struct tls_client tls_client;
+
+/**
+ * <pre>
+ * This function creates a reusable TLS client.
+ * </pre>
+ * @param[in]  client_private_key      client's private key
+ * @param[in]  client_private_key_len  length (in bytes) of client_private_key
+ * @param[in]  client_cert_path        path to the client's certificate
+ * @param[in]  ca_cert_path            path to the certificate for the
+ *                                     Certificate Authority (CA) that
+ *                                     issued the server certificate
+ * @param[in]  session_cache_path      path to the file sessions are loaded
+ *                                     from and saved to (NULL to keep them
+ *                                     in memory only). The file holds
+ *                                     session secrets, so it is written
+ *                                     with owner-only permissions.
+ * @param[out] client                  the new client (release with
+ *                                     tls_client_free())
+ * @return 0 on success, 1 on error
+ */
+int tls_client_new(unsigned char *client_private_key,
+                   size_t client_private_key_len,
+                   char *client_cert_path, char *ca_cert_path,
+                   const char *session_cache_path, tls_client ** client);
+
+/**
+ * <pre>
+ * This function provides a TLS connection to a server. The client's open
+ * connection is returned if it is to the same server and still usable.
+ * Otherwise a new connection is made, resuming a cached session for the
+ * server when there is one. The connection remains owned by the client.
+ * </pre>
+ * @param[in]  client       the client
+ * @param[in]  server_ip    IP address (or host name) of the server
+ * @param[in]  server_port  port of the server
+ * @param[out] tls_bio      BIO containing the TLS connection
+ * @return 0 on success, 1 on error
+ */
+int tls_client_connect(tls_client * client,
+                       const char *server_ip, const char *server_port,
+                       BIO ** tls_bio);
+
+/**
+ * <pre>
+ * This function provides a TLS connection to whichever of several
+ * equivalent servers (e.g., replicated KMIP servers) answers first. The
+ * client's open connection is returned if it is to one of the servers and
+ * still usable. Otherwise the servers are raced as described for
+ * setup_client_socket_any(), and a server that connects but fails the TLS
+ * handshake is dropped and the remaining servers raced again.
+ * </pre>
+ * @param[in]  client        the client
+ * @param[in]  server_ips    IP address (or host name) of each server
+ * @param[in]  server_ports  port of each server
+ * @param[in]  server_count  number of servers (at most
+ *                           KMYTH_MAX_SERVER_ENDPOINTS)
+ * @param[out] tls_bio       BIO containing the TLS connection
+ * @param[out] server_index  index of the server connected to
+ * @return 0 on success, 1 on error
+ */
+int tls_client_connect_any(tls_client * client,
+                           const char **server_ips, const char **server_ports,
+                           size_t server_count,
+                           BIO ** tls_bio, size_t *server_index);
+
+/**
+ * <pre>
+ * This function sets the time a client allows for new connections, in
+ * place of the KMYTH_CONNECT_TIMEOUT_MS and KMYTH_HANDSHAKE_TIMEOUT_MS
+ * defaults.
+ * </pre>
+ * @param[in]  client                the client
+ * @param[in]  connect_timeout_ms    time (in milliseconds) allowed for a
+ *                                   TCP connection to be made
+ * @param[in]  handshake_timeout_ms  time (in milliseconds) allowed for the
+ *                                   TLS handshake, once connected
+ * @return 0 on success, 1 on error
+ */
+int tls_client_set_timeouts(tls_client * client, int connect_timeout_ms,
+                            int handshake_timeout_ms);
+
+/**
+ * <pre>
+ * This function turns kernel TLS (kTLS) on or off for a client's new
+ * connections. With kTLS on, once the handshake is done the TLS records
+ * are encrypted and decrypted by the kernel rather than by OpenSSL, so
+ * data written to or read from the connection's BIO is not copied through
+ * OpenSSL's record buffers. The connection falls back to user-space
+ * record processing if the kernel (the 'tls' module) or the negotiated
+ * cipher does not support kTLS, or if OpenSSL was built without it (which
+ * is logged, but is not an error).
+ * </pre>
+ * @param[in]  client  the client
+ * @param[in]  enable  true to use kTLS, false (the default) not to
+ * @return 0 on success, 1 on error
+ */
+int tls_client_set_ktls(tls_client * client, bool enable);
+
+/**
+ * <pre>
+ * This function shuts down and releases the client's open connection, if
+ * any (e.g., after an error left it in an unknown state). Cached sessions
+ * are kept.
+ * </pre>
+ * @param[in]  client  the client
+ * @return None
+ */
+void tls_client_disconnect(tls_client * client);
+
+/**
+ * <pre>
+ * This function releases a TLS client, closing its connection and saving
+ * its sessions to the session cache file (if it has one). The handle is
+ * set to NULL.
+ * </pre>
+ * @param[in,out] client  the client to be released
+ * @return None
+ */
+void tls_client_free(tls_client ** client);
+
+/**
+ * <pre>
+ * This function releases the calling thread's OpenSSL state. Global
+ * OpenSSL state is left for OpenSSL to free at exit, so it is safe to
+ * call while other threads are still using TLS.
  * </pre>
  *
  * @return 0;
@@ -89,7 +226,8 @@ int tls_cleanup(void);
  * <pre>
  * This function takes an existing TLS connection (in the form of OpenSSL BIO and SSL_CTX 
  * structures) along with an optional message, sends the message to the server and gets
- * a key back.
+ * a key back. The key is expected in one TLS record (of up to
+ * KMYTH_GETKEY_RX_BUFFER_SIZE bytes), as the simple server does not frame it.
  * </pre>
  *
  * @param[in]  bio             OpenSSL BIO structure with the connection
@@ -115,7 +253,8 @@ int get_key_from_tls_server(BIO * bio,
  * <pre>
  * This function takes an existing TLS connection (in the form of OpenSSL BIO and SSL_CTX
  * structures) along with a message (the symmetric key ID), and sends the message to the
- * KMIP server to retrieve the key.
+ * KMIP server to retrieve the key. The response is read in full, however it is split
+ * into TLS records, into one buffer sized from its KMIP TTLV header.
  * </pre>
  *
  * @param[in]  bio             OpenSSL BIO structure with the connection
@@ -133,4 +272,211 @@ int get_key_from_tls_server(BIO * bio,
 int get_key_from_kmip_server(BIO * bio,
                              char *message, size_t message_length,
                              unsigned char **key, size_t * key_size);
+
+/**
+ * <pre>
+ * This function takes an existing TLS connection to a KMIP server and
+ * retrieves several symmetric keys in one round trip, sending one KMIP
+ * Get request with a batch item for each key ID.
+ * </pre>
+ *
+ * @param[in]  bio           OpenSSL BIO structure with the connection
+ *                           already instantiated
+ * @param[in]  key_ids       the (null terminated) IDs of the keys to retrieve
+ *
+ * @param[in]  key_id_count  number of key IDs (at most
+ *                           KMIP_GET_BATCH_MAX_ITEMS)
+ *
+ * @param[out] keys          array of key_id_count entries, set to the keys
+ *                           retrieved (in key_ids order, to be cleared and
+ *                           freed by the caller)
+ *
+ * @param[out] key_sizes     array of key_id_count entries, set to the sizes
+ *                           of the keys retrieved
+ *
+ * @return 0 if success, 1 if error (no keys are returned if any of the
+ *         keys could not be retrieved)
+ */
+int get_keys_from_kmip_server(BIO * bio,
+                              char **key_ids, size_t key_id_count,
+                              unsigned char **keys, size_t *key_sizes);
+
+/// Largest number of connections a kmip_pool holds.
+#define KMIP_POOL_MAX_CONNECTIONS 64
+
+/**
+ * <pre>
+ * Opaque handle for a pool of long-lived TLS connections to a KMIP server,
+ * for a server that retrieves keys from an upstream key store on behalf of
+ * its own clients. Each connection is a tls_client kept together with the
+ * KMIP context and encoding buffer used on it, so a request through the
+ * pool reuses an open, authenticated connection and its KMIP state (a new
+ * connection is made only when the old one was closed or failed). A pool
+ * may be shared by several threads: each request has a connection to
+ * itself for its duration, waiting for one if all of them are in use.
+ * </pre>
+ */
+typedef struct kmip_pool kmip_pool;
+
+/**
+ * <pre>
+ * This function creates a pool of connections to a KMIP server. The
+ * client key and certificates are loaded for each connection here, while
+ * the connections themselves are made as they are first used.
+ * </pre>
+ * @param[in]  client_private_key      client's private key
+ * @param[in]  client_private_key_len  length (in bytes) of client_private_key
+ * @param[in]  client_cert_path        path to the client's certificate
+ * @param[in]  ca_cert_path            path to the certificate for the
+ *                                     Certificate Authority (CA) that
+ *                                     issued the server certificate
+ * @param[in]  server_ip               IP address (or host name) of the
+ *                                     KMIP server
+ * @param[in]  server_port             port of the KMIP server
+ * @param[in]  size                    number of connections (at most
+ *                                     KMIP_POOL_MAX_CONNECTIONS), e.g., the
+ *                                     number of threads sharing the pool
+ * @param[out] pool                    the new pool (release with
+ *                                     kmip_pool_free())
+ * @return 0 on success, 1 on error
+ */
+int kmip_pool_new(unsigned char *client_private_key,
+                  size_t client_private_key_len,
+                  char *client_cert_path, char *ca_cert_path,
+                  const char *server_ip, const char *server_port,
+                  size_t size, kmip_pool ** pool);
+
+/**
+ * <pre>
+ * This function retrieves several symmetric keys from the pool's KMIP
+ * server, as get_keys_from_kmip_server() does, over one of the pool's
+ * connections.
+ * </pre>
+ * @param[in]  pool          the pool
+ * @param[in]  key_ids       the (null terminated) IDs of the keys to retrieve
+ * @param[in]  key_id_count  number of key IDs (at most
+ *                           KMIP_GET_BATCH_MAX_ITEMS)
+ * @param[out] keys          array of key_id_count entries, set to the keys
+ *                           retrieved (in key_ids order, to be cleared and
+ *                           freed by the caller)
+ * @param[out] key_sizes     array of key_id_count entries, set to the sizes
+ *                           of the keys retrieved
+ * @return 0 if success, 1 if error
+ */
+int kmip_pool_get_keys(kmip_pool * pool,
+                       char **key_ids, size_t key_id_count,
+                       unsigned char **keys, size_t *key_sizes);
+
+/**
+ * <pre>
+ * This function closes a pool's connections and releases it. No request
+ * may be in progress on the pool. The handle is set to NULL.
+ * </pre>
+ * @param[in,out] pool  the pool to be released
+ * @return None
+ */
+void kmip_pool_free(kmip_pool ** pool);
+
+/**
+ * <pre>
+ * Result of a tls_async_step(): the event the operation's socket must be
+ * polled for before the next step can make progress, or how it ended.
+ * </pre>
+ */
+typedef enum tls_async_status
+{
+  TLS_ASYNC_WANT_READ,
+  TLS_ASYNC_WANT_WRITE,
+  TLS_ASYNC_DONE,
+  TLS_ASYNC_ERROR
+} tls_async_status;
+
+/**
+ * <pre>
+ * Opaque handle for a non-blocking key retrieval from a KMIP server: a
+ * state machine that connects, makes the TLS handshake, sends one batched
+ * KMIP Get request and reads the response, without ever waiting on its
+ * socket. It is driven from an external event loop (e.g., epoll or
+ * libuv) by calling tls_async_step() whenever its socket is ready for the
+ * event the previous step asked for. Any timeout is the event loop's to
+ * enforce, by freeing the operation. A tls_async must not be used by more
+ * than one thread at a time, but any number may be in flight at once.
+ * </pre>
+ */
+typedef struct tls_async tls_async;
+
+/**
+ * <pre>
+ * This function starts a non-blocking retrieval of one or more keys from a
+ * KMIP server. The connection is started, but no step of the exchange is
+ * taken until tls_async_step() is called.
+ * </pre>
+ * @param[in]  ctx           SSL_CTX set up by tls_set_context() (it may be
+ *                           shared with other operations, and freed by the
+ *                           caller once they are started)
+ * @param[in]  server_ip     IP address of the server (a host name is
+ *                           looked up with a blocking DNS query)
+ * @param[in]  server_port   port of the server
+ * @param[in]  key_ids       the (null terminated) IDs of the keys to
+ *                           retrieve (copied)
+ * @param[in]  key_id_count  number of key IDs (at most
+ *                           KMIP_GET_BATCH_MAX_ITEMS)
+ * @param[out] op            the new operation (release with
+ *                           tls_async_free())
+ * @return 0 on success, 1 on error
+ */
+int tls_async_get_keys_start(SSL_CTX * ctx,
+                             const char *server_ip, const char *server_port,
+                             char **key_ids, size_t key_id_count,
+                             tls_async ** op);
+
+/**
+ * <pre>
+ * This function provides the socket of an operation, for registration
+ * with an event loop. It does not change over the operation's lifetime.
+ * </pre>
+ * @param[in]  op  the operation
+ * @return the socket file descriptor, or -1 if op is NULL
+ */
+int tls_async_fd(const tls_async * op);
+
+/**
+ * <pre>
+ * This function advances an operation as far as it can go without
+ * waiting on its socket.
+ * </pre>
+ * @param[in]  op  the operation
+ * @return TLS_ASYNC_WANT_READ or TLS_ASYNC_WANT_WRITE if the operation
+ *         must be stepped again once its socket is readable or writable,
+ *         TLS_ASYNC_DONE once the keys have been retrieved, or
+ *         TLS_ASYNC_ERROR if the operation failed
+ */
+tls_async_status tls_async_step(tls_async * op);
+
+/**
+ * <pre>
+ * This function hands over the keys retrieved by a finished operation.
+ * </pre>
+ * @param[in]  op         the operation (TLS_ASYNC_DONE must have been
+ *                        returned for it)
+ * @param[out] keys       array of key_id_count entries, set to the keys
+ *                        retrieved (in key_ids order, to be cleared and
+ *                        freed by the caller)
+ * @param[out] key_sizes  array of key_id_count entries, set to the sizes
+ *                        of the keys retrieved
+ * @return 0 on success, 1 on error
+ */
+int tls_async_get_keys_result(tls_async * op,
+                              unsigned char **keys, size_t *key_sizes);
+
+/**
+ * <pre>
+ * This function releases an operation, finished or not, closing its
+ * socket (without waiting to shut the TLS connection down cleanly) and
+ * clearing any keys not handed over. The handle is set to NULL.
+ * </pre>
+ * @param[in,out] op  the operation to be released
+ * @return None
+ */
+void tls_async_free(tls_async ** op);
 #endif
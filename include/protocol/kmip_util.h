@@ -7,6 +7,45 @@
 #ifndef KMYTH_KMIP_UTIL_H
 #define KMYTH_KMIP_UTIL_H
 
+/// Size (in bytes) of a KMIP TTLV item header (tag, type and length).
+#define KMIP_TTLV_HEADER_SIZE 8
+
+/// Largest number of key IDs requested in one batched KMIP Get request.
+#define KMIP_GET_BATCH_MAX_ITEMS 64
+
+/// Size (in bytes) of the Unique Batch Item IDs in a batched KMIP request.
+#define KMIP_GET_BATCH_ITEM_ID_SIZE 2
+
+/// Largest encoding buffer (in bytes) a KMIP message is built in.
+#define KMIP_ENCODING_BUFFER_MAX_SIZE (1024 * 1024)
+
+/**
+ * A buffer KMIP messages are encoded into. It starts out empty
+ * ({ NULL, 0 }), is grown as needed by the build_kmip_*_into() functions
+ * and can be reused for any number of messages, so a caller building one
+ * message after another (e.g., over a session) allocates only when a
+ * message outgrows the last. The bytes past the current message may hold
+ * (parts of) earlier messages, so the buffer is released with
+ * kmip_encoding_buffer_free(), which clears it.
+ */
+typedef struct kmip_encoding_buffer
+{
+  unsigned char *data;
+  size_t size;
+} kmip_encoding_buffer;
+
+/**
+ * <pre>
+ * This function clears and frees an encoding buffer, leaving it empty (and
+ * ready to be used again).
+ * </pre>
+ *
+ * @param[in,out] buffer    the encoding buffer
+ *
+ * @return None
+ */
+void kmip_encoding_buffer_free(kmip_encoding_buffer * buffer);
+
 /**
  * <pre>
  * This function builds a basic KMIP Get request message.
@@ -28,6 +67,62 @@ int build_kmip_get_request(KMIP * ctx,
                            unsigned char *id, size_t id_len,
                            unsigned char **request, size_t *request_len);
 
+/**
+ * <pre>
+ * This function builds a KMIP Get request message with one batch item for
+ * each of the given key IDs, so several keys are retrieved in one round
+ * trip.
+ * </pre>
+ *
+ * @param[in]  ctx          the KMIP context used to build the message
+ *
+ * @param[in]  ids          the IDs of the KMIP objects to retrieve
+ *
+ * @param[in]  id_lens      lengths (in bytes) of the IDs to retrieve
+ *
+ * @param[in]  id_count     number of IDs to retrieve (at most
+ *                          KMIP_GET_BATCH_MAX_ITEMS)
+ *
+ * @param[out] request      the KMIP Get request message
+ *
+ * @param[out] request_len  length (in bytes) of the request message
+ *
+ * @return 0 on success, 1 on error
+ */
+int build_kmip_get_batch_request(KMIP * ctx,
+                                 unsigned char **ids, size_t *id_lens,
+                                 size_t id_count,
+                                 unsigned char **request, size_t *request_len);
+
+/**
+ * <pre>
+ * This function builds the same KMIP Get request message as
+ * build_kmip_get_batch_request(), encoded into a (reusable) encoding
+ * buffer: the message is the first request_len bytes of buffer->data,
+ * and stays valid until the buffer is next used or freed.
+ * </pre>
+ *
+ * @param[in]     ctx          the KMIP context used to build the message
+ *
+ * @param[in]     ids          the IDs of the KMIP objects to retrieve
+ *
+ * @param[in]     id_lens      lengths (in bytes) of the IDs to retrieve
+ *
+ * @param[in]     id_count     number of IDs to retrieve (at most
+ *                             KMIP_GET_BATCH_MAX_ITEMS)
+ *
+ * @param[in,out] buffer       the encoding buffer (grown as needed)
+ *
+ * @param[out]    request_len  length (in bytes) of the request message
+ *
+ * @return 0 on success, 1 on error
+ */
+int build_kmip_get_batch_request_into(KMIP * ctx,
+                                      unsigned char **ids, size_t *id_lens,
+                                      size_t id_count,
+                                      kmip_encoding_buffer * buffer,
+                                      size_t *request_len);
+
 /**
  * <pre>
  * This function parses a basic KMIP Get request message.
@@ -49,6 +144,40 @@ int parse_kmip_get_request(KMIP * ctx,
                            unsigned char *request, size_t request_len,
                            unsigned char **id, size_t *id_len);
 
+/**
+ * <pre>
+ * This function parses a KMIP Get request message with one or more batch
+ * items. Each item's Unique Batch Item ID (required when there is more than
+ * one item) is returned alongside its key ID, so that the response can echo
+ * it back in whatever order the keys are answered.
+ * </pre>
+ *
+ * @param[in]  ctx           the KMIP context used to parse the message
+ *
+ * @param[in]  request       the KMIP Get request message
+ *
+ * @param[in]  request_len   length (in bytes) of the request message
+ *
+ * @param[out] ids           the IDs of the KMIP objects to retrieve (an
+ *                           array of KMIP_GET_BATCH_MAX_ITEMS entries)
+ *
+ * @param[out] id_lens       lengths (in bytes) of the IDs to retrieve
+ *
+ * @param[out] item_ids      the Unique Batch Item ID of each request item
+ *                           (NULL for a single item that carries none)
+ *
+ * @param[out] item_id_lens  lengths (in bytes) of the batch item IDs
+ *
+ * @param[out] id_count      number of IDs requested
+ *
+ * @return 0 on success, 1 on error
+ */
+int parse_kmip_get_batch_request(KMIP * ctx,
+                                 unsigned char *request, size_t request_len,
+                                 unsigned char **ids, size_t *id_lens,
+                                 unsigned char **item_ids,
+                                 size_t *item_id_lens, size_t *id_count);
+
 /**
  * <pre>
  * This function builds a KMIP Get response message.
@@ -75,6 +204,87 @@ int build_kmip_get_response(KMIP * ctx,
                             unsigned char *key, size_t key_len,
                             unsigned char **response, size_t *response_len);
 
+/**
+ * <pre>
+ * This function builds a KMIP Get response message answering a batched
+ * request, with one batch item per key. The items are encoded in the order
+ * given, each echoing the Unique Batch Item ID of the request item it
+ * answers.
+ * </pre>
+ *
+ * @param[in]  ctx           the KMIP context used to build the message
+ *
+ * @param[in]  ids           the key IDs
+ *
+ * @param[in]  id_lens       lengths (in bytes) of the key IDs
+ *
+ * @param[in]  item_ids      the Unique Batch Item IDs to echo (entries may
+ *                           be NULL)
+ *
+ * @param[in]  item_id_lens  lengths (in bytes) of the batch item IDs
+ *
+ * @param[in]  keys          the symmetric keys
+ *
+ * @param[in]  key_lens      lengths (in bytes) of the keys
+ *
+ * @param[in]  id_count      number of keys (at most KMIP_GET_BATCH_MAX_ITEMS)
+ *
+ * @param[out] response      the KMIP Get response message
+ *
+ * @param[out] response_len  length (in bytes) of the response message
+ *
+ * @return 0 on success, 1 on error
+ */
+int build_kmip_get_batch_response(KMIP * ctx,
+                                  unsigned char **ids, size_t *id_lens,
+                                  unsigned char **item_ids,
+                                  size_t *item_id_lens,
+                                  unsigned char **keys, size_t *key_lens,
+                                  size_t id_count,
+                                  unsigned char **response,
+                                  size_t *response_len);
+
+/**
+ * <pre>
+ * This function builds the same KMIP Get response message as
+ * build_kmip_get_batch_response(), encoded into a (reusable) encoding
+ * buffer: the message is the first response_len bytes of buffer->data,
+ * and stays valid until the buffer is next used or freed.
+ * </pre>
+ *
+ * @param[in]     ctx           the KMIP context used to build the message
+ *
+ * @param[in]     ids           the key IDs
+ *
+ * @param[in]     id_lens       lengths (in bytes) of the key IDs
+ *
+ * @param[in]     item_ids      the Unique Batch Item IDs to echo (entries
+ *                              may be NULL)
+ *
+ * @param[in]     item_id_lens  lengths (in bytes) of the batch item IDs
+ *
+ * @param[in]     keys          the symmetric keys
+ *
+ * @param[in]     key_lens      lengths (in bytes) of the keys
+ *
+ * @param[in]     id_count      number of keys (at most
+ *                              KMIP_GET_BATCH_MAX_ITEMS)
+ *
+ * @param[in,out] buffer        the encoding buffer (grown as needed)
+ *
+ * @param[out]    response_len  length (in bytes) of the response message
+ *
+ * @return 0 on success, 1 on error
+ */
+int build_kmip_get_batch_response_into(KMIP * ctx,
+                                       unsigned char **ids, size_t *id_lens,
+                                       unsigned char **item_ids,
+                                       size_t *item_id_lens,
+                                       unsigned char **keys,
+                                       size_t *key_lens, size_t id_count,
+                                       kmip_encoding_buffer * buffer,
+                                       size_t *response_len);
+
 /**
  * <pre>
  * This function parses a KMIP Get response message.
@@ -101,4 +311,37 @@ int parse_kmip_get_response(KMIP * ctx,
                             unsigned char **id, size_t *id_len,
                             unsigned char **key, size_t *key_len);
 
+/**
+ * <pre>
+ * This function parses the response to a batched KMIP Get request. The
+ * i-th output entries hold the key answering the i-th requested ID, even
+ * if the server answered the batch items out of order. The response fails
+ * as a whole if any of its batch items failed.
+ * </pre>
+ *
+ * @param[in]  ctx           the KMIP context used to parse the message
+ *
+ * @param[in]  response      the KMIP Get response message
+ *
+ * @param[in]  response_len  length (in bytes) of the response message
+ *
+ * @param[in]  id_count      number of IDs that were requested (and size of
+ *                           each of the output arrays)
+ *
+ * @param[out] ids           the retrieved key IDs
+ *
+ * @param[out] id_lens       lengths (in bytes) of the retrieved key IDs
+ *
+ * @param[out] keys          the retrieved keys
+ *
+ * @param[out] key_lens      lengths (in bytes) of the retrieved keys
+ *
+ * @return 0 on success, 1 on error
+ */
+int parse_kmip_get_batch_response(KMIP * ctx,
+                                  unsigned char *response,
+                                  size_t response_len, size_t id_count,
+                                  unsigned char **ids, size_t *id_lens,
+                                  unsigned char **keys, size_t *key_lens);
+
 #endif
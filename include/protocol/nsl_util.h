@@ -7,9 +7,73 @@
 #ifndef NSL_UTIL_H
 #define NSL_UTIL_H
 
+#include <stddef.h>
+
+#include <openssl/evp.h>
+
+#include "kdf_util.h"
+
+/**
+ * @brief Elliptic curve used for the ephemeral keys and the ECDSA signing
+ *        keys of the ECDH protocol variant (P-256).
+ */
+#define NSL_ECDH_CURVE_NID NID_X9_62_prime256v1
+
+/**
+ * @brief Protocols an NSL endpoint can negotiate a session key with.
+ */
+typedef enum nsl_protocol
+{
+  /// @brief Needham-Schroeder-Lowe nonce exchange, encrypted with RSA keys
+  NSL_PROTOCOL_RSA,
+
+  /// @brief ephemeral ECDH (P-256) exchange, authenticated with ECDSA
+  ///        signatures over both ephemeral keys and the peer's ID
+  NSL_PROTOCOL_ECDH
+} nsl_protocol;
+
+/**
+ * @brief A local NSL protocol endpoint: the key material and ID used for
+ *        every session it negotiates. The key contexts are parsed and
+ *        initialized once, so an endpoint can be reused for any number of
+ *        sessions without re-reading or re-initializing them.
+ */
+typedef struct nsl_endpoint
+{
+  /// @brief protocol used for every session negotiated by the endpoint
+  nsl_protocol protocol;
+
+  /// @brief remote public key context, initialized for encryption
+  ///        (NSL_PROTOCOL_RSA only)
+  EVP_PKEY_CTX *public_key_ctx;
+
+  /// @brief local private key context, initialized for decryption
+  ///        (NSL_PROTOCOL_RSA only)
+  EVP_PKEY_CTX *private_key_ctx;
+
+  /// @brief remote signature verification key (NSL_PROTOCOL_ECDH only)
+  EVP_PKEY *public_key;
+
+  /// @brief local signing key (NSL_PROTOCOL_ECDH only)
+  EVP_PKEY *private_key;
+
+  /// @brief the local ID
+  unsigned char *id;
+
+  /// @brief length (in bytes) of the local ID
+  size_t id_len;
+
+  /// @brief session key derivation (NSL_PROTOCOL_RSA), set up for
+  ///        KMYTH_KDF_HASH; may be re-initialized with kdf_params_init()
+  ///        to select another hash (both peers must agree on it)
+  kdf_params session_key_kdf;
+} nsl_endpoint;
+
 /**
  * <pre>
  * This function encrypts plaintext using the provided EVP keypair context.
+ * The context must already be initialized for encryption, as done by
+ * setup_public_evp_context().
  * </pre>
  *
  * @param[in]  ctx    EVP keypair context used for encryption
@@ -24,13 +88,15 @@
  *
  * @return 0 on success, 1 on error
  */
-int encrypt_with_key_pair(EVP_PKEY_CTX ctx,
+int encrypt_with_key_pair(EVP_PKEY_CTX * ctx,
                           const unsigned char *p, size_t p_len,
                           unsigned char **c, size_t *c_len);
 
 /**
  * <pre>
  * This function decrypts ciphertext using the provided EVP keypair context.
+ * The context must already be initialized for decryption, as done by
+ * setup_private_evp_context().
  * </pre>
  *
  * @param[in]  ctx    EVP keypair context used for decryption
@@ -39,13 +105,14 @@ int encrypt_with_key_pair(EVP_PKEY_CTX ctx,
  *
  * @param[in]  c_len  length (in bytes) of the ciphertext
  *
- * @param[out] p      plaintext
+ * @param[out] p      plaintext, allocated with kmyth_secure_alloc()
+ *                    (release with kmyth_secure_free())
  *
  * @param[out] p_len  length (in bytes) of the plaintext
  *
  * @return 0 on success, 1 on error
  */
-int decrypt_with_key_pair(EVP_PKEY_CTX ctx,
+int decrypt_with_key_pair(EVP_PKEY_CTX * ctx,
                           const unsigned char *c, size_t c_len,
                           unsigned char **p, size_t *p_len);
 
@@ -209,7 +276,8 @@ int parse_nonce_confirmation(EVP_PKEY_CTX * ctx,
 
 /**
  * <pre>
- * This function sets up the EVP context for a public key.
+ * This function sets up the EVP context for a public key, initialized
+ * for encryption.
  * </pre>
  *
  * @param[in] filepath  The file path to the public key file.
@@ -220,7 +288,8 @@ EVP_PKEY_CTX *setup_public_evp_context(const char *filepath);
 
 /**
  * <pre>
- * This function sets up the EVP context for a private key.
+ * This function sets up the EVP context for a private key, initialized
+ * for decryption.
  * </pre>
  *
  * @param[in] filepath  The file path to the private key file.
@@ -231,9 +300,50 @@ EVP_PKEY_CTX *setup_private_evp_context(const char *filepath);
 
 /**
  * <pre>
- * This function generates a session key from two nonce values.
+ * This function sets up an NSL endpoint, loading its key files and
+ * copying its ID. NSL_PROTOCOL_RSA endpoints take RSA keys, and
+ * NSL_PROTOCOL_ECDH endpoints take EC keys on the NSL_ECDH_CURVE_NID curve.
  * </pre>
  *
+ * @param[out] endpoint          the endpoint to be set up (release with
+ *                               nsl_endpoint_cleanup())
+ *
+ * @param[in]  protocol          protocol the endpoint negotiates with
+ *
+ * @param[in]  public_key_path   path to the remote public key file
+ *
+ * @param[in]  private_key_path  path to the local private key file
+ *
+ * @param[in]  id                the local ID
+ *
+ * @param[in]  id_len            length (in bytes) of the local ID
+ *
+ * @return 0 on success, 1 on error
+ */
+int nsl_endpoint_init(nsl_endpoint * endpoint, nsl_protocol protocol,
+                      const char *public_key_path,
+                      const char *private_key_path,
+                      const unsigned char *id, size_t id_len);
+
+/**
+ * <pre>
+ * This function releases the key contexts and ID held by an NSL endpoint.
+ * </pre>
+ *
+ * @param[in]  endpoint  the endpoint to be cleaned up
+ *
+ * @return None
+ */
+void nsl_endpoint_cleanup(nsl_endpoint * endpoint);
+
+/**
+ * <pre>
+ * This function generates a session key from two nonce values, with
+ * HKDF over their concatenation.
+ * </pre>
+ *
+ * @param[in]  kdf          the session key derivation parameters
+ *
  * @param[in]  nonce_a      nonce A
  *
  * @param[in]  nonce_a_len  length (in bytes) of nonce A
@@ -248,7 +358,8 @@ EVP_PKEY_CTX *setup_private_evp_context(const char *filepath);
  *
  * @return 0 on success, 1 on error
  */
-int generate_session_key(unsigned char *nonce_a, size_t nonce_a_len,
+int generate_session_key(const kdf_params * kdf,
+                         unsigned char *nonce_a, size_t nonce_a_len,
                          unsigned char *nonce_b, size_t nonce_b_len,
                          unsigned char **key, size_t *key_len);
 /**
@@ -270,17 +381,12 @@ int generate_nonce(size_t desired_min_nonce_len, unsigned char **nonce,
 /**
  * <pre>
  * This function runs the client side NSL negotation to obtain a shared session key.
+ * The endpoint's protocol selects the exchange; both peers must use the same one.
  * </pre>
  *
  * @param[in]  socket_fd        the open socket file descriptor
  *
- * @param[in]  public_key_ctx   the EVP_PKEY_CTX containing the remote public key
- *
- * @param[in]  private_key_ctx  the EVP_PKEY_CTX containing the local private key
- *
- * @param[in]  id               the local ID
- *
- * @param[in]  id_len           length (in bytes) of the local ID
+ * @param[in]  endpoint         the local endpoint (keys and ID)
  *
  * @param[in]  expected_id      the expected ID
  *
@@ -292,10 +398,7 @@ int generate_nonce(size_t desired_min_nonce_len, unsigned char **nonce,
  *
  * @return 0 on success, 1 on error
  */
-int negotiate_client_session_key(int socket_fd,
-                                 EVP_PKEY_CTX * public_key_ctx,
-                                 EVP_PKEY_CTX * private_key_ctx,
-                                 unsigned char *id, size_t id_len,
+int negotiate_client_session_key(int socket_fd, nsl_endpoint * endpoint,
                                  unsigned char *expected_id,
                                  size_t expected_id_len,
                                  unsigned char **session_key,
@@ -304,28 +407,20 @@ int negotiate_client_session_key(int socket_fd,
 /**
  * <pre>
  * This function runs the server side NSL negotiation to obtain a shared session key.
+ * The endpoint's protocol selects the exchange; both peers must use the same one.
  * </pre>
  *
  * @param[in]  socket_fd        the open socket file descriptor
  *
- * @param[in]  public_key_ctx   the EVP_PKEY_CTX containing the remote public key
- *
- * @param[in]  private_key_ctx  the EVP_PKEY_CTX containing the local private key
- *
- * @param[in]  id               the local ID
+ * @param[in]  endpoint         the local endpoint (keys and ID)
  *
- * @param[in]  id_len           length (in bytes) of the local ID
- * 
  * @param[out] session_key      the session key
  *
  * @param[out] session_key_len  length (in bytes) of the session key
  *
  * @return 0 on success, 1 on error
  */
-int negotiate_server_session_key(int socket_fd,
-                                 EVP_PKEY_CTX * public_key_ctx,
-                                 EVP_PKEY_CTX * private_key_ctx,
-                                 unsigned char *id, size_t id_len,
+int negotiate_server_session_key(int socket_fd, nsl_endpoint * endpoint,
                                  unsigned char **session_key,
                                  size_t *session_key_len);
 #endif
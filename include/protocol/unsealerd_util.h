@@ -0,0 +1,238 @@
+/**
+ * @file unsealerd_util.h
+ *
+ * @brief Utility functions supporting the kmyth-unsealerd local socket
+ *        protocol.
+ *
+ * Each message is an 8-byte header (protocol version, message type, two
+ * reserved zero bytes, and the body length as a 32-bit big-endian value)
+ * followed by the body. A client sends an UNSEALERD_MSG_UNSEAL request,
+ * whose body is the 32-bit big-endian length of the authorization string,
+ * the authorization string, and the contents of the .ski file, and the
+ * daemon replies with an UNSEALERD_MSG_DATA message holding the unsealed
+ * data or an (empty) UNSEALERD_MSG_ERROR message. A client may send any
+ * number of requests over one connection.
+ *
+ * A client may instead send an UNSEALERD_MSG_UNSEAL_FD request (with the
+ * same body), to which the daemon replies with an UNSEALERD_MSG_FD message:
+ * the unsealed data is written to a memory file (see
+ * write_bytes_to_secret_fd()) whose descriptor is passed, as SCM_RIGHTS
+ * ancillary data, with the message header, and the body is the 64-bit
+ * big-endian length of the data. The unsealed data then never passes
+ * through the socket, or the client's heap.
+ */
+
+#ifndef UNSEALERD_UTIL_H
+#define UNSEALERD_UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// kmyth-unsealerd protocol version carried in every message header.
+#define UNSEALERD_PROTOCOL_VERSION 1
+
+/// Size (in bytes) of the kmyth-unsealerd message header.
+#define UNSEALERD_HEADER_SIZE 8
+
+/**
+ * @brief kmyth-unsealerd message types
+ */
+typedef enum unsealerd_msg_type
+{
+  UNSEALERD_MSG_UNSEAL = 1,     ///< client request to unseal a .ski
+  UNSEALERD_MSG_DATA = 2,       ///< daemon reply carrying unsealed data
+  UNSEALERD_MSG_ERROR = 3,      ///< daemon reply for a failed request
+  UNSEALERD_MSG_UNSEAL_FD = 4,  ///< client request to unseal a .ski to a fd
+  UNSEALERD_MSG_FD = 5,         ///< daemon reply passing a memory file fd
+} unsealerd_msg_type;
+
+/**
+ * <pre>
+ * This function sends a complete kmyth-unsealerd message over a connected
+ * socket.
+ * </pre>
+ *
+ * @param[in]  socket_fd  The connected socket file descriptor
+ *
+ * @param[in]  type       The message type
+ *
+ * @param[in]  body       The message body (may be NULL if body_len is 0)
+ *
+ * @param[in]  body_len   Length (in bytes) of the message body
+ *
+ * @return 0 on success, 1 on error
+ */
+int send_unsealerd_message(int socket_fd, uint8_t type,
+                           const uint8_t * body, size_t body_len);
+
+/**
+ * <pre>
+ * This function receives a complete kmyth-unsealerd message from a
+ * connected socket.
+ * </pre>
+ *
+ * @param[in]  socket_fd  The connected socket file descriptor
+ *
+ * @param[in]  max_len    Largest message body (in bytes) to accept
+ *
+ * @param[out] type       The message type
+ *
+ * @param[out] body       The message body (to be cleared and freed by the
+ *                        caller)
+ *
+ * @param[out] body_len   Length (in bytes) of the message body
+ *
+ * @return 0 on success, 1 on error (including the peer closing the connection)
+ */
+int recv_unsealerd_message(int socket_fd, size_t max_len, uint8_t * type,
+                           uint8_t ** body, size_t *body_len);
+
+/**
+ * <pre>
+ * This function sends an UNSEALERD_MSG_FD message, passing a file
+ * descriptor over a connected AF_UNIX socket.
+ * </pre>
+ *
+ * @param[in]  socket_fd  The connected socket file descriptor
+ *
+ * @param[in]  fd         The file descriptor to pass (still to be closed by
+ *                        the caller)
+ *
+ * @param[in]  data_len   Length (in bytes) of the data the file holds
+ *
+ * @return 0 on success, 1 on error
+ */
+int send_unsealerd_fd_message(int socket_fd, int fd, size_t data_len);
+
+/**
+ * <pre>
+ * This function receives a complete kmyth-unsealerd message from a
+ * connected socket, along with any file descriptor passed with it.
+ * </pre>
+ *
+ * @param[in]  socket_fd  The connected socket file descriptor
+ *
+ * @param[in]  max_len    Largest message body (in bytes) to accept
+ *
+ * @param[out] type       The message type
+ *
+ * @param[out] body       The message body (to be cleared and freed by the
+ *                        caller)
+ *
+ * @param[out] body_len   Length (in bytes) of the message body
+ *
+ * @param[out] fd         The file descriptor passed with the message (to be
+ *                        closed by the caller), or -1 if there was none
+ *
+ * @return 0 on success, 1 on error (including the peer closing the connection)
+ */
+int recv_unsealerd_message_fd(int socket_fd, size_t max_len, uint8_t * type,
+                              uint8_t ** body, size_t *body_len, int *fd);
+
+/**
+ * <pre>
+ * This function builds the body of an unseal request message.
+ * </pre>
+ *
+ * @param[in]  auth_bytes      The authorization string (may be NULL)
+ *
+ * @param[in]  auth_bytes_len  Length (in bytes) of the authorization string
+ *
+ * @param[in]  ski_bytes       The contents of the .ski file to unseal
+ *
+ * @param[in]  ski_bytes_len   Length (in bytes) of the .ski contents
+ *
+ * @param[out] request         The request body (to be cleared and freed by
+ *                             the caller, as it holds the authorization
+ *                             string)
+ *
+ * @param[out] request_len     Length (in bytes) of the request body
+ *
+ * @return 0 on success, 1 on error
+ */
+int build_unseal_request(const uint8_t * auth_bytes, size_t auth_bytes_len,
+                         const uint8_t * ski_bytes, size_t ski_bytes_len,
+                         uint8_t ** request, size_t *request_len);
+
+/**
+ * <pre>
+ * This function parses the body of an unseal request message. The outputs
+ * point into the request body, nothing is copied.
+ * </pre>
+ *
+ * @param[in]  request         The request body
+ *
+ * @param[in]  request_len     Length (in bytes) of the request body
+ *
+ * @param[out] auth_bytes      The authorization string
+ *
+ * @param[out] auth_bytes_len  Length (in bytes) of the authorization string
+ *
+ * @param[out] ski_bytes       The contents of the .ski file to unseal
+ *
+ * @param[out] ski_bytes_len   Length (in bytes) of the .ski contents
+ *
+ * @return 0 on success, 1 on error
+ */
+int parse_unseal_request(uint8_t * request, size_t request_len,
+                         uint8_t ** auth_bytes, size_t *auth_bytes_len,
+                         uint8_t ** ski_bytes, size_t *ski_bytes_len);
+
+/**
+ * <pre>
+ * This function asks a running kmyth-unsealerd to unseal the contents of a
+ * .ski file, using the daemon's warm TPM context.
+ * </pre>
+ *
+ * @param[in]  socket_path     Path of the kmyth-unsealerd socket
+ *
+ * @param[in]  ski_bytes       The contents of the .ski file to unseal
+ *
+ * @param[in]  ski_bytes_len   Length (in bytes) of the .ski contents
+ *
+ * @param[in]  auth_bytes      The authorization string (may be NULL)
+ *
+ * @param[in]  auth_bytes_len  Length (in bytes) of the authorization string
+ *
+ * @param[out] output          The unsealed data (to be cleared and freed by
+ *                             the caller)
+ *
+ * @param[out] output_len      Length (in bytes) of the unsealed data
+ *
+ * @return 0 on success, 1 on error
+ */
+int unsealerd_unseal(const char *socket_path,
+                     const uint8_t * ski_bytes, size_t ski_bytes_len,
+                     const uint8_t * auth_bytes, size_t auth_bytes_len,
+                     uint8_t ** output, size_t *output_len);
+
+/**
+ * <pre>
+ * This function asks a running kmyth-unsealerd to unseal the contents of a
+ * .ski file into a memory file, which it passes back by file descriptor.
+ * </pre>
+ *
+ * @param[in]  socket_path     Path of the kmyth-unsealerd socket
+ *
+ * @param[in]  ski_bytes       The contents of the .ski file to unseal
+ *
+ * @param[in]  ski_bytes_len   Length (in bytes) of the .ski contents
+ *
+ * @param[in]  auth_bytes      The authorization string (may be NULL)
+ *
+ * @param[in]  auth_bytes_len  Length (in bytes) of the authorization string
+ *
+ * @param[out] fd              The memory file holding the unsealed data (to
+ *                             be closed by the caller, see
+ *                             map_bytes_from_secret_fd())
+ *
+ * @param[out] output_len      Length (in bytes) of the unsealed data
+ *
+ * @return 0 on success, 1 on error
+ */
+int unsealerd_unseal_fd(const char *socket_path,
+                        const uint8_t * ski_bytes, size_t ski_bytes_len,
+                        const uint8_t * auth_bytes, size_t auth_bytes_len,
+                        int *fd, size_t *output_len);
+
+#endif
@@ -10,11 +10,304 @@
 #ifndef KMYTH_SEAL_UNSEAL_IMPL_H
 #define KMYTH_SEAL_UNSEAL_IMPL_H
 
+#include <pthread.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #include <tss2/tss2_sys.h>
 
+#include "kmyth.h"
+#include "defines.h"
+#include "marshalling_tools.h"
+#include "tpm2_interface.h"
+#include "cipher/cipher.h"
+
+/**
+ * @brief Entry in a Kmyth TPM context's cache of loaded storage keys (SKs)
+ */
+typedef struct kmyth_sk_cache_entry
+{
+  /// @brief true if this entry holds a loaded SK
+  bool in_use;
+
+  /// @brief digest of the marshalled SK public area (the cache key)
+  uint8_t sk_pub_digest[KMYTH_DIGEST_SIZE];
+
+  /// @brief transient handle of the loaded SK
+  TPM2_HANDLE sk_handle;
+
+  /// @brief value of the context's use counter when this SK was last used
+  uint64_t last_used;
+} kmyth_sk_cache_entry;
+
+/**
+ * @brief Entry in a Kmyth TPM context's cache of saved storage key (SK)
+ *        contexts, from which a flushed SK is restored with
+ *        TPM2_ContextLoad rather than reloaded with TPM2_Load
+ */
+typedef struct kmyth_sk_saved_entry
+{
+  /// @brief digest of the marshalled SK public area (the cache key)
+  uint8_t sk_pub_digest[KMYTH_DIGEST_SIZE];
+
+  /// @brief saved context of the SK, or NULL if this entry is free
+  TPMS_CONTEXT *context;
+
+  /// @brief value of the context's use counter when this SK was last used
+  uint64_t last_used;
+} kmyth_sk_saved_entry;
+
+/**
+ * @brief Reusable TPM 2.0 context state shared by a sequence of Kmyth
+ *        seal/unseal operations (declared opaque in kmyth.h).
+ */
+struct kmyth_tpm_context
+{
+  /**
+   * @brief System API (SAPI) context for the open connection to the
+   *        TPM 2.0 resource manager
+   */
+  TSS2_SYS_CONTEXT *sapi_ctx;
+
+  /**
+   * @brief TPM owner (storage) hierarchy authorization, retained so that
+   *        storage keys can be created or loaded under the SRK on demand
+   */
+  TPM2B_AUTH ownerAuth;
+
+  /**
+   * @brief Persistent handle of the storage root key (SRK)
+   */
+  TPM2_HANDLE srk_handle;
+
+  /**
+   * @brief Storage keys currently loaded under the SRK, keyed on a digest
+   *        of their public area
+   */
+  kmyth_sk_cache_entry sk_cache[KMYTH_SK_CACHE_SIZE];
+
+  /**
+   * @brief Saved contexts of storage keys flushed from sk_cache
+   */
+  kmyth_sk_saved_entry sk_saved[KMYTH_SK_SAVED_CACHE_SIZE];
+
+  /**
+   * @brief Use counter used to find the least recently used cache entry
+   */
+  uint64_t sk_cache_clock;
+
+  /**
+   * @brief Policy session reused (re-armed with TPM2_PolicyRestart) by the
+   *        seal and unseal operations on this context, valid while
+   *        policy_session_open is true
+   */
+  SESSION policy_session;
+
+  /**
+   * @brief true if policy_session has been started and not yet flushed
+   */
+  bool policy_session_open;
+
+  /**
+   * @brief true if the seal and unseal operations on this context use a
+   *        policy session salted to the SRK, encrypting their sensitive
+   *        TPM command and response parameters
+   */
+  bool param_encryption;
+
+  /**
+   * @brief true if the unseal operations on this context first check, in
+   *        software, that the current PCR values satisfy the .ski's policy
+   */
+  bool policy_preflight;
+
+  /**
+   * @brief Values of the PCRs last selected by a seal (or read to diagnose
+   *        a failed unseal), reused while the PCRs are unchanged
+   */
+  kmyth_pcr_snapshot pcr_snapshot;
+
+  /**
+   * @brief Format of the .ski output produced by seal operations
+   */
+  kmyth_ski_format ski_format;
+
+  /**
+   * @brief Compression applied to the data before it is encrypted by seal
+   *        operations (compressed data is always sealed to a binary .ski)
+   */
+  kmyth_compression compression;
+
+  /**
+   * @brief Algorithm (TPM2_ALG_RSA or TPM2_ALG_ECC) of the storage keys
+   *        created by seal operations
+   */
+  TPMI_ALG_PUBLIC sk_alg;
+
+  /**
+   * @brief Directory of pre-created storage keys taken by seal operations
+   *        (see sk_pool.h), or NULL if no pool is used
+   */
+  char *sk_pool_dir;
+
+  /**
+   * @brief OpenSSL cipher contexts reused by the symmetric encryption and
+   *        decryption of the payloads
+   */
+  kmyth_cipher_ctx *cipher_ctx;
+
+  /**
+   * @brief Serializes the TPM commands (and SK cache updates) of concurrent
+   *        seal/unseal calls on the shared connection
+   */
+  pthread_mutex_t tpm_lock;
+
+  /**
+   * @brief Guards cipher_ctx; a call that finds it busy uses single-use
+   *        OpenSSL cipher contexts instead of waiting
+   */
+  pthread_mutex_t cipher_lock;
+};
+
+/**
+ * @brief Computes the digest identifying a storage key (SK) in the SK cache,
+ *        the hash of the marshalled SK public area.
+ *
+ * @param[in]  sk_pub         Public area of the storage key
+ *
+ * @param[out] digest         Buffer (KMYTH_DIGEST_SIZE bytes) to hold the
+ *                            computed digest
+ *
+ * @return 0 on success, 1 on error
+ */
+int get_sk_cache_digest(TPM2B_PUBLIC * sk_pub, uint8_t * digest);
+
+/**
+ * @brief Obtains a handle for a storage key (SK), loading it under the SRK
+ *        only if an identical SK is not already held in the context's SK
+ *        cache. An SK evicted from the cache has its context saved first,
+ *        and is restored from that (TPM2_ContextLoad) if needed again. The
+ *        returned handle remains owned by the cache and must not be
+ *        flushed by the caller.
+ *
+ * @param[in]  ctx            Open Kmyth TPM context
+ *
+ * @param[in]  sk_pub         Public area of the storage key
+ *
+ * @param[in]  sk_priv        Encrypted private area of the storage key
+ *
+ * @param[out] sk_handle      Handle of the loaded storage key
+ *                            (passed as a pointer to the handle value)
+ *
+ * @return 0 on success, 1 on error
+ */
+int load_cached_sk(kmyth_tpm_context * ctx,
+                   TPM2B_PUBLIC * sk_pub,
+                   TPM2B_PRIVATE * sk_priv, TPM2_HANDLE * sk_handle);
+
+/**
+ * @brief Flushes all storage keys held in a context's SK cache from the TPM
+ *        and empties the cache, including its saved SK contexts.
+ *
+ * @param[in]  ctx            Open Kmyth TPM context
+ *
+ * @return None
+ */
+void flush_sk_cache(kmyth_tpm_context * ctx);
+
+/**
+ * @brief Flushes the policy session that a context reuses across seal and
+ *        unseal operations from the TPM, if one is open. The next operation
+ *        starts a new session.
+ *
+ * @param[in]  ctx            Open Kmyth TPM context
+ *
+ * @return None
+ */
+void close_policy_session(kmyth_tpm_context * ctx);
+
+/**
+ * @brief Common implementation of kmyth_tpm_context_seal() and
+ *        kmyth_tpm_context_seal_bundle(). Creates one storage key and one
+ *        sealed wrapping key, encrypts every input under that wrapping key,
+ *        and formats the result as a .ski.
+ *
+ * @param[in]  ctx            Open Kmyth TPM context
+ *
+ * @param[in]  inputs         Array of inputs to be kmyth-sealed
+ *
+ * @param[in]  input_lens     Array of input sizes, in bytes
+ *
+ * @param[in]  input_count    Number of inputs (must be 1 if bundle is false)
+ *
+ * @param[in]  bundle         true to produce a multi-payload bundle .ski,
+ *                            false to produce a standard .ski
+ *
+ * @param[in]  into           true to write a standard .ski into the buffer
+ *                            at *output (of *output_len bytes) instead of
+ *                            allocating one. If *output is NULL, only an
+ *                            upper bound on the .ski size is returned in
+ *                            *output_len, and nothing is sealed.
+ *
+ * @param[out] output         Bytes in .ski format of sealed data
+ *
+ * @param[out] output_len     Number of bytes in output
+ *
+ * @param[in]  auth_bytes     Authorization bytes to be applied to the Kmyth
+ *                            TPM objects created
+ *
+ * @param[in]  auth_bytes_len Number of bytes in auth_bytes
+ *
+ * @param[in]  pcrs           Array containing PCR index selections, if any
+ *
+ * @param[in]  pcrs_len       The length of pcrs
+ *
+ * @param[in]  cipher_string  String indicating the symmetric cipher to use
+ *                            (NULL selects the default cipher)
+ *
+ * @return 0 on success, 1 on error
+ */
+int seal_ski_payloads(kmyth_tpm_context * ctx,
+                      uint8_t ** inputs,
+                      size_t * input_lens,
+                      size_t input_count,
+                      bool bundle,
+                      bool into,
+                      uint8_t ** output,
+                      size_t * output_len,
+                      uint8_t * auth_bytes,
+                      size_t auth_bytes_len,
+                      int *pcrs, size_t pcrs_len, char *cipher_string);
+
+/**
+ * @brief Recovers the symmetric wrapping key sealed in a parsed .ski, by
+ *        loading its storage key (through the context's SK cache) and
+ *        unsealing the wrapping key object.
+ *
+ * @param[in]  ctx            Open Kmyth TPM context
+ *
+ * @param[in]  ski            Parsed .ski contents
+ *
+ * @param[in]  auth_bytes     Authorization bytes applied to the Kmyth TPM
+ *                            objects when they were created
+ *
+ * @param[in]  auth_bytes_len Number of bytes in auth_bytes
+ *
+ * @param[out] key            The unsealed wrapping key, in locked memory
+ *                            (passed as pointer to byte buffer, release
+ *                            with kmyth_secure_free())
+ *
+ * @param[out] key_len        Size, in bytes, of the wrapping key
+ *
+ * @return 0 on success, 1 on error
+ */
+int unseal_ski_wrapping_key(kmyth_tpm_context * ctx,
+                            Ski * ski,
+                            uint8_t * auth_bytes,
+                            size_t auth_bytes_len,
+                            uint8_t ** key, size_t * key_len);
+
 /**
  * @brief Seal data using TPM 2.0.
  *
@@ -27,6 +320,12 @@
  * @param[in]  sapi_ctx       System API (SAPI) context, must be initialized
  *                            and passed in as pointer to the SAPI context
  *
+ * @param[in]  policySession  Policy session, started with
+ *                            create_policy_auth_session() (and restarted, if
+ *                            already used), to authorize the use of the SK,
+ *                            and left open; or NULL to have a session
+ *                            started and flushed within this call
+ *
  * @param[in]  sdo_data       Input data (e.g., symmetric wrapping key) to be
  *                            sealed - pass pointer to input plaintext buffer
  *
@@ -61,6 +360,7 @@
  * @return 0 on success, 1 on error
  */
 int tpm2_kmyth_seal_data(TSS2_SYS_CONTEXT * sapi_ctx,
+                         SESSION * policySession,
                          uint8_t * sdo_data,
                          int sdo_dataSize,
                          TPM2_HANDLE sk_handle,
@@ -81,6 +381,12 @@ int tpm2_kmyth_seal_data(TSS2_SYS_CONTEXT * sapi_ctx,
  * @param[in]  sapi_ctx       System API (SAPI) context, must be initialized
  *                            and passed in as a pointer to the SAPI context
  *
+ * @param[in]  policySession  Policy session, started with
+ *                            create_policy_auth_session() (and restarted, if
+ *                            already used), to authorize both the load and
+ *                            the unseal, and left open; or NULL to have a
+ *                            session started and flushed within this call
+ *
  * @param[in]  sk_handle      The handle for the storage key that was used
  *                            to encrypt the data
  *
@@ -105,8 +411,9 @@ int tpm2_kmyth_seal_data(TSS2_SYS_CONTEXT * sapi_ctx,
  *                            loading the input 'data' blob under the SK and
  *                            then unsealing it. 
  *
- * @param[out] result         The kmyth-unsealed result
- *                            (passed as pointer to byte buffer)
+ * @param[out] result         The kmyth-unsealed result, allocated with
+ *                            kmyth_secure_alloc() (passed as pointer to
+ *                            byte buffer, release with kmyth_secure_free())
  *
  * @param[out] result_size    The size of the kmyth-unsealed (unencrypted)
  *                            result (passed as pointer to size value)
@@ -114,6 +421,7 @@ int tpm2_kmyth_seal_data(TSS2_SYS_CONTEXT * sapi_ctx,
  * @return 0 on success, 1 on error
  */
 int tpm2_kmyth_unseal_data(TSS2_SYS_CONTEXT * sapi_ctx,
+                           SESSION * policySession,
                            TPM2_HANDLE sk_handle,
                            TPM2B_PUBLIC sdo_public,
                            TPM2B_PRIVATE sdo_private,
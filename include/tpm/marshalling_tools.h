@@ -8,15 +8,71 @@
 #ifndef MARSHALLING_TOOLS_H
 #define MARSHALLING_TOOLS_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #include <tss2/tss2_sys.h>
 
 #include "formatting_tools.h"
+#include "kmyth.h"
 
 #include "cipher/cipher.h"
 
+/**
+ * <pre>
+ * Binary (.ski v2) file layout, selected with KMYTH_SKI_FORMAT_BINARY. All
+ * integers are big-endian.
+ *
+ *    magic    ("KMYTHSKI", 8 bytes)
+ *    version  (1 byte, KMYTH_SKI_BINARY_VERSION)
+ *    flags    (1 byte, see KMYTH_SKI_BINARY_FLAG_*)
+ *    reserved (2 bytes, zero)
+ *
+ * followed by seven sections, each a length (8 bytes) and that many bytes:
+ * the PCR selection list, storage key public, storage key encrypted private,
+ * cipher suite name (no terminator), wrapping key public, wrapping key
+ * encrypted private, and encrypted data. The TPM objects are marshalled as
+ * they are (before base64 encoding) in the text format.
+ *
+ * A .ski written as a stream (KMYTH_SKI_BINARY_FLAG_STREAM), before the
+ * size of its encrypted data is known, has KMYTH_SKI_BINARY_STREAM_SIZE in
+ * place of that size: the encrypted data then runs to the end of the file.
+ * Only ciphers whose output authenticates its own end (see the cipher_t
+ * encrypt_stream_fn) may be written this way.
+ *
+ * Data compressed before it was encrypted is flagged with the compression
+ * used (KMYTH_SKI_BINARY_FLAG_ZSTD), so that it is decompressed once it is
+ * decrypted. The text format has no way to record this.
+ * </pre>
+ */
+#define KMYTH_SKI_BINARY_MAGIC "KMYTHSKI"
+#define KMYTH_SKI_BINARY_MAGIC_LEN 8
+#define KMYTH_SKI_BINARY_VERSION 2
+#define KMYTH_SKI_BINARY_HEADER_LEN (KMYTH_SKI_BINARY_MAGIC_LEN + 4)
+#define KMYTH_SKI_BINARY_SECTION_COUNT 7
+
+/// Binary .ski flag: the encrypted data is a multi-payload bundle block
+#define KMYTH_SKI_BINARY_FLAG_BUNDLE 0x01
+
+/// Binary .ski flag: the encrypted data runs to the end of the input
+#define KMYTH_SKI_BINARY_FLAG_STREAM 0x02
+
+/// Binary .ski flag: the data was zstd compressed before it was encrypted
+#define KMYTH_SKI_BINARY_FLAG_ZSTD 0x04
+
+/// Encrypted data size recorded in a stream .ski (size unknown)
+#define KMYTH_SKI_BINARY_STREAM_SIZE UINT64_MAX
+
+/// Largest section, other than the encrypted data, a stream .ski header
+/// is read with (the TPM objects and cipher name are far smaller)
+#define KMYTH_SKI_BINARY_MAX_HEADER_SECTION 65536
+
+/// Number of marshalled TPM objects in a .ski (PCR selection list, storage
+/// key public/private and wrapping key public/private, in that order)
+#define KMYTH_SKI_OBJECT_COUNT 5
+
 typedef struct Ski_s
 {
   //List of PCRs chosen to use when kmyth-sealing
@@ -37,12 +93,49 @@ typedef struct Ski_s
   uint8_t *enc_data;
   size_t enc_data_size;
 
+  //True if enc_data is a multi-payload bundle block (see
+  //pack_bundle_payloads()) rather than a single encrypted payload
+  bool bundle;
+
+  //Compression applied to the data (to each payload of a bundle) before
+  //it was encrypted
+  kmyth_compression compression;
+
 } Ski;
 
+/// SkiView sections decoded so far
+#define KMYTH_SKI_VIEW_CIPHER 0x01
+#define KMYTH_SKI_VIEW_PCR_LIST 0x02
+#define KMYTH_SKI_VIEW_OBJECTS 0x04
+#define KMYTH_SKI_VIEW_ENC_DATA 0x08
+
+/**
+ * A .ski whose sections have been located (and its framing validated) by
+ * open_ski_view(), but which are only decoded as they are first asked for -
+ * e.g., to inspect the cipher or PCR selections of many .ski files without
+ * decoding their encrypted data.
+ */
+typedef struct SkiView_s
+{
+  //Each section of the .ski, in .ski order, as a view into the input (the
+  //cipher suite section is the bare cipher name)
+  uint8_t *sections[KMYTH_SKI_BINARY_SECTION_COUNT];
+  size_t section_sizes[KMYTH_SKI_BINARY_SECTION_COUNT];
+
+  //True if the sections are base64 encoded (a text .ski)
+  bool encoded;
+
+  //The sections decoded into ski so far (KMYTH_SKI_VIEW_* flags)
+  unsigned int decoded;
+  Ski ski;
+} SkiView;
+
 /**
  * @brief Parses a .ski formatted byte array into a ski struct. 
  *        The output is only modified on success, otherwise the 
- *        pointer is untouched
+ *        pointer is untouched. Both the text and binary (v2) formats are
+ *        accepted - the format is detected from the leading bytes - as is
+ *        a binary .ski written as a stream.
  *
  * @param[in]  input          The bytes in .ski format
  *
@@ -54,18 +147,225 @@ typedef struct Ski_s
  */
 int parse_ski_bytes(uint8_t * input, size_t input_length, Ski * output);
 
+/**
+ * @brief Locates the sections of a .ski formatted byte array (text or
+ *        binary, as for parse_ski_bytes()) without decoding any of them.
+ *        The view refers to the input, which must outlive it. The output
+ *        is only modified on success.
+ *
+ * @param[in]  input          The bytes in .ski format
+ *
+ * @param[in]  input_length   The number of bytes
+ *
+ * @param[out] view           The new view (release with free_ski_view())
+ *
+ * @return 0 on success, 1 on error
+ */
+int open_ski_view(uint8_t * input, size_t input_length, SkiView * view);
+
+/**
+ * @brief Gets the cipher of a .ski view, parsing it on first access.
+ *
+ * @param[in]  view           The view
+ *
+ * @param[out] cipher         The cipher the .ski data is encrypted with
+ *
+ * @return 0 on success, 1 on error
+ */
+int ski_view_get_cipher(SkiView * view, cipher_t * cipher);
+
+/**
+ * @brief Gets the PCR selection list of a .ski view, decoding it on first
+ *        access.
+ *
+ * @param[in]  view           The view
+ *
+ * @param[out] pcr_list       The PCR selection list (owned by the view)
+ *
+ * @return 0 on success, 1 on error
+ */
+int ski_view_get_pcr_list(SkiView * view, TPML_PCR_SELECTION ** pcr_list);
+
+/**
+ * @brief Gets the ski struct of a .ski view with its cipher and TPM objects
+ *        decoded (on first access), but not (yet) its encrypted data.
+ *
+ * @param[in]  view           The view
+ *
+ * @param[out] ski            The ski struct (owned by the view)
+ *
+ * @return 0 on success, 1 on error
+ */
+int ski_view_get_tpm_objects(SkiView * view, Ski ** ski);
+
+/**
+ * @brief Gets the whole ski struct of a .ski view, decoding whatever has
+ *        not been decoded yet (as parse_ski_bytes() would).
+ *
+ * @param[in]  view           The view
+ *
+ * @param[out] ski            The ski struct (owned by the view)
+ *
+ * @return 0 on success, 1 on error
+ */
+int ski_view_get_ski(SkiView * view, Ski ** ski);
+
+/**
+ * @brief Frees what a .ski view has decoded. The view may still be used
+ *        (its sections are decoded again as they are asked for).
+ *
+ * @param[in]  view           The view
+ */
+void free_ski_view(SkiView * view);
+
 /**
  * @brief Creates a byte array in .ski format from a ski struct
  *
  * @param[in]  input          The ski struct to be converted
  *
+ * @param[in]  format         The .ski format to produce: text (base64
+ *                            blocks) or binary (length-prefixed, v2)
+ *
  * @param[out] output         The bytes in .ski format
  *
  * @param[out] output_length  The number of bytes in output
  *
  * @return 0 on success, 1 on error
  */
-int create_ski_bytes(Ski input, uint8_t ** output, size_t * output_length);
+int create_ski_bytes(Ski input, kmyth_ski_format format,
+                     uint8_t ** output, size_t * output_length);
+
+/**
+ * @brief Same as create_ski_bytes(), but writes the .ski bytes into a
+ *        caller-provided buffer instead of allocating one.
+ *
+ * @param[in]     input          The ski struct to be converted
+ *
+ * @param[in]     format         The .ski format to produce
+ *
+ * @param[out]    output         Output buffer (NULL to query the size the
+ *                               .ski bytes need)
+ *
+ * @param[in,out] output_length  On input, the size of output. On output,
+ *                               the number of bytes written (or needed).
+ *
+ * @return 0 on success, 1 on error (including a buffer that is too small)
+ */
+int create_ski_bytes_into(Ski input, kmyth_ski_format format,
+                          uint8_t * output, size_t * output_length);
+
+/**
+ * @brief Creates the leading bytes of a stream .ski (binary format, see
+ *        KMYTH_SKI_BINARY_FLAG_STREAM) from a ski struct: everything up to
+ *        and including the encrypted data size. The encrypted data is
+ *        written after them, as it is produced. The ski's enc_data is
+ *        ignored.
+ *
+ * @param[in]  input          The ski struct to be converted
+ *
+ * @param[out] output         The stream .ski header bytes
+ *
+ * @param[out] output_length  The number of bytes in output
+ *
+ * @return 0 on success, 1 on error
+ */
+int create_ski_stream_header(Ski input, uint8_t ** output,
+                             size_t * output_length);
+
+/**
+ * @brief Creates new leading bytes for an existing .ski, holding different
+ *        TPM objects: every section before the encrypted data, in the
+ *        format (and, for a binary .ski, with the header flags) of the
+ *        input. The input from data_offset on - the encrypted data, as it
+ *        is stored - is kept as is after them, so a .ski can be resealed
+ *        without decoding or decrypting its data.
+ *
+ * @param[in]  input          Bytes in .ski format
+ *
+ * @param[in]  input_length   The number of bytes in input
+ *
+ * @param[in]  objects        The ski struct holding the new PCR selection
+ *                            list, storage key and wrapping key objects
+ *                            (its other members are ignored)
+ *
+ * @param[out] header         The new leading bytes
+ *
+ * @param[out] header_length  The number of bytes in header
+ *
+ * @param[out] data_offset    The offset in input of the bytes to be kept
+ *                            after header
+ *
+ * @return 0 on success, 1 on error
+ */
+int create_ski_rewrap_header(uint8_t * input, size_t input_length,
+                             Ski objects, uint8_t ** header,
+                             size_t * header_length, size_t * data_offset);
+
+/**
+ * @brief Reads the leading bytes of a binary .ski, up to and including
+ *        the encrypted data size, from a stream, leaving the stream
+ *        positioned at the start of the encrypted data. Works for both
+ *        stream and standard binary .ski contents.
+ *
+ * @param[in]  in             The stream to read from
+ *
+ * @param[in]  prefix         Bytes already read from the start of the
+ *                            stream (e.g., to detect the format)
+ *
+ * @param[in]  prefix_length  The number of bytes in prefix (at most
+ *                            KMYTH_SKI_BINARY_HEADER_LEN)
+ *
+ * @param[out] output         The header bytes (including prefix), to be
+ *                            passed to parse_ski_stream_header()
+ *
+ * @param[out] output_length  The number of bytes in output
+ *
+ * @return 0 on success, 1 on error
+ */
+int read_ski_stream_header(FILE * in, uint8_t * prefix, size_t prefix_length,
+                           uint8_t ** output, size_t * output_length);
+
+/**
+ * @brief Parses the leading bytes of a binary .ski (as returned by
+ *        read_ski_stream_header()) into a ski struct, whose enc_data is
+ *        left empty. The output is only modified on success.
+ *
+ * @param[in]  input          The header bytes
+ *
+ * @param[in]  input_length   The number of bytes
+ *
+ * @param[out] output         The new ski struct
+ *
+ * @param[out] enc_data_size  The recorded encrypted data size
+ *                            (KMYTH_SKI_BINARY_STREAM_SIZE for a stream
+ *                            .ski)
+ *
+ * @return 0 on success, 1 on error
+ */
+int parse_ski_stream_header(uint8_t * input, size_t input_length,
+                            Ski * output, uint64_t * enc_data_size);
+
+/**
+ * @brief Computes an upper bound on the size of the .ski bytes
+ *        create_ski_bytes() produces for a given encrypted data size, before
+ *        the TPM objects that go into the .ski exist (e.g., to size the
+ *        buffer passed to create_ski_bytes_into()).
+ *
+ * @param[in]  format         The .ski format to be produced
+ *
+ * @param[in]  bundle         true for a multi-payload bundle .ski
+ *
+ * @param[in]  cipher_name    Name of the cipher the data is encrypted with
+ *
+ * @param[in]  enc_data_size  Size, in bytes, of the encrypted data
+ *
+ * @param[out] max_size       The upper bound, in bytes
+ *
+ * @return 0 on success, 1 on error
+ */
+int get_ski_bytes_max_size(kmyth_ski_format format, bool bundle,
+                           char *cipher_name, size_t enc_data_size,
+                           size_t * max_size);
 
 /**
  * @brief Frees the contents of a ski struct
@@ -321,6 +621,78 @@ int unmarshal_skiObjects(TPML_PCR_SELECTION * pcr_selection_struct,
                          size_t sealed_key_private_data_size,
                          size_t sealed_key_private_data_offset);
 
+/**
+ * @brief Marshals the TPM 2.0 objects of a .ski into a single block.
+ *
+ * The block is allocated once, sized up front, and every object is
+ * marshalled into it (Tss2_MU_*_Marshal()) at a single running offset, in
+ * the order the objects appear in a .ski. The PCR selection list keeps the
+ * fixed (struct sized) extent it has always had in a .ski.
+ *
+ * @param[in]  pcr_selection_struct     PCR selection list
+ *
+ * @param[in]  storage_key_public_blob  Storage key (SK) public blob
+ *
+ * @param[in]  storage_key_private_blob SK encrypted private blob
+ *
+ * @param[in]  sealed_key_public_blob   Sealed wrapping key public blob
+ *
+ * @param[in]  sealed_key_private_blob  Sealed wrapping key encrypted
+ *                                      private blob
+ *
+ * @param[out] block                    The marshalled objects, one after
+ *                                      another (allocated here, freed by
+ *                                      the caller)
+ *
+ * @param[out] block_size               Size, in bytes, of block
+ *
+ * @param[out] objects                  KMYTH_SKI_OBJECT_COUNT pointers set
+ *                                      to each object within block
+ *
+ * @param[out] object_sizes             KMYTH_SKI_OBJECT_COUNT sizes, in
+ *                                      bytes, of each object
+ *
+ * @return 0 if success, 1 if error
+ */
+int pack_ski_objects(TPML_PCR_SELECTION * pcr_selection_struct,
+                     TPM2B_PUBLIC * storage_key_public_blob,
+                     TPM2B_PRIVATE * storage_key_private_blob,
+                     TPM2B_PUBLIC * sealed_key_public_blob,
+                     TPM2B_PRIVATE * sealed_key_private_blob,
+                     uint8_t ** block, size_t * block_size,
+                     uint8_t ** objects, size_t * object_sizes);
+
+/**
+ * @brief Unmarshals the TPM 2.0 objects of a .ski directly from slices of
+ *        the input (e.g., views into a binary .ski) - nothing is copied
+ *        before it is unmarshalled.
+ *
+ * @param[in]  objects                  KMYTH_SKI_OBJECT_COUNT slices, in
+ *                                      the order of pack_ski_objects()
+ *
+ * @param[in]  object_sizes             KMYTH_SKI_OBJECT_COUNT sizes, in
+ *                                      bytes, of each slice
+ *
+ * @param[out] pcr_selection_struct     PCR selection list
+ *
+ * @param[out] storage_key_public_blob  Storage key (SK) public blob
+ *
+ * @param[out] storage_key_private_blob SK encrypted private blob
+ *
+ * @param[out] sealed_key_public_blob   Sealed wrapping key public blob
+ *
+ * @param[out] sealed_key_private_blob  Sealed wrapping key encrypted
+ *                                      private blob
+ *
+ * @return 0 if success, 1 if error
+ */
+int unpack_ski_objects(uint8_t ** objects, size_t * object_sizes,
+                       TPML_PCR_SELECTION * pcr_selection_struct,
+                       TPM2B_PUBLIC * storage_key_public_blob,
+                       TPM2B_PRIVATE * storage_key_private_blob,
+                       TPM2B_PUBLIC * sealed_key_public_blob,
+                       TPM2B_PRIVATE * sealed_key_private_blob);
+
 /**
  * @brief This function packs an input TPM 2.0 PCR selection list structure
  *        (TPML_PCR_SELECTION)  into a platform independent format, which,
@@ -511,6 +883,57 @@ int unpack_private(TPM2B_PRIVATE * private_blob_out,
                    uint8_t * packed_data_in,
                    size_t packed_data_in_size, size_t packed_data_in_offset);
 
+/**
+ * @brief Packs a set of encrypted payloads into a single multi-payload
+ *        (bundle) block, stored in the ENC DATA position of a bundle .ski.
+ *
+ * The block is a big-endian 32-bit payload count followed, for each
+ * payload, by its big-endian 32-bit size and its bytes.
+ *
+ * @param[in]  payloads      Array of encrypted payloads
+ *
+ * @param[in]  payload_sizes Array of payload sizes, in bytes
+ *
+ * @param[in]  payload_count Number of payloads (at least one)
+ *
+ * @param[out] block         Newly allocated bundle block -
+ *                           passed as a pointer to the byte array
+ *
+ * @param[out] block_size    Size, in bytes, of the bundle block
+ *
+ * @return 0 if success, 1 if error
+ */
+int pack_bundle_payloads(uint8_t ** payloads,
+                         size_t * payload_sizes,
+                         size_t payload_count,
+                         uint8_t ** block, size_t * block_size);
+
+/**
+ * @brief Unpacks a multi-payload (bundle) block produced by
+ *        pack_bundle_payloads().
+ *
+ * The returned payload pointers point into the input block (no payload
+ * data is copied), so they are only valid while the block is. Only the
+ * two arrays are allocated and must be freed by the caller.
+ *
+ * @param[in]  block         Bundle block to be unpacked
+ *
+ * @param[in]  block_size    Size, in bytes, of the bundle block
+ *
+ * @param[out] payloads      Newly allocated array of pointers to the
+ *                           payloads within block
+ *
+ * @param[out] payload_sizes Newly allocated array of payload sizes
+ *
+ * @param[out] payload_count Number of payloads
+ *
+ * @return 0 if success, 1 if error
+ */
+int unpack_bundle_payloads(uint8_t * block,
+                           size_t block_size,
+                           uint8_t *** payloads,
+                           size_t ** payload_sizes, size_t * payload_count);
+
 /**
  * There are a number of fixed TPM properties (tagged properties)
  * that are returned as 32-bit integers into which up to four 8-byte
@@ -0,0 +1,148 @@
+/**
+ * @file  nv_tools.h
+ *
+ * @brief Provides TPM 2.0 utility functions for storing small secrets in,
+ *        and retrieving them from, policy-protected TPM NV indices. A secret
+ *        stored this way is read back with a single TPM2_NV_Read(), without
+ *        the storage key and sealed data objects a .ski needs loaded.
+ */
+
+#ifndef NV_TOOLS_H
+#define NV_TOOLS_H
+
+#include "tpm2_interface.h"
+
+/**
+ * @brief Finds the first NV index handle, in the range Kmyth allocates from
+ *        (KMYTH_NV_INDEX_FIRST to KMYTH_NV_INDEX_LAST), that is not defined.
+ *
+ * @param[in]  sapi_ctx  System API (SAPI) context, must be initialized
+ *                       and passed in as pointer to the SAPI context
+ *
+ * @param[out] nv_index  Free NV index handle - passed as a pointer to
+ *                       the handle value
+ *
+ * @return 0 if success, 1 if error (including a full range).
+ */
+int get_free_nv_index(TSS2_SYS_CONTEXT * sapi_ctx, TPM2_HANDLE * nv_index);
+
+/**
+ * @brief Gets the largest secret that can be stored in an NV index and read
+ *        back with a single TPM2_NV_Read() (the TPM's TPM2_PT_NV_BUFFER_MAX,
+ *        bounded by the size of a TPM2B_MAX_NV_BUFFER).
+ *
+ * @param[in]  sapi_ctx  System API (SAPI) context, must be initialized
+ *                       and passed in as pointer to the SAPI context
+ *
+ * @param[out] max_size  Maximum secret size (in bytes)
+ *
+ * @return 0 if success, 1 if error.
+ */
+int get_nv_max_data_size(TSS2_SYS_CONTEXT * sapi_ctx, size_t *max_size);
+
+/**
+ * @brief Defines an ordinary NV index for a Kmyth secret. The index is
+ *        written with owner authorization and read under the Kmyth
+ *        authorization policy (the authVal plus the PCR criteria, if any)
+ *        only - the attributes are TPMA_NV_OWNERWRITE and TPMA_NV_POLICYREAD.
+ *
+ * @param[in]  sapi_ctx       System API (SAPI) context, must be initialized
+ *                            and passed in as pointer to the SAPI context
+ *
+ * @param[in]  owner_auth     Authorization value for the owner (storage)
+ *                            hierarchy
+ *
+ * @param[in]  nv_index       Handle of the NV index to be defined
+ *
+ * @param[in]  nv_auth        Authorization value of the NV index (the hash
+ *                            of the authorization bytes, or the default
+ *                            all-zero hash)
+ *
+ * @param[in]  nv_authPolicy  Authorization policy digest of the NV index
+ *
+ * @param[in]  nv_size        Size of the NV index data (in bytes)
+ *
+ * @return 0 if success, 1 if error.
+ */
+int define_kmyth_nv_index(TSS2_SYS_CONTEXT * sapi_ctx,
+                          TPM2B_AUTH owner_auth,
+                          TPM2_HANDLE nv_index,
+                          TPM2B_AUTH nv_auth,
+                          TPM2B_DIGEST nv_authPolicy, uint16_t nv_size);
+
+/**
+ * @brief Writes a secret to a Kmyth NV index (see define_kmyth_nv_index())
+ *        with a single TPM2_NV_Write(), under owner authorization. The
+ *        command is authorized in a salted HMAC session with parameter
+ *        encryption, so neither the secret nor the owner authorization is
+ *        sent to the TPM in the clear.
+ *
+ * @param[in]  sapi_ctx   System API (SAPI) context, must be initialized
+ *                        and passed in as pointer to the SAPI context
+ *
+ * @param[in]  salt_key   Handle of a loaded RSA decryption key (e.g., the
+ *                        SRK) to salt the session with
+ *
+ * @param[in]  owner_auth Authorization value for the owner (storage)
+ *                        hierarchy
+ *
+ * @param[in]  nv_index   Handle of the NV index to be written
+ *
+ * @param[in]  data       Secret to be written
+ *
+ * @param[in]  data_size  Size of the secret (in bytes), at most the size
+ *                        returned by get_nv_max_data_size()
+ *
+ * @return 0 if success, 1 if error.
+ */
+int write_kmyth_nv_index(TSS2_SYS_CONTEXT * sapi_ctx,
+                         TPM2_HANDLE salt_key,
+                         TPM2B_AUTH owner_auth,
+                         TPM2_HANDLE nv_index,
+                         uint8_t * data, size_t data_size);
+
+/**
+ * @brief Reads the secret in a Kmyth NV index with a single TPM2_NV_Read(),
+ *        authorized by the Kmyth policy in the policy session passed in.
+ *
+ * @param[in]  sapi_ctx       System API (SAPI) context, must be initialized
+ *                            and passed in as pointer to the SAPI context
+ *
+ * @param[in/out] nvAuthSession Policy session used to authorize the read
+ *
+ * @param[in]  nv_index       Handle of the NV index to be read
+ *
+ * @param[in]  nv_auth        Authorization value of the NV index
+ *
+ * @param[in]  nv_pcrList     PCR List structure indicating the PCRs in the
+ *                            NV index's authorization policy
+ *
+ * @param[out] nv_data        The secret read
+ *
+ * @return 0 if success, 1 if error.
+ */
+int read_kmyth_nv_index(TSS2_SYS_CONTEXT * sapi_ctx,
+                        SESSION * nvAuthSession,
+                        TPM2_HANDLE nv_index,
+                        TPM2B_AUTH nv_auth,
+                        TPML_PCR_SELECTION nv_pcrList,
+                        TPM2B_MAX_NV_BUFFER * nv_data);
+
+/**
+ * @brief Undefines a Kmyth NV index (see define_kmyth_nv_index()), under
+ *        owner authorization, releasing its NV space.
+ *
+ * @param[in]  sapi_ctx   System API (SAPI) context, must be initialized
+ *                        and passed in as pointer to the SAPI context
+ *
+ * @param[in]  owner_auth Authorization value for the owner (storage)
+ *                        hierarchy
+ *
+ * @param[in]  nv_index   Handle of the NV index to be undefined
+ *
+ * @return 0 if success, 1 if error.
+ */
+int undefine_kmyth_nv_index(TSS2_SYS_CONTEXT * sapi_ctx,
+                            TPM2B_AUTH owner_auth, TPM2_HANDLE nv_index);
+
+#endif /* NV_TOOLS_H */
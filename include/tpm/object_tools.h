@@ -77,6 +77,26 @@ int init_kmyth_object_sensitive(TPM2B_AUTH object_auth,
 int init_kmyth_object_template(bool isKey, TPM2B_DIGEST auth_policy,
                                TPMT_PUBLIC * pubArea);
 
+/**
+ * @brief Initializes the public template for a Kmyth key (an SRK or SK),
+ *        like init_kmyth_object_template(), but with the key algorithm
+ *        chosen by the caller rather than KMYTH_KEY_PUBKEY_ALG. Generating
+ *        an ECC (KMYTH_ECC_CURVE) key typically takes the TPM a small
+ *        fraction of the time an RSA (KMYTH_RSA_KEY_LEN) key takes.
+ *
+ * @param[in]  keyAlg      Key algorithm: TPM2_ALG_RSA or TPM2_ALG_ECC
+ *
+ * @param[in]  auth_policy Authorization policy digest for object -
+ *                         passed as a pointer to this buffer
+ *
+ * @param[out] pubArea:    Public template (TPMT_PUBLIC) to be initialized -
+ *                         passed as a pointer to this structure
+ *
+ * @return 0 if success, 1 if error.
+ */
+int init_kmyth_key_template(TPMI_ALG_PUBLIC keyAlg, TPM2B_DIGEST auth_policy,
+                            TPMT_PUBLIC * pubArea);
+
 /**
  * @brief Set attributes for Kmyth objects (SRK, SK, or sealed data).
  * 
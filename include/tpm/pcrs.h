@@ -9,9 +9,57 @@
 #define PCRS_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <tss2/tss2_sys.h>
 
+#include "defines.h"
+
+/**
+ * @brief Values of a set of PCRs read at one point in time, as identified
+ *        by the TPM's PCR update counter
+ */
+typedef struct kmyth_pcr_snapshot
+{
+  /// @brief true if this snapshot holds values read from the TPM
+  bool valid;
+
+  /// @brief the PCRs whose values are held, as selected when read
+  TPML_PCR_SELECTION selection;
+
+  /// @brief the TPM's PCR update counter when the values were read
+  uint32_t update_counter;
+
+  /// @brief number of values held
+  uint32_t count;
+
+  /// @brief PCR values, in selection order (bank by bank, in increasing
+  ///        PCR index within each bank)
+  TPM2B_DIGEST values[KMYTH_PCR_SNAPSHOT_MAX];
+
+  /// @brief true once no_increment has been read from the TPM
+  bool no_increment_known;
+
+  /// @brief PCRs whose changes do not increment the update counter (the
+  ///        TPM2_PT_PCR_NO_INCREMENT property), which are never reused
+  uint8_t no_increment[TPM2_PCR_SELECT_MAX];
+} kmyth_pcr_snapshot;
+
+/**
+ * @brief Parses a list of PCR indices given by the user (e.g., "0, 1, 2",
+ *        separated by commas and/or blanks) into an array of integers.
+ *
+ * @param[in]  pcrs_string PCR list string (NULL for no PCRs)
+ *
+ * @param[out] pcrs        Array of the PCR indices (release with free(),
+ *                         not allocated if pcrs_string is NULL)
+ *
+ * @param[out] pcrs_len    Number of entries in pcrs
+ *
+ * @return 0 if success, 1 if error
+ */
+int parse_pcrs_string(char *pcrs_string, int **pcrs, int *pcrs_len);
+
 /**
  * @brief Converts a PCR selection input string, from the user, into the
  *        TPM 2.0 struct used to specify which PCRs to use in a sealing
@@ -51,4 +99,71 @@ int init_pcr_selection(TSS2_SYS_CONTEXT * sapi_ctx,
  */
 int get_pcr_count(TSS2_SYS_CONTEXT * sapi_ctx, int *pcrCount);
 
+/**
+ * @brief Reads the values of the selected PCRs from the TPM into a snapshot.
+ *        The TPM returns at most a few values per TPM2_PCR_Read(), so the
+ *        selection is read in batches until none of it is left; if the PCR
+ *        update counter changes between batches, the whole selection is
+ *        read again, so that the values are consistent.
+ *
+ * @param[in]  sapi_ctx    System API (SAPI) context, must be initialized
+ *                         and passed in as pointer to the SAPI context
+ *
+ * @param[in]  selection   PCR Selection List specifying the PCRs to read
+ *
+ * @param[out] snapshot    PCR snapshot to hold the values read
+ *
+ * @return 0 if success, 1 if error
+ */
+int read_pcr_snapshot(TSS2_SYS_CONTEXT * sapi_ctx,
+                      TPML_PCR_SELECTION selection,
+                      kmyth_pcr_snapshot * snapshot);
+
+/**
+ * @brief Brings a snapshot up to date for a PCR selection: a snapshot of
+ *        the same selection is kept if the TPM's PCR update counter has not
+ *        changed since it was read (checked with a TPM2_PCR_Read() selecting
+ *        no PCRs, which returns no values), and otherwise read again with
+ *        read_pcr_snapshot(). A selection including a PCR that does not
+ *        increment the update counter is always read again.
+ *
+ * @param[in]  sapi_ctx    System API (SAPI) context, must be initialized
+ *                         and passed in as pointer to the SAPI context
+ *
+ * @param[in]  selection   PCR Selection List specifying the PCRs needed
+ *
+ * @param[in,out] snapshot PCR snapshot to be checked and, if needed, read
+ *                         again (may be an invalid or zeroed snapshot)
+ *
+ * @return 0 if success, 1 if error
+ */
+int refresh_pcr_snapshot(TSS2_SYS_CONTEXT * sapi_ctx,
+                         TPML_PCR_SELECTION selection,
+                         kmyth_pcr_snapshot * snapshot);
+
+/**
+ * @brief Computes the PCR digest used by TPM2_PolicyPCR(): the hash
+ *        (KMYTH_HASH_ALG) of the concatenated values held in a snapshot.
+ *
+ * @param[in]  snapshot    Valid PCR snapshot
+ *
+ * @param[out] pcrDigest   Resulting digest
+ *
+ * @return 0 if success, 1 if error
+ */
+int get_pcr_snapshot_digest(kmyth_pcr_snapshot * snapshot,
+                            TPM2B_DIGEST * pcrDigest);
+
+/**
+ * @brief Logs the value of each PCR held in a snapshot (e.g., to diagnose
+ *        an unseal whose PCR policy is not satisfied).
+ *
+ * @param[in]  severity    Log severity (e.g., LOG_INFO)
+ *
+ * @param[in]  snapshot    Valid PCR snapshot
+ *
+ * @return None
+ */
+void log_pcr_snapshot(int severity, kmyth_pcr_snapshot * snapshot);
+
 #endif /* PRCS_H */
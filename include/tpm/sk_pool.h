@@ -0,0 +1,142 @@
+/**
+ * @file  sk_pool.h
+ *
+ * @brief Provides a pool of pre-created storage keys (SKs), kept as files
+ *        in a pool directory, so that a seal only needs to load (rather than
+ *        generate) its SK.
+ *
+ *        A storage key's authorization value and policy (bound to the
+ *        values of the PCRs it was sealed to) are fixed when it is created,
+ *        so a pooled SK can only be used by a seal that would have created
+ *        an identical SK. Pooled SKs are therefore grouped by a pool ID,
+ *        a digest of the SK algorithm, authorization policy digest and
+ *        authVal keyed with the pool's own secret key (see
+ *        get_sk_pool_id()). Each SK is stored in its own file, named
+ *        '<pool ID>-<random suffix>.sk', holding the marshalled
+ *        TPM2B_PUBLIC and TPM2B_PRIVATE (SRK wrapped) blobs of the key.
+ *
+ *        The pool directory, its key and its key files are readable and
+ *        writable only by their owner, and a pool directory that anyone
+ *        else could put files in is refused.
+ */
+
+#ifndef SK_POOL_H
+#define SK_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <tss2/tss2_sys.h>
+
+#include "defines.h"
+
+/**
+ * @brief Length of a pool ID (see get_sk_pool_id()), a hex-encoded digest,
+ *        including its NUL terminator
+ */
+#define KMYTH_SK_POOL_ID_LEN (2 * KMYTH_DIGEST_SIZE + 1)
+
+/**
+ * @brief Size, in bytes, of a pool's secret key
+ */
+#define KMYTH_SK_POOL_KEY_SIZE 32
+
+/**
+ * @brief Name of the file, in the pool directory, holding the pool key
+ */
+#define KMYTH_SK_POOL_KEY_FILE ".pool_key"
+
+/**
+ * @brief Computes the pool ID of the storage keys with the specified
+ *        algorithm, authorization policy and authVal: the hex encoding of
+ *        an HMAC over these, keyed with the pool key. As the ID depends on
+ *        a secret only the pool owner can read, the pool's file names
+ *        cannot be used to test guesses of the authVal offline.
+ *
+ * @param[in]  pool_dir      Path of the pool directory, which (like the
+ *                           pool key) is created if it does not exist
+ *
+ * @param[in]  sk_alg        Storage key algorithm (TPM2_ALG_RSA or
+ *                           TPM2_ALG_ECC)
+ *
+ * @param[in]  sk_authPolicy Authorization policy digest of the storage key
+ *
+ * @param[in]  sk_authVal    Authorization value (authVal) of the storage key
+ *
+ * @param[out] id            Buffer (KMYTH_SK_POOL_ID_LEN bytes) to hold the
+ *                           NUL-terminated pool ID
+ *
+ * @return 0 on success, 1 on error
+ */
+int get_sk_pool_id(const char *pool_dir, TPMI_ALG_PUBLIC sk_alg,
+                   TPM2B_DIGEST sk_authPolicy, TPM2B_AUTH sk_authVal,
+                   char *id);
+
+/**
+ * @brief Counts the storage keys with the specified pool ID in a pool
+ *        directory.
+ *
+ * @param[in]  pool_dir      Path of the pool directory (a directory that
+ *                           does not exist holds no keys)
+ *
+ * @param[in]  id            Pool ID (see get_sk_pool_id())
+ *
+ * @param[out] count         Number of pooled storage keys with that ID
+ *
+ * @return 0 on success, 1 on error
+ */
+int sk_pool_count(const char *pool_dir, const char *id, size_t *count);
+
+/**
+ * @brief Adds a storage key to a pool directory, which is created (readable
+ *        only by its owner) if it does not exist. The key file is created
+ *        (readable only by its owner) under a temporary name and then
+ *        renamed, so that it is never seen partially written.
+ *
+ * @param[in]  pool_dir      Path of the pool directory
+ *
+ * @param[in]  id            Pool ID of the storage key (see get_sk_pool_id())
+ *
+ * @param[in]  sk_public     "Public" structure of the storage key
+ *
+ * @param[in]  sk_private    "Private" structure of the storage key
+ *
+ * @return 0 on success, 1 on error
+ */
+int sk_pool_put(const char *pool_dir, const char *id,
+                TPM2B_PUBLIC * sk_public, TPM2B_PRIVATE * sk_private);
+
+/**
+ * @brief Takes a storage key with the specified pool ID out of a pool
+ *        directory. The key file is claimed by renaming it before it is
+ *        read and removed, so that concurrent callers (in this or other
+ *        processes) never take the same key. A key whose public area is
+ *        not that of a Kmyth storage key with the specified algorithm and
+ *        policy (see init_kmyth_key_template()) - non-duplicable
+ *        (fixedTPM, fixedParent), a restricted decryption key, with the
+ *        Kmyth name algorithm - is discarded rather than taken.
+ *
+ * @param[in]  pool_dir      Path of the pool directory
+ *
+ * @param[in]  id            Pool ID (see get_sk_pool_id())
+ *
+ * @param[in]  sk_alg        Algorithm the storage key must have
+ *
+ * @param[in]  sk_authPolicy Authorization policy digest the storage key
+ *                           must have
+ *
+ * @param[out] sk_public     "Public" structure of the storage key taken
+ *
+ * @param[out] sk_private    "Private" structure of the storage key taken
+ *
+ * @param[out] found         true if a storage key was taken, false if the
+ *                           pool holds no (acceptable) key with that ID
+ *
+ * @return 0 on success (whether or not a key was found), 1 on error
+ */
+int sk_pool_take(const char *pool_dir, const char *id,
+                 TPMI_ALG_PUBLIC sk_alg, TPM2B_DIGEST sk_authPolicy,
+                 TPM2B_PUBLIC * sk_public, TPM2B_PRIVATE * sk_private,
+                 bool *found);
+
+#endif /* SK_POOL_H */
@@ -0,0 +1,184 @@
+/**
+ * @file  ski_store.h
+ *
+ * @brief Provides a content-addressed store of .ski files, kept in a store
+ *        directory, so that identical seals (the same data sealed under the
+ *        same policy, e.g. one secret deployed to many services on a host)
+ *        share one .ski rather than each creating its own storage key,
+ *        wrapping key and ciphertext.
+ *
+ *        Each .ski in the store is named after its store ID, an HMAC (keyed
+ *        with a random key kept in the store directory, readable only by its
+ *        owner) over the plaintext and every seal parameter that determines
+ *        the .ski: the authorization string, PCR selection, cipher, .ski
+ *        format, storage key algorithm and compression (see ski_store_id()).
+ *        As the hash is keyed, the file names reveal nothing about the data
+ *        to anyone who cannot read the store key (in particular, a low
+ *        entropy secret cannot be found by hashing guesses).
+ *
+ *        The sealed outputs themselves are links to the stored .ski (see
+ *        ski_store_link()), so all of them have identical contents, and a
+ *        cache keyed on the .ski contents (e.g., kmyth-unsealerd's) serves
+ *        every alias from one entry. Resealing an alias (kmyth-seal -r)
+ *        replaces it with a new file, leaving the stored .ski and the other
+ *        aliases as they were.
+ *
+ *        The store directory and the files in it are readable and writable
+ *        only by the store owner, and an existing store directory is only
+ *        used if it is owned by the current user and not writable by anyone
+ *        else.
+ */
+
+#ifndef SKI_STORE_H
+#define SKI_STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "defines.h"
+
+/**
+ * @brief Size, in bytes, of the HMAC key kept in a store directory
+ */
+#define KMYTH_SKI_STORE_KEY_SIZE 32
+
+/**
+ * @brief Name of the file holding the HMAC key in a store directory
+ */
+#define KMYTH_SKI_STORE_KEY_FILE ".store_key"
+
+/**
+ * @brief Length of a store ID (see ski_store_id()), a hex-encoded HMAC,
+ *        including its NUL terminator
+ */
+#define KMYTH_SKI_STORE_ID_LEN (2 * KMYTH_DIGEST_SIZE + 1)
+
+/**
+ * @brief The seal parameters, other than the data, that a stored .ski was
+ *        sealed with: a .ski is only shared by seals with identical ones.
+ */
+typedef struct ski_store_policy
+{
+  /// Authorization string bytes (may be NULL if auth_bytes_len is 0)
+  const uint8_t *auth_bytes;
+  size_t auth_bytes_len;
+
+  /// PCR indices (may be NULL if pcrs_len is 0)
+  const int *pcrs;
+  size_t pcrs_len;
+
+  /// Cipher name (NULL for the default cipher)
+  const char *cipher_string;
+
+  /// .ski format, storage key algorithm and compression, as numbers
+  uint32_t ski_format;
+  uint32_t sk_alg;
+  uint32_t compression;
+} ski_store_policy;
+
+/**
+ * @brief Reads the HMAC key of a store directory. The directory (readable
+ *        only by its owner) and a new random key are created if they do not
+ *        exist. The key file is created under a temporary name and linked
+ *        into place, so concurrent callers all end up with the same key.
+ *        An existing directory that is not owned by the current user, or
+ *        that is writable by group or others, is rejected.
+ *
+ * @param[in]  store_dir     Path of the store directory
+ *
+ * @param[out] key           Buffer (KMYTH_SKI_STORE_KEY_SIZE bytes) to hold
+ *                           the key (the caller should clear it after use)
+ *
+ * @return 0 on success, 1 on error
+ */
+int ski_store_get_key(const char *store_dir, uint8_t * key);
+
+/**
+ * @brief Computes the store ID of a seal: the hex encoding of an HMAC, with
+ *        the store key, over the data and seal parameters.
+ *
+ * @param[in]  key           Store key (KMYTH_SKI_STORE_KEY_SIZE bytes, see
+ *                           ski_store_get_key())
+ *
+ * @param[in]  input         Data to be sealed
+ *
+ * @param[in]  input_len     Size of input, in bytes
+ *
+ * @param[in]  policy        Seal parameters
+ *
+ * @param[out] id            Buffer (KMYTH_SKI_STORE_ID_LEN bytes) to hold
+ *                           the NUL-terminated store ID
+ *
+ * @return 0 on success, 1 on error
+ */
+int ski_store_id(const uint8_t * key, const uint8_t * input, size_t input_len,
+                 const ski_store_policy * policy, char *id);
+
+/**
+ * @brief Returns the path of the .ski with a given store ID.
+ *
+ * @param[in]  store_dir     Path of the store directory
+ *
+ * @param[in]  id            Store ID (see ski_store_id())
+ *
+ * @param[out] path          Path ('<store_dir>/<id>.ski', release with
+ *                           free())
+ *
+ * @return 0 on success, 1 on error
+ */
+int ski_store_path(const char *store_dir, const char *id, char **path);
+
+/**
+ * @brief Reads the .ski with a given store ID, if the store holds one.
+ *
+ * @param[in]  store_dir     Path of the store directory
+ *
+ * @param[in]  id            Store ID (see ski_store_id())
+ *
+ * @param[out] ski           Contents of the stored .ski (release with
+ *                           free()), NULL if not found
+ *
+ * @param[out] ski_len       Size of ski, in bytes
+ *
+ * @param[out] found         true if the store holds a .ski with that ID
+ *
+ * @return 0 on success (whether or not it was found), 1 on error
+ */
+int ski_store_get(const char *store_dir, const char *id,
+                  uint8_t ** ski, size_t *ski_len, bool *found);
+
+/**
+ * @brief Adds (or replaces) the .ski with a given store ID. The file is
+ *        created readable only by its owner, under a temporary name, and
+ *        then renamed, so that it is never seen partially written.
+ *
+ * @param[in]  store_dir     Path of the store directory (created, readable
+ *                           only by its owner, if it does not exist)
+ *
+ * @param[in]  id            Store ID (see ski_store_id())
+ *
+ * @param[in]  ski           .ski contents
+ *
+ * @param[in]  ski_len       Size of ski, in bytes
+ *
+ * @return 0 on success, 1 on error
+ */
+int ski_store_put(const char *store_dir, const char *id,
+                  const uint8_t * ski, size_t ski_len);
+
+/**
+ * @brief Makes a path an alias of a stored .ski: a hard link to it (which
+ *        shares its owner and permissions), or a copy of it if the alias is
+ *        on another filesystem. Any existing file at the alias path is
+ *        replaced atomically.
+ *
+ * @param[in]  stored_path   Path of the stored .ski (see ski_store_path())
+ *
+ * @param[in]  alias_path    Path of the alias to create
+ *
+ * @return 0 on success, 1 on error
+ */
+int ski_store_link(const char *stored_path, const char *alias_path);
+
+#endif /* SKI_STORE_H */
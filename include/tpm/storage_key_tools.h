@@ -20,6 +20,12 @@
  * memory, it is re-derived from the storage hierarchy primary seed and
  * made persistent (i.e., relocated to a persistent handle). 
  *
+ * The handle configured with set_srk_handle() (or KMYTH_SRK_HANDLE), the
+ * handle the SRK was last found at by this process, and the handle recorded
+ * in the state file (see set_srk_state_file()) are checked first, each with
+ * two TPM commands, before falling back on get_existing_srk_handle(). The
+ * handle found is recorded in the state file.
+ *
  * @param[in]  sapi_ctx               System API (SAPI) context,
  *                                    must be initialized and
  *                                    passed in as pointer to the SAPI context
@@ -38,6 +44,34 @@ int get_srk_handle(TSS2_SYS_CONTEXT * sapi_ctx,
                    TPM2_HANDLE * srk_handle,
                    TPM2B_AUTH * storage_hierarchy_auth);
 
+/**
+ * @brief Configures the persistent handle at which get_srk_handle() first
+ *        looks for the SRK, before the state file (see
+ *        set_srk_state_file()) and before listing every persistent object.
+ *        If no SRK is there and that handle is free, an SRK that has to be
+ *        re-derived is made persistent at it. Overrides the KMYTH_SRK_HANDLE
+ *        environment variable.
+ *
+ * @param[in]  handle  Persistent handle (e.g., "0x81000001"), or NULL to
+ *                     fall back on the environment variable again
+ *
+ * @return 0 if success, 1 if the handle is not a valid persistent handle
+ */
+int set_srk_handle(const char *handle);
+
+/**
+ * @brief Configures the state file in which get_srk_handle() records the
+ *        persistent handle at which it found (or put) the SRK, to look
+ *        there first next time. Overrides the KMYTH_SRK_STATE_FILE
+ *        environment variable and the default (KMYTH_SRK_STATE_FILE in
+ *        defines.h).
+ *
+ * @param[in]  path  Path of the state file, or NULL to use none
+ *
+ * @return 0 if success, 1 if error
+ */
+int set_srk_state_file(const char *path);
+
 /**
  * @brief Try to get handle of a Storage Root Key (SRK) that is already loaded
  *        into the TPM's persistent storage.
@@ -100,6 +134,50 @@ int check_if_srk(TSS2_SYS_CONTEXT * sapi_ctx, TPM2_HANDLE handle, bool * isSRK);
 int put_srk_into_persistent_storage(TSS2_SYS_CONTEXT * sapi_ctx,
                                     TPM2_HANDLE srkHandle, TPM2B_AUTH sps_auth);
 
+/**
+ * @brief Creates, without loading it, a new storage key (SK) under the
+ *        specified key hierarchy (parent is specified to be the SRK), e.g.
+ *        to be kept in a storage key pool (see sk_pool.h) and loaded when
+ *        it is used.
+ *
+ * @param[in]  sapi_ctx      System API (SAPI) context, must be initialized
+ *                           and passed in as pointer to the SAPI context
+ *
+ * @param[in]  srk_handle    TPM 2.0 handle value that references parent in the
+ *                           key hierarchy (SRK), that this new storage key
+ *                           (SK) is to be created under.
+ *
+ * @param[in]  srk_authVal   Secret value needed to authorize use of the SRK
+ *
+ * @param[in]  sk_authVal    Authorization value (authVal) for storage key
+ *                           to be created
+ *
+ * @param[in]  sk_pcrList    PCR Selection List struct indicating the set of
+ *                           PCRs to which the storage key should be sealed
+ *
+ * @param[in]  sk_authPolicy Authorization policy digest to be associated
+ *                           with the created storage key
+ *
+ * @param[in]  sk_alg        Storage key algorithm (TPM2_ALG_RSA or
+ *                           TPM2_ALG_ECC), recorded in sk_public
+ *
+ * @param[out] sk_private    "Private" structure for newly created TPM 2.0
+ *                           storage key object
+ *
+ * @param[out] sk_public     "Public" structure for newly created TPM 2.0
+ *                           storage key object
+ *
+ * @return 0 if success, 1 if error.
+ */
+int create_sk(TSS2_SYS_CONTEXT * sapi_ctx,
+              TPM2_HANDLE srk_handle,
+              TPM2B_AUTH srk_authVal,
+              TPM2B_AUTH sk_authVal,
+              TPML_PCR_SELECTION sk_pcrList,
+              TPM2B_DIGEST sk_authPolicy,
+              TPMI_ALG_PUBLIC sk_alg,
+              TPM2B_PRIVATE * sk_private, TPM2B_PUBLIC * sk_public);
+
 /**
  * @brief Creates and loads, into the TPM, a new storage key (SK) under the
  *        specified key hierarchy (parent is specified to be the SRK)
@@ -127,6 +205,9 @@ int put_srk_into_persistent_storage(TSS2_SYS_CONTEXT * sapi_ctx,
  * @param[in]  sk_authPolicy Authorization policy digest to be associated
  *                           with the created storage key
  *
+ * @param[in]  sk_alg        Storage key algorithm (TPM2_ALG_RSA or
+ *                           TPM2_ALG_ECC), recorded in sk_public
+ *
  * @param[out] sk_handle     TPM 2.0 handle that references the created
  *                           and loaded storage key (SK) -
  *                           passed as a pointer to the handle value
@@ -145,6 +226,7 @@ int create_and_load_sk(TSS2_SYS_CONTEXT * sapi_ctx,
                        TPM2B_AUTH sk_authVal,
                        TPML_PCR_SELECTION sk_pcrList,
                        TPM2B_DIGEST sk_authPolicy,
+                       TPMI_ALG_PUBLIC sk_alg,
                        TPM2_HANDLE * sk_handle,
                        TPM2B_PRIVATE * sk_private, TPM2B_PUBLIC * sk_public);
 
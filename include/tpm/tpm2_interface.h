@@ -14,6 +14,8 @@
 
 #include <tss2/tss2_sys.h>
 
+#include "pcrs.h"
+
 /**
  * @brief Array of manufacturer strings known to identify software TPM simulators.
  */
@@ -90,6 +92,54 @@ typedef struct
  */
 int init_tpm2_connection(TSS2_SYS_CONTEXT ** sapi_ctx);
 
+/**
+ * @brief Configures the TPM Command Transmission Interface (TCTI) used by
+ *        init_tpm2_connection(), overriding the KMYTH_TCTI environment
+ *        variable.
+ *
+ * @param[in]  config  TCTI configuration string, '<name>[:<conf>]' as
+ *                     understood by Tss2_TctiLdr (e.g.,
+ *                     "device:/dev/tpmrm0" for the kernel resource manager,
+ *                     "mssim:host=localhost,port=2321", "swtpm" or
+ *                     "tabrmd"), or NULL to fall back on the environment
+ *                     variable again
+ *
+ * @return 0 if success, 1 if error
+ */
+int set_tcti_config(const char *config);
+
+/**
+ * @brief Initializes the TCTI context for a TPM 2.0 connection: the TCTI
+ *        configured with set_tcti_config() or, if none, with the KMYTH_TCTI
+ *        environment variable, loaded through Tss2_TctiLdr; or, if neither
+ *        is set (or it is empty), the tpm2-abrmd TCTI (see
+ *        init_tcti_abrmd()).
+ *
+ * @param[out] tcti_ctx  TPM Command Transmission Interface (TCTI) context,
+ *                       must be passed in as a NULL
+ *
+ * In the boot build (kmyth-unseal-boot, built with KMYTH_BOOT), only the
+ * device TCTI is available: a "device[:<path>]" configuration opens that
+ * TPM device, and no configuration opens KMYTH_BOOT_TPM_DEVICE.
+ *
+ * @return 0 if success, 1 if error
+ */
+int init_tcti(TSS2_TCTI_CONTEXT ** tcti_ctx);
+
+/**
+ * @brief Initializes a TCTI context to talk to a TPM device directly (or
+ *        through the kernel resource manager, /dev/tpmrm0), without
+ *        tpm2-abrmd or the TCTI loader.
+ *
+ * @param[out] tcti_ctx  TPM Command Transmission Interface (TCTI) context,
+ *                       must be passed in as a NULL
+ *
+ * @param[in]  device    Path of the TPM device (e.g., "/dev/tpmrm0")
+ *
+ * @return 0 if success, 1 if error
+ */
+int init_tcti_device(TSS2_TCTI_CONTEXT ** tcti_ctx, const char *device);
+
 /**
  * @brief Initializes a TCTI context to talk to resource manager.
  *        Will not work if resource manager is not turned on and connected
@@ -123,6 +173,21 @@ int init_sapi(TSS2_SYS_CONTEXT ** sapi_ctx, TSS2_TCTI_CONTEXT * tcti_ctx);
  */
 int free_tpm2_resources(TSS2_SYS_CONTEXT ** sapi_ctx);
 
+/**
+ * @brief Flushes a transient object or session from the TPM 2.0, releasing
+ *        the TPM memory it occupies. Connections that are held open across
+ *        many operations must flush the objects they load, as the TPM only
+ *        has room for a small number of loaded objects at once.
+ *
+ * @param[in]  sapi_ctx  System API context, must be initialized (non-NULL)
+ *
+ * @param[in]  handle    Handle of the transient object or session to be
+ *                       flushed
+ *
+ * @return 0 if success, 1 if error
+ */
+int flush_tpm2_object(TSS2_SYS_CONTEXT * sapi_ctx, TPM2_HANDLE handle);
+
 /**
  * @brief Starts up TPM. 
  *
@@ -137,6 +202,17 @@ int startup_tpm2(TSS2_SYS_CONTEXT ** sapi_ctx);
 /**
  * @brief Get specified TPM 2.0 property value(s).
  *
+ *        Queries for data that cannot change while a connection is open
+ *        (the fixed TPM properties, e.g., TPM2_PT_MANUFACTURER and
+ *        TPM2_PT_PCR_COUNT), or that only changes when an object is made
+ *        persistent or evicted (the TPM2_HR_PERSISTENT handle list and
+ *        TPM2_PT_HR_PERSISTENT_AVAIL), are answered from a cache kept for
+ *        each SAPI context: the first query reads the data from the TPM
+ *        (all of the fixed properties at once), and later ones are free.
+ *        Answers from the cache hold only properties of the requested
+ *        group. Other queries (e.g., for the active sessions) always go to
+ *        the TPM.
+ *
  * @param[in]  sapi_ctx       System API (SAPI) context, must be initialized -
  *                            passed in as a pointer to the context struct
  *
@@ -156,6 +232,79 @@ int get_tpm2_properties(TSS2_SYS_CONTEXT * sapi_ctx,
                         uint32_t property, uint32_t propertyCount,
                         TPMS_CAPABILITY_DATA * capabilityData);
 
+/**
+ * @brief Drops the capability data cached for a SAPI context (see
+ *        get_tpm2_properties()), so that it is read from the TPM again.
+ *        Called by free_tpm2_resources(); to be called as well whenever
+ *        the TPM may have been changed by another process (e.g., an object
+ *        made persistent with tpm2-tools) while the connection was open.
+ *
+ * @param[in]  sapi_ctx  System API (SAPI) context, or NULL to drop the
+ *                       data cached for every context
+ *
+ * @return None
+ */
+void invalidate_tpm2_capability_cache(TSS2_SYS_CONTEXT * sapi_ctx);
+
+/**
+ * @brief Drops the persistent handle list and TPM2_PT_HR_PERSISTENT_AVAIL
+ *        value cached for a SAPI context, keeping the fixed properties.
+ *        To be called after making an object persistent or evicting one.
+ *
+ * @param[in]  sapi_ctx  System API (SAPI) context
+ *
+ * @return None
+ */
+void invalidate_tpm2_persistent_handle_cache(TSS2_SYS_CONTEXT * sapi_ctx);
+
+/**
+ * @brief Reads PCR values (TPM2_PCR_Read). Callers in any thread or context
+ *        asking for the same selection while an identical read is in
+ *        flight are merged into a single read sent once it completes, so
+ *        contending callers share one command, and never a response the TPM
+ *        produced before they asked.
+ *
+ * @param[in]  sapi_ctx       System API (SAPI) context, must be initialized
+ *
+ * @param[in]  selection      PCR selection to read
+ *
+ * @param[out] updateCounter  The TPM's PCR update counter
+ *
+ * @param[out] selectionOut   The PCRs actually read
+ *
+ * @param[out] values         The values of the PCRs read
+ *
+ * @return TPM2_RC_SUCCESS, or the response code of the failed command
+ */
+TPM2_RC read_tpm2_pcrs(TSS2_SYS_CONTEXT * sapi_ctx,
+                       TPML_PCR_SELECTION * selection,
+                       UINT32 * updateCounter,
+                       TPML_PCR_SELECTION * selectionOut,
+                       TPML_DIGEST * values);
+
+/**
+ * @brief Reads the public area and names of a loaded object
+ *        (TPM2_ReadPublic). Reads of a persistent object are merged as in
+ *        read_tpm2_pcrs(); transient handles differ between connections,
+ *        so their reads are always sent as they are.
+ *
+ * @param[in]  sapi_ctx       System API (SAPI) context, must be initialized
+ *
+ * @param[in]  handle         Handle of the object
+ *
+ * @param[out] outPublic      The object's public area (may be NULL)
+ *
+ * @param[out] name           The object's name (may be NULL)
+ *
+ * @param[out] qualifiedName  The object's qualified name (may be NULL)
+ *
+ * @return TPM2_RC_SUCCESS, or the response code of the failed command
+ */
+TPM2_RC read_tpm2_public(TSS2_SYS_CONTEXT * sapi_ctx,
+                         TPM2_HANDLE handle,
+                         TPM2B_PUBLIC * outPublic,
+                         TPM2B_NAME * name, TPM2B_NAME * qualifiedName);
+
 /**
  * @brief Determine whether TPM 2.0 implementation is hardware or emulator.
  *
@@ -189,6 +338,22 @@ int get_tpm2_impl_type(TSS2_SYS_CONTEXT * sapi_ctx, bool * isEmulator);
  */
 const char *getErrorString(TSS2_RC err);
 
+/**
+ * @brief Logs (at LOG_ERR) a failed TSS2 call's return code, along with its
+ *        human readable translation, carrying the call and return code as
+ *        structured "operation" and "tpm_rc" fields (see kmyth_log_fields())
+ *
+ * @param[in]  operation - name of the failed TSS2 call (e.g., "Tss2_Sys_Load")
+ *
+ * @param[in]  rc        - TPM 2.0 error code (return value)
+ */
+#define kmyth_log_tpm_rc(operation, rc)\
+  kmyth_log_fields(LOG_ERR, ((kmyth_log_field[]) {\
+                     KMYTH_LOG_STR("operation", (operation)),\
+                     KMYTH_LOG_HEX("tpm_rc", (rc)) }), 2,\
+                   "%s(): rc = 0x%08X, %s", (operation), (rc),\
+                   getErrorString(rc))
+
 /**
  * @brief Initializes command and response authorization structures
  *        for the upcoming TPM interaction (TSS2 library call) using
@@ -218,6 +383,14 @@ int init_password_cmd_auth(TPM2B_AUTH authEntityAuthVal,
  *        for the upcoming TPM interaction (TSS2 library call) using
  *        a policy authorization session
  * 
+ * @param[in]  sapi_ctx            System API (SAPI) context holding the
+ *                                 prepared command. If the session uses
+ *                                 parameter encryption (symmetric algorithm
+ *                                 not TPM2_ALG_NULL), the first command
+ *                                 parameter is encrypted in place, and
+ *                                 response encryption is requested for
+ *                                 TPM2_Unseal() and TPM2_NV_Read().
+ *
  * @param[in]  authSession         Pointer to authorization session parameters
  *                                 structure. A null pointer should be passed
  *                                 in if policy authorization is not being
@@ -266,7 +439,8 @@ int init_password_cmd_auth(TPM2B_AUTH authEntityAuthVal,
  *
  * @return 0 if success, 1 if error
  */
-int init_policy_cmd_auth(SESSION * authSession,
+int init_policy_cmd_auth(TSS2_SYS_CONTEXT * sapi_ctx,
+                         SESSION * authSession,
                          TPM2_CC authCmdCode,
                          TPM2B_NAME authEntityName,
                          TPM2B_AUTH authEntityAuthVal,
@@ -430,6 +604,9 @@ int compute_rpHash(TPM2_RC rspCode,
  *        response authorization.
  *
  * @param[in]  auth_session           Authorization session parameters stucture
+ *                                    (the HMAC key is its sessionKey, empty
+ *                                    for an unsalted session, followed by
+ *                                    auth_authValue)
  *
  * @param[in]  auth_pHash             Command or response parameter hash
  *
@@ -477,6 +654,38 @@ int create_policy_digest(TSS2_SYS_CONTEXT * sapi_ctx,
                          TPML_PCR_SELECTION tp_pcrList,
                          TPM2B_DIGEST * policyDigest_out);
 
+/**
+ * @brief Computes the same authorization policy (authPolicy) digest as
+ *        create_policy_digest(), on the host rather than in a TPM trial
+ *        session: the TPM2_PolicyAuthValue and TPM2_PolicyPCR extensions of
+ *        the policy digest are replayed in software, so the only TPM command
+ *        needed is TPM2_PCR_Read() (not even that if no PCRs are selected, or
+ *        if a current snapshot of them is passed in), instead of starting,
+ *        extending, reading and flushing a trial session.
+ *
+ * @param[in]  sapi_ctx          System API (SAPI) context, must be initialized
+ *                               and passed in as pointer to the SAPI context
+ *                               (may be NULL if tp_pcrList is empty)
+ *
+ * @param[in]  tp_pcrList        PCR Selection List structure specifying
+ *                               which PCRs to apply to authorization policy
+ *
+ * @param[in,out] pcrSnapshot    PCR snapshot holding the PCR values to use,
+ *                               brought up to date (see
+ *                               refresh_pcr_snapshot()) first, so that it
+ *                               can be reused by later calls; or NULL to
+ *                               read the PCRs for this call only
+ *
+ * @param[out] policyDigest_out  Authorization policy digest result -
+ *                               passed as a pointer to the hash value
+ *
+ * @return 0 if success, 1 if error
+ */
+int compute_policy_digest(TSS2_SYS_CONTEXT * sapi_ctx,
+                          TPML_PCR_SELECTION tp_pcrList,
+                          kmyth_pcr_snapshot * pcrSnapshot,
+                          TPM2B_DIGEST * policyDigest_out);
+
 /**
  * @brief Creates a session used to authorize kmyth objects
  *
@@ -491,6 +700,66 @@ int create_policy_digest(TSS2_SYS_CONTEXT * sapi_ctx,
 int create_policy_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
                                SESSION * policySession);
 
+/**
+ * @brief Creates a salted session used to authorize kmyth objects with
+ *        parameter encryption: the secret parameters of the commands it
+ *        authorizes (the sensitive data of TPM2_Create(), the data of
+ *        TPM2_NV_Write() and the data returned by TPM2_Unseal() or
+ *        TPM2_NV_Read()) are AES CFB encrypted between the host and the TPM. The salt is encrypted to tpmKey, so
+ *        that only the TPM can derive the session key.
+ *
+ * @param[in]  sapi_ctx      System API (SAPI) context, must be initialized
+ *                           and passed in as pointer to the SAPI context
+ *
+ * @param[in]  tpmKey        Handle of a loaded RSA decryption key (e.g.,
+ *                           the SRK) to encrypt the salt to
+ *
+ * @param[out] policySession Pointer to policy session parameters struct
+ *                           initialized by this function
+ *
+ * @return 0 if success, 1 if error
+ */
+int create_salted_policy_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
+                                      TPM2_HANDLE tpmKey,
+                                      SESSION * policySession);
+
+/**
+ * @brief Creates a salted HMAC session, with parameter encryption as for
+ *        create_salted_policy_auth_session(), used to authorize a command
+ *        with an entity's authValue (e.g., TPM2_NV_Write() with the owner
+ *        authorization) without sending the authValue or the secret
+ *        parameters in the clear.
+ *
+ * @param[in]  sapi_ctx      System API (SAPI) context, must be initialized
+ *                           and passed in as pointer to the SAPI context
+ *
+ * @param[in]  tpmKey        Handle of a loaded RSA decryption key (e.g.,
+ *                           the SRK) to encrypt the salt to
+ *
+ * @param[out] hmacSession   Pointer to session parameters struct
+ *                           initialized by this function
+ *
+ * @return 0 if success, 1 if error
+ */
+int create_salted_hmac_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
+                                    TPM2_HANDLE tpmKey, SESSION * hmacSession);
+
+/**
+ * @brief Re-arms a policy session created with create_policy_auth_session()
+ *        (or create_salted_policy_auth_session(), keeping its session key)
+ *        for another authorization (TPM2_PolicyRestart), so that it can be
+ *        reused instead of starting and flushing a new session.
+ *
+ * @param[in]  sapi_ctx      System API (SAPI) context, must be initialized
+ *                           and passed in as pointer to the SAPI context
+ *
+ * @param[in]  policySession Pointer to the policy session to be restarted
+ *
+ * @return 0 if success, 1 if error
+ */
+int restart_policy_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
+                                SESSION * policySession);
+
 /**
  * @brief Initiates (starts) a new authorization session (called by
  *        create_policy_auth_session()).
@@ -512,6 +781,57 @@ int create_policy_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
 int start_policy_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
                               SESSION * session, TPM2_SE session_type);
 
+/**
+ * @brief Computes the TPM 2.0 key derivation function KDFa (the SP800-108
+ *        counter mode KDF, with HMAC-SHA256), used to derive session keys
+ *        and parameter encryption keys.
+ *
+ * @param[in]  key          HMAC key
+ *
+ * @param[in]  key_size     Size, in bytes, of the HMAC key
+ *
+ * @param[in]  label        Label (e.g., "ATH" or "CFB"), whose NUL
+ *                          terminator is part of the derivation input
+ *
+ * @param[in]  contextU     First context value (a nonce)
+ *
+ * @param[in]  contextV     Second context value (a nonce)
+ *
+ * @param[in]  bits         Number of bits to derive
+ *
+ * @param[out] out          Buffer ((bits + 7) / 8 bytes) to hold the result
+ *
+ * @return 0 if success, 1 if error
+ */
+int compute_kdfa(const uint8_t * key, size_t key_size, const char *label,
+                 TPM2B_NONCE contextU, TPM2B_NONCE contextV,
+                 size_t bits, uint8_t * out);
+
+/**
+ * @brief Encrypts or decrypts (in place) a command or response parameter
+ *        sent under a parameter encryption session (AES-256 CFB), with the
+ *        key and IV derived from the session key, the authValue and the
+ *        session nonces. The session nonces must have been rolled for the
+ *        command (init_policy_cmd_auth()) or response
+ *        (check_response_auth()) the parameter belongs to.
+ *
+ * @param[in]  session      Parameter encryption session
+ *
+ * @param[in]  authValue    Authorization value of the entity authorized by
+ *                          the session
+ *
+ * @param[in]  encrypt      true to encrypt (command parameter), false to
+ *                          decrypt (response parameter)
+ *
+ * @param[in,out] data      Parameter data (without its size field)
+ *
+ * @param[in]  data_size    Size, in bytes, of the parameter data
+ *
+ * @return 0 if success, 1 if error
+ */
+int crypt_session_param(SESSION * session, TPM2B_AUTH authValue,
+                        bool encrypt, uint8_t * data, size_t data_size);
+
 /**
  * @brief Executes the Kmyth-specific authorization policy steps and updates
  *        the authorization policy session context for the specified TPM 2.0
@@ -539,7 +859,7 @@ int apply_policy(TSS2_SYS_CONTEXT * sapi_ctx,
  * An authorization session uses two nonces, the caller provides one with a
  * command and the TPM provides one with the response to the command. This
  * function creates an new caller nonce for the authorization session using
- * random bytes obtained from the OpenSSL RAND_bytes() function.
+ * random bytes drawn from the calling thread's random pool (see random_pool.h).
  * 
  * @param[out] nonceOut  The created nonce value (passed as a pointer to
  *                       the TPM2B_NONCE struct containing the nonce value)
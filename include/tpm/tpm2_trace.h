@@ -0,0 +1,71 @@
+/**
+ * @file  tpm2_trace.h
+ *
+ * @brief Provides a TCTI wrapper that observes every TPM 2.0 command sent
+ *        over a connection, to attribute TPM latency to the commands
+ *        (e.g., TPM2_Create, TPM2_PolicyPCR, TPM2_Unseal) that cause it.
+ */
+
+#ifndef TPM2_TRACE_H
+#define TPM2_TRACE_H
+
+#include <tss2/tss2_tcti.h>
+
+/**
+ * @brief Wraps a TCTI context so that each TPM command passing through it
+ *        is traced: its command code, duration, response code, and number
+ *        of authorization sessions are
+ *          - recorded in the kmyth_tpm_command_duration_seconds metric
+ *            (see kmyth_metrics.h), if metrics are being recorded
+ *          - logged, if debug logging is enabled
+ *          - written to the trace file opened with tpm2_trace_open(), if any
+ *
+ *        Commands are not timed when none of these is enabled.
+ *
+ *        The wrapper forwards every TCTI call to the wrapped context, which
+ *        it owns from then on: finalizing the wrapper (Tss2_Tcti_Finalize())
+ *        finalizes and frees the wrapped context.
+ *
+ * @param[in]  inner     TCTI context to be wrapped (e.g., the resource
+ *                       manager connection from init_tcti_abrmd())
+ *
+ * @param[out] tcti_ctx  The wrapping TCTI context, to be used in place of
+ *                       the wrapped one and freed by the caller (after
+ *                       finalizing it), must be passed in as a NULL
+ *
+ * @return 0 if success, 1 if error (in which case the wrapped context is
+ *         left to the caller)
+ */
+int init_tcti_trace(TSS2_TCTI_CONTEXT * inner, TSS2_TCTI_CONTEXT ** tcti_ctx);
+
+/**
+ * @brief Names a TPM 2.0 command code (e.g., "TPM2_Create"), for the
+ *        commands Kmyth is known to use.
+ *
+ * @param[in]  command_code  TPM 2.0 command code
+ *
+ * @return The command name, or NULL if the command code is not known
+ */
+const char *tpm2_command_name(TPM2_CC command_code);
+
+/**
+ * @brief Starts writing the TPM commands sent over every traced connection
+ *        to a file, in the Chrome trace-event format (a JSON array of
+ *        complete events, which can be loaded in, e.g., chrome://tracing or
+ *        Perfetto). A trace file already open is closed first.
+ *
+ * @param[in]  path  Path of the trace file, which is overwritten
+ *
+ * @return 0 if success, 1 if error
+ */
+int tpm2_trace_open(const char *path);
+
+/**
+ * @brief Stops writing TPM commands to the trace file, and closes it
+ *        (a no-op if no trace file is open). Suitable for atexit().
+ *
+ * @return None
+ */
+void tpm2_trace_close(void);
+
+#endif /* TPM2_TRACE_H */
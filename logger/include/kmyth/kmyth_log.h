@@ -8,6 +8,8 @@
 #ifndef KMYTH_LOG_H
 #define KMYTH_LOG_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <syslog.h>
 
@@ -94,6 +96,31 @@
  */
 #define KMYTH_APPLOG_OUTPUT_MODE_DEFAULT 1
 
+/*
+ * A logger built with KMYTH_LOG_STDERR_ONLY defined (as for the boot build,
+ * kmyth-unseal-boot, which runs from an initramfs before syslog is up and
+ * with no writable /var/log) never opens syslog or the application log file:
+ * every entry the severity threshold lets through goes to stderr, keeping
+ * stdout for the tool's own output.
+ */
+
+/**
+ * @brief flag combined with an application logging "output mode" (e.g.,
+ *        1 | KMYTH_APPLOG_OUTPUT_JSON) to write each entry as a single line
+ *        JSON object, for log pipelines to ingest without parsing text:
+ *
+ * <pre>
+ *   {"time":"2021-06-01T12:00:00-0400","app":"kmyth","version":"0.0.0",
+ *    "severity":"ERROR","file":"src/tpm/object_tools.c","func":"...",
+ *    "line":412,"msg":"...","operation":"Tss2_Sys_Load","tpm_rc":"0x0000098E"}
+ * </pre>
+ *
+ * The structured fields of entries logged with kmyth_log_fields() follow
+ * the standard members (without the flag, they follow the message text).
+ * Syslog entries are unaffected.
+ */
+#define KMYTH_APPLOG_OUTPUT_JSON 0x04
+
 /**
  * @brief sets the default "severity threshold" for logging to the Kmyth
  *        application log file globally - options (in order of least to
@@ -116,14 +143,98 @@
  */
 #define KMYTH_APPLOG_SEVERITY_THRESHOLD_DEFAULT LOG_INFO
 
+/**
+ * @brief least severe level of the kmyth_log() calls compiled in: calls
+ *        logging a less severe level (a greater value) are removed at
+ *        compile time, arguments and all. Release builds can define it
+ *        (e.g., -DKMYTH_LOG_MIN_LEVEL=LOG_INFO) to drop their LOG_DEBUG
+ *        calls; by default every level is compiled in.
+ */
+#ifndef KMYTH_LOG_MIN_LEVEL
+#define KMYTH_LOG_MIN_LEVEL LOG_DEBUG
+#endif
+
 /**
  * @brief maximum message length of a log entry
  *        (note: this does not include the string's null termination character)
  */
 #define DEFAULT_MAX_LOG_MSG_LEN 128
 
+/**
+ * @brief async mode overflow policy: an entry logged while the queue is
+ *        full is discarded (and counted, in a warning logged later)
+ */
+#define KMYTH_LOG_ASYNC_DROP 0
+
+/**
+ * @brief async mode overflow policy: logging an entry while the queue is
+ *        full waits for the queue to make room
+ */
+#define KMYTH_LOG_ASYNC_BLOCK 1
+
+/**
+ * @brief default number of entries held by the async mode queue
+ */
+#define KMYTH_LOG_ASYNC_QUEUE_LEN_DEFAULT 256
+
+/**
+ * @brief maximum number of entries held by the async mode queue
+ */
+#define KMYTH_LOG_ASYNC_QUEUE_LEN_MAX 65536
+
+/**
+ * @brief default number of warnings (or more severe entries) one source
+ *        location may log in a burst before it is rate limited
+ */
+#define KMYTH_LOG_RATE_BURST_DEFAULT 20
+
+/**
+ * @brief default number of warnings (or more severe entries) per second a
+ *        rate limited source location may log
+ */
+#define KMYTH_LOG_RATE_PER_SEC_DEFAULT 2
+
 //--------------------------Templates-----------------------------------------
 
+/**
+ * @brief types of the structured fields logged by kmyth_log_fields()
+ */
+typedef enum kmyth_log_field_type
+{
+  KMYTH_LOG_FIELD_STR,          // string
+  KMYTH_LOG_FIELD_INT,          // signed integer
+  KMYTH_LOG_FIELD_UINT,         // unsigned integer
+  KMYTH_LOG_FIELD_HEX           // unsigned integer, shown as "0x%08X"
+} kmyth_log_field_type;
+
+/**
+ * @brief a structured (named and typed) log field, set up with the
+ *        KMYTH_LOG_STR(), KMYTH_LOG_INT(), KMYTH_LOG_UINT(), and
+ *        KMYTH_LOG_HEX() initializers
+ */
+typedef struct kmyth_log_field
+{
+  const char *key;
+  kmyth_log_field_type type;
+  union
+  {
+    const char *s;
+    long long i;
+    unsigned long long u;
+  } value;
+} kmyth_log_field;
+
+#define KMYTH_LOG_STR(k, v)\
+  { .key = (k), .type = KMYTH_LOG_FIELD_STR, .value.s = (v) }
+#define KMYTH_LOG_INT(k, v)\
+  { .key = (k), .type = KMYTH_LOG_FIELD_INT, .value.i = (long long) (v) }
+#define KMYTH_LOG_UINT(k, v)\
+  { .key = (k), .type = KMYTH_LOG_FIELD_UINT,\
+    .value.u = (unsigned long long) (v) }
+#define KMYTH_LOG_HEX(k, v)\
+  { .key = (k), .type = KMYTH_LOG_FIELD_HEX,\
+    .value.u = (unsigned long long) (v) }
+
 struct log_params
 {
   char app_name[MAX_APP_NAME_LEN + 1];
@@ -143,6 +254,28 @@ struct log_params
 #ifdef __cplusplus
 extern "C" {
 #endif
+/**
+ * @brief least severe level that is currently written anywhere (the greater
+ *        of the application log and syslog severity thresholds), maintained
+ *        by the severity threshold setters for kmyth_log_enabled(). It is
+ *        not to be set directly.
+ */
+extern int kmyth_log_severity_limit;
+
+/**
+ * @brief checks, without formatting anything, whether an entry of the given
+ *        severity would be written by the current severity thresholds
+ *
+ * @param[in]  severity  severity level of the entry
+ *
+ * @return non-zero if the entry would be logged, 0 otherwise
+ */
+static inline int kmyth_log_enabled(int severity)
+{
+  return LOG_PRI(severity) <= __atomic_load_n(&kmyth_log_severity_limit,
+                                              __ATOMIC_RELAXED);
+}
+
 /**
  * @brief sets new name string to identify application being logged
  *
@@ -192,6 +325,8 @@ void set_applog_max_msg_len(int new_max_log_msg_len);
  *                                <LI> 2 (0x02) = log file if available but
  *                                     never stddest </LI>
  *                              </UL>
+ *                              optionally combined with
+ *                              KMYTH_APPLOG_OUTPUT_JSON
  *
  * @return None
  */
@@ -248,6 +383,96 @@ void set_applog_severity_threshold(int new_syslog_facility);
  */
 void set_syslog_severity_threshold(int new_severity_threshold);
 
+/**
+ * @brief requests that the application log file and the syslog connection,
+ *        which are otherwise kept open between log entries, be closed and
+ *        reopened before the next entry is logged (e.g., from a SIGHUP
+ *        handler, once logrotate has moved the log file). Only a flag is
+ *        set, so this is async-signal-safe.
+ *
+ * @return None
+ */
+void kmyth_log_reopen(void);
+
+/**
+ * @brief sets the rate limit applied to each source location (call site)
+ *        logging warnings or more severe entries (less severe entries are
+ *        never rate limited), so that a fault repeated across a bulk
+ *        operation does not flood the logs
+ *
+ * <pre>
+ * Each source location may log a burst of entries, after which it may log
+ * per_second entries a second: a token bucket. The entries it logs beyond
+ * that are dropped, and counted in an entry ("N log entries suppressed
+ * (rate limit)") written from the same location when it is next let
+ * through, or when the application exits.
+ * </pre>
+ *
+ * @param[in]  burst       number of entries a location may log at once
+ *                         (0 turns rate limiting off)
+ *
+ * @param[in]  per_second  number of entries per second a location may log
+ *                         once its burst is spent
+ *
+ * @return None
+ */
+void set_log_rate_limit(unsigned int burst, unsigned int per_second);
+
+/**
+ * @brief turns duplicate suppression (on by default) on or off: an entry
+ *        identical to the one before it (same source location, severity,
+ *        message, and fields) is not written again, but counted, and the
+ *        count written ("last message repeated N times") when a different
+ *        entry is logged, at least every 30 seconds while the repeats go
+ *        on, and when the application exits
+ *
+ * @param[in]  enabled  true to suppress repeated entries
+ *
+ * @return None
+ */
+void set_log_repeat_suppression(bool enabled);
+
+/**
+ * @brief starts "async mode": log entries are formatted on the calling
+ *        thread but queued, and written (to syslog, the application log
+ *        file, or stdout/stderr) by a background thread, so that callers
+ *        do not wait on log output. Queueing an entry takes no locks.
+ *
+ * <pre>
+ * Entries still queued are written when the application exits (or by
+ * kmyth_log_stop_async()). A child process forked in async mode logs
+ * synchronously. As the background thread blocks all signals, a daemon
+ * should start async mode after setting up its signal handling threads'
+ * masks, so that it inherits none of the signals they wait for.
+ * </pre>
+ *
+ * @param[in]  queue_len        number of entries the queue holds
+ *                              (1 to KMYTH_LOG_ASYNC_QUEUE_LEN_MAX)
+ *
+ * @param[in]  overflow_policy  KMYTH_LOG_ASYNC_DROP or KMYTH_LOG_ASYNC_BLOCK,
+ *                              for entries logged while the queue is full
+ *
+ * @return 0 on success (or if async mode is already started), 1 on error
+ */
+int kmyth_log_start_async(size_t queue_len, int overflow_policy);
+
+/**
+ * @brief waits for the entries queued (in async mode) before the call to
+ *        be written. Does nothing beyond flushing stdout otherwise.
+ *
+ * @return None
+ */
+void kmyth_log_flush(void);
+
+/**
+ * @brief writes any queued entries and stops async mode, so that entries
+ *        are again written synchronously. Registered with atexit() by
+ *        kmyth_log_start_async().
+ *
+ * @return None
+ */
+void kmyth_log_stop_async(void);
+
 /**
  * @brief 
  *
@@ -332,9 +557,68 @@ void log_event(const char *src_file,
                const char *message, ...);
 
 /**
- * @brief macro used to specify common initial three kmyth_log() parameters
+ * @brief Records a log entry like log_event(), carrying structured fields
+ *        (e.g., an operation name, a duration, or a TPM return code) that
+ *        JSON output mode writes as typed JSON members.
+ *
+ * <pre>
+ *   kmyth_log_field fields[] = { KMYTH_LOG_STR("operation", "seal"),
+ *                                KMYTH_LOG_UINT("duration_us", elapsed) };
+ *
+ *   kmyth_log_fields(LOG_INFO, fields, 2, "sealed %s", path);
+ * </pre>
+ *
+ * @param[in] src_file     The source file recording the log
+ *
+ * @param[in] src_func     The source function recording the log
+ *
+ * @param[in] src_line     The line in the source file recording the log
+ *
+ * @param[in] severity     The "severity level" of the message to be logged
+ *
+ * @param[in] fields       The structured fields of the entry
+ *
+ * @param[in] field_count  The number of fields
+ *
+ * @param[in] message      format specification for string of log to be
+ *                         recorded
+ *
+ * @param[in] ...          arguments for message format spec
+ *
+ * @return None
+ */
+void log_event_fields(const char *src_file, const char *src_func,
+                      const int src_line, int severity,
+                      const kmyth_log_field * fields, size_t field_count,
+                      const char *message, ...);
+
+/**
+ * @brief macro used to specify common initial three kmyth_log() parameters.
+ *        Calls less severe than KMYTH_LOG_MIN_LEVEL are compiled out, and
+ *        the format arguments of an entry no threshold would let through
+ *        are never evaluated or formatted. (The severity, normally a
+ *        constant, is evaluated more than once.)
+ */
+#define kmyth_log(severity, ...)\
+do {\
+  if ((severity) <= KMYTH_LOG_MIN_LEVEL && kmyth_log_enabled(severity))\
+  {\
+    log_event(__FILE__, __func__, __LINE__, (severity), __VA_ARGS__);\
+  }\
+} while (0)
+
+/**
+ * @brief macro used to specify common initial three log_event_fields()
+ *        parameters, filtering entries as kmyth_log() does
  */
-#define kmyth_log(...) log_event(__FILE__, __func__, __LINE__, __VA_ARGS__)
+#define kmyth_log_fields(severity, fields, field_count, ...)\
+do {\
+  if ((severity) <= KMYTH_LOG_MIN_LEVEL && kmyth_log_enabled(severity))\
+  {\
+    log_event_fields(__FILE__, __func__, __LINE__, (severity), (fields),\
+                     (field_count), __VA_ARGS__);\
+  }\
+} while (0)
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,137 @@
+/**
+ * @file  kmyth_metrics.h
+ *
+ * @brief Provides a small registry of counters and latency histograms for
+ *        long-running Kmyth services (e.g., kmyth-unsealerd), exported in
+ *        the Prometheus text format.
+ *
+ * Metrics are recorded only once kmyth_metrics_serve() has started the
+ * endpoint: until then each recording call costs a single check. A metric
+ * is identified by its name and label set, and is created the first time
+ * it is recorded.
+ */
+
+#ifndef KMYTH_METRICS_H
+#define KMYTH_METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+//--------------------------Macros--------------------------------------------
+
+/**
+ * @brief most metrics (distinct name and label set pairs) that can be
+ *        registered - further metrics are not recorded
+ */
+#define KMYTH_METRICS_MAX 128
+
+/**
+ * @brief maximum length (in chars) of a metric's label set
+ *        (note: this does not include the string's null termination character)
+ */
+#define KMYTH_METRICS_MAX_LABELS_LEN 95
+
+/**
+ * @brief number of (finite) buckets in a latency histogram, with upper
+ *        bounds from 100 microseconds to 10 seconds
+ */
+#define KMYTH_METRICS_LATENCY_BUCKETS 16
+
+//--------------------------Function Prototypes-------------------------------
+
+/**
+ * @brief non-zero once metrics are being recorded (see kmyth_metrics_enabled)
+ */
+extern int kmyth_metrics_active;
+
+/**
+ * @brief checks whether metrics are being recorded, e.g., to skip gathering
+ *        the values of metrics nobody will read
+ *
+ * @return non-zero if metrics are recorded, 0 otherwise
+ */
+static inline int kmyth_metrics_enabled(void)
+{
+  return __atomic_load_n(&kmyth_metrics_active, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief adds to a counter
+ *
+ * @param[in]  name    metric name (e.g., "kmyth_unsealerd_cache_hits_total"),
+ *                     which must outlive the registry (e.g., a literal)
+ *
+ * @param[in]  labels  label set, in the exposition format without braces
+ *                     (e.g., "result=\"ok\""), or NULL - values are not
+ *                     escaped, so must not contain quotes or backslashes
+ *
+ * @param[in]  help    description of the metric, which must outlive the
+ *                     registry as well
+ *
+ * @param[in]  count   amount added to the counter
+ *
+ * @return None
+ */
+void kmyth_metrics_count(const char *name, const char *labels,
+                         const char *help, uint64_t count);
+
+/**
+ * @brief starts timing an operation to be recorded in a latency histogram
+ *
+ * @return the start time (monotonic clock, in nanoseconds) to be passed to
+ *         kmyth_metrics_observe_latency(), or 0 if metrics are not recorded
+ */
+uint64_t kmyth_metrics_clock(void);
+
+/**
+ * @brief records the duration of an operation in a latency histogram
+ *        (exported in seconds)
+ *
+ * @param[in]  name    metric name (e.g., "kmyth_unseal_duration_seconds"),
+ *                     see kmyth_metrics_count()
+ *
+ * @param[in]  labels  label set, or NULL (see kmyth_metrics_count())
+ *
+ * @param[in]  help    description of the metric (see kmyth_metrics_count())
+ *
+ * @param[in]  begin   start time returned by kmyth_metrics_clock() (nothing
+ *                     is recorded if this is 0)
+ *
+ * @return None
+ */
+void kmyth_metrics_observe_latency(const char *name, const char *labels,
+                                   const char *help, uint64_t begin);
+
+/**
+ * @brief writes every registered metric, in the Prometheus text
+ *        exposition format
+ *
+ * @param[in]  stream  where the metrics are written
+ *
+ * @return None
+ */
+void kmyth_metrics_print(FILE * stream);
+
+/**
+ * @brief starts recording metrics, and a background thread that writes
+ *        them to each client connecting to the given listening socket
+ *        (e.g., a local socket set up with setup_unix_server_socket()).
+ *        A client sending an HTTP GET request is answered with an HTTP
+ *        response, so the endpoint can be scraped with, e.g.,
+ *        curl --unix-socket <path> http://localhost/metrics
+ *
+ * @param[in]  listen_fd  listening socket, closed by kmyth_metrics_stop()
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_metrics_serve(int listen_fd);
+
+/**
+ * @brief stops the metrics endpoint started by kmyth_metrics_serve() and
+ *        closes its socket (the metrics recorded so far are kept)
+ *
+ * @return None
+ */
+void kmyth_metrics_stop(void);
+
+#endif
@@ -6,14 +6,22 @@
 
 #include "kmyth_log.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
 #include <time.h>
-
+#include <unistd.h>
 
 static struct log_params log_settings = {
   .app_name = DEFAULT_APP_NAME,
@@ -29,6 +37,421 @@ static struct log_params log_settings = {
   .syslog_severity_threshold = SYSLOG_SEVERITY_THRESHOLD_DEFAULT,
 };
 
+// The application log file and the syslog connection are opened on first
+// use and kept open. A file that cannot be opened (e.g., by a non-root
+// user) is not retried until the handles are reopened.
+static int applog_fd = -1;
+static bool applog_unavailable = false;
+static bool syslog_opened = false;
+static int syslog_mask_threshold = -1;
+static volatile sig_atomic_t log_reopen_requested = 0;
+
+// the greater (least restrictive) of the two severity thresholds
+int kmyth_log_severity_limit =
+  (KMYTH_APPLOG_SEVERITY_THRESHOLD_DEFAULT > SYSLOG_SEVERITY_THRESHOLD_DEFAULT)
+  ? KMYTH_APPLOG_SEVERITY_THRESHOLD_DEFAULT : SYSLOG_SEVERITY_THRESHOLD_DEFAULT;
+
+// Serializes the settings, handles, and output above between threads. Only
+// applog_max_msg_len is read without it (atomically, when a message is
+// formatted), so that async mode producers never wait on log output.
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Largest message length accepted by set_applog_max_msg_len()
+#define LOG_MSG_LEN_LIMIT 1024
+
+// Source locations longer than these are truncated in async mode
+#define LOG_RECORD_FILE_LEN 256
+#define LOG_RECORD_FUNC_LEN 128
+
+// Space for an entry's structured fields, rendered as JSON object members
+// (fields that do not fit are left out)
+#define LOG_FIELDS_LEN 512
+
+// An async mode ring buffer slot. The source location is copied, as it
+// does not always point to static strings (e.g., enclave log ocalls). seq
+// is set to the position the slot was filled for, plus one, once filled.
+struct log_record
+{
+  atomic_size_t seq;
+  int severity;
+  int src_line;
+  time_t ts;
+  char src_file[LOG_RECORD_FILE_LEN];
+  char src_func[LOG_RECORD_FUNC_LEN];
+  char msg[LOG_MSG_LEN_LIMIT + 1];
+  char fields[LOG_FIELDS_LEN];
+};
+
+// Number of source locations (call sites) whose rate limits are tracked at
+// once; sites that hash to the same slot take it over from each other
+#define LOG_RATE_SITES 64
+
+// Least severe level that is rate limited (routine entries never are)
+#define LOG_RATE_LIMIT_SEVERITY LOG_WARNING
+
+// Longest time (in seconds) the repeats of an entry go unreported
+#define LOG_REPEAT_REPORT_INTERVAL 30.0
+
+// A call site's token bucket: it holds up to log_rate_burst tokens, refilled
+// at log_rate_per_second, and each entry written takes one
+struct log_site
+{
+  bool used;
+  int src_line;
+  int severity;
+  char src_file[LOG_RECORD_FILE_LEN];
+  char src_func[LOG_RECORD_FUNC_LEN];
+  double tokens;
+  double refilled;              // monotonic time of the last refill
+  size_t suppressed;            // entries dropped since the last one written
+};
+
+// The last entry written, and how many times it has been repeated since
+struct log_last_entry
+{
+  bool valid;
+  int severity;
+  int src_line;
+  char src_file[LOG_RECORD_FILE_LEN];
+  char src_func[LOG_RECORD_FUNC_LEN];
+  char msg[LOG_MSG_LEN_LIMIT + 1];
+  char fields[LOG_FIELDS_LEN];
+  size_t repeats;
+  double reported;              // monotonic time repeats were last reported
+};
+
+// Duplicate suppression and rate limiting state, protected by log_lock
+static bool log_repeat_suppression = true;
+static unsigned int log_rate_burst = KMYTH_LOG_RATE_BURST_DEFAULT;
+static unsigned int log_rate_per_second = KMYTH_LOG_RATE_PER_SEC_DEFAULT;
+static struct log_site log_sites[LOG_RATE_SITES];
+static struct log_last_entry last_entry;
+static pthread_once_t suppression_report_once = PTHREAD_ONCE_INIT;
+
+// Async mode state. Producers claim a free slot from async_space (blocking
+// or dropping the entry when none is free), take the next position from
+// async_tail, fill the slot and announce it on async_items. The drain
+// thread empties the slots in position order.
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool async_running = false;
+static bool async_hooks_registered = false;
+static pthread_t async_thread;
+static struct log_record *async_ring = NULL;
+static size_t async_ring_len = 0;
+static int async_overflow_policy = KMYTH_LOG_ASYNC_DROP;
+static sem_t async_space;
+static sem_t async_items;
+static atomic_bool async_enabled = false;
+static atomic_bool async_stopping = false;
+static atomic_size_t async_producers = 0;
+static atomic_size_t async_tail = 0;
+static atomic_size_t async_done = 0;
+static atomic_size_t async_dropped = 0;
+
+//############################################################################
+// close_applog()
+//############################################################################
+static void close_applog(void)
+{
+  if (applog_fd >= 0)
+  {
+    close(applog_fd);
+  }
+  applog_fd = -1;
+  applog_unavailable = false;
+}
+
+//############################################################################
+// close_syslog()
+//############################################################################
+static void close_syslog(void)
+{
+  if (syslog_opened)
+  {
+    closelog();
+  }
+  syslog_opened = false;
+}
+
+//############################################################################
+// update_severity_limit()
+//   - the caller holds log_lock
+//############################################################################
+static void update_severity_limit(void)
+{
+  int limit = log_settings.applog_severity_threshold;
+
+  if (log_settings.syslog_severity_threshold > limit)
+  {
+    limit = log_settings.syslog_severity_threshold;
+  }
+  __atomic_store_n(&kmyth_log_severity_limit, limit, __ATOMIC_RELAXED);
+}
+
+//############################################################################
+// get_applog_fd()
+//############################################################################
+static int get_applog_fd(void)
+{
+#ifdef KMYTH_LOG_STDERR_ONLY
+  return -1;
+#endif
+  if (applog_fd < 0 && !applog_unavailable)
+  {
+    applog_fd = open(log_settings.applog_path,
+                     O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+    applog_unavailable = (applog_fd < 0);
+  }
+  return applog_fd;
+}
+
+#ifndef KMYTH_LOG_STDERR_ONLY
+//############################################################################
+// open_syslog()
+//############################################################################
+static void open_syslog(void)
+{
+  if (syslog_mask_threshold != log_settings.syslog_severity_threshold)
+  {
+    setlogmask(LOG_UPTO(log_settings.syslog_severity_threshold));
+    syslog_mask_threshold = log_settings.syslog_severity_threshold;
+  }
+  if (!syslog_opened)
+  {
+    openlog(log_settings.app_name,
+            LOG_CONS | LOG_PID | LOG_NDELAY, log_settings.syslog_facility);
+    syslog_opened = true;
+  }
+}
+#endif
+
+//############################################################################
+// json_escape()
+//   - dest_size must allow for each character of src escaped as \u00XX
+//     (6 characters), or the result is truncated (between characters)
+//############################################################################
+static size_t json_escape(char *dest, size_t dest_size, const char *src)
+{
+  static const char hex_digits[] = "0123456789abcdef";
+  size_t len = 0;
+
+  for (const unsigned char *c = (const unsigned char *) src; *c != '\0'; c++)
+  {
+    char esc[6] = { '\\', (char) *c };
+    size_t esc_len = 2;
+
+    switch (*c)
+    {
+    case '"':
+    case '\\':
+      break;
+    case '\n':
+      esc[1] = 'n';
+      break;
+    case '\r':
+      esc[1] = 'r';
+      break;
+    case '\t':
+      esc[1] = 't';
+      break;
+    default:
+      if (*c < 0x20)
+      {
+        memcpy(esc + 1, "u00", 3);
+        esc[4] = hex_digits[*c >> 4];
+        esc[5] = hex_digits[*c & 0x0f];
+        esc_len = 6;
+      }
+      else
+      {
+        esc[0] = (char) *c;
+        esc_len = 1;
+      }
+    }
+
+    if (len + esc_len >= dest_size)
+    {
+      break;
+    }
+    memcpy(dest + len, esc, esc_len);
+    len += esc_len;
+  }
+  dest[len] = '\0';
+
+  return len;
+}
+
+//############################################################################
+// format_log_fields()
+//############################################################################
+static void format_log_fields(const kmyth_log_field * fields,
+                              size_t field_count, char *dest,
+                              size_t dest_size)
+{
+  size_t len = 0;
+
+  dest[0] = '\0';
+  for (size_t i = 0; i < field_count; i++)
+  {
+    if (fields[i].key == NULL)
+    {
+      continue;
+    }
+
+    const char *value = (fields[i].type == KMYTH_LOG_FIELD_STR
+                         && fields[i].value.s != NULL) ? fields[i].value.s
+      : "";
+    size_t member_size = 6 * (strlen(fields[i].key) + strlen(value)) + 32;
+    char key[6 * strlen(fields[i].key) + 1];
+    char member[member_size];
+    int member_len = 0;
+
+    json_escape(key, sizeof(key), fields[i].key);
+    switch (fields[i].type)
+    {
+    case KMYTH_LOG_FIELD_INT:
+      member_len = snprintf(member, member_size, "\"%s\":%lld", key,
+                            fields[i].value.i);
+      break;
+    case KMYTH_LOG_FIELD_UINT:
+      member_len = snprintf(member, member_size, "\"%s\":%llu", key,
+                            fields[i].value.u);
+      break;
+    case KMYTH_LOG_FIELD_HEX:
+      member_len = snprintf(member, member_size, "\"%s\":\"0x%08llX\"", key,
+                            fields[i].value.u);
+      break;
+    default:
+      {
+        char escaped[6 * strlen(value) + 1];
+
+        json_escape(escaped, sizeof(escaped), value);
+        member_len = snprintf(member, member_size, "\"%s\":\"%s\"", key,
+                              escaped);
+      }
+    }
+
+    // leave out (rather than truncate) a field that does not fit
+    size_t needed = (size_t) member_len + ((len > 0) ? 1 : 0);
+
+    if (member_len <= 0 || len + needed >= dest_size)
+    {
+      continue;
+    }
+    if (len > 0)
+    {
+      dest[len++] = ',';
+    }
+    memcpy(dest + len, member, (size_t) member_len + 1);
+    len += (size_t) member_len;
+  }
+}
+
+//############################################################################
+// format_json_entry()
+//############################################################################
+static void format_json_entry(char *line, size_t line_size,
+                              const char *severity_string, time_t ts,
+                              const char *src_file, const char *src_func,
+                              int src_line, const char *msg,
+                              const char *fields)
+{
+  char timestamp[32];
+  char app_name[6 * log_settings.app_name_len + 1];
+  char app_version[6 * log_settings.app_version_len + 1];
+  char file[6 * strlen(src_file) + 1];
+  char func[6 * strlen(src_func) + 1];
+  char message[6 * strlen(msg) + 1];
+
+  // ISO 8601 local time, with the UTC offset: yyyy-mm-ddThh:mm:ss+hhmm
+  strftime(timestamp, sizeof(timestamp), "%FT%T%z", localtime(&ts));
+  json_escape(app_name, sizeof(app_name), log_settings.app_name);
+  json_escape(app_version, sizeof(app_version), log_settings.app_version);
+  json_escape(file, sizeof(file), src_file);
+  json_escape(func, sizeof(func), src_func);
+  json_escape(message, sizeof(message), msg);
+
+  snprintf(line, line_size,
+           "{\"time\":\"%s\",\"app\":\"%s\",\"version\":\"%s\","
+           "\"severity\":\"%s\",\"file\":\"%s\",\"func\":\"%s\","
+           "\"line\":%d,\"msg\":\"%s\"%s%s}\n", timestamp, app_name,
+           app_version, severity_string, file, func, src_line, message,
+           (fields[0] != '\0') ? "," : "", fields);
+}
+
+//############################################################################
+// print_stddest_entry()
+//############################################################################
+static void print_stddest_entry(FILE * stddest, const char *json_line,
+                                const char *severity_string,
+                                const char *src_file, const char *src_func,
+                                int src_line, const char *out)
+{
+  if (json_line != NULL)
+  {
+    fputs(json_line, stddest);
+  }
+  else if (log_settings.applog_severity_threshold > LOG_INFO)
+  {
+    fprintf(stddest, "%s-%s %s - %s(%s:%d) %s\n",
+            log_settings.app_name, log_settings.app_version,
+            severity_string, src_file, src_func, src_line, out);
+  }
+  else
+  {
+    fprintf(stddest, "%s - %s\n", severity_string, out);
+  }
+}
+
+//############################################################################
+// write_applog_entry()
+//############################################################################
+static void write_applog_entry(int fd, const char *json_line,
+                               const char *severity_string,
+                               const char *timestamp, const char *src_file,
+                               const char *src_func, int src_line,
+                               const char *out)
+{
+  if (json_line != NULL)
+  {
+    ssize_t written = write(fd, json_line, strlen(json_line));
+
+    (void) written;
+    return;
+  }
+
+  // Format the whole entry and append it with one write(2), so entries
+  // from concurrent writers (O_APPEND) are never interleaved. The fixed
+  // text and the line number take well under 32 characters.
+  size_t line_size = log_settings.app_name_len
+    + log_settings.app_version_len + strlen(severity_string)
+    + strlen(timestamp) + strlen(src_file) + strlen(src_func)
+    + strlen(out) + 32;
+  char line[line_size];
+  int line_len = snprintf(line, line_size, "%s-%s %s %s - %s(%s:%d) %s\n",
+                          log_settings.app_name, log_settings.app_version,
+                          severity_string, timestamp, src_file, src_func,
+                          src_line, out);
+
+  if (line_len > 0)
+  {
+    size_t len = ((size_t) line_len < line_size) ? (size_t) line_len
+      : line_size - 1;
+    ssize_t written = write(fd, line, len);
+
+    (void) written;
+  }
+}
+
+//############################################################################
+// kmyth_log_reopen()
+//############################################################################
+void kmyth_log_reopen(void)
+{
+  // only sets a flag, so that it may be called from a signal handler
+  log_reopen_requested = 1;
+}
+
 //############################################################################
 // set_app_name()
 //############################################################################
@@ -37,6 +460,8 @@ void set_app_name(const char *new_app_name)
   bool truncated = false;
   size_t temp_len = 0;
 
+  pthread_mutex_lock(&log_lock);
+
   temp_len = strnlen(new_app_name, MAX_APP_NAME_LEN + 1);
   if (temp_len <= MAX_APP_NAME_LEN)
   {
@@ -54,12 +479,17 @@ void set_app_name(const char *new_app_name)
   // ensure application name string is null terminated
   log_settings.app_name[log_settings.app_name_len] = '\0';
 
+  // syslog entries are identified by the application name
+  close_syslog();
+
   // if application name was truncated, notify user 
   if (truncated == true)
   {
     fprintf(stderr, "set_app_name(): input \"%s\" ", new_app_name);
     fprintf(stderr, "truncated to \"%s\"\n", log_settings.app_name);
   }
+
+  pthread_mutex_unlock(&log_lock);
 }
 
 //############################################################################
@@ -70,6 +500,8 @@ void set_app_version(const char *new_app_version)
   bool truncated = false;
   size_t temp_len = 0;
 
+  pthread_mutex_lock(&log_lock);
+
   temp_len = strnlen(new_app_version, MAX_APP_VERSION_LEN + 1);
   if (temp_len <= MAX_APP_VERSION_LEN)
   {
@@ -94,6 +526,8 @@ void set_app_version(const char *new_app_version)
     fprintf(stderr, "set_app_version(): input \"%s\" ", new_app_version);
     fprintf(stderr, "truncated to \"%s\"\n", log_settings.app_version);
   }
+
+  pthread_mutex_unlock(&log_lock);
 }
 
 //############################################################################
@@ -103,6 +537,8 @@ void set_applog_path(const char *new_applog_path)
 {
   size_t temp_len = 0;
 
+  pthread_mutex_lock(&log_lock);
+
   temp_len = strnlen(new_applog_path, MAX_APPLOG_PATH_LEN + 1);
   if (temp_len <= MAX_APPLOG_PATH_LEN)
   {
@@ -112,6 +548,9 @@ void set_applog_path(const char *new_applog_path)
 
     // ensure log directory string is null terminated
     log_settings.applog_path[log_settings.applog_path_len] = '\0';
+
+    // the new file is opened by the next entry written to it
+    close_applog();
   }
   else
   {
@@ -121,6 +560,8 @@ void set_applog_path(const char *new_applog_path)
     fprintf(stderr, "(%d) - application log path ", MAX_APPLOG_PATH_LEN);
     fprintf(stderr, "remains \"%s\"\n", log_settings.applog_path);
   }
+
+  pthread_mutex_unlock(&log_lock);
 }
 
 
@@ -130,9 +571,14 @@ void set_applog_path(const char *new_applog_path)
 //############################################################################
 void set_applog_max_msg_len(int new_max_log_msg_len)
 {
-  if ((new_max_log_msg_len >= 0) && (new_max_log_msg_len <= 1024))
+  pthread_mutex_lock(&log_lock);
+
+  if ((new_max_log_msg_len >= 0)
+      && (new_max_log_msg_len <= LOG_MSG_LEN_LIMIT))
   {
-    log_settings.applog_max_msg_len = new_max_log_msg_len;
+    // read without the lock when a message is formatted
+    __atomic_store_n(&log_settings.applog_max_msg_len, new_max_log_msg_len,
+                     __ATOMIC_RELAXED);
   }
   else
   {
@@ -141,15 +587,22 @@ void set_applog_max_msg_len(int new_max_log_msg_len)
     fprintf(stderr, "input (%d) invalid ", new_max_log_msg_len);
     fprintf(stderr, "- unchanged (%d)\n", log_settings.applog_max_msg_len);
   }
+
+  pthread_mutex_unlock(&log_lock);
 }
 
 //############################################################################
 // set_applog_output_mode()
-//   - valid values: 0, 1, or 2
+//   - valid values: 0, 1, or 2, optionally combined with
+//                   KMYTH_APPLOG_OUTPUT_JSON
 //############################################################################
 void set_applog_output_mode(int new_output_mode)
 {
-  if ((new_output_mode >= 0) && (new_output_mode <= 2))
+  pthread_mutex_lock(&log_lock);
+
+  int destination = new_output_mode & ~KMYTH_APPLOG_OUTPUT_JSON;
+
+  if ((destination >= 0) && (destination <= 2))
   {
     log_settings.applog_output_mode = new_output_mode;
   }
@@ -160,6 +613,8 @@ void set_applog_output_mode(int new_output_mode)
     fprintf(stderr, "input (%d) invalid ", new_output_mode);
     fprintf(stderr, "- unchanged (%d)\n", log_settings.applog_output_mode);
   }
+
+  pthread_mutex_unlock(&log_lock);
 }
 
 //############################################################################
@@ -168,9 +623,12 @@ void set_applog_output_mode(int new_output_mode)
 //############################################################################
 void set_applog_severity_threshold(int new_severity_threshold)
 {
+  pthread_mutex_lock(&log_lock);
+
   if ((new_severity_threshold >= 0) && (new_severity_threshold <= 7))
   {
     log_settings.applog_severity_threshold = new_severity_threshold;
+    update_severity_limit();
   }
   else
   {
@@ -179,6 +637,8 @@ void set_applog_severity_threshold(int new_severity_threshold)
     fprintf(stderr, "input (%d) invalid - unchanged ", new_severity_threshold);
     fprintf(stderr, "(%d)\n", log_settings.applog_severity_threshold);
   }
+
+  pthread_mutex_unlock(&log_lock);
 }
 
 //############################################################################
@@ -189,10 +649,13 @@ void set_applog_severity_threshold(int new_severity_threshold)
 //############################################################################
 void set_syslog_facility(int new_syslog_facility)
 {
+  pthread_mutex_lock(&log_lock);
+
   if ((LOG_FAC(new_syslog_facility) >= 0) &&
       (LOG_FAC(new_syslog_facility) <= (LOG_NFACILITIES - 1)))
   {
     log_settings.syslog_facility = new_syslog_facility;
+    close_syslog();
   }
   else
   {
@@ -202,6 +665,8 @@ void set_syslog_facility(int new_syslog_facility)
     fprintf(stderr, "invalid - unchanged ");
     fprintf(stderr, "(%d)\n", LOG_FAC(log_settings.syslog_facility));
   }
+
+  pthread_mutex_unlock(&log_lock);
 }
 
 //############################################################################
@@ -210,9 +675,12 @@ void set_syslog_facility(int new_syslog_facility)
 //############################################################################
 void set_syslog_severity_threshold(int new_severity_threshold)
 {
+  pthread_mutex_lock(&log_lock);
+
   if ((new_severity_threshold >= 0) && (new_severity_threshold <= 7))
   {
     log_settings.syslog_severity_threshold = new_severity_threshold;
+    update_severity_limit();
   }
   else
   {
@@ -221,6 +689,8 @@ void set_syslog_severity_threshold(int new_severity_threshold)
     fprintf(stderr, "input (%d) invalid - unchanged ", new_severity_threshold);
     fprintf(stderr, "(%d)\n", log_settings.syslog_severity_threshold);
   }
+
+  pthread_mutex_unlock(&log_lock);
 }
 
 //############################################################################
@@ -264,6 +734,9 @@ void get_severity_str(int severity_val_in, char **severity_str_out)
 //############################################################################
 FILE *get_stddest(int severity_val_in)
 {
+#ifdef KMYTH_LOG_STDERR_ONLY
+  return stderr;
+#endif
   FILE *stddest_out;
 
   switch (severity_val_in)
@@ -286,30 +759,33 @@ FILE *get_stddest(int severity_val_in)
 }
 
 //############################################################################
-// log_event()
+// write_log_entry()
+//   - the caller holds log_lock
 //############################################################################
-void log_event(const char *src_file,
-               const char *src_func,
-               const int src_line, int severity, const char *message, ...)
+static void write_log_entry(const char *src_file, const char *src_func,
+                            int src_line, int severity, time_t ts,
+                            const char *msg, const char *fields)
 {
+  // text output shows any structured fields after the message
+  size_t out_size = strlen(msg) + strlen(fields) + 4;
+  char out[out_size];
 
-  // format log message (vsnprintf() count parameter includes null terminator)
-  char out[log_settings.applog_max_msg_len + 1];
-  va_list args;
+  snprintf(out, out_size, (fields[0] != '\0') ? "%s {%s}" : "%s", msg,
+           fields);
 
-  va_start(args, message);
-  vsnprintf(out, log_settings.applog_max_msg_len + 1, message, args);
-  va_end(args);
-
-  // force severity to a valid value by masking (only use three lowest bits)
-  severity = LOG_PRI(severity);
+  // pick up a request (e.g., after logrotate) to reopen the log handles
+  if (log_reopen_requested)
+  {
+    log_reopen_requested = 0;
+    close_applog();
+    close_syslog();
+  }
 
+#ifndef KMYTH_LOG_STDERR_ONLY
   // log to centralized syslog facility
-  setlogmask(LOG_UPTO(log_settings.syslog_severity_threshold));
-  openlog(log_settings.app_name,
-          LOG_CONS | LOG_PID | LOG_NDELAY, log_settings.syslog_facility);
+  open_syslog();
   syslog(severity, "%s", out);
-  closelog();
+#endif
 
   // application logging
   if (severity <= log_settings.applog_severity_threshold)
@@ -321,19 +797,34 @@ void log_event(const char *src_file,
     FILE *stddest = get_stddest(severity);
 
     char timestamp[20];
-    time_t ts = time(0);
 
     // Populate the timestamp string
     // yyyy-mm-dd hh:mm:ss
     strftime(timestamp, 20, "%F %T", localtime(&ts));
 
-    // open log file for writing -- logfile is NULL if not available to user
-    FILE *logfile = fopen(log_settings.applog_path, "a");
+    // log file descriptor for appending -- negative if not available to user
+    int logfile = get_applog_fd();
+
+    // In JSON mode, the same JSON line (with every field escaped, in the
+    // worst case six characters to one) is printed to stddest and log file
+    bool json = (log_settings.applog_output_mode & KMYTH_APPLOG_OUTPUT_JSON);
+    size_t json_size = (json) ? 6 * (log_settings.app_name_len
+                                     + log_settings.app_version_len
+                                     + strlen(src_file) + strlen(src_func)
+                                     + strlen(msg)) + strlen(fields)
+      + strlen(severity_string) + 160 : 1;
+    char json_line[json_size];
+
+    if (json)
+    {
+      format_json_entry(json_line, json_size, severity_string, ts, src_file,
+                        src_func, src_line, msg, fields);
+    }
 
     // This switch decides what to print and where.
     // When printing to logfile, timestamps are included, when printing to
     // stddest, they are not.
-    switch (log_settings.applog_output_mode)
+    switch (log_settings.applog_output_mode & ~KMYTH_APPLOG_OUTPUT_JSON)
     {
       // output mode 0:
       //   print to both stddest (stdout/stderr) and log file (if available)
@@ -348,23 +839,14 @@ void log_event(const char *src_file,
       //       with source location information. User can turn on detailed
       //       logging by using the --verbose (or -v) command line option.
     case 0:
-      if (log_settings.applog_severity_threshold > LOG_INFO)
-      {
-        fprintf(stddest, "%s-%s %s - %s(%s:%d) %s\n",
-                log_settings.app_name, log_settings.app_version,
-                severity_string, src_file, src_func, src_line, out);
-      }
-      else
-      {
-        fprintf(stddest, "%s - %s\n", severity_string, out);
-      }
+      print_stddest_entry(stddest, (json) ? json_line : NULL,
+                          severity_string, src_file, src_func, src_line, out);
 
-      if (logfile != NULL)
+      if (logfile >= 0)
       {
-        fprintf(logfile, "%s-%s %s %s - %s(%s:%d) %s\n",
-                log_settings.app_name, log_settings.app_version,
-                severity_string, timestamp, src_file, src_func, src_line, out);
-        fclose(logfile);
+        write_applog_entry(logfile, (json) ? json_line : NULL,
+                           severity_string, timestamp,
+                           src_file, src_func, src_line, out);
       }
       break;
 
@@ -373,7 +855,7 @@ void log_event(const char *src_file,
       //
       // fall through to output mode 1 if log file is available
     case 2:
-      if (logfile == NULL)
+      if (logfile < 0)
       {
         break;
       }
@@ -392,25 +874,17 @@ void log_event(const char *src_file,
       //       with source location information. User can turn on detailed
       //       logging by using the --verbose (or -v) command line option.
     default:
-      if (logfile == NULL)
+      if (logfile < 0)
       {
-        if (log_settings.applog_severity_threshold > LOG_INFO)
-        {
-          fprintf(stddest, "%s-%s %s - %s(%s:%d) %s\n",
-                  log_settings.app_name, log_settings.app_version,
-                  severity_string, src_file, src_func, src_line, out);
-        }
-        else
-        {
-          fprintf(stddest, "%s - %s\n", severity_string, out);
-        }
+        print_stddest_entry(stddest, (json) ? json_line : NULL,
+                            severity_string, src_file, src_func, src_line,
+                            out);
       }
       else
       {
-        fprintf(logfile, "%s-%s %s %s - %s(%s:%d) %s\n",
-                log_settings.app_name, log_settings.app_version,
-                severity_string, timestamp, src_file, src_func, src_line, out);
-        fclose(logfile);
+        write_applog_entry(logfile, (json) ? json_line : NULL,
+                           severity_string, timestamp,
+                           src_file, src_func, src_line, out);
       }
     }
 
@@ -418,3 +892,606 @@ void log_event(const char *src_file,
     free(severity_string);
   }
 }
+
+//############################################################################
+// monotonic_seconds()
+//############################################################################
+static double monotonic_seconds(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+//############################################################################
+// log_site_hash()
+//############################################################################
+static size_t log_site_hash(const char *src_file, int src_line)
+{
+  // FNV-1a, over the file name (not its address: async mode copies it)
+  uint32_t hash = 2166136261u;
+
+  for (const unsigned char *c = (const unsigned char *) src_file; *c != '\0';
+       c++)
+  {
+    hash = (hash ^ *c) * 16777619u;
+  }
+  hash = (hash ^ (uint32_t) src_line) * 16777619u;
+
+  return hash % LOG_RATE_SITES;
+}
+
+//############################################################################
+// report_rate_limited()
+//   - the caller holds log_lock
+//############################################################################
+static void report_rate_limited(struct log_site *site, time_t ts)
+{
+  if (site->suppressed > 0)
+  {
+    char out[64];
+
+    snprintf(out, sizeof(out), "%zu log entries suppressed (rate limit)",
+             site->suppressed);
+    write_log_entry(site->src_file, site->src_func, site->src_line,
+                    site->severity, ts, out, "");
+    site->suppressed = 0;
+  }
+}
+
+//############################################################################
+// report_repeats()
+//   - the caller holds log_lock
+//############################################################################
+static void report_repeats(time_t ts)
+{
+  if (last_entry.repeats > 0)
+  {
+    char out[64];
+
+    snprintf(out, sizeof(out), "last message repeated %zu times",
+             last_entry.repeats);
+    write_log_entry(last_entry.src_file, last_entry.src_func,
+                    last_entry.src_line, last_entry.severity, ts, out, "");
+    last_entry.repeats = 0;
+  }
+  last_entry.reported = monotonic_seconds();
+}
+
+//############################################################################
+// report_suppressed_entries()
+//   - the caller holds log_lock
+//############################################################################
+static void report_suppressed_entries(void)
+{
+  time_t ts = time(0);
+
+  report_repeats(ts);
+  for (size_t i = 0; i < LOG_RATE_SITES; i++)
+  {
+    report_rate_limited(&log_sites[i], ts);
+  }
+}
+
+//############################################################################
+// report_suppressed_at_exit()
+//############################################################################
+static void report_suppressed_at_exit(void)
+{
+  kmyth_log_flush();
+
+  pthread_mutex_lock(&log_lock);
+  report_suppressed_entries();
+  pthread_mutex_unlock(&log_lock);
+}
+
+//############################################################################
+// register_suppression_report()
+//############################################################################
+static void register_suppression_report(void)
+{
+  atexit(report_suppressed_at_exit);
+}
+
+//############################################################################
+// rate_limit_allows()
+//   - the caller holds log_lock
+//############################################################################
+static bool rate_limit_allows(const char *src_file, const char *src_func,
+                              int src_line, int severity, time_t ts,
+                              double now)
+{
+  if (log_rate_burst == 0 || severity > LOG_RATE_LIMIT_SEVERITY)
+  {
+    return true;
+  }
+
+  struct log_site *site = &log_sites[log_site_hash(src_file, src_line)];
+
+  // a new site takes over the slot (with a full bucket) from any other
+  if (!site->used || site->src_line != src_line
+      || strcmp(site->src_file, src_file) != 0)
+  {
+    report_rate_limited(site, ts);
+    site->used = true;
+    site->src_line = src_line;
+    snprintf(site->src_file, LOG_RECORD_FILE_LEN, "%s", src_file);
+    site->tokens = log_rate_burst;
+    site->refilled = now;
+  }
+  snprintf(site->src_func, LOG_RECORD_FUNC_LEN, "%s", src_func);
+  site->severity = severity;
+
+  site->tokens += (now - site->refilled) * log_rate_per_second;
+  if (site->tokens > log_rate_burst)
+  {
+    site->tokens = log_rate_burst;
+  }
+  site->refilled = now;
+
+  if (site->tokens < 1.0)
+  {
+    site->suppressed++;
+    pthread_once(&suppression_report_once, register_suppression_report);
+    return false;
+  }
+  site->tokens -= 1.0;
+
+  // the site is let through again: say how many entries it lost first
+  report_rate_limited(site, ts);
+
+  return true;
+}
+
+//############################################################################
+// emit_log_entry()
+//   - the caller holds log_lock
+//############################################################################
+static void emit_log_entry(const char *src_file, const char *src_func,
+                           int src_line, int severity, time_t ts,
+                           const char *msg, const char *fields)
+{
+  double now = monotonic_seconds();
+
+  // An entry identical to the one before it (same source location,
+  // severity, message and fields) is only counted, and the count written
+  // when a different entry arrives, or every LOG_REPEAT_REPORT_INTERVAL
+  if (log_repeat_suppression && last_entry.valid
+      && last_entry.src_line == src_line && last_entry.severity == severity
+      && strcmp(last_entry.msg, msg) == 0
+      && strcmp(last_entry.fields, fields) == 0
+      && strcmp(last_entry.src_file, src_file) == 0)
+  {
+    last_entry.repeats++;
+    pthread_once(&suppression_report_once, register_suppression_report);
+    if (now - last_entry.reported >= LOG_REPEAT_REPORT_INTERVAL)
+    {
+      report_repeats(ts);
+    }
+    return;
+  }
+  report_repeats(ts);
+
+  if (!rate_limit_allows(src_file, src_func, src_line, severity, ts, now))
+  {
+    return;
+  }
+
+  last_entry.valid = true;
+  last_entry.severity = severity;
+  last_entry.src_line = src_line;
+  snprintf(last_entry.src_file, LOG_RECORD_FILE_LEN, "%s", src_file);
+  snprintf(last_entry.src_func, LOG_RECORD_FUNC_LEN, "%s", src_func);
+  snprintf(last_entry.msg, LOG_MSG_LEN_LIMIT + 1, "%s", msg);
+  snprintf(last_entry.fields, LOG_FIELDS_LEN, "%s", fields);
+
+  write_log_entry(src_file, src_func, src_line, severity, ts, msg, fields);
+}
+
+//############################################################################
+// report_dropped_entries()
+//   - the caller holds log_lock
+//############################################################################
+static void report_dropped_entries(void)
+{
+  size_t dropped = atomic_exchange(&async_dropped, 0);
+
+  if (dropped > 0)
+  {
+    char out[64];
+
+    snprintf(out, sizeof(out), "%zu log entries dropped (queue full)",
+             dropped);
+    write_log_entry(__FILE__, __func__, __LINE__, LOG_WARNING, time(0), out,
+                    "");
+  }
+}
+
+//############################################################################
+// drain_log_entries()
+//############################################################################
+static void *drain_log_entries(void *arg)
+{
+  (void) arg;
+  size_t head = 0;
+
+  while (true)
+  {
+    while (sem_wait(&async_items) != 0 && errno == EINTR)
+    {
+    }
+
+    // the stop request's extra wakeup, once every entry has been written
+    if (head == atomic_load(&async_tail) && atomic_load(&async_stopping))
+    {
+      break;
+    }
+
+    // a later slot may have been filled first: wait for this one
+    struct log_record *record = &async_ring[head % async_ring_len];
+
+    while (atomic_load_explicit(&record->seq, memory_order_acquire)
+           != head + 1)
+    {
+      sched_yield();
+    }
+
+    pthread_mutex_lock(&log_lock);
+    emit_log_entry(record->src_file, record->src_func, record->src_line,
+                   record->severity, record->ts, record->msg, record->fields);
+    report_dropped_entries();
+    pthread_mutex_unlock(&log_lock);
+
+    head++;
+    atomic_store(&async_done, head);
+    sem_post(&async_space);
+  }
+
+  pthread_mutex_lock(&log_lock);
+  report_dropped_entries();
+  pthread_mutex_unlock(&log_lock);
+
+  return NULL;
+}
+
+//############################################################################
+// queue_log_entry()
+//   - returns false if the entry must be written on the caller's thread
+//############################################################################
+static bool queue_log_entry(const char *src_file, const char *src_func,
+                            int src_line, int severity, time_t ts,
+                            const char *out, const char *fields)
+{
+  if (!atomic_load(&async_enabled))
+  {
+    return false;
+  }
+
+  // counted first, so that kmyth_log_stop_async() waits for this entry
+  atomic_fetch_add(&async_producers, 1);
+  if (!atomic_load(&async_enabled))
+  {
+    atomic_fetch_sub(&async_producers, 1);
+    return false;
+  }
+
+  // claim a free slot
+  if (async_overflow_policy == KMYTH_LOG_ASYNC_BLOCK)
+  {
+    int result;
+
+    while ((result = sem_wait(&async_space)) != 0 && errno == EINTR)
+    {
+    }
+    if (result != 0)
+    {
+      atomic_fetch_sub(&async_producers, 1);
+      return false;
+    }
+  }
+  else if (sem_trywait(&async_space) != 0)
+  {
+    atomic_fetch_add(&async_dropped, 1);
+    atomic_fetch_sub(&async_producers, 1);
+    return true;
+  }
+
+  // Holding a free slot guarantees that the slot at this position has been
+  // emptied: at most async_ring_len positions are ever outstanding
+  size_t pos = atomic_fetch_add(&async_tail, 1);
+  struct log_record *record = &async_ring[pos % async_ring_len];
+
+  record->severity = severity;
+  record->src_line = src_line;
+  record->ts = ts;
+  snprintf(record->src_file, LOG_RECORD_FILE_LEN, "%s", src_file);
+  snprintf(record->src_func, LOG_RECORD_FUNC_LEN, "%s", src_func);
+  snprintf(record->msg, LOG_MSG_LEN_LIMIT + 1, "%s", out);
+  snprintf(record->fields, LOG_FIELDS_LEN, "%s", fields);
+  atomic_store_explicit(&record->seq, pos + 1, memory_order_release);
+
+  sem_post(&async_items);
+  atomic_fetch_sub(&async_producers, 1);
+
+  return true;
+}
+
+//############################################################################
+// fork_prepare(), fork_parent(), fork_child()
+//############################################################################
+static void fork_prepare(void)
+{
+  pthread_mutex_lock(&log_lock);
+}
+
+static void fork_parent(void)
+{
+  pthread_mutex_unlock(&log_lock);
+}
+
+static void fork_child(void)
+{
+  // the drain thread is not duplicated, so a child logs synchronously
+  atomic_store(&async_enabled, false);
+  async_running = false;
+  pthread_mutex_unlock(&log_lock);
+}
+
+//############################################################################
+// kmyth_log_start_async()
+//############################################################################
+int kmyth_log_start_async(size_t queue_len, int overflow_policy)
+{
+  if (queue_len == 0 || queue_len > KMYTH_LOG_ASYNC_QUEUE_LEN_MAX
+      || (overflow_policy != KMYTH_LOG_ASYNC_DROP
+          && overflow_policy != KMYTH_LOG_ASYNC_BLOCK))
+  {
+    fprintf(stderr, "kmyth_log_start_async(): ");
+    fprintf(stderr, "queue length (%zu) or overflow policy ", queue_len);
+    fprintf(stderr, "(%d) invalid\n", overflow_policy);
+    return 1;
+  }
+
+  pthread_mutex_lock(&async_lock);
+  if (async_running)
+  {
+    pthread_mutex_unlock(&async_lock);
+    return 0;
+  }
+
+  async_ring = calloc(queue_len, sizeof(struct log_record));
+  if (async_ring == NULL)
+  {
+    fprintf(stderr, "kmyth_log_start_async(): queue allocation failed\n");
+    pthread_mutex_unlock(&async_lock);
+    return 1;
+  }
+  for (size_t i = 0; i < queue_len; i++)
+  {
+    atomic_init(&async_ring[i].seq, 0);
+  }
+  async_ring_len = queue_len;
+  async_overflow_policy = overflow_policy;
+  atomic_store(&async_stopping, false);
+  atomic_store(&async_tail, 0);
+  atomic_store(&async_done, 0);
+  atomic_store(&async_dropped, 0);
+
+  if (sem_init(&async_space, 0, (unsigned int) queue_len) != 0)
+  {
+    fprintf(stderr, "kmyth_log_start_async(): semaphore setup failed\n");
+    free(async_ring);
+    async_ring = NULL;
+    pthread_mutex_unlock(&async_lock);
+    return 1;
+  }
+  if (sem_init(&async_items, 0, 0) != 0)
+  {
+    fprintf(stderr, "kmyth_log_start_async(): semaphore setup failed\n");
+    sem_destroy(&async_space);
+    free(async_ring);
+    async_ring = NULL;
+    pthread_mutex_unlock(&async_lock);
+    return 1;
+  }
+
+  // the drain thread leaves all signals to the application's threads
+  sigset_t all_signals;
+  sigset_t caller_signals;
+
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &caller_signals);
+  int result = pthread_create(&async_thread, NULL, drain_log_entries, NULL);
+
+  pthread_sigmask(SIG_SETMASK, &caller_signals, NULL);
+  if (result != 0)
+  {
+    fprintf(stderr, "kmyth_log_start_async(): thread creation failed\n");
+    sem_destroy(&async_items);
+    sem_destroy(&async_space);
+    free(async_ring);
+    async_ring = NULL;
+    pthread_mutex_unlock(&async_lock);
+    return 1;
+  }
+
+  // flush the queue when the application exits
+  if (!async_hooks_registered)
+  {
+    atexit(kmyth_log_stop_async);
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+    async_hooks_registered = true;
+  }
+
+  async_running = true;
+  atomic_store(&async_enabled, true);
+  pthread_mutex_unlock(&async_lock);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_log_flush()
+//############################################################################
+void kmyth_log_flush(void)
+{
+  pthread_mutex_lock(&async_lock);
+  if (async_running)
+  {
+    size_t target = atomic_load(&async_tail);
+    struct timespec pause = {.tv_sec = 0,.tv_nsec = 1000000 };
+
+    while (atomic_load(&async_done) < target)
+    {
+      nanosleep(&pause, NULL);
+    }
+  }
+  pthread_mutex_unlock(&async_lock);
+
+  fflush(stdout);
+}
+
+//############################################################################
+// kmyth_log_stop_async()
+//############################################################################
+void kmyth_log_stop_async(void)
+{
+  pthread_mutex_lock(&async_lock);
+  if (!async_running)
+  {
+    pthread_mutex_unlock(&async_lock);
+    return;
+  }
+
+  // new entries are written synchronously, once those in progress are queued
+  atomic_store(&async_enabled, false);
+  while (atomic_load(&async_producers) > 0)
+  {
+    sched_yield();
+  }
+
+  // wake the drain thread one last time, after it empties the queue
+  atomic_store(&async_stopping, true);
+  sem_post(&async_items);
+  pthread_join(async_thread, NULL);
+
+  sem_destroy(&async_items);
+  sem_destroy(&async_space);
+  free(async_ring);
+  async_ring = NULL;
+  async_ring_len = 0;
+  async_running = false;
+  pthread_mutex_unlock(&async_lock);
+
+  fflush(stdout);
+}
+
+//############################################################################
+// set_log_rate_limit()
+//############################################################################
+void set_log_rate_limit(unsigned int burst, unsigned int per_second)
+{
+  pthread_mutex_lock(&log_lock);
+
+  // entries held back under the old limits are reported before they change
+  report_suppressed_entries();
+  log_rate_burst = burst;
+  log_rate_per_second = per_second;
+  memset(log_sites, 0, sizeof(log_sites));
+
+  pthread_mutex_unlock(&log_lock);
+}
+
+//############################################################################
+// set_log_repeat_suppression()
+//############################################################################
+void set_log_repeat_suppression(bool enabled)
+{
+  pthread_mutex_lock(&log_lock);
+
+  report_repeats(time(0));
+  log_repeat_suppression = enabled;
+  last_entry.valid = false;
+
+  pthread_mutex_unlock(&log_lock);
+}
+
+//############################################################################
+// log_event_va()
+//############################################################################
+static void log_event_va(const char *src_file, const char *src_func,
+                         int src_line, int severity,
+                         const kmyth_log_field * fields, size_t field_count,
+                         const char *message, va_list args)
+{
+  // format log message (vsnprintf() count parameter includes null terminator)
+  int max_msg_len = __atomic_load_n(&log_settings.applog_max_msg_len,
+                                    __ATOMIC_RELAXED);
+  char out[max_msg_len + 1];
+
+  vsnprintf(out, max_msg_len + 1, message, args);
+
+  char fields_json[LOG_FIELDS_LEN];
+
+  format_log_fields(fields, field_count, fields_json, LOG_FIELDS_LEN);
+
+  // force severity to a valid value by masking (only use three lowest bits)
+  severity = LOG_PRI(severity);
+
+  time_t ts = time(0);
+
+  // in async mode, the drain thread writes the entry
+  if (queue_log_entry(src_file, src_func, src_line, severity, ts, out,
+                      fields_json))
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&log_lock);
+  emit_log_entry(src_file, src_func, src_line, severity, ts, out,
+                 fields_json);
+  pthread_mutex_unlock(&log_lock);
+}
+
+//############################################################################
+// log_event()
+//############################################################################
+void log_event(const char *src_file,
+               const char *src_func,
+               const int src_line, int severity, const char *message, ...)
+{
+  // skip formatting an entry that neither threshold lets through
+  if (!kmyth_log_enabled(severity))
+  {
+    return;
+  }
+
+  va_list args;
+
+  va_start(args, message);
+  log_event_va(src_file, src_func, src_line, severity, NULL, 0, message,
+               args);
+  va_end(args);
+}
+
+//############################################################################
+// log_event_fields()
+//############################################################################
+void log_event_fields(const char *src_file, const char *src_func,
+                      const int src_line, int severity,
+                      const kmyth_log_field * fields, size_t field_count,
+                      const char *message, ...)
+{
+  if (!kmyth_log_enabled(severity))
+  {
+    return;
+  }
+
+  va_list args;
+
+  va_start(args, message);
+  log_event_va(src_file, src_func, src_line, severity, fields, field_count,
+               message, args);
+  va_end(args);
+}
@@ -0,0 +1,428 @@
+/**
+ * @file  kmyth_metrics.c
+ *
+ * @brief Implements the kmyth metrics registry and its endpoint.
+ */
+
+#include "kmyth_metrics.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "kmyth_log.h"
+
+// time (in seconds) a client of the endpoint has to send its request
+#define METRICS_REQUEST_TIMEOUT 1
+
+typedef enum metric_type
+{
+  METRIC_COUNTER,
+  METRIC_HISTOGRAM,
+} metric_type;
+
+typedef struct metric_entry
+{
+  const char *name;
+  const char *help;
+  metric_type type;
+  char labels[KMYTH_METRICS_MAX_LABELS_LEN + 1];
+
+  // counter value, or number of observations of a histogram
+  atomic_uint_fast64_t count;
+
+  // histogram only: sum (in nanoseconds) and per-bucket (not cumulative)
+  // observation counts, the last bucket holding those above every bound
+  atomic_uint_fast64_t sum_ns;
+  atomic_uint_fast64_t buckets[KMYTH_METRICS_LATENCY_BUCKETS + 1];
+} metric_entry;
+
+// upper bounds (in nanoseconds) of the latency histogram buckets
+static const uint64_t latency_bounds[KMYTH_METRICS_LATENCY_BUCKETS] = {
+  100000, 250000, 500000,
+  1000000, 2500000, 5000000,
+  10000000, 25000000, 50000000,
+  100000000, 250000000, 500000000,
+  1000000000, 2500000000, 5000000000, 10000000000
+};
+
+int kmyth_metrics_active = 0;
+
+// Entries are appended (under registry_lock) and never removed, and an
+// entry is complete before registry_len counts it, so that recording and
+// exporting only need the lock to add an entry.
+static metric_entry registry[KMYTH_METRICS_MAX];
+static atomic_size_t registry_len = 0;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool registry_full_reported = false;
+
+static pthread_t server_thread;
+static bool server_running = false;
+static int server_fd = -1;
+static atomic_bool server_stopping = false;
+
+//############################################################################
+// find_metric_entry()
+//############################################################################
+static metric_entry *find_metric_entry(const char *name, const char *labels,
+                                       metric_type type, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    if (registry[i].type == type
+        && strcmp(registry[i].name, name) == 0
+        && strcmp(registry[i].labels, labels) == 0)
+    {
+      return &registry[i];
+    }
+  }
+
+  return NULL;
+}
+
+//############################################################################
+// get_metric_entry()
+//############################################################################
+static metric_entry *get_metric_entry(const char *name, const char *labels,
+                                      const char *help, metric_type type)
+{
+  if (name == NULL)
+  {
+    return NULL;
+  }
+  if (labels == NULL)
+  {
+    labels = "";
+  }
+
+  size_t len = atomic_load_explicit(&registry_len, memory_order_acquire);
+  metric_entry *entry = find_metric_entry(name, labels, type, len);
+
+  if (entry != NULL)
+  {
+    return entry;
+  }
+
+  pthread_mutex_lock(&registry_lock);
+
+  // another thread may have added it since
+  len = atomic_load_explicit(&registry_len, memory_order_relaxed);
+  entry = find_metric_entry(name, labels, type, len);
+  if (entry == NULL && len < KMYTH_METRICS_MAX
+      && strlen(labels) <= KMYTH_METRICS_MAX_LABELS_LEN)
+  {
+    entry = &registry[len];
+    entry->name = name;
+    entry->help = (help != NULL) ? help : "";
+    entry->type = type;
+    strcpy(entry->labels, labels);
+    atomic_store_explicit(&registry_len, len + 1, memory_order_release);
+  }
+  else if (entry == NULL && !registry_full_reported)
+  {
+    registry_full_reported = true;
+    kmyth_log(LOG_WARNING, "unable to register metric %s{%s}", name, labels);
+  }
+
+  pthread_mutex_unlock(&registry_lock);
+
+  return entry;
+}
+
+//############################################################################
+// kmyth_metrics_count()
+//############################################################################
+void kmyth_metrics_count(const char *name, const char *labels,
+                         const char *help, uint64_t count)
+{
+  if (!kmyth_metrics_enabled())
+  {
+    return;
+  }
+
+  metric_entry *entry = get_metric_entry(name, labels, help, METRIC_COUNTER);
+
+  if (entry != NULL)
+  {
+    atomic_fetch_add_explicit(&entry->count, count, memory_order_relaxed);
+  }
+}
+
+//############################################################################
+// kmyth_metrics_clock()
+//############################################################################
+uint64_t kmyth_metrics_clock(void)
+{
+  if (!kmyth_metrics_enabled())
+  {
+    return 0;
+  }
+
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+//############################################################################
+// kmyth_metrics_observe_latency()
+//############################################################################
+void kmyth_metrics_observe_latency(const char *name, const char *labels,
+                                   const char *help, uint64_t begin)
+{
+  uint64_t end = kmyth_metrics_clock();
+
+  if (begin == 0 || end == 0)
+  {
+    return;
+  }
+
+  metric_entry *entry = get_metric_entry(name, labels, help,
+                                         METRIC_HISTOGRAM);
+
+  if (entry == NULL)
+  {
+    return;
+  }
+
+  uint64_t duration_ns = (end > begin) ? end - begin : 0;
+  size_t bucket = 0;
+
+  while (bucket < KMYTH_METRICS_LATENCY_BUCKETS
+         && duration_ns > latency_bounds[bucket])
+  {
+    bucket++;
+  }
+
+  atomic_fetch_add_explicit(&entry->buckets[bucket], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&entry->sum_ns, duration_ns,
+                            memory_order_relaxed);
+  atomic_fetch_add_explicit(&entry->count, 1, memory_order_relaxed);
+}
+
+//############################################################################
+// print_metric_sample()
+//############################################################################
+static void print_metric_sample(FILE * stream, const char *name,
+                                const char *suffix, const char *labels,
+                                const char *le, const char *value_format,
+                                ...)
+{
+  fprintf(stream, "%s%s", name, suffix);
+  if (labels[0] != '\0' || le != NULL)
+  {
+    fprintf(stream, "{%s%s", labels,
+            (labels[0] != '\0' && le != NULL) ? "," : "");
+    if (le != NULL)
+    {
+      fprintf(stream, "le=\"%s\"", le);
+    }
+    fputc('}', stream);
+  }
+  fputc(' ', stream);
+
+  va_list args;
+
+  va_start(args, value_format);
+  vfprintf(stream, value_format, args);
+  va_end(args);
+  fputc('\n', stream);
+}
+
+//############################################################################
+// print_metric_samples()
+//############################################################################
+static void print_metric_samples(FILE * stream, metric_entry * entry)
+{
+  if (entry->type == METRIC_COUNTER)
+  {
+    print_metric_sample(stream, entry->name, "", entry->labels, NULL, "%llu",
+                        (unsigned long long) atomic_load(&entry->count));
+    return;
+  }
+
+  // the buckets are read one at a time, so a scrape racing with
+  // observations may see them a few observations apart
+  unsigned long long cumulative = 0;
+  char le[32];
+
+  for (size_t i = 0; i < KMYTH_METRICS_LATENCY_BUCKETS; i++)
+  {
+    cumulative += atomic_load(&entry->buckets[i]);
+    snprintf(le, sizeof(le), "%g", latency_bounds[i] / 1e9);
+    print_metric_sample(stream, entry->name, "_bucket", entry->labels, le,
+                        "%llu", cumulative);
+  }
+  cumulative += atomic_load(&entry->buckets[KMYTH_METRICS_LATENCY_BUCKETS]);
+  print_metric_sample(stream, entry->name, "_bucket", entry->labels, "+Inf",
+                      "%llu", cumulative);
+  print_metric_sample(stream, entry->name, "_sum", entry->labels, NULL,
+                      "%.9f", atomic_load(&entry->sum_ns) / 1e9);
+  print_metric_sample(stream, entry->name, "_count", entry->labels, NULL,
+                      "%llu", cumulative);
+}
+
+//############################################################################
+// kmyth_metrics_print()
+//############################################################################
+void kmyth_metrics_print(FILE * stream)
+{
+  size_t len = atomic_load_explicit(&registry_len, memory_order_acquire);
+
+  // every sample of a metric follows its HELP and TYPE lines, whatever
+  // the order in which its label sets were registered
+  for (size_t i = 0; i < len; i++)
+  {
+    bool printed = false;
+
+    for (size_t j = 0; j < i && !printed; j++)
+    {
+      printed = (strcmp(registry[j].name, registry[i].name) == 0);
+    }
+    if (printed)
+    {
+      continue;
+    }
+
+    fprintf(stream, "# HELP %s %s\n", registry[i].name, registry[i].help);
+    fprintf(stream, "# TYPE %s %s\n", registry[i].name,
+            (registry[i].type == METRIC_COUNTER) ? "counter" : "histogram");
+    for (size_t j = i; j < len; j++)
+    {
+      if (strcmp(registry[j].name, registry[i].name) == 0)
+      {
+        print_metric_samples(stream, &registry[j]);
+      }
+    }
+  }
+}
+
+//############################################################################
+// serve_metrics_client()
+//############################################################################
+static void serve_metrics_client(int client_fd)
+{
+  // the request (if any) only decides whether to answer in HTTP, so a
+  // client that sends nothing gets the bare metrics after the timeout
+  struct timeval timeout = {.tv_sec = METRICS_REQUEST_TIMEOUT, };
+  char request[512] = { 0 };
+
+  setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  ssize_t request_len = recv(client_fd, request, sizeof(request) - 1, 0);
+  int stream_fd = dup(client_fd);
+  FILE *stream = (stream_fd < 0) ? NULL : fdopen(stream_fd, "w");
+
+  if (stream == NULL)
+  {
+    if (stream_fd >= 0)
+    {
+      close(stream_fd);
+    }
+    return;
+  }
+
+  if (request_len >= 4 && strncmp(request, "GET ", 4) == 0)
+  {
+    fprintf(stream, "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Connection: close\r\n\r\n");
+  }
+  kmyth_metrics_print(stream);
+  fclose(stream);
+}
+
+//############################################################################
+// serve_metrics()
+//############################################################################
+static void *serve_metrics(void *arg)
+{
+  (void) arg;
+
+  while (!atomic_load(&server_stopping))
+  {
+    int client_fd = accept(server_fd, NULL, NULL);
+
+    if (client_fd < 0)
+    {
+      if (errno != EINTR && errno != ECONNABORTED
+          && !atomic_load(&server_stopping))
+      {
+        // back off, e.g., while out of file descriptors
+        sleep(1);
+      }
+      continue;
+    }
+    serve_metrics_client(client_fd);
+    close(client_fd);
+  }
+
+  return NULL;
+}
+
+//############################################################################
+// kmyth_metrics_serve()
+//############################################################################
+int kmyth_metrics_serve(int listen_fd)
+{
+  if (server_running || listen_fd < 0)
+  {
+    kmyth_log(LOG_ERR, "unable to start the metrics endpoint ... exiting");
+    return 1;
+  }
+
+  server_fd = listen_fd;
+  atomic_store(&server_stopping, false);
+
+  // the endpoint thread takes no signals, leaving them to the application
+  sigset_t all_signals;
+  sigset_t caller_signals;
+
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &caller_signals);
+  int result = pthread_create(&server_thread, NULL, serve_metrics, NULL);
+
+  pthread_sigmask(SIG_SETMASK, &caller_signals, NULL);
+  if (result != 0)
+  {
+    kmyth_log(LOG_ERR, "unable to start the metrics thread ... exiting");
+    server_fd = -1;
+    return 1;
+  }
+  server_running = true;
+  __atomic_store_n(&kmyth_metrics_active, 1, __ATOMIC_RELAXED);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_metrics_stop()
+//############################################################################
+void kmyth_metrics_stop(void)
+{
+  if (!server_running)
+  {
+    return;
+  }
+
+  __atomic_store_n(&kmyth_metrics_active, 0, __ATOMIC_RELAXED);
+
+  // shutting down the socket wakes the thread blocked in accept()
+  atomic_store(&server_stopping, true);
+  shutdown(server_fd, SHUT_RDWR);
+  pthread_join(server_thread, NULL);
+
+  close(server_fd);
+  server_fd = -1;
+  server_running = false;
+}
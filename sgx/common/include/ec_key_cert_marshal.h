@@ -30,7 +30,8 @@ extern "C"
 #include "kmyth_enclave_common.h"
 
 /**
- * @brief DER formats elliptic curve private key struct (EVP_PKEY).
+ * @brief DER formats elliptic curve (EC or Ed25519) private key struct
+ *        (EVP_PKEY).
  *
  * @param[in] ec_pkey_in             Pointer to an EVP_PKEY input struct to
  *                                   be marshalled (i.e., serialized into
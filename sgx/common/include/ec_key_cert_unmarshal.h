@@ -23,6 +23,7 @@ extern "C"
 
 /**
  * @brief Restores EVP_PKEY private key struct from DER formatted input.
+ *        Accepts EC and Ed25519 private keys.
  *
  * @param[in] ec_der_bytes_in      Pointer to byte array that contains
  *                                 the marshalled (DER format) EC private
@@ -29,25 +29,42 @@ extern "C"
  * @brief Object or Numeric Identifiers (OID/NID) are used to specify
  *        cryptographic primitives within the ASN.1 context. This macro
  *        (KMYTH_EC_NID) is used to specify the elliptic curve used for
- *        Elliptic Curve Diffe Hellman (ECDH) key agreement by kmyth.
- *        While the kmyth API calls supporting ECDH generally
- *        parameterize the 'curve ID' specification, this macro provides
- *        calling functions a way to easily specify the kmyth default
- *        when invoking API calls that include a 'curve ID' parameter.
+ *        Elliptic Curve Diffe Hellman (ECDH) key agreement by kmyth
+ *        in the P-384 key agreement suite (KMYTH_ECDH_SUITE_P384).
  */
 #define KMYTH_EC_NID NID_secp384r1
 
 /**
- * @brief OpenSSL's compute_ecdh_key() call supports optionally passing
- *        a function pointer for a KDF to apply to the derived shared
- *        secret value. If the intent is to use the shared secret value
- *        directly, NULL should be passed for this parameter. This macro
- *        provides a centralized way to configure this behavior. For now
- *        this is set to NULL and the compute_ecdh_session_key() function
- *        was added to hash the ECDH mutually computed secret as a 'KDF'
- *        and create a 'session key'
+ * @brief Key agreement suites supported for the ECDH exchange. Each peer's
+ *        ephemeral 'public key' contribution starts with the ID of the
+ *        suite it was generated for, and is signed with it, so the
+ *        responder can answer in the initiator's suite and a peer can
+ *        detect a contribution changed to another suite.
+ *
+ *        The signatures over the contributions follow the type of the
+ *        peers' long-term keys: ECDSA (with SHA-512) for EC keys and
+ *        Ed25519 for Ed25519 keys.
  */
-#define KMYTH_ECDH_KDF NULL
+#define KMYTH_ECDH_SUITE_P384 0x01
+#define KMYTH_ECDH_SUITE_X25519 0x02
+
+/**
+ * @brief Key agreement suite kmyth proposes when it starts an exchange.
+ */
+#ifndef KMYTH_ECDH_SUITE
+#define KMYTH_ECDH_SUITE KMYTH_ECDH_SUITE_P384
+#endif
+
+/**
+ * @brief Length (in bytes) of the session key compute_ecdh_session_key()
+ *        derives (an AES-256 key).
+ */
+#define KMYTH_ECDH_SESSION_KEY_LEN 32
+
+/**
+ * @brief HKDF 'info' label for the ECDH session key derivation.
+ */
+#define KMYTH_ECDH_SESSION_KEY_INFO "kmyth ECDH session key"
 
 /**
  * @brief Maximum size of an encrypted ECDH message.
@@ -64,67 +81,90 @@ struct ECDHMessageHeader {
 };
 
 /**
- * @brief Creates an ephemeral elliptic curve key pair (containing both the
- *        private and public components) for a participant's contribution
- *        in an ECDH key agreement protocol
+ * @brief Creates an ephemeral key pair (containing both the private and
+ *        public components) for a participant's contribution in an ECDH
+ *        key agreement protocol
  *
- * @param[in]  ec_nid                     ID for the elliptic curve to use
- *                                        for generating this ephemeral
- *                                        private/public key pair.
+ * @param[in]  suite                   Key agreement suite
+ *                                     (KMYTH_ECDH_SUITE_*) to generate
+ *                                     this ephemeral key pair for
  *
- * @param[out] ephemeral_ec_key_pair_out  Pointer to ephemeral key pair
- *                                        (EC_KEY struct) generated
+ * @param[out] ephemeral_key_pair_out  Pointer to ephemeral key pair
+ *                                     (EVP_PKEY struct) generated
  *
  * @return 0 on success, 1 on error
  */
-  int create_ecdh_ephemeral_key_pair(int ec_nid,
-                                     EC_KEY ** ephemeral_ec_key_pair_out);
+  int create_ecdh_ephemeral_key_pair(uint8_t suite,
+                                     EVP_PKEY ** ephemeral_key_pair_out);
+
+/**
+ * @brief Gets the key agreement suite an ephemeral key (pair or
+ *        'public key') belongs to
+ *
+ * @param[in]  ephemeral_key  Pointer to the ephemeral key
+ *
+ * @param[out] suite          Key agreement suite (KMYTH_ECDH_SUITE_*)
+ *
+ * @return 0 on success, 1 on error (not a key of a supported suite)
+ */
+  int get_ecdh_ephemeral_key_suite(EVP_PKEY * ephemeral_key, uint8_t * suite);
 
 /**
  * @brief Creates an ephemeral 'public key' contribution (in byte array or
- *        'octet string' format0 to be exchanged with a peer as part of an
- *        ECDH key agreement protocol
+ *        'octet string' format) to be exchanged with a peer as part of an
+ *        ECDH key agreement protocol. The contribution is the suite ID byte
+ *        followed by the 'public key' (an uncompressed curve point for
+ *        P-384, the 32 byte key for X25519).
  *
- * @param[in]  ephemeral_ec_key_pair_in  Pointer to ephemeral elliptic curve
- *                                       key pair to be used for generating
- *                                       the 'public key' octet string
+ * @param[in]  ephemeral_key_pair_in  Pointer to ephemeral key pair to be
+ *                                    used for generating the 'public key'
+ *                                    octet string
  *
- * @param[out] ephemeral_ec_pub_out      Pointer to ephemeral 'public key'
- *                                       octet string generated
+ * @param[out] ephemeral_pub_out      Pointer to ephemeral 'public key'
+ *                                    octet string generated
  *
- * @param[out] ephemeral_ec_pub_out_len  Pointer to length (in bytes) of
- *                                       ephemeral 'public key' octet string
- *                                       generated
+ * @param[out] ephemeral_pub_out_len  Pointer to length (in bytes) of
+ *                                    ephemeral 'public key' octet string
+ *                                    generated
  *
  * @return 0 on success, 1 on error
  */
-  int create_ecdh_ephemeral_public(EC_KEY * ephemeral_ec_key_pair_in,
-                                   unsigned char **ephemeral_ec_pub_out,
-                                   size_t *ephemeral_ec_pub_out_len);
+  int create_ecdh_ephemeral_public(EVP_PKEY * ephemeral_key_pair_in,
+                                   unsigned char **ephemeral_pub_out,
+                                   size_t *ephemeral_pub_out_len);
 
 /**
- * @brief Reconstructs the curve point for an elliptic curve 'public key' in
- *        octet string format
+ * @brief Gets the key agreement suite of an ephemeral 'public key'
+ *        contribution in octet string format
+ *
+ * @param[in]  ephemeral_pub_in      Ephemeral 'public key' octet string
  *
- * @param[in]  ec_nid               ID for the elliptic curve to use for
- *                                  generating this ephemeral 'public key'
- *                                  point
+ * @param[in]  ephemeral_pub_in_len  Length (in bytes) of the octet string
+ *
+ * @param[out] suite                 Key agreement suite (KMYTH_ECDH_SUITE_*)
+ *
+ * @return 0 on success, 1 on error (empty or unsupported suite)
+ */
+  int get_ecdh_ephemeral_public_suite(unsigned char *ephemeral_pub_in,
+                                      size_t ephemeral_pub_in_len,
+                                      uint8_t * suite);
+
+/**
+ * @brief Reconstructs a peer's ephemeral 'public key' from its octet string
+ *        contribution, in the suite the contribution names
  *
- * @param[in]  ec_octet_str_in      Input elliptic curve 'public key' in octet
- *                                  string format
+ * @param[in]  ephemeral_pub_in      Ephemeral 'public key' octet string
  *
- * @param[in]  ec_octet_str_in_len  Length (in bytes) of input octet string
+ * @param[in]  ephemeral_pub_in_len  Length (in bytes) of the octet string
  *
- * @param[out] ec_point_out         Pointer to EC_POINT struct that represents
- *                                  the elliptic curve point for the input
- *                                  elliptic curve 'public key' contribution
+ * @param[out] ephemeral_pub_out     Pointer to the EVP_PKEY struct holding
+ *                                   the peer's ephemeral 'public key'
  *
  * @return 0 on success, 1 on error
  */
-  int reconstruct_ecdh_ephemeral_public_point(int ec_nid,
-                                              unsigned char *ec_octet_str_in,
-                                              size_t ec_octet_str_in_len,
-                                              EC_POINT ** ec_point_out);
+  int reconstruct_ecdh_ephemeral_public(unsigned char *ephemeral_pub_in,
+                                        size_t ephemeral_pub_in_len,
+                                        EVP_PKEY ** ephemeral_pub_out);
 
 /**
  * @brief Computes shared secret value, using ECDH, from a local private
@@ -136,35 +176,37 @@ struct ECDHMessageHeader {
  *                                  'private key' for the 'local' party
  *                                  participating in the ECDH exchange.
  *
- * @param[in]  remote_eph_pub_point Elliptic curve 'public key' point
- *                                  representing remote peer's contribution
- *                                  to the ECDH shared secret computation
+ * @param[in]  remote_eph_pub_key   Ephemeral 'public key' representing the
+ *                                  remote peer's contribution to the ECDH
+ *                                  shared secret computation (must be of
+ *                                  the same suite as the local key pair)
  *
- * @param[out] shared_secret        computed X component of the remote peer's
- *                                  'public key' point dotted with the local
- *                                  'private key' point
+ * @param[out] shared_secret        computed shared secret (for P-384, the
+ *                                  X component of the remote peer's
+ *                                  'public key' point multiplied by the
+ *                                  local 'private key')
  *
  * @param[out] shared_secret_len    Pointer to the length (in bytes) of the
  *                                  shared secret result.
  *
  * @return 0 on success, 1 on error
  */
-  int compute_ecdh_shared_secret(EC_KEY * local_eph_priv_key,
-                                 EC_POINT * remote_eph_pub_point,
+  int compute_ecdh_shared_secret(EVP_PKEY * local_eph_priv_key,
+                                 EVP_PKEY * remote_eph_pub_key,
                                  unsigned char **shared_secret,
                                  size_t *shared_secret_len);
 
 /**
- * @brief Computes session key from a shared secret value input.
+ * @brief Computes session key from a shared secret value input, using
+ *        HKDF with the kmyth default hash (KMYTH_KDF_HASH).
  *
- * @param[in]  secret           Secret value that will be hashed to produce
- *                              a session key result of the desired length.
+ * @param[in]  secret           Secret value that the session key will be
+ *                              derived from.
  *
  * @param[in]  secret_len       Length (in bytes) of the input secret value
  *
- * @param[out] session_key      Message digest resulting from the hash of the
- *                              input secret value. This result will be used
- *                              as a session key value.
+ * @param[out] session_key      Session key (KMYTH_ECDH_SESSION_KEY_LEN
+ *                              bytes) derived from the input secret value.
  *
  * @param[out] session_key_len  Pointer to the length (in bytes) of the
  *                              session key result.
@@ -178,10 +220,11 @@ struct ECDHMessageHeader {
 
 /**
  * @brief Generates a signature over the data in an input buffer passed
- *        in to the function, using a specified EC private key
+ *        in to the function, using a specified EC (ECDSA with SHA-512) or
+ *        Ed25519 private key
  *
- * @param[in]  ec_sign_pkey       Pointer to EC_KEY containing an elliptic
- *                                curve private key to be used for signing
+ * @param[in]  ec_sign_pkey       Pointer to EVP_PKEY containing an EC or
+ *                                Ed25519 private key to be used for signing
  *
  * @param[in]  buf_in             Input buffer (pointer to byte array)
  *                                containing data to be signed
@@ -205,11 +248,12 @@ struct ECDHMessageHeader {
 
 /**
  * @brief Validates a signature over the data in an input buffer passed
- *        in to the function, using a specified EC private key
+ *        in to the function, using a specified EC (ECDSA with SHA-512) or
+ *        Ed25519 public key
  *
- * @param[in]  ec_sign_pkey       Pointer to EC_KEY containing an elliptic
- *                                curve public key to be used for signature
- *                                verification.
+ * @param[in]  ec_sign_pkey       Pointer to EVP_PKEY containing an EC or
+ *                                Ed25519 public key to be used for
+ *                                signature verification.
  *
  * @param[in]  buf_in             Input buffer (pointer to byte array)
  *                                containing the data over which
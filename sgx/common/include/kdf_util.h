@@ -0,0 +1,105 @@
+/**
+ * @file kdf_util.h
+ * @brief Header file for the HKDF (RFC 5869) key derivation used to turn
+ *        negotiated secrets (e.g., ECDH shared secrets or NSL nonces) into
+ *        session keys, within kmyth SGX code and the kmyth protocols
+ */
+
+#ifndef _KDF_UTIL_H_
+#define _KDF_UTIL_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+
+#include <openssl/evp.h>
+
+/**
+ * @brief Hash functions the KDF can be instantiated with.
+ */
+  typedef enum kdf_hash
+  {
+    KDF_HASH_SHA256,
+    KDF_HASH_SHA384
+  } kdf_hash;
+
+/**
+ * @brief Hash function kmyth uses for its session key derivation unless
+ *        a caller selects another.
+ */
+#define KMYTH_KDF_HASH KDF_HASH_SHA256
+
+/**
+ * @brief Largest number of keys derived by a single kdf_derive_keys() call.
+ */
+#define KDF_MAX_KEYS 8
+
+/**
+ * @brief Derivation parameters, set up once (the hash lookup is done by
+ *        kdf_params_init()) and reused for any number of derivations. The
+ *        salt and info are referenced, not copied, so they must outlive
+ *        the parameters (they are typically constant labels).
+ */
+  typedef struct kdf_params
+  {
+    const EVP_MD *md;
+    const unsigned char *salt;
+    size_t salt_len;
+    const unsigned char *info;
+    size_t info_len;
+  } kdf_params;
+
+/**
+ * @brief Sets up the parameters for HKDF derivations.
+ *
+ * @param[out] params    Parameters to be set up
+ *
+ * @param[in]  hash      Hash function HKDF is instantiated with
+ *
+ * @param[in]  salt      HKDF salt (may be NULL, for a string of zeros)
+ *
+ * @param[in]  salt_len  Length (in bytes) of the salt
+ *
+ * @param[in]  info      HKDF context/application label (may be NULL)
+ *
+ * @param[in]  info_len  Length (in bytes) of the label
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kdf_params_init(kdf_params * params, kdf_hash hash,
+                      const unsigned char *salt, size_t salt_len,
+                      const unsigned char *info, size_t info_len);
+
+/**
+ * @brief Derives one or more keys (e.g., an encryption key and a MAC key)
+ *        from a secret with a single HKDF extract and expand: the keys are
+ *        consecutive, non-overlapping sections of one HKDF output.
+ *
+ * @param[in]  params      Parameters set up by kdf_params_init()
+ *
+ * @param[in]  secret      Input keying material
+ *
+ * @param[in]  secret_len  Length (in bytes) of the input keying material
+ *
+ * @param[in]  key_count   Number of keys to derive (1 to KDF_MAX_KEYS)
+ *
+ * @param[in]  key_lens    Length (in bytes) of each key to derive
+ *
+ * @param[out] keys        The derived keys (each to be cleared and freed
+ *                         by the caller). On error, all are NULL.
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kdf_derive_keys(const kdf_params * params,
+                      const unsigned char *secret, size_t secret_len,
+                      size_t key_count, const size_t *key_lens,
+                      unsigned char **keys);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
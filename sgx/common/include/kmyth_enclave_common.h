@@ -16,6 +16,8 @@ extern "C"
 // maximum log message size - can use to size buffer
 #define MAX_LOG_MSG_LEN 128
 
+#include "kmyth_enclave_log_entry.h"
+
 //if 'syslog.h' is not included, define its 'priority' level macros here
 #ifndef LOG_EMERG
 #define	LOG_EMERG	0
@@ -49,20 +51,43 @@ extern "C"
 #define	LOG_DEBUG	7
 #endif
 
-// macro for generic logging call
+// least severe level of the kmyth_sgx_log() calls compiled in (see
+// kmyth_log.h) - release builds of the enclave leave out LOG_DEBUG calls
+#ifndef KMYTH_LOG_MIN_LEVEL
+#define KMYTH_LOG_MIN_LEVEL LOG_DEBUG
+#endif
+
+// macro for generic logging call - inside the enclave, events are buffered
+// and passed out in batches (see kmyth_enclave_log.h)
+#ifdef _KMYTH_LOCALE_TRUSTED_
+#include "kmyth_enclave_log.h"
 #define kmyth_sgx_log(severity, message)\
 {\
-  const char *src_file = __FILE__;\
-  const char *src_func = __func__;\
-  const int src_line = __LINE__;\
-  int log_level = severity;\
-  const char *log_msg = message;\
-  log_event_ocall(&src_file, &src_func, &src_line, &log_level, &log_msg);\
+  if ((severity) <= KMYTH_LOG_MIN_LEVEL)\
+  {\
+    kmyth_enclave_log_event(__FILE__, __func__, __LINE__, (severity),\
+                            (message));\
+  }\
 }
+#else
+#define kmyth_sgx_log(severity, message)\
+{\
+  if ((severity) <= KMYTH_LOG_MIN_LEVEL)\
+  {\
+    const char *src_file = __FILE__;\
+    const char *src_func = __func__;\
+    const int src_line = __LINE__;\
+    int log_level = severity;\
+    const char *log_msg = message;\
+    log_event_ocall(&src_file, &src_func, &src_line, &log_level, &log_msg);\
+  }\
+}
+#endif
 
 #include "ec_key_cert_marshal.h"
 #include "ec_key_cert_unmarshal.h"
 #include "ecdh_util.h"
+#include "kdf_util.h"
 
 #ifdef _KMYTH_LOCALE_TRUSTED_
 #include ENCLAVE_HEADER_TRUSTED
@@ -0,0 +1,42 @@
+/**
+ * @file kmyth_enclave_log_entry.h
+ *
+ * @brief Defines the log event record passed out of the enclave, in
+ *        batches, by log_event_batch_ocall()
+ */
+
+#ifndef _KMYTH_ENCLAVE_LOG_ENTRY_H_
+#define _KMYTH_ENCLAVE_LOG_ENTRY_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// maximum log message size - can use to size buffer
+#ifndef MAX_LOG_MSG_LEN
+#define MAX_LOG_MSG_LEN 128
+#endif
+
+// maximum length of the source file and function names kept for an event
+#define MAX_LOG_SRC_LEN 64
+
+/**
+ * @brief A log event recorded inside the enclave. The strings are copied
+ *        (and truncated as needed) into the record, so that a batch of
+ *        events can be passed out of the enclave in one buffer.
+ */
+  typedef struct kmyth_enclave_log_entry_s
+  {
+    int src_line;
+    int severity;
+    char src_file[MAX_LOG_SRC_LEN];
+    char src_func[MAX_LOG_SRC_LEN];
+    char message[MAX_LOG_MSG_LEN];
+  } kmyth_enclave_log_entry_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
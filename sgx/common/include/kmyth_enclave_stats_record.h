@@ -0,0 +1,59 @@
+/**
+ * @file kmyth_enclave_stats_record.h
+ *
+ * @brief Defines the memory and transition counters of a kmyth enclave,
+ *        passed out of the enclave by kmyth_enclave_get_stats()
+ */
+
+#ifndef _KMYTH_ENCLAVE_STATS_RECORD_H_
+#define _KMYTH_ENCLAVE_STATS_RECORD_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// the paths (groups of ECALLs) the counters are kept for
+#define KMYTH_ENCLAVE_STATS_SEAL 0
+#define KMYTH_ENCLAVE_STATS_UNSEAL 1
+#define KMYTH_ENCLAVE_STATS_RETRIEVE 2
+#define KMYTH_ENCLAVE_STATS_PATHS 3
+
+/**
+ * @brief The counters of an enclave since it was created (or its stats
+ *        were last reset).
+ *
+ *        The unsealed data table bytes count the data of each entry, its
+ *        entry record and the table's slot arrays, including entries
+ *        removed from the table but still referenced by a reader.
+ *
+ *        The heap bytes of a path count the buffers kmyth allocates on
+ *        the enclave heap for the duration of one of the path's ECALLs
+ *        (e.g., sealed output, unsealed plaintext not yet in the table,
+ *        KMIP messages), summed across the threads in the path at once.
+ *        Allocations made inside OpenSSL are not included, so
+ *        HeapMaxSize must leave room for those too.
+ *
+ *        The OCALL count is of enclave exits (sgx_ocall()), including
+ *        those made by the SDK (e.g., to wait on a mutex). OCALLs
+ *        served by switchless worker threads do not exit the enclave and
+ *        are not counted.
+ */
+  typedef struct kmyth_enclave_stats_s
+  {
+    uint64_t unseal_table_entries;
+    uint64_t unseal_table_bytes;
+    uint64_t unseal_table_peak_bytes;
+    uint64_t ecalls[KMYTH_ENCLAVE_STATS_PATHS];
+    uint64_t heap_bytes[KMYTH_ENCLAVE_STATS_PATHS];
+    uint64_t heap_peak_bytes[KMYTH_ENCLAVE_STATS_PATHS];
+    uint64_t ocalls;
+  } kmyth_enclave_stats_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
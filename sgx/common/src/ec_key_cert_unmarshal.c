@@ -24,7 +24,17 @@ int unmarshal_ec_der_to_pkey(uint8_t ** ec_der_bytes_in,
   const unsigned char *buf_in = (const unsigned char *) *ec_der_bytes_in;
   long buf_len = (long) *ec_der_bytes_in_len;
 
-  *ec_pkey_out = d2i_PrivateKey(EVP_PKEY_EC, NULL, &buf_in, buf_len);
+  // EC keys may be in either their own or PKCS#8 encoding, Ed25519 keys
+  // only in PKCS#8 encoding, so let OpenSSL work out which this is
+  *ec_pkey_out = d2i_AutoPrivateKey(NULL, &buf_in, buf_len);
+  if (*ec_pkey_out != NULL && EVP_PKEY_base_id(*ec_pkey_out) != EVP_PKEY_EC
+      && EVP_PKEY_base_id(*ec_pkey_out) != EVP_PKEY_ED25519)
+  {
+    kmyth_sgx_log(LOG_ERR, "unmarshalled PKEY is not of EC type");
+    EVP_PKEY_free(*ec_pkey_out);
+    *ec_pkey_out = NULL;
+    return EXIT_FAILURE;
+  }
   if (*ec_pkey_out == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "DER to PKEY format conversion failed");
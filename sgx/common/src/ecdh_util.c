@@ -11,14 +11,38 @@
 /*****************************************************************************
  * create_ecdh_ephemeral_key_pair()
  ****************************************************************************/
-int create_ecdh_ephemeral_key_pair(int ec_nid,
-                                   EC_KEY ** ephemeral_ec_key_pair_out)
+int create_ecdh_ephemeral_key_pair(uint8_t suite,
+                                   EVP_PKEY ** ephemeral_key_pair_out)
 {
+  *ephemeral_key_pair_out = NULL;
+
+  if (suite == KMYTH_ECDH_SUITE_X25519)
+  {
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_X25519, NULL);
+
+    if (ctx == NULL || EVP_PKEY_keygen_init(ctx) != 1
+        || EVP_PKEY_keygen(ctx, ephemeral_key_pair_out) != 1)
+    {
+      kmyth_sgx_log(LOG_ERR, "ephemeral X25519 key pair generation failed");
+      EVP_PKEY_CTX_free(ctx);
+      return EXIT_FAILURE;
+    }
+    EVP_PKEY_CTX_free(ctx);
+    return EXIT_SUCCESS;
+  }
+
+  if (suite != KMYTH_ECDH_SUITE_P384)
+  {
+    kmyth_sgx_log(LOG_ERR, "unsupported ECDH key agreement suite");
+    return EXIT_FAILURE;
+  }
+
   // create new EC_KEY object for the specified built-in curve
   //   The EC_KEY object passed to 'generate_key' below must be associated
   //   with the desired EC_GROUP.
-  *ephemeral_ec_key_pair_out = EC_KEY_new_by_curve_name(ec_nid);
-  if (*ephemeral_ec_key_pair_out == NULL)
+  EC_KEY *ec_key_pair = EC_KEY_new_by_curve_name(KMYTH_EC_NID);
+
+  if (ec_key_pair == NULL)
   {
     kmyth_sgx_log(LOG_ERR,
                   "failed to create new elliptic curve key object by NID");
@@ -26,24 +50,106 @@ int create_ecdh_ephemeral_key_pair(int ec_nid,
   }
 
   // generate the ephemeral EC key pair
-  if (1 != EC_KEY_generate_key(*ephemeral_ec_key_pair_out))
+  if (1 != EC_KEY_generate_key(ec_key_pair))
   {
     kmyth_sgx_log(LOG_ERR, "ephemeral key pair generation failed");
+    EC_KEY_free(ec_key_pair);
+    return EXIT_FAILURE;
+  }
+
+  *ephemeral_key_pair_out = EVP_PKEY_new();
+  if (*ephemeral_key_pair_out == NULL
+      || EVP_PKEY_assign_EC_KEY(*ephemeral_key_pair_out, ec_key_pair) != 1)
+  {
+    kmyth_sgx_log(LOG_ERR, "wrapping ephemeral EC key pair in PKEY failed");
+    EVP_PKEY_free(*ephemeral_key_pair_out);
+    *ephemeral_key_pair_out = NULL;
+    EC_KEY_free(ec_key_pair);
     return EXIT_FAILURE;
   }
 
   return EXIT_SUCCESS;
 }
 
+/*****************************************************************************
+ * get_ecdh_ephemeral_key_suite()
+ ****************************************************************************/
+int get_ecdh_ephemeral_key_suite(EVP_PKEY * ephemeral_key, uint8_t * suite)
+{
+  switch (EVP_PKEY_base_id(ephemeral_key))
+  {
+  case EVP_PKEY_X25519:
+    *suite = KMYTH_ECDH_SUITE_X25519;
+    return EXIT_SUCCESS;
+  case EVP_PKEY_EC:
+    {
+      const EC_KEY *ec_key = EVP_PKEY_get0_EC_KEY(ephemeral_key);
+
+      if (ec_key != NULL && EC_GROUP_get_curve_name(EC_KEY_get0_group(ec_key))
+          == KMYTH_EC_NID)
+      {
+        *suite = KMYTH_ECDH_SUITE_P384;
+        return EXIT_SUCCESS;
+      }
+      break;
+    }
+  default:
+    break;
+  }
+
+  kmyth_sgx_log(LOG_ERR, "key is not of a supported ECDH suite");
+  return EXIT_FAILURE;
+}
+
 /*****************************************************************************
  * create_ecdh_ephemeral_public()
  ****************************************************************************/
-int create_ecdh_ephemeral_public(EC_KEY * ephemeral_ec_key_pair_in,
-                                 unsigned char **ephemeral_ec_pub_out,
-                                 size_t *ephemeral_ec_pub_out_len)
+int create_ecdh_ephemeral_public(EVP_PKEY * ephemeral_key_pair_in,
+                                 unsigned char **ephemeral_pub_out,
+                                 size_t *ephemeral_pub_out_len)
 {
+  uint8_t suite = 0;
+
+  if (get_ecdh_ephemeral_key_suite(ephemeral_key_pair_in, &suite))
+  {
+    return EXIT_FAILURE;
+  }
+
+  if (suite == KMYTH_ECDH_SUITE_X25519)
+  {
+    // an X25519 'public key' is already a byte string
+    size_t pub_len = 0;
+
+    if (EVP_PKEY_get_raw_public_key(ephemeral_key_pair_in, NULL,
+                                    &pub_len) != 1)
+    {
+      kmyth_sgx_log(LOG_ERR, "failed to get size for X25519 ephemeral pubkey");
+      return EXIT_FAILURE;
+    }
+    *ephemeral_pub_out = (unsigned char *) malloc(1 + pub_len);
+    if (*ephemeral_pub_out == NULL)
+    {
+      kmyth_sgx_log(LOG_ERR, "malloc of ephemeral pubkey buffer failed");
+      return EXIT_FAILURE;
+    }
+    if (EVP_PKEY_get_raw_public_key(ephemeral_key_pair_in,
+                                    *ephemeral_pub_out + 1, &pub_len) != 1)
+    {
+      kmyth_sgx_log(LOG_ERR, "X25519 ephemeral pubkey export failed");
+      free(*ephemeral_pub_out);
+      *ephemeral_pub_out = NULL;
+      return EXIT_FAILURE;
+    }
+    (*ephemeral_pub_out)[0] = suite;
+    *ephemeral_pub_out_len = 1 + pub_len;
+
+    return EXIT_SUCCESS;
+  }
+
+  const EC_KEY *ec_key_pair = EVP_PKEY_get0_EC_KEY(ephemeral_key_pair_in);
+
   // need EC_GROUP (elliptic curve definition) as parameter for API calls
-  EC_GROUP const *grp = EC_KEY_get0_group(ephemeral_ec_key_pair_in);
+  EC_GROUP const *grp = EC_KEY_get0_group(ec_key_pair);
 
   if (grp == NULL)
   {
@@ -52,7 +158,7 @@ int create_ecdh_ephemeral_public(EC_KEY * ephemeral_ec_key_pair_in,
   }
 
   // extract 'public key' (as an EC_POINT struct)
-  EC_POINT const *pub_pt = EC_KEY_get0_public_key(ephemeral_ec_key_pair_in);
+  EC_POINT const *pub_pt = EC_KEY_get0_public_key(ec_key_pair);
 
   if (pub_pt == NULL)
   {
@@ -65,8 +171,9 @@ int create_ecdh_ephemeral_public(EC_KEY * ephemeral_ec_key_pair_in,
   // remote peer. The first 'point2oct' call, specifying a NULL pointer as
   // the output byte array parameter, returns the length of the octet string
   // that will be produced. This enables memory allocation for a buffer of the
-  // required size. The second call passes a pointer to this newly allocated
-  // buffer, and gets populated with the required octet string representation.
+  // required size (plus the leading suite ID). The second call passes a
+  // pointer into this newly allocated buffer, and gets populated with the
+  // required octet string representation.
   size_t required_buffer_len = EC_POINT_point2oct(grp,
                                                   pub_pt,
                                                   POINT_CONVERSION_UNCOMPRESSED,
@@ -81,62 +188,114 @@ int create_ecdh_ephemeral_public(EC_KEY * ephemeral_ec_key_pair_in,
     return EXIT_FAILURE;
   }
 
-  *ephemeral_ec_pub_out = (unsigned char *) malloc(required_buffer_len);
-  if (*ephemeral_ec_pub_out == NULL)
+  *ephemeral_pub_out = (unsigned char *) malloc(1 + required_buffer_len);
+  if (*ephemeral_pub_out == NULL)
   {
     kmyth_sgx_log(LOG_ERR,
                   "malloc of ephemeral pubkey octet string buffer failed");
     return EXIT_FAILURE;
   }
-  *ephemeral_ec_pub_out_len = EC_POINT_point2oct(grp,
-                                                 pub_pt,
-                                                 POINT_CONVERSION_UNCOMPRESSED,
-                                                 *ephemeral_ec_pub_out,
-                                                 required_buffer_len, NULL);
-  if (*ephemeral_ec_pub_out_len <= 0)
+  (*ephemeral_pub_out)[0] = suite;
+  *ephemeral_pub_out_len = EC_POINT_point2oct(grp,
+                                              pub_pt,
+                                              POINT_CONVERSION_UNCOMPRESSED,
+                                              *ephemeral_pub_out + 1,
+                                              required_buffer_len, NULL);
+  if (*ephemeral_pub_out_len <= 0)
   {
     kmyth_sgx_log(LOG_ERR, "EC_POINT to octet string conversion failed");
+    free(*ephemeral_pub_out);
+    *ephemeral_pub_out = NULL;
     return EXIT_FAILURE;
   }
+  *ephemeral_pub_out_len += 1;
 
   return EXIT_SUCCESS;
 }
 
 /*****************************************************************************
- * reconstruct_ecdh_ephemeral_public_point()
+ * get_ecdh_ephemeral_public_suite()
  ****************************************************************************/
-int reconstruct_ecdh_ephemeral_public_point(int ec_nid,
-                                            unsigned char *ec_octet_str_in,
-                                            size_t ec_octet_str_in_len,
-                                            EC_POINT ** ec_point_out)
+int get_ecdh_ephemeral_public_suite(unsigned char *ephemeral_pub_in,
+                                    size_t ephemeral_pub_in_len,
+                                    uint8_t * suite)
 {
-  // need 'group' parameter to create new EC_POINT on this elliptic curve
-  EC_GROUP *group = EC_GROUP_new_by_curve_name(ec_nid);
+  if (ephemeral_pub_in == NULL || ephemeral_pub_in_len < 2)
+  {
+    kmyth_sgx_log(LOG_ERR, "ephemeral 'public key' octet string too short");
+    return EXIT_FAILURE;
+  }
 
-  if (group == NULL)
+  if (ephemeral_pub_in[0] != KMYTH_ECDH_SUITE_P384 &&
+      ephemeral_pub_in[0] != KMYTH_ECDH_SUITE_X25519)
   {
-    kmyth_sgx_log(LOG_ERR, "EC_GROUP creation for built-in curve NID failed");
+    kmyth_sgx_log(LOG_ERR, "ephemeral 'public key' of unsupported ECDH suite");
     return EXIT_FAILURE;
   }
+  *suite = ephemeral_pub_in[0];
 
-  *ec_point_out = EC_POINT_new(group);
-  if (*ec_point_out == NULL)
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * reconstruct_ecdh_ephemeral_public()
+ ****************************************************************************/
+int reconstruct_ecdh_ephemeral_public(unsigned char *ephemeral_pub_in,
+                                      size_t ephemeral_pub_in_len,
+                                      EVP_PKEY ** ephemeral_pub_out)
+{
+  uint8_t suite = 0;
+
+  *ephemeral_pub_out = NULL;
+  if (get_ecdh_ephemeral_public_suite(ephemeral_pub_in, ephemeral_pub_in_len,
+                                      &suite))
   {
-    kmyth_sgx_log(LOG_ERR, "init of empty EC_POINT for specified group failed");
     return EXIT_FAILURE;
   }
 
-  // convert input octet string to an EC_POINT struct 
-  if (EC_POINT_oct2point(group, *ec_point_out,
-                         ec_octet_str_in, ec_octet_str_in_len, NULL) != 1)
+  // skip the suite ID
+  unsigned char *pub = ephemeral_pub_in + 1;
+  size_t pub_len = ephemeral_pub_in_len - 1;
+
+  if (suite == KMYTH_ECDH_SUITE_X25519)
+  {
+    // any 32 byte string is an X25519 'public key', no point to decode
+    *ephemeral_pub_out = EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, NULL,
+                                                     pub, pub_len);
+    if (*ephemeral_pub_out == NULL)
+    {
+      kmyth_sgx_log(LOG_ERR, "invalid X25519 ephemeral 'public key'");
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  // convert input octet string to a point on the curve, in a new EC_KEY
+  // (the EC_KEY object supplies the EC_GROUP the point is decoded for)
+  EC_KEY *ec_pub = EC_KEY_new_by_curve_name(KMYTH_EC_NID);
+
+  if (ec_pub == NULL)
+  {
+    kmyth_sgx_log(LOG_ERR, "failed to create new elliptic curve key object");
+    return EXIT_FAILURE;
+  }
+  if (EC_KEY_oct2key(ec_pub, pub, pub_len, NULL) != 1)
   {
-    EC_GROUP_clear_free(group);
     kmyth_sgx_log(LOG_ERR, "octet string to EC_POINT conversion failed");
+    EC_KEY_free(ec_pub);
     return EXIT_FAILURE;
   }
 
-  // clean-up
-  EC_GROUP_clear_free(group);
+  *ephemeral_pub_out = EVP_PKEY_new();
+  if (*ephemeral_pub_out == NULL
+      || EVP_PKEY_assign_EC_KEY(*ephemeral_pub_out, ec_pub) != 1)
+  {
+    kmyth_sgx_log(LOG_ERR, "wrapping ephemeral EC 'public key' failed");
+    EVP_PKEY_free(*ephemeral_pub_out);
+    *ephemeral_pub_out = NULL;
+    EC_KEY_free(ec_pub);
+    return EXIT_FAILURE;
+  }
 
   return EXIT_SUCCESS;
 }
@@ -144,36 +303,36 @@ int reconstruct_ecdh_ephemeral_public_point(int ec_nid,
 /*****************************************************************************
  * compute_ecdh_shared_secret()
  ****************************************************************************/
-int compute_ecdh_shared_secret(EC_KEY * local_eph_priv_key,
-                               EC_POINT * remote_eph_pub_point,
+int compute_ecdh_shared_secret(EVP_PKEY * local_eph_priv_key,
+                               EVP_PKEY * remote_eph_pub_key,
                                unsigned char **shared_secret,
                                size_t *shared_secret_len)
 {
-  // create buffer (allocate memory) for the shared secret (session key) result
-  //   - the field size calculated below returns the number of bits required
-  //     for a field element for the elliptic curve being used (i.e., the size
-  //     of the prime p for a prime field and the value of m for a binary (2^m)
-  //     field)
-  //   - the length of the shared secret is calculated by converting to the
-  //     maximum number of bytes required. Adding 7 to the bit length and
-  //     taking the integer portion of dividing by 8 bits in a byte returns
-  //     the necessary size in bytes.
-  int field_size = EC_GROUP_get_degree(EC_KEY_get0_group(local_eph_priv_key));
-
-  *shared_secret_len = (field_size + 7) / 8;
-  *shared_secret = OPENSSL_malloc(*shared_secret_len);
-
-  // derive the 'shared secret' (session key) value
-  *shared_secret_len = ECDH_compute_key(*shared_secret,
-                                        *shared_secret_len,
-                                        remote_eph_pub_point,
-                                        local_eph_priv_key, KMYTH_ECDH_KDF);
-
-  if (*shared_secret_len <= 0)
+  // the derivation context checks that both keys are of the same suite
+  // (key type and, for P-384, curve)
+  EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(local_eph_priv_key, NULL);
+
+  *shared_secret = NULL;
+  if (ctx == NULL || EVP_PKEY_derive_init(ctx) != 1
+      || EVP_PKEY_derive_set_peer(ctx, remote_eph_pub_key) != 1)
+  {
+    kmyth_sgx_log(LOG_ERR, "ECDH shared secret derivation setup failed");
+    EVP_PKEY_CTX_free(ctx);
+    return EXIT_FAILURE;
+  }
+
+  // first call gets the length of the shared secret, second derives it
+  if (EVP_PKEY_derive(ctx, NULL, shared_secret_len) != 1
+      || (*shared_secret = OPENSSL_malloc(*shared_secret_len)) == NULL
+      || EVP_PKEY_derive(ctx, *shared_secret, shared_secret_len) != 1)
   {
     kmyth_sgx_log(LOG_ERR, "computation of ECDH shared secret value failed");
+    OPENSSL_free(*shared_secret);
+    *shared_secret = NULL;
+    EVP_PKEY_CTX_free(ctx);
     return EXIT_FAILURE;
   }
+  EVP_PKEY_CTX_free(ctx);
 
   return EXIT_SUCCESS;
 }
@@ -186,61 +345,26 @@ int compute_ecdh_session_key(unsigned char *secret,
                              unsigned char **session_key,
                              unsigned int *session_key_len)
 {
-  // specify hash algorithm to employ as a KDF
-  const EVP_MD *kdf = EVP_shake256();
-
-  if (NULL == kdf)
-  {
-    kmyth_sgx_log(LOG_ERR, "failed to locate the specifed hash function");
-    return EXIT_FAILURE;
-  }
-
-  // create message digest (EVP_MD) context
-  EVP_MD_CTX *ctx = EVP_MD_CTX_new();
-
-  if (NULL == ctx)
-  {
-    kmyth_sgx_log(LOG_ERR, "failed to create the message digest context");
-    return EXIT_FAILURE;
-  }
-
-  // initialize the context
-  int result = EVP_DigestInit_ex(ctx, kdf, NULL);
+  // HKDF, labelled for this use, so that the session key is independent of
+  // any other key derived from the same kind of secret
+  static const unsigned char info[] = KMYTH_ECDH_SESSION_KEY_INFO;
+  kdf_params params;
 
-  if (0 == result)
+  if (kdf_params_init(&params, KMYTH_KDF_HASH, NULL, 0,
+                      info, sizeof(info) - 1))
   {
-    kmyth_sgx_log(LOG_ERR, "failed to initialize the message digest context.");
-    EVP_MD_CTX_free(ctx);
+    kmyth_sgx_log(LOG_ERR, "failed to set up the session key KDF");
     return EXIT_FAILURE;
   }
 
-  // apply shared secret input
-  result = EVP_DigestUpdate(ctx, secret, secret_len);
-  if (0 == result)
-  {
-    kmyth_sgx_log(LOG_ERR, "failed to update the message digest context");
-    EVP_MD_CTX_free(ctx);
-    return EXIT_FAILURE;
-  }
+  size_t key_len = KMYTH_ECDH_SESSION_KEY_LEN;
 
-  *session_key = calloc(EVP_MAX_MD_SIZE, sizeof(unsigned char));
-  if (NULL == *session_key)
+  if (kdf_derive_keys(&params, secret, secret_len, 1, &key_len, session_key))
   {
-    kmyth_sgx_log(LOG_ERR, "failed to allocate the session key buffer");
-    EVP_MD_CTX_free(ctx);
+    kmyth_sgx_log(LOG_ERR, "failed to derive the session key");
     return EXIT_FAILURE;
   }
-  *session_key_len = EVP_MAX_MD_SIZE * sizeof(unsigned char);
-
-  result = EVP_DigestFinal_ex(ctx, *session_key, session_key_len);
-  if (0 == result)
-  {
-    kmyth_sgx_log(LOG_ERR, "failed to finalize the message digest context");
-    EVP_MD_CTX_free(ctx);
-    return 1;
-  }
-
-  EVP_MD_CTX_free(ctx);
+  *session_key_len = KMYTH_ECDH_SESSION_KEY_LEN;
 
   return EXIT_SUCCESS;
 }
@@ -252,6 +376,11 @@ int sign_buffer(EVP_PKEY * ec_sign_pkey,
                 unsigned char *buf_in, size_t buf_in_len,
                 unsigned char **sig_out, unsigned int *sig_out_len)
 {
+  // Ed25519 hashes the data itself (so takes no message digest), EC keys
+  // sign a SHA-512 digest of it
+  const EVP_MD *md =
+    (EVP_PKEY_base_id(ec_sign_pkey) == EVP_PKEY_ED25519) ? NULL : EVP_sha512();
+
   // create message digest context
   EVP_MD_CTX *mdctx = EVP_MD_CTX_new();
 
@@ -262,21 +391,13 @@ int sign_buffer(EVP_PKEY * ec_sign_pkey,
   }
 
   // configure signing context
-  if (EVP_SignInit(mdctx, EVP_sha512()) != 1)
+  if (EVP_DigestSignInit(mdctx, NULL, md, NULL, ec_sign_pkey) != 1)
   {
     kmyth_sgx_log(LOG_ERR, "config of message digest signature context failed");
     EVP_MD_CTX_free(mdctx);
     return EXIT_FAILURE;
   }
 
-  // hash data into the signature context
-  if (EVP_SignUpdate(mdctx, buf_in, buf_in_len) != 1)
-  {
-    kmyth_sgx_log(LOG_ERR, "error hashing data into signature context");
-    EVP_MD_CTX_free(mdctx);
-    return EXIT_FAILURE;
-  }
-
   // allocate memory for signature
   int max_sig_len = EVP_PKEY_size(ec_sign_pkey);
 
@@ -294,14 +415,16 @@ int sign_buffer(EVP_PKEY * ec_sign_pkey,
     return EXIT_FAILURE;
   }
 
-  // sign the data (create signature)
-  if (EVP_SignFinal(mdctx, *sig_out,
-                    (unsigned int *) sig_out_len, ec_sign_pkey) != 1)
+  // sign the data (create signature) - one-shot, as Ed25519 requires
+  size_t sig_len = (size_t) max_sig_len;
+
+  if (EVP_DigestSign(mdctx, *sig_out, &sig_len, buf_in, buf_in_len) != 1)
   {
     kmyth_sgx_log(LOG_ERR, "signature creation failed");
     EVP_MD_CTX_free(mdctx);
     return EXIT_FAILURE;
   }
+  *sig_out_len = (unsigned int) sig_len;
 
   // done - clean-up context
   EVP_MD_CTX_free(mdctx);
@@ -316,6 +439,12 @@ int verify_buffer(EVP_PKEY * ec_verify_pkey,
                   unsigned char *buf_in, size_t buf_in_len,
                   unsigned char *sig_in, unsigned int sig_in_len)
 {
+  // Ed25519 hashes the data itself (so takes no message digest), EC keys
+  // verify against a SHA-512 digest of it
+  const EVP_MD *md =
+    (EVP_PKEY_base_id(ec_verify_pkey) == EVP_PKEY_ED25519) ? NULL :
+    EVP_sha512();
+
   // create message digest context
   EVP_MD_CTX *mdctx = EVP_MD_CTX_new();
 
@@ -326,27 +455,15 @@ int verify_buffer(EVP_PKEY * ec_verify_pkey,
   }
 
   // 'initialize' (e.g., load public key)
-  if (EVP_DigestVerifyInit(mdctx, NULL, EVP_sha512(),
-                           NULL, ec_verify_pkey) != 1)
+  if (EVP_DigestVerifyInit(mdctx, NULL, md, NULL, ec_verify_pkey) != 1)
   {
     kmyth_sgx_log(LOG_ERR, "initialization of message digest context failed");
     EVP_MD_CTX_free(mdctx);
     return EXIT_FAILURE;
   }
 
-  // 'update' with signed data
-  if (EVP_DigestVerifyUpdate(mdctx, buf_in, buf_in_len) != 1)
-  {
-    kmyth_sgx_log(LOG_ERR,
-                  "message digest context update with signed data failed");
-    EVP_MD_CTX_free(mdctx);
-    return EXIT_FAILURE;
-  }
-
-  // check signature
-  unsigned char *sig_ptr = sig_in;
-
-  if (EVP_DigestVerifyFinal(mdctx, sig_ptr, sig_in_len) != 1)
+  // check signature over the signed data - one-shot, as Ed25519 requires
+  if (EVP_DigestVerify(mdctx, sig_in, sig_in_len, buf_in, buf_in_len) != 1)
   {
     kmyth_sgx_log(LOG_ERR, "signature verification failed");
     EVP_MD_CTX_free(mdctx);
@@ -0,0 +1,152 @@
+/**
+ * @file kdf_util.c
+ *
+ * @brief Provides implementation of the HKDF key derivation shared by the
+ *        kmyth SGX ECDH code and the kmyth session key protocols.
+ */
+
+#include "kdf_util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/kdf.h>
+
+#include "kmyth_enclave_common.h"
+
+/*****************************************************************************
+ * kdf_params_init()
+ ****************************************************************************/
+int kdf_params_init(kdf_params * params, kdf_hash hash,
+                    const unsigned char *salt, size_t salt_len,
+                    const unsigned char *info, size_t info_len)
+{
+  if (params == NULL || (salt == NULL && salt_len > 0)
+      || (info == NULL && info_len > 0))
+  {
+    kmyth_sgx_log(LOG_ERR, "invalid KDF parameters");
+    return EXIT_FAILURE;
+  }
+
+  switch (hash)
+  {
+  case KDF_HASH_SHA256:
+    params->md = EVP_sha256();
+    break;
+  case KDF_HASH_SHA384:
+    params->md = EVP_sha384();
+    break;
+  default:
+    params->md = NULL;
+    break;
+  }
+  if (params->md == NULL)
+  {
+    kmyth_sgx_log(LOG_ERR, "failed to locate the specified KDF hash function");
+    return EXIT_FAILURE;
+  }
+
+  params->salt = salt;
+  params->salt_len = salt_len;
+  params->info = info;
+  params->info_len = info_len;
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * kdf_derive_keys()
+ ****************************************************************************/
+int kdf_derive_keys(const kdf_params * params,
+                    const unsigned char *secret, size_t secret_len,
+                    size_t key_count, const size_t *key_lens,
+                    unsigned char **keys)
+{
+  if (params == NULL || params->md == NULL || secret == NULL
+      || secret_len == 0 || key_count == 0 || key_count > KDF_MAX_KEYS
+      || key_lens == NULL || keys == NULL)
+  {
+    kmyth_sgx_log(LOG_ERR, "invalid key derivation parameters");
+    return EXIT_FAILURE;
+  }
+
+  // HKDF-Expand can produce at most 255 hash blocks
+  size_t output_len = 0;
+
+  for (size_t i = 0; i < key_count; i++)
+  {
+    keys[i] = NULL;
+    if (key_lens[i] == 0)
+    {
+      kmyth_sgx_log(LOG_ERR, "invalid derived key length");
+      return EXIT_FAILURE;
+    }
+    output_len += key_lens[i];
+  }
+  if (output_len > 255 * (size_t) EVP_MD_size(params->md))
+  {
+    kmyth_sgx_log(LOG_ERR, "requested key material exceeds the HKDF limit");
+    return EXIT_FAILURE;
+  }
+
+  unsigned char *output = malloc(output_len);
+
+  if (output == NULL)
+  {
+    kmyth_sgx_log(LOG_ERR, "failed to allocate the KDF output buffer");
+    return EXIT_FAILURE;
+  }
+
+  // derive all of the keys with one extract and expand
+  EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+  size_t derived_len = output_len;
+
+  if (ctx == NULL
+      || EVP_PKEY_derive_init(ctx) <= 0
+      || EVP_PKEY_CTX_set_hkdf_md(ctx, params->md) <= 0
+      || (params->salt_len > 0
+          && EVP_PKEY_CTX_set1_hkdf_salt(ctx, params->salt,
+                                         params->salt_len) <= 0)
+      || EVP_PKEY_CTX_set1_hkdf_key(ctx, secret, secret_len) <= 0
+      || (params->info_len > 0
+          && EVP_PKEY_CTX_add1_hkdf_info(ctx, params->info,
+                                         params->info_len) <= 0)
+      || EVP_PKEY_derive(ctx, output, &derived_len) <= 0
+      || derived_len != output_len)
+  {
+    kmyth_sgx_log(LOG_ERR, "HKDF key derivation failed");
+    EVP_PKEY_CTX_free(ctx);
+    OPENSSL_cleanse(output, output_len);
+    free(output);
+    return EXIT_FAILURE;
+  }
+  EVP_PKEY_CTX_free(ctx);
+
+  // split the output into the requested keys
+  unsigned char *section = output;
+
+  for (size_t i = 0; i < key_count; i++)
+  {
+    keys[i] = malloc(key_lens[i]);
+    if (keys[i] == NULL)
+    {
+      kmyth_sgx_log(LOG_ERR, "failed to allocate a derived key buffer");
+      for (size_t j = 0; j < i; j++)
+      {
+        OPENSSL_cleanse(keys[j], key_lens[j]);
+        free(keys[j]);
+        keys[j] = NULL;
+      }
+      OPENSSL_cleanse(output, output_len);
+      free(output);
+      return EXIT_FAILURE;
+    }
+    memcpy(keys[i], section, key_lens[i]);
+    section += key_lens[i];
+  }
+
+  OPENSSL_cleanse(output, output_len);
+  free(output);
+
+  return EXIT_SUCCESS;
+}
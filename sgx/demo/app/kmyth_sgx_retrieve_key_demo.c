@@ -19,6 +19,8 @@
 #include <openssl/err.h>
 
 #include "sgx_urts.h"
+#include "sgx_enclave_create.h"
+#include "sgx_enclave_stats.h"
 
 #include "ec_key_cert_marshal.h"
 #include "ec_key_cert_unmarshal.h"
@@ -68,7 +70,7 @@ static sgx_status_t initialize_enclave(const char *enclave_fn,
 {
   sgx_status_t ret = SGX_ERROR_UNEXPECTED;
 
-  ret = sgx_create_enclave(enclave_fn, SGX_DEBUG_FLAG, NULL, NULL, eid, NULL);
+  ret = kmyth_sgx_create_enclave(enclave_fn, SGX_DEBUG_FLAG, eid);
   return ret;
 }
 
@@ -181,13 +183,26 @@ int main(int argc, char **argv)
   }
   demo_log(LOG_DEBUG, "initialized SGX enclave - EID = 0x%016lx", eid);
 
-  // make ECALL to retrieve key into enclave from the key server
+  // the retrieved key is placed in the enclave's unsealed data table
   int retval = -1;
 
+  sgx_ret = kmyth_unsealed_data_table_initialize(eid, &retval);
+  if (sgx_ret != SGX_SUCCESS || retval != 0)
+  {
+    demo_log(LOG_ERR, "kmyth_unsealed_data_table_initialize() failed");
+    free(client_priv_ec_key_bytes);
+    free(server_pub_ec_cert_bytes);
+    sgx_destroy_enclave(eid);
+    return EXIT_FAILURE;
+  }
+
+  // make ECALL to retrieve key into enclave from the key server
   const char *server_host = SERVER_IP;
   int server_host_len = strlen(server_host) + 1;
   int server_port = SERVER_PORT;
+  uint64_t key_handle = 0;
 
+  retval = -1;
   sgx_ret = kmyth_enclave_retrieve_key_from_server(eid,
                                                    &retval,
                                                    client_priv_ec_key_bytes,
@@ -198,18 +213,29 @@ int main(int argc, char **argv)
                                                    server_host_len,
                                                    server_port,
                                                    (unsigned char *) KEY_ID,
-                                                   KEY_ID_LEN);
+                                                   KEY_ID_LEN, &key_handle);
 
   free(client_priv_ec_key_bytes);
   free(server_pub_ec_cert_bytes);
 
+  // further retrievals would reuse the session; this demo is done with it
+  kmyth_enclave_close_key_server_session(eid);
+
+  // the enclave's memory use, e.g., to size its HeapMaxSize
+  kmyth_sgx_print_enclave_stats(eid, stdout, NULL);
+
+  int cleanup_ret = -1;
+
+  kmyth_unsealed_data_table_cleanup(eid, &cleanup_ret);
   sgx_destroy_enclave(eid);
 
-  if (sgx_ret)
+  if (sgx_ret != SGX_SUCCESS || retval != 0)
   {
     demo_log(LOG_ERR, "kmyth_enclave_retrieve_key_from_server() failed");
     return EXIT_FAILURE;
   }
+  demo_log(LOG_DEBUG, "retrieved key into enclave - handle = 0x%016lx",
+           key_handle);
 
   return EXIT_SUCCESS;
 }
@@ -4,3 +4,11 @@ openssl req -new -x509 -key client_priv_test.pem -subj "/C=US/O=Kmyth/CN=TestCli
 openssl ecparam -name secp384r1 -genkey -noout -out server_priv_test.pem
 openssl req -new -x509 -key server_priv_test.pem -subj "/C=US/O=Kmyth/CN=TestServer" -out server_cert_test.pem -days 365
 
+openssl genpkey -algorithm ed25519 -out client_ed25519_priv_test.pem
+openssl req -new -x509 -key client_ed25519_priv_test.pem -subj "/C=US/O=Kmyth/CN=TestClient" -out client_ed25519_cert_test.pem -days 365
+
+openssl genpkey -algorithm ed25519 -out server_ed25519_priv_test.pem
+openssl req -new -x509 -key server_ed25519_priv_test.pem -subj "/C=US/O=Kmyth/CN=TestServer" -out server_ed25519_cert_test.pem -days 365
+
+openssl ecparam -name prime256v1 -genkey -noout -out tls_server_priv_test.pem
+openssl req -new -x509 -key tls_server_priv_test.pem -subj "/C=US/O=Kmyth/CN=localhost" -out tls_server_cert_test.pem -days 365
@@ -3,11 +3,25 @@
  * @brief Shared code for the ECDHE client/server applications.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <time.h>
+
+#include <kmyth/file_io.h>
+
 #include "ecdh_demo.h"
+#include "tls_util.h"
 
 #define KEY_ID "7"
 #define KEY_ID_LEN 1
 
+#define POOL_QUEUE_SIZE 64
+#define POOL_MAX_EVENTS 64
+
 void init(ECDHServer * ecdhconn)
 {
   secure_memset(ecdhconn, 0, sizeof(ECDHServer));
@@ -15,32 +29,20 @@ void init(ECDHServer * ecdhconn)
   ecdhconn->client_mode = false;
 }
 
-void cleanup(ECDHServer * ecdhconn)
+void cleanup_connection(ECDHServer * ecdhconn)
 {
-  /* Note: These clear and free functions should all be safe to use with null pointer values. */
+  /* Releases the per-connection state, leaving the long-term keys loaded. */
 
   if (ecdhconn->socket_fd != UNSET_FD)
   {
     close(ecdhconn->socket_fd);
-  }
-
-  if (ecdhconn->local_privkey != NULL)
-  {
-    kmyth_clear(ecdhconn->local_privkey, sizeof(ecdhconn->local_privkey));
-    EVP_PKEY_free(ecdhconn->local_privkey);
-  }
-
-  if (ecdhconn->remote_pubkey != NULL)
-  {
-    kmyth_clear(ecdhconn->remote_pubkey, sizeof(ecdhconn->remote_pubkey));
-    EVP_PKEY_free(ecdhconn->remote_pubkey);
+    ecdhconn->socket_fd = UNSET_FD;
   }
 
   if (ecdhconn->local_ephemeral_keypair != NULL)
   {
-    kmyth_clear(ecdhconn->local_ephemeral_keypair,
-                sizeof(ecdhconn->local_ephemeral_keypair));
-    EC_KEY_free(ecdhconn->local_ephemeral_keypair);
+    // freeing the key pair clears its private key
+    EVP_PKEY_free(ecdhconn->local_ephemeral_keypair);
   }
 
   if (ecdhconn->remote_ephemeral_pubkey != NULL)
@@ -54,11 +56,47 @@ void cleanup(ECDHServer * ecdhconn)
     kmyth_clear_and_free(ecdhconn->session_key, ecdhconn->session_key_len);
   }
 
+  ecdhconn->local_ephemeral_keypair = NULL;
+  ecdhconn->remote_ephemeral_pubkey = NULL;
+  ecdhconn->remote_ephemeral_pubkey_len = 0;
+  ecdhconn->session_key = NULL;
+  ecdhconn->session_key_len = 0;
+  kmip_encoding_buffer_free(&ecdhconn->kmip_buffer);
+}
+
+void cleanup(ECDHServer * ecdhconn)
+{
+  /* Note: These clear and free functions should all be safe to use with null pointer values. */
+
+  cleanup_connection(ecdhconn);
+
+  if (ecdhconn->local_privkey != NULL)
+  {
+    kmyth_clear(ecdhconn->local_privkey, sizeof(ecdhconn->local_privkey));
+    EVP_PKEY_free(ecdhconn->local_privkey);
+  }
+
+  if (ecdhconn->remote_pubkey != NULL)
+  {
+    kmyth_clear(ecdhconn->remote_pubkey, sizeof(ecdhconn->remote_pubkey));
+    EVP_PKEY_free(ecdhconn->remote_pubkey);
+  }
+
+  kmip_pool_free(&ecdhconn->upstream_pool);
+  key_store_close(&ecdhconn->key_store);
+
   init(ecdhconn);
 }
 
 void error(ECDHServer * ecdhconn)
 {
+  if (ecdhconn->conn_error != NULL)
+  {
+    /* A pool worker: drop only this connection and keep serving. */
+    cleanup_connection(ecdhconn);
+    longjmp(*ecdhconn->conn_error, 1);
+  }
+
   cleanup(ecdhconn);
   exit(EXIT_FAILURE);
 }
@@ -76,10 +114,45 @@ static void usage(const char *prog)
           "  -i or --ip       The IP address or hostname of the server (only used by the client).\n"
           "Test Options --\n"
           "  -m or --maxconn  The number of connections the server will accept before exiting (unlimited by default, or if the value is not a positive integer).\n"
+          "  -b or --backlog  The listen backlog of the server socket (1 by default, or if the value is not a positive integer).\n"
+          "  -w or --workers  Serve connections from an epoll loop with this many worker threads, instead of forking a process per connection.\n"
+          "  -e or --ephemeral  With -w, keep this many ephemeral key pairs generated ahead of the connections that use them, by a background thread.\n"
+          "  -s or --suite    The ECDH key agreement suite, p384 or x25519: the one proposed by the client (p384 by default), or the only one the server accepts (any by default).\n"
+          "Upstream KMIP Server (server only; a static key is served without one) --\n"
+          "  -I or --kmip-ip    The IP address or hostname of the KMIP server the keys are retrieved from.\n"
+          "  -P or --kmip-port  The port number of the KMIP server.\n"
+          "  -C or --kmip-ca    Path to the CA certificate the KMIP server's certificate is verified with.\n"
+          "  -R or --kmip-key   Path to the private key used to authenticate to the KMIP server.\n"
+          "  -U or --kmip-cert  Path to the certificate used to authenticate to the KMIP server.\n"
+          "Key Store (server only, instead of a KMIP server) --\n"
+          "  -k or --key-store       Path to the key store file the keys are looked up in (see key-store-gen).\n"
+          "  -W or --key-store-wrap  Path to the kmyth-sealed (.ski) wrapping key of the key store.\n"
+          "Load Generator (client only) --\n"
+          "  -L or --load           Run a load test with this many connections in parallel (one per thread), reporting latency percentiles and throughput.\n"
+          "  -d or --duration       Length of the load test in seconds (10 by default).\n"
+          "  -q or --rate           Total key requests per second across all connections (as many as possible by default).\n"
+          "  -n or --key-ids        Request key IDs 1 to this number (only the demo key ID by default).\n"
+          "  -z or --zipf           Draw the key IDs from a Zipf distribution with this exponent (uniform by default).\n"
+          "  -y or --keys-per-conn  Key requests made over each connection (1 by default).\n"
           "Misc --\n"
           "  -h or --help     Help (displays this usage).\n\n", prog);
 }
 
+static int parse_ecdh_suite(const char *name, uint8_t * suite)
+{
+  if (strcmp(name, "p384") == 0)
+  {
+    *suite = KMYTH_ECDH_SUITE_P384;
+    return EXIT_SUCCESS;
+  }
+  if (strcmp(name, "x25519") == 0)
+  {
+    *suite = KMYTH_ECDH_SUITE_X25519;
+    return EXIT_SUCCESS;
+  }
+  return EXIT_FAILURE;
+}
+
 void get_options(ECDHServer * ecdhconn, int argc, char **argv)
 {
   // Exit early if there are no arguments.
@@ -93,7 +166,7 @@ void get_options(ECDHServer * ecdhconn, int argc, char **argv)
   int option_index = 0;
 
   while ((options =
-          getopt_long(argc, argv, "r:u:p:i:m:h", longopts, &option_index)) != -1)
+          getopt_long(argc, argv, "r:u:p:i:m:b:w:e:s:I:P:C:R:U:k:W:L:d:q:n:z:y:h", longopts, &option_index)) != -1)
   {
     switch (options)
     {
@@ -115,6 +188,64 @@ void get_options(ECDHServer * ecdhconn, int argc, char **argv)
     case 'm':
       ecdhconn->maxconn = atoi(optarg);
       break;
+    case 'b':
+      ecdhconn->backlog = atoi(optarg);
+      break;
+    case 'w':
+      ecdhconn->workers = atoi(optarg);
+      break;
+    case 'e':
+      ecdhconn->ephemeral_pool_size = atoi(optarg);
+      break;
+    case 's':
+      if (parse_ecdh_suite(optarg, &ecdhconn->ecdh_suite) != EXIT_SUCCESS)
+      {
+        fprintf(stderr, "Unknown ECDH suite (-s): %s\n", optarg);
+        error(ecdhconn);
+      }
+      break;
+    // Upstream KMIP server
+    case 'I':
+      ecdhconn->kmip_ip = optarg;
+      break;
+    case 'P':
+      ecdhconn->kmip_port = optarg;
+      break;
+    case 'C':
+      ecdhconn->kmip_ca_path = optarg;
+      break;
+    case 'R':
+      ecdhconn->kmip_key_path = optarg;
+      break;
+    case 'U':
+      ecdhconn->kmip_cert_path = optarg;
+      break;
+    // Key store
+    case 'k':
+      ecdhconn->key_store_path = optarg;
+      break;
+    case 'W':
+      ecdhconn->key_store_wrap_path = optarg;
+      break;
+    // Load generator
+    case 'L':
+      ecdhconn->load_threads = atoi(optarg);
+      break;
+    case 'd':
+      ecdhconn->load_duration = atoi(optarg);
+      break;
+    case 'q':
+      ecdhconn->load_rate = atof(optarg);
+      break;
+    case 'n':
+      ecdhconn->load_key_ids = atol(optarg);
+      break;
+    case 'z':
+      ecdhconn->load_zipf = atof(optarg);
+      break;
+    case 'y':
+      ecdhconn->load_keys_per_conn = atoi(optarg);
+      break;
     // Misc
     case 'h':
       usage(argv[0]);
@@ -149,6 +280,36 @@ void check_options(ECDHServer * ecdhconn)
     fprintf(stderr, "IP address argument (-i) is required in client mode.\n");
     err = true;
   }
+  if (ecdhconn->kmip_ip != NULL
+      && (ecdhconn->kmip_port == NULL || ecdhconn->kmip_ca_path == NULL
+          || ecdhconn->kmip_key_path == NULL
+          || ecdhconn->kmip_cert_path == NULL))
+  {
+    fprintf(stderr, "The KMIP server arguments (-P, -C, -R and -U) are required with -I.\n");
+    err = true;
+  }
+  if ((ecdhconn->key_store_path == NULL)
+      != (ecdhconn->key_store_wrap_path == NULL))
+  {
+    fprintf(stderr, "The key store arguments (-k and -W) are required together.\n");
+    err = true;
+  }
+  if (ecdhconn->load_threads > 0)
+  {
+    if (ecdhconn->load_duration <= 0)
+    {
+      ecdhconn->load_duration = DEFAULT_LOAD_DURATION;
+    }
+    if (ecdhconn->load_keys_per_conn <= 0)
+    {
+      ecdhconn->load_keys_per_conn = 1;
+    }
+  }
+  if (ecdhconn->key_store_path != NULL && ecdhconn->kmip_ip != NULL)
+  {
+    fprintf(stderr, "Keys are served from a key store (-k) or a KMIP server (-I), not both.\n");
+    err = true;
+  }
   if (err)
   {
     kmyth_log(LOG_ERR, "Invalid command-line arguments.");
@@ -159,30 +320,53 @@ void check_options(ECDHServer * ecdhconn)
 void ecdh_send_data(ECDHServer * ecdhconn, const void *buf, size_t len)
 {
   /* Wrapper function to simplify error handling. */
-  ssize_t bytes_sent = write(ecdhconn->socket_fd, buf, len);
+  const unsigned char *p = buf;
 
-  if (bytes_sent != len)
+  while (len > 0)
   {
-    kmyth_log(LOG_ERR, "Failed to send a message.");
-    error(ecdhconn);
+    ssize_t bytes_sent = write(ecdhconn->socket_fd, p, len);
+
+    if (bytes_sent < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (bytes_sent <= 0)
+    {
+      kmyth_log(LOG_ERR, "Failed to send a message.");
+      error(ecdhconn);
+    }
+    p += bytes_sent;
+    len -= bytes_sent;
   }
 }
 
 void ecdh_recv_data(ECDHServer * ecdhconn, void *buf, size_t len)
 {
   /* Wrapper function to simplify error handling. */
-  ssize_t bytes_read = read(ecdhconn->socket_fd, buf, len);
+  unsigned char *p = buf;
 
-  if (bytes_read == 0)
-  {
-    kmyth_log(LOG_ERR, "ECDH connection is closed.");
-    error(ecdhconn);
-  }
-  else if (bytes_read != len)
+  /* With these protocols, we should always receive exactly (len) bytes,
+   * but a peer (e.g. the TLS proxy) may deliver them in pieces. */
+  while (len > 0)
   {
-    /* With these protocols, we should always receive exactly (len) bytes. */
-    kmyth_log(LOG_ERR, "Failed to receive a message.");
-    error(ecdhconn);
+    ssize_t bytes_read = read(ecdhconn->socket_fd, p, len);
+
+    if (bytes_read < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (bytes_read == 0)
+    {
+      kmyth_log(LOG_ERR, "ECDH connection is closed.");
+      error(ecdhconn);
+    }
+    else if (bytes_read < 0)
+    {
+      kmyth_log(LOG_ERR, "Failed to receive a message.");
+      error(ecdhconn);
+    }
+    p += bytes_read;
+    len -= bytes_read;
   }
 }
 
@@ -266,11 +450,27 @@ void ecdh_recv_decrypt(ECDHServer * ecdhconn, unsigned char **plaintext, size_t
   kmyth_clear_and_free(ciphertext, ciphertext_len);
 }
 
-void create_server_socket(ECDHServer * ecdhconn)
+static double seconds_since(const struct timespec *start)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double) (now.tv_sec - start->tv_sec)
+    + (double) (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void log_connection_rate(int numconn, const struct timespec *start)
+{
+  double elapsed = seconds_since(start);
+
+  kmyth_log(LOG_INFO, "Served %d connections in %.3f seconds (%.1f per second).",
+            numconn, elapsed, (elapsed > 0) ? numconn / elapsed : 0.0);
+}
+
+int listen_server_socket(ECDHServer * ecdhconn)
 {
   int listen_fd = UNSET_FD;
-  int numconn = 0;
-  int ret;
+  int backlog = ecdhconn->backlog > 0 ? ecdhconn->backlog : DEFAULT_LISTEN_BACKLOG;
 
   kmyth_log(LOG_DEBUG, "Setting up server socket");
   if (setup_server_socket(ecdhconn->port, &listen_fd))
@@ -279,7 +479,7 @@ void create_server_socket(ECDHServer * ecdhconn)
     error(ecdhconn);
   }
 
-  if (listen(listen_fd, 1))
+  if (listen(listen_fd, backlog))
   {
     kmyth_log(LOG_ERR, "Socket listen failed.");
     perror("listen");
@@ -291,6 +491,16 @@ void create_server_socket(ECDHServer * ecdhconn)
     kmyth_log(LOG_DEBUG, "Server will quit after receiving %d connections.", ecdhconn->maxconn);
   }
 
+  return listen_fd;
+}
+
+void create_server_socket(ECDHServer * ecdhconn)
+{
+  int listen_fd = listen_server_socket(ecdhconn);
+  int numconn = 0;
+  int ret;
+  struct timespec start;
+
   while (true) {
     ecdhconn->socket_fd = accept(listen_fd, NULL, NULL);
     if (ecdhconn->socket_fd == -1)
@@ -312,6 +522,10 @@ void create_server_socket(ECDHServer * ecdhconn)
     } else {
       /* parent */
       close(ecdhconn->socket_fd);
+      if (numconn == 0)
+      {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+      }
       numconn++;
       if (ecdhconn->maxconn > 0 && numconn >= ecdhconn->maxconn) {
         break;
@@ -321,205 +535,746 @@ void create_server_socket(ECDHServer * ecdhconn)
 
   close(listen_fd);
   while (wait(NULL) > 0);
+  log_connection_rate(numconn, &start);
   cleanup(ecdhconn);
   exit(EXIT_SUCCESS);
 }
 
-void create_client_socket(ECDHServer * ecdhconn)
+/*
+ * Ephemeral key pool: in worker pool mode a background thread keeps up to
+ * ephemeral_pool_size single-use ephemeral key pairs generated, so that a
+ * handshake only has to take one. Each pair is handed to exactly one
+ * connection. When the pool is empty (or not running), or the connection
+ * negotiated another suite than the pool's, the pair is generated on the
+ * spot, as before.
+ */
+typedef struct ECDHEphemeralPool
 {
-  kmyth_log(LOG_DEBUG, "Setting up client socket");
-  if (setup_client_socket(ecdhconn->ip, ecdhconn->port, &ecdhconn->socket_fd))
-  {
-    kmyth_log(LOG_ERR, "Failed to setup client socket.");
-    error(ecdhconn);
-  }
-}
-
-void load_private_key(ECDHServer * ecdhconn)
+  pthread_mutex_t lock;
+  pthread_cond_t not_full;
+  EVP_PKEY **keypairs;
+  uint8_t suite;
+  size_t capacity;
+  size_t count;
+  bool closed;
+  pthread_t thread;
+} ECDHEphemeralPool;
+
+static ECDHEphemeralPool *ephemeral_pool = NULL;
+
+static void *ephemeral_pool_refill(void *arg)
 {
-  // read server private EC signing key from file (.pem formatted)
-  BIO *priv_key_bio = BIO_new_file(ecdhconn->private_key_path, "r");
+  ECDHEphemeralPool *pool = arg;
 
-  if (priv_key_bio == NULL)
+  pthread_mutex_lock(&pool->lock);
+  while (!pool->closed)
   {
-    kmyth_log(LOG_ERR, "BIO association with file (%s) failed",
-              ecdhconn->private_key_path);
-    error(ecdhconn);
-  }
+    if (pool->count == pool->capacity)
+    {
+      pthread_cond_wait(&pool->not_full, &pool->lock);
+      continue;
+    }
 
-  ecdhconn->local_privkey = PEM_read_bio_PrivateKey(priv_key_bio, NULL, 0, NULL);
-  BIO_free(priv_key_bio);
-  priv_key_bio = NULL;
-  if (!ecdhconn->local_privkey)
-  {
-    kmyth_log(LOG_ERR, "EC Key PEM file (%s) read failed",
-              ecdhconn->private_key_path);
-    error(ecdhconn);
+    /* Generate outside the lock, so takers are never held up by it. */
+    EVP_PKEY *keypair = NULL;
+
+    pthread_mutex_unlock(&pool->lock);
+    if (create_ecdh_ephemeral_key_pair(pool->suite, &keypair) != EXIT_SUCCESS)
+    {
+      kmyth_log(LOG_ERR, "Failed to pregenerate an ephemeral key pair.");
+      EVP_PKEY_free(keypair);
+      pthread_mutex_lock(&pool->lock);
+      break;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->keypairs[pool->count++] = keypair;
   }
+  pthread_mutex_unlock(&pool->lock);
 
-  kmyth_log(LOG_DEBUG, "obtained local private signing key from file");
+  return NULL;
 }
 
-void load_public_key(ECDHServer * ecdhconn)
+static void ephemeral_pool_start(int size, uint8_t suite)
 {
-  // read remote certificate (X509) from file (.pem formatted)
-  X509 *client_cert = NULL;
+  ECDHEphemeralPool *pool = NULL;
 
-  BIO *pub_cert_bio = BIO_new_file(ecdhconn->public_cert_path, "r");
-
-  if (pub_cert_bio == NULL)
+  if (size <= 0)
   {
-    kmyth_log(LOG_ERR, "BIO association with file (%s) failed",
-              ecdhconn->public_cert_path);
-    error(ecdhconn);
+    return;
   }
 
-  client_cert = PEM_read_bio_X509(pub_cert_bio, NULL, 0, NULL);
-  BIO_free(pub_cert_bio);
-  pub_cert_bio = NULL;
-  if (!client_cert)
+  pool = calloc(1, sizeof(ECDHEphemeralPool));
+  if (pool != NULL)
   {
-    kmyth_log(LOG_ERR, "EC Certificate PEM file (%s) read failed",
-              ecdhconn->public_cert_path);
-    error(ecdhconn);
+    pool->keypairs = calloc((size_t) size, sizeof(EVP_PKEY *));
   }
-  kmyth_log(LOG_DEBUG, "obtained remote certificate from file");
+  if (pool == NULL || pool->keypairs == NULL)
+  {
+    kmyth_log(LOG_WARNING, "Failed to allocate the ephemeral key pool.");
+    free(pool);
+    return;
+  }
+  pool->capacity = (size_t) size;
+  pool->suite = suite;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->not_full, NULL);
 
-  ecdhconn->remote_pubkey = X509_get_pubkey(client_cert);
-  X509_free(client_cert);
-  client_cert = NULL;
-  if (ecdhconn->remote_pubkey == NULL)
+  if (pthread_create(&pool->thread, NULL, ephemeral_pool_refill, pool))
   {
-    kmyth_log(LOG_ERR, "extracting public key from remote certificate failed");
-    error(ecdhconn);
+    kmyth_log(LOG_WARNING, "Failed to start the ephemeral key pool thread.");
+    pthread_cond_destroy(&pool->not_full);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->keypairs);
+    free(pool);
+    return;
   }
-  kmyth_log(LOG_DEBUG, "extracted public key from remote certificate");
+
+  kmyth_log(LOG_DEBUG, "Pregenerating up to %d ephemeral key pairs.", size);
+  ephemeral_pool = pool;
 }
 
-void make_ephemeral_keypair(ECDHServer * ecdhconn)
+static EVP_PKEY *ephemeral_pool_take(uint8_t suite)
 {
-  // create local ephemeral contribution (public/private key pair)
-  int ret = create_ecdh_ephemeral_key_pair(KMYTH_EC_NID,
-                                           &ecdhconn->local_ephemeral_keypair);
+  ECDHEphemeralPool *pool = ephemeral_pool;
+  EVP_PKEY *keypair = NULL;
 
-  if (ret != EXIT_SUCCESS)
+  if (pool == NULL || pool->suite != suite)
   {
-    kmyth_log(LOG_ERR, "creation of local ephemeral key pair failed");
-    error(ecdhconn);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->count > 0)
+  {
+    keypair = pool->keypairs[--pool->count];
+    pool->keypairs[pool->count] = NULL;
+    pthread_cond_signal(&pool->not_full);
   }
-  kmyth_log(LOG_DEBUG, "created local ephemeral EC key pair");
+  pthread_mutex_unlock(&pool->lock);
+
+  return keypair;
 }
 
-void recv_ephemeral_public(ECDHServer * ecdhconn)
+static void ephemeral_pool_stop(void)
 {
-  unsigned char *remote_pub_sig = NULL;
-  unsigned int remote_pub_sig_len = 0;
-  int ret;
+  ECDHEphemeralPool *pool = ephemeral_pool;
 
-  kmyth_log(LOG_DEBUG, "Receiving ephemeral public key.");
-  ecdh_recv_data(ecdhconn, &ecdhconn->remote_ephemeral_pubkey_len,
-           sizeof(ecdhconn->remote_ephemeral_pubkey_len));
-  if (ecdhconn->remote_ephemeral_pubkey_len > ECDH_MAX_MSG_SIZE)
+  if (pool == NULL)
   {
-    kmyth_log(LOG_ERR, "Received invalid public key size.");
-    error(ecdhconn);
+    return;
   }
-  ecdhconn->remote_ephemeral_pubkey =
-    calloc(ecdhconn->remote_ephemeral_pubkey_len, sizeof(unsigned char));
-  ecdh_recv_data(ecdhconn, ecdhconn->remote_ephemeral_pubkey,
-           ecdhconn->remote_ephemeral_pubkey_len);
+  ephemeral_pool = NULL;
 
-  kmyth_log(LOG_DEBUG, "Receiving ephemeral public key signature.");
-  ecdh_recv_data(ecdhconn, &remote_pub_sig_len, sizeof(remote_pub_sig_len));
-  if (remote_pub_sig_len > ECDH_MAX_MSG_SIZE)
+  pthread_mutex_lock(&pool->lock);
+  pool->closed = true;
+  pthread_cond_signal(&pool->not_full);
+  pthread_mutex_unlock(&pool->lock);
+  pthread_join(pool->thread, NULL);
+
+  /* Unused key pairs were never sent anywhere, but are still secrets. */
+  for (size_t i = 0; i < pool->count; i++)
   {
-    kmyth_log(LOG_ERR, "Received invalid public key signature size.");
-    error(ecdhconn);
+    EVP_PKEY_free(pool->keypairs[i]);
   }
-  remote_pub_sig = calloc(remote_pub_sig_len, sizeof(unsigned char));
-  ecdh_recv_data(ecdhconn, remote_pub_sig, remote_pub_sig_len);
+  pthread_cond_destroy(&pool->not_full);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->keypairs);
+  free(pool);
+}
 
-  // check signature on received ephemeral contribution from remote
-  ret = verify_buffer(ecdhconn->remote_pubkey,
-                      ecdhconn->remote_ephemeral_pubkey,
-                      ecdhconn->remote_ephemeral_pubkey_len, remote_pub_sig,
-                      remote_pub_sig_len);
-  kmyth_clear_and_free(remote_pub_sig, remote_pub_sig_len);
-  remote_pub_sig = NULL;
-  if (ret != EXIT_SUCCESS)
+/*
+ * Worker pool server mode: the main thread accepts connections and waits
+ * on them in an epoll set, handing each one to a worker thread only once
+ * the client's first message has arrived, so that idle clients never tie
+ * up a worker. The long-term keys are loaded once and shared by all of
+ * the workers.
+ */
+typedef struct ECDHServerPool
+{
+  ECDHServer *server;
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  pthread_cond_t not_full;
+  int queue[POOL_QUEUE_SIZE];
+  size_t head;
+  size_t count;
+  bool closed;
+  int served;
+  int failed;
+} ECDHServerPool;
+
+static void pool_push(ECDHServerPool * pool, int socket_fd)
+{
+  pthread_mutex_lock(&pool->lock);
+  while (pool->count == POOL_QUEUE_SIZE)
   {
-    kmyth_log(LOG_ERR, "signature of ECDH remote 'public key' invalid");
-    error(ecdhconn);
+    pthread_cond_wait(&pool->not_full, &pool->lock);
   }
-  kmyth_log(LOG_DEBUG, "validated signature on ECDH remote 'public key'");
+  pool->queue[(pool->head + pool->count) % POOL_QUEUE_SIZE] = socket_fd;
+  pool->count++;
+  pthread_cond_signal(&pool->ready);
+  pthread_mutex_unlock(&pool->lock);
 }
 
-void send_ephemeral_public(ECDHServer * ecdhconn)
+static int pool_pop(ECDHServerPool * pool, int *socket_fd)
 {
-  unsigned char *local_pub = NULL, *local_pub_sig = NULL;
-  size_t local_pub_len = 0;
-  unsigned int local_pub_sig_len = 0;
-  int ret;
-
-  ret = create_ecdh_ephemeral_public(ecdhconn->local_ephemeral_keypair,
-                                     &local_pub, &local_pub_len);
-  if (ret != EXIT_SUCCESS)
+  pthread_mutex_lock(&pool->lock);
+  while (pool->count == 0 && !pool->closed)
   {
-    kmyth_log(LOG_ERR, "creation of local epehemeral 'public key' failed");
-    error(ecdhconn);
+    pthread_cond_wait(&pool->ready, &pool->lock);
   }
-  kmyth_log(LOG_DEBUG, "created ephemeral local 'public key' octet string");
-
-  // sign local ephemeral contribution
-  ret = sign_buffer(ecdhconn->local_privkey, local_pub, local_pub_len,
-                    &local_pub_sig, &local_pub_sig_len);
-  if (ret != EXIT_SUCCESS)
+  if (pool->count == 0)
   {
-    kmyth_log(LOG_ERR, "server EC ephemeral 'public key' signature failed");
-    kmyth_clear_and_free(local_pub, local_pub_len);
-    error(ecdhconn);
+    /* Closed, and every queued connection has been taken. */
+    pthread_mutex_unlock(&pool->lock);
+    return EXIT_FAILURE;
   }
-  kmyth_log(LOG_DEBUG, "signed local ephemeral ECDH 'public key'");
+  *socket_fd = pool->queue[pool->head];
+  pool->head = (pool->head + 1) % POOL_QUEUE_SIZE;
+  pool->count--;
+  pthread_cond_signal(&pool->not_full);
+  pthread_mutex_unlock(&pool->lock);
 
-  kmyth_log(LOG_DEBUG, "Sending ephemeral public key.");
-  ecdh_send_data(ecdhconn, &local_pub_len, sizeof(local_pub_len));
-  ecdh_send_data(ecdhconn, local_pub, local_pub_len);
-  kmyth_log(LOG_DEBUG, "Sending ephemeral public key signature.");
-  ecdh_send_data(ecdhconn, &local_pub_sig_len, sizeof(local_pub_sig_len));
-  ecdh_send_data(ecdhconn, local_pub_sig, local_pub_sig_len);
+  return EXIT_SUCCESS;
+}
 
-  kmyth_clear_and_free(local_pub, local_pub_len);
-  kmyth_clear_and_free(local_pub_sig, local_pub_sig_len);
+static void pool_close(ECDHServerPool * pool)
+{
+  pthread_mutex_lock(&pool->lock);
+  pool->closed = true;
+  pthread_cond_broadcast(&pool->ready);
+  pthread_mutex_unlock(&pool->lock);
 }
 
-void get_session_key(ECDHServer * ecdhconn)
+static int serve_connection(ECDHServer * conn)
 {
-  EC_POINT *remote_ephemeral_pub_pt = NULL;
-  unsigned char *session_secret = NULL;
-  size_t session_secret_len = 0;
-  int ret;
+  jmp_buf conn_error;
 
-  // re-construct EVP_PKEY for client's public contribution
-  ret = reconstruct_ecdh_ephemeral_public_point(KMYTH_EC_NID,
-                                                ecdhconn->remote_ephemeral_pubkey,
-                                                ecdhconn->remote_ephemeral_pubkey_len,
-                                                &remote_ephemeral_pub_pt);
-  if (ret != EXIT_SUCCESS)
+  if (setjmp(conn_error))
   {
-    kmyth_log(LOG_ERR, "remote ephemeral public point reconstruction failed");
-    error(ecdhconn);
+    /* error() has already released the connection state. */
+    conn->conn_error = NULL;
+    return EXIT_FAILURE;
   }
-  kmyth_log(LOG_DEBUG, "reconstructed remote 'public key' as EC_POINT");
+  conn->conn_error = &conn_error;
 
-  // generate shared secret result for ECDH key agreement (server side)
-  ret = compute_ecdh_shared_secret(ecdhconn->local_ephemeral_keypair,
-                                   remote_ephemeral_pub_pt,
-                                   &session_secret, &session_secret_len);
-  EC_POINT_clear_free(remote_ephemeral_pub_pt);
-  remote_ephemeral_pub_pt = NULL;
-  if (ret != EXIT_SUCCESS)
-  {
-    kmyth_log(LOG_ERR, "server computation of 'session secret' result failed");
+  recv_ephemeral_public(conn);
+  make_ephemeral_keypair(conn);
+  send_ephemeral_public(conn);
+
+  get_session_key(conn);
+
+  send_operational_keys(conn);
+
+  conn->conn_error = NULL;
+  cleanup_connection(conn);
+
+  return EXIT_SUCCESS;
+}
+
+static void *pool_worker(void *arg)
+{
+  ECDHServerPool *pool = arg;
+  int socket_fd = UNSET_FD;
+
+  while (pool_pop(pool, &socket_fd) == EXIT_SUCCESS)
+  {
+    /* The copy shares the long-term keys, which the workers only read. */
+    ECDHServer conn = *pool->server;
+    int ret;
+
+    conn.socket_fd = socket_fd;
+    ret = serve_connection(&conn);
+
+    pthread_mutex_lock(&pool->lock);
+    if (ret == EXIT_SUCCESS)
+    {
+      pool->served++;
+    }
+    else
+    {
+      pool->failed++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  return NULL;
+}
+
+static int pool_accept(ECDHServer * ecdhconn, int listen_fd, int epoll_fd,
+                       int *numconn, int *pending, struct timespec *start)
+{
+  struct epoll_event event;
+
+  /* Drain the accept queue: the listening socket is non-blocking. */
+  while (ecdhconn->maxconn <= 0 || *numconn < ecdhconn->maxconn)
+  {
+    int socket_fd = accept(listen_fd, NULL, NULL);
+
+    if (socket_fd == -1)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+      {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+      {
+        /* e.g. EMFILE: keep serving, and retry on the next wakeup. */
+        kmyth_log(LOG_WARNING, "Socket accept failed: %s", strerror(errno));
+      }
+      return EXIT_SUCCESS;
+    }
+
+    secure_memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.fd = socket_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, socket_fd, &event))
+    {
+      kmyth_log(LOG_ERR, "Failed to add a connection to the epoll set.");
+      close(socket_fd);
+      return EXIT_FAILURE;
+    }
+
+    if (*numconn == 0)
+    {
+      clock_gettime(CLOCK_MONOTONIC, start);
+    }
+    (*numconn)++;
+    (*pending)++;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+void run_server_pool(ECDHServer * ecdhconn)
+{
+  ECDHServerPool pool;
+  pthread_t *threads = NULL;
+  struct epoll_event event;
+  struct epoll_event events[POOL_MAX_EVENTS];
+  struct timespec start;
+  int listen_fd = UNSET_FD;
+  int epoll_fd = UNSET_FD;
+  int numconn = 0;
+  int pending = 0;
+  int started = 0;
+  int ret = EXIT_SUCCESS;
+
+  secure_memset(&pool, 0, sizeof(pool));
+  pool.server = ecdhconn;
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.ready, NULL);
+  pthread_cond_init(&pool.not_full, NULL);
+
+  /* A client that goes away mid-exchange must not kill the whole server. */
+  signal(SIGPIPE, SIG_IGN);
+
+  listen_fd = listen_server_socket(ecdhconn);
+  if (fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK))
+  {
+    kmyth_log(LOG_ERR, "Failed to make the server socket non-blocking.");
+    close(listen_fd);
+    error(ecdhconn);
+  }
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  secure_memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = listen_fd;
+  if (epoll_fd == -1
+      || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event))
+  {
+    kmyth_log(LOG_ERR, "Failed to set up the epoll set.");
+    if (epoll_fd != -1)
+    {
+      close(epoll_fd);
+    }
+    close(listen_fd);
+    error(ecdhconn);
+  }
+
+  ephemeral_pool_start(ecdhconn->ephemeral_pool_size,
+                       ecdhconn->ecdh_suite ? ecdhconn->ecdh_suite :
+                       KMYTH_ECDH_SUITE);
+
+  threads = calloc(ecdhconn->workers, sizeof(pthread_t));
+  while (threads != NULL && started < ecdhconn->workers
+         && pthread_create(&threads[started], NULL, pool_worker, &pool) == 0)
+  {
+    started++;
+  }
+  if (started < ecdhconn->workers)
+  {
+    kmyth_log(LOG_ERR, "Failed to start the worker threads.");
+    ret = EXIT_FAILURE;
+  }
+  else
+  {
+    kmyth_log(LOG_DEBUG, "Serving connections with %d worker threads.",
+              started);
+  }
+
+  while (ret == EXIT_SUCCESS
+         && (listen_fd != UNSET_FD || pending > 0))
+  {
+    int nevents = epoll_wait(epoll_fd, events, POOL_MAX_EVENTS, -1);
+
+    if (nevents == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      kmyth_log(LOG_ERR, "epoll_wait failed: %s", strerror(errno));
+      ret = EXIT_FAILURE;
+      break;
+    }
+
+    for (int i = 0; i < nevents && ret == EXIT_SUCCESS; i++)
+    {
+      int fd = events[i].data.fd;
+
+      if (fd == listen_fd)
+      {
+        ret = pool_accept(ecdhconn, listen_fd, epoll_fd,
+                          &numconn, &pending, &start);
+        if (ecdhconn->maxconn > 0 && numconn >= ecdhconn->maxconn)
+        {
+          /* Stop accepting, and finish the connections already open. */
+          close(listen_fd);
+          listen_fd = UNSET_FD;
+        }
+        continue;
+      }
+
+      /* The client's first message (or a hangup) is waiting. */
+      epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+      pending--;
+      pool_push(&pool, fd);
+    }
+  }
+
+  pool_close(&pool);
+  for (int i = 0; i < started; i++)
+  {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+  ephemeral_pool_stop();
+
+  if (numconn > 0)
+  {
+    log_connection_rate(pool.served, &start);
+  }
+  if (pool.failed > 0)
+  {
+    kmyth_log(LOG_WARNING, "%d connections failed.", pool.failed);
+  }
+
+  if (listen_fd != UNSET_FD)
+  {
+    close(listen_fd);
+  }
+  close(epoll_fd);
+  pthread_cond_destroy(&pool.not_full);
+  pthread_cond_destroy(&pool.ready);
+  pthread_mutex_destroy(&pool.lock);
+
+  if (ret != EXIT_SUCCESS)
+  {
+    error(ecdhconn);
+  }
+}
+
+void create_client_socket(ECDHServer * ecdhconn)
+{
+  kmyth_log(LOG_DEBUG, "Setting up client socket");
+  if (setup_client_socket(ecdhconn->ip, ecdhconn->port, &ecdhconn->socket_fd))
+  {
+    kmyth_log(LOG_ERR, "Failed to setup client socket.");
+    error(ecdhconn);
+  }
+}
+
+void load_private_key(ECDHServer * ecdhconn)
+{
+  // read server private EC signing key from file (.pem formatted)
+  BIO *priv_key_bio = BIO_new_file(ecdhconn->private_key_path, "r");
+
+  if (priv_key_bio == NULL)
+  {
+    kmyth_log(LOG_ERR, "BIO association with file (%s) failed",
+              ecdhconn->private_key_path);
+    error(ecdhconn);
+  }
+
+  ecdhconn->local_privkey = PEM_read_bio_PrivateKey(priv_key_bio, NULL, 0, NULL);
+  BIO_free(priv_key_bio);
+  priv_key_bio = NULL;
+  if (!ecdhconn->local_privkey)
+  {
+    kmyth_log(LOG_ERR, "EC Key PEM file (%s) read failed",
+              ecdhconn->private_key_path);
+    error(ecdhconn);
+  }
+
+  kmyth_log(LOG_DEBUG, "obtained local private signing key from file");
+}
+
+void load_public_key(ECDHServer * ecdhconn)
+{
+  // read remote certificate (X509) from file (.pem formatted)
+  X509 *client_cert = NULL;
+
+  BIO *pub_cert_bio = BIO_new_file(ecdhconn->public_cert_path, "r");
+
+  if (pub_cert_bio == NULL)
+  {
+    kmyth_log(LOG_ERR, "BIO association with file (%s) failed",
+              ecdhconn->public_cert_path);
+    error(ecdhconn);
+  }
+
+  client_cert = PEM_read_bio_X509(pub_cert_bio, NULL, 0, NULL);
+  BIO_free(pub_cert_bio);
+  pub_cert_bio = NULL;
+  if (!client_cert)
+  {
+    kmyth_log(LOG_ERR, "EC Certificate PEM file (%s) read failed",
+              ecdhconn->public_cert_path);
+    error(ecdhconn);
+  }
+  kmyth_log(LOG_DEBUG, "obtained remote certificate from file");
+
+  ecdhconn->remote_pubkey = X509_get_pubkey(client_cert);
+  X509_free(client_cert);
+  client_cert = NULL;
+  if (ecdhconn->remote_pubkey == NULL)
+  {
+    kmyth_log(LOG_ERR, "extracting public key from remote certificate failed");
+    error(ecdhconn);
+  }
+  kmyth_log(LOG_DEBUG, "extracted public key from remote certificate");
+}
+
+void make_ephemeral_keypair(ECDHServer * ecdhconn)
+{
+  // answer in the suite of the remote contribution, if it has arrived,
+  // otherwise propose the configured one
+  uint8_t suite = ecdhconn->ecdh_suite ? ecdhconn->ecdh_suite :
+    KMYTH_ECDH_SUITE;
+
+  if (ecdhconn->remote_ephemeral_pubkey != NULL)
+  {
+    suite = ecdhconn->remote_ephemeral_pubkey[0];
+  }
+
+  // take a pregenerated local ephemeral contribution, if there is one
+  ecdhconn->local_ephemeral_keypair = ephemeral_pool_take(suite);
+  if (ecdhconn->local_ephemeral_keypair != NULL)
+  {
+    kmyth_log(LOG_DEBUG, "took a pregenerated local ephemeral key pair");
+    return;
+  }
+
+  // create local ephemeral contribution (public/private key pair)
+  int ret = create_ecdh_ephemeral_key_pair(suite,
+                                           &ecdhconn->local_ephemeral_keypair);
+
+  if (ret != EXIT_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "creation of local ephemeral key pair failed");
+    error(ecdhconn);
+  }
+  kmyth_log(LOG_DEBUG, "created local ephemeral key pair");
+}
+
+void accept_ephemeral_public(ECDHServer * ecdhconn,
+                             unsigned char *pub, size_t pub_len,
+                             unsigned char *sig, unsigned int sig_len)
+{
+  int ret;
+
+  if (pub_len > ECDH_MAX_MSG_SIZE || sig_len > ECDH_MAX_MSG_SIZE)
+  {
+    kmyth_log(LOG_ERR, "Received invalid public key or signature size.");
+    error(ecdhconn);
+  }
+
+  // check signature on received ephemeral contribution from remote
+  ret = verify_buffer(ecdhconn->remote_pubkey, pub, pub_len, sig, sig_len);
+  if (ret != EXIT_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "signature of ECDH remote 'public key' invalid");
+    error(ecdhconn);
+  }
+  kmyth_log(LOG_DEBUG, "validated signature on ECDH remote 'public key'");
+
+  // the initiator picks the suite: a responder accepts it if it may, an
+  // initiator checks the responder answered in its own
+  uint8_t suite = 0;
+  uint8_t local_suite = 0;
+
+  ret = get_ecdh_ephemeral_public_suite(pub, pub_len, &suite);
+  if (ret != EXIT_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "ECDH remote 'public key' of an unknown suite");
+    error(ecdhconn);
+  }
+  if (ecdhconn->local_ephemeral_keypair != NULL)
+  {
+    ret = get_ecdh_ephemeral_key_suite(ecdhconn->local_ephemeral_keypair,
+                                       &local_suite);
+    if (ret != EXIT_SUCCESS || suite != local_suite)
+    {
+      kmyth_log(LOG_ERR, "ECDH remote 'public key' of another suite");
+      error(ecdhconn);
+    }
+  }
+  else if (ecdhconn->ecdh_suite != 0 && suite != ecdhconn->ecdh_suite)
+  {
+    kmyth_log(LOG_ERR, "ECDH remote 'public key' of a refused suite");
+    error(ecdhconn);
+  }
+
+  ecdhconn->remote_ephemeral_pubkey = calloc(pub_len, sizeof(unsigned char));
+  if (ecdhconn->remote_ephemeral_pubkey == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to allocate the remote public key buffer.");
+    error(ecdhconn);
+  }
+  memcpy(ecdhconn->remote_ephemeral_pubkey, pub, pub_len);
+  ecdhconn->remote_ephemeral_pubkey_len = pub_len;
+}
+
+void recv_ephemeral_public(ECDHServer * ecdhconn)
+{
+  unsigned char *remote_pub = NULL;
+  size_t remote_pub_len = 0;
+  unsigned char *remote_pub_sig = NULL;
+  unsigned int remote_pub_sig_len = 0;
+
+  kmyth_log(LOG_DEBUG, "Receiving ephemeral public key.");
+  ecdh_recv_data(ecdhconn, &remote_pub_len, sizeof(remote_pub_len));
+  if (remote_pub_len > ECDH_MAX_MSG_SIZE)
+  {
+    kmyth_log(LOG_ERR, "Received invalid public key size.");
+    error(ecdhconn);
+  }
+  remote_pub = calloc(remote_pub_len, sizeof(unsigned char));
+  ecdh_recv_data(ecdhconn, remote_pub, remote_pub_len);
+
+  kmyth_log(LOG_DEBUG, "Receiving ephemeral public key signature.");
+  ecdh_recv_data(ecdhconn, &remote_pub_sig_len, sizeof(remote_pub_sig_len));
+  if (remote_pub_sig_len > ECDH_MAX_MSG_SIZE)
+  {
+    kmyth_log(LOG_ERR, "Received invalid public key signature size.");
+    kmyth_clear_and_free(remote_pub, remote_pub_len);
+    error(ecdhconn);
+  }
+  remote_pub_sig = calloc(remote_pub_sig_len, sizeof(unsigned char));
+  ecdh_recv_data(ecdhconn, remote_pub_sig, remote_pub_sig_len);
+
+  accept_ephemeral_public(ecdhconn, remote_pub, remote_pub_len,
+                          remote_pub_sig, remote_pub_sig_len);
+
+  kmyth_clear_and_free(remote_pub, remote_pub_len);
+  kmyth_clear_and_free(remote_pub_sig, remote_pub_sig_len);
+}
+
+void build_ephemeral_public(ECDHServer * ecdhconn,
+                            unsigned char **msg, size_t *msg_len)
+{
+  unsigned char *local_pub = NULL, *local_pub_sig = NULL;
+  size_t local_pub_len = 0;
+  unsigned int local_pub_sig_len = 0;
+  unsigned char *p = NULL;
+  int ret;
+
+  ret = create_ecdh_ephemeral_public(ecdhconn->local_ephemeral_keypair,
+                                     &local_pub, &local_pub_len);
+  if (ret != EXIT_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "creation of local epehemeral 'public key' failed");
+    error(ecdhconn);
+  }
+  kmyth_log(LOG_DEBUG, "created ephemeral local 'public key' octet string");
+
+  // sign local ephemeral contribution
+  ret = sign_buffer(ecdhconn->local_privkey, local_pub, local_pub_len,
+                    &local_pub_sig, &local_pub_sig_len);
+  if (ret != EXIT_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "server EC ephemeral 'public key' signature failed");
+    kmyth_clear_and_free(local_pub, local_pub_len);
+    error(ecdhconn);
+  }
+  kmyth_log(LOG_DEBUG, "signed local ephemeral ECDH 'public key'");
+
+  // key length || key || signature length || signature
+  *msg_len = sizeof(local_pub_len) + local_pub_len
+    + sizeof(local_pub_sig_len) + local_pub_sig_len;
+  *msg = calloc(*msg_len, sizeof(unsigned char));
+  if (*msg == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to allocate the public key message.");
+    kmyth_clear_and_free(local_pub, local_pub_len);
+    kmyth_clear_and_free(local_pub_sig, local_pub_sig_len);
+    error(ecdhconn);
+  }
+  p = *msg;
+  memcpy(p, &local_pub_len, sizeof(local_pub_len));
+  p += sizeof(local_pub_len);
+  memcpy(p, local_pub, local_pub_len);
+  p += local_pub_len;
+  memcpy(p, &local_pub_sig_len, sizeof(local_pub_sig_len));
+  p += sizeof(local_pub_sig_len);
+  memcpy(p, local_pub_sig, local_pub_sig_len);
+
+  kmyth_clear_and_free(local_pub, local_pub_len);
+  kmyth_clear_and_free(local_pub_sig, local_pub_sig_len);
+}
+
+void send_ephemeral_public(ECDHServer * ecdhconn)
+{
+  unsigned char *msg = NULL;
+  size_t msg_len = 0;
+
+  build_ephemeral_public(ecdhconn, &msg, &msg_len);
+
+  kmyth_log(LOG_DEBUG, "Sending signed ephemeral public key.");
+  ecdh_send_data(ecdhconn, msg, msg_len);
+
+  kmyth_clear_and_free(msg, msg_len);
+}
+
+void get_session_key(ECDHServer * ecdhconn)
+{
+  EVP_PKEY *remote_ephemeral_pubkey = NULL;
+  unsigned char *session_secret = NULL;
+  size_t session_secret_len = 0;
+  int ret;
+
+  // re-construct EVP_PKEY for client's public contribution
+  ret = reconstruct_ecdh_ephemeral_public(ecdhconn->remote_ephemeral_pubkey,
+                                          ecdhconn->remote_ephemeral_pubkey_len,
+                                          &remote_ephemeral_pubkey);
+  if (ret != EXIT_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "remote ephemeral public key reconstruction failed");
+    error(ecdhconn);
+  }
+  kmyth_log(LOG_DEBUG, "reconstructed remote 'public key' as EVP_PKEY");
+
+  // generate shared secret result for ECDH key agreement (server side)
+  ret = compute_ecdh_shared_secret(ecdhconn->local_ephemeral_keypair,
+                                   remote_ephemeral_pubkey,
+                                   &session_secret, &session_secret_len);
+  EVP_PKEY_free(remote_ephemeral_pubkey);
+  remote_ephemeral_pubkey = NULL;
+  if (ret != EXIT_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "server computation of 'session secret' result failed");
     error(ecdhconn);
   }
   kmyth_log(LOG_DEBUG, "shared secret = 0x%02X%02X...%02X%02X (%d bytes)",
@@ -554,7 +1309,6 @@ int request_key(ECDHServer *ecdhconn,
   KMIP kmip_context = { 0 };
   kmip_init(&kmip_context, NULL, 0, KMIP_2_0);
 
-  unsigned char *key_request = NULL;
   size_t key_request_len = 0;
   unsigned char *response = NULL;
   size_t response_len = 0;
@@ -562,17 +1316,17 @@ int request_key(ECDHServer *ecdhconn,
   size_t received_key_id_len = 0;
 
   /* Build and send request. */
-  int result = build_kmip_get_request(&kmip_context,
-                                      key_id, key_id_len,
-                                      &key_request, &key_request_len);
+  int result = build_kmip_get_batch_request_into(&kmip_context,
+                                                 &key_id, &key_id_len, 1,
+                                                 &ecdhconn->kmip_buffer,
+                                                 &key_request_len);
   if (result)
   {
     kmyth_log(LOG_ERR, "Failed to build the KMIP Get request.");
     kmip_destroy(&kmip_context);
     return EXIT_FAILURE;
   }
-  ecdh_encrypt_send(ecdhconn, key_request, key_request_len);
-  kmyth_clear_and_free(key_request, key_request_len);
+  ecdh_encrypt_send(ecdhconn, ecdhconn->kmip_buffer.data, key_request_len);
 
   /* Receive and parse response. */
   ecdh_recv_decrypt(ecdhconn, &response, &response_len);
@@ -597,15 +1351,54 @@ int request_key(ECDHServer *ecdhconn,
   return EXIT_SUCCESS;
 }
 
+static int get_upstream_keys(ECDHServer * ecdhconn,
+                             unsigned char **key_ids, size_t *key_id_lens,
+                             size_t key_count,
+                             unsigned char **keys, size_t *key_lens)
+{
+  char *ids[KMIP_GET_BATCH_MAX_ITEMS] = { NULL };
+  int ret = EXIT_SUCCESS;
+
+  /* The pool takes the key IDs as strings. */
+  for (size_t i = 0; i < key_count && ret == EXIT_SUCCESS; i++)
+  {
+    ids[i] = strndup((char *) key_ids[i], key_id_lens[i]);
+    if (ids[i] == NULL || strlen(ids[i]) != key_id_lens[i])
+    {
+      kmyth_log(LOG_ERR, "Invalid key ID in the KMIP Get request.");
+      ret = EXIT_FAILURE;
+    }
+  }
+
+  if (ret == EXIT_SUCCESS
+      && kmip_pool_get_keys(ecdhconn->upstream_pool, ids, key_count,
+                            keys, key_lens))
+  {
+    kmyth_log(LOG_ERR, "Failed to retrieve the keys from the KMIP server.");
+    ret = EXIT_FAILURE;
+  }
+
+  for (size_t i = 0; i < key_count; i++)
+  {
+    free(ids[i]);
+  }
+
+  return ret;
+}
+
 int handle_key_request(ECDHServer *ecdhconn,
                       unsigned char *key, size_t key_len)
 {
   int ret;
   unsigned char *request = NULL;
   size_t request_len = 0;
-  unsigned char *key_id = NULL;
-  size_t key_id_len = 0;
-  unsigned char *response = NULL;
+  unsigned char *key_ids[KMIP_GET_BATCH_MAX_ITEMS] = { NULL };
+  size_t key_id_lens[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  unsigned char *item_ids[KMIP_GET_BATCH_MAX_ITEMS] = { NULL };
+  size_t item_id_lens[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  unsigned char *keys[KMIP_GET_BATCH_MAX_ITEMS] = { NULL };
+  size_t key_lens[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  size_t key_count = 0;
   size_t response_len = 0;
 
   KMIP kmip_context = { 0 };
@@ -622,10 +1415,11 @@ int handle_key_request(ECDHServer *ecdhconn,
     return EXIT_FAILURE;
   }
 
-  // Assuming we received a Get request.
-  ret = parse_kmip_get_request(&kmip_context,
-                               request, request_len,
-                               &key_id, &key_id_len);
+  // Assuming we received a Get request, for one or more keys.
+  ret = parse_kmip_get_batch_request(&kmip_context,
+                                     request, request_len,
+                                     key_ids, key_id_lens,
+                                     item_ids, item_id_lens, &key_count);
   kmyth_clear_and_free(request, request_len);
   request = NULL;
   if (ret)
@@ -634,16 +1428,91 @@ int handle_key_request(ECDHServer *ecdhconn,
     kmip_destroy(&kmip_context);
     return EXIT_FAILURE;
   }
-  kmyth_log(LOG_DEBUG, "Received a KMIP Get request for key ID: %.*s",
-            key_id_len, key_id);
+  for (size_t i = 0; i < key_count; i++)
+  {
+    kmyth_log(LOG_DEBUG, "Received a KMIP Get request for key ID: %.*s",
+              key_id_lens[i], key_ids[i]);
+    keys[i] = key;
+    key_lens[i] = key_len;
+  }
+
+  /* With a key store, serve the keys it holds instead. */
+  unsigned char stored_keys[KMIP_GET_BATCH_MAX_ITEMS][KEY_STORE_MAX_KEY_LEN];
+  bool stored = (ecdhconn->key_store != NULL);
+
+  for (size_t i = 0; stored && i < key_count; i++)
+  {
+    keys[i] = stored_keys[i];
+    if (key_store_get(ecdhconn->key_store, key_ids[i], key_id_lens[i],
+                      keys[i], &key_lens[i]))
+    {
+      kmyth_log(LOG_ERR, "Key ID %.*s is not in the key store.",
+                key_id_lens[i], key_ids[i]);
+      kmyth_clear(stored_keys, sizeof(stored_keys));
+      for (size_t j = 0; j < key_count; j++)
+      {
+        kmyth_clear_and_free(key_ids[j], key_id_lens[j]);
+        kmyth_clear_and_free(item_ids[j], item_id_lens[j]);
+      }
+      kmip_destroy(&kmip_context);
+      return EXIT_FAILURE;
+    }
+  }
+
+  /* With an upstream KMIP server, serve the keys it holds instead. */
+  bool upstream = (ecdhconn->upstream_pool != NULL);
+
+  if (upstream
+      && get_upstream_keys(ecdhconn, key_ids, key_id_lens, key_count,
+                           keys, key_lens))
+  {
+    for (size_t i = 0; i < key_count; i++)
+    {
+      kmyth_clear_and_free(key_ids[i], key_id_lens[i]);
+      kmyth_clear_and_free(item_ids[i], item_id_lens[i]);
+    }
+    kmip_destroy(&kmip_context);
+    return EXIT_FAILURE;
+  }
 
-  /* Build and send response. */
-  ret = build_kmip_get_response(&kmip_context,
-                                key_id, key_id_len,
-                                key, key_len,
-                                &response, &response_len);
-  kmyth_clear_and_free(key_id, key_id_len);
-  key_id = NULL;
+  /* Build and send response, answering the requests in reverse order. */
+  /* The batch item IDs let the client match them up regardless. */
+  for (size_t i = 0; i < key_count / 2; i++)
+  {
+    size_t j = key_count - 1 - i;
+    unsigned char *tmp_id = key_ids[i];
+    size_t tmp_id_len = key_id_lens[i];
+    unsigned char *tmp_item_id = item_ids[i];
+    size_t tmp_item_id_len = item_id_lens[i];
+
+    key_ids[i] = key_ids[j];
+    key_id_lens[i] = key_id_lens[j];
+    item_ids[i] = item_ids[j];
+    item_id_lens[i] = item_id_lens[j];
+    key_ids[j] = tmp_id;
+    key_id_lens[j] = tmp_id_len;
+    item_ids[j] = tmp_item_id;
+    item_id_lens[j] = tmp_item_id_len;
+  }
+  ret = build_kmip_get_batch_response_into(&kmip_context,
+                                           key_ids, key_id_lens,
+                                           item_ids, item_id_lens,
+                                           keys, key_lens, key_count,
+                                           &ecdhconn->kmip_buffer,
+                                           &response_len);
+  for (size_t i = 0; i < key_count; i++)
+  {
+    kmyth_clear_and_free(key_ids[i], key_id_lens[i]);
+    kmyth_clear_and_free(item_ids[i], item_id_lens[i]);
+    if (upstream)
+    {
+      kmyth_clear_and_free(keys[i], key_lens[i]);
+    }
+  }
+  if (stored)
+  {
+    kmyth_clear(stored_keys, sizeof(stored_keys));
+  }
   kmip_destroy(&kmip_context);
   if (ret)
   {
@@ -651,14 +1520,33 @@ int handle_key_request(ECDHServer *ecdhconn,
     return EXIT_FAILURE;
   }
 
-  ecdh_encrypt_send(ecdhconn, response, response_len);
-  kmyth_clear_and_free(response, response_len);
+  ecdh_encrypt_send(ecdhconn, ecdhconn->kmip_buffer.data, response_len);
+  // the buffer is kept for the next response, without this one's keys
+  kmyth_clear(ecdhconn->kmip_buffer.data, response_len);
 
-  kmyth_log(LOG_DEBUG, "Sent the KMIP key response.");
+  kmyth_log(LOG_DEBUG, "Sent the KMIP key response (%zu keys).", key_count);
 
   return EXIT_SUCCESS;
 }
 
+bool ecdh_peer_closed(ECDHServer * ecdhconn)
+{
+  unsigned char byte;
+  ssize_t bytes_read;
+
+  /* Waits for the next message, without consuming any of it. */
+  do
+  {
+    bytes_read = recv(ecdhconn->socket_fd, &byte, 1, MSG_PEEK);
+  } while (bytes_read < 0 && errno == EINTR);
+
+  if (bytes_read < 0)
+  {
+    kmyth_log(LOG_ERR, "Failed to receive a message.");
+  }
+  return bytes_read <= 0;
+}
+
 void send_operational_key(ECDHServer * ecdhconn)
 {
   int ret;
@@ -678,6 +1566,15 @@ void send_operational_key(ECDHServer * ecdhconn)
   }
 }
 
+void send_operational_keys(ECDHServer * ecdhconn)
+{
+  /* A client may make any number of requests over one session. */
+  while (!ecdh_peer_closed(ecdhconn))
+  {
+    send_operational_key(ecdhconn);
+  }
+}
+
 void get_operational_key(ECDHServer * ecdhconn)
 {
   unsigned char *op_key = NULL;
@@ -699,25 +1596,449 @@ void get_operational_key(ECDHServer * ecdhconn)
   kmyth_clear_and_free(op_key, op_key_len);
 }
 
+void start_kmip_pool(ECDHServer * ecdhconn)
+{
+  uint8_t *client_key = NULL;
+  size_t client_key_len = 0;
+  int ret;
+
+  if (ecdhconn->kmip_ip == NULL)
+  {
+    return;
+  }
+
+  if (read_bytes_from_file(ecdhconn->kmip_key_path,
+                           &client_key, &client_key_len))
+  {
+    kmyth_log(LOG_ERR, "Failed to read the KMIP client key.");
+    error(ecdhconn);
+  }
+
+  /*
+   * One long-lived connection per worker (just one when forking, as each
+   * connection is then served by a process of its own), each made the
+   * first time it is used and kept open for the requests after it.
+   */
+  size_t pool_size = 1;
+
+  if (ecdhconn->workers > 0)
+  {
+    pool_size = (size_t) ecdhconn->workers;
+  }
+  if (pool_size > KMIP_POOL_MAX_CONNECTIONS)
+  {
+    pool_size = KMIP_POOL_MAX_CONNECTIONS;
+  }
+  ret = kmip_pool_new(client_key, client_key_len,
+                      ecdhconn->kmip_cert_path, ecdhconn->kmip_ca_path,
+                      ecdhconn->kmip_ip, ecdhconn->kmip_port,
+                      pool_size, &ecdhconn->upstream_pool);
+  kmyth_clear_and_free(client_key, client_key_len);
+  if (ret)
+  {
+    kmyth_log(LOG_ERR, "Failed to set up the KMIP server connections.");
+    error(ecdhconn);
+  }
+  kmyth_log(LOG_DEBUG, "Retrieving keys from the KMIP server at %s:%s.",
+            ecdhconn->kmip_ip, ecdhconn->kmip_port);
+}
+
+void open_key_store(ECDHServer * ecdhconn)
+{
+  if (ecdhconn->key_store_path == NULL)
+  {
+    return;
+  }
+
+  /* Mapped once, and shared by the workers (or forked processes). */
+  if (key_store_open(ecdhconn->key_store_path,
+                     ecdhconn->key_store_wrap_path, &ecdhconn->key_store))
+  {
+    kmyth_log(LOG_ERR, "Failed to open the key store.");
+    error(ecdhconn);
+  }
+}
+
 void server_main(ECDHServer * ecdhconn)
 {
+  start_kmip_pool(ecdhconn);
+  open_key_store(ecdhconn);
+
+  if (ecdhconn->workers > 0)
+  {
+    load_private_key(ecdhconn);
+    load_public_key(ecdhconn);
+
+    run_server_pool(ecdhconn);
+    return;
+  }
+
   create_server_socket(ecdhconn);
 
   load_private_key(ecdhconn);
   load_public_key(ecdhconn);
 
-  make_ephemeral_keypair(ecdhconn);
-
   recv_ephemeral_public(ecdhconn);
+  make_ephemeral_keypair(ecdhconn);
   send_ephemeral_public(ecdhconn);
 
   get_session_key(ecdhconn);
 
-  send_operational_key(ecdhconn);
+  send_operational_keys(ecdhconn);
+}
+
+/*
+ * Load generator client mode: each of a number of threads repeatedly
+ * connects, completes the key exchange and makes some key requests, until
+ * the test duration is up. Requests draw key IDs from a uniform or Zipf
+ * distribution and, given a rate, are paced to a common schedule shared by
+ * all of the threads. Handshake and key fetch latencies are collected per
+ * thread, then sorted and reported as percentiles along with throughput.
+ */
+typedef struct ECDHLoadSamples
+{
+  uint64_t *ns;
+  size_t count;
+  size_t capacity;
+} ECDHLoadSamples;
+
+typedef struct ECDHLoad
+{
+  ECDHServer *client;
+  double *zipf_cdf;
+  struct timespec start;
+  uint64_t duration_ns;
+  uint64_t next_request;
+} ECDHLoad;
+
+typedef struct ECDHLoadWorker
+{
+  ECDHLoad *load;
+  pthread_t thread;
+  uint64_t rng;
+  ECDHLoadSamples handshakes;
+  ECDHLoadSamples fetches;
+  size_t failed;
+} ECDHLoadWorker;
+
+static uint64_t load_elapsed_ns(const struct timespec *start)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) (now.tv_sec - start->tv_sec) * 1000000000ULL
+    + (uint64_t) now.tv_nsec - (uint64_t) start->tv_nsec;
+}
+
+static void load_record(ECDHLoadSamples * samples, uint64_t ns)
+{
+  if (samples->count == samples->capacity)
+  {
+    size_t capacity = samples->capacity ? 2 * samples->capacity : 1024;
+    uint64_t *ns_array = realloc(samples->ns, capacity * sizeof(uint64_t));
+
+    if (ns_array == NULL)
+    {
+      return;
+    }
+    samples->ns = ns_array;
+    samples->capacity = capacity;
+  }
+  samples->ns[samples->count++] = ns;
+}
+
+static double load_random(ECDHLoadWorker * worker)
+{
+  /* xorshift64*, one generator per thread */
+  worker->rng ^= worker->rng >> 12;
+  worker->rng ^= worker->rng << 25;
+  worker->rng ^= worker->rng >> 27;
+  return (double) ((worker->rng * 0x2545F4914F6CDD1DULL) >> 11)
+    / (double) (1ULL << 53);
+}
+
+static long load_key_id(ECDHLoadWorker * worker)
+{
+  long count = worker->load->client->load_key_ids;
+  double u = load_random(worker);
+
+  if (worker->load->zipf_cdf == NULL)
+  {
+    return 1 + (long) (u * (double) count);
+  }
+
+  /* The first ID whose cumulative probability reaches u. */
+  long lo = 0;
+  long hi = count - 1;
+
+  while (lo < hi)
+  {
+    long mid = lo + (hi - lo) / 2;
+
+    if (worker->load->zipf_cdf[mid] < u)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  return lo + 1;
+}
+
+static double *load_zipf_cdf(long count, double exponent)
+{
+  double *cdf = calloc((size_t) count, sizeof(double));
+  double sum = 0.0;
+
+  if (cdf == NULL)
+  {
+    return NULL;
+  }
+  for (long i = 0; i < count; i++)
+  {
+    sum += 1.0 / pow((double) (i + 1), exponent);
+    cdf[i] = sum;
+  }
+  for (long i = 0; i < count; i++)
+  {
+    cdf[i] /= sum;
+  }
+  return cdf;
+}
+
+/* Waits for the request's slot in the schedule (if the rate is limited). */
+static bool load_pace(ECDHLoad * load)
+{
+  uint64_t now = load_elapsed_ns(&load->start);
+
+  if (load->client->load_rate <= 0.0)
+  {
+    return now < load->duration_ns;
+  }
+
+  uint64_t ticket = __atomic_fetch_add(&load->next_request, 1,
+                                       __ATOMIC_RELAXED);
+  uint64_t due = (uint64_t) ((double) ticket * 1e9 / load->client->load_rate);
+
+  if (due >= load->duration_ns)
+  {
+    return false;
+  }
+  if (due > now)
+  {
+    struct timespec wait = {
+      .tv_sec = (time_t) ((due - now) / 1000000000ULL),
+      .tv_nsec = (long) ((due - now) % 1000000000ULL)
+    };
+    nanosleep(&wait, NULL);
+  }
+  return true;
+}
+
+static void load_connection(ECDHLoadWorker * worker, ECDHServer * conn)
+{
+  ECDHLoad *load = worker->load;
+  uint64_t start = load_elapsed_ns(&load->start);
+
+  create_client_socket(conn);
+  make_ephemeral_keypair(conn);
+  send_ephemeral_public(conn);
+  recv_ephemeral_public(conn);
+  get_session_key(conn);
+  load_record(&worker->handshakes, load_elapsed_ns(&load->start) - start);
+
+  for (int i = 0; i < load->client->load_keys_per_conn; i++)
+  {
+    char key_id[24];
+    int key_id_len;
+    unsigned char *key = NULL;
+    size_t key_len = 0;
+
+    if (!load_pace(load))
+    {
+      break;
+    }
+    if (load->client->load_key_ids > 0)
+    {
+      key_id_len = snprintf(key_id, sizeof(key_id), "%ld",
+                            load_key_id(worker));
+    }
+    else
+    {
+      key_id_len = snprintf(key_id, sizeof(key_id), "%s", KEY_ID);
+    }
+
+    start = load_elapsed_ns(&load->start);
+    if (request_key(conn, (unsigned char *) key_id, (size_t) key_id_len,
+                    &key, &key_len))
+    {
+      kmyth_log(LOG_ERR, "Failed to retrieve key %s.", key_id);
+      error(conn);
+    }
+    load_record(&worker->fetches, load_elapsed_ns(&load->start) - start);
+    kmyth_clear_and_free(key, key_len);
+  }
+}
+
+static void *load_worker(void *arg)
+{
+  ECDHLoadWorker *worker = arg;
+  ECDHLoad *load = worker->load;
+
+  while (load_elapsed_ns(&load->start) < load->duration_ns)
+  {
+    /* The copy shares the long-term keys, which the threads only read. */
+    ECDHServer conn = *load->client;
+    jmp_buf conn_error;
+
+    if (setjmp(conn_error))
+    {
+      /* error() has already released the connection state. */
+      worker->failed++;
+      continue;
+    }
+    conn.conn_error = &conn_error;
+
+    load_connection(worker, &conn);
+
+    conn.conn_error = NULL;
+    cleanup_connection(&conn);
+  }
+
+  return NULL;
+}
+
+static int load_compare_ns(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+static double load_percentile_us(const ECDHLoadSamples * samples, double p)
+{
+  /* Nearest rank, of sorted samples */
+  size_t rank = (size_t) ceil(p * (double) samples->count);
+
+  if (rank == 0)
+  {
+    rank = 1;
+  }
+  return (double) samples->ns[rank - 1] / 1000.0;
+}
+
+static void load_report(const char *name, ECDHLoadWorker * workers,
+                        int threads, bool handshakes, double seconds)
+{
+  ECDHLoadSamples all = { NULL, 0, 0 };
+
+  for (int i = 0; i < threads; i++)
+  {
+    ECDHLoadSamples *samples = handshakes
+      ? &workers[i].handshakes : &workers[i].fetches;
+
+    for (size_t j = 0; j < samples->count; j++)
+    {
+      load_record(&all, samples->ns[j]);
+    }
+  }
+
+  if (all.count == 0)
+  {
+    fprintf(stdout, "%-10s %10d\n", name, 0);
+    return;
+  }
+  qsort(all.ns, all.count, sizeof(uint64_t), load_compare_ns);
+  fprintf(stdout, "%-10s %10zu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+          name, all.count, (double) all.count / seconds,
+          load_percentile_us(&all, 0.50), load_percentile_us(&all, 0.90),
+          load_percentile_us(&all, 0.99), load_percentile_us(&all, 1.0));
+  free(all.ns);
+}
+
+void run_client_load(ECDHServer * ecdhconn)
+{
+  ECDHLoad load;
+  ECDHLoadWorker *workers = NULL;
+  int started = 0;
+  size_t failed = 0;
+
+  secure_memset(&load, 0, sizeof(load));
+  load.client = ecdhconn;
+  load.duration_ns = (uint64_t) ecdhconn->load_duration * 1000000000ULL;
+
+  if (ecdhconn->load_key_ids > 0 && ecdhconn->load_zipf > 0.0)
+  {
+    load.zipf_cdf = load_zipf_cdf(ecdhconn->load_key_ids,
+                                  ecdhconn->load_zipf);
+    if (load.zipf_cdf == NULL)
+    {
+      kmyth_log(LOG_ERR, "Failed to set up the key ID distribution.");
+      error(ecdhconn);
+    }
+  }
+
+  /* A server that goes away mid-exchange must not end the whole test. */
+  signal(SIGPIPE, SIG_IGN);
+
+  workers = calloc(ecdhconn->load_threads, sizeof(ECDHLoadWorker));
+  clock_gettime(CLOCK_MONOTONIC, &load.start);
+  while (workers != NULL && started < ecdhconn->load_threads)
+  {
+    workers[started].load = &load;
+    workers[started].rng = 0x9E3779B97F4A7C15ULL * (uint64_t) (started + 1)
+      ^ (uint64_t) load.start.tv_nsec;
+    if (pthread_create(&workers[started].thread, NULL, load_worker,
+                       &workers[started]))
+    {
+      break;
+    }
+    started++;
+  }
+  if (started < ecdhconn->load_threads)
+  {
+    kmyth_log(LOG_ERR, "Failed to start the load threads.");
+  }
+
+  for (int i = 0; i < started; i++)
+  {
+    pthread_join(workers[i].thread, NULL);
+    failed += workers[i].failed;
+  }
+
+  double seconds = (double) load_elapsed_ns(&load.start) / 1e9;
+
+  fprintf(stdout, "%d connections in parallel for %.1f s:\n", started,
+          seconds);
+  fprintf(stdout, "%-10s %10s %10s %10s %10s %10s %10s\n", "", "count",
+          "per sec", "p50 (us)", "p90 (us)", "p99 (us)", "max (us)");
+  load_report("handshake", workers, started, true, seconds);
+  load_report("key fetch", workers, started, false, seconds);
+  fprintf(stdout, "%zu connections failed.\n", failed);
+
+  for (int i = 0; i < started; i++)
+  {
+    free(workers[i].handshakes.ns);
+    free(workers[i].fetches.ns);
+  }
+  free(workers);
+  free(load.zipf_cdf);
 }
 
 void client_main(ECDHServer * ecdhconn)
 {
+  if (ecdhconn->load_threads > 0)
+  {
+    load_private_key(ecdhconn);
+    load_public_key(ecdhconn);
+
+    run_client_load(ecdhconn);
+    return;
+  }
+
   create_client_socket(ecdhconn);
 
   load_private_key(ecdhconn);
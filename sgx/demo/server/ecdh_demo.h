@@ -10,6 +10,7 @@
 
 #include <getopt.h>
 #include <netdb.h>
+#include <setjmp.h>
 #include <string.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -29,11 +30,14 @@
 
 #include "aes_gcm.h"
 #include "ecdh_util.h"
+#include "key_store.h"
 #include "kmip_util.h"
 #include "socket_util.h"
 
 #define UNSET_FD -1
 #define OP_KEY_SIZE 16
+#define DEFAULT_LISTEN_BACKLOG 1
+#define DEFAULT_LOAD_DURATION 10
 
 typedef struct ECDHServer
 {
@@ -43,14 +47,48 @@ typedef struct ECDHServer
   char *port;
   char *ip;
   int maxconn;
+  int backlog;
+  int workers;
+  int ephemeral_pool_size;
+  // ECDH key agreement suite (KMYTH_ECDH_SUITE_*): the one proposed in
+  // client mode, the only one accepted in server mode (any when 0).
+  uint8_t ecdh_suite;
+  // Set while a pool worker serves a connection, so that error() drops
+  // that connection instead of exiting the server.
+  jmp_buf *conn_error;
   int socket_fd;
   EVP_PKEY *local_privkey;
   EVP_PKEY *remote_pubkey;
-  EC_KEY *local_ephemeral_keypair;
+  EVP_PKEY *local_ephemeral_keypair;
   unsigned char *remote_ephemeral_pubkey;
   size_t remote_ephemeral_pubkey_len;
   unsigned char *session_key;
   unsigned int session_key_len;
+  // KMIP messages of the connection are encoded into this, reused for each
+  kmip_encoding_buffer kmip_buffer;
+  // Upstream KMIP server the keys are retrieved from (the server answers
+  // with a static key when none is set), and the pool of connections to it
+  // shared by all of the connections served.
+  char *kmip_ip;
+  char *kmip_port;
+  char *kmip_ca_path;
+  char *kmip_key_path;
+  char *kmip_cert_path;
+  struct kmip_pool *upstream_pool;
+  // Key store the keys are looked up in, instead (see key_store.h).
+  char *key_store_path;
+  char *key_store_wrap_path;
+  KeyStore *key_store;
+  // Load generator (client mode): parallel connections, test duration (in
+  // seconds), total key request rate (0 for no limit), key IDs drawn from
+  // (0 for the demo key ID only), their Zipf exponent (0 for uniform) and
+  // key requests per connection.
+  int load_threads;
+  int load_duration;
+  double load_rate;
+  long load_key_ids;
+  double load_zipf;
+  int load_keys_per_conn;
 } ECDHServer;
 
 static const struct option longopts[] = {
@@ -62,6 +100,26 @@ static const struct option longopts[] = {
   {"ip", required_argument, 0, 'i'},
   // Test options
   {"maxconn", required_argument, 0, 'm'},
+  {"backlog", required_argument, 0, 'b'},
+  {"workers", required_argument, 0, 'w'},
+  {"ephemeral", required_argument, 0, 'e'},
+  {"suite", required_argument, 0, 's'},
+  // Upstream KMIP server
+  {"kmip-ip", required_argument, 0, 'I'},
+  {"kmip-port", required_argument, 0, 'P'},
+  {"kmip-ca", required_argument, 0, 'C'},
+  {"kmip-key", required_argument, 0, 'R'},
+  {"kmip-cert", required_argument, 0, 'U'},
+  // Key store
+  {"key-store", required_argument, 0, 'k'},
+  {"key-store-wrap", required_argument, 0, 'W'},
+  // Load generator
+  {"load", required_argument, 0, 'L'},
+  {"duration", required_argument, 0, 'd'},
+  {"rate", required_argument, 0, 'q'},
+  {"key-ids", required_argument, 0, 'n'},
+  {"zipf", required_argument, 0, 'z'},
+  {"keys-per-conn", required_argument, 0, 'y'},
   // Misc
   {"help", no_argument, 0, 'h'},
   {0, 0, 0, 0}
@@ -71,6 +129,7 @@ static void usage(const char *prog);
 
 void init(ECDHServer * ecdhconn);
 void cleanup(ECDHServer * ecdhconn);
+void cleanup_connection(ECDHServer * ecdhconn);
 
 void error(ECDHServer * ecdhconn);
 
@@ -80,7 +139,9 @@ void check_options(ECDHServer * ecdhconn);
 void ecdh_encrypt_send(ECDHServer * ecdhconn, unsigned char *plaintext, size_t plaintext_len);
 void ecdh_recv_decrypt(ECDHServer * ecdhconn, unsigned char **plaintext, size_t *plaintext_len);
 
+int listen_server_socket(ECDHServer * ecdhconn);
 void create_server_socket(ECDHServer * ecdhconn);
+void run_server_pool(ECDHServer * ecdhconn);
 void create_client_socket(ECDHServer * ecdhconn);
 
 void load_private_key(ECDHServer * ecdhconn);
@@ -88,14 +149,28 @@ void load_public_key(ECDHServer * ecdhconn);
 
 void make_ephemeral_keypair(ECDHServer * ecdhconn);
 
+void accept_ephemeral_public(ECDHServer * ecdhconn,
+                             unsigned char *pub, size_t pub_len,
+                             unsigned char *sig, unsigned int sig_len);
+void build_ephemeral_public(ECDHServer * ecdhconn,
+                            unsigned char **msg, size_t *msg_len);
+
 void recv_ephemeral_public(ECDHServer * ecdhconn);
 void send_ephemeral_public(ECDHServer * ecdhconn);
 
 void get_session_key(ECDHServer * ecdhconn);
 
+void start_kmip_pool(ECDHServer * ecdhconn);
+void open_key_store(ECDHServer * ecdhconn);
+
+bool ecdh_peer_closed(ECDHServer * ecdhconn);
+
 void send_operational_key(ECDHServer * ecdhconn);
+void send_operational_keys(ECDHServer * ecdhconn);
 void get_operational_key(ECDHServer * ecdhconn);
 
+void run_client_load(ECDHServer * ecdhconn);
+
 void server_main(ECDHServer * ecdhconn);
 void client_main(ECDHServer * ecdhconn);
 
@@ -0,0 +1,681 @@
+/**
+ * @file ecdh_demo_test.c
+ * @brief Tests of the ECDHE test server, client and proxy applications.
+ *
+ * Each server and client runs in a process of its own, as it would from
+ * the command line, so that error() exiting it fails only that process.
+ * The tests use the test keys and certificates under demo/data (see
+ * 'make demo-test-keys-certs'), and are run from the sgx directory.
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+
+#include <CUnit/CUnit.h>
+#include <CUnit/Basic.h>
+
+#include "ecdh_demo.h"
+
+#define SERVER_PRIV "demo/data/server_priv_test.pem"
+#define SERVER_CERT "demo/data/server_cert_test.pem"
+#define CLIENT_PRIV "demo/data/client_priv_test.pem"
+#define CLIENT_CERT "demo/data/client_cert_test.pem"
+#define TLS_SERVER_PRIV "demo/data/tls_server_priv_test.pem"
+#define TLS_SERVER_CERT "demo/data/tls_server_cert_test.pem"
+#define PROXY_PATH "demo/bin/tls-proxy"
+
+// time (in seconds) given a server to start listening
+#define SERVER_START_DELAY 1
+
+//----------------------------------------------------------------------------
+// start_demo(): runs the server (or client) main with the given options
+//               in a new process
+//----------------------------------------------------------------------------
+static pid_t start_demo(bool client_mode, char **argv)
+{
+  // so the child does not repeat the output buffered so far
+  fflush(stdout);
+
+  pid_t pid = fork();
+
+  if (pid != 0)
+  {
+    return pid;
+  }
+
+  ECDHServer ecdhconn;
+  int argc = 0;
+
+  while (argv[argc] != NULL)
+  {
+    argc++;
+  }
+
+  init(&ecdhconn);
+  ecdhconn.client_mode = client_mode;
+
+  set_applog_severity_threshold(LOG_WARNING);
+
+  get_options(&ecdhconn, argc, argv);
+  check_options(&ecdhconn);
+
+  if (client_mode)
+  {
+    client_main(&ecdhconn);
+  }
+  else
+  {
+    server_main(&ecdhconn);
+  }
+
+  cleanup(&ecdhconn);
+
+  exit(EXIT_SUCCESS);
+}
+
+//----------------------------------------------------------------------------
+// wait_demo(): waits for a process started by start_demo(), returning its
+//              exit status (-1 if it did not exit normally)
+//----------------------------------------------------------------------------
+static int wait_demo(pid_t pid)
+{
+  int status = 0;
+
+  if (pid == -1 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status))
+  {
+    return -1;
+  }
+  return WEXITSTATUS(status);
+}
+
+//----------------------------------------------------------------------------
+// start_client(): starts a client of the server on the given port
+//----------------------------------------------------------------------------
+static pid_t start_client(char *port)
+{
+  char *argv[] = { "ecdh-client", "-r", CLIENT_PRIV, "-u", SERVER_CERT,
+    "-i", "localhost", "-p", port, NULL
+  };
+
+  return start_demo(true, argv);
+}
+
+//----------------------------------------------------------------------------
+// test_server_pool()
+//----------------------------------------------------------------------------
+void test_server_pool(void)
+{
+  char *port = "7301";
+  char *server_argv[] = { "ecdh-server", "-r", SERVER_PRIV, "-u", CLIENT_CERT,
+    "-p", port, "-m", "8", "-b", "8", "-w", "4", NULL
+  };
+  pid_t clients[8];
+
+  pid_t server = start_demo(false, server_argv);
+
+  CU_ASSERT_FATAL(server != -1);
+  sleep(SERVER_START_DELAY);
+
+  // more clients at once than there are workers
+  for (int i = 0; i < 8; i++)
+  {
+    clients[i] = start_client(port);
+  }
+  for (int i = 0; i < 8; i++)
+  {
+    CU_ASSERT(wait_demo(clients[i]) == EXIT_SUCCESS);
+  }
+
+  // the server exits once it has served its -m connections
+  CU_ASSERT(wait_demo(server) == EXIT_SUCCESS);
+}
+
+//----------------------------------------------------------------------------
+// test_server_pool_failed_connection()
+//----------------------------------------------------------------------------
+void test_server_pool_failed_connection(void)
+{
+  char *port = "7302";
+  char *server_argv[] = { "ecdh-server", "-r", SERVER_PRIV, "-u", CLIENT_CERT,
+    "-p", port, "-m", "3", "-w", "2", NULL
+  };
+  int socket_fd = UNSET_FD;
+  size_t junk_len = 4;
+  unsigned int junk_sig_len = 4;
+
+  pid_t server = start_demo(false, server_argv);
+
+  CU_ASSERT_FATAL(server != -1);
+  sleep(SERVER_START_DELAY);
+
+  // a client that sends a malformed ephemeral public key, and one that
+  // hangs up before sending anything, only fail their own connections
+  CU_ASSERT(setup_client_socket("localhost", port, &socket_fd) == 0);
+  CU_ASSERT(write(socket_fd, &junk_len, sizeof(junk_len)) ==
+            sizeof(junk_len));
+  CU_ASSERT(write(socket_fd, "junk", junk_len) == (ssize_t) junk_len);
+  CU_ASSERT(write(socket_fd, &junk_sig_len, sizeof(junk_sig_len)) ==
+            sizeof(junk_sig_len));
+  CU_ASSERT(write(socket_fd, "junk", junk_sig_len) ==
+            (ssize_t) junk_sig_len);
+  close(socket_fd);
+
+  CU_ASSERT(setup_client_socket("localhost", port, &socket_fd) == 0);
+  close(socket_fd);
+
+  pid_t client = start_client(port);
+
+  CU_ASSERT(wait_demo(client) == EXIT_SUCCESS);
+  CU_ASSERT(wait_demo(server) == EXIT_SUCCESS);
+}
+
+//----------------------------------------------------------------------------
+// run_load_client(): runs a load generator client of the server on the
+//                    given port, with the given options, writing its
+//                    report to the given file - returns its exit status
+//----------------------------------------------------------------------------
+static int run_load_client(char *port, char *threads, char *duration,
+                           char *rate, const char *report_path)
+{
+  char *argv[] = { "ecdh-client", "-r", CLIENT_PRIV, "-u", SERVER_CERT,
+    "-i", "localhost", "-p", port, "-L", threads, "-d", duration,
+    "-y", "5", (rate != NULL) ? "-q" : NULL, rate, NULL
+  };
+  int report_fd = open(report_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  int stdout_fd = dup(STDOUT_FILENO);
+
+  if (report_fd == -1 || stdout_fd == -1)
+  {
+    return -1;
+  }
+
+  // the client inherits the report file as its stdout
+  fflush(stdout);
+  dup2(report_fd, STDOUT_FILENO);
+  pid_t client = start_demo(true, argv);
+
+  dup2(stdout_fd, STDOUT_FILENO);
+  close(stdout_fd);
+  close(report_fd);
+
+  return wait_demo(client);
+}
+
+//----------------------------------------------------------------------------
+// read_load_report(): reads the handshake and key fetch counts, and the
+//                     failed connection count, from a load client report
+//----------------------------------------------------------------------------
+static int read_load_report(const char *report_path, size_t *handshakes,
+                            size_t *fetches, size_t *failed)
+{
+  FILE *report = fopen(report_path, "r");
+  char line[256];
+  int found = 0;
+
+  if (report == NULL)
+  {
+    return -1;
+  }
+
+  // a phase with no samples is reported with a count of 0 only
+  while (fgets(line, sizeof(line), report) != NULL)
+  {
+    found += (sscanf(line, "handshake %zu", handshakes) == 1);
+    found += (sscanf(line, "key fetch %zu", fetches) == 1);
+    found += (sscanf(line, "%zu connections failed.", failed) == 1);
+  }
+  fclose(report);
+
+  return (found == 3) ? 0 : -1;
+}
+
+//----------------------------------------------------------------------------
+// test_load_client()
+//----------------------------------------------------------------------------
+void test_load_client(void)
+{
+  char *port = "7303";
+  char *server_argv[] = { "ecdh-server", "-r", SERVER_PRIV, "-u", CLIENT_CERT,
+    "-p", port, "-b", "8", "-w", "4", NULL
+  };
+  char report_path[] = "/tmp/kmyth-load-test-XXXXXX";
+  int report_fd = mkstemp(report_path);
+  size_t handshakes = 0;
+  size_t fetches = 0;
+  size_t failed = 0;
+
+  CU_ASSERT_FATAL(report_fd != -1);
+  close(report_fd);
+
+  // with no server, every connection fails, but the load test carries on
+  // until its duration is up
+  CU_ASSERT(run_load_client(port, "2", "1", NULL, report_path)
+            == EXIT_SUCCESS);
+  CU_ASSERT(read_load_report(report_path, &handshakes, &fetches, &failed)
+            == 0);
+  CU_ASSERT(handshakes == 0 && fetches == 0);
+  CU_ASSERT(failed > 0);
+
+  pid_t server = start_demo(false, server_argv);
+
+  CU_ASSERT_FATAL(server != -1);
+  sleep(SERVER_START_DELAY);
+
+  // against the worker pool, every connection succeeds and makes its key
+  // requests, as many as the rate allows (4 connections at once, making
+  // 5 requests each, for 2 seconds at 50 requests per second)
+  CU_ASSERT(run_load_client(port, "4", "2", "50", report_path)
+            == EXIT_SUCCESS);
+  CU_ASSERT(read_load_report(report_path, &handshakes, &fetches, &failed)
+            == 0);
+  CU_ASSERT(failed == 0);
+  CU_ASSERT(fetches > 50 && fetches <= 100);
+  CU_ASSERT(handshakes >= fetches / 5 && handshakes <= fetches / 5 + 4);
+
+  // the server would serve connections indefinitely
+  kill(server, SIGKILL);
+  waitpid(server, NULL, 0);
+  unlink(report_path);
+}
+
+//----------------------------------------------------------------------------
+// get_stored_key(): looks up the key with the given (string) ID
+//----------------------------------------------------------------------------
+static int get_stored_key(KeyStore * store, const char *id,
+                          unsigned char *key, size_t *key_len)
+{
+  return key_store_get(store, (const unsigned char *) id, strlen(id), key,
+                       key_len);
+}
+
+//----------------------------------------------------------------------------
+// test_key_store()
+//----------------------------------------------------------------------------
+void test_key_store(void)
+{
+  char dir[] = "/tmp/kmyth-key-store-test-XXXXXX";
+  char path[64] = { 0 };
+  unsigned char wrap_key[KEY_STORE_WRAP_KEY_LEN];
+  unsigned char wrong_key[KEY_STORE_WRAP_KEY_LEN];
+  unsigned char key[KEY_STORE_MAX_KEY_LEN];
+  unsigned char first_key[KEY_STORE_MAX_KEY_LEN];
+  size_t key_len = 0;
+  char id[KEY_STORE_MAX_ID_LEN + 2];
+  KeyStore *store = NULL;
+  KeyStore *wrong_store = NULL;
+
+  CU_ASSERT_FATAL(mkdtemp(dir) != NULL);
+  snprintf(path, sizeof(path), "%s/keys.ks", dir);
+  CU_ASSERT_FATAL(RAND_bytes(wrap_key, sizeof(wrap_key)) == 1);
+  memcpy(wrong_key, wrap_key, sizeof(wrong_key));
+  wrong_key[0] ^= 0x01;
+
+  // invalid key counts and lengths, and missing stores, are rejected
+  CU_ASSERT(key_store_create(path, wrap_key, 0, 16) == EXIT_FAILURE);
+  CU_ASSERT(key_store_create(path, wrap_key, 10, 0) == EXIT_FAILURE);
+  CU_ASSERT(key_store_create(path, wrap_key, 10, KEY_STORE_MAX_KEY_LEN + 1)
+            == EXIT_FAILURE);
+  CU_ASSERT(key_store_open_key(path, wrap_key, &store) == EXIT_FAILURE);
+  CU_ASSERT(store == NULL);
+
+  // every key created can be looked up, and the keys differ
+  CU_ASSERT_FATAL(key_store_create(path, wrap_key, 100, 32) == EXIT_SUCCESS);
+  CU_ASSERT_FATAL(key_store_open_key(path, wrap_key, &store)
+                  == EXIT_SUCCESS);
+  for (int i = 1; i <= 100; i++)
+  {
+    snprintf(id, sizeof(id), "%d", i);
+    key_len = 0;
+    CU_ASSERT(get_stored_key(store, id, key, &key_len) == EXIT_SUCCESS);
+    CU_ASSERT(key_len == 32);
+    if (i == 1)
+    {
+      memcpy(first_key, key, key_len);
+    }
+    else
+    {
+      CU_ASSERT(memcmp(first_key, key, key_len) != 0);
+    }
+  }
+
+  // IDs not in the store, or too short or long to be, are not found
+  CU_ASSERT(get_stored_key(store, "0", key, &key_len) == EXIT_FAILURE);
+  CU_ASSERT(get_stored_key(store, "101", key, &key_len) == EXIT_FAILURE);
+  CU_ASSERT(get_stored_key(store, "", key, &key_len) == EXIT_FAILURE);
+  memset(id, '1', sizeof(id) - 1);
+  id[sizeof(id) - 1] = '\0';
+  CU_ASSERT(get_stored_key(store, id, key, &key_len) == EXIT_FAILURE);
+
+  // a store opened with the wrong wrapping key yields no keys
+  CU_ASSERT_FATAL(key_store_open_key(path, wrong_key, &wrong_store)
+                  == EXIT_SUCCESS);
+  CU_ASSERT(get_stored_key(wrong_store, "1", key, &key_len) == EXIT_FAILURE);
+  key_store_close(&wrong_store);
+  CU_ASSERT(wrong_store == NULL);
+
+  // a store file replaced by a new store is reloaded, once the reload
+  // interval has passed
+  CU_ASSERT_FATAL(key_store_create(path, wrap_key, 200, 16) == EXIT_SUCCESS);
+  sleep(KEY_STORE_RELOAD_INTERVAL);
+  CU_ASSERT(get_stored_key(store, "150", key, &key_len) == EXIT_SUCCESS);
+  CU_ASSERT(key_len == 16);
+  CU_ASSERT(get_stored_key(store, "1", key, &key_len) == EXIT_SUCCESS);
+  CU_ASSERT(key_len == 16 && memcmp(first_key, key, key_len) != 0);
+
+  // a store file replaced by one that does not load leaves the current
+  // store in use
+  char junk_path[80];
+  FILE *junk = NULL;
+
+  snprintf(junk_path, sizeof(junk_path), "%s.junk", path);
+  junk = fopen(junk_path, "w");
+  CU_ASSERT_FATAL(junk != NULL);
+  fputs("not a key store", junk);
+  fclose(junk);
+  CU_ASSERT(rename(junk_path, path) == 0);
+  sleep(KEY_STORE_RELOAD_INTERVAL);
+  CU_ASSERT(get_stored_key(store, "150", key, &key_len) == EXIT_SUCCESS);
+  CU_ASSERT(key_store_open_key(path, wrap_key, &wrong_store)
+            == EXIT_FAILURE);
+
+  key_store_close(&store);
+  CU_ASSERT(store == NULL);
+  kmyth_clear(key, sizeof(key));
+  kmyth_clear(first_key, sizeof(first_key));
+  kmyth_clear(wrap_key, sizeof(wrap_key));
+  unlink(path);
+  rmdir(dir);
+}
+
+//----------------------------------------------------------------------------
+// start_tls_echo(): starts a TLS server that echoes back what each of the
+//                   given number of connections sends it
+//----------------------------------------------------------------------------
+static pid_t start_tls_echo(char *port, int numconn)
+{
+  fflush(stdout);
+
+  pid_t pid = fork();
+
+  if (pid != 0)
+  {
+    return pid;
+  }
+
+  SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+  int listen_fd = UNSET_FD;
+
+  if (ctx == NULL
+      || SSL_CTX_use_PrivateKey_file(ctx, TLS_SERVER_PRIV,
+                                     SSL_FILETYPE_PEM) != 1
+      || SSL_CTX_use_certificate_file(ctx, TLS_SERVER_CERT,
+                                      SSL_FILETYPE_PEM) != 1
+      || setup_server_socket(port, &listen_fd)
+      || listen(listen_fd, numconn))
+  {
+    exit(EXIT_FAILURE);
+  }
+
+  // each connection is served by a process of its own, as the proxy
+  // relays all of its sessions at once
+  for (int i = 0; i < numconn; i++)
+  {
+    int socket_fd = accept(listen_fd, NULL, NULL);
+
+    if (socket_fd == -1)
+    {
+      exit(EXIT_FAILURE);
+    }
+    if (fork() == 0)
+    {
+      SSL *ssl = SSL_new(ctx);
+      unsigned char buf[4096];
+      int len = 0;
+
+      SSL_set_fd(ssl, socket_fd);
+      if (SSL_accept(ssl) != 1)
+      {
+        exit(EXIT_FAILURE);
+      }
+      while ((len = SSL_read(ssl, buf, sizeof(buf))) > 0)
+      {
+        if (SSL_write(ssl, buf, len) != len)
+        {
+          exit(EXIT_FAILURE);
+        }
+      }
+      SSL_shutdown(ssl);
+      SSL_free(ssl);
+      exit(EXIT_SUCCESS);
+    }
+    close(socket_fd);
+  }
+
+  int status = 0;
+  int ret = EXIT_SUCCESS;
+
+  while (wait(&status) != -1)
+  {
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+    {
+      ret = EXIT_FAILURE;
+    }
+  }
+  close(listen_fd);
+  SSL_CTX_free(ctx);
+  exit(ret);
+}
+
+//----------------------------------------------------------------------------
+// start_proxy(): starts the TLS proxy (built alongside this test) in front
+//                of a TLS server, for the given number of sessions
+//----------------------------------------------------------------------------
+static pid_t start_proxy(char *port, char *tls_port, char *numconn)
+{
+  char *argv[] = { PROXY_PATH, "-r", SERVER_PRIV, "-u", CLIENT_CERT,
+    "-p", port, "-I", "localhost", "-P", tls_port, "-C", TLS_SERVER_CERT,
+    "-m", numconn, NULL
+  };
+
+  fflush(stdout);
+
+  pid_t pid = fork();
+
+  if (pid == 0)
+  {
+    execv(PROXY_PATH, argv);
+    exit(EXIT_FAILURE);
+  }
+  return pid;
+}
+
+typedef struct ProxyClientMessages
+{
+  ECDHServer *ecdhconn;
+  unsigned char *data;
+  int msg_count;
+  size_t msg_len;
+} ProxyClientMessages;
+
+static void *proxy_client_send(void *arg)
+{
+  ProxyClientMessages *msgs = arg;
+
+  for (int i = 0; i < msgs->msg_count; i++)
+  {
+    ecdh_encrypt_send(msgs->ecdhconn, msgs->data + i * msgs->msg_len,
+                      msgs->msg_len);
+  }
+  return NULL;
+}
+
+//----------------------------------------------------------------------------
+// start_proxy_client(): starts a client that completes the key exchange
+//                       with the proxy, then sends the given number of
+//                       messages through it and checks that they all
+//                       come back, in order
+//----------------------------------------------------------------------------
+static pid_t start_proxy_client(char *port, int msg_count, size_t msg_len)
+{
+  fflush(stdout);
+
+  pid_t pid = fork();
+
+  if (pid != 0)
+  {
+    return pid;
+  }
+
+  ECDHServer ecdhconn;
+  size_t total = (size_t) msg_count * msg_len;
+  unsigned char *sent = malloc(total);
+  size_t received = 0;
+
+  init(&ecdhconn);
+  ecdhconn.client_mode = true;
+  ecdhconn.private_key_path = CLIENT_PRIV;
+  ecdhconn.public_cert_path = SERVER_CERT;
+  ecdhconn.ip = "localhost";
+  ecdhconn.port = port;
+
+  set_applog_severity_threshold(LOG_WARNING);
+
+  create_client_socket(&ecdhconn);
+  load_private_key(&ecdhconn);
+  load_public_key(&ecdhconn);
+  make_ephemeral_keypair(&ecdhconn);
+  send_ephemeral_public(&ecdhconn);
+  recv_ephemeral_public(&ecdhconn);
+  get_session_key(&ecdhconn);
+
+  for (size_t i = 0; i < total; i++)
+  {
+    sent[i] = (unsigned char) (i * 31 + getpid());
+  }
+  // sent while the echo is read back, so that the proxy's buffers fill
+  // without the client's filling too
+  ProxyClientMessages msgs = { &ecdhconn, sent, msg_count, msg_len };
+  pthread_t sender;
+
+  if (pthread_create(&sender, NULL, proxy_client_send, &msgs))
+  {
+    error(&ecdhconn);
+  }
+
+  // the echoed bytes may come back split into other messages
+  while (received < total)
+  {
+    unsigned char *msg = NULL;
+    size_t len = 0;
+
+    ecdh_recv_decrypt(&ecdhconn, &msg, &len);
+    if (len > total - received || memcmp(msg, sent + received, len) != 0)
+    {
+      kmyth_log(LOG_ERR, "The relayed data does not match what was sent.");
+      error(&ecdhconn);
+    }
+    received += len;
+    kmyth_clear_and_free(msg, len);
+  }
+  pthread_join(sender, NULL);
+
+  free(sent);
+  cleanup(&ecdhconn);
+  exit(EXIT_SUCCESS);
+}
+
+//----------------------------------------------------------------------------
+// test_tls_proxy()
+//----------------------------------------------------------------------------
+void test_tls_proxy(void)
+{
+  char *port = "7311";
+  char *tls_port = "7312";
+  pid_t clients[4];
+
+  pid_t tls_server = start_tls_echo(tls_port, 4);
+
+  CU_ASSERT_FATAL(tls_server != -1);
+
+  pid_t proxy = start_proxy(port, tls_port, "4");
+
+  CU_ASSERT_FATAL(proxy != -1);
+  sleep(SERVER_START_DELAY);
+
+  // concurrent sessions, relayed by the one proxy loop: short messages,
+  // and more data than fits in the proxy's per-session buffers
+  clients[0] = start_proxy_client(port, 1, 16);
+  clients[1] = start_proxy_client(port, 4, 1000);
+  clients[2] = start_proxy_client(port, 8, 8192);
+  clients[3] = start_proxy_client(port, 32, 8192);
+  for (int i = 0; i < 4; i++)
+  {
+    CU_ASSERT(wait_demo(clients[i]) == EXIT_SUCCESS);
+  }
+
+  // both exit once their sessions are done
+  CU_ASSERT(wait_demo(proxy) == EXIT_SUCCESS);
+  CU_ASSERT(wait_demo(tls_server) == EXIT_SUCCESS);
+}
+
+int main(void)
+{
+  if (CUE_SUCCESS != CU_initialize_registry())
+  {
+    return CU_get_error();
+  }
+
+  CU_pSuite ecdh_demo_test_suite = NULL;
+
+  ecdh_demo_test_suite =
+    CU_add_suite("ECDHE Demo Test Suite", NULL, NULL);
+  if (NULL == ecdh_demo_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (NULL == CU_add_test(ecdh_demo_test_suite, "Test server worker pool",
+                          test_server_pool))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (NULL == CU_add_test(ecdh_demo_test_suite,
+                          "Test server worker pool failed connection",
+                          test_server_pool_failed_connection))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if (NULL == CU_add_test(ecdh_demo_test_suite, "Test load generator client",
+                          test_load_client))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if (NULL == CU_add_test(ecdh_demo_test_suite, "Test indexed key store",
+                          test_key_store))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if (NULL == CU_add_test(ecdh_demo_test_suite, "Test TLS proxy sessions",
+                          test_tls_proxy))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  CU_basic_run_tests();
+
+  CU_cleanup_registry();
+  return CU_get_error();
+}
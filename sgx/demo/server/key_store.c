@@ -0,0 +1,471 @@
+/**
+ * @file key_store.c
+ * @brief Indexed key store backend for the ECDHE test server.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <openssl/rand.h>
+
+#include <kmyth/kmyth.h>
+#include <kmyth/kmyth_log.h>
+#include <kmyth/memory_util.h>
+
+#include "aes_gcm.h"
+#include "key_store.h"
+
+#define KEY_STORE_MAGIC "KMYTHKS1"
+
+/* An encrypted slot holds IV || (ID || key) || tag. */
+#define KEY_STORE_SEALED_LEN (GCM_IV_LEN + KEY_STORE_MAX_ID_LEN \
+                              + KEY_STORE_MAX_KEY_LEN + GCM_TAG_LEN)
+
+/* The file layout: all byte arrays and 64-bit fields, so no padding. */
+typedef struct KeyStoreHeader
+{
+  uint8_t magic[8];
+  uint64_t slot_count;
+  uint64_t key_count;
+  uint64_t reserved;
+} KeyStoreHeader;
+
+typedef struct KeyStoreSlot
+{
+  uint8_t id_len;               // 0 for an empty slot
+  uint8_t sealed_len;
+  uint8_t id[KEY_STORE_MAX_ID_LEN];
+  uint8_t sealed[KEY_STORE_SEALED_LEN];
+  uint8_t reserved[2];
+} KeyStoreSlot;
+
+struct KeyStoreMap
+{
+  void *base;
+  size_t size;
+  const KeyStoreHeader *header;
+  const KeyStoreSlot *slots;
+};
+
+static uint64_t key_store_hash(const unsigned char *id, size_t id_len)
+{
+  /* FNV-1a */
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  for (size_t i = 0; i < id_len; i++)
+  {
+    hash ^= id[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static void key_store_unmap(KeyStoreMap * map)
+{
+  if (map != NULL)
+  {
+    munmap(map->base, map->size);
+    free(map);
+  }
+}
+
+static int key_store_map(const char *path, KeyStoreMap ** map,
+                         struct stat *st)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+  if (fd == -1)
+  {
+    kmyth_log(LOG_ERR, "Failed to open the key store %s: %s", path,
+              strerror(errno));
+    return EXIT_FAILURE;
+  }
+  if (fstat(fd, st) || (size_t) st->st_size < sizeof(KeyStoreHeader))
+  {
+    kmyth_log(LOG_ERR, "Invalid key store file: %s", path);
+    close(fd);
+    return EXIT_FAILURE;
+  }
+
+  size_t size = (size_t) st->st_size;
+  void *base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+  close(fd);
+  if (base == MAP_FAILED)
+  {
+    kmyth_log(LOG_ERR, "Failed to map the key store %s: %s", path,
+              strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  const KeyStoreHeader *header = base;
+  uint64_t slot_count = header->slot_count;
+
+  if (memcmp(header->magic, KEY_STORE_MAGIC, sizeof(header->magic)) != 0
+      || slot_count == 0 || (slot_count & (slot_count - 1)) != 0
+      || slot_count > (size - sizeof(KeyStoreHeader)) / sizeof(KeyStoreSlot)
+      || size != sizeof(KeyStoreHeader) + slot_count * sizeof(KeyStoreSlot))
+  {
+    kmyth_log(LOG_ERR, "Invalid key store file: %s", path);
+    munmap(base, size);
+    return EXIT_FAILURE;
+  }
+
+  /* Lookups touch a slot or two anywhere in the file. */
+  madvise(base, size, MADV_RANDOM);
+
+  *map = calloc(1, sizeof(KeyStoreMap));
+  if (*map == NULL)
+  {
+    munmap(base, size);
+    return EXIT_FAILURE;
+  }
+  (*map)->base = base;
+  (*map)->size = size;
+  (*map)->header = header;
+  (*map)->slots = (const KeyStoreSlot *) (header + 1);
+
+  kmyth_log(LOG_DEBUG, "Mapped the key store %s (%lu keys).", path,
+            (unsigned long) header->key_count);
+
+  return EXIT_SUCCESS;
+}
+
+int key_store_open(const char *path, const char *wrap_key_path,
+                   KeyStore ** store)
+{
+  uint8_t *wrap_key = NULL;
+  size_t wrap_key_len = 0;
+
+  *store = NULL;
+
+  /* The wrapping key is unsealed once, and kept for the store's lifetime. */
+  if (tpm2_kmyth_unseal_file((char *) wrap_key_path, &wrap_key, &wrap_key_len,
+                             NULL, 0, NULL, 0))
+  {
+    kmyth_log(LOG_ERR, "Failed to unseal the key store wrapping key.");
+    return EXIT_FAILURE;
+  }
+  if (wrap_key_len != KEY_STORE_WRAP_KEY_LEN)
+  {
+    kmyth_log(LOG_ERR, "Invalid key store wrapping key length: %zu",
+              wrap_key_len);
+    kmyth_clear_and_free(wrap_key, wrap_key_len);
+    return EXIT_FAILURE;
+  }
+
+  int ret = key_store_open_key(path, wrap_key, store);
+
+  kmyth_clear_and_free(wrap_key, wrap_key_len);
+
+  return ret;
+}
+
+int key_store_open_key(const char *path, const unsigned char *wrap_key,
+                       KeyStore ** store)
+{
+  struct stat st;
+
+  *store = NULL;
+
+  KeyStore *new_store = calloc(1, sizeof(KeyStore));
+
+  if (new_store == NULL)
+  {
+    return EXIT_FAILURE;
+  }
+  pthread_rwlock_init(&new_store->lock, NULL);
+  pthread_mutex_init(&new_store->check_lock, NULL);
+
+  new_store->path = strdup(path);
+  if (new_store->path == NULL)
+  {
+    key_store_close(&new_store);
+    return EXIT_FAILURE;
+  }
+  memcpy(new_store->wrap_key, wrap_key, KEY_STORE_WRAP_KEY_LEN);
+
+  if (key_store_map(path, &new_store->map, &st))
+  {
+    key_store_close(&new_store);
+    return EXIT_FAILURE;
+  }
+  new_store->dev = st.st_dev;
+  new_store->ino = st.st_ino;
+  new_store->mtime = st.st_mtime;
+  clock_gettime(CLOCK_MONOTONIC, &new_store->checked);
+
+  *store = new_store;
+
+  return EXIT_SUCCESS;
+}
+
+void key_store_close(KeyStore ** store)
+{
+  if (store == NULL || *store == NULL)
+  {
+    return;
+  }
+
+  KeyStore *old_store = *store;
+
+  key_store_unmap(old_store->map);
+  kmyth_clear(old_store->wrap_key, sizeof(old_store->wrap_key));
+  free(old_store->path);
+  pthread_mutex_destroy(&old_store->check_lock);
+  pthread_rwlock_destroy(&old_store->lock);
+  free(old_store);
+
+  *store = NULL;
+}
+
+static void key_store_check_reload(KeyStore * store)
+{
+  struct timespec now;
+  struct stat st;
+  KeyStoreMap *map = NULL;
+
+  /* One thread checks, while the others carry on with the current map. */
+  if (pthread_mutex_trylock(&store->check_lock))
+  {
+    return;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (now.tv_sec - store->checked.tv_sec < KEY_STORE_RELOAD_INTERVAL)
+  {
+    pthread_mutex_unlock(&store->check_lock);
+    return;
+  }
+  store->checked = now;
+
+  if (stat(store->path, &st)
+      || (st.st_dev == store->dev && st.st_ino == store->ino
+          && st.st_mtime == store->mtime))
+  {
+    pthread_mutex_unlock(&store->check_lock);
+    return;
+  }
+
+  /* A store that fails to load leaves the current one in use. */
+  if (key_store_map(store->path, &map, &st) == EXIT_SUCCESS)
+  {
+    KeyStoreMap *old_map = NULL;
+
+    pthread_rwlock_wrlock(&store->lock);
+    old_map = store->map;
+    store->map = map;
+    pthread_rwlock_unlock(&store->lock);
+
+    key_store_unmap(old_map);
+    store->dev = st.st_dev;
+    store->ino = st.st_ino;
+    store->mtime = st.st_mtime;
+    kmyth_log(LOG_INFO, "Reloaded the key store %s.", store->path);
+  }
+
+  pthread_mutex_unlock(&store->check_lock);
+}
+
+static int key_store_unwrap(KeyStore * store, const KeyStoreSlot * slot,
+                            unsigned char *key, size_t *key_len)
+{
+  unsigned char plaintext[KEY_STORE_MAX_ID_LEN + KEY_STORE_MAX_KEY_LEN];
+  size_t plaintext_len = sizeof(plaintext);
+  int ret = EXIT_FAILURE;
+
+  if (slot->sealed_len > KEY_STORE_SEALED_LEN
+      || aes_gcm_decrypt_into(NULL, store->wrap_key, KEY_STORE_WRAP_KEY_LEN,
+                              (unsigned char *) slot->sealed,
+                              slot->sealed_len, plaintext, &plaintext_len))
+  {
+    kmyth_log(LOG_ERR, "Failed to decrypt a key store entry.");
+    return EXIT_FAILURE;
+  }
+
+  /* The key was encrypted together with its ID, so it cannot be moved. */
+  if (plaintext_len > slot->id_len
+      && plaintext_len - slot->id_len <= KEY_STORE_MAX_KEY_LEN
+      && memcmp(plaintext, slot->id, slot->id_len) == 0)
+  {
+    *key_len = plaintext_len - slot->id_len;
+    memcpy(key, plaintext + slot->id_len, *key_len);
+    ret = EXIT_SUCCESS;
+  }
+  else
+  {
+    kmyth_log(LOG_ERR, "Key store entry does not match its ID.");
+  }
+  kmyth_clear(plaintext, sizeof(plaintext));
+
+  return ret;
+}
+
+int key_store_get(KeyStore * store,
+                  const unsigned char *id, size_t id_len,
+                  unsigned char *key, size_t *key_len)
+{
+  int ret = EXIT_FAILURE;
+
+  if (id_len == 0 || id_len > KEY_STORE_MAX_ID_LEN)
+  {
+    return EXIT_FAILURE;
+  }
+
+  key_store_check_reload(store);
+
+  pthread_rwlock_rdlock(&store->lock);
+
+  const KeyStoreMap *map = store->map;
+  uint64_t mask = map->header->slot_count - 1;
+  uint64_t index = key_store_hash(id, id_len) & mask;
+
+  for (uint64_t probes = 0; probes <= mask; probes++)
+  {
+    const KeyStoreSlot *slot = &map->slots[index];
+
+    if (slot->id_len == 0)
+    {
+      break;
+    }
+    if (slot->id_len == id_len && memcmp(slot->id, id, id_len) == 0)
+    {
+      ret = key_store_unwrap(store, slot, key, key_len);
+      break;
+    }
+    index = (index + 1) & mask;
+  }
+
+  pthread_rwlock_unlock(&store->lock);
+
+  return ret;
+}
+
+int key_store_create(const char *path, const unsigned char *wrap_key,
+                     size_t key_count, size_t key_len)
+{
+  uint64_t slot_count = 2;
+
+  if (key_count == 0 || key_len == 0 || key_len > KEY_STORE_MAX_KEY_LEN)
+  {
+    kmyth_log(LOG_ERR, "Invalid key store key count or length.");
+    return EXIT_FAILURE;
+  }
+  while (slot_count < 2 * (uint64_t) key_count)
+  {
+    slot_count *= 2;
+  }
+  if (slot_count > (SIZE_MAX - sizeof(KeyStoreHeader)) / sizeof(KeyStoreSlot))
+  {
+    kmyth_log(LOG_ERR, "Too many keys for a key store.");
+    return EXIT_FAILURE;
+  }
+
+  size_t size = sizeof(KeyStoreHeader) + slot_count * sizeof(KeyStoreSlot);
+  size_t tmp_path_len = strlen(path) + sizeof(".tmp");
+  char *tmp_path = malloc(tmp_path_len);
+
+  if (tmp_path == NULL)
+  {
+    return EXIT_FAILURE;
+  }
+  snprintf(tmp_path, tmp_path_len, "%s.tmp", path);
+
+  /* Written beside the store, then renamed over it, so readers never see
+   * a partial store. */
+  int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+  if (fd == -1 || ftruncate(fd, (off_t) size))
+  {
+    kmyth_log(LOG_ERR, "Failed to create the key store %s: %s", tmp_path,
+              strerror(errno));
+    if (fd != -1)
+    {
+      close(fd);
+      unlink(tmp_path);
+    }
+    free(tmp_path);
+    return EXIT_FAILURE;
+  }
+
+  void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  if (base == MAP_FAILED)
+  {
+    kmyth_log(LOG_ERR, "Failed to map the key store %s: %s", tmp_path,
+              strerror(errno));
+    close(fd);
+    unlink(tmp_path);
+    free(tmp_path);
+    return EXIT_FAILURE;
+  }
+
+  KeyStoreHeader *header = base;
+  KeyStoreSlot *slots = (KeyStoreSlot *) (header + 1);
+  unsigned char plaintext[KEY_STORE_MAX_ID_LEN + KEY_STORE_MAX_KEY_LEN];
+  int ret = EXIT_SUCCESS;
+
+  memcpy(header->magic, KEY_STORE_MAGIC, sizeof(header->magic));
+  header->slot_count = slot_count;
+  header->key_count = key_count;
+
+  for (size_t i = 1; i <= key_count && ret == EXIT_SUCCESS; i++)
+  {
+    int id_len = snprintf((char *) plaintext, KEY_STORE_MAX_ID_LEN + 1,
+                          "%zu", i);
+    size_t sealed_len = KEY_STORE_SEALED_LEN;
+    uint64_t index = key_store_hash(plaintext, (size_t) id_len)
+      & (slot_count - 1);
+
+    while (slots[index].id_len != 0)
+    {
+      index = (index + 1) & (slot_count - 1);
+    }
+
+    KeyStoreSlot *slot = &slots[index];
+
+    if (RAND_bytes(plaintext + id_len, (int) key_len) != 1
+        || aes_gcm_encrypt_into(NULL, (unsigned char *) wrap_key,
+                                KEY_STORE_WRAP_KEY_LEN, plaintext,
+                                (size_t) id_len + key_len,
+                                slot->sealed, &sealed_len))
+    {
+      kmyth_log(LOG_ERR, "Failed to generate key store entry %zu.", i);
+      ret = EXIT_FAILURE;
+      break;
+    }
+    slot->id_len = (uint8_t) id_len;
+    slot->sealed_len = (uint8_t) sealed_len;
+    memcpy(slot->id, plaintext, (size_t) id_len);
+  }
+  kmyth_clear(plaintext, sizeof(plaintext));
+
+  if (ret == EXIT_SUCCESS && (msync(base, size, MS_SYNC) || fsync(fd)))
+  {
+    kmyth_log(LOG_ERR, "Failed to write the key store %s: %s", tmp_path,
+              strerror(errno));
+    ret = EXIT_FAILURE;
+  }
+  munmap(base, size);
+  close(fd);
+
+  if (ret == EXIT_SUCCESS && rename(tmp_path, path))
+  {
+    kmyth_log(LOG_ERR, "Failed to replace the key store %s: %s", path,
+              strerror(errno));
+    ret = EXIT_FAILURE;
+  }
+  if (ret != EXIT_SUCCESS)
+  {
+    unlink(tmp_path);
+  }
+  free(tmp_path);
+
+  return ret;
+}
@@ -0,0 +1,125 @@
+/**
+ * @file  key_store.h
+ *
+ * @brief Provides an indexed key store backend for the ECDHE test server.
+ *
+ * A key store file maps key IDs to key material. It is a header followed
+ * by a power of two number of fixed size slots, a key's slot found by
+ * hashing its ID (with linear probing past collisions), so a lookup reads
+ * a slot or two of the memory-mapped file whatever the number of keys.
+ * The IDs are stored in the clear; each key is stored encrypted (AES-GCM,
+ * together with its ID) under a store wrapping key, which is itself kept
+ * kmyth-sealed (.ski) alongside the store.
+ *
+ * A store is reloaded, without a restart, when its file is replaced (e.g.,
+ * by writing the new store to a temporary file and renaming it over the
+ * old one). Lookups may be made from any number of threads at once.
+ */
+
+#ifndef KMYTH_KEY_STORE_H
+#define KMYTH_KEY_STORE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+/// Longest key ID a store holds, in bytes.
+#define KEY_STORE_MAX_ID_LEN 48
+
+/// Longest key a store holds, in bytes.
+#define KEY_STORE_MAX_KEY_LEN 32
+
+/// Size (in bytes) of a store wrapping key (AES-256).
+#define KEY_STORE_WRAP_KEY_LEN 32
+
+/// Time (in seconds) between checks of whether the store file was replaced.
+#define KEY_STORE_RELOAD_INTERVAL 1
+
+typedef struct KeyStoreMap KeyStoreMap;
+
+typedef struct KeyStore
+{
+  char *path;
+  unsigned char wrap_key[KEY_STORE_WRAP_KEY_LEN];
+  // the mapped store file, replaced (under the write lock) on reload
+  pthread_rwlock_t lock;
+  KeyStoreMap *map;
+  // the file that is mapped, and when it was last checked for a new one
+  dev_t dev;
+  ino_t ino;
+  time_t mtime;
+  pthread_mutex_t check_lock;
+  struct timespec checked;
+} KeyStore;
+
+/**
+ * @brief Opens a key store, unsealing its wrapping key and mapping its file.
+ *
+ * @param[in]  path          Path to the key store file
+ * @param[in]  wrap_key_path Path to the kmyth-sealed (.ski) wrapping key
+ * @param[out] store         The opened store (close with key_store_close())
+ *
+ * @return 0 on success, 1 on error
+ */
+int key_store_open(const char *path, const char *wrap_key_path,
+                   KeyStore ** store);
+
+/**
+ * @brief Opens a key store with a wrapping key already in hand (e.g., one
+ *        just generated by the caller), mapping its file.
+ *
+ * @param[in]  path      Path to the key store file
+ * @param[in]  wrap_key  The store wrapping key (KEY_STORE_WRAP_KEY_LEN
+ *                       bytes), copied into the store
+ * @param[out] store     The opened store (close with key_store_close())
+ *
+ * @return 0 on success, 1 on error
+ */
+int key_store_open_key(const char *path, const unsigned char *wrap_key,
+                       KeyStore ** store);
+
+/**
+ * @brief Closes a key store, clearing its wrapping key. The handle is set
+ *        to NULL.
+ *
+ * @param[in,out] store  The store to be closed
+ */
+void key_store_close(KeyStore ** store);
+
+/**
+ * @brief Looks up a key, first reloading the store if its file has been
+ *        replaced (checked at most every KEY_STORE_RELOAD_INTERVAL seconds).
+ *
+ * @param[in]  store    The store
+ * @param[in]  id       ID of the key
+ * @param[in]  id_len   Length (in bytes) of the ID
+ * @param[out] key      Buffer (of KEY_STORE_MAX_KEY_LEN bytes) the key is
+ *                      written to
+ * @param[out] key_len  Length (in bytes) of the key
+ *
+ * @return 0 on success, 1 if the key is not in the store (or on error)
+ */
+int key_store_get(KeyStore * store,
+                  const unsigned char *id, size_t id_len,
+                  unsigned char *key, size_t *key_len);
+
+/**
+ * @brief Writes a new key store file, of random keys with the IDs "1" to
+ *        the given count (in decimal), sized to be at most half full.
+ *
+ * @param[in]  path       Path to the key store file (replaced atomically if
+ *                        it exists)
+ * @param[in]  wrap_key   The store wrapping key
+ *                        (KEY_STORE_WRAP_KEY_LEN bytes)
+ * @param[in]  key_count  Number of keys
+ * @param[in]  key_len    Length (in bytes) of each key (at most
+ *                        KEY_STORE_MAX_KEY_LEN)
+ *
+ * @return 0 on success, 1 on error
+ */
+int key_store_create(const char *path, const unsigned char *wrap_key,
+                     size_t key_count, size_t key_len);
+
+#endif
@@ -0,0 +1,152 @@
+/**
+ * @file key_store_gen.c
+ * @brief Generates a key store of random test keys for the ECDHE test server.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <openssl/rand.h>
+
+#include <kmyth/file_io.h>
+#include <kmyth/kmyth.h>
+#include <kmyth/kmyth_log.h>
+#include <kmyth/memory_util.h>
+
+#include "key_store.h"
+
+#ifndef DEMO_LOG_LEVEL
+#define DEMO_LOG_LEVEL LOG_DEBUG
+#endif
+
+#define DEFAULT_KEY_LEN 16
+
+static const struct option gen_longopts[] = {
+  {"output", required_argument, 0, 'o'},
+  {"wrap-key", required_argument, 0, 'w'},
+  {"count", required_argument, 0, 'n'},
+  {"key-length", required_argument, 0, 'l'},
+  {"help", no_argument, 0, 'h'},
+  {0, 0, 0, 0}
+};
+
+static void gen_usage(const char *prog)
+{
+  fprintf(stdout,
+          "\nusage: %s [options]\n\n"
+          "options are:\n\n"
+          "  -o or --output      Path to the key store file to write.\n"
+          "  -w or --wrap-key    Path to the kmyth-sealed (.ski) store wrapping key. If the file does not exist, a new wrapping key is generated and sealed to it.\n"
+          "  -n or --count       The number of keys, with the IDs 1 to count.\n"
+          "  -l or --key-length  The length of each key in bytes (16 by default, at most %d).\n"
+          "  -h or --help        Help (displays this usage).\n\n",
+          prog, KEY_STORE_MAX_KEY_LEN);
+}
+
+static int get_wrap_key(char *path, uint8_t ** wrap_key,
+                        size_t *wrap_key_len)
+{
+  uint8_t *ski = NULL;
+  size_t ski_len = 0;
+  int ret;
+
+  if (access(path, F_OK) == 0)
+  {
+    return tpm2_kmyth_unseal_file(path, wrap_key, wrap_key_len,
+                                  NULL, 0, NULL, 0);
+  }
+
+  *wrap_key_len = KEY_STORE_WRAP_KEY_LEN;
+  *wrap_key = malloc(*wrap_key_len);
+  if (*wrap_key == NULL || RAND_bytes(*wrap_key, (int) *wrap_key_len) != 1)
+  {
+    kmyth_log(LOG_ERR, "Failed to generate a store wrapping key.");
+    return EXIT_FAILURE;
+  }
+
+  ret = tpm2_kmyth_seal(*wrap_key, *wrap_key_len, &ski, &ski_len,
+                        NULL, 0, NULL, 0, NULL, 0, NULL);
+  if (ret == 0)
+  {
+    ret = write_bytes_to_file(path, ski, ski_len);
+  }
+  free(ski);
+  if (ret)
+  {
+    kmyth_log(LOG_ERR, "Failed to seal the store wrapping key to %s.", path);
+    return EXIT_FAILURE;
+  }
+  kmyth_log(LOG_INFO, "Sealed a new store wrapping key to %s.", path);
+
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+  char *output_path = NULL;
+  char *wrap_key_path = NULL;
+  long count = 0;
+  long key_len = DEFAULT_KEY_LEN;
+  uint8_t *wrap_key = NULL;
+  size_t wrap_key_len = 0;
+  int options;
+  int option_index = 0;
+  int ret;
+
+  set_applog_severity_threshold(DEMO_LOG_LEVEL);
+
+  while ((options = getopt_long(argc, argv, "o:w:n:l:h",
+                                gen_longopts, &option_index)) != -1)
+  {
+    switch (options)
+    {
+    case 'o':
+      output_path = optarg;
+      break;
+    case 'w':
+      wrap_key_path = optarg;
+      break;
+    case 'n':
+      count = atol(optarg);
+      break;
+    case 'l':
+      key_len = atol(optarg);
+      break;
+    case 'h':
+      gen_usage(argv[0]);
+      return EXIT_SUCCESS;
+    default:
+      gen_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (output_path == NULL || wrap_key_path == NULL || count <= 0
+      || key_len <= 0 || key_len > KEY_STORE_MAX_KEY_LEN)
+  {
+    gen_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (get_wrap_key(wrap_key_path, &wrap_key, &wrap_key_len)
+      || wrap_key_len != KEY_STORE_WRAP_KEY_LEN)
+  {
+    kmyth_log(LOG_ERR, "Failed to get the store wrapping key.");
+    kmyth_clear_and_free(wrap_key, wrap_key_len);
+    return EXIT_FAILURE;
+  }
+
+  ret = key_store_create(output_path, wrap_key, (size_t) count,
+                         (size_t) key_len);
+  kmyth_clear_and_free(wrap_key, wrap_key_len);
+  if (ret)
+  {
+    return EXIT_FAILURE;
+  }
+  kmyth_log(LOG_INFO, "Wrote %ld keys to the key store %s.", count,
+            output_path);
+
+  return EXIT_SUCCESS;
+}
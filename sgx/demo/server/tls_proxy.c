@@ -3,6 +3,11 @@
  * @brief Code for the ECDHE/TLS proxy application.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+
 #include <openssl/bio.h>
 #include <openssl/buffer.h>
 #include <openssl/conf.h>
@@ -12,7 +17,8 @@
 #include <openssl/ssl.h>
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
-#include <poll.h>
+
+#include <kmyth/kmyth_metrics.h>
 
 #include "ecdh_demo.h"
 #include "tls_proxy.h"
@@ -21,12 +27,11 @@
 #define DEMO_LOG_LEVEL LOG_DEBUG
 #endif
 
-#define NUM_POLL_FDS 2
-
 void proxy_init(TLSProxy * proxy)
 {
   secure_memset(proxy, 0, sizeof(TLSProxy));
   init(&proxy->ecdhconn);
+  proxy->epoll_fd = UNSET_FD;
 }
 
 static void tls_cleanup(TLSConnection *tlsconn)
@@ -42,8 +47,22 @@ static void tls_cleanup(TLSConnection *tlsconn)
   }
 }
 
+static void proxy_free_sessions(TLSProxy * proxy);
+
 void proxy_cleanup(TLSProxy * proxy)
 {
+  proxy_free_sessions(proxy);
+  if (proxy->metrics_path != NULL)
+  {
+    kmyth_metrics_stop();
+    unlink(proxy->metrics_path);
+  }
+  if (proxy->epoll_fd != UNSET_FD)
+  {
+    close(proxy->epoll_fd);
+  }
+  kmyth_cipher_ctx_free(proxy->cipher_ctx);
+
   cleanup(&proxy->ecdhconn);
   tls_cleanup(&proxy->tlsconn);
 
@@ -71,8 +90,11 @@ static void proxy_usage(const char *prog)
     "  -C or --ca-path         Optional certificate file used to verify the remote server (if not specified, the default system CA chain will be used instead).\n"
     "  -R or --client-key      Local private key PEM file used for TLS connections.\n"
     "  -U or --client-cert     Local certificate PEM file used for TLS connections.\n"
+    "  -K or --ktls            Use kernel TLS for TLS connections (falls back to OpenSSL where the kernel does not support it).\n"
     "Test Options --\n"
     "  -m or --maxconn  The number of connections the server will accept before exiting (unlimited by default, or if the value is not a positive integer).\n"
+    "  -b or --backlog  The listen backlog of the server socket (1 by default, or if the value is not a positive integer).\n"
+    "  -M or --metrics  Optional local socket path on which to serve handshake latency and traffic metrics.\n"
     "Misc --\n"
     "  -h or --help     Help (displays this usage).\n\n", prog);
 }
@@ -90,7 +112,7 @@ static void proxy_get_options(TLSProxy * proxy, int argc, char **argv)
   int option_index = 0;
 
   while ((options =
-          getopt_long(argc, argv, "r:u:p:I:P:C:R:U:m:h", longopts, &option_index)) != -1)
+          getopt_long(argc, argv, "r:u:p:I:P:C:R:U:Km:b:M:h", proxy_longopts, &option_index)) != -1)
   {
     switch (options)
     {
@@ -121,10 +143,19 @@ static void proxy_get_options(TLSProxy * proxy, int argc, char **argv)
     case 'U':
       proxy->tlsconn.client_cert_path = optarg;
       break;
+    case 'K':
+      proxy->tlsconn.ktls = true;
+      break;
     // Test
     case 'm':
       proxy->ecdhconn.maxconn = atoi(optarg);
       break;
+    case 'b':
+      proxy->ecdhconn.backlog = atoi(optarg);
+      break;
+    case 'M':
+      proxy->metrics_path = optarg;
+      break;
     // Misc
     case 'h':
       proxy_usage(argv[0]);
@@ -251,6 +282,16 @@ static int tls_config_ctx(TLSConnection * tlsconn)
     }
   }
 
+  /* Hand the record keys to the kernel once each handshake is done. */
+  if (tlsconn->ktls)
+  {
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_options(tlsconn->ctx, SSL_OP_ENABLE_KTLS);
+#else
+    kmyth_log(LOG_WARNING, "OpenSSL has no kernel TLS support, TLS records will be processed in user space");
+#endif
+  }
+
   return 0;
 }
 
@@ -335,60 +376,791 @@ static void tls_get_verify_error(TLSConnection * tlsconn)
   }
 }
 
-static int tls_connect(TLSConnection * tlsconn)
+/*
+ * The proxy serves every session from one epoll loop. Both sockets of a
+ * session are non-blocking, and data moves through fixed buffers carved
+ * out of a per-session arena (released arenas are kept for reuse):
+ *   ecdh_in   raw bytes read from the ECDH client (framed ciphertext)
+ *   ecdh_out  framed ciphertext waiting to be written to the ECDH client
+ *   tls_in    plaintext read from the TLS server, encrypted per read
+ *   tls_out   decrypted plaintext waiting to be written to the TLS server
+ * A side is only read while the buffer it feeds has room, so a slow peer
+ * applies back pressure instead of growing the buffers.
+ */
+
+#define PROXY_FRAME_SIZE (sizeof(struct ECDHMessageHeader) + ECDH_MAX_MSG_SIZE)
+#define PROXY_PLAINTEXT_SIZE (ECDH_MAX_MSG_SIZE - GCM_IV_LEN - GCM_TAG_LEN)
+
+#define PROXY_ECDH_IN_SIZE PROXY_FRAME_SIZE
+#define PROXY_ECDH_OUT_SIZE (2 * PROXY_FRAME_SIZE)
+#define PROXY_TLS_IN_SIZE PROXY_PLAINTEXT_SIZE
+#define PROXY_TLS_OUT_SIZE (2 * PROXY_PLAINTEXT_SIZE)
+#define PROXY_ARENA_SIZE (PROXY_ECDH_IN_SIZE + PROXY_ECDH_OUT_SIZE \
+                          + PROXY_TLS_IN_SIZE + PROXY_TLS_OUT_SIZE)
+
+#define PROXY_MAX_FREE_ARENAS 16
+#define PROXY_MAX_EVENTS 64
+
+#define PROXY_HANDSHAKE_HELP "Time taken by each handshake of a proxy session."
+#define PROXY_BYTES_HELP "Plaintext bytes relayed by the proxy."
+#define PROXY_KTLS_HELP "TLS connections whose records the kernel processes."
+
+typedef struct ProxyArena
+{
+  struct ProxyArena *next;
+  unsigned char data[PROXY_ARENA_SIZE];
+} ProxyArena;
+
+typedef struct ProxyBuffer
+{
+  unsigned char *data;
+  size_t size;
+  size_t start;
+  size_t end;
+} ProxyBuffer;
+
+typedef enum ProxySessionState
+{
+  SESSION_HANDSHAKE,
+  SESSION_TLS_CONNECT,
+  SESSION_PROXYING,
+  SESSION_DRAINING,
+  SESSION_CLOSED
+} ProxySessionState;
+
+typedef struct ProxyEndpoint
+{
+  struct ProxySession *session;
+  int fd;
+  bool registered;
+  uint32_t events;
+} ProxyEndpoint;
+
+typedef struct ProxySession
+{
+  ECDHServer ecdhconn;
+  TLSConnection tlsconn;
+  ProxySessionState state;
+  ProxyEndpoint ecdh_end;
+  ProxyEndpoint tls_end;
+  bool tls_read_wants_write;
+  bool tls_write_wants_read;
+  bool tls_connect_wants_write;
+  ProxyArena *arena;
+  ProxyBuffer ecdh_in;
+  ProxyBuffer ecdh_out;
+  ProxyBuffer tls_in;
+  ProxyBuffer tls_out;
+  uint64_t phase_begin;
+  struct ProxySession *next;
+} ProxySession;
+
+static size_t buffer_len(const ProxyBuffer * buf)
+{
+  return buf->end - buf->start;
+}
+
+static size_t buffer_space(ProxyBuffer * buf)
+{
+  /* Move any unconsumed bytes to the front before reporting the room left. */
+  if (buf->start == buf->end)
+  {
+    buf->start = 0;
+    buf->end = 0;
+  }
+  else if (buf->start > 0)
+  {
+    memmove(buf->data, buf->data + buf->start, buffer_len(buf));
+    buf->end -= buf->start;
+    buf->start = 0;
+  }
+  return buf->size - buf->end;
+}
+
+static void buffer_consume(ProxyBuffer * buf, size_t len)
+{
+  buf->start += len;
+  if (buf->start == buf->end)
+  {
+    buf->start = 0;
+    buf->end = 0;
+  }
+}
+
+static void buffer_carve(ProxyBuffer * buf, unsigned char **next, size_t size)
+{
+  buf->data = *next;
+  buf->size = size;
+  buf->start = 0;
+  buf->end = 0;
+  *next += size;
+}
+
+static ProxyArena *arena_get(TLSProxy * proxy)
+{
+  ProxyArena *arena = proxy->free_arenas;
+
+  if (arena != NULL)
+  {
+    proxy->free_arenas = arena->next;
+    proxy->free_arena_count--;
+    arena->next = NULL;
+    return arena;
+  }
+
+  return calloc(1, sizeof(ProxyArena));
+}
+
+static void arena_put(TLSProxy * proxy, ProxyArena * arena)
+{
+  if (arena == NULL)
+  {
+    return;
+  }
+
+  /* The arena holds session plaintext, so it is cleared either way. */
+  if (proxy->free_arena_count >= PROXY_MAX_FREE_ARENAS)
+  {
+    kmyth_clear_and_free(arena, sizeof(ProxyArena));
+    return;
+  }
+  kmyth_clear(arena, sizeof(ProxyArena));
+  arena->next = proxy->free_arenas;
+  proxy->free_arenas = arena;
+  proxy->free_arena_count++;
+}
+
+static int endpoint_update(int epoll_fd, ProxyEndpoint * end, uint32_t events)
+{
+  struct epoll_event event;
+
+  if (end->fd == UNSET_FD || (end->registered && end->events == events))
+  {
+    return 0;
+  }
+
+  secure_memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.ptr = end;
+  if (epoll_ctl(epoll_fd, end->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+                end->fd, &event))
+  {
+    kmyth_log(LOG_ERR, "Failed to update the epoll set: %s", strerror(errno));
+    return -1;
+  }
+  end->registered = true;
+  end->events = events;
+
+  return 0;
+}
+
+static int session_update_events(int epoll_fd, ProxySession * session)
+{
+  uint32_t ecdh_events = 0;
+  uint32_t tls_events = 0;
+
+  switch (session->state)
+  {
+  case SESSION_HANDSHAKE:
+    ecdh_events = EPOLLIN;
+    break;
+  case SESSION_TLS_CONNECT:
+    tls_events = session->tls_connect_wants_write ? EPOLLOUT : EPOLLIN;
+    break;
+  case SESSION_PROXYING:
+    if (buffer_space(&session->ecdh_in) > 0)
+    {
+      ecdh_events |= EPOLLIN;
+    }
+    if ((buffer_space(&session->ecdh_out) >= PROXY_FRAME_SIZE
+         && !session->tls_read_wants_write) || session->tls_write_wants_read)
+    {
+      tls_events |= EPOLLIN;
+    }
+    if ((buffer_len(&session->tls_out) > 0 && !session->tls_write_wants_read)
+        || session->tls_read_wants_write)
+    {
+      tls_events |= EPOLLOUT;
+    }
+    break;
+  default:
+    break;
+  }
+  if (buffer_len(&session->ecdh_out) > 0)
+  {
+    ecdh_events |= EPOLLOUT;
+  }
+
+  if (endpoint_update(epoll_fd, &session->ecdh_end, ecdh_events)
+      || endpoint_update(epoll_fd, &session->tls_end, tls_events))
+  {
+    return -1;
+  }
+
+  return 0;
+}
+
+static ProxySession *session_new(TLSProxy * proxy, int socket_fd)
+{
+  ProxySession *session = calloc(1, sizeof(ProxySession));
+  unsigned char *next = NULL;
+
+  if (session == NULL)
+  {
+    return NULL;
+  }
+  session->arena = arena_get(proxy);
+  if (session->arena == NULL)
+  {
+    free(session);
+    return NULL;
+  }
+
+  next = session->arena->data;
+  buffer_carve(&session->ecdh_in, &next, PROXY_ECDH_IN_SIZE);
+  buffer_carve(&session->ecdh_out, &next, PROXY_ECDH_OUT_SIZE);
+  buffer_carve(&session->tls_in, &next, PROXY_TLS_IN_SIZE);
+  buffer_carve(&session->tls_out, &next, PROXY_TLS_OUT_SIZE);
+
+  /* The copies share the long-term keys and the SSL_CTX. */
+  session->ecdhconn = proxy->ecdhconn;
+  session->ecdhconn.socket_fd = socket_fd;
+  session->tlsconn = proxy->tlsconn;
+  session->tlsconn.conn = NULL;
+
+  session->state = SESSION_HANDSHAKE;
+  session->ecdh_end.session = session;
+  session->ecdh_end.fd = socket_fd;
+  session->tls_end.session = session;
+  session->tls_end.fd = UNSET_FD;
+  session->phase_begin = kmyth_metrics_clock();
+
+  return session;
+}
+
+static void session_free(TLSProxy * proxy, ProxySession * session)
+{
+  /* Closing the sockets also removes them from the epoll set. */
+  if (session->tlsconn.conn != NULL)
+  {
+    BIO_free_all(session->tlsconn.conn);
+  }
+  cleanup_connection(&session->ecdhconn);
+  arena_put(proxy, session->arena);
+  free(session);
+}
+
+static int session_ecdh_read(ProxySession * session, bool *progress)
+{
+  ProxyBuffer *buf = &session->ecdh_in;
+
+  while (buffer_space(buf) > 0)
+  {
+    ssize_t count = recv(session->ecdh_end.fd, buf->data + buf->end,
+                         buf->size - buf->end, 0);
+
+    if (count > 0)
+    {
+      buf->end += (size_t) count;
+      *progress = true;
+      continue;
+    }
+    if (count == 0)
+    {
+      kmyth_log(LOG_INFO, "ECDH connection is closed");
+      return 1;
+    }
+    if (errno == EINTR)
+    {
+      continue;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+    {
+      return 0;
+    }
+    kmyth_log(LOG_ERR, "ECDH read error: %s", strerror(errno));
+    return 1;
+  }
+
+  return 0;
+}
+
+static int session_ecdh_write(ProxySession * session, bool *progress)
+{
+  ProxyBuffer *buf = &session->ecdh_out;
+
+  while (buffer_len(buf) > 0)
+  {
+    ssize_t count = send(session->ecdh_end.fd, buf->data + buf->start,
+                         buffer_len(buf), MSG_NOSIGNAL);
+
+    if (count > 0)
+    {
+      buffer_consume(buf, (size_t) count);
+      *progress = true;
+      continue;
+    }
+    if (count < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      return 0;
+    }
+    kmyth_log(LOG_ERR, "ECDH write error");
+    return 1;
+  }
+
+  return 0;
+}
+
+static int session_handshake(ProxySession * session)
+{
+  /*
+   * The client's signed ephemeral public key:
+   *   key length || key || signature length || signature
+   */
+  ProxyBuffer *in = &session->ecdh_in;
+  ProxyBuffer *out = &session->ecdh_out;
+  unsigned char *p = in->data + in->start;
+  size_t len = buffer_len(in);
+  size_t pub_len = 0;
+  unsigned int sig_len = 0;
+  size_t hello_len = 0;
+  unsigned char *msg = NULL;
+  size_t msg_len = 0;
+  jmp_buf conn_error;
+
+  if (len < sizeof(pub_len))
+  {
+    return 0;
+  }
+  memcpy(&pub_len, p, sizeof(pub_len));
+  if (pub_len > in->size - sizeof(pub_len) - sizeof(sig_len))
+  {
+    kmyth_log(LOG_ERR, "Received invalid public key size.");
+    return 1;
+  }
+  if (len < sizeof(pub_len) + pub_len + sizeof(sig_len))
+  {
+    return 0;
+  }
+  memcpy(&sig_len, p + sizeof(pub_len) + pub_len, sizeof(sig_len));
+  hello_len = sizeof(pub_len) + pub_len + sizeof(sig_len) + sig_len;
+  if (sig_len > in->size || hello_len > in->size)
+  {
+    kmyth_log(LOG_ERR, "Received invalid public key signature size.");
+    return 1;
+  }
+  if (len < hello_len)
+  {
+    return 0;
+  }
+
+  if (setjmp(conn_error))
+  {
+    /* error() has already released the connection state. */
+    session->ecdh_end.fd = UNSET_FD;
+    session->ecdhconn.conn_error = NULL;
+    return 1;
+  }
+  session->ecdhconn.conn_error = &conn_error;
+
+  accept_ephemeral_public(&session->ecdhconn,
+                          p + sizeof(pub_len), pub_len,
+                          p + hello_len - sig_len, sig_len);
+  make_ephemeral_keypair(&session->ecdhconn);
+  build_ephemeral_public(&session->ecdhconn, &msg, &msg_len);
+  if (msg_len > buffer_space(out))
+  {
+    kmyth_log(LOG_ERR, "Public key message exceeds the session buffer.");
+    kmyth_clear_and_free(msg, msg_len);
+    error(&session->ecdhconn);
+  }
+  memcpy(out->data + out->end, msg, msg_len);
+  out->end += msg_len;
+  kmyth_clear_and_free(msg, msg_len);
+
+  get_session_key(&session->ecdhconn);
+
+  session->ecdhconn.conn_error = NULL;
+  buffer_consume(in, hello_len);
+
+  /* Anything the client sent after its key is kept for the proxy phase. */
+  if (tls_config_conn(&session->tlsconn))
+  {
+    return 1;
+  }
+  BIO_set_nbio(session->tlsconn.conn, 1);
+  session->state = SESSION_TLS_CONNECT;
+
+  kmyth_metrics_observe_latency("kmyth_proxy_handshake_duration_seconds",
+                                "handshake=\"ecdh\"", PROXY_HANDSHAKE_HELP,
+                                session->phase_begin);
+  session->phase_begin = kmyth_metrics_clock();
+
+  return 0;
+}
+
+static void session_tls_log_ktls(ProxySession * session)
+{
+#if defined(SSL_OP_ENABLE_KTLS) && defined(BIO_get_ktls_send)
+  SSL *ssl = NULL;
+  bool send_on = false;
+  bool recv_on = false;
+
+  if (!session->tlsconn.ktls)
+  {
+    return;
+  }
+  BIO_get_ssl(session->tlsconn.conn, &ssl);  // internal pointer, not a new allocation
+  if (ssl == NULL)
+  {
+    return;
+  }
+  send_on = BIO_get_ktls_send(SSL_get_wbio(ssl));
+  recv_on = BIO_get_ktls_recv(SSL_get_rbio(ssl));
+  kmyth_log(LOG_DEBUG, "Kernel TLS: send %s, receive %s",
+            send_on ? "on" : "off", recv_on ? "on" : "off");
+  if (send_on)
+  {
+    kmyth_metrics_count("kmyth_proxy_ktls_sessions_total",
+                        "direction=\"send\"", PROXY_KTLS_HELP, 1);
+  }
+  if (recv_on)
+  {
+    kmyth_metrics_count("kmyth_proxy_ktls_sessions_total",
+                        "direction=\"receive\"", PROXY_KTLS_HELP, 1);
+  }
+#else
+  (void) session;
+#endif
+}
+
+static int session_tls_connect(ProxySession * session)
 {
+  BIO *conn = session->tlsconn.conn;
   int ret;
   unsigned long ssl_err;
 
-  ret = BIO_do_connect(tlsconn->conn);
+  ERR_clear_error();
+  ret = BIO_do_connect(conn);
   ssl_err = ERR_get_error();
-  if (1 != ret)
+
+  /* The connect BIO creates its socket on the first attempt. */
+  session->tls_end.fd = BIO_get_fd(conn, NULL);
+
+  if (ret == 1)
   {
-    /* Both connection failures and certificate verification failures are caught here. */
-    log_openssl_error(ssl_err, "BIO_do_connect");
-    tls_get_verify_error(tlsconn);
-    return -1;
+    kmyth_log(LOG_DEBUG, "TLS connection established");
+    session_tls_log_ktls(session);
+    session->state = SESSION_PROXYING;
+    kmyth_metrics_observe_latency("kmyth_proxy_handshake_duration_seconds",
+                                  "handshake=\"tls\"", PROXY_HANDSHAKE_HELP,
+                                  session->phase_begin);
+    return 0;
+  }
+  if (BIO_should_retry(conn))
+  {
+    session->tls_connect_wants_write = !BIO_should_read(conn);
+    return 0;
+  }
+
+  /* Both connection failures and certificate verification failures are caught here. */
+  log_openssl_error(ssl_err, "BIO_do_connect");
+  tls_get_verify_error(&session->tlsconn);
+  return 1;
+}
+
+static int session_decrypt_frames(TLSProxy * proxy, ProxySession * session,
+                                  bool *progress)
+{
+  ProxyBuffer *in = &session->ecdh_in;
+  ProxyBuffer *out = &session->tls_out;
+  struct ECDHMessageHeader header;
+  unsigned char *plaintext = NULL;
+  size_t plaintext_len = 0;
+
+  while (buffer_len(in) >= sizeof(header)
+         && buffer_space(out) >= PROXY_PLAINTEXT_SIZE)
+  {
+    memcpy(&header, in->data + in->start, sizeof(header));
+    if (header.msg_size > ECDH_MAX_MSG_SIZE)
+    {
+      kmyth_log(LOG_ERR, "Received invalid ECDH message header.");
+      return 1;
+    }
+    if (buffer_len(in) < sizeof(header) + header.msg_size)
+    {
+      break;
+    }
+
+    if (aes_gcm_decrypt_with_ctx(proxy->cipher_ctx,
+                                 session->ecdhconn.session_key,
+                                 session->ecdhconn.session_key_len,
+                                 in->data + in->start + sizeof(header),
+                                 header.msg_size,
+                                 &plaintext, &plaintext_len)
+        || plaintext_len > buffer_space(out))
+    {
+      kmyth_log(LOG_ERR, "Failed to decrypt a message.");
+      kmyth_clear_and_free(plaintext, plaintext_len);
+      return 1;
+    }
+    kmyth_log(LOG_DEBUG, "Received %zu bytes on ECDH connection",
+              plaintext_len);
+    kmyth_metrics_count("kmyth_proxy_bytes_total",
+                        "direction=\"to_server\"", PROXY_BYTES_HELP,
+                        plaintext_len);
+
+    memcpy(out->data + out->end, plaintext, plaintext_len);
+    out->end += plaintext_len;
+    kmyth_clear_and_free(plaintext, plaintext_len);
+    plaintext = NULL;
+    buffer_consume(in, sizeof(header) + header.msg_size);
+    *progress = true;
   }
 
   return 0;
 }
 
-static int setup_ecdhconn(TLSProxy * proxy)
+static int session_tls_write(ProxySession * session, bool *progress)
 {
-  ECDHServer *ecdhconn = &proxy->ecdhconn;
+  ProxyBuffer *buf = &session->tls_out;
+  BIO *conn = session->tlsconn.conn;
 
-  create_server_socket(ecdhconn);
+  session->tls_write_wants_read = false;
+  while (buffer_len(buf) > 0)
+  {
+    int count = BIO_write(conn, buf->data + buf->start, buffer_len(buf));
 
-  load_private_key(ecdhconn);
-  load_public_key(ecdhconn);
+    if (count > 0)
+    {
+      buffer_consume(buf, (size_t) count);
+      *progress = true;
+      continue;
+    }
+    if (BIO_should_retry(conn))
+    {
+      session->tls_write_wants_read = BIO_should_read(conn);
+      return 0;
+    }
+    kmyth_log(LOG_ERR, "TLS write error");
+    return 1;
+  }
 
-  make_ephemeral_keypair(ecdhconn);
+  return 0;
+}
 
-  recv_ephemeral_public(ecdhconn);
-  send_ephemeral_public(ecdhconn);
+static int session_tls_read(TLSProxy * proxy, ProxySession * session,
+                            bool *progress)
+{
+  ProxyBuffer *in = &session->tls_in;
+  ProxyBuffer *out = &session->ecdh_out;
+  BIO *conn = session->tlsconn.conn;
+  struct ECDHMessageHeader header;
+  unsigned char *ciphertext = NULL;
+  size_t ciphertext_len = 0;
+
+  session->tls_read_wants_write = false;
+  while (buffer_space(out) >= PROXY_FRAME_SIZE)
+  {
+    /* Keep reading while OpenSSL still holds decrypted records. */
+    int count = BIO_read(conn, in->data, in->size);
 
-  get_session_key(ecdhconn);
+    if (count <= 0 && BIO_should_retry(conn))
+    {
+      session->tls_read_wants_write = BIO_should_write(conn);
+      return 0;
+    }
+    if (count == 0)
+    {
+      kmyth_log(LOG_INFO, "TLS connection is closed");
+      session->state = SESSION_DRAINING;
+      return 0;
+    }
+    if (count < 0)
+    {
+      kmyth_log(LOG_ERR, "TLS read error");
+      return 1;
+    }
+    kmyth_log(LOG_DEBUG, "Received %d bytes on TLS connection", count);
+    kmyth_metrics_count("kmyth_proxy_bytes_total",
+                        "direction=\"to_client\"", PROXY_BYTES_HELP,
+                        (uint64_t) count);
+
+    if (aes_gcm_encrypt_with_ctx(proxy->cipher_ctx,
+                                 session->ecdhconn.session_key,
+                                 session->ecdhconn.session_key_len,
+                                 in->data, (size_t) count,
+                                 &ciphertext, &ciphertext_len)
+        || ciphertext_len > ECDH_MAX_MSG_SIZE)
+    {
+      kmyth_log(LOG_ERR, "Failed to encrypt a message.");
+      kmyth_clear_and_free(ciphertext, ciphertext_len);
+      return 1;
+    }
+    kmyth_clear(in->data, (size_t) count);
+
+    secure_memset(&header, 0, sizeof(header));
+    header.msg_size = ciphertext_len;
+    memcpy(out->data + out->end, &header, sizeof(header));
+    memcpy(out->data + out->end + sizeof(header), ciphertext, ciphertext_len);
+    out->end += sizeof(header) + ciphertext_len;
+    kmyth_clear_and_free(ciphertext, ciphertext_len);
+    ciphertext = NULL;
+    *progress = true;
+  }
 
   return 0;
 }
 
-static int setup_tlsconn(TLSProxy * proxy)
+static int session_pump(TLSProxy * proxy, ProxySession * session)
 {
-  TLSConnection *tlsconn = &proxy->tlsconn;
+  bool progress = true;
 
-  if (tls_config_ctx(tlsconn))
+  /* Move data in both directions until neither side can make progress. */
+  while (progress)
   {
-    proxy_error(proxy);
+    progress = false;
+
+    if (session_ecdh_write(session, &progress))
+    {
+      return 1;
+    }
+
+    switch (session->state)
+    {
+    case SESSION_HANDSHAKE:
+      if (session_ecdh_read(session, &progress) || session_handshake(session))
+      {
+        return 1;
+      }
+      progress = progress || session->state != SESSION_HANDSHAKE;
+      break;
+    case SESSION_TLS_CONNECT:
+      if (session_tls_connect(session))
+      {
+        return 1;
+      }
+      progress = progress || session->state != SESSION_TLS_CONNECT;
+      break;
+    case SESSION_PROXYING:
+      if (session_ecdh_read(session, &progress)
+          || session_decrypt_frames(proxy, session, &progress)
+          || session_tls_write(session, &progress)
+          || session_tls_read(proxy, session, &progress))
+      {
+        return 1;
+      }
+      break;
+    case SESSION_DRAINING:
+      /* The TLS server is done: close once the client has everything. */
+      if (buffer_len(&session->ecdh_out) == 0)
+      {
+        return 1;
+      }
+      break;
+    default:
+      return 1;
+    }
   }
 
-  if (tls_config_conn(tlsconn))
+  return 0;
+}
+
+static void proxy_free_sessions(TLSProxy * proxy)
+{
+  ProxySession *lists[] = { proxy->sessions, proxy->closed_sessions };
+  ProxyArena *arena = NULL;
+
+  for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++)
   {
-    proxy_error(proxy);
+    while (lists[i] != NULL)
+    {
+      ProxySession *session = lists[i];
+
+      lists[i] = session->next;
+      session_free(proxy, session);
+    }
   }
+  proxy->sessions = NULL;
+  proxy->closed_sessions = NULL;
+  proxy->session_count = 0;
 
-  if (tls_connect(tlsconn))
+  while (proxy->free_arenas != NULL)
   {
-    proxy_error(proxy);
+    arena = proxy->free_arenas;
+    proxy->free_arenas = arena->next;
+    free(arena);
+  }
+  proxy->free_arena_count = 0;
+}
+
+static void proxy_close_session(TLSProxy * proxy, ProxySession * session)
+{
+  ProxySession **link = &proxy->sessions;
+
+  while (*link != NULL && *link != session)
+  {
+    link = &(*link)->next;
+  }
+  if (*link != NULL)
+  {
+    *link = session->next;
+  }
+  proxy->session_count--;
+
+  /* Freed after the current batch of events, which may still refer to it. */
+  session->state = SESSION_CLOSED;
+  session->next = proxy->closed_sessions;
+  proxy->closed_sessions = session;
+}
+
+static int proxy_accept(TLSProxy * proxy, int listen_fd, int *numconn)
+{
+  ECDHServer *ecdhconn = &proxy->ecdhconn;
+
+  while (ecdhconn->maxconn <= 0 || *numconn < ecdhconn->maxconn)
+  {
+    int socket_fd = accept(listen_fd, NULL, NULL);
+    ProxySession *session = NULL;
+
+    if (socket_fd == -1)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+      {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+      {
+        kmyth_log(LOG_WARNING, "Socket accept failed: %s", strerror(errno));
+      }
+      return 0;
+    }
+    (*numconn)++;
+
+    if (fcntl(socket_fd, F_SETFL, fcntl(socket_fd, F_GETFL) | O_NONBLOCK) == 0)
+    {
+      session = session_new(proxy, socket_fd);
+    }
+    if (session == NULL)
+    {
+      kmyth_log(LOG_ERR, "Failed to set up a proxy session.");
+      close(socket_fd);
+      continue;
+    }
+    session->next = proxy->sessions;
+    proxy->sessions = session;
+    proxy->session_count++;
+    kmyth_metrics_count("kmyth_proxy_sessions_total", NULL,
+                        "Connections accepted by the proxy.", 1);
+
+    if (session_update_events(proxy->epoll_fd, session))
+    {
+      proxy_close_session(proxy, session);
+    }
   }
 
   return 0;
@@ -396,67 +1168,127 @@ static int setup_tlsconn(TLSProxy * proxy)
 
 void proxy_start(TLSProxy * proxy)
 {
-  struct pollfd pfds[NUM_POLL_FDS];
-  int bytes_read = 0;
-  int bytes_written = 0;
-  unsigned char tls_msg_buf[ECDH_MAX_MSG_SIZE];
-  unsigned char *ecdh_msg_buf = NULL;
-  size_t ecdh_msg_len = 0;
+  struct epoll_event event;
+  struct epoll_event events[PROXY_MAX_EVENTS];
   ECDHServer *ecdhconn = &proxy->ecdhconn;
-  BIO *tls_bio = proxy->tlsconn.conn;
+  int listen_fd = UNSET_FD;
+  int numconn = 0;
 
-  secure_memset(pfds, 0, sizeof(pfds));
-  secure_memset(tls_msg_buf, 0, sizeof(tls_msg_buf));
+  /* A peer that goes away mid-write must not kill every session. */
+  signal(SIGPIPE, SIG_IGN);
 
-  pfds[0].fd = ecdhconn->socket_fd;
-  pfds[0].events = POLLIN;
+  listen_fd = listen_server_socket(ecdhconn);
+  if (fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK))
+  {
+    kmyth_log(LOG_ERR, "Failed to make the server socket non-blocking.");
+    close(listen_fd);
+    proxy_error(proxy);
+  }
 
-  pfds[1].fd = BIO_get_fd(tls_bio, NULL);
-  pfds[1].events = POLLIN;
+  proxy->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  secure_memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;
+  if (proxy->epoll_fd == UNSET_FD
+      || epoll_ctl(proxy->epoll_fd, EPOLL_CTL_ADD, listen_fd, &event))
+  {
+    kmyth_log(LOG_ERR, "Failed to set up the epoll set.");
+    close(listen_fd);
+    proxy_error(proxy);
+  }
 
   kmyth_log(LOG_DEBUG, "Starting proxy loop");
-  while (true)
+  while (listen_fd != UNSET_FD || proxy->session_count > 0)
   {
-    /* Wait to receive data with no timeout. */
-    poll(pfds, NUM_POLL_FDS, -1);
+    int nevents = epoll_wait(proxy->epoll_fd, events, PROXY_MAX_EVENTS, -1);
 
-    if (pfds[0].revents & POLLIN)
+    if (nevents == -1)
     {
-      ecdh_recv_decrypt(ecdhconn, &ecdh_msg_buf, &ecdh_msg_len);
-      kmyth_log(LOG_DEBUG, "Received %zu bytes on ECDH connection", ecdh_msg_len);
-      bytes_written = BIO_write(tls_bio, ecdh_msg_buf, ecdh_msg_len);
-      if (bytes_written != ecdh_msg_len)
+      if (errno == EINTR)
       {
-        kmyth_log(LOG_ERR, "TLS write error");
-        proxy_error(proxy);
+        continue;
       }
-      kmyth_clear_and_free(ecdh_msg_buf, ecdh_msg_len);
+      kmyth_log(LOG_ERR, "epoll_wait failed: %s", strerror(errno));
+      close(listen_fd);
+      proxy_error(proxy);
     }
 
-    if (pfds[1].revents & POLLIN)
+    for (int i = 0; i < nevents; i++)
     {
-      bytes_read = BIO_read(proxy->tlsconn.conn, tls_msg_buf, sizeof(tls_msg_buf));
-      if (bytes_read == 0)
+      ProxyEndpoint *end = events[i].data.ptr;
+
+      if (end == NULL)
+      {
+        proxy_accept(proxy, listen_fd, &numconn);
+        if (ecdhconn->maxconn > 0 && numconn >= ecdhconn->maxconn)
+        {
+          /* Stop accepting, and finish the sessions already open. */
+          close(listen_fd);
+          listen_fd = UNSET_FD;
+        }
+        continue;
+      }
+
+      ProxySession *session = end->session;
+
+      if (session->state == SESSION_CLOSED)
       {
-        kmyth_log(LOG_INFO, "TLS connection is closed");
-        break;
+        continue;
       }
-      else if (bytes_read < 0)
+      if (session_pump(proxy, session)
+          || session_update_events(proxy->epoll_fd, session))
       {
-        kmyth_log(LOG_ERR, "TLS read error");
-        proxy_error(proxy);
+        proxy_close_session(proxy, session);
       }
-      kmyth_log(LOG_DEBUG, "Received %zu bytes on TLS connection", bytes_read);
-      ecdh_encrypt_send(ecdhconn, tls_msg_buf, bytes_read);
+    }
+
+    while (proxy->closed_sessions != NULL)
+    {
+      ProxySession *session = proxy->closed_sessions;
+
+      proxy->closed_sessions = session->next;
+      session_free(proxy, session);
     }
   }
 }
 
 void proxy_main(TLSProxy * proxy)
 {
-  // The ECDH setup must come first because it forks a new process to handle each new connection.
-  setup_ecdhconn(proxy);
-  setup_tlsconn(proxy);
+  // The long-term keys and the TLS context are shared by every session.
+  load_private_key(&proxy->ecdhconn);
+  load_public_key(&proxy->ecdhconn);
+
+  if (tls_config_ctx(&proxy->tlsconn))
+  {
+    proxy_error(proxy);
+  }
+  SSL_CTX_set_mode(proxy->tlsconn.ctx, SSL_MODE_ENABLE_PARTIAL_WRITE
+                   | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+  proxy->cipher_ctx = kmyth_cipher_ctx_new();
+  if (proxy->cipher_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to allocate the cipher context pool.");
+    proxy_error(proxy);
+  }
+
+  // The metrics endpoint is optional: the proxy runs without it
+  int metrics_fd = UNSET_FD;
+
+  if (proxy->metrics_path != NULL
+      && (setup_unix_server_socket(proxy->metrics_path, 0600, &metrics_fd)
+          || kmyth_metrics_serve(metrics_fd)))
+  {
+    kmyth_log(LOG_WARNING, "Unable to serve metrics on %s",
+              proxy->metrics_path);
+    if (metrics_fd != UNSET_FD)
+    {
+      close(metrics_fd);
+      unlink(proxy->metrics_path);
+    }
+    proxy->metrics_path = NULL;
+  }
+
   proxy_start(proxy);
 }
 
@@ -21,14 +21,26 @@ typedef struct TLSConnection
   char *ca_path;
   char *client_key_path;
   char *client_cert_path;
+  bool ktls;
   SSL_CTX *ctx;
   BIO *conn;
 } TLSConnection;
 
+struct ProxySession;
+struct ProxyArena;
+
 typedef struct TLSProxy
 {
   TLSConnection tlsconn;
   ECDHServer ecdhconn;
+  kmyth_cipher_ctx *cipher_ctx;
+  int epoll_fd;
+  struct ProxySession *sessions;
+  struct ProxySession *closed_sessions;
+  size_t session_count;
+  struct ProxyArena *free_arenas;
+  size_t free_arena_count;
+  char *metrics_path;
 } TLSProxy;
 
 static const struct option proxy_longopts[] = {
@@ -42,8 +54,11 @@ static const struct option proxy_longopts[] = {
   {"ca-path", required_argument, 0, 'C'},
   {"client-key", required_argument, 0, 'R'},
   {"client-cert", required_argument, 0, 'U'},
+  {"ktls", no_argument, 0, 'K'},
   // Test options
   {"maxconn", required_argument, 0, 'm'},
+  {"backlog", required_argument, 0, 'b'},
+  {"metrics", required_argument, 0, 'M'},
   // Misc
   {"help", no_argument, 0, 'h'},
   {0, 0, 0, 0}
@@ -0,0 +1,1317 @@
+/**
+ * @file  kmyth_sgx_bench.c
+ *
+ * Latency benchmark for the kmyth SGX functionality, run against the test
+ * enclave (kmyth_sgx_test_enclave). Reports the p50 and p99 latency of:
+ *   - an ECALL that does no work, giving the cost of the enclave transition
+ *     itself
+ *   - kmyth_sgx_seal_nkl() and kmyth_sgx_unseal_nkl(), for several payload
+ *     sizes
+ *   - a batch of kmyth_sgx_unseal_nkl_parallel() unseals, run on one
+ *     thread and on KMYTH_SGX_ECALL_THREADS threads
+ *   - inserting into, and looking up entries of, the unsealed data table as
+ *     it grows to a number of entries
+ *   - kmyth_enclave_retrieve_key_from_server(), end to end, against a
+ *     running ecdh-server (only when a server port is given), both opening
+ *     a new session for each key and reusing one session
+ *
+ * along with the number of OCALLs each operation made. The OCALLs are
+ * counted by wrapping (with the linker's --wrap option) the untrusted
+ * OCALL implementations, so the counts hold whether or not the enclave was
+ * built with switchless OCALLs (SGX_SWITCHLESS=1).
+ *
+ * The latency samples can be recorded in a benchmark history file, and
+ * compared against a baseline run (of the same SGX mode and OCALL setup)
+ * recorded in one, reporting the benchmarks - among them the cost of the
+ * enclave transition - that significantly slowed down (see
+ * bench_history.h).
+ *
+ * Usage: kmyth_enclave_bench [-n iterations (default 1000)]
+ *                            [-s payload size] [-t max table entries]
+ *                            [-p key server port] [-H key server host]
+ *                            [-r key retrievals (default 10)]
+ *                            [-c client private key PEM]
+ *                            [-u server certificate PEM]
+ *                            [-F name filter] [-f console|csv]
+ *                            [-o history file to record the run in]
+ *                            [-b history file holding the baseline]
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/rand.h>
+
+#include "sgx_urts.h"
+#include "sgx_attributes.h"
+
+#include "ecdh_ocall.h"
+#include "log_ocall.h"
+#include "memory_ocall.h"
+#include "ec_key_cert_marshal.h"
+#include "sgx_seal_unseal_impl.h"
+#include "sgx_enclave_create.h"
+
+#include "kmyth_sgx_test_enclave_u.h"
+
+#include "bench_history.h"
+
+// NB: Should specify as an absolute path.
+#define ENCLAVE_PATH "test/enclave/kmyth_sgx_test_enclave.signed.so"
+
+#define BENCH_DEFAULT_ITERATIONS 1000
+#define BENCH_DEFAULT_TABLE_ENTRIES 1000
+#define BENCH_DEFAULT_RETRIEVE_ITERATIONS 10
+#define BENCH_DEFAULT_SERVER_HOST "localhost"
+#define BENCH_DEFAULT_CLIENT_KEY "demo/data/client_priv_test.pem"
+#define BENCH_DEFAULT_SERVER_CERT "demo/data/server_cert_test.pem"
+#define BENCH_KEY_ID "7"
+#define BENCH_BATCH_KEY_COUNT 8
+#define BENCH_MAX_NAME_LEN 63
+
+#ifndef KMYTH_SGX_MODE
+#define KMYTH_SGX_MODE "SIM"
+#endif
+
+#ifdef KMYTH_SGX_SWITCHLESS
+#define BENCH_SUITE "kmyth_enclave_bench/" KMYTH_SGX_MODE "/switchless"
+#else
+#define BENCH_SUITE "kmyth_enclave_bench/" KMYTH_SGX_MODE
+#endif
+
+typedef enum bench_format
+{
+  BENCH_FORMAT_CONSOLE,
+  BENCH_FORMAT_CSV,
+} bench_format;
+
+typedef enum bench_ocall
+{
+  BENCH_OCALL_LOG,
+  BENCH_OCALL_LOG_BATCH,
+  BENCH_OCALL_FREE,
+  BENCH_OCALL_SETUP_SOCKET,
+  BENCH_OCALL_CLOSE_SOCKET,
+  BENCH_OCALL_TIME,
+  BENCH_OCALL_ECDH_EXCHANGE,
+  BENCH_OCALL_ECDH_SEND,
+  BENCH_OCALL_ECDH_RECV,
+  BENCH_OCALL_ECDH_MSG_BUFFER,
+  BENCH_OCALL_ECDH_SEND_BUFFER,
+  BENCH_OCALL_ECDH_RECV_BUFFER,
+  BENCH_OCALL_PRINT,
+  BENCH_OCALL_COUNT
+} bench_ocall;
+
+static const char *const ocall_names[BENCH_OCALL_COUNT] = {
+  "log_event",
+  "log_event_batch",
+  "OPENSSL_free",
+  "setup_socket",
+  "close_socket",
+  "time",
+  "ecdh_exchange",
+  "ecdh_send",
+  "ecdh_recv",
+  "ecdh_msg_buffer",
+  "ecdh_send_buffer",
+  "ecdh_recv_buffer",
+  "print_table_entry",
+};
+
+// OCALLs made so far, by type (switchless OCALLs are made on worker threads)
+static uint64_t ocall_counts[BENCH_OCALL_COUNT];
+
+static sgx_enclave_id_t eid = 0;
+
+// the results of the run, when they are recorded or compared
+static bench_history *history = NULL;
+static bool history_failed = false;
+
+// latency samples (in ns) of one operation, and the OCALLs it made
+typedef struct bench_samples
+{
+  uint64_t *ns;
+  size_t count;
+  size_t capacity;
+  uint64_t ocalls[BENCH_OCALL_COUNT];
+} bench_samples;
+
+typedef struct bench_options
+{
+  bench_format format;
+  size_t iterations;
+  size_t payload_len;
+  size_t table_entries;
+  const char *filter;
+  const char *server_host;
+  int server_port;
+  const char *client_key_file;
+  const char *server_cert_file;
+} bench_options;
+
+//############################################################################
+// OCALL wrappers
+//
+// The bench is linked with -Wl,--wrap=<ocall> for each of the OCALLs
+// below, so the generated untrusted bridge calls these, which count the
+// OCALL and forward it to the real implementation.
+//############################################################################
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  void __real_log_event_ocall(const char **src_file_ptr,
+                              const char **src_func_ptr,
+                              const int *src_line_ptr, int *severity_ptr,
+                              const char **message_ptr);
+  void __real_log_event_batch_ocall(const kmyth_enclave_log_entry_t *
+                                    entries, size_t count);
+  void __real_OPENSSL_free_ocall(void **mem_block_ptr);
+  int __real_setup_socket_ocall(const char *server_host, int server_host_len,
+                                int server_port, int *socket_fd);
+  void __real_close_socket_ocall(int socket_fd);
+  time_t __real_time_ocall(time_t * timer);
+  int __real_ecdh_exchange_ocall(unsigned char *enclave_ephemeral_public,
+                                 size_t enclave_ephemeral_public_len,
+                                 unsigned char *enclave_eph_pub_signature,
+                                 unsigned int enclave_eph_pub_signature_len,
+                                 unsigned char **remote_eph_pub,
+                                 size_t *remote_eph_pub_len,
+                                 unsigned char **remote_eph_pub_signature,
+                                 unsigned int *remote_eph_pub_signature_len,
+                                 int socket_fd);
+  int __real_ecdh_send_ocall(unsigned char *encrypted_msg,
+                             size_t encrypted_msg_len, int socket_fd);
+  int __real_ecdh_recv_ocall(unsigned char **encrypted_msg,
+                             size_t *encrypted_msg_len, int socket_fd);
+  int __real_ecdh_msg_buffer_ocall(size_t buffer_size,
+                                   unsigned char **buffer);
+  int __real_ecdh_send_buffer_ocall(unsigned char *buffer, size_t msg_len,
+                                    int socket_fd);
+  int __real_ecdh_recv_buffer_ocall(unsigned char *buffer, size_t buffer_size,
+                                    size_t *msg_len,
+                                    unsigned char **overflow_msg,
+                                    int socket_fd);
+
+#define count_ocall(ocall) \
+  __atomic_fetch_add(&ocall_counts[ocall], 1, __ATOMIC_RELAXED)
+
+  void __wrap_log_event_ocall(const char **src_file_ptr,
+                              const char **src_func_ptr,
+                              const int *src_line_ptr, int *severity_ptr,
+                              const char **message_ptr)
+  {
+    count_ocall(BENCH_OCALL_LOG);
+    __real_log_event_ocall(src_file_ptr, src_func_ptr, src_line_ptr,
+                           severity_ptr, message_ptr);
+  }
+
+  void __wrap_log_event_batch_ocall(const kmyth_enclave_log_entry_t *
+                                    entries, size_t count)
+  {
+    count_ocall(BENCH_OCALL_LOG_BATCH);
+    __real_log_event_batch_ocall(entries, count);
+  }
+
+  void __wrap_OPENSSL_free_ocall(void **mem_block_ptr)
+  {
+    count_ocall(BENCH_OCALL_FREE);
+    __real_OPENSSL_free_ocall(mem_block_ptr);
+  }
+
+  int __wrap_setup_socket_ocall(const char *server_host, int server_host_len,
+                                int server_port, int *socket_fd)
+  {
+    count_ocall(BENCH_OCALL_SETUP_SOCKET);
+    return __real_setup_socket_ocall(server_host, server_host_len,
+                                     server_port, socket_fd);
+  }
+
+  void __wrap_close_socket_ocall(int socket_fd)
+  {
+    count_ocall(BENCH_OCALL_CLOSE_SOCKET);
+    __real_close_socket_ocall(socket_fd);
+  }
+
+  time_t __wrap_time_ocall(time_t * timer)
+  {
+    count_ocall(BENCH_OCALL_TIME);
+    return __real_time_ocall(timer);
+  }
+
+  int __wrap_ecdh_exchange_ocall(unsigned char *enclave_ephemeral_public,
+                                 size_t enclave_ephemeral_public_len,
+                                 unsigned char *enclave_eph_pub_signature,
+                                 unsigned int enclave_eph_pub_signature_len,
+                                 unsigned char **remote_eph_pub,
+                                 size_t *remote_eph_pub_len,
+                                 unsigned char **remote_eph_pub_signature,
+                                 unsigned int *remote_eph_pub_signature_len,
+                                 int socket_fd)
+  {
+    count_ocall(BENCH_OCALL_ECDH_EXCHANGE);
+    return __real_ecdh_exchange_ocall(enclave_ephemeral_public,
+                                      enclave_ephemeral_public_len,
+                                      enclave_eph_pub_signature,
+                                      enclave_eph_pub_signature_len,
+                                      remote_eph_pub, remote_eph_pub_len,
+                                      remote_eph_pub_signature,
+                                      remote_eph_pub_signature_len,
+                                      socket_fd);
+  }
+
+  int __wrap_ecdh_send_ocall(unsigned char *encrypted_msg,
+                             size_t encrypted_msg_len, int socket_fd)
+  {
+    count_ocall(BENCH_OCALL_ECDH_SEND);
+    return __real_ecdh_send_ocall(encrypted_msg, encrypted_msg_len,
+                                  socket_fd);
+  }
+
+  int __wrap_ecdh_recv_ocall(unsigned char **encrypted_msg,
+                             size_t *encrypted_msg_len, int socket_fd)
+  {
+    count_ocall(BENCH_OCALL_ECDH_RECV);
+    return __real_ecdh_recv_ocall(encrypted_msg, encrypted_msg_len,
+                                  socket_fd);
+  }
+
+  int __wrap_ecdh_msg_buffer_ocall(size_t buffer_size,
+                                   unsigned char **buffer)
+  {
+    count_ocall(BENCH_OCALL_ECDH_MSG_BUFFER);
+    return __real_ecdh_msg_buffer_ocall(buffer_size, buffer);
+  }
+
+  int __wrap_ecdh_send_buffer_ocall(unsigned char *buffer, size_t msg_len,
+                                    int socket_fd)
+  {
+    count_ocall(BENCH_OCALL_ECDH_SEND_BUFFER);
+    return __real_ecdh_send_buffer_ocall(buffer, msg_len, socket_fd);
+  }
+
+  int __wrap_ecdh_recv_buffer_ocall(unsigned char *buffer, size_t buffer_size,
+                                    size_t *msg_len,
+                                    unsigned char **overflow_msg,
+                                    int socket_fd)
+  {
+    count_ocall(BENCH_OCALL_ECDH_RECV_BUFFER);
+    return __real_ecdh_recv_buffer_ocall(buffer, buffer_size, msg_len,
+                                         overflow_msg, socket_fd);
+  }
+
+  void ocall_print_table_entry(size_t size, uint8_t * data)
+  {
+    count_ocall(BENCH_OCALL_PRINT);
+  }
+
+#ifdef __cplusplus
+}
+#endif
+
+//############################################################################
+// now_ns()
+//############################################################################
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+//############################################################################
+// samples_init()
+//############################################################################
+static int samples_init(bench_samples * samples, size_t capacity)
+{
+  memset(samples, 0, sizeof(bench_samples));
+  samples->ns = (uint64_t *) calloc(capacity, sizeof(uint64_t));
+  if (samples->ns == NULL)
+  {
+    fprintf(stderr, "unable to allocate the samples\n");
+    return 1;
+  }
+  samples->capacity = capacity;
+  return 0;
+}
+
+//############################################################################
+// samples_begin()
+//
+// Starts timing one operation: snapshots the OCALL counts and the clock
+//############################################################################
+static uint64_t samples_begin(uint64_t * ocalls_before)
+{
+  for (int i = 0; i < BENCH_OCALL_COUNT; i++)
+  {
+    ocalls_before[i] = __atomic_load_n(&ocall_counts[i], __ATOMIC_RELAXED);
+  }
+  return now_ns();
+}
+
+//############################################################################
+// samples_end()
+//
+// Records the time an operation took, and the OCALLs it made
+//############################################################################
+static void samples_end(bench_samples * samples, uint64_t start_ns,
+                        uint64_t * ocalls_before)
+{
+  uint64_t end_ns = now_ns();
+
+  if (samples->count < samples->capacity)
+  {
+    samples->ns[samples->count++] = end_ns - start_ns;
+  }
+  for (int i = 0; i < BENCH_OCALL_COUNT; i++)
+  {
+    samples->ocalls[i] +=
+      __atomic_load_n(&ocall_counts[i], __ATOMIC_RELAXED) - ocalls_before[i];
+  }
+}
+
+//############################################################################
+// compare_ns()
+//############################################################################
+static int compare_ns(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+//############################################################################
+// percentile()
+//
+// Nearest-rank percentile (in us) of sorted samples
+//############################################################################
+static double percentile(bench_samples * samples, double p)
+{
+  size_t rank = (size_t) (p * samples->count + 0.999999);
+
+  if (rank < 1)
+  {
+    rank = 1;
+  }
+  return samples->ns[rank - 1] / 1e3;
+}
+
+//############################################################################
+// report_samples()
+//
+// Reports (and frees) the samples of one benchmark, adding them to the run
+// history (if it is kept)
+//############################################################################
+static void report_samples(bench_format format, const char *name,
+                           bench_samples * samples)
+{
+  if (samples->count > 0)
+  {
+    double sum_us = 0;
+    uint64_t ocalls = 0;
+
+    qsort(samples->ns, samples->count, sizeof(uint64_t), compare_ns);
+    for (size_t i = 0; i < samples->count; i++)
+    {
+      sum_us += samples->ns[i] / 1e3;
+    }
+    for (int i = 0; i < BENCH_OCALL_COUNT; i++)
+    {
+      ocalls += samples->ocalls[i];
+    }
+
+    if (format == BENCH_FORMAT_CSV)
+    {
+      printf("\"%s\",%zu,%.3f,%.3f,%.3f,%.2f\n", name, samples->count,
+             percentile(samples, 0.50), percentile(samples, 0.99),
+             sum_us / samples->count, (double) ocalls / samples->count);
+    }
+    else
+    {
+      printf("%-32s %8zu %12.3f %12.3f %12.3f %10.2f\n", name,
+             samples->count, percentile(samples, 0.50),
+             percentile(samples, 0.99), sum_us / samples->count,
+             (double) ocalls / samples->count);
+      for (int i = 0; i < BENCH_OCALL_COUNT; i++)
+      {
+        if (samples->ocalls[i] > 0)
+        {
+          printf("%-32s %8s %-25s %10.2f\n", "", "", ocall_names[i],
+                 (double) samples->ocalls[i] / samples->count);
+        }
+      }
+    }
+    fflush(stdout);
+
+    if (history != NULL)
+    {
+      double *ns = (double *) calloc(samples->count, sizeof(double));
+
+      for (size_t i = 0; ns != NULL && i < samples->count; i++)
+      {
+        ns[i] = (double) samples->ns[i];
+      }
+      if (ns == NULL
+          || bench_history_add(history, name, ns, samples->count))
+      {
+        history_failed = true;
+      }
+      free(ns);
+    }
+  }
+
+  free(samples->ns);
+  samples->ns = NULL;
+}
+
+//############################################################################
+// selected()
+//############################################################################
+static bool selected(bench_options * opts, const char *name)
+{
+  return (opts->filter == NULL || strstr(name, opts->filter) != NULL);
+}
+
+//############################################################################
+// bench_ecall()
+//
+// Times an ECALL that does no work (it only reads the unsealed data table
+// entry count)
+//############################################################################
+static int bench_ecall(bench_options * opts)
+{
+  const char *name = "ecall/empty";
+  bench_samples samples;
+  uint64_t ocalls_before[BENCH_OCALL_COUNT];
+  size_t table_size = 0;
+
+  if (!selected(opts, name))
+  {
+    return 0;
+  }
+  if (samples_init(&samples, opts->iterations))
+  {
+    return 1;
+  }
+
+  for (size_t i = 0; i < opts->iterations; i++)
+  {
+    uint64_t start_ns = samples_begin(ocalls_before);
+
+    if (kmyth_sgx_test_get_unseal_table_size(eid, &table_size) !=
+        SGX_SUCCESS)
+    {
+      fprintf(stderr, "%s: ECALL failed\n", name);
+      free(samples.ns);
+      return 1;
+    }
+    samples_end(&samples, start_ns, ocalls_before);
+  }
+
+  report_samples(opts->format, name, &samples);
+  return 0;
+}
+
+//############################################################################
+// bench_seal_unseal()
+//
+// Times kmyth_sgx_seal_nkl() and kmyth_sgx_unseal_nkl() of a payload. Each
+// unsealed entry is removed from the table (untimed) before the next.
+//############################################################################
+static int bench_seal_unseal(bench_options * opts, size_t payload_len)
+{
+  char seal_name[BENCH_MAX_NAME_LEN + 1];
+  char unseal_name[BENCH_MAX_NAME_LEN + 1];
+  bench_samples seal_samples;
+  bench_samples unseal_samples;
+  uint64_t ocalls_before[BENCH_OCALL_COUNT];
+  uint16_t key_policy = SGX_KEYPOLICY_MRSIGNER;
+  sgx_attributes_t attribute_mask;
+  int result = 0;
+
+  attribute_mask.flags = 0;
+  attribute_mask.xfrm = 0;
+
+  snprintf(seal_name, sizeof(seal_name), "seal_nkl/%zu", payload_len);
+  snprintf(unseal_name, sizeof(unseal_name), "unseal_nkl/%zu", payload_len);
+  if (!selected(opts, seal_name) && !selected(opts, unseal_name))
+  {
+    return 0;
+  }
+
+  uint8_t *payload = (uint8_t *) malloc(payload_len);
+
+  if (payload == NULL || RAND_bytes(payload, (int) payload_len) != 1)
+  {
+    fprintf(stderr, "%s: unable to set up the payload\n", seal_name);
+    free(payload);
+    return 1;
+  }
+  if (samples_init(&seal_samples, opts->iterations))
+  {
+    free(payload);
+    return 1;
+  }
+  if (samples_init(&unseal_samples, opts->iterations))
+  {
+    free(seal_samples.ns);
+    free(payload);
+    return 1;
+  }
+
+  for (size_t i = 0; i < opts->iterations && result == 0; i++)
+  {
+    uint8_t *nkl = NULL;
+    size_t nkl_len = 0;
+    uint64_t handle = 0;
+    bool removed = false;
+    uint64_t start_ns = samples_begin(ocalls_before);
+
+    if (kmyth_sgx_seal_nkl(eid, payload, payload_len, &nkl, &nkl_len,
+                           key_policy, attribute_mask))
+    {
+      fprintf(stderr, "%s: seal failed (iteration %zu)\n", seal_name, i);
+      result = 1;
+      break;
+    }
+    samples_end(&seal_samples, start_ns, ocalls_before);
+
+    start_ns = samples_begin(ocalls_before);
+    if (kmyth_sgx_unseal_nkl(eid, nkl, nkl_len, &handle))
+    {
+      fprintf(stderr, "%s: unseal failed (iteration %zu)\n", unseal_name, i);
+      result = 1;
+    }
+    else
+    {
+      samples_end(&unseal_samples, start_ns, ocalls_before);
+      kmyth_sgx_test_remove_from_enclave(eid, &removed, handle);
+    }
+    free(nkl);
+  }
+
+  report_samples(opts->format, seal_name, &seal_samples);
+  report_samples(opts->format, unseal_name, &unseal_samples);
+  free(payload);
+  return result;
+}
+
+//############################################################################
+// bench_unseal_parallel()
+//
+// Times kmyth_sgx_unseal_nkl_parallel() of a batch of (the same) sealed
+// payloads over a dispatcher with the given number of threads. Each sample
+// is one batch; its entries are removed from the table (untimed) before the
+// next.
+//############################################################################
+static int bench_unseal_parallel(bench_options * opts, size_t threads)
+{
+  char name[BENCH_MAX_NAME_LEN + 1];
+  bench_samples samples;
+  uint64_t ocalls_before[BENCH_OCALL_COUNT];
+  uint16_t key_policy = SGX_KEYPOLICY_MRSIGNER;
+  sgx_attributes_t attribute_mask;
+  size_t batch = 4 * KMYTH_SGX_ECALL_THREADS;
+  size_t iterations = (opts->iterations + batch - 1) / batch;
+  uint8_t *nkl = NULL;
+  size_t nkl_len = 0;
+  int result = 0;
+
+  attribute_mask.flags = 0;
+  attribute_mask.xfrm = 0;
+
+  snprintf(name, sizeof(name), "unseal_nkl_parallel/%zux%zu@%zu",
+           opts->payload_len, batch, threads);
+  if (!selected(opts, name))
+  {
+    return 0;
+  }
+
+  uint8_t *payload = (uint8_t *) malloc(opts->payload_len);
+  uint8_t **inputs = (uint8_t **) calloc(batch, sizeof(uint8_t *));
+  size_t *input_lens = (size_t *) calloc(batch, sizeof(size_t));
+  uint64_t *handles = (uint64_t *) calloc(batch, sizeof(uint64_t));
+  kmyth_sgx_dispatcher_t *dispatcher =
+    kmyth_sgx_dispatcher_create(eid, threads);
+
+  if (payload == NULL || inputs == NULL || input_lens == NULL
+      || handles == NULL || dispatcher == NULL
+      || RAND_bytes(payload, (int) opts->payload_len) != 1
+      || kmyth_sgx_seal_nkl(eid, payload, opts->payload_len, &nkl, &nkl_len,
+                            key_policy, attribute_mask)
+      || samples_init(&samples, iterations))
+  {
+    fprintf(stderr, "%s: unable to set up the payload\n", name);
+    kmyth_sgx_dispatcher_destroy(dispatcher);
+    free(nkl);
+    free(payload);
+    free(inputs);
+    free(input_lens);
+    free(handles);
+    return 1;
+  }
+  for (size_t i = 0; i < batch; i++)
+  {
+    inputs[i] = nkl;
+    input_lens[i] = nkl_len;
+  }
+
+  for (size_t i = 0; i < iterations; i++)
+  {
+    uint64_t start_ns = samples_begin(ocalls_before);
+
+    if (kmyth_sgx_unseal_nkl_parallel(dispatcher, batch, inputs, input_lens,
+                                      handles, NULL))
+    {
+      fprintf(stderr, "%s: unseal failed (iteration %zu)\n", name, i);
+      result = 1;
+      break;
+    }
+    samples_end(&samples, start_ns, ocalls_before);
+
+    for (size_t j = 0; j < batch; j++)
+    {
+      bool removed = false;
+
+      kmyth_sgx_test_remove_from_enclave(eid, &removed, handles[j]);
+    }
+  }
+
+  if (result != 0)
+  {
+    // some of the failed batch may have been unsealed
+    int sgx_ret_int = 0;
+
+    kmyth_unsealed_data_table_cleanup(eid, &sgx_ret_int);
+    kmyth_unsealed_data_table_initialize(eid, &sgx_ret_int);
+  }
+
+  report_samples(opts->format, name, &samples);
+  kmyth_sgx_dispatcher_destroy(dispatcher);
+  free(nkl);
+  free(payload);
+  free(inputs);
+  free(input_lens);
+  free(handles);
+  return result;
+}
+
+//############################################################################
+// bench_table()
+//
+// Fills the unsealed data table with entries, timing each insertion (as an
+// unseal of the same sealed payload), then times looking each entry up
+// (by reference) in a random order, and empties the table again
+//############################################################################
+static int bench_table(bench_options * opts, size_t entries)
+{
+  char insert_name[BENCH_MAX_NAME_LEN + 1];
+  char lookup_name[BENCH_MAX_NAME_LEN + 1];
+  bench_samples insert_samples;
+  bench_samples lookup_samples;
+  uint64_t ocalls_before[BENCH_OCALL_COUNT];
+  uint16_t key_policy = SGX_KEYPOLICY_MRSIGNER;
+  sgx_attributes_t attribute_mask;
+  uint8_t *nkl = NULL;
+  size_t nkl_len = 0;
+  size_t inserted = 0;
+  int sgx_ret_int = 0;
+  int result = 0;
+
+  attribute_mask.flags = 0;
+  attribute_mask.xfrm = 0;
+
+  snprintf(insert_name, sizeof(insert_name), "table/insert@%zu", entries);
+  snprintf(lookup_name, sizeof(lookup_name), "table/lookup@%zu", entries);
+  if (!selected(opts, insert_name) && !selected(opts, lookup_name))
+  {
+    return 0;
+  }
+
+  uint8_t *payload = (uint8_t *) malloc(opts->payload_len);
+  uint8_t *read_data = (uint8_t *) malloc(opts->payload_len);
+  uint64_t *handles = (uint64_t *) calloc(entries, sizeof(uint64_t));
+
+  if (payload == NULL || read_data == NULL || handles == NULL
+      || RAND_bytes(payload, (int) opts->payload_len) != 1
+      || kmyth_sgx_seal_nkl(eid, payload, opts->payload_len, &nkl, &nkl_len,
+                            key_policy, attribute_mask))
+  {
+    fprintf(stderr, "%s: unable to set up the payload\n", insert_name);
+    free(payload);
+    free(read_data);
+    free(handles);
+    return 1;
+  }
+  if (samples_init(&insert_samples, entries))
+  {
+    free(nkl);
+    free(payload);
+    free(read_data);
+    free(handles);
+    return 1;
+  }
+  if (samples_init(&lookup_samples, entries))
+  {
+    free(insert_samples.ns);
+    free(nkl);
+    free(payload);
+    free(read_data);
+    free(handles);
+    return 1;
+  }
+
+  for (inserted = 0; inserted < entries; inserted++)
+  {
+    uint64_t start_ns = samples_begin(ocalls_before);
+
+    if (kmyth_sgx_unseal_nkl(eid, nkl, nkl_len, &handles[inserted]))
+    {
+      // typically the enclave heap (HeapMaxSize) running out
+      fprintf(stderr, "%s: insertion failed after %zu entries\n",
+              insert_name, inserted);
+      result = 1;
+      break;
+    }
+    samples_end(&insert_samples, start_ns, ocalls_before);
+  }
+
+  // shuffle the handles, so the lookups do not follow insertion order
+  for (size_t i = inserted; i > 1; i--)
+  {
+    size_t j = (size_t) rand() % i;
+    uint64_t handle = handles[i - 1];
+
+    handles[i - 1] = handles[j];
+    handles[j] = handle;
+  }
+
+  for (size_t i = 0; i < inserted; i++)
+  {
+    size_t read_len = 0;
+    uint64_t start_ns = samples_begin(ocalls_before);
+
+    kmyth_sgx_test_read_from_enclave(eid, &read_len, handles[i],
+                                     (uint32_t) opts->payload_len, read_data);
+    if (read_len != opts->payload_len
+        || memcmp(read_data, payload, opts->payload_len) != 0)
+    {
+      fprintf(stderr, "%s: lookup failed (entry %zu)\n", lookup_name, i);
+      result = 1;
+      break;
+    }
+    samples_end(&lookup_samples, start_ns, ocalls_before);
+  }
+
+  // empty the table for the next benchmark
+  kmyth_unsealed_data_table_cleanup(eid, &sgx_ret_int);
+  kmyth_unsealed_data_table_initialize(eid, &sgx_ret_int);
+
+  report_samples(opts->format, insert_name, &insert_samples);
+  report_samples(opts->format, lookup_name, &lookup_samples);
+  free(nkl);
+  free(payload);
+  free(read_data);
+  free(handles);
+  return result;
+}
+
+//############################################################################
+// read_der_credentials()
+//
+// Reads the client (enclave) private key and server certificate PEM files,
+// and marshals them (DER format) to be passed into the enclave
+//############################################################################
+static int read_der_credentials(bench_options * opts,
+                                unsigned char **client_key,
+                                int *client_key_len,
+                                unsigned char **server_cert,
+                                int *server_cert_len)
+{
+  EVP_PKEY *key = NULL;
+  X509 *cert = NULL;
+  BIO *bio = BIO_new_file(opts->client_key_file, "r");
+
+  if (bio != NULL)
+  {
+    key = PEM_read_bio_PrivateKey(bio, NULL, 0, NULL);
+    BIO_free(bio);
+  }
+  if (key == NULL || marshal_ec_pkey_to_der(&key, client_key, client_key_len))
+  {
+    fprintf(stderr, "unable to read the client private key (%s)\n",
+            opts->client_key_file);
+    EVP_PKEY_free(key);
+    return 1;
+  }
+  EVP_PKEY_free(key);
+
+  bio = BIO_new_file(opts->server_cert_file, "r");
+  if (bio != NULL)
+  {
+    cert = PEM_read_bio_X509(bio, NULL, 0, NULL);
+    BIO_free(bio);
+  }
+  if (cert == NULL
+      || marshal_ec_x509_to_der(&cert, server_cert, server_cert_len))
+  {
+    fprintf(stderr, "unable to read the server certificate (%s)\n",
+            opts->server_cert_file);
+    X509_free(cert);
+    free(*client_key);
+    *client_key = NULL;
+    return 1;
+  }
+  X509_free(cert);
+  return 0;
+}
+
+//############################################################################
+// retrieve_key()
+//
+// Retrieves the benchmark key into the enclave's unsealed data table
+//############################################################################
+static int retrieve_key(bench_options * opts, unsigned char *client_key,
+                        int client_key_len, unsigned char *server_cert,
+                        int server_cert_len, uint64_t * handle)
+{
+  int retval = -1;
+  sgx_status_t sgx_ret =
+    kmyth_enclave_retrieve_key_from_server(eid, &retval, client_key,
+                                           client_key_len, server_cert,
+                                           server_cert_len,
+                                           opts->server_host,
+                                           strlen(opts->server_host) + 1,
+                                           opts->server_port,
+                                           (unsigned char *) BENCH_KEY_ID,
+                                           strlen(BENCH_KEY_ID), handle);
+
+  return (sgx_ret != SGX_SUCCESS || retval != 0);
+}
+
+//############################################################################
+// bench_retrieve_key()
+//
+// Times kmyth_enclave_retrieve_key_from_server() end to end against the key
+// server: either each retrieval opening a new session (connection, ECDH
+// exchange, KMIP key request and response), optionally with the enclave's
+// ephemeral key pool filled beforehand (untimed), or every retrieval
+// reusing one session (the KMIP key request and response only)
+//############################################################################
+static int bench_retrieve_key(bench_options * opts, size_t iterations,
+                              bool reuse_session, bool pooled)
+{
+  const char *name = reuse_session ? "retrieve_key_session"
+    : pooled ? "retrieve_key_pooled" : "retrieve_key";
+  bench_samples samples;
+  uint64_t ocalls_before[BENCH_OCALL_COUNT];
+  unsigned char *client_key = NULL;
+  int client_key_len = 0;
+  unsigned char *server_cert = NULL;
+  int server_cert_len = 0;
+  uint64_t handle = 0;
+  bool removed = false;
+  int result = 0;
+
+  if (opts->server_port <= 0 || !selected(opts, name))
+  {
+    return 0;
+  }
+  if (read_der_credentials(opts, &client_key, &client_key_len, &server_cert,
+                           &server_cert_len))
+  {
+    return 1;
+  }
+  if (samples_init(&samples, iterations))
+  {
+    free(client_key);
+    free(server_cert);
+    return 1;
+  }
+
+  // open the session to be reused (untimed)
+  if (reuse_session)
+  {
+    if (retrieve_key(opts, client_key, client_key_len, server_cert,
+                     server_cert_len, &handle))
+    {
+      fprintf(stderr, "%s: key retrieval failed (opening session)\n", name);
+      result = 1;
+      iterations = 0;
+    }
+    else
+    {
+      kmyth_sgx_test_remove_from_enclave(eid, &removed, handle);
+    }
+  }
+
+  for (size_t i = 0; i < iterations; i++)
+  {
+    if (!reuse_session)
+    {
+      kmyth_enclave_close_key_server_session(eid);
+    }
+    if (pooled)
+    {
+      int retval = -1;
+
+      kmyth_enclave_fill_ephemeral_key_pool(eid, &retval);
+    }
+
+    uint64_t start_ns = samples_begin(ocalls_before);
+
+    if (retrieve_key(opts, client_key, client_key_len, server_cert,
+                     server_cert_len, &handle))
+    {
+      fprintf(stderr, "%s: key retrieval failed (iteration %zu)\n", name, i);
+      result = 1;
+      break;
+    }
+    samples_end(&samples, start_ns, ocalls_before);
+    kmyth_sgx_test_remove_from_enclave(eid, &removed, handle);
+  }
+  kmyth_enclave_close_key_server_session(eid);
+
+  report_samples(opts->format, name, &samples);
+  kmyth_clear_and_free(client_key, client_key_len);
+  free(server_cert);
+  return result;
+}
+
+//############################################################################
+// bench_retrieve_keys()
+//
+// Times retrievals over one reused session, each iteration asking for
+// BENCH_BATCH_KEY_COUNT keys in a single request (to compare with
+// BENCH_BATCH_KEY_COUNT times retrieve_key_session): either with
+// kmyth_enclave_retrieve_keys_from_server(), parsing the client key and
+// server certificate each time, or with
+// kmyth_enclave_retrieve_keys_with_identity() and the two loaded once
+//############################################################################
+static int bench_retrieve_keys(bench_options * opts, size_t iterations,
+                               bool loaded_identity)
+{
+  const char *name = loaded_identity ? "retrieve_keys_identity"
+    : "retrieve_keys_batch";
+  bench_samples samples;
+  uint64_t ocalls_before[BENCH_OCALL_COUNT];
+  unsigned char *client_key = NULL;
+  int client_key_len = 0;
+  unsigned char *server_cert = NULL;
+  int server_cert_len = 0;
+  unsigned char key_ids[BENCH_BATCH_KEY_COUNT];
+  size_t key_id_lens[BENCH_BATCH_KEY_COUNT];
+  uint64_t handles[BENCH_BATCH_KEY_COUNT] = { 0 };
+  uint64_t handle = 0;
+  bool removed = false;
+  int result = 0;
+
+  if (opts->server_port <= 0 || !selected(opts, name))
+  {
+    return 0;
+  }
+  if (read_der_credentials(opts, &client_key, &client_key_len, &server_cert,
+                           &server_cert_len))
+  {
+    return 1;
+  }
+  if (samples_init(&samples, iterations))
+  {
+    free(client_key);
+    free(server_cert);
+    return 1;
+  }
+
+  // single-character key IDs "1", "2", ...
+  for (size_t k = 0; k < BENCH_BATCH_KEY_COUNT; k++)
+  {
+    key_ids[k] = (unsigned char) ('1' + k);
+    key_id_lens[k] = 1;
+  }
+
+  // open the session to be reused, and load the identity (untimed)
+  int retval = -1;
+
+  if (loaded_identity
+      && (kmyth_enclave_load_key_server_identity(eid, &retval, client_key,
+                                                 client_key_len, server_cert,
+                                                 server_cert_len)
+          != SGX_SUCCESS || retval != 0))
+  {
+    fprintf(stderr, "%s: loading the key server identity failed\n", name);
+    result = 1;
+    iterations = 0;
+  }
+  else if (retrieve_key(opts, client_key, client_key_len, server_cert,
+                        server_cert_len, &handle))
+  {
+    fprintf(stderr, "%s: key retrieval failed (opening session)\n", name);
+    result = 1;
+    iterations = 0;
+  }
+  else
+  {
+    kmyth_sgx_test_remove_from_enclave(eid, &removed, handle);
+  }
+
+  for (size_t i = 0; i < iterations; i++)
+  {
+    uint64_t start_ns = samples_begin(ocalls_before);
+    sgx_status_t sgx_ret;
+
+    retval = -1;
+    if (loaded_identity)
+    {
+      sgx_ret =
+        kmyth_enclave_retrieve_keys_with_identity(eid, &retval,
+                                                  opts->server_host,
+                                                  strlen(opts->server_host)
+                                                  + 1, opts->server_port,
+                                                  key_ids, sizeof(key_ids),
+                                                  key_id_lens,
+                                                  BENCH_BATCH_KEY_COUNT,
+                                                  handles);
+    }
+    else
+    {
+      sgx_ret =
+        kmyth_enclave_retrieve_keys_from_server(eid, &retval, client_key,
+                                                client_key_len, server_cert,
+                                                server_cert_len,
+                                                opts->server_host,
+                                                strlen(opts->server_host) + 1,
+                                                opts->server_port, key_ids,
+                                                sizeof(key_ids), key_id_lens,
+                                                BENCH_BATCH_KEY_COUNT,
+                                                handles);
+    }
+
+    if (sgx_ret != SGX_SUCCESS || retval != 0)
+    {
+      fprintf(stderr, "%s: key retrieval failed (iteration %zu)\n", name, i);
+      result = 1;
+      break;
+    }
+    samples_end(&samples, start_ns, ocalls_before);
+    for (size_t k = 0; k < BENCH_BATCH_KEY_COUNT; k++)
+    {
+      kmyth_sgx_test_remove_from_enclave(eid, &removed, handles[k]);
+    }
+  }
+  kmyth_enclave_close_key_server_session(eid);
+  if (loaded_identity)
+  {
+    kmyth_enclave_unload_key_server_identity(eid);
+  }
+
+  report_samples(opts->format, name, &samples);
+  kmyth_clear_and_free(client_key, client_key_len);
+  free(server_cert);
+  return result;
+}
+
+//############################################################################
+// usage()
+//############################################################################
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [-n iterations] [-s payload size] [-t table entries] "
+          "[-p server port] [-H server host] [-r key retrievals] "
+          "[-c client key PEM] "
+          "[-u server cert PEM] [-F filter] [-f console|csv] "
+          "[-o history file] [-b baseline history file]\n", prog);
+}
+
+//############################################################################
+// main()
+//############################################################################
+int main(int argc, char **argv)
+{
+  bench_options opts;
+  long iterations = BENCH_DEFAULT_ITERATIONS;
+  long payload_len = 0;
+  long table_entries = BENCH_DEFAULT_TABLE_ENTRIES;
+  long retrieve_iterations = -1;
+  const char *history_path = NULL;
+  const char *baseline_path = NULL;
+  int options;
+
+  memset(&opts, 0, sizeof(opts));
+  opts.format = BENCH_FORMAT_CONSOLE;
+  opts.server_host = BENCH_DEFAULT_SERVER_HOST;
+  opts.client_key_file = BENCH_DEFAULT_CLIENT_KEY;
+  opts.server_cert_file = BENCH_DEFAULT_SERVER_CERT;
+
+  while ((options = getopt(argc, argv, "n:s:t:p:H:c:u:r:F:f:o:b:h")) != -1)
+  {
+    switch (options)
+    {
+    case 'n':
+      iterations = strtol(optarg, NULL, 10);
+      break;
+    case 's':
+      payload_len = strtol(optarg, NULL, 10);
+      break;
+    case 't':
+      table_entries = strtol(optarg, NULL, 10);
+      break;
+    case 'p':
+      opts.server_port = (int) strtol(optarg, NULL, 10);
+      break;
+    case 'H':
+      opts.server_host = optarg;
+      break;
+    case 'c':
+      opts.client_key_file = optarg;
+      break;
+    case 'u':
+      opts.server_cert_file = optarg;
+      break;
+    case 'r':
+      retrieve_iterations = strtol(optarg, NULL, 10);
+      break;
+    case 'F':
+      opts.filter = optarg;
+      break;
+    case 'f':
+      if (strcmp(optarg, "csv") == 0)
+      {
+        opts.format = BENCH_FORMAT_CSV;
+      }
+      else if (strcmp(optarg, "console") != 0)
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'o':
+      history_path = optarg;
+      break;
+    case 'b':
+      baseline_path = optarg;
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (iterations < 1 || payload_len < 0 || table_entries < 1)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+  opts.iterations = (size_t) iterations;
+  opts.payload_len = (payload_len > 0) ? (size_t) payload_len : 32;
+  opts.table_entries = (size_t) table_entries;
+
+  // only errors are logged, so that logging does not skew the results
+  set_applog_severity_threshold(LOG_ERR);
+
+  if ((history_path != NULL || baseline_path != NULL)
+      && bench_history_begin(BENCH_SUITE, "none", &history))
+  {
+    return 1;
+  }
+
+  sgx_status_t sgx_ret = kmyth_sgx_create_enclave(ENCLAVE_PATH, 0, &eid);
+
+  if (sgx_ret != SGX_SUCCESS)
+  {
+    fprintf(stderr, "unable to create the enclave (error 0x%x)\n",
+            (unsigned int) sgx_ret);
+    return 1;
+  }
+
+  int sgx_ret_int = 0;
+
+  kmyth_unsealed_data_table_initialize(eid, &sgx_ret_int);
+  if (sgx_ret_int != 0)
+  {
+    fprintf(stderr, "unable to initialize the unsealed data table\n");
+    sgx_destroy_enclave(eid);
+    return 1;
+  }
+
+  if (opts.format == BENCH_FORMAT_CSV)
+  {
+    printf("benchmark,samples,p50_us,p99_us,mean_us,ocalls_per_op\n");
+  }
+  else
+  {
+#ifdef KMYTH_SGX_SWITCHLESS
+    printf("switchless OCALLs enabled (%d untrusted workers)\n",
+           KMYTH_SGX_SWITCHLESS_UWORKERS);
+#else
+    printf("switchless OCALLs disabled\n");
+#endif
+    printf("%-32s %8s %12s %12s %12s %10s\n", "benchmark", "samples",
+           "p50 (us)", "p99 (us)", "mean (us)", "ocalls/op");
+  }
+
+  int result = bench_ecall(&opts);
+
+  if (payload_len > 0)
+  {
+    result |= bench_seal_unseal(&opts, opts.payload_len);
+  }
+  else
+  {
+    const size_t payload_lens[] = { 32, 1024, 16 * 1024 };
+
+    for (size_t i = 0; i < sizeof(payload_lens) / sizeof(payload_lens[0]);
+         i++)
+    {
+      result |= bench_seal_unseal(&opts, payload_lens[i]);
+    }
+  }
+
+  result |= bench_unseal_parallel(&opts, 1);
+  result |= bench_unseal_parallel(&opts, KMYTH_SGX_ECALL_THREADS);
+
+  // the table grows by a factor of 10 up to the largest size requested
+  for (size_t entries = 10; entries < opts.table_entries; entries *= 10)
+  {
+    result |= bench_table(&opts, entries);
+  }
+  result |= bench_table(&opts, opts.table_entries);
+
+  if (retrieve_iterations < 1)
+  {
+    retrieve_iterations = BENCH_DEFAULT_RETRIEVE_ITERATIONS;
+  }
+  result |= bench_retrieve_key(&opts, (size_t) retrieve_iterations, false,
+                               false);
+  result |= bench_retrieve_key(&opts, (size_t) retrieve_iterations, false,
+                               true);
+  result |= bench_retrieve_key(&opts, (size_t) retrieve_iterations, true,
+                               false);
+  result |= bench_retrieve_keys(&opts, (size_t) retrieve_iterations, false);
+  result |= bench_retrieve_keys(&opts, (size_t) retrieve_iterations, true);
+
+  kmyth_unsealed_data_table_cleanup(eid, &sgx_ret_int);
+  sgx_destroy_enclave(eid);
+
+  size_t regressions = 0;
+
+  if (history != NULL
+      && (bench_history_end(history, baseline_path, history_path,
+                            &regressions) || history_failed))
+  {
+    result = 1;
+  }
+
+  return (result || regressions > 0) ? 1 : 0;
+}
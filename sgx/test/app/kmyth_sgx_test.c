@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <unistd.h>
 
 #include <CUnit/CUnit.h>
 #include <CUnit/Basic.h>
@@ -11,6 +12,8 @@
 
 #include "log_ocall.h"
 #include "sgx_seal_unseal_impl.h"
+#include "sgx_enclave_create.h"
+#include "sgx_enclave_stats.h"
 
 #include "kmyth_sgx_test_enclave_u.h"
 
@@ -33,7 +36,7 @@ int init_suite(void)
 {
   sgx_status_t retval;
 
-  retval = sgx_create_enclave(ENCLAVE_PATH, 0, NULL, NULL, &eid, NULL);
+  retval = kmyth_sgx_create_enclave(ENCLAVE_PATH, 0, &eid);
   if (retval != SGX_SUCCESS)
   {
     return 1;
@@ -43,6 +46,7 @@ int init_suite(void)
 
 int clean_suite(void)
 {
+  kmyth_sgx_print_enclave_stats(eid, stdout, NULL);
   sgx_destroy_enclave(eid);
   return 0;
 }
@@ -188,6 +192,149 @@ void test_unseal_and_export(void)
   return;
 }
 
+void test_unseal_table_references(void)
+{
+  const char *data = "Test of reading an unsealed entry by reference";
+  size_t data_len = strlen(data);
+  uint8_t *sgx_seal = NULL;
+  size_t sgx_seal_len = 0;
+  uint64_t handle;
+  uint16_t key_policy = SGX_KEYPOLICY_MRSIGNER;
+  sgx_attributes_t attribute_mask;
+
+  attribute_mask.flags = 0;
+  attribute_mask.xfrm = 0;
+
+  int sgx_ret_int;
+  size_t sgx_ret_size;
+  bool sgx_ret_bool;
+
+  CU_ASSERT(kmyth_sgx_seal_nkl
+            (eid, (uint8_t *) data, data_len, &sgx_seal, &sgx_seal_len,
+             key_policy, attribute_mask) == 0);
+
+  kmyth_unsealed_data_table_initialize(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  CU_ASSERT(kmyth_sgx_unseal_nkl(eid, sgx_seal, sgx_seal_len, &handle) == 0);
+
+  // Reading by reference must leave the entry in the table, so it can be
+  // read any number of times.
+  uint8_t *read_data = (uint8_t *) malloc(data_len);
+
+  for (size_t i = 0; i < 3; i++)
+  {
+    memset(read_data, 0, data_len);
+    kmyth_sgx_test_read_from_enclave(eid, &sgx_ret_size, handle, data_len,
+                                     read_data);
+    CU_ASSERT(sgx_ret_size == data_len);
+    CU_ASSERT(memcmp(read_data, data, data_len) == 0);
+
+    kmyth_sgx_test_get_unseal_table_size(eid, &sgx_ret_size);
+    CU_ASSERT(sgx_ret_size == 1);
+  }
+
+  // Views of the entry are of its storage in the table, not copies.
+  kmyth_sgx_test_check_views(eid, &sgx_ret_bool, handle);
+  CU_ASSERT(sgx_ret_bool == true);
+
+  kmyth_sgx_test_remove_from_enclave(eid, &sgx_ret_bool, handle);
+  CU_ASSERT(sgx_ret_bool == true);
+
+  kmyth_sgx_test_get_unseal_table_size(eid, &sgx_ret_size);
+  CU_ASSERT(sgx_ret_size == 0);
+
+  kmyth_sgx_test_read_from_enclave(eid, &sgx_ret_size, handle, data_len,
+                                   read_data);
+  CU_ASSERT(sgx_ret_size == 0);
+
+  kmyth_sgx_test_remove_from_enclave(eid, &sgx_ret_bool, handle);
+  CU_ASSERT(sgx_ret_bool == false);
+
+  kmyth_unsealed_data_table_cleanup(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  free(sgx_seal);
+  free(read_data);
+  return;
+}
+
+void test_unseal_handle_scheme(void)
+{
+  const char *data = "Test of the unsealed data handle scheme";
+  size_t data_len = strlen(data);
+  uint8_t *sgx_seal[2] = { NULL, NULL };
+  size_t sgx_seal_len[2] = { 0, 0 };
+  uint64_t handles[3] = { 0, 0, 0 };
+  uint16_t key_policy = SGX_KEYPOLICY_MRSIGNER;
+  sgx_attributes_t attribute_mask;
+
+  attribute_mask.flags = 0;
+  attribute_mask.xfrm = 0;
+
+  int sgx_ret_int;
+  size_t sgx_ret_size;
+
+  // Two seals of the same data give two different sealed blobs
+  for (size_t i = 0; i < 2; i++)
+  {
+    CU_ASSERT(kmyth_sgx_seal_nkl
+              (eid, (uint8_t *) data, data_len, &sgx_seal[i],
+               &sgx_seal_len[i], key_policy, attribute_mask) == 0);
+  }
+
+  kmyth_unsealed_data_table_initialize(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  // Unseal the first blob, the second, then the first again
+  CU_ASSERT(kmyth_sgx_unseal_nkl(eid, sgx_seal[0], sgx_seal_len[0],
+                                 &handles[0]) == 0);
+  CU_ASSERT(kmyth_sgx_unseal_nkl(eid, sgx_seal[1], sgx_seal_len[1],
+                                 &handles[1]) == 0);
+  CU_ASSERT(kmyth_sgx_unseal_nkl(eid, sgx_seal[0], sgx_seal_len[0],
+                                 &handles[2]) == 0);
+
+#if defined(KMYTH_SGX_TEST_UNSEAL_HANDLE_COUNTER)
+  // Counter handles are new for every unseal, and handed out in sequence
+  CU_ASSERT(handles[1] == handles[0] + 1);
+  CU_ASSERT(handles[2] == handles[0] + 2);
+#elif defined(KMYTH_SGX_TEST_UNSEAL_HANDLE_HEADER)
+  // Header handles follow the sealed blob, not the data
+  CU_ASSERT(handles[0] != handles[1]);
+  CU_ASSERT(handles[0] == handles[2]);
+#else
+  // Content handles follow the data, whichever blob it came from
+  CU_ASSERT(handles[0] == handles[1]);
+  CU_ASSERT(handles[0] == handles[2]);
+#endif
+
+  // Whatever the scheme, every unseal adds an entry holding the data
+  kmyth_sgx_test_get_unseal_table_size(eid, &sgx_ret_size);
+  CU_ASSERT(sgx_ret_size == 3);
+
+  uint8_t *read_data = (uint8_t *) malloc(data_len);
+
+  for (size_t i = 0; i < 3; i++)
+  {
+    memset(read_data, 0, data_len);
+    kmyth_sgx_test_export_from_enclave(eid, &sgx_ret_size, handles[i],
+                                       data_len, read_data);
+    CU_ASSERT(sgx_ret_size == data_len);
+    CU_ASSERT(memcmp(read_data, data, data_len) == 0);
+  }
+
+  kmyth_sgx_test_get_unseal_table_size(eid, &sgx_ret_size);
+  CU_ASSERT(sgx_ret_size == 0);
+
+  kmyth_unsealed_data_table_cleanup(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  free(sgx_seal[0]);
+  free(sgx_seal[1]);
+  free(read_data);
+  return;
+}
+
 void test_seal_unseal_nkl(void)
 {
   const char *data = "Test of the NKL seal and unseal";
@@ -233,6 +380,369 @@ void test_seal_unseal_nkl(void)
   return;
 }
 
+void test_seal_unseal_nkl_batch(void)
+{
+  const char *data[] = {
+    "First test of the batched NKL seal and unseal",
+    "Second",
+    "Third test of the batched NKL seal and unseal, a little longer"
+  };
+  size_t count = sizeof(data) / sizeof(data[0]);
+  uint8_t *inputs[3];
+  size_t input_lens[3];
+  uint8_t *sgx_seals[3] = { NULL, NULL, NULL };
+  size_t sgx_seal_lens[3];
+  uint64_t handles[3];
+  uint16_t key_policy = SGX_KEYPOLICY_MRSIGNER;
+  sgx_attributes_t attribute_mask;
+
+  attribute_mask.flags = 0;
+  attribute_mask.xfrm = 0;
+
+  int sgx_ret_int;
+  size_t sgx_ret_size;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    inputs[i] = (uint8_t *) data[i];
+    input_lens[i] = strlen(data[i]);
+  }
+
+  CU_ASSERT(kmyth_sgx_seal_nkl_batch
+            (eid, count, inputs, input_lens, sgx_seals, sgx_seal_lens,
+             key_policy, attribute_mask) == 0);
+
+  kmyth_unsealed_data_table_initialize(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  CU_ASSERT(kmyth_sgx_unseal_nkl_batch
+            (eid, count, sgx_seals, sgx_seal_lens, handles) == 0);
+
+  kmyth_sgx_test_get_unseal_table_size(eid, &sgx_ret_size);
+  CU_ASSERT(sgx_ret_size == count);
+
+  // each blob must come back out under its own handle
+  for (size_t i = 0; i < count; i++)
+  {
+    uint8_t *cipher_data_decrypted = (uint8_t *) malloc(input_lens[i]);
+
+    kmyth_sgx_test_export_from_enclave(eid, &sgx_ret_size, handles[i],
+                                       input_lens[i], cipher_data_decrypted);
+    CU_ASSERT(sgx_ret_size == input_lens[i]);
+    CU_ASSERT(memcmp(cipher_data_decrypted, data[i], input_lens[i]) == 0);
+    free(cipher_data_decrypted);
+  }
+
+  kmyth_unsealed_data_table_cleanup(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    free(sgx_seals[i]);
+  }
+  return;
+}
+
+void test_seal_unseal_nkl_parallel(void)
+{
+  size_t count = 3 * KMYTH_SGX_ECALL_THREADS;
+  uint8_t **inputs = (uint8_t **) calloc(count, sizeof(uint8_t *));
+  size_t *input_lens = (size_t *) calloc(count, sizeof(size_t));
+  uint8_t **sgx_seals = (uint8_t **) calloc(count, sizeof(uint8_t *));
+  size_t *sgx_seal_lens = (size_t *) calloc(count, sizeof(size_t));
+  uint64_t *handles = (uint64_t *) calloc(count, sizeof(uint64_t));
+  int *results = (int *) calloc(count, sizeof(int));
+  uint16_t key_policy = SGX_KEYPOLICY_MRSIGNER;
+  sgx_attributes_t attribute_mask;
+
+  attribute_mask.flags = 0;
+  attribute_mask.xfrm = 0;
+
+  int sgx_ret_int;
+  size_t sgx_ret_size;
+
+  // distinct payloads, so a handle mixed up between threads shows
+  for (size_t i = 0; i < count; i++)
+  {
+    input_lens[i] = 16 + i;
+    inputs[i] = (uint8_t *) malloc(input_lens[i]);
+    memset(inputs[i], (int) (i + 1), input_lens[i]);
+  }
+
+  CU_ASSERT(kmyth_sgx_seal_nkl_batch
+            (eid, count, inputs, input_lens, sgx_seals, sgx_seal_lens,
+             key_policy, attribute_mask) == 0);
+
+  kmyth_unsealed_data_table_initialize(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  kmyth_sgx_dispatcher_t *dispatcher = kmyth_sgx_dispatcher_create(eid, 0);
+
+  CU_ASSERT(dispatcher != NULL);
+  CU_ASSERT(kmyth_sgx_unseal_nkl_parallel
+            (dispatcher, count, sgx_seals, sgx_seal_lens, handles,
+             results) == 0);
+
+  kmyth_sgx_test_get_unseal_table_size(eid, &sgx_ret_size);
+  CU_ASSERT(sgx_ret_size == count);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    uint8_t *cipher_data_decrypted = (uint8_t *) malloc(input_lens[i]);
+
+    CU_ASSERT(results[i] == 0);
+    kmyth_sgx_test_export_from_enclave(eid, &sgx_ret_size, handles[i],
+                                       input_lens[i], cipher_data_decrypted);
+    CU_ASSERT(sgx_ret_size == input_lens[i]);
+    CU_ASSERT(memcmp(cipher_data_decrypted, inputs[i], input_lens[i]) == 0);
+    free(cipher_data_decrypted);
+  }
+
+  kmyth_sgx_dispatcher_destroy(dispatcher);
+
+  kmyth_unsealed_data_table_cleanup(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    free(inputs[i]);
+    free(sgx_seals[i]);
+  }
+  free(inputs);
+  free(input_lens);
+  free(sgx_seals);
+  free(sgx_seal_lens);
+  free(handles);
+  free(results);
+  return;
+}
+
+void test_enclave_stats(void)
+{
+  const char *data = "Test of the enclave memory counters";
+  size_t data_len = strlen(data);
+  uint8_t *sgx_seal = NULL;
+  size_t sgx_seal_len = 0;
+  uint64_t handle;
+  uint16_t key_policy = SGX_KEYPOLICY_MRSIGNER;
+  sgx_attributes_t attribute_mask;
+  kmyth_enclave_stats_t before;
+  kmyth_enclave_stats_t after;
+  FILE *devnull = fopen("/dev/null", "w");
+
+  attribute_mask.flags = 0;
+  attribute_mask.xfrm = 0;
+
+  int sgx_ret_int;
+  bool removed = false;
+
+  kmyth_unsealed_data_table_initialize(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  CU_ASSERT(kmyth_enclave_reset_stats(eid) == SGX_SUCCESS);
+  CU_ASSERT(kmyth_sgx_print_enclave_stats(eid, devnull, &before) == 0);
+  CU_ASSERT(before.ecalls[KMYTH_ENCLAVE_STATS_SEAL] == 0);
+  CU_ASSERT(before.ecalls[KMYTH_ENCLAVE_STATS_UNSEAL] == 0);
+  CU_ASSERT(before.unseal_table_peak_bytes == before.unseal_table_bytes);
+
+  CU_ASSERT(kmyth_sgx_seal_nkl
+            (eid, (uint8_t *) data, data_len, &sgx_seal, &sgx_seal_len,
+             key_policy, attribute_mask) == 0);
+  CU_ASSERT(kmyth_sgx_unseal_nkl(eid, sgx_seal, sgx_seal_len, &handle) == 0);
+
+  CU_ASSERT(kmyth_sgx_print_enclave_stats(eid, devnull, &after) == 0);
+  CU_ASSERT(after.ecalls[KMYTH_ENCLAVE_STATS_SEAL] >= 1);
+  CU_ASSERT(after.ecalls[KMYTH_ENCLAVE_STATS_UNSEAL] == 1);
+  CU_ASSERT(after.unseal_table_entries == before.unseal_table_entries + 1);
+  CU_ASSERT(after.unseal_table_bytes >= before.unseal_table_bytes + data_len);
+  CU_ASSERT(after.unseal_table_peak_bytes >= after.unseal_table_bytes);
+
+  // the sealed output and the plaintext were counted while in use only
+  CU_ASSERT(after.heap_peak_bytes[KMYTH_ENCLAVE_STATS_SEAL] >= sgx_seal_len);
+  CU_ASSERT(after.heap_peak_bytes[KMYTH_ENCLAVE_STATS_UNSEAL] >= data_len);
+  CU_ASSERT(after.heap_bytes[KMYTH_ENCLAVE_STATS_SEAL] ==
+            before.heap_bytes[KMYTH_ENCLAVE_STATS_SEAL]);
+  CU_ASSERT(after.heap_bytes[KMYTH_ENCLAVE_STATS_UNSEAL] ==
+            before.heap_bytes[KMYTH_ENCLAVE_STATS_UNSEAL]);
+
+  // removing the entry gives its memory back
+  kmyth_sgx_test_remove_from_enclave(eid, &removed, handle);
+  CU_ASSERT(removed);
+  CU_ASSERT(kmyth_sgx_print_enclave_stats(eid, devnull, &after) == 0);
+  CU_ASSERT(after.unseal_table_entries == before.unseal_table_entries);
+  CU_ASSERT(after.unseal_table_bytes == before.unseal_table_bytes);
+
+  kmyth_unsealed_data_table_cleanup(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  fclose(devnull);
+  free(sgx_seal);
+  return;
+}
+
+void test_seal_unseal_chunked(void)
+{
+  // several chunks (at the default SGX_SEAL_CHUNK_SIZE) and a short tail
+  size_t data_len = 4 * 65536 + 1000;
+  uint8_t *data = (uint8_t *) malloc(data_len);
+  uint8_t *sgx_seal = NULL;
+  size_t sgx_seal_len = 0;
+  uint64_t handle;
+  uint16_t key_policy = SGX_KEYPOLICY_MRSIGNER;
+  sgx_attributes_t attribute_mask;
+
+  attribute_mask.flags = 0;
+  attribute_mask.xfrm = 0;
+
+  int sgx_ret_int;
+  size_t sgx_ret_size;
+  bool result = false;
+
+  for (size_t i = 0; i < data_len; i++)
+  {
+    data[i] = (uint8_t) (i * 7);
+  }
+
+  CU_ASSERT(kmyth_sgx_seal_nkl
+            (eid, data, data_len, &sgx_seal, &sgx_seal_len, key_policy,
+             attribute_mask) == 0);
+
+  kmyth_unsealed_data_table_initialize(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  CU_ASSERT(kmyth_sgx_unseal_nkl(eid, sgx_seal, sgx_seal_len, &handle) == 0);
+
+  uint8_t *data_decrypted = (uint8_t *) malloc(data_len);
+
+  kmyth_sgx_test_export_from_enclave(eid, &sgx_ret_size, handle, data_len,
+                                     data_decrypted);
+  CU_ASSERT(sgx_ret_size == data_len);
+  CU_ASSERT(memcmp(data_decrypted, data, data_len) == 0);
+  free(data_decrypted);
+  free(sgx_seal);
+
+  // with whole chunks only, the sealed blobs are all the same size, so
+  // they can be reordered or dropped - which unsealing must detect
+  uint32_t in_size = 4 * 65536;
+  uint32_t out_size = 0;
+
+  enc_get_chunked_sealed_size(eid, &sgx_ret_int, in_size, &out_size);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  uint8_t *out_data = (uint8_t *) malloc(out_size);
+  uint32_t blob_size = out_size / 4;
+
+  enc_seal_data_chunked(eid, &sgx_ret_int, data, in_size, out_data, out_size,
+                        key_policy, attribute_mask);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  uint8_t *swapped = (uint8_t *) malloc(out_size);
+
+  memcpy(swapped, out_data, out_size);
+  memcpy(swapped + blob_size, out_data + 2 * blob_size, blob_size);
+  memcpy(swapped + 2 * blob_size, out_data + blob_size, blob_size);
+  kmyth_unseal_into_enclave(eid, &result, out_size, swapped, &handle);
+  CU_ASSERT(result == false);
+
+  kmyth_unseal_into_enclave(eid, &result, 3 * blob_size, out_data, &handle);
+  CU_ASSERT(result == false);
+
+  kmyth_unseal_into_enclave(eid, &result, out_size, out_data, &handle);
+  CU_ASSERT(result == true);
+
+  kmyth_unsealed_data_table_cleanup(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  free(swapped);
+  free(out_data);
+  free(data);
+  return;
+}
+
+// counts the lines of the log file at path that contain marker
+static size_t count_log_lines(const char *path, const char *marker)
+{
+  FILE *log_file = fopen(path, "r");
+  char line[2 * MAX_LOG_MSG_LEN];
+  size_t count = 0;
+
+  if (log_file == NULL)
+  {
+    return 0;
+  }
+  while (fgets(line, sizeof(line), log_file) != NULL)
+  {
+    if (strstr(line, marker) != NULL)
+    {
+      count++;
+    }
+  }
+  fclose(log_file);
+  return count;
+}
+
+void test_enclave_log_buffer(void)
+{
+  char log_dir[] = "/tmp/kmyth_sgx_test_log_XXXXXX";
+  char log_path[sizeof(log_dir) + 16];
+
+  CU_ASSERT_FATAL(mkdtemp(log_dir) != NULL);
+  snprintf(log_path, sizeof(log_path), "%s/test.log", log_dir);
+
+  // write every event through to the file, so only the enclave buffering
+  // decides when events appear
+  set_applog_path(log_path);
+  set_applog_output_mode(2);
+  set_applog_severity_threshold(LOG_DEBUG);
+  set_log_repeat_suppression(false);
+  set_log_rate_limit(0, 0);
+
+  kmyth_sgx_test_log(eid, LOG_DEBUG, 3, "buffered event");
+#if KMYTH_SGX_TEST_LOG_BUFFER_ENTRIES > 0
+  // held in the enclave until flushed
+  CU_ASSERT(count_log_lines(log_path, "buffered event") == 0);
+#else
+  CU_ASSERT(count_log_lines(log_path, "buffered event") == 3);
+#endif
+  kmyth_sgx_test_log_flush(eid);
+  CU_ASSERT(count_log_lines(log_path, "buffered event") == 3);
+  CU_ASSERT(count_log_lines(log_path, "buffered event 0") == 1);
+  CU_ASSERT(count_log_lines(log_path, "buffered event 2") == 1);
+
+  // flushing an empty buffer writes nothing
+  kmyth_sgx_test_log_flush(eid);
+  CU_ASSERT(count_log_lines(log_path, "buffered event") == 3);
+
+  // an event at the flush severity passes out the events buffered before it
+  kmyth_sgx_test_log(eid, LOG_DEBUG, 2, "pending event");
+  kmyth_sgx_test_log(eid, LOG_ERR, 1, "urgent event");
+  CU_ASSERT(count_log_lines(log_path, "pending event") == 2);
+  CU_ASSERT(count_log_lines(log_path, "urgent event") == 1);
+
+#if KMYTH_SGX_TEST_LOG_BUFFER_ENTRIES > 0
+  // a full buffer is passed out without a flush
+  kmyth_sgx_test_log(eid, LOG_DEBUG, KMYTH_SGX_TEST_LOG_BUFFER_ENTRIES + 1,
+                     "overflow event");
+  CU_ASSERT(count_log_lines(log_path, "overflow event") >=
+            KMYTH_SGX_TEST_LOG_BUFFER_ENTRIES);
+  kmyth_sgx_test_log_flush(eid);
+  CU_ASSERT(count_log_lines(log_path, "overflow event") ==
+            KMYTH_SGX_TEST_LOG_BUFFER_ENTRIES + 1);
+#endif
+
+  // restore the logger defaults for the remaining tests
+  set_log_repeat_suppression(true);
+  set_log_rate_limit(KMYTH_LOG_RATE_BURST_DEFAULT,
+                     KMYTH_LOG_RATE_PER_SEC_DEFAULT);
+  set_applog_severity_threshold(KMYTH_APPLOG_SEVERITY_THRESHOLD_DEFAULT);
+  set_applog_output_mode(KMYTH_APPLOG_OUTPUT_MODE_DEFAULT);
+  set_applog_path(DEFAULT_APPLOG_PATH);
+
+  unlink(log_path);
+  rmdir(log_dir);
+  return;
+}
+
 int main(void)
 {
 
@@ -263,6 +773,20 @@ int main(void)
     CU_cleanup_registry();
     return CU_get_error();
   }
+  if (NULL == CU_add_test(kmyth_sgx_test_suite,
+                          "Test enclave unseal table references",
+                          test_unseal_table_references))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (NULL == CU_add_test(kmyth_sgx_test_suite,
+                          "Test enclave unseal handle scheme",
+                          test_unseal_handle_scheme))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
   if (NULL == CU_add_test(kmyth_sgx_test_suite, "Test seal/unseal nkl",
                           test_seal_unseal_nkl))
   {
@@ -270,6 +794,42 @@ int main(void)
     return CU_get_error();
   }
 
+  if (NULL == CU_add_test(kmyth_sgx_test_suite, "Test seal/unseal nkl batch",
+                          test_seal_unseal_nkl_batch))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if (NULL == CU_add_test(kmyth_sgx_test_suite,
+                          "Test parallel seal/unseal nkl",
+                          test_seal_unseal_nkl_parallel))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if (NULL == CU_add_test(kmyth_sgx_test_suite, "Test enclave stats",
+                          test_enclave_stats))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if (NULL == CU_add_test(kmyth_sgx_test_suite, "Test chunked seal/unseal",
+                          test_seal_unseal_chunked))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if (NULL == CU_add_test(kmyth_sgx_test_suite, "Test enclave log buffer",
+                          test_enclave_log_buffer))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
   CU_basic_run_tests();
 
   CU_cleanup_registry();
@@ -1,3 +1,4 @@
+#include <stdio.h>
 #include <string.h>
 
 #include "sgx_trts.h"
@@ -8,6 +9,7 @@
 #include "sgx_attributes.h"
 
 #include "kmyth_enclave_trusted.h"
+#include "kmyth_enclave_log.h"
 
 int enc_get_unsealed_size(uint32_t in_size, uint8_t * in_data, uint32_t * size)
 {
@@ -81,17 +83,7 @@ Out:
 
 uint32_t kmyth_sgx_test_get_data_size(uint64_t handle)
 {
-  unseal_data_t *slot = kmyth_unsealed_data_table;
-
-  while (slot != NULL && slot->handle != handle)
-  {
-    slot = slot->next;
-  }
-  if (slot != NULL)
-  {
-    return slot->data_size;
-  }
-  return 0;
+  return (uint32_t) unseal_table_data_size(handle);
 }
 
 size_t kmyth_sgx_test_export_from_enclave(uint64_t handle, uint32_t data_size,
@@ -105,15 +97,69 @@ size_t kmyth_sgx_test_export_from_enclave(uint64_t handle, uint32_t data_size,
   return retval;
 }
 
+size_t kmyth_sgx_test_read_from_enclave(uint64_t handle, uint32_t data_size,
+                                        uint8_t * data)
+{
+  unseal_data_view_t view;
+
+  if (!acquire_unseal_table_view(handle, &view))
+  {
+    return 0;
+  }
+
+  size_t retval = view.data_size;
+
+  memcpy(data, view.data, (data_size < retval) ? data_size : retval);
+  release_unseal_table_view(&view);
+  return retval;
+}
+
+bool kmyth_sgx_test_check_views(uint64_t handle)
+{
+  unseal_data_view_t first;
+  unseal_data_view_t second;
+
+  if (!acquire_unseal_table_view(handle, &first))
+  {
+    return false;
+  }
+  if (!acquire_unseal_table_view(handle, &second))
+  {
+    release_unseal_table_view(&first);
+    return false;
+  }
+
+  // both views are of the table's own storage, not of copies
+  bool shared = (first.data == second.data
+                 && first.data_size == second.data_size);
+
+  release_unseal_table_view(&second);
+  release_unseal_table_view(&first);
+  return shared && first.data == NULL && first.ref == NULL;
+}
+
+bool kmyth_sgx_test_remove_from_enclave(uint64_t handle)
+{
+  return remove_from_unseal_table(handle);
+}
+
 size_t kmyth_sgx_test_get_unseal_table_size(void)
 {
-  size_t count = 0;
-  unseal_data_t *slot = kmyth_unsealed_data_table;
+  return unseal_table_entry_count();
+}
+
+void kmyth_sgx_test_log(int severity, size_t count, const char *message)
+{
+  char event[MAX_LOG_MSG_LEN];
 
-  while (slot != NULL)
+  for (size_t i = 0; i < count; i++)
   {
-    count++;
-    slot = slot->next;
+    snprintf(event, sizeof(event), "%s %zu", message, i);
+    kmyth_enclave_log_event(__FILE__, __func__, __LINE__, severity, event);
   }
-  return count;
+}
+
+void kmyth_sgx_test_log_flush(void)
+{
+  kmyth_enclave_log_flush();
 }
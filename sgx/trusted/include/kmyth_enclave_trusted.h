@@ -12,6 +12,8 @@ extern "C"
 
 #include "kmyth_enclave_memory_util.h"
 
+#include "kmyth_enclave_stats.h"
+
 #include "sgx_retrieve_key_impl.h"
 
 #include "kmyth_enclave_common.h"
@@ -24,21 +26,157 @@ extern "C"
 
 #include ENCLAVE_HEADER_TRUSTED
 
+// largest piece of an input sealed at once by enc_seal_data_chunked(), so
+// the enclave heap used to seal is bounded whatever the input size
+#ifndef KMYTH_SGX_SEAL_CHUNK_SIZE
+#define KMYTH_SGX_SEAL_CHUNK_SIZE 65536
+#endif
+
+// identifies the additional MAC text of a chunk of a chunked sealed blob
+#define KMYTH_SGX_SEAL_CHUNK_MAGIC "KMYTHCHK"
+
+// size of the random ID shared by the chunks of one chunked seal
+#define KMYTH_SGX_SEAL_ID_LEN 16
+
+  /**
+   * @brief The additional MAC text of each chunk of an input sealed by
+   *        enc_seal_data_chunked(). It is authenticated along with the
+   *        chunk, so chunks cannot be reordered or dropped, and, as every
+   *        seal draws a new random seal_id, cannot be spliced in from
+   *        another sealed blob (even one of the same size).
+   */
+  typedef struct kmyth_sealed_chunk_s
+  {
+    uint8_t magic[8];
+    uint8_t seal_id[KMYTH_SGX_SEAL_ID_LEN];
+    uint32_t index;
+    uint32_t count;
+    uint32_t total_size;
+  } kmyth_sealed_chunk_t;
+
   typedef struct unseal_data_s
   {
     uint64_t handle;
     size_t data_size;
     uint8_t *data;
-    struct unseal_data_s *next;
+    uint32_t refcount;
   } unseal_data_t;
 
-  extern unseal_data_t *kmyth_unsealed_data_table;
+  /**
+   * @brief A read-only view of the data of an unsealed data table entry,
+   *        for trusted code in the enclave to use the data where it is
+   *        stored, with no copy. The view holds a reference to the entry,
+   *        so its data stays valid (even if the entry is removed from the
+   *        table) until the view is released.
+   */
+  typedef struct unseal_data_view_s
+  {
+    const uint8_t *data;
+    size_t data_size;
+    unseal_data_t *ref;         // held reference, not to be used directly
+  } unseal_data_view_t;
 
+  /**
+   * @brief Removes an entry from the unsealed data table, returning a copy
+   *        of its data. Readers still holding a reference to the entry
+   *        are unaffected.
+   *
+   * @param[in]  handle The handle of the entry to retrieve.
+   *
+   * @param[out] buf    A pointer to the newly allocated copy of the data
+   *                    (to be freed by the caller).
+   *
+   * @returns the size of the data, or 0 if no entry has the handle.
+   */
   size_t retrieve_from_unseal_table(uint64_t handle, uint8_t ** buf);
 
+  /**
+   * @brief Adds data to the unsealed data table. On success the table
+   *        takes ownership of the (malloc'd) data.
+   *
+   * @param[in]  data      The data to add.
+   *
+   * @param[in]  data_size The size of the data.
+   *
+   * @param[out] handle    A pointer to a uint64_t to hold the handle.
+   *
+   * @returns true on success, false on failure.
+   */
   bool insert_into_unseal_table(uint8_t * data, uint32_t data_size,
                                 uint64_t * handle);
 
+  /**
+   * @brief Takes a reference to an entry in the unsealed data table,
+   *        leaving the entry in the table. Any number of threads may hold
+   *        a reference to the same entry, and read its data and data_size
+   *        (which must not be modified), at once.
+   *
+   * @param[in] handle The handle of the entry.
+   *
+   * @returns the entry, or NULL if no entry has the handle. The reference
+   *          MUST be dropped with release_unseal_table_ref().
+   */
+  unseal_data_t *retrieve_ref_from_unseal_table(uint64_t handle);
+
+  /**
+   * @brief Drops a reference taken with retrieve_ref_from_unseal_table().
+   *        The entry must not be used afterwards.
+   *
+   * @param[in] entry The entry (NULL is ignored).
+   */
+  void release_unseal_table_ref(unseal_data_t * entry);
+
+  /**
+   * @brief Takes a read-only view of the data of an entry in the unsealed
+   *        data table, leaving the entry in the table. Any number of views
+   *        of the same entry may be held, by any threads, at once.
+   *
+   * @param[in]  handle The handle of the entry.
+   *
+   * @param[out] view   The view. On failure it is left empty (NULL data).
+   *
+   * @returns true on success, false if no entry has the handle. The view
+   *          MUST be released with release_unseal_table_view().
+   */
+  bool acquire_unseal_table_view(uint64_t handle, unseal_data_view_t * view);
+
+  /**
+   * @brief Releases a view taken with acquire_unseal_table_view(), and
+   *        empties it. Releasing an empty view does nothing.
+   *
+   * @param[in,out] view The view.
+   */
+  void release_unseal_table_view(unseal_data_view_t * view);
+
+  /**
+   * @brief Removes an entry from the unsealed data table. Its data is
+   *        cleared and freed once the last outstanding reference to it
+   *        has been released.
+   *
+   * @param[in] handle The handle of the entry.
+   *
+   * @returns true if the entry was removed, false if no entry has the
+   *          handle.
+   */
+  bool remove_from_unseal_table(uint64_t handle);
+
+  /**
+   * @brief Counts the entries in the unsealed data table.
+   *
+   * @returns the number of entries.
+   */
+  size_t unseal_table_entry_count(void);
+
+  /**
+   * @brief Looks up the size of the data held for a handle, leaving the
+   *        entry in the table.
+   *
+   * @param[in] handle The handle of the entry.
+   *
+   * @returns the size of the data, or 0 if no entry has the handle.
+   */
+  size_t unseal_table_data_size(uint64_t handle);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,53 @@
+/**
+ * @file  kmyth_enclave_log.h
+ *
+ * @brief Provides buffered logging from within a kmyth SGX enclave
+ *
+ * Log events are held in an in-enclave buffer and passed out to the
+ * untrusted logger in one log_event_batch_ocall(), rather than taking an
+ * enclave exit each. The buffer is flushed when it is full, when an event
+ * at or above KMYTH_ENCLAVE_LOG_FLUSH_SEVERITY is logged, and when an ECALL
+ * that logs calls kmyth_enclave_log_flush() before returning. Building
+ * with KMYTH_ENCLAVE_LOG_BUFFER_ENTRIES set to 0 logs every event with its
+ * own log_event_ocall() instead.
+ */
+
+#ifndef _KMYTH_ENCLAVE_LOG_H_
+#define _KMYTH_ENCLAVE_LOG_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Records a log event, flushing the buffer as described above.
+ *
+ * @param[in] src_file          Source code filename string
+ *
+ * @param[in] src_func          Function name string
+ *
+ * @param[in] src_line          Source code line number
+ *
+ * @param[in] severity          Severity level of the event (LOG_ERR, ...)
+ *
+ * @param[in] message           Message to be logged
+ *
+ * @return                      None
+ */
+  void kmyth_enclave_log_event(const char *src_file, const char *src_func,
+                               int src_line, int severity,
+                               const char *message);
+
+/**
+ * @brief Passes any buffered log events out of the enclave.
+ *
+ * @return                      None
+ */
+  void kmyth_enclave_log_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
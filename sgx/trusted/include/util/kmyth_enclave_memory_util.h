@@ -51,10 +51,11 @@ extern "C"
 
 /**
  * Clears the contents of a pointer, without running into issues of gcc
- * optimizing around memset. Implementation obtained from:
- *    open-std WG 15 Document: N1381
- *    http://www.open-std.org/jtc1/sc22/wg14/www/docs/n1381.pdf
- *    
+ * optimizing around memset (see open-std WG 14 Document N1381:
+ *    http://www.open-std.org/jtc1/sc22/wg14/www/docs/n1381.pdf).
+ * The memset() is followed by a compiler barrier, so it keeps the speed of
+ * the C library's word-wide stores while never being removed as a dead store.
+ *
  * @param[in,out] v         The pointer containing contents to clear
  *
  * @param[in] c             The value to fill the array with
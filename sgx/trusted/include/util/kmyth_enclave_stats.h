@@ -0,0 +1,71 @@
+/**
+ * @file  kmyth_enclave_stats.h
+ *
+ * @brief Keeps memory and transition counters inside a kmyth SGX enclave
+ *
+ * Each kmyth ECALL counts itself against its path (seal, unseal or key
+ * retrieval) on entry, and the buffers it allocates for the duration of
+ * the call against the same path, so that the peak of each path's heap
+ * use can be found. The unsealed data table counts its own memory. Every
+ * OCALL is counted by wrapping sgx_ocall() at link time
+ * (-Wl,--wrap=sgx_ocall). The counters are atomic, and are read out with
+ * the kmyth_enclave_get_stats() ECALL.
+ */
+
+#ifndef _KMYTH_ENCLAVE_STATS_H_
+#define _KMYTH_ENCLAVE_STATS_H_
+
+#include <stddef.h>
+
+#include "kmyth_enclave_stats_record.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Counts an ECALL against a path, and makes the path the calling
+ *        thread's own for the heap counters until its next ECALL.
+ *
+ * @param[in] path              KMYTH_ENCLAVE_STATS_SEAL, ..._UNSEAL or
+ *                              ..._RETRIEVE
+ *
+ * @return                      None
+ */
+  void kmyth_enclave_stats_ecall(int path);
+
+/**
+ * @brief Counts a buffer allocated by the calling thread's ECALL.
+ *
+ * @param[in] size              The size of the buffer in bytes
+ *
+ * @return                      None
+ */
+  void kmyth_enclave_stats_heap_alloc(size_t size);
+
+/**
+ * @brief Counts a buffer, counted with kmyth_enclave_stats_heap_alloc()
+ *        in the same ECALL, as freed.
+ *
+ * @param[in] size              The size of the buffer in bytes
+ *
+ * @return                      None
+ */
+  void kmyth_enclave_stats_heap_free(size_t size);
+
+/**
+ * @brief Counts memory taken (positive delta) or given back (negative
+ *        delta) by the unsealed data table.
+ *
+ * @param[in] delta             The change in size in bytes
+ *
+ * @return                      None
+ */
+  void kmyth_enclave_stats_table_bytes(int64_t delta);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -25,10 +25,53 @@ extern "C"
 
 #include "kmyth_enclave_trusted.h"
 
+/**
+ * @brief Longest time (in seconds) a session with the key server is used
+ *        for before a new one is negotiated. The time comes from outside
+ *        the enclave, so KMYTH_KEY_SESSION_MAX_REQUESTS is the bound that
+ *        cannot be stretched.
+ */
+#ifndef KMYTH_KEY_SESSION_LIFETIME
+#define KMYTH_KEY_SESSION_LIFETIME 300
+#endif
+
+/**
+ * @brief Most key requests made over one session with the key server
+ *        before a new one is negotiated.
+ */
+#ifndef KMYTH_KEY_SESSION_MAX_REQUESTS
+#define KMYTH_KEY_SESSION_MAX_REQUESTS 256
+#endif
+
+/**
+ * @brief Size (in bytes) of the untrusted buffer a session's messages with
+ *        the key server are moved through. Larger messages are still
+ *        passed, one allocation each.
+ */
+#ifndef KMYTH_ECDH_MSG_BUFFER_SIZE
+#define KMYTH_ECDH_MSG_BUFFER_SIZE 16384
+#endif
+
+/**
+ * @brief Number of single-use ECDH ephemeral key pairs the enclave keeps
+ *        generated ahead of the handshakes that use them.
+ */
+#ifndef KMYTH_ECDH_EPHEMERAL_POOL_SIZE
+#define KMYTH_ECDH_EPHEMERAL_POOL_SIZE 4
+#endif
+
 /**
  * @brief Retrieve a designated key from a "remote" key server securely
  *        into the enclave.
  *
+ *        The connection and ECDH session key are kept for the requests
+ *        that follow, as long as they are made to the same server (host,
+ *        port and certificate) with the same client key, and the session
+ *        is not due to be renegotiated (see KMYTH_KEY_SESSION_LIFETIME and
+ *        KMYTH_KEY_SESSION_MAX_REQUESTS). A request that fails over a
+ *        reused session is retried once over a new one; any other failure
+ *        closes the session.
+ *
  *        TODO: The parameters to this function will have to be augmented
  *              to support actual retrieval from the remote server. This
  *              initial implementation is purely focused on the key
@@ -85,6 +128,115 @@ extern "C"
                            size_t *retrieved_key_id_len,
                            uint8_t **retrieved_key, size_t *retrieved_key_len);
 
+/**
+ * @brief Retrieves several keys from the key server with a single request,
+ *        over the same session as enclave_retrieve_key(). The keys are
+ *        asked for as the items of one batched KMIP Get request, each
+ *        tagged with its own ID, so the server may answer them in any
+ *        order; the i-th outputs always hold the key for the i-th
+ *        requested ID. The request fails as a whole if any key is not
+ *        returned.
+ *
+ * @param[in]  enclave_sign_privkey   as for enclave_retrieve_key()
+ *
+ * @param[in]  peer_cert              as for enclave_retrieve_key()
+ *
+ * @param[in]  server_host            as for enclave_retrieve_key()
+ *
+ * @param[in]  server_host_len        as for enclave_retrieve_key()
+ *
+ * @param[in]  server_port            as for enclave_retrieve_key()
+ *
+ * @param[in]  req_key_ids            IDs of the keys to be retrieved
+ *
+ * @param[in]  req_key_id_lens        Lengths (in bytes) of the key IDs
+ *
+ * @param[in]  key_count              Number of keys to retrieve (at most
+ *                                    KMIP_GET_BATCH_MAX_ITEMS)
+ *
+ * @param[out] retrieved_key_ids      Key IDs returned by the server, one
+ *                                    per requested key
+ *
+ * @param[out] retrieved_key_id_lens  Lengths (in bytes) of the returned
+ *                                    key IDs
+ *
+ * @param[out] retrieved_keys         The retrieved keys
+ *
+ * @param[out] retrieved_key_lens     Lengths (in bytes) of the retrieved
+ *                                    keys
+ *
+ * @return 0 on success, 1 on error
+ */
+  int enclave_retrieve_keys(EVP_PKEY * enclave_sign_privkey,
+                            X509 * peer_cert, const char *server_host,
+                            int server_host_len, int server_port,
+                            unsigned char **req_key_ids,
+                            size_t *req_key_id_lens, size_t key_count,
+                            unsigned char **retrieved_key_ids,
+                            size_t *retrieved_key_id_lens,
+                            uint8_t **retrieved_keys,
+                            size_t *retrieved_key_lens);
+
+/**
+ * @brief Loads the client signing key and key server certificate that
+ *        enclave_retrieve_keys_with_identity() opens sessions with,
+ *        replacing any loaded before. The server's verification key is
+ *        extracted from the certificate here, once.
+ *
+ * @param[in]  enclave_sign_privkey   Enclave's (client's) private signing
+ *                                    key. On success the enclave keeps it
+ *                                    (until enclave_unload_key_server_identity()
+ *                                    frees it).
+ *
+ * @param[in]  peer_cert              Key server's certificate (which the
+ *                                    caller still frees).
+ *
+ * @return 0 on success, 1 on error
+ */
+  int enclave_load_key_server_identity(EVP_PKEY * enclave_sign_privkey,
+                                       X509 * peer_cert);
+
+/**
+ * @brief As enclave_retrieve_keys(), but with the client key and server
+ *        certificate loaded by enclave_load_key_server_identity(), so
+ *        nothing is parsed per retrieval.
+ *
+ * @return 0 on success, 1 on error (including no identity being loaded)
+ */
+  int enclave_retrieve_keys_with_identity(const char *server_host,
+                                          int server_host_len,
+                                          int server_port,
+                                          unsigned char **req_key_ids,
+                                          size_t *req_key_id_lens,
+                                          size_t key_count,
+                                          unsigned char **retrieved_key_ids,
+                                          size_t *retrieved_key_id_lens,
+                                          uint8_t **retrieved_keys,
+                                          size_t *retrieved_key_lens);
+
+/**
+ * @brief Frees the identity loaded by enclave_load_key_server_identity(),
+ *        if there is one.
+ */
+  void enclave_unload_key_server_identity(void);
+
+/**
+ * @brief Generates ECDH ephemeral key pairs until the pool holds
+ *        KMYTH_ECDH_EPHEMERAL_POOL_SIZE of them. A handshake takes one
+ *        pair from the pool (each is used once), leaving only the shared
+ *        secret computation on its path, and generates its own if the
+ *        pool is empty.
+ *
+ * @return 0 on success, 1 on error
+ */
+  int enclave_fill_ephemeral_key_pool(void);
+
+/**
+ * @brief Closes the session with the key server kept open by
+ *        enclave_retrieve_key(), if there is one.
+ */
+  void enclave_close_key_session(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -7,32 +7,28 @@
 #include <openssl/err.h>
 
 #include "kmyth_enclave_trusted.h"
+#include "kmip_util.h"
 
 #include ENCLAVE_HEADER_TRUSTED
 
-// This is the function that gets converted into the ecall.
-int kmyth_enclave_retrieve_key_from_server(uint8_t * client_private_bytes,
-                                           size_t client_private_bytes_len,
-                                           uint8_t * server_cert_bytes,
-                                           size_t server_cert_bytes_len,
-                                           const char *server_host,
-                                           int server_host_len,
-                                           int server_port,
-                                           unsigned char *key_id,
-                                           size_t key_id_len)
+static int unmarshal_key_server_identity(uint8_t * client_private_bytes,
+                                        size_t client_private_bytes_len,
+                                        uint8_t * server_cert_bytes,
+                                        size_t server_cert_bytes_len,
+                                        EVP_PKEY ** client_sign_privkey,
+                                        X509 ** server_cert)
 {
   // unmarshal client private signing key
-  EVP_PKEY *client_sign_privkey = NULL;
   int ret_val = unmarshal_ec_der_to_pkey(&client_private_bytes,
                                          &client_private_bytes_len,
-                                         &client_sign_privkey);
+                                         client_sign_privkey);
 
   if (ret_val)
   {
     kmyth_sgx_log(LOG_ERR, "unmarshal of client private signing key failed");
     kmyth_enclave_clear(client_private_bytes, client_private_bytes_len);
-    kmyth_enclave_clear(client_sign_privkey, sizeof(client_sign_privkey));
-    EVP_PKEY_free(client_sign_privkey);
+    EVP_PKEY_free(*client_sign_privkey);
+    *client_sign_privkey = NULL;
     return EXIT_FAILURE;
   }
   kmyth_sgx_log(LOG_DEBUG,
@@ -42,66 +38,319 @@ int kmyth_enclave_retrieve_key_from_server(uint8_t * client_private_bytes,
   kmyth_enclave_clear(client_private_bytes, client_private_bytes_len);
 
   // unmarshal server cert (containing public key for signature verification)
-  X509 *server_cert = NULL;
-
   ret_val = unmarshal_ec_der_to_x509(&server_cert_bytes,
-                                     &server_cert_bytes_len, &server_cert);
+                                     &server_cert_bytes_len, server_cert);
   if (ret_val)
   {
     kmyth_sgx_log(LOG_ERR, "unmarshal of server certificate (to X509) failed");
-    kmyth_enclave_clear(client_sign_privkey, sizeof(client_sign_privkey));
-    EVP_PKEY_free(client_sign_privkey);
-    X509_free(server_cert);
+    EVP_PKEY_free(*client_sign_privkey);
+    X509_free(*server_cert);
+    *client_sign_privkey = NULL;
+    *server_cert = NULL;
     return EXIT_FAILURE;
   }
   kmyth_sgx_log(LOG_DEBUG, "unmarshalled server certificate (to X509)");
 
-  unsigned char *retrieve_key_result = NULL;
-  size_t retrieve_key_result_len = 0;
-  unsigned char *retrieve_key_result_id = NULL;
-  size_t retrieve_key_result_id_len = 0;
+  return EXIT_SUCCESS;
+}
+
+static int split_key_ids(unsigned char *key_ids, size_t key_ids_len,
+                         size_t *key_id_lens, size_t key_count,
+                         unsigned char **ids)
+{
+  size_t offset = 0;
 
-  ret_val =
-    enclave_retrieve_key(client_sign_privkey, server_cert, server_host,
-                         server_host_len, server_port, key_id, key_id_len,
-                         &retrieve_key_result_id, &retrieve_key_result_id_len,
-                         &retrieve_key_result, &retrieve_key_result_len);
-  if (ret_val)
+  if (key_count == 0 || key_count > KMIP_GET_BATCH_MAX_ITEMS)
   {
-    kmyth_sgx_log(LOG_ERR,
-                  "enclave_retrieve_key() wrapper function call failed");
+    kmyth_sgx_log(LOG_ERR, "invalid number of keys requested");
+    return EXIT_FAILURE;
+  }
+
+  // the packed key IDs must exactly fill the buffer
+  for (size_t i = 0; i < key_count; i++)
+  {
+    if (key_id_lens[i] == 0 || key_id_lens[i] > key_ids_len - offset)
+    {
+      kmyth_sgx_log(LOG_ERR, "key ID lengths do not match the key IDs");
+      return EXIT_FAILURE;
+    }
+    ids[i] = key_ids + offset;
+    offset += key_id_lens[i];
+  }
+  if (offset != key_ids_len)
+  {
+    kmyth_sgx_log(LOG_ERR, "key ID lengths do not match the key IDs");
     return EXIT_FAILURE;
   }
 
+  return EXIT_SUCCESS;
+}
+
+static int insert_retrieved_keys(size_t key_count,
+                                 unsigned char **retrieve_key_result_ids,
+                                 size_t *retrieve_key_result_id_lens,
+                                 unsigned char **retrieve_key_results,
+                                 size_t *retrieve_key_result_lens,
+                                 uint64_t * handles)
+{
   char msg[MAX_LOG_MSG_LEN] = { 0 };
+  size_t inserted = 0;
+
+  for (size_t i = 0; i < key_count; i++)
+  {
+    snprintf(msg, MAX_LOG_MSG_LEN, "Retrieved into enclave key with ID: %.*s",
+             (int) retrieve_key_result_id_lens[i], retrieve_key_result_ids[i]);
+    kmyth_sgx_log(LOG_DEBUG, msg);
+
+    // the key IDs received in the response have been checked to match the
+    // requested key IDs, so they are not returned
+    kmyth_enclave_clear_and_free(retrieve_key_result_ids[i],
+                                 retrieve_key_result_id_lens[i]);
+
+    // the table takes the key over, so it is never copied
+    if (inserted == i
+        && retrieve_key_result_lens[i] <= UINT32_MAX
+        && insert_into_unseal_table(retrieve_key_results[i],
+                                    (uint32_t) retrieve_key_result_lens[i],
+                                    &handles[i]))
+    {
+      inserted++;
+    }
+    else
+    {
+      kmyth_enclave_clear_and_free(retrieve_key_results[i],
+                                   retrieve_key_result_lens[i]);
+    }
+  }
+
+  // the keys are handed back all together or not at all
+  if (inserted != key_count)
+  {
+    kmyth_sgx_log(LOG_ERR, "unable to add retrieved key to the unseal table");
+    for (size_t i = 0; i < inserted; i++)
+    {
+      remove_from_unseal_table(handles[i]);
+    }
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+static int retrieve_keys_from_server(uint8_t * client_private_bytes,
+                                     size_t client_private_bytes_len,
+                                     uint8_t * server_cert_bytes,
+                                     size_t server_cert_bytes_len,
+                                     const char *server_host,
+                                     int server_host_len,
+                                     int server_port,
+                                     unsigned char **key_ids,
+                                     size_t *key_id_lens, size_t key_count,
+                                     uint64_t * handles)
+{
+  EVP_PKEY *client_sign_privkey = NULL;
+  X509 *server_cert = NULL;
 
-  snprintf(msg, MAX_LOG_MSG_LEN, "Retrieved into enclave key with ID: %.*s",
-           (int) retrieve_key_result_id_len, retrieve_key_result_id);
-  kmyth_sgx_log(LOG_DEBUG, msg);
-
-  snprintf(msg, MAX_LOG_MSG_LEN,
-           "Retrieved into enclave key: 0x%02X..%02X",
-           retrieve_key_result[0],
-           retrieve_key_result[retrieve_key_result_len - 1]);
-  kmyth_sgx_log(LOG_DEBUG, msg);
-
-  // Verification that the Key ID received in the response from the key server
-  // matches the requested Key ID eliminates the need to return this parameter
-  // to the ECALL caller. A successful ECALL return indicates that the
-  // returned key ID matches the input value that the caller provided.
-  if (strcmp((const char*) retrieve_key_result_id, (const char*) key_id) != 0)
+  if (unmarshal_key_server_identity(client_private_bytes,
+                                    client_private_bytes_len,
+                                    server_cert_bytes, server_cert_bytes_len,
+                                    &client_sign_privkey, &server_cert))
   {
-    kmyth_sgx_log(LOG_ERR, "retrieved key ID mismatches requested key ID");
     return EXIT_FAILURE;
   }
 
-  // free memory for parameters passed to 'retrieve key' wrapper function
+  unsigned char *retrieve_key_results[KMIP_GET_BATCH_MAX_ITEMS] = { NULL };
+  size_t retrieve_key_result_lens[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  unsigned char *retrieve_key_result_ids[KMIP_GET_BATCH_MAX_ITEMS] = { NULL };
+  size_t retrieve_key_result_id_lens[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+
+  int ret_val =
+    enclave_retrieve_keys(client_sign_privkey, server_cert, server_host,
+                          server_host_len, server_port, key_ids, key_id_lens,
+                          key_count, retrieve_key_result_ids,
+                          retrieve_key_result_id_lens, retrieve_key_results,
+                          retrieve_key_result_lens);
+  // done with the parameters passed to 'retrieve key' wrapper function
   EVP_PKEY_free(client_sign_privkey);
   X509_free(server_cert);
-  kmyth_enclave_clear(retrieve_key_result, retrieve_key_result_len);
-  kmyth_enclave_clear(retrieve_key_result_id, retrieve_key_result_id_len);
-  free(retrieve_key_result);
-  free(retrieve_key_result_id);
+  if (ret_val)
+  {
+    kmyth_sgx_log(LOG_ERR,
+                  "enclave_retrieve_keys() wrapper function call failed");
+    return EXIT_FAILURE;
+  }
 
-  return EXIT_SUCCESS;
+  return insert_retrieved_keys(key_count, retrieve_key_result_ids,
+                               retrieve_key_result_id_lens,
+                               retrieve_key_results, retrieve_key_result_lens,
+                               handles);
+}
+
+// This is the function that gets converted into the ecall.
+int kmyth_enclave_retrieve_key_from_server(uint8_t * client_private_bytes,
+                                           size_t client_private_bytes_len,
+                                           uint8_t * server_cert_bytes,
+                                           size_t server_cert_bytes_len,
+                                           const char *server_host,
+                                           int server_host_len,
+                                           int server_port,
+                                           unsigned char *key_id,
+                                           size_t key_id_len,
+                                           uint64_t * handle)
+{
+  kmyth_enclave_stats_ecall(KMYTH_ENCLAVE_STATS_RETRIEVE);
+  int ret_val = retrieve_keys_from_server(client_private_bytes,
+                                          client_private_bytes_len,
+                                          server_cert_bytes,
+                                          server_cert_bytes_len,
+                                          server_host, server_host_len,
+                                          server_port, &key_id, &key_id_len,
+                                          1, handle);
+
+  // pass the events logged during the key retrieval out in one OCALL
+  kmyth_enclave_log_flush();
+  return ret_val;
+}
+
+// This is the function that gets converted into the ecall.
+int kmyth_enclave_retrieve_keys_from_server(uint8_t * client_private_bytes,
+                                            size_t client_private_bytes_len,
+                                            uint8_t * server_cert_bytes,
+                                            size_t server_cert_bytes_len,
+                                            const char *server_host,
+                                            int server_host_len,
+                                            int server_port,
+                                            unsigned char *key_ids,
+                                            size_t key_ids_len,
+                                            size_t *key_id_lens,
+                                            size_t key_count,
+                                            uint64_t * handles)
+{
+  kmyth_enclave_stats_ecall(KMYTH_ENCLAVE_STATS_RETRIEVE);
+  unsigned char *ids[KMIP_GET_BATCH_MAX_ITEMS] = { NULL };
+  int ret_val = EXIT_FAILURE;
+
+  if (split_key_ids(key_ids, key_ids_len, key_id_lens, key_count, ids))
+  {
+    kmyth_enclave_clear(client_private_bytes, client_private_bytes_len);
+  }
+  else
+  {
+    ret_val = retrieve_keys_from_server(client_private_bytes,
+                                        client_private_bytes_len,
+                                        server_cert_bytes,
+                                        server_cert_bytes_len,
+                                        server_host, server_host_len,
+                                        server_port, ids, key_id_lens,
+                                        key_count, handles);
+  }
+
+  kmyth_enclave_log_flush();
+  return ret_val;
+}
+
+// This is the function that gets converted into the ecall.
+int kmyth_enclave_load_key_server_identity(uint8_t * client_private_bytes,
+                                           size_t client_private_bytes_len,
+                                           uint8_t * server_cert_bytes,
+                                           size_t server_cert_bytes_len)
+{
+  kmyth_enclave_stats_ecall(KMYTH_ENCLAVE_STATS_RETRIEVE);
+  EVP_PKEY *client_sign_privkey = NULL;
+  X509 *server_cert = NULL;
+  int ret_val = unmarshal_key_server_identity(client_private_bytes,
+                                              client_private_bytes_len,
+                                              server_cert_bytes,
+                                              server_cert_bytes_len,
+                                              &client_sign_privkey,
+                                              &server_cert);
+
+  if (ret_val == EXIT_SUCCESS)
+  {
+    // the enclave keeps the client key, but only needs the certificate's
+    // public key and digest
+    ret_val = enclave_load_key_server_identity(client_sign_privkey,
+                                               server_cert);
+    if (ret_val)
+    {
+      EVP_PKEY_free(client_sign_privkey);
+    }
+    X509_free(server_cert);
+  }
+
+  kmyth_enclave_log_flush();
+  return ret_val;
+}
+
+// This is the function that gets converted into the ecall.
+int kmyth_enclave_retrieve_keys_with_identity(const char *server_host,
+                                              int server_host_len,
+                                              int server_port,
+                                              unsigned char *key_ids,
+                                              size_t key_ids_len,
+                                              size_t *key_id_lens,
+                                              size_t key_count,
+                                              uint64_t * handles)
+{
+  kmyth_enclave_stats_ecall(KMYTH_ENCLAVE_STATS_RETRIEVE);
+  unsigned char *ids[KMIP_GET_BATCH_MAX_ITEMS] = { NULL };
+  unsigned char *retrieve_key_results[KMIP_GET_BATCH_MAX_ITEMS] = { NULL };
+  size_t retrieve_key_result_lens[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  unsigned char *retrieve_key_result_ids[KMIP_GET_BATCH_MAX_ITEMS] = { NULL };
+  size_t retrieve_key_result_id_lens[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  int ret_val = split_key_ids(key_ids, key_ids_len, key_id_lens, key_count,
+                              ids);
+
+  if (ret_val == EXIT_SUCCESS)
+  {
+    ret_val = enclave_retrieve_keys_with_identity(server_host,
+                                                  server_host_len,
+                                                  server_port, ids,
+                                                  key_id_lens, key_count,
+                                                  retrieve_key_result_ids,
+                                                  retrieve_key_result_id_lens,
+                                                  retrieve_key_results,
+                                                  retrieve_key_result_lens);
+    if (ret_val)
+    {
+      kmyth_sgx_log(LOG_ERR, "enclave_retrieve_keys_with_identity() "
+                    "wrapper function call failed");
+    }
+  }
+  if (ret_val == EXIT_SUCCESS)
+  {
+    ret_val = insert_retrieved_keys(key_count, retrieve_key_result_ids,
+                                    retrieve_key_result_id_lens,
+                                    retrieve_key_results,
+                                    retrieve_key_result_lens, handles);
+  }
+
+  kmyth_enclave_log_flush();
+  return ret_val;
+}
+
+// This is the function that gets converted into the ecall.
+void kmyth_enclave_unload_key_server_identity(void)
+{
+  kmyth_enclave_stats_ecall(KMYTH_ENCLAVE_STATS_RETRIEVE);
+  enclave_unload_key_server_identity();
+  kmyth_enclave_log_flush();
+}
+
+// This is the function that gets converted into the ecall.
+int kmyth_enclave_fill_ephemeral_key_pool(void)
+{
+  kmyth_enclave_stats_ecall(KMYTH_ENCLAVE_STATS_RETRIEVE);
+  int ret_val = enclave_fill_ephemeral_key_pool();
+
+  kmyth_enclave_log_flush();
+  return ret_val;
+}
+
+// This is the function that gets converted into the ecall.
+void kmyth_enclave_close_key_server_session(void)
+{
+  kmyth_enclave_stats_ecall(KMYTH_ENCLAVE_STATS_RETRIEVE);
+  enclave_close_key_session();
+  kmyth_enclave_log_flush();
 }
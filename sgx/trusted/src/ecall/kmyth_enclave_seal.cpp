@@ -7,11 +7,65 @@
 #include "sgx_utils.h"
 #include "sgx_attributes.h"
 
+#include "kmyth_enclave_trusted.h"
 #include ENCLAVE_HEADER_TRUSTED
 
+// Applies the defaults and the KSS requirements to a sealing key policy
+static void set_seal_policy(uint16_t * key_policy,
+                            sgx_attributes_t * attribute_mask)
+{
+  // This combination is recommended by the SGX Developer Guide, so
+  // we use it as default.
+  if (attribute_mask->flags == 0)
+  {
+    attribute_mask->flags = SGX_FLAGS_INITTED | SGX_FLAGS_DEBUG;
+  }
+
+  // If the enclave uses the key separation and sharing (KSS) features
+  // we need that to be reflected in the policy of the sealing key
+  // as well.
+  const sgx_report_t *report = sgx_self_report();
+
+  if (report->body.attributes.flags & SGX_FLAGS_KSS)
+  {
+    *key_policy |=
+      (SGX_KEYPOLICY_CONFIGID | SGX_KEYPOLICY_ISVFAMILYID |
+       SGX_KEYPOLICY_ISVEXTPRODID);
+  }
+}
+
+// Sizes the output of enc_seal_data_chunked(): inputs of up to one chunk
+// are sealed as a single plain blob, larger ones as a run of blobs each
+// carrying a kmyth_sealed_chunk_t
+static uint32_t calc_chunked_sealed_size(uint32_t in_size)
+{
+  if (in_size <= KMYTH_SGX_SEAL_CHUNK_SIZE)
+  {
+    return sgx_calc_sealed_data_size(0, in_size);
+  }
+
+  uint32_t full_chunks = in_size / KMYTH_SGX_SEAL_CHUNK_SIZE;
+  uint32_t tail = in_size % KMYTH_SGX_SEAL_CHUNK_SIZE;
+  uint32_t chunk_sealedsz =
+    sgx_calc_sealed_data_size(sizeof(kmyth_sealed_chunk_t),
+                              KMYTH_SGX_SEAL_CHUNK_SIZE);
+  uint64_t total = (uint64_t) full_chunks * chunk_sealedsz;
+
+  if (tail != 0)
+  {
+    total += sgx_calc_sealed_data_size(sizeof(kmyth_sealed_chunk_t), tail);
+  }
+  if (chunk_sealedsz == UINT32_MAX || total >= UINT32_MAX)
+  {
+    return UINT32_MAX;
+  }
+  return (uint32_t) total;
+}
+
 // EDL checks that `size` is outside the enclave (speculative-safe)
 int enc_get_sealed_size(uint32_t in_size, uint32_t * size)
 {
+  kmyth_enclave_stats_ecall(KMYTH_ENCLAVE_STATS_SEAL);
   if (size == NULL)
   {
     return SGX_ERROR_INVALID_PARAMETER;
@@ -27,11 +81,11 @@ int enc_get_sealed_size(uint32_t in_size, uint32_t * size)
   return 0;
 }
 
-// EDL checks that `in_data` is outside the enclave (speculative-safe)
-// `out_data` is user_check
-int enc_seal_data(const uint8_t * in_data, uint32_t in_size, uint8_t * out_data,
-                  uint32_t out_size, uint16_t key_policy,
-                  sgx_attributes_t attribute_mask)
+// Seals one input into out_data (the body of enc_seal_data, shared with
+// enc_seal_data_batch)
+static int seal_data(const uint8_t * in_data, uint32_t in_size,
+                     uint8_t * out_data, uint32_t out_size,
+                     uint16_t key_policy, sgx_attributes_t attribute_mask)
 {
   if (in_data == NULL || out_data == NULL)
   {
@@ -54,28 +108,12 @@ int enc_seal_data(const uint8_t * in_data, uint32_t in_size, uint8_t * out_data,
 
   if (buf == NULL)
     return SGX_ERROR_OUT_OF_MEMORY;
+  kmyth_enclave_stats_heap_alloc(sealedsz);
 
   // Retire validity check of `out_data` and checks in `malloc` against `sealedsz`, influenced by `in_size`
   sgx_lfence();
 
-  // This combination is recommended by the SGX Developer Guide, so
-  // we use it as default.
-  if (attribute_mask.flags == 0)
-  {
-    attribute_mask.flags = SGX_FLAGS_INITTED | SGX_FLAGS_DEBUG;
-  }
-
-  // If the enclave uses the key separation and sharing (KSS) features
-  // we need that to be reflected in the policy of the sealing key
-  // as well.
-  const sgx_report_t *report = sgx_self_report();
-
-  if (report->body.attributes.flags & SGX_FLAGS_KSS)
-  {
-    key_policy |=
-      (SGX_KEYPOLICY_CONFIGID | SGX_KEYPOLICY_ISVFAMILYID |
-       SGX_KEYPOLICY_ISVEXTPRODID);
-  }
+  set_seal_policy(&key_policy, &attribute_mask);
 
   // This 0 value is currently unused by SGX.
   const sgx_misc_select_t misc_mask = 0;
@@ -92,6 +130,186 @@ int enc_seal_data(const uint8_t * in_data, uint32_t in_size, uint8_t * out_data,
   ret = 0;
 Out:
   if (buf)
+  {
     free(buf);
+    kmyth_enclave_stats_heap_free(sealedsz);
+  }
+  return ret;
+}
+
+// EDL checks that `in_data` is outside the enclave (speculative-safe)
+// `out_data` is user_check
+int enc_seal_data(const uint8_t * in_data, uint32_t in_size, uint8_t * out_data,
+                  uint32_t out_size, uint16_t key_policy,
+                  sgx_attributes_t attribute_mask)
+{
+  kmyth_enclave_stats_ecall(KMYTH_ENCLAVE_STATS_SEAL);
+  return seal_data(in_data, in_size, out_data, out_size, key_policy,
+                   attribute_mask);
+}
+
+// EDL checks that `in_data` and `in_sizes` are outside the enclave
+// (speculative-safe) and copies them in; `out_data` is user_check
+int enc_seal_data_batch(uint32_t count, const uint8_t * in_data,
+                        uint32_t in_size, const uint32_t * in_sizes,
+                        uint8_t * out_data, uint32_t out_size,
+                        uint32_t * out_sizes, uint16_t key_policy,
+                        sgx_attributes_t attribute_mask)
+{
+  kmyth_enclave_stats_ecall(KMYTH_ENCLAVE_STATS_SEAL);
+  if (count == 0 || in_data == NULL || in_sizes == NULL || out_data == NULL
+      || out_sizes == NULL)
+  {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+  if (!sgx_is_outside_enclave(out_data, out_size))
+    return SGX_ERROR_INVALID_PARAMETER;
+
+  // The packed inputs must exactly fill in_data, and every sealed output
+  // must fit in out_data, before anything is sealed.
+  uint64_t in_total = 0;
+  uint64_t out_total = 0;
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    uint32_t sealedsz = sgx_calc_sealed_data_size(0, in_sizes[i]);
+
+    if (sealedsz == UINT32_MAX)
+      return SGX_ERROR_INVALID_PARAMETER;
+    in_total += in_sizes[i];
+    out_total += sealedsz;
+    out_sizes[i] = sealedsz;
+  }
+  if (in_total != in_size || out_total > out_size)
+    return SGX_ERROR_INVALID_PARAMETER;
+
+  // Retire the size checks above before using them as offsets
+  sgx_lfence();
+
+  uint32_t in_offset = 0;
+  uint32_t out_offset = 0;
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    int ret = seal_data(in_data + in_offset, in_sizes[i],
+                        out_data + out_offset, out_sizes[i],
+                        key_policy, attribute_mask);
+
+    if (ret != 0)
+      return ret;
+    in_offset += in_sizes[i];
+    out_offset += out_sizes[i];
+  }
+  return 0;
+}
+
+// EDL checks that `size` is outside the enclave (speculative-safe)
+int enc_get_chunked_sealed_size(uint32_t in_size, uint32_t * size)
+{
+  kmyth_enclave_stats_ecall(KMYTH_ENCLAVE_STATS_SEAL);
+  if (size == NULL || in_size == 0)
+  {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+  *size = 0;
+
+  uint32_t sealedsz = calc_chunked_sealed_size(in_size);
+
+  if (sealedsz == UINT32_MAX)
+    return SGX_ERROR_INVALID_PARAMETER;
+
+  *size = sealedsz;
+  return 0;
+}
+
+// `in_data` and `out_data` are both user_check, so neither is copied into
+// the enclave as a whole: each chunk is copied in, sealed and copied out
+// through buffers of (at most) one chunk.
+int enc_seal_data_chunked(const uint8_t * in_data, uint32_t in_size,
+                          uint8_t * out_data, uint32_t out_size,
+                          uint16_t key_policy,
+                          sgx_attributes_t attribute_mask)
+{
+  kmyth_enclave_stats_ecall(KMYTH_ENCLAVE_STATS_SEAL);
+  if (in_data == NULL || out_data == NULL || in_size == 0)
+  {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+  if (!sgx_is_outside_enclave(in_data, in_size)
+      || !sgx_is_outside_enclave(out_data, out_size))
+    return SGX_ERROR_INVALID_PARAMETER;
+
+  uint32_t sealedsz = calc_chunked_sealed_size(in_size);
+
+  if (sealedsz == UINT32_MAX)
+    return SGX_ERROR_INVALID_PARAMETER;
+  if (sealedsz > out_size)
+    return SGX_ERROR_INVALID_PARAMETER;
+
+  // Retire the checks of `in_data` and `out_data` against sizes influenced
+  // by `in_size` before they are used to copy
+  sgx_lfence();
+
+  bool chunked = (in_size > KMYTH_SGX_SEAL_CHUNK_SIZE);
+  uint32_t chunk_size = chunked ? KMYTH_SGX_SEAL_CHUNK_SIZE : in_size;
+  uint32_t mac_size = chunked ? sizeof(kmyth_sealed_chunk_t) : 0;
+  uint32_t count = (in_size - 1) / chunk_size + 1;
+  uint32_t buf_size = sgx_calc_sealed_data_size(mac_size, chunk_size);
+
+  uint8_t *chunk = (uint8_t *) malloc(chunk_size);
+  sgx_sealed_data_t *buf = (sgx_sealed_data_t *) malloc(buf_size);
+
+  if (chunk == NULL || buf == NULL)
+  {
+    free(chunk);
+    free(buf);
+    return SGX_ERROR_OUT_OF_MEMORY;
+  }
+  kmyth_enclave_stats_heap_alloc(chunk_size + buf_size);
+
+  set_seal_policy(&key_policy, &attribute_mask);
+
+  // This 0 value is currently unused by SGX.
+  const sgx_misc_select_t misc_mask = 0;
+
+  kmyth_sealed_chunk_t header;
+
+  memcpy(header.magic, KMYTH_SGX_SEAL_CHUNK_MAGIC, sizeof(header.magic));
+  header.count = count;
+  header.total_size = in_size;
+
+  // binds the chunks of this seal together
+  int ret = chunked ? sgx_read_rand(header.seal_id, sizeof(header.seal_id))
+    : SGX_SUCCESS;
+  uint32_t in_offset = 0;
+  uint32_t out_offset = 0;
+
+  for (uint32_t i = 0; i < count && ret == 0; i++)
+  {
+    uint32_t len = in_size - in_offset;
+
+    if (len > chunk_size)
+      len = chunk_size;
+
+    uint32_t blob_size = sgx_calc_sealed_data_size(mac_size, len);
+
+    // sealing reads the plaintext from inside the enclave, which also stops
+    // the untrusted side changing it while it is encrypted
+    memcpy(chunk, in_data + in_offset, len);
+    header.index = i;
+    ret = sgx_seal_data_ex(key_policy, attribute_mask, misc_mask, mac_size,
+                           chunked ? (const uint8_t *) &header : NULL, len,
+                           chunk, blob_size, buf);
+    if (ret == SGX_SUCCESS)
+    {
+      memcpy(out_data + out_offset, buf, blob_size);
+      in_offset += len;
+      out_offset += blob_size;
+    }
+  }
+
+  kmyth_enclave_clear_and_free(chunk, chunk_size);
+  free(buf);
+  kmyth_enclave_stats_heap_free(chunk_size + buf_size);
   return ret;
 }
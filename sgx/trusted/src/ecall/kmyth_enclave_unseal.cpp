@@ -11,9 +11,70 @@
 #include "kmyth_enclave_trusted.h"
 #include ENCLAVE_HEADER_TRUSTED
 
-unseal_data_t *kmyth_unsealed_data_table = NULL;
+/**
+ * The unsealed data table is split into UNSEAL_TABLE_SHARDS independent
+ * shards, each an open-addressing (linear probing) hash table keyed on the
+ * 64-bit handle and guarded by its own lock, so that ecall threads working
+ * with different handles rarely contend. A NULL slot is empty. Handles
+ * are either taken from a SHA-384 digest, and so already uniformly
+ * distributed, or handed out in sequence: either way the low bits select
+ * the shard and the remaining bits the starting slot within it.
+ *
+ * Slots point to separately allocated entries so that a reference taken
+ * with retrieve_ref_from_unseal_table() stays valid while the shard grows
+ * or the entry is removed. The table holds one reference to each entry it
+ * contains and each reader holds another; the entry is cleared and freed
+ * when the last reference is dropped. New references are only taken under
+ * the shard lock, from entries still in the table, so dropping one needs
+ * no lock.
+ *
+ * A shard's slot array doubles when it passes a 3/4 load and halves (down
+ * to UNSEAL_TABLE_INITIAL_SLOTS) when it falls to a 1/8 load, so that the
+ * table gives back the heap it took under a burst of unseals. On an SGX2
+ * platform with a dynamic heap (SGX_EDMM=1 in sgx/Makefile) the enclave's
+ * heap pages are then committed and released as the table grows and shrinks.
+ */
+#define UNSEAL_TABLE_SHARDS 16
+#define UNSEAL_TABLE_SHARD_BITS 4
+#define UNSEAL_TABLE_INITIAL_SLOTS 16
+
+typedef struct unseal_table_shard_s
+{
+  sgx_thread_mutex_t lock;
+  unseal_data_t **slots;
+  size_t capacity;              // always a power of two
+  size_t count;
+} unseal_table_shard_t;
+
+static unseal_table_shard_t kmyth_unsealed_data_table[UNSEAL_TABLE_SHARDS];
 static bool kmyth_unsealed_data_table_initialized = false;
-static sgx_thread_mutex_t kmyth_unsealed_data_table_lock;
+
+/**
+ * How the handle for unsealed data is chosen, selected at build time with
+ * -DKMYTH_UNSEAL_HANDLE=<scheme> (SGX_UNSEAL_HANDLE in sgx/Makefile):
+ *
+ *   KMYTH_UNSEAL_HANDLE_CONTENT - the first 64 bits of the SHA-384 digest
+ *                                 of the plaintext (the default); the same
+ *                                 data always gets the same handle
+ *   KMYTH_UNSEAL_HANDLE_COUNTER - a random salt, drawn when the table is
+ *                                 initialized, plus a counter; no pass over
+ *                                 the data at all
+ *   KMYTH_UNSEAL_HANDLE_HEADER  - the SHA-384 digest of the fixed size
+ *                                 sgx_sealed_data_t header (key request and
+ *                                 MAC) rather than of the whole plaintext
+ */
+#define KMYTH_UNSEAL_HANDLE_CONTENT 0
+#define KMYTH_UNSEAL_HANDLE_COUNTER 1
+#define KMYTH_UNSEAL_HANDLE_HEADER 2
+
+#ifndef KMYTH_UNSEAL_HANDLE
+#define KMYTH_UNSEAL_HANDLE KMYTH_UNSEAL_HANDLE_CONTENT
+#endif
+
+#if KMYTH_UNSEAL_HANDLE == KMYTH_UNSEAL_HANDLE_COUNTER
+static uint64_t kmyth_unseal_handle_salt = 0;
+static uint64_t kmyth_unseal_handle_counter = 0;
+#endif
 
 /**
  * @brief Derives the data handle by taking the first 64 bits of the
@@ -21,7 +82,7 @@ static sgx_thread_mutex_t kmyth_unsealed_data_table_lock;
  *
  * @param[in] data_size The size (in bytes) of the input data.
  *
- * @param[in] data      A pointer to the sealed data.
+ * @param[in] data      A pointer to the input data.
  *
  * @param[out] handle   A pointer to a uint64_t to hold the handle.
  *
@@ -34,110 +95,513 @@ static bool derive_handle(uint32_t data_size, uint8_t * data, uint64_t * handle)
     return false;
   }
 
-  EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+  unsigned char digest[EVP_MAX_MD_SIZE];
 
-  if (ctx == NULL)
+  if (EVP_Digest(data, data_size, digest, NULL, EVP_sha384(), NULL) != 1)
   {
     return false;
   }
-  if (EVP_DigestInit_ex(ctx, EVP_sha384(), NULL) != 1)
+  memcpy(handle, digest, sizeof(uint64_t));
+  kmyth_enclave_clear(digest, sizeof(digest));
+  return true;
+}
+
+#if KMYTH_UNSEAL_HANDLE == KMYTH_UNSEAL_HANDLE_COUNTER
+/**
+ * @brief Hands out the next handle in sequence.
+ *
+ * @param[out] handle   A pointer to a uint64_t to hold the handle.
+ */
+static void next_handle(uint64_t * handle)
+{
+  *handle = kmyth_unseal_handle_salt +
+    __atomic_fetch_add(&kmyth_unseal_handle_counter, 1, __ATOMIC_RELAXED);
+}
+#endif
+
+static unseal_table_shard_t *shard_for_handle(uint64_t handle)
+{
+  return &kmyth_unsealed_data_table[handle & (UNSEAL_TABLE_SHARDS - 1)];
+}
+
+static size_t home_slot(const unseal_table_shard_t * shard, uint64_t handle)
+{
+  return (size_t) (handle >> UNSEAL_TABLE_SHARD_BITS) & (shard->capacity - 1);
+}
+
+/**
+ * @brief Finds the slot holding a handle in a shard. The shard's lock
+ *        must be held.
+ *
+ * @returns the slot index, or shard->capacity if the handle is not present.
+ */
+static size_t find_slot(const unseal_table_shard_t * shard, uint64_t handle)
+{
+  size_t mask = shard->capacity - 1;
+
+  for (size_t i = home_slot(shard, handle);
+       shard->slots[i] != NULL; i = (i + 1) & mask)
   {
-    EVP_MD_CTX_free(ctx);
-    return false;
+    if (shard->slots[i]->handle == handle)
+    {
+      return i;
+    }
   }
-  if (EVP_DigestUpdate(ctx, data, data_size) != 1)
+  return shard->capacity;
+}
+
+/**
+ * @brief Places an entry in the first free slot of its probe sequence. The
+ *        shard's lock must be held and the shard must have a free slot.
+ */
+static void place_slot(unseal_table_shard_t * shard, unseal_data_t * entry)
+{
+  size_t mask = shard->capacity - 1;
+  size_t i = home_slot(shard, entry->handle);
+
+  while (shard->slots[i] != NULL)
   {
-    EVP_MD_CTX_free(ctx);
-    return false;
+    i = (i + 1) & mask;
   }
+  shard->slots[i] = entry;
+}
+
+/**
+ * @brief Empties a slot, shifting later entries of the same probe run back
+ *        so that lookups never need tombstones. The shard's lock must be
+ *        held.
+ */
+static void remove_slot(unseal_table_shard_t * shard, size_t index)
+{
+  size_t mask = shard->capacity - 1;
+  size_t hole = index;
+  size_t i = index;
 
-  unsigned char *digest = (unsigned char *) malloc(EVP_MD_size(EVP_sha384()));
+  while (true)
+  {
+    i = (i + 1) & mask;
+    if (shard->slots[i] == NULL)
+    {
+      break;
+    }
+
+    // An entry may fill the hole only if the hole lies cyclically between
+    // its home slot and its current slot.
+    size_t home = home_slot(shard, shard->slots[i]->handle);
+
+    if (((i - home) & mask) >= ((i - hole) & mask))
+    {
+      shard->slots[hole] = shard->slots[i];
+      hole = i;
+    }
+  }
+  shard->slots[hole] = NULL;
+  shard->count--;
+}
 
-  if (digest == NULL)
+/**
+ * @brief Drops a reference to an entry, clearing and freeing it when no
+ *        references remain.
+ */
+static void drop_reference(unseal_data_t * entry)
+{
+  if (__atomic_sub_fetch(&entry->refcount, 1, __ATOMIC_ACQ_REL) == 0)
+  {
+    kmyth_enclave_stats_table_bytes(-(int64_t) (entry->data_size +
+                                                sizeof(unseal_data_t)));
+    kmyth_enclave_clear_and_free(entry->data, entry->data_size);
+    free(entry);
+  }
+}
+
+/**
+ * @brief Changes the number of slots in a shard, rehashing its entries.
+ *        The shard's lock must be held, and new_capacity must be a power
+ *        of two larger than the shard's count.
+ *
+ * @returns true on success, false on failure (the shard is unchanged).
+ */
+static bool resize_shard(unseal_table_shard_t * shard, size_t new_capacity)
+{
+  size_t old_capacity = shard->capacity;
+  unseal_data_t **old_slots = shard->slots;
+
+  if (new_capacity > SIZE_MAX / sizeof(unseal_data_t *))
   {
-    EVP_MD_CTX_free(ctx);
     return false;
   }
-  if (EVP_DigestFinal_ex(ctx, digest, NULL) != 1)
+
+  unseal_data_t **new_slots =
+    (unseal_data_t **) calloc(new_capacity, sizeof(unseal_data_t *));
+
+  if (new_slots == NULL)
   {
-    EVP_MD_CTX_free(ctx);
-    free(digest);
     return false;
   }
-  memcpy(handle, digest, sizeof(uint64_t));
-  free(digest);
+
+  shard->slots = new_slots;
+  shard->capacity = new_capacity;
+  for (size_t i = 0; i < old_capacity; i++)
+  {
+    if (old_slots[i] != NULL)
+    {
+      place_slot(shard, old_slots[i]);
+    }
+  }
+  free(old_slots);
+  kmyth_enclave_stats_table_bytes(((int64_t) new_capacity -
+                                   (int64_t) old_capacity) *
+                                  (int64_t) sizeof(unseal_data_t *));
   return true;
 }
 
+/**
+ * @brief Doubles the number of slots in a shard. The shard's lock must be
+ *        held.
+ *
+ * @returns true on success, false on failure.
+ */
+static bool grow_shard(unseal_table_shard_t * shard)
+{
+  if (shard->capacity > SIZE_MAX / 2)
+  {
+    return false;
+  }
+  return resize_shard(shard, 2 * shard->capacity);
+}
+
+/**
+ * @brief Halves the number of slots in a shard that has fallen to a 1/8
+ *        load, releasing the rest. The shard's lock must be held. A shard
+ *        that cannot be shrunk (no heap for the smaller array) just keeps
+ *        its slots.
+ */
+static void shrink_shard(unseal_table_shard_t * shard)
+{
+  if (shard->capacity > UNSEAL_TABLE_INITIAL_SLOTS
+      && 8 * shard->count <= shard->capacity)
+  {
+    resize_shard(shard, shard->capacity / 2);
+  }
+}
+
 int kmyth_unsealed_data_table_initialize(void)
 {
-  if (sgx_thread_mutex_init(&kmyth_unsealed_data_table_lock, NULL))
+  kmyth_enclave_stats_ecall(KMYTH_ENCLAVE_STATS_UNSEAL);
+  for (size_t i = 0; i < UNSEAL_TABLE_SHARDS; i++)
+  {
+    unseal_table_shard_t *shard = &kmyth_unsealed_data_table[i];
+
+    shard->slots = (unseal_data_t **) calloc(UNSEAL_TABLE_INITIAL_SLOTS,
+                                             sizeof(unseal_data_t *));
+    if (shard->slots == NULL
+        || sgx_thread_mutex_init(&shard->lock, NULL) != 0)
+    {
+      free(shard->slots);
+      shard->slots = NULL;
+      for (size_t j = 0; j < i; j++)
+      {
+        sgx_thread_mutex_destroy(&kmyth_unsealed_data_table[j].lock);
+        free(kmyth_unsealed_data_table[j].slots);
+        kmyth_unsealed_data_table[j].slots = NULL;
+      }
+      return -1;
+    }
+    shard->capacity = UNSEAL_TABLE_INITIAL_SLOTS;
+    shard->count = 0;
+  }
+  kmyth_enclave_stats_table_bytes((int64_t) (UNSEAL_TABLE_SHARDS *
+                                             UNSEAL_TABLE_INITIAL_SLOTS *
+                                             sizeof(unseal_data_t *)));
+#if KMYTH_UNSEAL_HANDLE == KMYTH_UNSEAL_HANDLE_COUNTER
+  if (sgx_read_rand((unsigned char *) &kmyth_unseal_handle_salt,
+                    sizeof(kmyth_unseal_handle_salt)) != SGX_SUCCESS)
   {
+    for (size_t i = 0; i < UNSEAL_TABLE_SHARDS; i++)
+    {
+      sgx_thread_mutex_destroy(&kmyth_unsealed_data_table[i].lock);
+      free(kmyth_unsealed_data_table[i].slots);
+      kmyth_unsealed_data_table[i].slots = NULL;
+    }
+    kmyth_enclave_stats_table_bytes(-(int64_t) (UNSEAL_TABLE_SHARDS *
+                                                UNSEAL_TABLE_INITIAL_SLOTS *
+                                                sizeof(unseal_data_t *)));
     return -1;
   }
+#endif
   kmyth_unsealed_data_table_initialized = true;
   return 0;
 }
 
 int kmyth_unsealed_data_table_cleanup(void)
 {
-  sgx_thread_mutex_lock(&kmyth_unsealed_data_table_lock);
-  unseal_data_t *slot = kmyth_unsealed_data_table;
-  unseal_data_t *next_slot;
+  kmyth_enclave_stats_ecall(KMYTH_ENCLAVE_STATS_UNSEAL);
+  if (!kmyth_unsealed_data_table_initialized)
+  {
+    return 0;
+  }
+  kmyth_unsealed_data_table_initialized = false;
+
+  int retval = 0;
 
-  while (slot != NULL)
+  for (size_t i = 0; i < UNSEAL_TABLE_SHARDS; i++)
   {
-    next_slot = slot->next;
-    free(slot->data);
-    free(slot);
-    slot = next_slot;
+    unseal_table_shard_t *shard = &kmyth_unsealed_data_table[i];
+
+    sgx_thread_mutex_lock(&shard->lock);
+    for (size_t j = 0; j < shard->capacity; j++)
+    {
+      // entries still referenced by a reader are freed on release
+      if (shard->slots[j] != NULL)
+      {
+        drop_reference(shard->slots[j]);
+      }
+    }
+    free(shard->slots);
+    kmyth_enclave_stats_table_bytes(-(int64_t) (shard->capacity *
+                                                sizeof(unseal_data_t *)));
+    shard->slots = NULL;
+    shard->capacity = 0;
+    shard->count = 0;
+    sgx_thread_mutex_unlock(&shard->lock);
+    if (sgx_thread_mutex_destroy(&shard->lock) != 0)
+    {
+      retval = -1;
+    }
   }
-  sgx_thread_mutex_unlock(&kmyth_unsealed_data_table_lock);
-  return sgx_thread_mutex_destroy(&kmyth_unsealed_data_table_lock);
+  return retval;
 }
 
-bool kmyth_unseal_into_enclave(uint32_t data_size, uint8_t * data,
-                               uint64_t * handle)
+/**
+ * @brief Adds data to the unsealed data table under the given handle. On
+ *        success the table takes ownership of the data.
+ *
+ * @returns true on success, false on failure.
+ */
+static bool insert_with_handle(uint8_t * data, uint32_t data_size,
+                               uint64_t handle);
+
+/**
+ * @brief Unseals the run of chunks written by enc_seal_data_chunked() into
+ *        one newly allocated buffer. Every chunk must be present, in order,
+ *        all from the same seal (carry the same seal ID), and the chunks
+ *        must fill data exactly.
+ *
+ * @returns true on success, false on failure.
+ */
+static bool unseal_chunks(uint32_t data_size, uint8_t * data,
+                          uint8_t ** plaintext, uint32_t * plaintext_size)
 {
+  // Size the plaintext from the (not yet authenticated) blob headers,
+  // which are only trusted as far as they stay within data
+  uint64_t total = 0;
+  uint32_t count = 0;
+  uint32_t offset = 0;
 
-  if (!kmyth_unsealed_data_table_initialized)
+  while (offset < data_size)
+  {
+    if (data_size - offset < sizeof(sgx_sealed_data_t))
+    {
+      return false;
+    }
+
+    sgx_sealed_data_t *blob = (sgx_sealed_data_t *) (data + offset);
+    uint32_t text_len = sgx_get_encrypt_txt_len(blob);
+    uint32_t blob_size =
+      sgx_calc_sealed_data_size(sgx_get_add_mac_txt_len(blob), text_len);
+
+    if (text_len == UINT32_MAX || blob_size == UINT32_MAX
+        || blob_size > data_size - offset)
+    {
+      return false;
+    }
+    total += text_len;
+    offset += blob_size;
+    count++;
+  }
+  if (total == 0 || total >= UINT32_MAX)
   {
     return false;
   }
 
-  if (data_size == 0 || data == NULL)
+  uint8_t *buf = (uint8_t *) malloc(total);
+
+  if (buf == NULL)
   {
     return false;
   }
+  kmyth_enclave_stats_heap_alloc(total);
 
-  uint32_t plaintext_data_size =
-    sgx_get_encrypt_txt_len((sgx_sealed_data_t *) data);
+  uint8_t seal_id[KMYTH_SGX_SEAL_ID_LEN] = { 0 };
+  uint32_t in_offset = 0;
+  uint32_t out_offset = 0;
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    sgx_sealed_data_t *blob = (sgx_sealed_data_t *) (data + in_offset);
+    kmyth_sealed_chunk_t header;
+    uint32_t mac_len = sizeof(header);
+    uint32_t text_len = sgx_get_encrypt_txt_len(blob);
+
+    if (sgx_get_add_mac_txt_len(blob) != sizeof(header)
+        || sgx_unseal_data(blob, (uint8_t *) & header, &mac_len,
+                           buf + out_offset, &text_len) != SGX_SUCCESS
+        || memcmp(header.magic, KMYTH_SGX_SEAL_CHUNK_MAGIC,
+                  sizeof(header.magic)) != 0 || header.index != i
+        || header.count != count || header.total_size != total
+        || (i > 0 && memcmp(header.seal_id, seal_id, sizeof(seal_id)) != 0))
+    {
+      kmyth_enclave_clear_and_free(buf, total);
+      kmyth_enclave_stats_heap_free(total);
+      return false;
+    }
+    if (i == 0)
+    {
+      memcpy(seal_id, header.seal_id, sizeof(seal_id));
+    }
+    in_offset += sgx_calc_sealed_data_size(mac_len, text_len);
+    out_offset += text_len;
+  }
+
+  *plaintext = buf;
+  *plaintext_size = (uint32_t) total;
+  return true;
+}
+
+/**
+ * @brief Unseals one sealed blob into the table (the body of
+ *        kmyth_unseal_into_enclave, shared with
+ *        kmyth_unseal_into_enclave_batch).
+ *
+ * @returns true on success, false on failure.
+ */
+static bool unseal_into_enclave(uint32_t data_size, uint8_t * data,
+                                uint64_t * handle)
+{
+  if (!kmyth_unsealed_data_table_initialized)
+  {
+    return false;
+  }
 
-  // UINT32_MAX is the error return value of sgx_get_encrypt_txt_len.
-  if (plaintext_data_size == UINT32_MAX)
+  if (data_size < sizeof(sgx_sealed_data_t) || data == NULL)
   {
     return false;
   }
 
-  uint8_t *plaintext_data = (uint8_t *) malloc(plaintext_data_size);
+#if KMYTH_UNSEAL_HANDLE == KMYTH_UNSEAL_HANDLE_HEADER
+  uint64_t new_handle;
 
-  if (plaintext_data == NULL)
+  if (!derive_handle(sizeof(sgx_sealed_data_t), data, &new_handle))
   {
     return false;
   }
+#endif
 
+  uint8_t *plaintext_data = NULL;
+  uint32_t plaintext_data_size = 0;
   uint32_t mac_len = sgx_get_add_mac_txt_len((sgx_sealed_data_t *) data);
 
-  if (sgx_unseal_data
-      ((sgx_sealed_data_t *) data, NULL, &mac_len, plaintext_data,
-       (uint32_t *) & plaintext_data_size) != SGX_SUCCESS)
+  // blobs sealed in chunks carry a chunk header as their MAC text; kmyth
+  // seals everything else without one
+  if (mac_len == sizeof(kmyth_sealed_chunk_t))
   {
-    free(plaintext_data);
-    return false;
+    if (!unseal_chunks(data_size, data, &plaintext_data, &plaintext_data_size))
+    {
+      return false;
+    }
+  }
+  else
+  {
+    plaintext_data_size = sgx_get_encrypt_txt_len((sgx_sealed_data_t *) data);
+
+    // UINT32_MAX is the error return value of sgx_get_encrypt_txt_len.
+    if (plaintext_data_size == UINT32_MAX)
+    {
+      return false;
+    }
+
+    plaintext_data = (uint8_t *) malloc(plaintext_data_size);
+
+    if (plaintext_data == NULL)
+    {
+      return false;
+    }
+    kmyth_enclave_stats_heap_alloc(plaintext_data_size);
+
+    if (sgx_unseal_data
+        ((sgx_sealed_data_t *) data, NULL, &mac_len, plaintext_data,
+         (uint32_t *) & plaintext_data_size) != SGX_SUCCESS)
+    {
+      free(plaintext_data);
+      kmyth_enclave_stats_heap_free(plaintext_data_size);
+      return false;
+    }
   }
 
+  // from here the plaintext is either the table's or freed
+  kmyth_enclave_stats_heap_free(plaintext_data_size);
+
+#if KMYTH_UNSEAL_HANDLE == KMYTH_UNSEAL_HANDLE_HEADER
+  if (plaintext_data_size == 0 || plaintext_data_size == UINT32_MAX
+      || !insert_with_handle(plaintext_data, plaintext_data_size,
+                             new_handle))
+  {
+    kmyth_enclave_clear_and_free(plaintext_data, plaintext_data_size);
+    return false;
+  }
+  *handle = new_handle;
+  return true;
+#else
   // handle gets set in insert_into_unseal_table
   return insert_into_unseal_table(plaintext_data, plaintext_data_size, handle);
+#endif
+}
+
+bool kmyth_unseal_into_enclave(uint32_t data_size, uint8_t * data,
+                               uint64_t * handle)
+{
+  kmyth_enclave_stats_ecall(KMYTH_ENCLAVE_STATS_UNSEAL);
+  return unseal_into_enclave(data_size, data, handle);
+}
+
+bool kmyth_unseal_into_enclave_batch(uint32_t count, uint8_t * data,
+                                     uint32_t data_size,
+                                     const uint32_t * data_sizes,
+                                     uint64_t * handles)
+{
+  kmyth_enclave_stats_ecall(KMYTH_ENCLAVE_STATS_UNSEAL);
+  if (count == 0 || data == NULL || data_sizes == NULL || handles == NULL)
+  {
+    return false;
+  }
+
+  uint64_t total = 0;
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    total += data_sizes[i];
+  }
+  if (total != data_size)
+  {
+    return false;
+  }
+
+  // All or nothing: on a failure, drop the blobs already unsealed
+  uint32_t offset = 0;
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    if (!unseal_into_enclave(data_sizes[i], data + offset, handles + i))
+    {
+      for (uint32_t j = 0; j < i; j++)
+      {
+        remove_from_unseal_table(handles[j]);
+      }
+      return false;
+    }
+    offset += data_sizes[i];
+  }
+  return true;
 }
 
 bool insert_into_unseal_table(uint8_t * data, uint32_t data_size,
@@ -155,72 +619,209 @@ bool insert_into_unseal_table(uint8_t * data, uint32_t data_size,
     return false;
   }
 
-  unseal_data_t *new_slot = (unseal_data_t *) malloc(sizeof(unseal_data_t));
+  // There is no sealed blob here, so the header scheme falls back to the
+  // content-derived handle.
+  uint64_t new_handle;
 
-  if (new_slot == NULL)
+#if KMYTH_UNSEAL_HANDLE == KMYTH_UNSEAL_HANDLE_COUNTER
+  next_handle(&new_handle);
+#else
+  if (!derive_handle(data_size, data, &new_handle))
   {
     return false;
   }
+#endif
 
-  if (!derive_handle(data_size, data, &new_slot->handle))
+  if (!insert_with_handle(data, data_size, new_handle))
+  {
+    return false;
+  }
+  *handle = new_handle;
+  return true;
+}
+
+static bool insert_with_handle(uint8_t * data, uint32_t data_size,
+                               uint64_t handle)
+{
+  if (!kmyth_unsealed_data_table_initialized)
+  {
+    return false;
+  }
+
+  unseal_data_t *new_slot = (unseal_data_t *) malloc(sizeof(unseal_data_t));
+
+  if (new_slot == NULL)
   {
-    free(new_slot);
     return false;
   }
 
+  new_slot->handle = handle;
   new_slot->data_size = data_size;
   new_slot->data = data;
-  if (new_slot->data == NULL)
+  new_slot->refcount = 1;       // the table's reference
+
+  unseal_table_shard_t *shard = shard_for_handle(new_slot->handle);
+
+  sgx_thread_mutex_lock(&shard->lock);
+
+  // keep the load factor at or below 3/4 so probe runs stay short
+  if (4 * (shard->count + 1) > 3 * shard->capacity && !grow_shard(shard))
   {
+    sgx_thread_mutex_unlock(&shard->lock);
     free(new_slot);
     return false;
   }
-
-  sgx_thread_mutex_lock(&kmyth_unsealed_data_table_lock);
-  new_slot->next = kmyth_unsealed_data_table;
-  kmyth_unsealed_data_table = new_slot;
-  sgx_thread_mutex_unlock(&kmyth_unsealed_data_table_lock);
-  *handle = new_slot->handle;
+  place_slot(shard, new_slot);
+  shard->count++;
+  sgx_thread_mutex_unlock(&shard->lock);
+  kmyth_enclave_stats_table_bytes((int64_t) (data_size +
+                                             sizeof(unseal_data_t)));
   return true;
 }
 
 size_t retrieve_from_unseal_table(uint64_t handle, uint8_t ** buf)
 {
-  if (!kmyth_unsealed_data_table_initialized)
+  unseal_data_t *entry = retrieve_ref_from_unseal_table(handle);
+
+  if (entry == NULL)
   {
     return 0;
   }
+  remove_from_unseal_table(handle);
 
-  unseal_data_t *slot = kmyth_unsealed_data_table;
-  unseal_data_t *prev_slot = NULL;
+  size_t data_size = entry->data_size;
 
-  sgx_thread_mutex_lock(&kmyth_unsealed_data_table_lock);
-  while (slot != NULL && slot->handle != handle)
+  *buf = (uint8_t *) malloc(data_size);
+  if (*buf == NULL)
   {
-    prev_slot = slot;
-    slot = slot->next;
+    release_unseal_table_ref(entry);
+    return 0;
   }
+  memcpy(*buf, entry->data, data_size);
+  release_unseal_table_ref(entry);
+  return data_size;
+}
 
-  if (slot == NULL)
+unseal_data_t *retrieve_ref_from_unseal_table(uint64_t handle)
+{
+  if (!kmyth_unsealed_data_table_initialized)
+  {
+    return NULL;
+  }
+
+  unseal_table_shard_t *shard = shard_for_handle(handle);
+  unseal_data_t *entry = NULL;
+
+  sgx_thread_mutex_lock(&shard->lock);
+
+  size_t index = find_slot(shard, handle);
+
+  if (index != shard->capacity)
+  {
+    entry = shard->slots[index];
+    __atomic_add_fetch(&entry->refcount, 1, __ATOMIC_RELAXED);
+  }
+  sgx_thread_mutex_unlock(&shard->lock);
+  return entry;
+}
+
+void release_unseal_table_ref(unseal_data_t * entry)
+{
+  if (entry != NULL)
+  {
+    drop_reference(entry);
+  }
+}
+
+bool acquire_unseal_table_view(uint64_t handle, unseal_data_view_t * view)
+{
+  unseal_data_t *entry = retrieve_ref_from_unseal_table(handle);
+
+  if (entry == NULL)
+  {
+    view->data = NULL;
+    view->data_size = 0;
+    view->ref = NULL;
+    return false;
+  }
+  view->data = entry->data;
+  view->data_size = entry->data_size;
+  view->ref = entry;
+  return true;
+}
+
+void release_unseal_table_view(unseal_data_view_t * view)
+{
+  release_unseal_table_ref(view->ref);
+  view->data = NULL;
+  view->data_size = 0;
+  view->ref = NULL;
+}
+
+bool remove_from_unseal_table(uint64_t handle)
+{
+  if (!kmyth_unsealed_data_table_initialized)
+  {
+    return false;
+  }
+
+  unseal_table_shard_t *shard = shard_for_handle(handle);
+
+  sgx_thread_mutex_lock(&shard->lock);
+
+  size_t index = find_slot(shard, handle);
+
+  if (index == shard->capacity)
+  {
+    sgx_thread_mutex_unlock(&shard->lock);
+    return false;
+  }
+
+  unseal_data_t *entry = shard->slots[index];
+
+  remove_slot(shard, index);
+  shrink_shard(shard);
+  sgx_thread_mutex_unlock(&shard->lock);
+  drop_reference(entry);
+  return true;
+}
+
+size_t unseal_table_entry_count(void)
+{
+  if (!kmyth_unsealed_data_table_initialized)
   {
-    sgx_thread_mutex_unlock(&kmyth_unsealed_data_table_lock);
     return 0;
   }
 
-  if (prev_slot != NULL)
+  size_t count = 0;
+
+  for (size_t i = 0; i < UNSEAL_TABLE_SHARDS; i++)
   {
-    prev_slot->next = slot->next;
+    sgx_thread_mutex_lock(&kmyth_unsealed_data_table[i].lock);
+    count += kmyth_unsealed_data_table[i].count;
+    sgx_thread_mutex_unlock(&kmyth_unsealed_data_table[i].lock);
   }
-  else
+  return count;
+}
+
+size_t unseal_table_data_size(uint64_t handle)
+{
+  if (!kmyth_unsealed_data_table_initialized)
   {
-    kmyth_unsealed_data_table = slot->next;
+    return 0;
   }
-  sgx_thread_mutex_unlock(&kmyth_unsealed_data_table_lock);
-  *buf = (uint8_t *) malloc(slot->data_size);
-  memcpy(*buf, slot->data, slot->data_size);
-  size_t data_size = slot->data_size;
 
-  free(slot->data);
-  free(slot);
+  unseal_table_shard_t *shard = shard_for_handle(handle);
+  size_t data_size = 0;
+
+  sgx_thread_mutex_lock(&shard->lock);
+
+  size_t index = find_slot(shard, handle);
+
+  if (index != shard->capacity)
+  {
+    data_size = shard->slots[index]->data_size;
+  }
+  sgx_thread_mutex_unlock(&shard->lock);
   return data_size;
 }
@@ -0,0 +1,101 @@
+/**
+ * kmyth_enclave_log.c:
+ *
+ * C library containing buffered logging for use within kmyth SGX enclave
+ */
+
+#include "kmyth_enclave_log.h"
+
+#include <string.h>
+
+#include "sgx_thread.h"
+
+#include "kmyth_enclave_trusted.h"
+
+#ifndef KMYTH_ENCLAVE_LOG_BUFFER_ENTRIES
+#define KMYTH_ENCLAVE_LOG_BUFFER_ENTRIES 32
+#endif
+
+#ifndef KMYTH_ENCLAVE_LOG_FLUSH_SEVERITY
+#define KMYTH_ENCLAVE_LOG_FLUSH_SEVERITY LOG_WARNING
+#endif
+
+#if KMYTH_ENCLAVE_LOG_BUFFER_ENTRIES > 0
+static kmyth_enclave_log_entry_t
+  kmyth_enclave_log_buffer[KMYTH_ENCLAVE_LOG_BUFFER_ENTRIES];
+static size_t kmyth_enclave_log_count = 0;
+static sgx_thread_mutex_t kmyth_enclave_log_lock =
+  SGX_THREAD_MUTEX_INITIALIZER;
+
+//############################################################################
+// copy_log_string()
+//############################################################################
+static void copy_log_string(char *dest, size_t dest_size, const char *src)
+{
+  size_t len = (src == NULL) ? 0 : strnlen(src, dest_size - 1);
+
+  if (len > 0)
+  {
+    memcpy(dest, src, len);
+  }
+  dest[len] = '\0';
+}
+
+//############################################################################
+// flush_log_buffer()
+//############################################################################
+static void flush_log_buffer(void)
+{
+  // the lock must be held: it also keeps the batches in order
+  if (kmyth_enclave_log_count > 0)
+  {
+    log_event_batch_ocall(kmyth_enclave_log_buffer, kmyth_enclave_log_count);
+    kmyth_enclave_log_count = 0;
+  }
+}
+#endif
+
+//############################################################################
+// kmyth_enclave_log_event()
+//############################################################################
+void kmyth_enclave_log_event(const char *src_file, const char *src_func,
+                             int src_line, int severity, const char *message)
+{
+#if KMYTH_ENCLAVE_LOG_BUFFER_ENTRIES > 0
+  sgx_thread_mutex_lock(&kmyth_enclave_log_lock);
+  if (kmyth_enclave_log_count == KMYTH_ENCLAVE_LOG_BUFFER_ENTRIES)
+  {
+    flush_log_buffer();
+  }
+
+  kmyth_enclave_log_entry_t *entry =
+    &kmyth_enclave_log_buffer[kmyth_enclave_log_count++];
+
+  entry->src_line = src_line;
+  entry->severity = severity;
+  copy_log_string(entry->src_file, sizeof(entry->src_file), src_file);
+  copy_log_string(entry->src_func, sizeof(entry->src_func), src_func);
+  copy_log_string(entry->message, sizeof(entry->message), message);
+
+  // severities are numbered from LOG_EMERG (0) down to LOG_DEBUG (7)
+  if (severity <= KMYTH_ENCLAVE_LOG_FLUSH_SEVERITY)
+  {
+    flush_log_buffer();
+  }
+  sgx_thread_mutex_unlock(&kmyth_enclave_log_lock);
+#else
+  log_event_ocall(&src_file, &src_func, &src_line, &severity, &message);
+#endif
+}
+
+//############################################################################
+// kmyth_enclave_log_flush()
+//############################################################################
+void kmyth_enclave_log_flush(void)
+{
+#if KMYTH_ENCLAVE_LOG_BUFFER_ENTRIES > 0
+  sgx_thread_mutex_lock(&kmyth_enclave_log_lock);
+  flush_log_buffer();
+  sgx_thread_mutex_unlock(&kmyth_enclave_log_lock);
+#endif
+}
@@ -7,6 +7,26 @@
 #include "kmyth_enclave_memory_util.h"
 
 #include <stdlib.h>
+#include <string.h>
+
+/*
+ * Clearing is done with memset(), which the C library implements with the
+ * widest stores available, followed by a compiler barrier that takes the
+ * cleared pointer as an input and clobbers memory: the compiler must assume
+ * the cleared bytes are then read, so it cannot drop the memset() as a dead
+ * store. Without GNU inline assembly, memset() is called through a volatile
+ * function pointer, which the compiler cannot assume still points to it.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define SECURE_MEMSET(v, c, n) \
+  do { \
+    memset((v), (c), (n)); \
+    __asm__ __volatile__("" : : "r"(v) : "memory"); \
+  } while (0)
+#else
+static void *(*const volatile memset_ptr) (void *, int, size_t) = memset;
+#define SECURE_MEMSET(v, c, n) memset_ptr((v), (c), (n))
+#endif
 
 //############################################################################
 // kmyth_enclave_clear()
@@ -16,10 +36,7 @@ void kmyth_enclave_clear(void *v, size_t size)
   if (v == NULL)
     return;
 
-  volatile unsigned char *p = v;
-
-  while (size--)
-    *p++ = '\0';
+  SECURE_MEMSET(v, 0, size);
 }
 
 //############################################################################
@@ -38,10 +55,7 @@ void kmyth_enclave_clear_and_free(void *v, size_t size)
 //############################################################################
 void *kmyth_enclave_secure_memset(void *v, int c, size_t n)
 {
-  volatile unsigned char *p = v;
-
-  while (n--)
-    *p++ = c;
+  SECURE_MEMSET(v, c, n);
 
   return v;
 }
@@ -0,0 +1,156 @@
+/**
+ * kmyth_enclave_stats.c:
+ *
+ * C library containing the memory and transition counters of a kmyth SGX
+ * enclave
+ */
+
+#include "kmyth_enclave_stats.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "sgx_edger8r.h"
+
+#include "kmyth_enclave_trusted.h"
+
+static uint64_t kmyth_enclave_ecalls[KMYTH_ENCLAVE_STATS_PATHS];
+static uint64_t kmyth_enclave_heap_bytes[KMYTH_ENCLAVE_STATS_PATHS];
+static uint64_t kmyth_enclave_heap_peak_bytes[KMYTH_ENCLAVE_STATS_PATHS];
+static uint64_t kmyth_enclave_table_bytes = 0;
+static uint64_t kmyth_enclave_table_peak_bytes = 0;
+static uint64_t kmyth_enclave_ocalls = 0;
+
+// the path of the calling thread's ECALL, plus one (0 until the thread
+// first enters a counted ECALL, so the heap counters ignore it)
+static __thread int kmyth_enclave_thread_path = 0;
+
+//############################################################################
+// raise_peak()
+//############################################################################
+static void raise_peak(uint64_t * peak, uint64_t value)
+{
+  uint64_t seen = __atomic_load_n(peak, __ATOMIC_RELAXED);
+
+  while (value > seen
+         && !__atomic_compare_exchange_n(peak, &seen, value, true,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+  {
+  }
+}
+
+//############################################################################
+// kmyth_enclave_stats_ecall()
+//############################################################################
+void kmyth_enclave_stats_ecall(int path)
+{
+  if (path < 0 || path >= KMYTH_ENCLAVE_STATS_PATHS)
+  {
+    return;
+  }
+  __atomic_add_fetch(&kmyth_enclave_ecalls[path], 1, __ATOMIC_RELAXED);
+  kmyth_enclave_thread_path = path + 1;
+}
+
+//############################################################################
+// kmyth_enclave_stats_heap_alloc()
+//############################################################################
+void kmyth_enclave_stats_heap_alloc(size_t size)
+{
+  int path = kmyth_enclave_thread_path - 1;
+
+  if (path < 0)
+  {
+    return;
+  }
+
+  uint64_t in_use = __atomic_add_fetch(&kmyth_enclave_heap_bytes[path], size,
+                                       __ATOMIC_RELAXED);
+
+  raise_peak(&kmyth_enclave_heap_peak_bytes[path], in_use);
+}
+
+//############################################################################
+// kmyth_enclave_stats_heap_free()
+//############################################################################
+void kmyth_enclave_stats_heap_free(size_t size)
+{
+  int path = kmyth_enclave_thread_path - 1;
+
+  if (path < 0)
+  {
+    return;
+  }
+  __atomic_sub_fetch(&kmyth_enclave_heap_bytes[path], size, __ATOMIC_RELAXED);
+}
+
+//############################################################################
+// kmyth_enclave_stats_table_bytes()
+//############################################################################
+void kmyth_enclave_stats_table_bytes(int64_t delta)
+{
+  uint64_t in_use = __atomic_add_fetch(&kmyth_enclave_table_bytes,
+                                       (uint64_t) delta, __ATOMIC_RELAXED);
+
+  if (delta > 0)
+  {
+    raise_peak(&kmyth_enclave_table_peak_bytes, in_use);
+  }
+}
+
+//############################################################################
+// __wrap_sgx_ocall()
+//
+// Every OCALL made from the enclave - by the edger8r generated code or by
+// the SDK libraries - goes through sgx_ocall(), which the enclave is linked
+// to wrap with this function.
+//############################################################################
+sgx_status_t __real_sgx_ocall(const unsigned int index, void *ms);
+
+sgx_status_t __wrap_sgx_ocall(const unsigned int index, void *ms)
+{
+  __atomic_add_fetch(&kmyth_enclave_ocalls, 1, __ATOMIC_RELAXED);
+  return __real_sgx_ocall(index, ms);
+}
+
+// This is the function that gets converted into the ecall.
+void kmyth_enclave_get_stats(kmyth_enclave_stats_t * stats)
+{
+  if (stats == NULL)
+  {
+    return;
+  }
+  memset(stats, 0, sizeof(kmyth_enclave_stats_t));
+  stats->unseal_table_entries = unseal_table_entry_count();
+  stats->unseal_table_bytes =
+    __atomic_load_n(&kmyth_enclave_table_bytes, __ATOMIC_RELAXED);
+  stats->unseal_table_peak_bytes =
+    __atomic_load_n(&kmyth_enclave_table_peak_bytes, __ATOMIC_RELAXED);
+  for (int i = 0; i < KMYTH_ENCLAVE_STATS_PATHS; i++)
+  {
+    stats->ecalls[i] =
+      __atomic_load_n(&kmyth_enclave_ecalls[i], __ATOMIC_RELAXED);
+    stats->heap_bytes[i] =
+      __atomic_load_n(&kmyth_enclave_heap_bytes[i], __ATOMIC_RELAXED);
+    stats->heap_peak_bytes[i] =
+      __atomic_load_n(&kmyth_enclave_heap_peak_bytes[i], __ATOMIC_RELAXED);
+  }
+  stats->ocalls = __atomic_load_n(&kmyth_enclave_ocalls, __ATOMIC_RELAXED);
+}
+
+// This is the function that gets converted into the ecall.
+void kmyth_enclave_reset_stats(void)
+{
+  // the memory in use stays counted; only the peaks drop back to it
+  for (int i = 0; i < KMYTH_ENCLAVE_STATS_PATHS; i++)
+  {
+    __atomic_store_n(&kmyth_enclave_ecalls[i], 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&kmyth_enclave_heap_peak_bytes[i],
+                     __atomic_load_n(&kmyth_enclave_heap_bytes[i],
+                                     __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&kmyth_enclave_table_peak_bytes,
+                   __atomic_load_n(&kmyth_enclave_table_bytes,
+                                   __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+  __atomic_store_n(&kmyth_enclave_ocalls, 0, __ATOMIC_RELAXED);
+}
@@ -6,21 +6,258 @@
 
 #include "sgx_retrieve_key_impl.h"
 
+#include <openssl/sha.h>
+
+#include "sgx_thread.h"
+#include "sgx_trts.h"
+
 #include "cipher/aes_gcm.h"
 
 #include "kmip_util.h"
 
+/**
+ * The session with the key server: a connection and the ECDH session key
+ * agreed over it, kept open between key requests. peer_id identifies who
+ * the session was opened between (see key_session_peer_id()). msg_buffer
+ * is the untrusted buffer its messages move through (NULL if it could not
+ * be allocated, in which case each message is passed across on its own).
+ * kmip_buffer is the buffer its KMIP requests are encoded into, reused for
+ * each request.
+ */
+typedef struct key_session_s
+{
+  int socket_fd;
+  unsigned char *msg_buffer;
+  size_t msg_buffer_size;
+  unsigned char *session_key;
+  unsigned int session_key_len;
+  unsigned char peer_id[SHA256_DIGEST_LENGTH];
+  time_t established;
+  unsigned int requests;
+  kmip_encoding_buffer kmip_buffer;
+} key_session_t;
+
+static key_session_t key_session = {
+  .socket_fd = -1,
+  .msg_buffer = NULL,
+  .msg_buffer_size = 0,
+  .session_key = NULL,
+  .session_key_len = 0,
+  .peer_id = {0},
+  .established = 0,
+  .requests = 0,
+  .kmip_buffer = {NULL, 0}
+};
+
+static sgx_thread_mutex_t key_session_lock = SGX_THREAD_MUTEX_INITIALIZER;
+
+/**
+ * The parsed credentials a session is opened with: the client (enclave)
+ * signing key, the key server's signature verification key, and a digest
+ * of the two (see key_server_identity_init()). key_server_identity holds
+ * the ones loaded by enclave_load_key_server_identity(), if any, and like
+ * key_session is guarded by key_session_lock.
+ */
+typedef struct key_server_identity_s
+{
+  EVP_PKEY *client_sign_privkey;
+  EVP_PKEY *server_sign_pubkey;
+  unsigned char digest[SHA256_DIGEST_LENGTH];
+} key_server_identity_t;
+
+static key_server_identity_t key_server_identity = {
+  .client_sign_privkey = NULL,
+  .server_sign_pubkey = NULL,
+  .digest = {0}
+};
+
+/**
+ * Single-use ephemeral key pairs generated ahead of the handshakes that use
+ * them (see enclave_fill_ephemeral_key_pool()).
+ */
+static EVP_PKEY *ephemeral_pool[KMYTH_ECDH_EPHEMERAL_POOL_SIZE];
+static size_t ephemeral_pool_count = 0;
+static sgx_thread_mutex_t ephemeral_pool_lock = SGX_THREAD_MUTEX_INITIALIZER;
+
 //############################################################################
-// enclave_retrieve_key()
+// take_ephemeral_key_pair()
+//
+// Takes a pregenerated ephemeral key pair out of the pool, or generates
+// one if the pool is empty
 //############################################################################
-int enclave_retrieve_key(EVP_PKEY * enclave_sign_privkey, X509 * peer_cert,
-                         const char *server_host, int server_host_len,
-                         int server_port, unsigned char *req_key_id,
-                         size_t req_key_id_len,
-                         unsigned char **retrieved_key_id,
-                         size_t *retrieved_key_id_len,
-                         uint8_t **retrieved_key, size_t *retrieved_key_len)
+static int take_ephemeral_key_pair(EVP_PKEY ** keypair)
 {
+  *keypair = NULL;
+
+  sgx_thread_mutex_lock(&ephemeral_pool_lock);
+  if (ephemeral_pool_count > 0)
+  {
+    *keypair = ephemeral_pool[--ephemeral_pool_count];
+    ephemeral_pool[ephemeral_pool_count] = NULL;
+  }
+  sgx_thread_mutex_unlock(&ephemeral_pool_lock);
+
+  if (*keypair != NULL)
+  {
+    kmyth_sgx_log(LOG_DEBUG, "took a pregenerated ECDH ephemeral key pair");
+    return EXIT_SUCCESS;
+  }
+  return create_ecdh_ephemeral_key_pair(KMYTH_ECDH_SUITE, keypair);
+}
+
+//############################################################################
+// close_key_session()
+//############################################################################
+static void close_key_session(void)
+{
+  if (key_session.socket_fd != -1)
+  {
+    close_socket_ocall(key_session.socket_fd);
+  }
+  if (key_session.msg_buffer != NULL)
+  {
+    OPENSSL_free_ocall((void **) &key_session.msg_buffer);
+  }
+  if (key_session.session_key != NULL)
+  {
+    kmyth_enclave_clear_and_free(key_session.session_key,
+                                 key_session.session_key_len);
+  }
+  key_session.socket_fd = -1;
+  key_session.msg_buffer = NULL;
+  key_session.msg_buffer_size = 0;
+  key_session.session_key = NULL;
+  key_session.session_key_len = 0;
+  kmyth_enclave_clear(key_session.peer_id, sizeof(key_session.peer_id));
+  key_session.established = 0;
+  key_session.requests = 0;
+  kmip_encoding_buffer_free(&key_session.kmip_buffer);
+}
+
+//############################################################################
+// key_server_identity_init()
+//
+// Extracts the server's verification key from its certificate and digests
+// the certificate with the client's public key. The client key is
+// referenced, not copied, so must outlive the identity.
+//############################################################################
+static int key_server_identity_init(key_server_identity_t * identity,
+                                    EVP_PKEY * enclave_sign_privkey,
+                                    X509 * peer_cert)
+{
+  unsigned char *cert_der = NULL;
+  unsigned char *client_pub_der = NULL;
+  int cert_der_len = i2d_X509(peer_cert, &cert_der);
+  int client_pub_der_len = i2d_PUBKEY(enclave_sign_privkey, &client_pub_der);
+  EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+  int ret_val = EXIT_FAILURE;
+
+  identity->client_sign_privkey = enclave_sign_privkey;
+  identity->server_sign_pubkey = X509_get_pubkey(peer_cert);
+  if (identity->server_sign_pubkey == NULL)
+  {
+    kmyth_sgx_log(LOG_ERR,
+                  "public key extraction from server certificate failed");
+  }
+  else if (cert_der_len > 0 && client_pub_der_len > 0 && ctx != NULL
+           && EVP_DigestInit_ex(ctx, EVP_sha256(), NULL)
+           && EVP_DigestUpdate(ctx, cert_der, cert_der_len)
+           && EVP_DigestUpdate(ctx, client_pub_der, client_pub_der_len)
+           && EVP_DigestFinal_ex(ctx, identity->digest, NULL))
+  {
+    ret_val = EXIT_SUCCESS;
+  }
+
+  EVP_MD_CTX_free(ctx);
+  OPENSSL_free(cert_der);
+  OPENSSL_free(client_pub_der);
+  if (ret_val)
+  {
+    EVP_PKEY_free(identity->server_sign_pubkey);
+    identity->server_sign_pubkey = NULL;
+    identity->client_sign_privkey = NULL;
+  }
+  return ret_val;
+}
+
+//############################################################################
+// key_server_identity_clear()
+//
+// Frees what key_server_identity_init() extracted (not the client key)
+//############################################################################
+static void key_server_identity_clear(key_server_identity_t * identity)
+{
+  EVP_PKEY_free(identity->server_sign_pubkey);
+  identity->server_sign_pubkey = NULL;
+  identity->client_sign_privkey = NULL;
+  kmyth_enclave_clear(identity->digest, sizeof(identity->digest));
+}
+
+//############################################################################
+// key_session_peer_id()
+//
+// Digests everything a session is bound to: the server's address, and the
+// server certificate and client key of the identity it was opened with
+//############################################################################
+static int key_session_peer_id(const key_server_identity_t * identity,
+                               const char *server_host, int server_host_len,
+                               int server_port, unsigned char *peer_id)
+{
+  EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+  int ret_val = EXIT_FAILURE;
+
+  if (ctx != NULL
+      && EVP_DigestInit_ex(ctx, EVP_sha256(), NULL)
+      && EVP_DigestUpdate(ctx, server_host, server_host_len)
+      && EVP_DigestUpdate(ctx, &server_port, sizeof(server_port))
+      && EVP_DigestUpdate(ctx, identity->digest, sizeof(identity->digest))
+      && EVP_DigestFinal_ex(ctx, peer_id, NULL))
+  {
+    ret_val = EXIT_SUCCESS;
+  }
+
+  EVP_MD_CTX_free(ctx);
+  return ret_val;
+}
+
+//############################################################################
+// key_session_usable()
+//
+// Checks the open session (if any) is with the same peer and due neither
+// a rekey (KMYTH_KEY_SESSION_MAX_REQUESTS) nor to expire
+// (KMYTH_KEY_SESSION_LIFETIME)
+//############################################################################
+static bool key_session_usable(const unsigned char *peer_id)
+{
+  if (key_session.session_key == NULL
+      || memcmp(key_session.peer_id, peer_id, sizeof(key_session.peer_id))
+      || key_session.requests >= KMYTH_KEY_SESSION_MAX_REQUESTS)
+  {
+    return false;
+  }
+
+  time_t now = 0;
+
+  if (time_ocall(&now, NULL) != SGX_SUCCESS || now < key_session.established
+      || now - key_session.established >= KMYTH_KEY_SESSION_LIFETIME)
+  {
+    return false;
+  }
+  return true;
+}
+
+//############################################################################
+// open_key_session()
+//
+// Connects to the key server and agrees a session key with it (a signed
+// ephemeral ECDH exchange), leaving both in key_session
+//############################################################################
+static int open_key_session(const key_server_identity_t * identity,
+                            const char *server_host, int server_host_len,
+                            int server_port)
+{
+  EVP_PKEY *enclave_sign_privkey = identity->client_sign_privkey;
+  EVP_PKEY *server_sign_pubkey = identity->server_sign_pubkey;
   int ret_val;
   sgx_status_t ret_ocall;
   char msg[MAX_LOG_MSG_LEN] = { 0 };
@@ -35,35 +272,17 @@ int enclave_retrieve_key(EVP_PKEY * enclave_sign_privkey, X509 * peer_cert,
     return EXIT_FAILURE;
   }
 
-  // recover public key from certificate
-  EVP_PKEY *server_sign_pubkey = NULL;
-
-  server_sign_pubkey = X509_get_pubkey(peer_cert);
-  if (server_sign_pubkey == NULL)
-  {
-    kmyth_sgx_log(LOG_ERR,
-                  "public key extraction from server certificate failed");
-    kmyth_enclave_clear(enclave_sign_privkey, sizeof(enclave_sign_privkey));
-    close_socket_ocall(socket_fd);
-    return EXIT_FAILURE;
-  }
-  kmyth_sgx_log(LOG_DEBUG,
-                "extracted server signature verification key from cert");
-
   // create client's ephemeral contribution to the session key
-  EC_KEY *client_ephemeral_keypair = NULL;
+  EVP_PKEY *client_ephemeral_keypair = NULL;
   unsigned char *client_ephemeral_pub = NULL;
   size_t client_ephemeral_pub_len = 0;
 
-  ret_val = create_ecdh_ephemeral_key_pair(KMYTH_EC_NID,
-                                           &client_ephemeral_keypair);
+  ret_val = take_ephemeral_key_pair(&client_ephemeral_keypair);
 
   if (ret_val != EXIT_SUCCESS)
   {
     kmyth_sgx_log(LOG_ERR, "client ECDH ephemeral key pair creation failed");
-    kmyth_enclave_clear(enclave_sign_privkey, sizeof(enclave_sign_privkey));
-    EVP_PKEY_free(server_sign_pubkey);
-    EC_KEY_free(client_ephemeral_keypair);
+    EVP_PKEY_free(client_ephemeral_keypair);
     close_socket_ocall(socket_fd);
     return EXIT_FAILURE;
   }
@@ -75,9 +294,7 @@ int enclave_retrieve_key(EVP_PKEY * enclave_sign_privkey, X509 * peer_cert,
   {
     kmyth_sgx_log(LOG_ERR,
                   "client ECDH 'public key' octet string creation failed");
-    kmyth_enclave_clear(enclave_sign_privkey, sizeof(enclave_sign_privkey));
-    EVP_PKEY_free(server_sign_pubkey);
-    EC_KEY_free(client_ephemeral_keypair);
+    EVP_PKEY_free(client_ephemeral_keypair);
     free(client_ephemeral_pub);
     close_socket_ocall(socket_fd);
     return EXIT_FAILURE;
@@ -97,9 +314,7 @@ int enclave_retrieve_key(EVP_PKEY * enclave_sign_privkey, X509 * peer_cert,
   if (ret_val != EXIT_SUCCESS)
   {
     kmyth_sgx_log(LOG_ERR, "error signing client ephemeral 'public key' bytes");
-    kmyth_enclave_clear(enclave_sign_privkey, sizeof(enclave_sign_privkey));
-    EVP_PKEY_free(server_sign_pubkey);
-    EC_KEY_free(client_ephemeral_keypair);
+    EVP_PKEY_free(client_ephemeral_keypair);
     free(client_ephemeral_pub);
     free(client_eph_pub_signature);
     close_socket_ocall(socket_fd);
@@ -108,9 +323,6 @@ int enclave_retrieve_key(EVP_PKEY * enclave_sign_privkey, X509 * peer_cert,
   kmyth_sgx_log(LOG_DEBUG,
                 "client signed ECDH ephemeral 'public key' octet string");
 
-  // done with client private signing key, so clear this sensitive data
-  kmyth_enclave_clear(enclave_sign_privkey, sizeof(enclave_sign_privkey));
-
   // exchange signed client/server 'public key' contributions
   unsigned char *server_ephemeral_pub = NULL;
   size_t server_ephemeral_pub_len = 0;
@@ -129,8 +341,7 @@ int enclave_retrieve_key(EVP_PKEY * enclave_sign_privkey, X509 * peer_cert,
   if (ret_ocall != SGX_SUCCESS || ret_val != EXIT_SUCCESS)
   {
     kmyth_sgx_log(LOG_ERR, "ECDH ephemeral 'public key' exchange unsuccessful");
-    EVP_PKEY_free(server_sign_pubkey);
-    EC_KEY_free(client_ephemeral_keypair);
+    EVP_PKEY_free(client_ephemeral_keypair);
     free(client_ephemeral_pub);
     free(client_eph_pub_signature);
     OPENSSL_free_ocall((void **) &server_ephemeral_pub);
@@ -154,8 +365,7 @@ int enclave_retrieve_key(EVP_PKEY * enclave_sign_privkey, X509 * peer_cert,
   if (ret_val != EXIT_SUCCESS)
   {
     kmyth_sgx_log(LOG_ERR, "client ephemeral 'public key' signature invalid");
-    EVP_PKEY_free(server_sign_pubkey);
-    EC_KEY_free(client_ephemeral_keypair);
+    EVP_PKEY_free(client_ephemeral_keypair);
     OPENSSL_free_ocall((void **) &server_ephemeral_pub);
     OPENSSL_free_ocall((void **) &server_eph_pub_signature);
     close_socket_ocall(socket_fd);
@@ -165,28 +375,40 @@ int enclave_retrieve_key(EVP_PKEY * enclave_sign_privkey, X509 * peer_cert,
                 "validated client ECDH ephemeral 'public key' signature");
 
   // done with signature verification of server contribution
-  EVP_PKEY_free(server_sign_pubkey);
   OPENSSL_free_ocall((void **) &server_eph_pub_signature);
 
-  // convert server's ephemeral public octet string to an EC_POINT struct
-  EC_POINT *server_ephemeral_pub_pt = NULL;
+  // the server must have answered in the suite the client proposed
+  uint8_t server_suite = 0;
+
+  ret_val = get_ecdh_ephemeral_public_suite(server_ephemeral_pub,
+                                            server_ephemeral_pub_len,
+                                            &server_suite);
+  if (ret_val != EXIT_SUCCESS || server_suite != KMYTH_ECDH_SUITE)
+  {
+    kmyth_sgx_log(LOG_ERR, "server answered in another ECDH suite");
+    EVP_PKEY_free(client_ephemeral_keypair);
+    OPENSSL_free_ocall((void **) &server_ephemeral_pub);
+    close_socket_ocall(socket_fd);
+    return EXIT_FAILURE;
+  }
 
-  ret_val = reconstruct_ecdh_ephemeral_public_point(KMYTH_EC_NID,
-                                                    server_ephemeral_pub,
-                                                    server_ephemeral_pub_len,
-                                                    &server_ephemeral_pub_pt);
+  // convert server's ephemeral public octet string to an EVP_PKEY struct
+  EVP_PKEY *server_ephemeral_pubkey = NULL;
+
+  ret_val = reconstruct_ecdh_ephemeral_public(server_ephemeral_pub,
+                                              server_ephemeral_pub_len,
+                                              &server_ephemeral_pubkey);
   if (ret_val != EXIT_SUCCESS)
   {
     kmyth_sgx_log(LOG_ERR,
-                  "reconstruct client ephemeral 'public key' point failed");
-    EC_KEY_free(client_ephemeral_keypair);
-    free(server_ephemeral_pub);
-    EC_POINT_free(server_ephemeral_pub_pt);
+                  "reconstruct server ephemeral 'public key' failed");
+    EVP_PKEY_free(client_ephemeral_keypair);
+    OPENSSL_free_ocall((void **) &server_ephemeral_pub);
     close_socket_ocall(socket_fd);
     return EXIT_FAILURE;
   }
   kmyth_sgx_log(LOG_DEBUG,
-                "reconstructed server ECDH ephemeral 'public key' point");
+                "reconstructed server ECDH ephemeral 'public key'");
 
   // done with server_ephemeral_pub
   OPENSSL_free_ocall((void **) &server_ephemeral_pub);
@@ -196,14 +418,14 @@ int enclave_retrieve_key(EVP_PKEY * enclave_sign_privkey, X509 * peer_cert,
   size_t session_secret_len = 0;
 
   ret_val = compute_ecdh_shared_secret(client_ephemeral_keypair,
-                                       server_ephemeral_pub_pt,
+                                       server_ephemeral_pubkey,
                                        &session_secret, &session_secret_len);
   if (ret_val)
   {
     kmyth_sgx_log(LOG_ERR,
                   "mutually agreed upon shared secret computation failed");
-    EC_KEY_free(client_ephemeral_keypair);
-    EC_POINT_free(server_ephemeral_pub_pt);
+    EVP_PKEY_free(client_ephemeral_keypair);
+    EVP_PKEY_free(server_ephemeral_pubkey);
     free(session_secret);
     close_socket_ocall(socket_fd);
     return EXIT_FAILURE;
@@ -215,11 +437,10 @@ int enclave_retrieve_key(EVP_PKEY * enclave_sign_privkey, X509 * peer_cert,
            session_secret[session_secret_len - 1], session_secret_len);
   kmyth_sgx_log(LOG_DEBUG, msg);
 
-  // done with inputs to shared secret contribution
-  kmyth_enclave_clear(client_ephemeral_keypair,
-                      sizeof(client_ephemeral_keypair));
-  EC_KEY_free(client_ephemeral_keypair);
-  EC_POINT_free(server_ephemeral_pub_pt);
+  // done with inputs to shared secret contribution (freeing the key pair
+  // clears its private key)
+  EVP_PKEY_free(client_ephemeral_keypair);
+  EVP_PKEY_free(server_ephemeral_pubkey);
 
   // generate session key result for ECDH key agreement (client side)
   unsigned char *session_key = NULL;
@@ -244,38 +465,95 @@ int enclave_retrieve_key(EVP_PKEY * enclave_sign_privkey, X509 * peer_cert,
            session_key[session_key_len - 1], session_key_len);
   kmyth_sgx_log(LOG_DEBUG, msg);
 
+  key_session.socket_fd = socket_fd;
+  key_session.session_key = session_key;
+  key_session.session_key_len = session_key_len;
+  key_session.requests = 0;
+
+  // the session's messages go through one untrusted buffer, rather than
+  // an allocation (and a free OCALL) per message
+  unsigned char *msg_buffer = NULL;
+
+  ret_ocall = ecdh_msg_buffer_ocall(&ret_val, KMYTH_ECDH_MSG_BUFFER_SIZE,
+                                    &msg_buffer);
+  if (ret_ocall == SGX_SUCCESS && ret_val == EXIT_SUCCESS
+      && msg_buffer != NULL
+      && sgx_is_outside_enclave(msg_buffer, KMYTH_ECDH_MSG_BUFFER_SIZE))
+  {
+    key_session.msg_buffer = msg_buffer;
+    key_session.msg_buffer_size = KMYTH_ECDH_MSG_BUFFER_SIZE;
+  }
+  else
+  {
+    kmyth_sgx_log(LOG_WARNING, "no ECDH message buffer, passing each "
+                  "message across the enclave boundary");
+  }
+  if (time_ocall(&key_session.established, NULL) != SGX_SUCCESS)
+  {
+    kmyth_sgx_log(LOG_ERR, "unable to get the time the session was opened");
+    close_key_session();
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+//############################################################################
+// key_session_get_keys()
+//
+// Makes one KMIP Get request over the open session, asking for all of the
+// keys at once as the items of a single batch. The server may answer the
+// items in any order; they are matched back to the requested IDs by their
+// Unique Batch Item IDs. On failure the caller must close the session, as
+// the two ends may no longer agree on where the message stream is.
+//############################################################################
+static int key_session_get_keys(unsigned char **req_key_ids,
+                                size_t *req_key_id_lens, size_t key_count,
+                                unsigned char **retrieved_key_ids,
+                                size_t *retrieved_key_id_lens,
+                                uint8_t **retrieved_keys,
+                                size_t *retrieved_key_lens)
+{
+  int ret_val;
+  sgx_status_t ret_ocall;
+  char msg[MAX_LOG_MSG_LEN] = { 0 };
+
+  // count the request whatever its outcome, as it uses up nonces
+  key_session.requests++;
+
   // create encrypted key request message
   KMIP kmip_context = { 0 };
   kmip_init(&kmip_context, NULL, 0, KMIP_2_0);
 
-  unsigned char *key_request = NULL;
   size_t key_request_len = 0;
 
-  ret_val = build_kmip_get_request(&kmip_context,
-                                   req_key_id, req_key_id_len,
-                                   &key_request, &key_request_len);
+  ret_val = build_kmip_get_batch_request_into(&kmip_context,
+                                              req_key_ids, req_key_id_lens,
+                                              key_count,
+                                              &key_session.kmip_buffer,
+                                              &key_request_len);
   if (ret_val)
   {
     kmyth_sgx_log(LOG_ERR, "Failed to build the KMIP Get request.");
     kmip_destroy(&kmip_context);
-    kmyth_enclave_clear_and_free(session_key, session_key_len);
-    close_socket_ocall(socket_fd);
     return EXIT_FAILURE;
   }
 
   unsigned char *encrypted_request = NULL;
   size_t encrypted_request_len = 0;
 
-  ret_val = aes_gcm_encrypt(session_key, session_key_len,
-                            key_request, key_request_len,
+  ret_val = aes_gcm_encrypt(key_session.session_key,
+                            key_session.session_key_len,
+                            key_session.kmip_buffer.data, key_request_len,
                             &encrypted_request, &encrypted_request_len);
-  kmyth_enclave_clear_and_free(key_request, key_request_len);
+  if (ret_val == 0)
+  {
+    kmyth_enclave_stats_heap_alloc(encrypted_request_len);
+  }
   if (ret_val)
   {
     kmyth_sgx_log(LOG_ERR, "Failed to encrypt the KMIP key request.");
     kmip_destroy(&kmip_context);
-    kmyth_enclave_clear_and_free(session_key, session_key_len);
-    close_socket_ocall(socket_fd);
     return EXIT_FAILURE;
   }
 
@@ -283,30 +561,74 @@ int enclave_retrieve_key(EVP_PKEY * enclave_sign_privkey, X509 * peer_cert,
   unsigned char *encrypted_response = NULL;
   size_t encrypted_response_len = 0;
 
-  ret_ocall = ecdh_send_ocall(&ret_val,
-                              encrypted_request,
-                              encrypted_request_len,
-                              socket_fd);
+  if (key_session.msg_buffer != NULL
+      && encrypted_request_len <= key_session.msg_buffer_size)
+  {
+    memcpy(key_session.msg_buffer, encrypted_request, encrypted_request_len);
+    ret_ocall = ecdh_send_buffer_ocall(&ret_val, key_session.msg_buffer,
+                                       encrypted_request_len,
+                                       key_session.socket_fd);
+  }
+  else
+  {
+    ret_ocall = ecdh_send_ocall(&ret_val,
+                                encrypted_request,
+                                encrypted_request_len,
+                                key_session.socket_fd);
+  }
   kmyth_enclave_clear_and_free(encrypted_request, encrypted_request_len);
+  kmyth_enclave_stats_heap_free(encrypted_request_len);
   if (ret_ocall != SGX_SUCCESS || ret_val != EXIT_SUCCESS)
   {
     kmyth_sgx_log(LOG_ERR, "Failed to send the KMIP key request.");
     kmip_destroy(&kmip_context);
-    kmyth_enclave_clear_and_free(session_key, session_key_len);
-    close_socket_ocall(socket_fd);
     return EXIT_FAILURE;
   }
 
-  ret_ocall = ecdh_recv_ocall(&ret_val,
-                              &encrypted_response,
-                              &encrypted_response_len,
-                              socket_fd);
-  close_socket_ocall(socket_fd);
+  // a response in the message buffer is used where it is; only one that
+  // did not fit (or with no buffer) is allocated, and must be freed
+  bool response_allocated = true;
+
+  if (key_session.msg_buffer != NULL)
+  {
+    ret_ocall = ecdh_recv_buffer_ocall(&ret_val, key_session.msg_buffer,
+                                       key_session.msg_buffer_size,
+                                       &encrypted_response_len,
+                                       &encrypted_response,
+                                       key_session.socket_fd);
+    if (ret_ocall == SGX_SUCCESS && ret_val == EXIT_SUCCESS
+        && encrypted_response == NULL)
+    {
+      response_allocated = false;
+      encrypted_response = key_session.msg_buffer;
+    }
+  }
+  else
+  {
+    ret_ocall = ecdh_recv_ocall(&ret_val,
+                                &encrypted_response,
+                                &encrypted_response_len,
+                                key_session.socket_fd);
+  }
   if (ret_ocall != SGX_SUCCESS || ret_val != EXIT_SUCCESS)
   {
-    kmyth_sgx_log(LOG_ERR, "Failed to send the KMIP key request.");
+    kmyth_sgx_log(LOG_ERR, "Failed to receive the KMIP key response.");
+    kmip_destroy(&kmip_context);
+    return EXIT_FAILURE;
+  }
+
+  // the length comes from outside the enclave, so check the message lies
+  // wholly outside it (and, in the message buffer, within the buffer)
+  if ((!response_allocated
+       && encrypted_response_len > key_session.msg_buffer_size)
+      || !sgx_is_outside_enclave(encrypted_response, encrypted_response_len))
+  {
+    kmyth_sgx_log(LOG_ERR, "KMIP key response is out of bounds.");
+    if (response_allocated)
+    {
+      OPENSSL_free_ocall((void **) &encrypted_response);
+    }
     kmip_destroy(&kmip_context);
-    kmyth_enclave_clear_and_free(session_key, session_key_len);
     return EXIT_FAILURE;
   }
 
@@ -314,24 +636,30 @@ int enclave_retrieve_key(EVP_PKEY * enclave_sign_privkey, X509 * peer_cert,
   unsigned char *response = NULL;
   size_t response_len = 0;
 
-  ret_val = aes_gcm_decrypt(session_key, session_key_len,
+  ret_val = aes_gcm_decrypt(key_session.session_key,
+                            key_session.session_key_len,
                             encrypted_response, encrypted_response_len,
                             &response, &response_len);
-  OPENSSL_free_ocall((void **) &encrypted_response);
-  kmyth_enclave_clear_and_free(session_key, session_key_len);
+  if (response_allocated)
+  {
+    OPENSSL_free_ocall((void **) &encrypted_response);
+  }
   if (ret_val)
   {
     kmyth_sgx_log(LOG_ERR, "Failed to decrypt the KMIP key response.");
     kmip_destroy(&kmip_context);
     return EXIT_FAILURE;
   }
-
-  ret_val = parse_kmip_get_response(&kmip_context,
-                                    response, response_len,
-                                    retrieved_key_id, retrieved_key_id_len,
-                                    (unsigned char **) retrieved_key,
-                                    retrieved_key_len);
+  kmyth_enclave_stats_heap_alloc(response_len);
+
+  ret_val = parse_kmip_get_batch_response(&kmip_context,
+                                          response, response_len, key_count,
+                                          retrieved_key_ids,
+                                          retrieved_key_id_lens,
+                                          (unsigned char **) retrieved_keys,
+                                          retrieved_key_lens);
   kmyth_enclave_clear_and_free(response, response_len);
+  kmyth_enclave_stats_heap_free(response_len);
   kmip_destroy(&kmip_context);
   if (ret_val)
   {
@@ -339,21 +667,283 @@ int enclave_retrieve_key(EVP_PKEY * enclave_sign_privkey, X509 * peer_cert,
     return EXIT_FAILURE;
   }
 
-  if (*retrieved_key_id_len != req_key_id_len
-      || memcmp(*retrieved_key_id, req_key_id, req_key_id_len))
+  for (size_t i = 0; i < key_count; i++)
+  {
+    if (retrieved_key_id_lens[i] != req_key_id_lens[i]
+        || memcmp(retrieved_key_ids[i], req_key_ids[i], req_key_id_lens[i]))
+    {
+      kmyth_sgx_log(LOG_ERR, "Retrieved key ID does not match request");
+      for (size_t j = 0; j < key_count; j++)
+      {
+        kmyth_enclave_clear_and_free(retrieved_keys[j],
+                                     retrieved_key_lens[j]);
+        free(retrieved_key_ids[j]);
+        retrieved_keys[j] = NULL;
+        retrieved_key_ids[j] = NULL;
+      }
+      return EXIT_FAILURE;
+    }
+  }
+
+  for (size_t i = 0; i < key_count; i++)
   {
-    kmyth_sgx_log(LOG_ERR, "Retrieved key ID does not match request");
+    snprintf(msg, MAX_LOG_MSG_LEN, "Received a KMIP object with ID: %.*s",
+             (int) retrieved_key_id_lens[i], retrieved_key_ids[i]);
+    kmyth_sgx_log(LOG_DEBUG, msg);
+
+    snprintf(msg, MAX_LOG_MSG_LEN,
+             "Received KMIP object with key: 0x%02X..%02X",
+             retrieved_keys[i][0],
+             retrieved_keys[i][retrieved_key_lens[i] - 1]);
+    kmyth_sgx_log(LOG_DEBUG, msg);
+  }
+
+  return EXIT_SUCCESS;
+}
+
+//############################################################################
+// retrieve_keys_locked()
+//
+// Gets the keys over the session with the key server, first opening one
+// with the identity given unless the open session can be reused. The
+// caller holds key_session_lock.
+//############################################################################
+static int retrieve_keys_locked(const key_server_identity_t * identity,
+                                const char *server_host, int server_host_len,
+                                int server_port, unsigned char **req_key_ids,
+                                size_t *req_key_id_lens, size_t key_count,
+                                unsigned char **retrieved_key_ids,
+                                size_t *retrieved_key_id_lens,
+                                uint8_t **retrieved_keys,
+                                size_t *retrieved_key_lens)
+{
+  unsigned char peer_id[SHA256_DIGEST_LENGTH];
+
+  if (key_count == 0 || key_count > KMIP_GET_BATCH_MAX_ITEMS)
+  {
+    kmyth_sgx_log(LOG_ERR, "invalid number of keys requested");
     return EXIT_FAILURE;
   }
 
-  snprintf(msg, MAX_LOG_MSG_LEN, "Received a KMIP object with ID: %.*s",
-           (int) *retrieved_key_id_len, *retrieved_key_id);
-  kmyth_sgx_log(LOG_DEBUG, msg);
+  if (key_session_peer_id(identity, server_host, server_host_len,
+                          server_port, peer_id))
+  {
+    kmyth_sgx_log(LOG_ERR, "unable to identify the key server session");
+    return EXIT_FAILURE;
+  }
 
-  snprintf(msg, MAX_LOG_MSG_LEN,
-           "Received KMIP object with key: 0x%02X..%02X",
-           (*retrieved_key)[0], (*retrieved_key)[*retrieved_key_len - 1]);
-  kmyth_sgx_log(LOG_DEBUG, msg);
+  bool reused = key_session_usable(peer_id);
+
+  if (!reused)
+  {
+    close_key_session();
+    if (open_key_session(identity, server_host, server_host_len,
+                         server_port))
+    {
+      return EXIT_FAILURE;
+    }
+    memcpy(key_session.peer_id, peer_id, sizeof(peer_id));
+  }
+  else
+  {
+    kmyth_sgx_log(LOG_DEBUG, "reusing the open key server session");
+  }
+
+  int ret_val = key_session_get_keys(req_key_ids, req_key_id_lens, key_count,
+                                     retrieved_key_ids,
+                                     retrieved_key_id_lens,
+                                     retrieved_keys, retrieved_key_lens);
+
+  // the server may have dropped a session that sat idle, so a reused one
+  // gets one retry over a new session
+  if (ret_val && reused)
+  {
+    kmyth_sgx_log(LOG_INFO, "key request over reused session failed, "
+                  "opening a new session");
+    close_key_session();
+    ret_val = open_key_session(identity, server_host, server_host_len,
+                               server_port);
+    if (ret_val == EXIT_SUCCESS)
+    {
+      memcpy(key_session.peer_id, peer_id, sizeof(peer_id));
+      ret_val = key_session_get_keys(req_key_ids, req_key_id_lens, key_count,
+                                     retrieved_key_ids,
+                                     retrieved_key_id_lens,
+                                     retrieved_keys, retrieved_key_lens);
+    }
+  }
+  if (ret_val)
+  {
+    close_key_session();
+  }
+
+  return ret_val;
+}
 
+//############################################################################
+// enclave_retrieve_keys()
+//############################################################################
+int enclave_retrieve_keys(EVP_PKEY * enclave_sign_privkey, X509 * peer_cert,
+                          const char *server_host, int server_host_len,
+                          int server_port, unsigned char **req_key_ids,
+                          size_t *req_key_id_lens, size_t key_count,
+                          unsigned char **retrieved_key_ids,
+                          size_t *retrieved_key_id_lens,
+                          uint8_t **retrieved_keys,
+                          size_t *retrieved_key_lens)
+{
+  key_server_identity_t identity = { 0 };
+
+  if (key_server_identity_init(&identity, enclave_sign_privkey, peer_cert))
+  {
+    kmyth_sgx_log(LOG_ERR, "unable to load the key server identity");
+    return EXIT_FAILURE;
+  }
+
+  sgx_thread_mutex_lock(&key_session_lock);
+  int ret_val = retrieve_keys_locked(&identity, server_host, server_host_len,
+                                     server_port, req_key_ids,
+                                     req_key_id_lens, key_count,
+                                     retrieved_key_ids,
+                                     retrieved_key_id_lens,
+                                     retrieved_keys, retrieved_key_lens);
+  sgx_thread_mutex_unlock(&key_session_lock);
+
+  key_server_identity_clear(&identity);
+  return ret_val;
+}
+
+//############################################################################
+// enclave_load_key_server_identity()
+//############################################################################
+int enclave_load_key_server_identity(EVP_PKEY * enclave_sign_privkey,
+                                     X509 * peer_cert)
+{
+  key_server_identity_t identity = { 0 };
+
+  if (key_server_identity_init(&identity, enclave_sign_privkey, peer_cert))
+  {
+    kmyth_sgx_log(LOG_ERR, "unable to load the key server identity");
+    return EXIT_FAILURE;
+  }
+
+  sgx_thread_mutex_lock(&key_session_lock);
+  EVP_PKEY_free(key_server_identity.client_sign_privkey);
+  key_server_identity_clear(&key_server_identity);
+  key_server_identity = identity;
+  sgx_thread_mutex_unlock(&key_session_lock);
+
+  kmyth_enclave_clear(&identity, sizeof(identity));
   return EXIT_SUCCESS;
 }
+
+//############################################################################
+// enclave_retrieve_keys_with_identity()
+//############################################################################
+int enclave_retrieve_keys_with_identity(const char *server_host,
+                                        int server_host_len, int server_port,
+                                        unsigned char **req_key_ids,
+                                        size_t *req_key_id_lens,
+                                        size_t key_count,
+                                        unsigned char **retrieved_key_ids,
+                                        size_t *retrieved_key_id_lens,
+                                        uint8_t **retrieved_keys,
+                                        size_t *retrieved_key_lens)
+{
+  int ret_val = EXIT_FAILURE;
+
+  sgx_thread_mutex_lock(&key_session_lock);
+  if (key_server_identity.client_sign_privkey == NULL)
+  {
+    kmyth_sgx_log(LOG_ERR, "no key server identity loaded");
+  }
+  else
+  {
+    ret_val = retrieve_keys_locked(&key_server_identity, server_host,
+                                   server_host_len, server_port,
+                                   req_key_ids, req_key_id_lens, key_count,
+                                   retrieved_key_ids, retrieved_key_id_lens,
+                                   retrieved_keys, retrieved_key_lens);
+  }
+  sgx_thread_mutex_unlock(&key_session_lock);
+
+  return ret_val;
+}
+
+//############################################################################
+// enclave_unload_key_server_identity()
+//############################################################################
+void enclave_unload_key_server_identity(void)
+{
+  sgx_thread_mutex_lock(&key_session_lock);
+  EVP_PKEY_free(key_server_identity.client_sign_privkey);
+  key_server_identity_clear(&key_server_identity);
+  sgx_thread_mutex_unlock(&key_session_lock);
+}
+
+//############################################################################
+// enclave_retrieve_key()
+//############################################################################
+int enclave_retrieve_key(EVP_PKEY * enclave_sign_privkey, X509 * peer_cert,
+                         const char *server_host, int server_host_len,
+                         int server_port, unsigned char *req_key_id,
+                         size_t req_key_id_len,
+                         unsigned char **retrieved_key_id,
+                         size_t *retrieved_key_id_len,
+                         uint8_t **retrieved_key, size_t *retrieved_key_len)
+{
+  return enclave_retrieve_keys(enclave_sign_privkey, peer_cert, server_host,
+                               server_host_len, server_port, &req_key_id,
+                               &req_key_id_len, 1, retrieved_key_id,
+                               retrieved_key_id_len, retrieved_key,
+                               retrieved_key_len);
+}
+
+//############################################################################
+// enclave_fill_ephemeral_key_pool()
+//############################################################################
+int enclave_fill_ephemeral_key_pool(void)
+{
+  while (true)
+  {
+    sgx_thread_mutex_lock(&ephemeral_pool_lock);
+    bool full = (ephemeral_pool_count == KMYTH_ECDH_EPHEMERAL_POOL_SIZE);
+
+    sgx_thread_mutex_unlock(&ephemeral_pool_lock);
+    if (full)
+    {
+      return EXIT_SUCCESS;
+    }
+
+    // generate outside the lock, so handshakes are never held up by it
+    EVP_PKEY *keypair = NULL;
+
+    if (create_ecdh_ephemeral_key_pair(KMYTH_ECDH_SUITE, &keypair))
+    {
+      kmyth_sgx_log(LOG_ERR, "ECDH ephemeral key pair creation failed");
+      EVP_PKEY_free(keypair);
+      return EXIT_FAILURE;
+    }
+
+    sgx_thread_mutex_lock(&ephemeral_pool_lock);
+    if (ephemeral_pool_count < KMYTH_ECDH_EPHEMERAL_POOL_SIZE)
+    {
+      ephemeral_pool[ephemeral_pool_count++] = keypair;
+      keypair = NULL;
+    }
+    sgx_thread_mutex_unlock(&ephemeral_pool_lock);
+
+    // another thread filled the pool meanwhile
+    EVP_PKEY_free(keypair);
+  }
+}
+
+//############################################################################
+// enclave_close_key_session()
+//############################################################################
+void enclave_close_key_session(void)
+{
+  sgx_thread_mutex_lock(&key_session_lock);
+  close_key_session();
+  sgx_thread_mutex_unlock(&key_session_lock);
+}
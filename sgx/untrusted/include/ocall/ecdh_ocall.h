@@ -34,6 +34,14 @@ extern "C"
 
 #include "kmyth_enclave_common.h"
 
+/**
+ * @brief Longest time (in milliseconds) any one of the calls below may
+ *        wait on the key server, whether to connect or to move a message.
+ *        The socket is non-blocking, so a server that stalls cannot hold
+ *        the calling enclave thread for longer.
+ */
+#define ECDH_OCALL_IO_TIMEOUT_MS 10000
+
 /**
  * @brief Creates a socket connected to the external key server.
  *
@@ -171,6 +179,66 @@ extern "C"
                       size_t *encrypted_msg_len,
                       int socket_fd);
 
+/**
+ * @brief Allocates the untrusted buffer that the enclave's session with the
+ *        key server moves its messages through (see ecdh_send_buffer_ocall()
+ *        and ecdh_recv_buffer_ocall()). It is freed with OPENSSL_free_ocall().
+ *
+ * @param[in]  buffer_size                Size (in bytes) of the buffer.
+ *
+ * @param[out] buffer                     Pointer used to return the address
+ *                                        of the buffer.
+ *
+ * @return 0 on success, 1 on failure
+ */
+  int ecdh_msg_buffer_ocall(size_t buffer_size, unsigned char **buffer);
+
+/**
+ * @brief Send a message, which the enclave has written to the start of its
+ *        message buffer, over the ECDH network connection.
+ *
+ * @param[in] buffer                      The message buffer.
+ *
+ * @param[in] msg_len                     Length (in bytes) of the encrypted
+ *                                        message.
+ *
+ * @param[in] socket_fd                   File descriptor number for
+ *                                        a network socket with an
+ *                                        active ECDH session.
+ *
+ * @return 0 on success, 1 on failure
+ */
+  int ecdh_send_buffer_ocall(unsigned char *buffer, size_t msg_len,
+                             int socket_fd);
+
+/**
+ * @brief Receive a message over the ECDH network connection into the start
+ *        of the enclave's message buffer. A message larger than the buffer
+ *        is received into a buffer allocated for it instead, as by
+ *        ecdh_recv_ocall().
+ *
+ * @param[in]  buffer                     The message buffer.
+ *
+ * @param[in]  buffer_size                Size (in bytes) of the buffer.
+ *
+ * @param[out] msg_len                    Pointer to length (in bytes)
+ *                                        of the encrypted message.
+ *
+ * @param[out] overflow_msg               Pointer used to return the address
+ *                                        of the buffer allocated for a
+ *                                        message larger than the message
+ *                                        buffer (else NULL).
+ *
+ * @param[in]  socket_fd                  File descriptor number for
+ *                                        a network socket with an
+ *                                        active ECDH session.
+ *
+ * @return 0 on success, 1 on failure
+ */
+  int ecdh_recv_buffer_ocall(unsigned char *buffer, size_t buffer_size,
+                             size_t *msg_len, unsigned char **overflow_msg,
+                             int socket_fd);
+
 #ifdef __cplusplus
 }
 #endif
@@ -8,8 +8,12 @@
 #ifndef _KMYTH_LOG_OCALL_H_
 #define _KMYTH_LOG_OCALL_H_
 
+#include <stddef.h>
+
 #include <kmyth/kmyth_log.h>
 
+#include "kmyth_enclave_log_entry.h"
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -39,6 +43,19 @@ extern "C"
                        const int *src_line_ptr,
                        int *severity_ptr, const char **message_ptr);
 
+/**
+ * @brief Supports passing a batch of log events, buffered inside the
+ *        enclave, to the logger in a single OCALL.
+ *
+ * @param[in] entries          The buffered log events, oldest first.
+ *
+ * @param[in] count            The number of events in entries.
+ *
+ * @return                     None
+ */
+  void log_event_batch_ocall(const kmyth_enclave_log_entry_t * entries,
+                             size_t count);
+
 #ifdef __cplusplus
 }
 #endif
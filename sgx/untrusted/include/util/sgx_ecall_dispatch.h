@@ -0,0 +1,96 @@
+/**
+ * @file sgx_ecall_dispatch.h
+ *
+ * @brief Header file for running independent ECALLs (e.g., unseals or key
+ *        retrievals) on several untrusted threads at once, up to the number
+ *        of threads the enclave can take
+ */
+
+#ifndef _KMYTH_SGX_ECALL_DISPATCH_H_
+#define _KMYTH_SGX_ECALL_DISPATCH_H_
+
+#include <stddef.h>
+
+#include "sgx_urts.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Default number of ECALLs a dispatcher runs at once. Each ECALL
+ *        in progress occupies one TCS of the enclave, and an ECALL finding
+ *        none free fails (SGX_ERROR_OUT_OF_TCS), so this must not exceed
+ *        the TCSNum in the enclave's configuration file. Set with
+ *        SGX_ECALL_THREADS in sgx/Makefile.
+ */
+#ifndef KMYTH_SGX_ECALL_THREADS
+#define KMYTH_SGX_ECALL_THREADS 8
+#endif
+
+/**
+ * @brief One job run by a dispatcher: makes the ECALL(s) for one item.
+ *
+ * @param[in]  eid  The enclave to call into
+ *
+ * @param[in]  job  The job's item
+ *
+ * @return 0 on success, non-zero on error
+ */
+  typedef int (*kmyth_sgx_ecall_job_t) (sgx_enclave_id_t eid, void *job);
+
+  typedef struct kmyth_sgx_dispatcher_s kmyth_sgx_dispatcher_t;
+
+/**
+ * @brief Creates a dispatcher, whose worker threads wait for jobs to run
+ *        against an enclave. The thread that dispatches the jobs runs
+ *        jobs too, so threads - 1 worker threads are started.
+ *
+ * @param[in]  eid      The enclave the jobs call into
+ *
+ * @param[in]  threads  The number of jobs to run at once (0 for
+ *                      KMYTH_SGX_ECALL_THREADS)
+ *
+ * @return the dispatcher, or NULL on error
+ */
+  kmyth_sgx_dispatcher_t *kmyth_sgx_dispatcher_create(sgx_enclave_id_t eid,
+                                                      size_t threads);
+
+/**
+ * @brief Runs a job for each of count items, up to the dispatcher's
+ *        number of threads at once, and waits for all of them to finish.
+ *        The items must be independent of each other. One batch is run
+ *        at a time: concurrent calls wait their turn.
+ *
+ * @param[in]  dispatcher  The dispatcher
+ *
+ * @param[in]  run         The job run for each item
+ *
+ * @param[in]  jobs        Array of count items, each job_size bytes
+ *
+ * @param[in]  job_size    Size (in bytes) of each item
+ *
+ * @param[in]  count       Number of items
+ *
+ * @param[out] results     Optional array (of count entries) to receive the
+ *                         return value of each job (NULL if not needed)
+ *
+ * @return 0 if every job succeeded, 1 otherwise
+ */
+  int kmyth_sgx_dispatch(kmyth_sgx_dispatcher_t * dispatcher,
+                         kmyth_sgx_ecall_job_t run, void *jobs,
+                         size_t job_size, size_t count, int *results);
+
+/**
+ * @brief Stops a dispatcher's worker threads and frees it.
+ *
+ * @param[in]  dispatcher  The dispatcher (NULL is ignored)
+ */
+  void kmyth_sgx_dispatcher_destroy(kmyth_sgx_dispatcher_t * dispatcher);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,42 @@
+/**
+ * @file sgx_enclave_create.h
+ *
+ * @brief Header file for creating an enclave that uses the kmyth enclave
+ *        functionality, optionally with switchless OCALLs enabled
+ */
+
+#ifndef _KMYTH_SGX_ENCLAVE_CREATE_H_
+#define _KMYTH_SGX_ENCLAVE_CREATE_H_
+
+#include "sgx_urts.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Creates (loads) an enclave. When built with KMYTH_SGX_SWITCHLESS
+ *        defined (SGX_SWITCHLESS=1 in sgx/Makefile), switchless calls are
+ *        enabled, so the OCALLs marked transition_using_threads in
+ *        kmyth_enclave.edl (logging, time and the ECDH send/receive) are
+ *        served by KMYTH_SGX_SWITCHLESS_UWORKERS untrusted worker threads
+ *        instead of each exiting the enclave. Otherwise those OCALLs are
+ *        made as ordinary OCALLs.
+ *
+ * @param[in]  enclave_file     Path to the (signed) enclave image
+ *
+ * @param[in]  debug            Non-zero to launch the enclave in debug mode
+ *
+ * @param[out] eid              The ID of the new enclave
+ *
+ * @return                      SGX_SUCCESS on success, an SGX error on error
+ */
+  sgx_status_t kmyth_sgx_create_enclave(const char *enclave_file, int debug,
+                                        sgx_enclave_id_t * eid);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
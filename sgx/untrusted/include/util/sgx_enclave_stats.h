@@ -0,0 +1,45 @@
+/**
+ * @file sgx_enclave_stats.h
+ *
+ * @brief Header file for reading out and printing the memory and
+ *        transition counters of an enclave that uses the kmyth enclave
+ *        functionality
+ */
+
+#ifndef _KMYTH_SGX_ENCLAVE_STATS_H_
+#define _KMYTH_SGX_ENCLAVE_STATS_H_
+
+#include <stdio.h>
+
+#include "sgx_urts.h"
+
+#include "kmyth_enclave_stats_record.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Reads the enclave's counters (with the kmyth_enclave_get_stats
+ *        ECALL) and prints them: the unsealed data table's entries and
+ *        bytes, and the ECALLs and peak heap use of each path (seal, unseal
+ *        and key retrieval), to help size the enclave's HeapMaxSize.
+ *
+ * @param[in]  eid              The ID of the enclave
+ *
+ * @param[in]  out              Stream to print to
+ *
+ * @param[out] stats            Optional, to receive the counters (NULL if
+ *                              not needed)
+ *
+ * @return                      0 on success, 1 on error
+ */
+  int kmyth_sgx_print_enclave_stats(sgx_enclave_id_t eid, FILE * out,
+                                    kmyth_enclave_stats_t * stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
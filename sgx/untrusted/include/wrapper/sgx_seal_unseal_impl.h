@@ -12,6 +12,8 @@
 
 #include ENCLAVE_HEADER_UNTRUSTED
 
+#include "sgx_ecall_dispatch.h"
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -55,6 +57,86 @@ extern "C"
                            uint8_t * input,
                            size_t input_len, uint64_t * handle);
 
+  /**
+   * @brief Seals several inputs into .nkl format using a single enclave
+   *        transition.
+   *
+   * @param[in]  count             Number of inputs
+   *
+   * @param[in]  inputs            Raw bytes of each input to be sgx-sealed
+   *
+   * @param[in]  input_lens        Number of bytes in each input
+   *
+   * @param[out] outputs           Array (of count entries) to receive the
+   *                               bytes in nkl format of each sealed input
+   *                               (each to be freed by the caller)
+   *
+   * @param[out] output_lens       Array (of count entries) to receive the
+   *                               number of bytes in each output
+   *
+   * @return 0 on success, 1 on error
+   */
+  int kmyth_sgx_seal_nkl_batch(sgx_enclave_id_t eid,
+                               size_t count,
+                               uint8_t ** inputs,
+                               size_t *input_lens,
+                               uint8_t ** outputs,
+                               size_t *output_lens,
+                               uint16_t key_policy,
+                               sgx_attributes_t attribute_mask);
+
+  /**
+   * @brief Unseals several .nkl inputs into the enclave using a single
+   *        enclave transition. Either every input is unsealed or none is.
+   *
+   * @param[in]  count             Number of inputs
+   *
+   * @param[in]  inputs            Raw data of each input to be sgx-unsealed
+   *
+   * @param[in]  input_lens        The size of each input in bytes
+   *
+   * @param[out] handles           Array (of count entries) to receive the
+   *                               handle of each unsealed input
+   *
+   * @return 0 on success, 1 on error
+   */
+  int kmyth_sgx_unseal_nkl_batch(sgx_enclave_id_t eid,
+                                 size_t count,
+                                 uint8_t ** inputs,
+                                 size_t *input_lens, uint64_t * handles);
+
+  /**
+   * @brief Unseals several .nkl inputs into the enclave, each with its own
+   *        kmyth_sgx_unseal_nkl() call, run on the dispatcher's threads at
+   *        once. Unlike kmyth_sgx_unseal_nkl_batch(), the unseals proceed
+   *        in parallel inside the enclave (the unsealed data table is
+   *        sharded, so they rarely contend), but they are independent: on
+   *        error, the inputs that were unsealed stay in the table.
+   *
+   * @param[in]  dispatcher        Dispatcher (for the enclave) to run the
+   *                               unseals on
+   *
+   * @param[in]  count             Number of inputs
+   *
+   * @param[in]  inputs            Raw data of each input to be sgx-unsealed
+   *
+   * @param[in]  input_lens        The size of each input in bytes
+   *
+   * @param[out] handles           Array (of count entries) to receive the
+   *                               handle of each unsealed input
+   *
+   * @param[out] results           Optional array (of count entries) to
+   *                               receive the result (0 on success) of each
+   *                               unseal (NULL if not needed)
+   *
+   * @return 0 if every input was unsealed, 1 otherwise
+   */
+  int kmyth_sgx_unseal_nkl_parallel(kmyth_sgx_dispatcher_t * dispatcher,
+                                    size_t count,
+                                    uint8_t ** inputs,
+                                    size_t *input_lens,
+                                    uint64_t * handles, int *results);
+
 #ifdef __cplusplus
 }
 #endif
@@ -8,8 +8,132 @@
 #include "ecdh_ocall.h"
 #include "ecdh_util.h"
 
+#include <poll.h>
+
 #define UNSET_FD -1
 
+/*****************************************************************************
+ * ecdh_io_deadline()
+ ****************************************************************************/
+static long long ecdh_io_deadline(void)
+{
+  struct timespec now = { 0 };
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000
+    + ECDH_OCALL_IO_TIMEOUT_MS;
+}
+
+/*****************************************************************************
+ * ecdh_wait_socket()
+ ****************************************************************************/
+static int ecdh_wait_socket(int socket_fd, short events, long long deadline)
+{
+  struct pollfd pfd = {.fd = socket_fd,.events = events };
+  int ready = 0;
+
+  do
+  {
+    struct timespec now = { 0 };
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    long long remaining = deadline
+      - ((long long) now.tv_sec * 1000 + now.tv_nsec / 1000000);
+
+    if (remaining <= 0)
+    {
+      kmyth_log(LOG_ERR, "Timed out waiting on the key server.");
+      return EXIT_FAILURE;
+    }
+    ready = poll(&pfd, 1, (int) remaining);
+  }
+  while (ready < 0 && errno == EINTR);
+
+  if (ready < 0)
+  {
+    kmyth_log(LOG_ERR, "Failed to poll the key server socket.");
+    return EXIT_FAILURE;
+  }
+  if (ready == 0)
+  {
+    kmyth_log(LOG_ERR, "Timed out waiting on the key server.");
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * ecdh_write_all()
+ ****************************************************************************/
+static int ecdh_write_all(int socket_fd, const void *data, size_t data_len,
+                          long long deadline)
+{
+  const unsigned char *next = data;
+
+  while (data_len > 0)
+  {
+    ssize_t written = write(socket_fd, next, data_len);
+
+    if (written < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      if (ecdh_wait_socket(socket_fd, POLLOUT, deadline) != EXIT_SUCCESS)
+      {
+        return EXIT_FAILURE;
+      }
+      continue;
+    }
+    if (written <= 0)
+    {
+      return EXIT_FAILURE;
+    }
+    next += written;
+    data_len -= (size_t) written;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * ecdh_read_all()
+ ****************************************************************************/
+static int ecdh_read_all(int socket_fd, void *data, size_t data_len,
+                         long long deadline)
+{
+  unsigned char *next = data;
+
+  while (data_len > 0)
+  {
+    ssize_t received = read(socket_fd, next, data_len);
+
+    if (received < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      if (ecdh_wait_socket(socket_fd, POLLIN, deadline) != EXIT_SUCCESS)
+      {
+        return EXIT_FAILURE;
+      }
+      continue;
+    }
+    if (received <= 0)
+    {
+      return EXIT_FAILURE;
+    }
+    next += received;
+    data_len -= (size_t) received;
+  }
+
+  return EXIT_SUCCESS;
+}
+
 /*****************************************************************************
  * setup_socket_ocall()
  ****************************************************************************/
@@ -26,9 +150,15 @@ int setup_socket_ocall(const char *server_host, int server_host_len,
   kmyth_log(LOG_DEBUG, "Setting up client socket, remote host: %s, port: %d",
             server_host, server_port);
 
-  if (setup_client_socket(server_host, server_service, socket_fd))
+  // the socket is left non-blocking, so that no exchange on it can stall
+  // the calling enclave thread past ECDH_OCALL_IO_TIMEOUT_MS
+  if (start_client_socket(server_host, server_service, socket_fd)
+      || ecdh_wait_socket(*socket_fd, POLLOUT, ecdh_io_deadline())
+      || finish_client_socket(*socket_fd))
   {
     kmyth_log(LOG_ERR, "Failed to connect to the server.");
+    close_socket_ocall(*socket_fd);
+    *socket_fd = UNSET_FD;
     return EXIT_FAILURE;
   }
 
@@ -67,46 +197,34 @@ int ecdh_exchange_ocall(unsigned char *enclave_ephemeral_public,
                         unsigned int *remote_eph_pub_signature_len,
                         int socket_fd)
 {
-  int num_bytes;
+  long long deadline = ecdh_io_deadline();
+
+  *remote_ephemeral_public = NULL;
+  *remote_eph_pub_signature = NULL;
 
   kmyth_log(LOG_DEBUG, "Sending ephemeral public key.");
-  num_bytes =
-    write(socket_fd, &enclave_ephemeral_public_len,
-          sizeof(enclave_ephemeral_public_len));
-  if (num_bytes != sizeof(enclave_ephemeral_public_len))
-  {
-    kmyth_log(LOG_ERR, "Failed to send a message.");
-    return EXIT_FAILURE;
-  }
-  num_bytes =
-    write(socket_fd, enclave_ephemeral_public, enclave_ephemeral_public_len);
-  if (num_bytes != enclave_ephemeral_public_len)
+  if (ecdh_write_all(socket_fd, &enclave_ephemeral_public_len,
+                     sizeof(enclave_ephemeral_public_len), deadline)
+      || ecdh_write_all(socket_fd, enclave_ephemeral_public,
+                        enclave_ephemeral_public_len, deadline))
   {
     kmyth_log(LOG_ERR, "Failed to send a message.");
     return EXIT_FAILURE;
   }
 
   kmyth_log(LOG_DEBUG, "Sending ephemeral public key signature.");
-  num_bytes =
-    write(socket_fd, &enclave_eph_pub_signature_len,
-          sizeof(enclave_eph_pub_signature_len));
-  if (num_bytes != sizeof(enclave_eph_pub_signature_len))
-  {
-    kmyth_log(LOG_ERR, "Failed to send a message.");
-    return EXIT_FAILURE;
-  }
-  num_bytes =
-    write(socket_fd, enclave_eph_pub_signature, enclave_eph_pub_signature_len);
-  if (num_bytes != enclave_eph_pub_signature_len)
+  if (ecdh_write_all(socket_fd, &enclave_eph_pub_signature_len,
+                     sizeof(enclave_eph_pub_signature_len), deadline)
+      || ecdh_write_all(socket_fd, enclave_eph_pub_signature,
+                        enclave_eph_pub_signature_len, deadline))
   {
     kmyth_log(LOG_ERR, "Failed to send a message.");
     return EXIT_FAILURE;
   }
 
   kmyth_log(LOG_DEBUG, "Receiving ephemeral public key.");
-  num_bytes = read(socket_fd, remote_ephemeral_public_len,
-                   sizeof(*remote_ephemeral_public_len));
-  if (num_bytes != sizeof(*remote_ephemeral_public_len))
+  if (ecdh_read_all(socket_fd, remote_ephemeral_public_len,
+                    sizeof(*remote_ephemeral_public_len), deadline))
   {
     kmyth_log(LOG_ERR, "Failed to receive a message.");
     return EXIT_FAILURE;
@@ -124,25 +242,23 @@ int ecdh_exchange_ocall(unsigned char *enclave_ephemeral_public,
     return EXIT_FAILURE;
   }
 
-  num_bytes =
-    read(socket_fd, *remote_ephemeral_public, *remote_ephemeral_public_len);
-  if (num_bytes != *remote_ephemeral_public_len)
+  if (ecdh_read_all(socket_fd, *remote_ephemeral_public,
+                    *remote_ephemeral_public_len, deadline))
   {
     kmyth_log(LOG_ERR, "Failed to receive a message.");
+    OPENSSL_free(*remote_ephemeral_public);
+    *remote_ephemeral_public = NULL;
     return EXIT_FAILURE;
   }
 
   kmyth_log(LOG_DEBUG, "Receiving ephemeral public key signature.");
-  num_bytes = read(socket_fd, remote_eph_pub_signature_len,
-                   sizeof(*remote_eph_pub_signature_len));
-  if (num_bytes != sizeof(*remote_eph_pub_signature_len))
+  if (ecdh_read_all(socket_fd, remote_eph_pub_signature_len,
+                    sizeof(*remote_eph_pub_signature_len), deadline)
+      || *remote_eph_pub_signature_len > ECDH_MAX_MSG_SIZE)
   {
-    kmyth_log(LOG_ERR, "Failed to receive a message.");
-    return EXIT_FAILURE;
-  }
-  if (*remote_eph_pub_signature_len > ECDH_MAX_MSG_SIZE)
-  {
-    kmyth_log(LOG_ERR, "Received invalid public key signature size.");
+    kmyth_log(LOG_ERR, "Failed to receive a valid public key signature size.");
+    OPENSSL_free(*remote_ephemeral_public);
+    *remote_ephemeral_public = NULL;
     return EXIT_FAILURE;
   }
 
@@ -150,14 +266,19 @@ int ecdh_exchange_ocall(unsigned char *enclave_ephemeral_public,
   if (*remote_eph_pub_signature == NULL)
   {
     kmyth_log(LOG_ERR, "Failed to allocate the remote ephemeral public key.");
+    OPENSSL_free(*remote_ephemeral_public);
+    *remote_ephemeral_public = NULL;
     return EXIT_FAILURE;
   }
 
-  num_bytes = read(socket_fd, *remote_eph_pub_signature,
-                   *remote_eph_pub_signature_len);
-  if (num_bytes != *remote_eph_pub_signature_len)
+  if (ecdh_read_all(socket_fd, *remote_eph_pub_signature,
+                    *remote_eph_pub_signature_len, deadline))
   {
     kmyth_log(LOG_ERR, "Failed to receive a message.");
+    OPENSSL_free(*remote_ephemeral_public);
+    *remote_ephemeral_public = NULL;
+    OPENSSL_free(*remote_eph_pub_signature);
+    *remote_eph_pub_signature = NULL;
     return EXIT_FAILURE;
   }
 
@@ -171,22 +292,20 @@ int ecdh_send_ocall(unsigned char *encrypted_msg,
                     size_t encrypted_msg_len,
                     int socket_fd)
 {
-  ssize_t write_result;
+  long long deadline = ecdh_io_deadline();
   struct ECDHMessageHeader header;
 
   kmyth_log(LOG_DEBUG, "Sending ecdh message.");
 
   secure_memset(&header, 0, sizeof(header));
   header.msg_size = encrypted_msg_len;
-  write_result = write(socket_fd, &header, sizeof(header));
-  if (write_result != sizeof(header))
+  if (ecdh_write_all(socket_fd, &header, sizeof(header), deadline))
   {
     kmyth_log(LOG_ERR, "Failed to send an ECDH message header.");
     return EXIT_FAILURE;
   }
 
-  write_result = write(socket_fd, encrypted_msg, encrypted_msg_len);
-  if (write_result != encrypted_msg_len)
+  if (ecdh_write_all(socket_fd, encrypted_msg, encrypted_msg_len, deadline))
   {
     kmyth_log(LOG_ERR, "Failed to send an ECDH message.");
     return EXIT_FAILURE;
@@ -202,14 +321,13 @@ int ecdh_recv_ocall(unsigned char **encrypted_msg,
                     size_t *encrypted_msg_len,
                     int socket_fd)
 {
-  ssize_t read_result;
+  long long deadline = ecdh_io_deadline();
   struct ECDHMessageHeader header;
 
   kmyth_log(LOG_DEBUG, "Receiving ecdh message.");
 
   secure_memset(&header, 0, sizeof(header));
-  read_result = read(socket_fd, &header, sizeof(header));
-  if (read_result != sizeof(header))
+  if (ecdh_read_all(socket_fd, &header, sizeof(header), deadline))
   {
     kmyth_log(LOG_ERR, "Failed to read an ECDH message header.");
     return EXIT_FAILURE;
@@ -222,14 +340,88 @@ int ecdh_recv_ocall(unsigned char **encrypted_msg,
     return EXIT_FAILURE;
   }
 
-  read_result = read(socket_fd, *encrypted_msg, header.msg_size);
-  if (read_result != header.msg_size)
+  if (ecdh_read_all(socket_fd, *encrypted_msg, header.msg_size, deadline))
   {
     kmyth_log(LOG_ERR, "Failed to read an ECDH message.");
     kmyth_clear_and_free(*encrypted_msg, header.msg_size);
+    *encrypted_msg = NULL;
+    return EXIT_FAILURE;
+  }
+  *encrypted_msg_len = header.msg_size;
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * ecdh_msg_buffer_ocall()
+ ****************************************************************************/
+int ecdh_msg_buffer_ocall(size_t buffer_size, unsigned char **buffer)
+{
+  *buffer = OPENSSL_zalloc(buffer_size);
+  if (*buffer == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to allocate the ECDH message buffer.");
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * ecdh_send_buffer_ocall()
+ ****************************************************************************/
+int ecdh_send_buffer_ocall(unsigned char *buffer, size_t msg_len,
+                           int socket_fd)
+{
+  // the message is already in untrusted memory, so sends just as one
+  // passed in
+  return ecdh_send_ocall(buffer, msg_len, socket_fd);
+}
+
+/*****************************************************************************
+ * ecdh_recv_buffer_ocall()
+ ****************************************************************************/
+int ecdh_recv_buffer_ocall(unsigned char *buffer, size_t buffer_size,
+                           size_t *msg_len, unsigned char **overflow_msg,
+                           int socket_fd)
+{
+  long long deadline = ecdh_io_deadline();
+  struct ECDHMessageHeader header;
+  unsigned char *dest = buffer;
+
+  kmyth_log(LOG_DEBUG, "Receiving ecdh message.");
+
+  *overflow_msg = NULL;
+  secure_memset(&header, 0, sizeof(header));
+  if (ecdh_read_all(socket_fd, &header, sizeof(header), deadline))
+  {
+    kmyth_log(LOG_ERR, "Failed to read an ECDH message header.");
+    return EXIT_FAILURE;
+  }
+
+  // a message too large for the buffer gets one of its own
+  if (header.msg_size > buffer_size)
+  {
+    dest = OPENSSL_zalloc(header.msg_size);
+    if (dest == NULL)
+    {
+      kmyth_log(LOG_ERR, "Failed to allocate the encrypted response buffer.");
+      return EXIT_FAILURE;
+    }
+    *overflow_msg = dest;
+  }
+
+  if (ecdh_read_all(socket_fd, dest, header.msg_size, deadline))
+  {
+    kmyth_log(LOG_ERR, "Failed to read an ECDH message.");
+    if (*overflow_msg != NULL)
+    {
+      kmyth_clear_and_free(*overflow_msg, header.msg_size);
+      *overflow_msg = NULL;
+    }
     return EXIT_FAILURE;
   }
-  *encrypted_msg_len = read_result;
+  *msg_len = header.msg_size;
 
   return EXIT_SUCCESS;
 }
@@ -18,3 +18,16 @@ void log_event_ocall(const char **src_file_ptr,
   log_event(*src_file_ptr, *src_func_ptr, *src_line_ptr, *severity_ptr,
             *message_ptr);
 }
+
+/*****************************************************************************
+ * log_event_batch_ocall
+ ****************************************************************************/
+void log_event_batch_ocall(const kmyth_enclave_log_entry_t * entries,
+                           size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    log_event(entries[i].src_file, entries[i].src_func, entries[i].src_line,
+              entries[i].severity, "%s", entries[i].message);
+  }
+}
@@ -0,0 +1,223 @@
+/**
+ * @file sgx_ecall_dispatch.c
+ *
+ * @brief Runs independent ECALLs on several untrusted threads at once
+ */
+
+#include "sgx_ecall_dispatch.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <kmyth/kmyth_log.h>
+
+/**
+ * The dispatcher's worker threads live as long as it does, so a batch
+ * costs no thread creation. A batch is posted under the lock; workers and
+ * the dispatching thread then claim its jobs one at a time, in order,
+ * until none are left, and the last one to finish wakes the dispatching
+ * thread.
+ */
+struct kmyth_sgx_dispatcher_s
+{
+  sgx_enclave_id_t eid;
+  pthread_mutex_t dispatch_lock;        // one batch at a time
+  pthread_mutex_t lock;
+  pthread_cond_t work;                  // a batch was posted, or closing
+  pthread_cond_t done;                  // the batch has finished
+  pthread_t *threads;
+  size_t thread_count;
+  bool closed;
+
+  // the current batch (no jobs left once next == count)
+  kmyth_sgx_ecall_job_t run;
+  uint8_t *jobs;
+  size_t job_size;
+  size_t count;
+  int *results;
+  size_t next;
+  size_t finished;
+  size_t failed;
+};
+
+//############################################################################
+// run_jobs()
+//
+// Runs jobs of the current batch until there are none left to claim. Called
+// and returns with the lock held; jobs run without it.
+//############################################################################
+static void run_jobs(kmyth_sgx_dispatcher_t * dispatcher)
+{
+  while (dispatcher->next < dispatcher->count)
+  {
+    size_t i = dispatcher->next++;
+    kmyth_sgx_ecall_job_t run = dispatcher->run;
+    void *job = dispatcher->jobs + i * dispatcher->job_size;
+
+    pthread_mutex_unlock(&dispatcher->lock);
+    int ret = run(dispatcher->eid, job);
+
+    pthread_mutex_lock(&dispatcher->lock);
+
+    if (dispatcher->results != NULL)
+    {
+      dispatcher->results[i] = ret;
+    }
+    if (ret != 0)
+    {
+      dispatcher->failed++;
+    }
+    if (++dispatcher->finished == dispatcher->count)
+    {
+      pthread_cond_signal(&dispatcher->done);
+    }
+  }
+}
+
+//############################################################################
+// dispatcher_worker()
+//############################################################################
+static void *dispatcher_worker(void *arg)
+{
+  kmyth_sgx_dispatcher_t *dispatcher = (kmyth_sgx_dispatcher_t *) arg;
+
+  pthread_mutex_lock(&dispatcher->lock);
+  while (!dispatcher->closed)
+  {
+    if (dispatcher->next == dispatcher->count)
+    {
+      pthread_cond_wait(&dispatcher->work, &dispatcher->lock);
+      continue;
+    }
+    run_jobs(dispatcher);
+  }
+  pthread_mutex_unlock(&dispatcher->lock);
+
+  return NULL;
+}
+
+//############################################################################
+// kmyth_sgx_dispatcher_create()
+//############################################################################
+kmyth_sgx_dispatcher_t *kmyth_sgx_dispatcher_create(sgx_enclave_id_t eid,
+                                                    size_t threads)
+{
+  if (threads == 0)
+  {
+    threads = KMYTH_SGX_ECALL_THREADS;
+  }
+
+  kmyth_sgx_dispatcher_t *dispatcher =
+    (kmyth_sgx_dispatcher_t *) calloc(1, sizeof(kmyth_sgx_dispatcher_t));
+
+  if (dispatcher == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate the ECALL dispatcher");
+    return NULL;
+  }
+  dispatcher->threads = (pthread_t *) calloc(threads, sizeof(pthread_t));
+  if (dispatcher->threads == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate the ECALL dispatcher");
+    free(dispatcher);
+    return NULL;
+  }
+  dispatcher->eid = eid;
+  pthread_mutex_init(&dispatcher->dispatch_lock, NULL);
+  pthread_mutex_init(&dispatcher->lock, NULL);
+  pthread_cond_init(&dispatcher->work, NULL);
+  pthread_cond_init(&dispatcher->done, NULL);
+
+  // the dispatching thread is the last of the threads
+  while (dispatcher->thread_count < threads - 1
+         && pthread_create(&dispatcher->threads[dispatcher->thread_count],
+                           NULL, dispatcher_worker, dispatcher) == 0)
+  {
+    dispatcher->thread_count++;
+  }
+  if (dispatcher->thread_count < threads - 1)
+  {
+    kmyth_log(LOG_WARNING, "started only %zu of %zu ECALL worker threads",
+              dispatcher->thread_count, threads - 1);
+  }
+
+  return dispatcher;
+}
+
+//############################################################################
+// kmyth_sgx_dispatch()
+//############################################################################
+int kmyth_sgx_dispatch(kmyth_sgx_dispatcher_t * dispatcher,
+                       kmyth_sgx_ecall_job_t run, void *jobs,
+                       size_t job_size, size_t count, int *results)
+{
+  if (dispatcher == NULL || run == NULL || (jobs == NULL && count > 0))
+  {
+    return 1;
+  }
+  if (count == 0)
+  {
+    return 0;
+  }
+
+  pthread_mutex_lock(&dispatcher->dispatch_lock);
+  pthread_mutex_lock(&dispatcher->lock);
+
+  dispatcher->run = run;
+  dispatcher->jobs = (uint8_t *) jobs;
+  dispatcher->job_size = job_size;
+  dispatcher->results = results;
+  dispatcher->next = 0;
+  dispatcher->finished = 0;
+  dispatcher->failed = 0;
+  dispatcher->count = count;
+  pthread_cond_broadcast(&dispatcher->work);
+
+  run_jobs(dispatcher);
+  while (dispatcher->finished < dispatcher->count)
+  {
+    pthread_cond_wait(&dispatcher->done, &dispatcher->lock);
+  }
+
+  size_t failed = dispatcher->failed;
+
+  dispatcher->count = 0;
+  dispatcher->next = 0;
+  dispatcher->jobs = NULL;
+  dispatcher->results = NULL;
+
+  pthread_mutex_unlock(&dispatcher->lock);
+  pthread_mutex_unlock(&dispatcher->dispatch_lock);
+
+  return (failed == 0) ? 0 : 1;
+}
+
+//############################################################################
+// kmyth_sgx_dispatcher_destroy()
+//############################################################################
+void kmyth_sgx_dispatcher_destroy(kmyth_sgx_dispatcher_t * dispatcher)
+{
+  if (dispatcher == NULL)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&dispatcher->lock);
+  dispatcher->closed = true;
+  pthread_cond_broadcast(&dispatcher->work);
+  pthread_mutex_unlock(&dispatcher->lock);
+
+  for (size_t i = 0; i < dispatcher->thread_count; i++)
+  {
+    pthread_join(dispatcher->threads[i], NULL);
+  }
+
+  pthread_cond_destroy(&dispatcher->done);
+  pthread_cond_destroy(&dispatcher->work);
+  pthread_mutex_destroy(&dispatcher->lock);
+  pthread_mutex_destroy(&dispatcher->dispatch_lock);
+  free(dispatcher->threads);
+  free(dispatcher);
+}
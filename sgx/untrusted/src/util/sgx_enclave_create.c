@@ -0,0 +1,42 @@
+/**
+ * @file sgx_enclave_create.c
+ *
+ * @brief Creates an enclave that uses the kmyth enclave functionality,
+ *        optionally with switchless OCALLs enabled
+ */
+
+#include "sgx_enclave_create.h"
+
+#include <stddef.h>
+
+#ifdef KMYTH_SGX_SWITCHLESS
+#include "sgx_uswitchless.h"
+
+#ifndef KMYTH_SGX_SWITCHLESS_UWORKERS
+#define KMYTH_SGX_SWITCHLESS_UWORKERS 1
+#endif
+#endif
+
+//############################################################################
+// kmyth_sgx_create_enclave()
+//############################################################################
+sgx_status_t kmyth_sgx_create_enclave(const char *enclave_file, int debug,
+                                      sgx_enclave_id_t * eid)
+{
+#ifdef KMYTH_SGX_SWITCHLESS
+  // Only OCALLs are switchless, so no trusted workers are needed. A
+  // switchless OCALL finding no idle worker falls back to an ordinary one.
+  sgx_uswitchless_config_t us_config = SGX_USWITCHLESS_CONFIG_INITIALIZER;
+  const void *enclave_ex_p[32] = { 0 };
+
+  us_config.num_uworkers = KMYTH_SGX_SWITCHLESS_UWORKERS;
+  us_config.num_tworkers = 0;
+  enclave_ex_p[SGX_CREATE_ENCLAVE_EX_SWITCHLESS_BIT_IDX] = &us_config;
+
+  return sgx_create_enclave_ex(enclave_file, debug, NULL, NULL, eid, NULL,
+                               SGX_CREATE_ENCLAVE_EX_SWITCHLESS,
+                               enclave_ex_p);
+#else
+  return sgx_create_enclave(enclave_file, debug, NULL, NULL, eid, NULL);
+#endif
+}
@@ -0,0 +1,53 @@
+/**
+ * @file sgx_enclave_stats.c
+ *
+ * @brief Reads out and prints the memory and transition counters of an
+ *        enclave that uses the kmyth enclave functionality
+ */
+
+#include "sgx_enclave_stats.h"
+
+#include <inttypes.h>
+
+#include ENCLAVE_HEADER_UNTRUSTED
+
+static const char *const path_names[KMYTH_ENCLAVE_STATS_PATHS] = {
+  "seal",
+  "unseal",
+  "retrieve key"
+};
+
+//############################################################################
+// kmyth_sgx_print_enclave_stats()
+//############################################################################
+int kmyth_sgx_print_enclave_stats(sgx_enclave_id_t eid, FILE * out,
+                                  kmyth_enclave_stats_t * stats)
+{
+  kmyth_enclave_stats_t enclave_stats;
+
+  if (kmyth_enclave_get_stats(eid, &enclave_stats) != SGX_SUCCESS)
+  {
+    return 1;
+  }
+
+  fprintf(out, "enclave unsealed data table: %" PRIu64 " entries, %" PRIu64
+          " bytes (peak %" PRIu64 " bytes)\n",
+          enclave_stats.unseal_table_entries,
+          enclave_stats.unseal_table_bytes,
+          enclave_stats.unseal_table_peak_bytes);
+  for (int i = 0; i < KMYTH_ENCLAVE_STATS_PATHS; i++)
+  {
+    fprintf(out, "enclave %-12s: %8" PRIu64 " ECALLs, heap %" PRIu64
+            " bytes in use (peak %" PRIu64 " bytes)\n", path_names[i],
+            enclave_stats.ecalls[i], enclave_stats.heap_bytes[i],
+            enclave_stats.heap_peak_bytes[i]);
+  }
+  fprintf(out, "enclave OCALLs (enclave exits): %" PRIu64 "\n",
+          enclave_stats.ocalls);
+
+  if (stats != NULL)
+  {
+    *stats = enclave_stats;
+  }
+  return 0;
+}
@@ -15,6 +15,7 @@
 
 #include <kmyth/kmyth_log.h>
 #include <kmyth/formatting_tools.h>
+#include <kmyth/memory_util.h>
 
 #include ENCLAVE_HEADER_UNTRUSTED
 
@@ -25,21 +26,42 @@ int kmyth_sgx_seal_nkl(sgx_enclave_id_t eid, uint8_t * input, size_t input_len,
                        uint8_t ** output, size_t *output_len,
                        uint16_t key_policy, sgx_attributes_t attribute_mask)
 {
+  if (input_len == 0 || input_len > UINT32_MAX)
+  {
+    kmyth_log(LOG_ERR, "invalid size of input to seal ... exiting");
+    return 1;
+  }
+
+  // the enclave seals the input a chunk at a time straight from (and back
+  // to) these buffers, so large inputs need no room in the enclave heap
   uint8_t *data = NULL;
-  size_t data_size = 0;
-  int ret;
+  uint32_t data_size = 0;
+  int ret = 1;
+  sgx_status_t sgx_ret = enc_get_chunked_sealed_size(eid, &ret,
+                                                     (uint32_t) input_len,
+                                                     &data_size);
 
-  enc_get_sealed_size(eid, &ret, input_len, (uint32_t *) & data_size);
-  if (ret == 0)
+  if (sgx_ret != SGX_SUCCESS || ret != 0)
   {
-    data = (uint8_t *) malloc(data_size);
-    enc_seal_data(eid, &ret, input, input_len, data, data_size, key_policy,
-                  attribute_mask);
-    if (ret == 1)
-    {
-      kmyth_log(LOG_ERR, "error to seal data ... exiting");
-      return 1;
-    }
+    kmyth_log(LOG_ERR, "error to size sealed data ... exiting");
+    return 1;
+  }
+
+  data = (uint8_t *) malloc(data_size);
+  if (data == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate sealed data buffer ... exiting");
+    return 1;
+  }
+
+  sgx_ret = enc_seal_data_chunked(eid, &ret, input, (uint32_t) input_len,
+                                  data, data_size, key_policy,
+                                  attribute_mask);
+  if (sgx_ret != SGX_SUCCESS || ret != 0)
+  {
+    kmyth_log(LOG_ERR, "error to seal data ... exiting");
+    free(data);
+    return 1;
   }
 
   if (create_nkl_bytes(data, data_size, output, output_len))
@@ -94,3 +116,272 @@ int kmyth_sgx_unseal_nkl(sgx_enclave_id_t eid, uint8_t * input,
   free(data);
   return 0;
 }
+
+//############################################################################
+// kmyth_sgx_seal_nkl_batch()
+//############################################################################
+int kmyth_sgx_seal_nkl_batch(sgx_enclave_id_t eid, size_t count,
+                             uint8_t ** inputs, size_t *input_lens,
+                             uint8_t ** outputs, size_t *output_lens,
+                             uint16_t key_policy,
+                             sgx_attributes_t attribute_mask)
+{
+  if (count == 0 || count > UINT32_MAX)
+  {
+    kmyth_log(LOG_ERR, "invalid number of inputs to seal ... exiting");
+    return 1;
+  }
+
+  // the sealed size of each input is fixed (see sgx_calc_sealed_data_size),
+  // so no enc_get_sealed_size call is needed to size the output buffer
+  size_t in_size = 0;
+  size_t out_size = 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    if (input_lens[i] > UINT32_MAX - sizeof(sgx_sealed_data_t)
+        || in_size + input_lens[i] > UINT32_MAX
+        || out_size + sizeof(sgx_sealed_data_t) + input_lens[i] > UINT32_MAX)
+    {
+      kmyth_log(LOG_ERR, "inputs too large to seal in one batch ... exiting");
+      return 1;
+    }
+    in_size += input_lens[i];
+    out_size += sizeof(sgx_sealed_data_t) + input_lens[i];
+  }
+
+  uint8_t *in_data = (uint8_t *) malloc(in_size);
+  uint32_t *in_sizes = (uint32_t *) malloc(count * sizeof(uint32_t));
+  uint8_t *out_data = (uint8_t *) malloc(out_size);
+  uint32_t *out_sizes = (uint32_t *) malloc(count * sizeof(uint32_t));
+
+  if (in_data == NULL || in_sizes == NULL || out_data == NULL
+      || out_sizes == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate batch buffers ... exiting");
+    free(in_data);
+    free(in_sizes);
+    free(out_data);
+    free(out_sizes);
+    return 1;
+  }
+
+  size_t offset = 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    memcpy(in_data + offset, inputs[i], input_lens[i]);
+    in_sizes[i] = (uint32_t) input_lens[i];
+    offset += input_lens[i];
+  }
+
+  int ret = 1;
+  sgx_status_t sgx_ret = enc_seal_data_batch(eid, &ret, (uint32_t) count,
+                                             in_data, (uint32_t) in_size,
+                                             in_sizes, out_data,
+                                             (uint32_t) out_size, out_sizes,
+                                             key_policy, attribute_mask);
+
+  kmyth_clear_and_free(in_data, in_size);
+  free(in_sizes);
+  if (sgx_ret != SGX_SUCCESS || ret != 0)
+  {
+    kmyth_log(LOG_ERR, "error to seal data batch ... exiting");
+    free(out_data);
+    free(out_sizes);
+    return 1;
+  }
+
+  offset = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    if (create_nkl_bytes(out_data + offset, out_sizes[i], outputs + i,
+                         output_lens + i))
+    {
+      kmyth_log(LOG_ERR, "error writing data to .nkl format ... exiting");
+      for (size_t j = 0; j < i; j++)
+      {
+        free(outputs[j]);
+        outputs[j] = NULL;
+      }
+      free(out_data);
+      free(out_sizes);
+      return 1;
+    }
+    offset += out_sizes[i];
+  }
+
+  free(out_data);
+  free(out_sizes);
+  return 0;
+}
+
+//############################################################################
+// kmyth_sgx_unseal_nkl_batch()
+//############################################################################
+int kmyth_sgx_unseal_nkl_batch(sgx_enclave_id_t eid, size_t count,
+                               uint8_t ** inputs, size_t *input_lens,
+                               uint64_t * handles)
+{
+  if (count == 0 || count > UINT32_MAX)
+  {
+    kmyth_log(LOG_ERR, "invalid number of inputs to unseal ... exiting");
+    return 1;
+  }
+
+  uint8_t **blobs = (uint8_t **) calloc(count, sizeof(uint8_t *));
+  uint32_t *data_sizes = (uint32_t *) malloc(count * sizeof(uint32_t));
+
+  if (blobs == NULL || data_sizes == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate batch buffers ... exiting");
+    free(blobs);
+    free(data_sizes);
+    return 1;
+  }
+
+  size_t data_size = 0;
+  int retval = 0;
+
+  for (size_t i = 0; i < count && retval == 0; i++)
+  {
+    char *input = (char *) inputs[i];
+    size_t input_len = input_lens[i];
+    uint8_t *block = NULL;
+    size_t blocksize = 0;
+    size_t blob_size = 0;
+
+    if (get_block_bytes
+        (&input, &input_len, &block, &blocksize,
+         (char *) KMYTH_DELIM_NKL_DATA, strlen(KMYTH_DELIM_NKL_DATA),
+         (char *) KMYTH_DELIM_END_NKL, strlen(KMYTH_DELIM_END_NKL)))
+    {
+      kmyth_log(LOG_ERR, "error getting block bytes ... exiting");
+      retval = 1;
+      break;
+    }
+    if (decodeBase64Data(block, blocksize, (unsigned char **) &blobs[i],
+                         &blob_size))
+    {
+      kmyth_log(LOG_ERR, "error Base64 decode of block bytes ... exiting");
+      retval = 1;
+    }
+    else if (blob_size > UINT32_MAX - data_size)
+    {
+      kmyth_log(LOG_ERR, "inputs too large to unseal in one batch ... "
+                "exiting");
+      retval = 1;
+    }
+    else
+    {
+      data_sizes[i] = (uint32_t) blob_size;
+      data_size += blob_size;
+    }
+    free(block);
+  }
+
+  uint8_t *data = NULL;
+
+  if (retval == 0)
+  {
+    data = (uint8_t *) malloc(data_size);
+    if (data == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to allocate batch buffers ... exiting");
+      retval = 1;
+    }
+  }
+
+  if (retval == 0)
+  {
+    size_t offset = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+      memcpy(data + offset, blobs[i], data_sizes[i]);
+      offset += data_sizes[i];
+    }
+
+    bool ret = false;
+    sgx_status_t sgx_ret = kmyth_unseal_into_enclave_batch(eid, &ret,
+                                                           (uint32_t) count,
+                                                           data,
+                                                           (uint32_t)
+                                                           data_size,
+                                                           data_sizes,
+                                                           handles);
+
+    if (sgx_ret != SGX_SUCCESS || ret == false)
+    {
+      kmyth_log(LOG_ERR, "error to unseal block bytes ... exiting");
+      retval = 1;
+    }
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    free(blobs[i]);
+  }
+  free(blobs);
+  free(data_sizes);
+  free(data);
+  return retval;
+}
+
+typedef struct unseal_nkl_job_s
+{
+  uint8_t *input;
+  size_t input_len;
+  uint64_t *handle;
+} unseal_nkl_job_t;
+
+//############################################################################
+// run_unseal_nkl_job()
+//############################################################################
+static int run_unseal_nkl_job(sgx_enclave_id_t eid, void *job)
+{
+  unseal_nkl_job_t *unseal = (unseal_nkl_job_t *) job;
+
+  return kmyth_sgx_unseal_nkl(eid, unseal->input, unseal->input_len,
+                              unseal->handle);
+}
+
+//############################################################################
+// kmyth_sgx_unseal_nkl_parallel()
+//############################################################################
+int kmyth_sgx_unseal_nkl_parallel(kmyth_sgx_dispatcher_t * dispatcher,
+                                  size_t count, uint8_t ** inputs,
+                                  size_t *input_lens, uint64_t * handles,
+                                  int *results)
+{
+  if (count == 0)
+  {
+    kmyth_log(LOG_ERR, "invalid number of inputs to unseal ... exiting");
+    return 1;
+  }
+
+  unseal_nkl_job_t *jobs =
+    (unseal_nkl_job_t *) malloc(count * sizeof(unseal_nkl_job_t));
+
+  if (jobs == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate unseal jobs ... exiting");
+    return 1;
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    jobs[i].input = inputs[i];
+    jobs[i].input_len = input_lens[i];
+    jobs[i].handle = handles + i;
+  }
+
+  int retval = kmyth_sgx_dispatch(dispatcher, run_unseal_nkl_job, jobs,
+                                  sizeof(unseal_nkl_job_t), count, results);
+
+  if (retval != 0)
+  {
+    kmyth_log(LOG_ERR, "error to unseal some of the inputs ... exiting");
+  }
+  free(jobs);
+  return retval;
+}
@@ -6,19 +6,44 @@
 
 #include "cipher/aes_gcm.h"
 
+#include <limits.h>
+#include <string.h>
+
 #include <openssl/evp.h>
-#include <openssl/rand.h>
 
+#include "cipher/random_pool.h"
 #include "memory_util.h"
 
 //############################################################################
-// aes_gcm_encrypt()
+// aes_gcm_encrypt_into()
 //############################################################################
-int aes_gcm_encrypt(unsigned char *key,
-                    size_t key_len,
-                    unsigned char *inData, size_t inData_len,
-                    unsigned char **outData, size_t * outData_len)
+int aes_gcm_encrypt_into(kmyth_cipher_ctx * cipher_ctx,
+                         unsigned char *key,
+                         size_t key_len,
+                         unsigned char *inData,
+                         size_t inData_len,
+                         unsigned char *outData, size_t * outData_len)
 {
+  if (outData_len == NULL || inData_len > INT_MAX - GCM_IV_LEN - GCM_TAG_LEN)
+  {
+    return 1;
+  }
+
+  // output data buffer (outData) will contain the concatenation of:
+  //   - GCM_IV_LEN (12) byte IV
+  //   - resultant ciphertext (same length as the input plaintext)
+  //   - GCM_TAG_LEN (16) byte tag
+  size_t required_len = GCM_IV_LEN + inData_len + GCM_TAG_LEN;
+
+  if (outData == NULL)
+  {
+    *outData_len = required_len;
+    return 0;
+  }
+  if (*outData_len < required_len)
+  {
+    return 1;
+  }
 
   // validate non-NULL and non-empty encryption key specified
   if (key == NULL || key_len == 0)
@@ -32,18 +57,7 @@ int aes_gcm_encrypt(unsigned char *key,
     return 1;
   }
 
-  // output data buffer (outData) will contain the concatenation of:
-  //   - GCM_IV_LEN (12) byte IV
-  //   - resultant ciphertext (same length as the input plaintext)
-  //   - GCM_TAG_LEN (16) byte tag
-  *outData_len = GCM_IV_LEN + inData_len + GCM_TAG_LEN;
-  *outData = NULL;
-  *outData = malloc(*outData_len);
-  if (*outData == NULL)
-  {
-    return 1;
-  }
-  unsigned char *iv = *outData;
+  unsigned char *iv = outData;
   unsigned char *ciphertext = iv + GCM_IV_LEN;
   unsigned char *tag = ciphertext + inData_len;
 
@@ -51,128 +65,125 @@ int aes_gcm_encrypt(unsigned char *key,
   int ciphertext_len = 0;
 
   // initialize the cipher context to match cipher suite being used
-  EVP_CIPHER_CTX *ctx;
-
-  if (!(ctx = EVP_CIPHER_CTX_new()))
-  {
-    free(*outData);
-    return 1;
-  }
-  int init_result = 0;
+  const EVP_CIPHER *evp_cipher = NULL;
 
   switch (key_len)
   {
   case 16:
-    init_result = EVP_EncryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, NULL, NULL);
+    evp_cipher = EVP_aes_128_gcm();
     break;
   case 24:
-    init_result = EVP_EncryptInit_ex(ctx, EVP_aes_192_gcm(), NULL, NULL, NULL);
+    evp_cipher = EVP_aes_192_gcm();
     break;
   case 32:
-    init_result = EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL);
+    evp_cipher = EVP_aes_256_gcm();
     break;
   default:
     break;
   }
-  if (!init_result)
+
+  EVP_CIPHER_CTX *ctx = kmyth_cipher_ctx_get(cipher_ctx, evp_cipher, 1);
+
+  if (ctx == NULL)
   {
-    free(*outData);
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
 
   // create the IV
-  if (RAND_bytes(iv, GCM_IV_LEN) != 1)
+  if (random_pool_bytes(iv, GCM_IV_LEN))
   {
-    free(*outData);
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_put(cipher_ctx, ctx);
     return 1;
   }
 
   // set the IV length in the cipher context
   if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, GCM_IV_LEN, NULL))
   {
-    free(*outData);
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_put(cipher_ctx, ctx);
     return 1;
   }
 
   // set the key and IV in the cipher context
   if (!EVP_EncryptInit_ex(ctx, NULL, NULL, key, iv))
   {
-    free(*outData);
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_put(cipher_ctx, ctx);
     return 1;
   }
 
   // encrypt the input plaintext, put result in the output ciphertext buffer
   if (!EVP_EncryptUpdate(ctx, ciphertext, &ciphertext_len, inData, inData_len))
   {
-    free(*outData);
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_put(cipher_ctx, ctx);
     return 1;
   }
 
   // verify that the resultant CT length matches the input PT length
   if (ciphertext_len != inData_len)
   {
-    free(*outData);
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_put(cipher_ctx, ctx);
     return 1;
   }
 
   // OpenSSL requires a "finalize" operation. For AES/GCM no data is written.
   if (!EVP_EncryptFinal_ex(ctx, tag, &ciphertext_len))
   {
-    free(*outData);
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_put(cipher_ctx, ctx);
     return 1;
   }
 
   // get the AES/GCM tag value, appending it to the output ciphertext
   if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, GCM_TAG_LEN, tag))
   {
-    free(*outData);
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_put(cipher_ctx, ctx);
     return 1;
   }
 
-  // now that the encryption is complete, clean-up cipher context
-  EVP_CIPHER_CTX_free(ctx);
+  // now that the encryption is complete, return the cipher context
+  kmyth_cipher_ctx_put(cipher_ctx, ctx);
+  *outData_len = required_len;
 
   return 0;
 }
 
 //############################################################################
-// aes_gcm_decrypt()
+// aes_gcm_decrypt_into()
 //############################################################################
-int aes_gcm_decrypt(unsigned char *key,
-                    size_t key_len,
-                    unsigned char *inData, size_t inData_len,
-                    unsigned char **outData, size_t * outData_len)
+int aes_gcm_decrypt_into(kmyth_cipher_ctx * cipher_ctx,
+                         unsigned char *key,
+                         size_t key_len,
+                         unsigned char *inData,
+                         size_t inData_len,
+                         unsigned char *outData, size_t * outData_len)
 {
-  // validate non-NULL and non-empty decryption key specified
-  if (key == NULL || key_len == 0)
+  // validate the input ciphertext holds at least an IV and a tag
+  if (outData_len == NULL || inData_len < GCM_IV_LEN + GCM_TAG_LEN
+      || inData_len > INT_MAX)
   {
     return 1;
   }
 
-  // validate non-NULL and non-empty input ciphertext buffer specified
-  if (inData == NULL || inData_len == 0)
+  // output data buffer (outData) will contain only the plaintext, which
+  // should be sized as the input minus the lengths of the IV and tag fields
+  size_t required_len = inData_len - (GCM_IV_LEN + GCM_TAG_LEN);
+
+  if (outData == NULL)
+  {
+    *outData_len = required_len;
+    return 0;
+  }
+  if (*outData_len < required_len)
   {
     return 1;
   }
-  if (inData_len < GCM_IV_LEN + GCM_TAG_LEN)
+
+  // validate non-NULL and non-empty decryption key specified
+  if (key == NULL || key_len == 0)
   {
     return 1;
   }
 
-  // output data buffer (outData) will contain only the plaintext, which
-  // should be sized as the input minus the lengths of the IV and tag fields
-  *outData_len = inData_len - (GCM_IV_LEN + GCM_TAG_LEN);
-  *outData = NULL;
-  *outData = malloc(*outData_len);
-  if (*outData == NULL)
+  // validate non-NULL input ciphertext buffer specified
+  if (inData == NULL)
   {
     return 1;
   }
@@ -183,7 +194,7 @@ int aes_gcm_decrypt(unsigned char *key,
   //   - GCM_TAG_LEN (16) byte tag
   unsigned char *iv = inData;
   unsigned char *ciphertext = inData + GCM_IV_LEN;
-  unsigned char *tag = ciphertext + *outData_len;
+  unsigned char *tag = ciphertext + required_len;
 
   // variables to hold/accumulate length returned by EVP library calls
   //   - OpenSSL insists this be an int
@@ -191,65 +202,57 @@ int aes_gcm_decrypt(unsigned char *key,
   int plaintext_len = 0;
 
   // initialize the cipher context to match cipher suite being used
-  EVP_CIPHER_CTX *ctx;
-
-  if (!(ctx = EVP_CIPHER_CTX_new()))
-  {
-    free(*outData);
-    return 1;
-  }
-  int init_result = 0;
+  const EVP_CIPHER *evp_cipher = NULL;
 
   switch (key_len)
   {
   case 16:
-    init_result = EVP_DecryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, NULL, NULL);
+    evp_cipher = EVP_aes_128_gcm();
     break;
   case 24:
-    init_result = EVP_DecryptInit_ex(ctx, EVP_aes_192_gcm(), NULL, NULL, NULL);
+    evp_cipher = EVP_aes_192_gcm();
     break;
   case 32:
-    init_result = EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL);
+    evp_cipher = EVP_aes_256_gcm();
     break;
   default:
     break;
   }
-  if (!init_result)
+
+  EVP_CIPHER_CTX *ctx = kmyth_cipher_ctx_get(cipher_ctx, evp_cipher, 0);
+
+  if (ctx == NULL)
   {
-    free(*outData);
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
 
   // set tag to expected tag passed in with input data
   if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, GCM_TAG_LEN, tag))
   {
-    free(*outData);
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_put(cipher_ctx, ctx);
     return 1;
   }
 
   // set the IV length in the cipher context
   if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, GCM_IV_LEN, NULL))
   {
-    free(*outData);
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_put(cipher_ctx, ctx);
     return 1;
   }
 
   // set the key and IV in the cipher context
   if (!EVP_DecryptInit_ex(ctx, NULL, NULL, key, iv))
   {
-    free(*outData);
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_put(cipher_ctx, ctx);
     return 1;
   }
 
   // decrypt the input ciphertext, put result in the output plaintext buffer
-  if (!EVP_DecryptUpdate(ctx, *outData, &len, ciphertext, *outData_len))
+  // (unauthenticated plaintext is wiped from it if the tag check fails)
+  if (!EVP_DecryptUpdate(ctx, outData, &len, ciphertext, required_len))
   {
-    kmyth_clear_and_free(*outData, *outData_len);
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_clear(outData, required_len);
+    kmyth_cipher_ctx_put(cipher_ctx, ctx);
     return 1;
   }
   plaintext_len += len;
@@ -257,24 +260,335 @@ int aes_gcm_decrypt(unsigned char *key,
   // 'Finalize' Decrypt:
   //   - validate that resultant tag matches the expected tag passed in
   //   - should produce no more plaintext bytes in our case
-  if (EVP_DecryptFinal_ex(ctx, *outData + plaintext_len, &len) <= 0)
+  if (EVP_DecryptFinal_ex(ctx, outData + plaintext_len, &len) <= 0)
   {
-    kmyth_clear_and_free(*outData, *outData_len);
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_clear(outData, required_len);
+    kmyth_cipher_ctx_put(cipher_ctx, ctx);
     return 1;
   }
   plaintext_len += len;
 
   // verify that the resultant PT length matches the input CT length
-  if (plaintext_len != *outData_len)
+  if (plaintext_len != required_len)
+  {
+    kmyth_clear(outData, required_len);
+    kmyth_cipher_ctx_put(cipher_ctx, ctx);
+    return 1;
+  }
+
+  // now that the decryption is complete, return the cipher context used
+  kmyth_cipher_ctx_put(cipher_ctx, ctx);
+  *outData_len = required_len;
+
+  return 0;
+}
+
+//############################################################################
+// aes_gcm_decrypt_in_place()
+//############################################################################
+int aes_gcm_decrypt_in_place(kmyth_cipher_ctx * cipher_ctx,
+                             unsigned char *key,
+                             size_t key_len,
+                             unsigned char *data,
+                             size_t data_len, size_t * plaintext_len)
+{
+  if (data == NULL || plaintext_len == NULL
+      || data_len < GCM_IV_LEN + GCM_TAG_LEN)
+  {
+    return 1;
+  }
+
+  // GCM decrypts exactly in place, so the plaintext is written over the
+  // ciphertext that follows the IV. Nothing is moved to the front of the
+  // buffer until the tag has been verified (a failed check wipes it).
+  size_t len = data_len - GCM_IV_LEN;
+
+  if (aes_gcm_decrypt_into(cipher_ctx, key, key_len, data, data_len,
+                           data + GCM_IV_LEN, &len))
+  {
+    return 1;
+  }
+
+  memmove(data, data + GCM_IV_LEN, len);
+  kmyth_clear(data + len, data_len - len);
+  *plaintext_len = len;
+
+  return 0;
+}
+
+//############################################################################
+// aes_gcm_encrypt_with_ctx()
+//############################################################################
+int aes_gcm_encrypt_with_ctx(kmyth_cipher_ctx * cipher_ctx,
+                             unsigned char *key,
+                             size_t key_len,
+                             unsigned char *inData,
+                             size_t inData_len,
+                             unsigned char **outData,
+                             size_t * outData_len)
+{
+  return kmyth_cipher_into_alloc(aes_gcm_encrypt_into, cipher_ctx,
+                                 key, key_len, inData, inData_len,
+                                 outData, outData_len);
+}
+
+//############################################################################
+// aes_gcm_decrypt_with_ctx()
+//############################################################################
+int aes_gcm_decrypt_with_ctx(kmyth_cipher_ctx * cipher_ctx,
+                             unsigned char *key,
+                             size_t key_len,
+                             unsigned char *inData,
+                             size_t inData_len,
+                             unsigned char **outData,
+                             size_t * outData_len)
+{
+  return kmyth_cipher_into_alloc(aes_gcm_decrypt_into, cipher_ctx,
+                                 key, key_len, inData, inData_len,
+                                 outData, outData_len);
+}
+
+//############################################################################
+// aes_gcm_encrypt()
+//############################################################################
+int aes_gcm_encrypt(unsigned char *key,
+                    size_t key_len,
+                    unsigned char *inData,
+                    size_t inData_len, unsigned char **outData,
+                    size_t * outData_len)
+{
+  return aes_gcm_encrypt_with_ctx(NULL, key, key_len, inData, inData_len,
+                                  outData, outData_len);
+}
+
+//############################################################################
+// aes_gcm_decrypt()
+//############################################################################
+int aes_gcm_decrypt(unsigned char *key,
+                    size_t key_len,
+                    unsigned char *inData,
+                    size_t inData_len, unsigned char **outData,
+                    size_t * outData_len)
+{
+  return aes_gcm_decrypt_with_ctx(NULL, key, key_len, inData, inData_len,
+                                  outData, outData_len);
+}
+
+//############################################################################
+// gcm_batch_ctx()
+//############################################################################
+static EVP_CIPHER_CTX *gcm_batch_ctx(kmyth_cipher_ctx * cipher_ctx,
+                                     unsigned char *key, size_t key_len,
+                                     int enc)
+{
+  const EVP_CIPHER *evp_cipher = NULL;
+
+  switch (key_len)
+  {
+  case 16:
+    evp_cipher = EVP_aes_128_gcm();
+    break;
+  case 24:
+    evp_cipher = EVP_aes_192_gcm();
+    break;
+  case 32:
+    evp_cipher = EVP_aes_256_gcm();
+    break;
+  default:
+    break;
+  }
+
+  EVP_CIPHER_CTX *ctx = kmyth_cipher_ctx_get(cipher_ctx, evp_cipher, enc);
+
+  if (ctx == NULL)
+  {
+    return NULL;
+  }
+
+  // set the key once - each input then only sets its IV, so that the
+  // key schedule is reused for the whole batch
+  if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, GCM_IV_LEN, NULL)
+      || !EVP_CipherInit_ex(ctx, NULL, NULL, key, NULL, enc))
+  {
+    kmyth_cipher_ctx_put(cipher_ctx, ctx);
+    return NULL;
+  }
+
+  return ctx;
+}
+
+//############################################################################
+// gcm_batch_encrypt_one()
+//############################################################################
+static int gcm_batch_encrypt_one(EVP_CIPHER_CTX * ctx,
+                                 unsigned char *inData, size_t inData_len,
+                                 unsigned char **outData,
+                                 size_t * outData_len)
+{
+  if (inData == NULL || inData_len > INT_MAX - GCM_IV_LEN - GCM_TAG_LEN)
   {
-    kmyth_clear_and_free(*outData, *outData_len);
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
 
-  // now that the decryption is complete, clean-up cipher context used
-  EVP_CIPHER_CTX_free(ctx);
+  *outData = malloc(GCM_IV_LEN + inData_len + GCM_TAG_LEN);
+  if (*outData == NULL)
+  {
+    return 1;
+  }
+
+  unsigned char *iv = *outData;
+  unsigned char *ciphertext = iv + GCM_IV_LEN;
+  unsigned char *tag = ciphertext + inData_len;
+  int len = 0;
+
+  if (random_pool_bytes(iv, GCM_IV_LEN)
+      || !EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, iv)
+      || !EVP_EncryptUpdate(ctx, ciphertext, &len, inData, inData_len)
+      || len != inData_len
+      || !EVP_EncryptFinal_ex(ctx, tag, &len)
+      || !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, GCM_TAG_LEN, tag))
+  {
+    free(*outData);
+    *outData = NULL;
+    return 1;
+  }
+  *outData_len = GCM_IV_LEN + inData_len + GCM_TAG_LEN;
 
   return 0;
 }
+
+//############################################################################
+// gcm_batch_decrypt_one()
+//############################################################################
+static int gcm_batch_decrypt_one(EVP_CIPHER_CTX * ctx,
+                                 unsigned char *inData, size_t inData_len,
+                                 unsigned char **outData,
+                                 size_t * outData_len)
+{
+  if (inData == NULL || inData_len < GCM_IV_LEN + GCM_TAG_LEN
+      || inData_len > INT_MAX)
+  {
+    return 1;
+  }
+
+  size_t plaintext_len = inData_len - (GCM_IV_LEN + GCM_TAG_LEN);
+
+  *outData = malloc(plaintext_len);
+  if (*outData == NULL)
+  {
+    return 1;
+  }
+
+  unsigned char *iv = inData;
+  unsigned char *ciphertext = inData + GCM_IV_LEN;
+  unsigned char *tag = ciphertext + plaintext_len;
+  int len = 0;
+  int final_len = 0;
+
+  if (!EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, iv)
+      || !EVP_DecryptUpdate(ctx, *outData, &len, ciphertext, plaintext_len)
+      || !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, GCM_TAG_LEN, tag)
+      || EVP_DecryptFinal_ex(ctx, *outData + len, &final_len) <= 0
+      || len + final_len != plaintext_len)
+  {
+    kmyth_clear_and_free(*outData, plaintext_len);
+    *outData = NULL;
+    return 1;
+  }
+  *outData_len = plaintext_len;
+
+  return 0;
+}
+
+//############################################################################
+// gcm_batch()
+//############################################################################
+static int gcm_batch(kmyth_cipher_ctx * cipher_ctx,
+                     unsigned char *key, size_t key_len, int enc,
+                     size_t count,
+                     unsigned char **inData, size_t * inData_len,
+                     unsigned char **outData, size_t * outData_len,
+                     int *status)
+{
+  if (count == 0)
+  {
+    return 0;
+  }
+  if (inData == NULL || inData_len == NULL || outData == NULL
+      || outData_len == NULL || status == NULL)
+  {
+    return 1;
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    outData[i] = NULL;
+    outData_len[i] = 0;
+    status[i] = 1;
+  }
+
+  // validate non-NULL and non-empty key specified
+  if (key == NULL || key_len == 0)
+  {
+    return 1;
+  }
+
+  EVP_CIPHER_CTX *ctx = gcm_batch_ctx(cipher_ctx, key, key_len, enc);
+
+  if (ctx == NULL)
+  {
+    return 1;
+  }
+
+  int retval = 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    if (enc)
+    {
+      status[i] = gcm_batch_encrypt_one(ctx, inData[i], inData_len[i],
+                                        &outData[i], &outData_len[i]);
+    }
+    else
+    {
+      status[i] = gcm_batch_decrypt_one(ctx, inData[i], inData_len[i],
+                                        &outData[i], &outData_len[i]);
+    }
+    retval |= status[i];
+  }
+
+  kmyth_cipher_ctx_put(cipher_ctx, ctx);
+
+  return retval;
+}
+
+//############################################################################
+// aes_gcm_encrypt_batch()
+//############################################################################
+int aes_gcm_encrypt_batch(kmyth_cipher_ctx * cipher_ctx,
+                          unsigned char *key,
+                          size_t key_len,
+                          size_t count,
+                          unsigned char **inData,
+                          size_t * inData_len,
+                          unsigned char **outData,
+                          size_t * outData_len, int *status)
+{
+  return gcm_batch(cipher_ctx, key, key_len, 1, count,
+                   inData, inData_len, outData, outData_len, status);
+}
+
+//############################################################################
+// aes_gcm_decrypt_batch()
+//############################################################################
+int aes_gcm_decrypt_batch(kmyth_cipher_ctx * cipher_ctx,
+                          unsigned char *key,
+                          size_t key_len,
+                          size_t count,
+                          unsigned char **inData,
+                          size_t * inData_len,
+                          unsigned char **outData,
+                          size_t * outData_len, int *status)
+{
+  return gcm_batch(cipher_ctx, key, key_len, 0, count,
+                   inData, inData_len, outData, outData_len, status);
+}
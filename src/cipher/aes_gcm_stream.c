@@ -0,0 +1,744 @@
+/**
+ * @file  aes_gcm_stream.c
+ *
+ * @brief Implements segmented (streaming) AES GCM for kmyth.
+ */
+
+#include "cipher/aes_gcm_stream.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <openssl/evp.h>
+
+#include "cipher/aes_gcm.h"
+#include "cipher/random_pool.h"
+#include "memory_util.h"
+
+static atomic_uint gcm_stream_threads = 1;
+
+// the segments of one in-memory encryption or decryption, shared by the
+// threads processing them - each thread claims the next unprocessed segment
+// and writes its output to the segment's fixed place in the output buffer
+typedef struct gcm_stream_job
+{
+  unsigned char *key;
+  size_t key_len;
+  int enc;
+  unsigned char *header;
+  unsigned char *in;
+  unsigned char *out;
+  size_t seg_len;
+  size_t data_len;              // total plaintext length
+  size_t seg_count;
+  atomic_size_t next;
+  atomic_int failed;
+} gcm_stream_job;
+
+//############################################################################
+// gcm_stream_ctx_new()
+//############################################################################
+static EVP_CIPHER_CTX *gcm_stream_ctx_new(unsigned char *key,
+                                          size_t key_len, int enc)
+{
+  const EVP_CIPHER *evp_cipher = NULL;
+
+  switch (key_len)
+  {
+  case 16:
+    evp_cipher = EVP_aes_128_gcm();
+    break;
+  case 24:
+    evp_cipher = EVP_aes_192_gcm();
+    break;
+  case 32:
+    evp_cipher = EVP_aes_256_gcm();
+    break;
+  default:
+    return NULL;
+  }
+
+  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+
+  if (ctx == NULL)
+  {
+    return NULL;
+  }
+
+  // the key is fixed for the whole message, so it is only set once here -
+  // each segment re-initializes the context with just its own nonce
+  if (!EVP_CipherInit_ex(ctx, evp_cipher, NULL, NULL, NULL, enc)
+      || !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, GCM_IV_LEN, NULL)
+      || !EVP_CipherInit_ex(ctx, NULL, NULL, key, NULL, enc))
+  {
+    EVP_CIPHER_CTX_free(ctx);
+    return NULL;
+  }
+
+  return ctx;
+}
+
+//############################################################################
+// gcm_stream_segment()
+//############################################################################
+static int gcm_stream_segment(EVP_CIPHER_CTX * ctx, int enc,
+                              unsigned char *header, uint32_t index,
+                              int last, unsigned char *in, size_t in_len,
+                              unsigned char *out, unsigned char *tag)
+{
+  // nonce = header nonce prefix || BE segment index || last segment flag
+  unsigned char nonce[GCM_IV_LEN];
+
+  memcpy(nonce, header, GCM_STREAM_NONCE_PREFIX_LEN);
+  nonce[GCM_STREAM_NONCE_PREFIX_LEN] = (unsigned char) (index >> 24);
+  nonce[GCM_STREAM_NONCE_PREFIX_LEN + 1] = (unsigned char) (index >> 16);
+  nonce[GCM_STREAM_NONCE_PREFIX_LEN + 2] = (unsigned char) (index >> 8);
+  nonce[GCM_STREAM_NONCE_PREFIX_LEN + 3] = (unsigned char) index;
+  nonce[GCM_IV_LEN - 1] = (last) ? 1 : 0;
+
+  if (!EVP_CipherInit_ex(ctx, NULL, NULL, NULL, nonce, enc))
+  {
+    return 1;
+  }
+
+  if (!enc && !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, GCM_TAG_LEN,
+                                   tag))
+  {
+    return 1;
+  }
+
+  int len = 0;
+
+  // bind the header (nonce prefix and segment length) to every segment
+  if (!EVP_CipherUpdate(ctx, NULL, &len, header, GCM_STREAM_HEADER_LEN))
+  {
+    return 1;
+  }
+
+  if (in_len > 0)
+  {
+    if (!EVP_CipherUpdate(ctx, out, &len, in, (int) in_len)
+        || (size_t) len != in_len)
+    {
+      return 1;
+    }
+  }
+
+  // for decryption, 'finalize' is where the segment tag is verified
+  if (EVP_CipherFinal_ex(ctx, out + in_len, &len) <= 0)
+  {
+    return 1;
+  }
+
+  if (enc && !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, GCM_TAG_LEN,
+                                  tag))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// gcm_stream_new_header()
+//############################################################################
+static int gcm_stream_new_header(unsigned char *header)
+{
+  if (random_pool_bytes(header, GCM_STREAM_NONCE_PREFIX_LEN))
+  {
+    return 1;
+  }
+
+  uint32_t seg_len = GCM_STREAM_SEGMENT_LEN;
+
+  header[GCM_STREAM_NONCE_PREFIX_LEN] = (unsigned char) (seg_len >> 24);
+  header[GCM_STREAM_NONCE_PREFIX_LEN + 1] = (unsigned char) (seg_len >> 16);
+  header[GCM_STREAM_NONCE_PREFIX_LEN + 2] = (unsigned char) (seg_len >> 8);
+  header[GCM_STREAM_NONCE_PREFIX_LEN + 3] = (unsigned char) seg_len;
+
+  return 0;
+}
+
+//############################################################################
+// gcm_stream_parse_header()
+//############################################################################
+static int gcm_stream_parse_header(unsigned char *header, size_t * seg_len)
+{
+  unsigned char *p = header + GCM_STREAM_NONCE_PREFIX_LEN;
+
+  *seg_len = ((size_t) p[0] << 24) | ((size_t) p[1] << 16) |
+    ((size_t) p[2] << 8) | (size_t) p[3];
+
+  if (*seg_len == 0 || *seg_len > GCM_STREAM_MAX_SEGMENT_LEN)
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// gcm_stream_layout()
+//
+// Parses the header of an in-memory input, and derives its segment count
+// and total plaintext length from the input length.
+//############################################################################
+static int gcm_stream_layout(unsigned char *inData, size_t inData_len,
+                             size_t * seg_len, size_t * seg_count,
+                             size_t * data_len)
+{
+  // validate input holds at least a header and one (empty) segment
+  if (inData == NULL || inData_len < GCM_STREAM_HEADER_LEN + GCM_TAG_LEN)
+  {
+    return 1;
+  }
+
+  if (gcm_stream_parse_header(inData, seg_len))
+  {
+    return 1;
+  }
+
+  // every segment but the last is exactly (seg_len + tag) bytes, the last
+  // one holds at least a tag - this fixes the segment count
+  size_t record_len = *seg_len + GCM_TAG_LEN;
+  size_t remaining = inData_len - GCM_STREAM_HEADER_LEN;
+
+  *seg_count = (remaining - 1) / record_len + 1;
+  if (remaining - (*seg_count - 1) * record_len < GCM_TAG_LEN)
+  {
+    return 1;
+  }
+  if (*seg_count > UINT32_MAX)
+  {
+    return 1;
+  }
+
+  *data_len = remaining - *seg_count * GCM_TAG_LEN;
+
+  return 0;
+}
+
+//############################################################################
+// gcm_stream_at_eof()
+//############################################################################
+static int gcm_stream_at_eof(FILE * in)
+{
+  int c = fgetc(in);
+
+  if (c == EOF)
+  {
+    return 1;
+  }
+  ungetc(c, in);
+  return 0;
+}
+
+//############################################################################
+// gcm_stream_worker()
+//############################################################################
+static void *gcm_stream_worker(void *arg)
+{
+  gcm_stream_job *job = (gcm_stream_job *) arg;
+  EVP_CIPHER_CTX *ctx = gcm_stream_ctx_new(job->key, job->key_len, job->enc);
+
+  if (ctx == NULL)
+  {
+    atomic_store(&job->failed, 1);
+    return NULL;
+  }
+
+  size_t record_len = job->seg_len + GCM_TAG_LEN;
+
+  while (!atomic_load(&job->failed))
+  {
+    size_t i = atomic_fetch_add(&job->next, 1);
+
+    if (i >= job->seg_count)
+    {
+      break;
+    }
+
+    int last = (i == job->seg_count - 1);
+    size_t len = (last) ? job->data_len - i * job->seg_len : job->seg_len;
+    unsigned char *pt = (job->enc) ? job->in : job->out;
+    unsigned char *ct = (job->enc) ? job->out : job->in;
+
+    pt += i * job->seg_len;
+    ct += GCM_STREAM_HEADER_LEN + i * record_len;
+    if (gcm_stream_segment(ctx, job->enc, job->header, (uint32_t) i, last,
+                           (job->enc) ? pt : ct, len,
+                           (job->enc) ? ct : pt, ct + len))
+    {
+      atomic_store(&job->failed, 1);
+    }
+  }
+
+  EVP_CIPHER_CTX_free(ctx);
+  return NULL;
+}
+
+//############################################################################
+// gcm_stream_run()
+//
+// Processes every segment of a job, on up to gcm_stream_threads threads
+// (including the calling one). Fewer threads are used for short inputs,
+// or if some cannot be started.
+//############################################################################
+static int gcm_stream_run(gcm_stream_job * job)
+{
+  size_t thread_count = atomic_load(&gcm_stream_threads);
+
+  if (thread_count > job->seg_count)
+  {
+    thread_count = job->seg_count;
+  }
+
+  pthread_t threads[GCM_STREAM_MAX_THREADS];
+  size_t started = 0;
+
+  atomic_init(&job->next, 0);
+  atomic_init(&job->failed, 0);
+  while (started + 1 < thread_count)
+  {
+    if (pthread_create(&threads[started], NULL, gcm_stream_worker, job) != 0)
+    {
+      break;
+    }
+    started++;
+  }
+
+  gcm_stream_worker(job);
+  for (size_t i = 0; i < started; i++)
+  {
+    pthread_join(threads[i], NULL);
+  }
+
+  return atomic_load(&job->failed) ? 1 : 0;
+}
+
+//############################################################################
+// aes_gcm_stream_set_threads()
+//############################################################################
+void aes_gcm_stream_set_threads(unsigned int threads)
+{
+  if (threads < 1)
+  {
+    threads = 1;
+  }
+  if (threads > GCM_STREAM_MAX_THREADS)
+  {
+    threads = GCM_STREAM_MAX_THREADS;
+  }
+  atomic_store(&gcm_stream_threads, threads);
+}
+
+//############################################################################
+// aes_gcm_stream_encrypt_into()
+//############################################################################
+int aes_gcm_stream_encrypt_into(kmyth_cipher_ctx * cipher_ctx,
+                                unsigned char *key,
+                                size_t key_len,
+                                unsigned char *inData,
+                                size_t inData_len,
+                                unsigned char *outData, size_t * outData_len)
+{
+  if (outData_len == NULL)
+  {
+    return 1;
+  }
+
+  // an empty input is still encoded as a single (empty) final segment
+  size_t seg_count = (inData_len + GCM_STREAM_SEGMENT_LEN - 1) /
+    GCM_STREAM_SEGMENT_LEN;
+
+  if (seg_count == 0)
+  {
+    seg_count = 1;
+  }
+  if (seg_count > UINT32_MAX)
+  {
+    return 1;
+  }
+
+  size_t required_len = GCM_STREAM_HEADER_LEN + inData_len +
+    seg_count * GCM_TAG_LEN;
+
+  if (outData == NULL)
+  {
+    *outData_len = required_len;
+    return 0;
+  }
+  if (*outData_len < required_len)
+  {
+    return 1;
+  }
+
+  // validate non-NULL and non-empty encryption key specified
+  if (key == NULL || key_len == 0)
+  {
+    return 1;
+  }
+
+  // validate non-NULL input plaintext buffer specified
+  if (inData == NULL)
+  {
+    return 1;
+  }
+
+  if (gcm_stream_new_header(outData))
+  {
+    return 1;
+  }
+
+  gcm_stream_job job = {
+    .key = key,
+    .key_len = key_len,
+    .enc = 1,
+    .header = outData,
+    .in = inData,
+    .out = outData,
+    .seg_len = GCM_STREAM_SEGMENT_LEN,
+    .data_len = inData_len,
+    .seg_count = seg_count,
+  };
+
+  if (gcm_stream_run(&job))
+  {
+    return 1;
+  }
+
+  *outData_len = required_len;
+
+  return 0;
+}
+
+//############################################################################
+// aes_gcm_stream_decrypt_into()
+//############################################################################
+int aes_gcm_stream_decrypt_into(kmyth_cipher_ctx * cipher_ctx,
+                                unsigned char *key,
+                                size_t key_len,
+                                unsigned char *inData,
+                                size_t inData_len,
+                                unsigned char *outData, size_t * outData_len)
+{
+  if (outData_len == NULL)
+  {
+    return 1;
+  }
+
+  unsigned char *header = inData;
+  size_t seg_len = 0;
+  size_t seg_count = 0;
+  size_t required_len = 0;
+
+  if (gcm_stream_layout(inData, inData_len, &seg_len, &seg_count,
+                        &required_len))
+  {
+    return 1;
+  }
+
+  if (outData == NULL)
+  {
+    *outData_len = required_len;
+    return 0;
+  }
+  if (*outData_len < required_len)
+  {
+    return 1;
+  }
+
+  // validate non-NULL and non-empty decryption key specified
+  if (key == NULL || key_len == 0)
+  {
+    return 1;
+  }
+
+  gcm_stream_job job = {
+    .key = key,
+    .key_len = key_len,
+    .enc = 0,
+    .header = header,
+    .in = inData,
+    .out = outData,
+    .seg_len = seg_len,
+    .data_len = required_len,
+    .seg_count = seg_count,
+  };
+
+  if (gcm_stream_run(&job))
+  {
+    kmyth_clear(outData, required_len);
+    return 1;
+  }
+
+  *outData_len = required_len;
+
+  return 0;
+}
+
+//############################################################################
+// aes_gcm_stream_decrypt_range()
+//############################################################################
+int aes_gcm_stream_decrypt_range(kmyth_cipher_ctx * cipher_ctx,
+                                 unsigned char *key,
+                                 size_t key_len,
+                                 unsigned char *inData,
+                                 size_t inData_len,
+                                 size_t offset,
+                                 unsigned char *outData, size_t outData_len)
+{
+  size_t seg_len = 0;
+  size_t seg_count = 0;
+  size_t data_len = 0;
+
+  if (gcm_stream_layout(inData, inData_len, &seg_len, &seg_count, &data_len))
+  {
+    return 1;
+  }
+
+  // validate the range lies within the plaintext
+  if (offset > data_len || outData_len > data_len - offset)
+  {
+    return 1;
+  }
+  if (outData_len == 0)
+  {
+    return 0;
+  }
+  if (outData == NULL || key == NULL || key_len == 0)
+  {
+    return 1;
+  }
+
+  EVP_CIPHER_CTX *ctx = gcm_stream_ctx_new(key, key_len, 0);
+
+  if (ctx == NULL)
+  {
+    return 1;
+  }
+
+  // segments only partly in the range are decrypted into a locked scratch
+  // buffer, the others straight into outData
+  unsigned char *scratch = NULL;
+  size_t record_len = seg_len + GCM_TAG_LEN;
+  size_t end = offset + outData_len;
+  int retval = 0;
+
+  for (size_t i = offset / seg_len; i <= (end - 1) / seg_len; i++)
+  {
+    int last = (i == seg_count - 1);
+    size_t seg_start = i * seg_len;
+    size_t ct_len = (last) ? data_len - seg_start : seg_len;
+    unsigned char *ct = inData + GCM_STREAM_HEADER_LEN + i * record_len;
+    size_t from = (offset > seg_start) ? offset - seg_start : 0;
+    size_t to = (end < seg_start + ct_len) ? end - seg_start : ct_len;
+
+    if (from == 0 && to == ct_len)
+    {
+      retval = gcm_stream_segment(ctx, 0, inData, (uint32_t) i, last, ct,
+                                  ct_len, outData + (seg_start - offset),
+                                  ct + ct_len);
+    }
+    else
+    {
+      if (scratch == NULL)
+      {
+        scratch = kmyth_secure_alloc(seg_len);
+      }
+      retval = (scratch == NULL)
+        || gcm_stream_segment(ctx, 0, inData, (uint32_t) i, last, ct, ct_len,
+                              scratch, ct + ct_len);
+      if (retval == 0)
+      {
+        memcpy(outData + (seg_start + from - offset), scratch + from,
+               to - from);
+      }
+    }
+    if (retval)
+    {
+      kmyth_clear(outData, outData_len);
+      break;
+    }
+  }
+
+  kmyth_secure_free(scratch, seg_len);
+  EVP_CIPHER_CTX_free(ctx);
+
+  return retval;
+}
+
+//############################################################################
+// aes_gcm_stream_encrypt()
+//############################################################################
+int aes_gcm_stream_encrypt(unsigned char *key,
+                           size_t key_len,
+                           unsigned char *inData, size_t inData_len,
+                           unsigned char **outData, size_t * outData_len)
+{
+  return kmyth_cipher_into_alloc(aes_gcm_stream_encrypt_into, NULL,
+                                 key, key_len, inData, inData_len,
+                                 outData, outData_len);
+}
+
+//############################################################################
+// aes_gcm_stream_decrypt()
+//############################################################################
+int aes_gcm_stream_decrypt(unsigned char *key,
+                           size_t key_len,
+                           unsigned char *inData, size_t inData_len,
+                           unsigned char **outData, size_t * outData_len)
+{
+  return kmyth_cipher_into_alloc(aes_gcm_stream_decrypt_into, NULL,
+                                 key, key_len, inData, inData_len,
+                                 outData, outData_len);
+}
+
+//############################################################################
+// aes_gcm_stream_encrypt_file()
+//############################################################################
+int aes_gcm_stream_encrypt_file(unsigned char *key, size_t key_len,
+                                FILE * in, FILE * out)
+{
+  if (key == NULL || key_len == 0 || in == NULL || out == NULL)
+  {
+    return 1;
+  }
+
+  unsigned char header[GCM_STREAM_HEADER_LEN];
+
+  if (gcm_stream_new_header(header)
+      || fwrite(header, 1, GCM_STREAM_HEADER_LEN, out) != GCM_STREAM_HEADER_LEN)
+  {
+    return 1;
+  }
+
+  // the plaintext segment buffer is locked arena memory, reused across calls
+  unsigned char *pt = kmyth_secure_alloc(GCM_STREAM_SEGMENT_LEN);
+  unsigned char *ct = malloc(GCM_STREAM_SEGMENT_LEN + GCM_TAG_LEN);
+
+  if (pt == NULL || ct == NULL)
+  {
+    kmyth_secure_free(pt, GCM_STREAM_SEGMENT_LEN);
+    free(ct);
+    return 1;
+  }
+
+  EVP_CIPHER_CTX *ctx = gcm_stream_ctx_new(key, key_len, 1);
+
+  if (ctx == NULL)
+  {
+    kmyth_secure_free(pt, GCM_STREAM_SEGMENT_LEN);
+    free(ct);
+    return 1;
+  }
+
+  int retval = 0;
+  uint32_t index = 0;
+  int last = 0;
+
+  while (!last)
+  {
+    size_t pt_len = fread(pt, 1, GCM_STREAM_SEGMENT_LEN, in);
+
+    if (ferror(in))
+    {
+      retval = 1;
+      break;
+    }
+    last = (pt_len < GCM_STREAM_SEGMENT_LEN) || gcm_stream_at_eof(in);
+
+    if ((!last && index == UINT32_MAX)
+        || gcm_stream_segment(ctx, 1, header, index, last, pt, pt_len, ct,
+                              ct + pt_len)
+        || fwrite(ct, 1, pt_len + GCM_TAG_LEN, out) != pt_len + GCM_TAG_LEN)
+    {
+      retval = 1;
+      break;
+    }
+    index++;
+  }
+
+  kmyth_secure_free(pt, GCM_STREAM_SEGMENT_LEN);
+  free(ct);
+  EVP_CIPHER_CTX_free(ctx);
+
+  return retval;
+}
+
+//############################################################################
+// aes_gcm_stream_decrypt_file()
+//############################################################################
+int aes_gcm_stream_decrypt_file(unsigned char *key, size_t key_len,
+                                FILE * in, FILE * out)
+{
+  if (key == NULL || key_len == 0 || in == NULL || out == NULL)
+  {
+    return 1;
+  }
+
+  unsigned char header[GCM_STREAM_HEADER_LEN];
+  size_t seg_len = 0;
+
+  if (fread(header, 1, GCM_STREAM_HEADER_LEN, in) != GCM_STREAM_HEADER_LEN
+      || gcm_stream_parse_header(header, &seg_len))
+  {
+    return 1;
+  }
+
+  size_t record_len = seg_len + GCM_TAG_LEN;
+  unsigned char *ct = malloc(record_len);
+  unsigned char *pt = kmyth_secure_alloc(seg_len);
+
+  if (pt == NULL || ct == NULL)
+  {
+    kmyth_secure_free(pt, seg_len);
+    free(ct);
+    return 1;
+  }
+
+  EVP_CIPHER_CTX *ctx = gcm_stream_ctx_new(key, key_len, 0);
+
+  if (ctx == NULL)
+  {
+    kmyth_secure_free(pt, seg_len);
+    free(ct);
+    return 1;
+  }
+
+  int retval = 0;
+  uint32_t index = 0;
+  int last = 0;
+
+  while (!last)
+  {
+    size_t rec_len = fread(ct, 1, record_len, in);
+
+    if (ferror(in) || rec_len < GCM_TAG_LEN)
+    {
+      retval = 1;
+      break;
+    }
+    last = (rec_len < record_len) || gcm_stream_at_eof(in);
+
+    size_t pt_len = rec_len - GCM_TAG_LEN;
+
+    if ((!last && index == UINT32_MAX)
+        || gcm_stream_segment(ctx, 0, header, index, last, ct, pt_len, pt,
+                              ct + pt_len)
+        || fwrite(pt, 1, pt_len, out) != pt_len)
+    {
+      retval = 1;
+      break;
+    }
+    index++;
+  }
+
+  kmyth_secure_free(pt, seg_len);
+  free(ct);
+  EVP_CIPHER_CTX_free(ctx);
+
+  return retval;
+}
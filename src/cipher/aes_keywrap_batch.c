@@ -0,0 +1,513 @@
+/**
+ * @file  aes_keywrap_batch.c
+ *
+ * @brief Implements batch AES Key Wrap (RFC 3394) and AES Key Wrap with
+ *        Padding (RFC 5649) for Kmyth.
+ */
+
+#include "cipher/aes_keywrap_batch.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+
+#include "cipher/aes_keywrap_5649pad.h"
+#include "memory_util.h"
+
+// RFC 3394 default initial value and RFC 5649 alternative initial value
+// (the 32-bit message length indicator completes the RFC 5649 value)
+static const unsigned char kw_default_iv[8] = {
+  0xA6, 0xA6, 0xA6, 0xA6, 0xA6, 0xA6, 0xA6, 0xA6
+};
+static const unsigned char kwp_aiv_prefix[4] = { 0xA6, 0x59, 0x59, 0xA6 };
+
+/**
+ * State of one key wrap or unwrap in progress. A wrap of n semiblocks
+ * takes 6n AES block operations (just one for an RFC 5649 wrap of a single
+ * semiblock), each of which updates the integrity register (A) and one of
+ * the n semiblock registers (R).
+ */
+typedef struct kw_lane
+{
+  size_t item;                  // index of this input in the batch
+  unsigned char A[8];           // integrity (A) register
+  unsigned char *R;             // semiblock registers, in the output buffer
+  size_t n;                     // number of semiblock registers
+  size_t steps;                 // total number of AES operations
+  size_t step;                  // number of AES operations completed
+  size_t out_size;              // allocated size of the output buffer
+  size_t cur;                   // semiblock used by the current operation
+  uint64_t t;                   // step counter for the current operation
+} kw_lane;
+
+// prepares a lane for one input (allocating its output), or finishes it
+typedef int (*kw_prepare_fn) (unsigned char *in, size_t in_len,
+                              kw_lane * lane, unsigned char **out,
+                              size_t * out_len);
+typedef int (*kw_finish_fn) (kw_lane * lane, unsigned char *out,
+                             size_t * out_len);
+
+//############################################################################
+// kw_xor_t()
+//############################################################################
+static void kw_xor_t(unsigned char *A, uint64_t t)
+{
+  for (int i = 7; i >= 0; i--)
+  {
+    A[i] ^= (unsigned char) (t & 0xFF);
+    t >>= 8;
+  }
+}
+
+//############################################################################
+// kw_run_lanes()
+//############################################################################
+static int kw_run_lanes(EVP_CIPHER_CTX * ctx, int enc,
+                        kw_lane * lanes, size_t lane_count)
+{
+  unsigned char blocks[AES_KEYWRAP_BATCH_LANES * 16];
+  kw_lane *active[AES_KEYWRAP_BATCH_LANES];
+
+  while (1)
+  {
+    // gather the next AES input block (A | R[i]) of every unfinished lane
+    size_t k = 0;
+
+    for (size_t l = 0; l < lane_count; l++)
+    {
+      kw_lane *lane = &lanes[l];
+
+      if (lane->step == lane->steps)
+      {
+        continue;
+      }
+
+      unsigned char *block = blocks + 16 * k;
+
+      memcpy(block, lane->A, 8);
+      lane->cur = 0;
+      lane->t = 0;
+      if (lane->steps > 1)
+      {
+        // wrapping runs j = 0..5, i = 1..n; unwrapping runs them backwards
+        size_t j = lane->step / lane->n;
+        size_t i = lane->step % lane->n;
+
+        if (!enc)
+        {
+          j = 5 - j;
+          i = lane->n - 1 - i;
+          kw_xor_t(block, lane->n * j + i + 1);
+        }
+        lane->cur = i;
+        lane->t = lane->n * j + i + 1;
+      }
+      memcpy(block + 8, lane->R + 8 * lane->cur, 8);
+      active[k++] = lane;
+    }
+
+    if (k == 0)
+    {
+      break;
+    }
+
+    // one multi-block AES-ECB operation advances every lane by one step
+    int len = 0;
+
+    if (!EVP_CipherUpdate(ctx, blocks, &len, blocks, (int) (16 * k))
+        || len != (int) (16 * k))
+    {
+      kmyth_clear(blocks, sizeof(blocks));
+      return 1;
+    }
+
+    // scatter the results back into each lane's registers
+    for (size_t l = 0; l < k; l++)
+    {
+      kw_lane *lane = active[l];
+      unsigned char *block = blocks + 16 * l;
+
+      memcpy(lane->A, block, 8);
+      if (enc && lane->steps > 1)
+      {
+        kw_xor_t(lane->A, lane->t);
+      }
+      memcpy(lane->R + 8 * lane->cur, block + 8, 8);
+      lane->step++;
+    }
+  }
+
+  kmyth_clear(blocks, sizeof(blocks));
+  return 0;
+}
+
+//############################################################################
+// kw_batch()
+//############################################################################
+static int kw_batch(kmyth_cipher_ctx * cipher_ctx,
+                    unsigned char *key, size_t key_len, int enc,
+                    kw_prepare_fn prepare, kw_finish_fn finish,
+                    size_t count,
+                    unsigned char **inData, size_t * inData_len,
+                    unsigned char **outData, size_t * outData_len,
+                    int *status)
+{
+  if (count == 0)
+  {
+    return 0;
+  }
+  if (inData == NULL || inData_len == NULL || outData == NULL
+      || outData_len == NULL || status == NULL)
+  {
+    return 1;
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    outData[i] = NULL;
+    outData_len[i] = 0;
+    status[i] = 1;
+  }
+
+  // validate non-NULL and non-empty key specified
+  if (key == NULL || key_len == 0)
+  {
+    return 1;
+  }
+
+  // key wrap is built here on AES-ECB, initialized once with the key
+  const EVP_CIPHER *evp_cipher = NULL;
+
+  switch (key_len)
+  {
+  case 16:
+    evp_cipher = EVP_aes_128_ecb();
+    break;
+  case 24:
+    evp_cipher = EVP_aes_192_ecb();
+    break;
+  case 32:
+    evp_cipher = EVP_aes_256_ecb();
+    break;
+  default:
+    break;
+  }
+
+  EVP_CIPHER_CTX *ctx = kmyth_cipher_ctx_get(cipher_ctx, evp_cipher, enc);
+
+  if (ctx == NULL)
+  {
+    return 1;
+  }
+  if (!EVP_CipherInit_ex(ctx, NULL, NULL, key, NULL, enc)
+      || !EVP_CIPHER_CTX_set_padding(ctx, 0))
+  {
+    kmyth_cipher_ctx_put(cipher_ctx, ctx);
+    return 1;
+  }
+
+  // process the inputs AES_KEYWRAP_BATCH_LANES at a time
+  kw_lane lanes[AES_KEYWRAP_BATCH_LANES];
+  int retval = 0;
+
+  for (size_t first = 0; first < count; first += AES_KEYWRAP_BATCH_LANES)
+  {
+    size_t lane_count = 0;
+
+    for (size_t i = first; i < count && i < first + AES_KEYWRAP_BATCH_LANES;
+         i++)
+    {
+      // invalid inputs are skipped, leaving their status set to error
+      if (prepare(inData[i], inData_len[i], &lanes[lane_count],
+                  &outData[i], &outData_len[i]))
+      {
+        retval = 1;
+        continue;
+      }
+      lanes[lane_count++].item = i;
+    }
+
+    int run_failed = kw_run_lanes(ctx, enc, lanes, lane_count);
+
+    for (size_t l = 0; l < lane_count; l++)
+    {
+      size_t i = lanes[l].item;
+
+      if (run_failed || finish(&lanes[l], outData[i], &outData_len[i]))
+      {
+        kmyth_clear_and_free(outData[i], lanes[l].out_size);
+        outData[i] = NULL;
+        outData_len[i] = 0;
+        retval = 1;
+        continue;
+      }
+      status[i] = 0;
+    }
+  }
+
+  kmyth_clear(lanes, sizeof(lanes));
+  kmyth_cipher_ctx_put(cipher_ctx, ctx);
+
+  return retval;
+}
+
+//############################################################################
+// kw_3394_prepare_wrap()
+//############################################################################
+static int kw_3394_prepare_wrap(unsigned char *in, size_t in_len,
+                                kw_lane * lane, unsigned char **out,
+                                size_t * out_len)
+{
+  // plaintext must be a multiple of eight (8) bytes, at least 16 bytes
+  if (in == NULL || in_len < 16 || in_len % 8 != 0)
+  {
+    return 1;
+  }
+
+  // the output is the final A register followed by the R registers
+  *out = malloc(in_len + 8);
+  if (*out == NULL)
+  {
+    return 1;
+  }
+  *out_len = in_len + 8;
+
+  memcpy(lane->A, kw_default_iv, 8);
+  lane->R = *out + 8;
+  memcpy(lane->R, in, in_len);
+  lane->n = in_len / 8;
+  lane->steps = 6 * lane->n;
+  lane->step = 0;
+  lane->out_size = in_len + 8;
+
+  return 0;
+}
+
+//############################################################################
+// kw_3394_prepare_unwrap()
+//############################################################################
+static int kw_3394_prepare_unwrap(unsigned char *in, size_t in_len,
+                                  kw_lane * lane, unsigned char **out,
+                                  size_t * out_len)
+{
+  // ciphertext must be a multiple of eight (8) bytes, at least 24 bytes
+  if (in == NULL || in_len < 24 || in_len % 8 != 0)
+  {
+    return 1;
+  }
+
+  // the output is the R registers (the A register is checked, not output)
+  *out = malloc(in_len - 8);
+  if (*out == NULL)
+  {
+    return 1;
+  }
+  *out_len = 0;
+
+  memcpy(lane->A, in, 8);
+  lane->R = *out;
+  memcpy(lane->R, in + 8, in_len - 8);
+  lane->n = in_len / 8 - 1;
+  lane->steps = 6 * lane->n;
+  lane->step = 0;
+  lane->out_size = in_len - 8;
+
+  return 0;
+}
+
+//############################################################################
+// kw_finish_wrap()
+//############################################################################
+static int kw_finish_wrap(kw_lane * lane, unsigned char *out,
+                          size_t * out_len)
+{
+  memcpy(out, lane->A, 8);
+  return 0;
+}
+
+//############################################################################
+// kw_3394_finish_unwrap()
+//############################################################################
+static int kw_3394_finish_unwrap(kw_lane * lane, unsigned char *out,
+                                 size_t * out_len)
+{
+  if (CRYPTO_memcmp(lane->A, kw_default_iv, 8) != 0)
+  {
+    return 1;
+  }
+  *out_len = 8 * lane->n;
+  return 0;
+}
+
+//############################################################################
+// kw_5649_prepare_wrap()
+//############################################################################
+static int kw_5649_prepare_wrap(unsigned char *in, size_t in_len,
+                                kw_lane * lane, unsigned char **out,
+                                size_t * out_len)
+{
+  if (in == NULL || in_len == 0 || in_len >= AES_KEYWRAP_5649PAD_MAX_DATA_LEN)
+  {
+    return 1;
+  }
+
+  // the plaintext is zero padded to a multiple of eight (8) bytes
+  size_t padded_len = (in_len + 7) & ~((size_t) 7);
+
+  *out = calloc(padded_len + 8, 1);
+  if (*out == NULL)
+  {
+    return 1;
+  }
+  *out_len = padded_len + 8;
+
+  // alternative initial value: prefix | 32-bit message length indicator
+  memcpy(lane->A, kwp_aiv_prefix, 4);
+  lane->A[4] = (unsigned char) (in_len >> 24);
+  lane->A[5] = (unsigned char) (in_len >> 16);
+  lane->A[6] = (unsigned char) (in_len >> 8);
+  lane->A[7] = (unsigned char) in_len;
+  lane->R = *out + 8;
+  memcpy(lane->R, in, in_len);
+  lane->n = padded_len / 8;
+
+  // a single padded semiblock is encrypted with one AES operation
+  lane->steps = (lane->n == 1) ? 1 : 6 * lane->n;
+  lane->step = 0;
+  lane->out_size = padded_len + 8;
+
+  return 0;
+}
+
+//############################################################################
+// kw_5649_prepare_unwrap()
+//############################################################################
+static int kw_5649_prepare_unwrap(unsigned char *in, size_t in_len,
+                                  kw_lane * lane, unsigned char **out,
+                                  size_t * out_len)
+{
+  // ciphertext must be a multiple of eight (8) bytes, at least 16 bytes
+  if (in == NULL || in_len < 16 || in_len % 8 != 0
+      || in_len > AES_KEYWRAP_5649PAD_MAX_DATA_LEN)
+  {
+    return 1;
+  }
+
+  *out = malloc(in_len - 8);
+  if (*out == NULL)
+  {
+    return 1;
+  }
+  *out_len = 0;
+
+  memcpy(lane->A, in, 8);
+  lane->R = *out;
+  memcpy(lane->R, in + 8, in_len - 8);
+  lane->n = in_len / 8 - 1;
+  lane->steps = (lane->n == 1) ? 1 : 6 * lane->n;
+  lane->step = 0;
+  lane->out_size = in_len - 8;
+
+  return 0;
+}
+
+//############################################################################
+// kw_5649_finish_unwrap()
+//############################################################################
+static int kw_5649_finish_unwrap(kw_lane * lane, unsigned char *out,
+                                 size_t * out_len)
+{
+  // check the alternative initial value prefix and message length indicator
+  size_t mli = ((size_t) lane->A[4] << 24) | ((size_t) lane->A[5] << 16)
+    | ((size_t) lane->A[6] << 8) | (size_t) lane->A[7];
+
+  if (CRYPTO_memcmp(lane->A, kwp_aiv_prefix, 4) != 0
+      || mli <= 8 * (lane->n - 1) || mli > 8 * lane->n)
+  {
+    return 1;
+  }
+
+  // the padding must be all zero
+  unsigned char pad = 0;
+
+  for (size_t i = mli; i < 8 * lane->n; i++)
+  {
+    pad |= out[i];
+  }
+  if (pad != 0)
+  {
+    return 1;
+  }
+
+  *out_len = mli;
+  return 0;
+}
+
+//############################################################################
+// aes_keywrap_3394nopad_encrypt_batch()
+//############################################################################
+int aes_keywrap_3394nopad_encrypt_batch(kmyth_cipher_ctx * cipher_ctx,
+                                        unsigned char *key,
+                                        size_t key_len,
+                                        size_t count,
+                                        unsigned char **inData,
+                                        size_t * inData_len,
+                                        unsigned char **outData,
+                                        size_t * outData_len, int *status)
+{
+  return kw_batch(cipher_ctx, key, key_len, 1,
+                  kw_3394_prepare_wrap, kw_finish_wrap,
+                  count, inData, inData_len, outData, outData_len, status);
+}
+
+//############################################################################
+// aes_keywrap_3394nopad_decrypt_batch()
+//############################################################################
+int aes_keywrap_3394nopad_decrypt_batch(kmyth_cipher_ctx * cipher_ctx,
+                                        unsigned char *key,
+                                        size_t key_len,
+                                        size_t count,
+                                        unsigned char **inData,
+                                        size_t * inData_len,
+                                        unsigned char **outData,
+                                        size_t * outData_len, int *status)
+{
+  return kw_batch(cipher_ctx, key, key_len, 0,
+                  kw_3394_prepare_unwrap, kw_3394_finish_unwrap,
+                  count, inData, inData_len, outData, outData_len, status);
+}
+
+//############################################################################
+// aes_keywrap_5649pad_encrypt_batch()
+//############################################################################
+int aes_keywrap_5649pad_encrypt_batch(kmyth_cipher_ctx * cipher_ctx,
+                                      unsigned char *key,
+                                      size_t key_len,
+                                      size_t count,
+                                      unsigned char **inData,
+                                      size_t * inData_len,
+                                      unsigned char **outData,
+                                      size_t * outData_len, int *status)
+{
+  return kw_batch(cipher_ctx, key, key_len, 1,
+                  kw_5649_prepare_wrap, kw_finish_wrap,
+                  count, inData, inData_len, outData, outData_len, status);
+}
+
+//############################################################################
+// aes_keywrap_5649pad_decrypt_batch()
+//############################################################################
+int aes_keywrap_5649pad_decrypt_batch(kmyth_cipher_ctx * cipher_ctx,
+                                      unsigned char *key,
+                                      size_t key_len,
+                                      size_t count,
+                                      unsigned char **inData,
+                                      size_t * inData_len,
+                                      unsigned char **outData,
+                                      size_t * outData_len, int *status)
+{
+  return kw_batch(cipher_ctx, key, key_len, 0,
+                  kw_5649_prepare_unwrap, kw_5649_finish_unwrap,
+                  count, inData, inData_len, outData, outData_len, status);
+}
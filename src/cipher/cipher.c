@@ -11,9 +11,12 @@
 #include <openssl/err.h>
 
 #include "defines.h"
+#include "memory_util.h"
 #include "cipher/aes_gcm.h"
+#include "cipher/aes_gcm_stream.h"
 #include "cipher/aes_keywrap_3394nopad.h"
 #include "cipher/aes_keywrap_5649pad.h"
+#include "cipher/aes_keywrap_batch.h"
 
 // Check for supported OpenSSL version
 //   - OpenSSL v1.1.x required for AES KeyWrap RFC5649 w/ padding
@@ -31,50 +34,154 @@
 const cipher_t cipher_list[] = {
   {.cipher_name = "AES/GCM/NoPadding/256",
    .encrypt_fn = aes_gcm_encrypt,
-   .decrypt_fn = aes_gcm_decrypt},
+   .decrypt_fn = aes_gcm_decrypt,
+   .encrypt_ctx_fn = aes_gcm_encrypt_with_ctx,
+   .decrypt_ctx_fn = aes_gcm_decrypt_with_ctx,
+   .encrypt_into_fn = aes_gcm_encrypt_into,
+   .decrypt_into_fn = aes_gcm_decrypt_into,
+   .decrypt_in_place_fn = aes_gcm_decrypt_in_place,
+   .encrypt_batch_fn = aes_gcm_encrypt_batch,
+   .decrypt_batch_fn = aes_gcm_decrypt_batch},
 
   {.cipher_name = "AES/GCM/NoPadding/192",
    .encrypt_fn = aes_gcm_encrypt,
-   .decrypt_fn = aes_gcm_decrypt},
+   .decrypt_fn = aes_gcm_decrypt,
+   .encrypt_ctx_fn = aes_gcm_encrypt_with_ctx,
+   .decrypt_ctx_fn = aes_gcm_decrypt_with_ctx,
+   .encrypt_into_fn = aes_gcm_encrypt_into,
+   .decrypt_into_fn = aes_gcm_decrypt_into,
+   .decrypt_in_place_fn = aes_gcm_decrypt_in_place,
+   .encrypt_batch_fn = aes_gcm_encrypt_batch,
+   .decrypt_batch_fn = aes_gcm_decrypt_batch},
 
   {.cipher_name = "AES/GCM/NoPadding/128",
    .encrypt_fn = aes_gcm_encrypt,
-   .decrypt_fn = aes_gcm_decrypt},
+   .decrypt_fn = aes_gcm_decrypt,
+   .encrypt_ctx_fn = aes_gcm_encrypt_with_ctx,
+   .decrypt_ctx_fn = aes_gcm_decrypt_with_ctx,
+   .encrypt_into_fn = aes_gcm_encrypt_into,
+   .decrypt_into_fn = aes_gcm_decrypt_into,
+   .decrypt_in_place_fn = aes_gcm_decrypt_in_place,
+   .encrypt_batch_fn = aes_gcm_encrypt_batch,
+   .decrypt_batch_fn = aes_gcm_decrypt_batch},
+
+  {.cipher_name = "AES/GCM-Stream/NoPadding/256",
+   .encrypt_fn = aes_gcm_stream_encrypt,
+   .decrypt_fn = aes_gcm_stream_decrypt,
+   .encrypt_into_fn = aes_gcm_stream_encrypt_into,
+   .decrypt_into_fn = aes_gcm_stream_decrypt_into,
+   .decrypt_range_fn = aes_gcm_stream_decrypt_range,
+   .encrypt_stream_fn = aes_gcm_stream_encrypt_file,
+   .decrypt_stream_fn = aes_gcm_stream_decrypt_file},
+
+  {.cipher_name = "AES/GCM-Stream/NoPadding/192",
+   .encrypt_fn = aes_gcm_stream_encrypt,
+   .decrypt_fn = aes_gcm_stream_decrypt,
+   .encrypt_into_fn = aes_gcm_stream_encrypt_into,
+   .decrypt_into_fn = aes_gcm_stream_decrypt_into,
+   .decrypt_range_fn = aes_gcm_stream_decrypt_range,
+   .encrypt_stream_fn = aes_gcm_stream_encrypt_file,
+   .decrypt_stream_fn = aes_gcm_stream_decrypt_file},
+
+  {.cipher_name = "AES/GCM-Stream/NoPadding/128",
+   .encrypt_fn = aes_gcm_stream_encrypt,
+   .decrypt_fn = aes_gcm_stream_decrypt,
+   .encrypt_into_fn = aes_gcm_stream_encrypt_into,
+   .decrypt_into_fn = aes_gcm_stream_decrypt_into,
+   .decrypt_range_fn = aes_gcm_stream_decrypt_range,
+   .encrypt_stream_fn = aes_gcm_stream_encrypt_file,
+   .decrypt_stream_fn = aes_gcm_stream_decrypt_file},
 
   {.cipher_name = "AES/KeyWrap/RFC3394NoPadding/256",
    .encrypt_fn = aes_keywrap_3394nopad_encrypt,
-   .decrypt_fn = aes_keywrap_3394nopad_decrypt},
+   .decrypt_fn = aes_keywrap_3394nopad_decrypt,
+   .encrypt_ctx_fn = aes_keywrap_3394nopad_encrypt_with_ctx,
+   .decrypt_ctx_fn = aes_keywrap_3394nopad_decrypt_with_ctx,
+   .encrypt_into_fn = aes_keywrap_3394nopad_encrypt_into,
+   .decrypt_into_fn = aes_keywrap_3394nopad_decrypt_into,
+   .encrypt_batch_fn = aes_keywrap_3394nopad_encrypt_batch,
+   .decrypt_batch_fn = aes_keywrap_3394nopad_decrypt_batch},
 
   {.cipher_name = "AES/KeyWrap/RFC3394NoPadding/192",
    .encrypt_fn = aes_keywrap_3394nopad_encrypt,
-   .decrypt_fn = aes_keywrap_3394nopad_decrypt},
+   .decrypt_fn = aes_keywrap_3394nopad_decrypt,
+   .encrypt_ctx_fn = aes_keywrap_3394nopad_encrypt_with_ctx,
+   .decrypt_ctx_fn = aes_keywrap_3394nopad_decrypt_with_ctx,
+   .encrypt_into_fn = aes_keywrap_3394nopad_encrypt_into,
+   .decrypt_into_fn = aes_keywrap_3394nopad_decrypt_into,
+   .encrypt_batch_fn = aes_keywrap_3394nopad_encrypt_batch,
+   .decrypt_batch_fn = aes_keywrap_3394nopad_decrypt_batch},
 
   {.cipher_name = "AES/KeyWrap/RFC3394NoPadding/128",
    .encrypt_fn = aes_keywrap_3394nopad_encrypt,
-   .decrypt_fn = aes_keywrap_3394nopad_decrypt},
+   .decrypt_fn = aes_keywrap_3394nopad_decrypt,
+   .encrypt_ctx_fn = aes_keywrap_3394nopad_encrypt_with_ctx,
+   .decrypt_ctx_fn = aes_keywrap_3394nopad_decrypt_with_ctx,
+   .encrypt_into_fn = aes_keywrap_3394nopad_encrypt_into,
+   .decrypt_into_fn = aes_keywrap_3394nopad_decrypt_into,
+   .encrypt_batch_fn = aes_keywrap_3394nopad_encrypt_batch,
+   .decrypt_batch_fn = aes_keywrap_3394nopad_decrypt_batch},
 
   {.cipher_name = "AES/KeyWrap/RFC5649Padding/256",
    .encrypt_fn = aes_keywrap_5649pad_encrypt,
-   .decrypt_fn = aes_keywrap_5649pad_decrypt},
+   .decrypt_fn = aes_keywrap_5649pad_decrypt,
+   .encrypt_ctx_fn = aes_keywrap_5649pad_encrypt_with_ctx,
+   .decrypt_ctx_fn = aes_keywrap_5649pad_decrypt_with_ctx,
+   .encrypt_into_fn = aes_keywrap_5649pad_encrypt_into,
+   .decrypt_into_fn = aes_keywrap_5649pad_decrypt_into,
+   .encrypt_batch_fn = aes_keywrap_5649pad_encrypt_batch,
+   .decrypt_batch_fn = aes_keywrap_5649pad_decrypt_batch},
 
   {.cipher_name = "AES/KeyWrap/RFC5649Padding/192",
    .encrypt_fn = aes_keywrap_5649pad_encrypt,
-   .decrypt_fn = aes_keywrap_5649pad_decrypt},
+   .decrypt_fn = aes_keywrap_5649pad_decrypt,
+   .encrypt_ctx_fn = aes_keywrap_5649pad_encrypt_with_ctx,
+   .decrypt_ctx_fn = aes_keywrap_5649pad_decrypt_with_ctx,
+   .encrypt_into_fn = aes_keywrap_5649pad_encrypt_into,
+   .decrypt_into_fn = aes_keywrap_5649pad_decrypt_into,
+   .encrypt_batch_fn = aes_keywrap_5649pad_encrypt_batch,
+   .decrypt_batch_fn = aes_keywrap_5649pad_decrypt_batch},
 
   {.cipher_name = "AES/KeyWrap/RFC5649Padding/128",
    .encrypt_fn = aes_keywrap_5649pad_encrypt,
-   .decrypt_fn = aes_keywrap_5649pad_decrypt},
+   .decrypt_fn = aes_keywrap_5649pad_decrypt,
+   .encrypt_ctx_fn = aes_keywrap_5649pad_encrypt_with_ctx,
+   .decrypt_ctx_fn = aes_keywrap_5649pad_decrypt_with_ctx,
+   .encrypt_into_fn = aes_keywrap_5649pad_encrypt_into,
+   .decrypt_into_fn = aes_keywrap_5649pad_decrypt_into,
+   .encrypt_batch_fn = aes_keywrap_5649pad_encrypt_batch,
+   .decrypt_batch_fn = aes_keywrap_5649pad_decrypt_batch},
 
   {.cipher_name = NULL,
    .encrypt_fn = NULL,
-   .decrypt_fn = NULL},
+   .decrypt_fn = NULL,
+   .encrypt_ctx_fn = NULL,
+   .decrypt_ctx_fn = NULL,
+   .encrypt_into_fn = NULL,
+   .decrypt_into_fn = NULL,
+   .decrypt_in_place_fn = NULL,
+   .decrypt_range_fn = NULL,
+   .encrypt_batch_fn = NULL,
+   .decrypt_batch_fn = NULL,
+   .encrypt_stream_fn = NULL,
+   .decrypt_stream_fn = NULL},
 };
 
 cipher_t kmyth_get_cipher_t_from_string(char *cipher_string)
 {
   cipher_t cipher = {.cipher_name = NULL,
     .encrypt_fn = NULL,
-    .decrypt_fn = NULL
+    .decrypt_fn = NULL,
+    .encrypt_ctx_fn = NULL,
+    .decrypt_ctx_fn = NULL,
+    .encrypt_into_fn = NULL,
+    .decrypt_into_fn = NULL,
+    .decrypt_in_place_fn = NULL,
+    .decrypt_range_fn = NULL,
+    .encrypt_batch_fn = NULL,
+    .decrypt_batch_fn = NULL,
+    .encrypt_stream_fn = NULL,
+    .decrypt_stream_fn = NULL
   };
 
   // if input string is NULL, just return initialized cipher_t struct
@@ -129,14 +236,16 @@ size_t get_key_len_from_cipher(cipher_t cipher)
 }
 
 //############################################################################
-// kmyth_encrypt_data
+// kmyth_encrypt_data_with_ctx
 //############################################################################
-int kmyth_encrypt_data(unsigned char *data,
-                       size_t data_size,
-                       cipher_t cipher_spec,
-                       unsigned char **enc_data,
-                       size_t * enc_data_size,
-                       unsigned char **enc_key, size_t * enc_key_size)
+int kmyth_encrypt_data_with_ctx(kmyth_cipher_ctx * cipher_ctx,
+                                unsigned char *data,
+                                size_t data_size,
+                                cipher_t cipher_spec,
+                                unsigned char **enc_data,
+                                size_t * enc_data_size,
+                                unsigned char **enc_key,
+                                size_t * enc_key_size)
 {
   if (cipher_spec.cipher_name == NULL)
   {
@@ -160,15 +269,70 @@ int kmyth_encrypt_data(unsigned char *data,
   }
 
   // create symmetric key (wrapping key) of the desired size
-  if (!RAND_bytes(*enc_key, *enc_key_size * sizeof(unsigned char)))
+  if (!RAND_priv_bytes(*enc_key, *enc_key_size * sizeof(unsigned char)))
   {
     return 1;
   }
 
   *enc_data_size = 0;
-  if (cipher_spec.encrypt_fn(*enc_key,
-                             *enc_key_size,
-                             data, data_size, enc_data, enc_data_size))
+  if (cipher_ctx != NULL && cipher_spec.encrypt_ctx_fn != NULL)
+  {
+    if (cipher_spec.encrypt_ctx_fn(cipher_ctx, *enc_key, *enc_key_size,
+                                   data, data_size, enc_data, enc_data_size))
+    {
+      return 1;
+    }
+  }
+  else if (cipher_spec.encrypt_fn(*enc_key,
+                                  *enc_key_size,
+                                  data, data_size, enc_data, enc_data_size))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_decrypt_data_with_ctx
+//###########################################################################
+int kmyth_decrypt_data_with_ctx(kmyth_cipher_ctx * cipher_ctx,
+                                unsigned char *enc_data,
+                                size_t enc_data_size,
+                                cipher_t cipher_spec,
+                                unsigned char *key,
+                                size_t key_size,
+                                unsigned char **result,
+                                size_t * result_size)
+{
+  if (enc_data == NULL || enc_data_size == 0)
+  {
+    return 1;
+  }
+  if (cipher_spec.cipher_name == NULL)
+  {
+    return 1;
+  }
+  if (key == NULL || key_size == 0)
+  {
+    return 1;
+  }
+  if (result == NULL)
+  {
+    return 1;
+  }
+
+  *result_size = 0;
+  if (cipher_ctx != NULL && cipher_spec.decrypt_ctx_fn != NULL)
+  {
+    if (cipher_spec.decrypt_ctx_fn(cipher_ctx, key, key_size, enc_data,
+                                   enc_data_size, result, result_size))
+    {
+      return 1;
+    }
+  }
+  else if (cipher_spec.decrypt_fn(key, key_size, enc_data,
+                                  enc_data_size, result, result_size))
   {
     return 1;
   }
@@ -176,6 +340,211 @@ int kmyth_encrypt_data(unsigned char *data,
   return 0;
 }
 
+//############################################################################
+// kmyth_encrypt_data_into
+//############################################################################
+int kmyth_encrypt_data_into(kmyth_cipher_ctx * cipher_ctx,
+                            unsigned char *data,
+                            size_t data_size,
+                            cipher_t cipher_spec,
+                            unsigned char *enc_data,
+                            size_t * enc_data_size,
+                            unsigned char **enc_key, size_t * enc_key_size)
+{
+  if (cipher_spec.cipher_name == NULL || cipher_spec.encrypt_into_fn == NULL)
+  {
+    return 1;
+  }
+  if (data_size == 0 || enc_data_size == NULL)
+  {
+    return 1;
+  }
+
+  // a length query needs neither the input nor a key
+  if (enc_data == NULL)
+  {
+    return cipher_spec.encrypt_into_fn(cipher_ctx, NULL, 0, NULL, data_size,
+                                       NULL, enc_data_size);
+  }
+
+  if (data == NULL)
+  {
+    return 1;
+  }
+  if (enc_key == NULL || enc_key_size == NULL || *enc_key_size == 0)
+  {
+    return 1;
+  }
+
+  // create symmetric key (wrapping key) of the desired size
+  if (!RAND_priv_bytes(*enc_key, *enc_key_size * sizeof(unsigned char)))
+  {
+    return 1;
+  }
+
+  return cipher_spec.encrypt_into_fn(cipher_ctx, *enc_key, *enc_key_size,
+                                     data, data_size,
+                                     enc_data, enc_data_size);
+}
+
+//############################################################################
+// kmyth_decrypt_data_into
+//############################################################################
+int kmyth_decrypt_data_into(kmyth_cipher_ctx * cipher_ctx,
+                            unsigned char *enc_data,
+                            size_t enc_data_size,
+                            cipher_t cipher_spec,
+                            unsigned char *key,
+                            size_t key_size,
+                            unsigned char *result, size_t * result_size)
+{
+  if (enc_data == NULL || enc_data_size == 0)
+  {
+    return 1;
+  }
+  if (cipher_spec.cipher_name == NULL || cipher_spec.decrypt_into_fn == NULL)
+  {
+    return 1;
+  }
+  if (result_size == NULL)
+  {
+    return 1;
+  }
+
+  // a length query needs no key
+  if (result == NULL)
+  {
+    return cipher_spec.decrypt_into_fn(cipher_ctx, NULL, 0, enc_data,
+                                       enc_data_size, NULL, result_size);
+  }
+
+  if (key == NULL || key_size == 0)
+  {
+    return 1;
+  }
+
+  return cipher_spec.decrypt_into_fn(cipher_ctx, key, key_size, enc_data,
+                                     enc_data_size, result, result_size);
+}
+
+//############################################################################
+// kmyth_decrypt_data_in_place
+//############################################################################
+int kmyth_decrypt_data_in_place(kmyth_cipher_ctx * cipher_ctx,
+                                unsigned char *enc_data,
+                                size_t enc_data_size,
+                                cipher_t cipher_spec,
+                                unsigned char *key,
+                                size_t key_size, size_t * result_size)
+{
+  if (enc_data == NULL || enc_data_size == 0)
+  {
+    return 1;
+  }
+  if (cipher_spec.cipher_name == NULL
+      || cipher_spec.decrypt_in_place_fn == NULL)
+  {
+    return 1;
+  }
+  if (key == NULL || key_size == 0)
+  {
+    return 1;
+  }
+  if (result_size == NULL)
+  {
+    return 1;
+  }
+
+  return cipher_spec.decrypt_in_place_fn(cipher_ctx, key, key_size,
+                                         enc_data, enc_data_size,
+                                         result_size);
+}
+
+//############################################################################
+// kmyth_decrypt_data_range
+//############################################################################
+int kmyth_decrypt_data_range(kmyth_cipher_ctx * cipher_ctx,
+                             unsigned char *enc_data,
+                             size_t enc_data_size,
+                             cipher_t cipher_spec,
+                             unsigned char *key,
+                             size_t key_size,
+                             size_t offset,
+                             unsigned char *result, size_t result_size)
+{
+  if (enc_data == NULL || enc_data_size == 0)
+  {
+    return 1;
+  }
+  if (cipher_spec.cipher_name == NULL)
+  {
+    return 1;
+  }
+  if (key == NULL || key_size == 0 || (result == NULL && result_size > 0))
+  {
+    return 1;
+  }
+
+  if (cipher_spec.decrypt_range_fn != NULL)
+  {
+    return cipher_spec.decrypt_range_fn(cipher_ctx, key, key_size,
+                                        enc_data, enc_data_size,
+                                        offset, result, result_size);
+  }
+
+  // otherwise, decrypt everything and copy out the range
+  size_t plain_size = 0;
+
+  if (kmyth_decrypt_data_into(cipher_ctx, enc_data, enc_data_size,
+                              cipher_spec, NULL, 0, NULL, &plain_size))
+  {
+    return 1;
+  }
+
+  unsigned char *plain = kmyth_secure_alloc(plain_size + 1);
+
+  if (plain == NULL)
+  {
+    return 1;
+  }
+
+  int retval = kmyth_decrypt_data_into(cipher_ctx, enc_data, enc_data_size,
+                                       cipher_spec, key, key_size,
+                                       plain, &plain_size);
+
+  if (retval == 0
+      && (offset > plain_size || result_size > plain_size - offset))
+  {
+    retval = 1;
+  }
+  if (retval == 0)
+  {
+    memcpy(result, plain + offset, result_size);
+  }
+  else if (result != NULL)
+  {
+    kmyth_clear(result, result_size);
+  }
+  kmyth_secure_free(plain, plain_size + 1);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_encrypt_data
+//############################################################################
+int kmyth_encrypt_data(unsigned char *data,
+                       size_t data_size,
+                       cipher_t cipher_spec,
+                       unsigned char **enc_data,
+                       size_t * enc_data_size,
+                       unsigned char **enc_key, size_t * enc_key_size)
+{
+  return kmyth_encrypt_data_with_ctx(NULL, data, data_size, cipher_spec,
+                                     enc_data, enc_data_size,
+                                     enc_key, enc_key_size);
+}
+
 //############################################################################
 // kmyth_decrypt_data
 //###########################################################################
@@ -186,29 +555,131 @@ int kmyth_decrypt_data(unsigned char *enc_data,
                        size_t key_size,
                        unsigned char **result, size_t * result_size)
 {
-  if (enc_data == NULL || enc_data_size == 0)
+  return kmyth_decrypt_data_with_ctx(NULL, enc_data, enc_data_size,
+                                     cipher_spec, key, key_size,
+                                     result, result_size);
+}
+
+//############################################################################
+// cipher_batch_loop()
+//############################################################################
+static int cipher_batch_loop(kmyth_cipher_ctx * cipher_ctx,
+                             cipher fn, cipher_with_ctx ctx_fn,
+                             unsigned char *key, size_t key_size,
+                             size_t count,
+                             unsigned char **in, size_t * in_sizes,
+                             unsigned char **out, size_t * out_sizes,
+                             int *status)
+{
+  int retval = 0;
+
+  for (size_t i = 0; i < count; i++)
   {
-    return 1;
+    out[i] = NULL;
+    out_sizes[i] = 0;
+    if (cipher_ctx != NULL && ctx_fn != NULL)
+    {
+      status[i] = ctx_fn(cipher_ctx, key, key_size, in[i], in_sizes[i],
+                         &out[i], &out_sizes[i]);
+    }
+    else
+    {
+      status[i] = fn(key, key_size, in[i], in_sizes[i],
+                     &out[i], &out_sizes[i]);
+    }
+    if (status[i])
+    {
+      out[i] = NULL;
+      out_sizes[i] = 0;
+      retval = 1;
+    }
   }
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_encrypt_data_batch
+//############################################################################
+int kmyth_encrypt_data_batch(kmyth_cipher_ctx * cipher_ctx,
+                             size_t count,
+                             unsigned char **data,
+                             size_t * data_sizes,
+                             cipher_t cipher_spec,
+                             unsigned char *key,
+                             size_t key_size,
+                             unsigned char **enc_data,
+                             size_t * enc_data_sizes, int *status)
+{
   if (cipher_spec.cipher_name == NULL)
   {
     return 1;
   }
-  if (key == NULL || key_size == 0)
+  if (data == NULL || data_sizes == NULL)
   {
     return 1;
   }
-  if (result == NULL)
+  if (enc_data == NULL || enc_data_sizes == NULL || status == NULL)
+  {
+    return 1;
+  }
+  if (key == NULL || key_size == 0)
   {
     return 1;
   }
 
-  *result_size = 0;
-  if (cipher_spec.decrypt_fn(key, key_size, enc_data,
-                             enc_data_size, result, result_size))
+  if (cipher_spec.encrypt_batch_fn != NULL)
+  {
+    return cipher_spec.encrypt_batch_fn(cipher_ctx, key, key_size, count,
+                                        data, data_sizes,
+                                        enc_data, enc_data_sizes, status);
+  }
+
+  return cipher_batch_loop(cipher_ctx, cipher_spec.encrypt_fn,
+                           cipher_spec.encrypt_ctx_fn, key, key_size, count,
+                           data, data_sizes, enc_data, enc_data_sizes,
+                           status);
+}
+
+//############################################################################
+// kmyth_decrypt_data_batch
+//############################################################################
+int kmyth_decrypt_data_batch(kmyth_cipher_ctx * cipher_ctx,
+                             size_t count,
+                             unsigned char **enc_data,
+                             size_t * enc_data_sizes,
+                             cipher_t cipher_spec,
+                             unsigned char *key,
+                             size_t key_size,
+                             unsigned char **result,
+                             size_t * result_sizes, int *status)
+{
+  if (cipher_spec.cipher_name == NULL)
+  {
+    return 1;
+  }
+  if (enc_data == NULL || enc_data_sizes == NULL)
+  {
+    return 1;
+  }
+  if (result == NULL || result_sizes == NULL || status == NULL)
+  {
+    return 1;
+  }
+  if (key == NULL || key_size == 0)
   {
     return 1;
   }
 
-  return 0;
+  if (cipher_spec.decrypt_batch_fn != NULL)
+  {
+    return cipher_spec.decrypt_batch_fn(cipher_ctx, key, key_size, count,
+                                        enc_data, enc_data_sizes,
+                                        result, result_sizes, status);
+  }
+
+  return cipher_batch_loop(cipher_ctx, cipher_spec.decrypt_fn,
+                           cipher_spec.decrypt_ctx_fn, key, key_size, count,
+                           enc_data, enc_data_sizes, result, result_sizes,
+                           status);
 }
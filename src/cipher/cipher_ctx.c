@@ -0,0 +1,179 @@
+/**
+ * @file  cipher_ctx.c
+ *
+ * @brief Implements the Kmyth pool of reusable OpenSSL cipher contexts.
+ *
+ * Kept separate from cipher.c so that it can be built (along with the
+ * individual cipher implementations) into SGX enclaves.
+ */
+
+#include "cipher/cipher.h"
+
+#include <stdlib.h>
+
+#include <openssl/evp.h>
+
+#include "memory_util.h"
+
+// Maximum number of OpenSSL cipher contexts held by a kmyth_cipher_ctx pool:
+// one per (pooled) cipher mode (GCM, KeyWrap, KeyWrap with padding, and the
+// ECB mode used by batch key wrap), key size (128, 192, 256), and direction
+// (encrypt, decrypt)
+#define KMYTH_CIPHER_CTX_POOL_SIZE 24
+
+struct kmyth_cipher_ctx
+{
+  size_t count;
+  struct
+  {
+    const EVP_CIPHER *evp_cipher;
+    int enc;
+    EVP_CIPHER_CTX *ctx;
+  } entry[KMYTH_CIPHER_CTX_POOL_SIZE];
+};
+
+//############################################################################
+// kmyth_cipher_ctx_new
+//############################################################################
+kmyth_cipher_ctx *kmyth_cipher_ctx_new(void)
+{
+  return calloc(1, sizeof(kmyth_cipher_ctx));
+}
+
+//############################################################################
+// kmyth_cipher_ctx_free
+//############################################################################
+void kmyth_cipher_ctx_free(kmyth_cipher_ctx * cipher_ctx)
+{
+  if (cipher_ctx == NULL)
+  {
+    return;
+  }
+
+  // EVP_CIPHER_CTX_free() cleanses the key schedule held by each context
+  for (size_t i = 0; i < cipher_ctx->count; i++)
+  {
+    EVP_CIPHER_CTX_free(cipher_ctx->entry[i].ctx);
+  }
+  free(cipher_ctx);
+}
+
+//############################################################################
+// kmyth_cipher_ctx_get
+//############################################################################
+EVP_CIPHER_CTX *kmyth_cipher_ctx_get(kmyth_cipher_ctx * cipher_ctx,
+                                     const EVP_CIPHER * evp_cipher, int enc)
+{
+  if (evp_cipher == NULL)
+  {
+    return NULL;
+  }
+
+  // reuse the pooled context for this cipher and direction, if there is one
+  if (cipher_ctx != NULL)
+  {
+    for (size_t i = 0; i < cipher_ctx->count; i++)
+    {
+      if (cipher_ctx->entry[i].evp_cipher == evp_cipher
+          && cipher_ctx->entry[i].enc == enc)
+      {
+        return cipher_ctx->entry[i].ctx;
+      }
+    }
+  }
+
+  // otherwise, create and initialize a new one
+  //   - OpenSSL requires the WRAP_ALLOW flag be explicitly set to use key
+  //     wrap modes through EVP.
+  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+
+  if (ctx == NULL)
+  {
+    return NULL;
+  }
+  if (EVP_CIPHER_mode(evp_cipher) == EVP_CIPH_WRAP_MODE)
+  {
+    EVP_CIPHER_CTX_set_flags(ctx, EVP_CIPHER_CTX_FLAG_WRAP_ALLOW);
+  }
+  if (!EVP_CipherInit_ex(ctx, evp_cipher, NULL, NULL, NULL, enc))
+  {
+    EVP_CIPHER_CTX_free(ctx);
+    return NULL;
+  }
+
+  // keep it in the pool if there is room (if not, it is single-use)
+  if (cipher_ctx != NULL && cipher_ctx->count < KMYTH_CIPHER_CTX_POOL_SIZE)
+  {
+    cipher_ctx->entry[cipher_ctx->count].evp_cipher = evp_cipher;
+    cipher_ctx->entry[cipher_ctx->count].enc = enc;
+    cipher_ctx->entry[cipher_ctx->count].ctx = ctx;
+    cipher_ctx->count++;
+  }
+
+  return ctx;
+}
+
+//############################################################################
+// kmyth_cipher_ctx_put
+//############################################################################
+void kmyth_cipher_ctx_put(kmyth_cipher_ctx * cipher_ctx, EVP_CIPHER_CTX * ctx)
+{
+  if (cipher_ctx != NULL)
+  {
+    for (size_t i = 0; i < cipher_ctx->count; i++)
+    {
+      if (cipher_ctx->entry[i].ctx == ctx)
+      {
+        return;
+      }
+    }
+  }
+  EVP_CIPHER_CTX_free(ctx);
+}
+
+//############################################################################
+// kmyth_cipher_into_alloc
+//############################################################################
+int kmyth_cipher_into_alloc(cipher_into into_fn,
+                            kmyth_cipher_ctx * cipher_ctx,
+                            unsigned char *key,
+                            size_t key_len,
+                            unsigned char *inData,
+                            size_t inData_len,
+                            unsigned char **outData, size_t * outData_len)
+{
+  if (into_fn == NULL || outData == NULL || outData_len == NULL)
+  {
+    return 1;
+  }
+
+  // size the output buffer with a length query
+  size_t buf_len = 0;
+
+  if (into_fn(cipher_ctx, NULL, 0, inData, inData_len, NULL, &buf_len))
+  {
+    return 1;
+  }
+
+  // malloc() of zero bytes may return NULL, so always ask for at least one
+  unsigned char *buf = malloc(buf_len > 0 ? buf_len : 1);
+
+  if (buf == NULL)
+  {
+    return 1;
+  }
+  kmyth_advise_huge_pages(buf, buf_len);
+
+  size_t out_len = buf_len;
+
+  if (into_fn(cipher_ctx, key, key_len, inData, inData_len, buf, &out_len))
+  {
+    kmyth_clear_and_free(buf, buf_len);
+    return 1;
+  }
+
+  *outData = buf;
+  *outData_len = out_len;
+
+  return 0;
+}
@@ -0,0 +1,161 @@
+/**
+ * @file  random_pool.c
+ *
+ * @brief Implements the per-thread random pool for Kmyth.
+ */
+
+#include "cipher/random_pool.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/rand.h>
+
+#include "memory_util.h"
+
+/**
+ * A thread's pool: the bytes of block from offset 'used' on have not been
+ * handed out yet (those before it have been, and are cleared).
+ */
+typedef struct random_pool
+{
+  unsigned char block[RANDOM_POOL_BLOCK_LEN];
+  size_t used;                  // bytes of block already handed out
+  unsigned long generation;     // pool_generation the block was made in
+} random_pool;
+
+static pthread_key_t pool_key;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+// Incremented in a child process after fork(), so that the child does not
+// hand out the same bytes as its parent from a copy of the parent's pools
+static unsigned long pool_generation = 1;
+
+//############################################################################
+// pool_atfork_child()
+//############################################################################
+static void pool_atfork_child(void)
+{
+  __atomic_add_fetch(&pool_generation, 1, __ATOMIC_RELAXED);
+}
+
+//############################################################################
+// free_pool()
+//############################################################################
+static void free_pool(void *arg)
+{
+  kmyth_clear_and_free(arg, sizeof(random_pool));
+}
+
+//############################################################################
+// create_pool_key()
+//############################################################################
+static void create_pool_key(void)
+{
+  pthread_key_create(&pool_key, free_pool);
+  pthread_atfork(NULL, NULL, pool_atfork_child);
+}
+
+//############################################################################
+// get_pool()
+//   - returns the calling thread's pool (NULL if it cannot be allocated)
+//############################################################################
+static random_pool *get_pool(void)
+{
+  pthread_once(&pool_once, create_pool_key);
+
+  unsigned long generation = __atomic_load_n(&pool_generation,
+                                             __ATOMIC_RELAXED);
+  random_pool *pool = pthread_getspecific(pool_key);
+
+  if (pool == NULL)
+  {
+    pool = malloc(sizeof(random_pool));
+    if (pool == NULL)
+    {
+      return NULL;
+    }
+    if (pthread_setspecific(pool_key, pool) != 0)
+    {
+      free(pool);
+      return NULL;
+    }
+    pool->used = RANDOM_POOL_BLOCK_LEN;
+    pool->generation = generation;
+  }
+
+  // a block inherited from the parent process is discarded unused
+  if (pool->generation != generation)
+  {
+    kmyth_clear(pool->block, RANDOM_POOL_BLOCK_LEN);
+    pool->used = RANDOM_POOL_BLOCK_LEN;
+    pool->generation = generation;
+  }
+
+  return pool;
+}
+
+//############################################################################
+// random_pool_bytes()
+//############################################################################
+int random_pool_bytes(unsigned char *buf, size_t len)
+{
+  if (len == 0)
+  {
+    return 0;
+  }
+  if (buf == NULL)
+  {
+    return 1;
+  }
+
+  random_pool *pool = NULL;
+
+  if (len <= RANDOM_POOL_MAX_REQUEST)
+  {
+    pool = get_pool();
+  }
+
+  // large requests (and any when a pool is not available) are served by
+  // the DRBG directly
+  if (pool == NULL)
+  {
+    return (len <= INT_MAX && RAND_bytes(buf, (int) len) == 1) ? 0 : 1;
+  }
+
+  if (RANDOM_POOL_BLOCK_LEN - pool->used < len)
+  {
+    if (RAND_bytes(pool->block, RANDOM_POOL_BLOCK_LEN) != 1)
+    {
+      kmyth_clear(pool->block, RANDOM_POOL_BLOCK_LEN);
+      pool->used = RANDOM_POOL_BLOCK_LEN;
+      return 1;
+    }
+    pool->used = 0;
+  }
+
+  memcpy(buf, pool->block + pool->used, len);
+  kmyth_clear(pool->block + pool->used, len);
+  pool->used += len;
+
+  return 0;
+}
+
+//############################################################################
+// random_pool_discard()
+//############################################################################
+void random_pool_discard(void)
+{
+  pthread_once(&pool_once, create_pool_key);
+
+  random_pool *pool = pthread_getspecific(pool_key);
+
+  if (pool == NULL)
+  {
+    return;
+  }
+  pthread_setspecific(pool_key, NULL);
+  free_pool(pool);
+}
@@ -8,17 +8,31 @@
  */
 
 #include <getopt.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include <kmip/kmip.h>
 #include <openssl/bio.h>
 #include <openssl/ssl.h>
 
+#include "config_file.h"
 #include "defines.h"
 #include "file_io.h"
+#include "kmip_util.h"
 #include "kmyth.h"
 #include "kmyth_log.h"
 #include "memory_util.h"
+#include "timing_util.h"
 #include "tls_util.h"
+#include "tpm/pcrs.h"
+#include "tpm/storage_key_tools.h"
+#include "tpm/tpm2_interface.h"
+#include "tpm/tpm2_trace.h"
+
+static void print_timings(void)
+{
+  kmyth_timings_print(stderr);
+}
 
 static void usage(const char *prog)
 {
@@ -33,16 +47,51 @@ static void usage(const char *prog)
           "                        Defaults to 'simple'.\n"
           "  -s or --server        Path to file containing the certificate\n"
           "                        for the CA that issued the server cert.\n"
-          "  -c or --conn_addr     The ip_address:port for the TLS connection.\n"
-          "  -m or --message       An optional message to send the key server.\n\n"
+          "  -c or --conn_addr     The ip_address:port for the TLS connection. May be given more\n"
+          "                        than once for replicated key servers: they are raced, and the\n"
+          "                        first to answer is used.\n"
+          "  -C or --conn_timeout  Time (in milliseconds) allowed to connect to a key server.\n"
+          "                        Defaults to %d.\n"
+          "  -H or --tls_timeout   Time (in milliseconds) allowed for the TLS handshake.\n"
+          "                        Defaults to %d.\n"
+          "  -m or --message       An optional message to send the key server. For a\n"
+          "                        'kmip' server, this is the ID of the key, and may be\n"
+          "                        given more than once to retrieve several keys in one\n"
+          "                        batched request.\n"
+          "  -S or --session_cache Path to a file in which TLS sessions are cached,\n"
+          "                        so later runs can resume them instead of making\n"
+          "                        a full handshake with the key server.\n"
+          "  -x or --ktls          Use kernel TLS (kTLS) once connected, so the kernel encrypts and\n"
+          "                        decrypts the TLS records. Falls back to OpenSSL if the kernel or\n"
+          "                        the negotiated cipher does not support it.\n\n"
           "Output Parameters --\n"
-          "  -o or --output        Output file path to write the key. If none is selected, key will be sent to stdout.\n\n"
+          "  -o or --output        Output file path to write the key. If none is selected, key will be sent to stdout.\n"
+          "                        When retrieving several keys, give one output path per key,\n"
+          "                        in the same order as the key IDs.\n"
+          "  -k or --seal          Seal each key retrieved (as kmyth-seal would) and write only the\n"
+          "                        resulting .ski data, so the key is never written out in the clear.\n"
+          "                        It is sealed with the -a and -w authorizations below.\n"
+          "  -p or --pcrs_list     List of TPM platform configuration registers (PCRs) to apply to the\n"
+          "                        authorization policy of each key sealed with -k. Defaults to no PCRs\n"
+          "                        specified. Encapsulate in quotes (e.g. \"0, 1, 2\").\n\n"
           "Sealed Key Parameters --\n"
           "  -a or --auth_string   String used to create 'authVal' digest. Defaults to empty string (all-zero digest)\n"
           "  -w or --owner_auth    TPM 2.0 storage (owner) hierarchy authorization. Defaults to emptyAuth to match TPM default.\n\n"
           "Misc --\n"
+          "  -T or --timings       Print the time spent in each phase (e.g., unsealing, networking) to stderr.\n"
+          "  -E or --tpm_trace     Write each TPM command (code, duration, response code, sessions) to this\n"
+          "                        file, in the Chrome trace-event format.\n"
+          "  -K or --srk_handle    Persistent handle expected to hold the storage root key (SRK).\n"
+          "                        Defaults to $KMYTH_SRK_HANDLE, if set, else the handle last recorded in\n"
+          "                        '" KMYTH_SRK_STATE_FILE "'.\n"
+          "  -R or --tcti          TPM transport (TCTI) configuration, e.g. 'device:/dev/tpmrm0' for the\n"
+          "                        kernel resource manager or 'mssim' for a simulator. Defaults to\n"
+          "                        $KMYTH_TCTI, if set, else tpm2-abrmd.\n"
+          "  -e or --param_enc     Encrypt the wrapping key as it is returned by the TPM (TPM parameter\n"
+          "                        encryption). Defaults to on if $KMYTH_TPM_PARAM_ENC is set.\n"
           "  -v or --verbose       Detailed logging mode to help with debugging.\n"
-          "  -h or --help          Help (displays this usage).\n\n", prog);
+          "  -h or --help          Help (displays this usage).\n\n", prog,
+          KMYTH_CONNECT_TIMEOUT_MS, KMYTH_HANDSHAKE_TIMEOUT_MS);
 }
 
 int check_string_arg(const char *arg, size_t arg_len,
@@ -63,13 +112,24 @@ const struct option longopts[] = {
   {"type", no_argument, 0, 't'},
   {"server", required_argument, 0, 's'},
   {"conn_addr", required_argument, 0, 'c'},
+  {"conn_timeout", required_argument, 0, 'C'},
+  {"tls_timeout", required_argument, 0, 'H'},
   {"message", required_argument, 0, 'm'},
+  {"session_cache", required_argument, 0, 'S'},
+  {"ktls", no_argument, 0, 'x'},
   // Output info
   {"output", required_argument, 0, 'o'},
+  {"seal", no_argument, 0, 'k'},
+  {"pcrs_list", required_argument, 0, 'p'},
   // Sealed Key info
   {"auth_string", required_argument, 0, 'a'},
   {"owner_auth", required_argument, 0, 'w'},
   // Misc
+  {"timings", no_argument, 0, 'T'},
+  {"tpm_trace", required_argument, 0, 'E'},
+  {"srk_handle", required_argument, 0, 'K'},
+  {"tcti", required_argument, 0, 'R'},
+  {"param_enc", no_argument, 0, 'e'},
   {"verbose", no_argument, 0, 'v'},
   {"help", no_argument, 0, 'h'},
   {0, 0, 0, 0}
@@ -89,22 +149,38 @@ int main(int argc, char **argv)
   set_app_version(KMYTH_VERSION);
   set_applog_path(KMYTH_APPLOG_PATH);
 
+  // Apply the options configured for this tool in the Kmyth configuration
+  // file, ahead of (so they are overridden by) the command line options
+  if (kmyth_config_apply(longopts, &argc, &argv))
+  {
+    return 1;
+  }
+
   // Info passed through command line inputs
   char *inPath = NULL;
-  char *outPath = NULL;
+  char *outPaths[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  size_t outPathCount = 0;
   char *clientCertPath = NULL;
   char *serverType = "simple";
   char *serverCertPath = NULL;
-  char *address = NULL;
-  char *message = NULL;
+  char *addresses[KMYTH_MAX_SERVER_ENDPOINTS] = { 0 };
+  size_t addressCount = 0;
+  int connectTimeout = KMYTH_CONNECT_TIMEOUT_MS;
+  int handshakeTimeout = KMYTH_HANDSHAKE_TIMEOUT_MS;
+  char *messages[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  size_t messageCount = 0;
+  char *sessionCachePath = NULL;
+  bool useKtls = false;
   char *authString = NULL;
   char *ownerAuthPasswd = "";
+  bool sealOutput = false;
+  char *pcrsString = NULL;
 
   int options;
   int option_index;
 
   while ((options =
-          getopt_long(argc, argv, "i:l:t:s:c:m:o:a:w:vh", longopts,
+          getopt_long(argc, argv, "i:l:t:s:c:C:H:m:S:xo:kp:a:w:E:K:R:eTvh", longopts,
                       &option_index)) != -1)
     switch (options)
     {
@@ -124,15 +200,51 @@ int main(int argc, char **argv)
       serverCertPath = optarg;
       break;
     case 'c':
-      address = optarg;
+      if (addressCount == KMYTH_MAX_SERVER_ENDPOINTS)
+      {
+        kmyth_log(LOG_ERR, "more than %d server addresses ... exiting",
+                  KMYTH_MAX_SERVER_ENDPOINTS);
+        return 1;
+      }
+      addresses[addressCount++] = optarg;
+      break;
+    case 'C':
+      connectTimeout = atoi(optarg);
+      break;
+    case 'H':
+      handshakeTimeout = atoi(optarg);
       break;
     case 'm':
-      message = optarg;
+      if (messageCount == KMIP_GET_BATCH_MAX_ITEMS)
+      {
+        kmyth_log(LOG_ERR, "more than %d key IDs ... exiting",
+                  KMIP_GET_BATCH_MAX_ITEMS);
+        return 1;
+      }
+      messages[messageCount++] = optarg;
+      break;
+    case 'S':
+      sessionCachePath = optarg;
+      break;
+    case 'x':
+      useKtls = true;
       break;
 
       // Output info
     case 'o':
-      outPath = optarg;
+      if (outPathCount == KMIP_GET_BATCH_MAX_ITEMS)
+      {
+        kmyth_log(LOG_ERR, "more than %d output paths ... exiting",
+                  KMIP_GET_BATCH_MAX_ITEMS);
+        return 1;
+      }
+      outPaths[outPathCount++] = optarg;
+      break;
+    case 'k':
+      sealOutput = true;
+      break;
+    case 'p':
+      pcrsString = optarg;
       break;
 
       // Sealed Key info
@@ -144,6 +256,32 @@ int main(int argc, char **argv)
       break;
 
       // Misc
+    case 'T':
+      kmyth_timings_enable(true);
+      atexit(print_timings);
+      break;
+    case 'E':
+      if (tpm2_trace_open(optarg))
+      {
+        return 1;
+      }
+      atexit(tpm2_trace_close);
+      break;
+    case 'K':
+      if (set_srk_handle(optarg))
+      {
+        return 1;
+      }
+      break;
+    case 'R':
+      if (set_tcti_config(optarg))
+      {
+        return 1;
+      }
+      break;
+    case 'e':
+      setenv(KMYTH_TPM_PARAM_ENC_ENV, "1", 1);
+      break;
     case 'v':
       // always display all log messages (severity threshold = LOG_DEBUG)
       // to stdout or stderr (output mode = 0)
@@ -184,18 +322,37 @@ int main(int argc, char **argv)
     kmyth_clear(ownerAuthPasswd, oa_passwd_len);
     return 1;
   }
-  if (address == NULL)
+  if (addressCount == 0)
   {
     kmyth_log(LOG_ERR, "server address not specified ... exiting");
     kmyth_clear(authString, auth_string_len);
     kmyth_clear(ownerAuthPasswd, oa_passwd_len);
     return 1;
   }
+  if (connectTimeout <= 0 || handshakeTimeout <= 0)
+  {
+    kmyth_log(LOG_ERR, "invalid connection timeout ... exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
+
+  // Each key retrieved is written to its own output, if outputs are given
+  size_t keyCount = (messageCount > 1) ? messageCount : 1;
 
-  // If configured to write to an output file, verify that path
-  if (outPath != NULL)
+  if (outPathCount > 0 && outPathCount != keyCount)
   {
-    if (verifyOutputFilePath(outPath))
+    kmyth_log(LOG_ERR, "%zu output paths given for %zu keys ... exiting",
+              outPathCount, keyCount);
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
+
+  // If configured to write to output files, verify those paths
+  for (size_t i = 0; i < outPathCount; i++)
+  {
+    if (verifyOutputFilePath(outPaths[i]))
     {
       kmyth_log(LOG_ERR, "error verifying output path ... exiting");
       kmyth_clear(authString, auth_string_len);
@@ -214,6 +371,14 @@ int main(int argc, char **argv)
     kmyth_clear(ownerAuthPasswd, strlen(ownerAuthPasswd));
     return 1;
   }
+  if (messageCount > 1
+      && !check_string_arg(serverType, serverTypeLen, "kmip", strlen("kmip")))
+  {
+    kmyth_log(LOG_ERR, "multiple key IDs need a 'kmip' key server ... exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
 
   // Validate user-specified input paths
   if (verifyInputFilePath(inPath))
@@ -238,7 +403,29 @@ int main(int argc, char **argv)
     return 1;
   }
 
+  // Parse the PCR selection the retrieved key(s) will be sealed to
+  int *pcrs = NULL;
+  int pcrs_len = 0;
+
+  if (pcrsString != NULL && !sealOutput)
+  {
+    kmyth_log(LOG_ERR, "PCRs (-p) only apply to sealed output (-k) ... "
+              "exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
+  if (sealOutput && parse_pcrs_string(pcrsString, &pcrs, &pcrs_len) != 0)
+  {
+    kmyth_log(LOG_ERR, "failed to parse PCR string %s ... exiting",
+              pcrsString);
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
+
   // Compute size of user-specified optional message parameter
+  char *message = messages[0];
   size_t message_length = 0;
 
   if (message != NULL)
@@ -261,99 +448,161 @@ int main(int argc, char **argv)
     free(sdo_orig_fn);
     kmyth_clear(authString, auth_string_len);
     kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    free(pcrs);
     return 1;
   }
 
   free(sdo_orig_fn);
 
-  // We no longer need authString and ownerAuthPasswd, so clear them
-  kmyth_clear(authString, auth_string_len);
-  kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+  // Unless they are needed to seal the key(s) retrieved, we no longer need
+  // authString and ownerAuthPasswd, so clear them
+  if (!sealOutput)
+  {
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+  }
 
-  // Create TLS connection to the key server, using the CAPK
-  BIO *bio = NULL;
-  SSL_CTX *ctx = NULL;
+  // Split each server address into its IP and trailing port portions
+  const char *ports[KMYTH_MAX_SERVER_ENDPOINTS] = { 0 };
 
-  if (create_tls_connection(&address,
-                            clientPrivateKey_data,
-                            clientPrivateKey_size,
-                            clientCertPath, serverCertPath, &bio, &ctx) == 1)
+  for (size_t i = 0; i < addressCount; i++)
+  {
+    char *port = strrchr(addresses[i], ':');
+
+    if (port == NULL)
+    {
+      kmyth_log(LOG_ERR, "null port (%s) ... exiting", addresses[i]);
+      kmyth_clear_and_free(clientPrivateKey_data, clientPrivateKey_size);
+      kmyth_clear(authString, auth_string_len);
+      kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+      free(pcrs);
+      return 1;
+    }
+    *port = '\0';
+    ports[i] = port + 1;
+  }
+
+  // Create TLS connection to the first key server to answer, using the
+  // CAPK and resuming a cached TLS session with it if there is one
+  tls_client *client = NULL;
+  BIO *bio = NULL;
+  size_t serverIndex = 0;
+  uint64_t timer = kmyth_timer_begin();
+
+  if (tls_client_new(clientPrivateKey_data, clientPrivateKey_size,
+                     clientCertPath, serverCertPath, sessionCachePath,
+                     &client)
+      || tls_client_set_timeouts(client, connectTimeout, handshakeTimeout)
+      || tls_client_set_ktls(client, useKtls)
+      || tls_client_connect_any(client, (const char **) addresses, ports,
+                                addressCount, &bio, &serverIndex))
   {
     kmyth_log(LOG_ERR, "error creating TLS connection ... exiting");
-    BIO_ssl_shutdown(bio);
+    tls_client_free(&client);
     tls_cleanup();
-    BIO_free_all(bio);
-    SSL_CTX_free(ctx);
     kmyth_clear_and_free(clientPrivateKey_data, clientPrivateKey_size);
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    free(pcrs);
     return 1;
   }
 
   // Done with unsealed key buffer, so clear and free this memory
   kmyth_clear_and_free(clientPrivateKey_data, clientPrivateKey_size);
 
-  // Now that we have a secure connection to the key server, retrieve the key
-  size_t key_size = 0;
-  unsigned char *key = NULL;
+  // Now that we have a secure connection to the key server, retrieve the
+  // key(s): several KMIP keys are requested as one batch, in one round trip
+  size_t key_sizes[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  unsigned char *keys[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
 
   int server_result = 1;
 
-  if (check_string_arg(serverType, serverTypeLen, "kmip", strlen("kmip")))
+  if (messageCount > 1)
+  {
+    server_result = get_keys_from_kmip_server(bio, messages, messageCount,
+                                              keys, key_sizes);
+  }
+  else if (check_string_arg(serverType, serverTypeLen, "kmip", strlen("kmip")))
   {
     server_result = get_key_from_kmip_server(bio,
                                              message, message_length,
-                                             &key, &key_size);
+                                             &keys[0], &key_sizes[0]);
   }
   else
   {
     // The "simple" key server is the default.
     server_result = get_key_from_tls_server(bio,
                                             message, message_length,
-                                            &key, &key_size);
+                                            &keys[0], &key_sizes[0]);
   }
 
   if (server_result)
   {
     kmyth_log(LOG_ERR, "error obtaining key from server ... exiting");
-    BIO_ssl_shutdown(bio);
+    tls_client_free(&client);
     tls_cleanup();
-    if (BIO_reset(bio) != 0)
+    for (size_t i = 0; i < keyCount; i++)
     {
-      kmyth_log(LOG_ERR, "error resetting TLS BIO");
+      kmyth_clear_and_free(keys[i], key_sizes[i]);
     }
-    BIO_free_all(bio);
-    SSL_CTX_free(ctx);
-    kmyth_clear_and_free(key, key_size);
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    free(pcrs);
     return 1;
   }
+  kmyth_timer_end(KMYTH_PHASE_NETWORK, timer);
 
-  if (outPath == NULL)
+  int retval = 0;
+
+  timer = kmyth_timer_begin();
+  for (size_t i = 0; i < keyCount; i++)
   {
-    if (print_to_stdout(key, key_size) != 0)
+    char *outPath = (outPathCount == 0) ? NULL : outPaths[i];
+
+    // With -k, the key is sealed in memory and only the .ski data is
+    // written, so the key itself never reaches the output in the clear
+    if (sealOutput)
     {
-      kmyth_log(LOG_ERR, "error printing to stdout ... exiting");
+      if (tpm2_kmyth_seal_to_file(keys[i], key_sizes[i], outPath,
+                                  (uint8_t *) authString, auth_string_len,
+                                  (uint8_t *) ownerAuthPasswd, oa_passwd_len,
+                                  pcrs, pcrs_len, NULL))
+      {
+        kmyth_log(LOG_ERR, "error sealing key %zu", i + 1);
+        retval = 1;
+      }
     }
-  }
-  else
-  {
-    if (write_bytes_to_file(outPath, key, key_size))
+    else if (outPath == NULL)
+    {
+      if (print_to_stdout(keys[i], key_sizes[i]) != 0)
+      {
+        kmyth_log(LOG_ERR, "error printing to stdout ... exiting");
+        retval = 1;
+      }
+    }
+    else
     {
-      kmyth_log(LOG_ERR, "Error writing file: %s", outPath);
+      if (write_bytes_to_file(outPath, keys[i], key_sizes[i]))
+      {
+        kmyth_log(LOG_ERR, "Error writing file: %s", outPath);
+        retval = 1;
+      }
     }
+
+    // Done with memory holding key, clear and free it
+    kmyth_clear_and_free(keys[i], key_sizes[i]);
   }
+  kmyth_timer_end(KMYTH_PHASE_FILE_IO, timer);
 
-  // Done with memory holding key, clear and free it
-  kmyth_clear_and_free(key, key_size);
+  kmyth_clear(authString, auth_string_len);
+  kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+  free(pcrs);
 
-  kmyth_log(LOG_INFO, "retrieved key from %s", address);
+  kmyth_log(LOG_INFO, "retrieved %zu key(s) from %s", keyCount,
+            addresses[serverIndex]);
 
-  // Cleanup TLS connection
-  BIO_ssl_shutdown(bio);
-  if (BIO_reset(bio) != 0)
-  {
-    kmyth_log(LOG_ERR, "error resetting TLS BIO");
-  }
-  BIO_free_all(bio);
-  SSL_CTX_free(ctx);
+  // Cleanup TLS connection, saving the TLS sessions to the cache file
+  tls_client_free(&client);
 
-  return 0;
+  return retval;
 }
@@ -27,6 +27,9 @@ static void usage(const char *prog)
           "  -i or --ip    The IP address or hostname of the server.\n"
           "  -p or --port  The port number to connect to.\n"
           "  -u or --pub  Path to the file containing the server's public key.\n"
+          "Protocol --\n"
+          "  -P or --protocol  Session key protocol: 'rsa' (default; RSA keys)\n"
+          "                    or 'ecdh' (P-256 ECDH/ECDSA; EC keys).\n"
           "Misc --\n" "  -h or --help  Help (displays this usage).\n\n", prog);
 }
 
@@ -47,6 +50,8 @@ const struct option longopts[] = {
   {"ip", required_argument, 0, 'i'},
   {"port", required_argument, 0, 'p'},
   {"pub", required_argument, 0, 'u'},
+  // Protocol
+  {"protocol", required_argument, 0, 'P'},
   // Misc
   {"help", no_argument, 0, 'h'},
   {0, 0, 0, 0}
@@ -65,12 +70,13 @@ int main(int argc, char **argv)
   char *ip = NULL;
   char *port = NULL;
   char *cert = NULL;
+  nsl_protocol protocol = NSL_PROTOCOL_RSA;
 
   int options;
   int option_index;
 
   while ((options =
-          getopt_long(argc, argv, "r:i:p:u:h", longopts, &option_index)) != -1)
+          getopt_long(argc, argv, "r:i:p:u:P:h", longopts, &option_index)) != -1)
   {
     switch (options)
     {
@@ -88,6 +94,22 @@ int main(int argc, char **argv)
     case 'u':
       cert = optarg;
       break;
+      // Protocol
+    case 'P':
+      if (check_string_arg(optarg, strlen(optarg), "rsa", 3))
+      {
+        protocol = NSL_PROTOCOL_RSA;
+      }
+      else if (check_string_arg(optarg, strlen(optarg), "ecdh", 4))
+      {
+        protocol = NSL_PROTOCOL_ECDH;
+      }
+      else
+      {
+        kmyth_log(LOG_ERR, "Invalid protocol: %s", optarg);
+        return 1;
+      }
+      break;
       // Misc
     case 'h':
       usage(argv[0]);
@@ -110,20 +132,12 @@ int main(int argc, char **argv)
   }
 
   // Load public/private keys; create EVP contexts
-  EVP_PKEY_CTX *public_key_ctx = setup_public_evp_context(cert);
-
-  if (NULL == public_key_ctx)
-  {
-    kmyth_log(LOG_ERR, "Failed to setup public EVP context.");
-    close(socket_fd);
-    return 1;
-  }
-  EVP_PKEY_CTX *private_key_ctx = setup_private_evp_context(key);
+  nsl_endpoint endpoint;
 
-  if (NULL == private_key_ctx)
+  if (nsl_endpoint_init(&endpoint, protocol, cert, key,
+                        (unsigned char *) "A\0", 2))
   {
-    kmyth_log(LOG_ERR, "Failed to setup the private EVP context.");
-    EVP_PKEY_CTX_free(public_key_ctx);
+    kmyth_log(LOG_ERR, "Failed to setup the NSL endpoint.");
     close(socket_fd);
     return 1;
   }
@@ -132,18 +146,13 @@ int main(int argc, char **argv)
   unsigned char *session_key = NULL;
   size_t session_key_len = 0;
 
-  unsigned char *id = (unsigned char *) "A\0";
-  size_t id_len = 2;
-
   unsigned char *remote_id = (unsigned char *) "B\0";
   size_t remote_id_len = 2;
 
-  result = negotiate_client_session_key(socket_fd,
-                                        public_key_ctx,
-                                        private_key_ctx,
-                                        id, id_len,
+  result = negotiate_client_session_key(socket_fd, &endpoint,
                                         remote_id, remote_id_len,
                                         &session_key, &session_key_len);
+  nsl_endpoint_cleanup(&endpoint);
   if (result)
   {
     kmyth_log(LOG_ERR, "Failed to negotiate the client session key.");
@@ -151,9 +160,6 @@ int main(int argc, char **argv)
     return 1;
   }
 
-  EVP_PKEY_CTX_free(public_key_ctx);
-  EVP_PKEY_CTX_free(private_key_ctx);
-
   // Request key K from B; encrypt message with S
   unsigned char *key_id = (unsigned char *) "1\0";
   size_t key_id_len = 2;
@@ -165,6 +171,7 @@ int main(int argc, char **argv)
                                          session_key, session_key_len,
                                          key_id, key_id_len,
                                          &retrieved_key, &retrieved_key_len);
+  kmyth_clear_and_free(session_key, session_key_len);
   if (result)
   {
     kmyth_log(LOG_ERR, "Failed to retrieve key: %.*s", key_id_len, key_id);
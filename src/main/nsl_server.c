@@ -1,4 +1,6 @@
+#include <errno.h>
 #include <getopt.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -7,10 +9,15 @@
 #include <kmip/kmip.h>
 
 #include "defines.h"
+#include "kmyth_metrics.h"
 #include "nsl_util.h"
 #include "socket_util.h"
 #include "kmip_io_util.h"
 #include "aes_gcm.h"
+#include "memory_util.h"
+
+// Pending connections queued while a session is being served.
+#define NSL_SERVER_LISTEN_BACKLOG 16
 
 static void usage(const char *prog)
 {
@@ -22,7 +29,14 @@ static void usage(const char *prog)
           "  -p or --port  The port number to connect to.\n"
           "Client Information --\n"
           "  -u or --pub  Path to the file containing the client's public key.\n"
-          "Misc --\n" "  -h or --help  Help (displays this usage).\n\n", prog);
+          "Protocol --\n"
+          "  -P or --protocol  Session key protocol: 'rsa' (default; RSA keys)\n"
+          "                    or 'ecdh' (P-256 ECDH/ECDSA; EC keys).\n"
+          "Misc --\n"
+          "  -n or --sessions  Number of sessions to serve before exiting\n"
+          "                    (default: 0, serve until killed).\n"
+          "  -M or --metrics   Serve metrics (Prometheus text format) on this local socket.\n"
+          "  -h or --help  Help (displays this usage).\n\n", prog);
 }
 
 int check_string_arg(const char *arg, size_t arg_len,
@@ -41,11 +55,59 @@ const struct option longopts[] = {
   {"port", required_argument, 0, 'p'},
   // Client info
   {"pub", required_argument, 0, 'u'},
+  // Protocol
+  {"protocol", required_argument, 0, 'P'},
   // Misc
+  {"sessions", required_argument, 0, 'n'},
+  {"metrics", required_argument, 0, 'M'},
   {"help", no_argument, 0, 'h'},
   {0, 0, 0, 0}
 };
 
+//
+// serve_session()
+//
+static int serve_session(int socket_fd, nsl_endpoint * endpoint,
+                         const char *protocol_label)
+{
+  // Conduct NSL to obtain a shared session key
+  unsigned char *session_key = NULL;
+  size_t session_key_len = 0;
+  uint64_t begin = kmyth_metrics_clock();
+
+  if (negotiate_server_session_key(socket_fd, endpoint,
+                                   &session_key, &session_key_len))
+  {
+    kmyth_log(LOG_ERR, "Failed to negotiate the server session key.");
+    return 1;
+  }
+  kmyth_metrics_observe_latency("kmyth_nsl_handshake_duration_seconds",
+                                protocol_label,
+                                "Time taken to negotiate an NSL session key.",
+                                begin);
+
+  // Send key K to A; encrypt message with S
+  uint8 static_key[16] = {
+    0xD3, 0x51, 0x91, 0x0F, 0x1D, 0x79, 0x34, 0xD6,
+    0xE2, 0xAE, 0x17, 0x57, 0x65, 0x64, 0xE2, 0xBC
+  };
+  kmyth_log(LOG_INFO, "Loaded symmetric key: 0x%02X..%02X", static_key[0],
+            static_key[15]);
+
+  int result = send_key_with_session_key(socket_fd,
+                                         session_key, session_key_len,
+                                         static_key, 16);
+
+  kmyth_clear_and_free(session_key, session_key_len);
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "Failed to send the static key.");
+    return 1;
+  }
+
+  return 0;
+}
+
 int main(int argc, char **argv)
 {
   // Exit early if there are no arguments.
@@ -58,12 +120,15 @@ int main(int argc, char **argv)
   char *key = NULL;
   char *port = NULL;
   char *cert = NULL;
+  nsl_protocol protocol = NSL_PROTOCOL_RSA;
+  unsigned long max_sessions = 0;
+  char *metrics_path = NULL;
 
   int options;
   int option_index;
 
   while ((options =
-          getopt_long(argc, argv, "r:p:u:h", longopts, &option_index)) != -1)
+          getopt_long(argc, argv, "r:p:u:P:n:M:h", longopts, &option_index)) != -1)
   {
     switch (options)
     {
@@ -78,7 +143,39 @@ int main(int argc, char **argv)
     case 'u':
       cert = optarg;
       break;
+      // Protocol
+    case 'P':
+      if (check_string_arg(optarg, strlen(optarg), "rsa", 3))
+      {
+        protocol = NSL_PROTOCOL_RSA;
+      }
+      else if (check_string_arg(optarg, strlen(optarg), "ecdh", 4))
+      {
+        protocol = NSL_PROTOCOL_ECDH;
+      }
+      else
+      {
+        kmyth_log(LOG_ERR, "Invalid protocol: %s", optarg);
+        return 1;
+      }
+      break;
       // Misc
+    case 'n':
+      {
+        char *end = NULL;
+
+        errno = 0;
+        max_sessions = strtoul(optarg, &end, 10);
+        if (errno || end == optarg || *end != '\0')
+        {
+          kmyth_log(LOG_ERR, "Invalid session count: %s", optarg);
+          return 1;
+        }
+      }
+      break;
+    case 'M':
+      metrics_path = optarg;
+      break;
     case 'h':
       usage(argv[0]);
       return 0;
@@ -89,96 +186,98 @@ int main(int argc, char **argv)
 
   set_applog_severity_threshold(LOG_INFO);
 
+  const char *protocol_label = (protocol == NSL_PROTOCOL_ECDH)
+    ? "protocol=\"ecdh\"" : "protocol=\"rsa\"";
+
+  // Load public/private keys and create the EVP contexts once; every
+  // session negotiated below reuses them.
+  nsl_endpoint endpoint;
+
+  if (nsl_endpoint_init(&endpoint, protocol, cert, key,
+                        (unsigned char *) "B\0", 2))
+  {
+    kmyth_log(LOG_ERR, "Failed to setup the NSL endpoint.");
+    return 1;
+  }
+
   // Create server socket
   kmyth_log(LOG_INFO, "Setting up server socket");
 
-  int listen_fd = -1, socket_fd = -1;
+  int listen_fd = -1;
   int result = setup_server_socket(port, &listen_fd);
 
   if (result)
   {
     kmyth_log(LOG_ERR, "Failed to setup server socket.");
+    nsl_endpoint_cleanup(&endpoint);
     return 1;
   }
 
-  if (listen(listen_fd, 1))
+  if (listen(listen_fd, NSL_SERVER_LISTEN_BACKLOG))
   {
     kmyth_log(LOG_ERR, "Socket listen failed.");
     close(listen_fd);
+    nsl_endpoint_cleanup(&endpoint);
     return 1;
   }
 
-  socket_fd = accept(listen_fd, NULL, NULL);
-  if (socket_fd == -1)
-  {
-    kmyth_log(LOG_ERR, "Socket accept failed.");
-    close(listen_fd);
-    return 1;
-  }
-
-  close(listen_fd);
-
-  // Load public/private keys; create EVP contexts
-  EVP_PKEY_CTX *public_key_ctx = setup_public_evp_context(cert);
+  // The metrics endpoint is optional: sessions are served without it
+  int metrics_fd = -1;
 
-  if (NULL == public_key_ctx)
+  if (metrics_path != NULL
+      && (setup_unix_server_socket(metrics_path, 0600, &metrics_fd)
+          || kmyth_metrics_serve(metrics_fd)))
   {
-    kmyth_log(LOG_ERR, "Failed to setup public EVP context.");
-    close(socket_fd);
-    return 1;
-  }
-  EVP_PKEY_CTX *private_key_ctx = setup_private_evp_context(key);
-
-  if (NULL == private_key_ctx)
-  {
-    kmyth_log(LOG_ERR, "Failed to setup the private EVP context.");
-    EVP_PKEY_CTX_free(public_key_ctx);
-    close(socket_fd);
-    return 1;
+    kmyth_log(LOG_WARNING, "Unable to serve metrics on %s.", metrics_path);
+    if (metrics_fd >= 0)
+    {
+      close(metrics_fd);
+      unlink(metrics_path);
+    }
+    metrics_path = NULL;
   }
 
-  // Conduct NSL to obtain a shared session key
-  unsigned char *id = (unsigned char *) "B\0";
-  size_t id_len = 2;
+  // Serve sessions one after another. A session that fails only ends
+  // that connection; the server goes on accepting new ones.
+  unsigned long served = 0;
 
-  unsigned char *session_key = NULL;
-  size_t session_key_len = 0;
+  while (max_sessions == 0 || served < max_sessions)
+  {
+    int socket_fd = accept(listen_fd, NULL, NULL);
 
-  result = negotiate_server_session_key(socket_fd,
-                                        public_key_ctx,
-                                        private_key_ctx,
-                                        id, id_len,
-                                        &session_key, &session_key_len);
+    if (socket_fd == -1)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+      {
+        continue;
+      }
+      kmyth_log(LOG_ERR, "Socket accept failed.");
+      result = 1;
+      break;
+    }
 
-  if (result)
-  {
-    kmyth_log(LOG_ERR, "Failed to negotiate the server session key.");
+    if (serve_session(socket_fd, &endpoint, protocol_label))
+    {
+      kmyth_log(LOG_WARNING, "NSL session failed.");
+      kmyth_metrics_count("kmyth_nsl_sessions_total", "result=\"error\"",
+                          "NSL sessions served.", 1);
+    }
+    else
+    {
+      kmyth_metrics_count("kmyth_nsl_sessions_total", "result=\"ok\"",
+                          "NSL sessions served.", 1);
+    }
     close(socket_fd);
-    return 1;
+    served++;
   }
 
-  EVP_PKEY_CTX_free(public_key_ctx);
-  EVP_PKEY_CTX_free(private_key_ctx);
-
-  // Send key K to A; encrypt message with S
-  uint8 static_key[16] = {
-    0xD3, 0x51, 0x91, 0x0F, 0x1D, 0x79, 0x34, 0xD6,
-    0xE2, 0xAE, 0x17, 0x57, 0x65, 0x64, 0xE2, 0xBC
-  };
-  kmyth_log(LOG_INFO, "Loaded symmetric key: 0x%02X..%02X", static_key[0],
-            static_key[15]);
-
-  result = send_key_with_session_key(socket_fd,
-                                     session_key, session_key_len,
-                                     static_key, 16);
-  if (result)
+  close(listen_fd);
+  if (metrics_path != NULL)
   {
-    kmyth_log(LOG_ERR, "Failed to send the static key.");
-    close(socket_fd);
-    return 1;
+    kmyth_metrics_stop();
+    unlink(metrics_path);
   }
+  nsl_endpoint_cleanup(&endpoint);
 
-  close(socket_fd);
-
-  return 0;
+  return result;
 }
@@ -3,20 +3,32 @@
  */
 
 #include <getopt.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <unistd.h>
 #include <sys/stat.h>
 
+#include "batch_io.h"
+#include "config_file.h"
 #include "defines.h"
 #include "file_io.h"
 #include "kmyth.h"
 #include "kmyth_log.h"
+#include "compression.h"
 #include "memory_util.h"
+#include "timing_util.h"
+#include "tpm/pcrs.h"
+#include "tpm/ski_store.h"
+#include "tpm/storage_key_tools.h"
+#include "tpm/tpm2_interface.h"
+#include "tpm/tpm2_trace.h"
 
 #include "cipher/cipher.h"
+#include "cipher/aes_gcm_stream.h"
 
 /**
  * @brief The external list of valid (implemented and configured) symmetric
@@ -25,118 +37,909 @@
 extern const cipher_t cipher_list[];
 
 //############################################################################
-// parse_pcrs_string()
+// seal_input_file()
 //############################################################################
-static int parse_pcrs_string(char *pcrs_string, int **pcrs, int *pcrs_len)
+static int seal_input_file(kmyth_tpm_context * ctx, char *path,
+                           uint8_t ** output, size_t * output_len,
+                           uint8_t * auth_bytes, size_t auth_bytes_len,
+                           int *pcrs, size_t pcrs_len, char *cipher_string)
 {
-  *pcrs_len = 0;
+  if (verifyInputFilePath(path))
+  {
+    kmyth_log(LOG_ERR, "input path (%s) is not valid ... exiting", path);
+    return 1;
+  }
+
+  uint8_t *data = NULL;
+  size_t data_len = 0;
 
-  if (pcrs_string == NULL)
+  if (map_bytes_from_file(path, &data, &data_len) || data_len == 0)
   {
-    return 0;
+    kmyth_log(LOG_ERR, "seal input data file read error ... exiting");
+    return 1;
+  }
+
+  int retval = kmyth_tpm_context_seal(ctx, data, data_len,
+                                      output, output_len,
+                                      auth_bytes, auth_bytes_len,
+                                      pcrs, pcrs_len, cipher_string);
+
+  unmap_bytes_from_file(data, data_len);
+  return retval;
+}
+
+//############################################################################
+// seal_stored_file()
+//
+// Seals an input file through a content-addressed .ski store, making the
+// output path an alias (link) of the stored .ski
+//############################################################################
+static int seal_stored_file(kmyth_tpm_context * ctx, char *path,
+                            const char *store_dir, char *out_path,
+                            uint8_t * auth_bytes, size_t auth_bytes_len,
+                            int *pcrs, size_t pcrs_len, char *cipher_string)
+{
+  if (verifyInputFilePath(path))
+  {
+    kmyth_log(LOG_ERR, "input path (%s) is not valid ... exiting", path);
+    return 1;
   }
 
-  kmyth_log(LOG_DEBUG, "parsing PCR selection string");
+  uint8_t *data = NULL;
+  size_t data_len = 0;
 
-  *pcrs = NULL;
-  *pcrs = malloc(24 * sizeof(int));
-  size_t pcrs_array_size = 24;
+  if (map_bytes_from_file(path, &data, &data_len) || data_len == 0)
+  {
+    kmyth_log(LOG_ERR, "seal input data file read error ... exiting");
+    return 1;
+  }
+
+  char *ski_path = NULL;
+  bool reused = false;
+  int retval = kmyth_tpm_context_seal_stored(ctx, store_dir, data, data_len,
+                                             &ski_path, &reused,
+                                             auth_bytes, auth_bytes_len,
+                                             pcrs, pcrs_len, cipher_string);
 
-  if (pcrs == NULL)
+  unmap_bytes_from_file(data, data_len);
+  if (retval)
   {
-    kmyth_log(LOG_ERR,
-              "failed to allocate memory to parse PCR string ... exiting");
     return 1;
   }
+  kmyth_log(LOG_DEBUG, "%s stored .ski %s", (reused) ? "reused" : "added",
+            ski_path);
 
-  char *pcrs_string_cur = pcrs_string;
-  char *pcrs_string_next = NULL;
+  uint64_t timer = kmyth_timer_begin();
+
+  retval = ski_store_link(ski_path, out_path);
+  kmyth_timer_end(KMYTH_PHASE_FILE_IO, timer);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error linking %s to stored .ski ... exiting",
+              out_path);
+  }
+  free(ski_path);
+  return retval;
+}
 
-  long pcrIndex;
+//############################################################################
+// seal_stream()
+//
+// Seals the input to the output as it is read, where either may be '-' for
+// stdin/stdout (e.g., 'pg_dump | kmyth-seal -i - -o -')
+//############################################################################
+static int seal_stream(kmyth_tpm_context * ctx, char *in_path, char *out_path,
+                       uint8_t * auth_bytes, size_t auth_bytes_len,
+                       int *pcrs, size_t pcrs_len, char *cipher_string)
+{
+  bool from_stdin = (strcmp(in_path, "-") == 0);
+  bool to_stdout = (strcmp(out_path, "-") == 0);
 
-  while (*pcrs_string_cur != '\0')
+  if (!from_stdin && verifyInputFilePath(in_path))
+  {
+    kmyth_log(LOG_ERR, "input path (%s) is not valid ... exiting", in_path);
+    return 1;
+  }
+  if (!to_stdout && verifyOutputFilePath(out_path))
   {
-    pcrIndex = strtol(pcrs_string_cur, &pcrs_string_next, 10);
+    kmyth_log(LOG_ERR, "output path (%s) is not valid ... exiting", out_path);
+    return 1;
+  }
 
-    // Check for overflow or underflow on the strtol call. There
-    // really shouldn't be, because the number of PCRs is small.
-    if ((pcrIndex == LONG_MIN) || (pcrIndex == LONG_MAX))
+  FILE *in = (from_stdin) ? stdin : fopen(in_path, "rb");
+
+  if (in == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to open input (%s) ... exiting", in_path);
+    return 1;
+  }
+
+  FILE *out = (to_stdout) ? stdout : fopen(out_path, "wb");
+
+  if (out == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to open output (%s) ... exiting", out_path);
+    if (!from_stdin)
     {
-      kmyth_log(LOG_ERR, "invalid PCR value specified ... exiting");
-      free(*pcrs);
-      *pcrs_len = 0;
-      return 1;
+      fclose(in);
     }
+    return 1;
+  }
+
+  int retval = kmyth_tpm_context_seal_stream(ctx, in, out,
+                                             auth_bytes, auth_bytes_len,
+                                             pcrs, pcrs_len, cipher_string);
+
+  if (!from_stdin)
+  {
+    fclose(in);
+  }
+  if (!to_stdout && fclose(out) != 0)
+  {
+    retval = 1;
+  }
 
-    // Check that strtol didn't fail to parse an integer, which is the only
-    // condition that would cause the pointers to match.
-    if (pcrs_string_cur == pcrs_string_next)
+  // a partially written .ski file is of no use
+  if (retval && !to_stdout)
+  {
+    remove(out_path);
+  }
+
+  return retval;
+}
+
+//############################################################################
+// seal_bundle_files()
+//############################################################################
+static int seal_bundle_files(kmyth_tpm_context * ctx,
+                             char **paths, size_t path_count,
+                             uint8_t ** output, size_t * output_len,
+                             uint8_t * auth_bytes, size_t auth_bytes_len,
+                             int *pcrs, size_t pcrs_len, char *cipher_string)
+{
+  uint8_t **data = calloc(path_count, sizeof(uint8_t *));
+  size_t *data_lens = calloc(path_count, sizeof(size_t));
+
+  if (data == NULL || data_lens == NULL)
+  {
+    kmyth_log(LOG_ERR, "failed to allocate bundle input arrays ... exiting");
+    free(data);
+    free(data_lens);
+    return 1;
+  }
+
+  int retval = 0;
+
+  for (size_t i = 0; i < path_count; i++)
+  {
+    if (verifyInputFilePath(paths[i]))
     {
-      kmyth_log(LOG_ERR, "error parsing PCR string ... exiting");
-      free(*pcrs);
-      *pcrs_len = 0;
-      return 1;
+      kmyth_log(LOG_ERR, "input path (%s) is not valid ... exiting", paths[i]);
+      retval = 1;
+      break;
+    }
+    if (map_bytes_from_file(paths[i], &data[i], &data_lens[i])
+        || data_lens[i] == 0)
+    {
+      kmyth_log(LOG_ERR, "error reading bundle input (%s) ... exiting",
+                paths[i]);
+      retval = 1;
+      break;
     }
+  }
+
+  if (retval == 0)
+  {
+    retval = kmyth_tpm_context_seal_bundle(ctx, data, data_lens, path_count,
+                                           output, output_len,
+                                           auth_bytes, auth_bytes_len,
+                                           pcrs, pcrs_len, cipher_string);
+  }
+
+  for (size_t i = 0; i < path_count; i++)
+  {
+    unmap_bytes_from_file(data[i], data_lens[i]);
+  }
+  free(data);
+  free(data_lens);
+  return retval;
+}
+
+//############################################################################
+// derive_ski_filename()
+//############################################################################
+static int derive_ski_filename(char *inPath, char **ski_name)
+{
+  // The default name is basename(inPath), with any leading '.'(s) removed
+  // and everything beyond the first remaining '.' treated as extension,
+  // with a .ski extension appended
+  char *original_fn = basename(inPath);
+
+  while (*original_fn == '.')
+  {
+    original_fn++;
+  }
+  size_t name_len = strcspn(original_fn, ".");
+
+  // Make sure resultant default file name does not have empty basename
+  if (name_len == 0)
+  {
+    kmyth_log(LOG_ERR, "invalid default filename derived ... exiting");
+    return 1;
+  }
+
+  *ski_name = malloc(name_len + 5);
+  if (*ski_name == NULL)
+  {
+    kmyth_log(LOG_ERR, "failed to allocate default filename ... exiting");
+    return 1;
+  }
+  memcpy(*ski_name, original_fn, name_len);
+  memcpy(*ski_name + name_len, ".ski", 5);
+
+  return 0;
+}
 
-    // Look at the first invalid character from the last call to strtol
-    // and confirm it's a blank, a comma, or '\0'. If not there's a disallowed
-    // character in the PCR string.
-    if (!isblank(*pcrs_string_next) && (*pcrs_string_next != ',')
-        && (*pcrs_string_next != '\0'))
+/**
+ * @brief Shared state of the worker threads sealing a list of input files,
+ *        each into its own .ski file
+ */
+typedef struct seal_jobs
+{
+  kmyth_tpm_context *ctx;
+  char **in_paths;
+  char **out_paths;
+  uint8_t *auth_bytes;
+  size_t auth_bytes_len;
+  int *pcrs;
+  size_t pcrs_len;
+  char *cipher_string;
+
+  // The inputs are sealed a window (of at most BATCH_IO_DEPTH inputs) at a
+  // time. The small inputs of a window are read together before it is
+  // sealed, and their outputs written together after; each entry below is
+  // indexed from the start of the window.
+  size_t first;
+  size_t end;
+  bool batched[BATCH_IO_DEPTH];
+  uint8_t *inputs[BATCH_IO_DEPTH];
+  size_t input_lens[BATCH_IO_DEPTH];
+  int read_results[BATCH_IO_DEPTH];
+  uint8_t *outputs[BATCH_IO_DEPTH];
+  size_t output_lens[BATCH_IO_DEPTH];
+
+  // next input index to be claimed by a worker, and the count of failed
+  // inputs, both guarded by lock
+  pthread_mutex_t lock;
+  size_t next;
+  size_t failed;
+} seal_jobs;
+
+//############################################################################
+// seal_worker()
+//############################################################################
+static void *seal_worker(void *arg)
+{
+  seal_jobs *jobs = (seal_jobs *) arg;
+
+  while (true)
+  {
+    pthread_mutex_lock(&jobs->lock);
+    size_t i = jobs->next++;
+
+    pthread_mutex_unlock(&jobs->lock);
+    if (i >= jobs->end)
     {
-      kmyth_log(LOG_ERR, "invalid character (%c) in PCR string ... exiting",
-                *pcrs_string_next);
-      free(*pcrs);
-      *pcrs_len = 0;
-      return 1;
+      break;
     }
 
-    // Step past the invalid characters, checking not to skip past the
-    // end of the string.
-    while ((*pcrs_string_next != '\0')
-           && (isblank(*pcrs_string_next) || (*pcrs_string_next == ',')))
+    // the AES and (un)marshalling of concurrent seals run in parallel, the
+    // TPM commands are serialized on the shared context's connection
+    size_t k = i - jobs->first;
+    uint8_t *output = NULL;
+    size_t output_len = 0;
+    int retval = 0;
+
+    if (jobs->batched[k])
     {
-      pcrs_string_next++;
+      if (jobs->read_results[k] || jobs->input_lens[k] == 0)
+      {
+        kmyth_log(LOG_ERR, "seal input data file read error ... exiting");
+        retval = 1;
+      }
+      else
+      {
+        retval = kmyth_tpm_context_seal(jobs->ctx, jobs->inputs[k],
+                                        jobs->input_lens[k],
+                                        &output, &output_len,
+                                        jobs->auth_bytes,
+                                        jobs->auth_bytes_len,
+                                        jobs->pcrs, jobs->pcrs_len,
+                                        jobs->cipher_string);
+      }
+
+      // written with the rest of the window (see seal_window_write())
+      if (retval == 0)
+      {
+        jobs->outputs[k] = output;
+        jobs->output_lens[k] = output_len;
+        continue;
+      }
     }
+    else
+    {
+      retval = seal_input_file(jobs->ctx, jobs->in_paths[i],
+                               &output, &output_len,
+                               jobs->auth_bytes, jobs->auth_bytes_len,
+                               jobs->pcrs, jobs->pcrs_len,
+                               jobs->cipher_string);
+      if (retval == 0)
+      {
+        retval = write_files_batch(&jobs->out_paths[i], &output,
+                                   &output_len, 1, true, NULL);
+      }
+    }
+    free(output);
 
-    if (*pcrs_len == pcrs_array_size)
+    if (retval)
     {
-      int *new_pcrs = NULL;
+      kmyth_log(LOG_ERR, "error sealing %s", jobs->in_paths[i]);
+      pthread_mutex_lock(&jobs->lock);
+      jobs->failed++;
+      pthread_mutex_unlock(&jobs->lock);
+    }
+    else
+    {
+      kmyth_log(LOG_DEBUG, "sealed %s to %s", jobs->in_paths[i],
+                jobs->out_paths[i]);
+    }
+  }
 
-      new_pcrs = realloc(*pcrs, pcrs_array_size * 2);
-      if (new_pcrs == NULL)
+  return NULL;
+}
+
+//############################################################################
+// seal_window_read()
+//
+// Reads the inputs of the current window that are small enough to be held
+// in memory with the rest of it, together. Larger ones (and any that cannot
+// be examined) are left to be mapped by the worker sealing them.
+//############################################################################
+static void seal_window_read(seal_jobs * jobs)
+{
+  char *paths[BATCH_IO_DEPTH];
+  size_t slots[BATCH_IO_DEPTH];
+  uint8_t *data[BATCH_IO_DEPTH];
+  size_t lengths[BATCH_IO_DEPTH];
+  int results[BATCH_IO_DEPTH];
+  size_t count = 0;
+
+  for (size_t i = jobs->first; i < jobs->end; i++)
+  {
+    size_t k = i - jobs->first;
+    struct stat st = { 0 };
+
+    jobs->batched[k] = (stat(jobs->in_paths[i], &st) == 0
+                        && S_ISREG(st.st_mode)
+                        && st.st_size <= KMYTH_BATCH_IO_MAX_INPUT_SIZE);
+    jobs->inputs[k] = NULL;
+    jobs->input_lens[k] = 0;
+    jobs->read_results[k] = 0;
+    jobs->outputs[k] = NULL;
+    jobs->output_lens[k] = 0;
+    if (jobs->batched[k])
+    {
+      paths[count] = jobs->in_paths[i];
+      slots[count++] = k;
+    }
+  }
+
+  // a failure to read one input is reported when it is sealed
+  read_files_batch(paths, count, data, lengths, results);
+  for (size_t j = 0; j < count; j++)
+  {
+    jobs->inputs[slots[j]] = data[j];
+    jobs->input_lens[slots[j]] = lengths[j];
+    jobs->read_results[slots[j]] = results[j];
+  }
+}
+
+//############################################################################
+// seal_window_write()
+//
+// Writes (and syncs) the outputs of the current window's batched inputs
+// together, then releases them
+//############################################################################
+static void seal_window_write(seal_jobs * jobs)
+{
+  char *paths[BATCH_IO_DEPTH];
+  uint8_t *bytes[BATCH_IO_DEPTH];
+  size_t lengths[BATCH_IO_DEPTH];
+  int results[BATCH_IO_DEPTH];
+  size_t slots[BATCH_IO_DEPTH];
+  size_t count = 0;
+
+  for (size_t k = 0; k < jobs->end - jobs->first; k++)
+  {
+    if (jobs->outputs[k] != NULL)
+    {
+      paths[count] = jobs->out_paths[jobs->first + k];
+      bytes[count] = jobs->outputs[k];
+      lengths[count] = jobs->output_lens[k];
+      slots[count++] = k;
+    }
+  }
+
+  write_files_batch(paths, bytes, lengths, count, true, results);
+  for (size_t j = 0; j < count; j++)
+  {
+    size_t i = jobs->first + slots[j];
+
+    if (results[j])
+    {
+      kmyth_log(LOG_ERR, "error sealing %s", jobs->in_paths[i]);
+      jobs->failed++;
+    }
+    else
+    {
+      kmyth_log(LOG_DEBUG, "sealed %s to %s", jobs->in_paths[i],
+                jobs->out_paths[i]);
+    }
+  }
+
+  // the inputs are plaintext secrets
+  for (size_t k = 0; k < jobs->end - jobs->first; k++)
+  {
+    kmyth_clear_and_free(jobs->inputs[k], jobs->input_lens[k]);
+    free(jobs->outputs[k]);
+    jobs->inputs[k] = NULL;
+    jobs->outputs[k] = NULL;
+  }
+}
+
+//############################################################################
+// seal_window()
+//
+// Seals the current window of inputs on job_count worker threads
+//############################################################################
+static void seal_window(seal_jobs * jobs, size_t job_count)
+{
+  if (job_count > jobs->end - jobs->first)
+  {
+    job_count = jobs->end - jobs->first;
+  }
+
+  pthread_t *workers = calloc(job_count, sizeof(pthread_t));
+  size_t started = 0;
+
+  seal_window_read(jobs);
+  jobs->next = jobs->first;
+  while (workers != NULL && started + 1 < job_count
+         && pthread_create(&workers[started], NULL, seal_worker, jobs) == 0)
+  {
+    started++;
+  }
+
+  // the calling thread is one of the job_count workers, so progress is
+  // made even if no other worker thread could be started
+  seal_worker(jobs);
+  for (size_t i = 0; i < started; i++)
+  {
+    pthread_join(workers[i], NULL);
+  }
+  free(workers);
+  seal_window_write(jobs);
+}
+
+//############################################################################
+// seal_multi_files()
+//############################################################################
+static int seal_multi_files(kmyth_tpm_context * ctx,
+                            char **paths, size_t path_count,
+                            char *out_dir, bool force, size_t job_count,
+                            uint8_t * auth_bytes, size_t auth_bytes_len,
+                            int *pcrs, size_t pcrs_len, char *cipher_string)
+{
+  seal_jobs jobs = {
+    .ctx = ctx,
+    .in_paths = paths,
+    .auth_bytes = auth_bytes,
+    .auth_bytes_len = auth_bytes_len,
+    .pcrs = pcrs,
+    .pcrs_len = pcrs_len,
+    .cipher_string = cipher_string,
+  };
+
+  jobs.out_paths = calloc(path_count, sizeof(char *));
+  if (jobs.out_paths == NULL)
+  {
+    kmyth_log(LOG_ERR, "failed to allocate output path list ... exiting");
+    return 1;
+  }
+
+  // Derive every output path up front, so that clashing outputs (e.g.,
+  // 'a.pem' and 'a.key' both map to 'a.ski') are refused before anything
+  // is sealed
+  int retval = 0;
+
+  for (size_t i = 0; i < path_count && retval == 0; i++)
+  {
+    char *ski_name = NULL;
+
+    if (derive_ski_filename(paths[i], &ski_name))
+    {
+      retval = 1;
+      break;
+    }
+
+    size_t out_path_len = strlen(out_dir) + strlen(ski_name) + 2;
+
+    jobs.out_paths[i] = malloc(out_path_len);
+    if (jobs.out_paths[i] == NULL)
+    {
+      kmyth_log(LOG_ERR, "failed to allocate output path ... exiting");
+      free(ski_name);
+      retval = 1;
+      break;
+    }
+    snprintf(jobs.out_paths[i], out_path_len, "%s/%s", out_dir, ski_name);
+    free(ski_name);
+
+    struct stat st = { 0 };
+    if (!stat(jobs.out_paths[i], &st) && !force)
+    {
+      kmyth_log(LOG_ERR, "output file (%s) already exists ... exiting",
+                jobs.out_paths[i]);
+      retval = 1;
+    }
+    for (size_t j = 0; j < i && retval == 0; j++)
+    {
+      if (strcmp(jobs.out_paths[i], jobs.out_paths[j]) == 0)
       {
-        kmyth_log(LOG_ERR, "Ran out of memory ... exiting");
-        free(*pcrs);
-        *pcrs_len = 0;
-        return 1;
+        kmyth_log(LOG_ERR, "inputs %s and %s both map to %s ... exiting",
+                  paths[j], paths[i], jobs.out_paths[i]);
+        retval = 1;
       }
-      *pcrs = new_pcrs;
-      pcrs_array_size *= 2;
     }
-    (*pcrs)[*pcrs_len] = (int) pcrIndex;
-    (*pcrs_len)++;
-    pcrs_string_cur = pcrs_string_next;
-    pcrs_string_next = NULL;
   }
 
+  if (retval == 0)
+  {
+    pthread_mutex_init(&jobs.lock, NULL);
+    for (jobs.first = 0; jobs.first < path_count; jobs.first = jobs.end)
+    {
+      jobs.end = jobs.first + BATCH_IO_DEPTH;
+      if (jobs.end > path_count)
+      {
+        jobs.end = path_count;
+      }
+      seal_window(&jobs, job_count);
+    }
+    pthread_mutex_destroy(&jobs.lock);
+
+    if (jobs.failed > 0)
+    {
+      kmyth_log(LOG_ERR, "failed to seal %zu of %zu input files",
+                jobs.failed, path_count);
+      retval = 1;
+    }
+  }
+
+  for (size_t i = 0; i < path_count; i++)
+  {
+    free(jobs.out_paths[i]);
+  }
+  free(jobs.out_paths);
+  return retval;
+}
+
+//############################################################################
+// fill_sk_pool()
+//############################################################################
+static int fill_sk_pool(char *pool_dir, size_t count, kmyth_sk_alg sk_alg,
+                        uint8_t * owner_auth, size_t owner_auth_len,
+                        uint8_t * auth_bytes, size_t auth_bytes_len,
+                        char *pcrs_string)
+{
+  if (pool_dir == NULL)
+  {
+    kmyth_log(LOG_ERR, "no SK pool (-P) specified ... exiting");
+    return 1;
+  }
+
+  int *pcrs = NULL;
+  int pcrs_len = 0;
+
+  if (parse_pcrs_string(pcrs_string, &pcrs, &pcrs_len) != 0)
+  {
+    kmyth_log(LOG_ERR, "failed to parse PCR string %s ... exiting",
+              pcrs_string);
+    return 1;
+  }
+
+  kmyth_tpm_context *ctx = NULL;
+  int retval = kmyth_tpm_context_open(owner_auth, owner_auth_len, &ctx);
+
+  if (retval == 0)
+  {
+    retval = kmyth_tpm_context_set_sk_alg(ctx, sk_alg);
+  }
+  if (retval == 0)
+  {
+    retval = kmyth_tpm_context_set_sk_pool(ctx, pool_dir);
+  }
+  if (retval == 0)
+  {
+    retval = kmyth_tpm_context_fill_sk_pool(ctx, auth_bytes, auth_bytes_len,
+                                            pcrs, pcrs_len, count);
+  }
+  kmyth_tpm_context_close(&ctx);
+  free(pcrs);
+
+  return retval;
+}
+
+//############################################################################
+// reseal_ski_files()
+//
+// Reseals existing .ski files under the -a authorization and -p PCRs, without
+// decrypting their data: a single .ski in place or into a new .ski file, a
+// list of them (-m or -d) in place, as a batch
+//############################################################################
+static int reseal_ski_files(char **paths, size_t path_count,
+                            char *in_path, char *out_path, size_t job_count,
+                            kmyth_sk_alg sk_alg,
+                            uint8_t * owner_auth, size_t owner_auth_len,
+                            uint8_t * old_auth_bytes, size_t old_auth_len,
+                            uint8_t * auth_bytes, size_t auth_bytes_len,
+                            char *pcrs_string)
+{
+  if (paths == NULL && (in_path == NULL || strcmp(in_path, "-") == 0))
+  {
+    kmyth_log(LOG_ERR, "no .ski file (-i) to reseal ... exiting");
+    return 1;
+  }
+  if (paths != NULL && out_path != NULL)
+  {
+    kmyth_log(LOG_ERR, "a batch of .ski files is resealed in place, without "
+              "-o ... exiting");
+    return 1;
+  }
+
+  int *pcrs = NULL;
+  int pcrs_len = 0;
+
+  if (parse_pcrs_string(pcrs_string, &pcrs, &pcrs_len) != 0)
+  {
+    kmyth_log(LOG_ERR, "failed to parse PCR string %s ... exiting",
+              pcrs_string);
+    return 1;
+  }
+
+  kmyth_tpm_context *ctx = NULL;
+  int retval = kmyth_tpm_context_open(owner_auth, owner_auth_len, &ctx);
+
+  if (retval == 0)
+  {
+    retval = kmyth_tpm_context_set_sk_alg(ctx, sk_alg);
+  }
+  if (retval == 0 && paths != NULL)
+  {
+    retval = kmyth_tpm_context_reseal_files(ctx, paths, path_count,
+                                            job_count,
+                                            old_auth_bytes, old_auth_len,
+                                            auth_bytes, auth_bytes_len,
+                                            pcrs, pcrs_len);
+  }
+  else if (retval == 0 && out_path == NULL)
+  {
+    retval = kmyth_tpm_context_reseal_file(ctx, in_path,
+                                           old_auth_bytes, old_auth_len,
+                                           auth_bytes, auth_bytes_len,
+                                           pcrs, pcrs_len);
+  }
+  else if (retval == 0)
+  {
+    uint8_t *ski_bytes = NULL;
+    size_t ski_bytes_len = 0;
+    uint8_t *output = NULL;
+    size_t output_length = 0;
+
+    retval = map_bytes_from_file(in_path, &ski_bytes, &ski_bytes_len);
+    if (retval == 0)
+    {
+      retval = kmyth_tpm_context_reseal(ctx, ski_bytes, ski_bytes_len,
+                                        &output, &output_length,
+                                        old_auth_bytes, old_auth_len,
+                                        auth_bytes, auth_bytes_len,
+                                        pcrs, pcrs_len);
+      unmap_bytes_from_file(ski_bytes, ski_bytes_len);
+    }
+    if (retval == 0)
+    {
+      retval = write_bytes_to_file(out_path, output, output_length);
+    }
+    free(output);
+  }
+  kmyth_tpm_context_close(&ctx);
+  free(pcrs);
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "failed to reseal .ski file(s) ... exiting");
+  }
+
+  return retval;
+}
+
+//############################################################################
+// parse_nv_index()
+//############################################################################
+static int parse_nv_index(char *str, uint32_t * nv_index)
+{
+  char *end = NULL;
+  unsigned long value = 0;
+
+  if (strcmp(str, "auto") != 0)
+  {
+    value = strtoul(str, &end, 0);
+    if (end == str || *end != '\0' || (value != 0
+                                       && (value < TPM2_NV_INDEX_FIRST
+                                           || value > TPM2_NV_INDEX_LAST)))
+    {
+      kmyth_log(LOG_ERR, "invalid NV index (%s) ... exiting", str);
+      return 1;
+    }
+  }
+  *nv_index = (uint32_t) value;
+
   return 0;
 }
 
+//############################################################################
+// seal_nv_index()
+//
+// Seals the input file into a TPM NV index (the first free one if 'auto'),
+// printing the index to stdout, or undefines a previously sealed index
+//############################################################################
+static int seal_nv_index(char *in_path, char *nv_index_string, bool undefine,
+                         uint8_t * owner_auth, size_t owner_auth_len,
+                         uint8_t * auth_bytes, size_t auth_bytes_len,
+                         char *pcrs_string)
+{
+  uint32_t nv_index = 0;
+
+  if (parse_nv_index(nv_index_string, &nv_index))
+  {
+    return 1;
+  }
+  if (undefine && nv_index == 0)
+  {
+    kmyth_log(LOG_ERR, "no NV index to undefine ... exiting");
+    return 1;
+  }
+  if (!undefine && (in_path == NULL || verifyInputFilePath(in_path)))
+  {
+    kmyth_log(LOG_ERR, "input path (%s) is not valid ... exiting", in_path);
+    return 1;
+  }
+
+  int *pcrs = NULL;
+  int pcrs_len = 0;
+
+  if (parse_pcrs_string(pcrs_string, &pcrs, &pcrs_len) != 0)
+  {
+    kmyth_log(LOG_ERR, "failed to parse PCR string %s ... exiting",
+              pcrs_string);
+    return 1;
+  }
+
+  kmyth_tpm_context *ctx = NULL;
+  int retval = kmyth_tpm_context_open(owner_auth, owner_auth_len, &ctx);
+
+  if (retval == 0 && undefine)
+  {
+    retval = kmyth_tpm_context_undefine_nv(ctx, nv_index);
+  }
+  else if (retval == 0)
+  {
+    uint8_t *data = NULL;
+    size_t data_len = 0;
+
+    retval = map_bytes_from_file(in_path, &data, &data_len);
+    if (retval == 0)
+    {
+      retval = kmyth_tpm_context_seal_nv(ctx, data, data_len, &nv_index,
+                                         auth_bytes, auth_bytes_len,
+                                         pcrs, pcrs_len);
+      unmap_bytes_from_file(data, data_len);
+    }
+    if (retval == 0)
+    {
+      fprintf(stdout, "0x%08X\n", nv_index);
+    }
+  }
+  kmyth_tpm_context_close(&ctx);
+  free(pcrs);
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "failed to %s NV index ... exiting",
+              (undefine) ? "undefine" : "seal data into");
+  }
+
+  return retval;
+}
+
+static void print_timings(void)
+{
+  kmyth_timings_print(stderr);
+}
+
 static void usage(const char *prog)
 {
   fprintf(stdout,
-          "\nusage: %s [options] \n\n"
+          "\nusage: %s [options] [additional bundle or multi-file inputs ...]\n\n"
           "options are: \n\n"
           " -a or --auth_string   String used to create 'authVal' digest. Defaults to empty string (all-zero digest).\n"
-          " -i or --input         Path to file containing the data to be sealed.\n"
-          " -o or --output        Destination path for the sealed file. Defaults to <filename>.ski in the CWD.\n"
+          " -i or --input         Path to file containing the data to be sealed, or '-' for stdin.\n"
+          " -o or --output        Destination path for the sealed file, or '-' for stdout. Defaults to\n"
+          "                       <filename>.ski in the CWD (must be given for stdin).\n"
+          "                       With '-' as either path, the data is sealed as it is read (see -c),\n"
+          "                       into a binary (v2) .ski.\n"
+          "                       With -m or -d (and no -b), the destination directory. Defaults to the CWD.\n"
           " -f or --force         Force the overwrite of an existing .ski file when using default output.\n"
           " -p or --pcrs_list     List of TPM platform configuration registers (PCRs) to apply to authorization policy.\n"
           "                       Defaults to no PCRs specified. Encapsulate in quotes (e.g. \"0, 1, 2\").\n"
+          " -b or --bundle        Seal the input file and any additional file arguments into a single\n"
+          "                       multi-payload .ski sharing one storage key and wrapping key.\n"
+          " -m or --multi         Seal the input file and any additional file arguments, each into its\n"
+          "                       own <filename>.ski, using parallel worker threads.\n"
+          " -d or --input_dir     Seal every regular file in the directory (in name order), in addition\n"
+          "                       to any other inputs. Implies -m, unless -b is specified.\n"
+          " -j or --jobs          Number of worker threads used by -m. Defaults to the number of CPUs.\n"
+          " -B or --binary        Write the sealed file in the binary (v2) .ski format, which is\n"
+          "                       about 25%% smaller and faster to read for large inputs.\n"
+          " -z or --compress      Compress the data before it is sealed, 'zstd' or 'none'. Defaults to\n"
+          "                       'none'. Compressed data is always sealed to a binary (v2) .ski, and\n"
+          "                       decompressed by kmyth-unseal.\n"
+          " -k or --sk_alg        Storage key algorithm, 'rsa' or 'ecc'. Defaults to 'rsa'. ECC storage\n"
+          "                       keys are much faster for the TPM to create.\n"
+          " -P or --sk_pool       Directory of storage keys created ahead of time (see -F). A seal takes\n"
+          "                       a matching key from it, if there is one, instead of creating its own.\n"
+          " -F or --fill_sk_pool  Create storage keys in the -P directory, until it holds this many for\n"
+          "                       seals with the -a, -p and -k options given, and exit without sealing.\n"
+          " -r or --reseal        Reseal the -i .ski file, sealed with the -A authorization, under the -a\n"
+          "                       authorization and -p PCRs, without decrypting its data. The .ski is\n"
+          "                       rewritten in place, unless -o is given. With -m or -d, every input\n"
+          "                       .ski is resealed in place, as a batch on -j worker threads.\n"
+          " -A or --old_auth      String the -r .ski was sealed with (see -a). Defaults to empty string.\n"
+          " -N or --nv_index      Seal the -i input (at most the TPM's NV buffer size, typically 1024\n"
+          "                       bytes) into this TPM NV index, under the -a authorization and -p PCRs,\n"
+          "                       instead of a .ski, and print the index. 'auto' uses the first free\n"
+          "                       index from 0x01800000. kmyth-unseal -N reads it back with one TPM command.\n"
+          " -D or --nv_undefine   Undefine (erase) the -N NV index and exit without sealing.\n"
+          " -S or --store         Directory of a content-addressed .ski store. A seal of the same data\n"
+          "                       under the same options as an earlier one reuses its stored .ski,\n"
+          "                       and the output is a link to the stored .ski. Single input only.\n"
           " -c or --cipher        Specifies the cipher type to use. Defaults to \'%s\'\n"
+          "                       ('" KMYTH_DEFAULT_STREAM_CIPHER "' with '-' as -i or -o,\n"
+          "                       which needs an AES/GCM-Stream cipher).\n"
+          " -t or --threads       Number of threads each input is encrypted on, with an AES/GCM-Stream\n"
+          "                       cipher. Defaults to 1.\n"
           " -l or --list_ciphers  Lists all valid ciphers and exits.\n"
           " -w or --owner_auth    TPM 2.0 storage (owner) hierarchy authorization. Defaults to emptyAuth to match TPM default.\n"
+          " -T or --timings       Print the time spent in each phase of the seal to stderr.\n"
+          " -E or --tpm_trace     Write each TPM command (code, duration, response code, sessions) to this\n"
+          "                       file, in the Chrome trace-event format.\n"
+          " -K or --srk_handle    Persistent handle expected to hold the storage root key (SRK).\n"
+          "                       Defaults to $KMYTH_SRK_HANDLE, if set, else the handle last recorded in\n"
+          "                       '" KMYTH_SRK_STATE_FILE "'.\n"
+          " -R or --tcti          TPM transport (TCTI) configuration, e.g. 'device:/dev/tpmrm0' for the\n"
+          "                       kernel resource manager or 'mssim' for a simulator. Defaults to\n"
+          "                       $KMYTH_TCTI, if set, else tpm2-abrmd.\n"
+          " -e or --param_enc     Encrypt the wrapping key as it is sent to the TPM (TPM parameter\n"
+          "                       encryption). Defaults to on if $KMYTH_TPM_PARAM_ENC is set.\n"
           " -v or --verbose       Enable detailed logging.\n"
           " -h or --help          Help (displays this usage).\n", prog,
           cipher_list[0].cipher_name);
@@ -168,6 +971,26 @@ const struct option longopts[] = {
   {"pcrs_list", required_argument, 0, 'p'},
   {"owner_auth", required_argument, 0, 'w'},
   {"cipher", required_argument, 0, 'c'},
+  {"threads", required_argument, 0, 't'},
+  {"bundle", no_argument, 0, 'b'},
+  {"binary", no_argument, 0, 'B'},
+  {"compress", required_argument, 0, 'z'},
+  {"sk_alg", required_argument, 0, 'k'},
+  {"sk_pool", required_argument, 0, 'P'},
+  {"fill_sk_pool", required_argument, 0, 'F'},
+  {"reseal", no_argument, 0, 'r'},
+  {"old_auth", required_argument, 0, 'A'},
+  {"nv_index", required_argument, 0, 'N'},
+  {"nv_undefine", no_argument, 0, 'D'},
+  {"store", required_argument, 0, 'S'},
+  {"multi", no_argument, 0, 'm'},
+  {"input_dir", required_argument, 0, 'd'},
+  {"jobs", required_argument, 0, 'j'},
+  {"timings", no_argument, 0, 'T'},
+  {"tpm_trace", required_argument, 0, 'E'},
+  {"srk_handle", required_argument, 0, 'K'},
+  {"tcti", required_argument, 0, 'R'},
+  {"param_enc", no_argument, 0, 'e'},
   {"verbose", no_argument, 0, 'v'},
   {"help", no_argument, 0, 'h'},
   {"list_ciphers", no_argument, 0, 'l'},
@@ -188,6 +1011,13 @@ int main(int argc, char **argv)
   set_app_version(KMYTH_VERSION);
   set_applog_path(KMYTH_APPLOG_PATH);
 
+  // Apply the options configured for this tool in the Kmyth configuration
+  // file, ahead of (so they are overridden by) the command line options
+  if (kmyth_config_apply(longopts, &argc, &argv))
+  {
+    return 1;
+  }
+
   // Initialize parameters that might be modified by command line options
   char *inPath = NULL;
   char *outPath = NULL;
@@ -197,13 +1027,28 @@ int main(int argc, char **argv)
   char *pcrsString = NULL;
   char *cipherString = NULL;
   bool forceOverwrite = false;
+  bool bundleMode = false;
+  bool binaryFormat = false;
+  kmyth_sk_alg skAlg = KMYTH_SK_ALG_RSA;
+  kmyth_compression compression = KMYTH_COMPRESSION_NONE;
+  char *skPoolDir = NULL;
+  long skPoolFill = 0;
+  bool resealMode = false;
+  char *oldAuthString = NULL;
+  char *nvIndexString = NULL;
+  bool nvUndefine = false;
+  char *storeDir = NULL;
+  bool multiMode = false;
+  char *inDir = NULL;
+  long jobCount = sysconf(_SC_NPROCESSORS_ONLN);
+  long threadCount = 1;
 
   // Parse and apply command line options
   int options;
   int option_index;
 
   while ((options =
-          getopt_long(argc, argv, "a:i:o:c:p:w:fhlv", longopts,
+          getopt_long(argc, argv, "a:i:o:c:p:w:d:j:t:A:N:E:K:R:k:P:F:S:z:bBDefhlmrTv", longopts,
                       &option_index)) != -1)
   {
     switch (options)
@@ -228,6 +1073,89 @@ int main(int argc, char **argv)
         memcpy(outPath, optarg, outPath_size);
       }
       break;
+    case 'b':
+      bundleMode = true;
+      break;
+    case 'B':
+      binaryFormat = true;
+      break;
+    case 'k':
+      if (strcmp(optarg, "rsa") == 0)
+      {
+        skAlg = KMYTH_SK_ALG_RSA;
+      }
+      else if (strcmp(optarg, "ecc") == 0)
+      {
+        skAlg = KMYTH_SK_ALG_ECC;
+      }
+      else
+      {
+        kmyth_log(LOG_ERR, "invalid storage key algorithm (%s) ... exiting",
+                  optarg);
+        free(outPath);
+        return 1;
+      }
+      break;
+    case 'z':
+      if (kmyth_compression_from_string(optarg, &compression))
+      {
+        kmyth_log(LOG_ERR, "invalid compression (%s) ... exiting", optarg);
+        free(outPath);
+        return 1;
+      }
+      break;
+    case 'P':
+      skPoolDir = optarg;
+      break;
+    case 'F':
+      skPoolFill = strtol(optarg, NULL, 10);
+      if (skPoolFill < 1)
+      {
+        kmyth_log(LOG_ERR, "invalid SK pool size (%s) ... exiting", optarg);
+        free(outPath);
+        return 1;
+      }
+      break;
+    case 'r':
+      resealMode = true;
+      break;
+    case 'A':
+      oldAuthString = optarg;
+      break;
+    case 'N':
+      nvIndexString = optarg;
+      break;
+    case 'D':
+      nvUndefine = true;
+      break;
+    case 'S':
+      storeDir = optarg;
+      break;
+    case 'm':
+      multiMode = true;
+      break;
+    case 'd':
+      inDir = optarg;
+      break;
+    case 'j':
+      jobCount = strtol(optarg, NULL, 10);
+      if (jobCount < 1)
+      {
+        kmyth_log(LOG_ERR, "invalid job count (%s) ... exiting", optarg);
+        free(outPath);
+        return 1;
+      }
+      break;
+    case 't':
+      threadCount = strtol(optarg, NULL, 10);
+      if (threadCount < 1 || threadCount > GCM_STREAM_MAX_THREADS)
+      {
+        kmyth_log(LOG_ERR, "invalid thread count (%s) ... exiting", optarg);
+        free(outPath);
+        return 1;
+      }
+      aes_gcm_stream_set_threads((unsigned int) threadCount);
+      break;
     case 'f':
       forceOverwrite = true;
       break;
@@ -237,6 +1165,35 @@ int main(int argc, char **argv)
     case 'w':
       ownerAuthPasswd = optarg;
       break;
+    case 'T':
+      kmyth_timings_enable(true);
+      atexit(print_timings);
+      break;
+    case 'E':
+      if (tpm2_trace_open(optarg))
+      {
+        free(outPath);
+        return 1;
+      }
+      atexit(tpm2_trace_close);
+      break;
+    case 'K':
+      if (set_srk_handle(optarg))
+      {
+        free(outPath);
+        return 1;
+      }
+      break;
+    case 'R':
+      if (set_tcti_config(optarg))
+      {
+        free(outPath);
+        return 1;
+      }
+      break;
+    case 'e':
+      setenv(KMYTH_TPM_PARAM_ENC_ENV, "1", 1);
+      break;
     case 'v':
       // always display all log messages (severity threshold = LOG_DEBUG)
       // to stdout or stderr (output mode = 0)
@@ -259,8 +1216,75 @@ int main(int argc, char **argv)
   size_t oa_passwd_len =
     (ownerAuthPasswd == NULL) ? 0 : strlen(ownerAuthPasswd);
 
+  // The .ski store holds one .ski per input, sealed as a whole
+  if (storeDir != NULL && (bundleMode || multiMode || inDir != NULL ||
+                           optind < argc || resealMode ||
+                           nvIndexString != NULL || nvUndefine ||
+                           skPoolFill > 0 ||
+                           (inPath != NULL && strcmp(inPath, "-") == 0) ||
+                           (outPath != NULL && strcmp(outPath, "-") == 0)))
+  {
+    kmyth_log(LOG_ERR, "a .ski store (-S) can only be used to seal a single "
+              "input file to a .ski file ... exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    free(outPath);
+    return 1;
+  }
+
+  // Filling the storage key pool seals nothing
+  if (skPoolFill > 0)
+  {
+    int retval = fill_sk_pool(skPoolDir, (size_t) skPoolFill, skAlg,
+                              (uint8_t *) ownerAuthPasswd, oa_passwd_len,
+                              (uint8_t *) authString, auth_string_len,
+                              pcrsString);
+
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    free(outPath);
+    return retval;
+  }
+
+  // An NV index holds the input itself, and is sealed (or undefined) alone
+  if (nvIndexString != NULL || nvUndefine)
+  {
+    int retval = 1;
+
+    if (nvIndexString == NULL)
+    {
+      kmyth_log(LOG_ERR, "no NV index (-N) to undefine ... exiting");
+    }
+    else
+    {
+      retval = seal_nv_index(inPath, nvIndexString, nvUndefine,
+                             (uint8_t *) ownerAuthPasswd, oa_passwd_len,
+                             (uint8_t *) authString, auth_string_len,
+                             pcrsString);
+    }
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    free(outPath);
+    return retval;
+  }
+
+  // An input directory without a bundle is sealed file by file, and more
+  // than one .ski is resealed as a batch
+  if (inDir != NULL && !bundleMode)
+  {
+    multiMode = true;
+  }
+  if (resealMode && optind < argc)
+  {
+    multiMode = true;
+  }
+  if (jobCount < 1)
+  {
+    jobCount = 1;
+  }
+
   // Check that input path (file to be sealed) was specified
-  if (inPath == NULL)
+  if (inPath == NULL && inDir == NULL)
   {
     kmyth_log(LOG_ERR, "no input (file to be sealed) specified ... exiting");
     if (authString != NULL)
@@ -272,55 +1296,139 @@ int main(int argc, char **argv)
     return 1;
   }
 
-  // If output file not specified, set output path to basename(inPath) with
-  // a .ski extension in the directory that the application is being run from.
-  if (outPath == NULL)
+  // A '-' input or output (stdin/stdout) seals a single input as a stream
+  bool streamMode = (inPath != NULL && strcmp(inPath, "-") == 0) ||
+    (outPath != NULL && strcmp(outPath, "-") == 0);
+
+  if (streamMode && (bundleMode || multiMode || optind < argc ||
+                     inPath == NULL || outPath == NULL))
   {
-    char *original_fn = basename(inPath);
-    char *temp_str = malloc((strlen(original_fn) + 5) * sizeof(char));
+    kmyth_log(LOG_ERR, "stdin/stdout ('-') can only be used to seal a single "
+              "input, with both -i and -o given ... exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    free(outPath);
+    return 1;
+  }
+
+  // In bundle and multi-file modes the inputs are the '-i' input (if any),
+  // followed by any remaining (non-option) command line arguments, in order,
+  // followed by the regular files in the '-d' input directory (if any)
+  char **inPaths = NULL;
+  size_t inPath_count = 0;
+
+  if (bundleMode || multiMode)
+  {
+    inPaths = malloc((1 + (size_t) (argc - optind)) * sizeof(char *));
+    if (inPaths == NULL)
+    {
+      kmyth_log(LOG_ERR, "failed to allocate input path list ... exiting");
+      kmyth_clear(authString, auth_string_len);
+      kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+      free(outPath);
+      return 1;
+    }
+    if (inPath != NULL)
+    {
+      inPaths[inPath_count++] = strdup(inPath);
+    }
+    for (int i = optind; i < argc; i++)
+    {
+      inPaths[inPath_count++] = strdup(argv[i]);
+    }
 
-    strncpy(temp_str, original_fn, strlen(original_fn));
+    int retval = 0;
 
-    // Remove any leading '.'s
-    while (*temp_str == '.')
+    for (size_t i = 0; i < inPath_count; i++)
     {
-      memmove(temp_str, temp_str + 1, strlen(temp_str) - 1);
+      if (inPaths[i] == NULL)
+      {
+        kmyth_log(LOG_ERR, "failed to allocate input path ... exiting");
+        retval = 1;
+      }
+    }
+    if (retval == 0 && inDir != NULL)
+    {
+      retval = append_dir_files(inDir, NULL, &inPaths, &inPath_count);
+    }
+    if (retval == 0 && inPath_count == 0)
+    {
+      kmyth_log(LOG_ERR, "no input files found in %s ... exiting", inDir);
+      retval = 1;
+    }
+    if (retval)
+    {
+      for (size_t i = 0; i < inPath_count; i++)
+      {
+        free(inPaths[i]);
+      }
+      free(inPaths);
+      kmyth_clear(authString, auth_string_len);
+      kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+      free(outPath);
+      return 1;
     }
-    char *scratch;
+  }
 
-    // Everything beyond first '.' in original filename, with any leading
-    // '.'(s) removed, is treated as extension
-    temp_str = strtok_r(temp_str, ".", &scratch);
+  // Resealing a .ski encrypts nothing
+  if (resealMode)
+  {
+    size_t old_auth_len = (oldAuthString == NULL) ? 0 : strlen(oldAuthString);
+    int retval = reseal_ski_files(inPaths, inPath_count, inPath, outPath,
+                                  (size_t) jobCount, skAlg,
+                                  (uint8_t *) ownerAuthPasswd, oa_passwd_len,
+                                  (uint8_t *) oldAuthString, old_auth_len,
+                                  (uint8_t *) authString, auth_string_len,
+                                  pcrsString);
 
-    // Append .ski file extension
-    strncat(temp_str, ".ski", 5);
+    for (size_t i = 0; i < inPath_count; i++)
+    {
+      free(inPaths[i]);
+    }
+    free(inPaths);
+    kmyth_clear(oldAuthString, old_auth_len);
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    free(outPath);
+    return retval;
+  }
 
-    outPath_size = strlen(temp_str) + 1;
-    // Make sure resultant default file name does not have empty basename
-    if (outPath_size < 6)
+  // If output file not specified, set output path to basename(inPath) with
+  // a .ski extension in the directory that the application is being run from.
+  // (a bundle is named after its first input, multi-file mode names each
+  // output after its input, in the '-o' directory)
+  if (outPath == NULL && !multiMode)
+  {
+    char *defaultInPath = (bundleMode) ? inPaths[0] : inPath;
+
+    if (derive_ski_filename(defaultInPath, &outPath))
     {
-      kmyth_log(LOG_ERR, "invalid default filename derived ... exiting");
-      free(temp_str);
+      for (size_t i = 0; i < inPath_count; i++)
+      {
+        free(inPaths[i]);
+      }
+      free(inPaths);
       kmyth_clear(authString, auth_string_len);
       kmyth_clear(ownerAuthPasswd, oa_passwd_len);
       return 1;
     }
     // Make sure default filename we constructed doesn't already exist
     struct stat st = { 0 };
-    if (!stat(temp_str, &st) && !forceOverwrite)
+    if (!stat(outPath, &st) && !forceOverwrite)
     {
       kmyth_log(LOG_ERR,
                 "default output filename (%s) already exists ... exiting",
-                temp_str);
-      free(temp_str);
+                outPath);
+      for (size_t i = 0; i < inPath_count; i++)
+      {
+        free(inPaths[i]);
+      }
+      free(inPaths);
+      free(outPath);
       kmyth_clear(authString, auth_string_len);
       kmyth_clear(ownerAuthPasswd, oa_passwd_len);
       return 1;
     }
-    // Go ahead and make the default value the output path
-    outPath = malloc(outPath_size * sizeof(char));
-    memcpy(outPath, temp_str, outPath_size);
-    free(temp_str);
     kmyth_log(LOG_WARNING, "output file not specified, default = %s", outPath);
   }
 
@@ -333,16 +1441,82 @@ int main(int argc, char **argv)
   if (parse_pcrs_string(pcrsString, &pcrs, &pcrs_len) != 0)
   {
     kmyth_log(LOG_ERR, "failed to parse PCR string %s ... exiting", pcrsString);
+    for (size_t i = 0; i < inPath_count; i++)
+    {
+      free(inPaths[i]);
+    }
+    free(inPaths);
     free(outPath);
     free(output);
     return 1;
   }
 
+  // Open a TPM context, selecting the requested .ski output format
+  kmyth_tpm_context *ctx = NULL;
+  int seal_result = kmyth_tpm_context_open((uint8_t *) ownerAuthPasswd,
+                                           oa_passwd_len, &ctx);
+
+  if (seal_result == 0 && binaryFormat)
+  {
+    seal_result = kmyth_tpm_context_set_ski_format(ctx,
+                                                   KMYTH_SKI_FORMAT_BINARY);
+  }
+  if (seal_result == 0)
+  {
+    seal_result = kmyth_tpm_context_set_sk_alg(ctx, skAlg);
+  }
+  if (seal_result == 0)
+  {
+    seal_result = kmyth_tpm_context_set_compression(ctx, compression);
+  }
+  if (seal_result == 0 && skPoolDir != NULL)
+  {
+    seal_result = kmyth_tpm_context_set_sk_pool(ctx, skPoolDir);
+  }
+
   // Call top-level "kmyth-seal" function
-  if (tpm2_kmyth_seal_file(inPath, &output, &output_length,
-                           (uint8_t *) authString, auth_string_len,
-                           (uint8_t *) ownerAuthPasswd, oa_passwd_len,
-                           pcrs, pcrs_len, cipherString))
+  if (seal_result == 0 && bundleMode)
+  {
+    seal_result = seal_bundle_files(ctx, inPaths, inPath_count,
+                                    &output, &output_length,
+                                    (uint8_t *) authString, auth_string_len,
+                                    pcrs, pcrs_len, cipherString);
+  }
+  else if (seal_result == 0 && streamMode)
+  {
+    seal_result = seal_stream(ctx, inPath, outPath,
+                              (uint8_t *) authString, auth_string_len,
+                              pcrs, pcrs_len, cipherString);
+  }
+  else if (seal_result == 0 && multiMode)
+  {
+    seal_result = seal_multi_files(ctx, inPaths, inPath_count,
+                                   (outPath == NULL) ? "." : outPath,
+                                   forceOverwrite, (size_t) jobCount,
+                                   (uint8_t *) authString, auth_string_len,
+                                   pcrs, pcrs_len, cipherString);
+  }
+  else if (seal_result == 0 && storeDir != NULL)
+  {
+    seal_result = seal_stored_file(ctx, inPath, storeDir, outPath,
+                                   (uint8_t *) authString, auth_string_len,
+                                   pcrs, pcrs_len, cipherString);
+  }
+  else if (seal_result == 0)
+  {
+    seal_result = seal_input_file(ctx, inPath, &output, &output_length,
+                                  (uint8_t *) authString, auth_string_len,
+                                  pcrs, pcrs_len, cipherString);
+  }
+  kmyth_tpm_context_close(&ctx);
+
+  for (size_t i = 0; i < inPath_count; i++)
+  {
+    free(inPaths[i]);
+  }
+  free(inPaths);
+
+  if (seal_result)
   {
     kmyth_log(LOG_ERR, "kmyth-seal error ... exiting");
     kmyth_clear(authString, auth_string_len);
@@ -356,6 +1530,16 @@ int main(int argc, char **argv)
   kmyth_clear(authString, auth_string_len);
   kmyth_clear(ownerAuthPasswd, oa_passwd_len);
 
+  // stream, multi-file and store modes have already written their outputs
+  if (streamMode || multiMode || storeDir != NULL)
+  {
+    free(pcrs);
+    free(outPath);
+    return 0;
+  }
+
+  uint64_t timer = kmyth_timer_begin();
+
   if (write_bytes_to_file(outPath, output, output_length))
   {
     kmyth_log(LOG_ERR, "error writing data to .ski file ... exiting");
@@ -364,6 +1548,7 @@ int main(int argc, char **argv)
     free(pcrs);
     return 1;
   }
+  kmyth_timer_end(KMYTH_PHASE_FILE_IO, timer);
 
   free(pcrs);
   free(outPath);
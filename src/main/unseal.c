@@ -2,33 +2,750 @@
  * Kmyth Unsealing Interface - TPM 2.0
  */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <sys/stat.h>
 
+#include <openssl/crypto.h>
+
+#include "batch_io.h"
+#include "cipher/aes_gcm_stream.h"
+#include "config_file.h"
 #include "defines.h"
 #include "file_io.h"
 #include "kmyth.h"
 #include "kmyth_log.h"
 #include "memory_util.h"
+#include "timing_util.h"
+#include "tpm/pcrs.h"
+#include "tpm/storage_key_tools.h"
+#include "tpm/tpm2_interface.h"
+#include "tpm/tpm2_trace.h"
+#include "unsealerd_util.h"
+
+static void print_timings(void)
+{
+  kmyth_timings_print(stderr);
+}
+
+//############################################################################
+// unseal_stream()
+//
+// Unseals the input to the output as it is read, where either may be '-'
+// for stdin/stdout (e.g., 'kmyth-unseal -i x.ski -s | app')
+//############################################################################
+static int unseal_stream(char *in_path, char *out_path,
+                         uint8_t * auth_bytes, size_t auth_bytes_len,
+                         uint8_t * owner_auth_bytes, size_t oa_bytes_len)
+{
+  bool from_stdin = (strcmp(in_path, "-") == 0);
+  bool to_stdout = (strcmp(out_path, "-") == 0);
+  FILE *in = (from_stdin) ? stdin : fopen(in_path, "rb");
+
+  if (in == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to open input (%s) ... exiting", in_path);
+    return 1;
+  }
+
+  FILE *out = (to_stdout) ? stdout : fopen(out_path, "wb");
+
+  if (out == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to open output (%s) ... exiting", out_path);
+    if (!from_stdin)
+    {
+      fclose(in);
+    }
+    return 1;
+  }
+
+  int retval = tpm2_kmyth_unseal_stream(in, out, auth_bytes, auth_bytes_len,
+                                        owner_auth_bytes, oa_bytes_len);
+
+  if (!from_stdin)
+  {
+    fclose(in);
+  }
+  if (!to_stdout && fclose(out) != 0)
+  {
+    retval = 1;
+  }
+
+  // incomplete output is not left behind in a file
+  if (retval && !to_stdout)
+  {
+    remove(out_path);
+  }
+
+  return retval;
+}
+
+//############################################################################
+// check_policy()
+//
+// Reports, without unsealing it, whether the current PCR values satisfy the
+// policy of the .ski file (e.g., before a reboot into an updated boot chain)
+//############################################################################
+static int check_policy(char *in_path,
+                        uint8_t * owner_auth_bytes, size_t oa_bytes_len)
+{
+  uint8_t *ski_bytes = NULL;
+  size_t ski_bytes_len = 0;
+
+  if (map_bytes_from_file(in_path, &ski_bytes, &ski_bytes_len))
+  {
+    kmyth_log(LOG_ERR, "unable to read input (%s) ... exiting", in_path);
+    return 1;
+  }
+
+  kmyth_tpm_context *ctx = NULL;
+  bool satisfied = false;
+  int *pcrs = NULL;
+  size_t pcrs_len = 0;
+  int retval = kmyth_tpm_context_open(owner_auth_bytes, oa_bytes_len, &ctx);
+
+  if (retval == 0)
+  {
+    retval = kmyth_tpm_context_check_policy(ctx, ski_bytes, ski_bytes_len,
+                                            &satisfied, &pcrs, &pcrs_len);
+    kmyth_tpm_context_close(&ctx);
+  }
+  unmap_bytes_from_file(ski_bytes, ski_bytes_len);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unable to check policy of %s ... exiting", in_path);
+    return 1;
+  }
+
+  if (satisfied)
+  {
+    fprintf(stdout, "%s: policy satisfied by current PCR values\n", in_path);
+    return 0;
+  }
+  fprintf(stdout, "%s: policy not satisfied, PCRs in policy:", in_path);
+  for (size_t i = 0; i < pcrs_len; i++)
+  {
+    fprintf(stdout, " %d", pcrs[i]);
+  }
+  fprintf(stdout, "\n");
+  free(pcrs);
+
+  return 1;
+}
+
+//############################################################################
+// unseal_nv_index()
+//
+// Unseals the data sealed into a TPM NV index by kmyth-seal -N, with the PCRs
+// it was sealed to (the index records only the policy digest)
+//############################################################################
+static int unseal_nv_index(char *nv_index_string, char *pcrs_string,
+                           uint8_t ** output, size_t * output_len,
+                           uint8_t * auth_bytes, size_t auth_bytes_len,
+                           uint8_t * owner_auth_bytes, size_t oa_bytes_len)
+{
+  char *end = NULL;
+  unsigned long nv_index = strtoul(nv_index_string, &end, 0);
+
+  if (end == nv_index_string || *end != '\0'
+      || nv_index < TPM2_NV_INDEX_FIRST || nv_index > TPM2_NV_INDEX_LAST)
+  {
+    kmyth_log(LOG_ERR, "invalid NV index (%s) ... exiting", nv_index_string);
+    return 1;
+  }
+
+  int *pcrs = NULL;
+  int pcrs_len = 0;
+
+  if (parse_pcrs_string(pcrs_string, &pcrs, &pcrs_len) != 0)
+  {
+    kmyth_log(LOG_ERR, "failed to parse PCR string %s ... exiting",
+              pcrs_string);
+    return 1;
+  }
+
+  kmyth_tpm_context *ctx = NULL;
+  int retval = kmyth_tpm_context_open(owner_auth_bytes, oa_bytes_len, &ctx);
+
+  if (retval == 0)
+  {
+    retval = kmyth_tpm_context_unseal_nv(ctx, (uint32_t) nv_index,
+                                         output, output_len,
+                                         auth_bytes, auth_bytes_len,
+                                         pcrs, pcrs_len);
+  }
+  kmyth_tpm_context_close(&ctx);
+  free(pcrs);
+
+  return retval;
+}
+
+//############################################################################
+// unseal_fd_exec()
+//
+// Unseals a .ski (or NV index) into a memory file, then runs a command with
+// the file's descriptor open, so that the command can map the data without
+// it being copied again or touching a filesystem. Only returns on error.
+//############################################################################
+static int unseal_fd_exec(char *in_path, char *nv_index_string,
+                          char *pcrs_string, char *socket_path,
+                          char **command,
+                          uint8_t * auth_bytes, size_t auth_bytes_len,
+                          uint8_t * owner_auth, size_t owner_auth_len)
+{
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+  int fd = -1;
+  int retval = 0;
+
+  if (nv_index_string == NULL && strcmp(in_path, "-") == 0)
+  {
+    kmyth_log(LOG_ERR, "-F needs an input .ski file, not stdin ... exiting");
+    return 1;
+  }
+
+  if (nv_index_string != NULL)
+  {
+    retval = unseal_nv_index(nv_index_string, pcrs_string,
+                             &output, &output_len, auth_bytes,
+                             auth_bytes_len, owner_auth, owner_auth_len);
+  }
+  else if (socket_path != NULL)
+  {
+    // the daemon creates the memory file, and passes it over the socket
+    uint8_t *ski_bytes = NULL;
+    size_t ski_bytes_len = 0;
+
+    retval = map_bytes_from_file(in_path, &ski_bytes, &ski_bytes_len);
+    if (retval == 0)
+    {
+      retval = unsealerd_unseal_fd(socket_path, ski_bytes, ski_bytes_len,
+                                   auth_bytes, auth_bytes_len,
+                                   &fd, &output_len);
+      unmap_bytes_from_file(ski_bytes, ski_bytes_len);
+    }
+  }
+  else
+  {
+    retval = tpm2_kmyth_unseal_file(in_path, &output, &output_len,
+                                    auth_bytes, auth_bytes_len,
+                                    owner_auth, owner_auth_len);
+  }
+  kmyth_clear(auth_bytes, auth_bytes_len);
+  kmyth_clear(owner_auth, owner_auth_len);
+
+  if (retval == 0 && fd == -1)
+  {
+    retval = write_bytes_to_secret_fd(output, output_len, &fd);
+  }
+  kmyth_clear_and_free(output, output_len);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "kmyth-unseal failed ... exiting");
+    return 1;
+  }
+
+  // the descriptor is the one thing the command inherits from the unseal
+  char fd_string[16] = { 0 };
+  char size_string[24] = { 0 };
+
+  snprintf(fd_string, sizeof(fd_string), "%d", fd);
+  snprintf(size_string, sizeof(size_string), "%zu", output_len);
+  if (fcntl(fd, F_SETFD, 0) == -1
+      || setenv(KMYTH_SECRET_FD_ENV, fd_string, 1)
+      || setenv(KMYTH_SECRET_SIZE_ENV, size_string, 1))
+  {
+    kmyth_log(LOG_ERR, "unable to pass the memory file ... exiting");
+    close(fd);
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "running %s with the unsealed data on fd %d",
+            command[0], fd);
+
+  execvp(command[0], command);
+  kmyth_log(LOG_ERR, "unable to run %s (%s) ... exiting", command[0],
+            strerror(errno));
+  close(fd);
+  return 1;
+}
+
+/**
+ * @brief A window of (at most BATCH_IO_DEPTH) input .ski files of a
+ *        multi-file unseal. The small files of a window are read together,
+ *        on a prefetch thread while the previous window is being unsealed.
+ *        Each entry below is indexed from the start of the window.
+ */
+typedef struct unseal_window
+{
+  char **in_paths;
+  size_t first;
+  size_t end;
+  bool batched[BATCH_IO_DEPTH];
+  uint8_t *inputs[BATCH_IO_DEPTH];
+  size_t input_lens[BATCH_IO_DEPTH];
+  int read_results[BATCH_IO_DEPTH];
+} unseal_window;
+
+/**
+ * @brief Shared state of the worker threads unsealing a list of .ski files,
+ *        each into its own output file (or onto stdout)
+ */
+typedef struct unseal_jobs
+{
+  kmyth_tpm_context *ctx;
+  char **in_paths;
+  char **out_paths;             // NULL when multiplexed onto stdout
+  uint8_t *auth_bytes;
+  size_t auth_bytes_len;
+
+  // the window being unsealed, and its outputs (plaintext), indexed from
+  // the start of the window
+  unseal_window *window;
+  uint8_t *outputs[BATCH_IO_DEPTH];
+  size_t output_lens[BATCH_IO_DEPTH];
+
+  // next input index to be claimed by a worker, and the count of failed
+  // inputs, both guarded by lock
+  pthread_mutex_t lock;
+  size_t next;
+  size_t failed;
+} unseal_jobs;
+
+//############################################################################
+// unseal_window_read()
+//
+// Reads the .ski files of a window that are small enough to be held in
+// memory with the rest of it, together. Larger ones (and any that cannot be
+// examined) are left to be mapped by the worker unsealing them.
+//############################################################################
+static void *unseal_window_read(void *arg)
+{
+  unseal_window *window = (unseal_window *) arg;
+  char *paths[BATCH_IO_DEPTH];
+  size_t slots[BATCH_IO_DEPTH];
+  uint8_t *data[BATCH_IO_DEPTH];
+  size_t lengths[BATCH_IO_DEPTH];
+  int results[BATCH_IO_DEPTH];
+  size_t count = 0;
+
+  for (size_t i = window->first; i < window->end; i++)
+  {
+    size_t k = i - window->first;
+    struct stat st = { 0 };
+
+    window->batched[k] = (stat(window->in_paths[i], &st) == 0
+                          && S_ISREG(st.st_mode)
+                          && st.st_size <= KMYTH_BATCH_IO_MAX_INPUT_SIZE);
+    window->inputs[k] = NULL;
+    window->input_lens[k] = 0;
+    window->read_results[k] = 0;
+    if (window->batched[k])
+    {
+      paths[count] = window->in_paths[i];
+      slots[count++] = k;
+    }
+  }
+
+  // a failure to read one input is reported when it is unsealed
+  read_files_batch(paths, count, data, lengths, results);
+  for (size_t j = 0; j < count; j++)
+  {
+    window->inputs[slots[j]] = data[j];
+    window->input_lens[slots[j]] = lengths[j];
+    window->read_results[slots[j]] = results[j];
+  }
+
+  return NULL;
+}
+
+//############################################################################
+// unseal_input_file()
+//############################################################################
+static int unseal_input_file(kmyth_tpm_context * ctx, char *path,
+                             uint8_t ** output, size_t * output_len,
+                             uint8_t * auth_bytes, size_t auth_bytes_len)
+{
+  if (verifyInputFilePath(path))
+  {
+    kmyth_log(LOG_ERR, "input path (%s) is not valid ... exiting", path);
+    return 1;
+  }
+
+  uint8_t *data = NULL;
+  size_t data_len = 0;
+
+  if (map_bytes_from_file(path, &data, &data_len))
+  {
+    kmyth_log(LOG_ERR, "unable to read file %s ... exiting", path);
+    return 1;
+  }
+
+  int retval = kmyth_tpm_context_unseal(ctx, data, data_len,
+                                        output, output_len,
+                                        auth_bytes, auth_bytes_len);
+
+  unmap_bytes_from_file(data, data_len);
+  return retval;
+}
+
+//############################################################################
+// unseal_worker()
+//############################################################################
+static void *unseal_worker(void *arg)
+{
+  unseal_jobs *jobs = (unseal_jobs *) arg;
+  unseal_window *window = jobs->window;
+
+  while (true)
+  {
+    pthread_mutex_lock(&jobs->lock);
+    size_t i = jobs->next++;
+
+    pthread_mutex_unlock(&jobs->lock);
+    if (i >= window->end)
+    {
+      break;
+    }
+
+    // the parsing and decryption of concurrent unseals run in parallel,
+    // the TPM commands are serialized on the shared context's connection
+    size_t k = i - window->first;
+    uint8_t *output = NULL;
+    size_t output_len = 0;
+    int retval = 0;
+
+    if (!window->batched[k])
+    {
+      retval = unseal_input_file(jobs->ctx, jobs->in_paths[i],
+                                 &output, &output_len,
+                                 jobs->auth_bytes, jobs->auth_bytes_len);
+    }
+    else if (window->read_results[k] || window->input_lens[k] == 0)
+    {
+      kmyth_log(LOG_ERR, "unable to read file %s ... exiting",
+                jobs->in_paths[i]);
+      retval = 1;
+    }
+    else
+    {
+      retval = kmyth_tpm_context_unseal(jobs->ctx, window->inputs[k],
+                                        window->input_lens[k],
+                                        &output, &output_len,
+                                        jobs->auth_bytes,
+                                        jobs->auth_bytes_len);
+    }
+
+    // written (in input order) with the rest of the window
+    if (retval == 0)
+    {
+      jobs->outputs[k] = output;
+      jobs->output_lens[k] = output_len;
+      continue;
+    }
+
+    kmyth_clear_and_free(output, output_len);
+    kmyth_log(LOG_ERR, "error unsealing %s", jobs->in_paths[i]);
+    pthread_mutex_lock(&jobs->lock);
+    jobs->failed++;
+    pthread_mutex_unlock(&jobs->lock);
+  }
+
+  return NULL;
+}
+
+//############################################################################
+// unseal_window_write()
+//
+// Writes the outputs of the current window, either to their files (together)
+// or, in input order, onto stdout, each after a '<length> <input path>'
+// line. Then releases them and the window's inputs.
+//############################################################################
+static void unseal_window_write(unseal_jobs * jobs)
+{
+  unseal_window *window = jobs->window;
+  size_t window_len = window->end - window->first;
+
+  if (jobs->out_paths == NULL)
+  {
+    for (size_t k = 0; k < window_len; k++)
+    {
+      if (jobs->outputs[k] == NULL)
+      {
+        continue;
+      }
+
+      size_t i = window->first + k;
+      char *header = NULL;
+      int header_len = asprintf(&header, "%zu %s\n", jobs->output_lens[k],
+                                jobs->in_paths[i]);
+
+      if (header_len < 0
+          || print_to_stdout((unsigned char *) header, (size_t) header_len)
+          || print_to_stdout(jobs->outputs[k], jobs->output_lens[k]))
+      {
+        kmyth_log(LOG_ERR, "error writing %s to stdout", jobs->in_paths[i]);
+        jobs->failed++;
+      }
+      if (header_len >= 0)
+      {
+        free(header);
+      }
+    }
+  }
+  else
+  {
+    char *paths[BATCH_IO_DEPTH];
+    uint8_t *bytes[BATCH_IO_DEPTH];
+    size_t lengths[BATCH_IO_DEPTH];
+    int results[BATCH_IO_DEPTH];
+    size_t slots[BATCH_IO_DEPTH];
+    size_t count = 0;
+
+    for (size_t k = 0; k < window_len; k++)
+    {
+      if (jobs->outputs[k] != NULL)
+      {
+        paths[count] = jobs->out_paths[window->first + k];
+        bytes[count] = jobs->outputs[k];
+        lengths[count] = jobs->output_lens[k];
+        slots[count++] = k;
+      }
+    }
+
+    write_files_batch(paths, bytes, lengths, count, false, results);
+    for (size_t j = 0; j < count; j++)
+    {
+      size_t i = window->first + slots[j];
+
+      if (results[j])
+      {
+        kmyth_log(LOG_ERR, "error writing file: %s", jobs->out_paths[i]);
+        jobs->failed++;
+      }
+      else
+      {
+        kmyth_log(LOG_DEBUG, "unsealed contents of %s to %s",
+                  jobs->in_paths[i], jobs->out_paths[i]);
+      }
+    }
+  }
+
+  // the outputs are plaintext secrets
+  for (size_t k = 0; k < window_len; k++)
+  {
+    kmyth_clear_and_free(jobs->outputs[k], jobs->output_lens[k]);
+    free(window->inputs[k]);
+    jobs->outputs[k] = NULL;
+    jobs->output_lens[k] = 0;
+    window->inputs[k] = NULL;
+  }
+}
+
+//############################################################################
+// unseal_current_window()
+//
+// Unseals the current window of inputs on job_count worker threads
+//############################################################################
+static void unseal_current_window(unseal_jobs * jobs, size_t job_count)
+{
+  unseal_window *window = jobs->window;
+
+  if (job_count > window->end - window->first)
+  {
+    job_count = window->end - window->first;
+  }
+
+  pthread_t *workers = calloc(job_count, sizeof(pthread_t));
+  size_t started = 0;
+
+  jobs->next = window->first;
+  while (workers != NULL && started + 1 < job_count
+         && pthread_create(&workers[started], NULL, unseal_worker, jobs) == 0)
+  {
+    started++;
+  }
+
+  // the calling thread is one of the job_count workers, so progress is
+  // made even if no other worker thread could be started
+  unseal_worker(jobs);
+  for (size_t i = 0; i < started; i++)
+  {
+    pthread_join(workers[i], NULL);
+  }
+  free(workers);
+  unseal_window_write(jobs);
+}
+
+//############################################################################
+// unseal_multi_files()
+//
+// Unseals a list of .ski files with one TPM context (so the SRK is looked up
+// once and each distinct storage key loaded once), into out_dir or, if it is
+// NULL, onto stdout. The next window of inputs is read while the current one
+// is unsealed.
+//############################################################################
+static int unseal_multi_files(char **paths, size_t path_count,
+                              char *out_dir, bool force, size_t job_count,
+                              uint8_t * auth_bytes, size_t auth_bytes_len,
+                              uint8_t * owner_auth_bytes, size_t oa_bytes_len)
+{
+  unseal_jobs jobs = {
+    .in_paths = paths,
+    .auth_bytes = auth_bytes,
+    .auth_bytes_len = auth_bytes_len,
+  };
+
+  if (out_dir != NULL)
+  {
+    jobs.out_paths = calloc(path_count, sizeof(char *));
+    if (jobs.out_paths == NULL)
+    {
+      kmyth_log(LOG_ERR, "failed to allocate output path list ... exiting");
+      return 1;
+    }
+  }
+
+  int retval = 0;
+
+  if (out_dir != NULL)
+  {
+    retval = derive_unsealed_paths(paths, path_count, out_dir, force,
+                                   jobs.out_paths);
+  }
+  if (retval == 0)
+  {
+    retval = kmyth_tpm_context_open(owner_auth_bytes, oa_bytes_len, &jobs.ctx);
+  }
+
+  if (retval == 0)
+  {
+    unseal_window windows[2] = {
+      {.in_paths = paths,.first = 0},
+      {.in_paths = paths},
+    };
+    size_t current = 0;
+
+    windows[0].end = (path_count < BATCH_IO_DEPTH) ? path_count
+      : BATCH_IO_DEPTH;
+    unseal_window_read(&windows[0]);
+
+    pthread_mutex_init(&jobs.lock, NULL);
+    while (true)
+    {
+      unseal_window *window = &windows[current];
+      unseal_window *next = &windows[1 - current];
+      bool more = (window->end < path_count);
+      bool prefetching = false;
+      pthread_t reader;
+
+      // read the next window's .ski files while this one is in the TPM
+      if (more)
+      {
+        next->first = window->end;
+        next->end = (path_count - next->first < BATCH_IO_DEPTH) ? path_count
+          : next->first + BATCH_IO_DEPTH;
+        prefetching = (pthread_create(&reader, NULL, unseal_window_read,
+                                      next) == 0);
+      }
+
+      jobs.window = window;
+      unseal_current_window(&jobs, job_count);
+
+      if (prefetching)
+      {
+        pthread_join(reader, NULL);
+      }
+      else if (more)
+      {
+        unseal_window_read(next);
+      }
+      if (!more)
+      {
+        break;
+      }
+      current = 1 - current;
+    }
+    pthread_mutex_destroy(&jobs.lock);
+
+    if (jobs.failed > 0)
+    {
+      kmyth_log(LOG_ERR, "failed to unseal %zu of %zu input files",
+                jobs.failed, path_count);
+      retval = 1;
+    }
+  }
+  kmyth_tpm_context_close(&jobs.ctx);
+
+  if (jobs.out_paths != NULL)
+  {
+    for (size_t i = 0; i < path_count; i++)
+    {
+      free(jobs.out_paths[i]);
+    }
+    free(jobs.out_paths);
+  }
+  return retval;
+}
 
 static void usage(const char *prog)
 {
   fprintf(stdout,
-          "\nusage: %s [options]\n\n"
+          "\nusage: %s [options] [additional multi-file inputs ...]\n\n"
           "options are: \n\n"
           " -a or --auth_string   String used to create 'authVal' digest. Defaults to empty string (all-zero digest).\n"
-          " -i or --input         Path to file containing data the to be unsealed\n"
+          " -i or --input         Path to file containing data the to be unsealed, or '-' for stdin\n"
           " -o or --output        Destination path for unsealed file. This or -s must be specified. Will not overwrite any\n"
           "                       existing files unless the 'force' option is selected.\n"
           " -f or --force         Force the overwrite of an existing output file\n"
-          " -s or --stdout        Output unencrypted result to stdout instead of file.\n"
+          " -m or --multi         Unseal the input file and any additional file arguments (each a\n"
+          "                       <name>.ski) with one TPM connection, each into <name> in the -o\n"
+          "                       directory, or onto stdout with -s, each after a '<length> <input>' line.\n"
+          " -d or --input_dir     Unseal every .ski file in the directory (in name order), in addition\n"
+          "                       to any other inputs. Implies -m.\n"
+          " -j or --jobs          Number of worker threads used by -m. Defaults to the number of CPUs.\n"
+          " -s or --stdout        Output unencrypted result to stdout instead of file. A binary .ski sealed\n"
+          "                       with an AES/GCM-Stream cipher is decrypted and written as it is read.\n"
+          " -F or --fd_exec       Unseal into a memory file (memfd_secret, or a sealed memfd where that is not\n"
+          "                       available) instead of -o or -s, and run the command given after the options\n"
+          "                       (e.g. '%s -i key.ski -F -- app args') with it open. $KMYTH_SECRET_FD and\n"
+          "                       $KMYTH_SECRET_SIZE hold its descriptor and size; the command mmap()s it.\n"
           " -w or --owner_auth    TPM 2.0 storage (owner) hierarchy authorization. Defaults to emptyAuth to match TPM default.\n"
+          " -S or --socket        Unseal through the kmyth-unsealerd serving this socket (e.g. %s),\n"
+          "                       instead of opening a TPM connection. The daemon's owner_auth is used.\n"
+          " -t or --threads       Number of threads the data is decrypted on, if it was sealed with an\n"
+          "                       AES/GCM-Stream cipher. Defaults to 1. More than one thread reads the\n"
+          "                       whole .ski file before decrypting it.\n"
+          " -T or --timings       Print the time spent in each phase of the unseal to stderr.\n"
+          " -E or --tpm_trace     Write each TPM command (code, duration, response code, sessions) to this\n"
+          "                       file, in the Chrome trace-event format.\n"
+          " -K or --srk_handle    Persistent handle expected to hold the storage root key (SRK).\n"
+          "                       Defaults to $KMYTH_SRK_HANDLE, if set, else the handle last recorded in\n"
+          "                       '" KMYTH_SRK_STATE_FILE "'.\n"
+          " -R or --tcti          TPM transport (TCTI) configuration, e.g. 'device:/dev/tpmrm0' for the\n"
+          "                       kernel resource manager or 'mssim' for a simulator. Defaults to\n"
+          "                       $KMYTH_TCTI, if set, else tpm2-abrmd.\n"
+          " -e or --param_enc     Encrypt the wrapping key as it is returned by the TPM (TPM parameter\n"
+          "                       encryption). Defaults to on if $KMYTH_TPM_PARAM_ENC is set.\n"
+          " -P or --preflight     Check the PCR policy on the host before loading anything into the TPM, and\n"
+          "                       fail fast if it is not satisfied. Defaults to on if $KMYTH_TPM_PREFLIGHT is set.\n"
+          " -N or --nv_index      Unseal the data sealed into this TPM NV index by kmyth-seal -N, with a\n"
+          "                       single TPM command, instead of an input .ski.\n"
+          " -p or --pcrs_list     The PCRs the -N NV index was sealed to (see kmyth-seal -p).\n"
+          " -c or --check_policy  Only check whether the current PCR values satisfy the policy of the input\n"
+          "                       (exit status 0 if they do), listing the PCRs in the policy if not.\n"
           " -v or --verbose       Enable detailed logging.\n"
-          " -h or --help          Help (displays this usage).\n", prog);
+          " -h or --help          Help (displays this usage).\n", prog,
+          prog, KMYTH_UNSEALERD_SOCKET_PATH);
 }
 
 const struct option longopts[] = {
@@ -36,8 +753,23 @@ const struct option longopts[] = {
   {"input", required_argument, 0, 'i'},
   {"output", required_argument, 0, 'o'},
   {"force", no_argument, 0, 'f'},
+  {"multi", no_argument, 0, 'm'},
+  {"input_dir", required_argument, 0, 'd'},
+  {"jobs", required_argument, 0, 'j'},
   {"owner_auth", required_argument, 0, 'w'},
   {"standard", no_argument, 0, 's'},
+  {"fd_exec", no_argument, 0, 'F'},
+  {"socket", required_argument, 0, 'S'},
+  {"threads", required_argument, 0, 't'},
+  {"timings", no_argument, 0, 'T'},
+  {"tpm_trace", required_argument, 0, 'E'},
+  {"srk_handle", required_argument, 0, 'K'},
+  {"tcti", required_argument, 0, 'R'},
+  {"param_enc", no_argument, 0, 'e'},
+  {"preflight", no_argument, 0, 'P'},
+  {"check_policy", no_argument, 0, 'c'},
+  {"nv_index", required_argument, 0, 'N'},
+  {"pcrs_list", required_argument, 0, 'p'},
   {"verbose", no_argument, 0, 'v'},
   {"help", no_argument, 0, 'h'},
   {0, 0, 0, 0}
@@ -57,18 +789,45 @@ int main(int argc, char **argv)
   set_app_version(KMYTH_VERSION);
   set_applog_path(KMYTH_APPLOG_PATH);
 
+#ifdef KMYTH_BOOT
+  // OpenSSL initializes itself on first use (only the ciphers and digests
+  // the unseal needs are set up); in the boot build, keep it from looking
+  // for an openssl.cnf (and the providers it may name) the initramfs lacks
+  if (OPENSSL_init_crypto(OPENSSL_INIT_NO_LOAD_CONFIG, NULL) == 0)
+  {
+    kmyth_log(LOG_ERR, "unable to initialize OpenSSL ... exiting");
+    return 1;
+  }
+#endif
+
+  // Apply the options configured for this tool in the Kmyth configuration
+  // file, ahead of (so they are overridden by) the command line options
+  if (kmyth_config_apply(longopts, &argc, &argv))
+  {
+    return 1;
+  }
+
   // Initialize parameters that might be modified by command line options
   char *inPath = NULL;
   char *outPath = NULL;
   bool stdout_flag = false;
+  bool fdExec = false;
   char *authString = NULL;
   char *ownerAuthPasswd = "";
   bool forceOverwrite = false;
+  bool checkPolicy = false;
+  char *nvIndexString = NULL;
+  char *pcrsString = NULL;
+  char *socketPath = NULL;
+  long threadCount = 1;
+  bool multiMode = false;
+  char *inDir = NULL;
+  long jobCount = sysconf(_SC_NPROCESSORS_ONLN);
   int options;
   int option_index;
 
   // Parse and apply command line options
-  while ((options = getopt_long(argc, argv, "a:i:o:w:fhsv", longopts,
+  while ((options = getopt_long(argc, argv, "a:d:i:j:o:w:S:t:E:K:N:R:p:cefFhmsPTv", longopts,
                                 &option_index)) != -1)
   {
     switch (options)
@@ -82,12 +841,76 @@ int main(int argc, char **argv)
     case 'i':
       inPath = optarg;
       break;
+    case 'm':
+      multiMode = true;
+      break;
+    case 'd':
+      inDir = optarg;
+      break;
+    case 'j':
+      jobCount = strtol(optarg, NULL, 10);
+      if (jobCount < 1)
+      {
+        kmyth_log(LOG_ERR, "invalid job count (%s) ... exiting", optarg);
+        return 1;
+      }
+      break;
     case 'o':
       outPath = optarg;
       break;
     case 'w':
       ownerAuthPasswd = optarg;
       break;
+    case 'S':
+      socketPath = optarg;
+      break;
+    case 't':
+      threadCount = strtol(optarg, NULL, 10);
+      if (threadCount < 1 || threadCount > GCM_STREAM_MAX_THREADS)
+      {
+        kmyth_log(LOG_ERR, "invalid thread count (%s) ... exiting", optarg);
+        return 1;
+      }
+      aes_gcm_stream_set_threads((unsigned int) threadCount);
+      break;
+    case 'T':
+      kmyth_timings_enable(true);
+      atexit(print_timings);
+      break;
+    case 'E':
+      if (tpm2_trace_open(optarg))
+      {
+        return 1;
+      }
+      atexit(tpm2_trace_close);
+      break;
+    case 'K':
+      if (set_srk_handle(optarg))
+      {
+        return 1;
+      }
+      break;
+    case 'R':
+      if (set_tcti_config(optarg))
+      {
+        return 1;
+      }
+      break;
+    case 'e':
+      setenv(KMYTH_TPM_PARAM_ENC_ENV, "1", 1);
+      break;
+    case 'P':
+      setenv(KMYTH_TPM_PREFLIGHT_ENV, "1", 1);
+      break;
+    case 'c':
+      checkPolicy = true;
+      break;
+    case 'N':
+      nvIndexString = optarg;
+      break;
+    case 'p':
+      pcrsString = optarg;
+      break;
     case 'v':
       // always display all log messages (severity threshold = LOG_DEBUG)
       // to stdout or stderr (output mode = 0)
@@ -97,6 +920,9 @@ int main(int argc, char **argv)
     case 's':
       stdout_flag = true;
       break;
+    case 'F':
+      fdExec = true;
+      break;
     case 'h':
       usage(argv[0]);
       return 0;
@@ -110,16 +936,150 @@ int main(int argc, char **argv)
   size_t oa_passwd_len =
     (ownerAuthPasswd == NULL) ? 0 : strlen(ownerAuthPasswd);
 
-  // Check that input path (file to be sealed) was specified
-  if (inPath == NULL || (outPath == NULL && stdout_flag == false))
+  // A policy check needs only the input .ski
+  if (checkPolicy)
+  {
+    int retval = 1;
+
+    kmyth_clear(authString, auth_string_len);
+    if (inPath == NULL || strcmp(inPath, "-") == 0)
+    {
+      kmyth_log(LOG_ERR, "an input file must be specified ... exiting");
+    }
+    else if (verifyInputFilePath(inPath))
+    {
+      kmyth_log(LOG_ERR, "invalid input path (%s) ... exiting", inPath);
+    }
+    else
+    {
+      retval = check_policy(inPath, (uint8_t *) ownerAuthPasswd,
+                            oa_passwd_len);
+    }
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return retval;
+  }
+
+  // Multi-file mode unseals the '-i' input (if any), followed by any
+  // remaining (non-option) command line arguments, in order, followed by
+  // the .ski files in the '-d' input directory (if any)
+  if (inDir != NULL)
+  {
+    multiMode = true;
+  }
+  if (jobCount < 1)
+  {
+    jobCount = 1;
+  }
+  if (multiMode)
+  {
+    int retval = 1;
+
+    if ((inPath != NULL && strcmp(inPath, "-") == 0) || nvIndexString != NULL
+        || socketPath != NULL || fdExec)
+    {
+      kmyth_log(LOG_ERR, "-m and -d unseal .ski files, with no '-' input, "
+                "-N, -S or -F ... exiting");
+    }
+    else if (stdout_flag == (outPath != NULL))
+    {
+      kmyth_log(LOG_ERR, "-m and -d take either an output directory (-o) "
+                "or -s ... exiting");
+    }
+    else
+    {
+      char **inPaths = malloc((1 + (size_t) (argc - optind)) *
+                              sizeof(char *));
+      size_t inPath_count = 0;
+
+      if (inPaths == NULL)
+      {
+        kmyth_log(LOG_ERR, "failed to allocate input path list ... exiting");
+      }
+      else
+      {
+        retval = 0;
+        if (inPath != NULL)
+        {
+          inPaths[inPath_count++] = strdup(inPath);
+        }
+        for (int i = optind; i < argc; i++)
+        {
+          inPaths[inPath_count++] = strdup(argv[i]);
+        }
+        for (size_t i = 0; i < inPath_count; i++)
+        {
+          if (inPaths[i] == NULL)
+          {
+            kmyth_log(LOG_ERR, "failed to allocate input path ... exiting");
+            retval = 1;
+          }
+        }
+        if (retval == 0 && inDir != NULL)
+        {
+          retval = append_dir_files(inDir, ".ski", &inPaths, &inPath_count);
+        }
+        if (retval == 0 && inPath_count == 0)
+        {
+          kmyth_log(LOG_ERR, "no .ski files to unseal ... exiting");
+          retval = 1;
+        }
+        if (retval == 0)
+        {
+          retval = unseal_multi_files(inPaths, inPath_count, outPath,
+                                      forceOverwrite, (size_t) jobCount,
+                                      (uint8_t *) authString,
+                                      auth_string_len,
+                                      (uint8_t *) ownerAuthPasswd,
+                                      oa_passwd_len);
+        }
+        for (size_t i = 0; i < inPath_count; i++)
+        {
+          free(inPaths[i]);
+        }
+        free(inPaths);
+      }
+    }
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    if (retval)
+    {
+      kmyth_log(LOG_ERR, "kmyth-unseal failed ... exiting");
+    }
+    return retval;
+  }
+
+  // Check that input path (file to be sealed), or an NV index, was specified
+  if ((inPath == NULL && nvIndexString == NULL)
+      || (inPath != NULL && nvIndexString != NULL)
+      || (outPath == NULL && stdout_flag == false && fdExec == false))
   {
     kmyth_log(LOG_ERR,
-              "Input file and output file (or stdout) must both be specified ... exiting");
+              "Input file (or NV index) and output file (or stdout) must both be specified ... exiting");
     kmyth_clear(authString, auth_string_len);
     kmyth_clear(ownerAuthPasswd, oa_passwd_len);
     return 1;
   }
-  else
+  if (fdExec && (outPath != NULL || stdout_flag || optind >= argc))
+  {
+    kmyth_log(LOG_ERR, "-F takes a command to run, and no -o or -s "
+              "... exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
+  if (fdExec)
+  {
+    int retval = unseal_fd_exec(inPath, nvIndexString, pcrsString,
+                                socketPath, argv + optind,
+                                (uint8_t *) authString, auth_string_len,
+                                (uint8_t *) ownerAuthPasswd, oa_passwd_len);
+
+    // only reached if the command could not be run
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return retval;
+  }
+  else if (inPath != NULL && strcmp(inPath, "-") != 0)
   {
     if (verifyInputFilePath(inPath))
     {
@@ -156,13 +1116,77 @@ int main(int argc, char **argv)
     }
   }
 
-  // Call top-level "kmyth-unseal" function
+  // Without kmyth-unsealerd, the .ski is unsealed as it is read (from a
+  // file or stdin) and its contents written out as they are recovered -
+  // unless the data is to be decrypted on several threads, which needs a
+  // .ski file read in full
+  bool from_stdin = (inPath != NULL && strcmp(inPath, "-") == 0);
+
+  if (nvIndexString == NULL && socketPath == NULL
+      && (from_stdin || threadCount == 1))
+  {
+    int retval = unseal_stream(inPath, (stdout_flag) ? "-" : outPath,
+                               (uint8_t *) authString, auth_string_len,
+                               (uint8_t *) ownerAuthPasswd, oa_passwd_len);
+
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    if (retval)
+    {
+      kmyth_log(LOG_ERR, "kmyth-unseal failed ... exiting");
+      return 1;
+    }
+    if (!stdout_flag)
+    {
+      kmyth_log(LOG_DEBUG, "unsealed contents of %s to %s", inPath, outPath);
+    }
+    return 0;
+  }
+
+  // Otherwise, hand the .ski contents to kmyth-unsealerd, which unseals them
+  // with its already open TPM context, or unseal them in memory
   uint8_t *output = NULL;
   size_t output_length = 0;
+  uint8_t *ski_bytes = NULL;
+  size_t ski_bytes_len = 0;
+  int unseal_result = 0;
+
+  if (nvIndexString != NULL)
+  {
+    unseal_result = unseal_nv_index(nvIndexString, pcrsString,
+                                    &output, &output_length,
+                                    (uint8_t *) authString, auth_string_len,
+                                    (uint8_t *) ownerAuthPasswd,
+                                    oa_passwd_len);
+    inPath = nvIndexString;
+  }
+  else if (socketPath != NULL && from_stdin)
+  {
+    kmyth_log(LOG_ERR, "stdin cannot be unsealed through kmyth-unsealerd");
+    unseal_result = 1;
+  }
+  else if (socketPath != NULL)
+  {
+    unseal_result = map_bytes_from_file(inPath, &ski_bytes, &ski_bytes_len);
+    if (unseal_result == 0)
+    {
+      unseal_result = unsealerd_unseal(socketPath, ski_bytes, ski_bytes_len,
+                                       (uint8_t *) authString,
+                                       auth_string_len,
+                                       &output, &output_length);
+      unmap_bytes_from_file(ski_bytes, ski_bytes_len);
+    }
+  }
+  else
+  {
+    unseal_result = tpm2_kmyth_unseal_file(inPath, &output, &output_length,
+                                           (uint8_t *) authString,
+                                           auth_string_len,
+                                           (uint8_t *) ownerAuthPasswd,
+                                           oa_passwd_len);
+  }
 
-  if (tpm2_kmyth_unseal_file(inPath, &output, &output_length,
-                             (uint8_t *) authString, auth_string_len,
-                             (uint8_t *) ownerAuthPasswd, oa_passwd_len))
+  if (unseal_result)
   {
     kmyth_clear_and_free(output, output_length);
     kmyth_log(LOG_ERR, "kmyth-unseal failed ... exiting");
@@ -174,6 +1198,8 @@ int main(int argc, char **argv)
   kmyth_clear(authString, auth_string_len);
   kmyth_clear(ownerAuthPasswd, oa_passwd_len);
 
+  uint64_t timer = kmyth_timer_begin();
+
   if (stdout_flag == true)
   {
     if (print_to_stdout(output, output_length))
@@ -192,6 +1218,7 @@ int main(int argc, char **argv)
       kmyth_log(LOG_DEBUG, "unsealed contents of %s to %s", inPath, outPath);
     }
   }
+  kmyth_timer_end(KMYTH_PHASE_FILE_IO, timer);
 
   kmyth_clear_and_free(output, output_length);
 
@@ -0,0 +1,605 @@
+/*
+ * Kmyth Unsealing Daemon - TPM 2.0
+ *
+ * Keeps one warm TPM context open (resource manager connection, SRK
+ * handle, and cached storage keys) and serves unseal requests from local
+ * clients over an AF_UNIX socket (see protocol/unsealerd_util.h).
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <arpa/inet.h>
+#include <openssl/evp.h>
+
+#include "config_file.h"
+#include "defines.h"
+#include "file_io.h"
+#include "kmyth.h"
+#include "kmyth_log.h"
+#include "kmyth_metrics.h"
+#include "memory_util.h"
+#include "secret_cache.h"
+#include "socket_util.h"
+#include "tpm/storage_key_tools.h"
+#include "tpm/tpm2_interface.h"
+#include "tpm/tpm2_trace.h"
+#include "unsealerd_util.h"
+
+/// Most user (group) IDs that can be given with -u (-g).
+#define UNSEALERD_MAX_ALLOWED_IDS 32
+
+/**
+ * @brief State shared by the kmyth-unsealerd worker threads
+ */
+typedef struct unsealerd_state
+{
+  kmyth_tpm_context *ctx;
+  int listen_fd;
+
+  // unsealed data, keyed on unseal_cache_key() (NULL if caching is off)
+  secret_cache *cache;
+
+  // peers allowed to connect, in addition to root and the daemon's user
+  uid_t allowed_uids[UNSEALERD_MAX_ALLOWED_IDS];
+  size_t allowed_uid_count;
+  gid_t allowed_gids[UNSEALERD_MAX_ALLOWED_IDS];
+  size_t allowed_gid_count;
+
+  // set (before the listening socket is shut down) when the daemon stops
+  volatile sig_atomic_t stopping;
+} unsealerd_state;
+
+static void usage(const char *prog)
+{
+  fprintf(stdout,
+          "\nusage: %s [options]\n\n"
+          "options are: \n\n"
+          " -S or --socket        Path of the local socket to serve. Defaults to %s.\n"
+          " -m or --mode          Permissions (octal) of the socket file. Defaults to 0660.\n"
+          " -u or --allow_uid     Also accept clients running as this user ID (may be repeated).\n"
+          " -g or --allow_gid     Also accept clients running as this group ID (may be repeated).\n"
+          "                       Clients running as root or as the daemon's user are always accepted.\n"
+          " -j or --jobs          Number of connections served at once. Defaults to %d.\n"
+          " -c or --cache_size    Bytes of locked memory for caching unsealed data (0 disables). Defaults to %d.\n"
+          " -t or --cache_ttl     Seconds unsealed data is served from the cache (0 disables). Defaults to %d.\n"
+          "                       SIGHUP clears the cache (and reopens the log file).\n"
+          " -w or --owner_auth    TPM 2.0 storage (owner) hierarchy authorization. Defaults to emptyAuth to match TPM default.\n"
+          " -M or --metrics       Serve metrics (Prometheus text format) on this local socket, created with\n"
+          "                       the same permissions (-m) as the request socket.\n"
+          " -E or --tpm_trace     Write each TPM command (code, duration, response code, sessions) to this\n"
+          "                       file, in the Chrome trace-event format.\n"
+          " -K or --srk_handle    Persistent handle expected to hold the storage root key (SRK).\n"
+          "                       Defaults to $KMYTH_SRK_HANDLE, if set, else the handle last recorded in\n"
+          "                       '" KMYTH_SRK_STATE_FILE "'.\n"
+          " -R or --tcti          TPM transport (TCTI) configuration, e.g. 'device:/dev/tpmrm0' for the\n"
+          "                       kernel resource manager or 'mssim' for a simulator. Defaults to\n"
+          "                       $KMYTH_TCTI, if set, else tpm2-abrmd.\n"
+          " -e or --param_enc     Encrypt the wrapping key as it is returned by the TPM (TPM parameter\n"
+          "                       encryption). Defaults to on if $KMYTH_TPM_PARAM_ENC is set.\n"
+          " -v or --verbose       Enable detailed logging.\n"
+          " -h or --help          Help (displays this usage).\n", prog,
+          KMYTH_UNSEALERD_SOCKET_PATH, KMYTH_UNSEALERD_WORKERS,
+          KMYTH_UNSEALERD_CACHE_SIZE, KMYTH_UNSEALERD_CACHE_TTL);
+}
+
+const struct option longopts[] = {
+  {"socket", required_argument, 0, 'S'},
+  {"mode", required_argument, 0, 'm'},
+  {"allow_uid", required_argument, 0, 'u'},
+  {"allow_gid", required_argument, 0, 'g'},
+  {"jobs", required_argument, 0, 'j'},
+  {"cache_size", required_argument, 0, 'c'},
+  {"cache_ttl", required_argument, 0, 't'},
+  {"owner_auth", required_argument, 0, 'w'},
+  {"metrics", required_argument, 0, 'M'},
+  {"tpm_trace", required_argument, 0, 'E'},
+  {"srk_handle", required_argument, 0, 'K'},
+  {"tcti", required_argument, 0, 'R'},
+  {"param_enc", no_argument, 0, 'e'},
+  {"verbose", no_argument, 0, 'v'},
+  {"help", no_argument, 0, 'h'},
+  {0, 0, 0, 0}
+};
+
+//############################################################################
+// parse_id()
+//############################################################################
+static int parse_id(const char *id_string, unsigned long *id)
+{
+  char *end = NULL;
+
+  errno = 0;
+  *id = strtoul(id_string, &end, 10);
+  if (errno != 0 || end == id_string || *end != '\0')
+  {
+    kmyth_log(LOG_ERR, "invalid ID (%s) ... exiting", id_string);
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// peer_is_allowed()
+//############################################################################
+static bool peer_is_allowed(unsealerd_state * state, uid_t uid, gid_t gid)
+{
+  if (uid == 0 || uid == geteuid())
+  {
+    return true;
+  }
+  for (size_t i = 0; i < state->allowed_uid_count; i++)
+  {
+    if (uid == state->allowed_uids[i])
+    {
+      return true;
+    }
+  }
+  for (size_t i = 0; i < state->allowed_gid_count; i++)
+  {
+    if (gid == state->allowed_gids[i])
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+//############################################################################
+// unseal_cache_key()
+//############################################################################
+static int unseal_cache_key(uint8_t * auth_bytes, size_t auth_bytes_len,
+                            uint8_t * ski_bytes, size_t ski_bytes_len,
+                            uint8_t * key)
+{
+  // The key covers the authorization string as well as the .ski contents,
+  // so a cached result is only served to a request that would also have
+  // been able to unseal it
+  uint32_t auth_len_be = htonl((uint32_t) auth_bytes_len);
+  unsigned int key_len = 0;
+  EVP_MD_CTX *md_ctx = EVP_MD_CTX_new();
+  int result = (md_ctx != NULL
+                && EVP_DigestInit_ex(md_ctx, EVP_sha256(), NULL)
+                && EVP_DigestUpdate(md_ctx, &auth_len_be, sizeof(auth_len_be))
+                && EVP_DigestUpdate(md_ctx, auth_bytes, auth_bytes_len)
+                && EVP_DigestUpdate(md_ctx, ski_bytes, ski_bytes_len)
+                && EVP_DigestFinal_ex(md_ctx, key, &key_len)
+                && key_len == SECRET_CACHE_KEY_SIZE);
+
+  EVP_MD_CTX_free(md_ctx);
+
+  return (result) ? 0 : 1;
+}
+
+//############################################################################
+// serve_connection()
+//############################################################################
+static void serve_connection(unsealerd_state * state, int client_fd)
+{
+  uid_t uid = 0;
+  gid_t gid = 0;
+  pid_t pid = 0;
+
+  // the peer's credentials are recorded by the kernel at connect() time,
+  // so they cannot be forged by the client
+  if (get_peer_credentials(client_fd, &uid, &gid, &pid))
+  {
+    return;
+  }
+  if (!peer_is_allowed(state, uid, gid))
+  {
+    kmyth_log(LOG_WARNING,
+              "refused connection from pid %d (uid %u, gid %u)",
+              (int) pid, (unsigned) uid, (unsigned) gid);
+    return;
+  }
+  kmyth_log(LOG_DEBUG, "accepted connection from pid %d (uid %u, gid %u)",
+            (int) pid, (unsigned) uid, (unsigned) gid);
+
+  // bound how long a stalled client can hold this worker
+  struct timeval timeout = {.tv_sec = KMYTH_UNSEALERD_IO_TIMEOUT, };
+  setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  // serve requests until the client closes the connection
+  while (!state->stopping)
+  {
+    uint8_t type = 0;
+    uint8_t *request = NULL;
+    size_t request_len = 0;
+
+    if (recv_unsealerd_message(client_fd, KMYTH_UNSEALERD_MAX_MESSAGE_SIZE,
+                               &type, &request, &request_len))
+    {
+      return;
+    }
+
+    uint8_t *auth_bytes = NULL;
+    size_t auth_bytes_len = 0;
+    uint8_t *ski_bytes = NULL;
+    size_t ski_bytes_len = 0;
+    uint8_t *output = NULL;
+    size_t output_len = 0;
+
+    int result = 1;
+    bool from_cache = false;
+    uint64_t begin = kmyth_metrics_clock();
+
+    if (type != UNSEALERD_MSG_UNSEAL && type != UNSEALERD_MSG_UNSEAL_FD)
+    {
+      kmyth_log(LOG_ERR, "unexpected request type (%u) from pid %d",
+                type, (int) pid);
+    }
+    else if (parse_unseal_request(request, request_len,
+                                  &auth_bytes, &auth_bytes_len,
+                                  &ski_bytes, &ski_bytes_len) == 0)
+    {
+      uint8_t key[SECRET_CACHE_KEY_SIZE] = { 0 };
+      bool cacheable = (state->cache != NULL
+                        && unseal_cache_key(auth_bytes, auth_bytes_len,
+                                            ski_bytes, ski_bytes_len,
+                                            key) == 0);
+
+      if (cacheable
+          && secret_cache_get(state->cache, key, &output, &output_len) == 0)
+      {
+        kmyth_log(LOG_DEBUG, "served request from pid %d from the cache",
+                  (int) pid);
+        kmyth_metrics_count("kmyth_unsealerd_cache_hits_total", NULL,
+                            "Unseal requests served from the cache.", 1);
+        result = 0;
+        from_cache = true;
+      }
+      else
+      {
+        if (cacheable)
+        {
+          kmyth_metrics_count("kmyth_unsealerd_cache_misses_total", NULL,
+                              "Unseal requests not found in the cache.", 1);
+        }
+        result = kmyth_tpm_context_unseal(state->ctx,
+                                          ski_bytes, ski_bytes_len,
+                                          &output, &output_len,
+                                          auth_bytes, auth_bytes_len);
+        if (result)
+        {
+          kmyth_log(LOG_ERR, "unseal request from pid %d failed", (int) pid);
+        }
+        else if (cacheable)
+        {
+          secret_cache_put(state->cache, key, output, output_len);
+        }
+      }
+      kmyth_clear(key, sizeof(key));
+    }
+
+    if (result == 0)
+    {
+      kmyth_metrics_observe_latency("kmyth_unseal_duration_seconds",
+                                    (from_cache) ? "source=\"cache\""
+                                    : "source=\"tpm\"",
+                                    "Time taken to serve an unseal request.",
+                                    begin);
+    }
+    kmyth_metrics_count("kmyth_unsealerd_requests_total",
+                        (result == 0) ? "result=\"ok\"" : "result=\"error\"",
+                        "Unseal requests served.", 1);
+
+    // the request holds the authorization string
+    kmyth_clear_and_free(request, request_len);
+
+    // the data asked for by descriptor is copied straight into a memory
+    // file, which the client maps without it passing through the socket
+    int output_fd = -1;
+
+    if (result == 0 && type == UNSEALERD_MSG_UNSEAL_FD)
+    {
+      result = write_bytes_to_secret_fd(output, output_len, &output_fd);
+    }
+
+    if (result)
+    {
+      result = send_unsealerd_message(client_fd, UNSEALERD_MSG_ERROR,
+                                      NULL, 0);
+    }
+    else if (output_fd != -1)
+    {
+      result = send_unsealerd_fd_message(client_fd, output_fd, output_len);
+      close(output_fd);
+    }
+    else
+    {
+      result = send_unsealerd_message(client_fd, UNSEALERD_MSG_DATA,
+                                      output, output_len);
+    }
+    kmyth_clear_and_free(output, output_len);
+
+    if (result)
+    {
+      return;
+    }
+  }
+}
+
+//############################################################################
+// unsealerd_worker()
+//############################################################################
+static void *unsealerd_worker(void *arg)
+{
+  unsealerd_state *state = (unsealerd_state *) arg;
+
+  while (!state->stopping)
+  {
+    int client_fd = accept(state->listen_fd, NULL, NULL);
+
+    if (client_fd < 0)
+    {
+      if (state->stopping)
+      {
+        break;
+      }
+      if (errno != EINTR && errno != ECONNABORTED)
+      {
+        // back off, so that e.g. running out of file descriptors does
+        // not become a busy loop
+        kmyth_log(LOG_ERR, "accept error: %s", strerror(errno));
+        sleep(1);
+      }
+      continue;
+    }
+
+    serve_connection(state, client_fd);
+    close(client_fd);
+  }
+
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  // Configure logging messages
+  set_app_name(KMYTH_APP_NAME);
+  set_app_version(KMYTH_VERSION);
+  set_applog_path(KMYTH_APPLOG_PATH);
+
+  // Apply the options configured for this tool in the Kmyth configuration
+  // file, ahead of (so they are overridden by) the command line options
+  if (kmyth_config_apply(longopts, &argc, &argv))
+  {
+    return 1;
+  }
+
+  // Initialize parameters that might be modified by command line options
+  char *socketPath = KMYTH_UNSEALERD_SOCKET_PATH;
+  mode_t socketMode = 0660;
+  long jobCount = KMYTH_UNSEALERD_WORKERS;
+  long cacheSize = KMYTH_UNSEALERD_CACHE_SIZE;
+  long cacheTtl = KMYTH_UNSEALERD_CACHE_TTL;
+  char *ownerAuthPasswd = "";
+  char *metricsPath = NULL;
+  unsealerd_state state = {.listen_fd = -1, };
+
+  int options;
+  int option_index;
+  unsigned long id = 0;
+
+  // Parse and apply command line options
+  while ((options = getopt_long(argc, argv, "S:m:u:g:j:c:t:w:M:E:K:R:ehv", longopts,
+                                &option_index)) != -1)
+  {
+    switch (options)
+    {
+    case 'S':
+      socketPath = optarg;
+      break;
+    case 'm':
+      socketMode = (mode_t) strtoul(optarg, NULL, 8) & 0777;
+      break;
+    case 'u':
+      if (parse_id(optarg, &id)
+          || state.allowed_uid_count == UNSEALERD_MAX_ALLOWED_IDS)
+      {
+        kmyth_log(LOG_ERR, "unable to allow user ID %s ... exiting", optarg);
+        return 1;
+      }
+      state.allowed_uids[state.allowed_uid_count++] = (uid_t) id;
+      break;
+    case 'g':
+      if (parse_id(optarg, &id)
+          || state.allowed_gid_count == UNSEALERD_MAX_ALLOWED_IDS)
+      {
+        kmyth_log(LOG_ERR, "unable to allow group ID %s ... exiting", optarg);
+        return 1;
+      }
+      state.allowed_gids[state.allowed_gid_count++] = (gid_t) id;
+      break;
+    case 'j':
+      jobCount = strtol(optarg, NULL, 10);
+      if (jobCount < 1)
+      {
+        kmyth_log(LOG_ERR, "invalid job count (%s) ... exiting", optarg);
+        return 1;
+      }
+      break;
+    case 'c':
+      cacheSize = strtol(optarg, NULL, 10);
+      break;
+    case 't':
+      cacheTtl = strtol(optarg, NULL, 10);
+      break;
+    case 'w':
+      ownerAuthPasswd = optarg;
+      break;
+    case 'M':
+      metricsPath = optarg;
+      break;
+    case 'E':
+      if (tpm2_trace_open(optarg))
+      {
+        return 1;
+      }
+      atexit(tpm2_trace_close);
+      break;
+    case 'K':
+      if (set_srk_handle(optarg))
+      {
+        return 1;
+      }
+      break;
+    case 'R':
+      if (set_tcti_config(optarg))
+      {
+        return 1;
+      }
+      break;
+    case 'e':
+      setenv(KMYTH_TPM_PARAM_ENC_ENV, "1", 1);
+      break;
+    case 'v':
+      // always display all log messages (severity threshold = LOG_DEBUG)
+      // to stdout or stderr (output mode = 0)
+      set_applog_severity_threshold(LOG_DEBUG);
+      set_applog_output_mode(0);
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      return 1;
+    }
+  }
+
+  size_t oa_passwd_len = strlen(ownerAuthPasswd);
+
+  // Open the TPM context once: every request served reuses its resource
+  // manager connection, SRK handle, and storage key cache
+  if (kmyth_tpm_context_open((uint8_t *) ownerAuthPasswd, oa_passwd_len,
+                             &state.ctx))
+  {
+    kmyth_log(LOG_ERR, "unable to open TPM context ... exiting");
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
+  kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+
+  // Without a locked arena the cache is left off, rather than letting
+  // unsealed data be swapped out
+  if (cacheSize > 0 && cacheTtl > 0
+      && secret_cache_new((size_t) cacheSize, KMYTH_UNSEALERD_CACHE_ENTRIES,
+                          (unsigned int) cacheTtl, &state.cache))
+  {
+    kmyth_log(LOG_WARNING, "unsealed data cache disabled");
+  }
+
+  // Block the termination (and cache clearing) signals in every thread,
+  // so the main thread alone can wait for them below
+  sigset_t signals;
+
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  // Workers queue their log entries rather than waiting on log output
+  if (kmyth_log_start_async(KMYTH_LOG_ASYNC_QUEUE_LEN_DEFAULT,
+                            KMYTH_LOG_ASYNC_DROP))
+  {
+    kmyth_log(LOG_WARNING, "asynchronous logging unavailable");
+  }
+
+  if (setup_unix_server_socket(socketPath, socketMode, &state.listen_fd))
+  {
+    kmyth_log(LOG_ERR, "unable to listen on %s ... exiting", socketPath);
+    secret_cache_free(&state.cache);
+    kmyth_tpm_context_close(&state.ctx);
+    return 1;
+  }
+
+  pthread_t *workers = calloc((size_t) jobCount, sizeof(pthread_t));
+  size_t started = 0;
+
+  while (workers != NULL && started < (size_t) jobCount
+         && pthread_create(&workers[started], NULL, unsealerd_worker,
+                           &state) == 0)
+  {
+    started++;
+  }
+
+  if (started == 0)
+  {
+    kmyth_log(LOG_ERR, "unable to start worker threads ... exiting");
+    free(workers);
+    close(state.listen_fd);
+    unlink(socketPath);
+    secret_cache_free(&state.cache);
+    kmyth_tpm_context_close(&state.ctx);
+    return 1;
+  }
+  kmyth_log(LOG_INFO, "serving unseal requests on %s (%zu workers)",
+            socketPath, started);
+
+  // The metrics endpoint is optional: the daemon serves requests without it
+  int metrics_fd = -1;
+
+  if (metricsPath != NULL
+      && (setup_unix_server_socket(metricsPath, socketMode, &metrics_fd)
+          || kmyth_metrics_serve(metrics_fd)))
+  {
+    kmyth_log(LOG_WARNING, "unable to serve metrics on %s", metricsPath);
+    if (metrics_fd >= 0)
+    {
+      close(metrics_fd);
+      unlink(metricsPath);
+    }
+    metricsPath = NULL;
+  }
+
+  int signal_number = 0;
+
+  while (sigwait(&signals, &signal_number) == 0 && signal_number == SIGHUP)
+  {
+    // reopen the log file too, in case it has been rotated
+    kmyth_log_reopen();
+    kmyth_log(LOG_INFO, "received SIGHUP, clearing the unsealed data cache");
+    secret_cache_clear(state.cache);
+  }
+  kmyth_log(LOG_INFO, "received signal %d, shutting down", signal_number);
+
+  // Shutting down the listening socket wakes the workers blocked in
+  // accept(); workers busy with a client finish its current request (or
+  // time out waiting for the next one)
+  state.stopping = 1;
+  shutdown(state.listen_fd, SHUT_RDWR);
+  for (size_t i = 0; i < started; i++)
+  {
+    pthread_join(workers[i], NULL);
+  }
+  free(workers);
+
+  close(state.listen_fd);
+  unlink(socketPath);
+  if (metricsPath != NULL)
+  {
+    kmyth_metrics_stop();
+    unlink(metricsPath);
+  }
+  secret_cache_free(&state.cache);
+  kmyth_tpm_context_close(&state.ctx);
+  kmyth_log_stop_async();
+
+  return 0;
+}
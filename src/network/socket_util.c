@@ -1,26 +1,330 @@
+#include "socket_util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <netdb.h>
 #include <unistd.h>
 
 #include "defines.h"
 
+//
+// now_ms()
+//
+static long long now_ms(void)
+{
+  struct timespec now = { 0 };
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+//
+// socket_connect_error()
+//
+static int socket_connect_error(int socket_fd)
+{
+  int error = 0;
+  socklen_t error_len = sizeof(error);
+
+  if (getsockopt(socket_fd, SOL_SOCKET, SO_ERROR, &error, &error_len) != 0)
+  {
+    error = errno;
+  }
+  return error;
+}
+
+//
+// order_endpoint_addresses()
+//
+static size_t order_endpoint_addresses(struct addrinfo *result,
+                                       struct addrinfo **ordered)
+{
+  // Alternate between address families, starting with the one the
+  // resolver preferred, so a broken IPv6 (or IPv4) path costs at most one
+  // attempt delay (RFC 8305, section 4)
+  size_t count = 0;
+  struct addrinfo *preferred = result;
+  struct addrinfo *other = result;
+
+  while (preferred != NULL || other != NULL)
+  {
+    while (preferred != NULL && preferred->ai_family != result->ai_family)
+    {
+      preferred = preferred->ai_next;
+    }
+    if (preferred != NULL)
+    {
+      ordered[count++] = preferred;
+      preferred = preferred->ai_next;
+    }
+    while (other != NULL && other->ai_family == result->ai_family)
+    {
+      other = other->ai_next;
+    }
+    if (other != NULL)
+    {
+      ordered[count++] = other;
+      other = other->ai_next;
+    }
+  }
+
+  return count;
+}
+
 //
 // setup_client_socket()
 //
 int setup_client_socket(const char *node, const char *service, int *socket_fd)
 {
-  // Setup socket settings and lookup the target Internet address.
+  size_t index = 0;
+
+  return setup_client_socket_any(&node, &service, 1, KMYTH_CONNECT_TIMEOUT_MS,
+                                 socket_fd, &index);
+}
+
+//
+// setup_client_socket_any()
+//
+int setup_client_socket_any(const char **nodes, const char **services,
+                            size_t count, int timeout_ms,
+                            int *socket_fd, size_t *index)
+{
+  *socket_fd = -1;
+
+  if (nodes == NULL || services == NULL || count == 0
+      || count > KMYTH_MAX_SERVER_ENDPOINTS || timeout_ms <= 0)
+  {
+    kmyth_log(LOG_ERR, "Invalid client socket endpoints.");
+    return 1;
+  }
+
+  // Setup socket settings and lookup each target's Internet addresses
+  // (of either family, for the hosts configured for it).
+  struct addrinfo hints = { 0 };
+  struct addrinfo *results[KMYTH_MAX_SERVER_ENDPOINTS] = { 0 };
+  size_t result_counts[KMYTH_MAX_SERVER_ENDPOINTS] = { 0 };
+  size_t total = 0;
+
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_ADDRCONFIG;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    int s = getaddrinfo(nodes[i], services[i], &hints, &results[i]);
+
+    if (s != 0)
+    {
+      kmyth_log(LOG_WARNING, "Failed to lookup %s: %s", nodes[i],
+                gai_strerror(s));
+      results[i] = NULL;
+      continue;
+    }
+    for (struct addrinfo * rp = results[i]; rp != NULL; rp = rp->ai_next)
+    {
+      result_counts[i]++;
+    }
+    total += result_counts[i];
+  }
+  if (total == 0)
+  {
+    kmyth_log(LOG_ERR, "Failed to lookup target Internet address.");
+    return 1;
+  }
+
+  // Order the attempts: each target's addresses alternate between families,
+  // and the targets take turns, so every target is tried early on.
+  struct addrinfo **ordered = calloc(total, sizeof(struct addrinfo *));
+  struct addrinfo **attempts = calloc(total, sizeof(struct addrinfo *));
+  size_t *attempt_targets = calloc(total, sizeof(size_t));
+  struct pollfd *pending = calloc(total, sizeof(struct pollfd));
+
+  if (ordered == NULL || attempts == NULL || attempt_targets == NULL
+      || pending == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to allocate connection attempts.");
+    free(ordered);
+    free(attempts);
+    free(attempt_targets);
+    free(pending);
+    for (size_t i = 0; i < count; i++)
+    {
+      if (results[i] != NULL)
+      {
+        freeaddrinfo(results[i]);
+      }
+    }
+    return 1;
+  }
+
+  size_t offsets[KMYTH_MAX_SERVER_ENDPOINTS] = { 0 };
+  size_t offset = 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    offsets[i] = offset;
+    if (results[i] != NULL)
+    {
+      offset += order_endpoint_addresses(results[i], ordered + offset);
+    }
+  }
+
+  size_t attempt_count = 0;
+
+  for (size_t rank = 0; attempt_count < total; rank++)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      if (rank < result_counts[i])
+      {
+        attempts[attempt_count] = ordered[offsets[i] + rank];
+        attempt_targets[attempt_count] = i;
+        attempt_count++;
+      }
+    }
+  }
+  for (size_t i = 0; i < total; i++)
+  {
+    pending[i].fd = -1;
+    pending[i].events = POLLOUT;
+  }
+
+  // Race the attempts: start the next one each time the pending ones have
+  // had the attempt delay to connect (or as soon as all of them fail), and
+  // use whichever connects first.
+  long long deadline = now_ms() + timeout_ms;
+  long long next_start = 0;
+  size_t started = 0;
+  size_t active = 0;
+  long long winner = -1;
+
+  while (winner < 0)
+  {
+    long long now = now_ms();
+
+    if (now >= deadline)
+    {
+      kmyth_log(LOG_ERR, "Timed out establishing socket connection.");
+      break;
+    }
+
+    if (started < total && (active == 0 || now >= next_start))
+    {
+      struct addrinfo *rp = attempts[started];
+      int fd = socket(rp->ai_family,
+                      rp->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                      rp->ai_protocol);
+
+      if (fd != -1 && connect(fd, rp->ai_addr, rp->ai_addrlen) == 0)
+      {
+        pending[started].fd = fd;
+        winner = (long long) started;
+      }
+      else if (fd != -1 && errno == EINPROGRESS)
+      {
+        pending[started].fd = fd;
+        active++;
+      }
+      else if (fd != -1)
+      {
+        close(fd);
+      }
+      started++;
+      next_start = now + KMYTH_CONNECT_ATTEMPT_DELAY_MS;
+      continue;
+    }
+    if (active == 0)
+    {
+      kmyth_log(LOG_ERR, "Failed to establish socket connection.");
+      break;
+    }
+
+    long long wait = deadline - now;
+
+    if (started < total && next_start - now < wait)
+    {
+      wait = next_start - now;
+    }
+    if (poll(pending, started, (int) wait) < 0 && errno != EINTR)
+    {
+      kmyth_log(LOG_ERR, "Failed to poll connection attempts.");
+      break;
+    }
+
+    for (size_t i = 0; i < started && winner < 0; i++)
+    {
+      if (pending[i].fd == -1 || pending[i].revents == 0)
+      {
+        continue;
+      }
+      if (socket_connect_error(pending[i].fd) == 0)
+      {
+        winner = (long long) i;
+        continue;
+      }
+
+      // a refused attempt makes way for the next one right away
+      kmyth_log(LOG_DEBUG, "Connection attempt to %s failed.",
+                nodes[attempt_targets[i]]);
+      close(pending[i].fd);
+      pending[i].fd = -1;
+      active--;
+      next_start = now;
+    }
+  }
+
+  // Keep the winner (as a blocking socket), and abandon the other attempts.
+  for (size_t i = 0; i < started; i++)
+  {
+    if (pending[i].fd != -1 && (long long) i != winner)
+    {
+      close(pending[i].fd);
+    }
+  }
+  if (winner >= 0)
+  {
+    *socket_fd = pending[winner].fd;
+    *index = attempt_targets[winner];
+    fcntl(*socket_fd, F_SETFL, fcntl(*socket_fd, F_GETFL) & ~O_NONBLOCK);
+  }
+
+  free(ordered);
+  free(attempts);
+  free(attempt_targets);
+  free(pending);
+  for (size_t i = 0; i < count; i++)
+  {
+    if (results[i] != NULL)
+    {
+      freeaddrinfo(results[i]);
+    }
+  }
+
+  return (winner >= 0) ? 0 : 1;
+}
+
+//
+// start_client_socket()
+//
+int start_client_socket(const char *node, const char *service, int *socket_fd)
+{
   *socket_fd = -1;
 
   struct addrinfo hints = { 0 };
   struct addrinfo *result = NULL;
   struct addrinfo *rp = NULL;
 
-  hints.ai_family = AF_INET;
+  hints.ai_family = AF_UNSPEC;
   hints.ai_socktype = SOCK_STREAM;
-  hints.ai_flags = 0;
-  hints.ai_protocol = 0;
+  hints.ai_flags = AI_ADDRCONFIG;
 
   int s = getaddrinfo(node, service, &hints, &result);
 
@@ -31,29 +335,47 @@ int setup_client_socket(const char *node, const char *service, int *socket_fd)
     return 1;
   }
 
-  // Scan through the set of possible Internet addresses until we find the
-  // right one.
+  // Start connecting to the first address that accepts the attempt. A
+  // refusal that only shows up later is reported by finish_client_socket().
   for (rp = result; rp != NULL; rp = rp->ai_next)
   {
-    *socket_fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+    *socket_fd = socket(rp->ai_family,
+                        rp->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                        rp->ai_protocol);
     if (*socket_fd == -1)
     {
-      // Socket creation failed, try the next address.
       continue;
     }
-    if (connect(*socket_fd, rp->ai_addr, rp->ai_addrlen) != -1)
+    if (connect(*socket_fd, rp->ai_addr, rp->ai_addrlen) == 0
+        || errno == EINPROGRESS)
     {
-      // Socket connection succeeded, use this socket.
       break;
     }
     close(*socket_fd);
+    *socket_fd = -1;
   }
 
-  // Cleanup address information and handle errors.
   freeaddrinfo(result);
   if (rp == NULL)
   {
-    kmyth_log(LOG_ERR, "Failed to establish socket connection.");
+    kmyth_log(LOG_ERR, "Failed to start socket connection.");
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// finish_client_socket()
+//
+int finish_client_socket(int socket_fd)
+{
+  int error = socket_connect_error(socket_fd);
+
+  if (error != 0)
+  {
+    kmyth_log(LOG_ERR, "Failed to establish socket connection: %s",
+              strerror(error));
     return 1;
   }
 
@@ -127,3 +449,139 @@ int setup_server_socket(const char *service, int *socket_fd)
 
   return 0;
 }
+
+//
+// fill_unix_address()
+//
+static int fill_unix_address(const char *path, struct sockaddr_un *addr)
+{
+  memset(addr, 0, sizeof(struct sockaddr_un));
+  addr->sun_family = AF_UNIX;
+
+  if (path == NULL || strlen(path) >= sizeof(addr->sun_path))
+  {
+    kmyth_log(LOG_ERR, "Invalid local socket path.");
+    return 1;
+  }
+  memcpy(addr->sun_path, path, strlen(path) + 1);
+
+  return 0;
+}
+
+//
+// setup_unix_server_socket()
+//
+int setup_unix_server_socket(const char *path, mode_t mode, int *socket_fd)
+{
+  struct sockaddr_un addr;
+
+  *socket_fd = -1;
+  if (fill_unix_address(path, &addr))
+  {
+    return 1;
+  }
+
+  // Replace a stale socket, but never remove anything else at the path.
+  struct stat st = { 0 };
+
+  if (lstat(path, &st) == 0)
+  {
+    if (!S_ISSOCK(st.st_mode))
+    {
+      kmyth_log(LOG_ERR, "Local socket path %s exists and is not a socket.",
+                path);
+      return 1;
+    }
+    if (unlink(path))
+    {
+      kmyth_log(LOG_ERR, "Failed to remove stale local socket %s.", path);
+      return 1;
+    }
+  }
+
+  *socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (*socket_fd == -1)
+  {
+    kmyth_log(LOG_ERR, "Failed to create local socket.");
+    return 1;
+  }
+
+  // The socket file is created with the requested permissions, so it is
+  // never reachable with looser ones.
+  mode_t old_umask = umask(~mode & 0777);
+  int result = bind(*socket_fd, (struct sockaddr *) &addr, sizeof(addr));
+
+  umask(old_umask);
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "Failed to bind local socket %s.", path);
+    close(*socket_fd);
+    *socket_fd = -1;
+    return 1;
+  }
+
+  if (listen(*socket_fd, SOMAXCONN))
+  {
+    kmyth_log(LOG_ERR, "Failed to listen on local socket %s.", path);
+    close(*socket_fd);
+    *socket_fd = -1;
+    unlink(path);
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// setup_unix_client_socket()
+//
+int setup_unix_client_socket(const char *path, int *socket_fd)
+{
+  struct sockaddr_un addr;
+
+  *socket_fd = -1;
+  if (fill_unix_address(path, &addr))
+  {
+    return 1;
+  }
+
+  *socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (*socket_fd == -1)
+  {
+    kmyth_log(LOG_ERR, "Failed to create local socket.");
+    return 1;
+  }
+
+  if (connect(*socket_fd, (struct sockaddr *) &addr, sizeof(addr)))
+  {
+    kmyth_log(LOG_ERR, "Failed to connect to local socket %s: %s", path,
+              strerror(errno));
+    close(*socket_fd);
+    *socket_fd = -1;
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// get_peer_credentials()
+//
+int get_peer_credentials(int socket_fd, uid_t * uid, gid_t * gid, pid_t * pid)
+{
+  struct ucred cred = { 0 };
+  socklen_t cred_len = sizeof(cred);
+
+  if (getsockopt(socket_fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len)
+      || cred_len != sizeof(cred))
+  {
+    kmyth_log(LOG_ERR, "Failed to get local socket peer credentials.");
+    return 1;
+  }
+
+  *uid = cred.uid;
+  *gid = cred.gid;
+  *pid = cred.pid;
+
+  return 0;
+}
@@ -6,17 +6,28 @@
 
 #include "tls_util.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <kmip/kmip.h>
-#include <kmip/kmip_bio.h>
 #include <openssl/bio.h>
 #include <openssl/err.h>
+#include <openssl/pem.h>
 #include <openssl/ssl.h>
 #include <openssl/x509v3.h>
 
 #include "defines.h"
+#include "kmip_util.h"
 #include "memory_util.h"
+#include "socket_util.h"
 
 // Check for supported OpenSSL version
 //   - OpenSSL v1.1.1 is a LTS version supported until 2023-09-11
@@ -31,76 +42,61 @@ const char *PREFERRED_CIPHERS = "ECDHE-ECDSA-AES256-GCM-SHA384:"
   "ECDHE-RSA-AES256-SHA384";
 
 //############################################################################
-// tls_ctx_connect()
+// tls_ctx_handshake()
 //############################################################################
 /**
  * <pre>
- * This static helper function initiates a TLS connection using an
- * already-established context.
+ * This static helper function makes a TLS connection over an
+ * already-connected socket, using an already-established context.
  * </pre>
  *
- * @param[in]  server_ip   the IP address of the server, in the form
- *                         xxx.xxx.xxx.xxx:pppp
+ * @param[in]  socket_fd   the connected socket (owned by the BIO chain
+ *                         from then on, and closed on error)
  *
  * @param[in]  ctx         the context to use
  *
+ * @param[in]  session     a session to offer for resumption (NULL for a
+ *                         full handshake)
+ *
+ * @param[in]  timeout_ms  time (in milliseconds) allowed for the handshake
+ *
  * @param[out] ssl_bio     the BIO structure used to interface with the
  *                         connection
  *
- * @param[in]  verbose     if true, print extra debugging messages
- *
  * @return 0 on success, 1 on error
  */
-static int tls_ctx_connect(char *server_ip, char *server_port,
-                           SSL_CTX * ctx, BIO ** ssl_bio)
+static int tls_ctx_handshake(int socket_fd, SSL_CTX * ctx,
+                             SSL_SESSION * session, int timeout_ms,
+                             BIO ** ssl_bio)
 {
-  if (server_ip == NULL)
-  {
-    kmyth_log(LOG_ERR, "no server IP ... exiting");
-    return 1;
-  }
-  if (server_port == NULL)
-  {
-    kmyth_log(LOG_ERR, "no server port ... exiting");
-    return 1;
-  }
-  if (ctx == NULL)
-  {
-    kmyth_log(LOG_ERR, "no SSL context ... exiting");
-    return 1;
-  }
-  if (ssl_bio == NULL)
+  BIO *socket_bio = BIO_new_socket(socket_fd, BIO_CLOSE);
+
+  if (socket_bio == NULL)
   {
-    kmyth_log(LOG_ERR, "no BIO structure variable ... exiting");
+    kmyth_log(LOG_ERR, "error creating socket BIO: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    close(socket_fd);
     return 1;
   }
 
-  *ssl_bio = BIO_new_ssl_connect(ctx);
+  *ssl_bio = BIO_new_ssl(ctx, 1);
   if (*ssl_bio == NULL)
   {
     kmyth_log(LOG_ERR, "error getting new BIO chain: %s ... exiting",
               ERR_error_string(ERR_get_error(), NULL));
+    BIO_free_all(socket_bio);
     return 1;
   }
+  BIO_push(*ssl_bio, socket_bio);
 
-  SSL *ssl;
+  SSL *ssl = NULL;
 
-  if (BIO_get_ssl(*ssl_bio, &ssl) <= 0)
+  if (BIO_get_ssl(*ssl_bio, &ssl) <= 0 || ssl == NULL)
   {
     kmyth_log(LOG_ERR, "error retrieving the BIO SSL pointer: %s ... exiting",
               ERR_error_string(ERR_get_error(), NULL));
-    return 1;
-  }
-  if (BIO_set_conn_address(*ssl_bio, server_ip) != 1)
-  {
-    kmyth_log(LOG_ERR, "error setting connection address: %s ... exiting",
-              ERR_error_string(ERR_get_error(), NULL));
-    return 1;
-  }
-  if (BIO_set_conn_port(*ssl_bio, server_port) != 1)
-  {
-    kmyth_log(LOG_ERR, "error setting connection port: %s ... exiting",
-              ERR_error_string(ERR_get_error(), NULL));
+    BIO_free_all(*ssl_bio);
+    *ssl_bio = NULL;
     return 1;
   }
 
@@ -109,34 +105,85 @@ static int tls_ctx_connect(char *server_ip, char *server_port,
   {
     kmyth_log(LOG_ERR, "negotiate ciper list error: %s ... exiting",
               ERR_error_string(ERR_get_error(), NULL));
+    BIO_free_all(*ssl_bio);
+    *ssl_bio = NULL;
     return 1;
   }
 
-  // verify server's X509 certificate
-  X509 *cert = SSL_get_peer_certificate(ssl);
+  // offer a cached session, to skip the full handshake if the server
+  // accepts it (a rejected session just falls back to a full handshake)
+  if (session != NULL && SSL_set_session(ssl, session) != 1)
+  {
+    kmyth_log(LOG_WARNING, "unable to offer cached TLS session: %s",
+              ERR_error_string(ERR_get_error(), NULL));
+  }
+
+  // initiate SSL/TLS handshake with the server, on a non-blocking socket
+  // so that a server that stops responding cannot hold it past the timeout
+  int flags = fcntl(socket_fd, F_GETFL);
+  struct timespec now = { 0 };
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  long long deadline = (long long) now.tv_sec * 1000
+    + now.tv_nsec / 1000000 + timeout_ms;
+  int result = 1;
 
-  if (cert)
+  fcntl(socket_fd, F_SETFL, flags | O_NONBLOCK);
+  while (true)
   {
-    if (SSL_get_verify_result(ssl) != X509_V_OK)
+    int ret = SSL_do_handshake(ssl);
+
+    if (ret == 1)
+    {
+      result = 0;
+      break;
+    }
+
+    struct pollfd pfd = {.fd = socket_fd };
+
+    switch (SSL_get_error(ssl, ret))
+    {
+    case SSL_ERROR_WANT_READ:
+      pfd.events = POLLIN;
+      break;
+    case SSL_ERROR_WANT_WRITE:
+      pfd.events = POLLOUT;
+      break;
+    default:
+      break;
+    }
+    if (pfd.events == 0)
     {
-      kmyth_log(LOG_ERR, "error verifying peer ... exiting: %s",
+      kmyth_log(LOG_ERR, "TLS connection error: %s ... exiting",
                 ERR_error_string(ERR_get_error(), NULL));
-      return 1;
+      break;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    long long remaining = deadline
+      - ((long long) now.tv_sec * 1000 + now.tv_nsec / 1000000);
+
+    if (remaining <= 0
+        || (poll(&pfd, 1, (int) remaining) == 0))
+    {
+      kmyth_log(LOG_ERR, "TLS handshake timed out ... exiting");
+      break;
     }
-    X509_free(cert);
   }
+  fcntl(socket_fd, F_SETFL, flags);
 
-  // initiate IP socket connection with the server
-  if (BIO_do_connect(*ssl_bio) <= 0)
+  // the server's X509 certificate is verified during the handshake
+  if (result == 0 && SSL_get_verify_result(ssl) != X509_V_OK)
   {
-    kmyth_log(LOG_ERR, "TCP/IP socket connection error ... exiting");
-    return 1;
+    kmyth_log(LOG_ERR, "error verifying peer ... exiting");
+    result = 1;
   }
-
-  // initiate SSL/TLS handshake with the server
-  if (BIO_do_handshake(*ssl_bio) <= 0)
+  if (result)
   {
-    kmyth_log(LOG_ERR, "TLS connection error ... exiting");
+    BIO_free_all(*ssl_bio);
+    *ssl_bio = NULL;
     return 1;
   }
 
@@ -212,7 +259,11 @@ int create_tls_connection(char **server_ip,
     return 1;
   }
 
-  if (tls_ctx_connect(*server_ip, server_port, *tls_ctx, tls_bio) != 0)
+  int socket_fd = -1;
+
+  if (setup_client_socket(*server_ip, server_port, &socket_fd)
+      || tls_ctx_handshake(socket_fd, *tls_ctx, NULL,
+                           KMYTH_HANDSHAKE_TIMEOUT_MS, tls_bio))
   {
     kmyth_log(LOG_ERR, "error connecting to server ... exiting");
     return 1;
@@ -221,235 +272,1121 @@ int create_tls_connection(char **server_ip,
 }
 
 //############################################################################
-// tls_cleanup()
+// tls_client
 //############################################################################
-int tls_cleanup(void)
+typedef struct tls_client_session
 {
-  CONF_modules_unload(1);
-  ERR_free_strings();
-  EVP_cleanup();
-  CRYPTO_cleanup_all_ex_data();
-  SSL_COMP_free_compression_methods();
-  return 0;
-}
+  char *server;
+  SSL_SESSION *session;
+} tls_client_session;
+
+struct tls_client
+{
+  SSL_CTX *ctx;
+  char *session_cache_path;
+  bool sessions_changed;
+  tls_client_session sessions[TLS_CLIENT_MAX_SESSIONS];
+  size_t session_count;
+
+  // the keep-alive connection, and the server ("ip:port") it is to
+  BIO *conn;
+  char *conn_server;
+
+  int connect_timeout_ms;
+  int handshake_timeout_ms;
+};
 
 //############################################################################
-// tls_set_context()
+// tls_client_server_key()
 //############################################################################
-int tls_set_context(unsigned char *client_private_key,
-                    size_t client_private_key_len,
-                    char *client_cert_path, char *ca_cert_path, SSL_CTX ** ctx)
+static char *tls_client_server_key(const char *server_ip,
+                                   const char *server_port)
 {
-  if (client_private_key == NULL || client_private_key_len == 0)
+  size_t len = strlen(server_ip) + strlen(server_port) + 2;
+  char *key = malloc(len);
+
+  if (key != NULL)
   {
-    kmyth_log(LOG_ERR, "no client private key ... exiting");
-    return 1;
+    snprintf(key, len, "%s:%s", server_ip, server_port);
   }
+  return key;
+}
 
-  if (client_private_key_len > INT_MAX)
+//############################################################################
+// tls_client_find_session()
+//############################################################################
+static tls_client_session *tls_client_find_session(tls_client * client,
+                                                   const char *server)
+{
+  for (size_t i = 0; i < client->session_count; i++)
   {
-    kmyth_log(LOG_ERR, "client private key length (%lu bytes) "
-              "exceeds maximum (%d bytes) ... exiting",
-              client_private_key_len, INT_MAX);
-    return 1;
+    if (strcmp(client->sessions[i].server, server) == 0)
+    {
+      return &client->sessions[i];
+    }
   }
+  return NULL;
+}
 
-  if (client_cert_path == NULL)
+//############################################################################
+// tls_client_drop_session()
+//############################################################################
+static void tls_client_drop_session(tls_client * client,
+                                    tls_client_session * entry)
+{
+  free(entry->server);
+  SSL_SESSION_free(entry->session);
+  client->session_count--;
+  *entry = client->sessions[client->session_count];
+  client->sessions[client->session_count].server = NULL;
+  client->sessions[client->session_count].session = NULL;
+  client->sessions_changed = true;
+}
+
+//############################################################################
+// tls_client_store_session()
+//############################################################################
+static int tls_client_store_session(tls_client * client, const char *server,
+                                    SSL_SESSION * session)
+{
+  tls_client_session *entry = tls_client_find_session(client, server);
+
+  if (entry != NULL)
   {
-    kmyth_log(LOG_ERR, "no client cert path ... exiting");
-    return 1;
+    SSL_SESSION_free(entry->session);
+    entry->session = session;
+    client->sessions_changed = true;
+    return 0;
   }
 
-  if (ca_cert_path == NULL)
+  // a full cache gives up its first (oldest stored) entry
+  if (client->session_count == TLS_CLIENT_MAX_SESSIONS)
   {
-    kmyth_log(LOG_ERR, "no CA cert path ... exiting");
-    return 1;
+    tls_client_drop_session(client, &client->sessions[0]);
   }
 
-  /*
-   * This does necessary OpenSSL setup stuff. The version checking is
-   * a stub for later automatic building against 1.1.1 (current LTS
-   * version) or newer. Other versions just error out.
-   */
-  if (OPENSSL_init_ssl(0, NULL) == 0)
+  char *server_copy = strdup(server);
+
+  if (server_copy == NULL)
   {
-    kmyth_log(LOG_ERR, "error initializing OpenSSL: %s ... exiting",
-              ERR_error_string(ERR_get_error(), NULL));
     return 1;
   }
+  client->sessions[client->session_count].server = server_copy;
+  client->sessions[client->session_count].session = session;
+  client->session_count++;
+  client->sessions_changed = true;
 
-  const SSL_METHOD *ssl_method = TLS_client_method();
+  return 0;
+}
 
-  if (ssl_method == NULL)
+//############################################################################
+// tls_client_new_session_cb()
+//############################################################################
+static int tls_client_new_session_cb(SSL * ssl, SSL_SESSION * session)
+{
+  // Called by OpenSSL for each session (TLS 1.3 ticket) the server issues.
+  // Returning 1 takes ownership of the session.
+  tls_client *client = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+
+  if (client == NULL || client->conn_server == NULL
+      || !SSL_SESSION_is_resumable(session))
   {
-    kmyth_log(LOG_ERR, "error getting TLS method: %s ... exiting",
-              ERR_error_string(ERR_get_error(), NULL));
-    return 1;
+    return 0;
   }
-
-  *ctx = SSL_CTX_new(ssl_method);
-  if (*ctx == NULL)
+  if (tls_client_store_session(client, client->conn_server, session))
   {
-    kmyth_log(LOG_ERR, "error creating new SSL context: %s",
-              ERR_error_string(ERR_get_error(), NULL));
-    return 1;
+    return 0;
   }
+  kmyth_log(LOG_DEBUG, "cached TLS session for %s", client->conn_server);
 
-  /*
-   * To negotiate the TLS connection we'll need a memory BIO to store
-   * the private key, and an EVP_PKEY structure to hold the private key
-   * object.
-   */
+  return 1;
+}
 
-  /*
-   * This creates the memory BIO and populates it with the client private
-   * key data.
-   */
-  BIO *private_key_mem =
-    BIO_new_mem_buf(client_private_key, (int) client_private_key_len);
-  if (private_key_mem == NULL)
+//############################################################################
+// tls_client_session_expired()
+//############################################################################
+static bool tls_client_session_expired(SSL_SESSION * session)
+{
+  return (SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session)
+          <= time(NULL));
+}
+
+//############################################################################
+// tls_client_load_sessions()
+//############################################################################
+static void tls_client_load_sessions(tls_client * client)
+{
+  // The cache file is a sequence of
+  //   server <ip:port>
+  //   <PEM encoded SSL session>
+  // entries. It is only an optimization, so a missing or unreadable file
+  // just means starting with full handshakes.
+  BIO *file = BIO_new_file(client->session_cache_path, "r");
+
+  if (file == NULL)
   {
-    kmyth_log(LOG_ERR, "create private key BIO error: %s ... exiting",
-              ERR_error_string(ERR_get_error(), NULL));
-    if (BIO_reset(private_key_mem) != 1)  // BIO_reset clears all data in BIO
-      kmyth_log(LOG_ERR, "error clearing client private key BIO");
-    BIO_free_all(private_key_mem);
-    return 1;
+    ERR_clear_error();
+    kmyth_log(LOG_DEBUG, "no TLS session cache file (%s)",
+              client->session_cache_path);
+    return;
   }
 
-  /*
-   * This creates the EVP_PKEY structure from the raw private key data.
-   */
-  EVP_PKEY *private_key_evp =
-    PEM_read_bio_PrivateKey(private_key_mem, NULL, 0, NULL);
-  if (private_key_evp == NULL)
+  char line[512];
+
+  while (client->session_count < TLS_CLIENT_MAX_SESSIONS
+         && BIO_gets(file, line, sizeof(line)) > 0)
   {
-    kmyth_log(LOG_ERR, "create private key error: %s ... exiting",
-              ERR_error_string(ERR_get_error(), NULL));
-    if (BIO_reset(private_key_mem) != 1)  // BIO_reset clears all data in BIO
-      kmyth_log(LOG_ERR, "error clearing client private key BIO");
-    BIO_free_all(private_key_mem);
-    return 1;
+    if (strncmp(line, "server ", strlen("server ")) != 0)
+    {
+      continue;
+    }
+    line[strcspn(line, "\r\n")] = '\0';
+
+    SSL_SESSION *session = PEM_read_bio_SSL_SESSION(file, NULL, NULL, NULL);
+
+    if (session == NULL)
+    {
+      break;
+    }
+    if (!SSL_SESSION_is_resumable(session)
+        || tls_client_session_expired(session)
+        || tls_client_store_session(client, line + strlen("server "),
+                                    session))
+    {
+      SSL_SESSION_free(session);
+    }
   }
+  ERR_clear_error();
+  BIO_free_all(file);
 
-  /*
-   * Done with client private key BIO, so clean it up - BIO_reset clears data
-   */
-  if (BIO_reset(private_key_mem) != 1)
-    kmyth_log(LOG_ERR, "error clearing client private key BIO");
-  BIO_free_all(private_key_mem);
+  client->sessions_changed = false;
+  kmyth_log(LOG_DEBUG, "loaded %zu TLS sessions from %s",
+            client->session_count, client->session_cache_path);
+}
 
-  /*
-   * This specifies the client certificate (which we assume is PEM formatted)
-   * used for client authentication within the TLS connection.
-   */
-  if (SSL_CTX_use_certificate_file(*ctx, client_cert_path, SSL_FILETYPE_PEM) !=
-      1)
+//############################################################################
+// tls_client_save_sessions()
+//############################################################################
+static int tls_client_save_sessions(tls_client * client)
+{
+  size_t tmp_path_len = strlen(client->session_cache_path) + 5;
+  char *tmp_path = malloc(tmp_path_len);
+
+  if (tmp_path == NULL)
   {
-    kmyth_log(LOG_ERR, "SSL_CTX_use_certificate_file: %s ... exiting",
-              ERR_error_string(ERR_get_error(), NULL));
-    EVP_PKEY_free(private_key_evp); // EVP_PKEY_free also clears memory. 
+    kmyth_log(LOG_ERR, "unable to allocate session cache path ... exiting");
     return 1;
   }
+  snprintf(tmp_path, tmp_path_len, "%s.tmp", client->session_cache_path);
 
-  if (SSL_CTX_use_PrivateKey(*ctx, private_key_evp) != 1)
+  // write the new cache beside the old one, readable by the owner only
+  int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  FILE *fp = (fd < 0) ? NULL : fdopen(fd, "w");
+
+  if (fp == NULL)
   {
-    kmyth_log(LOG_ERR, "SSL_CTX_use_PrivateKey: %s ... exiting",
-              ERR_error_string(ERR_get_error(), NULL));
-    EVP_PKEY_free(private_key_evp);
+    kmyth_log(LOG_ERR, "unable to create TLS session cache file %s: %s",
+              tmp_path, strerror(errno));
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+    free(tmp_path);
     return 1;
   }
 
-  /*
-   * EVP_PKEY_free does not provide a useful return value, so we ignore it.
-   * EVP_PKEY_free clears memory before freeing it. 
-   */
-  EVP_PKEY_free(private_key_evp);
+  BIO *file = BIO_new_fp(fp, BIO_CLOSE);
+  int result = (file == NULL);
 
-  if (SSL_CTX_check_private_key(*ctx) != 1)
+  for (size_t i = 0; !result && i < client->session_count; i++)
   {
-    kmyth_log(LOG_ERR, "private key / cert mismatch ... exiting");
-    return 1;
+    SSL_SESSION *session = client->sessions[i].session;
+
+    if (tls_client_session_expired(session))
+    {
+      continue;
+    }
+    if (BIO_printf(file, "server %s\n", client->sessions[i].server) <= 0
+        || PEM_write_bio_SSL_SESSION(file, session) != 1)
+    {
+      result = 1;
+    }
+  }
+  if (file == NULL)
+  {
+    fclose(fp);
   }
+  else if (BIO_flush(file) != 1)
+  {
+    result = 1;
+  }
+  BIO_free_all(file);
 
-  /* pin CA certificate for client verification of server certificate */
-  if (SSL_CTX_load_verify_locations(*ctx, ca_cert_path, NULL) != 1)
+  if (result || rename(tmp_path, client->session_cache_path) != 0)
   {
-    kmyth_log(LOG_ERR, "trust store load error: %s ... exiting",
-              ERR_error_string(ERR_get_error(), NULL));
+    kmyth_log(LOG_ERR, "unable to write TLS session cache file %s",
+              client->session_cache_path);
+    unlink(tmp_path);
+    free(tmp_path);
     return 1;
   }
-  SSL_CTX_set_verify(*ctx, SSL_VERIFY_PEER, NULL);
-  SSL_CTX_set_verify_depth(*ctx, 1);
+  free(tmp_path);
+  client->sessions_changed = false;
 
   return 0;
 }
 
 //############################################################################
-// get_key_from_tls_server()
+// tls_client_conn_usable()
 //############################################################################
-int get_key_from_tls_server(BIO * bio,
-                            char *message, size_t message_length,
-                            unsigned char **key, size_t * key_size)
+static bool tls_client_conn_usable(tls_client * client)
 {
-  // validate input
-  if (bio == NULL)
+  SSL *ssl = NULL;
+  int fd = -1;
+
+  if (BIO_get_ssl(client->conn, &ssl) <= 0 || ssl == NULL
+      || (SSL_get_shutdown(ssl) & SSL_RECEIVED_SHUTDOWN)
+      || BIO_get_fd(client->conn, &fd) <= 0 || fd < 0)
   {
-    kmyth_log(LOG_ERR, "no valid BIO object ... exiting");
-    return 1;
+    return false;
   }
 
-  // write message to server
-  if (message_length > 0)
+  // Between requests nothing should be waiting on the socket. Anything
+  // that is (most often the server closing the connection) means it
+  // cannot simply be picked up again.
+  char byte = 0;
+  ssize_t count = recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+
+  return (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+//############################################################################
+// tls_client_new()
+//############################################################################
+int tls_client_new(unsigned char *client_private_key,
+                   size_t client_private_key_len,
+                   char *client_cert_path, char *ca_cert_path,
+                   const char *session_cache_path, tls_client ** client)
+{
+  if (client == NULL)
   {
-    if (BIO_write(bio, message, message_length) <= 0)
-    {
-      kmyth_log(LOG_ERR, "error writing message to server ... exiting");
-      return 1;
-    }
-    if (BIO_flush(bio) != 1)
-      kmyth_log(LOG_ERR, "error flushing server message BIO");
+    kmyth_log(LOG_ERR, "no TLS client variable ... exiting");
+    return 1;
   }
-  size_t buf_size = KMYTH_GETKEY_RX_BUFFER_SIZE;
-  char *buf = calloc(buf_size, sizeof(char));
+  *client = NULL;
 
-  if (buf == NULL)
+  tls_client *new_client = calloc(1, sizeof(tls_client));
+
+  if (new_client == NULL)
   {
-    kmyth_log(LOG_ERR,
-              "error allocating memory for server response ... exiting");
+    kmyth_log(LOG_ERR, "unable to allocate TLS client ... exiting");
     return 1;
   }
 
-  int recv = BIO_read(bio, buf, buf_size);
-
-  if (0 >= recv)
+  if (tls_set_context(client_private_key, client_private_key_len,
+                      client_cert_path, ca_cert_path, &new_client->ctx))
   {
-    kmyth_log(LOG_ERR, "no data received: %s ... exiting",
-              ERR_error_string(ERR_get_error(), NULL));
-    free(buf);
+    kmyth_log(LOG_ERR, "error setting up TLS context ... exiting");
+    SSL_CTX_free(new_client->ctx);
+    free(new_client);
     return 1;
   }
 
-  *key_size = recv;
+  // Keep client sessions in our own cache (keyed on server address, which
+  // OpenSSL's internal cache cannot look up by) rather than OpenSSL's.
+  SSL_CTX_set_app_data(new_client->ctx, new_client);
+  SSL_CTX_set_session_cache_mode(new_client->ctx, SSL_SESS_CACHE_CLIENT
+                                 | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(new_client->ctx, tls_client_new_session_cb);
+
+  new_client->connect_timeout_ms = KMYTH_CONNECT_TIMEOUT_MS;
+  new_client->handshake_timeout_ms = KMYTH_HANDSHAKE_TIMEOUT_MS;
 
-  (*key) = malloc(recv);
-  if (*key == NULL)
+  if (session_cache_path != NULL)
   {
-    kmyth_log(LOG_ERR, "error allocating fresh memory for key ... exiting");
-    buf = secure_memset(buf, 0, buf_size);
-    free(buf);
-    return 1;
+    new_client->session_cache_path = strdup(session_cache_path);
+    if (new_client->session_cache_path == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to allocate session cache path ... exiting");
+      tls_client_free(&new_client);
+      return 1;
+    }
+    tls_client_load_sessions(new_client);
   }
-  memcpy((*key), buf, recv);
 
-  buf = secure_memset(buf, 0, buf_size);
-  free(buf);
+  *client = new_client;
 
   return 0;
 }
 
 //############################################################################
-// get_key_from_kmip_server()
+// tls_client_set_timeouts()
+//############################################################################
+int tls_client_set_timeouts(tls_client * client, int connect_timeout_ms,
+                            int handshake_timeout_ms)
+{
+  if (client == NULL || connect_timeout_ms <= 0 || handshake_timeout_ms <= 0)
+  {
+    kmyth_log(LOG_ERR, "invalid TLS client timeouts ... exiting");
+    return 1;
+  }
+
+  client->connect_timeout_ms = connect_timeout_ms;
+  client->handshake_timeout_ms = handshake_timeout_ms;
+
+  return 0;
+}
+
+//############################################################################
+// tls_client_set_ktls()
+//############################################################################
+int tls_client_set_ktls(tls_client * client, bool enable)
+{
+  if (client == NULL)
+  {
+    kmyth_log(LOG_ERR, "no TLS client ... exiting");
+    return 1;
+  }
+
+#ifdef SSL_OP_ENABLE_KTLS
+  if (enable)
+  {
+    SSL_CTX_set_options(client->ctx, SSL_OP_ENABLE_KTLS);
+  }
+  else
+  {
+    SSL_CTX_clear_options(client->ctx, SSL_OP_ENABLE_KTLS);
+  }
+#else
+  if (enable)
+  {
+    kmyth_log(LOG_WARNING, "OpenSSL has no kernel TLS support, TLS records "
+              "will be processed in user space");
+  }
+#endif
+
+  return 0;
+}
+
+//############################################################################
+// tls_client_log_ktls()
+//
+// Logs whether the kernel took over the records of a new connection for
+// which kTLS was requested
+//############################################################################
+static void tls_client_log_ktls(tls_client * client)
+{
+#if defined(SSL_OP_ENABLE_KTLS) && defined(BIO_get_ktls_send)
+  SSL *ssl = NULL;
+
+  BIO_get_ssl(client->conn, &ssl);
+  if (ssl == NULL || !(SSL_get_options(ssl) & SSL_OP_ENABLE_KTLS))
+  {
+    return;
+  }
+  kmyth_log(LOG_DEBUG, "kernel TLS with %s: send %s, receive %s",
+            client->conn_server,
+            BIO_get_ktls_send(SSL_get_wbio(ssl)) ? "on" : "off",
+            BIO_get_ktls_recv(SSL_get_rbio(ssl)) ? "on" : "off");
+#else
+  (void) client;
+#endif
+}
+
+//############################################################################
+// tls_client_connect()
+//############################################################################
+int tls_client_connect(tls_client * client,
+                       const char *server_ip, const char *server_port,
+                       BIO ** tls_bio)
+{
+  size_t server_index = 0;
+
+  return tls_client_connect_any(client, &server_ip, &server_port, 1,
+                                tls_bio, &server_index);
+}
+
+//############################################################################
+// tls_client_connect_any()
+//############################################################################
+int tls_client_connect_any(tls_client * client,
+                           const char **server_ips, const char **server_ports,
+                           size_t server_count,
+                           BIO ** tls_bio, size_t *server_index)
+{
+  if (client == NULL || server_ips == NULL || server_ports == NULL
+      || server_count == 0 || server_count > KMYTH_MAX_SERVER_ENDPOINTS
+      || tls_bio == NULL || server_index == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid TLS client connect parameters ... exiting");
+    return 1;
+  }
+
+  char *servers[KMYTH_MAX_SERVER_ENDPOINTS] = { 0 };
+
+  for (size_t i = 0; i < server_count; i++)
+  {
+    if (server_ips[i] == NULL || server_ports[i] == NULL)
+    {
+      kmyth_log(LOG_ERR, "invalid TLS client connect parameters ... exiting");
+      return 1;
+    }
+  }
+  for (size_t i = 0; i < server_count; i++)
+  {
+    servers[i] = tls_client_server_key(server_ips[i], server_ports[i]);
+    if (servers[i] == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to allocate server address ... exiting");
+      for (size_t j = 0; j < i; j++)
+      {
+        free(servers[j]);
+      }
+      return 1;
+    }
+  }
+
+  // the open connection serves if it is to any of the servers
+  if (client->conn != NULL)
+  {
+    for (size_t i = 0; i < server_count; i++)
+    {
+      if (strcmp(client->conn_server, servers[i]) == 0
+          && tls_client_conn_usable(client))
+      {
+        kmyth_log(LOG_DEBUG, "reusing TLS connection to %s", servers[i]);
+        for (size_t j = 0; j < server_count; j++)
+        {
+          free(servers[j]);
+        }
+        *server_index = i;
+        *tls_bio = client->conn;
+        return 0;
+      }
+    }
+    tls_client_disconnect(client);
+  }
+
+  // Race the servers still in the running, and make the TLS connection
+  // with the first to answer. A server that answers but fails the
+  // handshake is dropped from the running, and the rest are raced again.
+  bool failed[KMYTH_MAX_SERVER_ENDPOINTS] = { false };
+
+  while (client->conn == NULL)
+  {
+    const char *ips[KMYTH_MAX_SERVER_ENDPOINTS] = { 0 };
+    const char *ports[KMYTH_MAX_SERVER_ENDPOINTS] = { 0 };
+    size_t candidates[KMYTH_MAX_SERVER_ENDPOINTS] = { 0 };
+    size_t candidate_count = 0;
+
+    for (size_t i = 0; i < server_count; i++)
+    {
+      if (!failed[i])
+      {
+        ips[candidate_count] = server_ips[i];
+        ports[candidate_count] = server_ports[i];
+        candidates[candidate_count++] = i;
+      }
+    }
+
+    int socket_fd = -1;
+    size_t winner = 0;
+
+    if (candidate_count == 0
+        || setup_client_socket_any(ips, ports, candidate_count,
+                                   client->connect_timeout_ms,
+                                   &socket_fd, &winner))
+    {
+      kmyth_log(LOG_ERR, "error connecting to server ... exiting");
+      break;
+    }
+
+    size_t index = candidates[winner];
+    tls_client_session *entry = tls_client_find_session(client,
+                                                        servers[index]);
+    SSL_SESSION *offered = NULL;
+
+    if (entry != NULL && tls_client_session_expired(entry->session))
+    {
+      tls_client_drop_session(client, entry);
+      entry = NULL;
+    }
+    if (entry != NULL)
+    {
+      // held, as a session issued during the handshake replaces the entry
+      offered = entry->session;
+      SSL_SESSION_up_ref(offered);
+    }
+
+    // set before the handshake, as the new session callback files
+    // sessions issued during the handshake under this server
+    client->conn_server = servers[index];
+    servers[index] = NULL;
+    if (tls_ctx_handshake(socket_fd, client->ctx, offered,
+                          client->handshake_timeout_ms, &client->conn) != 0)
+    {
+      kmyth_log(LOG_WARNING, "TLS handshake with %s failed",
+                client->conn_server);
+      SSL_SESSION_free(offered);
+      servers[index] = client->conn_server;
+      client->conn_server = NULL;
+      failed[index] = true;
+      continue;
+    }
+
+    SSL *ssl = NULL;
+
+    BIO_get_ssl(client->conn, &ssl);
+    if (ssl != NULL && SSL_session_reused(ssl))
+    {
+      kmyth_log(LOG_DEBUG, "resumed TLS session with %s",
+                client->conn_server);
+    }
+    else if (offered != NULL)
+    {
+      // the server would not resume it, so do not offer it again
+      entry = tls_client_find_session(client, client->conn_server);
+      if (entry != NULL && entry->session == offered)
+      {
+        tls_client_drop_session(client, entry);
+      }
+    }
+    SSL_SESSION_free(offered);
+    tls_client_log_ktls(client);
+    *server_index = index;
+  }
+
+  for (size_t i = 0; i < server_count; i++)
+  {
+    free(servers[i]);
+  }
+  if (client->conn == NULL)
+  {
+    return 1;
+  }
+  *tls_bio = client->conn;
+
+  return 0;
+}
+
+//############################################################################
+// tls_client_disconnect()
+//############################################################################
+void tls_client_disconnect(tls_client * client)
+{
+  if (client == NULL)
+  {
+    return;
+  }
+
+  if (client->conn != NULL)
+  {
+    BIO_ssl_shutdown(client->conn);
+    BIO_free_all(client->conn);
+    client->conn = NULL;
+  }
+  free(client->conn_server);
+  client->conn_server = NULL;
+}
+
+//############################################################################
+// tls_client_free()
+//############################################################################
+void tls_client_free(tls_client ** client)
+{
+  if (client == NULL || *client == NULL)
+  {
+    return;
+  }
+
+  tls_client_disconnect(*client);
+
+  if ((*client)->session_cache_path != NULL && (*client)->sessions_changed)
+  {
+    tls_client_save_sessions(*client);
+  }
+  for (size_t i = 0; i < (*client)->session_count; i++)
+  {
+    free((*client)->sessions[i].server);
+    SSL_SESSION_free((*client)->sessions[i].session);
+  }
+
+  SSL_CTX_free((*client)->ctx);
+  free((*client)->session_cache_path);
+  free(*client);
+  *client = NULL;
+}
+
+//############################################################################
+// tls_cleanup()
+//############################################################################
+int tls_cleanup(void)
+{
+  // OpenSSL 1.1.0+ releases its global state from an atexit handler, and
+  // tearing it down here would pull it out from under any other thread
+  // still using TLS, so only this thread's error queue is released
+  OPENSSL_thread_stop();
+  return 0;
+}
+
+//############################################################################
+// tls_set_context()
+//############################################################################
+int tls_set_context(unsigned char *client_private_key,
+                    size_t client_private_key_len,
+                    char *client_cert_path, char *ca_cert_path, SSL_CTX ** ctx)
+{
+  if (client_private_key == NULL || client_private_key_len == 0)
+  {
+    kmyth_log(LOG_ERR, "no client private key ... exiting");
+    return 1;
+  }
+
+  if (client_private_key_len > INT_MAX)
+  {
+    kmyth_log(LOG_ERR, "client private key length (%lu bytes) "
+              "exceeds maximum (%d bytes) ... exiting",
+              client_private_key_len, INT_MAX);
+    return 1;
+  }
+
+  if (client_cert_path == NULL)
+  {
+    kmyth_log(LOG_ERR, "no client cert path ... exiting");
+    return 1;
+  }
+
+  if (ca_cert_path == NULL)
+  {
+    kmyth_log(LOG_ERR, "no CA cert path ... exiting");
+    return 1;
+  }
+
+  /*
+   * This does necessary OpenSSL setup stuff. The version checking is
+   * a stub for later automatic building against 1.1.1 (current LTS
+   * version) or newer. Other versions just error out.
+   */
+  if (OPENSSL_init_ssl(0, NULL) == 0)
+  {
+    kmyth_log(LOG_ERR, "error initializing OpenSSL: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    return 1;
+  }
+
+  const SSL_METHOD *ssl_method = TLS_client_method();
+
+  if (ssl_method == NULL)
+  {
+    kmyth_log(LOG_ERR, "error getting TLS method: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    return 1;
+  }
+
+  *ctx = SSL_CTX_new(ssl_method);
+  if (*ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "error creating new SSL context: %s",
+              ERR_error_string(ERR_get_error(), NULL));
+    return 1;
+  }
+
+  /*
+   * To negotiate the TLS connection we'll need a memory BIO to store
+   * the private key, and an EVP_PKEY structure to hold the private key
+   * object.
+   */
+
+  /*
+   * This creates the memory BIO and populates it with the client private
+   * key data.
+   */
+  BIO *private_key_mem =
+    BIO_new_mem_buf(client_private_key, (int) client_private_key_len);
+  if (private_key_mem == NULL)
+  {
+    kmyth_log(LOG_ERR, "create private key BIO error: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    if (BIO_reset(private_key_mem) != 1)  // BIO_reset clears all data in BIO
+      kmyth_log(LOG_ERR, "error clearing client private key BIO");
+    BIO_free_all(private_key_mem);
+    return 1;
+  }
+
+  /*
+   * This creates the EVP_PKEY structure from the raw private key data.
+   */
+  EVP_PKEY *private_key_evp =
+    PEM_read_bio_PrivateKey(private_key_mem, NULL, 0, NULL);
+  if (private_key_evp == NULL)
+  {
+    kmyth_log(LOG_ERR, "create private key error: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    if (BIO_reset(private_key_mem) != 1)  // BIO_reset clears all data in BIO
+      kmyth_log(LOG_ERR, "error clearing client private key BIO");
+    BIO_free_all(private_key_mem);
+    return 1;
+  }
+
+  /*
+   * Done with client private key BIO, so clean it up - BIO_reset clears data
+   */
+  if (BIO_reset(private_key_mem) != 1)
+    kmyth_log(LOG_ERR, "error clearing client private key BIO");
+  BIO_free_all(private_key_mem);
+
+  /*
+   * This specifies the client certificate (which we assume is PEM formatted)
+   * used for client authentication within the TLS connection.
+   */
+  if (SSL_CTX_use_certificate_file(*ctx, client_cert_path, SSL_FILETYPE_PEM) !=
+      1)
+  {
+    kmyth_log(LOG_ERR, "SSL_CTX_use_certificate_file: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    EVP_PKEY_free(private_key_evp); // EVP_PKEY_free also clears memory. 
+    return 1;
+  }
+
+  if (SSL_CTX_use_PrivateKey(*ctx, private_key_evp) != 1)
+  {
+    kmyth_log(LOG_ERR, "SSL_CTX_use_PrivateKey: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    EVP_PKEY_free(private_key_evp);
+    return 1;
+  }
+
+  /*
+   * EVP_PKEY_free does not provide a useful return value, so we ignore it.
+   * EVP_PKEY_free clears memory before freeing it. 
+   */
+  EVP_PKEY_free(private_key_evp);
+
+  if (SSL_CTX_check_private_key(*ctx) != 1)
+  {
+    kmyth_log(LOG_ERR, "private key / cert mismatch ... exiting");
+    return 1;
+  }
+
+  /* pin CA certificate for client verification of server certificate */
+  if (SSL_CTX_load_verify_locations(*ctx, ca_cert_path, NULL) != 1)
+  {
+    kmyth_log(LOG_ERR, "trust store load error: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    return 1;
+  }
+  SSL_CTX_set_verify(*ctx, SSL_VERIFY_PEER, NULL);
+  SSL_CTX_set_verify_depth(*ctx, 1);
+
+  return 0;
+}
+
+//############################################################################
+// tls_write_all()
+//############################################################################
+static int tls_write_all(BIO * bio, const unsigned char *data, size_t data_len)
+{
+  while (data_len > 0)
+  {
+    int chunk = (data_len > INT_MAX) ? INT_MAX : (int) data_len;
+    int written = BIO_write(bio, data, chunk);
+
+    if (written <= 0)
+    {
+      if (BIO_should_retry(bio))
+      {
+        continue;
+      }
+      return 1;
+    }
+    data += written;
+    data_len -= (size_t) written;
+  }
+  if (BIO_flush(bio) != 1)
+  {
+    kmyth_log(LOG_ERR, "error flushing server message BIO");
+  }
+
+  return 0;
+}
+
+//############################################################################
+// tls_read_all()
+//############################################################################
+static int tls_read_all(BIO * bio, unsigned char *data, size_t data_len)
+{
+  while (data_len > 0)
+  {
+    int chunk = (data_len > INT_MAX) ? INT_MAX : (int) data_len;
+    int received = BIO_read(bio, data, chunk);
+
+    if (received <= 0)
+    {
+      if (BIO_should_retry(bio))
+      {
+        continue;
+      }
+      return 1;
+    }
+    data += received;
+    data_len -= (size_t) received;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// tls_recv_kmip_message()
+//############################################################################
+static int tls_recv_kmip_message(BIO * bio, size_t max_len,
+                                 unsigned char **message,
+                                 size_t *message_len)
+{
+  // A KMIP message is one TTLV item: a 3-byte tag, a 1-byte type and a
+  // 4-byte big-endian length, followed by that many bytes of value
+  unsigned char header[KMIP_TTLV_HEADER_SIZE] = { 0 };
+
+  if (tls_read_all(bio, header, sizeof(header)))
+  {
+    kmyth_log(LOG_ERR, "error reading KMIP message header ... exiting");
+    return 1;
+  }
+
+  size_t value_len = ((size_t) header[4] << 24) | ((size_t) header[5] << 16)
+    | ((size_t) header[6] << 8) | (size_t) header[7];
+
+  if (value_len > max_len - sizeof(header))
+  {
+    kmyth_log(LOG_ERR, "KMIP message too large (%zu bytes) ... exiting",
+              value_len);
+    return 1;
+  }
+
+  // the message may carry keys, so it is read into locked memory
+  *message_len = sizeof(header) + value_len;
+  *message = kmyth_secure_alloc(*message_len);
+  if (*message == NULL)
+  {
+    kmyth_log(LOG_ERR, "error allocating KMIP message buffer ... exiting");
+    return 1;
+  }
+  memcpy(*message, header, sizeof(header));
+
+  if (tls_read_all(bio, *message + sizeof(header), value_len))
+  {
+    kmyth_log(LOG_ERR, "error reading KMIP message ... exiting");
+    kmyth_secure_free(*message, *message_len);
+    *message = NULL;
+    *message_len = 0;
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmip_key_id_list()
+//############################################################################
+static int kmip_key_id_list(char **key_ids, size_t key_id_count,
+                            unsigned char **ids, size_t *id_lens)
+{
+  if (key_ids == NULL || key_id_count == 0
+      || key_id_count > KMIP_GET_BATCH_MAX_ITEMS)
+  {
+    kmyth_log(LOG_ERR, "invalid key ID list ... exiting");
+    return 1;
+  }
+
+  for (size_t i = 0; i < key_id_count; i++)
+  {
+    if (key_ids[i] == NULL || strlen(key_ids[i]) == 0)
+    {
+      kmyth_log(LOG_ERR, "empty key ID ... exiting");
+      return 1;
+    }
+    ids[i] = (unsigned char *) key_ids[i];
+    id_lens[i] = strlen(key_ids[i]);
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmip_parse_get_keys()
+//############################################################################
+static int kmip_parse_get_keys(KMIP * kmip_context,
+                               unsigned char *response, size_t response_len,
+                               unsigned char **ids, size_t *id_lens,
+                               size_t id_count,
+                               unsigned char **keys, size_t *key_sizes)
+{
+  unsigned char *resp_ids[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  size_t resp_id_lens[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+
+  int result = parse_kmip_get_batch_response(kmip_context,
+                                             response, response_len,
+                                             id_count, resp_ids,
+                                             resp_id_lens, keys, key_sizes);
+
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "error parsing KMIP Get response ... exiting");
+    return 1;
+  }
+
+  // each key must be the one asked for in its slot
+  for (size_t i = 0; i < id_count; i++)
+  {
+    if (resp_id_lens[i] != id_lens[i]
+        || memcmp(resp_ids[i], ids[i], id_lens[i]) != 0)
+    {
+      kmyth_log(LOG_ERR, "KMIP server returned the wrong key ... exiting");
+      result = 1;
+    }
+    free(resp_ids[i]);
+  }
+  if (result)
+  {
+    for (size_t i = 0; i < id_count; i++)
+    {
+      kmyth_clear_and_free(keys[i], key_sizes[i]);
+      keys[i] = NULL;
+      key_sizes[i] = 0;
+    }
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmip_get_keys_with()
+//############################################################################
+static int kmip_get_keys_with(BIO * bio, KMIP * kmip_context,
+                              kmip_encoding_buffer * buffer,
+                              unsigned char **ids, size_t *id_lens,
+                              size_t id_count,
+                              unsigned char **keys, size_t *key_sizes)
+{
+  // send all of the Get requests as the items of one batch
+  size_t request_len = 0;
+
+  if (build_kmip_get_batch_request_into(kmip_context, ids, id_lens,
+                                        id_count, buffer, &request_len))
+  {
+    kmyth_log(LOG_ERR, "error building KMIP Get request ... exiting");
+    return 1;
+  }
+
+  int result = tls_write_all(bio, buffer->data, request_len);
+
+  kmyth_clear(buffer->data, request_len);
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "error writing KMIP request to server ... exiting");
+    return 1;
+  }
+
+  unsigned char *response = NULL;
+  size_t response_len = 0;
+
+  if (tls_recv_kmip_message(bio, KMYTH_KMIP_MAX_MESSAGE_SIZE,
+                            &response, &response_len))
+  {
+    kmyth_log(LOG_ERR, "error reading KMIP response ... exiting");
+    return 1;
+  }
+
+  result = kmip_parse_get_keys(kmip_context, response, response_len,
+                               ids, id_lens, id_count, keys, key_sizes);
+  kmyth_secure_free(response, response_len);
+
+  return result;
+}
+
+//############################################################################
+// kmip_get_keys()
+//############################################################################
+static int kmip_get_keys(BIO * bio,
+                         unsigned char **ids, size_t *id_lens,
+                         size_t id_count,
+                         unsigned char **keys, size_t *key_sizes)
+{
+  KMIP kmip_context = { 0 };
+  kmip_encoding_buffer buffer = { NULL, 0 };
+
+  kmip_init(&kmip_context, NULL, 0, KMIP_1_0);
+  kmip_context.max_message_size = KMYTH_KMIP_MAX_MESSAGE_SIZE;
+
+  int result = kmip_get_keys_with(bio, &kmip_context, &buffer,
+                                  ids, id_lens, id_count, keys, key_sizes);
+
+  kmip_encoding_buffer_free(&buffer);
+  kmip_destroy(&kmip_context);
+
+  return result;
+}
+
+//############################################################################
+// get_key_from_tls_server()
+//############################################################################
+int get_key_from_tls_server(BIO * bio,
+                            char *message, size_t message_length,
+                            unsigned char **key, size_t * key_size)
+{
+  // validate input
+  if (bio == NULL)
+  {
+    kmyth_log(LOG_ERR, "no valid BIO object ... exiting");
+    return 1;
+  }
+
+  // write message to server
+  if (message_length > 0)
+  {
+    if (tls_write_all(bio, (unsigned char *) message, message_length))
+    {
+      kmyth_log(LOG_ERR, "error writing message to server ... exiting");
+      return 1;
+    }
+  }
+
+  // The simple key server sends the key unframed, in one TLS record, so
+  // the receive buffer holds a whole record and is handed back as the key
+  size_t buf_size = KMYTH_GETKEY_RX_BUFFER_SIZE;
+  unsigned char *buf = calloc(buf_size, sizeof(unsigned char));
+
+  if (buf == NULL)
+  {
+    kmyth_log(LOG_ERR,
+              "error allocating memory for server response ... exiting");
+    return 1;
+  }
+
+  int recv = 0;
+
+  do
+  {
+    recv = BIO_read(bio, buf, buf_size);
+  }
+  while (recv <= 0 && BIO_should_retry(bio));
+
+  if (0 >= recv)
+  {
+    kmyth_log(LOG_ERR, "no data received: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    free(buf);
+    return 1;
+  }
+
+  *key = buf;
+  *key_size = (size_t) recv;
+
+  return 0;
+}
+
+//############################################################################
+// get_key_from_kmip_server()
 //############################################################################
 
 int get_key_from_kmip_server(BIO * bio,
@@ -473,33 +1410,605 @@ int get_key_from_kmip_server(BIO * bio,
     return 1;
   }
 
-  KMIP kmip_context = { 0 };
-  kmip_init(&kmip_context, NULL, 0, KMIP_1_0);
+  // an empty message asks for no key
+  if (message_len == 0)
+  {
+    *key_size = 0;
+    return 0;
+  }
 
-  int result = -1;
-  int key_len = 0;
+  unsigned char *id = (unsigned char *) message;
+  size_t id_len = (size_t) message_len;
 
-  // write message to server
-  if (message_length > 0)
+  return kmip_get_keys(bio, &id, &id_len, 1, key, key_size);
+}
+
+//############################################################################
+// get_keys_from_kmip_server()
+//############################################################################
+int get_keys_from_kmip_server(BIO * bio,
+                              char **key_ids, size_t key_id_count,
+                              unsigned char **keys, size_t *key_sizes)
+{
+  // validate input
+  if (bio == NULL)
+  {
+    kmyth_log(LOG_ERR, "no valid BIO object ... exiting");
+    return 1;
+  }
+  if (keys == NULL || key_sizes == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid key ID list ... exiting");
+    return 1;
+  }
+
+  unsigned char *ids[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  size_t id_lens[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+
+  if (kmip_key_id_list(key_ids, key_id_count, ids, id_lens))
+  {
+    return 1;
+  }
+
+  return kmip_get_keys(bio, ids, id_lens, key_id_count, keys, key_sizes);
+}
+
+//############################################################################
+// kmip_pool
+//############################################################################
+typedef struct kmip_pool_conn
+{
+  tls_client *client;
+  KMIP kmip_context;
+  kmip_encoding_buffer buffer;
+} kmip_pool_conn;
+
+struct kmip_pool
+{
+  char *server_ip;
+  char *server_port;
+
+  kmip_pool_conn *conns;
+  size_t size;
+
+  // indices of the idle connections, the most recently used last, so the
+  // connections in use stay open and the others are left to expire
+  size_t *idle;
+  size_t idle_count;
+
+  pthread_mutex_t lock;
+  pthread_cond_t idle_cond;
+};
+
+//############################################################################
+// kmip_pool_new()
+//############################################################################
+int kmip_pool_new(unsigned char *client_private_key,
+                  size_t client_private_key_len,
+                  char *client_cert_path, char *ca_cert_path,
+                  const char *server_ip, const char *server_port,
+                  size_t size, kmip_pool ** pool)
+{
+  if (pool == NULL)
+  {
+    kmyth_log(LOG_ERR, "no KMIP pool variable ... exiting");
+    return 1;
+  }
+  *pool = NULL;
+
+  if (server_ip == NULL || server_port == NULL)
+  {
+    kmyth_log(LOG_ERR, "no KMIP server address ... exiting");
+    return 1;
+  }
+  if (size == 0 || size > KMIP_POOL_MAX_CONNECTIONS)
   {
-    result = kmip_bio_get_symmetric_key_with_context(&kmip_context,
-                                                     bio,
-                                                     message, message_len,
-                                                     (char **) key, &key_len);
-    if (0 != result)
+    kmyth_log(LOG_ERR, "invalid KMIP pool size (%zu) ... exiting", size);
+    return 1;
+  }
+
+  kmip_pool *new_pool = calloc(1, sizeof(kmip_pool));
+
+  if (new_pool == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate KMIP pool ... exiting");
+    return 1;
+  }
+  pthread_mutex_init(&new_pool->lock, NULL);
+  pthread_cond_init(&new_pool->idle_cond, NULL);
+
+  new_pool->server_ip = strdup(server_ip);
+  new_pool->server_port = strdup(server_port);
+  new_pool->conns = calloc(size, sizeof(kmip_pool_conn));
+  new_pool->idle = calloc(size, sizeof(size_t));
+  if (new_pool->server_ip == NULL || new_pool->server_port == NULL
+      || new_pool->conns == NULL || new_pool->idle == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate KMIP pool ... exiting");
+    kmip_pool_free(&new_pool);
+    return 1;
+  }
+
+  // The client key and certificates are parsed here, once for each
+  // connection; the connections themselves are made on first use.
+  for (size_t i = 0; i < size; i++)
+  {
+    kmip_pool_conn *conn = &new_pool->conns[i];
+
+    if (tls_client_new(client_private_key, client_private_key_len,
+                       client_cert_path, ca_cert_path, NULL, &conn->client))
     {
-      // NOTE: There is more error information available on the KMIP context
-      // that may be useful here (e.g., stack trace, string version of the
-      // returned error code, etc).
-      kmyth_log(LOG_ERR, "error retrieving key from KMIP server");
-      kmyth_log(LOG_ERR, kmip_context.error_message);
-      kmip_destroy(&kmip_context);
-      return result;
+      kmyth_log(LOG_ERR, "error setting up KMIP pool connection ... exiting");
+      kmip_pool_free(&new_pool);
+      return 1;
     }
+    kmip_init(&conn->kmip_context, NULL, 0, KMIP_1_0);
+    conn->kmip_context.max_message_size = KMYTH_KMIP_MAX_MESSAGE_SIZE;
+
+    new_pool->size++;
+    new_pool->idle[new_pool->idle_count++] = i;
   }
 
-  *key_size = (size_t) key_len;
+  *pool = new_pool;
+
+  return 0;
+}
+
+//############################################################################
+// kmip_pool_get_keys()
+//############################################################################
+int kmip_pool_get_keys(kmip_pool * pool,
+                       char **key_ids, size_t key_id_count,
+                       unsigned char **keys, size_t *key_sizes)
+{
+  if (pool == NULL)
+  {
+    kmyth_log(LOG_ERR, "no KMIP pool ... exiting");
+    return 1;
+  }
+  if (keys == NULL || key_sizes == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid key ID list ... exiting");
+    return 1;
+  }
+
+  unsigned char *ids[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  size_t id_lens[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+
+  if (kmip_key_id_list(key_ids, key_id_count, ids, id_lens))
+  {
+    return 1;
+  }
+
+  // take the most recently used idle connection, waiting for one if need be
+  pthread_mutex_lock(&pool->lock);
+  while (pool->idle_count == 0)
+  {
+    pthread_cond_wait(&pool->idle_cond, &pool->lock);
+  }
+  size_t index = pool->idle[--pool->idle_count];
+
+  pthread_mutex_unlock(&pool->lock);
+
+  kmip_pool_conn *conn = &pool->conns[index];
+  BIO *bio = NULL;
+  int result = tls_client_connect(conn->client, pool->server_ip,
+                                  pool->server_port, &bio);
+
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "error connecting to KMIP server ... exiting");
+  }
+  else
+  {
+    result = kmip_get_keys_with(bio, &conn->kmip_context, &conn->buffer,
+                                ids, id_lens, key_id_count, keys, key_sizes);
+    if (result)
+    {
+      // the connection is in an unknown state; the next use makes another
+      tls_client_disconnect(conn->client);
+    }
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->idle[pool->idle_count++] = index;
+  pthread_cond_signal(&pool->idle_cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  return result;
+}
+
+//############################################################################
+// kmip_pool_free()
+//############################################################################
+void kmip_pool_free(kmip_pool ** pool)
+{
+  if (pool == NULL || *pool == NULL)
+  {
+    return;
+  }
+
+  kmip_pool *old_pool = *pool;
+
+  for (size_t i = 0; i < old_pool->size; i++)
+  {
+    tls_client_free(&old_pool->conns[i].client);
+    kmip_encoding_buffer_free(&old_pool->conns[i].buffer);
+    kmip_destroy(&old_pool->conns[i].kmip_context);
+  }
+  free(old_pool->conns);
+  free(old_pool->idle);
+  free(old_pool->server_ip);
+  free(old_pool->server_port);
+  pthread_cond_destroy(&old_pool->idle_cond);
+  pthread_mutex_destroy(&old_pool->lock);
+  free(old_pool);
+
+  *pool = NULL;
+}
+
+//############################################################################
+// tls_async
+//############################################################################
+typedef enum tls_async_state
+{
+  TLS_ASYNC_STATE_CONNECT,
+  TLS_ASYNC_STATE_HANDSHAKE,
+  TLS_ASYNC_STATE_SEND,
+  TLS_ASYNC_STATE_RECV_HEADER,
+  TLS_ASYNC_STATE_RECV_BODY,
+  TLS_ASYNC_STATE_FINISHED,
+  TLS_ASYNC_STATE_FAILED
+} tls_async_state;
+
+struct tls_async
+{
+  tls_async_state state;
+  int fd;
+  SSL *ssl;
+  KMIP kmip_context;
+
+  // the batched Get request, sent whole once the handshake completes
+  unsigned char *request;
+  size_t request_len;
+
+  // the response, read into its TTLV header and then a buffer sized from it
+  unsigned char header[KMIP_TTLV_HEADER_SIZE];
+  unsigned char *response;
+  size_t response_len;
+  size_t received;
+
+  // copies of the requested key IDs, and the keys retrieved for them
+  size_t id_count;
+  unsigned char *ids[KMIP_GET_BATCH_MAX_ITEMS];
+  size_t id_lens[KMIP_GET_BATCH_MAX_ITEMS];
+  unsigned char *keys[KMIP_GET_BATCH_MAX_ITEMS];
+  size_t key_sizes[KMIP_GET_BATCH_MAX_ITEMS];
+};
+
+//############################################################################
+// tls_async_retry()
+//############################################################################
+static tls_async_status tls_async_retry(tls_async * op, int ret,
+                                        const char *step)
+{
+  // OpenSSL reports what an incomplete non-blocking call is waiting on
+  switch (SSL_get_error(op->ssl, ret))
+  {
+  case SSL_ERROR_WANT_READ:
+    return TLS_ASYNC_WANT_READ;
+  case SSL_ERROR_WANT_WRITE:
+    return TLS_ASYNC_WANT_WRITE;
+  default:
+    kmyth_log(LOG_ERR, "%s error: %s ... exiting", step,
+              ERR_error_string(ERR_get_error(), NULL));
+    op->state = TLS_ASYNC_STATE_FAILED;
+    return TLS_ASYNC_ERROR;
+  }
+}
+
+//############################################################################
+// tls_async_read()
+//############################################################################
+static tls_async_status tls_async_read(tls_async * op, unsigned char *data,
+                                       size_t data_len)
+{
+  // reads until op->received reaches data_len, or the socket runs dry
+  while (op->received < data_len)
+  {
+    size_t remaining = data_len - op->received;
+    int chunk = (remaining > INT_MAX) ? INT_MAX : (int) remaining;
+    int ret = SSL_read(op->ssl, data + op->received, chunk);
+
+    if (ret <= 0)
+    {
+      return tls_async_retry(op, ret, "KMIP response read");
+    }
+    op->received += (size_t) ret;
+  }
+
+  return TLS_ASYNC_DONE;
+}
+
+//############################################################################
+// tls_async_get_keys_start()
+//############################################################################
+int tls_async_get_keys_start(SSL_CTX * ctx,
+                             const char *server_ip, const char *server_port,
+                             char **key_ids, size_t key_id_count,
+                             tls_async ** op)
+{
+  if (ctx == NULL || server_ip == NULL || server_port == NULL || op == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid TLS async parameters ... exiting");
+    return 1;
+  }
+  *op = NULL;
+
+  unsigned char *ids[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  size_t id_lens[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+
+  if (kmip_key_id_list(key_ids, key_id_count, ids, id_lens))
+  {
+    return 1;
+  }
+
+  tls_async *new_op = calloc(1, sizeof(tls_async));
+
+  if (new_op == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate TLS async operation ... exiting");
+    return 1;
+  }
+  new_op->fd = -1;
+  kmip_init(&new_op->kmip_context, NULL, 0, KMIP_1_0);
+  new_op->kmip_context.max_message_size = KMYTH_KMIP_MAX_MESSAGE_SIZE;
+
+  // the caller's key IDs need not outlive this call
+  new_op->id_count = key_id_count;
+  for (size_t i = 0; i < key_id_count; i++)
+  {
+    new_op->ids[i] = (unsigned char *) strdup(key_ids[i]);
+    new_op->id_lens[i] = id_lens[i];
+    if (new_op->ids[i] == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to allocate key ID ... exiting");
+      tls_async_free(&new_op);
+      return 1;
+    }
+  }
+
+  // build the request now, so no step does more than move bytes
+  if (build_kmip_get_batch_request(&new_op->kmip_context,
+                                   new_op->ids, new_op->id_lens,
+                                   new_op->id_count,
+                                   &new_op->request, &new_op->request_len)
+      || new_op->request_len > INT_MAX)
+  {
+    kmyth_log(LOG_ERR, "error building KMIP Get request ... exiting");
+    tls_async_free(&new_op);
+    return 1;
+  }
+
+  if (start_client_socket(server_ip, server_port, &new_op->fd))
+  {
+    kmyth_log(LOG_ERR, "error connecting to server ... exiting");
+    tls_async_free(&new_op);
+    return 1;
+  }
+
+  new_op->ssl = SSL_new(ctx);
+  if (new_op->ssl == NULL
+      || SSL_set_fd(new_op->ssl, new_op->fd) != 1
+      || SSL_set_cipher_list(new_op->ssl, PREFERRED_CIPHERS) != 1)
+  {
+    kmyth_log(LOG_ERR, "error setting up TLS connection: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    tls_async_free(&new_op);
+    return 1;
+  }
+  SSL_set_connect_state(new_op->ssl);
+
+  new_op->state = TLS_ASYNC_STATE_CONNECT;
+  *op = new_op;
+
+  return 0;
+}
+
+//############################################################################
+// tls_async_fd()
+//############################################################################
+int tls_async_fd(const tls_async * op)
+{
+  return (op == NULL) ? -1 : op->fd;
+}
+
+//############################################################################
+// tls_async_step()
+//############################################################################
+tls_async_status tls_async_step(tls_async * op)
+{
+  if (op == NULL)
+  {
+    return TLS_ASYNC_ERROR;
+  }
+
+  while (true)
+  {
+    switch (op->state)
+    {
+    case TLS_ASYNC_STATE_CONNECT:
+      {
+        // checked without waiting, as the caller need not have polled
+        struct pollfd pfd = {.fd = op->fd,.events = POLLOUT };
+
+        if (poll(&pfd, 1, 0) == 0)
+        {
+          return TLS_ASYNC_WANT_WRITE;
+        }
+        if (finish_client_socket(op->fd))
+        {
+          op->state = TLS_ASYNC_STATE_FAILED;
+          return TLS_ASYNC_ERROR;
+        }
+        op->state = TLS_ASYNC_STATE_HANDSHAKE;
+        break;
+      }
+
+    case TLS_ASYNC_STATE_HANDSHAKE:
+      {
+        // the server certificate is verified as part of the handshake
+        int ret = SSL_connect(op->ssl);
+
+        if (ret != 1)
+        {
+          return tls_async_retry(op, ret, "TLS handshake");
+        }
+        op->state = TLS_ASYNC_STATE_SEND;
+        break;
+      }
+
+    case TLS_ASYNC_STATE_SEND:
+      {
+        // without partial writes, SSL_write() completes the whole request
+        // (and must be retried with the same arguments until it does)
+        int ret = SSL_write(op->ssl, op->request, (int) op->request_len);
+
+        if (ret <= 0)
+        {
+          return tls_async_retry(op, ret, "KMIP request write");
+        }
+        op->received = 0;
+        op->state = TLS_ASYNC_STATE_RECV_HEADER;
+        break;
+      }
+
+    case TLS_ASYNC_STATE_RECV_HEADER:
+      {
+        tls_async_status status = tls_async_read(op, op->header,
+                                                 sizeof(op->header));
+
+        if (status != TLS_ASYNC_DONE)
+        {
+          return status;
+        }
+
+        size_t value_len = ((size_t) op->header[4] << 24)
+          | ((size_t) op->header[5] << 16)
+          | ((size_t) op->header[6] << 8) | (size_t) op->header[7];
+
+        if (value_len > KMYTH_KMIP_MAX_MESSAGE_SIZE - sizeof(op->header))
+        {
+          kmyth_log(LOG_ERR, "KMIP message too large (%zu bytes) ... exiting",
+                    value_len);
+          op->state = TLS_ASYNC_STATE_FAILED;
+          return TLS_ASYNC_ERROR;
+        }
+
+        op->response_len = sizeof(op->header) + value_len;
+        op->response = kmyth_secure_alloc(op->response_len);
+        if (op->response == NULL)
+        {
+          kmyth_log(LOG_ERR, "error allocating KMIP message buffer ... "
+                    "exiting");
+          op->state = TLS_ASYNC_STATE_FAILED;
+          return TLS_ASYNC_ERROR;
+        }
+        memcpy(op->response, op->header, sizeof(op->header));
+        op->state = TLS_ASYNC_STATE_RECV_BODY;
+        break;
+      }
+
+    case TLS_ASYNC_STATE_RECV_BODY:
+      {
+        tls_async_status status = tls_async_read(op, op->response,
+                                                 op->response_len);
+
+        if (status != TLS_ASYNC_DONE)
+        {
+          return status;
+        }
+        if (kmip_parse_get_keys(&op->kmip_context,
+                                op->response, op->response_len,
+                                op->ids, op->id_lens, op->id_count,
+                                op->keys, op->key_sizes))
+        {
+          op->state = TLS_ASYNC_STATE_FAILED;
+          return TLS_ASYNC_ERROR;
+        }
+        op->state = TLS_ASYNC_STATE_FINISHED;
+        break;
+      }
+
+    case TLS_ASYNC_STATE_FINISHED:
+      return TLS_ASYNC_DONE;
+
+    default:
+      return TLS_ASYNC_ERROR;
+    }
+  }
+}
+
+//############################################################################
+// tls_async_get_keys_result()
+//############################################################################
+int tls_async_get_keys_result(tls_async * op,
+                              unsigned char **keys, size_t *key_sizes)
+{
+  if (op == NULL || op->state != TLS_ASYNC_STATE_FINISHED
+      || keys == NULL || key_sizes == NULL)
+  {
+    kmyth_log(LOG_ERR, "no keys retrieved by TLS async operation ... exiting");
+    return 1;
+  }
+
+  // the keys are handed over, so they can be taken only once
+  for (size_t i = 0; i < op->id_count; i++)
+  {
+    keys[i] = op->keys[i];
+    key_sizes[i] = op->key_sizes[i];
+    op->keys[i] = NULL;
+    op->key_sizes[i] = 0;
+  }
+  op->state = TLS_ASYNC_STATE_FAILED;
 
-  kmip_destroy(&kmip_context);
   return 0;
 }
+
+//############################################################################
+// tls_async_free()
+//############################################################################
+void tls_async_free(tls_async ** op)
+{
+  if (op == NULL || *op == NULL)
+  {
+    return;
+  }
+
+  if ((*op)->ssl != NULL)
+  {
+    // a best effort close notify, as the socket must not be waited on
+    if (SSL_is_init_finished((*op)->ssl))
+    {
+      SSL_shutdown((*op)->ssl);
+    }
+    SSL_free((*op)->ssl);
+  }
+  if ((*op)->fd >= 0)
+  {
+    close((*op)->fd);
+  }
+
+  kmyth_clear_and_free((*op)->request, (*op)->request_len);
+  kmyth_secure_free((*op)->response, (*op)->response_len);
+  for (size_t i = 0; i < (*op)->id_count; i++)
+  {
+    free((*op)->ids[i]);
+    kmyth_clear_and_free((*op)->keys[i], (*op)->key_sizes[i]);
+  }
+  kmip_destroy(&(*op)->kmip_context);
+
+  kmyth_clear(*op, sizeof(tls_async));
+  free(*op);
+  *op = NULL;
+}
@@ -7,6 +7,7 @@
 #include "defines.h"
 #include "memory_util.h"
 #include "aes_gcm.h"
+#include "kmip_util.h"
 
 #ifdef KMYTH_SGX
   #define time(ret_ptr) time_sgx((ret_ptr))
@@ -31,22 +32,137 @@ int build_kmip_get_request(KMIP * ctx,
                            unsigned char *id, size_t id_len,
                            unsigned char **request, size_t *request_len)
 {
-  // Set up the encoding buffer.
-  size_t buffer_blocks = 1;
-  size_t buffer_block_size = 1024;
-  size_t buffer_total_size = buffer_blocks * buffer_block_size;
+  return build_kmip_get_batch_request(ctx, &id, &id_len, 1,
+                                      request, request_len);
+}
+
+//
+// kmip_encoding_buffer_free()
+//
+void kmip_encoding_buffer_free(kmip_encoding_buffer * buffer)
+{
+  if (buffer == NULL)
+  {
+    return;
+  }
+  kmyth_clear_and_free(buffer->data, buffer->size);
+  buffer->data = NULL;
+  buffer->size = 0;
+}
+
+// A first guess at the encoded size of a message header, and of the fixed
+// part of each batch item, so most messages encode on the first attempt.
+#define KMIP_ENCODING_HEADER_ESTIMATE 256
+#define KMIP_ENCODING_ITEM_ESTIMATE 128
+
+// The encoded size of a TTLV value of the given length (padded to eight
+// bytes), with its header.
+static size_t encoded_item_size(size_t len)
+{
+  return KMIP_TTLV_HEADER_SIZE + ((len + 7) / 8) * 8;
+}
+
+typedef int (*kmip_encode_message_fn) (KMIP * ctx, void *message);
+
+static int encode_request_message(KMIP * ctx, void *message)
+{
+  return kmip_encode_request_message(ctx, (RequestMessage *) message);
+}
+
+static int encode_response_message(KMIP * ctx, void *message)
+{
+  return kmip_encode_response_message(ctx, (ResponseMessage *) message);
+}
+
+//
+// encode_kmip_message()
+//
+// Encodes a message into the encoding buffer, starting from the larger of
+// the buffer's size and the size expected, and doubling the buffer each
+// time the message does not fit.
+//
+static int encode_kmip_message(KMIP * ctx, kmip_encode_message_fn encode,
+                               void *message, size_t size_hint,
+                               kmip_encoding_buffer * buffer,
+                               size_t *message_len)
+{
+  size_t size = (buffer->size > size_hint) ? buffer->size : size_hint;
+  int result = KMIP_ERROR_BUFFER_FULL;
+
+  while (result == KMIP_ERROR_BUFFER_FULL
+         && size <= KMIP_ENCODING_BUFFER_MAX_SIZE)
+  {
+    if (size > buffer->size)
+    {
+      // nothing in the old buffer is kept, so it is replaced, not copied
+      unsigned char *data = malloc(size);
+
+      if (data == NULL)
+      {
+        kmyth_log(LOG_ERR, "Failed to allocate the KMIP encoding buffer.");
+        return 1;
+      }
+      kmip_encoding_buffer_free(buffer);
+      buffer->data = data;
+      buffer->size = size;
+    }
 
-  uint8 *encoding = calloc(buffer_blocks, buffer_block_size);
+    // detach the buffer before the reset, so it is not zeroed needlessly
+    kmip_set_buffer(ctx, NULL, 0);
+    kmip_reset(ctx);
+    kmip_set_buffer(ctx, buffer->data, buffer->size);
+
+    result = encode(ctx, message);
+    size = 2 * buffer->size;
+  }
+
+  if (result == KMIP_OK)
+  {
+    *message_len = ctx->index - ctx->buffer;
+  }
+  kmip_set_buffer(ctx, NULL, 0);
+  return (result == KMIP_OK) ? 0 : 1;
+}
 
-  if (encoding == NULL)
+//
+// build_kmip_get_batch_request()
+//
+int build_kmip_get_batch_request(KMIP * ctx,
+                                 unsigned char **ids, size_t *id_lens,
+                                 size_t id_count,
+                                 unsigned char **request, size_t *request_len)
+{
+  kmip_encoding_buffer buffer = { NULL, 0 };
+
+  if (build_kmip_get_batch_request_into(ctx, ids, id_lens, id_count,
+                                        &buffer, request_len))
   {
-    kmyth_log(LOG_ERR, "Failed to allocate the KMIP encoding buffer.");
+    kmip_encoding_buffer_free(&buffer);
+    return 1;
+  }
+
+  // hand the encoding buffer over, rather than a copy of the message
+  *request = buffer.data;
+  return 0;
+}
+
+//
+// build_kmip_get_batch_request_into()
+//
+int build_kmip_get_batch_request_into(KMIP * ctx,
+                                      unsigned char **ids, size_t *id_lens,
+                                      size_t id_count,
+                                      kmip_encoding_buffer * buffer,
+                                      size_t *request_len)
+{
+  if (ids == NULL || id_lens == NULL || id_count == 0
+      || id_count > KMIP_GET_BATCH_MAX_ITEMS)
+  {
+    kmyth_log(LOG_ERR, "Invalid KMIP Get request key IDs.");
     return 1;
   }
-  kmip_reset(ctx);
-  kmip_set_buffer(ctx, encoding, buffer_total_size);
 
-  // Build the KMIP Get request.
+  // Build the KMIP Get request, one batch item per key ID.
   ProtocolVersion protocol_version = { 0 };
   kmip_init_protocol_version(&protocol_version, ctx->version);
 
@@ -56,49 +172,50 @@ int build_kmip_get_request(KMIP * ctx,
   header.protocol_version = &protocol_version;
   header.maximum_response_size = ctx->max_message_size;
   header.time_stamp = time(NULL);
-  header.batch_count = 1;
+  header.batch_count = (int32) id_count;
 
-  TextString key_id = { 0 };
-  key_id.value = (char *) id;
-  key_id.size = id_len;
+  TextString key_ids[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  GetRequestPayload payloads[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  uint8 item_id_values[KMIP_GET_BATCH_MAX_ITEMS][KMIP_GET_BATCH_ITEM_ID_SIZE];
+  ByteString item_ids[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  RequestBatchItem batch_items[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  size_t size_hint = KMIP_ENCODING_HEADER_ESTIMATE;
+
+  for (size_t i = 0; i < id_count; i++)
+  {
+    key_ids[i].value = (char *) ids[i];
+    key_ids[i].size = id_lens[i];
+    size_hint += KMIP_ENCODING_ITEM_ESTIMATE + encoded_item_size(id_lens[i]);
 
-  GetRequestPayload payload = { 0 };
-  payload.unique_identifier = &key_id;
+    payloads[i].unique_identifier = &key_ids[i];
 
-  RequestBatchItem batch_item = { 0 };
-  kmip_init_request_batch_item(&batch_item);
-  batch_item.operation = KMIP_OP_GET;
-  batch_item.request_payload = &payload;
+    kmip_init_request_batch_item(&batch_items[i]);
+    batch_items[i].operation = KMIP_OP_GET;
+    batch_items[i].request_payload = &payloads[i];
+
+    // KMIP requires a Unique Batch Item ID on each item of a multi-item
+    // batch; the item's index is used, so responses map back to requests
+    if (id_count > 1)
+    {
+      item_id_values[i][0] = (uint8) (i >> 8);
+      item_id_values[i][1] = (uint8) i;
+      item_ids[i].value = item_id_values[i];
+      item_ids[i].size = KMIP_GET_BATCH_ITEM_ID_SIZE;
+      batch_items[i].unique_batch_item_id = &item_ids[i];
+    }
+  }
 
   RequestMessage message = { 0 };
   message.request_header = &header;
-  message.batch_items = &batch_item;
-  message.batch_count = 1;
-
-  int result = kmip_encode_request_message(ctx, &message);
+  message.batch_items = batch_items;
+  message.batch_count = id_count;
 
-  if (result != KMIP_OK)
+  if (encode_kmip_message(ctx, encode_request_message, &message, size_hint,
+                          buffer, request_len))
   {
     kmyth_log(LOG_ERR, "Failed to encode the KMIP key request.");
-    kmyth_clear_and_free(encoding, buffer_total_size);
-    kmip_set_buffer(ctx, NULL, 0);
-    return 1;
-  }
-
-  // Set up the official request buffer and clean up.
-  *request_len = ctx->index - ctx->buffer;
-  *request = calloc(*request_len, sizeof(unsigned char));
-  if (request == NULL)
-  {
-    kmyth_log(LOG_ERR, "Failed to allocate the KMIP request buffer.");
-    kmyth_clear_and_free(encoding, buffer_total_size);
-    kmip_set_buffer(ctx, NULL, 0);
     return 1;
   }
-  memcpy(*request, encoding, *request_len);
-
-  kmyth_clear_and_free(encoding, buffer_total_size);
-  kmip_set_buffer(ctx, NULL, 0);
 
   return 0;
 }
@@ -164,6 +281,127 @@ int parse_kmip_get_request(KMIP * ctx,
   return 0;
 }
 
+//
+// parse_kmip_get_batch_request()
+//
+int parse_kmip_get_batch_request(KMIP * ctx,
+                                 unsigned char *request, size_t request_len,
+                                 unsigned char **ids, size_t *id_lens,
+                                 unsigned char **item_ids,
+                                 size_t *item_id_lens, size_t *id_count)
+{
+  if (ids == NULL || id_lens == NULL || item_ids == NULL
+      || item_id_lens == NULL || id_count == NULL)
+  {
+    kmyth_log(LOG_ERR, "Invalid KMIP Get request parameters.");
+    return 1;
+  }
+  *id_count = 0;
+
+  // Set up the decoding buffer and data structures.
+  kmip_reset(ctx);
+  kmip_set_buffer(ctx, request, request_len);
+  RequestMessage message = { 0 };
+
+  // Parse the request message and handle errors.
+  int result = kmip_decode_request_message(ctx, &message);
+
+  if (result != KMIP_OK)
+  {
+    kmyth_log(LOG_ERR, "Failed to decode the KMIP request message.");
+    kmip_free_request_message(ctx, &message);
+    kmip_set_buffer(ctx, NULL, 0);
+    return 1;
+  }
+
+  size_t count = message.batch_count;
+
+  if (count == 0 || count > KMIP_GET_BATCH_MAX_ITEMS
+      || message.request_header->batch_count != (int32) count)
+  {
+    kmyth_log(LOG_ERR, "Received incorrect number of requests "
+              "(expected 1 to %d).", KMIP_GET_BATCH_MAX_ITEMS);
+    kmip_free_request_message(ctx, &message);
+    kmip_set_buffer(ctx, NULL, 0);
+    return 1;
+  }
+
+  size_t parsed = 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    RequestBatchItem batch_item = message.batch_items[i];
+    GetRequestPayload *payload =
+      (GetRequestPayload *) batch_item.request_payload;
+
+    ids[i] = NULL;
+    id_lens[i] = 0;
+    item_ids[i] = NULL;
+    item_id_lens[i] = 0;
+
+    if (batch_item.operation != KMIP_OP_GET || payload == NULL
+        || payload->unique_identifier == NULL)
+    {
+      kmyth_log(LOG_ERR, "Did not receive a KMIP Get request.");
+      break;
+    }
+
+    // KMIP requires a Unique Batch Item ID on each item of a multi-item
+    // batch, to be echoed in the response item that answers it
+    ByteString *item_id = batch_item.unique_batch_item_id;
+
+    if (count > 1 && (item_id == NULL || item_id->size == 0))
+    {
+      kmyth_log(LOG_ERR, "KMIP batch item has no Unique Batch Item ID.");
+      break;
+    }
+
+    // Set up the official ID buffers.
+    ids[i] = calloc(payload->unique_identifier->size, sizeof(unsigned char));
+    if (ids[i] == NULL)
+    {
+      kmyth_log(LOG_ERR, "Failed to allocate the ID buffer.");
+      break;
+    }
+    id_lens[i] = payload->unique_identifier->size;
+    memcpy(ids[i], payload->unique_identifier->value, id_lens[i]);
+
+    if (item_id != NULL && item_id->size > 0)
+    {
+      item_ids[i] = calloc(item_id->size, sizeof(unsigned char));
+      if (item_ids[i] == NULL)
+      {
+        kmyth_log(LOG_ERR, "Failed to allocate the batch item ID buffer.");
+        break;
+      }
+      item_id_lens[i] = item_id->size;
+      memcpy(item_ids[i], item_id->value, item_id_lens[i]);
+    }
+
+    parsed++;
+  }
+
+  kmip_free_request_message(ctx, &message);
+  kmip_set_buffer(ctx, NULL, 0);
+
+  if (parsed != count)
+  {
+    for (size_t i = 0; i <= parsed && i < count; i++)
+    {
+      free(ids[i]);
+      free(item_ids[i]);
+      ids[i] = NULL;
+      id_lens[i] = 0;
+      item_ids[i] = NULL;
+      item_id_lens[i] = 0;
+    }
+    return 1;
+  }
+
+  *id_count = count;
+  return 0;
+}
+
 //
 // build_kmip_get_response()
 //
@@ -172,22 +410,62 @@ int build_kmip_get_response(KMIP * ctx,
                             unsigned char *key, size_t key_len,
                             unsigned char **response, size_t *response_len)
 {
-  // Set up the encoding buffer
-  size_t buffer_blocks = 1;
-  size_t buffer_block_size = 1024;
-  size_t buffer_total_size = buffer_blocks * buffer_block_size;
+  unsigned char *item_id = NULL;
+  size_t item_id_len = 0;
 
-  uint8 *encoding = calloc(buffer_blocks, buffer_block_size);
+  return build_kmip_get_batch_response(ctx, &id, &id_len, &item_id,
+                                       &item_id_len, &key, &key_len, 1,
+                                       response, response_len);
+}
+
+//
+// build_kmip_get_batch_response()
+//
+int build_kmip_get_batch_response(KMIP * ctx,
+                                  unsigned char **ids, size_t *id_lens,
+                                  unsigned char **item_ids,
+                                  size_t *item_id_lens,
+                                  unsigned char **keys, size_t *key_lens,
+                                  size_t id_count,
+                                  unsigned char **response,
+                                  size_t *response_len)
+{
+  kmip_encoding_buffer buffer = { NULL, 0 };
 
-  if (encoding == NULL)
+  if (build_kmip_get_batch_response_into(ctx, ids, id_lens, item_ids,
+                                         item_id_lens, keys, key_lens,
+                                         id_count, &buffer, response_len))
   {
-    kmyth_log(LOG_ERR, "Failed to allocate the KMIP encoding buffer.");
+    kmip_encoding_buffer_free(&buffer);
+    return 1;
+  }
+
+  // hand the encoding buffer over, rather than a copy of the message
+  *response = buffer.data;
+  return 0;
+}
+
+//
+// build_kmip_get_batch_response_into()
+//
+int build_kmip_get_batch_response_into(KMIP * ctx,
+                                       unsigned char **ids, size_t *id_lens,
+                                       unsigned char **item_ids,
+                                       size_t *item_id_lens,
+                                       unsigned char **keys,
+                                       size_t *key_lens, size_t id_count,
+                                       kmip_encoding_buffer * buffer,
+                                       size_t *response_len)
+{
+  if (ids == NULL || id_lens == NULL || item_ids == NULL
+      || item_id_lens == NULL || keys == NULL || key_lens == NULL
+      || id_count == 0 || id_count > KMIP_GET_BATCH_MAX_ITEMS)
+  {
+    kmyth_log(LOG_ERR, "Invalid KMIP Get response parameters.");
     return 1;
   }
-  kmip_reset(ctx);
-  kmip_set_buffer(ctx, encoding, buffer_total_size);
 
-  // Build the KMIP Get response
+  // Build the KMIP Get response, one batch item per key.
   ProtocolVersion protocol_version = { 0 };
   kmip_init_protocol_version(&protocol_version, ctx->version);
 
@@ -196,65 +474,65 @@ int build_kmip_get_response(KMIP * ctx,
 
   header.protocol_version = &protocol_version;
   header.time_stamp = time(NULL);
-  header.batch_count = 1;
+  header.batch_count = (int32) id_count;
+
+  ByteString key_materials[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  KeyValue key_values[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  KeyBlock key_blocks[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  SymmetricKey symmetric_keys[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  TextString key_ids[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  GetResponsePayload payloads[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  ByteString batch_item_ids[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  ResponseBatchItem batch_items[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  size_t size_hint = KMIP_ENCODING_HEADER_ESTIMATE;
+
+  for (size_t i = 0; i < id_count; i++)
+  {
+    key_materials[i].size = key_lens[i];
+    key_materials[i].value = keys[i];
+    size_hint += 2 * KMIP_ENCODING_ITEM_ESTIMATE
+      + encoded_item_size(id_lens[i]) + encoded_item_size(key_lens[i])
+      + encoded_item_size(item_id_lens[i]);
 
-  ByteString byte_string = { 0 };
-  byte_string.size = key_len;
-  byte_string.value = key;
+    key_values[i].key_material = &key_materials[i];
 
-  KeyValue key_value = { 0 };
-  key_value.key_material = &byte_string;
+    key_blocks[i].key_format_type = KMIP_KEYFORMAT_RAW;
+    key_blocks[i].key_value = &key_values[i];
 
-  KeyBlock key_block = { 0 };
-  key_block.key_format_type = KMIP_KEYFORMAT_RAW;
-  key_block.key_value = &key_value;
+    symmetric_keys[i].key_block = &key_blocks[i];
 
-  SymmetricKey symmetric_key = { 0 };
-  symmetric_key.key_block = &key_block;
+    key_ids[i].value = (char *) ids[i];
+    key_ids[i].size = id_lens[i];
 
-  TextString key_id = { 0 };
-  key_id.value = (char *) id;
-  key_id.size = id_len;
+    payloads[i].object_type = KMIP_OBJTYPE_SYMMETRIC_KEY;
+    payloads[i].unique_identifier = &key_ids[i];
+    payloads[i].object = &symmetric_keys[i];
 
-  GetResponsePayload payload = { 0 };
-  payload.object_type = KMIP_OBJTYPE_SYMMETRIC_KEY;
-  payload.unique_identifier = &key_id;
-  payload.object = &symmetric_key;
+    batch_items[i].operation = KMIP_OP_GET;
+    batch_items[i].result_status = KMIP_STATUS_SUCCESS;
+    batch_items[i].response_payload = &payloads[i];
 
-  ResponseBatchItem batch_item = { 0 };
-  batch_item.operation = KMIP_OP_GET;
-  batch_item.result_status = KMIP_STATUS_SUCCESS;
-  batch_item.response_payload = &payload;
+    // echo the request item's ID, which lets the client match the answers
+    // to its requests in whatever order they come
+    if (item_ids[i] != NULL)
+    {
+      batch_item_ids[i].value = item_ids[i];
+      batch_item_ids[i].size = item_id_lens[i];
+      batch_items[i].unique_batch_item_id = &batch_item_ids[i];
+    }
+  }
 
   ResponseMessage message = { 0 };
   message.response_header = &header;
-  message.batch_items = &batch_item;
-  message.batch_count = 1;
+  message.batch_items = batch_items;
+  message.batch_count = id_count;
 
-  int result = kmip_encode_response_message(ctx, &message);
-
-  if (result != KMIP_OK)
+  if (encode_kmip_message(ctx, encode_response_message, &message,
+                          size_hint, buffer, response_len))
   {
     kmyth_log(LOG_ERR, "Failed to encode the KMIP Get response.");
-    kmyth_clear_and_free(encoding, buffer_total_size);
-    kmip_set_buffer(ctx, NULL, 0);
-    return 1;
-  }
-
-  // Set up the official response buffer and clean up.
-  *response_len = ctx->index - ctx->buffer;
-  *response = calloc(*response_len, sizeof(unsigned char));
-  if (response == NULL)
-  {
-    kmyth_log(LOG_ERR, "Failed to allocate the KMIP response buffer.");
-    kmyth_clear_and_free(encoding, buffer_total_size);
-    kmip_set_buffer(ctx, NULL, 0);
     return 1;
   }
-  memcpy(*response, encoding, *response_len);
-
-  kmyth_clear_and_free(encoding, buffer_total_size);
-  kmip_set_buffer(ctx, NULL, 0);
 
   return 0;
 }
@@ -267,6 +545,33 @@ int parse_kmip_get_response(KMIP * ctx,
                             unsigned char **id, size_t *id_len,
                             unsigned char **key, size_t *key_len)
 {
+  return parse_kmip_get_batch_response(ctx, response, response_len, 1,
+                                       id, id_len, key, key_len);
+}
+
+//
+// parse_kmip_get_batch_response()
+//
+int parse_kmip_get_batch_response(KMIP * ctx,
+                                  unsigned char *response,
+                                  size_t response_len, size_t id_count,
+                                  unsigned char **ids, size_t *id_lens,
+                                  unsigned char **keys, size_t *key_lens)
+{
+  if (ids == NULL || id_lens == NULL || keys == NULL || key_lens == NULL
+      || id_count == 0)
+  {
+    kmyth_log(LOG_ERR, "Invalid KMIP Get response parameters.");
+    return 1;
+  }
+  for (size_t i = 0; i < id_count; i++)
+  {
+    ids[i] = NULL;
+    id_lens[i] = 0;
+    keys[i] = NULL;
+    key_lens[i] = 0;
+  }
+
   // Set up the decoding buffer and data structures.
   kmip_reset(ctx);
   kmip_set_buffer(ctx, response, response_len);
@@ -283,74 +588,104 @@ int parse_kmip_get_response(KMIP * ctx,
     return 1;
   }
 
-  if (message.response_header->batch_count != 1)
+  if (message.response_header->batch_count != (int32) id_count
+      || message.batch_count != id_count)
   {
-    kmyth_log(LOG_ERR, "Received incorrect number of responses (expected 1).");
+    kmyth_log(LOG_ERR, "Received incorrect number of responses "
+              "(expected %zu).", id_count);
     kmip_free_response_message(ctx, &message);
     kmip_set_buffer(ctx, NULL, 0);
     return 1;
   }
 
-  ResponseBatchItem batch_item = message.batch_items[0];
+  // Map each batch item back to the request it answers: by its Unique
+  // Batch Item ID if it has one, otherwise by its position.
+  size_t parsed = 0;
 
-  if (batch_item.operation != KMIP_OP_GET)
-  {
-    kmyth_log(LOG_ERR, "Did not receive a KMIP Get response.");
-    kmip_free_response_message(ctx, &message);
-    kmip_set_buffer(ctx, NULL, 0);
-    return 1;
-  }
-  if (batch_item.result_status != KMIP_STATUS_SUCCESS)
+  for (size_t n = 0; n < id_count; n++)
   {
-    kmyth_log(LOG_ERR, "The KMIP Get request failed.");
-    kmip_free_response_message(ctx, &message);
-    kmip_set_buffer(ctx, NULL, 0);
-    return 1;
-  }
+    ResponseBatchItem batch_item = message.batch_items[n];
+    size_t i = n;
 
-  GetResponsePayload *payload =
-    (GetResponsePayload *) batch_item.response_payload;
-  if (payload->object_type != KMIP_OBJTYPE_SYMMETRIC_KEY)
-  {
-    kmyth_log(LOG_ERR, "The received KMIP object is not a symmetric key.");
-    kmip_free_response_message(ctx, &message);
-    kmip_set_buffer(ctx, NULL, 0);
-    return 1;
-  }
+    if (id_count > 1 && batch_item.unique_batch_item_id != NULL)
+    {
+      ByteString *item_id = batch_item.unique_batch_item_id;
 
-  SymmetricKey *symmetric_key = (SymmetricKey *) payload->object;
-  KeyBlock *key_block = symmetric_key->key_block;
-  KeyValue *key_value = key_block->key_value;
-  ByteString *key_material = key_value->key_material;
+      i = id_count;
+      if (item_id->size == KMIP_GET_BATCH_ITEM_ID_SIZE)
+      {
+        i = ((size_t) item_id->value[0] << 8) | item_id->value[1];
+      }
+    }
+    if (i >= id_count || ids[i] != NULL)
+    {
+      kmyth_log(LOG_ERR, "Unexpected KMIP batch item in the Get response.");
+      break;
+    }
 
-  // Set up the official ID and key buffers and clean up.
-  *id = calloc(payload->unique_identifier->size, sizeof(unsigned char));
-  if (*id == NULL)
-  {
-    kmyth_log(LOG_ERR, "Failed to allocate the ID buffer.");
-    kmip_free_response_message(ctx, &message);
-    kmip_set_buffer(ctx, NULL, 0);
-    return 1;
-  }
-  *id_len = payload->unique_identifier->size;
-  memcpy(*id, payload->unique_identifier->value, *id_len);
+    if (batch_item.operation != KMIP_OP_GET)
+    {
+      kmyth_log(LOG_ERR, "Did not receive a KMIP Get response.");
+      break;
+    }
+    if (batch_item.result_status != KMIP_STATUS_SUCCESS)
+    {
+      kmyth_log(LOG_ERR, "The KMIP Get request failed (batch item %zu).", i);
+      break;
+    }
 
-  *key = calloc(key_material->size, sizeof(unsigned char));
-  if (*key == NULL)
-  {
-    kmyth_log(LOG_ERR, "Failed to allocate the key buffer.");
-    kmyth_clear_and_free(*id, *id_len);
-    *id = NULL;
-    *id_len = 0;
-    kmip_free_response_message(ctx, &message);
-    kmip_set_buffer(ctx, NULL, 0);
-    return 1;
+    GetResponsePayload *payload =
+      (GetResponsePayload *) batch_item.response_payload;
+    if (payload->object_type != KMIP_OBJTYPE_SYMMETRIC_KEY)
+    {
+      kmyth_log(LOG_ERR, "The received KMIP object is not a symmetric key.");
+      break;
+    }
+
+    SymmetricKey *symmetric_key = (SymmetricKey *) payload->object;
+    KeyBlock *key_block = symmetric_key->key_block;
+    KeyValue *key_value = key_block->key_value;
+    ByteString *key_material = key_value->key_material;
+
+    // Set up the official ID and key buffers.
+    ids[i] = calloc(payload->unique_identifier->size, sizeof(unsigned char));
+    if (ids[i] == NULL)
+    {
+      kmyth_log(LOG_ERR, "Failed to allocate the ID buffer.");
+      break;
+    }
+    id_lens[i] = payload->unique_identifier->size;
+    memcpy(ids[i], payload->unique_identifier->value, id_lens[i]);
+
+    keys[i] = calloc(key_material->size, sizeof(unsigned char));
+    if (keys[i] == NULL)
+    {
+      kmyth_log(LOG_ERR, "Failed to allocate the key buffer.");
+      break;
+    }
+    key_lens[i] = key_material->size;
+    memcpy(keys[i], key_material->value, key_lens[i]);
+
+    parsed++;
   }
-  *key_len = key_material->size;
-  memcpy(*key, key_material->value, *key_len);
 
   kmip_free_response_message(ctx, &message);
   kmip_set_buffer(ctx, NULL, 0);
 
+  if (parsed != id_count)
+  {
+    // one failed batch item fails the whole request
+    for (size_t i = 0; i < id_count; i++)
+    {
+      kmyth_clear_and_free(ids[i], id_lens[i]);
+      kmyth_clear_and_free(keys[i], key_lens[i]);
+      ids[i] = NULL;
+      id_lens[i] = 0;
+      keys[i] = NULL;
+      key_lens[i] = 0;
+    }
+    return 1;
+  }
+
   return 0;
 }
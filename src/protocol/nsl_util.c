@@ -1,5 +1,6 @@
 //
-// An implementation of the Needham-Schroeder-Lowe protocol using OpenSSL RSA.
+// An implementation of the Needham-Schroeder-Lowe protocol using OpenSSL RSA,
+// and of an ECDH/ECDSA variant built on the shared SGX ECDH utilities.
 // 
 
 #include <string.h>
@@ -16,11 +17,16 @@
 #include <openssl/bn.h>
 #include <openssl/engine.h>
 
+#include "byte_builder.h"
 #include "defines.h"
+#include "ecdh_util.h"
 #include "memory_util.h"
+#include "nsl_util.h"
 
 #define NSL_NONCE_LEN 32
 #define NSL_SESSION_KEY_LEN 32
+#define NSL_MAX_MESSAGE_LEN 8192
+#define NSL_SESSION_KEY_INFO "kmyth NSL session key"
 
 //
 // encrypt_with_key_pair()
@@ -29,23 +35,17 @@ int encrypt_with_key_pair(EVP_PKEY_CTX * ctx,
                           const unsigned char *p, size_t p_len,
                           unsigned char **c, size_t *c_len)
 {
-  // Initialize the context for encryption.
-  int result = EVP_PKEY_encrypt_init(ctx);
+  // The context was initialized for encryption when it was set up, and
+  // the ciphertext is never longer than the key, so one call does it.
+  EVP_PKEY *pkey = EVP_PKEY_CTX_get0_pkey(ctx);
 
-  if (result == 0)
-  {
-    kmyth_log(LOG_ERR, "Failed to initialize the EVP context for encryption.");
-    return 1;
-  }
-
-  // Determine the length of the ciphertext buffer.
-  result = EVP_PKEY_encrypt(ctx, NULL, c_len, p, p_len);
-  if (result <= 0)
+  if (pkey == NULL || EVP_PKEY_size(pkey) <= 0)
   {
     kmyth_log(LOG_ERR,
               "Failed to determine the length of the ciphertext buffer.");
     return 1;
   }
+  *c_len = (size_t) EVP_PKEY_size(pkey);
 
   // Allocate the ciphertext buffer.
   *c = calloc(*c_len, sizeof(unsigned char));
@@ -56,10 +56,12 @@ int encrypt_with_key_pair(EVP_PKEY_CTX * ctx,
   }
 
   // Encrypt the plaintext.
-  result = EVP_PKEY_encrypt(ctx, *c, c_len, p, p_len);
-  if (result <= 0)
+  if (EVP_PKEY_encrypt(ctx, *c, c_len, p, p_len) <= 0)
   {
     kmyth_log(LOG_ERR, "Failed to encrypt the plaintext.");
+    free(*c);
+    *c = NULL;
+    *c_len = 0;
     return 1;
   }
 
@@ -73,37 +75,34 @@ int decrypt_with_key_pair(EVP_PKEY_CTX * ctx,
                           const unsigned char *c, size_t c_len,
                           unsigned char **p, size_t *p_len)
 {
-  // Initialize the context for decryption.
-  int result = EVP_PKEY_decrypt_init(ctx);
-
-  if (result == 0)
-  {
-    kmyth_log(LOG_ERR, "Failed to initialize the EVP context for decryption.");
-    return 1;
-  }
+  // The context was initialized for decryption when it was set up, and
+  // the plaintext is never longer than the key, so one call does it.
+  EVP_PKEY *pkey = EVP_PKEY_CTX_get0_pkey(ctx);
 
-  // Determine the length of the plaintext buffer.
-  result = EVP_PKEY_decrypt(ctx, NULL, p_len, c, c_len);
-  if (result <= 0)
+  if (pkey == NULL || EVP_PKEY_size(pkey) <= 0)
   {
     kmyth_log(LOG_ERR,
               "Failed to determine the length of the plaintext buffer.");
     return 1;
   }
+  size_t buffer_len = (size_t) EVP_PKEY_size(pkey);
 
-  // Allocate the plaintext buffer.
-  *p = calloc(*p_len, sizeof(unsigned char));
+  // Allocate the plaintext buffer (in locked memory, since it holds nonces).
+  *p = kmyth_secure_alloc(buffer_len);
   if (*p == NULL)
   {
     kmyth_log(LOG_ERR, "Failed to allocate the plaintext buffer.");
     return 1;
   }
+  *p_len = buffer_len;
 
   // Decrypt the ciphertext.
-  result = EVP_PKEY_decrypt(ctx, *p, p_len, c, c_len);
-  if (result <= 0)
+  if (EVP_PKEY_decrypt(ctx, *p, p_len, c, c_len) <= 0)
   {
     kmyth_log(LOG_ERR, "Failed to decrypt the ciphertext.");
+    kmyth_secure_free(*p, buffer_len);
+    *p = NULL;
+    *p_len = 0;
     return 1;
   }
 
@@ -128,33 +127,23 @@ int build_nonce_request(EVP_PKEY_CTX * ctx,
 
   // TODO Add a length check for the ID as well.
 
-  // Allocate the unencrypted request buffer.
-  unsigned char *message = NULL;
-  size_t message_len = id_len + nonce_len + (2 * sizeof(size_t));
+  // Allocate and build the unencrypted nonce request message.
+  byte_builder message = { 0 };
 
-  message = calloc(message_len, sizeof(unsigned char));
-  if (message == NULL)
+  if (byte_builder_init(&message, id_len + nonce_len + (2 * sizeof(size_t)))
+      || byte_builder_append_sized(&message, nonce, nonce_len)
+      || byte_builder_append_sized(&message, id, id_len))
   {
-    kmyth_log(LOG_ERR, "Failed to allocate the message buffer.");
+    kmyth_log(LOG_ERR, "Failed to build the nonce request message.");
+    byte_builder_free(&message);
     return 1;
   }
 
-  // Build the nonce request message.
-  unsigned char *index = message;
-
-  memcpy(index, &nonce_len, sizeof(size_t));
-  index += sizeof(size_t);
-  memcpy(index, nonce, nonce_len);
-  index += nonce_len;
-  memcpy(index, &id_len, sizeof(size_t));
-  index += sizeof(size_t);
-  memcpy(index, id, id_len);
-
   // Encrypt the nonce request and then clean up the unencrypted request.
-  int result =
-    encrypt_with_key_pair(ctx, message, message_len, request, request_len);
+  int result = encrypt_with_key_pair(ctx, message.buffer, message.length,
+                                     request, request_len);
 
-  kmyth_clear_and_free(message, message_len);
+  byte_builder_free(&message);
 
   // Handle encryption errors if any occurred.
   if (result)
@@ -197,7 +186,7 @@ int parse_nonce_request(EVP_PKEY_CTX * ctx,
 
     *nonce_len = 0;
 
-    kmyth_clear_and_free(message, message_len);
+    kmyth_secure_free(message, message_len);
 
     return 1;
   }
@@ -218,13 +207,13 @@ int parse_nonce_request(EVP_PKEY_CTX * ctx,
 
     *id_len = 0;
 
-    kmyth_clear_and_free(message, message_len);
+    kmyth_secure_free(message, message_len);
 
     return 1;
   }
   memcpy(*id, index, *id_len);
 
-  kmyth_clear_and_free(message, message_len);
+  kmyth_secure_free(message, message_len);
 
   return 0;
 }
@@ -238,37 +227,26 @@ int build_nonce_response(EVP_PKEY_CTX * ctx,
                          unsigned char *id, size_t id_len,
                          unsigned char **response, size_t *response_len)
 {
-  // Allocate the unencrypted response buffer.
-  unsigned char *message = NULL;
-  size_t message_len =
-    id_len + nonce_a_len + nonce_b_len + (3 * sizeof(size_t));
-  message = calloc(message_len, sizeof(unsigned char));
-  if (message == NULL)
-  {
-    kmyth_log(LOG_ERR, "Failed to allocate the message buffer.");
+  // Allocate and build the unencrypted nonce response message.
+  byte_builder message = { 0 };
+
+  if (byte_builder_init(&message,
+                        id_len + nonce_a_len + nonce_b_len +
+                        (3 * sizeof(size_t)))
+      || byte_builder_append_sized(&message, nonce_a, nonce_a_len)
+      || byte_builder_append_sized(&message, nonce_b, nonce_b_len)
+      || byte_builder_append_sized(&message, id, id_len))
+  {
+    kmyth_log(LOG_ERR, "Failed to build the nonce response message.");
+    byte_builder_free(&message);
     return 1;
   }
 
-  // Build the nonce response message.
-  unsigned char *index = message;
-
-  memcpy(index, &nonce_a_len, sizeof(size_t));
-  index += sizeof(size_t);
-  memcpy(index, nonce_a, nonce_a_len);
-  index += nonce_a_len;
-  memcpy(index, &nonce_b_len, sizeof(size_t));
-  index += sizeof(size_t);
-  memcpy(index, nonce_b, nonce_b_len);
-  index += nonce_b_len;
-  memcpy(index, &id_len, sizeof(size_t));
-  index += sizeof(size_t);
-  memcpy(index, id, id_len);
-
   // Encrypt the nonce response and then clean up the unencrypted response.
-  int result =
-    encrypt_with_key_pair(ctx, message, message_len, response, response_len);
+  int result = encrypt_with_key_pair(ctx, message.buffer, message.length,
+                                     response, response_len);
 
-  kmyth_clear_and_free(message, message_len);
+  byte_builder_free(&message);
 
   // Handle encryption errors if any occurred.
   if (result)
@@ -315,7 +293,7 @@ int parse_nonce_response(EVP_PKEY_CTX * ctx,
               "Unexpected length for nonce A; received: %zd bytes, expected: %zd bytes",
               *nonce_a_len, NSL_NONCE_LEN);
     *nonce_a_len = 0;
-    kmyth_clear_and_free(message, message_len);
+    kmyth_secure_free(message, message_len);
     return 1;
   }
   *nonce_a = calloc(*nonce_a_len, sizeof(unsigned char));
@@ -325,7 +303,7 @@ int parse_nonce_response(EVP_PKEY_CTX * ctx,
 
     *nonce_a_len = 0;
 
-    kmyth_clear_and_free(message, message_len);
+    kmyth_secure_free(message, message_len);
 
     return 1;
   }
@@ -345,7 +323,7 @@ int parse_nonce_response(EVP_PKEY_CTX * ctx,
     *nonce_b_len = 0;
 
     kmyth_clear_and_free(nonce_a, *nonce_a_len);
-    kmyth_clear_and_free(message, message_len);
+    kmyth_secure_free(message, message_len);
 
     return 1;
   }
@@ -360,7 +338,7 @@ int parse_nonce_response(EVP_PKEY_CTX * ctx,
     *nonce_a = NULL;
     *nonce_a_len = 0;
 
-    kmyth_clear_and_free(message, message_len);
+    kmyth_secure_free(message, message_len);
 
     return 1;
   }
@@ -385,13 +363,13 @@ int parse_nonce_response(EVP_PKEY_CTX * ctx,
 
     *id_len = 0;
 
-    kmyth_clear_and_free(message, message_len);
+    kmyth_secure_free(message, message_len);
 
     return 1;
   }
   memcpy(*id, index, *id_len);
 
-  kmyth_clear_and_free(message, message_len);
+  kmyth_secure_free(message, message_len);
 
   return 0;
 }
@@ -412,30 +390,23 @@ int build_nonce_confirmation(EVP_PKEY_CTX * ctx,
     return 1;
   }
 
-  // Allocate the unencrypted confirmation buffer.
-  unsigned char *message = NULL;
-  size_t message_len = nonce_len + sizeof(size_t);
+  // Allocate and build the unencrypted nonce confirmation message.
+  byte_builder message = { 0 };
 
-  message = calloc(message_len, sizeof(unsigned char));
-  if (message == NULL)
+  if (byte_builder_init(&message, nonce_len + sizeof(size_t))
+      || byte_builder_append_sized(&message, nonce, nonce_len))
   {
-    kmyth_log(LOG_ERR, "Failed to allocate the message buffer.");
+    kmyth_log(LOG_ERR, "Failed to build the nonce confirmation message.");
+    byte_builder_free(&message);
     return 1;
   }
 
-  // Build the nonce confirmation message.
-  unsigned char *index = message;
-
-  memcpy(index, &nonce_len, sizeof(size_t));
-  index += sizeof(size_t);
-  memcpy(index, nonce, nonce_len);
-
   // Encrypt the nonce confirmation and then clean up the unencrypted
   // confirmation.
-  int result = encrypt_with_key_pair(ctx, message, message_len, confirmation,
-                                     confirmation_len);
+  int result = encrypt_with_key_pair(ctx, message.buffer, message.length,
+                                     confirmation, confirmation_len);
 
-  kmyth_clear_and_free(message, message_len);
+  byte_builder_free(&message);
 
   // Handle encryption errors if any occurred.
   if (result)
@@ -479,21 +450,21 @@ int parse_nonce_confirmation(EVP_PKEY_CTX * ctx,
 
     *nonce_len = 0;
 
-    kmyth_clear_and_free(message, message_len);
+    kmyth_secure_free(message, message_len);
 
     return 1;
   }
   memcpy(*nonce, index, *nonce_len);
 
-  kmyth_clear_and_free(message, message_len);
+  kmyth_secure_free(message, message_len);
 
   return 0;
 }
 
 //
-// setup_public_evp_context
+// load_public_key()
 //
-EVP_PKEY_CTX *setup_public_evp_context(const char *filepath)
+static EVP_PKEY *load_public_key(const char *filepath)
 {
   FILE *f = fopen(filepath, "r");
 
@@ -522,6 +493,21 @@ EVP_PKEY_CTX *setup_public_evp_context(const char *filepath)
     return NULL;
   }
 
+  return pkey;
+}
+
+//
+// setup_public_evp_context
+//
+EVP_PKEY_CTX *setup_public_evp_context(const char *filepath)
+{
+  EVP_PKEY *pkey = load_public_key(filepath);
+
+  if (NULL == pkey)
+  {
+    return NULL;
+  }
+
   EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(pkey, NULL);
 
   if (NULL == ctx)
@@ -533,13 +519,22 @@ EVP_PKEY_CTX *setup_public_evp_context(const char *filepath)
 
   EVP_PKEY_free(pkey);
 
+  // Initialize the context for encryption once, so it can be reused for
+  // every message encrypted with it.
+  if (EVP_PKEY_encrypt_init(ctx) <= 0)
+  {
+    kmyth_log(LOG_ERR, "Failed to initialize the EVP context for encryption.");
+    EVP_PKEY_CTX_free(ctx);
+    return NULL;
+  }
+
   return ctx;
 }
 
 //
-// setup_private_evp_context()
+// load_private_key()
 //
-EVP_PKEY_CTX *setup_private_evp_context(const char *filepath)
+static EVP_PKEY *load_private_key(const char *filepath)
 {
   FILE *f = fopen(filepath, "r");
 
@@ -568,6 +563,21 @@ EVP_PKEY_CTX *setup_private_evp_context(const char *filepath)
     return NULL;
   }
 
+  return pkey;
+}
+
+//
+// setup_private_evp_context()
+//
+EVP_PKEY_CTX *setup_private_evp_context(const char *filepath)
+{
+  EVP_PKEY *pkey = load_private_key(filepath);
+
+  if (NULL == pkey)
+  {
+    return NULL;
+  }
+
   EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(pkey, NULL);
 
   if (NULL == ctx)
@@ -580,13 +590,139 @@ EVP_PKEY_CTX *setup_private_evp_context(const char *filepath)
 
   EVP_PKEY_free(pkey);
 
+  // Initialize the context for decryption once, so it can be reused for
+  // every message decrypted with it.
+  if (EVP_PKEY_decrypt_init(ctx) <= 0)
+  {
+    kmyth_log(LOG_ERR, "Failed to initialize the EVP context for decryption.");
+    EVP_PKEY_CTX_free(ctx);
+    return NULL;
+  }
+
   return ctx;
 }
 
+//
+// check_ecdh_key()
+//
+static int check_ecdh_key(EVP_PKEY * pkey)
+{
+  // The ECDH variant signs with the same curve it exchanges keys on.
+  const EC_KEY *ec_key = EVP_PKEY_get0_EC_KEY(pkey);
+
+  if (ec_key == NULL
+      || EC_GROUP_get_curve_name(EC_KEY_get0_group(ec_key)) !=
+      NSL_ECDH_CURVE_NID)
+  {
+    kmyth_log(LOG_ERR, "The ECDH protocol requires P-256 EC keys.");
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// nsl_endpoint_init()
+//
+int nsl_endpoint_init(nsl_endpoint * endpoint, nsl_protocol protocol,
+                      const char *public_key_path,
+                      const char *private_key_path,
+                      const unsigned char *id, size_t id_len)
+{
+  if (endpoint == NULL || public_key_path == NULL || private_key_path == NULL
+      || id == NULL || id_len == 0
+      || (protocol != NSL_PROTOCOL_RSA && protocol != NSL_PROTOCOL_ECDH))
+  {
+    kmyth_log(LOG_ERR, "Invalid NSL endpoint parameters.");
+    return 1;
+  }
+  memset(endpoint, 0, sizeof(nsl_endpoint));
+  endpoint->protocol = protocol;
+
+  // Set up the session key derivation once, for every session.
+  static const unsigned char info[] = NSL_SESSION_KEY_INFO;
+
+  if (kdf_params_init(&endpoint->session_key_kdf, KMYTH_KDF_HASH,
+                      NULL, 0, info, sizeof(info) - 1))
+  {
+    kmyth_log(LOG_ERR, "Failed to set up the session key KDF.");
+    return 1;
+  }
+
+  if (protocol == NSL_PROTOCOL_ECDH)
+  {
+    endpoint->public_key = load_public_key(public_key_path);
+    if (endpoint->public_key == NULL
+        || check_ecdh_key(endpoint->public_key))
+    {
+      kmyth_log(LOG_ERR, "Failed to load the public signing key.");
+      nsl_endpoint_cleanup(endpoint);
+      return 1;
+    }
+
+    endpoint->private_key = load_private_key(private_key_path);
+    if (endpoint->private_key == NULL
+        || check_ecdh_key(endpoint->private_key))
+    {
+      kmyth_log(LOG_ERR, "Failed to load the private signing key.");
+      nsl_endpoint_cleanup(endpoint);
+      return 1;
+    }
+  }
+  else
+  {
+    endpoint->public_key_ctx = setup_public_evp_context(public_key_path);
+    if (endpoint->public_key_ctx == NULL)
+    {
+      kmyth_log(LOG_ERR, "Failed to setup public EVP context.");
+      return 1;
+    }
+
+    endpoint->private_key_ctx = setup_private_evp_context(private_key_path);
+    if (endpoint->private_key_ctx == NULL)
+    {
+      kmyth_log(LOG_ERR, "Failed to setup the private EVP context.");
+      nsl_endpoint_cleanup(endpoint);
+      return 1;
+    }
+  }
+
+  endpoint->id = calloc(id_len, sizeof(unsigned char));
+  if (endpoint->id == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to allocate the ID buffer.");
+    nsl_endpoint_cleanup(endpoint);
+    return 1;
+  }
+  memcpy(endpoint->id, id, id_len);
+  endpoint->id_len = id_len;
+
+  return 0;
+}
+
+//
+// nsl_endpoint_cleanup()
+//
+void nsl_endpoint_cleanup(nsl_endpoint * endpoint)
+{
+  if (endpoint == NULL)
+  {
+    return;
+  }
+
+  EVP_PKEY_CTX_free(endpoint->public_key_ctx);
+  EVP_PKEY_CTX_free(endpoint->private_key_ctx);
+  EVP_PKEY_free(endpoint->public_key);
+  EVP_PKEY_free(endpoint->private_key);
+  free(endpoint->id);
+  memset(endpoint, 0, sizeof(nsl_endpoint));
+}
+
 //
 // generate_session_key()
 //
-int generate_session_key(unsigned char *nonce_a, size_t nonce_a_len,
+int generate_session_key(const kdf_params * kdf,
+                         unsigned char *nonce_a, size_t nonce_a_len,
                          unsigned char *nonce_b, size_t nonce_b_len,
                          unsigned char **key, size_t *key_len)
 {
@@ -605,141 +741,556 @@ int generate_session_key(unsigned char *nonce_a, size_t nonce_a_len,
     return 1;
   }
 
-  // Build the combined nonce as the base for key generation.
-  size_t len = nonce_a_len + nonce_b_len;
-  unsigned char *nonces = calloc(len, sizeof(unsigned char));
+  // The combined nonces are the input keying material.
+  unsigned char nonces[2 * NSL_NONCE_LEN];
+
+  memcpy(nonces, nonce_a, nonce_a_len);
+  memcpy(nonces + nonce_a_len, nonce_b, nonce_b_len);
 
-  if (NULL == nonces)
+  size_t len = NSL_SESSION_KEY_LEN;
+  int result = kdf_derive_keys(kdf, nonces, sizeof(nonces), 1, &len, key);
+
+  kmyth_clear(nonces, sizeof(nonces));
+  if (result)
   {
-    kmyth_log(LOG_ERR, "Failed to allocated the nonces buffer.");
+    kmyth_log(LOG_ERR, "Failed to derive the session key.");
     return 1;
   }
-  size_t nonces_len = len * sizeof(unsigned char);
-  unsigned char *index = nonces;
+  *key_len = len;
+
+  return 0;
+}
+
+//
+// generate_nonce()
+//
+int generate_nonce(size_t desired_min_nonce_len, unsigned char **nonce,
+                   size_t *nonce_len)
+{
+  size_t size = 1;
 
-  memcpy(index, nonce_a, nonce_a_len);
-  index += nonce_a_len;
-  memcpy(index, nonce_b, nonce_b_len);
+  while ((size * sizeof(int)) < desired_min_nonce_len)
+  {
+    size += 1;
+  }
 
-  // Setup the message digest context.
-  const EVP_MD *type = EVP_shake256();
+  *nonce_len = size * sizeof(int);
+  unsigned int *buffer = calloc(size, sizeof(int));
 
-  if (NULL == type)
+  if (NULL == buffer)
   {
-    kmyth_log(LOG_ERR, "Failed to obtain the SHAKE-256 MD.");
-    kmyth_clear_and_free(nonces, nonces_len);
+    kmyth_log(LOG_ERR, "Failed to allocated the nonce buffer.");
     return 1;
   }
-  EVP_MD_CTX *ctx = EVP_MD_CTX_new();
 
-  if (NULL == ctx)
+  // the nonces are secret (the session key is derived from them), so they
+  // come from the OpenSSL private DRBG rather than a shared random pool
+  if (RAND_priv_bytes((unsigned char *) buffer, (int) *nonce_len) != 1)
+  {
+    kmyth_log(LOG_ERR, "Failed to generate the nonce.");
+    free(buffer);
+    return 1;
+  }
+
+  *nonce = (unsigned char *) buffer;
+  return 0;
+}
+
+//
+// send_sized_fields()
+//
+static int send_sized_fields(int socket_fd, size_t field_count,
+                             unsigned char **fields, size_t *field_lens)
+{
+  size_t message_len = 0;
+
+  for (size_t i = 0; i < field_count; i++)
+  {
+    message_len += sizeof(size_t) + field_lens[i];
+  }
+
+  byte_builder message = { 0 };
+  int result = byte_builder_init(&message, message_len);
+
+  for (size_t i = 0; i < field_count && result == 0; i++)
+  {
+    result = byte_builder_append_sized(&message, fields[i], field_lens[i]);
+  }
+  if (result == 0
+      && write(socket_fd, message.buffer, message.length) != message.length)
+  {
+    result = 1;
+  }
+  byte_builder_free(&message);
+
+  if (result)
   {
-    kmyth_log(LOG_ERR, "Failed to create the MD context.");
-    kmyth_clear_and_free(nonces, nonces_len);
+    kmyth_log(LOG_ERR, "Failed to send the ECDH message.");
     return 1;
   }
 
-  // Initialize the context and load in the nonces to generate the session
-  // key.
-  int result = EVP_DigestInit_ex(ctx, type, NULL);
+  return 0;
+}
 
-  if (0 == result)
+//
+// recv_sized_fields()
+//
+static int recv_sized_fields(int socket_fd, size_t field_count,
+                             unsigned char **message, size_t *message_len,
+                             unsigned char **fields, size_t *field_lens)
+{
+  *message = calloc(NSL_MAX_MESSAGE_LEN, sizeof(unsigned char));
+  if (*message == NULL)
   {
-    kmyth_log(LOG_ERR, "Failed to initialize the MD context.");
-    EVP_MD_CTX_free(ctx);
-    kmyth_clear_and_free(nonces, nonces_len);
+    kmyth_log(LOG_ERR, "Failed to allocate the message buffer.");
     return 1;
   }
 
-  result = EVP_DigestUpdate(ctx, nonces, len);
-  if (0 == result)
+  ssize_t read_result = read(socket_fd, *message, NSL_MAX_MESSAGE_LEN);
+
+  if (read_result <= 0)
   {
-    kmyth_log(LOG_ERR, "Failed to update the MD context.");
-    EVP_MD_CTX_free(ctx);
-    kmyth_clear_and_free(nonces, nonces_len);
+    kmyth_log(LOG_ERR, "Failed to read the ECDH message.");
+    free(*message);
+    *message = NULL;
     return 1;
   }
+  *message_len = (size_t) read_result;
+
+  // The fields point into the message, which must hold exactly the
+  // expected number of them.
+  unsigned char *index = *message;
+  size_t remaining = *message_len;
 
-  *key = calloc(EVP_MAX_MD_SIZE, sizeof(unsigned char));
-  if (NULL == key)
+  for (size_t i = 0; i < field_count; i++)
   {
-    kmyth_log(LOG_ERR, "Failed to allocated the key buffer.");
-    EVP_MD_CTX_free(ctx);
-    kmyth_clear_and_free(nonces, nonces_len);
+    if (remaining < sizeof(size_t))
+    {
+      break;
+    }
+    memcpy(&field_lens[i], index, sizeof(size_t));
+    index += sizeof(size_t);
+    remaining -= sizeof(size_t);
+    if (field_lens[i] == 0 || field_lens[i] > remaining)
+    {
+      break;
+    }
+    fields[i] = index;
+    index += field_lens[i];
+    remaining -= field_lens[i];
+    if (i == field_count - 1 && remaining == 0)
+    {
+      return 0;
+    }
+  }
+
+  kmyth_log(LOG_ERR, "Received a malformed ECDH message.");
+  free(*message);
+  *message = NULL;
+  *message_len = 0;
+  return 1;
+}
+
+//
+// build_ecdh_transcript()
+//
+static int build_ecdh_transcript(unsigned char *first_pub,
+                                 size_t first_pub_len,
+                                 unsigned char *second_pub,
+                                 size_t second_pub_len,
+                                 unsigned char *id, size_t id_len,
+                                 byte_builder * transcript)
+{
+  if (byte_builder_init(transcript, (3 * sizeof(size_t)) + first_pub_len
+                        + second_pub_len + id_len)
+      || byte_builder_append_sized(transcript, first_pub, first_pub_len)
+      || byte_builder_append_sized(transcript, second_pub, second_pub_len)
+      || byte_builder_append_sized(transcript, id, id_len))
+  {
+    kmyth_log(LOG_ERR, "Failed to build the ECDH transcript.");
+    byte_builder_free(transcript);
     return 1;
   }
-  *key_len = EVP_MAX_MD_SIZE * sizeof(unsigned char);
 
-  result = EVP_DigestFinal_ex(ctx, *key, (unsigned int *) key_len);
-  if (0 == result)
+  return 0;
+}
+
+//
+// sign_ecdh_transcript()
+//
+static int sign_ecdh_transcript(EVP_PKEY * private_key,
+                                unsigned char *first_pub,
+                                size_t first_pub_len,
+                                unsigned char *second_pub,
+                                size_t second_pub_len,
+                                unsigned char *id, size_t id_len,
+                                unsigned char **signature,
+                                size_t *signature_len)
+{
+  byte_builder transcript = { 0 };
+
+  if (build_ecdh_transcript(first_pub, first_pub_len,
+                            second_pub, second_pub_len,
+                            id, id_len, &transcript))
   {
-    kmyth_log(LOG_ERR, "Failed to finalize the MD context.");
-    EVP_MD_CTX_free(ctx);
-    kmyth_clear_and_free(nonces, nonces_len);
-    kmyth_clear_and_free(*key, *key_len);
     return 1;
   }
 
-  EVP_MD_CTX_free(ctx);
-  kmyth_clear_and_free(nonces, nonces_len);
+  unsigned int sig_len = 0;
+  int result = sign_buffer(private_key, transcript.buffer, transcript.length,
+                           signature, &sig_len);
 
-  if (*key_len != NSL_SESSION_KEY_LEN)
+  byte_builder_free(&transcript);
+  if (result)
   {
-    kmyth_log(LOG_ERR,
-              "The generated key length must be %zd bytes, not %zd bytes.",
-              NSL_SESSION_KEY_LEN, *key_len);
-    kmyth_clear_and_free(*key, *key_len);
+    kmyth_log(LOG_ERR, "Failed to sign the ECDH transcript.");
     return 1;
   }
+  *signature_len = sig_len;
 
   return 0;
 }
 
 //
-// generate_nonce()
+// verify_ecdh_transcript()
 //
-int generate_nonce(size_t desired_min_nonce_len, unsigned char **nonce,
-                   size_t *nonce_len)
+static int verify_ecdh_transcript(EVP_PKEY * public_key,
+                                  unsigned char *first_pub,
+                                  size_t first_pub_len,
+                                  unsigned char *second_pub,
+                                  size_t second_pub_len,
+                                  unsigned char *id, size_t id_len,
+                                  unsigned char *signature,
+                                  size_t signature_len)
 {
-  size_t size = 1;
+  byte_builder transcript = { 0 };
 
-  while ((size * sizeof(int)) < desired_min_nonce_len)
+  if (build_ecdh_transcript(first_pub, first_pub_len,
+                            second_pub, second_pub_len,
+                            id, id_len, &transcript))
   {
-    size += 1;
+    return 1;
   }
 
-  *nonce_len = size * sizeof(int);
-  unsigned int *buffer = calloc(size, sizeof(int));
+  int result = verify_buffer(public_key, transcript.buffer, transcript.length,
+                             signature, (unsigned int) signature_len);
 
-  if (NULL == buffer)
+  byte_builder_free(&transcript);
+  if (result)
   {
-    kmyth_log(LOG_ERR, "Failed to allocated the nonce buffer.");
+    kmyth_log(LOG_ERR, "The ECDH transcript signature is invalid.");
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// create_ecdh_ephemeral()
+//
+static int create_ecdh_ephemeral(EVP_PKEY ** ephemeral_key,
+                                 unsigned char **ephemeral_pub,
+                                 size_t *ephemeral_pub_len)
+{
+  // The shared ECDH utilities only generate the ephemerals of their own
+  // key agreement suites (P-384, X25519), so the P-256 ephemerals of this
+  // protocol are generated, and exported as uncompressed points, here.
+  EC_KEY *ec_key = EC_KEY_new_by_curve_name(NSL_ECDH_CURVE_NID);
+
+  *ephemeral_key = NULL;
+  if (ec_key == NULL || EC_KEY_generate_key(ec_key) != 1
+      || (*ephemeral_key = EVP_PKEY_new()) == NULL
+      || EVP_PKEY_assign_EC_KEY(*ephemeral_key, ec_key) != 1)
+  {
+    kmyth_log(LOG_ERR, "Failed to create the ephemeral key pair.");
+    EVP_PKEY_free(*ephemeral_key);
+    *ephemeral_key = NULL;
+    EC_KEY_free(ec_key);
     return 1;
   }
-  unsigned int *index = buffer;
 
-  for (size_t i = 0; i < size; i++)
+  size_t len = EC_POINT_point2oct(EC_KEY_get0_group(ec_key),
+                                  EC_KEY_get0_public_key(ec_key),
+                                  POINT_CONVERSION_UNCOMPRESSED,
+                                  NULL, 0, NULL);
+
+  *ephemeral_pub = (len == 0) ? NULL : malloc(len);
+  if (*ephemeral_pub == NULL
+      || EC_POINT_point2oct(EC_KEY_get0_group(ec_key),
+                            EC_KEY_get0_public_key(ec_key),
+                            POINT_CONVERSION_UNCOMPRESSED,
+                            *ephemeral_pub, len, NULL) != len)
   {
-    *index = rand();
-    index += 1;
+    kmyth_log(LOG_ERR, "Failed to export the ephemeral public key.");
+    free(*ephemeral_pub);
+    *ephemeral_pub = NULL;
+    EVP_PKEY_free(*ephemeral_key);
+    *ephemeral_key = NULL;
+    return 1;
+  }
+  *ephemeral_pub_len = len;
+
+  return 0;
+}
+
+//
+// derive_ecdh_session_key()
+//
+static int derive_ecdh_session_key(EVP_PKEY * ephemeral_key,
+                                   unsigned char *remote_pub,
+                                   size_t remote_pub_len,
+                                   unsigned char **session_key,
+                                   size_t *session_key_len)
+{
+  // Decode the remote point (EC_KEY_oct2key() checks it is on the curve).
+  EC_KEY *remote_ec_key = EC_KEY_new_by_curve_name(NSL_ECDH_CURVE_NID);
+  EVP_PKEY *remote_key = NULL;
+
+  if (remote_ec_key == NULL
+      || EC_KEY_oct2key(remote_ec_key, remote_pub, remote_pub_len,
+                        NULL) != 1
+      || (remote_key = EVP_PKEY_new()) == NULL
+      || EVP_PKEY_assign_EC_KEY(remote_key, remote_ec_key) != 1)
+  {
+    kmyth_log(LOG_ERR, "The remote ephemeral public key is invalid.");
+    EVP_PKEY_free(remote_key);
+    EC_KEY_free(remote_ec_key);
+    return 1;
+  }
+
+  unsigned char *secret = NULL;
+  size_t secret_len = 0;
+  int result = compute_ecdh_shared_secret(ephemeral_key, remote_key,
+                                          &secret, &secret_len);
+
+  EVP_PKEY_free(remote_key);
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "Failed to compute the ECDH shared secret.");
+    return 1;
+  }
+
+  unsigned int key_len = 0;
+
+  result = compute_ecdh_session_key(secret, secret_len, session_key, &key_len);
+  OPENSSL_clear_free(secret, secret_len);
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "Failed to generate the session key.");
+    return 1;
+  }
+  *session_key_len = key_len;
+
+  return 0;
+}
+
+//
+// negotiate_client_ecdh_session_key()
+//
+static int negotiate_client_ecdh_session_key(int socket_fd,
+                                             nsl_endpoint * endpoint,
+                                             unsigned char *expected_id,
+                                             size_t expected_id_len,
+                                             unsigned char **session_key,
+                                             size_t *session_key_len)
+{
+  EVP_PKEY *ephemeral_key = NULL;
+  unsigned char *local_pub = NULL;
+  size_t local_pub_len = 0;
+
+  if (create_ecdh_ephemeral(&ephemeral_key, &local_pub, &local_pub_len))
+  {
+    return 1;
+  }
+
+  // Send A's ID and ephemeral public key.
+  unsigned char *request_fields[] = { endpoint->id, local_pub };
+  size_t request_field_lens[] = { endpoint->id_len, local_pub_len };
+
+  int result = send_sized_fields(socket_fd, 2,
+                                 request_fields, request_field_lens);
+
+  // Receive B's ID and ephemeral public key, with B's signature over both
+  // public keys and A's ID.
+  unsigned char *response = NULL;
+  size_t response_len = 0;
+  unsigned char *response_fields[3] = { NULL };
+  size_t response_field_lens[3] = { 0 };
+
+  if (result == 0)
+  {
+    result = recv_sized_fields(socket_fd, 3, &response, &response_len,
+                               response_fields, response_field_lens);
+  }
+  if (result == 0 && (response_field_lens[0] != expected_id_len
+                      || memcmp(response_fields[0], expected_id,
+                                expected_id_len) != 0))
+  {
+    kmyth_log(LOG_ERR, "The received ID is invalid.");
+    result = 1;
+  }
+  if (result == 0)
+  {
+    result = verify_ecdh_transcript(endpoint->public_key,
+                                    local_pub, local_pub_len,
+                                    response_fields[1], response_field_lens[1],
+                                    endpoint->id, endpoint->id_len,
+                                    response_fields[2],
+                                    response_field_lens[2]);
+  }
+
+  // Confirm with A's signature over both public keys and B's ID.
+  unsigned char *signature = NULL;
+  size_t signature_len = 0;
+
+  if (result == 0)
+  {
+    result = sign_ecdh_transcript(endpoint->private_key,
+                                  response_fields[1], response_field_lens[1],
+                                  local_pub, local_pub_len,
+                                  response_fields[0], response_field_lens[0],
+                                  &signature, &signature_len);
+  }
+  if (result == 0)
+  {
+    result = send_sized_fields(socket_fd, 1, &signature, &signature_len);
+  }
+
+  if (result == 0)
+  {
+    result = derive_ecdh_session_key(ephemeral_key,
+                                     response_fields[1],
+                                     response_field_lens[1],
+                                     session_key, session_key_len);
+  }
+
+  OPENSSL_free(signature);
+  free(response);
+  free(local_pub);
+  EVP_PKEY_free(ephemeral_key);
+
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "Failed to negotiate the ECDH session key.");
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// negotiate_server_ecdh_session_key()
+//
+static int negotiate_server_ecdh_session_key(int socket_fd,
+                                             nsl_endpoint * endpoint,
+                                             unsigned char **session_key,
+                                             size_t *session_key_len)
+{
+  // Receive A's ID and ephemeral public key.
+  unsigned char *request = NULL;
+  size_t request_len = 0;
+  unsigned char *request_fields[2] = { NULL };
+  size_t request_field_lens[2] = { 0 };
+
+  if (recv_sized_fields(socket_fd, 2, &request, &request_len,
+                        request_fields, request_field_lens))
+  {
+    return 1;
+  }
+
+  kmyth_log(LOG_DEBUG, "Received ID: %.*s", (int) request_field_lens[0],
+            request_fields[0]);
+
+  EVP_PKEY *ephemeral_key = NULL;
+  unsigned char *local_pub = NULL;
+  size_t local_pub_len = 0;
+
+  if (create_ecdh_ephemeral(&ephemeral_key, &local_pub, &local_pub_len))
+  {
+    free(request);
+    return 1;
+  }
+
+  // Respond with B's ID and ephemeral public key, with B's signature over
+  // both public keys and A's ID.
+  unsigned char *signature = NULL;
+  size_t signature_len = 0;
+
+  int result = sign_ecdh_transcript(endpoint->private_key,
+                                    request_fields[1], request_field_lens[1],
+                                    local_pub, local_pub_len,
+                                    request_fields[0], request_field_lens[0],
+                                    &signature, &signature_len);
+
+  if (result == 0)
+  {
+    unsigned char *response_fields[] = { endpoint->id, local_pub, signature };
+    size_t response_field_lens[] = { endpoint->id_len, local_pub_len,
+      signature_len
+    };
+
+    result = send_sized_fields(socket_fd, 3,
+                               response_fields, response_field_lens);
+  }
+  OPENSSL_free(signature);
+
+  // Receive A's confirming signature over both public keys and B's ID.
+  unsigned char *confirmation = NULL;
+  size_t confirmation_len = 0;
+  unsigned char *remote_signature = NULL;
+  size_t remote_signature_len = 0;
+
+  if (result == 0)
+  {
+    result = recv_sized_fields(socket_fd, 1, &confirmation, &confirmation_len,
+                               &remote_signature, &remote_signature_len);
+  }
+  if (result == 0)
+  {
+    result = verify_ecdh_transcript(endpoint->public_key,
+                                    local_pub, local_pub_len,
+                                    request_fields[1], request_field_lens[1],
+                                    endpoint->id, endpoint->id_len,
+                                    remote_signature, remote_signature_len);
+  }
+
+  if (result == 0)
+  {
+    result = derive_ecdh_session_key(ephemeral_key,
+                                     request_fields[1], request_field_lens[1],
+                                     session_key, session_key_len);
+  }
+
+  free(confirmation);
+  free(request);
+  free(local_pub);
+  EVP_PKEY_free(ephemeral_key);
+
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "Failed to negotiate the ECDH session key.");
+    return 1;
   }
 
-  *nonce = (unsigned char *) buffer;
   return 0;
 }
 
 //
 // negotiate_client_session_key()
 //
-int negotiate_client_session_key(int socket_fd,
-                                 EVP_PKEY_CTX * public_key_ctx,
-                                 EVP_PKEY_CTX * private_key_ctx,
-                                 unsigned char *id, size_t id_len,
+int negotiate_client_session_key(int socket_fd, nsl_endpoint * endpoint,
                                  unsigned char *expected_id,
                                  size_t expected_id_len,
                                  unsigned char **session_key,
                                  size_t *session_key_len)
 {
+  if (endpoint->protocol == NSL_PROTOCOL_ECDH)
+  {
+    return negotiate_client_ecdh_session_key(socket_fd, endpoint,
+                                             expected_id, expected_id_len,
+                                             session_key, session_key_len);
+  }
+
   // Generate nonce A
   unsigned char *nonce_a = NULL;
   size_t nonce_a_len = 0;
@@ -771,9 +1322,10 @@ int negotiate_client_session_key(int socket_fd,
 
   kmyth_log(LOG_DEBUG, "Sending nonce A: %zd bytes", nonce_a_len);
 
-  result = build_nonce_request(public_key_ctx,
+  result = build_nonce_request(endpoint->public_key_ctx,
                                nonce_a, nonce_a_len,
-                               id, id_len, &request, &request_len);
+                               endpoint->id, endpoint->id_len,
+                               &request, &request_len);
   if (result)
   {
     kmyth_log(LOG_ERR, "Failed to build the nonce request.");
@@ -814,7 +1366,7 @@ int negotiate_client_session_key(int socket_fd,
   unsigned char *received_id = NULL;
   size_t received_id_len = 0;
 
-  result = parse_nonce_response(private_key_ctx,
+  result = parse_nonce_response(endpoint->private_key_ctx,
                                 response, read_result,
                                 &received_nonce_a, &received_nonce_a_len,
                                 &nonce_b, &nonce_b_len,
@@ -877,7 +1429,7 @@ int negotiate_client_session_key(int socket_fd,
 
   kmyth_clear_and_free(received_id, received_id_len);
 
-  result = build_nonce_confirmation(public_key_ctx,
+  result = build_nonce_confirmation(endpoint->public_key_ctx,
                                     nonce_b, nonce_b_len,
                                     &request, &request_len);
   if (result)
@@ -902,7 +1454,8 @@ int negotiate_client_session_key(int socket_fd,
   request_len = 0;
 
   // Use nonces to generate shared session key S
-  result = generate_session_key(nonce_a, nonce_a_len,
+  result = generate_session_key(&endpoint->session_key_kdf,
+                                nonce_a, nonce_a_len,
                                 nonce_b, nonce_b_len,
                                 session_key, session_key_len);
   kmyth_clear_and_free(nonce_a, nonce_a_len);
@@ -919,13 +1472,16 @@ int negotiate_client_session_key(int socket_fd,
 //
 // negotiate_server_session_key()
 //
-int negotiate_server_session_key(int socket_fd,
-                                 EVP_PKEY_CTX * public_key_ctx,
-                                 EVP_PKEY_CTX * private_key_ctx,
-                                 unsigned char *id, size_t id_len,
+int negotiate_server_session_key(int socket_fd, nsl_endpoint * endpoint,
                                  unsigned char **session_key,
                                  size_t *session_key_len)
 {
+  if (endpoint->protocol == NSL_PROTOCOL_ECDH)
+  {
+    return negotiate_server_ecdh_session_key(socket_fd, endpoint,
+                                             session_key, session_key_len);
+  }
+
   // Generate nonce B
   unsigned char *nonce_b = NULL;
   size_t nonce_b_len = 0;
@@ -965,7 +1521,7 @@ int negotiate_server_session_key(int socket_fd,
   unsigned char *received_id = NULL;
   size_t received_id_len = 0;
 
-  result = parse_nonce_request(private_key_ctx,
+  result = parse_nonce_request(endpoint->private_key_ctx,
                                response, read_result,
                                &received_nonce_a, &received_nonce_a_len,
                                &received_id, &received_id_len);
@@ -980,10 +1536,11 @@ int negotiate_server_session_key(int socket_fd,
 
   kmyth_log(LOG_DEBUG, "Sending nonce B: %zd", nonce_b_len);
 
-  result = build_nonce_response(public_key_ctx,
+  result = build_nonce_response(endpoint->public_key_ctx,
                                 received_nonce_a, received_nonce_a_len,
                                 nonce_b, nonce_b_len,
-                                id, id_len, &response, &response_len);
+                                endpoint->id, endpoint->id_len,
+                                &response, &response_len);
   if (result)
   {
     kmyth_log(LOG_ERR, "Failed to build the nonce response.");
@@ -1027,7 +1584,7 @@ int negotiate_server_session_key(int socket_fd,
   unsigned char *received_nonce_b = NULL;
   size_t received_nonce_b_len = 0;
 
-  result = parse_nonce_confirmation(private_key_ctx,
+  result = parse_nonce_confirmation(endpoint->private_key_ctx,
                                     response, read_result,
                                     &received_nonce_b, &received_nonce_b_len);
   kmyth_clear_and_free(response, response_len);
@@ -1061,7 +1618,8 @@ int negotiate_server_session_key(int socket_fd,
   kmyth_log(LOG_DEBUG, "Received nonce B: %zd bytes", nonce_b_len);
 
   // Use nonces to generate shared session key S
-  result = generate_session_key(received_nonce_a, received_nonce_a_len,
+  result = generate_session_key(&endpoint->session_key_kdf,
+                                received_nonce_a, received_nonce_a_len,
                                 nonce_b, nonce_b_len,
                                 session_key, session_key_len);
   kmyth_clear_and_free(nonce_b, nonce_b_len);
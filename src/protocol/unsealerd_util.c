@@ -0,0 +1,520 @@
+//
+// The kmyth-unsealerd local socket protocol.
+//
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "byte_builder.h"
+#include "defines.h"
+#include "memory_util.h"
+#include "socket_util.h"
+#include "unsealerd_util.h"
+
+//
+// send_all()
+//
+static int send_all(int socket_fd, const uint8_t * data, size_t data_len)
+{
+  while (data_len > 0)
+  {
+    // MSG_NOSIGNAL: a peer that has gone away is an error, not a SIGPIPE
+    ssize_t sent = send(socket_fd, data, data_len, MSG_NOSIGNAL);
+
+    if (sent < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (sent <= 0)
+    {
+      return 1;
+    }
+    data += sent;
+    data_len -= (size_t) sent;
+  }
+
+  return 0;
+}
+
+//
+// recv_all()
+//
+static int recv_all(int socket_fd, uint8_t * data, size_t data_len,
+                    size_t *received)
+{
+  *received = 0;
+  while (*received < data_len)
+  {
+    ssize_t count = recv(socket_fd, data + *received,
+                         data_len - *received, 0);
+
+    if (count < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (count <= 0)
+    {
+      return 1;
+    }
+    *received += (size_t) count;
+  }
+
+  return 0;
+}
+
+//
+// send_unsealerd_message()
+//
+int send_unsealerd_message(int socket_fd, uint8_t type,
+                           const uint8_t * body, size_t body_len)
+{
+  if (body_len > UINT32_MAX)
+  {
+    kmyth_log(LOG_ERR, "Message body too large to send.");
+    return 1;
+  }
+
+  uint8_t header[UNSEALERD_HEADER_SIZE] = { 0 };
+  uint32_t len_be = htonl((uint32_t) body_len);
+
+  header[0] = UNSEALERD_PROTOCOL_VERSION;
+  header[1] = type;
+  memcpy(header + 4, &len_be, sizeof(len_be));
+
+  if (send_all(socket_fd, header, UNSEALERD_HEADER_SIZE)
+      || (body_len > 0 && send_all(socket_fd, body, body_len)))
+  {
+    kmyth_log(LOG_ERR, "Failed to send kmyth-unsealerd message.");
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// send_unsealerd_fd_message()
+//
+int send_unsealerd_fd_message(int socket_fd, int fd, size_t data_len)
+{
+  uint8_t header[UNSEALERD_HEADER_SIZE] = { 0 };
+  uint8_t body[8] = { 0 };
+  uint32_t len_be = htonl((uint32_t) sizeof(body));
+
+  header[0] = UNSEALERD_PROTOCOL_VERSION;
+  header[1] = UNSEALERD_MSG_FD;
+  memcpy(header + 4, &len_be, sizeof(len_be));
+  for (size_t i = 0; i < sizeof(body); i++)
+  {
+    body[i] = (uint8_t) ((uint64_t) data_len >> (8 * (sizeof(body) - 1 - i)));
+  }
+
+  // the descriptor rides on the first byte of the header
+  union
+  {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct iovec iov = {.iov_base = header,.iov_len = UNSEALERD_HEADER_SIZE };
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control.buf,
+    .msg_controllen = sizeof(control.buf),
+  };
+
+  memset(&control, 0, sizeof(control));
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+  ssize_t sent = -1;
+
+  do
+  {
+    sent = sendmsg(socket_fd, &msg, MSG_NOSIGNAL);
+  }
+  while (sent < 0 && errno == EINTR);
+
+  if (sent <= 0
+      || send_all(socket_fd, header + sent, UNSEALERD_HEADER_SIZE - sent)
+      || send_all(socket_fd, body, sizeof(body)))
+  {
+    kmyth_log(LOG_ERR, "Failed to send kmyth-unsealerd message.");
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// recv_header()
+//
+// Receives a message header, and any file descriptor passed with it
+//
+static int recv_header(int socket_fd, uint8_t * header, size_t *received,
+                       int *fd)
+{
+  union
+  {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct iovec iov = {.iov_base = header,.iov_len = UNSEALERD_HEADER_SIZE };
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control.buf,
+    .msg_controllen = sizeof(control.buf),
+  };
+  ssize_t count = -1;
+
+  *fd = -1;
+  *received = 0;
+  do
+  {
+    count = recvmsg(socket_fd, &msg, MSG_CMSG_CLOEXEC);
+  }
+  while (count < 0 && errno == EINTR);
+
+  if (count <= 0)
+  {
+    return 1;
+  }
+
+  // descriptors beyond the one expected are closed by the kernel
+  for (struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(&msg, cmsg))
+  {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS
+        && cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+    {
+      memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+  }
+
+  size_t rest = 0;
+  int result = recv_all(socket_fd, header + count,
+                        UNSEALERD_HEADER_SIZE - (size_t) count, &rest);
+
+  *received = (size_t) count + rest;
+  if (result && *fd != -1)
+  {
+    close(*fd);
+    *fd = -1;
+  }
+
+  return result;
+}
+
+//
+// recv_unsealerd_message_fd()
+//
+int recv_unsealerd_message_fd(int socket_fd, size_t max_len, uint8_t * type,
+                              uint8_t ** body, size_t *body_len, int *fd)
+{
+  *body = NULL;
+  *body_len = 0;
+  *fd = -1;
+
+  uint8_t header[UNSEALERD_HEADER_SIZE] = { 0 };
+  size_t received = 0;
+  int passed_fd = -1;
+
+  if (recv_header(socket_fd, header, &received, &passed_fd))
+  {
+    // a peer closing the connection between messages is not an error
+    // worth reporting, one closing it part way through a header is
+    if (received == 0)
+    {
+      kmyth_log(LOG_DEBUG, "kmyth-unsealerd peer closed the connection.");
+    }
+    else
+    {
+      kmyth_log(LOG_ERR, "Failed to read kmyth-unsealerd message header.");
+    }
+    return 1;
+  }
+
+  if (header[0] != UNSEALERD_PROTOCOL_VERSION)
+  {
+    kmyth_log(LOG_ERR, "Unsupported kmyth-unsealerd protocol version (%u).",
+              header[0]);
+    if (passed_fd != -1)
+    {
+      close(passed_fd);
+    }
+    return 1;
+  }
+
+  uint32_t len_be = 0;
+
+  memcpy(&len_be, header + 4, sizeof(len_be));
+  size_t len = ntohl(len_be);
+
+  if (len > max_len)
+  {
+    kmyth_log(LOG_ERR, "kmyth-unsealerd message too large (%zu bytes).", len);
+    if (passed_fd != -1)
+    {
+      close(passed_fd);
+    }
+    return 1;
+  }
+
+  uint8_t *buffer = malloc((len > 0) ? len : 1);
+
+  if (buffer == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to allocate the message buffer.");
+    if (passed_fd != -1)
+    {
+      close(passed_fd);
+    }
+    return 1;
+  }
+
+  if (recv_all(socket_fd, buffer, len, &received))
+  {
+    kmyth_log(LOG_ERR, "Failed to read kmyth-unsealerd message body.");
+    kmyth_clear_and_free(buffer, received);
+    if (passed_fd != -1)
+    {
+      close(passed_fd);
+    }
+    return 1;
+  }
+
+  *type = header[1];
+  *body = buffer;
+  *body_len = len;
+  *fd = passed_fd;
+
+  return 0;
+}
+
+//
+// recv_unsealerd_message()
+//
+int recv_unsealerd_message(int socket_fd, size_t max_len, uint8_t * type,
+                           uint8_t ** body, size_t *body_len)
+{
+  int fd = -1;
+
+  if (recv_unsealerd_message_fd(socket_fd, max_len, type, body, body_len,
+                                &fd))
+  {
+    return 1;
+  }
+
+  // a descriptor is only expected where the caller asks for one
+  if (fd != -1)
+  {
+    close(fd);
+  }
+
+  return 0;
+}
+
+//
+// build_unseal_request()
+//
+int build_unseal_request(const uint8_t * auth_bytes, size_t auth_bytes_len,
+                         const uint8_t * ski_bytes, size_t ski_bytes_len,
+                         uint8_t ** request, size_t *request_len)
+{
+  if (auth_bytes_len > UINT32_MAX || ski_bytes == NULL || ski_bytes_len == 0)
+  {
+    kmyth_log(LOG_ERR, "Invalid unseal request parameters.");
+    return 1;
+  }
+
+  byte_builder builder;
+  uint32_t len_be = htonl((uint32_t) auth_bytes_len);
+
+  if (byte_builder_init(&builder,
+                        sizeof(len_be) + auth_bytes_len + ski_bytes_len)
+      || byte_builder_append(&builder, &len_be, sizeof(len_be))
+      || byte_builder_append(&builder, auth_bytes, auth_bytes_len)
+      || byte_builder_append(&builder, ski_bytes, ski_bytes_len))
+  {
+    kmyth_log(LOG_ERR, "Failed to build the unseal request.");
+    byte_builder_free(&builder);
+    return 1;
+  }
+
+  byte_builder_finish(&builder, request, request_len);
+
+  return 0;
+}
+
+//
+// parse_unseal_request()
+//
+int parse_unseal_request(uint8_t * request, size_t request_len,
+                         uint8_t ** auth_bytes, size_t *auth_bytes_len,
+                         uint8_t ** ski_bytes, size_t *ski_bytes_len)
+{
+  uint32_t len_be = 0;
+
+  if (request_len < sizeof(len_be))
+  {
+    kmyth_log(LOG_ERR, "Unseal request too short.");
+    return 1;
+  }
+  memcpy(&len_be, request, sizeof(len_be));
+
+  size_t auth_len = ntohl(len_be);
+
+  if (auth_len >= request_len - sizeof(len_be))
+  {
+    kmyth_log(LOG_ERR, "Unseal request has no .ski contents.");
+    return 1;
+  }
+
+  *auth_bytes = request + sizeof(len_be);
+  *auth_bytes_len = auth_len;
+  *ski_bytes = *auth_bytes + auth_len;
+  *ski_bytes_len = request_len - sizeof(len_be) - auth_len;
+
+  return 0;
+}
+
+//
+// unsealerd_request()
+//
+// Sends an unseal request of the given type to kmyth-unsealerd, and
+// receives its reply
+//
+static int unsealerd_request(const char *socket_path, uint8_t request_type,
+                             const uint8_t * ski_bytes, size_t ski_bytes_len,
+                             const uint8_t * auth_bytes,
+                             size_t auth_bytes_len, uint8_t * reply_type,
+                             uint8_t ** reply, size_t *reply_len, int *fd)
+{
+  uint8_t *request = NULL;
+  size_t request_len = 0;
+
+  if (build_unseal_request(auth_bytes, auth_bytes_len,
+                           ski_bytes, ski_bytes_len, &request, &request_len))
+  {
+    return 1;
+  }
+
+  int socket_fd = -1;
+
+  if (setup_unix_client_socket(socket_path, &socket_fd))
+  {
+    kmyth_log(LOG_ERR, "Failed to connect to kmyth-unsealerd.");
+    kmyth_clear_and_free(request, request_len);
+    return 1;
+  }
+
+  int result = send_unsealerd_message(socket_fd, request_type,
+                                      request, request_len);
+
+  kmyth_clear_and_free(request, request_len);
+
+  if (result == 0)
+  {
+    result = recv_unsealerd_message_fd(socket_fd,
+                                       KMYTH_UNSEALERD_MAX_MESSAGE_SIZE,
+                                       reply_type, reply, reply_len, fd);
+  }
+  close(socket_fd);
+
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "No response from kmyth-unsealerd.");
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// unsealerd_unseal()
+//
+int unsealerd_unseal(const char *socket_path,
+                     const uint8_t * ski_bytes, size_t ski_bytes_len,
+                     const uint8_t * auth_bytes, size_t auth_bytes_len,
+                     uint8_t ** output, size_t *output_len)
+{
+  uint8_t type = 0;
+  int fd = -1;
+
+  if (unsealerd_request(socket_path, UNSEALERD_MSG_UNSEAL,
+                        ski_bytes, ski_bytes_len, auth_bytes, auth_bytes_len,
+                        &type, output, output_len, &fd))
+  {
+    return 1;
+  }
+  if (fd != -1)
+  {
+    close(fd);
+  }
+
+  if (type != UNSEALERD_MSG_DATA)
+  {
+    kmyth_log(LOG_ERR, "kmyth-unsealerd failed to unseal the data.");
+    kmyth_clear_and_free(*output, *output_len);
+    *output = NULL;
+    *output_len = 0;
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// unsealerd_unseal_fd()
+//
+int unsealerd_unseal_fd(const char *socket_path,
+                        const uint8_t * ski_bytes, size_t ski_bytes_len,
+                        const uint8_t * auth_bytes, size_t auth_bytes_len,
+                        int *fd, size_t *output_len)
+{
+  uint8_t type = 0;
+  uint8_t *reply = NULL;
+  size_t reply_len = 0;
+
+  *fd = -1;
+  *output_len = 0;
+  if (unsealerd_request(socket_path, UNSEALERD_MSG_UNSEAL_FD,
+                        ski_bytes, ski_bytes_len, auth_bytes, auth_bytes_len,
+                        &type, &reply, &reply_len, fd))
+  {
+    return 1;
+  }
+
+  // an older daemon refuses the request type with an error reply
+  if (type != UNSEALERD_MSG_FD || reply_len != 8 || *fd == -1)
+  {
+    kmyth_log(LOG_ERR, "kmyth-unsealerd failed to unseal the data.");
+    kmyth_clear_and_free(reply, reply_len);
+    if (*fd != -1)
+    {
+      close(*fd);
+      *fd = -1;
+    }
+    return 1;
+  }
+
+  uint64_t len = 0;
+
+  for (size_t i = 0; i < reply_len; i++)
+  {
+    len = (len << 8) | reply[i];
+  }
+  free(reply);
+  *output_len = (size_t) len;
+
+  return 0;
+}
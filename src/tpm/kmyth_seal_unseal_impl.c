@@ -7,17 +7,32 @@
 
 #include "kmyth_seal_unseal_impl.h"
 
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <tss2/tss2_mu.h>
+
+#include "compression.h"
 #include "defines.h"
 #include "file_io.h"
 #include "formatting_tools.h"
+#include "kmyth_metrics.h"
 #include "marshalling_tools.h"
 #include "memory_util.h"
+#include "nv_tools.h"
 #include "object_tools.h"
 #include "pcrs.h"
+#include "sk_pool.h"
+#include "ski_store.h"
 #include "storage_key_tools.h"
+#include "timing_util.h"
 #include "tpm2_interface.h"
 
 #include "cipher/cipher.h"
@@ -28,250 +43,3302 @@
  */
 extern const cipher_t cipher_list[];
 
+// per-thread contexts handed out by kmyth_tpm_context_thread()
+static pthread_key_t thread_ctx_key;
+static pthread_once_t thread_ctx_once = PTHREAD_ONCE_INIT;
+
 //############################################################################
-// tpm2_kmyth_seal()
+// kmyth_tpm_context_open()
 //############################################################################
-int tpm2_kmyth_seal(uint8_t * input,
-                    size_t input_len,
-                    uint8_t ** output,
-                    size_t * output_len,
-                    uint8_t * auth_bytes,
-                    size_t auth_bytes_len,
-                    uint8_t * owner_auth_bytes,
-                    size_t oa_bytes_len, int *pcrs, size_t pcrs_len,
-                    char *cipher_string)
+int kmyth_tpm_context_open(uint8_t * owner_auth_bytes,
+                           size_t oa_bytes_len, kmyth_tpm_context ** ctx)
 {
+  if (ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL context pointer ... exiting");
+    return 1;
+  }
+  *ctx = NULL;
 
-  //init connection to the resource manager
-  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
-
-  if (init_tpm2_connection(&sapi_ctx))
+  // The owner auth must fit in a TPM2B_AUTH buffer
+  if (oa_bytes_len > sizeof(((TPM2B_AUTH *) NULL)->buffer))
   {
-    kmyth_log(LOG_ERR, "unable to init connection to TPM2 resource manager");
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR,
+              "bad size: auth string for TPM storage hierarchy ... exiting");
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "initialized connection to TPM 2.0 resource manager");
 
-  Ski ski = get_default_ski();
+  kmyth_tpm_context *new_ctx = calloc(1, sizeof(kmyth_tpm_context));
 
-  //obtain cipher function
-  if (cipher_string == NULL)
+  if (new_ctx == NULL)
   {
-    cipher_string = KMYTH_DEFAULT_CIPHER;
+    kmyth_log(LOG_ERR, "unable to allocate TPM context ... exiting");
+    return 1;
   }
-  ski.cipher = kmyth_get_cipher_t_from_string(cipher_string);
+  pthread_mutex_init(&new_ctx->tpm_lock, NULL);
+  pthread_mutex_init(&new_ctx->cipher_lock, NULL);
+  new_ctx->sk_alg = KMYTH_KEY_PUBKEY_ALG;
 
-  if (ski.cipher.cipher_name == NULL)
+  const char *param_enc = getenv(KMYTH_TPM_PARAM_ENC_ENV);
+
+  new_ctx->param_encryption = (param_enc != NULL && param_enc[0] != '\0'
+                               && strcmp(param_enc, "0") != 0);
+
+  const char *preflight = getenv(KMYTH_TPM_PREFLIGHT_ENV);
+
+  new_ctx->policy_preflight = (preflight != NULL && preflight[0] != '\0'
+                               && strcmp(preflight, "0") != 0);
+
+  new_ctx->cipher_ctx = kmyth_cipher_ctx_new();
+  if (new_ctx->cipher_ctx == NULL)
   {
-    kmyth_log(LOG_ERR, "invalid cipher: %s ... exiting", cipher_string);
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "unable to allocate cipher context pool ... exiting");
+    kmyth_tpm_context_close(&new_ctx);
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "cipher: %s", ski.cipher.cipher_name);
 
-  // Create owner (storage) hierarchy authorization structure
-  TPM2B_AUTH ownerAuth;
+  uint64_t timer = kmyth_timer_begin();
 
-  ownerAuth.size = oa_bytes_len;
-  if (owner_auth_bytes != NULL && oa_bytes_len > 0)
+  //init connection to the resource manager
+  if (init_tpm2_connection(&new_ctx->sapi_ctx))
   {
-    memcpy(ownerAuth.buffer, owner_auth_bytes, ownerAuth.size);
+    kmyth_log(LOG_ERR, "unable to init connection to TPM2 resource manager");
+    kmyth_tpm_context_close(&new_ctx);
+    return 1;
   }
-  if (ownerAuth.size > 0)
+  kmyth_log(LOG_DEBUG, "initialized connection to TPM 2.0 resource manager");
+  kmyth_timer_end(KMYTH_PHASE_TPM_CONNECT, timer);
+
+  // Create owner (storage) hierarchy authorization structure
+  // to provide password session authorization criteria for use of:
+  //   - Storage Root Key (SRK)
+  //   - Storage Primary Seed (SPS), if necessary to re-derive SRK
+  new_ctx->ownerAuth.size = oa_bytes_len;
+  if (owner_auth_bytes != NULL && oa_bytes_len > 0)
   {
+    memcpy(new_ctx->ownerAuth.buffer, owner_auth_bytes,
+           new_ctx->ownerAuth.size);
     kmyth_log(LOG_DEBUG, "TPM storage hierarchy auth string provided");
   }
-  else if (ownerAuth.size == 0)
+  else
   {
+    new_ctx->ownerAuth.size = 0;
     kmyth_log(LOG_DEBUG,
               "using default (empty) auth string for TPM storage hierarchy");
   }
-  else
+
+  // The storage root key (SRK) is the primary key for the storage hierarchy
+  // in the TPM.  We will first check to see if it is already loaded in
+  // persistent storage. We do this by getting the loaded persistent handle
+  // values, inspecting each of their their public structures, and comparing
+  // these public area parameters against those for the SRK. None of these
+  // activities require authorization. If the key is not already loaded,
+  // though, it must be re-derived using the storage hierarchy's primary
+  // seed (SPS). Use of the SPS requires owner hierarchy authorization.
+  timer = kmyth_timer_begin();
+  if (get_srk_handle(new_ctx->sapi_ctx, &new_ctx->srk_handle,
+                     &new_ctx->ownerAuth))
   {
-    // should never reach this code - ownerAuth.size should be:
-    //   - zero that it was initialized to
-    //   - strlen(owner_auth_password) value that is greater than zero
-    // included this case for completenes
-    kmyth_log(LOG_DEBUG,
-              "bad size: auth string for TPM storage hierarchy ... exiting");
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "error obtaining handle for SRK ... exiting");
+    kmyth_tpm_context_close(&new_ctx);
     return 1;
   }
+  kmyth_log(LOG_DEBUG, "retrieved SRK handle (0x%08X)", new_ctx->srk_handle);
+  kmyth_timer_end(KMYTH_PHASE_SRK_LOOKUP, timer);
 
-  // Create authorization value for new, non-primary Kmyth objects (objectAuth)
-  //   - all-zero digest (like TPM 1.2 well-known secret) by default
-  //   - hash of input authorization string if one is specified
-  TPM2B_AUTH objAuthVal = {.size = 0, };
-  if (create_authVal(auth_bytes, auth_bytes_len, &objAuthVal))
+  *ctx = new_ctx;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_tpm_context_close()
+//############################################################################
+void kmyth_tpm_context_close(kmyth_tpm_context ** ctx)
+{
+  if (ctx == NULL || *ctx == NULL)
   {
-    kmyth_log(LOG_ERR, "error creating authorization value ... exiting");
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
-    free_tpm2_resources(&sapi_ctx);
+    return;
+  }
+
+  // flush the policy session and cached storage keys, clear owner hierarchy
+  // authorization, free cipher contexts and TPM resources
+  close_policy_session(*ctx);
+  flush_sk_cache(*ctx);
+  kmyth_clear((*ctx)->ownerAuth.buffer, sizeof((*ctx)->ownerAuth.buffer));
+  kmyth_cipher_ctx_free((*ctx)->cipher_ctx);
+  free((*ctx)->sk_pool_dir);
+  free_tpm2_resources(&(*ctx)->sapi_ctx);
+  pthread_mutex_destroy(&(*ctx)->tpm_lock);
+  pthread_mutex_destroy(&(*ctx)->cipher_lock);
+
+  free(*ctx);
+  *ctx = NULL;
+}
+
+//############################################################################
+// free_thread_ctx()
+//############################################################################
+static void free_thread_ctx(void *arg)
+{
+  kmyth_tpm_context *ctx = (kmyth_tpm_context *) arg;
+
+  kmyth_tpm_context_close(&ctx);
+}
+
+//############################################################################
+// create_thread_ctx_key()
+//############################################################################
+static void create_thread_ctx_key(void)
+{
+  pthread_key_create(&thread_ctx_key, free_thread_ctx);
+}
+
+//############################################################################
+// kmyth_tpm_context_thread()
+//############################################################################
+int kmyth_tpm_context_thread(uint8_t * owner_auth_bytes,
+                             size_t oa_bytes_len, kmyth_tpm_context ** ctx)
+{
+  if (ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL context pointer ... exiting");
     return 1;
   }
+  *ctx = NULL;
 
-  // Create a "PCR Selection" struct and populate it in accordance with
-  // the PCR values specified in user input "PCR Selection" string, if any
-  // (if the "PCR Selection" string is NULL, the "PCR Selection" struct created
-  // will specify that no PCRs were selected by the user - all-zero mask)
-  // This PCR Selection struct will be used in the authorization policy for
-  // new, non-primary Kmyth objects.
-  if (init_pcr_selection(sapi_ctx, pcrs, pcrs_len, &ski.pcr_list))
+  pthread_once(&thread_ctx_once, create_thread_ctx_key);
+
+  if (owner_auth_bytes == NULL)
   {
-    kmyth_log(LOG_ERR, "error initializing PCRs ... exiting");
+    oa_bytes_len = 0;
+  }
 
-    // clear potential 'auth' data, free TPM resources before exiting early
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
-    free_tpm2_resources(&sapi_ctx);
+  kmyth_tpm_context *cached = pthread_getspecific(thread_ctx_key);
+
+  // reuse this thread's context only if it was opened with the same owner
+  // hierarchy authorization
+  if (cached != NULL && cached->ownerAuth.size == oa_bytes_len
+      && CRYPTO_memcmp(cached->ownerAuth.buffer, owner_auth_bytes,
+                       oa_bytes_len) == 0)
+  {
+    *ctx = cached;
+    return 0;
+  }
+
+  kmyth_tpm_context_thread_close();
+
+  if (kmyth_tpm_context_open(owner_auth_bytes, oa_bytes_len, &cached))
+  {
+    kmyth_log(LOG_ERR, "unable to open per-thread TPM context ... exiting");
+    return 1;
+  }
+  if (pthread_setspecific(thread_ctx_key, cached) != 0)
+  {
+    kmyth_log(LOG_ERR, "unable to save per-thread TPM context ... exiting");
+    kmyth_tpm_context_close(&cached);
     return 1;
   }
 
-  // For all non-primary (other than SRK), Kmyth TPM 2.0 objects that we will
-  // create, we will assign TPM 2.0 policy-based enhanced authorization
-  // critera. Therefore, we will calculate the authorization policy digest that
-  // results from applying the steps of our selected authorization policy. We
-  // can then incorporate this result into the objects we create as the
-  // authorization policy digest value that must be regenerated to authorize
-  // use of these objects.
-  TPM2B_DIGEST objAuthPolicy;
+  *ctx = cached;
+  return 0;
+}
 
-  objAuthPolicy.size = 0;
-  if (create_policy_digest(sapi_ctx, ski.pcr_list, &objAuthPolicy))
+//############################################################################
+// kmyth_tpm_context_thread_close()
+//############################################################################
+void kmyth_tpm_context_thread_close(void)
+{
+  pthread_once(&thread_ctx_once, create_thread_ctx_key);
+
+  kmyth_tpm_context *cached = pthread_getspecific(thread_ctx_key);
+
+  if (cached == NULL)
+  {
+    return;
+  }
+  pthread_setspecific(thread_ctx_key, NULL);
+  kmyth_tpm_context_close(&cached);
+}
+
+//############################################################################
+// kmyth_tpm_context_set_ski_format()
+//############################################################################
+int kmyth_tpm_context_set_ski_format(kmyth_tpm_context * ctx,
+                                     kmyth_ski_format format)
+{
+  if (ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL TPM context ... exiting");
+    return 1;
+  }
+
+  if (format != KMYTH_SKI_FORMAT_TEXT && format != KMYTH_SKI_FORMAT_BINARY)
+  {
+    kmyth_log(LOG_ERR, "invalid .ski format (%d) ... exiting", format);
+    return 1;
+  }
+
+  ctx->ski_format = format;
+  return 0;
+}
+
+//############################################################################
+// kmyth_tpm_context_set_sk_alg()
+//############################################################################
+int kmyth_tpm_context_set_sk_alg(kmyth_tpm_context * ctx, kmyth_sk_alg alg)
+{
+  if (ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL TPM context ... exiting");
+    return 1;
+  }
+
+  switch (alg)
+  {
+  case KMYTH_SK_ALG_RSA:
+    ctx->sk_alg = TPM2_ALG_RSA;
+    break;
+  case KMYTH_SK_ALG_ECC:
+    ctx->sk_alg = TPM2_ALG_ECC;
+    break;
+  default:
+    kmyth_log(LOG_ERR, "invalid storage key algorithm (%d) ... exiting", alg);
+    return 1;
+  }
+  return 0;
+}
+
+//############################################################################
+// kmyth_tpm_context_set_sk_pool()
+//############################################################################
+int kmyth_tpm_context_set_sk_pool(kmyth_tpm_context * ctx,
+                                  const char *pool_dir)
+{
+  if (ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL TPM context ... exiting");
+    return 1;
+  }
+
+  char *new_dir = NULL;
+
+  if (pool_dir != NULL)
+  {
+    new_dir = strdup(pool_dir);
+    if (new_dir == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to allocate SK pool path ... exiting");
+      return 1;
+    }
+  }
+
+  pthread_mutex_lock(&ctx->tpm_lock);
+  free(ctx->sk_pool_dir);
+  ctx->sk_pool_dir = new_dir;
+  pthread_mutex_unlock(&ctx->tpm_lock);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_tpm_context_set_param_encryption()
+//############################################################################
+int kmyth_tpm_context_set_param_encryption(kmyth_tpm_context * ctx,
+                                           bool enable)
+{
+  if (ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL TPM context ... exiting");
+    return 1;
+  }
+
+  // the reused policy session is salted (or not) when it is started, so a
+  // change takes effect with a new session
+  pthread_mutex_lock(&ctx->tpm_lock);
+  if (ctx->param_encryption != enable)
+  {
+    close_policy_session(ctx);
+    ctx->param_encryption = enable;
+  }
+  pthread_mutex_unlock(&ctx->tpm_lock);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_tpm_context_set_policy_preflight()
+//############################################################################
+int kmyth_tpm_context_set_policy_preflight(kmyth_tpm_context * ctx,
+                                           bool enable)
+{
+  if (ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL TPM context ... exiting");
+    return 1;
+  }
+
+  pthread_mutex_lock(&ctx->tpm_lock);
+  ctx->policy_preflight = enable;
+  pthread_mutex_unlock(&ctx->tpm_lock);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_tpm_context_set_compression()
+//############################################################################
+int kmyth_tpm_context_set_compression(kmyth_tpm_context * ctx,
+                                      kmyth_compression compression)
+{
+  if (ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL TPM context ... exiting");
+    return 1;
+  }
+
+  if (kmyth_compression_name(compression) == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid compression (%d) ... exiting", compression);
+    return 1;
+  }
+
+  ctx->compression = compression;
+  return 0;
+}
+
+//############################################################################
+// get_sk_cache_digest()
+//############################################################################
+int get_sk_cache_digest(TPM2B_PUBLIC * sk_pub, uint8_t * digest)
+{
+  if (sk_pub == NULL || digest == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input ... exiting");
+    return 1;
+  }
+
+  // marshal the public area so the digest covers its canonical encoding
+  uint8_t packed[sizeof(TPM2B_PUBLIC)];
+  size_t packed_size = 0;
+  TSS2_RC rc = Tss2_MU_TPM2B_PUBLIC_Marshal(sk_pub, packed, sizeof(packed),
+                                            &packed_size);
+
+  if (rc != TSS2_RC_SUCCESS)
   {
     kmyth_log(LOG_ERR,
-              "error creating policy digest for new Kmyth object ... exiting");
+              "Tss2_MU_TPM2B_PUBLIC_Marshal(): 0x%08X ... exiting", rc);
+    return 1;
+  }
 
-    // clear potential 'auth' data, free TPM resources before exiting early
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
-    free_tpm2_resources(&sapi_ctx);
+  if (!EVP_Digest(packed, packed_size, digest, NULL, KMYTH_OPENSSL_HASH,
+                  NULL))
+  {
+    kmyth_log(LOG_ERR, "error computing SK public digest ... exiting");
     return 1;
   }
 
-  // The storage root key (SRK) is the primary key for the storage hierarchy
-  // in the TPM.  We will first check to see if it is already loaded in
-  // persistent storage. We do this by getting the loaded persistent handle
-  // values, inspecting each of their their public structures, and comparing
-  // these public area parameters against those for the SRK. None of these
-  // activities require authorization. If the key is not already loaded,
-  // though, it must be re-derived using the storage hierarchy's primary
-  // seed (SPS). Use of the SPS requires owner hierarchy authorization.
-  TPM2_HANDLE storageRootKey_handle = 0;
+  return 0;
+}
+
+//############################################################################
+// save_sk_context()
+//############################################################################
+static void save_sk_context(kmyth_tpm_context * ctx,
+                            kmyth_sk_cache_entry * cached)
+{
+  // find an existing saved context for this SK, tracking the entry to
+  // replace (a free one, or else the least recently used) if there is none
+  kmyth_sk_saved_entry *slot = &ctx->sk_saved[0];
 
-  if (get_srk_handle(sapi_ctx, &storageRootKey_handle, &ownerAuth))
+  for (int i = 0; i < KMYTH_SK_SAVED_CACHE_SIZE; i++)
   {
-    kmyth_log(LOG_ERR, "error obtaining handle for SRK ... exiting");
+    kmyth_sk_saved_entry *entry = &ctx->sk_saved[i];
+
+    if (entry->context != NULL && memcmp(entry->sk_pub_digest,
+                                         cached->sk_pub_digest,
+                                         KMYTH_DIGEST_SIZE) == 0)
+    {
+      entry->last_used = cached->last_used;
+      return;
+    }
+    if (slot->context != NULL && (entry->context == NULL ||
+                                  entry->last_used < slot->last_used))
+    {
+      slot = entry;
+    }
+  }
 
-    // clear potential 'auth' data, free TPM resources before exiting early
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
-    free_tpm2_resources(&sapi_ctx);
+  TPMS_CONTEXT *context = calloc(1, sizeof(TPMS_CONTEXT));
+
+  if (context == NULL)
+  {
+    return;
+  }
+
+  // failing to save only costs a full reload should this SK be needed again
+  TSS2_RC rc = Tss2_Sys_ContextSave(ctx->sapi_ctx, cached->sk_handle, context);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_DEBUG, "Tss2_Sys_ContextSave(): rc = 0x%08X, %s", rc,
+              getErrorString(rc));
+    free(context);
+    return;
+  }
+
+  free(slot->context);
+  memcpy(slot->sk_pub_digest, cached->sk_pub_digest, KMYTH_DIGEST_SIZE);
+  slot->context = context;
+  slot->last_used = cached->last_used;
+}
+
+//############################################################################
+// restore_sk_context()
+//############################################################################
+static int restore_sk_context(kmyth_tpm_context * ctx, uint8_t * digest,
+                              TPM2_HANDLE * sk_handle)
+{
+  for (int i = 0; i < KMYTH_SK_SAVED_CACHE_SIZE; i++)
+  {
+    kmyth_sk_saved_entry *entry = &ctx->sk_saved[i];
+
+    if (entry->context == NULL ||
+        memcmp(entry->sk_pub_digest, digest, KMYTH_DIGEST_SIZE) != 0)
+    {
+      continue;
+    }
+
+    // a saved context of a transient object can be loaded more than once,
+    // so the entry is kept unless the TPM rejects it (e.g., after a reset)
+    TSS2_RC rc = Tss2_Sys_ContextLoad(ctx->sapi_ctx, entry->context,
+                                      sk_handle);
+
+    if (rc == TSS2_RC_SUCCESS)
+    {
+      return 0;
+    }
+    kmyth_log(LOG_DEBUG, "Tss2_Sys_ContextLoad(): rc = 0x%08X, %s", rc,
+              getErrorString(rc));
+    free(entry->context);
+    entry->context = NULL;
+    return 1;
+  }
+
+  return 1;
+}
+
+//############################################################################
+// load_cached_sk()
+//############################################################################
+int load_cached_sk(kmyth_tpm_context * ctx,
+                   TPM2B_PUBLIC * sk_pub,
+                   TPM2B_PRIVATE * sk_priv, TPM2_HANDLE * sk_handle)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "TPM context not open ... exiting");
+    return 1;
+  }
+
+  uint8_t digest[KMYTH_DIGEST_SIZE];
+
+  if (get_sk_cache_digest(sk_pub, digest))
+  {
+    kmyth_log(LOG_ERR, "unable to identify storage key ... exiting");
+    return 1;
+  }
+
+  // look for an identical SK that is already loaded, tracking the entry to
+  // replace (a free one, or else the least recently used) on a miss
+  kmyth_sk_cache_entry *victim = &ctx->sk_cache[0];
+
+  for (int i = 0; i < KMYTH_SK_CACHE_SIZE; i++)
+  {
+    kmyth_sk_cache_entry *entry = &ctx->sk_cache[i];
+
+    if (entry->in_use && memcmp(entry->sk_pub_digest, digest,
+                                KMYTH_DIGEST_SIZE) == 0)
+    {
+      entry->last_used = ++ctx->sk_cache_clock;
+      *sk_handle = entry->sk_handle;
+      kmyth_log(LOG_DEBUG, "using cached SK at handle = 0x%08X", *sk_handle);
+      return 0;
+    }
+    if (victim->in_use && (!entry->in_use ||
+                           entry->last_used < victim->last_used))
+    {
+      victim = entry;
+    }
+  }
+
+  // save the context of the SK being evicted before flushing it, so that
+  // it can be restored rather than reloaded if it is needed again
+  if (victim->in_use)
+  {
+    save_sk_context(ctx, victim);
+    flush_tpm2_object(ctx->sapi_ctx, victim->sk_handle);
+    victim->in_use = false;
+  }
+
+  if (restore_sk_context(ctx, digest, sk_handle) == 0)
+  {
+    kmyth_metrics_count("kmyth_tpm_sk_load_total", "result=\"restored\"",
+                        "Storage keys loaded into the TPM", 1);
+    kmyth_log(LOG_DEBUG, "restored SK at handle = 0x%08X", *sk_handle);
+  }
+  else
+  {
+    // The SK is loaded under the SRK, so its parent (SRK) authorization is
+    // the owner hierarchy authorization
+    TPML_PCR_SELECTION emptyPcrList = {.count = 0, };
+    if (load_kmyth_object(ctx->sapi_ctx,
+                          (SESSION *) NULL,
+                          ctx->srk_handle,
+                          ctx->ownerAuth,
+                          emptyPcrList, sk_priv, sk_pub, sk_handle))
+    {
+      kmyth_log(LOG_ERR, "error loading storage key ... exiting");
+      return 1;
+    }
+    kmyth_metrics_count("kmyth_tpm_sk_load_total", "result=\"loaded\"",
+                        "Storage keys loaded into the TPM", 1);
+    kmyth_log(LOG_DEBUG, "loaded SK at handle = 0x%08X", *sk_handle);
+  }
+
+  memcpy(victim->sk_pub_digest, digest, KMYTH_DIGEST_SIZE);
+  victim->sk_handle = *sk_handle;
+  victim->last_used = ++ctx->sk_cache_clock;
+  victim->in_use = true;
+
+  return 0;
+}
+
+//############################################################################
+// flush_sk_cache()
+//############################################################################
+void flush_sk_cache(kmyth_tpm_context * ctx)
+{
+  if (ctx == NULL)
+  {
+    return;
+  }
+
+  for (int i = 0; i < KMYTH_SK_CACHE_SIZE; i++)
+  {
+    if (ctx->sk_cache[i].in_use && ctx->sapi_ctx != NULL)
+    {
+      flush_tpm2_object(ctx->sapi_ctx, ctx->sk_cache[i].sk_handle);
+    }
+    ctx->sk_cache[i].in_use = false;
+  }
+
+  for (int i = 0; i < KMYTH_SK_SAVED_CACHE_SIZE; i++)
+  {
+    free(ctx->sk_saved[i].context);
+    ctx->sk_saved[i].context = NULL;
+  }
+}
+
+//############################################################################
+// acquire_cipher_ctx()
+//############################################################################
+static kmyth_cipher_ctx *acquire_cipher_ctx(kmyth_tpm_context * ctx)
+{
+  if (pthread_mutex_trylock(&ctx->cipher_lock) != 0)
+  {
+    return NULL;
+  }
+  return ctx->cipher_ctx;
+}
+
+//############################################################################
+// release_cipher_ctx()
+//############################################################################
+static void release_cipher_ctx(kmyth_tpm_context * ctx,
+                               kmyth_cipher_ctx * cipher_ctx)
+{
+  if (cipher_ctx != NULL)
+  {
+    pthread_mutex_unlock(&ctx->cipher_lock);
+  }
+}
+
+//############################################################################
+// get_policy_session()
+//############################################################################
+static SESSION *get_policy_session(kmyth_tpm_context * ctx)
+{
+  // Reuse the context's policy session, re-armed for another authorization,
+  // rather than starting (and later flushing) a new one
+  if (ctx->policy_session_open)
+  {
+    if (restart_policy_auth_session(ctx->sapi_ctx, &ctx->policy_session) == 0)
+    {
+      kmyth_metrics_count("kmyth_tpm_policy_session_total",
+                          "result=\"reused\"",
+                          "Policy sessions used by seal/unseal", 1);
+      return &ctx->policy_session;
+    }
+    close_policy_session(ctx);
+  }
+
+  uint64_t timer = kmyth_timer_begin();
+
+  // a parameter encryption session is salted to the SRK - the salt and the
+  // session key derived from it are kept across restarts, so the RSA salt
+  // encryption is only paid for when the session is started
+  if (ctx->param_encryption)
+  {
+    if (create_salted_policy_auth_session(ctx->sapi_ctx, ctx->srk_handle,
+                                          &ctx->policy_session))
+    {
+      kmyth_log(LOG_ERR, "error starting salted auth policy session ... "
+                "exiting");
+      return NULL;
+    }
+  }
+  else if (create_policy_auth_session(ctx->sapi_ctx, &ctx->policy_session))
+  {
+    kmyth_log(LOG_ERR, "error starting auth policy session ... exiting");
+    return NULL;
+  }
+  kmyth_timer_end(KMYTH_PHASE_POLICY_SESSION, timer);
+  kmyth_metrics_count("kmyth_tpm_policy_session_total",
+                      "result=\"started\"",
+                      "Policy sessions used by seal/unseal", 1);
+  ctx->policy_session_open = true;
+
+  return &ctx->policy_session;
+}
+
+//############################################################################
+// close_policy_session()
+//############################################################################
+void close_policy_session(kmyth_tpm_context * ctx)
+{
+  if (ctx == NULL || !ctx->policy_session_open)
+  {
+    return;
+  }
+
+  if (ctx->sapi_ctx != NULL)
+  {
+    TSS2_RC rc = Tss2_Sys_FlushContext(ctx->sapi_ctx,
+                                       ctx->policy_session.sessionHandle);
+
+    if (rc != TSS2_RC_SUCCESS)
+    {
+      kmyth_log_tpm_rc("Tss2_Sys_FlushContext", rc);
+    }
+  }
+  kmyth_clear(&ctx->policy_session, sizeof(ctx->policy_session));
+  ctx->policy_session_open = false;
+}
+
+//############################################################################
+// get_sk_auth_policy()
+//############################################################################
+static int get_sk_auth_policy(kmyth_tpm_context * ctx,
+                              int *pcrs, size_t pcrs_len,
+                              TPML_PCR_SELECTION * pcrList,
+                              TPM2B_DIGEST * objAuthPolicy)
+{
+  // Create a "PCR Selection" struct and populate it in accordance with
+  // the PCR values specified in user input "PCR Selection" string, if any
+  // (if the "PCR Selection" string is NULL, the "PCR Selection" struct created
+  // will specify that no PCRs were selected by the user - all-zero mask)
+  // This PCR Selection struct will be used in the authorization policy for
+  // new, non-primary Kmyth objects.
+  uint64_t timer = kmyth_timer_begin();
+
+  if (init_pcr_selection(ctx->sapi_ctx, pcrs, pcrs_len, pcrList))
+  {
+    kmyth_log(LOG_ERR, "error initializing PCRs ... exiting");
+    return 1;
+  }
+
+  // For all non-primary (other than SRK), Kmyth TPM 2.0 objects that we will
+  // create, we will assign TPM 2.0 policy-based enhanced authorization
+  // critera. Therefore, we will calculate the authorization policy digest that
+  // results from applying the steps of our selected authorization policy. We
+  // can then incorporate this result into the objects we create as the
+  // authorization policy digest value that must be regenerated to authorize
+  // use of these objects. The digest is computed on the host, which only
+  // needs the PCR values from the TPM, with a TPM trial session as fallback.
+  objAuthPolicy->size = 0;
+  if (compute_policy_digest(ctx->sapi_ctx, *pcrList, &ctx->pcr_snapshot,
+                            objAuthPolicy))
+  {
+    kmyth_log(LOG_DEBUG, "falling back to a trial session for policy digest");
+    objAuthPolicy->size = 0;
+    if (create_policy_digest(ctx->sapi_ctx, *pcrList, objAuthPolicy))
+    {
+      kmyth_log(LOG_ERR,
+                "error creating policy digest for new Kmyth object ... exiting");
+      return 1;
+    }
+  }
+  kmyth_timer_end(KMYTH_PHASE_PCR_POLICY, timer);
+
+  return 0;
+}
+
+//############################################################################
+// take_pooled_sk()
+//############################################################################
+static int take_pooled_sk(kmyth_tpm_context * ctx,
+                          TPM2B_AUTH objAuthVal,
+                          TPM2B_DIGEST objAuthPolicy,
+                          TPM2_HANDLE * sk_handle,
+                          TPM2B_PRIVATE * sk_priv, TPM2B_PUBLIC * sk_pub)
+{
+  char id[KMYTH_SK_POOL_ID_LEN];
+  bool found = false;
+
+  if (get_sk_pool_id(ctx->sk_pool_dir, ctx->sk_alg, objAuthPolicy,
+                     objAuthVal, id) ||
+      sk_pool_take(ctx->sk_pool_dir, id, ctx->sk_alg, objAuthPolicy, sk_pub,
+                   sk_priv, &found))
+  {
+    kmyth_log(LOG_WARNING, "unable to use SK pool (%s)", ctx->sk_pool_dir);
+    return 1;
+  }
+  if (!found)
+  {
+    kmyth_metrics_count("kmyth_tpm_sk_pool_total", "result=\"miss\"",
+                        "Seals looking for a pooled storage key", 1);
+    return 1;
+  }
+
+  // The pooled SK was created under the SRK, so loading it needs only the
+  // owner hierarchy authorization (it fails if the SRK has since changed)
+  TPML_PCR_SELECTION emptyPcrList = {.count = 0, };
+  if (load_kmyth_object(ctx->sapi_ctx,
+                        (SESSION *) NULL,
+                        ctx->srk_handle,
+                        ctx->ownerAuth,
+                        emptyPcrList, sk_priv, sk_pub, sk_handle))
+  {
+    kmyth_log(LOG_WARNING, "unable to load pooled storage key");
+    return 1;
+  }
+  kmyth_metrics_count("kmyth_tpm_sk_pool_total", "result=\"hit\"",
+                      "Seals looking for a pooled storage key", 1);
+  kmyth_log(LOG_DEBUG, "loaded pooled SK at handle = 0x%08X", *sk_handle);
+
+  return 0;
+}
+
+//############################################################################
+// seal_ski_wrapping_key_with_sk()
+//############################################################################
+static int seal_ski_wrapping_key_with_sk(kmyth_tpm_context * ctx,
+                                         Ski * ski,
+                                         unsigned char *wrapKey,
+                                         size_t wrapKey_size,
+                                         TPM2B_AUTH objAuthVal,
+                                         TPM2B_DIGEST objAuthPolicy,
+                                         TPM2_HANDLE storageKey_handle)
+{
+  // Seal the wrapping key to the TPM using the (loaded) Storage Key (SK),
+  // in the context's policy session
+  SESSION *policySession = get_policy_session(ctx);
+
+  if (policySession == NULL)
+  {
+    return 1;
+  }
+
+  int retval = tpm2_kmyth_seal_data(ctx->sapi_ctx,
+                                    policySession,
+                                    wrapKey,
+                                    wrapKey_size,
+                                    storageKey_handle,
+                                    objAuthVal,
+                                    ski->pcr_list,
+                                    objAuthVal,
+                                    ski->pcr_list,
+                                    objAuthPolicy,
+                                    &ski->wk_pub, &ski->wk_priv);
+
+  // a session left in an unknown state by a failure is not reused
+  if (retval)
+  {
+    close_policy_session(ctx);
+  }
+
+  return retval;
+}
+
+//############################################################################
+// seal_ski_wrapping_key()
+//############################################################################
+static int seal_ski_wrapping_key(kmyth_tpm_context * ctx,
+                                 Ski * ski,
+                                 unsigned char *wrapKey,
+                                 size_t wrapKey_size,
+                                 TPM2B_AUTH objAuthVal,
+                                 int *pcrs, size_t pcrs_len)
+{
+  TPM2B_DIGEST objAuthPolicy;
+
+  if (get_sk_auth_policy(ctx, pcrs, pcrs_len, &ski->pcr_list, &objAuthPolicy))
+  {
+    return 1;
+  }
+
+  // We create a storage key (SK) that we will use to seal the symmetric
+  // wrapping key used to encrypt the user input data, unless a matching
+  // SK was created ahead of time in the context's SK pool.
+  // This storage key will be sealed to the SRK (its parent is the SRK).
+  TPM2_HANDLE storageKey_handle = 0;
+
+  uint64_t timer = kmyth_timer_begin();
+  bool pooled = (ctx->sk_pool_dir != NULL &&
+                 take_pooled_sk(ctx, objAuthVal, objAuthPolicy,
+                                &storageKey_handle, &ski->sk_priv,
+                                &ski->sk_pub) == 0);
+
+  if (!pooled && create_and_load_sk(ctx->sapi_ctx,
+                                    ctx->srk_handle,
+                                    ctx->ownerAuth,
+                                    objAuthVal,
+                                    ski->pcr_list,
+                                    objAuthPolicy,
+                                    ctx->sk_alg,
+                                    &storageKey_handle,
+                                    &ski->sk_priv, &ski->sk_pub))
+  {
+    kmyth_log(LOG_ERR, "failed to create and load a storage key ... exiting");
+    return 1;
+  }
+  kmyth_timer_end(KMYTH_PHASE_STORAGE_KEY, timer);
+
+  int retval = seal_ski_wrapping_key_with_sk(ctx, ski, wrapKey, wrapKey_size,
+                                             objAuthVal, objAuthPolicy,
+                                             storageKey_handle);
+
+  // done with the SK, so flush it from the TPM to keep the object slots
+  // of a long-lived connection free
+  flush_tpm2_object(ctx->sapi_ctx, storageKey_handle);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_tpm_context_fill_sk_pool()
+//############################################################################
+int kmyth_tpm_context_fill_sk_pool(kmyth_tpm_context * ctx,
+                                   uint8_t * auth_bytes,
+                                   size_t auth_bytes_len,
+                                   int *pcrs, size_t pcrs_len, size_t count)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "TPM context not open ... exiting");
+    return 1;
+  }
+
+  // The pooled SKs get the authVal a seal with this authorization string
+  // would give its own SK
+  TPM2B_AUTH objAuthVal = {.size = 0, };
+  if (create_authVal(auth_bytes, auth_bytes_len, &objAuthVal))
+  {
+    kmyth_log(LOG_ERR, "error creating authorization value ... exiting");
+    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+    return 1;
+  }
+
+  pthread_mutex_lock(&ctx->tpm_lock);
+
+  if (ctx->sk_pool_dir == NULL)
+  {
+    kmyth_log(LOG_ERR, "no SK pool selected ... exiting");
+    pthread_mutex_unlock(&ctx->tpm_lock);
+    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+    return 1;
+  }
+
+  // The pooled SKs get the policy (PCR selection and current PCR values)
+  // a seal with these PCRs would give its own SK
+  TPML_PCR_SELECTION pcrList;
+  TPM2B_DIGEST objAuthPolicy;
+  char id[KMYTH_SK_POOL_ID_LEN];
+  size_t pooled = 0;
+
+  if (get_sk_auth_policy(ctx, pcrs, pcrs_len, &pcrList, &objAuthPolicy) ||
+      get_sk_pool_id(ctx->sk_pool_dir, ctx->sk_alg, objAuthPolicy,
+                     objAuthVal, id) ||
+      sk_pool_count(ctx->sk_pool_dir, id, &pooled))
+  {
+    kmyth_log(LOG_ERR, "unable to inspect SK pool (%s) ... exiting",
+              ctx->sk_pool_dir);
+    pthread_mutex_unlock(&ctx->tpm_lock);
+    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+    return 1;
+  }
+
+  int retval = 0;
+  size_t created = 0;
+
+  while (pooled + created < count && retval == 0)
+  {
+    TPM2B_PUBLIC sk_pub = {.size = 0, };
+    TPM2B_PRIVATE sk_priv = {.size = 0, };
+
+    retval = create_sk(ctx->sapi_ctx, ctx->srk_handle, ctx->ownerAuth,
+                       objAuthVal, pcrList, objAuthPolicy, ctx->sk_alg,
+                       &sk_priv, &sk_pub);
+    if (retval == 0)
+    {
+      retval = sk_pool_put(ctx->sk_pool_dir, id, &sk_pub, &sk_priv);
+    }
+    if (retval == 0)
+    {
+      created++;
+    }
+  }
+  pthread_mutex_unlock(&ctx->tpm_lock);
+  kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+
+  kmyth_log(LOG_INFO, "SK pool (%s): %zu matching keys found, %zu created",
+            ctx->sk_pool_dir, pooled, created);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error filling SK pool ... exiting");
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// clear_payload_list()
+//############################################################################
+static void clear_payload_list(uint8_t ** payloads, size_t * payload_sizes,
+                               size_t count)
+{
+  for (size_t i = 0; payloads != NULL && i < count; i++)
+  {
+    kmyth_clear_and_free(payloads[i], payload_sizes[i]);
+  }
+  free(payloads);
+  free(payload_sizes);
+}
+
+//############################################################################
+// compress_payload_list()
+//############################################################################
+static int compress_payload_list(kmyth_compression compression,
+                                 uint8_t ** inputs, size_t * input_lens,
+                                 size_t input_count, uint8_t *** outputs,
+                                 size_t ** output_lens)
+{
+  uint64_t timer = kmyth_timer_begin();
+  uint8_t **payloads = calloc(input_count, sizeof(uint8_t *));
+  size_t *payload_sizes = calloc(input_count, sizeof(size_t));
+
+  if (payloads == NULL || payload_sizes == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate payload list ... exiting");
+    free(payloads);
+    free(payload_sizes);
+    return 1;
+  }
+
+  // each payload is compressed on its own, so that each can be recovered
+  // without the others
+  for (size_t i = 0; i < input_count; i++)
+  {
+    if (kmyth_compress_data(compression, inputs[i], input_lens[i],
+                            &payloads[i], &payload_sizes[i]))
+    {
+      kmyth_log(LOG_ERR, "unable to compress input %zu ... exiting", i);
+      clear_payload_list(payloads, payload_sizes, input_count);
+      return 1;
+    }
+  }
+  kmyth_timer_end(KMYTH_PHASE_COMPRESS, timer);
+
+  *outputs = payloads;
+  *output_lens = payload_sizes;
+  return 0;
+}
+
+//############################################################################
+// seal_ski_payloads()
+//############################################################################
+int seal_ski_payloads(kmyth_tpm_context * ctx,
+                      uint8_t ** inputs,
+                      size_t * input_lens,
+                      size_t input_count,
+                      bool bundle,
+                      bool into,
+                      uint8_t ** output,
+                      size_t * output_len,
+                      uint8_t * auth_bytes,
+                      size_t auth_bytes_len,
+                      int *pcrs, size_t pcrs_len, char *cipher_string)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "TPM context not open ... exiting");
+    return 1;
+  }
+
+  // validate non-empty plaintext buffers specified
+  if (inputs == NULL || input_lens == NULL || input_count == 0 ||
+      (!bundle && input_count != 1))
+  {
+    kmyth_log(LOG_ERR, "no input data ... exiting");
+    return 1;
+  }
+  for (size_t i = 0; i < input_count; i++)
+  {
+    if (input_lens[i] == 0 || inputs[i] == NULL)
+    {
+      kmyth_log(LOG_ERR, "no input data (input %zu) ... exiting", i);
+      return 1;
+    }
+  }
+
+  Ski ski = get_default_ski();
+
+  ski.bundle = bundle;
+  ski.compression = ctx->compression;
+
+  // only the binary format records the compression
+  kmyth_ski_format format = (ski.compression == KMYTH_COMPRESSION_NONE) ?
+    ctx->ski_format : KMYTH_SKI_FORMAT_BINARY;
+
+  //obtain cipher function
+  if (cipher_string == NULL)
+  {
+    cipher_string = KMYTH_DEFAULT_CIPHER;
+  }
+  ski.cipher = kmyth_get_cipher_t_from_string(cipher_string);
+
+  if (ski.cipher.cipher_name == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid cipher: %s ... exiting", cipher_string);
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "cipher: %s", ski.cipher.cipher_name);
+
+  // a caller-provided output buffer is only supported for a standard .ski,
+  // and a NULL one asks for the size it needs (before any TPM work is done)
+  if (into && bundle)
+  {
+    kmyth_log(LOG_ERR, "bundle .ski needs an allocated output ... exiting");
+    return 1;
+  }
+  if (into && ski.compression != KMYTH_COMPRESSION_NONE)
+  {
+    kmyth_log(LOG_ERR, "compressed .ski needs an allocated output ... "
+              "exiting");
+    return 1;
+  }
+  if (into && *output == NULL)
+  {
+    size_t enc_data_size = 0;
+
+    if (kmyth_encrypt_data_into(NULL, inputs[0], input_lens[0], ski.cipher,
+                                NULL, &enc_data_size, NULL, NULL)
+        || get_ski_bytes_max_size(format, false,
+                                  ski.cipher.cipher_name, enc_data_size,
+                                  output_len))
+    {
+      kmyth_log(LOG_ERR, "unable to size .ski output ... exiting");
+      return 1;
+    }
+    return 0;
+  }
+
+  // Compress the input data, if the context is set to, before it is
+  // wrapped (the compressed copies are cleared once encrypted)
+  uint8_t **comp_inputs = NULL;
+  size_t *comp_input_lens = NULL;
+
+  if (ski.compression != KMYTH_COMPRESSION_NONE)
+  {
+    if (compress_payload_list(ski.compression, inputs, input_lens,
+                              input_count, &comp_inputs, &comp_input_lens))
+    {
+      return 1;
+    }
+    inputs = comp_inputs;
+    input_lens = comp_input_lens;
+  }
+
+  // Wrap input data -
+  //   - The encryption uses the symmetric 'cipher' specified by the user.
+  //   - One symmetric wrapping key is generated and used to encrypt every
+  //     input (each encryption uses its own IV, where the cipher has one)
+  //   - This needs no TPM access, so it is done first, outside of the
+  //     context's TPM lock, letting concurrent seals encrypt in parallel
+  kmyth_log(LOG_DEBUG, "wrapping input data");
+  size_t wrapKey_size = get_key_len_from_cipher(ski.cipher) / 8;
+  unsigned char *wrapKey = kmyth_secure_alloc(wrapKey_size);
+  uint8_t **enc_payloads = calloc(input_count, sizeof(uint8_t *));
+  size_t *enc_payload_sizes = calloc(input_count, sizeof(size_t));
+
+  if (wrapKey == NULL || enc_payloads == NULL || enc_payload_sizes == NULL)
+  {
+    kmyth_log(LOG_ERR,
+              "unable to allocate memory for the wrapping key ... exiting");
+    kmyth_secure_free(wrapKey, wrapKey_size);
+    free(enc_payloads);
+    free(enc_payload_sizes);
+    clear_payload_list(comp_inputs, comp_input_lens, input_count);
+    return 1;
+  }
+
+  // encrypt (wrap) input data read in (e.g., client certificate private .pem)
+  //   - the first encryption generates the wrapping key
+  //   - the remaining inputs are encrypted under that same key
+  //   - the context's cipher context pool is reused across all of them,
+  //     unless another thread is using it
+  uint64_t timer = kmyth_timer_begin();
+  kmyth_cipher_ctx *cipher_ctx = acquire_cipher_ctx(ctx);
+  int retval = kmyth_encrypt_data_with_ctx(cipher_ctx,
+                                           inputs[0], input_lens[0],
+                                           ski.cipher, &enc_payloads[0],
+                                           &enc_payload_sizes[0],
+                                           &wrapKey, &wrapKey_size);
+
+  for (size_t i = 1; i < input_count && retval == 0; i++)
+  {
+    if (cipher_ctx != NULL && ski.cipher.encrypt_ctx_fn != NULL)
+    {
+      retval = ski.cipher.encrypt_ctx_fn(cipher_ctx,
+                                         wrapKey, wrapKey_size,
+                                         inputs[i], input_lens[i],
+                                         &enc_payloads[i],
+                                         &enc_payload_sizes[i]);
+    }
+    else
+    {
+      retval = ski.cipher.encrypt_fn(wrapKey, wrapKey_size,
+                                     inputs[i], input_lens[i],
+                                     &enc_payloads[i], &enc_payload_sizes[i]);
+    }
+  }
+  release_cipher_ctx(ctx, cipher_ctx);
+  clear_payload_list(comp_inputs, comp_input_lens, input_count);
+
+  if (retval == 0 && bundle)
+  {
+    retval = pack_bundle_payloads(enc_payloads, enc_payload_sizes,
+                                  input_count, &ski.enc_data,
+                                  &ski.enc_data_size);
+  }
+  else if (retval == 0)
+  {
+    ski.enc_data = enc_payloads[0];
+    ski.enc_data_size = enc_payload_sizes[0];
+    enc_payloads[0] = NULL;
+  }
+  kmyth_timer_end(KMYTH_PHASE_ENCRYPT, timer);
+
+  for (size_t i = 0; i < input_count; i++)
+  {
+    free(enc_payloads[i]);
+  }
+  free(enc_payloads);
+  free(enc_payload_sizes);
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unable to encrypt (wrap) data ... exiting");
+    kmyth_secure_free(wrapKey, wrapKey_size);
+    free_ski(&ski);
+    return 1;
+  }
+
+  kmyth_log(LOG_DEBUG, "input data wrapped (%zu input(s))", input_count);
+
+  // Create authorization value for new, non-primary Kmyth objects (objectAuth)
+  //   - all-zero digest (like TPM 1.2 well-known secret) by default
+  //   - hash of input authorization string if one is specified
+  TPM2B_AUTH objAuthVal = {.size = 0, };
+  if (create_authVal(auth_bytes, auth_bytes_len, &objAuthVal))
+  {
+    kmyth_log(LOG_ERR, "error creating authorization value ... exiting");
+    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+    kmyth_secure_free(wrapKey, wrapKey_size);
+    free_ski(&ski);
+    return 1;
+  }
+
+  // Seal the wrapping key: the TPM commands on the shared connection are
+  // serialized by the context's TPM lock
+  pthread_mutex_lock(&ctx->tpm_lock);
+  retval = seal_ski_wrapping_key(ctx, &ski, wrapKey, wrapKey_size,
+                                 objAuthVal, pcrs, pcrs_len);
+  pthread_mutex_unlock(&ctx->tpm_lock);
+
+  // Clean-up:
+  //   - done with unencrypted wrapping key (now have sealed version)
+  //   - done with authVal
+  kmyth_secure_free(wrapKey, wrapKey_size);
+  kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unable to seal data ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+
+  timer = kmyth_timer_begin();
+  if (into)
+  {
+    retval = create_ski_bytes_into(ski, format, *output, output_len);
+  }
+  else
+  {
+    retval = create_ski_bytes(ski, format, output, output_len);
+  }
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error writing data to .ski format ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+  kmyth_timer_end(KMYTH_PHASE_SKI_ENCODE, timer);
+
+  free_ski(&ski);
+
+  return 0;
+}
+
+//############################################################################
+// check_ski_policy()
+//############################################################################
+static int check_ski_policy(kmyth_tpm_context * ctx, Ski * ski,
+                            bool *satisfied)
+{
+  // The wrapping key's authorization policy is only satisfiable if the same
+  // policy, computed on the host from the current PCR values, matches it
+  TPM2B_DIGEST policyDigest = {.size = 0, };
+
+  if (compute_policy_digest(ctx->sapi_ctx, ski->pcr_list, &ctx->pcr_snapshot,
+                            &policyDigest))
+  {
+    kmyth_log(LOG_ERR, "error computing policy digest ... exiting");
+    return 1;
+  }
+
+  *satisfied = (policyDigest.size == ski->wk_pub.publicArea.authPolicy.size
+                && memcmp(policyDigest.buffer,
+                          ski->wk_pub.publicArea.authPolicy.buffer,
+                          policyDigest.size) == 0);
+
+  return 0;
+}
+
+//############################################################################
+// get_pcr_selection_indices()
+//############################################################################
+static int get_pcr_selection_indices(TPML_PCR_SELECTION * pcr_list,
+                                     int **pcrs, size_t *pcrs_len)
+{
+  size_t count = 0;
+
+  *pcrs = NULL;
+  *pcrs_len = 0;
+  for (size_t i = 0; i < pcr_list->count; i++)
+  {
+    for (size_t j = 0; j < pcr_list->pcrSelections[i].sizeofSelect * 8; j++)
+    {
+      if (pcr_list->pcrSelections[i].pcrSelect[j / 8] & (1 << (j % 8)))
+      {
+        count++;
+      }
+    }
+  }
+  if (count == 0)
+  {
+    return 0;
+  }
+
+  *pcrs = malloc(count * sizeof(int));
+  if (*pcrs == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate PCR list ... exiting");
+    return 1;
+  }
+  for (size_t i = 0; i < pcr_list->count; i++)
+  {
+    for (size_t j = 0; j < pcr_list->pcrSelections[i].sizeofSelect * 8; j++)
+    {
+      if (pcr_list->pcrSelections[i].pcrSelect[j / 8] & (1 << (j % 8)))
+      {
+        (*pcrs)[(*pcrs_len)++] = (int) j;
+      }
+    }
+  }
+
+  return 0;
+}
+
+//############################################################################
+// unseal_ski_wrapping_key()
+//############################################################################
+int unseal_ski_wrapping_key(kmyth_tpm_context * ctx,
+                            Ski * ski,
+                            uint8_t * auth_bytes,
+                            size_t auth_bytes_len,
+                            uint8_t ** key, size_t * key_len)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "TPM context not open ... exiting");
+    return 1;
+  }
+
+  // With the pre-flight check enabled, an unseal whose PCR policy cannot
+  // be satisfied fails here, before any object is loaded into the TPM
+  bool satisfied = true;
+
+  if (ctx->policy_preflight && ski->pcr_list.count > 0
+      && check_ski_policy(ctx, ski, &satisfied) == 0 && !satisfied)
+  {
+    kmyth_log(LOG_ERR, "current PCR values do not satisfy policy ... exiting");
+    if (ctx->pcr_snapshot.count > 0)
+    {
+      kmyth_log(LOG_WARNING, "current values of the PCRs in the policy:");
+      log_pcr_snapshot(LOG_WARNING, &ctx->pcr_snapshot);
+    }
+    return 1;
+  }
+
+  // Create authorization value (authVal) to provide policy session
+  // authorization criteria for use of:
+  //   - Storage Key (SK) TPM object
+  //   - Sealed Data (wrapping key) TPM object
+  // The authVal is set to:
+  //   - all-zero digest (like TPM 1.2 well-known secret) by default
+  //   - hash of input authorization string if one is specified
+  TPM2B_AUTH objAuthValue = {.size = 0, };
+
+  if (create_authVal(auth_bytes, auth_bytes_len, &objAuthValue))
+  {
+    kmyth_log(LOG_ERR, "error creating authorization value ... exiting");
+    kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+    return 1;
+  }
+
+  // The Storage Key (SK) will be used by the TPM to unseal the wrapping key.
+  // We have obtained its public and encrypted private blobs from
+  // the input .ski file and will now load the SK into the TPM, unless the
+  // context already holds the same SK from a previous unseal.
+  TPM2_HANDLE storageKey_handle = 0;
+  uint64_t timer = kmyth_timer_begin();
+
+  if (load_cached_sk(ctx, &ski->sk_pub, &ski->sk_priv, &storageKey_handle))
+  {
+    kmyth_log(LOG_ERR, "error loading storage key ... exiting");
+    kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+    return 1;
+  }
+  kmyth_timer_end(KMYTH_PHASE_STORAGE_KEY, timer);
+
+  // Authorization for the use of all non-primary (other than SRK), Kmyth
+  // TPM 2.0 objects utilizes policy-based enhanced authorization critera.
+  // Therefore, we will calculate the authorization policy digest that
+  // results from applying the steps of our selected authorization policy.
+  // We pass this result to the kmyth_unseal_data() function where it is
+  // used in theinto the objects we create as the
+  // authorization policy digest value that must be regenerated to authorize
+  // use of these objects.
+  TPM2B_DIGEST objAuthPolicy;
+
+  objAuthPolicy.size = 0;
+
+  // Perform "unseal" to recover the wrapping key, in the context's policy
+  // session (a session left in an unknown state by a failure is not reused)
+  SESSION *policySession = get_policy_session(ctx);
+
+  if (policySession == NULL)
+  {
+    kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+    return 1;
+  }
+
+  if (tpm2_kmyth_unseal_data(ctx->sapi_ctx,
+                             policySession,
+                             storageKey_handle,
+                             ski->wk_pub,
+                             ski->wk_priv,
+                             objAuthValue,
+                             ski->pcr_list, objAuthPolicy, key, key_len))
+  {
+    kmyth_log(LOG_ERR, "error unsealing data ... exiting");
+    close_policy_session(ctx);
+
+    // the current values of the PCRs in the policy help tell whether (and
+    // which) PCRs have changed since the data was sealed
+    if (ski->pcr_list.count > 0
+        && refresh_pcr_snapshot(ctx->sapi_ctx, ski->pcr_list,
+                                &ctx->pcr_snapshot) == 0
+        && ctx->pcr_snapshot.count > 0)
+    {
+      kmyth_log(LOG_WARNING, "current values of the PCRs in the policy:");
+      log_pcr_snapshot(LOG_WARNING, &ctx->pcr_snapshot);
+    }
+    kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+    return 1;
+  }
+
+  // Done with the authVal (the SK stays loaded in the context's SK cache)
+  kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+
+  return 0;
+}
+
+//############################################################################
+// reseal_ski_header()
+//############################################################################
+static int reseal_ski_header(kmyth_tpm_context * ctx,
+                             uint8_t * input,
+                             size_t input_len,
+                             uint8_t * auth_bytes,
+                             size_t auth_bytes_len,
+                             uint8_t * new_auth_bytes,
+                             size_t new_auth_bytes_len,
+                             int *pcrs, size_t pcrs_len,
+                             uint8_t ** header, size_t * header_len,
+                             size_t * data_offset)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "TPM context not open ... exiting");
+    return 1;
+  }
+
+  // only the TPM objects are decoded, never the encrypted data
+  SkiView view;
+  Ski *ski = NULL;
+
+  if (open_ski_view(input, input_len, &view))
+  {
+    kmyth_log(LOG_ERR, "error parsing .ski ... exiting");
+    return 1;
+  }
+  if (ski_view_get_tpm_objects(&view, &ski))
+  {
+    kmyth_log(LOG_ERR, "error parsing .ski ... exiting");
+    free_ski_view(&view);
+    return 1;
+  }
+
+  TPM2B_AUTH objAuthVal = {.size = 0, };
+  if (create_authVal(new_auth_bytes, new_auth_bytes_len, &objAuthVal))
+  {
+    kmyth_log(LOG_ERR, "error creating authorization value ... exiting");
+    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+    free_ski_view(&view);
+    return 1;
+  }
+
+  // The wrapping key is unsealed, and sealed again under a new storage key
+  // and policy, without touching the data it encrypts
+  Ski new_ski = get_default_ski();
+  uint8_t *wrapKey = NULL;
+  size_t wrapKey_size = 0;
+
+  pthread_mutex_lock(&ctx->tpm_lock);
+  int retval = unseal_ski_wrapping_key(ctx, ski, auth_bytes, auth_bytes_len,
+                                       &wrapKey, &wrapKey_size);
+
+  if (retval == 0)
+  {
+    retval = seal_ski_wrapping_key(ctx, &new_ski, wrapKey, wrapKey_size,
+                                   objAuthVal, pcrs, pcrs_len);
+  }
+  pthread_mutex_unlock(&ctx->tpm_lock);
+  kmyth_secure_free(wrapKey, wrapKey_size);
+  kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unable to reseal wrapping key ... exiting");
+  }
+  else if (create_ski_rewrap_header(input, input_len, new_ski,
+                                    header, header_len, data_offset))
+  {
+    kmyth_log(LOG_ERR, "error writing .ski header ... exiting");
+    retval = 1;
+  }
+  free_ski(&new_ski);
+  free_ski_view(&view);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_tpm_context_reseal()
+//############################################################################
+int kmyth_tpm_context_reseal(kmyth_tpm_context * ctx,
+                             uint8_t * input,
+                             size_t input_len,
+                             uint8_t ** output,
+                             size_t * output_len,
+                             uint8_t * auth_bytes,
+                             size_t auth_bytes_len,
+                             uint8_t * new_auth_bytes,
+                             size_t new_auth_bytes_len,
+                             int *pcrs, size_t pcrs_len)
+{
+  uint8_t *header = NULL;
+  size_t header_len = 0;
+  size_t data_offset = 0;
+
+  if (reseal_ski_header(ctx, input, input_len, auth_bytes, auth_bytes_len,
+                        new_auth_bytes, new_auth_bytes_len, pcrs, pcrs_len,
+                        &header, &header_len, &data_offset))
+  {
+    return 1;
+  }
+
+  // the new header is followed by the encrypted data, as it was stored
+  *output_len = header_len + (input_len - data_offset);
+  *output = malloc(*output_len);
+  if (*output == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate .ski output ... exiting");
+    free(header);
+    *output_len = 0;
+    return 1;
+  }
+  memcpy(*output, header, header_len);
+  memcpy(*output + header_len, input + data_offset, input_len - data_offset);
+  free(header);
+
+  return 0;
+}
+
+//############################################################################
+// sync_parent_dir()
+//
+// Flushes the directory holding a path, so that a rename() into it is
+// durable
+//############################################################################
+static int sync_parent_dir(const char *path)
+{
+  const char *name = strrchr(path, '/');
+  char *dir = (name == NULL) ? strdup(".") :
+    strndup(path, (name == path) ? 1 : (size_t) (name - path));
+
+  if (dir == NULL)
+  {
+    return 1;
+  }
+
+  int fd = open(dir, O_RDONLY | O_DIRECTORY);
+  int retval = (fd < 0 || fsync(fd) != 0);
+
+  if (fd >= 0)
+  {
+    close(fd);
+  }
+  free(dir);
+
+  return retval;
+}
+
+//############################################################################
+// rewrite_ski_file()
+//############################################################################
+static int rewrite_ski_file(char *path, uint8_t * input, size_t input_len,
+                            uint8_t * header, size_t header_len,
+                            size_t data_offset)
+{
+  // The resealed .ski is written in full to a temporary file (with the
+  // permissions of the original) that then replaces the original, so a
+  // crash at any point leaves either the old or the new .ski, never one
+  // with a partly written wrapping key. Replacing the file also breaks any
+  // other hard link to it (e.g., another alias of a .ski store entry, see
+  // ski_store.h), which keeps the policy it was sealed with.
+  int retval = 0;
+  uint64_t timer = kmyth_timer_begin();
+  struct stat st = { 0 };
+
+  if (stat(path, &st) != 0)
+  {
+    kmyth_log(LOG_ERR, "unable to stat %s ... exiting", path);
+    return 1;
+  }
+
+  size_t temp_path_size = strlen(path) + strlen(".reseal") + 1;
+  char *temp_path = malloc(temp_path_size);
+  FILE *file = NULL;
+
+  if (temp_path != NULL)
+  {
+    snprintf(temp_path, temp_path_size, "%s.reseal", path);
+
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC,
+                  st.st_mode & 0777);
+
+    if (fd >= 0 && fchmod(fd, st.st_mode & 0777) == 0)
+    {
+      file = fdopen(fd, "wb");
+    }
+    if (file == NULL && fd >= 0)
+    {
+      close(fd);
+    }
+  }
+  if (file == NULL || fwrite(header, 1, header_len, file) != header_len
+      || fwrite(input + data_offset, 1, input_len - data_offset, file)
+      != input_len - data_offset || fflush(file) != 0
+      || fsync(fileno(file)) != 0)
+  {
+    kmyth_log(LOG_ERR, "error writing resealed %s ... exiting", path);
+    retval = 1;
+  }
+  if (file != NULL && fclose(file) != 0)
+  {
+    retval = 1;
+  }
+  if (retval == 0 && rename(temp_path, path) != 0)
+  {
+    kmyth_log(LOG_ERR, "error replacing %s ... exiting", path);
+    retval = 1;
+  }
+  if (retval == 0 && sync_parent_dir(path) != 0)
+  {
+    kmyth_log(LOG_ERR, "error syncing directory of %s ... exiting", path);
+    retval = 1;
+  }
+  if (retval && temp_path != NULL)
+  {
+    remove(temp_path);
+  }
+  free(temp_path);
+  kmyth_timer_end(KMYTH_PHASE_FILE_IO, timer);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_tpm_context_reseal_file()
+//############################################################################
+int kmyth_tpm_context_reseal_file(kmyth_tpm_context * ctx,
+                                  char *path,
+                                  uint8_t * auth_bytes,
+                                  size_t auth_bytes_len,
+                                  uint8_t * new_auth_bytes,
+                                  size_t new_auth_bytes_len,
+                                  int *pcrs, size_t pcrs_len)
+{
+  uint8_t *input = NULL;
+  size_t input_len = 0;
+
+  if (map_bytes_from_file(path, &input, &input_len))
+  {
+    kmyth_log(LOG_ERR, "Unable to read file %s ... exiting", path);
+    return 1;
+  }
+
+  uint8_t *header = NULL;
+  size_t header_len = 0;
+  size_t data_offset = 0;
+
+  if (reseal_ski_header(ctx, input, input_len, auth_bytes, auth_bytes_len,
+                        new_auth_bytes, new_auth_bytes_len, pcrs, pcrs_len,
+                        &header, &header_len, &data_offset))
+  {
+    unmap_bytes_from_file(input, input_len);
+    return 1;
+  }
+
+  int retval = rewrite_ski_file(path, input, input_len,
+                                header, header_len, data_offset);
+
+  free(header);
+  unmap_bytes_from_file(input, input_len);
+
+  return retval;
+}
+
+/**
+ * @brief A .ski file of a bulk reseal, mapped and with its TPM objects
+ *        parsed (ski is NULL if it could not be)
+ */
+typedef struct reseal_item
+{
+  char *path;
+  uint8_t *input;
+  size_t input_len;
+  SkiView view;
+  Ski *ski;
+  uint8_t sk_digest[KMYTH_DIGEST_SIZE];
+} reseal_item;
+
+/**
+ * @brief Shared state of the worker threads of a bulk reseal
+ */
+typedef struct reseal_batch
+{
+  kmyth_tpm_context *ctx;
+  reseal_item *items;
+  size_t count;
+  uint8_t *auth_bytes;
+  size_t auth_bytes_len;
+
+  // the new storage key, loaded once for every wrapping key sealed
+  TPM2B_AUTH objAuthVal;
+  TPM2B_DIGEST objAuthPolicy;
+  TPML_PCR_SELECTION pcr_list;
+  TPM2B_PUBLIC sk_pub;
+  TPM2B_PRIVATE sk_priv;
+  TPM2_HANDLE sk_handle;
+
+  // next item to be claimed by a worker, and the count of failed items,
+  // both guarded by lock
+  pthread_mutex_t lock;
+  size_t next;
+  size_t failed;
+} reseal_batch;
+
+//############################################################################
+// compare_reseal_items()
+//############################################################################
+static int compare_reseal_items(const void *a, const void *b)
+{
+  const reseal_item *item_a = (const reseal_item *) a;
+  const reseal_item *item_b = (const reseal_item *) b;
+
+  return memcmp(item_a->sk_digest, item_b->sk_digest, KMYTH_DIGEST_SIZE);
+}
+
+//############################################################################
+// reseal_item_file()
+//############################################################################
+static int reseal_item_file(reseal_batch * batch, reseal_item * item)
+{
+  Ski new_ski = get_default_ski();
+  uint8_t *wrapKey = NULL;
+  size_t wrapKey_size = 0;
+
+  new_ski.pcr_list = batch->pcr_list;
+  new_ski.sk_pub = batch->sk_pub;
+  new_ski.sk_priv = batch->sk_priv;
+
+  // only the TPM commands are serialized: the items are in storage key
+  // order, so each old storage key is loaded once (through the context's
+  // SK cache) for all of the items sealed under it
+  pthread_mutex_lock(&batch->ctx->tpm_lock);
+  int retval = unseal_ski_wrapping_key(batch->ctx, item->ski,
+                                       batch->auth_bytes,
+                                       batch->auth_bytes_len,
+                                       &wrapKey, &wrapKey_size);
+
+  if (retval == 0)
+  {
+    retval = seal_ski_wrapping_key_with_sk(batch->ctx, &new_ski,
+                                           wrapKey, wrapKey_size,
+                                           batch->objAuthVal,
+                                           batch->objAuthPolicy,
+                                           batch->sk_handle);
+  }
+  pthread_mutex_unlock(&batch->ctx->tpm_lock);
+  kmyth_secure_free(wrapKey, wrapKey_size);
+
+  uint8_t *header = NULL;
+  size_t header_len = 0;
+  size_t data_offset = 0;
+
+  if (retval == 0)
+  {
+    retval = create_ski_rewrap_header(item->input, item->input_len, new_ski,
+                                      &header, &header_len, &data_offset);
+  }
+  if (retval == 0)
+  {
+    retval = rewrite_ski_file(item->path, item->input, item->input_len,
+                              header, header_len, data_offset);
+  }
+  free(header);
+  free_ski(&new_ski);
+
+  return retval;
+}
+
+//############################################################################
+// reseal_worker()
+//############################################################################
+static void *reseal_worker(void *arg)
+{
+  reseal_batch *batch = (reseal_batch *) arg;
+
+  while (true)
+  {
+    pthread_mutex_lock(&batch->lock);
+    size_t i = batch->next++;
+
+    pthread_mutex_unlock(&batch->lock);
+    if (i >= batch->count)
+    {
+      break;
+    }
+
+    // a file that could not be parsed has already been counted as failed
+    reseal_item *item = &batch->items[i];
+
+    if (item->ski == NULL)
+    {
+      continue;
+    }
+    if (reseal_item_file(batch, item))
+    {
+      kmyth_log(LOG_ERR, "error resealing %s", item->path);
+      pthread_mutex_lock(&batch->lock);
+      batch->failed++;
+      pthread_mutex_unlock(&batch->lock);
+    }
+    else
+    {
+      kmyth_log(LOG_DEBUG, "resealed %s", item->path);
+    }
+
+    // done with the file: the old objects and mapping are released as the
+    // batch goes, not at its end
+    free_ski_view(&item->view);
+    unmap_bytes_from_file(item->input, item->input_len);
+    item->input = NULL;
+    item->ski = NULL;
+  }
+
+  return NULL;
+}
+
+//############################################################################
+// kmyth_tpm_context_reseal_files()
+//############################################################################
+int kmyth_tpm_context_reseal_files(kmyth_tpm_context * ctx,
+                                   char **paths,
+                                   size_t path_count,
+                                   size_t job_count,
+                                   uint8_t * auth_bytes,
+                                   size_t auth_bytes_len,
+                                   uint8_t * new_auth_bytes,
+                                   size_t new_auth_bytes_len,
+                                   int *pcrs, size_t pcrs_len)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "TPM context not open ... exiting");
+    return 1;
+  }
+  if (paths == NULL || path_count == 0)
+  {
+    kmyth_log(LOG_ERR, "no .ski files to reseal ... exiting");
+    return 1;
+  }
+
+  reseal_batch batch = {
+    .ctx = ctx,
+    .count = path_count,
+    .auth_bytes = auth_bytes,
+    .auth_bytes_len = auth_bytes_len,
+    .objAuthVal = {.size = 0, },
+  };
+
+  batch.items = calloc(path_count, sizeof(reseal_item));
+  if (batch.items == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate reseal list ... exiting");
+    return 1;
+  }
+
+  // Parse the TPM objects of every file up front (never the encrypted
+  // data), so that the files can be resealed grouped by storage key
+  for (size_t i = 0; i < path_count; i++)
+  {
+    reseal_item *item = &batch.items[i];
+
+    item->path = paths[i];
+    if (map_bytes_from_file(item->path, &item->input, &item->input_len))
+    {
+      kmyth_log(LOG_ERR, "Unable to read file %s", item->path);
+      item->input = NULL;
+    }
+    else if (open_ski_view(item->input, item->input_len, &item->view)
+             || ski_view_get_tpm_objects(&item->view, &item->ski)
+             || get_sk_cache_digest(&item->ski->sk_pub, item->sk_digest))
+    {
+      kmyth_log(LOG_ERR, "error parsing %s", item->path);
+      free_ski_view(&item->view);
+      item->ski = NULL;
+    }
+    if (item->ski == NULL)
+    {
+      batch.failed++;
+    }
+  }
+  qsort(batch.items, path_count, sizeof(reseal_item), compare_reseal_items);
+  for (size_t i = 0; i < path_count; i++)
+  {
+    // the parsed objects are held in the (moved) view
+    if (batch.items[i].ski != NULL)
+    {
+      batch.items[i].ski = &batch.items[i].view.ski;
+    }
+  }
+
+  // One new storage key is created (or taken from the SK pool) for the
+  // whole batch, and stays loaded until every wrapping key is sealed
+  int retval = create_authVal(new_auth_bytes, new_auth_bytes_len,
+                              &batch.objAuthVal);
+
+  pthread_mutex_lock(&ctx->tpm_lock);
+  if (retval == 0)
+  {
+    retval = get_sk_auth_policy(ctx, pcrs, pcrs_len, &batch.pcr_list,
+                                &batch.objAuthPolicy);
+  }
+  if (retval == 0
+      && (ctx->sk_pool_dir == NULL
+          || take_pooled_sk(ctx, batch.objAuthVal, batch.objAuthPolicy,
+                            &batch.sk_handle, &batch.sk_priv,
+                            &batch.sk_pub) != 0))
+  {
+    retval = create_and_load_sk(ctx->sapi_ctx, ctx->srk_handle,
+                                ctx->ownerAuth, batch.objAuthVal,
+                                batch.pcr_list, batch.objAuthPolicy,
+                                ctx->sk_alg, &batch.sk_handle,
+                                &batch.sk_priv, &batch.sk_pub);
+  }
+  pthread_mutex_unlock(&ctx->tpm_lock);
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "failed to create a storage key ... exiting");
+  }
+  else
+  {
+    // Workers overlap the file I/O of some files with the TPM commands of
+    // another; the calling thread is one of them, so progress is made even
+    // if no other worker thread could be started
+    if (job_count < 1)
+    {
+      job_count = 1;
+    }
+    if (job_count > path_count)
+    {
+      job_count = path_count;
+    }
+
+    pthread_t *workers = calloc(job_count, sizeof(pthread_t));
+    size_t started = 0;
+
+    pthread_mutex_init(&batch.lock, NULL);
+    while (workers != NULL && started + 1 < job_count
+           && pthread_create(&workers[started], NULL, reseal_worker,
+                             &batch) == 0)
+    {
+      started++;
+    }
+    reseal_worker(&batch);
+    for (size_t i = 0; i < started; i++)
+    {
+      pthread_join(workers[i], NULL);
+    }
+    pthread_mutex_destroy(&batch.lock);
+    free(workers);
+
+    pthread_mutex_lock(&ctx->tpm_lock);
+    flush_tpm2_object(ctx->sapi_ctx, batch.sk_handle);
+    pthread_mutex_unlock(&ctx->tpm_lock);
+  }
+  kmyth_clear(batch.objAuthVal.buffer, batch.objAuthVal.size);
+
+  // release whatever a failure left behind
+  for (size_t i = 0; i < path_count; i++)
+  {
+    free_ski_view(&batch.items[i].view);
+    if (batch.items[i].input != NULL)
+    {
+      unmap_bytes_from_file(batch.items[i].input, batch.items[i].input_len);
+    }
+  }
+  free(batch.items);
+
+  if (retval == 0 && batch.failed > 0)
+  {
+    kmyth_log(LOG_ERR, "failed to reseal %zu of %zu .ski files",
+              batch.failed, path_count);
+    retval = 1;
+  }
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_tpm_context_check_policy()
+//############################################################################
+int kmyth_tpm_context_check_policy(kmyth_tpm_context * ctx,
+                                   uint8_t * input,
+                                   size_t input_len,
+                                   bool *satisfied,
+                                   int **pcrs, size_t *pcrs_len)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "TPM context not open ... exiting");
+    return 1;
+  }
+
+  *pcrs = NULL;
+  *pcrs_len = 0;
+
+  // only the TPM objects are decoded, never the encrypted data
+  SkiView view;
+  Ski *ski = NULL;
+
+  if (open_ski_view(input, input_len, &view))
+  {
+    kmyth_log(LOG_ERR, "error parsing .ski ... exiting");
+    return 1;
+  }
+  if (ski_view_get_tpm_objects(&view, &ski))
+  {
+    kmyth_log(LOG_ERR, "error parsing .ski ... exiting");
+    free_ski_view(&view);
+    return 1;
+  }
+
+  pthread_mutex_lock(&ctx->tpm_lock);
+  int retval = check_ski_policy(ctx, ski, satisfied);
+
+  if (retval == 0 && !*satisfied)
+  {
+    // the .ski only records the combined policy digest, so the PCRs that
+    // changed cannot be told apart: report all those in the policy
+    retval = get_pcr_selection_indices(&ski->pcr_list, pcrs, pcrs_len);
+    if (ctx->pcr_snapshot.count > 0)
+    {
+      kmyth_log(LOG_WARNING, "current values of the PCRs in the policy:");
+      log_pcr_snapshot(LOG_WARNING, &ctx->pcr_snapshot);
+    }
+  }
+  pthread_mutex_unlock(&ctx->tpm_lock);
+
+  free_ski_view(&view);
+
+  return retval;
+}
+
+//############################################################################
+// define_nv_secret()
+//############################################################################
+static int define_nv_secret(kmyth_tpm_context * ctx,
+                            uint8_t * input,
+                            size_t input_len,
+                            uint32_t * nv_index,
+                            TPM2B_AUTH objAuthVal, int *pcrs, size_t pcrs_len)
+{
+  // the secret is written and read with one command each, so it has to fit
+  // in the TPM's NV buffer
+  size_t maxSize = 0;
+
+  if (get_nv_max_data_size(ctx->sapi_ctx, &maxSize))
+  {
+    return 1;
+  }
+  if (input_len > maxSize)
+  {
+    kmyth_log(LOG_ERR, "input (%zu bytes) exceeds NV buffer size (%zu bytes)"
+              " ... exiting", input_len, maxSize);
+    return 1;
+  }
+  if (*nv_index == 0 && get_free_nv_index(ctx->sapi_ctx, nv_index))
+  {
+    return 1;
+  }
+
+  TPML_PCR_SELECTION pcrList;
+  TPM2B_DIGEST objAuthPolicy;
+
+  if (get_sk_auth_policy(ctx, pcrs, pcrs_len, &pcrList, &objAuthPolicy))
+  {
+    return 1;
+  }
+  if (define_kmyth_nv_index(ctx->sapi_ctx, ctx->ownerAuth, *nv_index,
+                            objAuthVal, objAuthPolicy, (uint16_t) input_len))
+  {
+    kmyth_log(LOG_ERR, "error defining NV index 0x%08X ... exiting",
+              *nv_index);
+    return 1;
+  }
+
+  // an index that could not be written is not left defined
+  if (write_kmyth_nv_index(ctx->sapi_ctx, ctx->srk_handle, ctx->ownerAuth,
+                           *nv_index, input, input_len))
+  {
+    kmyth_log(LOG_ERR, "error writing NV index 0x%08X ... exiting",
+              *nv_index);
+    undefine_kmyth_nv_index(ctx->sapi_ctx, ctx->ownerAuth, *nv_index);
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "sealed %zu bytes into NV index 0x%08X", input_len,
+            *nv_index);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_tpm_context_seal_nv()
+//############################################################################
+int kmyth_tpm_context_seal_nv(kmyth_tpm_context * ctx,
+                              uint8_t * input,
+                              size_t input_len,
+                              uint32_t * nv_index,
+                              uint8_t * auth_bytes,
+                              size_t auth_bytes_len, int *pcrs, size_t pcrs_len)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "TPM context not open ... exiting");
+    return 1;
+  }
+  if (input == NULL || input_len == 0)
+  {
+    kmyth_log(LOG_ERR, "no input data ... exiting");
+    return 1;
+  }
+
+  TPM2B_AUTH objAuthVal = {.size = 0, };
+
+  if (create_authVal(auth_bytes, auth_bytes_len, &objAuthVal))
+  {
+    kmyth_log(LOG_ERR, "error creating authorization value ... exiting");
+    return 1;
+  }
+
+  pthread_mutex_lock(&ctx->tpm_lock);
+  int retval = define_nv_secret(ctx, input, input_len, nv_index, objAuthVal,
+                                pcrs, pcrs_len);
+
+  pthread_mutex_unlock(&ctx->tpm_lock);
+  kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+
+  return retval;
+}
+
+//############################################################################
+// read_nv_secret()
+//############################################################################
+static int read_nv_secret(kmyth_tpm_context * ctx,
+                          uint32_t nv_index,
+                          TPM2B_AUTH objAuthVal,
+                          int *pcrs, size_t pcrs_len,
+                          TPM2B_MAX_NV_BUFFER * nvData)
+{
+  TPML_PCR_SELECTION pcrList;
+
+  if (init_pcr_selection(ctx->sapi_ctx, pcrs, pcrs_len, &pcrList))
+  {
+    kmyth_log(LOG_ERR, "error initializing PCRs ... exiting");
+    return 1;
+  }
+
+  // the read is authorized in the context's policy session (a session left
+  // in an unknown state by a failure is not reused)
+  SESSION *policySession = get_policy_session(ctx);
+
+  if (policySession == NULL)
+  {
+    return 1;
+  }
+  if (read_kmyth_nv_index(ctx->sapi_ctx, policySession, nv_index,
+                          objAuthVal, pcrList, nvData))
+  {
+    kmyth_log(LOG_ERR, "error reading NV index 0x%08X ... exiting",
+              nv_index);
+    close_policy_session(ctx);
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_tpm_context_unseal_nv()
+//############################################################################
+int kmyth_tpm_context_unseal_nv(kmyth_tpm_context * ctx,
+                                uint32_t nv_index,
+                                uint8_t ** output,
+                                size_t * output_len,
+                                uint8_t * auth_bytes,
+                                size_t auth_bytes_len,
+                                int *pcrs, size_t pcrs_len)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "TPM context not open ... exiting");
+    return 1;
+  }
+
+  *output = NULL;
+  *output_len = 0;
+
+  TPM2B_AUTH objAuthVal = {.size = 0, };
+
+  if (create_authVal(auth_bytes, auth_bytes_len, &objAuthVal))
+  {
+    kmyth_log(LOG_ERR, "error creating authorization value ... exiting");
+    return 1;
+  }
+
+  TPM2B_MAX_NV_BUFFER nvData = {.size = 0, };
+
+  pthread_mutex_lock(&ctx->tpm_lock);
+  int retval = read_nv_secret(ctx, nv_index, objAuthVal, pcrs, pcrs_len,
+                              &nvData);
+
+  pthread_mutex_unlock(&ctx->tpm_lock);
+  kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+  if (retval)
+  {
+    return 1;
+  }
+
+  *output = malloc(nvData.size);
+  if (*output == NULL)
+  {
+    kmyth_log(LOG_ERR, "error allocating unsealed data buffer ... exiting");
+    kmyth_clear(&nvData, sizeof(nvData));
+    return 1;
+  }
+  memcpy(*output, nvData.buffer, nvData.size);
+  *output_len = nvData.size;
+  kmyth_clear(&nvData, sizeof(nvData));
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_tpm_context_undefine_nv()
+//############################################################################
+int kmyth_tpm_context_undefine_nv(kmyth_tpm_context * ctx, uint32_t nv_index)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "TPM context not open ... exiting");
+    return 1;
+  }
+
+  pthread_mutex_lock(&ctx->tpm_lock);
+  int retval = undefine_kmyth_nv_index(ctx->sapi_ctx, ctx->ownerAuth,
+                                       nv_index);
+
+  pthread_mutex_unlock(&ctx->tpm_lock);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_tpm_context_seal()
+//############################################################################
+int kmyth_tpm_context_seal(kmyth_tpm_context * ctx,
+                           uint8_t * input,
+                           size_t input_len,
+                           uint8_t ** output,
+                           size_t * output_len,
+                           uint8_t * auth_bytes,
+                           size_t auth_bytes_len,
+                           int *pcrs, size_t pcrs_len, char *cipher_string)
+{
+  return seal_ski_payloads(ctx, &input, &input_len, 1, false, false,
+                           output, output_len,
+                           auth_bytes, auth_bytes_len,
+                           pcrs, pcrs_len, cipher_string);
+}
+
+//############################################################################
+// kmyth_tpm_context_seal_bundle()
+//############################################################################
+int kmyth_tpm_context_seal_bundle(kmyth_tpm_context * ctx,
+                                  uint8_t ** inputs,
+                                  size_t * input_lens,
+                                  size_t input_count,
+                                  uint8_t ** output,
+                                  size_t * output_len,
+                                  uint8_t * auth_bytes,
+                                  size_t auth_bytes_len,
+                                  int *pcrs, size_t pcrs_len,
+                                  char *cipher_string)
+{
+  return seal_ski_payloads(ctx, inputs, input_lens, input_count, true,
+                           false, output, output_len,
+                           auth_bytes, auth_bytes_len,
+                           pcrs, pcrs_len, cipher_string);
+}
+
+//############################################################################
+// kmyth_tpm_context_seal_into()
+//############################################################################
+int kmyth_tpm_context_seal_into(kmyth_tpm_context * ctx,
+                                uint8_t * input,
+                                size_t input_len,
+                                uint8_t * output,
+                                size_t * output_len,
+                                uint8_t * auth_bytes,
+                                size_t auth_bytes_len,
+                                int *pcrs, size_t pcrs_len,
+                                char *cipher_string)
+{
+  if (output_len == NULL)
+  {
+    kmyth_log(LOG_ERR, "no output length specified ... exiting");
+    return 1;
+  }
+
+  return seal_ski_payloads(ctx, &input, &input_len, 1, false, true,
+                           &output, output_len,
+                           auth_bytes, auth_bytes_len,
+                           pcrs, pcrs_len, cipher_string);
+}
+
+//############################################################################
+// check_stored_ski()
+//
+// Checks that a .ski from a .ski store can still be unsealed here: that its
+// storage key loads under the current SRK (it does not after, e.g., a TPM
+// clear or a new SRK), and that the current PCR values satisfy its policy
+//############################################################################
+static int check_stored_ski(kmyth_tpm_context * ctx, uint8_t * input,
+                            size_t input_len, bool *usable)
+{
+  SkiView view;
+  Ski *ski = NULL;
+
+  *usable = false;
+  if (open_ski_view(input, input_len, &view))
+  {
+    kmyth_log(LOG_ERR, "error parsing stored .ski ... exiting");
+    return 1;
+  }
+  if (ski_view_get_tpm_objects(&view, &ski))
+  {
+    kmyth_log(LOG_ERR, "error parsing stored .ski ... exiting");
+    free_ski_view(&view);
+    return 1;
+  }
+
+  // the storage key stays loaded in the context's SK cache, so the check
+  // costs nothing more if the .ski is then unsealed with this context
+  TPM2_HANDLE sk_handle = 0;
+  bool satisfied = true;
+
+  pthread_mutex_lock(&ctx->tpm_lock);
+  if (load_cached_sk(ctx, &ski->sk_pub, &ski->sk_priv, &sk_handle))
+  {
+    kmyth_log(LOG_INFO, "stored .ski storage key does not load under the "
+              "current SRK");
+    satisfied = false;
+  }
+  else if (ski->pcr_list.count > 0
+           && (check_ski_policy(ctx, ski, &satisfied) || !satisfied))
+  {
+    kmyth_log(LOG_INFO, "stored .ski PCR policy is not satisfied by the "
+              "current PCR values");
+    satisfied = false;
+  }
+  pthread_mutex_unlock(&ctx->tpm_lock);
+
+  free_ski_view(&view);
+  *usable = satisfied;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_tpm_context_seal_stored()
+//############################################################################
+int kmyth_tpm_context_seal_stored(kmyth_tpm_context * ctx,
+                                  const char *store_dir,
+                                  uint8_t * input,
+                                  size_t input_len,
+                                  char **ski_path,
+                                  bool *reused,
+                                  uint8_t * auth_bytes,
+                                  size_t auth_bytes_len,
+                                  int *pcrs, size_t pcrs_len,
+                                  char *cipher_string)
+{
+  if (ctx == NULL || store_dir == NULL || ski_path == NULL || reused == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input ... exiting");
+    return 1;
+  }
+  *ski_path = NULL;
+  *reused = false;
+
+  // the store ID covers every parameter that shapes the .ski, so a stored
+  // .ski is only shared by seals that would have produced an equivalent one
+  uint8_t store_key[KMYTH_SKI_STORE_KEY_SIZE];
+  char id[KMYTH_SKI_STORE_ID_LEN];
+  ski_store_policy policy = {
+    .auth_bytes = auth_bytes,
+    .auth_bytes_len = auth_bytes_len,
+    .pcrs = pcrs,
+    .pcrs_len = pcrs_len,
+    .cipher_string = cipher_string,
+    .ski_format = (uint32_t) ctx->ski_format,
+    .sk_alg = (uint32_t) ctx->sk_alg,
+    .compression = (uint32_t) ctx->compression,
+  };
+
+  if (ski_store_get_key(store_dir, store_key))
+  {
+    return 1;
+  }
+
+  int retval = ski_store_id(store_key, input, input_len, &policy, id);
+
+  kmyth_clear(store_key, sizeof(store_key));
+  if (retval)
+  {
+    return 1;
+  }
+
+  uint8_t *ski = NULL;
+  size_t ski_len = 0;
+  bool found = false;
+
+  if (ski_store_get(store_dir, id, &ski, &ski_len, &found))
+  {
+    return 1;
+  }
+
+  // a stored .ski that can no longer be unsealed here (its storage key was
+  // sealed under an SRK that is gone, or to PCR values that have since
+  // changed) is replaced by a fresh seal
+  if (found)
+  {
+    bool usable = false;
+
+    if (check_stored_ski(ctx, ski, ski_len, &usable) || !usable)
+    {
+      kmyth_log(LOG_INFO, "stored .ski %s can no longer be unsealed, "
+                "resealing", id);
+      found = false;
+    }
+  }
+  free(ski);
+  ski = NULL;
+
+  if (found)
+  {
+    kmyth_metrics_count("kmyth_ski_store_seal_total", "result=\"reused\"",
+                        "Seals made through a .ski store", 1);
+    kmyth_log(LOG_DEBUG, "reusing stored .ski %s", id);
+    *reused = true;
+    return ski_store_path(store_dir, id, ski_path);
+  }
+
+  if (kmyth_tpm_context_seal(ctx, input, input_len, &ski, &ski_len,
+                             auth_bytes, auth_bytes_len,
+                             pcrs, pcrs_len, cipher_string))
+  {
+    return 1;
+  }
+  retval = ski_store_put(store_dir, id, ski, ski_len);
+  free(ski);
+  if (retval)
+  {
+    return 1;
+  }
+  kmyth_metrics_count("kmyth_ski_store_seal_total", "result=\"sealed\"",
+                      "Seals made through a .ski store", 1);
+
+  return ski_store_path(store_dir, id, ski_path);
+}
+
+//############################################################################
+// decompress_payload()
+//############################################################################
+static int decompress_payload(kmyth_compression compression,
+                              uint8_t ** payload, size_t * payload_len)
+{
+  uint8_t *plain = NULL;
+  size_t plain_len = 0;
+  uint64_t timer = kmyth_timer_begin();
+  int retval = kmyth_decompress_data(compression, *payload, *payload_len,
+                                     &plain, &plain_len);
+
+  kmyth_timer_end(KMYTH_PHASE_COMPRESS, timer);
+
+  // the decrypted (compressed) payload is replaced either way
+  kmyth_clear_and_free(*payload, *payload_len);
+  *payload = plain;
+  *payload_len = plain_len;
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error decompressing data ... exiting");
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// unseal_ski_payload()
+//############################################################################
+static int unseal_ski_payload(kmyth_tpm_context * ctx,
+                              uint8_t * input,
+                              size_t input_len,
+                              bool into,
+                              size_t * range_offset,
+                              uint8_t ** output,
+                              size_t * output_len,
+                              uint8_t * auth_bytes, size_t auth_bytes_len)
+{
+  Ski ski = get_default_ski();
+  uint64_t timer = kmyth_timer_begin();
+
+  if (parse_ski_bytes(input, input_len, &ski))
+  {
+    kmyth_log(LOG_ERR, "error parsing ski string ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+  kmyth_timer_end(KMYTH_PHASE_SKI_PARSE, timer);
+
+  if (ski.bundle)
+  {
+    kmyth_log(LOG_ERR, "input is a multi-payload bundle .ski, "
+              "use kmyth_tpm_context_unseal_bundle() ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+
+  // the size of compressed data is only known once it is decompressed
+  if (into && ski.compression != KMYTH_COMPRESSION_NONE)
+  {
+    kmyth_log(LOG_ERR, "input is a compressed .ski, which needs an "
+              "allocated output ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+
+  // a NULL caller-provided buffer asks for the plaintext size, which the
+  // cipher can bound without the wrapping key (so without the TPM)
+  if (into && *output == NULL)
+  {
+    int retval = kmyth_decrypt_data_into(NULL,
+                                         (unsigned char *) ski.enc_data,
+                                         ski.enc_data_size, ski.cipher,
+                                         NULL, 0, NULL, output_len);
+
+    free_ski(&ski);
+    if (retval)
+    {
+      kmyth_log(LOG_ERR, "unable to size unsealed output ... exiting");
+      return 1;
+    }
+    return 0;
+  }
+
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "TPM context not open ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+
+  uint8_t *key = NULL;
+  size_t key_len = 0;
+
+  // the TPM commands (and SK cache) are serialized by the context's
+  // TPM lock, the decryption below runs outside of it
+  pthread_mutex_lock(&ctx->tpm_lock);
+  int retval = unseal_ski_wrapping_key(ctx, &ski, auth_bytes, auth_bytes_len,
+                                       &key, &key_len);
+
+  pthread_mutex_unlock(&ctx->tpm_lock);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error unsealing wrapping key ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+
+  timer = kmyth_timer_begin();
+  kmyth_cipher_ctx *cipher_ctx = acquire_cipher_ctx(ctx);
+
+  if (range_offset != NULL)
+  {
+    retval = kmyth_decrypt_data_range(cipher_ctx,
+                                      (unsigned char *) ski.enc_data,
+                                      ski.enc_data_size,
+                                      ski.cipher,
+                                      (unsigned char *) key, key_len,
+                                      *range_offset, *output, *output_len);
+  }
+  else if (into)
+  {
+    retval = kmyth_decrypt_data_into(cipher_ctx,
+                                     (unsigned char *) ski.enc_data,
+                                     ski.enc_data_size,
+                                     ski.cipher,
+                                     (unsigned char *) key, key_len,
+                                     *output, output_len);
+  }
+  else if (ski.cipher.decrypt_in_place_fn != NULL)
+  {
+    // the parsed ciphertext is not needed afterwards, so it is decrypted
+    // in place and its buffer handed to the caller, keeping peak memory
+    // at about one copy of the payload
+    retval = kmyth_decrypt_data_in_place(cipher_ctx,
+                                         (unsigned char *) ski.enc_data,
+                                         ski.enc_data_size,
+                                         ski.cipher,
+                                         (unsigned char *) key, key_len,
+                                         output_len);
+    if (retval == 0)
+    {
+      *output = ski.enc_data;
+      ski.enc_data = NULL;
+      ski.enc_data_size = 0;
+    }
+  }
+  else
+  {
+    retval = kmyth_decrypt_data_with_ctx(cipher_ctx,
+                                         (unsigned char *) ski.enc_data,
+                                         ski.enc_data_size,
+                                         ski.cipher,
+                                         (unsigned char *) key, key_len,
+                                         output, output_len);
+  }
+  release_cipher_ctx(ctx, cipher_ctx);
+  kmyth_timer_end(KMYTH_PHASE_DECRYPT, timer);
+  kmyth_secure_free(key, key_len);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error decrypting data ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+
+  if (ski.compression != KMYTH_COMPRESSION_NONE &&
+      decompress_payload(ski.compression, output, output_len))
+  {
+    free_ski(&ski);
+    return 1;
+  }
+
+  // done, so free any allocated resources that remain
+  free_ski(&ski);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_tpm_context_unseal()
+//############################################################################
+int kmyth_tpm_context_unseal(kmyth_tpm_context * ctx,
+                             uint8_t * input,
+                             size_t input_len,
+                             uint8_t ** output,
+                             size_t * output_len,
+                             uint8_t * auth_bytes, size_t auth_bytes_len)
+{
+  return unseal_ski_payload(ctx, input, input_len, false, NULL,
+                            output, output_len, auth_bytes, auth_bytes_len);
+}
+
+//############################################################################
+// kmyth_tpm_context_unseal_into()
+//############################################################################
+int kmyth_tpm_context_unseal_into(kmyth_tpm_context * ctx,
+                                  uint8_t * input,
+                                  size_t input_len,
+                                  uint8_t * output,
+                                  size_t * output_len,
+                                  uint8_t * auth_bytes,
+                                  size_t auth_bytes_len)
+{
+  if (output_len == NULL)
+  {
+    kmyth_log(LOG_ERR, "no output length specified ... exiting");
+    return 1;
+  }
+
+  return unseal_ski_payload(ctx, input, input_len, true, NULL,
+                            &output, output_len, auth_bytes, auth_bytes_len);
+}
+
+//############################################################################
+// kmyth_ski_get_compression()
+//############################################################################
+int kmyth_ski_get_compression(uint8_t * input, size_t input_len,
+                              kmyth_compression * compression)
+{
+  SkiView view;
+
+  if (compression == NULL)
+  {
+    kmyth_log(LOG_ERR, "no compression output specified ... exiting");
+    return 1;
+  }
+  if (open_ski_view(input, input_len, &view))
+  {
+    kmyth_log(LOG_ERR, "error parsing ski string ... exiting");
+    return 1;
+  }
+  *compression = view.ski.compression;
+  free_ski_view(&view);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_tpm_context_unseal_range()
+//############################################################################
+int kmyth_tpm_context_unseal_range(kmyth_tpm_context * ctx,
+                                   uint8_t * input,
+                                   size_t input_len,
+                                   size_t offset,
+                                   uint8_t * output,
+                                   size_t * output_len,
+                                   uint8_t * auth_bytes,
+                                   size_t auth_bytes_len)
+{
+  if (output_len == NULL)
+  {
+    kmyth_log(LOG_ERR, "no output length specified ... exiting");
+    return 1;
+  }
+
+  // a size query is answered as for kmyth_tpm_context_unseal_into()
+  return unseal_ski_payload(ctx, input, input_len, true,
+                            (output == NULL) ? NULL : &offset,
+                            &output, output_len, auth_bytes, auth_bytes_len);
+}
+
+//############################################################################
+// kmyth_tpm_context_unseal_bundle()
+//############################################################################
+int kmyth_tpm_context_unseal_bundle(kmyth_tpm_context * ctx,
+                                    uint8_t * input,
+                                    size_t input_len,
+                                    uint8_t *** outputs,
+                                    size_t ** output_lens,
+                                    size_t * output_count,
+                                    uint8_t * auth_bytes,
+                                    size_t auth_bytes_len)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "TPM context not open ... exiting");
+    return 1;
+  }
+
+  Ski ski = get_default_ski();
+  uint64_t timer = kmyth_timer_begin();
+
+  if (parse_ski_bytes(input, input_len, &ski))
+  {
+    kmyth_log(LOG_ERR, "error parsing ski string ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+  kmyth_timer_end(KMYTH_PHASE_SKI_PARSE, timer);
+
+  // a bundle holds any number of payloads, a standard .ski holds a single
+  // payload (treated here as a bundle of one)
+  uint8_t **enc_payloads = NULL;
+  size_t *enc_payload_sizes = NULL;
+  size_t count = 1;
+
+  if (ski.bundle)
+  {
+    if (unpack_bundle_payloads(ski.enc_data, ski.enc_data_size,
+                               &enc_payloads, &enc_payload_sizes, &count))
+    {
+      kmyth_log(LOG_ERR, "error unpacking bundle payloads ... exiting");
+      free_ski(&ski);
+      return 1;
+    }
+  }
+  else
+  {
+    enc_payloads = malloc(sizeof(uint8_t *));
+    enc_payload_sizes = malloc(sizeof(size_t));
+    if (enc_payloads == NULL || enc_payload_sizes == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to allocate payload list ... exiting");
+      free(enc_payloads);
+      free(enc_payload_sizes);
+      free_ski(&ski);
+      return 1;
+    }
+    enc_payloads[0] = ski.enc_data;
+    enc_payload_sizes[0] = ski.enc_data_size;
+  }
+
+  uint8_t **out = calloc(count, sizeof(uint8_t *));
+  size_t *out_lens = calloc(count, sizeof(size_t));
+
+  if (out == NULL || out_lens == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate output list ... exiting");
+    free(out);
+    free(out_lens);
+    free(enc_payloads);
+    free(enc_payload_sizes);
+    free_ski(&ski);
+    return 1;
+  }
+
+  uint8_t *key = NULL;
+  size_t key_len = 0;
+
+  pthread_mutex_lock(&ctx->tpm_lock);
+  int retval = unseal_ski_wrapping_key(ctx, &ski, auth_bytes, auth_bytes_len,
+                                       &key, &key_len);
+
+  pthread_mutex_unlock(&ctx->tpm_lock);
+
+  timer = kmyth_timer_begin();
+  kmyth_cipher_ctx *cipher_ctx = acquire_cipher_ctx(ctx);
+
+  for (size_t i = 0; i < count && retval == 0; i++)
+  {
+    retval = kmyth_decrypt_data_with_ctx(cipher_ctx,
+                                         enc_payloads[i],
+                                         enc_payload_sizes[i],
+                                         ski.cipher, key, key_len,
+                                         &out[i], &out_lens[i]);
+  }
+  release_cipher_ctx(ctx, cipher_ctx);
+  kmyth_timer_end(KMYTH_PHASE_DECRYPT, timer);
+
+  for (size_t i = 0; i < count && retval == 0 &&
+       ski.compression != KMYTH_COMPRESSION_NONE; i++)
+  {
+    retval = decompress_payload(ski.compression, &out[i], &out_lens[i]);
+  }
+
+  free(enc_payloads);
+  free(enc_payload_sizes);
+  free_ski(&ski);
+  kmyth_secure_free(key, key_len);
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error unsealing bundle ... exiting");
+    for (size_t i = 0; i < count; i++)
+    {
+      kmyth_clear_and_free(out[i], out_lens[i]);
+    }
+    free(out);
+    free(out_lens);
+    return 1;
+  }
+
+  *outputs = out;
+  *output_lens = out_lens;
+  *output_count = count;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_tpm_context_seal_stream()
+//############################################################################
+int kmyth_tpm_context_seal_stream(kmyth_tpm_context * ctx,
+                                  FILE * input,
+                                  FILE * output,
+                                  uint8_t * auth_bytes,
+                                  size_t auth_bytes_len,
+                                  int *pcrs, size_t pcrs_len,
+                                  char *cipher_string)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "TPM context not open ... exiting");
+    return 1;
+  }
+  if (input == NULL || output == NULL)
+  {
+    kmyth_log(LOG_ERR, "no input or output stream ... exiting");
+    return 1;
+  }
+
+  Ski ski = get_default_ski();
+
+  ski.compression = ctx->compression;
+
+  //obtain cipher function - it must be able to encrypt incrementally
+  if (cipher_string == NULL)
+  {
+    cipher_string = KMYTH_DEFAULT_STREAM_CIPHER;
+  }
+  ski.cipher = kmyth_get_cipher_t_from_string(cipher_string);
+
+  if (ski.cipher.cipher_name == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid cipher: %s ... exiting", cipher_string);
+    return 1;
+  }
+  if (ski.cipher.encrypt_stream_fn == NULL)
+  {
+    kmyth_log(LOG_ERR, "cipher (%s) cannot seal a stream ... exiting",
+              cipher_string);
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "cipher: %s", ski.cipher.cipher_name);
+
+  // The wrapping key is generated and sealed before any input is read, so
+  // that the .ski header can be written ahead of the encrypted data
+  size_t wrapKey_size = get_key_len_from_cipher(ski.cipher) / 8;
+  unsigned char *wrapKey = kmyth_secure_alloc(wrapKey_size);
+
+  if (wrapKey == NULL || !RAND_priv_bytes(wrapKey, (int) wrapKey_size))
+  {
+    kmyth_log(LOG_ERR, "unable to create the wrapping key ... exiting");
+    kmyth_secure_free(wrapKey, wrapKey_size);
+    return 1;
+  }
+
+  TPM2B_AUTH objAuthVal = {.size = 0, };
+  if (create_authVal(auth_bytes, auth_bytes_len, &objAuthVal))
+  {
+    kmyth_log(LOG_ERR, "error creating authorization value ... exiting");
+    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+    kmyth_secure_free(wrapKey, wrapKey_size);
+    return 1;
+  }
+
+  pthread_mutex_lock(&ctx->tpm_lock);
+  int retval = seal_ski_wrapping_key(ctx, &ski, wrapKey, wrapKey_size,
+                                     objAuthVal, pcrs, pcrs_len);
+
+  pthread_mutex_unlock(&ctx->tpm_lock);
+  kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unable to seal data ... exiting");
+    kmyth_secure_free(wrapKey, wrapKey_size);
+    free_ski(&ski);
+    return 1;
+  }
+
+  uint8_t *header = NULL;
+  size_t header_len = 0;
+  uint64_t timer = kmyth_timer_begin();
+
+  retval = create_ski_stream_header(ski, &header, &header_len);
+  kmyth_timer_end(KMYTH_PHASE_SKI_ENCODE, timer);
+  if (retval || fwrite(header, 1, header_len, output) != header_len)
+  {
+    kmyth_log(LOG_ERR, "error writing .ski header ... exiting");
+    kmyth_secure_free(wrapKey, wrapKey_size);
+    free_ski(&ski);
+    free(header);
+    return 1;
+  }
+  free(header);
+
+  // the data is encrypted as it is read, one segment at a time - when it
+  // is compressed, the cipher reads it through the compressor, which
+  // reads the input a block at a time as it is needed (so the time spent
+  // compressing is counted as encryption)
+  FILE *plain_input = input;
+
+  if (ski.compression != KMYTH_COMPRESSION_NONE)
+  {
+    plain_input = kmyth_compress_reader(input, ski.compression);
+    if (plain_input == NULL)
+    {
+      kmyth_secure_free(wrapKey, wrapKey_size);
+      free_ski(&ski);
+      return 1;
+    }
+  }
+
+  timer = kmyth_timer_begin();
+  retval = ski.cipher.encrypt_stream_fn(wrapKey, wrapKey_size,
+                                        plain_input, output);
+  if (plain_input != input && fclose(plain_input) != 0)
+  {
+    retval = 1;
+  }
+  if (retval == 0 && fflush(output) != 0)
+  {
+    retval = 1;
+  }
+  kmyth_timer_end(KMYTH_PHASE_ENCRYPT, timer);
+  kmyth_secure_free(wrapKey, wrapKey_size);
+  free_ski(&ski);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unable to encrypt (wrap) data stream ... exiting");
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// read_stream_remainder()
+//############################################################################
+static int read_stream_remainder(FILE * input,
+                                 uint8_t * prefix, size_t prefix_len,
+                                 uint8_t ** output, size_t * output_len)
+{
+  size_t capacity = (prefix_len > 4096) ? prefix_len * 2 : 8192;
+  uint8_t *buffer = malloc(capacity);
+
+  if (buffer == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate input buffer ... exiting");
+    return 1;
+  }
+  if (prefix_len > 0)
+  {
+    memcpy(buffer, prefix, prefix_len);
+  }
+
+  size_t length = prefix_len;
+
+  while (!feof(input))
+  {
+    if (length == capacity)
+    {
+      uint8_t *grown = (capacity > SIZE_MAX / 2) ? NULL :
+        realloc(buffer, capacity * 2);
+
+      if (grown == NULL)
+      {
+        kmyth_log(LOG_ERR, "unable to grow input buffer ... exiting");
+        free(buffer);
+        return 1;
+      }
+      buffer = grown;
+      capacity *= 2;
+    }
+    length += fread(buffer + length, 1, capacity - length, input);
+    if (ferror(input))
+    {
+      kmyth_log(LOG_ERR, "error reading input stream ... exiting");
+      free(buffer);
+      return 1;
+    }
+  }
+
+  *output = buffer;
+  *output_len = length;
+  return 0;
+}
+
+//############################################################################
+// unseal_buffered_stream()
+//############################################################################
+static int unseal_buffered_stream(kmyth_tpm_context * ctx,
+                                  FILE * input, FILE * output,
+                                  uint8_t * prefix, size_t prefix_len,
+                                  uint8_t * auth_bytes, size_t auth_bytes_len)
+{
+  uint8_t *ski_bytes = NULL;
+  size_t ski_bytes_len = 0;
+  uint8_t *plain = NULL;
+  size_t plain_len = 0;
+
+  if (read_stream_remainder(input, prefix, prefix_len,
+                            &ski_bytes, &ski_bytes_len))
+  {
+    return 1;
+  }
+
+  int retval = kmyth_tpm_context_unseal(ctx, ski_bytes, ski_bytes_len,
+                                        &plain, &plain_len,
+                                        auth_bytes, auth_bytes_len);
+
+  free(ski_bytes);
+  if (retval == 0 && (fwrite(plain, 1, plain_len, output) != plain_len ||
+                      fflush(output) != 0))
+  {
+    kmyth_log(LOG_ERR, "error writing unsealed data ... exiting");
+    retval = 1;
+  }
+  kmyth_clear_and_free(plain, plain_len);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_tpm_context_unseal_stream()
+//############################################################################
+int kmyth_tpm_context_unseal_stream(kmyth_tpm_context * ctx,
+                                    FILE * input,
+                                    FILE * output,
+                                    uint8_t * auth_bytes,
+                                    size_t auth_bytes_len)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "TPM context not open ... exiting");
+    return 1;
+  }
+  if (input == NULL || output == NULL)
+  {
+    kmyth_log(LOG_ERR, "no input or output stream ... exiting");
+    return 1;
+  }
+
+  // only the binary format can be read a section at a time, a text .ski
+  // is read in full and unsealed as usual
+  uint8_t magic[KMYTH_SKI_BINARY_MAGIC_LEN];
+  size_t magic_len = fread(magic, 1, sizeof(magic), input);
+
+  if (magic_len != sizeof(magic) ||
+      memcmp(magic, KMYTH_SKI_BINARY_MAGIC, sizeof(magic)) != 0)
+  {
+    return unseal_buffered_stream(ctx, input, output, magic, magic_len,
+                                  auth_bytes, auth_bytes_len);
+  }
+
+  uint8_t *header = NULL;
+  size_t header_len = 0;
+  uint64_t enc_data_size = 0;
+  Ski ski = get_default_ski();
+  uint64_t timer = kmyth_timer_begin();
+
+  if (read_ski_stream_header(input, magic, magic_len, &header, &header_len)
+      || parse_ski_stream_header(header, header_len, &ski, &enc_data_size))
+  {
+    kmyth_log(LOG_ERR, "error parsing .ski header ... exiting");
+    free(header);
+    free_ski(&ski);
+    return 1;
+  }
+  kmyth_timer_end(KMYTH_PHASE_SKI_PARSE, timer);
+
+  if (ski.bundle)
+  {
+    kmyth_log(LOG_ERR, "input is a multi-payload bundle .ski, "
+              "use kmyth_tpm_context_unseal_bundle() ... exiting");
+    free(header);
+    free_ski(&ski);
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "retrieved SRK handle (0x%08X)", storageRootKey_handle);
 
-  // We create a storage key (SK) that we will use to seal a symmetric
-  // wrapping key that we will create and use to encrypt the user input data.
-  // This storage key will be sealed to the SRK (its parent is the SRK).
-  TPM2_HANDLE storageKey_handle = 0;
-
-  if (create_and_load_sk(sapi_ctx,
-                         storageRootKey_handle,
-                         ownerAuth,
-                         objAuthVal,
-                         ski.pcr_list,
-                         objAuthPolicy,
-                         &storageKey_handle, &ski.sk_priv, &ski.sk_pub))
+  // a cipher that cannot decrypt incrementally needs the whole .ski (a
+  // stream .ski always has a cipher that can)
+  if (ski.cipher.decrypt_stream_fn == NULL)
   {
-    kmyth_log(LOG_ERR, "failed to create and load a storage key ... exiting");
+    free_ski(&ski);
 
-    // clear potential 'auth' data, free TPM resources before exiting early
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
-    free_tpm2_resources(&sapi_ctx);
-    return 1;
+    int retval = unseal_buffered_stream(ctx, input, output,
+                                        header, header_len,
+                                        auth_bytes, auth_bytes_len);
+
+    free(header);
+    return retval;
   }
+  free(header);
 
-  // Done with owner hierarchy authorization - SRK and SK available in TPM
-  kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+  uint8_t *key = NULL;
+  size_t key_len = 0;
 
-  // Wrap input data -
-  //   - The data to be encrypted is contained in a file and the path to that
-  //     file is specified by the user.
-  //   - The encryption uses the symmetric 'cipher' specified by the user.
-  //   - The symmetric wrapping key used for encryption
-  kmyth_log(LOG_DEBUG, "wrapping input data");
-  size_t wrapKey_size = get_key_len_from_cipher(ski.cipher) / 8;
-  unsigned char *wrapKey = calloc(wrapKey_size, sizeof(unsigned char));
+  pthread_mutex_lock(&ctx->tpm_lock);
+  int retval = unseal_ski_wrapping_key(ctx, &ski, auth_bytes, auth_bytes_len,
+                                       &key, &key_len);
 
-  if (wrapKey == NULL)
+  pthread_mutex_unlock(&ctx->tpm_lock);
+  if (retval)
   {
-    kmyth_log(LOG_ERR,
-              "unable to allocate memory for the wrapping key ... exiting");
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "error unsealing wrapping key ... exiting");
+    free_ski(&ski);
     return 1;
   }
 
-  // validate non-empty plaintext buffer specified
-  if (input_len == 0 || input == NULL)
+  // compressed data is decompressed as the cipher writes it out, a block
+  // at a time
+  FILE *plain_output = output;
+
+  if (ski.compression != KMYTH_COMPRESSION_NONE)
   {
-    kmyth_log(LOG_ERR, "no input data ... exiting");
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    free_tpm2_resources(&sapi_ctx);
-    return 1;
+    plain_output = kmyth_decompress_writer(output, ski.compression);
+    if (plain_output == NULL)
+    {
+      free_ski(&ski);
+      kmyth_secure_free(key, key_len);
+      return 1;
+    }
   }
 
-  // encrypt (wrap) input data read in (e.g., client certificate private .pem)
-  if (kmyth_encrypt_data(input, input_len,
-                         ski.cipher, &ski.enc_data, &ski.enc_data_size,
-                         &wrapKey, &wrapKey_size))
+  // the encrypted data (the rest of the input, whichever way its size was
+  // recorded) authenticates its own end, so it is simply read to EOF
+  timer = kmyth_timer_begin();
+  retval = ski.cipher.decrypt_stream_fn((unsigned char *) key, key_len,
+                                        input, plain_output);
+  if (plain_output != output && fclose(plain_output) != 0)
   {
-    kmyth_log(LOG_ERR, "unable to encrypt (wrap) data ... exiting");
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    free_tpm2_resources(&sapi_ctx);
+    retval = 1;
+  }
+  if (retval == 0 && fflush(output) != 0)
+  {
+    retval = 1;
+  }
+  kmyth_timer_end(KMYTH_PHASE_DECRYPT, timer);
+  free_ski(&ski);
+  kmyth_secure_free(key, key_len);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error decrypting data stream ... exiting");
     return 1;
   }
 
-  kmyth_log(LOG_DEBUG, "input data wrapped");
+  return 0;
+}
+
+//############################################################################
+// tpm2_kmyth_seal()
+//############################################################################
+int tpm2_kmyth_seal(uint8_t * input,
+                    size_t input_len,
+                    uint8_t ** output,
+                    size_t * output_len,
+                    uint8_t * auth_bytes,
+                    size_t auth_bytes_len,
+                    uint8_t * owner_auth_bytes,
+                    size_t oa_bytes_len, int *pcrs, size_t pcrs_len,
+                    char *cipher_string)
+{
+  // single-shot seal: open a TPM context, use it once, close it
+  kmyth_tpm_context *ctx = NULL;
 
-  // Seal the wrapping key to the TPM using the Storage Key (SK)
-  if (tpm2_kmyth_seal_data(sapi_ctx,
-                           wrapKey,
-                           wrapKey_size,
-                           storageKey_handle,
-                           objAuthVal,
-                           ski.pcr_list,
-                           objAuthVal,
-                           ski.pcr_list,
-                           objAuthPolicy, &ski.wk_pub, &ski.wk_priv))
+  if (kmyth_tpm_context_open(owner_auth_bytes, oa_bytes_len, &ctx))
   {
-    kmyth_log(LOG_ERR, "unable to seal data ... exiting");
-    kmyth_clear_and_free(wrapKey, wrapKey_size);
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "unable to open TPM context ... exiting");
     return 1;
   }
 
-  // Clean-up:
-  //   - done with unencrypted wrapping key (now have sealed version)
-  //   - done with authVal
-  kmyth_clear_and_free(wrapKey, wrapKey_size);
-  kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-
-  if (create_ski_bytes(ski, output, output_len))
+  if (kmyth_tpm_context_seal(ctx,
+                             input, input_len,
+                             output, output_len,
+                             auth_bytes, auth_bytes_len,
+                             pcrs, pcrs_len, cipher_string))
   {
-    kmyth_log(LOG_ERR, "error writing data to .ski format ... exiting");
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "unable to kmyth-seal data ... exiting");
+    kmyth_tpm_context_close(&ctx);
     return 1;
   }
 
-  free_ski(&ski);
   // done, so free any allocated resources that remain
-  free_tpm2_resources(&sapi_ctx);
+  kmyth_tpm_context_close(&ctx);
 
   return 0;
 }
@@ -287,144 +3354,232 @@ int tpm2_kmyth_unseal(uint8_t * input,
                       size_t auth_bytes_len,
                       uint8_t * owner_auth_bytes, size_t oa_bytes_len)
 {
-  // Initialize connection to TPM 2.0 resource manager
-  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+  // single-shot unseal: open a TPM context, use it once, close it
+  kmyth_tpm_context *ctx = NULL;
 
-  if (init_tpm2_connection(&sapi_ctx))
+  if (kmyth_tpm_context_open(owner_auth_bytes, oa_bytes_len, &ctx))
   {
-    kmyth_log(LOG_ERR, "unable to init connection to TPM2 resource manager");
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "unable to open TPM context ... exiting");
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "initialized connection to TPM 2.0 resource manager");
 
-  // Create owner (storage) hierarchy authorization structure
-  // to provide password session authorization criteria for use of:
-  //   - Storage Root Key (SRK)
-  //   - Storage Primary Seed (SPS), if necessary to re-derive SRK
-  TPM2B_AUTH ownerAuth;
+  if (kmyth_tpm_context_unseal(ctx,
+                               input, input_len,
+                               output, output_len,
+                               auth_bytes, auth_bytes_len))
+  {
+    kmyth_log(LOG_ERR, "unable to kmyth-unseal data ... exiting");
+    kmyth_tpm_context_close(&ctx);
+    return 1;
+  }
 
-  ownerAuth.size = oa_bytes_len;
-  if (owner_auth_bytes != NULL && oa_bytes_len > 0)
+  // done, so free any allocated resources that remain
+  kmyth_tpm_context_close(&ctx);
+
+  return 0;
+}
+
+//############################################################################
+// tpm2_kmyth_seal_into()
+//############################################################################
+int tpm2_kmyth_seal_into(uint8_t * input,
+                         size_t input_len,
+                         uint8_t * output,
+                         size_t * output_len,
+                         uint8_t * auth_bytes,
+                         size_t auth_bytes_len,
+                         uint8_t * owner_auth_bytes,
+                         size_t oa_bytes_len, int *pcrs, size_t pcrs_len,
+                         char *cipher_string)
+{
+  // single-shot seal: open a TPM context, use it once, close it
+  kmyth_tpm_context *ctx = NULL;
+
+  if (kmyth_tpm_context_open(owner_auth_bytes, oa_bytes_len, &ctx))
   {
-    memcpy(ownerAuth.buffer, owner_auth_bytes, ownerAuth.size);
+    kmyth_log(LOG_ERR, "unable to open TPM context ... exiting");
+    return 1;
   }
 
-  if (ownerAuth.size > 0)
+  if (kmyth_tpm_context_seal_into(ctx,
+                                  input, input_len,
+                                  output, output_len,
+                                  auth_bytes, auth_bytes_len,
+                                  pcrs, pcrs_len, cipher_string))
   {
-    kmyth_log(LOG_DEBUG, "auth string for TPM storage hierarchy specified");
+    kmyth_log(LOG_ERR, "unable to kmyth-seal data ... exiting");
+    kmyth_tpm_context_close(&ctx);
+    return 1;
   }
-  // Create authorization value (authVal) to provide policy session
-  // authorization criteria for use of:
-  //   - Storage Key (SK) TPM object
-  //   - Sealed Data (wrapping key) TPM object
-  // The authVal is set to:
-  //   - all-zero digest (like TPM 1.2 well-known secret) by default
-  //   - hash of input authorization string if one is specified
-  TPM2B_AUTH objAuthValue;
 
-  if (create_authVal(auth_bytes, auth_bytes_len, &objAuthValue))
+  // done, so free any allocated resources that remain
+  kmyth_tpm_context_close(&ctx);
+
+  return 0;
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_into()
+//############################################################################
+int tpm2_kmyth_unseal_into(uint8_t * input,
+                           size_t input_len,
+                           uint8_t * output,
+                           size_t * output_len,
+                           uint8_t * auth_bytes,
+                           size_t auth_bytes_len,
+                           uint8_t * owner_auth_bytes, size_t oa_bytes_len)
+{
+  // a size query needs no TPM, so only the unseal proper opens a context
+  if (output == NULL)
   {
-    kmyth_log(LOG_ERR, "error creating authorization value ... exiting");
-    kmyth_clear(objAuthValue.buffer, objAuthValue.size);
-    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
-    free_tpm2_resources(&sapi_ctx);
+    return kmyth_tpm_context_unseal_into(NULL, input, input_len,
+                                         NULL, output_len,
+                                         auth_bytes, auth_bytes_len);
+  }
+
+  // single-shot unseal: open a TPM context, use it once, close it
+  kmyth_tpm_context *ctx = NULL;
+
+  if (kmyth_tpm_context_open(owner_auth_bytes, oa_bytes_len, &ctx))
+  {
+    kmyth_log(LOG_ERR, "unable to open TPM context ... exiting");
     return 1;
   }
 
-  // The storage root key (SRK) is the primary key for the storage hierarchy
-  // in the TPM.  We will first check to see if it is already loaded in
-  // persistent storage. We do this by getting the loaded persistent handle
-  // values, inspecting each of their their public structures, and comparing
-  // these public area parameters against those for the SRK. None of these
-  // activities require authorization. If the key is not already loaded,
-  // though, it must be re-derived using the storage hierarchy's primary
-  // seed (SPS). Use of the SPS requires owner hierarchy authorization.
-  TPM2_HANDLE storageRootKey_handle = 0;
+  if (kmyth_tpm_context_unseal_into(ctx,
+                                    input, input_len,
+                                    output, output_len,
+                                    auth_bytes, auth_bytes_len))
+  {
+    kmyth_log(LOG_ERR, "unable to kmyth-unseal data ... exiting");
+    kmyth_tpm_context_close(&ctx);
+    return 1;
+  }
+
+  // done, so free any allocated resources that remain
+  kmyth_tpm_context_close(&ctx);
+
+  return 0;
+}
 
-  if (get_srk_handle(sapi_ctx, &storageRootKey_handle, &ownerAuth))
+//############################################################################
+// tpm2_kmyth_unseal_range()
+//############################################################################
+int tpm2_kmyth_unseal_range(uint8_t * input,
+                            size_t input_len,
+                            size_t offset,
+                            uint8_t * output,
+                            size_t * output_len,
+                            uint8_t * auth_bytes,
+                            size_t auth_bytes_len,
+                            uint8_t * owner_auth_bytes, size_t oa_bytes_len)
+{
+  // a size query needs no TPM, so only the unseal proper opens a context
+  if (output == NULL)
   {
-    kmyth_log(LOG_ERR, "error obtaining handle for SRK ... exiting");
-    free_tpm2_resources(&sapi_ctx);
+    return kmyth_tpm_context_unseal_range(NULL, input, input_len, offset,
+                                          NULL, output_len,
+                                          auth_bytes, auth_bytes_len);
+  }
+
+  // single-shot unseal: open a TPM context, use it once, close it
+  kmyth_tpm_context *ctx = NULL;
+
+  if (kmyth_tpm_context_open(owner_auth_bytes, oa_bytes_len, &ctx))
+  {
+    kmyth_log(LOG_ERR, "unable to open TPM context ... exiting");
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "retrieved SRK handle (0x%08X)", storageRootKey_handle);
 
-  Ski ski = get_default_ski();
+  if (kmyth_tpm_context_unseal_range(ctx,
+                                     input, input_len, offset,
+                                     output, output_len,
+                                     auth_bytes, auth_bytes_len))
+  {
+    kmyth_log(LOG_ERR, "unable to kmyth-unseal data range ... exiting");
+    kmyth_tpm_context_close(&ctx);
+    return 1;
+  }
 
-  if (parse_ski_bytes(input, input_len, &ski))
+  // done, so free any allocated resources that remain
+  kmyth_tpm_context_close(&ctx);
+
+  return 0;
+}
+
+//############################################################################
+// tpm2_kmyth_seal_bundle()
+//############################################################################
+int tpm2_kmyth_seal_bundle(uint8_t ** inputs,
+                           size_t * input_lens,
+                           size_t input_count,
+                           uint8_t ** output,
+                           size_t * output_len,
+                           uint8_t * auth_bytes,
+                           size_t auth_bytes_len,
+                           uint8_t * owner_auth_bytes,
+                           size_t oa_bytes_len, int *pcrs, size_t pcrs_len,
+                           char *cipher_string)
+{
+  // single-shot seal: open a TPM context, use it once, close it
+  kmyth_tpm_context *ctx = NULL;
+
+  if (kmyth_tpm_context_open(owner_auth_bytes, oa_bytes_len, &ctx))
   {
-    kmyth_log(LOG_ERR, "error parsing ski string ... exiting");
-    free_ski(&ski);
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "unable to open TPM context ... exiting");
     return 1;
   }
 
-  // The Storage Key (SK) will be used by the TPM to unseal the wrapping key.
-  // We have obtained its public and encrypted private blobs from
-  // the input .ski file and will now load the SK into the TPM.
-  TPM2_HANDLE storageKey_handle = 0;
-  TPML_PCR_SELECTION emptyPcrList = {.count = 0, };
-  if (load_kmyth_object(sapi_ctx,
-                        (SESSION *) NULL,
-                        storageRootKey_handle,
-                        ownerAuth,
-                        emptyPcrList,
-                        &ski.sk_priv, &ski.sk_pub, &storageKey_handle))
+  if (kmyth_tpm_context_seal_bundle(ctx,
+                                    inputs, input_lens, input_count,
+                                    output, output_len,
+                                    auth_bytes, auth_bytes_len,
+                                    pcrs, pcrs_len, cipher_string))
   {
-    kmyth_log(LOG_ERR, "error loading storage key ... exiting");
-    free_ski(&ski);
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "unable to kmyth-seal bundle ... exiting");
+    kmyth_tpm_context_close(&ctx);
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "loaded SK at handle = 0x%08X", storageKey_handle);
 
-  // Authorization for the use of all non-primary (other than SRK), Kmyth
-  // TPM 2.0 objects utilizes policy-based enhanced authorization critera.
-  // Therefore, we will calculate the authorization policy digest that
-  // results from applying the steps of our selected authorization policy.
-  // We pass this result to the kmyth_unseal_data() function where it is
-  // used in theinto the objects we create as the
-  // authorization policy digest value that must be regenerated to authorize
-  // use of these objects.
-  TPM2B_DIGEST objAuthPolicy;
+  // done, so free any allocated resources that remain
+  kmyth_tpm_context_close(&ctx);
 
-  objAuthPolicy.size = 0;
+  return 0;
+}
 
-  uint8_t *key = NULL;
-  size_t key_len;
+//############################################################################
+// tpm2_kmyth_unseal_bundle()
+//############################################################################
+int tpm2_kmyth_unseal_bundle(uint8_t * input,
+                             size_t input_len,
+                             uint8_t *** outputs,
+                             size_t ** output_lens,
+                             size_t * output_count,
+                             uint8_t * auth_bytes,
+                             size_t auth_bytes_len,
+                             uint8_t * owner_auth_bytes, size_t oa_bytes_len)
+{
+  // single-shot unseal: open a TPM context, use it once, close it
+  kmyth_tpm_context *ctx = NULL;
 
-  // Perform "unseal" to recover data
-  if (tpm2_kmyth_unseal_data(sapi_ctx,
-                             storageKey_handle,
-                             ski.wk_pub,
-                             ski.wk_priv,
-                             objAuthValue,
-                             ski.pcr_list, objAuthPolicy, &key, &key_len))
+  if (kmyth_tpm_context_open(owner_auth_bytes, oa_bytes_len, &ctx))
   {
-    kmyth_log(LOG_ERR, "error unsealing data ... exiting");
-    free_ski(&ski);
-    free_tpm2_resources(&sapi_ctx);
-    kmyth_clear(key, key_len);
+    kmyth_log(LOG_ERR, "unable to open TPM context ... exiting");
     return 1;
   }
 
-  if (kmyth_decrypt_data((unsigned char *) ski.enc_data,
-                         ski.enc_data_size,
-                         ski.cipher,
-                         (unsigned char *) key, key_len, output, output_len))
+  if (kmyth_tpm_context_unseal_bundle(ctx,
+                                      input, input_len,
+                                      outputs, output_lens, output_count,
+                                      auth_bytes, auth_bytes_len))
   {
-    kmyth_log(LOG_ERR, "error decrypting data ... exiting");
-    free_ski(&ski);
-    free_tpm2_resources(&sapi_ctx);
-    kmyth_clear(key, key_len);
+    kmyth_log(LOG_ERR, "unable to kmyth-unseal bundle ... exiting");
+    kmyth_tpm_context_close(&ctx);
     return 1;
   }
 
   // done, so free any allocated resources that remain
-  free_ski(&ski);
-  free_tpm2_resources(&sapi_ctx);
-  kmyth_clear(key, key_len);
+  kmyth_tpm_context_close(&ctx);
 
   return 0;
 }
@@ -452,19 +3607,21 @@ int tpm2_kmyth_seal_file(char *input_path,
   uint8_t *data = NULL;
   size_t data_len = 0;
 
-  if (read_bytes_from_file(input_path, &data, &data_len))
+  // the plaintext is only read by the cipher, so map it rather than copy it
+  uint64_t timer = kmyth_timer_begin();
+
+  if (map_bytes_from_file(input_path, &data, &data_len))
   {
     kmyth_log(LOG_ERR, "seal input data file read error ... exiting");
-    free(data);
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "read in %d bytes of data to be wrapped", data_len);
+  kmyth_timer_end(KMYTH_PHASE_FILE_IO, timer);
+  kmyth_log(LOG_DEBUG, "read in %zu bytes of data to be wrapped", data_len);
 
   // validate non-empty plaintext buffer specified
   if (data_len == 0 || data == NULL)
   {
     kmyth_log(LOG_ERR, "no input data ... exiting");
-    free(data);
     return 1;
   }
 
@@ -475,13 +3632,58 @@ int tpm2_kmyth_seal_file(char *input_path,
                       pcrs, pcrs_len, cipher_string))
   {
     kmyth_log(LOG_ERR, "Failed to kmyth-seal data ... exiting");
-    free(data);
+    unmap_bytes_from_file(data, data_len);
     return (1);
   }
-  free(data);
+  unmap_bytes_from_file(data, data_len);
   return 0;
 }
 
+//############################################################################
+// tpm2_kmyth_seal_to_file()
+//############################################################################
+int tpm2_kmyth_seal_to_file(uint8_t * input,
+                            size_t input_len,
+                            char *output_path,
+                            uint8_t * auth_bytes,
+                            size_t auth_bytes_len,
+                            uint8_t * owner_auth_bytes,
+                            size_t oa_bytes_len,
+                            int *pcrs, size_t pcrs_len, char *cipher_string)
+{
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+
+  if (tpm2_kmyth_seal(input, input_len,
+                      &sealed, &sealed_len,
+                      auth_bytes, auth_bytes_len,
+                      owner_auth_bytes, oa_bytes_len,
+                      pcrs, pcrs_len, cipher_string))
+  {
+    kmyth_log(LOG_ERR, "Failed to kmyth-seal data ... exiting");
+    return 1;
+  }
+
+  int retval = 0;
+
+  if (output_path == NULL)
+  {
+    if (print_to_stdout(sealed, sealed_len))
+    {
+      kmyth_log(LOG_ERR, "error printing to stdout ... exiting");
+      retval = 1;
+    }
+  }
+  else if (write_bytes_to_file(output_path, sealed, sealed_len))
+  {
+    kmyth_log(LOG_ERR, "Error writing file: %s", output_path);
+    retval = 1;
+  }
+
+  free(sealed);
+  return retval;
+}
+
 //############################################################################
 // tpm2_kmyth_unseal_file()
 //############################################################################
@@ -495,22 +3697,89 @@ int tpm2_kmyth_unseal_file(char *input_path,
 
   uint8_t *data = NULL;
   size_t data_length = 0;
+  uint64_t timer = kmyth_timer_begin();
 
-  if (read_bytes_from_file(input_path, &data, &data_length))
+  if (map_bytes_from_file(input_path, &data, &data_length))
   {
     kmyth_log(LOG_ERR, "Unable to read file %s ... exiting", input_path);
     return (1);
   }
+  kmyth_timer_end(KMYTH_PHASE_FILE_IO, timer);
   if (tpm2_kmyth_unseal(data, data_length,
                         output, output_length, auth_bytes, auth_bytes_len,
                         owner_auth_bytes, oa_bytes_len))
   {
     kmyth_log(LOG_ERR, "Unable to unseal contents ... exiting");
-    free(data);
+    unmap_bytes_from_file(data, data_length);
     return (1);
   }
 
-  free(data);
+  unmap_bytes_from_file(data, data_length);
+  return 0;
+}
+
+//############################################################################
+// tpm2_kmyth_seal_stream()
+//############################################################################
+int tpm2_kmyth_seal_stream(FILE * input,
+                           FILE * output,
+                           uint8_t * auth_bytes,
+                           size_t auth_bytes_len,
+                           uint8_t * owner_auth_bytes,
+                           size_t oa_bytes_len,
+                           int *pcrs, size_t pcrs_len, char *cipher_string)
+{
+  // single-shot seal: open a TPM context, use it once, close it
+  kmyth_tpm_context *ctx = NULL;
+
+  if (kmyth_tpm_context_open(owner_auth_bytes, oa_bytes_len, &ctx))
+  {
+    kmyth_log(LOG_ERR, "unable to open TPM context ... exiting");
+    return 1;
+  }
+
+  if (kmyth_tpm_context_seal_stream(ctx, input, output,
+                                    auth_bytes, auth_bytes_len,
+                                    pcrs, pcrs_len, cipher_string))
+  {
+    kmyth_log(LOG_ERR, "unable to kmyth-seal data stream ... exiting");
+    kmyth_tpm_context_close(&ctx);
+    return 1;
+  }
+
+  kmyth_tpm_context_close(&ctx);
+
+  return 0;
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_stream()
+//############################################################################
+int tpm2_kmyth_unseal_stream(FILE * input,
+                             FILE * output,
+                             uint8_t * auth_bytes,
+                             size_t auth_bytes_len,
+                             uint8_t * owner_auth_bytes, size_t oa_bytes_len)
+{
+  // single-shot unseal: open a TPM context, use it once, close it
+  kmyth_tpm_context *ctx = NULL;
+
+  if (kmyth_tpm_context_open(owner_auth_bytes, oa_bytes_len, &ctx))
+  {
+    kmyth_log(LOG_ERR, "unable to open TPM context ... exiting");
+    return 1;
+  }
+
+  if (kmyth_tpm_context_unseal_stream(ctx, input, output,
+                                      auth_bytes, auth_bytes_len))
+  {
+    kmyth_log(LOG_ERR, "unable to kmyth-unseal data stream ... exiting");
+    kmyth_tpm_context_close(&ctx);
+    return 1;
+  }
+
+  kmyth_tpm_context_close(&ctx);
+
   return 0;
 }
 
@@ -518,6 +3787,7 @@ int tpm2_kmyth_unseal_file(char *input_path,
 // tpm2_kmyth_seal_data
 //############################################################################
 int tpm2_kmyth_seal_data(TSS2_SYS_CONTEXT * sapi_ctx,
+                         SESSION * policySession,
                          uint8_t * sdo_data,
                          int sdo_dataSize,
                          TPM2_HANDLE sk_handle,
@@ -558,19 +3828,27 @@ int tpm2_kmyth_seal_data(TSS2_SYS_CONTEXT * sapi_ctx,
     return 1;
   }
 
-  // Start a TPM 2.0 policy session that we will use to authorize the use of
-  // storage key (SK) to create the sealed wrapping key object
+  // Unless the caller supplies one, start a TPM 2.0 policy session that we
+  // will use to authorize the use of storage key (SK) to create the sealed
+  // wrapping key object
   SESSION sealData_session;
+  uint64_t timer = kmyth_timer_begin();
 
-  if (create_policy_auth_session(sapi_ctx, &sealData_session))
+  if (policySession == NULL)
   {
-    kmyth_log(LOG_ERR, "error starting auth policy session ... exiting");
-    return 1;
+    if (create_policy_auth_session(sapi_ctx, &sealData_session))
+    {
+      kmyth_log(LOG_ERR, "error starting auth policy session ... exiting");
+      return 1;
+    }
+    policySession = &sealData_session;
+    kmyth_timer_end(KMYTH_PHASE_POLICY_SESSION, timer);
   }
 
   // create sealed data object
+  timer = kmyth_timer_begin();
   if (create_kmyth_object(sapi_ctx,
-                          &sealData_session,
+                          policySession,
                           sk_handle,
                           sk_authVal,
                           sk_pcrList,
@@ -580,18 +3858,28 @@ int tpm2_kmyth_seal_data(TSS2_SYS_CONTEXT * sapi_ctx,
                           (TPM2_HANDLE) 0, sdo_private, sdo_public))
   {
     kmyth_log(LOG_ERR, "could not seal data ... exiting");
+    if (policySession == &sealData_session)
+    {
+      Tss2_Sys_FlushContext(sapi_ctx, sealData_session.sessionHandle);
+    }
     return 1;
   }
+  kmyth_timer_end(KMYTH_PHASE_TPM_SEAL, timer);
   kmyth_log(LOG_DEBUG, "created sealed data (wrapping key) object");
 
+  // A session supplied by the caller is left to the caller
+  if (policySession != &sealData_session)
+  {
+    return 0;
+  }
+
   // Clean-up: done with the policy authorization session setup to enable
   //           creation of the sealed data object, so flush it from the TPM
   TSS2_RC rc = Tss2_Sys_FlushContext(sapi_ctx, sealData_session.sessionHandle);
 
   if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "Tss2_Sys_FlushContext(): rc = 0x%08X, %s",
-              rc, getErrorString(rc));
+    kmyth_log_tpm_rc("Tss2_Sys_FlushContext", rc);
     kmyth_log(LOG_ERR,
               "error flushing policy session (handle = 0x%08X) ... exiting",
               sealData_session.sessionHandle);
@@ -608,6 +3896,7 @@ int tpm2_kmyth_seal_data(TSS2_SYS_CONTEXT * sapi_ctx,
 // tpm2_kmyth_unseal_data()
 //############################################################################
 int tpm2_kmyth_unseal_data(TSS2_SYS_CONTEXT * sapi_ctx,
+                           SESSION * policySession,
                            TPM2_HANDLE sk_handle,
                            TPM2B_PUBLIC sdo_public,
                            TPM2B_PRIVATE sdo_private,
@@ -616,29 +3905,40 @@ int tpm2_kmyth_unseal_data(TSS2_SYS_CONTEXT * sapi_ctx,
                            TPM2B_DIGEST authPolicy,
                            uint8_t ** result, size_t * result_size)
 {
-  // Start a TPM 2.0 policy session that we will use to authorize the use of
-  // storage key (SK) to:
+  // Unless the caller supplies one, start a TPM 2.0 policy session that we
+  // will use to authorize the use of storage key (SK) to:
   //   1. load the sealed data object into the TPM as a child of the SK
   //   2. unseal it in order to retrieve the wrapping key
   SESSION unsealData_session;
+  uint64_t timer = kmyth_timer_begin();
 
-  if (create_policy_auth_session(sapi_ctx, &unsealData_session))
+  if (policySession == NULL)
   {
-    kmyth_log(LOG_ERR, "error starting auth policy session ... exiting");
-    return 1;
+    if (create_policy_auth_session(sapi_ctx, &unsealData_session))
+    {
+      kmyth_log(LOG_ERR, "error starting auth policy session ... exiting");
+      return 1;
+    }
+    policySession = &unsealData_session;
+    kmyth_timer_end(KMYTH_PHASE_POLICY_SESSION, timer);
   }
 
   // Load sealed data object into the TPM so that we can unseal it
   // It gets loaded under the storage key (authEntity for this command)
   TPM2_HANDLE sdo_handle = 0;
 
+  timer = kmyth_timer_begin();
   if (load_kmyth_object(sapi_ctx,
-                        &unsealData_session,
+                        policySession,
                         sk_handle,
                         authVal,
                         pcrList, &sdo_private, &sdo_public, &sdo_handle))
   {
     kmyth_log(LOG_ERR, "load error: sealed data object ... exiting");
+    if (policySession == &unsealData_session)
+    {
+      Tss2_Sys_FlushContext(sapi_ctx, unsealData_session.sessionHandle);
+    }
     return 1;
   }
   kmyth_log(LOG_DEBUG, "loaded sealed data object at handle = 0x%08X",
@@ -647,7 +3947,7 @@ int tpm2_kmyth_unseal_data(TSS2_SYS_CONTEXT * sapi_ctx,
   // Unseal the data object just loaded into the TPM (e.g., sealed wrap key)
   TPM2B_SENSITIVE_DATA unseal_sensitive = {.size = 0, };
   if (unseal_kmyth_object(sapi_ctx,
-                          &unsealData_session,
+                          policySession,
                           sdo_handle, authVal, pcrList, &unseal_sensitive))
   {
     kmyth_log(LOG_ERR, "error unsealing ... exiting");
@@ -655,32 +3955,55 @@ int tpm2_kmyth_unseal_data(TSS2_SYS_CONTEXT * sapi_ctx,
     // overwrite any potentially unsealed data before exiting early due
     // to failed unseal
     kmyth_clear(unseal_sensitive.buffer, unseal_sensitive.size);
+    flush_tpm2_object(sapi_ctx, sdo_handle);
+    if (policySession == &unsealData_session)
+    {
+      Tss2_Sys_FlushContext(sapi_ctx, unsealData_session.sessionHandle);
+    }
     return 1;
   }
+  kmyth_timer_end(KMYTH_PHASE_TPM_UNSEAL, timer);
   kmyth_log(LOG_DEBUG, "unsealed data object (handle = 0x%08X)", sdo_handle);
 
+  // Clean-up: done with the sealed data object, so flush it from the TPM
+  if (flush_tpm2_object(sapi_ctx, sdo_handle))
+  {
+    kmyth_log(LOG_ERR, "error flushing sealed data object ... exiting");
+    kmyth_clear(unseal_sensitive.buffer, unseal_sensitive.size);
+    return 1;
+  }
+
   // Clean-up: done with the policy authorization session setup to enable
   //           loading and unsealing of the sealed data object, so
-  //           flush it from the TPM
-  TSS2_RC rc = Tss2_Sys_FlushContext(sapi_ctx,
-                                     unsealData_session.sessionHandle);
-
-  if (rc != TSS2_RC_SUCCESS)
+  //           flush it from the TPM (a session supplied by the caller is
+  //           left to the caller)
+  if (policySession == &unsealData_session)
   {
-    kmyth_log(LOG_ERR,
-              "Tss2_Sys_FlushContext(): rc = 0x%08X, %s",
-              rc, getErrorString(rc));
-    kmyth_log(LOG_ERR,
-              "error flushing policy session (handle = 0x%08X) ... exiting",
+    TSS2_RC rc = Tss2_Sys_FlushContext(sapi_ctx,
+                                       unsealData_session.sessionHandle);
+
+    if (rc != TSS2_RC_SUCCESS)
+    {
+      kmyth_log_tpm_rc("Tss2_Sys_FlushContext", rc);
+      kmyth_log(LOG_ERR,
+                "error flushing policy session (handle = 0x%08X) ... exiting",
+                unsealData_session.sessionHandle);
+      kmyth_clear(unseal_sensitive.buffer, unseal_sensitive.size);
+      return 1;
+    }
+    kmyth_log(LOG_DEBUG, "flushed policy auth session (handle = 0x%08X)",
               unsealData_session.sessionHandle);
+  }
+
+  // the unsealed data (e.g., a wrapping key) is handed back in locked memory
+  *result = kmyth_secure_alloc(unseal_sensitive.size);
+  if (*result == NULL)
+  {
+    kmyth_log(LOG_ERR, "error allocating unsealed data buffer ... exiting");
     kmyth_clear(unseal_sensitive.buffer, unseal_sensitive.size);
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "flushed policy auth session (handle = 0x%08X)",
-            unsealData_session.sessionHandle);
-
   *result_size = unseal_sensitive.size;
-  *result = (uint8_t *) malloc(*result_size);
 
   memcpy(*result, unseal_sensitive.buffer, *result_size);
   kmyth_clear(unseal_sensitive.buffer, unseal_sensitive.size);
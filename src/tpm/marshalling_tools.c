@@ -14,7 +14,407 @@
 #include <openssl/evp.h>
 #include <tss2/tss2_mu.h>
 
+#include "base64_codec.h"
+#include "byte_builder.h"
 #include "defines.h"
+#include "timing_util.h"
+
+//############################################################################
+// get_ski_binary_size()
+//############################################################################
+static int get_ski_binary_size(size_t * section_sizes, size_t * total_size)
+{
+  *total_size = KMYTH_SKI_BINARY_HEADER_LEN;
+
+  for (size_t i = 0; i < KMYTH_SKI_BINARY_SECTION_COUNT; i++)
+  {
+    if (section_sizes[i] > SIZE_MAX - *total_size - sizeof(uint64_t))
+    {
+      kmyth_log(LOG_ERR, "binary .ski section too large ... exiting");
+      return 1;
+    }
+    *total_size += sizeof(uint64_t) + section_sizes[i];
+  }
+
+  return 0;
+}
+
+//############################################################################
+// get_ski_text_delims()
+//############################################################################
+static void get_ski_text_delims(bool bundle, char **delims)
+{
+  delims[0] = KMYTH_DELIM_PCR_SELECTION_LIST;
+  delims[1] = KMYTH_DELIM_STORAGE_KEY_PUBLIC;
+  delims[2] = KMYTH_DELIM_STORAGE_KEY_PRIVATE;
+  delims[3] = KMYTH_DELIM_CIPHER_SUITE;
+  delims[4] = KMYTH_DELIM_SYM_KEY_PUBLIC;
+  delims[5] = KMYTH_DELIM_SYM_KEY_PRIVATE;
+  delims[6] = (bundle) ? KMYTH_DELIM_BUNDLE_DATA : KMYTH_DELIM_ENC_DATA;
+}
+
+//############################################################################
+// get_ski_text_size()
+//############################################################################
+static size_t get_ski_text_size(char **delims, size_t * section_sizes,
+                                size_t cipher_name_len)
+{
+  // the cipher suite section is the cipher name, as text, plus a newline
+  size_t total_size = cipher_name_len + 1 + strlen(KMYTH_DELIM_END_FILE);
+
+  for (size_t i = 0; i < KMYTH_SKI_BINARY_SECTION_COUNT; i++)
+  {
+    total_size += strlen(delims[i]) + base64_encoded_size(section_sizes[i]);
+  }
+
+  return total_size;
+}
+
+//############################################################################
+// init_ski_output()
+//############################################################################
+static int init_ski_output(byte_builder * out, size_t total_size, bool into,
+                           uint8_t ** output, size_t * output_length)
+{
+  if (!into)
+  {
+    return byte_builder_init(out, total_size);
+  }
+
+  // writing into a caller-provided buffer: a NULL buffer is a length query
+  // (reported with the builder left empty), anything else must be big enough
+  if (*output == NULL)
+  {
+    *output_length = total_size;
+    return 0;
+  }
+  if (*output_length < total_size)
+  {
+    kmyth_log(LOG_ERR, "output buffer too small (%zu bytes, need %zu)",
+              *output_length, total_size);
+    return 1;
+  }
+
+  return byte_builder_init_external(out, *output, *output_length);
+}
+
+//############################################################################
+// create_ski_binary_bytes()
+//############################################################################
+static int create_ski_binary_bytes(uint8_t ** sections, size_t * section_sizes,
+                                   uint8_t flags, bool into,
+                                   uint8_t ** output, size_t * output_length)
+{
+  // compute the total size up front so the output is allocated only once
+  size_t total_size = 0;
+
+  if (get_ski_binary_size(section_sizes, &total_size))
+  {
+    return 1;
+  }
+
+  byte_builder out = { 0 };
+
+  if (init_ski_output(&out, total_size, into, output, output_length))
+  {
+    kmyth_log(LOG_ERR, "unable to set up binary .ski output ... exiting");
+    return 1;
+  }
+  if (out.buffer == NULL)
+  {
+    // length query
+    return 0;
+  }
+
+  uint8_t header[KMYTH_SKI_BINARY_HEADER_LEN] = { 0 };
+
+  memcpy(header, KMYTH_SKI_BINARY_MAGIC, KMYTH_SKI_BINARY_MAGIC_LEN);
+  header[KMYTH_SKI_BINARY_MAGIC_LEN] = KMYTH_SKI_BINARY_VERSION;
+  header[KMYTH_SKI_BINARY_MAGIC_LEN + 1] = flags;
+
+  int retval = byte_builder_append(&out, header, sizeof(header));
+
+  for (size_t i = 0; i < KMYTH_SKI_BINARY_SECTION_COUNT && retval == 0; i++)
+  {
+    uint8_t *size_field = byte_builder_reserve(&out, sizeof(uint64_t));
+    size_t offset = 0;
+    uint64_t size = (uint64_t) section_sizes[i];
+
+    // a stream .ski ends with the size of its (not yet written) encrypted
+    // data, which is unknown
+    if (i == KMYTH_SKI_BINARY_SECTION_COUNT - 1 &&
+        (flags & KMYTH_SKI_BINARY_FLAG_STREAM))
+    {
+      size = KMYTH_SKI_BINARY_STREAM_SIZE;
+    }
+
+    if (size_field == NULL ||
+        Tss2_MU_UINT64_Marshal(size, size_field,
+                               sizeof(uint64_t), &offset) != TSS2_RC_SUCCESS)
+    {
+      retval = 1;
+      break;
+    }
+    retval = byte_builder_append(&out, sections[i], section_sizes[i]);
+  }
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error building binary .ski contents ... exiting");
+    byte_builder_free(&out);
+    return 1;
+  }
+
+  byte_builder_finish(&out, output, output_length);
+
+  return 0;
+}
+
+//############################################################################
+// locate_ski_binary_sections()
+//############################################################################
+static int locate_ski_binary_sections(uint8_t * input, size_t input_length,
+                                      bool header_only, uint8_t ** sections,
+                                      size_t * section_sizes, uint8_t * flags,
+                                      uint64_t * enc_data_size)
+{
+  if (input_length < KMYTH_SKI_BINARY_HEADER_LEN)
+  {
+    kmyth_log(LOG_ERR, "truncated binary .ski header ... exiting");
+    return 1;
+  }
+
+  uint8_t version = input[KMYTH_SKI_BINARY_MAGIC_LEN];
+
+  *flags = input[KMYTH_SKI_BINARY_MAGIC_LEN + 1];
+  if (version != KMYTH_SKI_BINARY_VERSION)
+  {
+    kmyth_log(LOG_ERR, "unsupported binary .ski version (%u) ... exiting",
+              version);
+    return 1;
+  }
+  if ((*flags & ~(KMYTH_SKI_BINARY_FLAG_BUNDLE |
+                  KMYTH_SKI_BINARY_FLAG_STREAM |
+                  KMYTH_SKI_BINARY_FLAG_ZSTD)) != 0 ||
+      ((*flags & KMYTH_SKI_BINARY_FLAG_BUNDLE) &&
+       (*flags & KMYTH_SKI_BINARY_FLAG_STREAM)) ||
+      input[KMYTH_SKI_BINARY_MAGIC_LEN + 2] != 0 ||
+      input[KMYTH_SKI_BINARY_MAGIC_LEN + 3] != 0)
+  {
+    kmyth_log(LOG_ERR, "invalid binary .ski header ... exiting");
+    return 1;
+  }
+
+  // locate every section as a view into the input buffer - each must be
+  // non-empty, and together they must account for the whole input (a
+  // header-only input ends with the size of the encrypted data, and the
+  // encrypted data of a stream .ski is whatever follows its size)
+  size_t offset = KMYTH_SKI_BINARY_HEADER_LEN;
+  bool stream = (*flags & KMYTH_SKI_BINARY_FLAG_STREAM) != 0;
+  uint64_t size = 0;
+
+  for (size_t i = 0; i < KMYTH_SKI_BINARY_SECTION_COUNT; i++)
+  {
+    bool last = (i == KMYTH_SKI_BINARY_SECTION_COUNT - 1);
+    TSS2_RC rc = Tss2_MU_UINT64_Unmarshal(input, input_length, &offset, &size);
+
+    if (rc == TSS2_RC_SUCCESS && last)
+    {
+      if (stream != (size == KMYTH_SKI_BINARY_STREAM_SIZE))
+      {
+        kmyth_log(LOG_ERR, "invalid binary .ski data size ... exiting");
+        return 1;
+      }
+      if (header_only)
+      {
+        break;
+      }
+      if (stream)
+      {
+        size = input_length - offset;
+      }
+    }
+    if (rc != TSS2_RC_SUCCESS || size == 0 || size > input_length - offset)
+    {
+      kmyth_log(LOG_ERR, "malformed binary .ski section (%zu) ... exiting", i);
+      return 1;
+    }
+    sections[i] = input + offset;
+    section_sizes[i] = (size_t) size;
+    offset += (size_t) size;
+  }
+
+  if (offset != input_length)
+  {
+    kmyth_log(LOG_ERR, "trailing data after binary .ski sections ... exiting");
+    return 1;
+  }
+
+  *enc_data_size = size;
+  return 0;
+}
+
+//############################################################################
+// locate_ski_text_sections()
+//############################################################################
+static int locate_ski_text_sections(uint8_t * input, size_t input_length,
+                                    uint8_t ** sections,
+                                    size_t * section_sizes, bool * bundle)
+{
+  // locate every block in a single forward pass over the input - each block
+  // is returned as a view into the input buffer, so nothing is copied until
+  // it is decoded
+  char *delims[KMYTH_SKI_BINARY_SECTION_COUNT] = { 0 };
+  uint8_t *position = input;
+  size_t remaining = input_length;
+
+  // the data block is either ENC DATA or BUNDLE DATA
+  *bundle = false;
+  get_ski_text_delims(false, delims);
+
+  for (size_t i = 0; i < KMYTH_SKI_BINARY_SECTION_COUNT; i++)
+  {
+    char *next_delim = KMYTH_DELIM_END_FILE;
+
+    if (i == KMYTH_SKI_BINARY_SECTION_COUNT - 2)
+    {
+      // the wrapping key private block is followed by either data delimiter,
+      // so stop at the next delimiter
+      next_delim = KMYTH_DELIM_PREFIX;
+    }
+    else if (i < KMYTH_SKI_BINARY_SECTION_COUNT - 2)
+    {
+      next_delim = delims[i + 1];
+    }
+    else if (remaining >= strlen(KMYTH_DELIM_BUNDLE_DATA) &&
+             memcmp(position, KMYTH_DELIM_BUNDLE_DATA,
+                    strlen(KMYTH_DELIM_BUNDLE_DATA)) == 0)
+    {
+      get_ski_text_delims(true, delims);
+      *bundle = true;
+    }
+
+    if (get_block_view(&position, &remaining,
+                       &sections[i], &section_sizes[i],
+                       delims[i], strlen(delims[i]),
+                       next_delim, strlen(next_delim)))
+    {
+      kmyth_log(LOG_ERR, "get .ski block (%s) error ... exiting", delims[i]);
+      return 1;
+    }
+  }
+
+  if (remaining != strlen(KMYTH_DELIM_END_FILE))
+  {
+    kmyth_log(LOG_ERR, "unable to find the end delimiter ... exiting");
+    return 1;
+  }
+
+  // the cipher suite block is the cipher name plus a newline
+  if (section_sizes[3] < 2)
+  {
+    kmyth_log(LOG_ERR, "empty cipher suite block ... exiting");
+    return 1;
+  }
+  section_sizes[3] -= 1;
+
+  return 0;
+}
+
+//############################################################################
+// get_ski_cipher()
+//############################################################################
+static int get_ski_cipher(uint8_t * name, size_t name_length,
+                          cipher_t * cipher)
+{
+  // create cipher suite struct (section is the cipher name, unterminated)
+  char *cipher_str = strndup((char *) name, name_length);
+
+  if (cipher_str == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to copy cipher string ... exiting");
+    return 1;
+  }
+  *cipher = kmyth_get_cipher_t_from_string(cipher_str);
+  free(cipher_str);
+  if (cipher->cipher_name == NULL)
+  {
+    kmyth_log(LOG_ERR, "cipher_t init error ... exiting");
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// parse_ski_binary_bytes()
+//############################################################################
+static int parse_ski_binary_bytes(uint8_t * input, size_t input_length,
+                                  bool header_only, Ski * output,
+                                  uint64_t * enc_data_size)
+{
+  uint8_t *sections[KMYTH_SKI_BINARY_SECTION_COUNT] = { NULL };
+  size_t section_sizes[KMYTH_SKI_BINARY_SECTION_COUNT] = { 0 };
+  uint8_t flags = 0;
+  uint64_t size = 0;
+
+  if (locate_ski_binary_sections(input, input_length, header_only,
+                                 sections, section_sizes, &flags, &size))
+  {
+    return 1;
+  }
+
+  Ski temp_ski = get_default_ski();
+
+  temp_ski.bundle = (flags & KMYTH_SKI_BINARY_FLAG_BUNDLE) != 0;
+  if (flags & KMYTH_SKI_BINARY_FLAG_ZSTD)
+  {
+    temp_ski.compression = KMYTH_COMPRESSION_ZSTD;
+  }
+
+  if (get_ski_cipher(sections[3], section_sizes[3], &temp_ski.cipher))
+  {
+    return 1;
+  }
+
+  // the TPM objects are unmarshalled straight from the input
+  uint8_t *objects[KMYTH_SKI_OBJECT_COUNT] = {
+    sections[0], sections[1], sections[2], sections[4], sections[5]
+  };
+  size_t object_sizes[KMYTH_SKI_OBJECT_COUNT] = {
+    section_sizes[0], section_sizes[1], section_sizes[2],
+    section_sizes[4], section_sizes[5]
+  };
+
+  if (unpack_ski_objects(objects, object_sizes,
+                         &temp_ski.pcr_list, &temp_ski.sk_pub,
+                         &temp_ski.sk_priv, &temp_ski.wk_pub,
+                         &temp_ski.wk_priv))
+  {
+    kmyth_log(LOG_ERR, "unmarshal .ski object error ... exiting");
+    return 1;
+  }
+
+  if (header_only)
+  {
+    *enc_data_size = size;
+    *output = temp_ski;
+    return 0;
+  }
+
+  // the encrypted data is the only section copied out of the input
+  temp_ski.enc_data = malloc(section_sizes[6]);
+  if (temp_ski.enc_data == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate encrypted data ... exiting");
+    return 1;
+  }
+  memcpy(temp_ski.enc_data, sections[6], section_sizes[6]);
+  temp_ski.enc_data_size = section_sizes[6];
+
+  *output = temp_ski;
+  return 0;
+}
 
 //############################################################################
 // parse_ski_bytes
@@ -22,532 +422,799 @@
 int parse_ski_bytes(uint8_t * input, size_t input_length, Ski * output)
 {
 
-  if (input == NULL)
+  if (input == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input cannot be parsed ... exiting");
+    return 1;
+  }
+
+  // binary (v2) .ski contents are identified by their leading magic value
+  // (text .ski contents always begin with a delimiter)
+  if (input_length >= KMYTH_SKI_BINARY_MAGIC_LEN &&
+      memcmp(input, KMYTH_SKI_BINARY_MAGIC, KMYTH_SKI_BINARY_MAGIC_LEN) == 0)
+  {
+    return parse_ski_binary_bytes(input, input_length, false, output, NULL);
+  }
+
+  uint8_t *sections[KMYTH_SKI_BINARY_SECTION_COUNT] = { NULL };
+  size_t section_sizes[KMYTH_SKI_BINARY_SECTION_COUNT] = { 0 };
+  Ski temp_ski = get_default_ski();
+
+  if (locate_ski_text_sections(input, input_length,
+                               sections, section_sizes, &temp_ski.bundle))
+  {
+    return 1;
+  }
+
+  if (get_ski_cipher(sections[3], section_sizes[3], &temp_ski.cipher))
+  {
+    return 1;
+  }
+
+  int retval = 0;
+  uint64_t timer = kmyth_timer_begin();
+
+  // decode the TPM objects one after another into a single block, each
+  // unmarshalled from its own slice of it
+  uint8_t *raw_objects[KMYTH_SKI_OBJECT_COUNT] = {
+    sections[0], sections[1], sections[2], sections[4], sections[5]
+  };
+  size_t raw_object_sizes[KMYTH_SKI_OBJECT_COUNT] = {
+    section_sizes[0], section_sizes[1], section_sizes[2],
+    section_sizes[4], section_sizes[5]
+  };
+  uint8_t *objects[KMYTH_SKI_OBJECT_COUNT] = { NULL };
+  size_t object_sizes[KMYTH_SKI_OBJECT_COUNT] = { 0 };
+  size_t objects_block_size = 0;
+
+  // an object decodes to fewer bytes than its encoding - the slack covers
+  // the room base64_decode() needs for an unpadded final quad
+  for (size_t i = 0; i < KMYTH_SKI_OBJECT_COUNT; i++)
+  {
+    objects_block_size += raw_object_sizes[i] + 4;
+  }
+
+  uint8_t *objects_block = malloc(objects_block_size);
+  size_t offset = 0;
+
+  if (objects_block == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate .ski object block ... exiting");
+    retval = 1;
+  }
+  for (size_t i = 0; i < KMYTH_SKI_OBJECT_COUNT && retval == 0; i++)
+  {
+    objects[i] = objects_block + offset;
+    if (base64_decode(raw_objects[i], raw_object_sizes[i],
+                      objects[i], &object_sizes[i]) || object_sizes[i] == 0)
+    {
+      retval = 1;
+    }
+    offset += object_sizes[i];
+  }
+
+  // decode the encrypted data block straight into the Ski - this is the only
+  // copy made of the (potentially large) encrypted payload
+  retval |= decodeBase64Data(sections[6], section_sizes[6],
+                             &temp_ski.enc_data, &temp_ski.enc_data_size);
+  kmyth_timer_end(KMYTH_PHASE_BASE64, timer);
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "base64 decode error ... exiting");
+  }
+  else
+  {
+    retval = unpack_ski_objects(objects, object_sizes,
+                                &temp_ski.pcr_list, &temp_ski.sk_pub,
+                                &temp_ski.sk_priv, &temp_ski.wk_pub,
+                                &temp_ski.wk_priv);
+    if (retval)
+    {
+      kmyth_log(LOG_ERR, "unmarshal .ski object error ... exiting");
+    }
+  }
+
+  free(objects_block);
+  *output = temp_ski;
+  return retval;
+}
+
+//############################################################################
+// decode_ski_view_section()
+//############################################################################
+static int decode_ski_view_section(SkiView * view, size_t index,
+                                   uint8_t ** data, size_t * size,
+                                   uint8_t ** scratch)
+{
+  *scratch = NULL;
+  if (!view->encoded)
+  {
+    *data = view->sections[index];
+    *size = view->section_sizes[index];
+    return 0;
+  }
+
+  // decoded into scratch space released by the caller once the section has
+  // been unmarshalled
+  *scratch = malloc(view->section_sizes[index] + 4);
+  if (*scratch == NULL ||
+      base64_decode(view->sections[index], view->section_sizes[index],
+                    *scratch, size) || *size == 0)
+  {
+    kmyth_log(LOG_ERR, "base64 decode error (.ski section %zu) ... exiting",
+              index);
+    free(*scratch);
+    *scratch = NULL;
+    return 1;
+  }
+  *data = *scratch;
+
+  return 0;
+}
+
+//############################################################################
+// open_ski_view
+//############################################################################
+int open_ski_view(uint8_t * input, size_t input_length, SkiView * view)
+{
+  if (input == NULL || view == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input cannot be parsed ... exiting");
+    return 1;
+  }
+
+  SkiView temp_view = {.ski = get_default_ski() };
+
+  if (input_length >= KMYTH_SKI_BINARY_MAGIC_LEN &&
+      memcmp(input, KMYTH_SKI_BINARY_MAGIC, KMYTH_SKI_BINARY_MAGIC_LEN) == 0)
+  {
+    uint8_t flags = 0;
+    uint64_t size = 0;
+
+    if (locate_ski_binary_sections(input, input_length, false,
+                                   temp_view.sections,
+                                   temp_view.section_sizes, &flags, &size))
+    {
+      return 1;
+    }
+    temp_view.ski.bundle = (flags & KMYTH_SKI_BINARY_FLAG_BUNDLE) != 0;
+    if (flags & KMYTH_SKI_BINARY_FLAG_ZSTD)
+    {
+      temp_view.ski.compression = KMYTH_COMPRESSION_ZSTD;
+    }
+  }
+  else
+  {
+    if (locate_ski_text_sections(input, input_length, temp_view.sections,
+                                 temp_view.section_sizes,
+                                 &temp_view.ski.bundle))
+    {
+      return 1;
+    }
+    temp_view.encoded = true;
+  }
+
+  *view = temp_view;
+  return 0;
+}
+
+//############################################################################
+// ski_view_get_cipher
+//############################################################################
+int ski_view_get_cipher(SkiView * view, cipher_t * cipher)
+{
+  if (!(view->decoded & KMYTH_SKI_VIEW_CIPHER))
+  {
+    if (get_ski_cipher(view->sections[3], view->section_sizes[3],
+                       &view->ski.cipher))
+    {
+      return 1;
+    }
+    view->decoded |= KMYTH_SKI_VIEW_CIPHER;
+  }
+
+  *cipher = view->ski.cipher;
+  return 0;
+}
+
+//############################################################################
+// ski_view_get_pcr_list
+//############################################################################
+int ski_view_get_pcr_list(SkiView * view, TPML_PCR_SELECTION ** pcr_list)
+{
+  if (!(view->decoded & KMYTH_SKI_VIEW_PCR_LIST))
+  {
+    uint8_t *data = NULL;
+    size_t size = 0;
+    uint8_t *scratch = NULL;
+
+    if (decode_ski_view_section(view, 0, &data, &size, &scratch))
+    {
+      return 1;
+    }
+
+    int retval = unpack_pcr(&view->ski.pcr_list, data, size, 0);
+
+    free(scratch);
+    if (retval)
+    {
+      return 1;
+    }
+    view->decoded |= KMYTH_SKI_VIEW_PCR_LIST;
+  }
+
+  *pcr_list = &view->ski.pcr_list;
+  return 0;
+}
+
+//############################################################################
+// ski_view_get_tpm_objects
+//############################################################################
+int ski_view_get_tpm_objects(SkiView * view, Ski ** ski)
+{
+  cipher_t cipher;
+
+  if (ski_view_get_cipher(view, &cipher))
+  {
+    return 1;
+  }
+
+  // the PCR selection list is unmarshalled again along with the other TPM
+  // objects, it is too small to be worth skipping
+  if (!(view->decoded & KMYTH_SKI_VIEW_OBJECTS))
+  {
+    static const size_t indices[KMYTH_SKI_OBJECT_COUNT] = { 0, 1, 2, 4, 5 };
+    uint8_t *objects[KMYTH_SKI_OBJECT_COUNT] = { NULL };
+    size_t object_sizes[KMYTH_SKI_OBJECT_COUNT] = { 0 };
+    uint8_t *scratch[KMYTH_SKI_OBJECT_COUNT] = { NULL };
+    int retval = 0;
+
+    for (size_t i = 0; i < KMYTH_SKI_OBJECT_COUNT && retval == 0; i++)
+    {
+      retval = decode_ski_view_section(view, indices[i], &objects[i],
+                                       &object_sizes[i], &scratch[i]);
+    }
+    if (retval == 0)
+    {
+      retval = unpack_ski_objects(objects, object_sizes,
+                                  &view->ski.pcr_list, &view->ski.sk_pub,
+                                  &view->ski.sk_priv, &view->ski.wk_pub,
+                                  &view->ski.wk_priv);
+    }
+    for (size_t i = 0; i < KMYTH_SKI_OBJECT_COUNT; i++)
+    {
+      free(scratch[i]);
+    }
+    if (retval)
+    {
+      kmyth_log(LOG_ERR, "unmarshal .ski object error ... exiting");
+      return 1;
+    }
+    view->decoded |= KMYTH_SKI_VIEW_PCR_LIST | KMYTH_SKI_VIEW_OBJECTS;
+  }
+
+  *ski = &view->ski;
+  return 0;
+}
+
+//############################################################################
+// ski_view_get_ski
+//############################################################################
+int ski_view_get_ski(SkiView * view, Ski ** ski)
+{
+  if (ski_view_get_tpm_objects(view, ski))
+  {
+    return 1;
+  }
+
+  if (!(view->decoded & KMYTH_SKI_VIEW_ENC_DATA))
+  {
+    size_t size = view->section_sizes[KMYTH_SKI_BINARY_SECTION_COUNT - 1];
+    uint8_t *data = view->sections[KMYTH_SKI_BINARY_SECTION_COUNT - 1];
+
+    if (view->encoded)
+    {
+      if (decodeBase64Data(data, size, &view->ski.enc_data,
+                           &view->ski.enc_data_size))
+      {
+        kmyth_log(LOG_ERR, "base64 decode error ... exiting");
+        return 1;
+      }
+    }
+    else
+    {
+      view->ski.enc_data = malloc(size);
+      if (view->ski.enc_data == NULL)
+      {
+        kmyth_log(LOG_ERR, "unable to allocate encrypted data ... exiting");
+        return 1;
+      }
+      memcpy(view->ski.enc_data, data, size);
+      view->ski.enc_data_size = size;
+    }
+    view->decoded |= KMYTH_SKI_VIEW_ENC_DATA;
+  }
+
+  *ski = &view->ski;
+  return 0;
+}
+
+//############################################################################
+// free_ski_view
+//############################################################################
+void free_ski_view(SkiView * view)
+{
+  if (view == NULL)
+  {
+    return;
+  }
+  free_ski(&view->ski);
+  view->decoded = 0;
+}
+
+//############################################################################
+// build_ski_bytes()
+//############################################################################
+static int build_ski_bytes(Ski input, kmyth_ski_format format, bool into,
+                           bool stream, uint8_t ** output,
+                           size_t * output_length)
+{
+  if (format != KMYTH_SKI_FORMAT_TEXT && format != KMYTH_SKI_FORMAT_BINARY)
+  {
+    kmyth_log(LOG_ERR, "invalid .ski format (%d) ... exiting", format);
+    return 1;
+  }
+  if (input.compression != KMYTH_COMPRESSION_NONE &&
+      (format != KMYTH_SKI_FORMAT_BINARY ||
+       input.compression != KMYTH_COMPRESSION_ZSTD))
+  {
+    kmyth_log(LOG_ERR, "compressed data needs a binary .ski ... exiting");
+    return 1;
+  }
+
+  // marshal data contained in TPM sized buffers (TPM2B_PUBLIC / TPM2B_PRIVATE)
+  // and structs (TPML_PCR_SELECTION) into a single block
+  uint8_t *objects_block = NULL;
+  size_t objects_block_size = 0;
+  uint8_t *objects[KMYTH_SKI_OBJECT_COUNT] = { NULL };
+  size_t object_sizes[KMYTH_SKI_OBJECT_COUNT] = { 0 };
+
+  if (pack_ski_objects(&input.pcr_list, &input.sk_pub, &input.sk_priv,
+                       &input.wk_pub, &input.wk_priv,
+                       &objects_block, &objects_block_size,
+                       objects, object_sizes))
+  {
+    kmyth_log(LOG_ERR, "unable to marshal data for ski file ... exiting");
+    return 1;
+  }
+
+  // validate that the remaining data to be written is non-NULL and non-empty
+  if (input.cipher.cipher_name == NULL ||
+      strlen(input.cipher.cipher_name) == 0 ||
+      (!stream && (input.enc_data == NULL || input.enc_data_size == 0)))
+  {
+    kmyth_log(LOG_ERR, "cannot write empty sections ... exiting");
+    free(objects_block);
+    return 1;
+  }
+
+  // the binary format stores the marshalled objects as they are
+  if (format == KMYTH_SKI_FORMAT_BINARY)
+  {
+    uint8_t *sections[KMYTH_SKI_BINARY_SECTION_COUNT] = {
+      objects[0], objects[1], objects[2],
+      (uint8_t *) input.cipher.cipher_name,
+      objects[3], objects[4], (stream) ? NULL : input.enc_data
+    };
+    size_t section_sizes[KMYTH_SKI_BINARY_SECTION_COUNT] = {
+      object_sizes[0], object_sizes[1], object_sizes[2],
+      strlen(input.cipher.cipher_name),
+      object_sizes[3], object_sizes[4], (stream) ? 0 : input.enc_data_size
+    };
+    uint8_t flags = (input.bundle) ? KMYTH_SKI_BINARY_FLAG_BUNDLE : 0;
+
+    if (stream)
+    {
+      flags |= KMYTH_SKI_BINARY_FLAG_STREAM;
+    }
+    if (input.compression == KMYTH_COMPRESSION_ZSTD)
+    {
+      flags |= KMYTH_SKI_BINARY_FLAG_ZSTD;
+    }
+
+    int retval = create_ski_binary_bytes(sections, section_sizes,
+                                         flags, into,
+                                         output, output_length);
+
+    free(objects_block);
+    return retval;
+  }
+
+  // The text file is a sequence of delimited sections. The size of each
+  // (base64 encoded) section is known up front, so the output is allocated
+  // once and every section is encoded directly into place.
+  char *delims[KMYTH_SKI_BINARY_SECTION_COUNT] = { 0 };
+
+  get_ski_text_delims(input.bundle, delims);
+  uint8_t *sections[] = {
+    objects[0], objects[1], objects[2], NULL,
+    objects[3], objects[4], input.enc_data
+  };
+  size_t section_sizes[] = {
+    object_sizes[0], object_sizes[1], object_sizes[2], 0,
+    object_sizes[3], object_sizes[4], input.enc_data_size
+  };
+  size_t section_count = sizeof(delims) / sizeof(delims[0]);
+  size_t cipher_name_len = strlen(input.cipher.cipher_name);
+  size_t total_size = get_ski_text_size(delims, section_sizes,
+                                        cipher_name_len);
+
+  byte_builder out = { 0 };
+  int retval = init_ski_output(&out, total_size, into, output, output_length);
+
+  if (retval == 0 && out.buffer == NULL)
+  {
+    // length query
+    free(objects_block);
+    return 0;
+  }
+
+  // the section encoding is timed as a whole, the delimiters copied in
+  // alongside it are negligible next to the base64 encoding
+  uint64_t timer = kmyth_timer_begin();
+
+  for (size_t i = 0; i < section_count && retval == 0; i++)
+  {
+    retval = byte_builder_append(&out, delims[i], strlen(delims[i]));
+    if (retval == 0 && sections[i] == NULL)
+    {
+      // the cipher suite section is the cipher name, as text
+      retval = byte_builder_append(&out, input.cipher.cipher_name,
+                                   cipher_name_len);
+      retval |= byte_builder_append(&out, "\n", 1);
+    }
+    else if (retval == 0)
+    {
+      size_t encoded_size = base64_encoded_size(section_sizes[i]);
+      uint8_t *encoded = byte_builder_reserve(&out, encoded_size);
+
+      if (encoded == NULL)
+      {
+        retval = 1;
+      }
+      else
+      {
+        base64_encode(sections[i], section_sizes[i], encoded);
+      }
+    }
+  }
+  kmyth_timer_end(KMYTH_PHASE_BASE64, timer);
+  if (retval == 0)
+  {
+    retval = byte_builder_append(&out, KMYTH_DELIM_END_FILE,
+                                 strlen(KMYTH_DELIM_END_FILE));
+  }
+
+  free(objects_block);
+
+  if (retval)
   {
-    kmyth_log(LOG_ERR, "NULL input cannot be parsed ... exiting");
+    kmyth_log(LOG_ERR, "error building .ski file contents ... exiting");
+    byte_builder_free(&out);
     return 1;
   }
 
-  uint8_t *position = input;
-  size_t remaining = input_length;
-  Ski temp_ski = get_default_ski();
+  byte_builder_finish(&out, output, output_length);
+
+  return 0;
+}
 
-  // read in (parse out) 'raw' (encoded) PCR selection list block
-  uint8_t *raw_pcr_select_list_data = NULL;
-  size_t raw_pcr_select_list_size = 0;
+//############################################################################
+// create_ski_bytes
+//############################################################################
+int create_ski_bytes(Ski input, kmyth_ski_format format,
+                     uint8_t ** output, size_t * output_length)
+{
+  return build_ski_bytes(input, format, false, false, output, output_length);
+}
 
-  if (get_block_bytes((char **) &position,
-                      &remaining,
-                      &raw_pcr_select_list_data,
-                      &raw_pcr_select_list_size,
-                      KMYTH_DELIM_PCR_SELECTION_LIST,
-                      strlen(KMYTH_DELIM_PCR_SELECTION_LIST),
-                      KMYTH_DELIM_STORAGE_KEY_PUBLIC,
-                      strlen(KMYTH_DELIM_STORAGE_KEY_PUBLIC)))
+//############################################################################
+// create_ski_bytes_into
+//############################################################################
+int create_ski_bytes_into(Ski input, kmyth_ski_format format,
+                          uint8_t * output, size_t * output_length)
+{
+  if (output_length == NULL)
   {
-    kmyth_log(LOG_ERR, "get PCR selection list error ... exiting");
-    free(raw_pcr_select_list_data);
     return 1;
   }
 
-  // read in (parse out) 'raw' (encoded) public data block for the storage key
-  uint8_t *raw_sk_pub_data = NULL;
-  size_t raw_sk_pub_size = 0;
+  return build_ski_bytes(input, format, true, false, &output, output_length);
+}
 
-  if (get_block_bytes((char **) &position,
-                      &remaining,
-                      &raw_sk_pub_data,
-                      &raw_sk_pub_size,
-                      KMYTH_DELIM_STORAGE_KEY_PUBLIC,
-                      strlen(KMYTH_DELIM_STORAGE_KEY_PUBLIC),
-                      KMYTH_DELIM_STORAGE_KEY_PRIVATE,
-                      strlen(KMYTH_DELIM_STORAGE_KEY_PRIVATE)))
+//############################################################################
+// create_ski_stream_header
+//############################################################################
+int create_ski_stream_header(Ski input, uint8_t ** output,
+                             size_t * output_length)
+{
+  if (input.bundle)
   {
-    kmyth_log(LOG_ERR, "get storage key public error ... exiting");
-    free(raw_pcr_select_list_data);
-    free(raw_sk_pub_data);
+    kmyth_log(LOG_ERR, "a bundle .ski cannot be written as a stream ... "
+              "exiting");
     return 1;
   }
 
-  // read in (parse out) 'raw' (encoded) private data block for the storage key
-  uint8_t *raw_sk_priv_data = NULL;
-  size_t raw_sk_priv_size = 0;
+  return build_ski_bytes(input, KMYTH_SKI_FORMAT_BINARY, false, true,
+                         output, output_length);
+}
+
+//############################################################################
+// create_ski_rewrap_header
+//############################################################################
+int create_ski_rewrap_header(uint8_t * input, size_t input_length,
+                             Ski objects, uint8_t ** header,
+                             size_t * header_length, size_t * data_offset)
+{
+  SkiView view;
 
-  if (get_block_bytes((char **) &position,
-                      &remaining,
-                      &raw_sk_priv_data,
-                      &raw_sk_priv_size,
-                      KMYTH_DELIM_STORAGE_KEY_PRIVATE,
-                      strlen(KMYTH_DELIM_STORAGE_KEY_PRIVATE),
-                      KMYTH_DELIM_CIPHER_SUITE,
-                      strlen(KMYTH_DELIM_CIPHER_SUITE)))
+  if (open_ski_view(input, input_length, &view))
   {
-    kmyth_log(LOG_ERR, "get storage key private error ... exiting");
-    free(raw_pcr_select_list_data);
-    free(raw_sk_pub_data);
-    free(raw_sk_priv_data);
     return 1;
   }
 
-  // read in (parse out) cipher suite string data block for the storage key
-  uint8_t *raw_cipher_str_data = NULL;
-  size_t raw_cipher_str_size = 0;
+  uint8_t *objects_block = NULL;
+  size_t objects_block_size = 0;
+  uint8_t *packed[KMYTH_SKI_OBJECT_COUNT] = { NULL };
+  size_t packed_sizes[KMYTH_SKI_OBJECT_COUNT] = { 0 };
 
-  if (get_block_bytes((char **) &position,
-                      &remaining,
-                      &raw_cipher_str_data,
-                      &raw_cipher_str_size,
-                      KMYTH_DELIM_CIPHER_SUITE,
-                      strlen(KMYTH_DELIM_CIPHER_SUITE),
-                      KMYTH_DELIM_SYM_KEY_PUBLIC,
-                      strlen(KMYTH_DELIM_SYM_KEY_PUBLIC)))
+  if (pack_ski_objects(&objects.pcr_list, &objects.sk_pub, &objects.sk_priv,
+                       &objects.wk_pub, &objects.wk_priv,
+                       &objects_block, &objects_block_size,
+                       packed, packed_sizes))
   {
-    kmyth_log(LOG_ERR, "get cipher string error ... exiting");
-    free(raw_pcr_select_list_data);
-    free(raw_sk_pub_data);
-    free(raw_sk_priv_data);
-    free(raw_cipher_str_data);
+    kmyth_log(LOG_ERR, "unable to marshal data for ski file ... exiting");
     return 1;
   }
 
-  // create cipher suite struct
-  raw_cipher_str_data[raw_cipher_str_size - 1] = '\0';
-  temp_ski.cipher =
-    kmyth_get_cipher_t_from_string((char *) raw_cipher_str_data);
-  if (temp_ski.cipher.cipher_name == NULL)
+  // the new objects replace the old ones, the cipher suite section is kept
+  size_t data_index = KMYTH_SKI_BINARY_SECTION_COUNT - 1;
+  uint8_t *sections[KMYTH_SKI_BINARY_SECTION_COUNT - 1] = {
+    packed[0], packed[1], packed[2], view.sections[3], packed[3], packed[4]
+  };
+  size_t section_sizes[KMYTH_SKI_BINARY_SECTION_COUNT - 1] = {
+    packed_sizes[0], packed_sizes[1], packed_sizes[2],
+    view.section_sizes[3], packed_sizes[3], packed_sizes[4]
+  };
+  char *delims[KMYTH_SKI_BINARY_SECTION_COUNT] = { 0 };
+  size_t total_size = 0;
+
+  // the data section is kept from its size (binary) or delimiter (text) on
+  if (!view.encoded)
   {
-    kmyth_log(LOG_ERR, "cipher_t init error ... exiting");
-    free_ski(&temp_ski);
-    free(raw_pcr_select_list_data);
-    free(raw_sk_pub_data);
-    free(raw_sk_priv_data);
-    free(raw_cipher_str_data);
-    return 1;
-  }
-  free(raw_cipher_str_data);
-  raw_cipher_str_data = NULL;
-  // read in (parse out) 'raw' (encoded) public data block for the wrapping key
-  uint8_t *raw_sym_pub_data = NULL;
-  size_t raw_sym_pub_size = 0;
-
-  if (get_block_bytes((char **) &position,
-                      &remaining,
-                      &raw_sym_pub_data,
-                      &raw_sym_pub_size,
-                      KMYTH_DELIM_SYM_KEY_PUBLIC,
-                      strlen(KMYTH_DELIM_SYM_KEY_PUBLIC),
-                      KMYTH_DELIM_SYM_KEY_PRIVATE,
-                      strlen(KMYTH_DELIM_SYM_KEY_PRIVATE)))
-  {
-    kmyth_log(LOG_ERR, "get symmetric key public error ... exiting");
-    free_ski(&temp_ski);
-    free(raw_pcr_select_list_data);
-    free(raw_sk_pub_data);
-    free(raw_sk_priv_data);
-    free(raw_sym_pub_data);
-    return 1;
-  }
-
-  // read in (parse out) raw (encoded) private data block for the wrapping key
-  unsigned char *raw_sym_priv_data = NULL;
-  size_t raw_sym_priv_size = 0;
-
-  if (get_block_bytes((char **) &position,
-                      &remaining,
-                      &raw_sym_priv_data,
-                      &raw_sym_priv_size,
-                      KMYTH_DELIM_SYM_KEY_PRIVATE,
-                      strlen(KMYTH_DELIM_SYM_KEY_PRIVATE),
-                      KMYTH_DELIM_ENC_DATA, strlen(KMYTH_DELIM_ENC_DATA)))
-  {
-    kmyth_log(LOG_ERR, "get symmetric key private error ... exiting");
-    free_ski(&temp_ski);
-    free(raw_pcr_select_list_data);
-    free(raw_sk_pub_data);
-    free(raw_sk_priv_data);
-    free(raw_sym_pub_data);
-    free(raw_sym_priv_data);
-    return 1;
-  }
-
-  // read in (parse out) raw (encoded) encrypted data block
-  unsigned char *raw_enc_data = NULL;
-  size_t raw_enc_size = 0;
-
-  if (get_block_bytes((char **) &position,
-                      &remaining,
-                      &raw_enc_data, &raw_enc_size,
-                      KMYTH_DELIM_ENC_DATA,
-                      strlen(KMYTH_DELIM_ENC_DATA),
-                      KMYTH_DELIM_END_FILE, strlen(KMYTH_DELIM_END_FILE)))
-  {
-    kmyth_log(LOG_ERR, "getting encrypted data error ... exiting");
-    free_ski(&temp_ski);
-    free(raw_pcr_select_list_data);
-    free(raw_sk_pub_data);
-    free(raw_sk_priv_data);
-    free(raw_sym_pub_data);
-    free(raw_sym_priv_data);
-    free(raw_enc_data);
-    return 1;
-  }
-
-  if (strncmp
-      ((char *) position, KMYTH_DELIM_END_FILE, strlen(KMYTH_DELIM_END_FILE))
-      || remaining != strlen(KMYTH_DELIM_END_FILE))
+    *data_offset = (size_t) (view.sections[data_index] - input)
+      - sizeof(uint64_t);
+    total_size = KMYTH_SKI_BINARY_HEADER_LEN;
+    for (size_t i = 0; i < data_index; i++)
+    {
+      total_size += sizeof(uint64_t) + section_sizes[i];
+    }
+  }
+  else
   {
-    kmyth_log(LOG_ERR, "unable to find the end delimiter ... exiting");
-    free_ski(&temp_ski);
-    free(raw_pcr_select_list_data);
-    free(raw_sk_pub_data);
-    free(raw_sk_priv_data);
-    free(raw_sym_pub_data);
-    free(raw_sym_priv_data);
-    free(raw_enc_data);
-    return 1;
+    get_ski_text_delims(view.ski.bundle, delims);
+    *data_offset = (size_t) (view.sections[data_index] - input)
+      - strlen(delims[data_index]);
+    for (size_t i = 0; i < data_index; i++)
+    {
+      // the cipher suite section is the cipher name, plus a newline
+      total_size += strlen(delims[i]);
+      total_size += (i == 3) ? section_sizes[i] + 1 :
+        base64_encoded_size(section_sizes[i]);
+    }
   }
 
-  //We are done with position. It was marking our place in input, which is freed by the caller
-  position = NULL;
-
-  int retval = 0;
-
-  // decode PCR selection list struct
-  uint8_t *decoded_pcr_select_list_data = NULL;
-  size_t decoded_pcr_select_list_size = 0;
-  size_t decoded_pcr_select_list_offset = 0;
-
-  retval |= decodeBase64Data(raw_pcr_select_list_data,
-                             raw_pcr_select_list_size,
-                             &decoded_pcr_select_list_data,
-                             &decoded_pcr_select_list_size);
-  free(raw_pcr_select_list_data);
-  raw_pcr_select_list_data = NULL;
-
-  // decode public data block for storage key
-  uint8_t *decoded_sk_pub_data = NULL;
-  size_t decoded_sk_pub_size = 0;
-  size_t decoded_sk_pub_offset = 0;
-
-  retval |= decodeBase64Data(raw_sk_pub_data,
-                             raw_sk_pub_size,
-                             &decoded_sk_pub_data, &decoded_sk_pub_size);
-  free(raw_sk_pub_data);
-  raw_sk_pub_data = NULL;
-
-  // decode encrypted private data block for storage key
-  uint8_t *decoded_sk_priv_data = NULL;
-  size_t decoded_sk_priv_size = 0;
-  size_t decoded_sk_priv_offset = 0;
-
-  retval |= decodeBase64Data(raw_sk_priv_data,
-                             raw_sk_priv_size,
-                             &decoded_sk_priv_data, &decoded_sk_priv_size);
-  free(raw_sk_priv_data);
-  raw_sk_priv_data = NULL;
-
-  // decode public data block for symmetric wrapping key
-  uint8_t *decoded_sym_pub_data = NULL;
-  size_t decoded_sym_pub_size = 0;
-  size_t decoded_sym_pub_offset = 0;
-
-  retval |= decodeBase64Data(raw_sym_pub_data,
-                             raw_sym_pub_size,
-                             &decoded_sym_pub_data, &decoded_sym_pub_size);
-  free(raw_sym_pub_data);
-  raw_sym_pub_data = NULL;
-
-  // decode encrypted private data block for symmetric wrapping key
-  uint8_t *decoded_sym_priv_data = NULL;
-  size_t decoded_sym_priv_size = 0;
-  size_t decoded_sym_priv_offset = 0;
-
-  retval |= decodeBase64Data(raw_sym_priv_data,
-                             raw_sym_priv_size,
-                             &decoded_sym_priv_data, &decoded_sym_priv_size);
-  free(raw_sym_priv_data);
-  raw_sym_priv_data = NULL;
-
-  // decode the encrypted data block
-  retval |= decodeBase64Data(raw_enc_data,
-                             raw_enc_size, &temp_ski.enc_data,
-                             &temp_ski.enc_data_size);
-  free(raw_enc_data);
-  raw_enc_data = NULL;
+  byte_builder out = { 0 };
+  int retval = byte_builder_init(&out, total_size);
 
-  if (retval)
+  // a binary .ski keeps its header, and so its version and flags
+  if (retval == 0 && !view.encoded)
   {
-    kmyth_log(LOG_ERR, "base64 decode error ... exiting");
+    retval = byte_builder_append(&out, input, KMYTH_SKI_BINARY_HEADER_LEN);
   }
-  else
+  for (size_t i = 0; i < data_index && retval == 0; i++)
   {
-    retval = unmarshal_skiObjects(&temp_ski.pcr_list,
-                                  decoded_pcr_select_list_data,
-                                  decoded_pcr_select_list_size,
-                                  decoded_pcr_select_list_offset,
-                                  &temp_ski.sk_pub,
-                                  decoded_sk_pub_data,
-                                  decoded_sk_pub_size,
-                                  decoded_sk_pub_offset,
-                                  &temp_ski.sk_priv,
-                                  decoded_sk_priv_data,
-                                  decoded_sk_priv_size,
-                                  decoded_sk_priv_offset,
-                                  &temp_ski.wk_pub,
-                                  decoded_sym_pub_data,
-                                  decoded_sym_pub_size,
-                                  decoded_sym_pub_offset,
-                                  &temp_ski.wk_priv,
-                                  decoded_sym_priv_data,
-                                  decoded_sym_priv_size,
-                                  decoded_sym_priv_offset);
-    if (retval)
+    if (!view.encoded)
     {
-      kmyth_log(LOG_ERR, "unmarshal .ski object error ... exiting");
+      uint8_t *size_field = byte_builder_reserve(&out, sizeof(uint64_t));
+      size_t offset = 0;
+
+      if (size_field == NULL ||
+          Tss2_MU_UINT64_Marshal((uint64_t) section_sizes[i], size_field,
+                                 sizeof(uint64_t), &offset)
+          != TSS2_RC_SUCCESS)
+      {
+        retval = 1;
+      }
+      else
+      {
+        retval = byte_builder_append(&out, sections[i], section_sizes[i]);
+      }
+      continue;
+    }
+
+    retval = byte_builder_append(&out, delims[i], strlen(delims[i]));
+    if (retval == 0 && i == 3)
+    {
+      retval = byte_builder_append(&out, sections[i], section_sizes[i]);
+      retval |= byte_builder_append(&out, "\n", 1);
+    }
+    else if (retval == 0)
+    {
+      uint8_t *encoded =
+        byte_builder_reserve(&out, base64_encoded_size(section_sizes[i]));
+
+      if (encoded == NULL)
+      {
+        retval = 1;
+      }
+      else
+      {
+        base64_encode(sections[i], section_sizes[i], encoded);
+      }
     }
   }
 
-  free(decoded_pcr_select_list_data);
-  free(decoded_sk_pub_data);
-  free(decoded_sk_priv_data);
-  free(decoded_sym_pub_data);
-  free(decoded_sym_priv_data);
-  *output = temp_ski;
-  return retval;
+  free(objects_block);
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error building .ski header ... exiting");
+    byte_builder_free(&out);
+    return 1;
+  }
+
+  byte_builder_finish(&out, header, header_length);
+
+  return 0;
 }
 
 //############################################################################
-// create_ski_bytes
+// read_ski_stream_header
 //############################################################################
-int create_ski_bytes(Ski input, uint8_t ** output, size_t * output_length)
+int read_ski_stream_header(FILE * in, uint8_t * prefix, size_t prefix_length,
+                           uint8_t ** output, size_t * output_length)
 {
-  // marshal data contained in TPM sized buffers (TPM2B_PUBLIC / TPM2B_PRIVATE)
-  // and structs (TPML_PCR_SELECTION)
-  // Note: must account for two extra bytes to include the buffer's size value
-  //       in the TPM2B_* sized buffer cases
-  size_t pcr_select_size = sizeof(input.pcr_list);
-  size_t pcr_select_offset = 0;
-  uint8_t *pcr_select_data =
-    (uint8_t *) calloc(pcr_select_size, sizeof(uint8_t));
-
-  if (pcr_select_data == NULL)
+  if (in == NULL || output == NULL || output_length == NULL ||
+      prefix_length > KMYTH_SKI_BINARY_HEADER_LEN ||
+      (prefix == NULL && prefix_length > 0))
   {
-    kmyth_log(LOG_ERR,
-              "unable to allocate memory for PCR select data ... exiting");
+    kmyth_log(LOG_ERR, "invalid stream .ski header input ... exiting");
     return 1;
   }
 
-  size_t sk_pub_size = input.sk_pub.size + 2;
-  size_t sk_pub_offset = 0;
-  uint8_t *sk_pub_data = (uint8_t *) malloc(sk_pub_size);
+  // the fixed header and first section size are read first, then each
+  // section along with the size of the next, growing the buffer as each
+  // size becomes known (the sections before the encrypted data are small,
+  // so a bad size is not allowed to drive a large allocation)
+  size_t length = KMYTH_SKI_BINARY_HEADER_LEN + sizeof(uint64_t);
+  uint8_t *header = malloc(length);
 
-  if (sk_pub_data == NULL)
+  if (header == NULL)
   {
-    kmyth_log(LOG_ERR,
-              "unable to allocate memory for storage key public data ... exiting");
-    free(pcr_select_data);
+    kmyth_log(LOG_ERR, "unable to allocate .ski header ... exiting");
     return 1;
   }
+  if (prefix_length > 0)
+  {
+    memcpy(header, prefix, prefix_length);
+  }
 
-  size_t sk_priv_size = input.sk_priv.size + 2;
-  size_t sk_priv_offset = 0;
-  uint8_t *sk_priv_data = (uint8_t *) malloc(sk_priv_size);
+  size_t filled = prefix_length;
 
-  if (sk_priv_data == NULL)
+  for (size_t i = 0; i < KMYTH_SKI_BINARY_SECTION_COUNT; i++)
   {
-    kmyth_log(LOG_ERR,
-              "unable to allocate memory for storage key private data ... exiting");
-    free(pcr_select_data);
-    free(sk_pub_data);
+    if (fread(header + filled, 1, length - filled, in) != length - filled)
+    {
+      kmyth_log(LOG_ERR, "truncated binary .ski header ... exiting");
+      free(header);
+      return 1;
+    }
+    filled = length;
+    if (i == KMYTH_SKI_BINARY_SECTION_COUNT - 1)
+    {
+      break;
+    }
+
+    uint64_t size = 0;
+    size_t offset = length - sizeof(uint64_t);
+
+    if (Tss2_MU_UINT64_Unmarshal(header, length, &offset, &size)
+        != TSS2_RC_SUCCESS || size == 0 ||
+        size > KMYTH_SKI_BINARY_MAX_HEADER_SECTION)
+    {
+      kmyth_log(LOG_ERR, "malformed binary .ski section (%zu) ... exiting", i);
+      free(header);
+      return 1;
+    }
+
+    uint8_t *grown = realloc(header, length + size + sizeof(uint64_t));
+
+    if (grown == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to allocate .ski header ... exiting");
+      free(header);
+      return 1;
+    }
+    header = grown;
+    length += size + sizeof(uint64_t);
+  }
+
+  *output = header;
+  *output_length = length;
+  return 0;
+}
+
+//############################################################################
+// parse_ski_stream_header
+//############################################################################
+int parse_ski_stream_header(uint8_t * input, size_t input_length,
+                            Ski * output, uint64_t * enc_data_size)
+{
+  if (input == NULL || enc_data_size == NULL ||
+      input_length < KMYTH_SKI_BINARY_MAGIC_LEN ||
+      memcmp(input, KMYTH_SKI_BINARY_MAGIC, KMYTH_SKI_BINARY_MAGIC_LEN) != 0)
+  {
+    kmyth_log(LOG_ERR, "input is not a binary .ski header ... exiting");
     return 1;
   }
 
-  size_t wk_pub_size = input.wk_pub.size + 2;
-  size_t wk_pub_offset = 0;
-  uint8_t *wk_pub_data = (uint8_t *) malloc(wk_pub_size);
+  return parse_ski_binary_bytes(input, input_length, true, output,
+                                enc_data_size);
+}
 
-  if (wk_pub_data == NULL)
+//############################################################################
+// get_ski_bytes_max_size
+//############################################################################
+int get_ski_bytes_max_size(kmyth_ski_format format, bool bundle,
+                           char *cipher_name, size_t enc_data_size,
+                           size_t * max_size)
+{
+  if (cipher_name == NULL || max_size == NULL)
   {
-    kmyth_log(LOG_ERR,
-              "unable to allocate memory for wrapping key public data ... exiting");
-    free(pcr_select_data);
-    free(sk_pub_data);
-    free(sk_priv_data);
     return 1;
   }
 
-  size_t wk_priv_size = input.wk_priv.size + 2;
-  size_t wk_priv_offset = 0;
-  uint8_t *wk_priv_data = (uint8_t *) malloc(wk_priv_size);
+  // every marshalled TPM object fits in the (unmarshalled) TPM structure
+  // it came from, and the section sizes are the only thing a .ski's size
+  // depends on besides the format and the cipher name
+  size_t section_sizes[KMYTH_SKI_BINARY_SECTION_COUNT] = {
+    sizeof(TPML_PCR_SELECTION), sizeof(TPM2B_PUBLIC), sizeof(TPM2B_PRIVATE),
+    strlen(cipher_name), sizeof(TPM2B_PUBLIC), sizeof(TPM2B_PRIVATE),
+    enc_data_size
+  };
 
-  if (wk_priv_data == NULL)
+  if (format == KMYTH_SKI_FORMAT_BINARY)
   {
-    kmyth_log(LOG_ERR,
-              "unable to allocate memory for wrapping key private data ... exiting");
-    free(pcr_select_data);
-    free(sk_pub_data);
-    free(sk_priv_data);
-    free(wk_pub_data);
-    return 1;
-  }
-
-  if (marshal_skiObjects(&input.pcr_list,
-                         &pcr_select_data,
-                         &pcr_select_size,
-                         pcr_select_offset,
-                         &input.sk_pub,
-                         &sk_pub_data,
-                         &sk_pub_size,
-                         sk_pub_offset,
-                         &input.sk_priv,
-                         &sk_priv_data,
-                         &sk_priv_size,
-                         sk_priv_offset,
-                         &input.wk_pub,
-                         &wk_pub_data,
-                         &wk_pub_size,
-                         wk_pub_offset,
-                         &input.wk_priv,
-                         &wk_priv_data, &wk_priv_size, wk_priv_offset))
+    return get_ski_binary_size(section_sizes, max_size);
+  }
+  if (format != KMYTH_SKI_FORMAT_TEXT)
   {
-    kmyth_log(LOG_ERR, "unable to marshal data for ski file ... exiting");
-    free(pcr_select_data);
-    free(sk_pub_data);
-    free(sk_priv_data);
-    free(wk_pub_data);
-    free(wk_priv_data);
-    return 1;
-  }
-
-  // validate that all data to be written is non-NULL and non-empty
-  if (pcr_select_data == NULL ||
-      pcr_select_size == 0 ||
-      sk_pub_data == NULL ||
-      sk_pub_size == 0 ||
-      sk_priv_data == NULL ||
-      sk_priv_size == 0 ||
-      wk_pub_data == NULL ||
-      wk_pub_size == 0 ||
-      wk_priv_data == NULL ||
-      wk_priv_size == 0 ||
-      input.cipher.cipher_name == NULL ||
-      strlen(input.cipher.cipher_name) == 0 ||
-      input.enc_data == NULL || input.enc_data_size == 0)
+    kmyth_log(LOG_ERR, "invalid .ski format (%d) ... exiting", format);
+    return 1;
+  }
+  if (enc_data_size > SIZE_MAX / 2)
   {
-    kmyth_log(LOG_ERR, "cannot write empty sections ... exiting");
-    free(pcr_select_data);
-    free(sk_pub_data);
-    free(sk_priv_data);
-    free(wk_pub_data);
-    free(wk_priv_data);
-    return 1;
-  }
-
-  //Encode each portion of the file in base64
-  uint8_t *pcr64_select_data = NULL;
-  size_t pcr64_select_size = 0;
-  uint8_t *sk64_pub_data = NULL;
-  size_t sk64_pub_size = 0;
-  uint8_t *sk64_priv_data = NULL;
-  size_t sk64_priv_size = 0;
-  uint8_t *wk64_pub_data = NULL;
-  size_t wk64_pub_size = 0;
-  uint8_t *wk64_priv_data = NULL;
-  size_t wk64_priv_size = 0;
-  uint8_t *enc64_data = NULL;
-  size_t enc64_data_size = 0;
-
-  if (encodeBase64Data
-      (pcr_select_data, pcr_select_size, &pcr64_select_data, &pcr64_select_size)
-      || encodeBase64Data(sk_pub_data, sk_pub_size, &sk64_pub_data,
-                          &sk64_pub_size)
-      || encodeBase64Data(sk_priv_data, sk_priv_size, &sk64_priv_data,
-                          &sk64_priv_size)
-      || encodeBase64Data(wk_pub_data, wk_pub_size, &wk64_pub_data,
-                          &wk64_pub_size)
-      || encodeBase64Data(wk_priv_data, wk_priv_size, &wk64_priv_data,
-                          &wk64_priv_size)
-      || encodeBase64Data(input.enc_data, input.enc_data_size, &enc64_data,
-                          &enc64_data_size))
-  {
-    kmyth_log(LOG_ERR, "error base64 encoding ski string ... exiting");
-    free(pcr_select_data);
-    free(sk_pub_data);
-    free(sk_priv_data);
-    free(wk_pub_data);
-    free(wk_priv_data);
-    free(pcr64_select_data);
-    free(sk64_pub_data);
-    free(sk64_priv_data);
-    free(wk64_pub_data);
-    free(wk64_priv_data);
-    free(enc64_data);
-    return 1;
-  }
-
-  free(pcr_select_data);
-  pcr_select_data = NULL;
-  free(sk_pub_data);
-  sk_pub_data = NULL;
-  free(sk_priv_data);
-  sk_priv_data = NULL;
-  free(wk_pub_data);
-  wk_pub_data = NULL;
-  free(wk_priv_data);
-  wk_priv_data = NULL;
-
-  //At this point the data is all formatted, it's time to create the string
-
-  uint8_t *out = NULL;
-  size_t out_length = 0;
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_PCR_SELECTION_LIST,
-         strlen(KMYTH_DELIM_PCR_SELECTION_LIST));
-  concat(&out, &out_length, pcr64_select_data, pcr64_select_size);
-  free(pcr64_select_data);
-  pcr64_select_data = NULL;
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_STORAGE_KEY_PUBLIC,
-         strlen(KMYTH_DELIM_STORAGE_KEY_PUBLIC));
-  concat(&out, &out_length, sk64_pub_data, sk64_pub_size);
-  free(sk64_pub_data);
-  sk64_pub_data = NULL;
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_STORAGE_KEY_PRIVATE,
-         strlen(KMYTH_DELIM_STORAGE_KEY_PRIVATE));
-  concat(&out, &out_length, sk64_priv_data, sk64_priv_size);
-  free(sk64_priv_data);
-  sk64_priv_data = NULL;
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_CIPHER_SUITE,
-         strlen(KMYTH_DELIM_CIPHER_SUITE));
-  concat(&out, &out_length, (uint8_t *) input.cipher.cipher_name,
-         strlen(input.cipher.cipher_name));
-  concat(&out, &out_length, (uint8_t *) "\n", 1);
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_SYM_KEY_PUBLIC,
-         strlen(KMYTH_DELIM_SYM_KEY_PUBLIC));
-  concat(&out, &out_length, wk64_pub_data, wk64_pub_size);
-  free(wk64_pub_data);
-  wk64_pub_data = NULL;
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_SYM_KEY_PRIVATE,
-         strlen(KMYTH_DELIM_SYM_KEY_PRIVATE));
-  concat(&out, &out_length, wk64_priv_data, wk64_priv_size);
-  free(wk64_priv_data);
-  wk64_priv_data = NULL;
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_ENC_DATA,
-         strlen(KMYTH_DELIM_ENC_DATA));
-  concat(&out, &out_length, enc64_data, enc64_data_size);
-  free(enc64_data);
-  enc64_data = NULL;
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_END_FILE,
-         strlen(KMYTH_DELIM_END_FILE));
-
-  *output = out;
-  *output_length = out_length;
+    kmyth_log(LOG_ERR, ".ski data section too large ... exiting");
+    return 1;
+  }
+
+  char *delims[KMYTH_SKI_BINARY_SECTION_COUNT] = { 0 };
+
+  get_ski_text_delims(bundle, delims);
+  section_sizes[3] = 0;
+  *max_size = get_ski_text_size(delims, section_sizes, strlen(cipher_name));
 
   return 0;
 }
@@ -557,6 +1224,8 @@ void free_ski(Ski * ski)
   free(ski->enc_data);
   ski->enc_data = NULL;
   ski->enc_data_size = 0;
+  ski->bundle = false;
+  ski->compression = KMYTH_COMPRESSION_NONE;
 }
 
 Ski get_default_ski(void)
@@ -569,7 +1238,9 @@ Ski get_default_ski(void)
     .wk_pub = {.size = 0},
     .wk_priv = {.size = 0},
     .enc_data = NULL,
-    .enc_data_size = 0
+    .enc_data_size = 0,
+    .bundle = false,
+    .compression = KMYTH_COMPRESSION_NONE
   };
   return (ret);
 
@@ -751,6 +1422,162 @@ int unmarshal_skiObjects(TPML_PCR_SELECTION * pcr_selection_struct,
   return retval;
 }
 
+//############################################################################
+// pack_ski_objects()
+//############################################################################
+int pack_ski_objects(TPML_PCR_SELECTION * pcr_selection_struct,
+                     TPM2B_PUBLIC * storage_key_public_blob,
+                     TPM2B_PRIVATE * storage_key_private_blob,
+                     TPM2B_PUBLIC * sealed_key_public_blob,
+                     TPM2B_PRIVATE * sealed_key_private_blob,
+                     uint8_t ** block, size_t * block_size,
+                     uint8_t ** objects, size_t * object_sizes)
+{
+  if (pcr_selection_struct == NULL ||
+      storage_key_public_blob == NULL ||
+      storage_key_private_blob == NULL ||
+      sealed_key_public_blob == NULL ||
+      sealed_key_private_blob == NULL ||
+      storage_key_public_blob->size == 0 ||
+      storage_key_private_blob->size == 0 ||
+      sealed_key_public_blob->size == 0 || sealed_key_private_blob->size == 0)
+  {
+    kmyth_log(LOG_ERR, "input structs to be packed NULL or empty ... exiting");
+    return 1;
+  }
+
+  // every object's marshalled size is known up front (a TPM2B_* sized buffer
+  // marshals as its two byte size followed by its contents), so the block is
+  // allocated only once
+  size_t sizes[KMYTH_SKI_OBJECT_COUNT] = {
+    sizeof(TPML_PCR_SELECTION),
+    storage_key_public_blob->size + sizeof(uint16_t),
+    storage_key_private_blob->size + sizeof(uint16_t),
+    sealed_key_public_blob->size + sizeof(uint16_t),
+    sealed_key_private_blob->size + sizeof(uint16_t)
+  };
+  size_t total_size = 0;
+
+  for (size_t i = 0; i < KMYTH_SKI_OBJECT_COUNT; i++)
+  {
+    total_size += sizes[i];
+  }
+
+  // zeroed, as the PCR selection list is padded out to its struct size
+  uint8_t *out = calloc(total_size, sizeof(uint8_t));
+
+  if (out == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate .ski object block ... exiting");
+    return 1;
+  }
+
+  size_t offset = 0;
+  TSS2_RC rc = Tss2_MU_TPML_PCR_SELECTION_Marshal(pcr_selection_struct, out,
+                                                  sizes[0], &offset);
+
+  // the remaining objects follow the PCR selection list's fixed extent, each
+  // one marshalled at the running offset left by the one before it
+  offset = sizes[0];
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    rc = Tss2_MU_TPM2B_PUBLIC_Marshal(storage_key_public_blob, out,
+                                      total_size, &offset);
+  }
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    rc = Tss2_MU_TPM2B_PRIVATE_Marshal(storage_key_private_blob, out,
+                                       total_size, &offset);
+  }
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    rc = Tss2_MU_TPM2B_PUBLIC_Marshal(sealed_key_public_blob, out,
+                                      total_size, &offset);
+  }
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    rc = Tss2_MU_TPM2B_PRIVATE_Marshal(sealed_key_private_blob, out,
+                                       total_size, &offset);
+  }
+
+  // a public area that marshals to other than its recorded size would leave
+  // the objects out of place
+  if (rc != TSS2_RC_SUCCESS || offset != total_size)
+  {
+    kmyth_log(LOG_ERR, "error marshalling .ski objects (0x%08X) ... exiting",
+              rc);
+    free(out);
+    return 1;
+  }
+
+  offset = 0;
+  for (size_t i = 0; i < KMYTH_SKI_OBJECT_COUNT; i++)
+  {
+    objects[i] = out + offset;
+    object_sizes[i] = sizes[i];
+    offset += sizes[i];
+  }
+  *block = out;
+  *block_size = total_size;
+
+  return 0;
+}
+
+//############################################################################
+// unpack_ski_objects()
+//############################################################################
+int unpack_ski_objects(uint8_t ** objects, size_t * object_sizes,
+                       TPML_PCR_SELECTION * pcr_selection_struct,
+                       TPM2B_PUBLIC * storage_key_public_blob,
+                       TPM2B_PRIVATE * storage_key_private_blob,
+                       TPM2B_PUBLIC * sealed_key_public_blob,
+                       TPM2B_PRIVATE * sealed_key_private_blob)
+{
+  if (objects == NULL || object_sizes == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL .ski object list ... exiting");
+    return 1;
+  }
+
+  // each object is unmarshalled in place, from the start of its slice
+  size_t offsets[KMYTH_SKI_OBJECT_COUNT] = { 0 };
+  TSS2_RC rc = Tss2_MU_TPML_PCR_SELECTION_Unmarshal(objects[0],
+                                                    object_sizes[0],
+                                                    &offsets[0],
+                                                    pcr_selection_struct);
+
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    rc = Tss2_MU_TPM2B_PUBLIC_Unmarshal(objects[1], object_sizes[1],
+                                        &offsets[1], storage_key_public_blob);
+  }
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    rc = Tss2_MU_TPM2B_PRIVATE_Unmarshal(objects[2], object_sizes[2],
+                                         &offsets[2],
+                                         storage_key_private_blob);
+  }
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    rc = Tss2_MU_TPM2B_PUBLIC_Unmarshal(objects[3], object_sizes[3],
+                                        &offsets[3], sealed_key_public_blob);
+  }
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    rc = Tss2_MU_TPM2B_PRIVATE_Unmarshal(objects[4], object_sizes[4],
+                                         &offsets[4], sealed_key_private_blob);
+  }
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "error unmarshalling .ski objects (0x%08x) ... exiting",
+              rc);
+    return 1;
+  }
+
+  return 0;
+}
+
 //############################################################################
 // pack_pcr()
 //############################################################################
@@ -889,6 +1716,148 @@ int unpack_private(TPM2B_PRIVATE * private_blob_out,
   return 0;
 }
 
+//############################################################################
+// pack_bundle_payloads()
+//############################################################################
+int pack_bundle_payloads(uint8_t ** payloads,
+                         size_t * payload_sizes,
+                         size_t payload_count,
+                         uint8_t ** block, size_t * block_size)
+{
+  if (payloads == NULL || payload_sizes == NULL || payload_count == 0 ||
+      payload_count > UINT32_MAX)
+  {
+    kmyth_log(LOG_ERR, "invalid bundle payload list ... exiting");
+    return 1;
+  }
+
+  // compute the total size up front so the block is allocated only once
+  size_t total_size = sizeof(uint32_t);
+
+  for (size_t i = 0; i < payload_count; i++)
+  {
+    if (payloads[i] == NULL || payload_sizes[i] == 0 ||
+        payload_sizes[i] > UINT32_MAX ||
+        payload_sizes[i] > SIZE_MAX - total_size - sizeof(uint32_t))
+    {
+      kmyth_log(LOG_ERR, "invalid bundle payload (%zu) ... exiting", i);
+      return 1;
+    }
+    total_size += sizeof(uint32_t) + payload_sizes[i];
+  }
+
+  uint8_t *out = malloc(total_size);
+
+  if (out == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate bundle block ... exiting");
+    return 1;
+  }
+
+  size_t offset = 0;
+  TSS2_RC rc = Tss2_MU_UINT32_Marshal((uint32_t) payload_count, out,
+                                      total_size, &offset);
+
+  for (size_t i = 0; i < payload_count && rc == TSS2_RC_SUCCESS; i++)
+  {
+    rc = Tss2_MU_UINT32_Marshal((uint32_t) payload_sizes[i], out,
+                                total_size, &offset);
+    if (rc == TSS2_RC_SUCCESS)
+    {
+      memcpy(out + offset, payloads[i], payload_sizes[i]);
+      offset += payload_sizes[i];
+    }
+  }
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_MU_UINT32_Marshal(): 0x%08X ... exiting", rc);
+    free(out);
+    return 1;
+  }
+
+  *block = out;
+  *block_size = total_size;
+
+  return 0;
+}
+
+//############################################################################
+// unpack_bundle_payloads()
+//############################################################################
+int unpack_bundle_payloads(uint8_t * block,
+                           size_t block_size,
+                           uint8_t *** payloads,
+                           size_t ** payload_sizes, size_t * payload_count)
+{
+  if (block == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL bundle block ... exiting");
+    return 1;
+  }
+
+  size_t offset = 0;
+  uint32_t count = 0;
+  TSS2_RC rc = Tss2_MU_UINT32_Unmarshal(block, block_size, &offset, &count);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_MU_UINT32_Unmarshal(): 0x%08x ... exiting", rc);
+    return 1;
+  }
+
+  // each payload needs at least its size field and one byte, which also
+  // bounds the allocations below by the size of the input
+  if (count == 0 || count > (block_size - offset) / (sizeof(uint32_t) + 1))
+  {
+    kmyth_log(LOG_ERR, "invalid bundle payload count (%u) ... exiting",
+              count);
+    return 1;
+  }
+
+  uint8_t **out = calloc(count, sizeof(uint8_t *));
+  size_t *out_sizes = calloc(count, sizeof(size_t));
+
+  if (out == NULL || out_sizes == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate bundle payload list ... exiting");
+    free(out);
+    free(out_sizes);
+    return 1;
+  }
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    uint32_t size = 0;
+
+    rc = Tss2_MU_UINT32_Unmarshal(block, block_size, &offset, &size);
+    if (rc != TSS2_RC_SUCCESS || size == 0 || size > block_size - offset)
+    {
+      kmyth_log(LOG_ERR, "malformed bundle payload (%u) ... exiting", i);
+      free(out);
+      free(out_sizes);
+      return 1;
+    }
+    out[i] = block + offset;
+    out_sizes[i] = size;
+    offset += size;
+  }
+
+  if (offset != block_size)
+  {
+    kmyth_log(LOG_ERR, "trailing data after bundle payloads ... exiting");
+    free(out);
+    free(out_sizes);
+    return 1;
+  }
+
+  *payloads = out;
+  *payload_sizes = out_sizes;
+  *payload_count = count;
+
+  return 0;
+}
+
 //############################################################################
 // unpack_uint32_to_str()
 //############################################################################
@@ -0,0 +1,479 @@
+/**
+ * @file  nv_tools.c
+ *
+ * @brief Implements a library of TPM 2.0 utility functions for storing
+ *        small secrets in, and retrieving them from, policy-protected TPM
+ *        NV indices
+ */
+
+#include "nv_tools.h"
+
+#include <string.h>
+
+#include <arpa/inet.h>
+
+#include "defines.h"
+#include "memory_util.h"
+#include "tpm2_interface.h"
+
+//############################################################################
+// get_free_nv_index()
+//############################################################################
+int get_free_nv_index(TSS2_SYS_CONTEXT * sapi_ctx, TPM2_HANDLE * nv_index)
+{
+  // The defined NV indices are listed in ascending order, starting from the
+  // handle asked for, so the first gap in the list (or its end) is the
+  // first free index
+  TPM2_HANDLE candidate = KMYTH_NV_INDEX_FIRST;
+  TPMS_CAPABILITY_DATA capData;
+
+  while (candidate <= KMYTH_NV_INDEX_LAST)
+  {
+    if (get_tpm2_properties(sapi_ctx, TPM2_CAP_HANDLES, candidate,
+                            TPM2_MAX_CAP_HANDLES, &capData))
+    {
+      kmyth_log(LOG_ERR, "unable to list defined NV indices ... exiting");
+      return 1;
+    }
+
+    uint32_t count = capData.data.handles.count;
+    uint32_t i = 0;
+
+    while (i < count && capData.data.handles.handle[i] == candidate)
+    {
+      candidate++;
+      i++;
+    }
+    if (i < count || count < TPM2_MAX_CAP_HANDLES)
+    {
+      break;
+    }
+  }
+
+  if (candidate > KMYTH_NV_INDEX_LAST)
+  {
+    kmyth_log(LOG_ERR, "no free NV index (0x%08X to 0x%08X) ... exiting",
+              KMYTH_NV_INDEX_FIRST, KMYTH_NV_INDEX_LAST);
+    return 1;
+  }
+  *nv_index = candidate;
+  kmyth_log(LOG_DEBUG, "free NV index = 0x%08X", *nv_index);
+
+  return 0;
+}
+
+//############################################################################
+// get_nv_max_data_size()
+//############################################################################
+int get_nv_max_data_size(TSS2_SYS_CONTEXT * sapi_ctx, size_t *max_size)
+{
+  TPMS_CAPABILITY_DATA capData;
+
+  if (get_tpm2_properties(sapi_ctx, TPM2_CAP_TPM_PROPERTIES,
+                          TPM2_PT_NV_BUFFER_MAX, 1, &capData)
+      || capData.data.tpmProperties.count < 1
+      || capData.data.tpmProperties.tpmProperty[0].property !=
+      TPM2_PT_NV_BUFFER_MAX)
+  {
+    kmyth_log(LOG_ERR, "unable to get TPM NV buffer size ... exiting");
+    return 1;
+  }
+
+  *max_size = capData.data.tpmProperties.tpmProperty[0].value;
+  if (*max_size > TPM2_MAX_NV_BUFFER_SIZE)
+  {
+    *max_size = TPM2_MAX_NV_BUFFER_SIZE;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// define_kmyth_nv_index()
+//############################################################################
+int define_kmyth_nv_index(TSS2_SYS_CONTEXT * sapi_ctx,
+                          TPM2B_AUTH owner_auth,
+                          TPM2_HANDLE nv_index,
+                          TPM2B_AUTH nv_auth,
+                          TPM2B_DIGEST nv_authPolicy, uint16_t nv_size)
+{
+  kmyth_log(LOG_DEBUG, "defining NV index (handle = 0x%08X)", nv_index);
+
+  if ((nv_index < TPM2_NV_INDEX_FIRST) || (nv_index > TPM2_NV_INDEX_LAST))
+  {
+    kmyth_log(LOG_ERR, "handle (0x%08X) out of NV index range ... exiting",
+              nv_index);
+    return 1;
+  }
+
+  // Defining an NV index in the owner hierarchy takes owner authorization
+  TSS2L_SYS_AUTH_COMMAND defineCmdAuths;
+  TSS2L_SYS_AUTH_RESPONSE defineRspAuths;
+
+  if (init_password_cmd_auth(owner_auth, &defineCmdAuths, &defineRspAuths))
+  {
+    kmyth_log(LOG_ERR, "error setting up auth session ... exiting");
+    return 1;
+  }
+
+  // An ordinary index that only the owner writes and only the Kmyth policy
+  // (the authVal, through PolicyAuthValue, and the PCR criteria) reads
+  TPM2B_NV_PUBLIC nvPublic;
+
+  memset(&nvPublic, 0, sizeof(nvPublic));
+  nvPublic.nvPublic.nvIndex = nv_index;
+  nvPublic.nvPublic.nameAlg = KMYTH_HASH_ALG;
+  nvPublic.nvPublic.attributes =
+    (TPM2_NT_ORDINARY << TPMA_NV_TPM2_NT_SHIFT) | TPMA_NV_OWNERWRITE |
+    TPMA_NV_POLICYREAD;
+  nvPublic.nvPublic.authPolicy = nv_authPolicy;
+  nvPublic.nvPublic.dataSize = nv_size;
+
+  TSS2_RC rc = Tss2_Sys_NV_DefineSpace(sapi_ctx,
+                                       TPM2_RH_OWNER,
+                                       &defineCmdAuths,
+                                       &nv_auth,
+                                       &nvPublic,
+                                       &defineRspAuths);
+
+  kmyth_clear(&defineCmdAuths, sizeof(defineCmdAuths));
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log_tpm_rc("Tss2_Sys_NV_DefineSpace", rc);
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// write_kmyth_nv_index()
+//############################################################################
+int write_kmyth_nv_index(TSS2_SYS_CONTEXT * sapi_ctx,
+                         TPM2_HANDLE salt_key,
+                         TPM2B_AUTH owner_auth,
+                         TPM2_HANDLE nv_index, uint8_t * data, size_t data_size)
+{
+  TPM2B_MAX_NV_BUFFER nvData;
+
+  if (data_size > sizeof(nvData.buffer))
+  {
+    kmyth_log(LOG_ERR, "data (%zu bytes) too large for NV index ... exiting",
+              data_size);
+    return 1;
+  }
+
+  // The command parameter hash covers the names of both handles: that of
+  // the owner hierarchy (its handle) and that of the index (read from the
+  // TPM, as it depends on the index's attributes)
+  TPM2B_NV_PUBLIC nvPublic = {.size = 0, };
+  TPM2B_NAME nvName = {.size = 0, };
+  TPM2B_NAME authNames = {.size = 0, };
+  uint32_t owner_be = htonl(TPM2_RH_OWNER);
+
+  TSS2_RC rc = Tss2_Sys_NV_ReadPublic(sapi_ctx, nv_index, NULL, &nvPublic,
+                                      &nvName, NULL);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log_tpm_rc("Tss2_Sys_NV_ReadPublic", rc);
+    return 1;
+  }
+  if (nvName.size > sizeof(authNames.name) - sizeof(owner_be))
+  {
+    kmyth_log(LOG_ERR, "unexpected NV index name size ... exiting");
+    return 1;
+  }
+  memcpy(authNames.name, &owner_be, sizeof(owner_be));
+  memcpy(authNames.name + sizeof(owner_be), nvName.name, nvName.size);
+  authNames.size = (uint16_t) (sizeof(owner_be) + nvName.size);
+
+  // The HMAC key and parameter encryption key use the owner authValue
+  // without trailing zero octets, as the TPM does
+  while (owner_auth.size > 0 && owner_auth.buffer[owner_auth.size - 1] == 0)
+  {
+    owner_auth.size--;
+  }
+
+  // The secret is sent encrypted in a salted HMAC session that authorizes
+  // the write with the owner authValue (rather than a password session,
+  // which would send both the authValue and the secret in the clear)
+  SESSION writeSession;
+
+  if (create_salted_hmac_auth_session(sapi_ctx, salt_key, &writeSession))
+  {
+    kmyth_log(LOG_ERR, "error starting NV write session ... exiting");
+    kmyth_clear(&owner_auth, sizeof(owner_auth));
+    return 1;
+  }
+
+  nvData.size = (uint16_t) data_size;
+  memcpy(nvData.buffer, data, data_size);
+
+  rc = Tss2_Sys_NV_Write_Prepare(sapi_ctx, TPM2_RH_OWNER, nv_index, &nvData,
+                                 0);
+  kmyth_clear(&nvData, sizeof(nvData));
+
+  uint8_t *cmdParams = NULL;
+  size_t cmdParams_size = 0;
+  TPM2_CC nv_write_command_code = 0;
+  TSS2L_SYS_AUTH_COMMAND writeCmdAuths;
+  TSS2L_SYS_AUTH_RESPONSE writeRspAuths;
+  TPML_PCR_SELECTION emptyPcrList = {.count = 0, };
+  int retval = 1;
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log_tpm_rc("Tss2_Sys_NV_Write_Prepare", rc);
+  }
+  else if ((rc = Tss2_Sys_GetCpBuffer(sapi_ctx, &cmdParams_size,
+                                      (const uint8_t **) &cmdParams))
+           != TSS2_RC_SUCCESS)
+  {
+    kmyth_log_tpm_rc("Tss2_Sys_GetCpBuffer", rc);
+  }
+  else if ((rc = Tss2_Sys_GetCommandCode(sapi_ctx,
+                                         (uint8_t *) &
+                                         nv_write_command_code))
+           != TSS2_RC_SUCCESS)
+  {
+    kmyth_log_tpm_rc("Tss2_Sys_GetCommandCode", rc);
+  }
+  // encrypts the secret in the prepared command, and sets 'decrypt'
+  else if (init_policy_cmd_auth(sapi_ctx, &writeSession,
+                                nv_write_command_code, authNames,
+                                owner_auth, cmdParams, cmdParams_size,
+                                emptyPcrList, &writeCmdAuths, &writeRspAuths))
+  {
+    kmyth_log(LOG_ERR, "error preparing Tss2_Sys_NV_Write() auth ... "
+              "exiting");
+  }
+  else if (!(writeCmdAuths.auths[0].sessionAttributes & TPMA_SESSION_DECRYPT))
+  {
+    kmyth_log(LOG_ERR, "NV data not encrypted ... exiting");
+  }
+  else if ((rc = Tss2_Sys_SetCmdAuths(sapi_ctx, &writeCmdAuths))
+           != TSS2_RC_SUCCESS)
+  {
+    kmyth_log_tpm_rc("Tss2_Sys_SetCmdAuths", rc);
+  }
+  // The one-call Tss2_Sys_NV_Write() would marshal the data again, in the
+  // clear, so the prepared (encrypted) command is executed as it is
+  else if ((rc = Tss2_Sys_Execute(sapi_ctx)) != TSS2_RC_SUCCESS)
+  {
+    kmyth_log_tpm_rc("Tss2_Sys_NV_Write", rc);
+  }
+  else if ((rc = Tss2_Sys_GetRspAuths(sapi_ctx, &writeRspAuths))
+           != TSS2_RC_SUCCESS)
+  {
+    kmyth_log_tpm_rc("Tss2_Sys_GetRspAuths", rc);
+  }
+  else if ((rc = Tss2_Sys_NV_Write_Complete(sapi_ctx)) != TSS2_RC_SUCCESS)
+  {
+    kmyth_log_tpm_rc("Tss2_Sys_NV_Write_Complete", rc);
+  }
+  else
+  {
+    // TPM2_NV_Write() has no response parameters
+    retval = check_response_auth(&writeSession, nv_write_command_code,
+                                 NULL, 0, owner_auth, &writeRspAuths);
+    if (retval)
+    {
+      kmyth_log(LOG_ERR, "response auth check failed ... exiting");
+    }
+  }
+
+  kmyth_clear(&writeCmdAuths, sizeof(writeCmdAuths));
+  kmyth_clear(&owner_auth, sizeof(owner_auth));
+  flush_tpm2_object(sapi_ctx, writeSession.sessionHandle);
+  kmyth_clear(&writeSession, sizeof(writeSession));
+  if (retval == 0)
+  {
+    kmyth_log(LOG_DEBUG, "wrote %zu bytes to NV index (handle = 0x%08X)",
+              data_size, nv_index);
+  }
+
+  return retval;
+}
+
+//############################################################################
+// read_kmyth_nv_index()
+//############################################################################
+int read_kmyth_nv_index(TSS2_SYS_CONTEXT * sapi_ctx,
+                        SESSION * nvAuthSession,
+                        TPM2_HANDLE nv_index,
+                        TPM2B_AUTH nv_auth,
+                        TPML_PCR_SELECTION nv_pcrList,
+                        TPM2B_MAX_NV_BUFFER * nv_data)
+{
+  kmyth_log(LOG_DEBUG, "reading NV index (handle = 0x%08X)", nv_index);
+
+  TSS2_RC rc = TPM2_RC_FAILURE;
+
+  // The size and the name of the index are needed for the read and its
+  // authorization (the name changes once the index is written, so it is
+  // read from the TPM rather than computed)
+  TPM2B_NV_PUBLIC nvPublic = {.size = 0, };
+  TPM2B_NAME nvName = {.size = 0, };
+
+  rc = Tss2_Sys_NV_ReadPublic(sapi_ctx, nv_index, NULL, &nvPublic, &nvName,
+                              NULL);
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log_tpm_rc("Tss2_Sys_NV_ReadPublic", rc);
+    return 1;
+  }
+  if (!(nvPublic.nvPublic.attributes & TPMA_NV_WRITTEN))
+  {
+    kmyth_log(LOG_ERR, "NV index (0x%08X) not written ... exiting", nv_index);
+    return 1;
+  }
+
+  // Apply policy to session context, in preparation for the read
+  if (apply_policy(sapi_ctx, nvAuthSession->sessionHandle, nv_pcrList))
+  {
+    kmyth_log(LOG_ERR, "error applying policy to session context ... exiting");
+    return 1;
+  }
+
+  // The index both authorizes and is the subject of TPM2_NV_Read()
+  rc = Tss2_Sys_NV_Read_Prepare(sapi_ctx, nv_index, nv_index,
+                                nvPublic.nvPublic.dataSize, 0);
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log_tpm_rc("Tss2_Sys_NV_Read_Prepare", rc);
+    return 1;
+  }
+
+  // The command parameter buffer is held by the sys-api context
+  uint8_t *cmdParams = NULL;
+  size_t cmdParams_size = 0;
+  TPM2_CC nv_read_command_code = 0;
+
+  rc = Tss2_Sys_GetCpBuffer(sapi_ctx,
+                            &cmdParams_size, (const uint8_t **) &cmdParams);
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log_tpm_rc("Tss2_Sys_GetCpBuffer", rc);
+    return 1;
+  }
+  rc = Tss2_Sys_GetCommandCode(sapi_ctx, (uint8_t *) & nv_read_command_code);
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log_tpm_rc("Tss2_Sys_GetCommandCode", rc);
+    return 1;
+  }
+
+  // The command parameter hash covers the names of both handles - as they
+  // are the same index, its name is hashed twice, the second time as if it
+  // led the command parameters (the size and offset of the read)
+  uint8_t nameParams[sizeof(nvName.name) + 2 * sizeof(uint16_t)];
+
+  if (cmdParams_size > sizeof(nameParams) - nvName.size)
+  {
+    kmyth_log(LOG_ERR, "unexpected TPM2_NV_Read() parameters ... exiting");
+    return 1;
+  }
+  memcpy(nameParams, nvName.name, nvName.size);
+  memcpy(nameParams + nvName.size, cmdParams, cmdParams_size);
+
+  TSS2L_SYS_AUTH_COMMAND readCmdAuths;
+  TSS2L_SYS_AUTH_RESPONSE readRspAuths;
+
+  if (init_policy_cmd_auth(sapi_ctx, nvAuthSession,
+                           nv_read_command_code,
+                           nvName,
+                           nv_auth,
+                           nameParams,
+                           nvName.size + cmdParams_size,
+                           nv_pcrList, &readCmdAuths, &readRspAuths))
+  {
+    kmyth_log(LOG_ERR, "error preparing Tss2_Sys_NV_Read() auth ... exiting");
+    return 1;
+  }
+
+  rc = Tss2_Sys_SetCmdAuths(sapi_ctx, &readCmdAuths);
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log_tpm_rc("Tss2_Sys_SetCmdAuths", rc);
+    return 1;
+  }
+
+  nv_data->size = 0;
+  rc = Tss2_Sys_NV_Read(sapi_ctx, nv_index, nv_index, &readCmdAuths,
+                        nvPublic.nvPublic.dataSize, 0, nv_data,
+                        &readRspAuths);
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log_tpm_rc("Tss2_Sys_NV_Read", rc);
+    return 1;
+  }
+
+  // Validate the TPM authorization response
+  size_t rspParams_size = 0;
+  uint8_t *rspParams = NULL;
+
+  rc = Tss2_Sys_GetRpBuffer(sapi_ctx, &rspParams_size,
+                            (const uint8_t **) &rspParams);
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log_tpm_rc("Tss2_Sys_GetRpBuffer", rc);
+    kmyth_clear(nv_data, sizeof(TPM2B_MAX_NV_BUFFER));
+    return 1;
+  }
+  if (check_response_auth(nvAuthSession,
+                          nv_read_command_code,
+                          rspParams, rspParams_size, nv_auth, &readRspAuths))
+  {
+    kmyth_log(LOG_ERR, "response auth check failed ... exiting");
+    kmyth_clear(nv_data, sizeof(TPM2B_MAX_NV_BUFFER));
+    return 1;
+  }
+
+  // decrypt the data read if the TPM returned it encrypted
+  if (readRspAuths.auths[0].sessionAttributes & TPMA_SESSION_ENCRYPT)
+  {
+    if (crypt_session_param(nvAuthSession, nv_auth, false,
+                            nv_data->buffer, nv_data->size))
+    {
+      kmyth_log(LOG_ERR, "error decrypting NV data ... exiting");
+      kmyth_clear(nv_data, sizeof(TPM2B_MAX_NV_BUFFER));
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+//############################################################################
+// undefine_kmyth_nv_index()
+//############################################################################
+int undefine_kmyth_nv_index(TSS2_SYS_CONTEXT * sapi_ctx,
+                            TPM2B_AUTH owner_auth, TPM2_HANDLE nv_index)
+{
+  TSS2L_SYS_AUTH_COMMAND undefineCmdAuths;
+  TSS2L_SYS_AUTH_RESPONSE undefineRspAuths;
+
+  if (init_password_cmd_auth(owner_auth, &undefineCmdAuths,
+                             &undefineRspAuths))
+  {
+    kmyth_log(LOG_ERR, "error setting up auth session ... exiting");
+    return 1;
+  }
+
+  TSS2_RC rc = Tss2_Sys_NV_UndefineSpace(sapi_ctx,
+                                         TPM2_RH_OWNER,
+                                         nv_index,
+                                         &undefineCmdAuths,
+                                         &undefineRspAuths);
+
+  kmyth_clear(&undefineCmdAuths, sizeof(undefineCmdAuths));
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log_tpm_rc("Tss2_Sys_NV_UndefineSpace", rc);
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "undefined NV index (handle = 0x%08X)", nv_index);
+
+  return 0;
+}
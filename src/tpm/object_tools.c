@@ -11,6 +11,7 @@
 #include <string.h>
 
 #include "defines.h"
+#include "memory_util.h"
 #include "tpm2_interface.h"
 
 //############################################################################
@@ -64,29 +65,12 @@ int init_kmyth_object_sensitive(TPM2B_AUTH object_auth,
 }
 
 //############################################################################
-// init_kmyth_object_template
+// init_kmyth_object_template_fields
 //############################################################################
-int init_kmyth_object_template(bool isKey,
-                               TPM2B_DIGEST auth_policy, TPMT_PUBLIC * pubArea)
+static int init_kmyth_object_template_fields(bool isKey,
+                                             TPM2B_DIGEST auth_policy,
+                                             TPMT_PUBLIC * pubArea)
 {
-  if (pubArea == NULL)
-  {
-    kmyth_log(LOG_ERR, "no pubArea data ... exiting");
-    return 1;
-  }
-
-  // Initialize public key algorithm (object type) for object to be created
-  //   - for SRK or SK, use Kmyth configured default for keys
-  //   - for sealed data, use Kmyth configured default for data
-  if (isKey == true)
-  {
-    pubArea->type = KMYTH_KEY_PUBKEY_ALG;
-  }
-  else
-  {
-    pubArea->type = KMYTH_DATA_PUBKEY_ALG;
-  }
-
   // initialize hash algorithm - used to compute name for new object
   pubArea->nameAlg = KMYTH_HASH_ALG;
   kmyth_log(LOG_DEBUG, "object hash ALG_ID = 0x%02X", KMYTH_HASH_ALG);
@@ -136,6 +120,55 @@ int init_kmyth_object_template(bool isKey,
   return 0;
 }
 
+//############################################################################
+// init_kmyth_object_template
+//############################################################################
+int init_kmyth_object_template(bool isKey,
+                               TPM2B_DIGEST auth_policy, TPMT_PUBLIC * pubArea)
+{
+  // Initialize public key algorithm (object type) for object to be created
+  //   - for SRK or SK, use Kmyth configured default for keys
+  //   - for sealed data, use Kmyth configured default for data
+  if (isKey == true)
+  {
+    return init_kmyth_key_template(KMYTH_KEY_PUBKEY_ALG, auth_policy, pubArea);
+  }
+
+  if (pubArea == NULL)
+  {
+    kmyth_log(LOG_ERR, "no pubArea data ... exiting");
+    return 1;
+  }
+  pubArea->type = KMYTH_DATA_PUBKEY_ALG;
+
+  return init_kmyth_object_template_fields(false, auth_policy, pubArea);
+}
+
+//############################################################################
+// init_kmyth_key_template
+//############################################################################
+int init_kmyth_key_template(TPMI_ALG_PUBLIC keyAlg,
+                            TPM2B_DIGEST auth_policy, TPMT_PUBLIC * pubArea)
+{
+  if (pubArea == NULL)
+  {
+    kmyth_log(LOG_ERR, "no pubArea data ... exiting");
+    return 1;
+  }
+
+  // Kmyth storage keys are restricted decryption keys, which the TPM only
+  // supports as RSA or ECC keys
+  if (keyAlg != TPM2_ALG_RSA && keyAlg != TPM2_ALG_ECC)
+  {
+    kmyth_log(LOG_ERR, "unsupported key algorithm (0x%04X) ... exiting",
+              keyAlg);
+    return 1;
+  }
+  pubArea->type = keyAlg;
+
+  return init_kmyth_object_template_fields(true, auth_policy, pubArea);
+}
+
 //############################################################################
 // init_kmyth_object_attributes()
 //############################################################################
@@ -204,7 +237,7 @@ int init_kmyth_object_parameters(TPMI_ALG_PUBLIC objectType,
     objectParams->rsaDetail.scheme.scheme = TPM2_ALG_NULL;
 
     // 'keyBits' options: 1024, 2048, 3072 - if actually implemented
-    objectParams->rsaDetail.keyBits = 2048;
+    objectParams->rsaDetail.keyBits = KMYTH_RSA_KEY_LEN;
 
     // Setting the exponent to zero selects the default (2^16 + 1). While
     // technically this value can be set to any prime number greater than 2,
@@ -231,7 +264,7 @@ int init_kmyth_object_parameters(TPMI_ALG_PUBLIC objectType,
     objectParams->eccDetail.scheme.scheme = TPM2_ALG_NULL;
 
     // 'curveID' options: P192, P224, P256 (TCG Standard), P384, P521
-    objectParams->eccDetail.curveID = TPM2_ECC_NIST_P256;
+    objectParams->eccDetail.curveID = KMYTH_ECC_CURVE;
     // Spec indicates "no commands where this (kdf.scheme) parameter has effect
     // and, in the reference code, this field needs to be set to TPM_ALG_NULL."
     objectParams->eccDetail.kdf.scheme = TPM2_ALG_NULL;
@@ -391,9 +424,7 @@ int create_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                                 &createObjectRspAuths);
     if (rc != TSS2_RC_SUCCESS)
     {
-      kmyth_log(LOG_ERR,
-                "Tss2_Sys_CreatePrimary(): rc = 0x%08X, %s ... exiting", rc,
-                getErrorString(rc));
+      kmyth_log_tpm_rc("Tss2_Sys_CreatePrimary", rc);
       return 1;
     }
     kmyth_log(LOG_DEBUG, "created primary object (transient handle = 0x%08X)",
@@ -407,10 +438,11 @@ int create_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                                        object_dest_handle,
                                        &createObjectRspAuths);
 
+    // the persistent handles are read from the TPM again next time
+    invalidate_tpm2_persistent_handle_cache(sapi_ctx);
     if (rc != TSS2_RC_SUCCESS)
     {
-      kmyth_log(LOG_ERR, "Tss2_Sys_EvictControl(): rc = 0x%08X, %s", rc,
-                getErrorString(rc));
+      kmyth_log_tpm_rc("Tss2_Sys_EvictControl", rc);
       return 1;
     }
     kmyth_log(LOG_DEBUG, "made primary object persistent (handle = 0x%08X)",
@@ -460,9 +492,7 @@ int create_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                                     nullRspAuths);
       if (rc != TSS2_RC_SUCCESS)
       {
-        kmyth_log(LOG_ERR,
-                  "Tss2_Sys_PolicyGetDigest(): rc = 0x%08X, %s ... exiting",
-                  rc, getErrorString(rc));
+        kmyth_log_tpm_rc("Tss2_Sys_PolicyGetDigest", rc);
         return 1;
       }
       kmyth_log(LOG_DEBUG, "session digest: 0x%02X..%02X",
@@ -476,16 +506,11 @@ int create_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
 
       parent_name.size = 0;     // start with empty parent name
 
-      rc = Tss2_Sys_ReadPublic(sapi_ctx,
-                               parent_handle,
-                               nullCmdAuths,
-                               out_public, &parent_name, qual_name,
-                               nullRspAuths);
+      rc = read_tpm2_public(sapi_ctx, parent_handle,
+                            out_public, &parent_name, qual_name);
       if (rc != TSS2_RC_SUCCESS)
       {
-        kmyth_log(LOG_ERR,
-                  "Tss2_Sys_ReadPublic(): rc = 0x%08X, %s ... exiting", rc,
-                  getErrorString(rc));
+        kmyth_log_tpm_rc("Tss2_Sys_ReadPublic", rc);
         return 1;
       }
 
@@ -497,9 +522,7 @@ int create_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                                    &outside_info, &object_pcrSelect);
       if (rc != TSS2_RC_SUCCESS)
       {
-        kmyth_log(LOG_ERR,
-                  "Tss2_Sys_Create_Prepare(): rc = 0x%08X, %s ... exiting", rc,
-                  getErrorString(rc));
+        kmyth_log_tpm_rc("Tss2_Sys_Create_Prepare", rc);
         return 1;
       }
 
@@ -515,9 +538,7 @@ int create_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                                 (const uint8_t **) &cmdParams);
       if (rc != TSS2_RC_SUCCESS)
       {
-        kmyth_log(LOG_ERR,
-                  "Tss2_Sys_GetCpBuffer(): rc = 0x%08X, %s ... exiting", rc,
-                  getErrorString(rc));
+        kmyth_log_tpm_rc("Tss2_Sys_GetCpBuffer", rc);
         return 1;
       }
 
@@ -526,14 +547,12 @@ int create_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                                    (uint8_t *) & create_object_command_code);
       if (rc != TSS2_RC_SUCCESS)
       {
-        kmyth_log(LOG_ERR,
-                  "Tss2_Sys_GetCommandCode(): rc = 0x%08X, %s ... exiting", rc,
-                  getErrorString(rc));
+        kmyth_log_tpm_rc("Tss2_Sys_GetCommandCode", rc);
         return 1;
       }
 
       // prepare command and response authorization structures
-      if (init_policy_cmd_auth(createObjectAuthSession,
+      if (init_policy_cmd_auth(sapi_ctx, createObjectAuthSession,
                                create_object_command_code,
                                parent_name,
                                parent_auth,
@@ -552,9 +571,7 @@ int create_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
       rc = Tss2_Sys_SetCmdAuths(sapi_ctx, &createObjectCmdAuths);
       if (rc != TSS2_RC_SUCCESS)
       {
-        kmyth_log(LOG_ERR,
-                  "Tss2_Sys_SetCmdAuths(): rc = 0x%08X, %s ... exiting", rc,
-                  getErrorString(rc));
+        kmyth_log_tpm_rc("Tss2_Sys_SetCmdAuths", rc);
         return 1;
       }
     }
@@ -563,35 +580,66 @@ int create_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
     int retry_count = 0;
 
     kmyth_log(LOG_DEBUG, "creating object");
-    rc = Tss2_Sys_Create(sapi_ctx, parent_handle, &createObjectCmdAuths,
-                         &object_sensitive, &object_template, &outside_info,
-                         &object_pcrSelect, object_private, object_public,
-                         &creation_data, &creation_hash, &creation_ticket,
-                         &createObjectRspAuths);
-    while (rc == TPM2_RC_RETRY)
+    if (createObjectAuthSession != NULL
+        && (createObjectCmdAuths.auths[0].sessionAttributes
+            & TPMA_SESSION_DECRYPT))
     {
-      if (retry_count < MAX_RETRIES)
+      // The one-call Tss2_Sys_Create() would marshal the sensitive data
+      // again, in the clear, so the prepared command, whose sensitive data
+      // was encrypted by init_policy_cmd_auth(), is executed as it is
+      rc = Tss2_Sys_Execute(sapi_ctx);
+      if (rc != TSS2_RC_SUCCESS)
       {
-        rc = Tss2_Sys_Create(sapi_ctx, parent_handle, &createObjectCmdAuths,
-                             &object_sensitive, &object_template, &outside_info,
-                             &object_pcrSelect, object_private, object_public,
-                             &creation_data, &creation_hash, &creation_ticket,
-                             &createObjectRspAuths);
-        retry_count++;
+        kmyth_log_tpm_rc("Tss2_Sys_Execute", rc);
+        return 1;
       }
-      else
+      rc = Tss2_Sys_GetRspAuths(sapi_ctx, &createObjectRspAuths);
+      if (rc != TSS2_RC_SUCCESS)
       {
-        kmyth_log(LOG_ERR,
-                  "Tss2_Sys_Create(): retry limit (%d) reached ... exiting",
-                  MAX_RETRIES);
+        kmyth_log_tpm_rc("Tss2_Sys_GetRspAuths", rc);
+        return 1;
+      }
+      rc = Tss2_Sys_Create_Complete(sapi_ctx, object_private, object_public,
+                                    &creation_data, &creation_hash,
+                                    &creation_ticket);
+      if (rc != TSS2_RC_SUCCESS)
+      {
+        kmyth_log_tpm_rc("Tss2_Sys_Create_Complete", rc);
         return 1;
       }
     }
-    if (rc != TSS2_RC_SUCCESS)
+    else
     {
-      kmyth_log(LOG_ERR, "Tss2_Sys_Create(): rc = 0x%08X, %s ... exiting", rc,
-                getErrorString(rc));
-      return 1;
+      rc = Tss2_Sys_Create(sapi_ctx, parent_handle, &createObjectCmdAuths,
+                           &object_sensitive, &object_template, &outside_info,
+                           &object_pcrSelect, object_private, object_public,
+                           &creation_data, &creation_hash, &creation_ticket,
+                           &createObjectRspAuths);
+      while (rc == TPM2_RC_RETRY)
+      {
+        if (retry_count < MAX_RETRIES)
+        {
+          rc = Tss2_Sys_Create(sapi_ctx, parent_handle,
+                               &createObjectCmdAuths, &object_sensitive,
+                               &object_template, &outside_info,
+                               &object_pcrSelect, object_private,
+                               object_public, &creation_data, &creation_hash,
+                               &creation_ticket, &createObjectRspAuths);
+          retry_count++;
+        }
+        else
+        {
+          kmyth_log(LOG_ERR,
+                    "Tss2_Sys_Create(): retry limit (%d) reached ... exiting",
+                    MAX_RETRIES);
+          return 1;
+        }
+      }
+      if (rc != TSS2_RC_SUCCESS)
+      {
+        kmyth_log_tpm_rc("Tss2_Sys_Create", rc);
+        return 1;
+      }
     }
     if (retry_count > 0)
     {
@@ -613,9 +661,7 @@ int create_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                                 (const uint8_t **) &rspParams);
       if (rc != TSS2_RC_SUCCESS)
       {
-        kmyth_log(LOG_ERR,
-                  "Tss2_Sys_GetRpBuffer(): rc = 0x%08X, %s ... exiting", rc,
-                  getErrorString(rc));
+        kmyth_log_tpm_rc("Tss2_Sys_GetRpBuffer", rc);
         return 1;
       }
 
@@ -668,14 +714,11 @@ int load_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
   TPM2B_PUBLIC *out_public = NULL;  // not exporting, just getting name value
   TPM2B_NAME *qual_name = NULL; // don't need qualified name value
 
-  rc = Tss2_Sys_ReadPublic(sapi_ctx,
-                           parent_handle,
-                           nullCmdAuths,
-                           out_public, &parent_name, qual_name, nullRspAuths);
+  rc = read_tpm2_public(sapi_ctx, parent_handle,
+                        out_public, &parent_name, qual_name);
   if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "Tss2_Sys_ReadPublic(): rc = 0x%08X, %s ... exiting",
-              rc, getErrorString(rc));
+    kmyth_log_tpm_rc("Tss2_Sys_ReadPublic", rc);
     return 1;
   }
 
@@ -731,9 +774,7 @@ int load_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                                   nullCmdAuths, &session_digest, nullRspAuths);
     if (rc != TSS2_RC_SUCCESS)
     {
-      kmyth_log(LOG_ERR,
-                "Tss2_Sys_PolicyGetDigest(): rc = 0x%08X, %s ... exiting", rc,
-                getErrorString(rc));
+      kmyth_log_tpm_rc("Tss2_Sys_PolicyGetDigest", rc);
       return 1;
     }
     kmyth_log(LOG_DEBUG, "session digest: 0x%02X..%02X",
@@ -744,8 +785,7 @@ int load_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
     rc = Tss2_Sys_Load_Prepare(sapi_ctx, parent_handle, in_private, in_public);
     if (rc != TSS2_RC_SUCCESS)
     {
-      kmyth_log(LOG_ERR, "Tss2_Sys_Load_Prepare(): rc = 0x%08X, %s ... exiting",
-                rc, getErrorString(rc));
+      kmyth_log_tpm_rc("Tss2_Sys_Load_Prepare", rc);
       return 1;
     }
 
@@ -761,8 +801,7 @@ int load_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                               &cmdParams_size, (const uint8_t **) &cmdParams);
     if (rc != TSS2_RC_SUCCESS)
     {
-      kmyth_log(LOG_ERR, "Tss2_Sys_GetCpBuffer(): rc = 0x%08X, %s ... exiting",
-                rc, getErrorString(rc));
+      kmyth_log_tpm_rc("Tss2_Sys_GetCpBuffer", rc);
       return 1;
     }
 
@@ -771,13 +810,11 @@ int load_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                                  (uint8_t *) & load_object_command_code);
     if (rc != TSS2_RC_SUCCESS)
     {
-      kmyth_log(LOG_ERR,
-                "Tss2_Sys_GetCommandCode(): rc = 0x%08X, %s ... exiting", rc,
-                getErrorString(rc));
+      kmyth_log_tpm_rc("Tss2_Sys_GetCommandCode", rc);
       return 1;
     }
     // prepare command and response authorization structures
-    if (init_policy_cmd_auth(loadObjectAuthSession,
+    if (init_policy_cmd_auth(sapi_ctx, loadObjectAuthSession,
                              load_object_command_code,
                              parent_name,
                              parent_auth,
@@ -795,8 +832,7 @@ int load_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
     rc = Tss2_Sys_SetCmdAuths(sapi_ctx, &loadObjectCmdAuths);
     if (rc != TSS2_RC_SUCCESS)
     {
-      kmyth_log(LOG_ERR, "Tss2_Sys_SetCmdAuths(): rc = 0x%08X, %s ... exiting",
-                rc, getErrorString(rc));
+      kmyth_log_tpm_rc("Tss2_Sys_SetCmdAuths", rc);
       return 1;
     }
   }
@@ -810,8 +846,7 @@ int load_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                      object_handle, &parent_name, &loadObjectRspAuths);
   if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "Tss2_Sys_Load(): rc = 0x%08X, %s ... exiting", rc,
-              getErrorString(rc));
+    kmyth_log_tpm_rc("Tss2_Sys_Load", rc);
     return 1;
   }
   kmyth_log(LOG_DEBUG, "loaded object into TPM");
@@ -830,8 +865,7 @@ int load_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                               (const uint8_t **) &rspParams);
     if (rc != TSS2_RC_SUCCESS)
     {
-      kmyth_log(LOG_ERR, "Tss2_Sys_GetRpBuffer(): rc = 0x%08X, %s ... exiting",
-                rc, getErrorString(rc));
+      kmyth_log_tpm_rc("Tss2_Sys_GetRpBuffer", rc);
       return 1;
     }
 
@@ -904,9 +938,7 @@ int unseal_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                                 nullCmdAuths, &session_digest, nullRspAuths);
   if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR,
-              "Tss2_Sys_PolicyGetDigest(): rc = 0x%08X, %s ... exiting", rc,
-              getErrorString(rc));
+    kmyth_log_tpm_rc("Tss2_Sys_PolicyGetDigest", rc);
     return 1;
   }
   kmyth_log(LOG_DEBUG, "session digest: 0x%02X..%02X",
@@ -926,8 +958,7 @@ int unseal_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                            out_public, &object_name, qual_name, nullRspAuths);
   if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "Tss2_Sys_ReadPublic(): rc = 0x%08X, %s ... exiting",
-              rc, getErrorString(rc));
+    kmyth_log_tpm_rc("Tss2_Sys_ReadPublic", rc);
     return 1;
   }
 
@@ -942,8 +973,7 @@ int unseal_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
   rc = Tss2_Sys_Unseal_Prepare(sapi_ctx, object_handle);
   if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "Tss2_Sys_Unseal_Prepare(): rc = 0x%08X, %s ... exiting",
-              rc, getErrorString(rc));
+    kmyth_log_tpm_rc("Tss2_Sys_Unseal_Prepare", rc);
     return 1;
   }
 
@@ -952,8 +982,7 @@ int unseal_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                             &cmdParams_size, (const uint8_t **) &cmdParams);
   if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "Tss2_Sys_GetCpBuffer(): rc = 0x%08X, %s ... exiting",
-              rc, getErrorString(rc));
+    kmyth_log_tpm_rc("Tss2_Sys_GetCpBuffer", rc);
     return 1;
   }
 
@@ -962,13 +991,12 @@ int unseal_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                                (uint8_t *) & unseal_object_command_code);
   if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "Tss2_Sys_GetCommandCode(): rc = 0x%08X, %s ... exiting",
-              rc, getErrorString(rc));
+    kmyth_log_tpm_rc("Tss2_Sys_GetCommandCode", rc);
     return 1;
   }
 
   // prepare command and response authorization structures
-  if (init_policy_cmd_auth(unsealObjectAuthSession,
+  if (init_policy_cmd_auth(sapi_ctx, unsealObjectAuthSession,
                            unseal_object_command_code,
                            object_name,
                            object_auth,
@@ -986,8 +1014,7 @@ int unseal_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
   rc = Tss2_Sys_SetCmdAuths(sapi_ctx, &unsealObjectCmdAuths);
   if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "Tss2_Sys_SetCmdAuths(): rc = 0x%08X, %s ... exiting",
-              rc, getErrorString(rc));
+    kmyth_log_tpm_rc("Tss2_Sys_SetCmdAuths", rc);
     return 1;
   }
 
@@ -997,8 +1024,7 @@ int unseal_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                        object_sensitive, &unsealObjectRspAuths);
   if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "Tss2_Sys_Unseal(): rc = 0x%08X, %s ... exiting",
-              rc, getErrorString(rc));
+    kmyth_log_tpm_rc("Tss2_Sys_Unseal", rc);
     return 1;
   }
 
@@ -1014,8 +1040,7 @@ int unseal_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                             (const uint8_t **) &rspParams);
   if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "Tss2_Sys_GetRpBuffer(): rc = 0x%08X, %s ... exiting",
-              rc, getErrorString(rc));
+    kmyth_log_tpm_rc("Tss2_Sys_GetRpBuffer", rc);
     return 1;
   }
 
@@ -1026,9 +1051,23 @@ int unseal_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                           rspParams_size, object_auth, &unsealObjectRspAuths))
   {
     kmyth_log(LOG_ERR, "response auth check failed ... exiting");
+    kmyth_clear(object_sensitive, sizeof(TPM2B_SENSITIVE_DATA));
     return 1;
   }
   kmyth_log(LOG_DEBUG, "validated HMAC in TPM unseal response");
 
+  // decrypt the unsealed data if the TPM returned it encrypted
+  if (unsealObjectRspAuths.auths[0].sessionAttributes & TPMA_SESSION_ENCRYPT)
+  {
+    if (crypt_session_param(unsealObjectAuthSession, object_auth, false,
+                            object_sensitive->buffer, object_sensitive->size))
+    {
+      kmyth_log(LOG_ERR, "error decrypting unsealed data ... exiting");
+      kmyth_clear(object_sensitive, sizeof(TPM2B_SENSITIVE_DATA));
+      return 1;
+    }
+    kmyth_log(LOG_DEBUG, "decrypted unsealed data");
+  }
+
   return 0;
 }
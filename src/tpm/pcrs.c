@@ -7,13 +7,116 @@
 #include "pcrs.h"
 
 #include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <openssl/evp.h>
 
 #include "defines.h"
+#include "kmyth_metrics.h"
 #include "tpm2_interface.h"
 
+//############################################################################
+// parse_pcrs_string()
+//############################################################################
+int parse_pcrs_string(char *pcrs_string, int **pcrs, int *pcrs_len)
+{
+  *pcrs_len = 0;
+
+  if (pcrs_string == NULL)
+  {
+    return 0;
+  }
+
+  kmyth_log(LOG_DEBUG, "parsing PCR selection string");
+
+  *pcrs = NULL;
+  *pcrs = malloc(24 * sizeof(int));
+  size_t pcrs_array_size = 24;
+
+  if (pcrs == NULL)
+  {
+    kmyth_log(LOG_ERR,
+              "failed to allocate memory to parse PCR string ... exiting");
+    return 1;
+  }
+
+  char *pcrs_string_cur = pcrs_string;
+  char *pcrs_string_next = NULL;
+
+  long pcrIndex;
+
+  while (*pcrs_string_cur != '\0')
+  {
+    pcrIndex = strtol(pcrs_string_cur, &pcrs_string_next, 10);
+
+    // Check for overflow or underflow on the strtol call. There
+    // really shouldn't be, because the number of PCRs is small.
+    if ((pcrIndex == LONG_MIN) || (pcrIndex == LONG_MAX))
+    {
+      kmyth_log(LOG_ERR, "invalid PCR value specified ... exiting");
+      free(*pcrs);
+      *pcrs_len = 0;
+      return 1;
+    }
+
+    // Check that strtol didn't fail to parse an integer, which is the only
+    // condition that would cause the pointers to match.
+    if (pcrs_string_cur == pcrs_string_next)
+    {
+      kmyth_log(LOG_ERR, "error parsing PCR string ... exiting");
+      free(*pcrs);
+      *pcrs_len = 0;
+      return 1;
+    }
+
+    // Look at the first invalid character from the last call to strtol
+    // and confirm it's a blank, a comma, or '\0'. If not there's a disallowed
+    // character in the PCR string.
+    if (!isblank(*pcrs_string_next) && (*pcrs_string_next != ',')
+        && (*pcrs_string_next != '\0'))
+    {
+      kmyth_log(LOG_ERR, "invalid character (%c) in PCR string ... exiting",
+                *pcrs_string_next);
+      free(*pcrs);
+      *pcrs_len = 0;
+      return 1;
+    }
+
+    // Step past the invalid characters, checking not to skip past the
+    // end of the string.
+    while ((*pcrs_string_next != '\0')
+           && (isblank(*pcrs_string_next) || (*pcrs_string_next == ',')))
+    {
+      pcrs_string_next++;
+    }
+
+    if (*pcrs_len == pcrs_array_size)
+    {
+      int *new_pcrs = NULL;
+
+      new_pcrs = realloc(*pcrs, pcrs_array_size * 2);
+      if (new_pcrs == NULL)
+      {
+        kmyth_log(LOG_ERR, "Ran out of memory ... exiting");
+        free(*pcrs);
+        *pcrs_len = 0;
+        return 1;
+      }
+      *pcrs = new_pcrs;
+      pcrs_array_size *= 2;
+    }
+    (*pcrs)[*pcrs_len] = (int) pcrIndex;
+    (*pcrs_len)++;
+    pcrs_string_cur = pcrs_string_next;
+    pcrs_string_next = NULL;
+  }
+
+  return 0;
+}
+
 //############################################################################
 // init_pcr_selection()
 //############################################################################
@@ -102,3 +205,328 @@ int get_pcr_count(TSS2_SYS_CONTEXT * sapi_ctx, int *pcrCount)
             *pcrCount);
   return 0;
 }
+
+//############################################################################
+// pcr_selection_empty()
+//############################################################################
+static bool pcr_selection_empty(TPML_PCR_SELECTION * selection)
+{
+  for (uint32_t i = 0; i < selection->count; i++)
+  {
+    for (uint8_t k = 0; k < selection->pcrSelections[i].sizeofSelect; k++)
+    {
+      if (selection->pcrSelections[i].pcrSelect[k] != 0)
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+//############################################################################
+// same_pcr_selection()
+//############################################################################
+static bool same_pcr_selection(TPML_PCR_SELECTION * a, TPML_PCR_SELECTION * b)
+{
+  if (a->count != b->count)
+  {
+    return false;
+  }
+  for (uint32_t i = 0; i < a->count; i++)
+  {
+    if (a->pcrSelections[i].hash != b->pcrSelections[i].hash
+        || a->pcrSelections[i].sizeofSelect != b->pcrSelections[i].sizeofSelect
+        || memcmp(a->pcrSelections[i].pcrSelect, b->pcrSelections[i].pcrSelect,
+                  a->pcrSelections[i].sizeofSelect) != 0)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+//############################################################################
+// drop_pcr_selection()
+//############################################################################
+static void drop_pcr_selection(TPML_PCR_SELECTION * selection,
+                               TPML_PCR_SELECTION * read)
+{
+  for (uint32_t i = 0; i < selection->count; i++)
+  {
+    for (uint32_t j = 0; j < read->count; j++)
+    {
+      if (read->pcrSelections[j].hash != selection->pcrSelections[i].hash)
+      {
+        continue;
+      }
+      for (uint8_t k = 0; k < selection->pcrSelections[i].sizeofSelect
+           && k < read->pcrSelections[j].sizeofSelect; k++)
+      {
+        selection->pcrSelections[i].pcrSelect[k] &=
+          (uint8_t) ~ read->pcrSelections[j].pcrSelect[k];
+      }
+    }
+  }
+}
+
+//############################################################################
+// read_pcr_snapshot()
+//############################################################################
+int read_pcr_snapshot(TSS2_SYS_CONTEXT * sapi_ctx,
+                      TPML_PCR_SELECTION selection,
+                      kmyth_pcr_snapshot * snapshot)
+{
+  if (snapshot == NULL)
+  {
+    kmyth_log(LOG_ERR, "no PCR snapshot ... exiting");
+    return 1;
+  }
+  snapshot->valid = false;
+  snapshot->count = 0;
+
+  // nothing to read (and so no TPM command) for an empty selection
+  if (pcr_selection_empty(&selection))
+  {
+    snapshot->selection = selection;
+    snapshot->update_counter = 0;
+    snapshot->valid = true;
+    return 0;
+  }
+
+  // the values must all come from the same PCR state, so the selection is
+  // read again (a few times at most) if a PCR changes between batches
+  for (int attempt = 0; attempt < 3; attempt++)
+  {
+    TPML_PCR_SELECTION remaining = selection;
+    bool consistent = true;
+
+    snapshot->count = 0;
+    while (!pcr_selection_empty(&remaining))
+    {
+      uint32_t pcrUpdateCounter = 0;
+      TPML_PCR_SELECTION pcrSelectionOut = {.count = 0, };
+      TPML_DIGEST pcrValues = {.count = 0, };
+      TPM2_RC rc = read_tpm2_pcrs(sapi_ctx,
+                                  &remaining,
+                                  &pcrUpdateCounter,
+                                  &pcrSelectionOut,
+                                  &pcrValues);
+
+      if (rc != TPM2_RC_SUCCESS)
+      {
+        kmyth_log_tpm_rc("Tss2_Sys_PCR_Read", rc);
+        return 1;
+      }
+      if (pcrValues.count == 0)
+      {
+        kmyth_log(LOG_ERR, "no PCR values read ... exiting");
+        return 1;
+      }
+      if (snapshot->count > 0 && pcrUpdateCounter != snapshot->update_counter)
+      {
+        consistent = false;
+        break;
+      }
+      if (snapshot->count + pcrValues.count > KMYTH_PCR_SNAPSHOT_MAX)
+      {
+        kmyth_log(LOG_ERR, "too many PCRs selected for snapshot ... exiting");
+        return 1;
+      }
+      for (uint32_t i = 0; i < pcrValues.count; i++)
+      {
+        snapshot->values[snapshot->count++] = pcrValues.digests[i];
+      }
+      snapshot->update_counter = pcrUpdateCounter;
+
+      // drop the PCRs just read from the selection still to be read
+      drop_pcr_selection(&remaining, &pcrSelectionOut);
+    }
+
+    if (consistent)
+    {
+      snapshot->selection = selection;
+      snapshot->valid = true;
+      kmyth_log(LOG_DEBUG, "read %u PCR values (update counter = %u)",
+                snapshot->count, snapshot->update_counter);
+      return 0;
+    }
+    kmyth_log(LOG_DEBUG, "PCRs changed while being read, reading again");
+  }
+
+  kmyth_log(LOG_ERR, "PCRs changed while being read ... exiting");
+  return 1;
+}
+
+//############################################################################
+// selects_no_increment_pcr()
+//############################################################################
+static bool selects_no_increment_pcr(TSS2_SYS_CONTEXT * sapi_ctx,
+                                     TPML_PCR_SELECTION * selection,
+                                     kmyth_pcr_snapshot * snapshot)
+{
+  if (!snapshot->no_increment_known)
+  {
+    TPMS_CAPABILITY_DATA capData;
+
+    if (get_tpm2_properties(sapi_ctx, TPM2_CAP_PCR_PROPERTIES,
+                            TPM2_PT_PCR_NO_INCREMENT, 1, &capData)
+        || capData.data.pcrProperties.count == 0
+        || capData.data.pcrProperties.pcrProperty[0].tag !=
+        TPM2_PT_PCR_NO_INCREMENT)
+    {
+      // without the property, no snapshot can be trusted to be current
+      return true;
+    }
+    memset(snapshot->no_increment, 0, TPM2_PCR_SELECT_MAX);
+    for (uint8_t k = 0;
+         k < capData.data.pcrProperties.pcrProperty[0].sizeofSelect
+         && k < TPM2_PCR_SELECT_MAX; k++)
+    {
+      snapshot->no_increment[k] =
+        capData.data.pcrProperties.pcrProperty[0].pcrSelect[k];
+    }
+    snapshot->no_increment_known = true;
+  }
+
+  for (uint32_t i = 0; i < selection->count; i++)
+  {
+    for (uint8_t k = 0; k < selection->pcrSelections[i].sizeofSelect
+         && k < TPM2_PCR_SELECT_MAX; k++)
+    {
+      if (selection->pcrSelections[i].pcrSelect[k] & snapshot->no_increment[k])
+      {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+//############################################################################
+// refresh_pcr_snapshot()
+//############################################################################
+int refresh_pcr_snapshot(TSS2_SYS_CONTEXT * sapi_ctx,
+                         TPML_PCR_SELECTION selection,
+                         kmyth_pcr_snapshot * snapshot)
+{
+  if (snapshot == NULL)
+  {
+    kmyth_log(LOG_ERR, "no PCR snapshot ... exiting");
+    return 1;
+  }
+
+  if (snapshot->valid && !pcr_selection_empty(&selection)
+      && same_pcr_selection(&snapshot->selection, &selection)
+      && !selects_no_increment_pcr(sapi_ctx, &selection, snapshot))
+  {
+    // selecting no PCRs reads just the update counter
+    uint32_t pcrUpdateCounter = 0;
+    TPML_PCR_SELECTION noPcrs = {.count = 0, };
+    TPML_PCR_SELECTION pcrSelectionOut = {.count = 0, };
+    TPML_DIGEST pcrValues = {.count = 0, };
+    TPM2_RC rc = read_tpm2_pcrs(sapi_ctx,
+                                &noPcrs,
+                                &pcrUpdateCounter,
+                                &pcrSelectionOut,
+                                &pcrValues);
+
+    if (rc == TPM2_RC_SUCCESS && pcrUpdateCounter == snapshot->update_counter)
+    {
+      kmyth_metrics_count("kmyth_tpm_pcr_snapshot_total", "result=\"hit\"",
+                          "PCR snapshots reused or read", 1);
+      kmyth_log(LOG_DEBUG, "reusing PCR snapshot (update counter = %u)",
+                pcrUpdateCounter);
+      return 0;
+    }
+  }
+
+  kmyth_metrics_count("kmyth_tpm_pcr_snapshot_total", "result=\"miss\"",
+                      "PCR snapshots reused or read", 1);
+  return read_pcr_snapshot(sapi_ctx, selection, snapshot);
+}
+
+//############################################################################
+// get_pcr_snapshot_digest()
+//############################################################################
+int get_pcr_snapshot_digest(kmyth_pcr_snapshot * snapshot,
+                            TPM2B_DIGEST * pcrDigest)
+{
+  if (snapshot == NULL || !snapshot->valid || pcrDigest == NULL)
+  {
+    kmyth_log(LOG_ERR, "no PCR snapshot or digest ... exiting");
+    return 1;
+  }
+
+  EVP_MD_CTX *md_ctx = EVP_MD_CTX_new();
+  unsigned int digest_size = 0;
+
+  if (md_ctx == NULL || !EVP_DigestInit_ex(md_ctx, KMYTH_OPENSSL_HASH, NULL))
+  {
+    kmyth_log(LOG_ERR, "error initializing PCR digest ... exiting");
+    EVP_MD_CTX_free(md_ctx);
+    return 1;
+  }
+  for (uint32_t i = 0; i < snapshot->count; i++)
+  {
+    if (!EVP_DigestUpdate(md_ctx, snapshot->values[i].buffer,
+                          snapshot->values[i].size))
+    {
+      kmyth_log(LOG_ERR, "error updating PCR digest ... exiting");
+      EVP_MD_CTX_free(md_ctx);
+      return 1;
+    }
+  }
+  if (!EVP_DigestFinal_ex(md_ctx, pcrDigest->buffer, &digest_size))
+  {
+    kmyth_log(LOG_ERR, "error finalizing PCR digest ... exiting");
+    EVP_MD_CTX_free(md_ctx);
+    return 1;
+  }
+  EVP_MD_CTX_free(md_ctx);
+  pcrDigest->size = digest_size;
+
+  return 0;
+}
+
+//############################################################################
+// log_pcr_snapshot()
+//############################################################################
+void log_pcr_snapshot(int severity, kmyth_pcr_snapshot * snapshot)
+{
+  if (snapshot == NULL || !snapshot->valid)
+  {
+    return;
+  }
+
+  // the values are held in selection order
+  uint32_t n = 0;
+
+  for (uint32_t i = 0; i < snapshot->selection.count; i++)
+  {
+    TPMS_PCR_SELECTION *bank = &snapshot->selection.pcrSelections[i];
+
+    for (int pcr = 0; pcr < bank->sizeofSelect * 8; pcr++)
+    {
+      if (!(bank->pcrSelect[pcr / 8] & (1 << (pcr % 8))))
+      {
+        continue;
+      }
+      if (n >= snapshot->count)
+      {
+        return;
+      }
+
+      char hex[2 * sizeof(snapshot->values[n].buffer) + 1];
+
+      for (uint16_t k = 0; k < snapshot->values[n].size; k++)
+      {
+        snprintf(hex + 2 * k, 3, "%02x", snapshot->values[n].buffer[k]);
+      }
+      hex[2 * snapshot->values[n].size] = '\0';
+      kmyth_log(severity, "PCR %d (hash alg 0x%04X) = %s", pcr, bank->hash,
+                hex);
+      n++;
+    }
+  }
+}
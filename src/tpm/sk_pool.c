@@ -0,0 +1,512 @@
+/**
+ * @file  sk_pool.c
+ *
+ * @brief Implements the pool of pre-created storage keys (SKs) kept in a
+ *        pool directory (see sk_pool.h).
+ */
+
+#include "sk_pool.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <arpa/inet.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <tss2/tss2_mu.h>
+
+#include "cipher/random_pool.h"
+#include "file_io.h"
+#include "memory_util.h"
+#include "object_tools.h"
+
+/*
+ * Pooled key files are named '<pool ID>-<suffix>.sk', with a random suffix
+ * of KMYTH_SK_POOL_SUFFIX_BYTES bytes (hex encoded)
+ */
+#define KMYTH_SK_POOL_SUFFIX_BYTES 8
+#define KMYTH_SK_POOL_FILE_EXT ".sk"
+
+//############################################################################
+// is_pool_file()
+//############################################################################
+static bool is_pool_file(const char *name, const char *id)
+{
+  size_t id_len = strlen(id);
+  size_t name_len = strlen(name);
+  size_t ext_len = strlen(KMYTH_SK_POOL_FILE_EXT);
+
+  return (name_len > id_len + 1 + ext_len &&
+          strncmp(name, id, id_len) == 0 && name[id_len] == '-' &&
+          strcmp(name + name_len - ext_len, KMYTH_SK_POOL_FILE_EXT) == 0);
+}
+
+//############################################################################
+// get_pool_path()
+//############################################################################
+static char *get_pool_path(const char *pool_dir, const char *prefix,
+                           const char *name, const char *suffix)
+{
+  size_t path_len = strlen(pool_dir) + strlen(prefix) + strlen(name) +
+    strlen(suffix) + 2;
+  char *path = malloc(path_len);
+
+  if (path == NULL)
+  {
+    kmyth_log(LOG_ERR, "failed to allocate SK pool path ... exiting");
+    return NULL;
+  }
+  snprintf(path, path_len, "%s/%s%s%s", pool_dir, prefix, name, suffix);
+
+  return path;
+}
+
+//############################################################################
+// get_pool_suffix()
+//
+// Generates the random (hex encoded) suffix that makes a pool file name
+// unique across the processes using the pool
+//############################################################################
+static int get_pool_suffix(char *suffix)
+{
+  uint8_t suffix_bytes[KMYTH_SK_POOL_SUFFIX_BYTES];
+
+  if (random_pool_bytes(suffix_bytes, sizeof(suffix_bytes)))
+  {
+    kmyth_log(LOG_ERR, "error generating SK pool file name ... exiting");
+    return 1;
+  }
+  for (size_t i = 0; i < KMYTH_SK_POOL_SUFFIX_BYTES; i++)
+  {
+    snprintf(suffix + 2 * i, 3, "%02x", suffix_bytes[i]);
+  }
+
+  return 0;
+}
+
+//############################################################################
+// get_sk_pool_key()
+//
+// Reads the pool key, creating the pool directory and key if they do not
+// exist yet
+//############################################################################
+static int get_sk_pool_key(const char *pool_dir, uint8_t * key)
+{
+  if (make_private_dir(pool_dir))
+  {
+    return 1;
+  }
+
+  char *key_path = get_pool_path(pool_dir, "", KMYTH_SK_POOL_KEY_FILE, "");
+
+  if (key_path == NULL)
+  {
+    return 1;
+  }
+
+  // a new key is written (readable only by its owner) under a temporary
+  // name and linked into place: if another process linked its key first,
+  // the link fails and that key is used instead
+  if (access(key_path, F_OK) != 0)
+  {
+    uint8_t new_key[KMYTH_SK_POOL_KEY_SIZE];
+    char suffix[2 * KMYTH_SK_POOL_SUFFIX_BYTES + 2] = ".";
+    char *tmp_path = NULL;
+
+    bool written = (get_pool_suffix(suffix + 1) == 0
+                    && (tmp_path = get_pool_path(pool_dir, "",
+                                                 KMYTH_SK_POOL_KEY_FILE,
+                                                 suffix)) != NULL
+                    && RAND_priv_bytes(new_key, sizeof(new_key)) == 1
+                    && write_bytes_to_new_file(tmp_path, new_key,
+                                               sizeof(new_key), 0600) == 0);
+
+    kmyth_clear(new_key, sizeof(new_key));
+    if (written && link(tmp_path, key_path) && errno != EEXIST)
+    {
+      written = false;
+    }
+    if (tmp_path != NULL)
+    {
+      unlink(tmp_path);
+    }
+    free(tmp_path);
+    if (!written)
+    {
+      kmyth_log(LOG_ERR, "unable to create SK pool key ... exiting");
+      free(key_path);
+      return 1;
+    }
+  }
+
+  uint8_t *key_bytes = NULL;
+  size_t key_bytes_len = 0;
+  int retval = read_bytes_from_file(key_path, &key_bytes, &key_bytes_len);
+
+  free(key_path);
+  if (retval || key_bytes_len != KMYTH_SK_POOL_KEY_SIZE)
+  {
+    kmyth_log(LOG_ERR, "unable to read SK pool key ... exiting");
+    kmyth_clear_and_free(key_bytes, key_bytes_len);
+    return 1;
+  }
+  memcpy(key, key_bytes, KMYTH_SK_POOL_KEY_SIZE);
+  kmyth_clear_and_free(key_bytes, key_bytes_len);
+
+  return 0;
+}
+
+//############################################################################
+// check_pooled_sk()
+//
+// Checks that a pooled key's public area is the one a Kmyth SK with the
+// given algorithm and policy would have been created with, so that a key
+// file put in the pool by anyone else (e.g., a duplicable key its creator
+// could export) is never used
+//############################################################################
+static bool check_pooled_sk(const TPMT_PUBLIC * pub, TPMI_ALG_PUBLIC sk_alg,
+                            TPM2B_DIGEST sk_authPolicy)
+{
+  TPMT_PUBLIC expected = { 0 };
+
+  if (init_kmyth_key_template(sk_alg, sk_authPolicy, &expected))
+  {
+    return false;
+  }
+  if (pub->type != expected.type || pub->nameAlg != expected.nameAlg
+      || pub->objectAttributes != expected.objectAttributes
+      || pub->authPolicy.size != expected.authPolicy.size
+      || memcmp(pub->authPolicy.buffer, expected.authPolicy.buffer,
+                expected.authPolicy.size) != 0)
+  {
+    return false;
+  }
+
+  if (pub->type == TPM2_ALG_RSA)
+  {
+    const TPMS_RSA_PARMS *p = &pub->parameters.rsaDetail;
+    const TPMS_RSA_PARMS *e = &expected.parameters.rsaDetail;
+
+    return (p->symmetric.algorithm == e->symmetric.algorithm
+            && p->symmetric.keyBits.sym == e->symmetric.keyBits.sym
+            && p->symmetric.mode.sym == e->symmetric.mode.sym
+            && p->scheme.scheme == e->scheme.scheme
+            && p->keyBits == e->keyBits && p->exponent == e->exponent);
+  }
+
+  const TPMS_ECC_PARMS *p = &pub->parameters.eccDetail;
+  const TPMS_ECC_PARMS *e = &expected.parameters.eccDetail;
+
+  return (p->symmetric.algorithm == e->symmetric.algorithm
+          && p->symmetric.keyBits.sym == e->symmetric.keyBits.sym
+          && p->symmetric.mode.sym == e->symmetric.mode.sym
+          && p->scheme.scheme == e->scheme.scheme
+          && p->curveID == e->curveID && p->kdf.scheme == e->kdf.scheme);
+}
+
+//############################################################################
+// get_sk_pool_id()
+//############################################################################
+int get_sk_pool_id(const char *pool_dir, TPMI_ALG_PUBLIC sk_alg,
+                   TPM2B_DIGEST sk_authPolicy, TPM2B_AUTH sk_authVal,
+                   char *id)
+{
+  if (pool_dir == NULL || id == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input ... exiting");
+    kmyth_clear(sk_authVal.buffer, sk_authVal.size);
+    return 1;
+  }
+
+  uint8_t key[KMYTH_SK_POOL_KEY_SIZE];
+
+  if (get_sk_pool_key(pool_dir, key))
+  {
+    kmyth_clear(sk_authVal.buffer, sk_authVal.size);
+    return 1;
+  }
+
+  // the ID is a keyed digest, so that the file names in the pool cannot be
+  // used (by anyone without the pool key) to test guesses of the authVal
+  uint16_t alg = htons(sk_alg);
+  uint16_t policy_size = htons(sk_authPolicy.size);
+  uint8_t digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_len = 0;
+  HMAC_CTX *hmac_ctx = HMAC_CTX_new();
+
+  int ok = (hmac_ctx != NULL &&
+            HMAC_Init_ex(hmac_ctx, key, sizeof(key), KMYTH_OPENSSL_HASH,
+                         NULL) &&
+            HMAC_Update(hmac_ctx, (const unsigned char *) &alg,
+                        sizeof(alg)) &&
+            HMAC_Update(hmac_ctx, (const unsigned char *) &policy_size,
+                        sizeof(policy_size)) &&
+            HMAC_Update(hmac_ctx, sk_authPolicy.buffer, sk_authPolicy.size) &&
+            HMAC_Update(hmac_ctx, sk_authVal.buffer, sk_authVal.size) &&
+            HMAC_Final(hmac_ctx, digest, &digest_len) &&
+            digest_len == KMYTH_DIGEST_SIZE);
+
+  HMAC_CTX_free(hmac_ctx);
+  kmyth_clear(key, sizeof(key));
+  kmyth_clear(sk_authVal.buffer, sk_authVal.size);
+
+  if (!ok)
+  {
+    kmyth_log(LOG_ERR, "error computing SK pool ID ... exiting");
+    return 1;
+  }
+
+  for (size_t i = 0; i < KMYTH_DIGEST_SIZE; i++)
+  {
+    snprintf(id + 2 * i, 3, "%02x", digest[i]);
+  }
+
+  return 0;
+}
+
+//############################################################################
+// sk_pool_count()
+//############################################################################
+int sk_pool_count(const char *pool_dir, const char *id, size_t *count)
+{
+  if (pool_dir == NULL || id == NULL || count == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input ... exiting");
+    return 1;
+  }
+  *count = 0;
+
+  DIR *dir = opendir(pool_dir);
+
+  if (dir == NULL)
+  {
+    if (errno == ENOENT)
+    {
+      return 0;
+    }
+    kmyth_log(LOG_ERR, "unable to open SK pool (%s) ... exiting", pool_dir);
+    return 1;
+  }
+
+  struct dirent *entry = NULL;
+
+  while ((entry = readdir(dir)) != NULL)
+  {
+    if (is_pool_file(entry->d_name, id))
+    {
+      (*count)++;
+    }
+  }
+  closedir(dir);
+
+  return 0;
+}
+
+//############################################################################
+// sk_pool_put()
+//############################################################################
+int sk_pool_put(const char *pool_dir, const char *id,
+                TPM2B_PUBLIC * sk_public, TPM2B_PRIVATE * sk_private)
+{
+  if (pool_dir == NULL || id == NULL || sk_public == NULL
+      || sk_private == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input ... exiting");
+    return 1;
+  }
+
+  if (make_private_dir(pool_dir))
+  {
+    kmyth_log(LOG_ERR, "unable to use SK pool (%s) ... exiting", pool_dir);
+    return 1;
+  }
+
+  // the key file holds the marshalled public blob followed by the
+  // marshalled private blob
+  uint8_t packed[sizeof(TPM2B_PUBLIC) + sizeof(TPM2B_PRIVATE)];
+  size_t packed_size = 0;
+  TSS2_RC rc = Tss2_MU_TPM2B_PUBLIC_Marshal(sk_public, packed,
+                                            sizeof(packed), &packed_size);
+
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    rc = Tss2_MU_TPM2B_PRIVATE_Marshal(sk_private, packed, sizeof(packed),
+                                       &packed_size);
+  }
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "error marshalling storage key: 0x%08X ... exiting",
+              rc);
+    return 1;
+  }
+
+  // name the key file with the pool ID and a random suffix, unique across
+  // the processes filling the pool
+  char suffix[2 * KMYTH_SK_POOL_SUFFIX_BYTES + 1];
+  char name[KMYTH_SK_POOL_ID_LEN + 2 * KMYTH_SK_POOL_SUFFIX_BYTES + 1];
+
+  if (get_pool_suffix(suffix))
+  {
+    return 1;
+  }
+  snprintf(name, sizeof(name), "%s-%s", id, suffix);
+
+  char *tmp_path = get_pool_path(pool_dir, ".", name, ".tmp");
+  char *path = get_pool_path(pool_dir, "", name, KMYTH_SK_POOL_FILE_EXT);
+
+  if (tmp_path == NULL || path == NULL)
+  {
+    free(tmp_path);
+    free(path);
+    return 1;
+  }
+
+  // pooled keys are readable only by the pool owner, like the pool
+  if (write_bytes_to_new_file(tmp_path, packed, packed_size, 0600))
+  {
+    kmyth_log(LOG_ERR, "error writing pooled storage key ... exiting");
+    free(tmp_path);
+    free(path);
+    return 1;
+  }
+  if (rename(tmp_path, path))
+  {
+    kmyth_log(LOG_ERR, "error adding storage key to SK pool ... exiting");
+    unlink(tmp_path);
+    free(tmp_path);
+    free(path);
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "added storage key to SK pool (%s)", path);
+
+  free(tmp_path);
+  free(path);
+  return 0;
+}
+
+//############################################################################
+// sk_pool_take()
+//############################################################################
+int sk_pool_take(const char *pool_dir, const char *id,
+                 TPMI_ALG_PUBLIC sk_alg, TPM2B_DIGEST sk_authPolicy,
+                 TPM2B_PUBLIC * sk_public, TPM2B_PRIVATE * sk_private,
+                 bool *found)
+{
+  if (pool_dir == NULL || id == NULL || sk_public == NULL
+      || sk_private == NULL || found == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input ... exiting");
+    return 1;
+  }
+  *found = false;
+
+  // keys are only taken from a pool no one else could have put them in
+  struct stat st = { 0 };
+
+  if (lstat(pool_dir, &st) != 0)
+  {
+    if (errno == ENOENT)
+    {
+      return 0;
+    }
+    kmyth_log(LOG_ERR, "unable to open SK pool (%s) ... exiting", pool_dir);
+    return 1;
+  }
+  if (make_private_dir(pool_dir))
+  {
+    kmyth_log(LOG_ERR, "unable to use SK pool (%s) ... exiting", pool_dir);
+    return 1;
+  }
+
+  DIR *dir = opendir(pool_dir);
+
+  if (dir == NULL)
+  {
+    if (errno == ENOENT)
+    {
+      return 0;
+    }
+    kmyth_log(LOG_ERR, "unable to open SK pool (%s) ... exiting", pool_dir);
+    return 1;
+  }
+
+  // claim the first key file that can be renamed: a concurrent taker may
+  // have renamed (claimed) a listed file first, so a failed rename just
+  // moves on to the next file
+  char *claimed_path = NULL;
+  struct dirent *entry = NULL;
+
+  while (claimed_path == NULL && (entry = readdir(dir)) != NULL)
+  {
+    if (!is_pool_file(entry->d_name, id))
+    {
+      continue;
+    }
+
+    char *path = get_pool_path(pool_dir, "", entry->d_name, "");
+    char *claim = get_pool_path(pool_dir, ".", entry->d_name, ".claimed");
+
+    if (path != NULL && claim != NULL && rename(path, claim) == 0)
+    {
+      claimed_path = claim;
+      claim = NULL;
+    }
+    free(path);
+    free(claim);
+  }
+  closedir(dir);
+
+  if (claimed_path == NULL)
+  {
+    return 0;
+  }
+
+  uint8_t *packed = NULL;
+  size_t packed_size = 0;
+  int retval = read_bytes_from_file(claimed_path, &packed, &packed_size);
+
+  unlink(claimed_path);
+  free(claimed_path);
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error reading pooled storage key ... exiting");
+    return 1;
+  }
+
+  size_t offset = 0;
+  TSS2_RC rc = Tss2_MU_TPM2B_PUBLIC_Unmarshal(packed, packed_size, &offset,
+                                              sk_public);
+
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    rc = Tss2_MU_TPM2B_PRIVATE_Unmarshal(packed, packed_size, &offset,
+                                         sk_private);
+  }
+  free(packed);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "error unmarshalling pooled storage key: 0x%08X "
+              "... exiting", rc);
+    return 1;
+  }
+
+  // the TPM binds the public area to the wrapped private part when the key
+  // is loaded, so checking it here vouches for the key itself
+  if (!check_pooled_sk(&sk_public->publicArea, sk_alg, sk_authPolicy))
+  {
+    kmyth_log(LOG_WARNING, "discarded a pooled storage key that is not a "
+              "Kmyth storage key for this policy");
+    return 0;
+  }
+  *found = true;
+
+  return 0;
+}
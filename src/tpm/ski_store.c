@@ -0,0 +1,399 @@
+/**
+ * @file  ski_store.c
+ *
+ * @brief Implements the content-addressed store of .ski files kept in a
+ *        store directory (see ski_store.h).
+ */
+
+#include "ski_store.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <arpa/inet.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#include "cipher/random_pool.h"
+#include "file_io.h"
+#include "memory_util.h"
+
+/*
+ * Files are written under a temporary name, '.<name>.<suffix>.tmp' with a
+ * random suffix of KMYTH_SKI_STORE_SUFFIX_BYTES bytes (hex encoded), and
+ * then moved into place
+ */
+#define KMYTH_SKI_STORE_SUFFIX_BYTES 8
+#define KMYTH_SKI_STORE_FILE_EXT ".ski"
+
+//############################################################################
+// get_temp_path()
+//
+// Returns a temporary path, in the same directory, for a file to be moved
+// to 'path' once complete
+//############################################################################
+static char *get_temp_path(const char *path)
+{
+  uint8_t suffix_bytes[KMYTH_SKI_STORE_SUFFIX_BYTES];
+  char suffix[2 * KMYTH_SKI_STORE_SUFFIX_BYTES + 1];
+
+  if (random_pool_bytes(suffix_bytes, sizeof(suffix_bytes)))
+  {
+    kmyth_log(LOG_ERR, "error generating temporary file name ... exiting");
+    return NULL;
+  }
+  for (size_t i = 0; i < KMYTH_SKI_STORE_SUFFIX_BYTES; i++)
+  {
+    snprintf(suffix + 2 * i, 3, "%02x", suffix_bytes[i]);
+  }
+
+  const char *name = strrchr(path, '/');
+  size_t dir_len = (name == NULL) ? 0 : (size_t) (name - path) + 1;
+
+  name = (name == NULL) ? path : name + 1;
+
+  size_t temp_len = strlen(path) + strlen(suffix) + 7;
+  char *temp = malloc(temp_len);
+
+  if (temp == NULL)
+  {
+    kmyth_log(LOG_ERR, "failed to allocate temporary path ... exiting");
+    return NULL;
+  }
+  snprintf(temp, temp_len, "%.*s.%s.%s.tmp", (int) dir_len, path, name,
+           suffix);
+
+  return temp;
+}
+
+//############################################################################
+// ski_store_get_key()
+//############################################################################
+int ski_store_get_key(const char *store_dir, uint8_t * key)
+{
+  if (store_dir == NULL || key == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input ... exiting");
+    return 1;
+  }
+  if (make_private_dir(store_dir))
+  {
+    return 1;
+  }
+
+  size_t key_path_len = strlen(store_dir) + strlen(KMYTH_SKI_STORE_KEY_FILE)
+    + 2;
+  char *key_path = malloc(key_path_len);
+
+  if (key_path == NULL)
+  {
+    kmyth_log(LOG_ERR, "failed to allocate store key path ... exiting");
+    return 1;
+  }
+  snprintf(key_path, key_path_len, "%s/%s", store_dir,
+           KMYTH_SKI_STORE_KEY_FILE);
+
+  // a new key is written (readable only by its owner) under a temporary
+  // name and linked into place: if another process linked its key first,
+  // the link fails and that key is used instead
+  if (access(key_path, F_OK) != 0)
+  {
+    uint8_t new_key[KMYTH_SKI_STORE_KEY_SIZE];
+    char *temp_path = get_temp_path(key_path);
+    bool written = (temp_path != NULL
+                    && RAND_priv_bytes(new_key, sizeof(new_key)) == 1
+                    && write_bytes_to_new_file(temp_path, new_key,
+                                               sizeof(new_key), 0600) == 0);
+
+    kmyth_clear(new_key, sizeof(new_key));
+    if (written && link(temp_path, key_path) && errno != EEXIST)
+    {
+      written = false;
+    }
+    if (temp_path != NULL)
+    {
+      unlink(temp_path);
+    }
+    free(temp_path);
+    if (!written)
+    {
+      kmyth_log(LOG_ERR, "unable to create .ski store key ... exiting");
+      free(key_path);
+      return 1;
+    }
+  }
+
+  uint8_t *key_bytes = NULL;
+  size_t key_bytes_len = 0;
+  int retval = read_bytes_from_file(key_path, &key_bytes, &key_bytes_len);
+
+  free(key_path);
+  if (retval || key_bytes_len != KMYTH_SKI_STORE_KEY_SIZE)
+  {
+    kmyth_log(LOG_ERR, "unable to read .ski store key ... exiting");
+    kmyth_clear_and_free(key_bytes, key_bytes_len);
+    return 1;
+  }
+  memcpy(key, key_bytes, KMYTH_SKI_STORE_KEY_SIZE);
+  kmyth_clear_and_free(key_bytes, key_bytes_len);
+
+  return 0;
+}
+
+//############################################################################
+// hmac_update_field()
+//
+// Adds a length-prefixed field to the HMAC, so that no two different sets
+// of fields are hashed as the same byte string
+//############################################################################
+static int hmac_update_field(HMAC_CTX * hmac_ctx, const void *field,
+                             size_t field_len)
+{
+  uint32_t len_be = htonl((uint32_t) field_len);
+
+  return (field_len <= UINT32_MAX
+          && HMAC_Update(hmac_ctx, (const unsigned char *) &len_be,
+                         sizeof(len_be))
+          && (field_len == 0
+              || HMAC_Update(hmac_ctx, (const unsigned char *) field,
+                             field_len)));
+}
+
+//############################################################################
+// ski_store_id()
+//############################################################################
+int ski_store_id(const uint8_t * key, const uint8_t * input, size_t input_len,
+                 const ski_store_policy * policy, char *id)
+{
+  if (key == NULL || (input == NULL && input_len > 0) || policy == NULL
+      || id == NULL || (policy->pcrs == NULL && policy->pcrs_len > 0))
+  {
+    kmyth_log(LOG_ERR, "NULL input ... exiting");
+    return 1;
+  }
+
+  // the numeric parameters and PCR indices are hashed in network byte
+  // order, so a store gives the same IDs on any host that can read it
+  uint32_t settings[3] = { htonl(policy->ski_format), htonl(policy->sk_alg),
+    htonl(policy->compression)
+  };
+  const char *cipher = (policy->cipher_string == NULL) ? "" :
+    policy->cipher_string;
+  uint8_t digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_len = 0;
+  HMAC_CTX *hmac_ctx = HMAC_CTX_new();
+
+  int ok = (hmac_ctx != NULL
+            && HMAC_Init_ex(hmac_ctx, key, KMYTH_SKI_STORE_KEY_SIZE,
+                            KMYTH_OPENSSL_HASH, NULL)
+            && hmac_update_field(hmac_ctx, settings, sizeof(settings))
+            && hmac_update_field(hmac_ctx, cipher, strlen(cipher))
+            && hmac_update_field(hmac_ctx, policy->auth_bytes,
+                                 policy->auth_bytes_len));
+
+  // the PCR list is prefixed with its count, like a field
+  uint32_t pcrs_len_be = htonl((uint32_t) policy->pcrs_len);
+
+  ok = (ok && policy->pcrs_len <= UINT32_MAX
+        && HMAC_Update(hmac_ctx, (const unsigned char *) &pcrs_len_be,
+                       sizeof(pcrs_len_be)));
+  for (size_t i = 0; ok && i < policy->pcrs_len; i++)
+  {
+    uint32_t pcr_be = htonl((uint32_t) policy->pcrs[i]);
+
+    ok = HMAC_Update(hmac_ctx, (const unsigned char *) &pcr_be,
+                     sizeof(pcr_be));
+  }
+  ok = (ok && hmac_update_field(hmac_ctx, input, input_len)
+        && HMAC_Final(hmac_ctx, digest, &digest_len)
+        && digest_len == KMYTH_DIGEST_SIZE);
+  HMAC_CTX_free(hmac_ctx);
+
+  if (!ok)
+  {
+    kmyth_log(LOG_ERR, "error computing .ski store ID ... exiting");
+    return 1;
+  }
+
+  for (size_t i = 0; i < KMYTH_DIGEST_SIZE; i++)
+  {
+    snprintf(id + 2 * i, 3, "%02x", digest[i]);
+  }
+
+  return 0;
+}
+
+//############################################################################
+// ski_store_path()
+//############################################################################
+int ski_store_path(const char *store_dir, const char *id, char **path)
+{
+  if (store_dir == NULL || id == NULL || path == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input ... exiting");
+    return 1;
+  }
+
+  size_t path_len = strlen(store_dir) + strlen(id) +
+    strlen(KMYTH_SKI_STORE_FILE_EXT) + 2;
+
+  *path = malloc(path_len);
+  if (*path == NULL)
+  {
+    kmyth_log(LOG_ERR, "failed to allocate .ski store path ... exiting");
+    return 1;
+  }
+  snprintf(*path, path_len, "%s/%s%s", store_dir, id,
+           KMYTH_SKI_STORE_FILE_EXT);
+
+  return 0;
+}
+
+//############################################################################
+// ski_store_get()
+//############################################################################
+int ski_store_get(const char *store_dir, const char *id,
+                  uint8_t ** ski, size_t *ski_len, bool *found)
+{
+  if (ski == NULL || ski_len == NULL || found == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input ... exiting");
+    return 1;
+  }
+  *ski = NULL;
+  *ski_len = 0;
+  *found = false;
+
+  char *path = NULL;
+
+  if (ski_store_path(store_dir, id, &path))
+  {
+    return 1;
+  }
+  if (access(path, F_OK) != 0)
+  {
+    free(path);
+    return 0;
+  }
+
+  int retval = read_bytes_from_file(path, ski, ski_len);
+
+  free(path);
+  if (retval || *ski_len == 0)
+  {
+    kmyth_log(LOG_ERR, "error reading stored .ski ... exiting");
+    free(*ski);
+    *ski = NULL;
+    *ski_len = 0;
+    return 1;
+  }
+  *found = true;
+
+  return 0;
+}
+
+//############################################################################
+// ski_store_put()
+//############################################################################
+int ski_store_put(const char *store_dir, const char *id,
+                  const uint8_t * ski, size_t ski_len)
+{
+  if (ski == NULL || ski_len == 0)
+  {
+    kmyth_log(LOG_ERR, "no .ski to store ... exiting");
+    return 1;
+  }
+
+  char *path = NULL;
+
+  if (make_private_dir(store_dir) || ski_store_path(store_dir, id, &path))
+  {
+    return 1;
+  }
+
+  char *temp_path = get_temp_path(path);
+
+  if (temp_path == NULL)
+  {
+    free(path);
+    return 1;
+  }
+
+  int retval = 0;
+
+  // stored files are readable only by the store owner, like the store
+  if (write_bytes_to_new_file(temp_path, ski, ski_len, 0600)
+      || rename(temp_path, path))
+  {
+    kmyth_log(LOG_ERR, "error adding .ski to store ... exiting");
+    unlink(temp_path);
+    retval = 1;
+  }
+  else
+  {
+    kmyth_log(LOG_DEBUG, "added .ski to store (%s)", path);
+  }
+  free(temp_path);
+  free(path);
+
+  return retval;
+}
+
+//############################################################################
+// ski_store_link()
+//############################################################################
+int ski_store_link(const char *stored_path, const char *alias_path)
+{
+  if (stored_path == NULL || alias_path == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input ... exiting");
+    return 1;
+  }
+
+  char *temp_path = get_temp_path(alias_path);
+
+  if (temp_path == NULL)
+  {
+    return 1;
+  }
+
+  // the link is made under a temporary name and renamed over the alias,
+  // so the alias path never holds anything but a complete .ski
+  int retval = link(stored_path, temp_path);
+
+  // a hard link cannot cross filesystems, and a symbolic link into the
+  // store would not be readable by anyone but the store owner, so the
+  // alias is then a copy (still identical, byte for byte, to the stored
+  // .ski) created as any other sealed output would be
+  if (retval && errno == EXDEV)
+  {
+    uint8_t *ski = NULL;
+    size_t ski_len = 0;
+
+    retval = (read_bytes_from_file((char *) stored_path, &ski, &ski_len)
+              || write_bytes_to_new_file(temp_path, ski, ski_len, 0666));
+    free(ski);
+  }
+  if (retval == 0 && rename(temp_path, alias_path))
+  {
+    unlink(temp_path);
+    retval = 1;
+  }
+  free(temp_path);
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unable to link %s to stored .ski ... exiting",
+              alias_path);
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "linked %s to stored .ski (%s)", alias_path,
+            stored_path);
+
+  return 0;
+}
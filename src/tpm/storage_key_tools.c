@@ -8,7 +8,13 @@
 
 #include "storage_key_tools.h"
 
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <arpa/inet.h>
 #include <openssl/evp.h>
@@ -17,6 +23,225 @@
 #include "object_tools.h"
 #include "tpm2_interface.h"
 
+/*
+ * Where get_srk_handle() looks for the SRK before listing every persistent
+ * object: the configured handle, the handle it was last found at by this
+ * process, and the handle recorded in the state file
+ */
+static pthread_mutex_t srk_config_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool srk_handle_configured = false;
+static TPM2_HANDLE srk_handle_config = 0;
+static bool srk_state_file_configured = false;
+static char *srk_state_file = NULL;
+static TPM2_HANDLE srk_handle_last = 0;
+
+//############################################################################
+// parse_srk_handle()
+//############################################################################
+static int parse_srk_handle(const char *str, TPM2_HANDLE * handle)
+{
+  char *end = NULL;
+
+  errno = 0;
+  unsigned long value = strtoul(str, &end, 0);
+
+  if (errno != 0 || end == str || *end != '\0'
+      || value < TPM2_PERSISTENT_FIRST || value > TPM2_PERSISTENT_LAST)
+  {
+    return 1;
+  }
+  *handle = (TPM2_HANDLE) value;
+  return 0;
+}
+
+//############################################################################
+// set_srk_handle()
+//############################################################################
+int set_srk_handle(const char *handle)
+{
+  TPM2_HANDLE value = 0;
+
+  if (handle != NULL && parse_srk_handle(handle, &value))
+  {
+    kmyth_log(LOG_ERR, "invalid persistent SRK handle (%s) ... exiting",
+              handle);
+    return 1;
+  }
+
+  pthread_mutex_lock(&srk_config_lock);
+  srk_handle_configured = (handle != NULL);
+  srk_handle_config = value;
+  pthread_mutex_unlock(&srk_config_lock);
+  return 0;
+}
+
+//############################################################################
+// set_srk_state_file()
+//############################################################################
+int set_srk_state_file(const char *path)
+{
+  char *copy = NULL;
+
+  if (path != NULL)
+  {
+    copy = strdup(path);
+    if (copy == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to copy SRK state file path ... exiting");
+      return 1;
+    }
+  }
+
+  pthread_mutex_lock(&srk_config_lock);
+  free(srk_state_file);
+  srk_state_file = copy;
+  srk_state_file_configured = true;
+  pthread_mutex_unlock(&srk_config_lock);
+  return 0;
+}
+
+//############################################################################
+// get_srk_config()
+//
+// Gets the configured SRK handle (0 if none), the last one found by this
+// process (0 if none), and the state file path (empty if none)
+//############################################################################
+static void get_srk_config(TPM2_HANDLE * configured, TPM2_HANDLE * last,
+                           char *state_file, size_t state_file_size)
+{
+  const char *path = NULL;
+
+  pthread_mutex_lock(&srk_config_lock);
+
+  *configured = srk_handle_config;
+  if (!srk_handle_configured)
+  {
+    const char *env = getenv(KMYTH_SRK_HANDLE_ENV);
+
+    *configured = 0;
+    if (env != NULL && *env != '\0' && parse_srk_handle(env, configured))
+    {
+      kmyth_log(LOG_WARNING, "ignoring invalid %s (%s)", KMYTH_SRK_HANDLE_ENV,
+                env);
+      *configured = 0;
+    }
+  }
+  *last = srk_handle_last;
+
+  if (srk_state_file_configured)
+  {
+    path = srk_state_file;
+  }
+  else
+  {
+    path = getenv(KMYTH_SRK_STATE_FILE_ENV);
+    if (path == NULL)
+    {
+      path = KMYTH_SRK_STATE_FILE;
+    }
+  }
+  snprintf(state_file, state_file_size, "%s", (path == NULL) ? "" : path);
+
+  pthread_mutex_unlock(&srk_config_lock);
+}
+
+//############################################################################
+// read_srk_state()
+//
+// Reads the SRK handle recorded in the state file, or 0 if there is none
+//############################################################################
+static TPM2_HANDLE read_srk_state(const char *path)
+{
+  TPM2_HANDLE handle = 0;
+  char line[32];
+  FILE *file = NULL;
+
+  if (*path == '\0' || (file = fopen(path, "r")) == NULL)
+  {
+    return 0;
+  }
+
+  if (fgets(line, sizeof(line), file) != NULL)
+  {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (parse_srk_handle(line, &handle))
+    {
+      kmyth_log(LOG_DEBUG, "ignoring malformed SRK state file %s", path);
+      handle = 0;
+    }
+  }
+  fclose(file);
+  return handle;
+}
+
+//############################################################################
+// write_srk_state()
+//
+// Records the SRK handle in the state file, replacing it atomically. A
+// failure is not an error: the SRK is only searched for again next time.
+//############################################################################
+static void write_srk_state(const char *path, TPM2_HANDLE handle)
+{
+  char tmp_path[PATH_MAX];
+
+  if (*path == '\0'
+      || snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path,
+                  (int) getpid()) >= (int) sizeof(tmp_path))
+  {
+    return;
+  }
+
+  FILE *file = fopen(tmp_path, "w");
+
+  if (file == NULL)
+  {
+    kmyth_log(LOG_DEBUG, "unable to write SRK state file %s", path);
+    return;
+  }
+  if (fprintf(file, "0x%08X\n", handle) < 0 || fclose(file) != 0)
+  {
+    kmyth_log(LOG_DEBUG, "unable to write SRK state file %s", path);
+    remove(tmp_path);
+    return;
+  }
+  if (rename(tmp_path, path) != 0)
+  {
+    kmyth_log(LOG_DEBUG, "unable to replace SRK state file %s", path);
+    remove(tmp_path);
+    return;
+  }
+  kmyth_log(LOG_DEBUG, "recorded SRK handle 0x%08X in %s", handle, path);
+}
+
+//############################################################################
+// probe_srk_handle()
+//
+// Checks whether an object is persistent at a handle (without an error if
+// not) and, if so, whether it is the SRK
+//############################################################################
+static int probe_srk_handle(TSS2_SYS_CONTEXT * sapi_ctx, TPM2_HANDLE handle,
+                            bool * present, bool * isSRK)
+{
+  TPMS_CAPABILITY_DATA capData;
+
+  *present = false;
+  *isSRK = false;
+
+  // lists the persistent handles from this one on, so one entry suffices
+  if (get_tpm2_properties(sapi_ctx, TPM2_CAP_HANDLES, handle, 1, &capData))
+  {
+    return 1;
+  }
+  if (capData.data.handles.count == 0
+      || capData.data.handles.handle[0] != handle)
+  {
+    return 0;
+  }
+
+  *present = true;
+  return check_if_srk(sapi_ctx, handle, isSRK);
+}
+
 //############################################################################
 // get_srk_handle()
 //############################################################################
@@ -24,34 +249,99 @@ int get_srk_handle(TSS2_SYS_CONTEXT * sapi_ctx,
                    TPM2_HANDLE * srk_handle,
                    TPM2B_AUTH * storage_hierarchy_auth)
 {
-  // Get the list of objects in TPM persistent storage and check them all
-  // against the SRK criteria. Upon return from get_existing_srk_handle(),
-  // the srk_handle parameter passed to get_existing_srk_handle() is either
-  // zero (none of the loaded objects is the SRK) or contains the handle used
-  // to reference the SRK in TPM persistent storage. The function
-  // get_existing_srk_handle() will set next_persistent_handle to the next
-  // available TPM persistent storage location where the SRK can be put.
-  TPM2_HANDLE next_persistent_handle = 0;
-
-  if (get_existing_srk_handle(sapi_ctx, srk_handle, &next_persistent_handle))
-  {
-    kmyth_log(LOG_ERR, "error retrieving SRK handle from TPM ... exiting");
-    return 1;
+  // First look for the SRK where it is configured to be, where this
+  // process last found it, and where the state file says it was, each of
+  // which is checked with two TPM commands (instead of checking every
+  // persistent object)
+  TPM2_HANDLE configured = 0;
+  TPM2_HANDLE last = 0;
+  char state_file[PATH_MAX];
+
+  get_srk_config(&configured, &last, state_file, sizeof(state_file));
+
+  TPM2_HANDLE recorded = read_srk_state(state_file);
+  TPM2_HANDLE candidates[] = { configured, last, recorded };
+  bool configured_free = false;
+
+  *srk_handle = 0;
+  for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++)
+  {
+    bool present = false;
+    bool isSRK = false;
+    bool checked = (candidates[i] == 0);
+
+    for (size_t j = 0; j < i && !checked; j++)
+    {
+      checked = (candidates[j] == candidates[i]);
+    }
+    if (checked)
+    {
+      continue;
+    }
+    if (probe_srk_handle(sapi_ctx, candidates[i], &present, &isSRK))
+    {
+      kmyth_log(LOG_ERR, "error checking handle 0x%08X for SRK ... exiting",
+                candidates[i]);
+      return 1;
+    }
+    if (isSRK)
+    {
+      *srk_handle = candidates[i];
+      kmyth_log(LOG_DEBUG, "SRK found at expected handle 0x%08X",
+                *srk_handle);
+      break;
+    }
+    if (candidates[i] == configured)
+    {
+      configured_free = !present;
+      kmyth_log(LOG_WARNING, "SRK not found at configured handle 0x%08X",
+                configured);
+    }
   }
 
-  // If we reach here and the srk_handle value is still zero (empty handle),
-  // a handle referencing the SRK is not already loaded in persistent storage.
-  // Therefore, we must re-derive it from its seed and load it at the
-  // previously determined next available persistent handle
   if (*srk_handle == 0)
   {
-    *srk_handle = next_persistent_handle;
-    if (put_srk_into_persistent_storage(sapi_ctx,
-                                        *srk_handle, *storage_hierarchy_auth))
+    // Get the list of objects in TPM persistent storage and check them all
+    // against the SRK criteria. Upon return from get_existing_srk_handle(),
+    // the srk_handle parameter passed to get_existing_srk_handle() is either
+    // zero (none of the loaded objects is the SRK) or contains the handle
+    // used to reference the SRK in TPM persistent storage. The function
+    // get_existing_srk_handle() will set next_persistent_handle to the next
+    // available TPM persistent storage location where the SRK can be put.
+    TPM2_HANDLE next_persistent_handle = 0;
+
+    if (get_existing_srk_handle(sapi_ctx, srk_handle,
+                                &next_persistent_handle))
     {
-      kmyth_log(LOG_ERR, "error reinstalling SRK in TPM ... exiting");
+      kmyth_log(LOG_ERR, "error retrieving SRK handle from TPM ... exiting");
       return 1;
     }
+
+    // If we reach here and the srk_handle value is still zero (empty
+    // handle), a handle referencing the SRK is not already loaded in
+    // persistent storage. Therefore, we must re-derive it from its seed and
+    // load it at the configured handle, if it is free, or else at the
+    // previously determined next available persistent handle
+    if (*srk_handle == 0)
+    {
+      *srk_handle = (configured_free) ? configured : next_persistent_handle;
+      if (put_srk_into_persistent_storage(sapi_ctx,
+                                          *srk_handle,
+                                          *storage_hierarchy_auth))
+      {
+        kmyth_log(LOG_ERR, "error reinstalling SRK in TPM ... exiting");
+        return 1;
+      }
+    }
+  }
+
+  pthread_mutex_lock(&srk_config_lock);
+  srk_handle_last = *srk_handle;
+  pthread_mutex_unlock(&srk_config_lock);
+
+  if (*srk_handle != recorded)
+  {
+    write_srk_state(state_file, *srk_handle);
   }
 
   return 0;
@@ -130,6 +420,9 @@ int get_existing_srk_handle(TSS2_SYS_CONTEXT * sapi_ctx,
     if (check_if_srk(sapi_ctx,
                      persistent_handle_list.data.handles.handle[i], &SRK_flag))
     {
+      // the (cached) handle list may be stale, if another process evicted
+      // the object, so it is read from the TPM again next time
+      invalidate_tpm2_persistent_handle_cache(sapi_ctx);
       kmyth_log(LOG_ERR,
                 "error checking if handle = 0x%08X references SRK ... exiting",
                 persistent_handle_list.data.handles.handle[i]);
@@ -239,12 +532,9 @@ int check_if_srk(TSS2_SYS_CONTEXT * sapi_ctx, TPM2_HANDLE handle, bool * isSRK)
 
   kmyth_log(LOG_DEBUG, "checking handle %08X", handle);
 
-  // Read the public info of the object referenced by the handle
-  //
-  // Note: Although Tss2_Sys_ReadPublic() takes command and response
-  //       authorization structures as parameters, the TPM specification
-  //       indicates that this command does not require authorization.
-  //       Therefore, we provide NULL values when invoking this function.
+  // Read the public info of the object referenced by the handle (the
+  // command needs no authorization, and is merged with identical reads
+  // from other callers, e.g., concurrent SRK lookups)
   TPM2B_PUBLIC publicOut;
   TPM2B_NAME nameOut;
   TPM2B_NAME qualNameOut;
@@ -252,19 +542,12 @@ int check_if_srk(TSS2_SYS_CONTEXT * sapi_ctx, TPM2_HANDLE handle, bool * isSRK)
   publicOut.size = 0;
   nameOut.size = 0;
   qualNameOut.size = 0;
-  TSS2L_SYS_AUTH_COMMAND *nullCmdAuths = NULL;
-  TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL;
-  TPM2_RC rc = Tss2_Sys_ReadPublic(sapi_ctx,
-                                   handle,
-                                   nullCmdAuths,
-                                   &publicOut,
-                                   &nameOut,
-                                   &qualNameOut,
-                                   nullRspAuths);
+  TPM2_RC rc = read_tpm2_public(sapi_ctx, handle, &publicOut, &nameOut,
+                                &qualNameOut);
 
   if (rc != TPM2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "Tss2_Sys_ReadPublic(): TPM rc = 0x%08X", rc);
+    kmyth_log_tpm_rc("Tss2_Sys_ReadPublic", rc);
     return 1;
   }
 
@@ -479,16 +762,16 @@ int put_srk_into_persistent_storage(TSS2_SYS_CONTEXT * sapi_ctx,
 }
 
 //############################################################################
-// create_and_load_sk()
+// create_sk()
 //############################################################################
-int create_and_load_sk(TSS2_SYS_CONTEXT * sapi_ctx,
-                       TPM2_HANDLE srk_handle,
-                       TPM2B_AUTH srk_authVal,
-                       TPM2B_AUTH sk_authVal,
-                       TPML_PCR_SELECTION sk_pcrList,
-                       TPM2B_DIGEST sk_authPolicy,
-                       TPM2_HANDLE * sk_handle,
-                       TPM2B_PRIVATE * sk_private, TPM2B_PUBLIC * sk_public)
+int create_sk(TSS2_SYS_CONTEXT * sapi_ctx,
+              TPM2_HANDLE srk_handle,
+              TPM2B_AUTH srk_authVal,
+              TPM2B_AUTH sk_authVal,
+              TPML_PCR_SELECTION sk_pcrList,
+              TPM2B_DIGEST sk_authPolicy,
+              TPMI_ALG_PUBLIC sk_alg,
+              TPM2B_PRIVATE * sk_private, TPM2B_PUBLIC * sk_public)
 {
   // Create and set up sensitive data input for new storage key object:
   //   - The authVal (hash of user specifed authorization string or default
@@ -512,8 +795,8 @@ int create_and_load_sk(TSS2_SYS_CONTEXT * sapi_ctx,
   TPM2B_PUBLIC sk_template;
 
   sk_template.size = 0;
-  if (init_kmyth_object_template(true,
-                                 sk_authPolicy, &(sk_template.publicArea)))
+  if (init_kmyth_key_template(sk_alg,
+                              sk_authPolicy, &(sk_template.publicArea)))
   {
     kmyth_log(LOG_ERR, "SK create template error ... exiting");
     return 1;
@@ -538,7 +821,34 @@ int create_and_load_sk(TSS2_SYS_CONTEXT * sapi_ctx,
     return 1;
   }
 
+  kmyth_log(LOG_DEBUG, "storage key object created");
+  return 0;
+}
+
+//############################################################################
+// create_and_load_sk()
+//############################################################################
+int create_and_load_sk(TSS2_SYS_CONTEXT * sapi_ctx,
+                       TPM2_HANDLE srk_handle,
+                       TPM2B_AUTH srk_authVal,
+                       TPM2B_AUTH sk_authVal,
+                       TPML_PCR_SELECTION sk_pcrList,
+                       TPM2B_DIGEST sk_authPolicy,
+                       TPMI_ALG_PUBLIC sk_alg,
+                       TPM2_HANDLE * sk_handle,
+                       TPM2B_PRIVATE * sk_private, TPM2B_PUBLIC * sk_public)
+{
+  if (create_sk(sapi_ctx, srk_handle, srk_authVal, sk_authVal, sk_pcrList,
+                sk_authPolicy, sk_alg, sk_private, sk_public))
+  {
+    return 1;
+  }
+
   // As this newly created storage key will be used by the TPM, we must load it
+  SESSION *nullSession = NULL;  // SRK (parent) auth is not policy based
+  TPML_PCR_SELECTION emptyPCRList;  // SRK (parent) has no PCR-based auth
+
+  emptyPCRList.count = 0;
   if (load_kmyth_object(sapi_ctx,
                         nullSession,
                         srk_handle,
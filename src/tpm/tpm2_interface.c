@@ -7,18 +7,34 @@
 
 #include "tpm2_interface.h"
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <arpa/inet.h>
+
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
 #include <openssl/evp.h>
 #include <openssl/hmac.h>
 #include <openssl/rand.h>
+#include <openssl/rsa.h>
 
+#include <tss2/tss2_mu.h>
 #include <tss2/tss2_rc.h>
+#include <tss2/tss2_tcti_device.h>
+#ifndef KMYTH_BOOT
 #include <tss2/tss2-tcti-tabrmd.h>
+#include <tss2/tss2_tctildr.h>
+#endif
 
 #include "defines.h"
+#include "cipher/random_pool.h"
+#include "kmyth_metrics.h"
+#include "memory_util.h"
 #include "tpm/marshalling_tools.h"
+#include "tpm/pcrs.h"
+#include "tpm/tpm2_trace.h"
 
 /*
  * These are known to be manufacturer strings for software TPM simulators.
@@ -30,6 +46,114 @@ const char *simulator_manufacturers[] = { "IBM",  // https://sourceforge.net/pro
   NULL
 };
 
+/*
+ * Capability data that cannot change while a connection is open (the fixed
+ * TPM properties), or that only changes when an object is made persistent
+ * or evicted (the persistent handle list and the room left for persistent
+ * objects), is kept for each SAPI context, so that it is only read from the
+ * TPM once per connection. See get_tpm2_properties().
+ */
+typedef struct capability_cache
+{
+  TSS2_SYS_CONTEXT *sapi_ctx;
+
+  bool fixed_valid;
+  bool fixed_complete;
+  TPML_TAGGED_TPM_PROPERTY fixed;
+
+  bool persistent_valid;
+  TPML_HANDLE persistent;
+
+  bool persistent_avail_valid;
+  uint32_t persistent_avail;
+
+  struct capability_cache *next;
+} capability_cache;
+
+#define CAPABILITY_CACHE_HELP \
+  "TPM capability queries, by whether they were answered from the" \
+  " per-connection cache."
+
+static capability_cache *capability_caches = NULL;
+static pthread_mutex_t capability_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * The digest and HMAC contexts used by the command/response authorization
+ * computations (cpHash, rpHash, authHMAC and KDFa) are allocated once per
+ * thread and reused for every command. The HMAC context also keeps the key
+ * it was last initialized with, so that the key setup is skipped while the
+ * same session key and authValue authorize a sequence of commands (e.g., on
+ * a reused policy session). See get_auth_hmac_ctx().
+ */
+typedef struct auth_hash_state
+{
+  EVP_MD_CTX *md_ctx;
+
+  HMAC_CTX *hmac_ctx;
+  bool hmac_keyed;
+  size_t hmac_key_size;
+  uint8_t hmac_key[sizeof(TPM2B_DIGEST) + sizeof(TPM2B_AUTH)];
+} auth_hash_state;
+
+static pthread_key_t auth_hash_key;
+static pthread_once_t auth_hash_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Read-only commands whose response does not depend on the connection
+ * (TPM2_PCR_Read, and TPM2_ReadPublic of a persistent object) are merged
+ * across the threads and contexts of the process: callers asking for the
+ * same thing while such a command is in flight queue up behind it as one
+ * flight, which is sent once the command in flight completes. So, however
+ * many callers contend, at most two identical commands are outstanding,
+ * and every response was produced after each caller it is handed to asked
+ * for it. Flights are forgotten when they complete (this is not a cache).
+ * See read_tpm2_pcrs() and read_tpm2_public().
+ */
+typedef struct read_flight
+{
+  TPM2_CC command;
+  uint8_t params[sizeof(TPML_PCR_SELECTION)];
+  size_t params_size;
+
+  bool sent;
+  bool done;
+  TPM2_RC rc;
+  union
+  {
+    struct
+    {
+      UINT32 updateCounter;
+      TPML_PCR_SELECTION selectionOut;
+      TPML_DIGEST values;
+    } pcr_read;
+    struct
+    {
+      TPM2B_PUBLIC outPublic;
+      TPM2B_NAME name;
+      TPM2B_NAME qualifiedName;
+    } read_public;
+  } out;
+
+  size_t waiters;
+  pthread_cond_t done_cond;
+
+  struct read_flight *next;
+} read_flight;
+
+#define READ_FLIGHT_HELP \
+  "TPM read commands merged with an identical one from another caller."
+
+static read_flight *read_flights = NULL;
+static pthread_mutex_t read_flight_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * TCTI configuration string set with set_tcti_config(), overriding the
+ * KMYTH_TCTI environment variable while tcti_configured is true
+ */
+static char *tcti_config = NULL;
+static bool tcti_configured = false;
+static pthread_mutex_t tcti_config_lock = PTHREAD_MUTEX_INITIALIZER;
+
 //############################################################################
 // init_tpm2_connection()
 //############################################################################
@@ -43,14 +167,23 @@ int init_tpm2_connection(TSS2_SYS_CONTEXT ** sapi_ctx)
     return 1;
   }
 
-  // Step 1: Initialize TCTI context for connection to resource manager
+  // Step 1: Initialize TCTI context for connection to resource manager,
+  //         wrapped so that the latency of each TPM command is observed
+  TSS2_TCTI_CONTEXT *inner_ctx = NULL;
   TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
 
-  if (init_tcti_abrmd(&tcti_ctx))
+  if (init_tcti(&inner_ctx))
   {
     kmyth_log(LOG_ERR, "unable to initialize TCTI context ... exiting");
     return 1;
   }
+  if (init_tcti_trace(inner_ctx, &tcti_ctx))
+  {
+    Tss2_Tcti_Finalize(inner_ctx);
+    free(inner_ctx);
+    kmyth_log(LOG_ERR, "unable to wrap TCTI context ... exiting");
+    return 1;
+  }
 
   // Step 2: Initialize SAPI context with TCTI context
   if (init_sapi(sapi_ctx, tcti_ctx))
@@ -71,6 +204,7 @@ int init_tpm2_connection(TSS2_SYS_CONTEXT ** sapi_ctx)
   if (get_tpm2_impl_type(*sapi_ctx, &tpmTypeIsEmulator))
   {
     // On failure, clean up initialization remnants to this point
+    invalidate_tpm2_capability_cache(*sapi_ctx);
     Tss2_Sys_Finalize(*sapi_ctx);
     free(*sapi_ctx);
     Tss2_Tcti_Finalize(tcti_ctx);
@@ -85,6 +219,7 @@ int init_tpm2_connection(TSS2_SYS_CONTEXT ** sapi_ctx)
       if (startup_tpm2(sapi_ctx))
       {
         // On failure, clean up initialization remnants to this point
+        invalidate_tpm2_capability_cache(*sapi_ctx);
         Tss2_Sys_Finalize(*sapi_ctx);
         free(*sapi_ctx);
         Tss2_Tcti_Finalize(tcti_ctx);
@@ -106,6 +241,153 @@ int init_tpm2_connection(TSS2_SYS_CONTEXT ** sapi_ctx)
   return 0;
 }
 
+//############################################################################
+// set_tcti_config()
+//############################################################################
+int set_tcti_config(const char *config)
+{
+  char *copy = NULL;
+
+  if (config != NULL)
+  {
+    copy = strdup(config);
+    if (copy == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to copy TCTI configuration ... exiting");
+      return 1;
+    }
+  }
+
+  pthread_mutex_lock(&tcti_config_lock);
+  free(tcti_config);
+  tcti_config = copy;
+  tcti_configured = (config != NULL);
+  pthread_mutex_unlock(&tcti_config_lock);
+  return 0;
+}
+
+//############################################################################
+// init_tcti()
+//############################################################################
+int init_tcti(TSS2_TCTI_CONTEXT ** tcti_ctx)
+{
+  // TCTI context must be passed in uninitialized (NULL)
+  if (*tcti_ctx != NULL)
+  {
+    kmyth_log(LOG_ERR, "TCTI context passed in not NULL ... exiting");
+    return 1;
+  }
+
+  char *config = NULL;
+
+  pthread_mutex_lock(&tcti_config_lock);
+  const char *source = tcti_configured ? tcti_config : getenv(KMYTH_TCTI_ENV);
+
+  if (source != NULL && source[0] != '\0')
+  {
+    config = strdup(source);
+  }
+  pthread_mutex_unlock(&tcti_config_lock);
+
+#ifdef KMYTH_BOOT
+  // The boot build (kmyth-unseal-boot) runs before tpm2-abrmd and without
+  // the TCTI loader: it links the device TCTI only, and talks to the kernel
+  // resource manager unless another device ("device:<path>") is configured
+  const char *device = KMYTH_BOOT_TPM_DEVICE;
+
+  if (config != NULL && strncmp(config, "device", 6) == 0
+      && (config[6] == '\0' || config[6] == ':'))
+  {
+    if (config[6] == ':' && config[7] != '\0')
+    {
+      device = config + 7;
+    }
+  }
+  else if (config != NULL)
+  {
+    kmyth_log(LOG_ERR, "TCTI (%s) not available in boot build ... exiting",
+              config);
+    free(config);
+    return 1;
+  }
+
+  int retval = init_tcti_device(tcti_ctx, device);
+
+  free(config);
+  return retval;
+#else
+  // Without a configuration, connect through the access broker and
+  // resource manager daemon (tpm2-abrmd), as Kmyth always has
+  if (config == NULL)
+  {
+    return init_tcti_abrmd(tcti_ctx);
+  }
+
+  // A configuration string ('<name>[:<conf>]', e.g., "device:/dev/tpmrm0",
+  // "mssim:host=localhost,port=2321", "swtpm" or "tabrmd") names the TCTI
+  // library, loaded by Tss2_TctiLdr, and its own configuration. The context
+  // it returns is a TCTI context whose finalize call also unloads the
+  // library, so it is cleaned up like any other.
+  TSS2_RC rc = Tss2_TctiLdr_Initialize(config, tcti_ctx);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "unable to load TCTI (%s) ... exiting", config);
+    kmyth_log_tpm_rc("Tss2_TctiLdr_Initialize", rc);
+    free(config);
+    *tcti_ctx = NULL;
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "initialized TCTI (%s)", config);
+  free(config);
+
+  return 0;
+#endif
+}
+
+//############################################################################
+// init_tcti_device()
+//############################################################################
+int init_tcti_device(TSS2_TCTI_CONTEXT ** tcti_ctx, const char *device)
+{
+  // TCTI context must be passed in uninitialized (NULL)
+  if (*tcti_ctx != NULL)
+  {
+    kmyth_log(LOG_ERR, "TCTI context passed in not NULL ... exiting");
+    return 1;
+  }
+
+  // As for tpm2-abrmd, the first call returns the size of the context
+  size_t size;
+  TSS2_RC rc = Tss2_Tcti_Device_Init(NULL, &size, device);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log_tpm_rc("Tss2_Tcti_Device_Init", rc);
+    return 1;
+  }
+
+  *tcti_ctx = (TSS2_TCTI_CONTEXT *) calloc(1, size);
+  if (*tcti_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "calloc for device TCTI context failed ... exiting");
+    return 1;
+  }
+
+  rc = Tss2_Tcti_Device_Init(*tcti_ctx, &size, device);
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "unable to open TPM device (%s) ... exiting", device);
+    kmyth_log_tpm_rc("Tss2_Tcti_Device_Init", rc);
+    free(*tcti_ctx);
+    *tcti_ctx = NULL;
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "initialized TCTI (device:%s)", device);
+
+  return 0;
+}
+
 //############################################################################
 // init_tcti_abrmd()
 //############################################################################
@@ -118,6 +400,10 @@ int init_tcti_abrmd(TSS2_TCTI_CONTEXT ** tcti_ctx)
     return 1;
   }
 
+#ifdef KMYTH_BOOT
+  kmyth_log(LOG_ERR, "tpm2-abrmd TCTI not available in boot build ... exiting");
+  return 1;
+#else
   // We are using the default TCTI bus. Initial Tss2_Tcti_Tabrmd_Init() call
   // returns memory space needed for TCTI context.
   size_t size;
@@ -126,8 +412,7 @@ int init_tcti_abrmd(TSS2_TCTI_CONTEXT ** tcti_ctx)
   rc = Tss2_Tcti_Tabrmd_Init(NULL, &size, NULL);
   if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "Tss2_Tcti_Tabrmd_Init(): rc = 0x%08X, %s", rc,
-              getErrorString(rc));
+    kmyth_log_tpm_rc("Tss2_Tcti_Tabrmd_Init", rc);
     return 1;
   }
 
@@ -143,13 +428,13 @@ int init_tcti_abrmd(TSS2_TCTI_CONTEXT ** tcti_ctx)
   rc = Tss2_Tcti_Tabrmd_Init(*tcti_ctx, &size, NULL);
   if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "Tss2_Tcti_Tabrmd_Init(): rc = 0x%08X, %s", rc,
-              getErrorString(rc));
+    kmyth_log_tpm_rc("Tss2_Tcti_Tabrmd_Init", rc);
     free(*tcti_ctx);
     return 1;
   }
 
   return 0;
+#endif
 }
 
 //############################################################################
@@ -202,16 +487,150 @@ int init_sapi(TSS2_SYS_CONTEXT ** sapi_ctx, TSS2_TCTI_CONTEXT * tcti_ctx)
 
   if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "Tss2_Sys_Initialize(): rc = 0x%08X, %s", rc,
-              getErrorString(rc));
+    kmyth_log_tpm_rc("Tss2_Sys_Initialize", rc);
     free(sapi_ctx);
     return 1;
   }
   kmyth_log(LOG_DEBUG, "initialized SAPI context");
 
+  // a context freed without free_tpm2_resources() may have left capability
+  // data behind for this address
+  invalidate_tpm2_capability_cache(*sapi_ctx);
+
   return 0;
 }
 
+//############################################################################
+// free_auth_hash_state()
+//############################################################################
+static void free_auth_hash_state(void *arg)
+{
+  auth_hash_state *state = (auth_hash_state *) arg;
+
+  if (state == NULL)
+  {
+    return;
+  }
+  EVP_MD_CTX_free(state->md_ctx);
+  HMAC_CTX_free(state->hmac_ctx);
+  kmyth_clear_and_free(state, sizeof(auth_hash_state));
+}
+
+//############################################################################
+// create_auth_hash_key()
+//############################################################################
+static void create_auth_hash_key(void)
+{
+  pthread_key_create(&auth_hash_key, free_auth_hash_state);
+}
+
+//############################################################################
+// get_auth_hash_state()
+//############################################################################
+static auth_hash_state *get_auth_hash_state(void)
+{
+  pthread_once(&auth_hash_once, create_auth_hash_key);
+
+  auth_hash_state *state = pthread_getspecific(auth_hash_key);
+
+  if (state != NULL)
+  {
+    return state;
+  }
+
+  state = calloc(1, sizeof(auth_hash_state));
+  if (state == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate digest contexts ... exiting");
+    return NULL;
+  }
+  state->md_ctx = EVP_MD_CTX_new();
+  state->hmac_ctx = HMAC_CTX_new();
+  if (state->md_ctx == NULL || state->hmac_ctx == NULL
+      || pthread_setspecific(auth_hash_key, state) != 0)
+  {
+    kmyth_log(LOG_ERR, "unable to create digest contexts ... exiting");
+    free_auth_hash_state(state);
+    return NULL;
+  }
+
+  return state;
+}
+
+//############################################################################
+// release_auth_hash_state()
+//############################################################################
+static void release_auth_hash_state(void)
+{
+  pthread_once(&auth_hash_once, create_auth_hash_key);
+
+  auth_hash_state *state = pthread_getspecific(auth_hash_key);
+
+  if (state != NULL)
+  {
+    pthread_setspecific(auth_hash_key, NULL);
+    free_auth_hash_state(state);
+  }
+}
+
+//############################################################################
+// get_auth_md_ctx()
+//############################################################################
+static EVP_MD_CTX *get_auth_md_ctx(void)
+{
+  auth_hash_state *state = get_auth_hash_state();
+
+  if (state == NULL
+      || !EVP_DigestInit_ex(state->md_ctx, KMYTH_OPENSSL_HASH, NULL))
+  {
+    return NULL;
+  }
+
+  return state->md_ctx;
+}
+
+//############################################################################
+// get_auth_hmac_ctx()
+//############################################################################
+static HMAC_CTX *get_auth_hmac_ctx(const uint8_t * key, size_t key_size)
+{
+  auth_hash_state *state = get_auth_hash_state();
+
+  if (state == NULL)
+  {
+    return NULL;
+  }
+
+  // with the same key as last time, HMAC_Init_ex() only needs to restore the
+  // context's precomputed (key-padded) initial state
+  if (state->hmac_keyed && key_size == state->hmac_key_size
+      && CRYPTO_memcmp(key, state->hmac_key, key_size) == 0)
+  {
+    if (!HMAC_Init_ex(state->hmac_ctx, NULL, 0, NULL, NULL))
+    {
+      state->hmac_keyed = false;
+      return NULL;
+    }
+    return state->hmac_ctx;
+  }
+
+  state->hmac_keyed = false;
+  kmyth_clear(state->hmac_key, sizeof(state->hmac_key));
+  if (!HMAC_Init_ex(state->hmac_ctx, key, (int) key_size, KMYTH_OPENSSL_HASH,
+                    NULL))
+  {
+    return NULL;
+  }
+  if (key_size <= sizeof(state->hmac_key))
+  {
+    memcpy(state->hmac_key, key, key_size);
+    state->hmac_key_size = key_size;
+    state->hmac_keyed = true;
+  }
+
+  return state->hmac_ctx;
+}
+
 //############################################################################
 // free_tpm2_resources()
 //############################################################################
@@ -275,8 +694,7 @@ int free_tpm2_resources(TSS2_SYS_CONTEXT ** sapi_ctx)
 
   if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "Tss2_Sys_GetTctiContext(): rc = 0x%08X, %s", rc,
-              getErrorString(rc));
+    kmyth_log_tpm_rc("Tss2_Sys_GetTctiContext", rc);
     retval = 1;
   }
 
@@ -290,6 +708,7 @@ int free_tpm2_resources(TSS2_SYS_CONTEXT ** sapi_ctx)
   }
 
   // Clean up higher-level SAPI context, first
+  invalidate_tpm2_capability_cache(*sapi_ctx);
   Tss2_Sys_Finalize(*sapi_ctx);
   free(*sapi_ctx);
   *sapi_ctx = NULL;
@@ -300,9 +719,37 @@ int free_tpm2_resources(TSS2_SYS_CONTEXT ** sapi_ctx)
   free(tcti_ctx);
   kmyth_log(LOG_DEBUG, "cleaned up TCTI context");
 
+  // free this thread's authorization digest/HMAC contexts (other threads'
+  // are freed when they exit)
+  release_auth_hash_state();
+
   return retval;
 }
 
+//############################################################################
+// flush_tpm2_object()
+//############################################################################
+int flush_tpm2_object(TSS2_SYS_CONTEXT * sapi_ctx, TPM2_HANDLE handle)
+{
+  if (sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL SAPI context ... exiting");
+    return 1;
+  }
+
+  TSS2_RC rc = Tss2_Sys_FlushContext(sapi_ctx, handle);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log_tpm_rc("Tss2_Sys_FlushContext", rc);
+    kmyth_log(LOG_ERR, "error flushing handle 0x%08X ... exiting", handle);
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "flushed handle 0x%08X", handle);
+
+  return 0;
+}
+
 //############################################################################
 // startup_tpm2()
 //############################################################################
@@ -332,8 +779,7 @@ int startup_tpm2(TSS2_SYS_CONTEXT ** sapi_ctx)
   }
   else
   {
-    kmyth_log(LOG_ERR, "Tss2_Sys_Startup(): rc = 0x%08X, %s", rc,
-              getErrorString(rc));
+    kmyth_log_tpm_rc("Tss2_Sys_Startup", rc);
     return 1;
   }
 
@@ -341,13 +787,14 @@ int startup_tpm2(TSS2_SYS_CONTEXT ** sapi_ctx)
 }
 
 //############################################################################
-// get_tpm2_properties()
+// query_tpm2_properties()
 //############################################################################
-int get_tpm2_properties(TSS2_SYS_CONTEXT * sapi_ctx,
-                        uint32_t capability,
-                        uint32_t property,
-                        uint32_t propertyCount,
-                        TPMS_CAPABILITY_DATA * capabilityData)
+static int query_tpm2_properties(TSS2_SYS_CONTEXT * sapi_ctx,
+                                 uint32_t capability,
+                                 uint32_t property,
+                                 uint32_t propertyCount,
+                                 TPMS_CAPABILITY_DATA * capabilityData,
+                                 TPMI_YES_NO * moreDataAvailable)
 {
   TSS2_RC rc;
 
@@ -361,20 +808,318 @@ int get_tpm2_properties(TSS2_SYS_CONTEXT * sapi_ctx,
    *   - capabilityData (structure passed in by caller)
    *   - rspAuthsArray - default is NULL byte
    */
-  TPMI_YES_NO moreDataAvailable = 1;
+  *moreDataAvailable = 1;
 
   rc =
     Tss2_Sys_GetCapability(sapi_ctx, 0, capability, property, propertyCount,
-                           &moreDataAvailable, capabilityData, 0);
+                           moreDataAvailable, capabilityData, 0);
   if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "Tss2_Get_Capability(): rc = 0x%08X, %s",
-              rc, getErrorString(rc));
+    kmyth_log_tpm_rc("Tss2_Get_Capability", rc);
     kmyth_log(LOG_ERR, "unable to get capability = %u, property = %u,"
               " count = %u ... exiting", capability, property, propertyCount);
     return 1;
   }
 
+  return 0;
+}
+
+//############################################################################
+// find_capability_cache()
+//
+// Must be called with capability_cache_lock held
+//############################################################################
+static capability_cache *find_capability_cache(TSS2_SYS_CONTEXT * sapi_ctx,
+                                               bool create)
+{
+  for (capability_cache * cache = capability_caches; cache != NULL;
+       cache = cache->next)
+  {
+    if (cache->sapi_ctx == sapi_ctx)
+    {
+      return cache;
+    }
+  }
+
+  if (!create)
+  {
+    return NULL;
+  }
+
+  capability_cache *cache = calloc(1, sizeof(capability_cache));
+
+  if (cache != NULL)
+  {
+    cache->sapi_ctx = sapi_ctx;
+    cache->next = capability_caches;
+    capability_caches = cache;
+  }
+  return cache;
+}
+
+//############################################################################
+// is_fixed_property()
+//############################################################################
+static bool is_fixed_property(uint32_t capability, uint32_t property)
+{
+  return (capability == TPM2_CAP_TPM_PROPERTIES)
+    && (property >= TPM2_PT_FIXED)
+    && (property < TPM2_PT_FIXED + TPM2_PT_GROUP);
+}
+
+//############################################################################
+// read_capability_cache()
+//
+// Copies the answer to a query out of a cache, returning true if the query
+// can be answered from what is cached
+//############################################################################
+static bool read_capability_cache(capability_cache * cache,
+                                  uint32_t capability,
+                                  uint32_t property,
+                                  uint32_t propertyCount,
+                                  TPMS_CAPABILITY_DATA * capabilityData)
+{
+  if (is_fixed_property(capability, property) && cache->fixed_valid)
+  {
+    TPML_TAGGED_TPM_PROPERTY *out = &capabilityData->data.tpmProperties;
+    uint32_t first = 0;
+
+    while (first < cache->fixed.count
+           && cache->fixed.tpmProperty[first].property < property)
+    {
+      first++;
+    }
+
+    // a property past the end of a partial list has to come from the TPM
+    if (first == cache->fixed.count && !cache->fixed_complete)
+    {
+      return false;
+    }
+
+    capabilityData->capability = capability;
+    out->count = 0;
+    for (uint32_t i = first;
+         i < cache->fixed.count && out->count < propertyCount
+         && out->count < TPM2_MAX_TPM_PROPERTIES; i++)
+    {
+      out->tpmProperty[out->count++] = cache->fixed.tpmProperty[i];
+    }
+    return true;
+  }
+
+  if (capability == TPM2_CAP_HANDLES && property == TPM2_HR_PERSISTENT
+      && cache->persistent_valid)
+  {
+    TPML_HANDLE *out = &capabilityData->data.handles;
+
+    capabilityData->capability = capability;
+    out->count = 0;
+    for (uint32_t i = 0;
+         i < cache->persistent.count && out->count < propertyCount; i++)
+    {
+      out->handle[out->count++] = cache->persistent.handle[i];
+    }
+    return true;
+  }
+
+  if (capability == TPM2_CAP_TPM_PROPERTIES
+      && property == TPM2_PT_HR_PERSISTENT_AVAIL
+      && propertyCount > 0 && cache->persistent_avail_valid)
+  {
+    capabilityData->capability = capability;
+    capabilityData->data.tpmProperties.count = 1;
+    capabilityData->data.tpmProperties.tpmProperty[0].property =
+      TPM2_PT_HR_PERSISTENT_AVAIL;
+    capabilityData->data.tpmProperties.tpmProperty[0].value =
+      cache->persistent_avail;
+    return true;
+  }
+
+  return false;
+}
+
+//############################################################################
+// fill_capability_cache()
+//
+// Reads the capability data a query would be answered from into a cache.
+// The fixed properties are read as a group, and the volatile ones (e.g.,
+// the room left for persistent objects) one at a time, so that values that
+// may go stale are never cached. Returns 1 if the TPM query failed.
+//############################################################################
+static int fill_capability_cache(TSS2_SYS_CONTEXT * sapi_ctx,
+                                 capability_cache * cache,
+                                 uint32_t capability, uint32_t property)
+{
+  TPMS_CAPABILITY_DATA capData;
+  TPMI_YES_NO moreData = 0;
+
+  if (is_fixed_property(capability, property))
+  {
+    if (query_tpm2_properties(sapi_ctx, TPM2_CAP_TPM_PROPERTIES,
+                              TPM2_PT_FIXED, TPM2_MAX_TPM_PROPERTIES,
+                              &capData, &moreData))
+    {
+      return 1;
+    }
+
+    TPML_TAGGED_TPM_PROPERTY *in = &capData.data.tpmProperties;
+
+    cache->fixed.count = 0;
+    cache->fixed_complete = !moreData;
+    for (uint32_t i = 0; i < in->count; i++)
+    {
+      if (!is_fixed_property(capability, in->tpmProperty[i].property))
+      {
+        // the list ran past the fixed group, so it holds all of it
+        cache->fixed_complete = true;
+        break;
+      }
+      cache->fixed.tpmProperty[cache->fixed.count++] = in->tpmProperty[i];
+    }
+    cache->fixed_valid = true;
+  }
+  else if (capability == TPM2_CAP_HANDLES && property == TPM2_HR_PERSISTENT)
+  {
+    if (query_tpm2_properties(sapi_ctx, TPM2_CAP_HANDLES, TPM2_HR_PERSISTENT,
+                              TPM2_MAX_CAP_HANDLES, &capData, &moreData))
+    {
+      return 1;
+    }
+    if (moreData)
+    {
+      kmyth_log(LOG_WARNING, "Tss2_Sys_GetCapability(): partial data");
+    }
+
+    // only handles in the persistent range are kept
+    cache->persistent.count = 0;
+    for (uint32_t i = 0; i < capData.data.handles.count; i++)
+    {
+      if ((capData.data.handles.handle[i] & TPM2_HR_RANGE_MASK) ==
+          TPM2_HR_PERSISTENT)
+      {
+        cache->persistent.handle[cache->persistent.count++] =
+          capData.data.handles.handle[i];
+      }
+    }
+    cache->persistent_valid = true;
+  }
+  else if (capability == TPM2_CAP_TPM_PROPERTIES
+           && property == TPM2_PT_HR_PERSISTENT_AVAIL)
+  {
+    if (query_tpm2_properties(sapi_ctx, TPM2_CAP_TPM_PROPERTIES,
+                              TPM2_PT_HR_PERSISTENT_AVAIL, 1, &capData,
+                              &moreData))
+    {
+      return 1;
+    }
+    if (capData.data.tpmProperties.count > 0
+        && capData.data.tpmProperties.tpmProperty[0].property ==
+        TPM2_PT_HR_PERSISTENT_AVAIL)
+    {
+      cache->persistent_avail =
+        capData.data.tpmProperties.tpmProperty[0].value;
+      cache->persistent_avail_valid = true;
+    }
+  }
+
+  return 0;
+}
+
+//############################################################################
+// merge_capability_cache()
+//
+// Must be called with capability_cache_lock held
+//############################################################################
+static void merge_capability_cache(capability_cache * cache,
+                                   capability_cache * filled)
+{
+  if (filled->fixed_valid)
+  {
+    cache->fixed_valid = true;
+    cache->fixed_complete = filled->fixed_complete;
+    cache->fixed = filled->fixed;
+  }
+  if (filled->persistent_valid)
+  {
+    cache->persistent_valid = true;
+    cache->persistent = filled->persistent;
+  }
+  if (filled->persistent_avail_valid)
+  {
+    cache->persistent_avail_valid = true;
+    cache->persistent_avail = filled->persistent_avail;
+  }
+}
+
+//############################################################################
+// get_tpm2_properties()
+//############################################################################
+int get_tpm2_properties(TSS2_SYS_CONTEXT * sapi_ctx,
+                        uint32_t capability,
+                        uint32_t property,
+                        uint32_t propertyCount,
+                        TPMS_CAPABILITY_DATA * capabilityData)
+{
+  bool cacheable = (sapi_ctx != NULL)
+    && (is_fixed_property(capability, property)
+        || (capability == TPM2_CAP_HANDLES && property == TPM2_HR_PERSISTENT)
+        || (capability == TPM2_CAP_TPM_PROPERTIES
+            && property == TPM2_PT_HR_PERSISTENT_AVAIL));
+
+  // The TPM is queried without the cache lock held, so that connections
+  // only wait on each other for the cache itself
+  if (cacheable)
+  {
+    pthread_mutex_lock(&capability_cache_lock);
+
+    capability_cache *cache = find_capability_cache(sapi_ctx, false);
+    bool hit = (cache != NULL) && read_capability_cache(cache, capability,
+                                                        property,
+                                                        propertyCount,
+                                                        capabilityData);
+
+    pthread_mutex_unlock(&capability_cache_lock);
+
+    if (hit)
+    {
+      kmyth_metrics_count("kmyth_tpm_capability_cache_total",
+                          "result=\"hit\"", CAPABILITY_CACHE_HELP, 1);
+      return 0;
+    }
+
+    capability_cache filled;
+
+    memset(&filled, 0, sizeof(filled));
+    if (fill_capability_cache(sapi_ctx, &filled, capability, property))
+    {
+      return 1;
+    }
+
+    pthread_mutex_lock(&capability_cache_lock);
+    cache = find_capability_cache(sapi_ctx, true);
+    if (cache != NULL)
+    {
+      merge_capability_cache(cache, &filled);
+    }
+    pthread_mutex_unlock(&capability_cache_lock);
+
+    if (read_capability_cache(&filled, capability, property, propertyCount,
+                              capabilityData))
+    {
+      kmyth_metrics_count("kmyth_tpm_capability_cache_total",
+                          "result=\"miss\"", CAPABILITY_CACHE_HELP, 1);
+      return 0;
+    }
+  }
+
+  TPMI_YES_NO moreDataAvailable = 1;
+
+  if (query_tpm2_properties(sapi_ctx, capability, property, propertyCount,
+                            capabilityData, &moreDataAvailable))
+  {
+    return 1;
+  }
+
   if (moreDataAvailable)
   {
     kmyth_log(LOG_WARNING, "Tss2_Sys_GetCapability(): partial data");
@@ -383,6 +1128,319 @@ int get_tpm2_properties(TSS2_SYS_CONTEXT * sapi_ctx,
   return 0;
 }
 
+//############################################################################
+// invalidate_tpm2_capability_cache()
+//############################################################################
+void invalidate_tpm2_capability_cache(TSS2_SYS_CONTEXT * sapi_ctx)
+{
+  pthread_mutex_lock(&capability_cache_lock);
+
+  capability_cache **link = &capability_caches;
+
+  while (*link != NULL)
+  {
+    capability_cache *cache = *link;
+
+    if (sapi_ctx == NULL || cache->sapi_ctx == sapi_ctx)
+    {
+      *link = cache->next;
+      free(cache);
+    }
+    else
+    {
+      link = &cache->next;
+    }
+  }
+
+  pthread_mutex_unlock(&capability_cache_lock);
+}
+
+//############################################################################
+// invalidate_tpm2_persistent_handle_cache()
+//############################################################################
+void invalidate_tpm2_persistent_handle_cache(TSS2_SYS_CONTEXT * sapi_ctx)
+{
+  pthread_mutex_lock(&capability_cache_lock);
+
+  capability_cache *cache = find_capability_cache(sapi_ctx, false);
+
+  if (cache != NULL)
+  {
+    cache->persistent_valid = false;
+    cache->persistent_avail_valid = false;
+  }
+
+  pthread_mutex_unlock(&capability_cache_lock);
+}
+
+//############################################################################
+// wait_read_flight()
+//
+// Must be called with read_flight_lock held
+//############################################################################
+static void wait_read_flight(read_flight * flight)
+{
+  flight->waiters++;
+  while (!flight->done)
+  {
+    pthread_cond_wait(&flight->done_cond, &read_flight_lock);
+  }
+}
+
+//############################################################################
+// free_read_flight()
+//############################################################################
+static void free_read_flight(read_flight * flight)
+{
+  pthread_cond_destroy(&flight->done_cond);
+  free(flight);
+}
+
+//############################################################################
+// leave_read_flight()
+//
+// Must be called with read_flight_lock held
+//############################################################################
+static void leave_read_flight(read_flight * flight)
+{
+  // the last caller to leave a completed flight releases it
+  if (--flight->waiters == 0)
+  {
+    free_read_flight(flight);
+  }
+}
+
+//############################################################################
+// begin_read_flight()
+//############################################################################
+static read_flight *begin_read_flight(TPM2_CC command,
+                                      const uint8_t * params,
+                                      size_t params_size, bool *joined)
+{
+  read_flight *in_flight = NULL;
+  read_flight *queued = NULL;
+
+  *joined = false;
+
+  pthread_mutex_lock(&read_flight_lock);
+  for (read_flight * flight = read_flights; flight != NULL;
+       flight = flight->next)
+  {
+    if (flight->command == command && flight->params_size == params_size
+        && memcmp(flight->params, params, params_size) == 0)
+    {
+      if (flight->sent)
+      {
+        in_flight = flight;
+      }
+      else
+      {
+        queued = flight;
+      }
+    }
+  }
+
+  // join the flight queued for this command, if there is one
+  if (queued != NULL)
+  {
+    wait_read_flight(queued);
+    pthread_mutex_unlock(&read_flight_lock);
+    *joined = true;
+    return queued;
+  }
+
+  // otherwise queue one (if this fails, the command is simply sent alone),
+  // which is sent once any identical command in flight has completed
+  queued = calloc(1, sizeof(read_flight));
+  if (queued == NULL)
+  {
+    pthread_mutex_unlock(&read_flight_lock);
+    return NULL;
+  }
+  queued->command = command;
+  memcpy(queued->params, params, params_size);
+  queued->params_size = params_size;
+  pthread_cond_init(&queued->done_cond, NULL);
+  queued->next = read_flights;
+  read_flights = queued;
+
+  if (in_flight != NULL)
+  {
+    wait_read_flight(in_flight);
+    leave_read_flight(in_flight);
+  }
+  queued->sent = true;
+  pthread_mutex_unlock(&read_flight_lock);
+
+  return queued;
+}
+
+//############################################################################
+// end_read_flight()
+//############################################################################
+static void end_read_flight(read_flight * flight)
+{
+  if (flight == NULL)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&read_flight_lock);
+
+  read_flight **link = &read_flights;
+
+  while (*link != flight)
+  {
+    link = &(*link)->next;
+  }
+  *link = flight->next;
+
+  flight->done = true;
+  pthread_cond_broadcast(&flight->done_cond);
+  if (flight->waiters == 0)
+  {
+    free_read_flight(flight);
+  }
+
+  pthread_mutex_unlock(&read_flight_lock);
+}
+
+//############################################################################
+// read_tpm2_pcrs()
+//############################################################################
+TPM2_RC read_tpm2_pcrs(TSS2_SYS_CONTEXT * sapi_ctx,
+                       TPML_PCR_SELECTION * selection,
+                       UINT32 * updateCounter,
+                       TPML_PCR_SELECTION * selectionOut,
+                       TPML_DIGEST * values)
+{
+  uint8_t params[sizeof(TPML_PCR_SELECTION)];
+  size_t params_size = 0;
+  read_flight *flight = NULL;
+  bool joined = false;
+
+  if (Tss2_MU_TPML_PCR_SELECTION_Marshal(selection, params, sizeof(params),
+                                         &params_size) == TSS2_RC_SUCCESS)
+  {
+    flight = begin_read_flight(TPM2_CC_PCR_Read, params, params_size,
+                               &joined);
+  }
+
+  TPM2_RC rc;
+
+  if (joined)
+  {
+    // a failed flight may have failed on its sender's connection alone, so
+    // its callers then send their own command
+    rc = flight->rc;
+    if (rc == TPM2_RC_SUCCESS)
+    {
+      *updateCounter = flight->out.pcr_read.updateCounter;
+      *selectionOut = flight->out.pcr_read.selectionOut;
+      *values = flight->out.pcr_read.values;
+      kmyth_metrics_count("kmyth_tpm_read_coalesced_total",
+                          "command=\"PCR_Read\"", READ_FLIGHT_HELP, 1);
+    }
+    pthread_mutex_lock(&read_flight_lock);
+    leave_read_flight(flight);
+    pthread_mutex_unlock(&read_flight_lock);
+    if (rc == TPM2_RC_SUCCESS)
+    {
+      return rc;
+    }
+    flight = NULL;
+  }
+
+  rc = Tss2_Sys_PCR_Read(sapi_ctx, NULL, selection, updateCounter,
+                         selectionOut, values, NULL);
+  if (flight != NULL)
+  {
+    flight->rc = rc;
+    flight->out.pcr_read.updateCounter = *updateCounter;
+    flight->out.pcr_read.selectionOut = *selectionOut;
+    flight->out.pcr_read.values = *values;
+    end_read_flight(flight);
+  }
+
+  return rc;
+}
+
+//############################################################################
+// read_tpm2_public()
+//############################################################################
+TPM2_RC read_tpm2_public(TSS2_SYS_CONTEXT * sapi_ctx,
+                         TPM2_HANDLE handle,
+                         TPM2B_PUBLIC * outPublic,
+                         TPM2B_NAME * name, TPM2B_NAME * qualifiedName)
+{
+  TPM2B_PUBLIC objectPublic = {.size = 0 };
+  TPM2B_NAME objectName = {.size = 0 };
+  TPM2B_NAME objectQualifiedName = {.size = 0 };
+  read_flight *flight = NULL;
+  bool joined = false;
+
+  // transient handles are virtualized for each connection by a resource
+  // manager, so only persistent objects are the same for every caller
+  if ((handle >> TPM2_HR_SHIFT) == TPM2_HT_PERSISTENT)
+  {
+    uint8_t params[sizeof(TPM2_HANDLE)];
+
+    memcpy(params, &handle, sizeof(handle));
+    flight = begin_read_flight(TPM2_CC_ReadPublic, params, sizeof(params),
+                               &joined);
+  }
+
+  TPM2_RC rc = TPM2_RC_SUCCESS;
+
+  if (joined)
+  {
+    rc = flight->rc;
+    if (rc == TPM2_RC_SUCCESS)
+    {
+      objectPublic = flight->out.read_public.outPublic;
+      objectName = flight->out.read_public.name;
+      objectQualifiedName = flight->out.read_public.qualifiedName;
+      kmyth_metrics_count("kmyth_tpm_read_coalesced_total",
+                          "command=\"ReadPublic\"", READ_FLIGHT_HELP, 1);
+    }
+    pthread_mutex_lock(&read_flight_lock);
+    leave_read_flight(flight);
+    pthread_mutex_unlock(&read_flight_lock);
+    flight = NULL;
+  }
+  if (!joined || rc != TPM2_RC_SUCCESS)
+  {
+    rc = Tss2_Sys_ReadPublic(sapi_ctx, handle, NULL, &objectPublic,
+                             &objectName, &objectQualifiedName, NULL);
+  }
+  if (flight != NULL)
+  {
+    flight->rc = rc;
+    flight->out.read_public.outPublic = objectPublic;
+    flight->out.read_public.name = objectName;
+    flight->out.read_public.qualifiedName = objectQualifiedName;
+    end_read_flight(flight);
+  }
+
+  if (rc == TPM2_RC_SUCCESS)
+  {
+    if (outPublic != NULL)
+    {
+      *outPublic = objectPublic;
+    }
+    if (name != NULL)
+    {
+      *name = objectName;
+    }
+    if (qualifiedName != NULL)
+    {
+      *qualifiedName = objectQualifiedName;
+    }
+  }
+
+  return rc;
+}
+
 //############################################################################
 // get_tpm2_impl_type()
 //############################################################################
@@ -481,10 +1539,88 @@ int init_password_cmd_auth(TPM2B_AUTH authEntityAuthVal,
   memcpy(commandAuths->auths[0].hmac.buffer, authEntityAuthVal.buffer,
          authEntityAuthVal.size);
 
-  // initialize lengths of values returned by TPM to zero in response
-  // authorization structure sent with command to TPM
-  responseAuths->auths[0].nonce.size = 0;
-  responseAuths->auths[0].hmac.size = 0;
+  // initialize lengths of values returned by TPM to zero in response
+  // authorization structure sent with command to TPM
+  responseAuths->auths[0].nonce.size = 0;
+  responseAuths->auths[0].hmac.size = 0;
+
+  return 0;
+}
+
+//############################################################################
+// set_param_encryption()
+//############################################################################
+static int set_param_encryption(TSS2_SYS_CONTEXT * sapi_ctx,
+                                SESSION * authSession,
+                                TPM2_CC authCmdCode,
+                                TPM2B_AUTH authEntityAuthVal,
+                                uint8_t ** authCmdParams,
+                                size_t *authCmdParams_len,
+                                TPMA_SESSION * sessionAttr)
+{
+  // Encrypt the first command parameter of the commands that send a secret
+  // (the sensitive data of TPM2_Create() and the data of TPM2_NV_Write()) -
+  // the private area passed to TPM2_Load() is already wrapped by its
+  // parent. The command code is in the TPM's big-endian byte order, as read
+  // with Tss2_Sys_GetCommandCode().
+  const uint8_t *param = NULL;
+  size_t param_size = 0;
+  TSS2_RC rc = TSS2_SYS_RC_NO_DECRYPT_PARAM;
+
+  if (authCmdCode == htonl(TPM2_CC_Create)
+      || authCmdCode == htonl(TPM2_CC_NV_Write))
+  {
+    rc = Tss2_Sys_GetDecryptParam(sapi_ctx, &param_size, &param);
+  }
+
+  if (rc == TSS2_RC_SUCCESS && param_size > 0)
+  {
+    uint8_t *encParam = malloc(param_size);
+
+    if (encParam == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to allocate parameter buffer ... exiting");
+      return 1;
+    }
+    memcpy(encParam, param, param_size);
+    if (crypt_session_param(authSession, authEntityAuthVal, true,
+                            encParam, param_size))
+    {
+      kmyth_clear_and_free(encParam, param_size);
+      return 1;
+    }
+    rc = Tss2_Sys_SetDecryptParam(sapi_ctx, param_size, encParam);
+    kmyth_clear_and_free(encParam, param_size);
+    if (rc != TSS2_RC_SUCCESS)
+    {
+      kmyth_log_tpm_rc("Tss2_Sys_SetDecryptParam", rc);
+      return 1;
+    }
+    *sessionAttr |= TPMA_SESSION_DECRYPT;
+
+    // the command parameter hash covers the encrypted parameters
+    rc = Tss2_Sys_GetCpBuffer(sapi_ctx, authCmdParams_len,
+                              (const uint8_t **) authCmdParams);
+    if (rc != TSS2_RC_SUCCESS)
+    {
+      kmyth_log_tpm_rc("Tss2_Sys_GetCpBuffer", rc);
+      return 1;
+    }
+  }
+  else if (rc != TSS2_RC_SUCCESS && rc != TSS2_SYS_RC_NO_DECRYPT_PARAM)
+  {
+    kmyth_log_tpm_rc("Tss2_Sys_GetDecryptParam", rc);
+    return 1;
+  }
+
+  // Ask for the first response parameter to be encrypted for the commands
+  // whose response carries a secret (the data returned by TPM2_Unseal() or
+  // TPM2_NV_Read())
+  if (authCmdCode == htonl(TPM2_CC_Unseal)
+      || authCmdCode == htonl(TPM2_CC_NV_Read))
+  {
+    *sessionAttr |= TPMA_SESSION_ENCRYPT;
+  }
 
   return 0;
 }
@@ -492,7 +1628,8 @@ int init_password_cmd_auth(TPM2B_AUTH authEntityAuthVal,
 //############################################################################
 // init_policy_cmd_auth()
 //############################################################################
-int init_policy_cmd_auth(SESSION * authSession,
+int init_policy_cmd_auth(TSS2_SYS_CONTEXT * sapi_ctx,
+                         SESSION * authSession,
                          TPM2_CC authCmdCode,
                          TPM2B_NAME authEntityName,
                          TPM2B_AUTH authEntityAuthVal,
@@ -531,15 +1668,31 @@ int init_policy_cmd_auth(SESSION * authSession,
          commandAuths->auths[0].nonce.size);
 
   // Define session attributes and put them into authorization structure
-  //   - this session is for authorization and not encryption or audit,
-  //     therefore 'audit', 'encrypt', 'decrypt', 'auditReset', and
-  //     'auditExclusive' bits should remain clear
+  //   - this session is not used for audit, therefore 'audit', 'auditReset',
+  //     and 'auditExclusive' bits should remain clear
+  //   - 'decrypt' and 'encrypt' are set by set_param_encryption() when the
+  //     session was started for parameter encryption, and remain clear
+  //     otherwise
   //   - the two reserved bits remain clear
   //   - the 'continueSession' bit is set so that the session remains
   //     active after command completion
   TPMA_SESSION sessionAttr = 0;
 
   sessionAttr |= TPMA_SESSION_CONTINUESESSION;
+
+  // Parameter encryption uses the nonceCaller just generated, and must be
+  // applied before the command parameter hash is computed, as the TPM
+  // checks the authorization against the encrypted parameters
+  if (authSession->symmetric.algorithm != TPM2_ALG_NULL)
+  {
+    if (set_param_encryption(sapi_ctx, authSession, authCmdCode,
+                             authEntityAuthVal, &authCmdParams,
+                             &authCmdParams_len, &sessionAttr))
+    {
+      kmyth_log(LOG_ERR, "error encrypting command parameter ... exiting");
+      return 1;
+    }
+  }
   commandAuths->auths[0].sessionAttributes = sessionAttr;
 
   // create the authorized command hash - part of the HMAC calculation
@@ -699,13 +1852,12 @@ int compute_cpHash(TPM2_CC cmdCode,
     return 1;
   }
 
-  // initialize hash
-  EVP_MD_CTX *md_ctx = EVP_MD_CTX_create();
+  // initialize hash (this thread's reused digest context)
+  EVP_MD_CTX *md_ctx = get_auth_md_ctx();
 
-  if (!EVP_DigestInit_ex(md_ctx, KMYTH_OPENSSL_HASH, NULL))
+  if (md_ctx == NULL)
   {
     kmyth_log(LOG_ERR, "error setting up digest context ... exiting");
-    EVP_MD_CTX_destroy(md_ctx);
     return 1;
   }
 
@@ -713,7 +1865,6 @@ int compute_cpHash(TPM2_CC cmdCode,
   if (!EVP_DigestUpdate(md_ctx, (uint8_t *) & cmdCode, sizeof(TPM2_CC)))
   {
     kmyth_log(LOG_ERR, "error hashing command code ... exiting");
-    EVP_MD_CTX_destroy(md_ctx);
     return 1;
   }
 
@@ -721,7 +1872,6 @@ int compute_cpHash(TPM2_CC cmdCode,
   if (!EVP_DigestUpdate(md_ctx, authEntityName.name, authEntityName.size))
   {
     kmyth_log(LOG_ERR, "error hashing entity name ... exiting");
-    EVP_MD_CTX_destroy(md_ctx);
     return 1;
   }
 
@@ -729,7 +1879,6 @@ int compute_cpHash(TPM2_CC cmdCode,
   if (!EVP_DigestUpdate(md_ctx, cmdParams, cmdParams_size))
   {
     kmyth_log(LOG_ERR, "error hashing command parameters ... exiting");
-    EVP_MD_CTX_destroy(md_ctx);
     return 1;
   }
 
@@ -740,12 +1889,9 @@ int compute_cpHash(TPM2_CC cmdCode,
   if (!EVP_DigestFinal_ex(md_ctx, cpHash_result, &cpHash_result_size))
   {
     kmyth_log(LOG_ERR, "error finalizing digest ... exiting");
-    EVP_MD_CTX_destroy(md_ctx);
     return 1;
   }
 
-  EVP_MD_CTX_destroy(md_ctx);
-  md_ctx = NULL;
   kmyth_log(LOG_DEBUG, "cpHash: 0x%02X..%02X", cpHash_result[0],
             cpHash_result[cpHash_result_size - 1]);
 
@@ -770,13 +1916,12 @@ int compute_rpHash(TPM2_RC rspCode,
     return 1;
   }
 
-  // initialize hash
-  EVP_MD_CTX *md_ctx = EVP_MD_CTX_create();
+  // initialize hash (this thread's reused digest context)
+  EVP_MD_CTX *md_ctx = get_auth_md_ctx();
 
-  if (!EVP_DigestInit_ex(md_ctx, KMYTH_OPENSSL_HASH, NULL))
+  if (md_ctx == NULL)
   {
     kmyth_log(LOG_ERR, "error setting up digest context ... exiting");
-    EVP_MD_CTX_destroy(md_ctx);
     return 1;
   }
 
@@ -784,7 +1929,6 @@ int compute_rpHash(TPM2_RC rspCode,
   if (!EVP_DigestUpdate(md_ctx, (uint8_t *) & rspCode, sizeof(TPM2_RC)))
   {
     kmyth_log(LOG_ERR, "error hashing response code ... exiting");
-    EVP_MD_CTX_destroy(md_ctx);
     return 1;
   }
 
@@ -792,7 +1936,6 @@ int compute_rpHash(TPM2_RC rspCode,
   if (!EVP_DigestUpdate(md_ctx, (uint8_t *) & cmdCode, sizeof(TPM2_CC)))
   {
     kmyth_log(LOG_ERR, "error hashing command code ... exiting");
-    EVP_MD_CTX_destroy(md_ctx);
     return 1;
   }
 
@@ -800,7 +1943,6 @@ int compute_rpHash(TPM2_RC rspCode,
   if (!EVP_DigestUpdate(md_ctx, cmdParams, cmdParams_size))
   {
     kmyth_log(LOG_ERR, "error hashing command parameters ... exiting");
-    EVP_MD_CTX_destroy(md_ctx);
     return 1;
   }
 
@@ -811,12 +1953,9 @@ int compute_rpHash(TPM2_RC rspCode,
   if (!EVP_DigestFinal_ex(md_ctx, rpHash_result, &rpHash_result_size))
   {
     kmyth_log(LOG_ERR, "error finalizing digest ... exiting");
-    EVP_MD_CTX_destroy(md_ctx);
     return 1;
   }
 
-  EVP_MD_CTX_destroy(md_ctx);
-  md_ctx = NULL;
 
   kmyth_log(LOG_DEBUG, "rpHash: 0x%02X..%02X", rpHash_result[0],
             rpHash_result[rpHash_result_size - 1]);
@@ -843,14 +1982,33 @@ int compute_authHMAC(SESSION auth_session,
     return 1;
   }
 
-  // initialize authHMAC (authValue is key for computing the keyed hash)
-  HMAC_CTX *hmac_ctx = HMAC_CTX_new();
+  // initialize authHMAC (the key for computing the keyed hash is the
+  // session key, empty for an unsalted session, followed by the authValue)
+  uint8_t hmac_key[sizeof(auth_session.sessionKey.buffer) +
+                   sizeof(auth_authValue.buffer)];
+  size_t hmac_key_size = 0;
+
+  if (auth_session.sessionKey.size > sizeof(auth_session.sessionKey.buffer)
+      || auth_authValue.size > sizeof(auth_authValue.buffer))
+  {
+    kmyth_log(LOG_ERR, "invalid HMAC key size ... exiting");
+    return 1;
+  }
+  memcpy(hmac_key, auth_session.sessionKey.buffer,
+         auth_session.sessionKey.size);
+  hmac_key_size = auth_session.sessionKey.size;
+  memcpy(hmac_key + hmac_key_size, auth_authValue.buffer,
+         auth_authValue.size);
+  hmac_key_size += auth_authValue.size;
+
+  // this thread's reused HMAC context, whose key setup is also reused while
+  // the key is unchanged
+  HMAC_CTX *hmac_ctx = get_auth_hmac_ctx(hmac_key, hmac_key_size);
 
-  if (!HMAC_Init_ex(hmac_ctx, auth_authValue.buffer, auth_authValue.size,
-                    KMYTH_OPENSSL_HASH, NULL))
+  kmyth_clear(hmac_key, hmac_key_size);
+  if (hmac_ctx == NULL)
   {
     kmyth_log(LOG_ERR, "error initializing HMAC ... exiting");
-    HMAC_CTX_free(hmac_ctx);
     return 1;
   }
 
@@ -859,7 +2017,6 @@ int compute_authHMAC(SESSION auth_session,
   {
     kmyth_log(LOG_ERR,
               "error updating HMAC with authorized command hash ... exiting");
-    HMAC_CTX_free(hmac_ctx);
     return 1;
   }
 
@@ -868,7 +2025,6 @@ int compute_authHMAC(SESSION auth_session,
                    auth_session.nonceNewer.size))
   {
     kmyth_log(LOG_ERR, "error updating HMAC with new nonce ... exiting");
-    HMAC_CTX_free(hmac_ctx);
     return 1;
   }
 
@@ -877,7 +2033,6 @@ int compute_authHMAC(SESSION auth_session,
                    auth_session.nonceOlder.size))
   {
     kmyth_log(LOG_ERR, "error updating HMAC with old nonce ... exiting");
-    HMAC_CTX_free(hmac_ctx);
     return 1;
   }
 
@@ -886,7 +2041,6 @@ int compute_authHMAC(SESSION auth_session,
   {
     kmyth_log(LOG_ERR,
               "error updating HMAC with session attributes ... exiting");
-    HMAC_CTX_free(hmac_ctx);
     return 1;
   }
 
@@ -897,11 +2051,8 @@ int compute_authHMAC(SESSION auth_session,
   if (!HMAC_Final(hmac_ctx, authHMAC_result, &authHMAC_result_size))
   {
     kmyth_log(LOG_ERR, "error finalizing HMAC ... exiting");
-    HMAC_CTX_free(hmac_ctx);
     return 1;
   }
-  HMAC_CTX_free(hmac_ctx);
-  hmac_ctx = NULL;
   kmyth_log(LOG_DEBUG, "authHMAC: 0x%02X..%02X", authHMAC_result[0],
             authHMAC_result[authHMAC_result_size - 1]);
 
@@ -926,7 +2077,11 @@ int create_policy_digest(TSS2_SYS_CONTEXT * sapi_ctx,
   TPM2B_NONCE initialNonce;
 
   initialNonce.size = KMYTH_DIGEST_SIZE;
-  create_caller_nonce(&initialNonce);
+  if (create_caller_nonce(&initialNonce))
+  {
+    kmyth_log(LOG_ERR, "error generating initial nonce ... exiting");
+    return 1;
+  }
 
   // initialize session state with "start-up" nonce values
   //   - nonceNewer initialized to nonceCaller value just generated
@@ -968,9 +2123,7 @@ int create_policy_digest(TSS2_SYS_CONTEXT * sapi_ctx,
 
   if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR,
-              "Tss2_Sys_PolicyGetDigest(): rc = 0x%08X, %s", rc,
-              getErrorString(rc));
+    kmyth_log_tpm_rc("Tss2_Sys_PolicyGetDigest", rc);
     return 1;
   }
   kmyth_log(LOG_DEBUG, "authPolicy: 0x%02X..%02X",
@@ -981,8 +2134,7 @@ int create_policy_digest(TSS2_SYS_CONTEXT * sapi_ctx,
   rc = Tss2_Sys_FlushContext(sapi_ctx, trialPolicySession.sessionHandle);
   if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "Tss2_Sys_FlushContext(): rc = 0x%08X, %s", rc,
-              getErrorString(rc));
+    kmyth_log_tpm_rc("Tss2_Sys_FlushContext", rc);
     return 1;
   }
   kmyth_log(LOG_DEBUG, "flushed trial policy session "
@@ -991,6 +2143,129 @@ int create_policy_digest(TSS2_SYS_CONTEXT * sapi_ctx,
   return 0;
 }
 
+//############################################################################
+// extend_policy_digest()
+//############################################################################
+static int extend_policy_digest(TPM2B_DIGEST * policyDigest,
+                                TPM2_CC commandCode,
+                                uint8_t * params, size_t params_size)
+{
+  // policyDigest_new = H(policyDigest_old || commandCode || params)
+  uint8_t cc_bytes[sizeof(TPM2_CC)];
+  size_t cc_offset = 0;
+
+  if (Tss2_MU_TPM2_CC_Marshal(commandCode, cc_bytes, sizeof(cc_bytes),
+                              &cc_offset) != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "error marshalling command code ... exiting");
+    return 1;
+  }
+
+  EVP_MD_CTX *md_ctx = EVP_MD_CTX_new();
+  unsigned int digest_size = 0;
+
+  if (md_ctx == NULL
+      || !EVP_DigestInit_ex(md_ctx, KMYTH_OPENSSL_HASH, NULL)
+      || !EVP_DigestUpdate(md_ctx, policyDigest->buffer, policyDigest->size)
+      || !EVP_DigestUpdate(md_ctx, cc_bytes, cc_offset)
+      || (params_size > 0 && !EVP_DigestUpdate(md_ctx, params, params_size))
+      || !EVP_DigestFinal_ex(md_ctx, policyDigest->buffer, &digest_size))
+  {
+    kmyth_log(LOG_ERR, "error extending policy digest ... exiting");
+    EVP_MD_CTX_free(md_ctx);
+    return 1;
+  }
+  EVP_MD_CTX_free(md_ctx);
+  policyDigest->size = digest_size;
+
+  return 0;
+}
+
+//############################################################################
+// compute_policy_digest
+//############################################################################
+int compute_policy_digest(TSS2_SYS_CONTEXT * sapi_ctx,
+                          TPML_PCR_SELECTION tp_pcrList,
+                          kmyth_pcr_snapshot * pcrSnapshot,
+                          TPM2B_DIGEST * policyDigest_out)
+{
+  if (policyDigest_out == NULL)
+  {
+    kmyth_log(LOG_ERR, "no output digest ... exiting");
+    return 1;
+  }
+
+  // a policy session starts with an all-zero policy digest
+  policyDigest_out->size = KMYTH_DIGEST_SIZE;
+  memset(policyDigest_out->buffer, 0, KMYTH_DIGEST_SIZE);
+
+  // same steps, in the same order, as apply_policy()
+  if (extend_policy_digest(policyDigest_out, TPM2_CC_PolicyAuthValue, NULL, 0))
+  {
+    kmyth_log(LOG_ERR, "error computing AuthVal policy ... exiting");
+    return 1;
+  }
+
+  if (tp_pcrList.count > 0)
+  {
+    if (sapi_ctx == NULL)
+    {
+      kmyth_log(LOG_ERR, "no SAPI context to read PCRs ... exiting");
+      return 1;
+    }
+
+    // policyDigest is extended by the marshalled PCR selection list and the
+    // digest of the current values of the selected PCRs
+    uint8_t params[sizeof(TPML_PCR_SELECTION) + sizeof(TPM2B_DIGEST)];
+    size_t params_size = 0;
+
+    if (Tss2_MU_TPML_PCR_SELECTION_Marshal(&tp_pcrList, params,
+                                           sizeof(params), &params_size)
+        != TSS2_RC_SUCCESS)
+    {
+      kmyth_log(LOG_ERR, "error marshalling PCR selection ... exiting");
+      return 1;
+    }
+
+    // the PCR values come from the caller's snapshot, if it is current
+    kmyth_pcr_snapshot localSnapshot = {.valid = false, };
+    kmyth_pcr_snapshot *snapshot = &localSnapshot;
+    int rc = 0;
+
+    if (pcrSnapshot != NULL)
+    {
+      snapshot = pcrSnapshot;
+      rc = refresh_pcr_snapshot(sapi_ctx, tp_pcrList, snapshot);
+    }
+    else
+    {
+      rc = read_pcr_snapshot(sapi_ctx, tp_pcrList, snapshot);
+    }
+
+    TPM2B_DIGEST pcrDigest = {.size = 0, };
+
+    if (rc || get_pcr_snapshot_digest(snapshot, &pcrDigest))
+    {
+      kmyth_log(LOG_ERR, "error computing PCR digest ... exiting");
+      return 1;
+    }
+    memcpy(params + params_size, pcrDigest.buffer, pcrDigest.size);
+    params_size += pcrDigest.size;
+
+    if (extend_policy_digest(policyDigest_out, TPM2_CC_PolicyPCR, params,
+                             params_size))
+    {
+      kmyth_log(LOG_ERR, "error computing PCR policy ... exiting");
+      return 1;
+    }
+  }
+  kmyth_log(LOG_DEBUG, "authPolicy (computed): 0x%02X..%02X",
+            policyDigest_out->buffer[0],
+            policyDigest_out->buffer[policyDigest_out->size - 1]);
+
+  return 0;
+}
+
 //############################################################################
 // create_policy_auth_session
 //############################################################################
@@ -1001,7 +2276,11 @@ int create_policy_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
   TPM2B_NONCE initialNonce;
 
   initialNonce.size = 0;        // start with empty nonce
-  create_caller_nonce(&initialNonce);
+  if (create_caller_nonce(&initialNonce))
+  {
+    kmyth_log(LOG_ERR, "error generating initial nonce ... exiting");
+    return 1;
+  }
 
   // initialize session state with "start-up" nonce values
   //   - nonceNewer initialized to nonceCaller value just generated
@@ -1027,15 +2306,157 @@ int create_policy_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
 }
 
 //############################################################################
-// start_policy_auth_session()
+// restart_policy_auth_session()
 //############################################################################
-int start_policy_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
-                              SESSION * session, TPM2_SE session_type)
+int restart_policy_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
+                                SESSION * policySession)
+{
+  if (policySession == NULL)
+  {
+    kmyth_log(LOG_ERR, "no policy session ... exiting");
+    return 1;
+  }
+
+  // TPM2_PolicyRestart() resets the session's policy digest to its initial
+  // (all-zero) value, leaving its nonces, and so the SESSION state, intact
+  TSS2L_SYS_AUTH_COMMAND const *nullCmdAuths = NULL;
+  TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL;
+  TPM2_RC rc = Tss2_Sys_PolicyRestart(sapi_ctx,
+                                      policySession->sessionHandle,
+                                      nullCmdAuths, nullRspAuths);
+
+  if (rc != TPM2_RC_SUCCESS)
+  {
+    kmyth_log_tpm_rc("Tss2_Sys_PolicyRestart", rc);
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "restarted policy session (handle = 0x%08X)",
+            policySession->sessionHandle);
+
+  return 0;
+}
+
+//############################################################################
+// encrypt_session_salt()
+//############################################################################
+static int encrypt_session_salt(TSS2_SYS_CONTEXT * sapi_ctx,
+                                TPM2_HANDLE tpmKey, SESSION * session)
+{
+  // get the public area of the (RSA) salt encryption key
+  TPM2B_PUBLIC tpmKey_public = {.size = 0, };
+  TPM2B_NAME tpmKey_name = {.size = sizeof(TPM2B_NAME) - sizeof(uint16_t), };
+  TPM2B_NAME tpmKey_qualifiedName = {.size =
+      sizeof(TPM2B_NAME) - sizeof(uint16_t),
+  };
+  TSS2_RC rc = read_tpm2_public(sapi_ctx, tpmKey, &tpmKey_public,
+                                &tpmKey_name, &tpmKey_qualifiedName);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log_tpm_rc("Tss2_Sys_ReadPublic", rc);
+    return 1;
+  }
+  if (tpmKey_public.publicArea.type != TPM2_ALG_RSA
+      || tpmKey_public.publicArea.nameAlg != KMYTH_HASH_ALG)
+  {
+    kmyth_log(LOG_ERR, "salt encryption key (0x%08X) is not an RSA key "
+              "with a SHA-256 name algorithm ... exiting", tpmKey);
+    return 1;
+  }
+
+  // generate the salt
+  session->salt.size = KMYTH_DIGEST_SIZE;
+  if (RAND_bytes(session->salt.buffer, session->salt.size) != 1)
+  {
+    kmyth_log(LOG_ERR, "error generating session salt ... exiting");
+    session->salt.size = 0;
+    return 1;
+  }
+
+  // encrypt it with RSA-OAEP (using the key's nameAlg hash, with the label
+  // "SECRET", including its NUL terminator, as required for a salt)
+  TPMS_RSA_PARMS *rsa_parms = &tpmKey_public.publicArea.parameters.rsaDetail;
+  TPM2B_PUBLIC_KEY_RSA *rsa_mod = &tpmKey_public.publicArea.unique.rsa;
+  uint32_t exponent = rsa_parms->exponent ? rsa_parms->exponent : 65537;
+  BIGNUM *n = BN_bin2bn(rsa_mod->buffer, rsa_mod->size, NULL);
+  BIGNUM *e = BN_new();
+  RSA *rsa = RSA_new();
+  EVP_PKEY *pkey = EVP_PKEY_new();
+
+  if (n == NULL || e == NULL || rsa == NULL || pkey == NULL
+      || !BN_set_word(e, exponent) || !RSA_set0_key(rsa, n, e, NULL))
+  {
+    kmyth_log(LOG_ERR, "error creating salt encryption key ... exiting");
+    BN_free(n);
+    BN_free(e);
+    RSA_free(rsa);
+    EVP_PKEY_free(pkey);
+    kmyth_clear(&session->salt, sizeof(session->salt));
+    return 1;
+  }
+  // the RSA now owns the modulus and exponent, and the EVP_PKEY the RSA
+  n = NULL;
+  e = NULL;
+  if (!EVP_PKEY_assign_RSA(pkey, rsa))
+  {
+    kmyth_log(LOG_ERR, "error creating salt encryption key ... exiting");
+    RSA_free(rsa);
+    EVP_PKEY_free(pkey);
+    kmyth_clear(&session->salt, sizeof(session->salt));
+    return 1;
+  }
+
+  // the OAEP label is taken over by the EVP_PKEY_CTX
+  unsigned char *label = (unsigned char *) OPENSSL_strdup("SECRET");
+  size_t encSalt_size = sizeof(session->encryptedSalt.secret);
+  EVP_PKEY_CTX *pkey_ctx = EVP_PKEY_CTX_new(pkey, NULL);
+
+  if (label == NULL || pkey_ctx == NULL
+      || EVP_PKEY_encrypt_init(pkey_ctx) <= 0
+      || EVP_PKEY_CTX_set_rsa_padding(pkey_ctx, RSA_PKCS1_OAEP_PADDING) <= 0
+      || EVP_PKEY_CTX_set_rsa_oaep_md(pkey_ctx, KMYTH_OPENSSL_HASH) <= 0
+      || EVP_PKEY_CTX_set0_rsa_oaep_label(pkey_ctx, label,
+                                          (int) strlen("SECRET") + 1) <= 0)
+  {
+    kmyth_log(LOG_ERR, "error configuring salt encryption ... exiting");
+    OPENSSL_free(label);
+    EVP_PKEY_CTX_free(pkey_ctx);
+    EVP_PKEY_free(pkey);
+    kmyth_clear(&session->salt, sizeof(session->salt));
+    return 1;
+  }
+  label = NULL;
+
+  int ok = EVP_PKEY_encrypt(pkey_ctx, session->encryptedSalt.secret,
+                            &encSalt_size, session->salt.buffer,
+                            session->salt.size);
+
+  EVP_PKEY_CTX_free(pkey_ctx);
+  EVP_PKEY_free(pkey);
+  if (ok <= 0)
+  {
+    kmyth_log(LOG_ERR, "error encrypting session salt ... exiting");
+    kmyth_clear(&session->salt, sizeof(session->salt));
+    return 1;
+  }
+  session->encryptedSalt.size = (uint16_t) encSalt_size;
+
+  return 0;
+}
+
+//############################################################################
+// start_auth_session()
+//############################################################################
+static int start_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
+                              SESSION * session, TPM2_SE session_type,
+                              TPM2_HANDLE tpmKey)
 {
   // assign session "type" passed in - Kmyth sessions are either:
   //   - trial (used to compute policy digest value) - TPM2_SE_TRIAL
   //   - policy (used for actual policy authorization) - TPM2_SE_POLICY
-  if ((session_type != TPM2_SE_TRIAL) && (session_type != TPM2_SE_POLICY))
+  //   - HMAC (used for salted owner authorization) - TPM2_SE_HMAC
+  if ((session_type != TPM2_SE_TRIAL) && (session_type != TPM2_SE_POLICY)
+      && (session_type != TPM2_SE_HMAC))
   {
     kmyth_log(LOG_ERR, "invalid session type ... exiting");
     return 1;
@@ -1048,12 +2469,17 @@ int start_policy_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
   }
   session->sessionType = session_type;
 
-  // For Kmyth, the current implementation uses unbound and unsalted sessions.
-  // This results in a NULL sessionKey meaning that the HMAC key is simply the
-  // authVal for the entity being authorized.
+  // Kmyth sessions are unbound. An unsalted session has a NULL sessionKey,
+  // meaning that the HMAC key is simply the authVal for the entity being
+  // authorized. A salted session derives its sessionKey from the salt, and
+  // always uses AES CFB parameter encryption (which is what it is for).
 
   // configure algorithm parameters for session according to Kmyth defaults
   session->symmetric.algorithm = KMYTH_SYM_PARAM_ENC_ALG;
+  if (tpmKey != TPM2_RH_NULL)
+  {
+    session->symmetric.algorithm = TPM2_ALG_AES;
+  }
   if (session->symmetric.algorithm == TPM2_ALG_AES)
   {
     session->symmetric.keyBits.aes = KMYTH_SYM_PARAM_ENC_KEY_LEN;
@@ -1061,10 +2487,18 @@ int start_policy_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
   }
   session->authHash = KMYTH_HASH_ALG;
   session->bind = TPM2_RH_NULL; // unbound
-  session->tpmKey = TPM2_RH_NULL; // unsalted
+  session->tpmKey = tpmKey;
   session->encryptedSalt.size = 0;  // empty encrypted salt value
+  session->salt.size = 0;
   session->sessionKey.size = 0; // empty session key
 
+  if (tpmKey != TPM2_RH_NULL && encrypt_session_salt(sapi_ctx, tpmKey,
+                                                     session))
+  {
+    kmyth_log(LOG_ERR, "error creating session salt ... exiting");
+    return 1;
+  }
+
   // use API call to start session - command requires no authorization
   TSS2L_SYS_AUTH_COMMAND const *nullCmdAuths = NULL;
   TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL;
@@ -1083,12 +2517,14 @@ int start_policy_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
 
   if (rc != TPM2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "Tss2_Sys_StartAuthSession(): rc = 0x%08X, %s",
-              rc, getErrorString(rc));
+    kmyth_log_tpm_rc("Tss2_Sys_StartAuthSession", rc);
+    kmyth_clear(&session->salt, sizeof(session->salt));
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "started %s session (0x%08X)",
-            session->sessionType == TPM2_SE_TRIAL ? "trial" : "policy",
+  kmyth_log(LOG_DEBUG, "started %s%s session (0x%08X)",
+            tpmKey != TPM2_RH_NULL ? "salted " : "",
+            session->sessionType == TPM2_SE_TRIAL ? "trial" :
+            session->sessionType == TPM2_SE_HMAC ? "HMAC" : "policy",
             session->sessionHandle);
 
   // Roll nonces to add the nonce just returned from the TPM to the session
@@ -1096,6 +2532,7 @@ int start_policy_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
   if (rollNonces(session, session->nonceTPM))
   {
     kmyth_log(LOG_ERR, "error rolling session nonces ... exiting");
+    kmyth_clear(&session->salt, sizeof(session->salt));
     return 1;
   }
   kmyth_log(LOG_DEBUG,
@@ -1103,6 +2540,220 @@ int start_policy_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
             session->nonceTPM.buffer[0],
             session->nonceTPM.buffer[session->nonceTPM.size - 1]);
 
+  // sessionKey = KDFa(salt, "ATH", nonceTPM, nonceCaller) - the salt is not
+  // needed once the session key is derived
+  if (tpmKey != TPM2_RH_NULL)
+  {
+    int retval = compute_kdfa(session->salt.buffer, session->salt.size,
+                              "ATH", session->nonceNewer,
+                              session->nonceOlder, KMYTH_DIGEST_SIZE * 8,
+                              session->sessionKey.buffer);
+
+    kmyth_clear(&session->salt, sizeof(session->salt));
+    if (retval)
+    {
+      kmyth_log(LOG_ERR, "error deriving session key ... exiting");
+      return 1;
+    }
+    session->sessionKey.size = KMYTH_DIGEST_SIZE;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// start_policy_auth_session()
+//############################################################################
+int start_policy_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
+                              SESSION * session, TPM2_SE session_type)
+{
+  return start_auth_session(sapi_ctx, session, session_type, TPM2_RH_NULL);
+}
+
+//############################################################################
+// create_salted_auth_session()
+//############################################################################
+static int create_salted_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
+                                      TPM2_HANDLE tpmKey,
+                                      SESSION * session,
+                                      TPM2_SE session_type)
+{
+  // create initial callerNonce
+  TPM2B_NONCE initialNonce;
+
+  initialNonce.size = 0;        // start with empty nonce
+  if (create_caller_nonce(&initialNonce))
+  {
+    kmyth_log(LOG_ERR, "error generating initial nonce ... exiting");
+    return 1;
+  }
+
+  // initialize session state with "start-up" nonce values (as for an
+  // unsalted session - see create_policy_auth_session())
+  session->nonceNewer.size = KMYTH_DIGEST_SIZE;
+  memset(session->nonceNewer.buffer, 0, KMYTH_DIGEST_SIZE);
+  if (rollNonces(session, initialNonce))
+  {
+    kmyth_log(LOG_ERR, "error rolling session nonces ... exiting");
+    return 1;
+  }
+  session->nonceTPM.size = 0;
+
+  // initiate an unbound session, salted with a secret encrypted to tpmKey,
+  // with AES CFB parameter encryption
+  if (start_auth_session(sapi_ctx, session, session_type, tpmKey))
+  {
+    kmyth_log(LOG_ERR, "error starting salted session ... exiting");
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// create_salted_policy_auth_session()
+//############################################################################
+int create_salted_policy_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
+                                      TPM2_HANDLE tpmKey,
+                                      SESSION * policySession)
+{
+  return create_salted_auth_session(sapi_ctx, tpmKey, policySession,
+                                    TPM2_SE_POLICY);
+}
+
+//############################################################################
+// create_salted_hmac_auth_session()
+//############################################################################
+int create_salted_hmac_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
+                                    TPM2_HANDLE tpmKey, SESSION * hmacSession)
+{
+  return create_salted_auth_session(sapi_ctx, tpmKey, hmacSession,
+                                    TPM2_SE_HMAC);
+}
+
+//############################################################################
+// compute_kdfa()
+//############################################################################
+int compute_kdfa(const uint8_t * key, size_t key_size, const char *label,
+                 TPM2B_NONCE contextU, TPM2B_NONCE contextV,
+                 size_t bits, uint8_t * out)
+{
+  if ((key == NULL && key_size > 0) || label == NULL || out == NULL
+      || bits == 0)
+  {
+    kmyth_log(LOG_ERR, "invalid KDFa input ... exiting");
+    return 1;
+  }
+
+  // SP800-108 counter mode KDF with HMAC (TPM 2.0 Part 1, Section 11.4.10.2):
+  //   K(i) = HMAC(key, [i]32 || label || 0x00 || contextU || contextV ||
+  //               [bits]32)
+  size_t out_size = (bits + 7) / 8;
+  size_t done = 0;
+  uint32_t bits_be = htonl((uint32_t) bits);
+  for (uint32_t i = 1; done < out_size; i++)
+  {
+    uint32_t i_be = htonl(i);
+    uint8_t block[KMYTH_DIGEST_SIZE];
+    unsigned int block_size = sizeof(block);
+    HMAC_CTX *hmac_ctx = get_auth_hmac_ctx(key, key_size);
+
+    if (hmac_ctx == NULL
+        || !HMAC_Update(hmac_ctx, (uint8_t *) & i_be, sizeof(i_be))
+        || !HMAC_Update(hmac_ctx, (const uint8_t *) label, strlen(label) + 1)
+        || !HMAC_Update(hmac_ctx, contextU.buffer, contextU.size)
+        || !HMAC_Update(hmac_ctx, contextV.buffer, contextV.size)
+        || !HMAC_Update(hmac_ctx, (uint8_t *) & bits_be, sizeof(bits_be))
+        || !HMAC_Final(hmac_ctx, block, &block_size))
+    {
+      kmyth_log(LOG_ERR, "error computing KDFa ... exiting");
+      kmyth_clear(block, sizeof(block));
+      return 1;
+    }
+
+    size_t n = out_size - done < block_size ? out_size - done : block_size;
+
+    memcpy(out + done, block, n);
+    kmyth_clear(block, sizeof(block));
+    done += n;
+  }
+
+  // clear any bits beyond the requested number in the final byte
+  if (bits % 8)
+  {
+    out[0] &= (uint8_t) (0xFF >> (8 - bits % 8));
+  }
+
+  return 0;
+}
+
+//############################################################################
+// crypt_session_param()
+//############################################################################
+int crypt_session_param(SESSION * session, TPM2B_AUTH authValue,
+                        bool encrypt, uint8_t * data, size_t data_size)
+{
+  if (session == NULL || (data == NULL && data_size > 0))
+  {
+    kmyth_log(LOG_ERR, "NULL input ... exiting");
+    return 1;
+  }
+  if (session->symmetric.algorithm != TPM2_ALG_AES
+      || session->symmetric.mode.aes != TPM2_ALG_CFB
+      || session->symmetric.keyBits.aes != 256)
+  {
+    kmyth_log(LOG_ERR, "unsupported parameter encryption ... exiting");
+    return 1;
+  }
+  if (session->sessionKey.size > sizeof(session->sessionKey.buffer)
+      || authValue.size > sizeof(authValue.buffer))
+  {
+    kmyth_log(LOG_ERR, "invalid parameter encryption key size ... exiting");
+    return 1;
+  }
+
+  // key || iv = KDFa(sessionKey || authValue, "CFB", nonceNewer, nonceOlder)
+  // where nonceNewer is the nonce of the sender (TPM 2.0 Part 1, Section
+  // 21.3) - the SESSION nonces have been rolled for this command/response
+  uint8_t kdf_key[sizeof(session->sessionKey.buffer) +
+                  sizeof(authValue.buffer)];
+  size_t kdf_key_size = session->sessionKey.size;
+  uint8_t key_iv[256 / 8 + 16];
+
+  memcpy(kdf_key, session->sessionKey.buffer, session->sessionKey.size);
+  memcpy(kdf_key + kdf_key_size, authValue.buffer, authValue.size);
+  kdf_key_size += authValue.size;
+
+  int retval = compute_kdfa(kdf_key, kdf_key_size, "CFB",
+                            session->nonceNewer, session->nonceOlder,
+                            sizeof(key_iv) * 8, key_iv);
+
+  kmyth_clear(kdf_key, sizeof(kdf_key));
+  kmyth_clear(authValue.buffer, authValue.size);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error deriving parameter encryption key ... exiting");
+    return 1;
+  }
+
+  EVP_CIPHER_CTX *cipher_ctx = EVP_CIPHER_CTX_new();
+  int out_len = 0;
+  int ok = (cipher_ctx != NULL &&
+            EVP_CipherInit_ex(cipher_ctx, EVP_aes_256_cfb128(), NULL, key_iv,
+                              key_iv + 256 / 8, encrypt ? 1 : 0) &&
+            EVP_CipherUpdate(cipher_ctx, data, &out_len, data,
+                             (int) data_size) &&
+            (size_t) out_len == data_size);
+
+  EVP_CIPHER_CTX_free(cipher_ctx);
+  kmyth_clear(key_iv, sizeof(key_iv));
+  if (!ok)
+  {
+    kmyth_log(LOG_ERR, "error %s session parameter ... exiting",
+              encrypt ? "encrypting" : "decrypting");
+    return 1;
+  }
+
   return 0;
 }
 
@@ -1122,9 +2773,7 @@ int apply_policy(TSS2_SYS_CONTEXT * sapi_ctx,
 
   if (rc != TPM2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR,
-              "Tss2_Sys_PolicyAuthValue(): rc = 0x%08X, %s ... exiting", rc,
-              getErrorString(rc));
+    kmyth_log_tpm_rc("Tss2_Sys_PolicyAuthValue", rc);
     return 1;
   }
   kmyth_log(LOG_DEBUG, "applied AuthVal policy to session context");
@@ -1144,8 +2793,7 @@ int apply_policy(TSS2_SYS_CONTEXT * sapi_ctx,
                             &policySession_pcrList, nullRspAuths);
     if (rc != TPM2_RC_SUCCESS)
     {
-      kmyth_log(LOG_ERR, "Tss2_Sys_PolicyPCR(): rc = 0x%08X, %s", rc,
-                getErrorString(rc));
+      kmyth_log_tpm_rc("Tss2_Sys_PolicyPCR", rc);
       return 1;
     }
     kmyth_log(LOG_DEBUG, "applied PCR policy to session context");
@@ -1158,17 +2806,13 @@ int apply_policy(TSS2_SYS_CONTEXT * sapi_ctx,
 //############################################################################
 int create_caller_nonce(TPM2B_NONCE * nonceOut)
 {
-  // use OpenSSL RAND_bytes() to generate a "unique" nonce
-  unsigned char rand_bytes[KMYTH_DIGEST_SIZE];
-
-  if (!RAND_bytes(rand_bytes, KMYTH_DIGEST_SIZE))
+  // draw a "unique" nonce from this thread's random pool
+  if (random_pool_bytes(nonceOut->buffer, KMYTH_DIGEST_SIZE))
   {
     kmyth_log(LOG_ERR, "error generating random bytes ... exiting");
+    return 1;
   }
-
-  // Put random bytes result in the TPM2B_NONCE struct passed in
   nonceOut->size = KMYTH_DIGEST_SIZE;
-  memcpy(nonceOut->buffer, rand_bytes, KMYTH_DIGEST_SIZE);
 
   kmyth_log(LOG_DEBUG, "nonceCaller: 0x%02X..%02X",
             nonceOut->buffer[0], nonceOut->buffer[nonceOut->size - 1]);
@@ -0,0 +1,488 @@
+/**
+ * @file  tpm2_trace.c
+ *
+ * @brief Implements the TCTI wrapper observing the TPM 2.0 commands sent
+ *        over a connection.
+ */
+
+#include "tpm2_trace.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "defines.h"
+#include "kmyth_metrics.h"
+
+// TCTI magic ("KMTRACE:" in ASCII), distinguishing the wrapper from the
+// TCTI it wraps
+#define TCTI_TRACE_MAGIC 0x4B4D54524143453AULL
+
+// A command (response) starts with its tag, size, and command (response)
+// code - the code is big-endian, at this offset
+#define TPM2_HEADER_CODE_OFFSET 6
+#define TPM2_HEADER_SIZE 10
+
+// the handle area of a command follows its header, and its authorization
+// area (the sessions, preceded by their total size) follows the handles
+#define TPM2_HANDLE_SIZE 4
+
+// the trace file (Chrome trace-event format) shared by every connection
+static pthread_mutex_t trace_file_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *trace_file = NULL;
+static bool trace_file_empty = true;
+
+/**
+ * @brief The wrapping TCTI context. Its common part must come first, as
+ *        the TCTI macros (e.g., Tss2_Tcti_Transmit()) read it through a
+ *        pointer to the context.
+ */
+typedef struct tcti_trace_context
+{
+  TSS2_TCTI_CONTEXT_COMMON_V2 common;
+  TSS2_TCTI_CONTEXT *inner;
+
+  // the command in flight (a SAPI context has at most one at a time)
+  TPM2_CC command_code;
+  int sessions;
+  uint64_t begin;
+} tcti_trace_context;
+
+typedef struct tpm2_command
+{
+  TPM2_CC command_code;
+  const char *name;
+
+  // number of handles in the command's handle area (TPM 2.0 Part 3)
+  int handles;
+} tpm2_command;
+
+#define TPM2_COMMAND(name, handles) { TPM2_CC_##name, "TPM2_" #name, handles }
+
+static const tpm2_command tpm2_commands[] = {
+  TPM2_COMMAND(ContextLoad, 0),
+  TPM2_COMMAND(ContextSave, 1),
+  TPM2_COMMAND(Create, 1),
+  TPM2_COMMAND(CreatePrimary, 1),
+  TPM2_COMMAND(EvictControl, 2),
+  TPM2_COMMAND(FlushContext, 0),
+  TPM2_COMMAND(GetCapability, 0),
+  TPM2_COMMAND(GetRandom, 0),
+  TPM2_COMMAND(HierarchyChangeAuth, 1),
+  TPM2_COMMAND(Load, 1),
+  TPM2_COMMAND(NV_DefineSpace, 1),
+  TPM2_COMMAND(NV_Read, 2),
+  TPM2_COMMAND(NV_ReadPublic, 1),
+  TPM2_COMMAND(NV_UndefineSpace, 2),
+  TPM2_COMMAND(NV_Write, 2),
+  TPM2_COMMAND(ObjectChangeAuth, 2),
+  TPM2_COMMAND(PCR_Read, 0),
+  TPM2_COMMAND(PolicyAuthValue, 1),
+  TPM2_COMMAND(PolicyCommandCode, 1),
+  TPM2_COMMAND(PolicyGetDigest, 1),
+  TPM2_COMMAND(PolicyOR, 1),
+  TPM2_COMMAND(PolicyPCR, 1),
+  TPM2_COMMAND(PolicyRestart, 1),
+  TPM2_COMMAND(PolicySecret, 2),
+  TPM2_COMMAND(ReadPublic, 1),
+  TPM2_COMMAND(StartAuthSession, 2),
+  TPM2_COMMAND(Startup, 0),
+  TPM2_COMMAND(Unseal, 1),
+};
+
+//############################################################################
+// find_command()
+//############################################################################
+static const tpm2_command *find_command(TPM2_CC command_code)
+{
+  for (size_t i = 0; i < sizeof(tpm2_commands) / sizeof(tpm2_commands[0]);
+       i++)
+  {
+    if (tpm2_commands[i].command_code == command_code)
+    {
+      return &tpm2_commands[i];
+    }
+  }
+
+  return NULL;
+}
+
+//############################################################################
+// tpm2_command_name()
+//############################################################################
+const char *tpm2_command_name(TPM2_CC command_code)
+{
+  const tpm2_command *command = find_command(command_code);
+
+  return (command != NULL) ? command->name : NULL;
+}
+
+//############################################################################
+// read_be16()
+//############################################################################
+static uint16_t read_be16(uint8_t const *buffer)
+{
+  return (uint16_t) (((uint16_t) buffer[0] << 8) | (uint16_t) buffer[1]);
+}
+
+//############################################################################
+// read_be32()
+//############################################################################
+static uint32_t read_be32(uint8_t const *buffer)
+{
+  return ((uint32_t) buffer[0] << 24) | ((uint32_t) buffer[1] << 16)
+    | ((uint32_t) buffer[2] << 8) | (uint32_t) buffer[3];
+}
+
+//############################################################################
+// read_header_code()
+//############################################################################
+static uint32_t read_header_code(uint8_t const *buffer, size_t size)
+{
+  if (buffer == NULL || size < TPM2_HEADER_SIZE)
+  {
+    return 0;
+  }
+
+  return read_be32(buffer + TPM2_HEADER_CODE_OFFSET);
+}
+
+//############################################################################
+// count_sessions()
+//############################################################################
+static int count_sessions(uint8_t const *command, size_t size)
+{
+  if (command == NULL || size < TPM2_HEADER_SIZE
+      || read_be16(command) != TPM2_ST_SESSIONS)
+  {
+    return 0;
+  }
+
+  // the authorization area can only be found past a known handle count
+  const tpm2_command *known = find_command(read_header_code(command, size));
+
+  if (known == NULL)
+  {
+    return -1;
+  }
+
+  size_t offset = TPM2_HEADER_SIZE + known->handles * TPM2_HANDLE_SIZE;
+
+  if (size < offset + sizeof(uint32_t))
+  {
+    return -1;
+  }
+
+  size_t end = offset + sizeof(uint32_t) + read_be32(command + offset);
+
+  if (end > size)
+  {
+    return -1;
+  }
+  offset += sizeof(uint32_t);
+
+  // each session is: handle || nonce (TPM2B) || attributes || hmac (TPM2B)
+  int sessions = 0;
+
+  while (offset < end)
+  {
+    offset += TPM2_HANDLE_SIZE;
+    if (offset + sizeof(uint16_t) > end)
+    {
+      return -1;
+    }
+    offset += sizeof(uint16_t) + read_be16(command + offset) + 1;
+    if (offset + sizeof(uint16_t) > end)
+    {
+      return -1;
+    }
+    offset += sizeof(uint16_t) + read_be16(command + offset);
+    if (offset > end)
+    {
+      return -1;
+    }
+    sessions++;
+  }
+
+  return sessions;
+}
+
+//############################################################################
+// trace_clock()
+//############################################################################
+static uint64_t trace_clock(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+//############################################################################
+// tracing_enabled()
+//############################################################################
+static bool tracing_enabled(void)
+{
+  return kmyth_metrics_enabled() || kmyth_log_enabled(LOG_DEBUG)
+    || __atomic_load_n(&trace_file, __ATOMIC_RELAXED) != NULL;
+}
+
+//############################################################################
+// write_trace_event()
+//############################################################################
+static void write_trace_event(const char *name, uint64_t begin,
+                              uint64_t duration_ns, uint32_t response_code,
+                              int sessions)
+{
+  pthread_mutex_lock(&trace_file_lock);
+  if (trace_file != NULL)
+  {
+    // a complete ("X") event, with its start and duration in microseconds
+    fprintf(trace_file,
+            "%s{\"name\":\"%s\",\"cat\":\"tpm\",\"ph\":\"X\","
+            "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%ld,\"tid\":%ld,"
+            "\"args\":{\"rc\":\"0x%08X\",\"sessions\":%d}}",
+            (trace_file_empty) ? "\n" : ",\n", name, begin / 1000.0,
+            duration_ns / 1000.0, (long) getpid(), (long) syscall(SYS_gettid),
+            response_code, sessions);
+    trace_file_empty = false;
+  }
+  pthread_mutex_unlock(&trace_file_lock);
+}
+
+//############################################################################
+// record_command()
+//############################################################################
+static void record_command(tcti_trace_context * trace, uint32_t response_code)
+{
+  uint64_t duration_ns = trace_clock() - trace->begin;
+  const char *name = tpm2_command_name(trace->command_code);
+  char unknown[sizeof("0x00000000")];
+
+  if (name == NULL)
+  {
+    snprintf(unknown, sizeof(unknown), "0x%08X", trace->command_code);
+    name = unknown;
+  }
+
+  if (kmyth_metrics_enabled())
+  {
+    char labels[KMYTH_METRICS_MAX_LABELS_LEN + 1];
+
+    snprintf(labels, sizeof(labels), "command=\"%s\"", name);
+    kmyth_metrics_observe_latency("kmyth_tpm_command_duration_seconds",
+                                  labels,
+                                  "Time from sending a TPM command to "
+                                  "receiving its response.", trace->begin);
+  }
+
+  kmyth_log_field fields[] = {
+    KMYTH_LOG_STR("command", name),
+    KMYTH_LOG_UINT("duration_us", duration_ns / 1000),
+    KMYTH_LOG_HEX("rc", response_code),
+    KMYTH_LOG_INT("sessions", trace->sessions)
+  };
+
+  kmyth_log_fields(LOG_DEBUG, fields, 4,
+                   "%s took %.3f ms (rc 0x%08X, %d session(s))", name,
+                   duration_ns / 1000000.0, response_code, trace->sessions);
+
+  write_trace_event(name, trace->begin, duration_ns, response_code,
+                    trace->sessions);
+}
+
+//############################################################################
+// tcti_trace_transmit()
+//############################################################################
+static TSS2_RC tcti_trace_transmit(TSS2_TCTI_CONTEXT * tcti_ctx,
+                                   size_t size, uint8_t const *command)
+{
+  tcti_trace_context *trace = (tcti_trace_context *) tcti_ctx;
+
+  trace->begin = 0;
+  if (tracing_enabled())
+  {
+    trace->command_code = read_header_code(command, size);
+    trace->sessions = count_sessions(command, size);
+    trace->begin = trace_clock();
+  }
+
+  return Tss2_Tcti_Transmit(trace->inner, size, command);
+}
+
+//############################################################################
+// tcti_trace_receive()
+//############################################################################
+static TSS2_RC tcti_trace_receive(TSS2_TCTI_CONTEXT * tcti_ctx,
+                                  size_t *size, uint8_t * response,
+                                  int32_t timeout)
+{
+  tcti_trace_context *trace = (tcti_trace_context *) tcti_ctx;
+  TSS2_RC rc = Tss2_Tcti_Receive(trace->inner, size, response, timeout);
+
+  // a query for the response size, or a poll that timed out, leaves the
+  // command in flight
+  if (response == NULL || rc == TSS2_TCTI_RC_TRY_AGAIN)
+  {
+    return rc;
+  }
+
+  if (trace->begin != 0)
+  {
+    // a failure to receive the response is reported in place of its code
+    record_command(trace, (rc == TSS2_RC_SUCCESS) ?
+                   read_header_code(response, *size) : rc);
+    trace->begin = 0;
+  }
+
+  return rc;
+}
+
+//############################################################################
+// tcti_trace_finalize()
+//############################################################################
+static void tcti_trace_finalize(TSS2_TCTI_CONTEXT * tcti_ctx)
+{
+  tcti_trace_context *trace = (tcti_trace_context *) tcti_ctx;
+
+  if (trace->inner != NULL)
+  {
+    Tss2_Tcti_Finalize(trace->inner);
+    free(trace->inner);
+    trace->inner = NULL;
+  }
+}
+
+//############################################################################
+// tcti_trace_cancel()
+//############################################################################
+static TSS2_RC tcti_trace_cancel(TSS2_TCTI_CONTEXT * tcti_ctx)
+{
+  tcti_trace_context *trace = (tcti_trace_context *) tcti_ctx;
+
+  trace->begin = 0;
+  return Tss2_Tcti_Cancel(trace->inner);
+}
+
+//############################################################################
+// tcti_trace_get_poll_handles()
+//############################################################################
+static TSS2_RC tcti_trace_get_poll_handles(TSS2_TCTI_CONTEXT * tcti_ctx,
+                                           TSS2_TCTI_POLL_HANDLE * handles,
+                                           size_t *num_handles)
+{
+  tcti_trace_context *trace = (tcti_trace_context *) tcti_ctx;
+
+  return Tss2_Tcti_GetPollHandles(trace->inner, handles, num_handles);
+}
+
+//############################################################################
+// tcti_trace_set_locality()
+//############################################################################
+static TSS2_RC tcti_trace_set_locality(TSS2_TCTI_CONTEXT * tcti_ctx,
+                                       uint8_t locality)
+{
+  tcti_trace_context *trace = (tcti_trace_context *) tcti_ctx;
+
+  return Tss2_Tcti_SetLocality(trace->inner, locality);
+}
+
+//############################################################################
+// tcti_trace_make_sticky()
+//############################################################################
+static TSS2_RC tcti_trace_make_sticky(TSS2_TCTI_CONTEXT * tcti_ctx,
+                                      TPM2_HANDLE * handle, uint8_t sticky)
+{
+  tcti_trace_context *trace = (tcti_trace_context *) tcti_ctx;
+
+  return Tss2_Tcti_MakeSticky(trace->inner, handle, sticky);
+}
+
+//############################################################################
+// init_tcti_trace()
+//############################################################################
+int init_tcti_trace(TSS2_TCTI_CONTEXT * inner, TSS2_TCTI_CONTEXT ** tcti_ctx)
+{
+  if (inner == NULL || *tcti_ctx != NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid TCTI context ... exiting");
+    return 1;
+  }
+
+  tcti_trace_context *trace = calloc(1, sizeof(tcti_trace_context));
+
+  if (trace == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate TCTI wrapper ... exiting");
+    return 1;
+  }
+
+  trace->common.v1.magic = TCTI_TRACE_MAGIC;
+  trace->common.v1.version = 2;
+  trace->common.v1.transmit = tcti_trace_transmit;
+  trace->common.v1.receive = tcti_trace_receive;
+  trace->common.v1.finalize = tcti_trace_finalize;
+  trace->common.v1.cancel = tcti_trace_cancel;
+  trace->common.v1.getPollHandles = tcti_trace_get_poll_handles;
+  trace->common.v1.setLocality = tcti_trace_set_locality;
+  trace->common.makeSticky = tcti_trace_make_sticky;
+  trace->inner = inner;
+
+  *tcti_ctx = (TSS2_TCTI_CONTEXT *) trace;
+
+  return 0;
+}
+
+//############################################################################
+// tpm2_trace_open()
+//############################################################################
+int tpm2_trace_open(const char *path)
+{
+  FILE *file = fopen(path, "w");
+
+  if (file == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to open TPM trace file %s ... exiting", path);
+    return 1;
+  }
+
+  // the JSON array format, which is closed by tpm2_trace_close()
+  fputc('[', file);
+
+  pthread_mutex_lock(&trace_file_lock);
+  FILE *previous = trace_file;
+
+  trace_file_empty = true;
+  __atomic_store_n(&trace_file, file, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&trace_file_lock);
+
+  if (previous != NULL)
+  {
+    fputs("\n]\n", previous);
+    fclose(previous);
+  }
+
+  return 0;
+}
+
+//############################################################################
+// tpm2_trace_close()
+//############################################################################
+void tpm2_trace_close(void)
+{
+  pthread_mutex_lock(&trace_file_lock);
+  FILE *file = trace_file;
+
+  __atomic_store_n(&trace_file, NULL, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&trace_file_lock);
+
+  if (file != NULL)
+  {
+    fputs("\n]\n", file);
+    fclose(file);
+  }
+}
@@ -0,0 +1,491 @@
+/**
+ * @file  tpm_queue.c
+ *
+ * @brief Implements the asynchronous TPM job queue declared in kmyth.h:
+ *        seal and unseal jobs run by worker threads on a shared Kmyth TPM
+ *        context, with completions reported through a callback or an
+ *        eventfd.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "kmyth.h"
+#include "defines.h"
+#include "memory_util.h"
+
+/**
+ * @brief A seal or unseal job, from submission until its completion has
+ *        been handed over
+ */
+typedef struct tpm_queue_job
+{
+  bool unseal;
+
+  // job input (the data itself remains owned by the caller)
+  uint8_t *input;
+  size_t input_len;
+  uint8_t *auth_bytes;
+  size_t auth_bytes_len;
+  int *pcrs;
+  size_t pcrs_len;
+  char *cipher_string;
+
+  kmyth_tpm_job_done done;
+  void *arg;
+
+  // job result
+  int result;
+  uint8_t *output;
+  size_t output_len;
+
+  struct tpm_queue_job *next;
+} tpm_queue_job;
+
+struct kmyth_tpm_queue
+{
+  kmyth_tpm_context *ctx;
+
+  pthread_t *workers;
+  size_t worker_count;
+
+  // jobs waiting for a worker, and finished jobs (without a callback)
+  // waiting to be reaped, both oldest first
+  tpm_queue_job *pending;
+  tpm_queue_job *pending_tail;
+  tpm_queue_job *completed;
+  tpm_queue_job *completed_tail;
+
+  // counts the completed jobs (a semaphore eventfd)
+  int event_fd;
+
+  bool closing;
+  pthread_mutex_t lock;
+  pthread_cond_t job_cond;
+};
+
+//############################################################################
+// free_tpm_job()
+//############################################################################
+static void free_tpm_job(tpm_queue_job * job)
+{
+  kmyth_clear_and_free(job->auth_bytes, job->auth_bytes_len);
+  free(job->pcrs);
+  free(job->cipher_string);
+  free(job);
+}
+
+//############################################################################
+// run_tpm_job()
+//############################################################################
+static void run_tpm_job(kmyth_tpm_context * ctx, tpm_queue_job * job)
+{
+  if (job->unseal)
+  {
+    job->result = kmyth_tpm_context_unseal(ctx, job->input, job->input_len,
+                                           &job->output, &job->output_len,
+                                           job->auth_bytes,
+                                           job->auth_bytes_len);
+  }
+  else
+  {
+    job->result = kmyth_tpm_context_seal(ctx, job->input, job->input_len,
+                                         &job->output, &job->output_len,
+                                         job->auth_bytes,
+                                         job->auth_bytes_len, job->pcrs,
+                                         job->pcrs_len, job->cipher_string);
+  }
+  if (job->result)
+  {
+    job->output = NULL;
+    job->output_len = 0;
+  }
+}
+
+//############################################################################
+// tpm_queue_worker()
+//############################################################################
+static void *tpm_queue_worker(void *arg)
+{
+  kmyth_tpm_queue *queue = (kmyth_tpm_queue *) arg;
+
+  pthread_mutex_lock(&queue->lock);
+  while (true)
+  {
+    while (queue->pending == NULL && !queue->closing)
+    {
+      pthread_cond_wait(&queue->job_cond, &queue->lock);
+    }
+
+    // a closing queue has already failed the jobs no worker had started
+    tpm_queue_job *job = queue->pending;
+
+    if (job == NULL)
+    {
+      break;
+    }
+    queue->pending = job->next;
+    if (queue->pending == NULL)
+    {
+      queue->pending_tail = NULL;
+    }
+    job->next = NULL;
+    pthread_mutex_unlock(&queue->lock);
+
+    // the context serializes the TPM commands of concurrent jobs, so
+    // other workers encrypt or decrypt while this one waits on the TPM
+    run_tpm_job(queue->ctx, job);
+
+    if (job->done != NULL)
+    {
+      job->done(job->arg, job->result, job->output, job->output_len);
+      free_tpm_job(job);
+      pthread_mutex_lock(&queue->lock);
+      continue;
+    }
+
+    // the eventfd is written under the lock, so that its count always
+    // matches the length of the completed list
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->completed_tail == NULL)
+    {
+      queue->completed = job;
+    }
+    else
+    {
+      queue->completed_tail->next = job;
+    }
+    queue->completed_tail = job;
+    if (write(queue->event_fd, &one, sizeof(one)) != sizeof(one))
+    {
+      kmyth_log(LOG_WARNING, "unable to signal TPM job completion");
+    }
+  }
+  pthread_mutex_unlock(&queue->lock);
+
+  return NULL;
+}
+
+//############################################################################
+// kmyth_tpm_queue_open()
+//############################################################################
+int kmyth_tpm_queue_open(kmyth_tpm_context * ctx, size_t worker_count,
+                         kmyth_tpm_queue ** queue)
+{
+  if (queue == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL queue pointer ... exiting");
+    return 1;
+  }
+  *queue = NULL;
+
+  if (ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "TPM context not open ... exiting");
+    return 1;
+  }
+  if (worker_count == 0)
+  {
+    worker_count = KMYTH_TPM_QUEUE_WORKERS;
+  }
+  if (worker_count > KMYTH_TPM_QUEUE_MAX_WORKERS)
+  {
+    kmyth_log(LOG_ERR, "invalid TPM queue worker count (%zu) ... exiting",
+              worker_count);
+    return 1;
+  }
+
+  kmyth_tpm_queue *new_queue = calloc(1, sizeof(kmyth_tpm_queue));
+
+  if (new_queue == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate TPM queue ... exiting");
+    return 1;
+  }
+  new_queue->ctx = ctx;
+  pthread_mutex_init(&new_queue->lock, NULL);
+  pthread_cond_init(&new_queue->job_cond, NULL);
+
+  new_queue->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
+  new_queue->workers = calloc(worker_count, sizeof(pthread_t));
+  if (new_queue->event_fd < 0 || new_queue->workers == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to set up TPM queue ... exiting");
+    kmyth_tpm_queue_close(&new_queue);
+    return 1;
+  }
+
+  while (new_queue->worker_count < worker_count
+         && pthread_create(&new_queue->workers[new_queue->worker_count],
+                           NULL, tpm_queue_worker, new_queue) == 0)
+  {
+    new_queue->worker_count++;
+  }
+  if (new_queue->worker_count == 0)
+  {
+    kmyth_log(LOG_ERR, "unable to start TPM queue workers ... exiting");
+    kmyth_tpm_queue_close(&new_queue);
+    return 1;
+  }
+  if (new_queue->worker_count < worker_count)
+  {
+    kmyth_log(LOG_WARNING, "started only %zu of %zu TPM queue workers",
+              new_queue->worker_count, worker_count);
+  }
+
+  *queue = new_queue;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_tpm_queue_close()
+//############################################################################
+void kmyth_tpm_queue_close(kmyth_tpm_queue ** queue)
+{
+  if (queue == NULL || *queue == NULL)
+  {
+    return;
+  }
+
+  kmyth_tpm_queue *old_queue = *queue;
+
+  // refuse further jobs, take the ones no worker has started, and let the
+  // workers finish the jobs they are running, then exit
+  pthread_mutex_lock(&old_queue->lock);
+  old_queue->closing = true;
+
+  tpm_queue_job *unstarted = old_queue->pending;
+
+  old_queue->pending = NULL;
+  old_queue->pending_tail = NULL;
+  pthread_cond_broadcast(&old_queue->job_cond);
+  pthread_mutex_unlock(&old_queue->lock);
+
+  // the jobs that never ran fail (a job without a callback has no one left
+  // to reap its completion, so it is just released)
+  while (unstarted != NULL)
+  {
+    tpm_queue_job *job = unstarted;
+
+    unstarted = job->next;
+    if (job->done != NULL)
+    {
+      job->done(job->arg, 1, NULL, 0);
+    }
+    free_tpm_job(job);
+  }
+
+  for (size_t i = 0; i < old_queue->worker_count; i++)
+  {
+    pthread_join(old_queue->workers[i], NULL);
+  }
+
+  // release the completions that were never reaped (unsealed data among
+  // them is cleared)
+  while (old_queue->completed != NULL)
+  {
+    tpm_queue_job *job = old_queue->completed;
+
+    old_queue->completed = job->next;
+    kmyth_clear_and_free(job->output, job->output_len);
+    free_tpm_job(job);
+  }
+
+  if (old_queue->event_fd >= 0)
+  {
+    close(old_queue->event_fd);
+  }
+  free(old_queue->workers);
+  pthread_cond_destroy(&old_queue->job_cond);
+  pthread_mutex_destroy(&old_queue->lock);
+  free(old_queue);
+
+  *queue = NULL;
+}
+
+//############################################################################
+// submit_tpm_job()
+//############################################################################
+static int submit_tpm_job(kmyth_tpm_queue * queue, bool unseal,
+                          uint8_t * input, size_t input_len,
+                          uint8_t * auth_bytes, size_t auth_bytes_len,
+                          int *pcrs, size_t pcrs_len, char *cipher_string,
+                          kmyth_tpm_job_done done, void *arg)
+{
+  if (queue == NULL)
+  {
+    kmyth_log(LOG_ERR, "no TPM queue ... exiting");
+    return 1;
+  }
+  if (input == NULL || input_len == 0)
+  {
+    kmyth_log(LOG_ERR, "no input data ... exiting");
+    return 1;
+  }
+  if ((auth_bytes == NULL && auth_bytes_len > 0)
+      || (pcrs == NULL && pcrs_len > 0))
+  {
+    kmyth_log(LOG_ERR, "invalid job parameters ... exiting");
+    return 1;
+  }
+
+  tpm_queue_job *job = calloc(1, sizeof(tpm_queue_job));
+
+  if (job == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate TPM job ... exiting");
+    return 1;
+  }
+  job->unseal = unseal;
+  job->input = input;
+  job->input_len = input_len;
+  job->done = done;
+  job->arg = arg;
+
+  // the small parameters are copied, so the caller may clear or reuse them
+  // as soon as the job is submitted
+  if (auth_bytes_len > 0)
+  {
+    job->auth_bytes = malloc(auth_bytes_len);
+    if (job->auth_bytes != NULL)
+    {
+      memcpy(job->auth_bytes, auth_bytes, auth_bytes_len);
+      job->auth_bytes_len = auth_bytes_len;
+    }
+  }
+  if (pcrs_len > 0)
+  {
+    job->pcrs = calloc(pcrs_len, sizeof(int));
+    if (job->pcrs != NULL)
+    {
+      memcpy(job->pcrs, pcrs, pcrs_len * sizeof(int));
+      job->pcrs_len = pcrs_len;
+    }
+  }
+  if (cipher_string != NULL)
+  {
+    job->cipher_string = strdup(cipher_string);
+  }
+  if (job->auth_bytes_len != auth_bytes_len || job->pcrs_len != pcrs_len
+      || (cipher_string != NULL && job->cipher_string == NULL))
+  {
+    kmyth_log(LOG_ERR, "unable to allocate TPM job ... exiting");
+    free_tpm_job(job);
+    return 1;
+  }
+
+  pthread_mutex_lock(&queue->lock);
+  if (queue->closing)
+  {
+    pthread_mutex_unlock(&queue->lock);
+    kmyth_log(LOG_ERR, "TPM queue is closing ... exiting");
+    free_tpm_job(job);
+    return 1;
+  }
+  if (queue->pending_tail == NULL)
+  {
+    queue->pending = job;
+  }
+  else
+  {
+    queue->pending_tail->next = job;
+  }
+  queue->pending_tail = job;
+  pthread_cond_signal(&queue->job_cond);
+  pthread_mutex_unlock(&queue->lock);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_tpm_queue_seal()
+//############################################################################
+int kmyth_tpm_queue_seal(kmyth_tpm_queue * queue,
+                         uint8_t * input, size_t input_len,
+                         uint8_t * auth_bytes, size_t auth_bytes_len,
+                         int *pcrs, size_t pcrs_len, char *cipher_string,
+                         kmyth_tpm_job_done done, void *arg)
+{
+  return submit_tpm_job(queue, false, input, input_len, auth_bytes,
+                        auth_bytes_len, pcrs, pcrs_len, cipher_string,
+                        done, arg);
+}
+
+//############################################################################
+// kmyth_tpm_queue_unseal()
+//############################################################################
+int kmyth_tpm_queue_unseal(kmyth_tpm_queue * queue,
+                           uint8_t * input, size_t input_len,
+                           uint8_t * auth_bytes, size_t auth_bytes_len,
+                           kmyth_tpm_job_done done, void *arg)
+{
+  return submit_tpm_job(queue, true, input, input_len, auth_bytes,
+                        auth_bytes_len, NULL, 0, NULL, done, arg);
+}
+
+//############################################################################
+// kmyth_tpm_queue_fd()
+//############################################################################
+int kmyth_tpm_queue_fd(const kmyth_tpm_queue * queue)
+{
+  if (queue == NULL)
+  {
+    return -1;
+  }
+  return queue->event_fd;
+}
+
+//############################################################################
+// kmyth_tpm_queue_reap()
+//############################################################################
+int kmyth_tpm_queue_reap(kmyth_tpm_queue * queue, void **arg, int *result,
+                         uint8_t ** output, size_t *output_len)
+{
+  if (queue == NULL || arg == NULL || result == NULL || output == NULL
+      || output_len == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid TPM queue reap parameters ... exiting");
+    return 1;
+  }
+
+  uint64_t count = 0;
+
+  pthread_mutex_lock(&queue->lock);
+
+  tpm_queue_job *job = queue->completed;
+
+  if (job != NULL)
+  {
+    queue->completed = job->next;
+    if (queue->completed == NULL)
+    {
+      queue->completed_tail = NULL;
+    }
+    if (read(queue->event_fd, &count, sizeof(count)) != sizeof(count))
+    {
+      kmyth_log(LOG_WARNING, "unable to consume TPM job completion");
+    }
+  }
+  pthread_mutex_unlock(&queue->lock);
+
+  if (job == NULL)
+  {
+    return 1;
+  }
+
+  *arg = job->arg;
+  *result = job->result;
+  *output = job->output;
+  *output_len = job->output_len;
+  free_tpm_job(job);
+
+  return 0;
+}
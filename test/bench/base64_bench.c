@@ -0,0 +1,209 @@
+/**
+ * @file  base64_bench.c
+ *
+ * Microbenchmark comparing the kmyth base64 codec implementations (see
+ * utils/src/base64_codec.c) against the OpenSSL base64 BIO filter chain
+ * previously used by encodeBase64Data() and decodeBase64Data().
+ *
+ * Usage: kmyth-bench-base64 [size in MiB (default 64)] [iterations (default 5)]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <openssl/bio.h>
+#include <openssl/buffer.h>
+#include <openssl/evp.h>
+
+#include "base64_codec.h"
+
+//############################################################################
+// now_seconds()
+//############################################################################
+static double now_seconds(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+//############################################################################
+// bio_encode()
+//
+// Reference encoder: the OpenSSL BIO chain used before the kmyth codec
+//############################################################################
+static size_t bio_encode(uint8_t * in, size_t in_len, uint8_t * out)
+{
+  BIO *bio64 = BIO_new(BIO_f_base64());
+  BIO *bio_mem = BIO_new(BIO_s_mem());
+  BUF_MEM *bioptr = NULL;
+  size_t out_len = 0;
+
+  if (bio64 == NULL || bio_mem == NULL)
+  {
+    BIO_free(bio64);
+    BIO_free(bio_mem);
+    return 0;
+  }
+  bio64 = BIO_push(bio64, bio_mem);
+  if (BIO_write(bio64, in, (int) in_len) == (int) in_len
+      && BIO_flush(bio64) == 1)
+  {
+    BIO_get_mem_ptr(bio64, &bioptr);
+    if (bioptr != NULL)
+    {
+      memcpy(out, bioptr->data, bioptr->length);
+      out_len = bioptr->length;
+    }
+  }
+  BIO_free_all(bio64);
+  return out_len;
+}
+
+//############################################################################
+// bio_decode()
+//
+// Reference decoder: the OpenSSL BIO chain used before the kmyth codec
+//############################################################################
+static size_t bio_decode(uint8_t * in, size_t in_len, uint8_t * out)
+{
+  BIO *bio64 = BIO_new(BIO_f_base64());
+  BIO *bio_mem = BIO_new_mem_buf(in, (int) in_len);
+  int bytes_read = 0;
+
+  if (bio64 == NULL || bio_mem == NULL)
+  {
+    BIO_free(bio64);
+    BIO_free(bio_mem);
+    return 0;
+  }
+  bio64 = BIO_push(bio64, bio_mem);
+  bytes_read = BIO_read(bio64, out, (int) in_len);
+  BIO_free_all(bio64);
+  return (bytes_read < 0) ? 0 : (size_t) bytes_read;
+}
+
+//############################################################################
+// report()
+//############################################################################
+static void report(const char *name, const char *op, size_t raw_len,
+                   double seconds, int iterations)
+{
+  double mb = (double) raw_len * iterations / (1024.0 * 1024.0);
+
+  printf("%-8s %-7s %10.1f MiB/s\n", name, op, mb / seconds);
+}
+
+//############################################################################
+// main()
+//############################################################################
+int main(int argc, char **argv)
+{
+  size_t raw_len = 64;
+  int iterations = 5;
+
+  if (argc > 1)
+  {
+    raw_len = strtoul(argv[1], NULL, 10);
+  }
+  if (argc > 2)
+  {
+    iterations = atoi(argv[2]);
+  }
+  if (raw_len == 0 || raw_len > 1024 || iterations <= 0)
+  {
+    fprintf(stderr, "usage: %s [size in MiB (1-1024)] [iterations]\n",
+            argv[0]);
+    return 1;
+  }
+  raw_len *= 1024 * 1024;
+
+  size_t enc_cap = base64_encoded_size(raw_len);
+  uint8_t *raw = malloc(raw_len);
+  uint8_t *enc = malloc(enc_cap);
+  uint8_t *dec = malloc(enc_cap + 4);
+
+  if (raw == NULL || enc == NULL || dec == NULL)
+  {
+    fprintf(stderr, "malloc error\n");
+    free(raw);
+    free(enc);
+    free(dec);
+    return 1;
+  }
+  for (size_t i = 0; i < raw_len; i++)
+  {
+    raw[i] = (uint8_t) (i * 2654435761u >> 13);
+  }
+
+  printf("base64 throughput, %zu MiB input, %d iterations\n",
+         raw_len / (1024 * 1024), iterations);
+
+  // OpenSSL BIO chain reference
+  size_t enc_len = 0;
+  size_t dec_len = 0;
+  double start = now_seconds();
+
+  for (int i = 0; i < iterations; i++)
+  {
+    enc_len = bio_encode(raw, raw_len, enc);
+  }
+  report("bio", "encode", raw_len, now_seconds() - start, iterations);
+
+  start = now_seconds();
+  for (int i = 0; i < iterations; i++)
+  {
+    dec_len = bio_decode(enc, enc_len, dec);
+  }
+  report("bio", "decode", raw_len, now_seconds() - start, iterations);
+  if (dec_len != raw_len || memcmp(dec, raw, raw_len) != 0)
+  {
+    fprintf(stderr, "bio round trip mismatch\n");
+  }
+
+  // kmyth codec implementations supported by this build and CPU
+  base64_codec_t codecs[] = {
+    BASE64_CODEC_SCALAR, BASE64_CODEC_AVX2, BASE64_CODEC_NEON
+  };
+  int result = 0;
+
+  for (size_t c = 0; c < sizeof(codecs) / sizeof(codecs[0]); c++)
+  {
+    if (base64_set_codec(codecs[c]))
+    {
+      continue;
+    }
+
+    start = now_seconds();
+    for (int i = 0; i < iterations; i++)
+    {
+      enc_len = base64_encode(raw, raw_len, enc);
+    }
+    report(base64_codec_name(), "encode", raw_len, now_seconds() - start,
+           iterations);
+
+    start = now_seconds();
+    for (int i = 0; i < iterations; i++)
+    {
+      if (base64_decode(enc, enc_len, dec, &dec_len))
+      {
+        dec_len = 0;
+      }
+    }
+    report(base64_codec_name(), "decode", raw_len, now_seconds() - start,
+           iterations);
+    if (dec_len != raw_len || memcmp(dec, raw, raw_len) != 0)
+    {
+      fprintf(stderr, "%s round trip mismatch\n", base64_codec_name());
+      result = 1;
+    }
+  }
+
+  free(raw);
+  free(enc);
+  free(dec);
+  return result;
+}
@@ -0,0 +1,637 @@
+/**
+ * @file  bench_history.c
+ *
+ * Benchmark history (see bench_history.h): records the results of a
+ * benchmark run as a line of JSON, and compares them against a baseline
+ * run read back from a history file.
+ *
+ * This file is also built as C++ (with the SGX benchmark), so allocations
+ * are cast.
+ */
+
+#include "bench_history.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define HISTORY_FIELD_LEN 128
+
+typedef struct bench_history_entry
+{
+  char *name;
+  double *samples;
+  size_t count;
+} bench_history_entry;
+
+struct bench_history
+{
+  char suite[HISTORY_FIELD_LEN];
+  char date[HISTORY_FIELD_LEN];
+  char revision[HISTORY_FIELD_LEN];
+  char cpu_model[HISTORY_FIELD_LEN];
+  char tpm[HISTORY_FIELD_LEN];
+  bench_history_entry *entries;
+  size_t count;
+};
+
+//############################################################################
+// history_free()
+//############################################################################
+static void history_free(bench_history * history)
+{
+  if (history == NULL)
+  {
+    return;
+  }
+  for (size_t i = 0; i < history->count; i++)
+  {
+    free(history->entries[i].name);
+    free(history->entries[i].samples);
+  }
+  free(history->entries);
+  free(history);
+}
+
+//############################################################################
+// history_copy_field()
+//
+// Copies a value into a fixed-size field, dropping the characters that
+// would need escaping in JSON (the fields are read back without unescaping)
+//############################################################################
+static void history_copy_field(char *field, const char *value, size_t len)
+{
+  size_t j = 0;
+
+  for (size_t i = 0; i < len && value[i] != '\0'
+       && j < HISTORY_FIELD_LEN - 1; i++)
+  {
+    unsigned char c = (unsigned char) value[i];
+
+    field[j++] = (c < 0x20 || c == '"' || c == '\\') ? '_' : (char) c;
+  }
+  field[j] = '\0';
+}
+
+//############################################################################
+// history_revision()
+//############################################################################
+static void history_revision(char *revision)
+{
+  const char *env = getenv(BENCH_HISTORY_REVISION_ENV);
+
+  if (env != NULL && *env != '\0')
+  {
+    history_copy_field(revision, env, strlen(env));
+    return;
+  }
+
+  char line[HISTORY_FIELD_LEN] = "";
+  FILE *git = popen("git describe --always --dirty 2>/dev/null", "r");
+
+  if (git != NULL)
+  {
+    if (fgets(line, sizeof(line), git) == NULL)
+    {
+      line[0] = '\0';
+    }
+    if (pclose(git) != 0)
+    {
+      line[0] = '\0';
+    }
+  }
+  line[strcspn(line, "\n")] = '\0';
+
+  history_copy_field(revision, (line[0] == '\0') ? "unknown" : line,
+                     HISTORY_FIELD_LEN);
+}
+
+//############################################################################
+// history_cpu_model()
+//############################################################################
+static void history_cpu_model(char *cpu_model)
+{
+  FILE *cpuinfo = fopen("/proc/cpuinfo", "r");
+  char line[256];
+
+  history_copy_field(cpu_model, "unknown", HISTORY_FIELD_LEN);
+  if (cpuinfo == NULL)
+  {
+    return;
+  }
+  while (fgets(line, sizeof(line), cpuinfo) != NULL)
+  {
+    char *value = strchr(line, ':');
+
+    if (strncmp(line, "model name", strlen("model name")) == 0
+        && value != NULL)
+    {
+      value += strspn(value + 1, " \t") + 1;
+      history_copy_field(cpu_model, value, strcspn(value, "\n"));
+      break;
+    }
+  }
+  fclose(cpuinfo);
+}
+
+//############################################################################
+// bench_history_begin()
+//############################################################################
+int bench_history_begin(const char *suite, const char *tpm,
+                        bench_history ** history)
+{
+  if (suite == NULL || history == NULL)
+  {
+    return 1;
+  }
+
+  *history = (bench_history *) calloc(1, sizeof(bench_history));
+  if (*history == NULL)
+  {
+    fprintf(stderr, "unable to allocate the benchmark history\n");
+    return 1;
+  }
+
+  time_t now = time(NULL);
+  struct tm utc;
+
+  history_copy_field((*history)->suite, suite, strlen(suite));
+  history_copy_field((*history)->tpm, (tpm == NULL) ? "none" : tpm,
+                     HISTORY_FIELD_LEN);
+  if (gmtime_r(&now, &utc) != NULL)
+  {
+    strftime((*history)->date, HISTORY_FIELD_LEN, "%Y-%m-%dT%H:%M:%SZ", &utc);
+  }
+  history_revision((*history)->revision);
+  history_cpu_model((*history)->cpu_model);
+
+  return 0;
+}
+
+//############################################################################
+// bench_history_add()
+//############################################################################
+int bench_history_add(bench_history * history, const char *name,
+                      const double *samples, size_t count)
+{
+  if (history == NULL || name == NULL || (samples == NULL && count > 0))
+  {
+    return 1;
+  }
+
+  bench_history_entry *entries = (bench_history_entry *)
+    realloc(history->entries, (history->count + 1) * sizeof(*entries));
+
+  if (entries == NULL)
+  {
+    fprintf(stderr, "%s: unable to allocate the benchmark history\n", name);
+    return 1;
+  }
+  history->entries = entries;
+
+  bench_history_entry *entry = &entries[history->count];
+
+  entry->name = (char *) calloc(HISTORY_FIELD_LEN, 1);
+  entry->samples = (double *) calloc((count > 0) ? count : 1, sizeof(double));
+  if (entry->name == NULL || entry->samples == NULL)
+  {
+    fprintf(stderr, "%s: unable to allocate the benchmark history\n", name);
+    free(entry->name);
+    free(entry->samples);
+    return 1;
+  }
+  history_copy_field(entry->name, name, strlen(name));
+  if (count > 0)
+  {
+    memcpy(entry->samples, samples, count * sizeof(double));
+  }
+  entry->count = count;
+  history->count++;
+
+  return 0;
+}
+
+//############################################################################
+// history_field()
+//
+// Reads the string value of a key from a recorded run
+//############################################################################
+static void history_field(const char *record, const char *key, char *field)
+{
+  char pattern[HISTORY_FIELD_LEN];
+  const char *value;
+
+  snprintf(pattern, sizeof(pattern), "\"%s\":\"", key);
+  value = strstr(record, pattern);
+  if (value == NULL)
+  {
+    field[0] = '\0';
+    return;
+  }
+  value += strlen(pattern);
+  history_copy_field(field, value, strcspn(value, "\""));
+}
+
+//############################################################################
+// history_parse()
+//
+// Reads back a run recorded by history_write()
+//############################################################################
+static int history_parse(const char *record, bench_history ** history)
+{
+  *history = (bench_history *) calloc(1, sizeof(bench_history));
+  if (*history == NULL)
+  {
+    return 1;
+  }
+  history_field(record, "suite", (*history)->suite);
+  history_field(record, "date", (*history)->date);
+  history_field(record, "revision", (*history)->revision);
+  history_field(record, "cpu_model", (*history)->cpu_model);
+  history_field(record, "tpm", (*history)->tpm);
+
+  const char *p = strstr(record, "\"benchmarks\":[");
+  double *samples = NULL;
+  size_t capacity = 0;
+  int retval = (p == NULL);
+
+  while (retval == 0 && (p = strstr(p, "{\"name\":\"")) != NULL)
+  {
+    char name[HISTORY_FIELD_LEN];
+    size_t count = 0;
+
+    p += strlen("{\"name\":\"");
+    history_copy_field(name, p, strcspn(p, "\""));
+
+    p = strstr(p, "\"samples\":[");
+    if (p == NULL)
+    {
+      retval = 1;
+      break;
+    }
+    p += strlen("\"samples\":[");
+
+    while (retval == 0 && *p != ']')
+    {
+      char *next = NULL;
+      double value = strtod(p, &next);
+
+      if (next == p)
+      {
+        retval = 1;
+        break;
+      }
+      if (count == capacity)
+      {
+        double *grown = (double *)
+          realloc(samples, (capacity * 2 + 8) * sizeof(double));
+
+        if (grown == NULL)
+        {
+          retval = 1;
+          break;
+        }
+        samples = grown;
+        capacity = capacity * 2 + 8;
+      }
+      samples[count++] = value;
+      p = next + (*next == ',');
+    }
+
+    if (retval == 0)
+    {
+      retval = bench_history_add(*history, name, samples, count);
+    }
+  }
+
+  free(samples);
+  if (retval)
+  {
+    history_free(*history);
+    *history = NULL;
+  }
+  return retval;
+}
+
+//############################################################################
+// history_read_baseline()
+//
+// Reads the last run of a suite recorded in a history file
+//############################################################################
+static int history_read_baseline(const char *path, const char *suite,
+                                 bench_history ** baseline)
+{
+  FILE *file = fopen(path, "r");
+
+  if (file == NULL)
+  {
+    fprintf(stderr, "unable to open the baseline %s\n", path);
+    return 1;
+  }
+
+  char pattern[HISTORY_FIELD_LEN + 16];
+  char *line = NULL;
+  size_t line_size = 0;
+  char *last = NULL;
+
+  snprintf(pattern, sizeof(pattern), "\"suite\":\"%s\"", suite);
+  while (getline(&line, &line_size, file) != -1)
+  {
+    if (strstr(line, pattern) != NULL)
+    {
+      free(last);
+      last = line;
+      line = NULL;
+      line_size = 0;
+    }
+  }
+  free(line);
+  fclose(file);
+
+  if (last == NULL)
+  {
+    fprintf(stderr, "no %s run recorded in the baseline %s\n", suite, path);
+    return 1;
+  }
+
+  int retval = history_parse(last, baseline);
+
+  if (retval)
+  {
+    fprintf(stderr, "malformed %s run in the baseline %s\n", suite, path);
+  }
+  free(last);
+  return retval;
+}
+
+//############################################################################
+// history_write()
+//############################################################################
+static int history_write(bench_history * history, const char *path)
+{
+  FILE *file = fopen(path, "a");
+
+  if (file == NULL)
+  {
+    fprintf(stderr, "unable to open the history %s\n", path);
+    return 1;
+  }
+
+  fprintf(file, "{\"suite\":\"%s\",\"date\":\"%s\",\"revision\":\"%s\","
+          "\"cpu_model\":\"%s\",\"tpm\":\"%s\",\"benchmarks\":[",
+          history->suite, history->date, history->revision,
+          history->cpu_model, history->tpm);
+  for (size_t i = 0; i < history->count; i++)
+  {
+    fprintf(file, "%s{\"name\":\"%s\",\"unit\":\"ns\",\"samples\":[",
+            (i > 0) ? "," : "", history->entries[i].name);
+    for (size_t j = 0; j < history->entries[i].count; j++)
+    {
+      fprintf(file, "%s%.1f", (j > 0) ? "," : "",
+              history->entries[i].samples[j]);
+    }
+    fprintf(file, "]}");
+  }
+  fprintf(file, "]}\n");
+
+  if (fclose(file) != 0)
+  {
+    fprintf(stderr, "unable to write the history %s\n", path);
+    return 1;
+  }
+  return 0;
+}
+
+//############################################################################
+// beta_fraction()
+//
+// Continued fraction of the incomplete beta function (modified Lentz)
+//############################################################################
+static double beta_fraction(double a, double b, double x)
+{
+  const double tiny = 1e-300;
+  double c = 1.0;
+  double d = 1.0 - (a + b) * x / (a + 1.0);
+
+  d = 1.0 / ((fabs(d) < tiny) ? tiny : d);
+
+  double h = d;
+
+  for (int m = 1; m <= 300; m++)
+  {
+    for (int step = 0; step < 2; step++)
+    {
+      double aa = (step == 0) ?
+        m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m)) :
+        -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1));
+
+      d = 1.0 + aa * d;
+      d = 1.0 / ((fabs(d) < tiny) ? tiny : d);
+      c = 1.0 + aa / c;
+      c = (fabs(c) < tiny) ? tiny : c;
+      h *= d * c;
+      if (step == 1 && fabs(d * c - 1.0) < 1e-12)
+      {
+        return h;
+      }
+    }
+  }
+  return h;
+}
+
+//############################################################################
+// incomplete_beta()
+//
+// Regularized incomplete beta function I_x(a, b)
+//############################################################################
+static double incomplete_beta(double a, double b, double x)
+{
+  if (x <= 0.0)
+  {
+    return 0.0;
+  }
+  if (x >= 1.0)
+  {
+    return 1.0;
+  }
+
+  double front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x)
+                     + b * log1p(-x));
+
+  if (x < (a + 1.0) / (a + b + 2.0))
+  {
+    return front * beta_fraction(a, b, x) / a;
+  }
+  return 1.0 - front * beta_fraction(b, a, 1.0 - x) / b;
+}
+
+//############################################################################
+// mean_variance()
+//############################################################################
+static void mean_variance(const bench_history_entry * entry, double *mean,
+                          double *variance)
+{
+  double sum = 0.0;
+  double squares = 0.0;
+
+  for (size_t i = 0; i < entry->count; i++)
+  {
+    sum += entry->samples[i];
+  }
+  *mean = sum / entry->count;
+  for (size_t i = 0; i < entry->count; i++)
+  {
+    squares += (entry->samples[i] - *mean) * (entry->samples[i] - *mean);
+  }
+  *variance = squares / (entry->count - 1);
+}
+
+//############################################################################
+// slowdown_p_value()
+//
+// One-sided Welch's t-test of the current mean time exceeding the baseline
+// mean time
+//############################################################################
+static double slowdown_p_value(double base_mean, double base_var,
+                               size_t base_n, double mean, double var,
+                               size_t n)
+{
+  double base_se = base_var / base_n;
+  double se = var / n;
+
+  if (base_se + se == 0.0)
+  {
+    return (mean > base_mean) ? 0.0 : 1.0;
+  }
+
+  double t = (mean - base_mean) / sqrt(base_se + se);
+  double df = (base_se + se) * (base_se + se)
+    / (base_se * base_se / (base_n - 1) + se * se / (n - 1));
+  double tail = 0.5 * incomplete_beta(df / 2.0, 0.5, df / (df + t * t));
+
+  return (t > 0.0) ? tail : 1.0 - tail;
+}
+
+//############################################################################
+// history_compare()
+//############################################################################
+static size_t history_compare(bench_history * baseline,
+                              bench_history * history)
+{
+  size_t compared = 0;
+  size_t regressions = 0;
+
+  fprintf(stderr, "\ncompared against %s (%s, revision %s)\n",
+          baseline->suite, baseline->date, baseline->revision);
+  if (strcmp(baseline->cpu_model, history->cpu_model) != 0)
+  {
+    fprintf(stderr, "warning: the baseline ran on another CPU (%s)\n",
+            baseline->cpu_model);
+  }
+  if (strcmp(baseline->tpm, history->tpm) != 0)
+  {
+    fprintf(stderr, "warning: the baseline ran on another TPM (%s)\n",
+            baseline->tpm);
+  }
+  fprintf(stderr, "%-56s %14s %14s %8s %8s\n", "benchmark", "baseline",
+          "current", "change", "p");
+
+  for (size_t i = 0; i < history->count; i++)
+  {
+    bench_history_entry *current = &history->entries[i];
+    bench_history_entry *base = NULL;
+
+    for (size_t j = 0; j < baseline->count && base == NULL; j++)
+    {
+      if (strcmp(baseline->entries[j].name, current->name) == 0)
+      {
+        base = &baseline->entries[j];
+      }
+    }
+    if (base == NULL || base->count < 2 || current->count < 2)
+    {
+      continue;
+    }
+
+    double base_mean;
+    double base_var;
+    double mean;
+    double var;
+
+    mean_variance(base, &base_mean, &base_var);
+    mean_variance(current, &mean, &var);
+    if (base_mean <= 0.0)
+    {
+      continue;
+    }
+
+    double change = (mean - base_mean) / base_mean;
+    double p = slowdown_p_value(base_mean, base_var, base->count, mean, var,
+                                current->count);
+    bool regressed = (change > BENCH_HISTORY_MIN_SLOWDOWN
+                      && p < BENCH_HISTORY_ALPHA);
+
+    fprintf(stderr, "%-56s %11.0f ns %11.0f ns %+7.1f%% %8.4f%s\n",
+            current->name, base_mean, mean, change * 100.0, p,
+            (regressed) ? "  REGRESSION" : "");
+    compared++;
+    if (regressed)
+    {
+      regressions++;
+    }
+  }
+
+  fprintf(stderr, "%zu of %zu benchmarks regressed (slower by more than "
+          "%.0f%%, p < %g)\n", regressions, compared,
+          BENCH_HISTORY_MIN_SLOWDOWN * 100.0, BENCH_HISTORY_ALPHA);
+  return regressions;
+}
+
+//############################################################################
+// bench_history_end()
+//############################################################################
+int bench_history_end(bench_history * history, const char *baseline_path,
+                      const char *output_path, size_t *regressions)
+{
+  int retval = 0;
+
+  if (regressions != NULL)
+  {
+    *regressions = 0;
+  }
+  if (history == NULL)
+  {
+    return 1;
+  }
+
+  if (baseline_path != NULL)
+  {
+    bench_history *baseline = NULL;
+
+    if (history_read_baseline(baseline_path, history->suite, &baseline))
+    {
+      retval = 1;
+    }
+    else
+    {
+      size_t regressed = history_compare(baseline, history);
+
+      if (regressions != NULL)
+      {
+        *regressions = regressed;
+      }
+      history_free(baseline);
+    }
+  }
+
+  if (output_path != NULL && history_write(history, output_path))
+  {
+    retval = 1;
+  }
+
+  history_free(history);
+  return retval;
+}
@@ -0,0 +1,122 @@
+/**
+ * @file  bench_history.h
+ *
+ * @brief Provides the benchmark history shared by the kmyth benchmarks
+ *        (kmyth-bench, kmyth-bench-tpm and kmyth_enclave_bench), which keeps
+ *        the results of each run so that a release can be compared against
+ *        the ones before it.
+ *
+ * A run is recorded as one line of JSON, appended to a history file:
+ *
+ *     {"suite":"kmyth-bench","date":"...","revision":"<git revision>",
+ *      "cpu_model":"...","tpm":"...",
+ *      "benchmarks":[{"name":"...","unit":"ns","samples":[...]}, ...]}
+ *
+ * where each sample is the time (per iteration or per operation) of one
+ * repetition of a benchmark, so that a lower value is always better. The
+ * git revision is taken from $KMYTH_BENCH_REVISION, if set, else from
+ * 'git describe' run in the current directory.
+ *
+ * A run compared against a baseline (the last run of the same suite in a
+ * history file) reports each benchmark whose mean time grew by more than
+ * BENCH_HISTORY_MIN_SLOWDOWN with a one-sided Welch's t-test p-value below
+ * BENCH_HISTORY_ALPHA as a regression. Only benchmarks present in both runs,
+ * with at least two samples each, are compared.
+ */
+
+#ifndef BENCH_HISTORY_H
+#define BENCH_HISTORY_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Significance level below which a slowdown is not put down to noise
+ */
+#define BENCH_HISTORY_ALPHA 0.01
+
+/**
+ * @brief Smallest relative growth of a benchmark's mean time reported as a
+ *        regression, however significant
+ */
+#define BENCH_HISTORY_MIN_SLOWDOWN 0.05
+
+/**
+ * @brief Repetitions the benchmarks that otherwise report a single
+ *        measurement make, by default, when recording or comparing a run
+ */
+#define BENCH_HISTORY_DEFAULT_REPETITIONS 5
+
+/**
+ * @brief Environment variable overriding the git revision a run is tagged
+ *        with (e.g., for a build outside of a git checkout)
+ */
+#define BENCH_HISTORY_REVISION_ENV "KMYTH_BENCH_REVISION"
+
+/**
+ * @brief The results of a benchmark run, as they are collected
+ */
+typedef struct bench_history bench_history;
+
+/**
+ * @brief Starts collecting the results of a run.
+ *
+ * @param[in]  suite     Name of the benchmark program (runs are only
+ *                       compared with runs of the same suite)
+ *
+ * @param[in]  tpm       Description of the TPM the run used ("none" if
+ *                       it used none)
+ *
+ * @param[out] history   The new (empty) run results
+ *
+ * @return 0 on success, 1 on error
+ */
+int bench_history_begin(const char *suite, const char *tpm,
+                        bench_history ** history);
+
+/**
+ * @brief Adds the samples of one benchmark to the results of a run.
+ *
+ * @param[in]  history   The run results
+ *
+ * @param[in]  name      Name of the benchmark
+ *
+ * @param[in]  samples   Time (in ns) of each repetition of the benchmark
+ *
+ * @param[in]  count     Number of samples
+ *
+ * @return 0 on success, 1 on error
+ */
+int bench_history_add(bench_history * history, const char *name,
+                      const double *samples, size_t count);
+
+/**
+ * @brief Compares the results of a run against a baseline, and records
+ *        them. The comparison is reported on stderr (so that it does not
+ *        mix with machine-readable benchmark output). The results are freed.
+ *
+ * @param[in]  history       The run results
+ *
+ * @param[in]  baseline_path History file holding the baseline (NULL to not
+ *                           compare the run)
+ *
+ * @param[in]  output_path   History file to append the run to (NULL to not
+ *                           record it). It may be the baseline file: the
+ *                           baseline is read first.
+ *
+ * @param[out] regressions   Number of benchmarks that regressed
+ *
+ * @return 0 on success, 1 on error (e.g., no run of the suite in the
+ *         baseline file)
+ */
+int bench_history_end(bench_history * history, const char *baseline_path,
+                      const char *output_path, size_t *regressions);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BENCH_HISTORY_H */
@@ -0,0 +1,730 @@
+/**
+ * @file  kmyth_bench.c
+ *
+ * Throughput benchmarks for the work kmyth-seal and kmyth-unseal do outside
+ * the TPM: symmetric encryption and decryption (every cipher_list entry),
+ * .ski encoding and parsing, base64, and file I/O, each across a range of
+ * payload sizes. Results are printed as a table, or in a machine-readable
+ * form (JSON in the Google Benchmark layout, or CSV) so that runs of
+ * different releases can be compared.
+ *
+ * Each benchmark can be repeated, each repetition giving one sample of its
+ * time per iteration. The samples can be recorded in a benchmark history
+ * file, and compared against a baseline run recorded in one, reporting the
+ * benchmarks that significantly slowed down (see bench_history.h).
+ *
+ * Usage: kmyth-bench [-f console|json|csv] [-m min seconds (default 0.2)]
+ *                    [-F name filter] [-d scratch directory (default /tmp)]
+ *                    [-r repetitions (default 1, or 5 with -o or -b)]
+ *                    [-o history file to record the run in]
+ *                    [-b history file holding the baseline]
+ */
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/rand.h>
+
+#include "bench_history.h"
+#include "cipher/cipher.h"
+#include "defines.h"
+#include "file_io.h"
+#include "formatting_tools.h"
+#include "kmyth_log.h"
+#include "memory_util.h"
+#include "tpm/marshalling_tools.h"
+#include "tpm/object_tools.h"
+
+extern const cipher_t cipher_list[];
+
+#define BENCH_DEFAULT_MIN_TIME 0.2
+#define BENCH_MAX_NAME_LEN 127
+#define BENCH_MAX_REPETITIONS 100
+
+// payload sizes every benchmark is run with (all multiples of the 8 byte
+// block the AES key wrap ciphers require)
+static const size_t bench_sizes[] = {
+  64, 1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024
+};
+
+#define BENCH_SIZE_COUNT (sizeof(bench_sizes) / sizeof(bench_sizes[0]))
+#define BENCH_MAX_SIZE (16 * 1024 * 1024)
+
+typedef enum bench_format
+{
+  BENCH_FORMAT_CONSOLE,
+  BENCH_FORMAT_JSON,
+  BENCH_FORMAT_CSV,
+} bench_format;
+
+// settings and results of the whole run
+typedef struct bench_run
+{
+  bench_format format;
+  double min_time;
+  const char *filter;
+  size_t repetitions;
+  bench_history *history;
+  size_t reported;
+  int failures;
+} bench_run;
+
+// a single benchmark, timed over as many iterations as fit in min_time, in
+// each of its repetitions
+typedef struct bench_state
+{
+  char name[BENCH_MAX_NAME_LEN + 1];
+  double min_time;
+  size_t repetitions;
+  uint64_t iterations;
+  uint64_t rep_iterations;
+  double real_start;
+  double cpu_start;
+  double rep_start;
+  double real_time;
+  double cpu_time;
+  double samples[BENCH_MAX_REPETITIONS];
+  size_t sample_count;
+} bench_state;
+
+//############################################################################
+// now_seconds()
+//############################################################################
+static double now_seconds(clockid_t clock)
+{
+  struct timespec ts;
+
+  clock_gettime(clock, &ts);
+  return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+//############################################################################
+// bench_begin()
+//
+// Names a benchmark, returning false if the name filter excludes it
+//############################################################################
+static bool bench_begin(bench_run * run, bench_state * state,
+                        const char *format, ...)
+{
+  va_list args;
+
+  va_start(args, format);
+  vsnprintf(state->name, sizeof(state->name), format, args);
+  va_end(args);
+
+  state->min_time = run->min_time;
+  state->repetitions = run->repetitions;
+  state->iterations = 0;
+  state->sample_count = 0;
+
+  return (run->filter == NULL || strstr(state->name, run->filter) != NULL);
+}
+
+//############################################################################
+// bench_keep_running()
+//
+// Loop condition for the timed loop: true until min_time has elapsed in
+// each repetition (the time per iteration of a repetition is one sample)
+//############################################################################
+static bool bench_keep_running(bench_state * state)
+{
+  double now = now_seconds(CLOCK_MONOTONIC);
+
+  if (state->iterations == 0)
+  {
+    state->real_start = now;
+    state->cpu_start = now_seconds(CLOCK_PROCESS_CPUTIME_ID);
+    state->rep_start = now;
+    state->rep_iterations = 0;
+  }
+  else if (now - state->rep_start >= state->min_time)
+  {
+    state->samples[state->sample_count++] =
+      (now - state->rep_start) * 1e9 / state->rep_iterations;
+    if (state->sample_count == state->repetitions)
+    {
+      state->real_time = now - state->real_start;
+      state->cpu_time =
+        now_seconds(CLOCK_PROCESS_CPUTIME_ID) - state->cpu_start;
+      return false;
+    }
+    state->rep_start = now;
+    state->rep_iterations = 0;
+  }
+
+  state->iterations++;
+  state->rep_iterations++;
+  return true;
+}
+
+//############################################################################
+// bench_print_header()
+//############################################################################
+static void bench_print_header(bench_run * run, const char *executable)
+{
+  char date[32] = "";
+  time_t now = time(NULL);
+  struct tm local;
+
+  if (localtime_r(&now, &local) != NULL)
+  {
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", &local);
+  }
+
+  switch (run->format)
+  {
+  case BENCH_FORMAT_JSON:
+    printf("{\n  \"context\": {\n"
+           "    \"date\": \"%s\",\n"
+           "    \"executable\": \"%s\",\n"
+           "    \"num_cpus\": %ld,\n"
+           "    \"library_version\": \"%s\"\n"
+           "  },\n  \"benchmarks\": [", date, executable,
+           sysconf(_SC_NPROCESSORS_ONLN), KMYTH_VERSION);
+    break;
+  case BENCH_FORMAT_CSV:
+    printf("name,iterations,real_time,cpu_time,time_unit,bytes_per_second\n");
+    break;
+  default:
+    printf("%s, kmyth %s, %ld CPUs\n", date, KMYTH_VERSION,
+           sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-56s %14s %14s %10s %12s\n", "benchmark", "time", "cpu",
+           "iterations", "throughput");
+    break;
+  }
+  fflush(stdout);
+}
+
+//############################################################################
+// bench_print_footer()
+//############################################################################
+static void bench_print_footer(bench_run * run)
+{
+  if (run->format == BENCH_FORMAT_JSON)
+  {
+    printf("\n  ]\n}\n");
+  }
+}
+
+//############################################################################
+// bench_end()
+//
+// Reports a benchmark that processed the given bytes per iteration, or its
+// failure (which is counted, and reported on stderr)
+//############################################################################
+static void bench_end(bench_run * run, bench_state * state, size_t bytes,
+                      bool failed)
+{
+  if (failed || state->iterations == 0)
+  {
+    fprintf(stderr, "%s: failed\n", state->name);
+    run->failures++;
+    return;
+  }
+
+  double real_ns = state->real_time * 1e9 / state->iterations;
+  double cpu_ns = state->cpu_time * 1e9 / state->iterations;
+  double bytes_per_second = (double) bytes * state->iterations
+    / state->real_time;
+
+  switch (run->format)
+  {
+  case BENCH_FORMAT_JSON:
+    printf("%s\n    {\n"
+           "      \"name\": \"%s\",\n"
+           "      \"run_type\": \"iteration\",\n"
+           "      \"iterations\": %llu,\n"
+           "      \"real_time\": %.1f,\n"
+           "      \"cpu_time\": %.1f,\n"
+           "      \"time_unit\": \"ns\",\n"
+           "      \"bytes_per_second\": %.1f\n"
+           "    }", (run->reported > 0) ? "," : "", state->name,
+           (unsigned long long) state->iterations, real_ns, cpu_ns,
+           bytes_per_second);
+    break;
+  case BENCH_FORMAT_CSV:
+    printf("\"%s\",%llu,%.1f,%.1f,ns,%.1f\n", state->name,
+           (unsigned long long) state->iterations, real_ns, cpu_ns,
+           bytes_per_second);
+    break;
+  default:
+    printf("%-56s %11.0f ns %11.0f ns %10llu %7.1f MiB/s\n", state->name,
+           real_ns, cpu_ns, (unsigned long long) state->iterations,
+           bytes_per_second / (1024.0 * 1024.0));
+    break;
+  }
+  fflush(stdout);
+  run->reported++;
+
+  if (run->history != NULL
+      && bench_history_add(run->history, state->name, state->samples,
+                           state->sample_count))
+  {
+    run->failures++;
+  }
+}
+
+//############################################################################
+// bench_cipher()
+//############################################################################
+static void bench_cipher(bench_run * run, cipher_t cipher, uint8_t * data,
+                         size_t size)
+{
+  bench_state state;
+  unsigned char key_buf[32];
+  unsigned char *key = key_buf;
+  size_t key_len = get_key_len_from_cipher(cipher) / 8;
+  unsigned char *enc = NULL;
+  size_t enc_len = 0;
+  unsigned char *dec = NULL;
+  size_t dec_len = 0;
+  bool failed = false;
+
+  if (key_len == 0 || key_len > sizeof(key_buf))
+  {
+    fprintf(stderr, "%s: unsupported key length\n", cipher.cipher_name);
+    run->failures++;
+    return;
+  }
+
+  if (bench_begin(run, &state, "kmyth_encrypt_data/%s/%zu",
+                  cipher.cipher_name, size))
+  {
+    while (bench_keep_running(&state))
+    {
+      size_t len = key_len;
+
+      free(enc);
+      enc = NULL;
+      if (kmyth_encrypt_data(data, size, cipher, &enc, &enc_len, &key, &len))
+      {
+        failed = true;
+        break;
+      }
+    }
+    bench_end(run, &state, size, failed);
+  }
+
+  // the decryption benchmark needs a ciphertext even if encryption was not
+  // benchmarked
+  if (enc == NULL)
+  {
+    size_t len = key_len;
+
+    if (kmyth_encrypt_data(data, size, cipher, &enc, &enc_len, &key, &len))
+    {
+      fprintf(stderr, "%s: unable to encrypt %zu bytes\n",
+              cipher.cipher_name, size);
+      run->failures++;
+      return;
+    }
+  }
+
+  failed = false;
+  if (bench_begin(run, &state, "kmyth_decrypt_data/%s/%zu",
+                  cipher.cipher_name, size))
+  {
+    while (bench_keep_running(&state))
+    {
+      free(dec);
+      dec = NULL;
+      if (kmyth_decrypt_data(enc, enc_len, cipher, key, key_len, &dec,
+                             &dec_len))
+      {
+        failed = true;
+        break;
+      }
+    }
+    failed = failed || dec_len != size || memcmp(dec, data, size) != 0;
+    bench_end(run, &state, size, failed);
+  }
+
+  free(enc);
+  free(dec);
+  kmyth_clear(key_buf, sizeof(key_buf));
+}
+
+//############################################################################
+// init_bench_ski()
+//
+// Builds a .ski struct shaped like one kmyth-seal produces, around the
+// given data
+//############################################################################
+static int init_bench_ski(uint8_t * data, size_t size, Ski * ski)
+{
+  TPM2B_DIGEST policy = {.size = 32 };
+
+  *ski = get_default_ski();
+  ski->cipher = cipher_list[0];
+  ski->enc_data = data;
+  ski->enc_data_size = size;
+
+  if (init_kmyth_object_template(true, policy, &ski->sk_pub.publicArea)
+      || init_kmyth_object_template(false, policy, &ski->wk_pub.publicArea))
+  {
+    return 1;
+  }
+
+  // the sizes only need to be non-zero: marshalling recomputes them
+  ski->sk_pub.size = sizeof(ski->sk_pub.publicArea);
+  ski->sk_pub.publicArea.unique.rsa.size = 256;
+  ski->wk_pub.size = sizeof(ski->wk_pub.publicArea);
+  ski->wk_pub.publicArea.unique.keyedHash.size = 32;
+  ski->sk_priv.size = 222;
+  ski->wk_priv.size = 190;
+
+  if (RAND_bytes(ski->sk_pub.publicArea.unique.rsa.buffer, 256) != 1
+      || RAND_bytes(ski->wk_pub.publicArea.unique.keyedHash.buffer, 32) != 1
+      || RAND_bytes(ski->sk_priv.buffer, ski->sk_priv.size) != 1
+      || RAND_bytes(ski->wk_priv.buffer, ski->wk_priv.size) != 1)
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// bench_ski()
+//############################################################################
+static void bench_ski(bench_run * run, kmyth_ski_format format,
+                      uint8_t * data, size_t size)
+{
+  const char *format_name =
+    (format == KMYTH_SKI_FORMAT_BINARY) ? "binary" : "text";
+  bench_state state;
+  Ski ski;
+  uint8_t *ski_bytes = NULL;
+  size_t ski_bytes_len = 0;
+  bool failed = false;
+
+  if (init_bench_ski(data, size, &ski))
+  {
+    fprintf(stderr, "unable to set up a %s .ski\n", format_name);
+    run->failures++;
+    return;
+  }
+
+  if (bench_begin(run, &state, "create_ski_bytes/%s/%zu", format_name, size))
+  {
+    while (bench_keep_running(&state))
+    {
+      free(ski_bytes);
+      ski_bytes = NULL;
+      if (create_ski_bytes(ski, format, &ski_bytes, &ski_bytes_len))
+      {
+        failed = true;
+        break;
+      }
+    }
+    bench_end(run, &state, size, failed);
+  }
+
+  if (ski_bytes == NULL
+      && create_ski_bytes(ski, format, &ski_bytes, &ski_bytes_len))
+  {
+    fprintf(stderr, "unable to create a %s .ski\n", format_name);
+    run->failures++;
+    return;
+  }
+
+  failed = false;
+  if (bench_begin(run, &state, "parse_ski_bytes/%s/%zu", format_name, size))
+  {
+    while (bench_keep_running(&state))
+    {
+      Ski parsed = get_default_ski();
+
+      if (parse_ski_bytes(ski_bytes, ski_bytes_len, &parsed))
+      {
+        failed = true;
+        break;
+      }
+      failed = (parsed.enc_data_size != size);
+      free_ski(&parsed);
+      if (failed)
+      {
+        break;
+      }
+    }
+    bench_end(run, &state, size, failed);
+  }
+
+  free(ski_bytes);
+}
+
+//############################################################################
+// bench_base64()
+//############################################################################
+static void bench_base64(bench_run * run, uint8_t * data, size_t size)
+{
+  bench_state state;
+  uint8_t *enc = NULL;
+  size_t enc_len = 0;
+  unsigned char *dec = NULL;
+  size_t dec_len = 0;
+  bool failed = false;
+
+  if (bench_begin(run, &state, "encodeBase64Data/%zu", size))
+  {
+    while (bench_keep_running(&state))
+    {
+      free(enc);
+      enc = NULL;
+      if (encodeBase64Data(data, size, &enc, &enc_len))
+      {
+        failed = true;
+        break;
+      }
+    }
+    bench_end(run, &state, size, failed);
+  }
+
+  if (enc == NULL && encodeBase64Data(data, size, &enc, &enc_len))
+  {
+    fprintf(stderr, "unable to base64 encode %zu bytes\n", size);
+    run->failures++;
+    return;
+  }
+
+  failed = false;
+  if (bench_begin(run, &state, "decodeBase64Data/%zu", size))
+  {
+    while (bench_keep_running(&state))
+    {
+      free(dec);
+      dec = NULL;
+      if (decodeBase64Data(enc, enc_len, &dec, &dec_len))
+      {
+        failed = true;
+        break;
+      }
+    }
+    failed = failed || dec_len != size || memcmp(dec, data, size) != 0;
+    bench_end(run, &state, size, failed);
+  }
+
+  free(enc);
+  free(dec);
+}
+
+//############################################################################
+// bench_file_io()
+//############################################################################
+static void bench_file_io(bench_run * run, const char *path, uint8_t * data,
+                          size_t size)
+{
+  bench_state state;
+  uint8_t *read_data = NULL;
+  size_t read_len = 0;
+  bool failed = false;
+
+  if (bench_begin(run, &state, "write_bytes_to_file/%zu", size))
+  {
+    while (bench_keep_running(&state))
+    {
+      if (write_bytes_to_file((char *) path, data, size))
+      {
+        failed = true;
+        break;
+      }
+    }
+    bench_end(run, &state, size, failed);
+  }
+
+  if (write_bytes_to_file((char *) path, data, size))
+  {
+    fprintf(stderr, "unable to write %zu bytes to %s\n", size, path);
+    run->failures++;
+    return;
+  }
+
+  // the file is read back from the page cache: this measures the cost of
+  // the reads, not of the storage device
+  failed = false;
+  if (bench_begin(run, &state, "read_bytes_from_file/%zu", size))
+  {
+    while (bench_keep_running(&state))
+    {
+      free(read_data);
+      read_data = NULL;
+      if (read_bytes_from_file((char *) path, &read_data, &read_len))
+      {
+        failed = true;
+        break;
+      }
+    }
+    failed = failed || read_len != size || memcmp(read_data, data, size) != 0;
+    bench_end(run, &state, size, failed);
+  }
+
+  free(read_data);
+}
+
+//############################################################################
+// usage()
+//############################################################################
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [-f console|json|csv] [-m min seconds] [-F filter] "
+          "[-d scratch directory]\n"
+          "       [-r repetitions] [-o history file] [-b baseline history "
+          "file]\n", prog);
+}
+
+//############################################################################
+// main()
+//############################################################################
+int main(int argc, char **argv)
+{
+  bench_run run = {
+    .format = BENCH_FORMAT_CONSOLE,
+    .min_time = BENCH_DEFAULT_MIN_TIME,
+  };
+  const char *scratch_dir = "/tmp";
+  const char *history_path = NULL;
+  const char *baseline_path = NULL;
+  long repetitions = 0;
+  int options;
+
+  while ((options = getopt(argc, argv, "f:m:F:d:r:o:b:h")) != -1)
+  {
+    switch (options)
+    {
+    case 'f':
+      if (strcmp(optarg, "json") == 0)
+      {
+        run.format = BENCH_FORMAT_JSON;
+      }
+      else if (strcmp(optarg, "csv") == 0)
+      {
+        run.format = BENCH_FORMAT_CSV;
+      }
+      else if (strcmp(optarg, "console") != 0)
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'm':
+      run.min_time = strtod(optarg, NULL);
+      break;
+    case 'F':
+      run.filter = optarg;
+      break;
+    case 'd':
+      scratch_dir = optarg;
+      break;
+    case 'r':
+      repetitions = strtol(optarg, NULL, 10);
+      if (repetitions < 1)
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'o':
+      history_path = optarg;
+      break;
+    case 'b':
+      baseline_path = optarg;
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (repetitions == 0)
+  {
+    // a single sample cannot show whether a change is significant
+    repetitions = (history_path != NULL || baseline_path != NULL) ?
+      BENCH_HISTORY_DEFAULT_REPETITIONS : 1;
+  }
+  if (run.min_time <= 0 || repetitions > BENCH_MAX_REPETITIONS)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+  run.repetitions = (size_t) repetitions;
+
+  // only errors are logged, so that logging does not skew the results
+  set_applog_severity_threshold(LOG_ERR);
+
+  char path[PATH_MAX];
+  int fd = -1;
+
+  snprintf(path, sizeof(path), "%s/kmyth-bench-XXXXXX", scratch_dir);
+  fd = mkstemp(path);
+
+  uint8_t *data = malloc(BENCH_MAX_SIZE);
+
+  if (fd == -1 || data == NULL || RAND_bytes(data, BENCH_MAX_SIZE) != 1)
+  {
+    fprintf(stderr, "unable to set up the benchmark data\n");
+    if (fd != -1)
+    {
+      close(fd);
+      unlink(path);
+    }
+    free(data);
+    return 1;
+  }
+  close(fd);
+
+  if ((history_path != NULL || baseline_path != NULL)
+      && bench_history_begin("kmyth-bench", "none", &run.history))
+  {
+    unlink(path);
+    free(data);
+    return 1;
+  }
+
+  bench_print_header(&run, argv[0]);
+
+  for (size_t i = 0; cipher_list[i].cipher_name != NULL; i++)
+  {
+    for (size_t s = 0; s < BENCH_SIZE_COUNT; s++)
+    {
+      bench_cipher(&run, cipher_list[i], data, bench_sizes[s]);
+    }
+  }
+  for (size_t s = 0; s < BENCH_SIZE_COUNT; s++)
+  {
+    bench_ski(&run, KMYTH_SKI_FORMAT_TEXT, data, bench_sizes[s]);
+    bench_ski(&run, KMYTH_SKI_FORMAT_BINARY, data, bench_sizes[s]);
+  }
+  for (size_t s = 0; s < BENCH_SIZE_COUNT; s++)
+  {
+    bench_base64(&run, data, bench_sizes[s]);
+  }
+  for (size_t s = 0; s < BENCH_SIZE_COUNT; s++)
+  {
+    bench_file_io(&run, path, data, bench_sizes[s]);
+  }
+
+  bench_print_footer(&run);
+
+  unlink(path);
+  free(data);
+
+  size_t regressions = 0;
+
+  if (run.history != NULL
+      && bench_history_end(run.history, baseline_path, history_path,
+                           &regressions))
+  {
+    run.failures++;
+  }
+
+  return (run.failures > 0 || regressions > 0) ? 1 : 0;
+}
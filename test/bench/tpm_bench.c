@@ -0,0 +1,566 @@
+/**
+ * @file  tpm_bench.c
+ *
+ * Latency benchmark for kmyth-seal and kmyth-unseal against the TPM reached
+ * through the resource manager (a simulator or a hardware TPM). Runs a
+ * number of seal/unseal cycles for each combination of PCR selection,
+ * authorization string, and TPM connection handling, and reports the p50
+ * and p99 latency of each phase (see timing_util.h): TPM connection, SRK
+ * lookup, PCR policy, storage key creation or loading, policy session,
+ * sealed object creation, and unsealing.
+ *
+ * Each scenario is run both with a connection opened per call (as by
+ * tpm2_kmyth_seal() and tpm2_kmyth_unseal()), and with one reused context
+ * (kmyth_tpm_context_seal() and kmyth_tpm_context_unseal()), so that the
+ * savings of the reused connection, SRK handle and storage key cache show
+ * up side by side.
+ *
+ * The latency samples can be recorded in a benchmark history file, tagged
+ * with the TPM's manufacturer, vendor string and firmware version, and
+ * compared against a baseline run recorded in one, reporting the phases
+ * that significantly slowed down (see bench_history.h).
+ *
+ * Usage: kmyth-bench-tpm [-n cycles (default 20)] [-w owner auth]
+ *                        [-s payload size (default 32)] [-F name filter]
+ *                        [-f console|csv] [-o history file to record the
+ *                        run in] [-b history file holding the baseline]
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/rand.h>
+
+#include "bench_history.h"
+#include "kmyth.h"
+#include "kmyth_log.h"
+#include "memory_util.h"
+#include "timing_util.h"
+#include "tpm/marshalling_tools.h"
+#include "tpm/tpm2_interface.h"
+
+#define BENCH_DEFAULT_CYCLES 20
+#define BENCH_DEFAULT_PAYLOAD_SIZE 32
+#define BENCH_MAX_NAME_LEN 63
+#define BENCH_MAX_TPM_DESCRIPTION_LEN 127
+
+// the end-to-end time of an operation is kept after the phases
+#define BENCH_TOTAL KMYTH_PHASE_COUNT
+
+typedef enum bench_format
+{
+  BENCH_FORMAT_CONSOLE,
+  BENCH_FORMAT_CSV,
+} bench_format;
+
+typedef enum bench_op
+{
+  BENCH_OP_OPEN,
+  BENCH_OP_SEAL,
+  BENCH_OP_UNSEAL,
+  BENCH_OP_COUNT
+} bench_op;
+
+static const char *const op_names[BENCH_OP_COUNT] = {
+  [BENCH_OP_OPEN] = "open",
+  [BENCH_OP_SEAL] = "seal",
+  [BENCH_OP_UNSEAL] = "unseal",
+};
+
+static int pcrs_one[] = { 0 };
+static int pcrs_boot[] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+
+typedef struct bench_pcrs
+{
+  const char *name;
+  int *pcrs;
+  size_t pcrs_len;
+} bench_pcrs;
+
+static const bench_pcrs pcr_selections[] = {
+  {"none", NULL, 0},
+  {"0", pcrs_one, 1},
+  {"0-7", pcrs_boot, 8},
+};
+
+static const char *const auth_strings[] = { NULL, "kmyth-bench-auth" };
+
+// latency samples (in ns) of one phase of one operation
+typedef struct phase_samples
+{
+  uint64_t *ns;
+  size_t count;
+} phase_samples;
+
+// per-phase totals, snapshotted around each operation
+typedef struct timings_snapshot
+{
+  uint64_t calls[KMYTH_PHASE_COUNT];
+  uint64_t ns[KMYTH_PHASE_COUNT];
+  uint64_t clock_ns;
+} timings_snapshot;
+
+//############################################################################
+// now_ns()
+//############################################################################
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+//############################################################################
+// take_snapshot()
+//############################################################################
+static void take_snapshot(timings_snapshot * snapshot)
+{
+  for (int i = 0; i < KMYTH_PHASE_COUNT; i++)
+  {
+    kmyth_timings_get((kmyth_phase) i, &snapshot->calls[i], &snapshot->ns[i]);
+  }
+  snapshot->clock_ns = now_ns();
+}
+
+//############################################################################
+// record_samples()
+//
+// Adds the time each phase took between two snapshots (for the phases that
+// ran) and the total time to the samples of an operation
+//############################################################################
+static void record_samples(phase_samples * samples,
+                           timings_snapshot * before,
+                           timings_snapshot * after)
+{
+  for (int i = 0; i < KMYTH_PHASE_COUNT; i++)
+  {
+    if (after->calls[i] > before->calls[i])
+    {
+      samples[i].ns[samples[i].count++] = after->ns[i] - before->ns[i];
+    }
+  }
+  samples[BENCH_TOTAL].ns[samples[BENCH_TOTAL].count++] =
+    after->clock_ns - before->clock_ns;
+}
+
+//############################################################################
+// compare_ns()
+//############################################################################
+static int compare_ns(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+//############################################################################
+// percentile()
+//
+// Nearest-rank percentile of sorted samples
+//############################################################################
+static double percentile(phase_samples * samples, double p)
+{
+  size_t rank = (size_t) (p * samples->count + 0.999999);
+
+  if (rank < 1)
+  {
+    rank = 1;
+  }
+  return samples->ns[rank - 1] / 1e6;
+}
+
+//############################################################################
+// report_samples()
+//
+// Reports the samples of an operation, and adds them to the run history
+// (if it is kept), returning 1 if they could not be added
+//############################################################################
+static int report_samples(bench_format format, bench_history * history,
+                          const char *scenario, bench_op op,
+                          phase_samples * samples)
+{
+  int result = 0;
+
+  for (int i = 0; i <= BENCH_TOTAL; i++)
+  {
+    if (samples[i].count == 0)
+    {
+      continue;
+    }
+
+    const char *phase = (i == BENCH_TOTAL) ?
+      "total" : kmyth_phase_name((kmyth_phase) i);
+    double sum_ms = 0;
+
+    qsort(samples[i].ns, samples[i].count, sizeof(uint64_t), compare_ns);
+    for (size_t j = 0; j < samples[i].count; j++)
+    {
+      sum_ms += samples[i].ns[j] / 1e6;
+    }
+
+    if (format == BENCH_FORMAT_CSV)
+    {
+      printf("\"%s\",%s,%s,%zu,%.3f,%.3f,%.3f\n", scenario, op_names[op],
+             phase, samples[i].count, percentile(&samples[i], 0.50),
+             percentile(&samples[i], 0.99), sum_ms / samples[i].count);
+    }
+    else
+    {
+      printf("%-40s %-7s %-15s %7zu %10.3f %10.3f %10.3f\n", scenario,
+             op_names[op], phase, samples[i].count,
+             percentile(&samples[i], 0.50), percentile(&samples[i], 0.99),
+             sum_ms / samples[i].count);
+    }
+
+    if (history != NULL)
+    {
+      char name[BENCH_MAX_NAME_LEN * 2];
+      double *ns = calloc(samples[i].count, sizeof(double));
+
+      snprintf(name, sizeof(name), "%s/%s/%s", scenario, op_names[op], phase);
+      for (size_t j = 0; ns != NULL && j < samples[i].count; j++)
+      {
+        ns[j] = (double) samples[i].ns[j];
+      }
+      if (ns == NULL
+          || bench_history_add(history, name, ns, samples[i].count))
+      {
+        result = 1;
+      }
+      free(ns);
+    }
+  }
+  fflush(stdout);
+
+  return result;
+}
+
+//############################################################################
+// run_scenario()
+//
+// Runs the seal/unseal cycles of one scenario, returning 1 if any failed
+//############################################################################
+static int run_scenario(bench_format format, bench_history * history,
+                        const char *name,
+                        const bench_pcrs * pcrs, const char *auth,
+                        bool reuse_context, uint8_t * owner_auth,
+                        size_t owner_auth_len, uint8_t * payload,
+                        size_t payload_len, size_t cycles)
+{
+  phase_samples samples[BENCH_OP_COUNT][BENCH_TOTAL + 1];
+  uint64_t *storage = calloc(BENCH_OP_COUNT * (BENCH_TOTAL + 1) * cycles,
+                             sizeof(uint64_t));
+  uint8_t *auth_bytes = (uint8_t *) auth;
+  size_t auth_len = (auth == NULL) ? 0 : strlen(auth);
+  kmyth_tpm_context *ctx = NULL;
+  timings_snapshot before;
+  timings_snapshot after;
+  int result = 0;
+
+  if (storage == NULL)
+  {
+    fprintf(stderr, "%s: unable to allocate the samples\n", name);
+    return 1;
+  }
+  for (int op = 0; op < BENCH_OP_COUNT; op++)
+  {
+    for (int i = 0; i <= BENCH_TOTAL; i++)
+    {
+      samples[op][i].ns = storage + (op * (BENCH_TOTAL + 1) + i) * cycles;
+      samples[op][i].count = 0;
+    }
+  }
+
+  if (reuse_context)
+  {
+    take_snapshot(&before);
+    if (kmyth_tpm_context_open(owner_auth, owner_auth_len, &ctx))
+    {
+      fprintf(stderr, "%s: unable to open a TPM context\n", name);
+      free(storage);
+      return 1;
+    }
+    take_snapshot(&after);
+    record_samples(samples[BENCH_OP_OPEN], &before, &after);
+  }
+
+  for (size_t cycle = 0; cycle < cycles && result == 0; cycle++)
+  {
+    uint8_t *ski = NULL;
+    size_t ski_len = 0;
+    uint8_t *output = NULL;
+    size_t output_len = 0;
+
+    take_snapshot(&before);
+    result = (reuse_context) ?
+      kmyth_tpm_context_seal(ctx, payload, payload_len, &ski, &ski_len,
+                             auth_bytes, auth_len, pcrs->pcrs,
+                             pcrs->pcrs_len, NULL) :
+      tpm2_kmyth_seal(payload, payload_len, &ski, &ski_len, auth_bytes,
+                      auth_len, owner_auth, owner_auth_len, pcrs->pcrs,
+                      pcrs->pcrs_len, NULL);
+    take_snapshot(&after);
+    if (result)
+    {
+      fprintf(stderr, "%s: seal failed (cycle %zu)\n", name, cycle);
+      break;
+    }
+    record_samples(samples[BENCH_OP_SEAL], &before, &after);
+
+    take_snapshot(&before);
+    result = (reuse_context) ?
+      kmyth_tpm_context_unseal(ctx, ski, ski_len, &output, &output_len,
+                               auth_bytes, auth_len) :
+      tpm2_kmyth_unseal(ski, ski_len, &output, &output_len, auth_bytes,
+                        auth_len, owner_auth, owner_auth_len);
+    take_snapshot(&after);
+    if (result || output_len != payload_len
+        || memcmp(output, payload, payload_len) != 0)
+    {
+      fprintf(stderr, "%s: unseal failed (cycle %zu)\n", name, cycle);
+      result = 1;
+    }
+    else
+    {
+      record_samples(samples[BENCH_OP_UNSEAL], &before, &after);
+    }
+
+    free(ski);
+    kmyth_clear_and_free(output, output_len);
+  }
+
+  kmyth_tpm_context_close(&ctx);
+
+  for (int op = 0; op < BENCH_OP_COUNT; op++)
+  {
+    result |= report_samples(format, history, name, (bench_op) op,
+                             samples[op]);
+  }
+
+  free(storage);
+  return result;
+}
+
+//############################################################################
+// describe_tpm()
+//
+// Describes the TPM the benchmark runs against by its manufacturer, vendor
+// string and firmware version, which tag the recorded run
+//############################################################################
+static void describe_tpm(char *description, size_t size)
+{
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+  TPMS_CAPABILITY_DATA capData;
+  char vendor[5 * 4 + 1] = "";
+  uint32_t firmware[2] = { 0, 0 };
+
+  snprintf(description, size, "unknown");
+  if (init_tpm2_connection(&sapi_ctx))
+  {
+    return;
+  }
+  if (get_tpm2_properties(sapi_ctx, TPM2_CAP_TPM_PROPERTIES,
+                          TPM2_PT_MANUFACTURER, TPM2_PT_GROUP, &capData))
+  {
+    free_tpm2_resources(&sapi_ctx);
+    return;
+  }
+  free_tpm2_resources(&sapi_ctx);
+
+  for (uint32_t i = 0; i < capData.data.tpmProperties.count; i++)
+  {
+    TPMS_TAGGED_PROPERTY *prop = &capData.data.tpmProperties.tpmProperty[i];
+    char *str = NULL;
+
+    switch (prop->property)
+    {
+    case TPM2_PT_MANUFACTURER:
+    case TPM2_PT_VENDOR_STRING_1:
+    case TPM2_PT_VENDOR_STRING_2:
+    case TPM2_PT_VENDOR_STRING_3:
+    case TPM2_PT_VENDOR_STRING_4:
+      if (prop->value != 0 && unpack_uint32_to_str(prop->value, &str) == 0)
+      {
+        strncat(vendor, str, sizeof(vendor) - strlen(vendor) - 1);
+        if (prop->property == TPM2_PT_MANUFACTURER)
+        {
+          strncat(vendor, " ", sizeof(vendor) - strlen(vendor) - 1);
+        }
+      }
+      free(str);
+      break;
+    case TPM2_PT_FIRMWARE_VERSION_1:
+      firmware[0] = prop->value;
+      break;
+    case TPM2_PT_FIRMWARE_VERSION_2:
+      firmware[1] = prop->value;
+      break;
+    default:
+      break;
+    }
+  }
+
+  snprintf(description, size, "%s firmware %08x.%08x", vendor, firmware[0],
+           firmware[1]);
+}
+
+//############################################################################
+// usage()
+//############################################################################
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [-n cycles] [-w owner auth] [-s payload size] "
+          "[-F filter] [-f console|csv]\n"
+          "       [-o history file] [-b baseline history file]\n", prog);
+}
+
+//############################################################################
+// main()
+//############################################################################
+int main(int argc, char **argv)
+{
+  bench_format format = BENCH_FORMAT_CONSOLE;
+  long cycles = BENCH_DEFAULT_CYCLES;
+  long payload_len = BENCH_DEFAULT_PAYLOAD_SIZE;
+  char *owner_auth = NULL;
+  const char *filter = NULL;
+  const char *history_path = NULL;
+  const char *baseline_path = NULL;
+  bench_history *history = NULL;
+  int options;
+
+  while ((options = getopt(argc, argv, "n:w:s:F:f:o:b:h")) != -1)
+  {
+    switch (options)
+    {
+    case 'n':
+      cycles = strtol(optarg, NULL, 10);
+      break;
+    case 'w':
+      owner_auth = optarg;
+      break;
+    case 's':
+      payload_len = strtol(optarg, NULL, 10);
+      break;
+    case 'F':
+      filter = optarg;
+      break;
+    case 'f':
+      if (strcmp(optarg, "csv") == 0)
+      {
+        format = BENCH_FORMAT_CSV;
+      }
+      else if (strcmp(optarg, "console") != 0)
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'o':
+      history_path = optarg;
+      break;
+    case 'b':
+      baseline_path = optarg;
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (cycles < 1 || payload_len < 1)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // only errors are logged, so that logging does not skew the results
+  set_applog_severity_threshold(LOG_ERR);
+  kmyth_timings_enable(true);
+
+  uint8_t *payload = malloc(payload_len);
+
+  if (payload == NULL || RAND_bytes(payload, (int) payload_len) != 1)
+  {
+    fprintf(stderr, "unable to set up the payload\n");
+    free(payload);
+    return 1;
+  }
+
+  if (history_path != NULL || baseline_path != NULL)
+  {
+    char tpm[BENCH_MAX_TPM_DESCRIPTION_LEN + 1];
+
+    describe_tpm(tpm, sizeof(tpm));
+    if (bench_history_begin("kmyth-bench-tpm", tpm, &history))
+    {
+      free(payload);
+      return 1;
+    }
+  }
+
+  if (format == BENCH_FORMAT_CSV)
+  {
+    printf("scenario,operation,phase,samples,p50_ms,p99_ms,mean_ms\n");
+  }
+  else
+  {
+    printf("%ld cycles, %ld byte payload (latencies in ms)\n", cycles,
+           payload_len);
+    printf("%-40s %-7s %-15s %7s %10s %10s %10s\n", "scenario", "op",
+           "phase", "samples", "p50", "p99", "mean");
+  }
+
+  size_t owner_auth_len = (owner_auth == NULL) ? 0 : strlen(owner_auth);
+  int result = 0;
+
+  for (int reuse = 0; reuse <= 1; reuse++)
+  {
+    for (size_t p = 0; p < sizeof(pcr_selections) / sizeof(pcr_selections[0]);
+         p++)
+    {
+      for (size_t a = 0; a < sizeof(auth_strings) / sizeof(auth_strings[0]);
+           a++)
+      {
+        char name[BENCH_MAX_NAME_LEN + 1];
+
+        snprintf(name, sizeof(name), "%s/pcrs=%s/auth=%s",
+                 (reuse) ? "context" : "per-call", pcr_selections[p].name,
+                 (auth_strings[a] == NULL) ? "empty" : "set");
+        if (filter != NULL && strstr(name, filter) == NULL)
+        {
+          continue;
+        }
+
+        result |= run_scenario(format, history, name, &pcr_selections[p],
+                               auth_strings[a], reuse,
+                               (uint8_t *) owner_auth, owner_auth_len,
+                               payload, (size_t) payload_len,
+                               (size_t) cycles);
+      }
+    }
+  }
+
+  free(payload);
+
+  size_t regressions = 0;
+
+  if (history != NULL
+      && bench_history_end(history, baseline_path, history_path,
+                           &regressions))
+  {
+    result = 1;
+  }
+
+  return (result || regressions > 0) ? 1 : 0;
+}
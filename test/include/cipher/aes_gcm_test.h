@@ -149,4 +149,30 @@ void test_gcm_cipher_modification(void);
  */
 void test_gcm_parameter_limits(void);
 
+/**
+ * Tests of the segmented AES/GCM-Stream encryption and decryption
+ * functionality, for both the in-memory and the stream (FILE) interfaces,
+ * across a range of segment counts.
+ */
+void test_gcm_stream_encrypt_decrypt(void);
+
+/**
+ * Test to verify that truncating, reordering, or modifying segments (or the
+ * header) of AES/GCM-Stream output prevents recovery of the plaintext.
+ */
+void test_gcm_stream_segment_modification(void);
+
+/**
+ * Tests that AES/GCM-Stream output produced with one thread count decrypts
+ * with another, and that a modified segment still fails the decryption
+ * when segments are processed concurrently.
+ */
+void test_gcm_stream_threads(void);
+
+/**
+ * Tests that aes_gcm_stream_decrypt_range() recovers arbitrary ranges of
+ * the plaintext, and that it authenticates every segment it decrypts.
+ */
+void test_gcm_stream_decrypt_range(void);
+
 #endif
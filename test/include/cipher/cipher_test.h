@@ -8,6 +8,11 @@
 #ifndef CIPHER_TEST_H
 #define CIPHER_TEST_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+
 /**
  * Specify maximum number of test vector sets (vector files) that can be
  * contained within a "vector set compilation" (used to size that array).
@@ -63,6 +68,108 @@ typedef struct cipher_vector_compilation
  */
 int convert_HexString_to_ByteArray(char **result, char *hex_str, int str_size);
 
+/**
+ * The stress tests (large payloads through every cipher and sealing mode)
+ * only run when KMYTH_TEST_STRESS_MB gives their payload size, in MiB
+ * (e.g., 4096). They hold up to three copies of the payload at once and
+ * write up to three to temporary files. Each operation must keep the
+ * growth of the process's peak resident set within what its output needs,
+ * plus KMYTH_TEST_STRESS_RSS_SLACK (and 1/16 of the payload), and run at
+ * no less than KMYTH_TEST_STRESS_MIN_MBPS (or the floor in the variable
+ * of that name), in MiB per second of payload. AES Key Wrap, which makes
+ * six passes over its input and is meant for keys, is held to a payload of
+ * at most KMYTH_TEST_STRESS_KEYWRAP_MB and to 1/16 of the floor.
+ */
+#define KMYTH_TEST_STRESS_MB_ENV "KMYTH_TEST_STRESS_MB"
+#define KMYTH_TEST_STRESS_MIN_MBPS_ENV "KMYTH_TEST_STRESS_MIN_MBPS"
+#define KMYTH_TEST_STRESS_MIN_MBPS 16
+#define KMYTH_TEST_STRESS_KEYWRAP_MB 16
+#define KMYTH_TEST_STRESS_RSS_SLACK (64 << 20)
+
+/**
+ * Measures the peak resident set growth and throughput of one stress test
+ * operation
+ */
+typedef struct stress_probe
+{
+  bool rss_valid;
+  size_t rss_start;
+  struct timespec start;
+} stress_probe;
+
+/**
+ * Returns the stress test payload size (in bytes), or 0 if the stress
+ * tests are not to be run
+ */
+size_t stress_payload_size(void);
+
+/**
+ * Returns the stress test throughput floor (in MiB per second)
+ */
+double stress_min_mbps(void);
+
+/**
+ * Allocates a stress test payload, filled with a pattern that
+ * stress_payload_check() verifies
+ *
+ * @param[in]  size    - size (in bytes) of the payload
+ *
+ * @return     The payload (to be freed by the caller), NULL on error
+ */
+unsigned char *stress_payload(size_t size);
+
+/**
+ * Checks that a buffer holds the stress test payload pattern
+ *
+ * @param[in]  data    - buffer to check
+ *
+ * @param[in]  size    - size (in bytes) of the buffer
+ *
+ * @param[in]  offset  - offset of the buffer in the payload
+ *
+ * @return     true if it does, false if not
+ */
+bool stress_payload_check(const unsigned char *data, size_t size,
+                          size_t offset);
+
+/**
+ * Checks that a file holds (exactly) the stress test payload
+ *
+ * @param[in]  file    - file to check (read from its start)
+ *
+ * @param[in]  size    - size (in bytes) of the payload
+ *
+ * @return     true if it does, false if not
+ */
+bool stress_stream_check(FILE * file, size_t size);
+
+/**
+ * Starts measuring an operation: resets the process's peak resident set
+ * size (where the kernel allows it) and records the time
+ *
+ * @param[out] probe   - the measurement
+ */
+void stress_probe_begin(stress_probe * probe);
+
+/**
+ * Completes measuring an operation, asserting that the peak resident set
+ * grew by no more than rss_budget (plus slack) and that the payload was
+ * processed at no less than min_mbps
+ *
+ * @param[in]  probe       - the measurement
+ *
+ * @param[in]  payload     - size (in bytes) of the payload processed
+ *
+ * @param[in]  rss_budget  - memory (in bytes) the operation needs (e.g.,
+ *                           for the output it allocates)
+ *
+ * @param[in]  min_mbps    - throughput floor (in MiB per second)
+ *
+ * @param[in]  what        - description of the operation, for the report
+ */
+void stress_probe_end(stress_probe * probe, size_t payload, size_t rss_budget,
+                      double min_mbps, const char *what);
+
 /**
  * This function adds all of the tests contained in cipher_test.c to a test
  * suite parameter passed in by the caller. This allows a top-level
@@ -99,4 +206,40 @@ void test_kmyth_encrypt_data(void);
  */
 void test_kmyth_decrypt_data(void);
 
+/**
+ * Tests for context reuse through a kmyth_cipher_ctx pool
+ */
+void test_kmyth_cipher_ctx(void);
+
+/**
+ * Tests for batch processing in kmyth_encrypt_data_batch() and
+ * kmyth_decrypt_data_batch()
+ */
+void test_kmyth_data_batch(void);
+
+/**
+ * Tests for caller-provided output buffers in kmyth_encrypt_data_into() and
+ * kmyth_decrypt_data_into()
+ */
+void test_kmyth_data_into(void);
+
+/**
+ * Tests for in-place decryption in kmyth_decrypt_data_in_place()
+ */
+void test_kmyth_decrypt_data_in_place(void);
+
+/**
+ * Tests for partial decryption in kmyth_decrypt_data_range(), for ciphers
+ * with and without a range implementation
+ */
+void test_kmyth_decrypt_data_range(void);
+
+/**
+ * Stress tests encrypting and decrypting a large payload (see
+ * KMYTH_TEST_STRESS_MB_ENV) with every cipher, through the allocating,
+ * caller-buffer, in-place and stream functions, bounding peak memory and
+ * throughput
+ */
+void test_kmyth_cipher_stress(void);
+
 #endif
@@ -0,0 +1,51 @@
+/**
+ * @file  kdf_util_test.h
+ *
+ * Provides unit tests for the HKDF key derivation implemented in
+ * sgx/common/src/kdf_util.c
+ */
+
+#ifndef KDF_UTIL_TEST_H
+#define KDF_UTIL_TEST_H
+
+/**
+ * This function adds all of the tests contained in
+ * test/src/cipher/kdf_util_test.c to a test suite parameter passed in by
+ * the caller. This allows a top-level 'test-runner' application to include
+ * them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the KDF tests to.
+ *
+ * @return     0 on success, 1 on error
+ */
+int kdf_util_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests
+//****************************************************************************
+
+/**
+ * Tests for kdf_params_init()
+ */
+void test_kdf_params_init(void);
+
+/**
+ * Tests kdf_derive_keys() against the RFC 5869 HKDF-SHA256 test vectors,
+ * derived as one key and split into several
+ */
+void test_kdf_derive_keys_vectors(void);
+
+/**
+ * Tests kdf_derive_keys() with SHA-384 against an HMAC-based reference
+ * HKDF computed by the test
+ */
+void test_kdf_derive_keys_sha384(void);
+
+/**
+ * Tests that kdf_derive_keys() rejects invalid requests, including output
+ * beyond the HKDF limit of 255 hash blocks
+ */
+void test_kdf_derive_keys_limits(void);
+
+#endif
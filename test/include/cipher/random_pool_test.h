@@ -0,0 +1,40 @@
+/**
+ * @file  random_pool_test.h
+ *
+ * Provides unit tests for the per-thread random pool implemented in
+ * src/cipher/random_pool.c
+ */
+
+#ifndef RANDOM_POOL_TEST_H
+#define RANDOM_POOL_TEST_H
+
+/**
+ * This function adds all of the tests contained in
+ * test/src/cipher/random_pool_test.c to a test suite parameter passed in by
+ * the caller. This allows a top-level 'test-runner' application to include
+ * them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the random pool tests to.
+ *
+ * @return     0 on success, 1 on error
+ */
+int random_pool_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests
+//****************************************************************************
+
+/**
+ * Tests that random_pool_bytes() serves requests of every size, across
+ * pool refills, without ever handing out the same bytes twice
+ */
+void test_random_pool_bytes(void);
+
+/**
+ * Tests that a child process does not hand out the bytes left in the pool
+ * it inherited from its parent
+ */
+void test_random_pool_fork(void);
+
+#endif
@@ -0,0 +1,38 @@
+/**
+ * @file  socket_util_test.h
+ *
+ * Provides unit tests for the socket utility functions implemented in
+ * tpm2/src/network/socket_util.c
+ */
+
+#ifndef SOCKET_UTIL_TEST_H
+#define SOCKET_UTIL_TEST_H
+
+/**
+ * This function adds all of the tests contained in socket_util_test.c to a
+ * test suite parameter passed in by the caller. This allows a top-level
+ * 'test-runner' application to include them in the set of tests that it runs
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of the
+ *                    socket utility tests to
+ *
+ * @return     0 on success, 1 on failure
+ */
+int socket_util_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests
+//****************************************************************************
+
+/**
+ * Tests for the local socket setup in setup_unix_server_socket() and
+ * setup_unix_client_socket()
+ */
+void test_setup_unix_socket(void);
+
+/**
+ * Tests for retrieving the peer of a local socket in get_peer_credentials()
+ */
+void test_get_peer_credentials(void);
+
+#endif
@@ -34,6 +34,21 @@ void test_create_tls_connection(void);
  */
 void test_tls_set_context(void);
 
+/**
+ * Tests for the reusable TLS client in tls_client_new(),
+ * tls_client_connect(), tls_client_connect_any(), tls_client_set_timeouts(),
+ * tls_client_disconnect() and tls_client_free()
+ */
+void test_tls_client(void);
+
+/**
+ * Tests for TLS session resumption and connection reuse by a tls_client,
+ * against a local TLS server: reusing the open connection, resuming cached
+ * sessions, persisting them to the session cache file, and dropping a
+ * session the server will not resume
+ */
+void test_tls_client_session_reuse(void);
+
 /**
  * Tests for getting a key from a TLS server in get_key_from_tls_server()
  */
@@ -44,4 +59,37 @@ void test_get_key_from_tls_server(void);
  */
 void test_get_key_from_kmip_server(void);
 
+/**
+ * Tests for getting a batch of keys from a KMIP server in
+ * get_keys_from_kmip_server()
+ */
+void test_get_keys_from_kmip_server(void);
+
+/**
+ * Tests for the batched KMIP Get messages of build_kmip_get_batch_request(),
+ * parse_kmip_get_batch_request(), build_kmip_get_batch_response() and
+ * parse_kmip_get_batch_response()
+ */
+void test_kmip_get_batch_round_trip(void);
+
+/**
+ * Tests for encoding batched KMIP Get messages into a reused
+ * kmip_encoding_buffer with build_kmip_get_batch_response_into() and
+ * releasing it with kmip_encoding_buffer_free()
+ */
+void test_kmip_encoding_buffer_reuse(void);
+
+/**
+ * Tests for the pooled KMIP connections of kmip_pool_new(),
+ * kmip_pool_get_keys() and kmip_pool_free()
+ */
+void test_kmip_pool(void);
+
+/**
+ * Tests for the non-blocking KMIP key retrieval in
+ * tls_async_get_keys_start(), tls_async_step(), tls_async_get_keys_result()
+ * and tls_async_free()
+ */
+void test_tls_async(void);
+
 #endif
@@ -0,0 +1,66 @@
+/**
+ * @file  nsl_util_test.h
+ *
+ * Provides unit tests for the Needham-Schroeder-Lowe protocol functions
+ * implemented in tpm2/src/protocol/nsl_util.c
+ */
+
+#ifndef NSL_UTIL_TEST_H
+#define NSL_UTIL_TEST_H
+
+/**
+ * This function adds all of the tests contained in nsl_util_test.c to a test
+ * suite parameter passed in by the caller. This allows a top-level
+ * 'test-runner' application to include them in the set of tests that it runs
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of the
+ *                    NSL protocol tests to
+ *
+ * @return     0 on success, 1 on failure
+ */
+int nsl_util_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests
+//****************************************************************************
+
+/**
+ * Tests for nsl_endpoint_init() and nsl_endpoint_cleanup()
+ */
+void test_nsl_endpoint_init(void);
+
+/**
+ * Tests that generate_session_key() derives the session key with HKDF over
+ * the concatenated nonces, with the given derivation parameters
+ */
+void test_generate_session_key(void);
+
+/**
+ * Tests that the key contexts set up by setup_public_evp_context() and
+ * setup_private_evp_context() can be reused for any number of messages,
+ * with encrypt_with_key_pair(), decrypt_with_key_pair() and the nonce
+ * message builders/parsers
+ */
+void test_nsl_key_pair_reuse(void);
+
+/**
+ * Tests for negotiate_client_session_key() and
+ * negotiate_server_session_key() (NSL_PROTOCOL_RSA), negotiating several
+ * sessions with the same pair of endpoints
+ */
+void test_nsl_rsa_session_reuse(void);
+
+/**
+ * Tests for nsl_endpoint_init() with NSL_PROTOCOL_ECDH, which takes P-256
+ * EC keys only
+ */
+void test_nsl_ecdh_endpoint_init(void);
+
+/**
+ * Tests for negotiate_client_session_key() and
+ * negotiate_server_session_key() (NSL_PROTOCOL_ECDH), including peers
+ * that sign with, or verify against, the wrong key
+ */
+void test_nsl_ecdh_session(void);
+
+#endif
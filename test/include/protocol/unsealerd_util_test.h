@@ -0,0 +1,44 @@
+/**
+ * @file  unsealerd_util_test.h
+ *
+ * Provides unit tests for the kmyth-unsealerd protocol functions
+ * implemented in tpm2/src/protocol/unsealerd_util.c
+ */
+
+#ifndef UNSEALERD_UTIL_TEST_H
+#define UNSEALERD_UTIL_TEST_H
+
+/**
+ * This function adds all of the tests contained in unsealerd_util_test.c to
+ * a test suite parameter passed in by the caller. This allows a top-level
+ * 'test-runner' application to include them in the set of tests that it runs
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of the
+ *                    kmyth-unsealerd protocol tests to
+ *
+ * @return     0 on success, 1 on failure
+ */
+int unsealerd_util_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests
+//****************************************************************************
+
+/**
+ * Tests for the unseal request body of build_unseal_request() and
+ * parse_unseal_request()
+ */
+void test_unseal_request(void);
+
+/**
+ * Tests for the message framing of send_unsealerd_message() and
+ * recv_unsealerd_message()
+ */
+void test_unsealerd_message(void);
+
+/**
+ * Tests for the client call unsealerd_unseal(), against a stand-in daemon
+ */
+void test_unsealerd_unseal(void);
+
+#endif
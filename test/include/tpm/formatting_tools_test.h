@@ -99,14 +99,22 @@ bool check_packed_private(TPM2B_PRIVATE in, uint8_t * packed_data,
 // format for test names is test_<function_name>()
 //****************************************************************************
 void test_marshal_unmarshal_skiObjects(void);
+void test_pack_unpack_ski_objects(void);
 void test_pack_unpack_pcr(void);
 void test_pack_unpack_public(void);
 void test_pack_unpack_private(void);
 void test_unpack_uint32_to_str(void);
+void test_pack_unpack_bundle_payloads(void);
 void test_parse_ski_bytes(void);
 void test_create_ski_bytes(void);
+void test_create_parse_ski_binary(void);
+void test_create_parse_ski_stream(void);
+void test_ski_view(void);
+void test_create_ski_rewrap_header(void);
+void test_create_parse_ski_compressed(void);
 void test_free_ski(void);
 void test_get_default_ski(void);
+void test_get_block_view(void);
 void test_get_block_bytes(void);
 void test_create_nkl_bytes(void);
 void test_encodeBase64Data(void);
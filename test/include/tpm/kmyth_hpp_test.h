@@ -0,0 +1,39 @@
+/**
+ * @file  kmyth_hpp_test.h
+ *
+ * Provides unit tests for the C++ wrappers of the kmyth seal/unseal
+ * library declared in include/kmyth.hpp
+ */
+
+#ifndef KMYTH_HPP_TEST_H
+#define KMYTH_HPP_TEST_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * This function adds all of the tests contained in kmyth_hpp_test.cpp to a
+ * test suite parameter passed in by the caller. This allows a top-level
+ * 'test-runner' application to include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will use to add
+ *                    C++ wrapper tests
+ *
+ * @return     0 on success, 1 on failure
+ */
+  int kmyth_hpp_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+//  Tests for the classes in kmyth.hpp, format for test names is:
+//    test_class_name()
+//****************************************************************************
+  void test_kmyth_hpp_tpm_context(void);
+  void test_kmyth_hpp_compression(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -28,6 +28,19 @@ void test_tpm2_kmyth_seal(void);
 void test_tpm2_kmyth_unseal(void);
 void test_tpm2_kmyth_seal_file(void);
 void test_tpm2_kmyth_unseal_file(void);
+void test_tpm2_kmyth_seal_to_file(void);
+void test_kmyth_tpm_context(void);
+void test_kmyth_tpm_context_threads(void);
+void test_kmyth_tpm_queue(void);
+void test_load_cached_sk(void);
 void test_tpm2_kmyth_seal_data(void);
 void test_tpm2_kmyth_unseal_data(void);
+
+/**
+ * Stress tests sealing and unsealing a large payload (see
+ * KMYTH_TEST_STRESS_MB_ENV in cipher_test.h) through every cipher and the
+ * allocating, caller-buffer, stream and mapped file functions, bounding
+ * peak memory and throughput
+ */
+void test_kmyth_seal_stress(void);
 #endif
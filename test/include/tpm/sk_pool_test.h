@@ -0,0 +1,30 @@
+/**
+ * @file  sk_pool_test.h
+ *
+ * Provides unit tests for the TPM 2.0 storage key pool functions
+ * implemented in tpm2/src/tpm/sk_pool.c
+ */
+
+#ifndef SK_POOL_TEST_H
+#define SK_POOL_TEST_H
+
+/**
+ * This function adds all of the tests contained in sk_pool_test.c to a
+ * test suite parameter passed in by the caller. This allows a top-level
+ * 'test-runner' application to include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will use to add
+ *                    storage key pool tests
+ *
+ * @return     0 on success, 1 on failure
+ */
+int sk_pool_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+//  Tests for functions in sk_pool.h, format for test names is:
+//    test_funtion_name()
+//****************************************************************************
+void test_get_sk_pool_id(void);
+void test_sk_pool_put_take(void);
+
+#endif
@@ -0,0 +1,31 @@
+/**
+ * @file  ski_store_test.h
+ *
+ * Provides unit tests for the content-addressed .ski store functions
+ * implemented in tpm2/src/tpm/ski_store.c
+ */
+
+#ifndef SKI_STORE_TEST_H
+#define SKI_STORE_TEST_H
+
+/**
+ * This function adds all of the tests contained in ski_store_test.c to a
+ * test suite parameter passed in by the caller. This allows a top-level
+ * 'test-runner' application to include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will use to add
+ *                    .ski store tests
+ *
+ * @return     0 on success, 1 on failure
+ */
+int ski_store_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+//  Tests for functions in ski_store.h, format for test names is:
+//    test_funtion_name()
+//****************************************************************************
+void test_ski_store_get_key(void);
+void test_ski_store_id(void);
+void test_ski_store_put_get_link(void);
+
+#endif
@@ -24,6 +24,7 @@ int storage_key_tools_add_tests(CU_pSuite suite);
 //    test_funtion_name()
 //****************************************************************************
 void test_get_srk_handle(void);
+void test_set_srk_handle(void);
 void test_get_existing_srk_handle(void);
 void test_check_if_srk(void);
 void test_put_srk_into_persistent_storage(void);
@@ -25,10 +25,14 @@ int tpm2_interface_add_tests(CU_pSuite suite);
 //****************************************************************************
 void test_init_tpm2_connection(void);
 void test_init_tcti_abrmd(void);
+void test_init_tcti(void);
+void test_init_tcti_device(void);
 void test_init_sapi(void);
 void test_free_tpm2_resources(void);
 void test_startup_tpm2(void);
 void test_get_tpm2_properties(void);
+void test_read_tpm2_pcrs(void);
+void test_read_tpm2_public(void);
 void test_get_tpm2_impl_type(void);
 void test_getErrorString(void);
 void test_init_password_cmd_auth(void);
@@ -39,8 +43,11 @@ void test_compute_cpHash(void);
 void test_compute_rpHash(void);
 void test_compute_authHMAC(void);
 void test_create_policy_digest(void);
+void test_compute_policy_digest(void);
 void test_create_policy_auth_session(void);
 void test_start_policy_auth_session(void);
+void test_compute_kdfa(void);
+void test_crypt_session_param(void);
 void test_apply_policy(void);
 void test_create_caller_nonce(void);
 void test_rollNonces(void);
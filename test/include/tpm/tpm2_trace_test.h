@@ -0,0 +1,31 @@
+/**
+ * @file  tpm2_trace_test.h
+ *
+ * Provides unit tests for the TPM 2.0 command tracing TCTI wrapper
+ * implemented in tpm2/src/tpm/tpm2_trace.c
+ */
+
+#ifndef TPM2_TRACE_TEST_H
+#define TPM2_TRACE_TEST_H
+
+/**
+ * This function adds all of the tests contained in tpm2_trace_test.c to a
+ * test suite parameter passed in by the caller. This allows a top-level
+ * 'test-runner' application to include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will use to add
+ *                    TPM trace tests
+ *
+ * @return     0 on success, 1 on failure
+ */
+int tpm2_trace_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+//  Tests for functions in tpm2_trace.h, format for test names is:
+//    test_funtion_name()
+//****************************************************************************
+void test_tpm2_command_name(void);
+void test_init_tcti_trace(void);
+void test_tpm2_trace_file(void);
+
+#endif
@@ -0,0 +1,45 @@
+/**
+ * @file  base64_codec_test.h
+ *
+ * Provides unit tests for the kmyth base64 codec functions
+ * implemented in utils/src/base64_codec.c
+ */
+
+#ifndef BASE64_CODEC_TEST_H
+#define BASE64_CODEC_TEST_H
+
+/**
+ * This function adds all of the tests contained in
+ * test/src/utils/base64_codec_test.c to a test suite parameter passed
+ * in by the caller. This allows a top-level 'test-runner' application to
+ * include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the kmyth base64 codec tests to.
+ *
+ * @return     0 on success, 1 on error
+ */
+int base64_codec_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests
+//****************************************************************************
+
+/**
+ * Tests that base64_encoded_size() matches the length of the output
+ * produced by base64_encode(), and that the output layout is as expected
+ */
+void test_base64_encode(void);
+
+/**
+ * Tests base64_decode() on valid, whitespace-laden, and malformed input
+ */
+void test_base64_decode(void);
+
+/**
+ * Tests that every codec implementation supported by this build and CPU
+ * produces output identical to the scalar implementation
+ */
+void test_base64_codecs_match(void);
+
+#endif
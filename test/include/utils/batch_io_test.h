@@ -0,0 +1,40 @@
+/**
+ * @file  batch_io_test.h
+ *
+ * Provides unit tests for the batched file I/O functions implemented in
+ * utils/src/batch_io.c
+ */
+
+#ifndef BATCH_IO_TEST_H
+#define BATCH_IO_TEST_H
+
+/**
+ * This function adds all of the tests contained in
+ * test/src/utils/batch_io_test.c to a test suite parameter passed in by the
+ * caller. This allows a top-level 'test-runner' application to include them
+ * in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the batched file I/O tests to.
+ *
+ * @return     0 on success, 1 on error
+ */
+int batch_io_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests
+//****************************************************************************
+
+/**
+ * Tests that write_files_batch() and read_files_batch() round trip more
+ * files than fit in one batch, with either engine, and report the files
+ * that could not be written or read individually
+ */
+void test_batch_io_round_trip(void);
+
+/**
+ * Tests the selection of the batch I/O engine
+ */
+void test_batch_io_set_engine(void);
+
+#endif
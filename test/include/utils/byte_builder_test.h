@@ -0,0 +1,41 @@
+/**
+ * @file  byte_builder_test.h
+ *
+ * Provides unit tests for the kmyth byte builder functions
+ * implemented in utils/src/byte_builder.c
+ */
+
+#ifndef BYTE_BUILDER_TEST_H
+#define BYTE_BUILDER_TEST_H
+
+/**
+ * This function adds all of the tests contained in
+ * test/src/utils/byte_builder_test.c to a test suite parameter passed
+ * in by the caller. This allows a top-level 'test-runner' application to
+ * include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the kmyth byte builder tests to.
+ *
+ * @return     0 on success, 1 on error
+ */
+int byte_builder_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests
+//****************************************************************************
+
+/**
+ * Tests building an output with byte_builder_append(),
+ * byte_builder_append_sized(), and byte_builder_reserve(), and that
+ * writes beyond the capacity are rejected
+ */
+void test_byte_builder_append(void);
+
+/**
+ * Tests the ownership hand-off in byte_builder_finish() and the release in
+ * byte_builder_free()
+ */
+void test_byte_builder_finish_free(void);
+
+#endif
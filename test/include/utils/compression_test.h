@@ -0,0 +1,46 @@
+/**
+ * @file  compression_test.h
+ *
+ * Provides unit tests for the compression functions implemented in
+ * utils/src/compression.c
+ */
+
+#ifndef COMPRESSION_TEST_H
+#define COMPRESSION_TEST_H
+
+/**
+ * This function adds all of the tests contained in
+ * test/src/utils/compression_test.c to a test suite parameter passed
+ * in by the caller. This allows a top-level 'test-runner' application to
+ * include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the compression tests to.
+ *
+ * @return     0 on success, 1 on error
+ */
+int compression_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests
+//****************************************************************************
+
+/**
+ * Tests the compression algorithm name lookups
+ */
+void test_kmyth_compression_names(void);
+
+/**
+ * Tests that kmyth_decompress_data() recovers what kmyth_compress_data()
+ * compresses, and rejects damaged compressed data
+ */
+void test_kmyth_compress_data(void);
+
+/**
+ * Tests that the compressing and decompressing streams round-trip data,
+ * read and written in pieces, and that an incomplete compressed stream
+ * is reported when the decompressing stream is closed
+ */
+void test_kmyth_compress_streams(void);
+
+#endif
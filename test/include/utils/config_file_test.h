@@ -0,0 +1,49 @@
+/**
+ * @file  config_file_test.h
+ *
+ * Provides unit tests for the kmyth configuration file functions
+ * implemented in utils/src/config_file.c
+ */
+
+#ifndef CONFIG_FILE_TEST_H
+#define CONFIG_FILE_TEST_H
+
+/**
+ * This function adds all of the tests contained in
+ * test/src/utils/config_file_test.c to a test suite parameter passed
+ * in by the caller. This allows a top-level 'test-runner' application to
+ * include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the kmyth configuration file tests to.
+ *
+ * @return     0 on success, 1 on error
+ */
+int config_file_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests
+//****************************************************************************
+
+/**
+ * Tests that kmyth_config_apply() inserts the settings of the [default],
+ * tool and profile sections, in that order, ahead of the command line
+ * options, ignoring other sections and options the tool does not have
+ */
+void test_kmyth_config_apply(void);
+
+/**
+ * Tests that kmyth_config_apply() gives an option that may be repeated
+ * every configured value, ahead of those on the command line
+ */
+void test_kmyth_config_apply_repeated(void);
+
+/**
+ * Tests that kmyth_config_apply() rejects malformed configuration files,
+ * files (or directories) writable by other users, files readable by other
+ * users that hold an authorization value and unknown profiles, and accepts
+ * a missing default configuration file
+ */
+void test_kmyth_config_apply_errors(void);
+
+#endif
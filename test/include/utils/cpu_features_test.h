@@ -0,0 +1,40 @@
+/**
+ * @file  cpu_features_test.h
+ *
+ * Provides unit tests for the CPU feature detection functions
+ * implemented in utils/src/cpu_features.c
+ */
+
+#ifndef CPU_FEATURES_TEST_H
+#define CPU_FEATURES_TEST_H
+
+/**
+ * This function adds all of the tests contained in
+ * test/src/utils/cpu_features_test.c to a test suite parameter passed
+ * in by the caller. This allows a top-level 'test-runner' application to
+ * include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the CPU feature detection tests to.
+ *
+ * @return     0 on success, 1 on error
+ */
+int cpu_features_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests
+//****************************************************************************
+
+/**
+ * Tests that kmyth_cpu_set_limit() only ever removes features from those
+ * reported by kmyth_cpu_features() and kmyth_cpu_has(), and that it
+ * rejects unknown levels
+ */
+void test_kmyth_cpu_set_limit(void);
+
+/**
+ * Tests that the base64 codec's automatic selection follows the limit
+ */
+void test_kmyth_cpu_limit_dispatch(void);
+
+#endif
@@ -43,12 +43,50 @@ void test_verifyOutputFilePath(void);
  */
 void test_read_bytes_from_file(void);
 
+/**
+ * Tests for the functionality to map a generic file into memory implemented
+ * in functions map_bytes_from_file() and unmap_bytes_from_file()
+ */
+void test_map_bytes_from_file(void);
+
 /**
  * Tests for the functionality to write bytes to a generic file implemented
  * in function write_bytes_to_file()
  */
 void test_write_bytes_to_file(void);
 
+/**
+ * Tests for the functionality to create a new file, which must not already
+ * exist, implemented in function write_bytes_to_new_file()
+ */
+void test_write_bytes_to_new_file(void);
+
+/**
+ * Tests for the functionality to create, or check, a directory only its
+ * owner may write to implemented in function make_private_dir()
+ */
+void test_make_private_dir(void);
+
+/**
+ * Tests for the functionality to list the regular files in a directory,
+ * in name order, implemented in function append_dir_files()
+ */
+void test_append_dir_files(void);
+
+/**
+ * Tests for the functionality to name the outputs of a list of .ski files
+ * in a directory, refusing existing or clashing ones, implemented in
+ * function derive_unsealed_paths()
+ */
+void test_derive_unsealed_paths(void);
+
+/**
+ * Tests for the functionality to pass bytes through an anonymous memory
+ * file implemented in functions write_bytes_to_secret_fd() and
+ * map_bytes_from_secret_fd()
+ */
+void test_write_bytes_to_secret_fd(void);
+
 /**
  * Tests for the functionality to print information to the STDOUT stream
  * implemented in function print_to_stdout()
@@ -0,0 +1,88 @@
+/**
+ * @file  kmyth_log_test.h
+ *
+ * Provides unit tests for the kmyth logging functions implemented in
+ * logger/src/kmyth_log.c
+ */
+
+#ifndef KMYTH_LOG_TEST_H
+#define KMYTH_LOG_TEST_H
+
+/**
+ * This function adds all of the tests contained in
+ * test/src/utils/kmyth_log_test.c to a test suite parameter passed in by
+ * the caller. This allows a top-level 'test-runner' application to include
+ * them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the logging tests to.
+ *
+ * @return     0 on success, 1 on error
+ */
+int kmyth_log_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests
+//****************************************************************************
+
+/**
+ * Tests that the application log file stays open between entries (so a
+ * file moved away, as by logrotate, keeps receiving them) until
+ * kmyth_log_reopen() or set_applog_path() is called
+ */
+void test_kmyth_log_file_handles(void);
+
+/**
+ * Tests that entries appended by several processes at once are never
+ * interleaved, each being written with one write(2)
+ */
+void test_kmyth_log_concurrent_writers(void);
+
+/**
+ * Tests that entries logged from several threads in async mode are all
+ * written, by kmyth_log_flush() and kmyth_log_stop_async(), and that
+ * kmyth_log_start_async() rejects invalid parameters
+ */
+void test_kmyth_log_async(void);
+
+/**
+ * Tests that in async mode with the KMYTH_LOG_ASYNC_DROP policy, every
+ * entry is either written or counted in a "dropped" warning
+ */
+void test_kmyth_log_async_overflow(void);
+
+/**
+ * Tests that kmyth_log_enabled() follows both severity thresholds, and that
+ * kmyth_log() neither evaluates nor formats the arguments of an entry
+ * neither threshold lets through
+ */
+void test_kmyth_log_severity_filter(void);
+
+/**
+ * Tests that kmyth_log() and kmyth_log_fields() calls less severe than
+ * KMYTH_LOG_MIN_LEVEL are compiled out
+ */
+void test_kmyth_log_min_level(void);
+
+/**
+ * Tests that with KMYTH_APPLOG_OUTPUT_JSON each entry is written as a
+ * single line JSON object, with the message and structured fields escaped,
+ * and that in text mode the fields follow the message
+ */
+void test_kmyth_log_json(void);
+
+/**
+ * Tests that an entry identical to the one before it is only counted, the
+ * count being written before the next different entry, unless repeat
+ * suppression is turned off
+ */
+void test_kmyth_log_repeats(void);
+
+/**
+ * Tests that warning and more severe entries from one call site are rate
+ * limited by set_log_rate_limit(), with the entries dropped reported once
+ * the site is let through again or the limits change
+ */
+void test_kmyth_log_rate_limit(void);
+
+#endif
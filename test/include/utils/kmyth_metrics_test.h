@@ -0,0 +1,47 @@
+/**
+ * @file  kmyth_metrics_test.h
+ *
+ * Provides unit tests for the kmyth metrics registry and endpoint
+ * implemented in logger/src/kmyth_metrics.c
+ */
+
+#ifndef KMYTH_METRICS_TEST_H
+#define KMYTH_METRICS_TEST_H
+
+/**
+ * This function adds all of the tests contained in
+ * test/src/utils/kmyth_metrics_test.c to a test suite parameter passed in
+ * by the caller. This allows a top-level 'test-runner' application to
+ * include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the metrics tests to.
+ *
+ * @return     0 on success, 1 on error
+ */
+int kmyth_metrics_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests
+//****************************************************************************
+
+/**
+ * Tests that nothing is recorded before kmyth_metrics_serve() or after
+ * kmyth_metrics_stop()
+ */
+void test_kmyth_metrics_disabled(void);
+
+/**
+ * Tests that counters and latency histograms are exported in the Prometheus
+ * text format by kmyth_metrics_print()
+ */
+void test_kmyth_metrics_print(void);
+
+/**
+ * Tests that the endpoint started by kmyth_metrics_serve() answers an HTTP
+ * GET request with an HTTP response, and any other client with the bare
+ * metrics
+ */
+void test_kmyth_metrics_serve(void);
+
+#endif
@@ -43,4 +43,16 @@ void test_kmyth_clear_and_free(void);
  */
 void test_secure_memset(void);
 
+/**
+ * Tests for the locked secret memory functionality implemented
+ * in functions kmyth_secure_alloc() and kmyth_secure_free()
+ */
+void test_kmyth_secure_alloc(void);
+
+/**
+ * Tests for the huge page settings (kmyth_set_huge_pages(),
+ * kmyth_huge_pages_name()) and large blocks allocated in each mode
+ */
+void test_kmyth_huge_pages(void);
+
 #endif
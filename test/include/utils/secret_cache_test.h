@@ -0,0 +1,40 @@
+/**
+ * @file  secret_cache_test.h
+ *
+ * Provides unit tests for the kmyth secret cache functions
+ * implemented in utils/src/secret_cache.c
+ */
+
+#ifndef SECRET_CACHE_TEST_H
+#define SECRET_CACHE_TEST_H
+
+/**
+ * This function adds all of the tests contained in
+ * test/src/utils/secret_cache_test.c to a test suite parameter passed
+ * in by the caller. This allows a top-level 'test-runner' application to
+ * include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the kmyth secret cache tests to.
+ *
+ * @return     0 on success, 1 on error
+ */
+int secret_cache_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests
+//****************************************************************************
+
+/**
+ * Tests storing, replacing, looking up, and clearing secrets with
+ * secret_cache_put(), secret_cache_get(), and secret_cache_clear()
+ */
+void test_secret_cache_put_get(void);
+
+/**
+ * Tests that the least recently used entries are dropped when the arena
+ * or the entry table is full, and that expired entries are not served
+ */
+void test_secret_cache_eviction(void);
+
+#endif
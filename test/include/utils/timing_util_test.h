@@ -0,0 +1,40 @@
+/**
+ * @file  timing_util_test.h
+ *
+ * Provides unit tests for the kmyth phase timing functions
+ * implemented in utils/src/timing_util.c
+ */
+
+#ifndef TIMING_UTIL_TEST_H
+#define TIMING_UTIL_TEST_H
+
+/**
+ * This function adds all of the tests contained in
+ * test/src/utils/timing_util_test.c to a test suite parameter passed
+ * in by the caller. This allows a top-level 'test-runner' application to
+ * include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the kmyth phase timing tests to.
+ *
+ * @return     0 on success, 1 on error
+ */
+int timing_util_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests
+//****************************************************************************
+
+/**
+ * Tests that timers are only recorded, with kmyth_timer_begin() and
+ * kmyth_timer_end(), while timing is enabled, and that
+ * kmyth_timings_reset() clears the totals
+ */
+void test_kmyth_timer_begin_end(void);
+
+/**
+ * Tests the phase names returned by kmyth_phase_name()
+ */
+void test_kmyth_phase_name(void);
+
+#endif
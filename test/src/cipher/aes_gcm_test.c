@@ -11,6 +11,7 @@
 #include "aes_gcm_test.h"
 #include "cipher_test.h"
 #include "aes_gcm.h"
+#include "aes_gcm_stream.h"
 
 //----------------------------------------------------------------------------
 // aes_gcm_add_tests()
@@ -60,6 +61,30 @@ int aes_gcm_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "Test AES/GCM-Stream encryption/decryption",
+                          test_gcm_stream_encrypt_decrypt))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Test AES/GCM-Stream segment modification",
+                          test_gcm_stream_segment_modification))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Test AES/GCM-Stream multithreaded segments",
+                          test_gcm_stream_threads))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Test AES/GCM-Stream range decryption",
+                          test_gcm_stream_decrypt_range))
+  {
+    return 1;
+  }
+
   return 0;
 }
 
@@ -736,3 +761,264 @@ void test_gcm_parameter_limits(void)
   CU_ASSERT(aes_gcm_encrypt(key, key_len, inData, inData_len,
                             &outData, &outData_len) == 1);
 }
+
+//----------------------------------------------------------------------------
+// test_gcm_stream_encrypt_decrypt()
+//----------------------------------------------------------------------------
+void test_gcm_stream_encrypt_decrypt(void)
+{
+  unsigned char key[32] = { 0 };
+  size_t key_len = 32;
+
+  // sizes exercise empty, single partial, exactly one, and several segments
+  size_t test_lens[] = { 0, 1, GCM_STREAM_SEGMENT_LEN,
+    GCM_STREAM_SEGMENT_LEN + 1, 3 * GCM_STREAM_SEGMENT_LEN + 17
+  };
+
+  for (size_t t = 0; t < sizeof(test_lens) / sizeof(size_t); t++)
+  {
+    size_t plaintext_len = test_lens[t];
+    unsigned char *plaintext = malloc(plaintext_len + 1);
+
+    for (size_t i = 0; i < plaintext_len; i++)
+    {
+      plaintext[i] = (unsigned char) (i * 7);
+    }
+
+    unsigned char *ciphertext = NULL;
+    size_t ciphertext_len = 0;
+    unsigned char *decrypt = NULL;
+    size_t decrypt_len = 0;
+    size_t seg_count = (plaintext_len == 0) ? 1 :
+      (plaintext_len + GCM_STREAM_SEGMENT_LEN - 1) / GCM_STREAM_SEGMENT_LEN;
+
+    CU_ASSERT(aes_gcm_stream_encrypt(key, key_len, plaintext, plaintext_len,
+                                     &ciphertext, &ciphertext_len) == 0);
+    CU_ASSERT(ciphertext_len == GCM_STREAM_HEADER_LEN + plaintext_len +
+              seg_count * GCM_TAG_LEN);
+    CU_ASSERT(aes_gcm_stream_decrypt(key, key_len, ciphertext, ciphertext_len,
+                                     &decrypt, &decrypt_len) == 0);
+    CU_ASSERT(decrypt_len == plaintext_len);
+    CU_ASSERT(memcmp(plaintext, decrypt, plaintext_len) == 0);
+    free(decrypt);
+
+    // the stream interface must interoperate with the buffer interface
+    char *stream_buf = NULL;
+    size_t stream_len = 0;
+    FILE *in = fmemopen(ciphertext, ciphertext_len, "r");
+    FILE *out = open_memstream(&stream_buf, &stream_len);
+
+    CU_ASSERT(aes_gcm_stream_decrypt_file(key, key_len, in, out) == 0);
+    fclose(in);
+    fclose(out);
+    CU_ASSERT(stream_len == plaintext_len);
+    CU_ASSERT(memcmp(plaintext, stream_buf, plaintext_len) == 0);
+    free(stream_buf);
+    free(ciphertext);
+
+    stream_buf = NULL;
+    in = fmemopen(plaintext, plaintext_len + 1, "r");
+    out = open_memstream(&stream_buf, &stream_len);
+    CU_ASSERT(aes_gcm_stream_encrypt_file(key, key_len, in, out) == 0);
+    fclose(in);
+    fclose(out);
+    CU_ASSERT(aes_gcm_stream_decrypt(key, key_len,
+                                     (unsigned char *) stream_buf, stream_len,
+                                     &decrypt, &decrypt_len) == 0);
+    CU_ASSERT(decrypt_len == plaintext_len + 1);
+    CU_ASSERT(memcmp(plaintext, decrypt, plaintext_len) == 0);
+    free(decrypt);
+    free(stream_buf);
+
+    free(plaintext);
+  }
+}
+
+//----------------------------------------------------------------------------
+// test_gcm_stream_segment_modification()
+//----------------------------------------------------------------------------
+void test_gcm_stream_segment_modification(void)
+{
+  unsigned char key[16] = { 0 };
+  size_t key_len = 16;
+  size_t plaintext_len = 2 * GCM_STREAM_SEGMENT_LEN + 5;
+  unsigned char *plaintext = calloc(plaintext_len, 1);
+  unsigned char *ciphertext = NULL;
+  size_t ciphertext_len = 0;
+  unsigned char *decrypt = NULL;
+  size_t decrypt_len = 0;
+  size_t record_len = GCM_STREAM_SEGMENT_LEN + GCM_TAG_LEN;
+
+  CU_ASSERT(aes_gcm_stream_encrypt(key, key_len, plaintext, plaintext_len,
+                                   &ciphertext, &ciphertext_len) == 0);
+
+  // check that dropping trailing segments (at a segment boundary) is caught
+  CU_ASSERT(aes_gcm_stream_decrypt(key, key_len, ciphertext,
+                                   GCM_STREAM_HEADER_LEN + record_len,
+                                   &decrypt, &decrypt_len) == 1);
+  CU_ASSERT(aes_gcm_stream_decrypt(key, key_len, ciphertext,
+                                   GCM_STREAM_HEADER_LEN + 2 * record_len,
+                                   &decrypt, &decrypt_len) == 1);
+
+  // check that swapping the two full segments is caught
+  unsigned char *swapped = malloc(ciphertext_len);
+
+  memcpy(swapped, ciphertext, ciphertext_len);
+  memcpy(swapped + GCM_STREAM_HEADER_LEN,
+         ciphertext + GCM_STREAM_HEADER_LEN + record_len, record_len);
+  memcpy(swapped + GCM_STREAM_HEADER_LEN + record_len,
+         ciphertext + GCM_STREAM_HEADER_LEN, record_len);
+  CU_ASSERT(aes_gcm_stream_decrypt(key, key_len, swapped, ciphertext_len,
+                                   &decrypt, &decrypt_len) == 1);
+  free(swapped);
+
+  // check that modifying the header (nonce prefix) is caught
+  ciphertext[0] ^= 1;
+  CU_ASSERT(aes_gcm_stream_decrypt(key, key_len, ciphertext, ciphertext_len,
+                                   &decrypt, &decrypt_len) == 1);
+  ciphertext[0] ^= 1;
+
+  // check that an invalid (zero) segment length in the header is rejected
+  unsigned char seg_len_byte = ciphertext[GCM_STREAM_NONCE_PREFIX_LEN + 1];
+
+  ciphertext[GCM_STREAM_NONCE_PREFIX_LEN + 1] = 0;
+  CU_ASSERT(aes_gcm_stream_decrypt(key, key_len, ciphertext, ciphertext_len,
+                                   &decrypt, &decrypt_len) == 1);
+  ciphertext[GCM_STREAM_NONCE_PREFIX_LEN + 1] = seg_len_byte;
+
+  // check that modifying the last segment's ciphertext is caught
+  ciphertext[ciphertext_len - GCM_TAG_LEN - 1] ^= 1;
+  CU_ASSERT(aes_gcm_stream_decrypt(key, key_len, ciphertext, ciphertext_len,
+                                   &decrypt, &decrypt_len) == 1);
+  ciphertext[ciphertext_len - GCM_TAG_LEN - 1] ^= 1;
+
+  // finally, check the unmodified result still decrypts
+  CU_ASSERT(aes_gcm_stream_decrypt(key, key_len, ciphertext, ciphertext_len,
+                                   &decrypt, &decrypt_len) == 0);
+  CU_ASSERT(decrypt_len == plaintext_len);
+  free(decrypt);
+
+  free(ciphertext);
+  free(plaintext);
+}
+
+//----------------------------------------------------------------------------
+// test_gcm_stream_threads()
+//----------------------------------------------------------------------------
+void test_gcm_stream_threads(void)
+{
+  unsigned char key[32] = { 0 };
+  size_t key_len = 32;
+  size_t plaintext_len = 9 * GCM_STREAM_SEGMENT_LEN + 33;
+  unsigned char *plaintext = malloc(plaintext_len);
+  unsigned char *ciphertext = NULL;
+  size_t ciphertext_len = 0;
+  unsigned char *decrypt = NULL;
+  size_t decrypt_len = 0;
+
+  for (size_t i = 0; i < plaintext_len; i++)
+  {
+    plaintext[i] = (unsigned char) (i * 13);
+  }
+
+  // output encrypted on several threads decrypts on one, and vice versa
+  aes_gcm_stream_set_threads(4);
+  CU_ASSERT(aes_gcm_stream_encrypt(key, key_len, plaintext, plaintext_len,
+                                   &ciphertext, &ciphertext_len) == 0);
+  aes_gcm_stream_set_threads(1);
+  CU_ASSERT(aes_gcm_stream_decrypt(key, key_len, ciphertext, ciphertext_len,
+                                   &decrypt, &decrypt_len) == 0);
+  CU_ASSERT(decrypt_len == plaintext_len);
+  CU_ASSERT(memcmp(plaintext, decrypt, plaintext_len) == 0);
+  free(decrypt);
+  decrypt = NULL;
+  free(ciphertext);
+  ciphertext = NULL;
+
+  CU_ASSERT(aes_gcm_stream_encrypt(key, key_len, plaintext, plaintext_len,
+                                   &ciphertext, &ciphertext_len) == 0);
+  aes_gcm_stream_set_threads(GCM_STREAM_MAX_THREADS + 1);
+  CU_ASSERT(aes_gcm_stream_decrypt(key, key_len, ciphertext, ciphertext_len,
+                                   &decrypt, &decrypt_len) == 0);
+  CU_ASSERT(decrypt_len == plaintext_len);
+  CU_ASSERT(memcmp(plaintext, decrypt, plaintext_len) == 0);
+  free(decrypt);
+  decrypt = NULL;
+
+  // a modified segment fails the whole decryption, and clears the output
+  size_t out_len = plaintext_len;
+  unsigned char *out = malloc(out_len);
+
+  ciphertext[GCM_STREAM_HEADER_LEN + 5 * (GCM_STREAM_SEGMENT_LEN +
+                                          GCM_TAG_LEN) + 7] ^= 1;
+  CU_ASSERT(aes_gcm_stream_decrypt_into(NULL, key, key_len, ciphertext,
+                                        ciphertext_len, out, &out_len) == 1);
+  CU_ASSERT(out[0] == 0 && out[plaintext_len - 1] == 0);
+  free(out);
+
+  aes_gcm_stream_set_threads(1);
+  free(ciphertext);
+  free(plaintext);
+}
+
+//----------------------------------------------------------------------------
+// test_gcm_stream_decrypt_range()
+//----------------------------------------------------------------------------
+void test_gcm_stream_decrypt_range(void)
+{
+  unsigned char key[16] = { 0 };
+  size_t key_len = 16;
+  size_t seg = GCM_STREAM_SEGMENT_LEN;
+  size_t plaintext_len = 4 * seg + 100;
+  unsigned char *plaintext = malloc(plaintext_len);
+  unsigned char *ciphertext = NULL;
+  size_t ciphertext_len = 0;
+  unsigned char *range = malloc(plaintext_len);
+
+  for (size_t i = 0; i < plaintext_len; i++)
+  {
+    plaintext[i] = (unsigned char) (i * 11 + (i >> 8));
+  }
+  CU_ASSERT(aes_gcm_stream_encrypt(key, key_len, plaintext, plaintext_len,
+                                   &ciphertext, &ciphertext_len) == 0);
+
+  // ranges within a segment, across segment boundaries, covering whole
+  // segments, ending in the (short) last segment, and the whole plaintext
+  size_t ranges[][2] = { {5, 10}, {seg - 3, 7}, {seg, seg},
+  {seg - 1, 2 * seg + 2}, {4 * seg + 50, 50}, {3 * seg + 1, seg + 99},
+  {0, plaintext_len}, {plaintext_len, 0}
+  };
+
+  for (size_t r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++)
+  {
+    memset(range, 0, plaintext_len);
+    CU_ASSERT(aes_gcm_stream_decrypt_range(NULL, key, key_len, ciphertext,
+                                           ciphertext_len, ranges[r][0],
+                                           range, ranges[r][1]) == 0);
+    CU_ASSERT(memcmp(range, plaintext + ranges[r][0], ranges[r][1]) == 0);
+  }
+
+  // a range extending past the end of the plaintext is rejected
+  CU_ASSERT(aes_gcm_stream_decrypt_range(NULL, key, key_len, ciphertext,
+                                         ciphertext_len, plaintext_len - 1,
+                                         range, 2) == 1);
+
+  // a modified segment only fails the ranges that include it, and leaves
+  // the output cleared
+  ciphertext[GCM_STREAM_HEADER_LEN + 2 * (seg + GCM_TAG_LEN) + 9] ^= 1;
+  CU_ASSERT(aes_gcm_stream_decrypt_range(NULL, key, key_len, ciphertext,
+                                         ciphertext_len, seg, range,
+                                         seg) == 0);
+  CU_ASSERT(memcmp(range, plaintext + seg, seg) == 0);
+  CU_ASSERT(aes_gcm_stream_decrypt_range(NULL, key, key_len, ciphertext,
+                                         ciphertext_len, 2 * seg + 20, range,
+                                         4) == 1);
+  CU_ASSERT(aes_gcm_stream_decrypt_range(NULL, key, key_len, ciphertext,
+                                         ciphertext_len, seg, range,
+                                         2 * seg) == 1);
+  CU_ASSERT(memcmp(range, plaintext + seg, 16) != 0);
+
+  free(range);
+  free(ciphertext);
+  free(plaintext);
+}
@@ -15,9 +15,14 @@
 #include "cipher_test.h"
 #include "aes_keywrap_3394nopad.h"
 #include "aes_keywrap_5649pad.h"
+#include "aes_keywrap_batch.h"
 
 #define AES_KW_VECTOR_PATH "test/vectors/kwtestvectors"
 
+// number of copies of each test vector run through the batch functions, so
+// that every vector is also checked with several lanes in flight
+#define AES_KW_BATCH_TEST_COPIES 3
+
 //---------------------- AES Key Wrap Cipher Test Configuration --------------
 
 //----------------------------------------------------------------------------
@@ -282,6 +287,75 @@ void test_aes_keywrap_parameters(void)
   free(inData);
 }
 
+//----------------------------------------------------------------------------
+// keywrap_batch_matches()
+//
+// Applies a test vector input through the batch function corresponding to
+// the named single-input function, and checks that every copy produces the
+// same result (rc, out, out_len) as the single-input function did.
+//----------------------------------------------------------------------------
+static bool keywrap_batch_matches(const char *func_to_test,
+                                  unsigned char *key, size_t key_len,
+                                  unsigned char *in, size_t in_len,
+                                  int rc, unsigned char *out, size_t out_len)
+{
+  cipher_batch batch_fn = NULL;
+
+  if (strcmp(func_to_test, "aes_keywrap_3394nopad_encrypt") == 0)
+  {
+    batch_fn = aes_keywrap_3394nopad_encrypt_batch;
+  }
+  else if (strcmp(func_to_test, "aes_keywrap_3394nopad_decrypt") == 0)
+  {
+    batch_fn = aes_keywrap_3394nopad_decrypt_batch;
+  }
+  else if (strcmp(func_to_test, "aes_keywrap_5649pad_encrypt") == 0)
+  {
+    batch_fn = aes_keywrap_5649pad_encrypt_batch;
+  }
+  else if (strcmp(func_to_test, "aes_keywrap_5649pad_decrypt") == 0)
+  {
+    batch_fn = aes_keywrap_5649pad_decrypt_batch;
+  }
+  else
+  {
+    return false;
+  }
+
+  unsigned char *batch_in[AES_KW_BATCH_TEST_COPIES];
+  size_t batch_in_len[AES_KW_BATCH_TEST_COPIES];
+  unsigned char *batch_out[AES_KW_BATCH_TEST_COPIES];
+  size_t batch_out_len[AES_KW_BATCH_TEST_COPIES];
+  int status[AES_KW_BATCH_TEST_COPIES];
+
+  for (size_t i = 0; i < AES_KW_BATCH_TEST_COPIES; i++)
+  {
+    batch_in[i] = in;
+    batch_in_len[i] = in_len;
+  }
+
+  int batch_rc = batch_fn(NULL, key, key_len, AES_KW_BATCH_TEST_COPIES,
+                          batch_in, batch_in_len,
+                          batch_out, batch_out_len, status);
+  bool matches = ((batch_rc == 0) == (rc == 0));
+
+  for (size_t i = 0; i < AES_KW_BATCH_TEST_COPIES; i++)
+  {
+    if ((status[i] == 0) != (rc == 0))
+    {
+      matches = false;
+    }
+    else if (rc == 0 && (batch_out_len[i] != out_len
+                         || memcmp(batch_out[i], out, out_len) != 0))
+    {
+      matches = false;
+    }
+    free(batch_out[i]);
+  }
+
+  return matches;
+}
+
 //----------------------------------------------------------------------------
 // test_aes_keywrap_vectors()
 //----------------------------------------------------------------------------
@@ -412,6 +486,8 @@ void test_aes_keywrap_vectors(void)
           // ct_data_len for encrypt, pt_data and pt_data_len for decrypt)
           unsigned char *exp_result = NULL;
           size_t exp_result_len = 0;
+          unsigned char *in = NULL;
+          size_t in_len = 0;
 
           if (strncmp(aes_keywrap_vectors.sets[i].func_to_test,
                       "aes_keywrap_3394nopad_encrypt", 29) == 0)
@@ -422,6 +498,8 @@ void test_aes_keywrap_vectors(void)
                                                pt_data_len, &out, &out_len);
             exp_result = ct_data;
             exp_result_len = ct_data_len;
+            in = pt_data;
+            in_len = pt_data_len;
           }
           else if (strncmp(aes_keywrap_vectors.sets[i].func_to_test,
                            "aes_keywrap_3394nopad_decrypt", 29) == 0)
@@ -432,6 +510,8 @@ void test_aes_keywrap_vectors(void)
                                                ct_data_len, &out, &out_len);
             exp_result = pt_data;
             exp_result_len = pt_data_len;
+            in = ct_data;
+            in_len = ct_data_len;
           }
           else if (strncmp(aes_keywrap_vectors.sets[i].func_to_test,
                            "aes_keywrap_5649pad_encrypt", 29) == 0)
@@ -442,6 +522,8 @@ void test_aes_keywrap_vectors(void)
                                              pt_data_len, &out, &out_len);
             exp_result = ct_data;
             exp_result_len = ct_data_len;
+            in = pt_data;
+            in_len = pt_data_len;
           }
           else if (strncmp(aes_keywrap_vectors.sets[i].func_to_test,
                            "aes_keywrap_5649pad_decrypt", 29) == 0)
@@ -452,6 +534,8 @@ void test_aes_keywrap_vectors(void)
                                              ct_data_len, &out, &out_len);
             exp_result = pt_data;
             exp_result_len = pt_data_len;
+            in = ct_data;
+            in_len = ct_data_len;
           }
 
           else
@@ -501,6 +585,11 @@ void test_aes_keywrap_vectors(void)
             }
             CU_ASSERT(vector_passed);
 
+            // the batch functions must agree with the single-input ones
+            CU_ASSERT(keywrap_batch_matches
+                      (aes_keywrap_vectors.sets[i].func_to_test, key_data,
+                       key_data_len, in, in_len, rc, out, out_len));
+
             // clean-up output_data byte array
             if (rc == 0)
             {
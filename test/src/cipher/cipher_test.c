@@ -6,6 +6,13 @@
 // Tests for cipher utility functions in tpm2/src/cipher/cipher.c
 //############################################################################
 
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
 #include <CUnit/CUnit.h>
 
 #include "cipher/aes_gcm.h"
@@ -39,6 +46,139 @@ int convert_HexString_to_ByteArray(char **result, char *hex_str, int str_size)
   return 0;
 }
 
+//----------------------------------------------------------------------------
+// stress_payload_size()
+//----------------------------------------------------------------------------
+size_t stress_payload_size(void)
+{
+  const char *mb = getenv(KMYTH_TEST_STRESS_MB_ENV);
+
+  return (mb == NULL) ? 0 : (size_t) strtoull(mb, NULL, 10) << 20;
+}
+
+//----------------------------------------------------------------------------
+// stress_min_mbps()
+//----------------------------------------------------------------------------
+double stress_min_mbps(void)
+{
+  const char *mbps = getenv(KMYTH_TEST_STRESS_MIN_MBPS_ENV);
+
+  return (mbps == NULL) ? KMYTH_TEST_STRESS_MIN_MBPS : strtod(mbps, NULL);
+}
+
+//----------------------------------------------------------------------------
+// stress_payload_byte()
+//----------------------------------------------------------------------------
+static unsigned char stress_payload_byte(size_t offset)
+{
+  return (unsigned char) ((offset * 2654435761u) >> 24);
+}
+
+//----------------------------------------------------------------------------
+// stress_payload()
+//----------------------------------------------------------------------------
+unsigned char *stress_payload(size_t size)
+{
+  unsigned char *data = malloc(size);
+
+  for (size_t i = 0; data != NULL && i < size; i++)
+  {
+    data[i] = stress_payload_byte(i);
+  }
+  return data;
+}
+
+//----------------------------------------------------------------------------
+// stress_payload_check()
+//----------------------------------------------------------------------------
+bool stress_payload_check(const unsigned char *data, size_t size,
+                          size_t offset)
+{
+  for (size_t i = 0; i < size; i++)
+  {
+    if (data[i] != stress_payload_byte(offset + i))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// stress_stream_check()
+//----------------------------------------------------------------------------
+bool stress_stream_check(FILE * file, size_t size)
+{
+  unsigned char buffer[1 << 16];
+  size_t offset = 0;
+  size_t len = 0;
+
+  rewind(file);
+  while ((len = fread(buffer, 1, sizeof(buffer), file)) > 0)
+  {
+    if (!stress_payload_check(buffer, len, offset))
+    {
+      return false;
+    }
+    offset += len;
+  }
+  return offset == size;
+}
+
+//----------------------------------------------------------------------------
+// stress_probe_begin()
+//----------------------------------------------------------------------------
+void stress_probe_begin(stress_probe * probe)
+{
+  // writing '5' to clear_refs resets the peak resident set size to the
+  // current one (Linux 4.0 and later)
+  int fd = open("/proc/self/clear_refs", O_WRONLY);
+  FILE *statm = fopen("/proc/self/statm", "r");
+  unsigned long pages = 0;
+
+  probe->rss_valid = fd >= 0 && write(fd, "5", 1) == 1 && statm != NULL
+    && fscanf(statm, "%*lu %lu", &pages) == 1;
+  probe->rss_start = pages * (size_t) sysconf(_SC_PAGESIZE);
+  if (fd >= 0)
+  {
+    close(fd);
+  }
+  if (statm != NULL)
+  {
+    fclose(statm);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &probe->start);
+}
+
+//----------------------------------------------------------------------------
+// stress_probe_end()
+//----------------------------------------------------------------------------
+void stress_probe_end(stress_probe * probe, size_t payload, size_t rss_budget,
+                      double min_mbps, const char *what)
+{
+  struct timespec end = { 0 };
+  struct rusage usage = { 0 };
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  double seconds = (double) (end.tv_sec - probe->start.tv_sec)
+    + (double) (end.tv_nsec - probe->start.tv_nsec) / 1e9;
+  double mbps = (double) (payload >> 20) / ((seconds > 0) ? seconds : 1e-9);
+
+  printf("\n  %s: %.0f MiB/s", what, mbps);
+  CU_ASSERT(mbps >= min_mbps);
+
+  if (probe->rss_valid && getrusage(RUSAGE_SELF, &usage) == 0)
+  {
+    size_t peak = (size_t) usage.ru_maxrss << 10;
+    size_t growth = (peak > probe->rss_start) ? peak - probe->rss_start : 0;
+    size_t limit = rss_budget + KMYTH_TEST_STRESS_RSS_SLACK + payload / 16;
+
+    printf(", peak RSS +%zu MiB (limit %zu MiB)", growth >> 20, limit >> 20);
+    CU_ASSERT(growth <= limit);
+  }
+}
+
 //############ Cipher Utility Function Test Configuration ####################
 
 //----------------------------------------------------------------------------
@@ -70,6 +210,42 @@ int cipher_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "kmyth_cipher_ctx Pool Tests",
+                          test_kmyth_cipher_ctx))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "kmyth_encrypt/decrypt_data_batch() Tests",
+                          test_kmyth_data_batch))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "kmyth_encrypt/decrypt_data_into() Tests",
+                          test_kmyth_data_into))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "kmyth_decrypt_data_in_place() Tests",
+                          test_kmyth_decrypt_data_in_place))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "kmyth_decrypt_data_range() Tests",
+                          test_kmyth_decrypt_data_range))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Cipher Large Payload Stress Tests",
+                          test_kmyth_cipher_stress))
+  {
+    return 1;
+  }
+
   return 0;
 }
 
@@ -427,3 +603,584 @@ void test_kmyth_decrypt_data(void)
   free(key_g);
   free(results_g);
 }
+
+//----------------------------------------------------------------------------
+// test_kmyth_cipher_ctx
+//----------------------------------------------------------------------------
+void test_kmyth_cipher_ctx(void)
+{
+  extern const cipher_t cipher_list[];
+  kmyth_cipher_ctx *cipher_ctx = kmyth_cipher_ctx_new();
+
+  CU_ASSERT(cipher_ctx != NULL);
+
+  // an unknown cipher cannot be drawn from the pool
+  CU_ASSERT(kmyth_cipher_ctx_get(cipher_ctx, NULL, 1) == NULL);
+
+  // the same pooled context is handed out for the same cipher and direction
+  EVP_CIPHER_CTX *ctx_a = kmyth_cipher_ctx_get(cipher_ctx,
+                                               EVP_aes_256_gcm(), 1);
+  EVP_CIPHER_CTX *ctx_b = kmyth_cipher_ctx_get(cipher_ctx,
+                                               EVP_aes_256_gcm(), 0);
+
+  CU_ASSERT(ctx_a != NULL && ctx_b != NULL && ctx_a != ctx_b);
+  kmyth_cipher_ctx_put(cipher_ctx, ctx_a);
+  kmyth_cipher_ctx_put(cipher_ctx, ctx_b);
+  CU_ASSERT(kmyth_cipher_ctx_get(cipher_ctx, EVP_aes_256_gcm(), 1) == ctx_a);
+  kmyth_cipher_ctx_put(cipher_ctx, ctx_a);
+
+  // repeatedly wrap and unwrap with every pooled cipher, interleaving
+  // algorithms and key sizes, and check against the single-use functions
+  unsigned char data[40];
+
+  for (size_t i = 0; i < sizeof(data); i++)
+  {
+    data[i] = (unsigned char) i;
+  }
+  for (int round = 0; round < 3; round++)
+  {
+    for (size_t i = 0; cipher_list[i].cipher_name != NULL; i++)
+    {
+      cipher_t spec = cipher_list[i];
+
+      if (spec.encrypt_ctx_fn == NULL)
+      {
+        continue;
+      }
+
+      size_t key_size = get_key_len_from_cipher(spec) / 8;
+      unsigned char *key = calloc(key_size, sizeof(unsigned char));
+      unsigned char *enc_data = NULL;
+      size_t enc_data_size = 0;
+      unsigned char *result = NULL;
+      size_t result_size = 0;
+
+      CU_ASSERT(kmyth_encrypt_data_with_ctx(cipher_ctx, data, sizeof(data),
+                                            spec, &enc_data, &enc_data_size,
+                                            &key, &key_size) == 0);
+      CU_ASSERT(kmyth_decrypt_data_with_ctx(cipher_ctx, enc_data,
+                                            enc_data_size, spec, key,
+                                            key_size, &result,
+                                            &result_size) == 0);
+      CU_ASSERT(result_size == sizeof(data));
+      CU_ASSERT(memcmp(result, data, sizeof(data)) == 0);
+      free(result);
+      result = NULL;
+
+      CU_ASSERT(kmyth_decrypt_data(enc_data, enc_data_size, spec, key,
+                                   key_size, &result, &result_size) == 0);
+      CU_ASSERT(memcmp(result, data, sizeof(data)) == 0);
+      free(result);
+      result = NULL;
+
+      // a failed decryption leaves the pooled context usable
+      enc_data[enc_data_size - 1] ^= 0x01;
+      CU_ASSERT(kmyth_decrypt_data_with_ctx(cipher_ctx, enc_data,
+                                            enc_data_size, spec, key,
+                                            key_size, &result,
+                                            &result_size) == 1);
+      enc_data[enc_data_size - 1] ^= 0x01;
+      CU_ASSERT(kmyth_decrypt_data_with_ctx(cipher_ctx, enc_data,
+                                            enc_data_size, spec, key,
+                                            key_size, &result,
+                                            &result_size) == 0);
+      CU_ASSERT(memcmp(result, data, sizeof(data)) == 0);
+
+      free(result);
+      free(enc_data);
+      free(key);
+    }
+  }
+
+  kmyth_cipher_ctx_free(cipher_ctx);
+  kmyth_cipher_ctx_free(NULL);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_data_batch
+//----------------------------------------------------------------------------
+void test_kmyth_data_batch(void)
+{
+  extern const cipher_t cipher_list[];
+
+  // RFC 3394 (section 4.1) and RFC 5649 (section 6) example key wraps
+  unsigned char kek_3394[16] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F
+  };
+  unsigned char key_3394[16] = {
+    0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+    0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF
+  };
+  unsigned char wrapped_3394[24] = {
+    0x1F, 0xA6, 0x8B, 0x0A, 0x81, 0x12, 0xB4, 0x47,
+    0xAE, 0xF3, 0x4B, 0xD8, 0xFB, 0x5A, 0x7B, 0x82,
+    0x9D, 0x3E, 0x86, 0x23, 0x71, 0xD2, 0xCF, 0xE5
+  };
+  unsigned char kek_5649[24] = {
+    0x58, 0x40, 0xDF, 0x6E, 0x29, 0xB0, 0x2A, 0xF1,
+    0xAB, 0x49, 0x3B, 0x70, 0x5B, 0xF1, 0x6E, 0xA1,
+    0xAE, 0x83, 0x38, 0xF4, 0xDC, 0xC1, 0x76, 0xA8
+  };
+  unsigned char key_5649_a[20] = {
+    0xC3, 0x7B, 0x7E, 0x64, 0x92, 0x58, 0x43, 0x40,
+    0xBE, 0xD1, 0x22, 0x07, 0x80, 0x89, 0x41, 0x15,
+    0x50, 0x68, 0xF7, 0x38
+  };
+  unsigned char wrapped_5649_a[32] = {
+    0x13, 0x8B, 0xDE, 0xAA, 0x9B, 0x8F, 0xA7, 0xFC,
+    0x61, 0xF9, 0x77, 0x42, 0xE7, 0x22, 0x48, 0xEE,
+    0x5A, 0xE6, 0xAE, 0x53, 0x60, 0xD1, 0xAE, 0x6A,
+    0x5F, 0x54, 0xF3, 0x73, 0xFA, 0x54, 0x3B, 0x6A
+  };
+  unsigned char key_5649_b[7] = { 0x46, 0x6F, 0x72, 0x50, 0x61, 0x73, 0x69 };
+  unsigned char wrapped_5649_b[16] = {
+    0xAF, 0xBE, 0xB0, 0xF0, 0x7D, 0xFB, 0xF5, 0x41,
+    0x92, 0x00, 0xF2, 0xCC, 0xB5, 0x0B, 0xB2, 0x4F
+  };
+
+  unsigned char *in[3] = { key_3394, NULL, NULL };
+  size_t in_sizes[3] = { sizeof(key_3394), 0, 0 };
+  unsigned char *out[3] = { NULL };
+  size_t out_sizes[3] = { 0 };
+  int status[3] = { 1, 1, 1 };
+
+  CU_ASSERT(kmyth_encrypt_data_batch(NULL, 1, in, in_sizes,
+                                     kmyth_get_cipher_t_from_string
+                                     ("AES/KeyWrap/RFC3394NoPadding/128"),
+                                     kek_3394, sizeof(kek_3394), out,
+                                     out_sizes, status) == 0);
+  CU_ASSERT(status[0] == 0);
+  CU_ASSERT(out_sizes[0] == sizeof(wrapped_3394));
+  CU_ASSERT(memcmp(out[0], wrapped_3394, sizeof(wrapped_3394)) == 0);
+  free(out[0]);
+
+  in[0] = key_5649_a;
+  in_sizes[0] = sizeof(key_5649_a);
+  in[1] = key_5649_b;
+  in_sizes[1] = sizeof(key_5649_b);
+  CU_ASSERT(kmyth_encrypt_data_batch(NULL, 3, in, in_sizes,
+                                     kmyth_get_cipher_t_from_string
+                                     ("AES/KeyWrap/RFC5649Padding/192"),
+                                     kek_5649, sizeof(kek_5649), out,
+                                     out_sizes, status) == 1);
+  CU_ASSERT(status[0] == 0 && status[1] == 0 && status[2] == 1);
+  CU_ASSERT(out_sizes[0] == sizeof(wrapped_5649_a));
+  CU_ASSERT(memcmp(out[0], wrapped_5649_a, sizeof(wrapped_5649_a)) == 0);
+  CU_ASSERT(out_sizes[1] == sizeof(wrapped_5649_b));
+  CU_ASSERT(memcmp(out[1], wrapped_5649_b, sizeof(wrapped_5649_b)) == 0);
+  CU_ASSERT(out[2] == NULL && out_sizes[2] == 0);
+  free(out[0]);
+  free(out[1]);
+
+  // batch encrypt and decrypt enough inputs (of varying sizes) to span
+  // several groups with every cipher, with and without a context pool
+  size_t count = 150;
+  unsigned char data[64];
+  unsigned char key[32] = { 0x5A };
+  unsigned char **batch_in = calloc(count, sizeof(unsigned char *));
+  size_t *batch_in_sizes = calloc(count, sizeof(size_t));
+  unsigned char **batch_enc = calloc(count, sizeof(unsigned char *));
+  size_t *batch_enc_sizes = calloc(count, sizeof(size_t));
+  unsigned char **batch_dec = calloc(count, sizeof(unsigned char *));
+  size_t *batch_dec_sizes = calloc(count, sizeof(size_t));
+  int *batch_status = calloc(count, sizeof(int));
+  kmyth_cipher_ctx *cipher_ctx = kmyth_cipher_ctx_new();
+
+  for (size_t i = 0; i < sizeof(data); i++)
+  {
+    data[i] = (unsigned char) (3 * i + 1);
+  }
+
+  for (size_t c = 0; cipher_list[c].cipher_name != NULL; c++)
+  {
+    cipher_t spec = cipher_list[c];
+    size_t key_size = get_key_len_from_cipher(spec) / 8;
+    bool nopad = (strstr(spec.cipher_name, "RFC3394") != NULL);
+    kmyth_cipher_ctx *pool = (c % 2) ? cipher_ctx : NULL;
+
+    for (size_t i = 0; i < count; i++)
+    {
+      batch_in[i] = data;
+      batch_in_sizes[i] = nopad ? 16 + 8 * (i % 6) : 1 + (i % sizeof(data));
+    }
+    batch_in[7] = NULL;
+
+    CU_ASSERT(kmyth_encrypt_data_batch(pool, count, batch_in, batch_in_sizes,
+                                       spec, key, key_size, batch_enc,
+                                       batch_enc_sizes, batch_status) == 1);
+    for (size_t i = 0; i < count; i++)
+    {
+      CU_ASSERT(batch_status[i] == (i == 7));
+    }
+    CU_ASSERT(batch_enc[7] == NULL);
+
+    // results must match those of the single input functions
+    for (size_t i = 0; i < count; i += 13)
+    {
+      unsigned char *result = NULL;
+      size_t result_size = 0;
+
+      CU_ASSERT(kmyth_decrypt_data(batch_enc[i], batch_enc_sizes[i], spec,
+                                   key, key_size, &result,
+                                   &result_size) == 0);
+      CU_ASSERT(result_size == batch_in_sizes[i]);
+      CU_ASSERT(memcmp(result, data, batch_in_sizes[i]) == 0);
+      free(result);
+      if (strstr(spec.cipher_name, "KeyWrap") != NULL)
+      {
+        CU_ASSERT(spec.encrypt_fn(key, key_size, data, batch_in_sizes[i],
+                                  &result, &result_size) == 0);
+        CU_ASSERT(result_size == batch_enc_sizes[i]);
+        CU_ASSERT(memcmp(result, batch_enc[i], result_size) == 0);
+        free(result);
+      }
+    }
+
+    // a modified input only fails its own decryption
+    batch_enc[20][batch_enc_sizes[20] - 1] ^= 0x01;
+    CU_ASSERT(kmyth_decrypt_data_batch(pool, count, batch_enc,
+                                       batch_enc_sizes, spec, key, key_size,
+                                       batch_dec, batch_dec_sizes,
+                                       batch_status) == 1);
+    for (size_t i = 0; i < count; i++)
+    {
+      CU_ASSERT(batch_status[i] == (i == 7 || i == 20));
+      if (batch_status[i] == 0)
+      {
+        CU_ASSERT(batch_dec_sizes[i] == batch_in_sizes[i]);
+        CU_ASSERT(memcmp(batch_dec[i], data, batch_in_sizes[i]) == 0);
+      }
+      else
+      {
+        CU_ASSERT(batch_dec[i] == NULL);
+      }
+      free(batch_enc[i]);
+      free(batch_dec[i]);
+    }
+  }
+
+  kmyth_cipher_ctx_free(cipher_ctx);
+  free(batch_in);
+  free(batch_in_sizes);
+  free(batch_enc);
+  free(batch_enc_sizes);
+  free(batch_dec);
+  free(batch_dec_sizes);
+  free(batch_status);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_data_into
+//----------------------------------------------------------------------------
+void test_kmyth_data_into(void)
+{
+  extern const cipher_t cipher_list[];
+  unsigned char data[40];
+
+  for (size_t i = 0; i < sizeof(data); i++)
+  {
+    data[i] = (unsigned char) i;
+  }
+
+  // every cipher writes into a caller buffer sized by a length query, and
+  // the result decrypts with the allocating functions (and vice versa)
+  for (size_t i = 0; cipher_list[i].cipher_name != NULL; i++)
+  {
+    cipher_t spec = cipher_list[i];
+    size_t key_size = get_key_len_from_cipher(spec) / 8;
+    unsigned char *key = calloc(key_size, sizeof(unsigned char));
+    size_t enc_data_size = 0;
+
+    CU_ASSERT(spec.encrypt_into_fn != NULL && spec.decrypt_into_fn != NULL);
+    CU_ASSERT(kmyth_encrypt_data_into(NULL, data, sizeof(data), spec, NULL,
+                                      &enc_data_size, NULL, NULL) == 0);
+
+    unsigned char *enc_data = malloc(enc_data_size);
+    size_t enc_buf_size = enc_data_size;
+
+    // a buffer that is one byte short is rejected
+    enc_data_size = enc_buf_size - 1;
+    CU_ASSERT(kmyth_encrypt_data_into(NULL, data, sizeof(data), spec,
+                                      enc_data, &enc_data_size,
+                                      &key, &key_size) == 1);
+    enc_data_size = enc_buf_size;
+    CU_ASSERT(kmyth_encrypt_data_into(NULL, data, sizeof(data), spec,
+                                      enc_data, &enc_data_size,
+                                      &key, &key_size) == 0);
+    CU_ASSERT(enc_data_size == enc_buf_size);
+
+    unsigned char *result = NULL;
+    size_t result_size = 0;
+
+    CU_ASSERT(kmyth_decrypt_data(enc_data, enc_data_size, spec, key,
+                                 key_size, &result, &result_size) == 0);
+    CU_ASSERT(result_size == sizeof(data));
+    CU_ASSERT(memcmp(result, data, sizeof(data)) == 0);
+    free(result);
+
+    // the length query bounds the plaintext, the decryption reports it
+    result_size = 0;
+    CU_ASSERT(kmyth_decrypt_data_into(NULL, enc_data, enc_data_size, spec,
+                                      NULL, 0, NULL, &result_size) == 0);
+    CU_ASSERT(result_size >= sizeof(data));
+
+    size_t result_buf_size = result_size;
+
+    result = calloc(result_buf_size, sizeof(unsigned char));
+    CU_ASSERT(kmyth_decrypt_data_into(NULL, enc_data, enc_data_size, spec,
+                                      key, key_size, result,
+                                      &result_size) == 0);
+    CU_ASSERT(result_size == sizeof(data));
+    CU_ASSERT(memcmp(result, data, sizeof(data)) == 0);
+
+    // a failed decryption leaves nothing in the caller's buffer
+    enc_data[enc_data_size - 1] ^= 0x01;
+    result_size = result_buf_size;
+    CU_ASSERT(kmyth_decrypt_data_into(NULL, enc_data, enc_data_size, spec,
+                                      key, key_size, result,
+                                      &result_size) == 1);
+    for (size_t j = 0; j < result_buf_size; j++)
+    {
+      CU_ASSERT(result[j] == 0);
+    }
+
+    free(result);
+    free(enc_data);
+    free(key);
+  }
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_decrypt_data_in_place
+//----------------------------------------------------------------------------
+void test_kmyth_decrypt_data_in_place(void)
+{
+  extern const cipher_t cipher_list[];
+  unsigned char data[40];
+
+  for (size_t i = 0; i < sizeof(data); i++)
+  {
+    data[i] = (unsigned char) i;
+  }
+
+  for (size_t i = 0; cipher_list[i].cipher_name != NULL; i++)
+  {
+    cipher_t spec = cipher_list[i];
+    size_t key_size = get_key_len_from_cipher(spec) / 8;
+    unsigned char *key = calloc(key_size, sizeof(unsigned char));
+    unsigned char *enc_data = NULL;
+    size_t enc_data_size = 0;
+    size_t result_size = 0;
+
+    CU_ASSERT(kmyth_encrypt_data(data, sizeof(data), spec, &enc_data,
+                                 &enc_data_size, &key, &key_size) == 0);
+
+    // ciphers without an in-place implementation are refused
+    if (spec.decrypt_in_place_fn == NULL)
+    {
+      CU_ASSERT(kmyth_decrypt_data_in_place(NULL, enc_data, enc_data_size,
+                                            spec, key, key_size,
+                                            &result_size) == 1);
+      free(enc_data);
+      free(key);
+      continue;
+    }
+
+    // a tampered input leaves no plaintext behind
+    unsigned char *tampered = malloc(enc_data_size);
+
+    memcpy(tampered, enc_data, enc_data_size);
+    tampered[enc_data_size - 1] ^= 0x01;
+    CU_ASSERT(kmyth_decrypt_data_in_place(NULL, tampered, enc_data_size,
+                                          spec, key, key_size,
+                                          &result_size) == 1);
+    CU_ASSERT(memmem(tampered, enc_data_size, data, 8) == NULL);
+    free(tampered);
+
+    CU_ASSERT(kmyth_decrypt_data_in_place(NULL, enc_data, enc_data_size,
+                                          spec, key, key_size,
+                                          &result_size) == 0);
+    CU_ASSERT(result_size == sizeof(data));
+    CU_ASSERT(memcmp(enc_data, data, sizeof(data)) == 0);
+
+    free(enc_data);
+    free(key);
+  }
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_decrypt_data_range
+//----------------------------------------------------------------------------
+void test_kmyth_decrypt_data_range(void)
+{
+  extern const cipher_t cipher_list[];
+  unsigned char data[40];
+  unsigned char result[sizeof(data)];
+
+  for (size_t i = 0; i < sizeof(data); i++)
+  {
+    data[i] = (unsigned char) i;
+  }
+
+  // every cipher supports ranges, natively or by decrypting everything
+  for (size_t i = 0; cipher_list[i].cipher_name != NULL; i++)
+  {
+    cipher_t spec = cipher_list[i];
+    size_t key_size = get_key_len_from_cipher(spec) / 8;
+    unsigned char *key = calloc(key_size, sizeof(unsigned char));
+    unsigned char *enc_data = NULL;
+    size_t enc_data_size = 0;
+
+    CU_ASSERT(kmyth_encrypt_data(data, sizeof(data), spec, &enc_data,
+                                 &enc_data_size, &key, &key_size) == 0);
+
+    CU_ASSERT(kmyth_decrypt_data_range(NULL, enc_data, enc_data_size, spec,
+                                       key, key_size, 0, result,
+                                       sizeof(data)) == 0);
+    CU_ASSERT(memcmp(result, data, sizeof(data)) == 0);
+
+    memset(result, 0, sizeof(result));
+    CU_ASSERT(kmyth_decrypt_data_range(NULL, enc_data, enc_data_size, spec,
+                                       key, key_size, 13, result, 8) == 0);
+    CU_ASSERT(memcmp(result, data + 13, 8) == 0);
+
+    CU_ASSERT(kmyth_decrypt_data_range(NULL, enc_data, enc_data_size, spec,
+                                       key, key_size, sizeof(data), result,
+                                       0) == 0);
+
+    // ranges past the end of the plaintext are rejected
+    CU_ASSERT(kmyth_decrypt_data_range(NULL, enc_data, enc_data_size, spec,
+                                       key, key_size, 33, result, 8) == 1);
+    CU_ASSERT(kmyth_decrypt_data_range(NULL, enc_data, enc_data_size, spec,
+                                       key, key_size, sizeof(data) + 1,
+                                       result, 0) == 1);
+
+    free(enc_data);
+    free(key);
+  }
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_cipher_stress
+//----------------------------------------------------------------------------
+void test_kmyth_cipher_stress(void)
+{
+  extern const cipher_t cipher_list[];
+  size_t stress_size = stress_payload_size();
+
+  if (stress_size == 0)
+  {
+    return;
+  }
+
+  for (size_t i = 0; cipher_list[i].cipher_name != NULL; i++)
+  {
+    cipher_t spec = cipher_list[i];
+    size_t payload = stress_size;
+    double min_mbps = stress_min_mbps();
+
+    if (strstr(spec.cipher_name, "KeyWrap") != NULL)
+    {
+      if (payload > ((size_t) KMYTH_TEST_STRESS_KEYWRAP_MB << 20))
+      {
+        payload = (size_t) KMYTH_TEST_STRESS_KEYWRAP_MB << 20;
+      }
+      min_mbps /= 16;
+    }
+    size_t key_size = get_key_len_from_cipher(spec) / 8;
+    unsigned char *key = calloc(key_size, sizeof(unsigned char));
+    unsigned char *data = stress_payload(payload);
+    unsigned char *enc_data = NULL;
+    size_t enc_data_size = 0;
+    unsigned char *result = NULL;
+    size_t result_size = 0;
+    FILE *plain = NULL;
+    stress_probe probe;
+
+    CU_ASSERT_FATAL(data != NULL);
+    printf("\n%s (%zu MiB)", spec.cipher_name, payload >> 20);
+
+    // the stream functions read their input back from a file
+    if (spec.encrypt_stream_fn != NULL)
+    {
+      plain = tmpfile();
+      CU_ASSERT_FATAL(plain != NULL);
+      CU_ASSERT(fwrite(data, 1, payload, plain) == payload);
+    }
+
+    // the allocating functions hold one copy of their output
+    stress_probe_begin(&probe);
+    CU_ASSERT(kmyth_encrypt_data(data, payload, spec, &enc_data,
+                                 &enc_data_size, &key, &key_size) == 0);
+    stress_probe_end(&probe, payload, enc_data_size, min_mbps, "encrypt");
+    free(data);
+
+    stress_probe_begin(&probe);
+    CU_ASSERT(kmyth_decrypt_data(enc_data, enc_data_size, spec, key,
+                                 key_size, &result, &result_size) == 0);
+    stress_probe_end(&probe, payload, payload, min_mbps, "decrypt");
+    CU_ASSERT(result_size == payload);
+    CU_ASSERT(result != NULL
+              && stress_payload_check(result, result_size, 0));
+    free(result);
+    result = NULL;
+
+    // decrypting into a caller's buffer needs no more memory
+    result_size = 0;
+    CU_ASSERT(kmyth_decrypt_data_into(NULL, enc_data, enc_data_size, spec,
+                                      NULL, 0, NULL, &result_size) == 0);
+    result = malloc(result_size);
+    CU_ASSERT_FATAL(result != NULL);
+    memset(result, 0xA5, result_size);  // fault the buffer in beforehand
+    stress_probe_begin(&probe);
+    CU_ASSERT(kmyth_decrypt_data_into(NULL, enc_data, enc_data_size, spec,
+                                      key, key_size, result,
+                                      &result_size) == 0);
+    stress_probe_end(&probe, payload, 0, min_mbps, "decrypt into");
+    CU_ASSERT(result_size == payload);
+    CU_ASSERT(stress_payload_check(result, result_size, 0));
+    free(result);
+
+    // nor does decrypting in place
+    if (spec.decrypt_in_place_fn != NULL)
+    {
+      stress_probe_begin(&probe);
+      CU_ASSERT(kmyth_decrypt_data_in_place(NULL, enc_data, enc_data_size,
+                                            spec, key, key_size,
+                                            &result_size) == 0);
+      stress_probe_end(&probe, payload, 0, min_mbps, "decrypt in place");
+      CU_ASSERT(result_size == payload);
+      CU_ASSERT(stress_payload_check(enc_data, result_size, 0));
+    }
+    free(enc_data);
+
+    // nor do the stream functions, which never hold the whole payload
+    if (plain != NULL)
+    {
+      FILE *enc = tmpfile();
+      FILE *dec = tmpfile();
+
+      CU_ASSERT_FATAL(enc != NULL && dec != NULL);
+      rewind(plain);
+      stress_probe_begin(&probe);
+      CU_ASSERT(spec.encrypt_stream_fn(key, key_size, plain, enc) == 0);
+      CU_ASSERT(fflush(enc) == 0);
+      stress_probe_end(&probe, payload, 0, min_mbps, "encrypt stream");
+
+      rewind(enc);
+      stress_probe_begin(&probe);
+      CU_ASSERT(spec.decrypt_stream_fn(key, key_size, enc, dec) == 0);
+      CU_ASSERT(fflush(dec) == 0);
+      stress_probe_end(&probe, payload, 0, min_mbps, "decrypt stream");
+      CU_ASSERT(stress_stream_check(dec, payload));
+
+      fclose(dec);
+      fclose(enc);
+      fclose(plain);
+    }
+
+    free(key);
+  }
+  printf("\n");
+}
@@ -0,0 +1,335 @@
+//############################################################################
+// kdf_util_test.c
+//
+// Tests for the kmyth HKDF key derivation in sgx/common/src/kdf_util.c
+//############################################################################
+
+#include <string.h>
+#include <stdlib.h>
+#include <CUnit/CUnit.h>
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include "kdf_util_test.h"
+#include "kdf_util.h"
+
+//----------------------------------------------------------------------------
+// RFC 5869, Appendix A: test case 1 (basic) and test case 3 (zero-length
+// salt and info), both HKDF-SHA256 with 42 bytes of output
+//----------------------------------------------------------------------------
+static const unsigned char rfc5869_ikm[22] = {
+  0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b,
+  0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b
+};
+
+static const unsigned char rfc5869_salt[13] = {
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a,
+  0x0b, 0x0c
+};
+
+static const unsigned char rfc5869_info[10] = {
+  0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9
+};
+
+static const unsigned char rfc5869_okm_1[42] = {
+  0x3c, 0xb2, 0x5f, 0x25, 0xfa, 0xac, 0xd5, 0x7a, 0x90, 0x43, 0x4f,
+  0x64, 0xd0, 0x36, 0x2f, 0x2a, 0x2d, 0x2d, 0x0a, 0x90, 0xcf, 0x1a,
+  0x5a, 0x4c, 0x5d, 0xb0, 0x2d, 0x56, 0xec, 0xc4, 0xc5, 0xbf, 0x34,
+  0x00, 0x72, 0x08, 0xd5, 0xb8, 0x87, 0x18, 0x58, 0x65
+};
+
+static const unsigned char rfc5869_okm_3[42] = {
+  0x8d, 0xa4, 0xe7, 0x75, 0xa5, 0x63, 0xc1, 0x8f, 0x71, 0x5f, 0x80,
+  0x2a, 0x06, 0x3c, 0x5a, 0x31, 0xb8, 0xa1, 0x1f, 0x5c, 0x5e, 0xe1,
+  0x87, 0x9e, 0xc3, 0x45, 0x4e, 0x5f, 0x3c, 0x73, 0x8d, 0x2d, 0x9d,
+  0x20, 0x13, 0x95, 0xfa, 0xa4, 0xb6, 0x1a, 0x96, 0xc8
+};
+
+//----------------------------------------------------------------------------
+// kdf_util_add_tests()
+//----------------------------------------------------------------------------
+int kdf_util_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "kdf_params_init() Tests",
+                          test_kdf_params_init))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "kdf_derive_keys() RFC 5869 Vector Tests",
+                          test_kdf_derive_keys_vectors))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "kdf_derive_keys() SHA-384 Tests",
+                          test_kdf_derive_keys_sha384))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "kdf_derive_keys() Limit Tests",
+                          test_kdf_derive_keys_limits))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// free_keys(): clears and frees the keys derived by kdf_derive_keys()
+//----------------------------------------------------------------------------
+static void free_keys(unsigned char **keys, const size_t *key_lens,
+                      size_t key_count)
+{
+  for (size_t i = 0; i < key_count; i++)
+  {
+    if (keys[i] != NULL)
+    {
+      memset(keys[i], 0, key_lens[i]);
+      free(keys[i]);
+      keys[i] = NULL;
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+// reference_hkdf(): HKDF (RFC 5869, section 2) computed directly with
+//                   HMAC, as an independent check of kdf_derive_keys()
+//----------------------------------------------------------------------------
+static int reference_hkdf(const EVP_MD * md,
+                          const unsigned char *salt, size_t salt_len,
+                          const unsigned char *ikm, size_t ikm_len,
+                          const unsigned char *info, size_t info_len,
+                          unsigned char *okm, size_t okm_len)
+{
+  unsigned char zeros[EVP_MAX_MD_SIZE] = { 0 };
+  unsigned char prk[EVP_MAX_MD_SIZE];
+  unsigned int prk_len = 0;
+  size_t hash_len = (size_t) EVP_MD_size(md);
+
+  // Extract (an empty salt is a string of hash_len zeros)
+  if (salt_len == 0)
+  {
+    salt = zeros;
+    salt_len = hash_len;
+  }
+  if (HMAC(md, salt, (int) salt_len, ikm, ikm_len, prk, &prk_len) == NULL)
+  {
+    return 1;
+  }
+
+  // Expand: T(i) = HMAC(PRK, T(i - 1) | info | i)
+  unsigned char block[EVP_MAX_MD_SIZE];
+  unsigned int block_len = 0;
+  unsigned char input[EVP_MAX_MD_SIZE + 256 + 1];
+  size_t done = 0;
+
+  if (info_len > 256)
+  {
+    return 1;
+  }
+  for (unsigned int i = 1; done < okm_len; i++)
+  {
+    size_t input_len = 0;
+
+    memcpy(input, block, block_len);
+    input_len += block_len;
+    memcpy(input + input_len, info, info_len);
+    input_len += info_len;
+    input[input_len++] = (unsigned char) i;
+    if (HMAC(md, prk, (int) prk_len, input, input_len, block,
+             &block_len) == NULL)
+    {
+      return 1;
+    }
+
+    size_t n = (okm_len - done < block_len) ? okm_len - done : block_len;
+
+    memcpy(okm + done, block, n);
+    done += n;
+  }
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_kdf_params_init()
+//----------------------------------------------------------------------------
+void test_kdf_params_init(void)
+{
+  kdf_params params = { 0 };
+
+  // Check that the hash is looked up and the salt and info referenced
+  CU_ASSERT(kdf_params_init(&params, KDF_HASH_SHA256, rfc5869_salt,
+                            sizeof(rfc5869_salt), rfc5869_info,
+                            sizeof(rfc5869_info)) == 0);
+  CU_ASSERT(params.md == EVP_sha256());
+  CU_ASSERT(params.salt == rfc5869_salt);
+  CU_ASSERT(params.salt_len == sizeof(rfc5869_salt));
+  CU_ASSERT(params.info == rfc5869_info);
+  CU_ASSERT(params.info_len == sizeof(rfc5869_info));
+  CU_ASSERT(kdf_params_init(&params, KDF_HASH_SHA384, NULL, 0, NULL,
+                            0) == 0);
+  CU_ASSERT(params.md == EVP_sha384());
+  CU_ASSERT(params.salt_len == 0);
+  CU_ASSERT(params.info_len == 0);
+
+  // Check that an unknown hash, or a length without data, is rejected
+  CU_ASSERT(kdf_params_init(&params, (kdf_hash) - 1, NULL, 0, NULL, 0) == 1);
+  CU_ASSERT(kdf_params_init(&params, KDF_HASH_SHA256, NULL, 4, NULL,
+                            0) == 1);
+  CU_ASSERT(kdf_params_init(&params, KDF_HASH_SHA256, NULL, 0, NULL,
+                            4) == 1);
+  CU_ASSERT(kdf_params_init(NULL, KDF_HASH_SHA256, NULL, 0, NULL, 0) == 1);
+}
+
+//----------------------------------------------------------------------------
+// test_kdf_derive_keys_vectors()
+//----------------------------------------------------------------------------
+void test_kdf_derive_keys_vectors(void)
+{
+  kdf_params params = { 0 };
+  unsigned char *keys[KDF_MAX_KEYS] = { NULL };
+  size_t one_key[] = { 42 };
+
+  // Check test case 1, as a single key
+  CU_ASSERT_FATAL(kdf_params_init(&params, KDF_HASH_SHA256, rfc5869_salt,
+                                  sizeof(rfc5869_salt), rfc5869_info,
+                                  sizeof(rfc5869_info)) == 0);
+  CU_ASSERT(kdf_derive_keys(&params, rfc5869_ikm, sizeof(rfc5869_ikm), 1,
+                            one_key, keys) == 0);
+  CU_ASSERT(keys[0] != NULL
+            && memcmp(keys[0], rfc5869_okm_1, sizeof(rfc5869_okm_1)) == 0);
+  free_keys(keys, one_key, 1);
+
+  // Check that several keys are consecutive sections of the same output
+  size_t split_keys[] = { 16, 20, 6 };
+
+  CU_ASSERT(kdf_derive_keys(&params, rfc5869_ikm, sizeof(rfc5869_ikm), 3,
+                            split_keys, keys) == 0);
+  CU_ASSERT(keys[0] != NULL && memcmp(keys[0], rfc5869_okm_1, 16) == 0);
+  CU_ASSERT(keys[1] != NULL
+            && memcmp(keys[1], rfc5869_okm_1 + 16, 20) == 0);
+  CU_ASSERT(keys[2] != NULL
+            && memcmp(keys[2], rfc5869_okm_1 + 36, 6) == 0);
+  free_keys(keys, split_keys, 3);
+
+  // Check that a shorter key is a prefix of the longer output
+  size_t short_key[] = { 32 };
+
+  CU_ASSERT(kdf_derive_keys(&params, rfc5869_ikm, sizeof(rfc5869_ikm), 1,
+                            short_key, keys) == 0);
+  CU_ASSERT(keys[0] != NULL && memcmp(keys[0], rfc5869_okm_1, 32) == 0);
+  free_keys(keys, short_key, 1);
+
+  // Check test case 3 (no salt, no info), with parameters reused for a
+  // second derivation
+  CU_ASSERT_FATAL(kdf_params_init(&params, KDF_HASH_SHA256, NULL, 0, NULL,
+                                  0) == 0);
+  for (int i = 0; i < 2; i++)
+  {
+    CU_ASSERT(kdf_derive_keys(&params, rfc5869_ikm, sizeof(rfc5869_ikm), 1,
+                              one_key, keys) == 0);
+    CU_ASSERT(keys[0] != NULL
+              && memcmp(keys[0], rfc5869_okm_3,
+                        sizeof(rfc5869_okm_3)) == 0);
+    free_keys(keys, one_key, 1);
+  }
+}
+
+//----------------------------------------------------------------------------
+// test_kdf_derive_keys_sha384()
+//----------------------------------------------------------------------------
+void test_kdf_derive_keys_sha384(void)
+{
+  kdf_params params = { 0 };
+  unsigned char *keys[KDF_MAX_KEYS] = { NULL };
+  unsigned char expected[100];
+  size_t key_lens[] = { 48, 48, 4 };
+
+  // Check output spanning more than two SHA-384 blocks, split into keys
+  CU_ASSERT_FATAL(kdf_params_init(&params, KDF_HASH_SHA384, rfc5869_salt,
+                                  sizeof(rfc5869_salt), rfc5869_info,
+                                  sizeof(rfc5869_info)) == 0);
+  CU_ASSERT_FATAL(reference_hkdf(EVP_sha384(), rfc5869_salt,
+                                 sizeof(rfc5869_salt), rfc5869_ikm,
+                                 sizeof(rfc5869_ikm), rfc5869_info,
+                                 sizeof(rfc5869_info), expected,
+                                 sizeof(expected)) == 0);
+  CU_ASSERT(kdf_derive_keys(&params, rfc5869_ikm, sizeof(rfc5869_ikm), 3,
+                            key_lens, keys) == 0);
+  CU_ASSERT(keys[0] != NULL && memcmp(keys[0], expected, 48) == 0);
+  CU_ASSERT(keys[1] != NULL && memcmp(keys[1], expected + 48, 48) == 0);
+  CU_ASSERT(keys[2] != NULL && memcmp(keys[2], expected + 96, 4) == 0);
+  free_keys(keys, key_lens, 3);
+
+  // Check that the reference agrees with RFC 5869 test case 1, and that
+  // SHA-384 and SHA-256 derive different keys from the same input
+  unsigned char sha256_okm[42];
+
+  CU_ASSERT(reference_hkdf(EVP_sha256(), rfc5869_salt, sizeof(rfc5869_salt),
+                           rfc5869_ikm, sizeof(rfc5869_ikm), rfc5869_info,
+                           sizeof(rfc5869_info), sha256_okm,
+                           sizeof(sha256_okm)) == 0);
+  CU_ASSERT(memcmp(sha256_okm, rfc5869_okm_1, sizeof(sha256_okm)) == 0);
+  CU_ASSERT(memcmp(expected, rfc5869_okm_1, sizeof(rfc5869_okm_1)) != 0);
+}
+
+//----------------------------------------------------------------------------
+// test_kdf_derive_keys_limits()
+//----------------------------------------------------------------------------
+void test_kdf_derive_keys_limits(void)
+{
+  kdf_params params = { 0 };
+  unsigned char *keys[KDF_MAX_KEYS + 1] = { NULL };
+  size_t key_lens[KDF_MAX_KEYS + 1];
+
+  CU_ASSERT_FATAL(kdf_params_init(&params, KDF_HASH_SHA256, NULL, 0, NULL,
+                                  0) == 0);
+
+  // Check that exactly 255 hash blocks can be derived, but no more
+  size_t max_key[] = { 255 * 32 };
+  size_t too_long_key[] = { 255 * 32 + 1 };
+  size_t too_long_keys[] = { 255 * 16, 255 * 16 + 1 };
+
+  CU_ASSERT(kdf_derive_keys(&params, rfc5869_ikm, sizeof(rfc5869_ikm), 1,
+                            max_key, keys) == 0);
+  CU_ASSERT(keys[0] != NULL);
+  free_keys(keys, max_key, 1);
+  CU_ASSERT(kdf_derive_keys(&params, rfc5869_ikm, sizeof(rfc5869_ikm), 1,
+                            too_long_key, keys) == 1);
+  CU_ASSERT(keys[0] == NULL);
+  CU_ASSERT(kdf_derive_keys(&params, rfc5869_ikm, sizeof(rfc5869_ikm), 2,
+                            too_long_keys, keys) == 1);
+  CU_ASSERT(keys[0] == NULL && keys[1] == NULL);
+
+  // Check that up to KDF_MAX_KEYS keys can be derived, but no more
+  for (size_t i = 0; i <= KDF_MAX_KEYS; i++)
+  {
+    key_lens[i] = 16;
+  }
+  CU_ASSERT(kdf_derive_keys(&params, rfc5869_ikm, sizeof(rfc5869_ikm),
+                            KDF_MAX_KEYS, key_lens, keys) == 0);
+  for (size_t i = 0; i < KDF_MAX_KEYS; i++)
+  {
+    CU_ASSERT(keys[i] != NULL);
+  }
+  free_keys(keys, key_lens, KDF_MAX_KEYS);
+  CU_ASSERT(kdf_derive_keys(&params, rfc5869_ikm, sizeof(rfc5869_ikm),
+                            KDF_MAX_KEYS + 1, key_lens, keys) == 1);
+
+  // Check that no keys, an empty key, or a missing secret is rejected
+  key_lens[1] = 0;
+  CU_ASSERT(kdf_derive_keys(&params, rfc5869_ikm, sizeof(rfc5869_ikm), 2,
+                            key_lens, keys) == 1);
+  CU_ASSERT(keys[0] == NULL);
+  CU_ASSERT(kdf_derive_keys(&params, rfc5869_ikm, sizeof(rfc5869_ikm), 0,
+                            key_lens, keys) == 1);
+  CU_ASSERT(kdf_derive_keys(&params, NULL, 0, 1, key_lens, keys) == 1);
+  CU_ASSERT(kdf_derive_keys(&params, rfc5869_ikm, 0, 1, key_lens, keys) ==
+            1);
+  CU_ASSERT(kdf_derive_keys(NULL, rfc5869_ikm, sizeof(rfc5869_ikm), 1,
+                            key_lens, keys) == 1);
+}
@@ -0,0 +1,116 @@
+//############################################################################
+// random_pool_test.c
+//
+// Tests for the kmyth per-thread random pool in src/cipher/random_pool.c
+//############################################################################
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <CUnit/CUnit.h>
+
+#include "random_pool_test.h"
+#include "random_pool.h"
+
+//----------------------------------------------------------------------------
+// random_pool_add_tests()
+//----------------------------------------------------------------------------
+int random_pool_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "random_pool_bytes() Tests",
+                          test_random_pool_bytes))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "random_pool_bytes() Fork Tests",
+                          test_random_pool_fork))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_random_pool_bytes()
+//----------------------------------------------------------------------------
+void test_random_pool_bytes(void)
+{
+  // enough 16-byte values to span several pool blocks
+  size_t count = 3 * RANDOM_POOL_BLOCK_LEN / 16;
+  unsigned char values[count][16];
+
+  random_pool_discard();
+  for (size_t i = 0; i < count; i++)
+  {
+    CU_ASSERT(random_pool_bytes(values[i], 16) == 0);
+  }
+  for (size_t i = 1; i < count; i++)
+  {
+    CU_ASSERT(memcmp(values[i - 1], values[i], 16) != 0);
+  }
+
+  // requests too large for the pool, and ones that do not divide the block
+  // evenly, are served too
+  unsigned char large[RANDOM_POOL_MAX_REQUEST + 1] = { 0 };
+  unsigned char zero[RANDOM_POOL_MAX_REQUEST + 1] = { 0 };
+
+  CU_ASSERT(random_pool_bytes(large, sizeof(large)) == 0);
+  CU_ASSERT(memcmp(large, zero, sizeof(large)) != 0);
+  for (size_t i = 0; i < count; i++)
+  {
+    CU_ASSERT(random_pool_bytes(large, 37) == 0);
+  }
+
+  // an empty request succeeds without touching the buffer, a NULL buffer
+  // is an error
+  CU_ASSERT(random_pool_bytes(NULL, 0) == 0);
+  CU_ASSERT(random_pool_bytes(NULL, 16) == 1);
+
+  random_pool_discard();
+  random_pool_discard();
+}
+
+//----------------------------------------------------------------------------
+// test_random_pool_fork()
+//----------------------------------------------------------------------------
+void test_random_pool_fork(void)
+{
+  int pipe_fds[2];
+  unsigned char parent_value[32];
+  unsigned char child_value[32];
+
+  // fill the pool, so that the child inherits a partly used block
+  random_pool_discard();
+  CU_ASSERT(random_pool_bytes(parent_value, 16) == 0);
+
+  CU_ASSERT_FATAL(pipe(pipe_fds) == 0);
+
+  pid_t pid = fork();
+
+  CU_ASSERT_FATAL(pid >= 0);
+  if (pid == 0)
+  {
+    close(pipe_fds[0]);
+    if (random_pool_bytes(child_value, sizeof(child_value))
+        || write(pipe_fds[1], child_value, sizeof(child_value))
+        != sizeof(child_value))
+    {
+      _exit(1);
+    }
+    _exit(0);
+  }
+  close(pipe_fds[1]);
+
+  int status = 0;
+
+  CU_ASSERT(random_pool_bytes(parent_value, sizeof(parent_value)) == 0);
+  CU_ASSERT(read(pipe_fds[0], child_value, sizeof(child_value))
+            == sizeof(child_value));
+  close(pipe_fds[0]);
+  CU_ASSERT(waitpid(pid, &status, 0) == pid);
+  CU_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  CU_ASSERT(memcmp(parent_value, child_value, sizeof(child_value)) != 0);
+}
@@ -5,25 +5,60 @@
  * Incorporates the following test suites:
  *   - File I/O Utility (tests in util/file_io_test.c)
  *   - TLS Utility (tests in util/tls_util_test.c)
+ *
+ * By default the suites are run one after another, in this process. With
+ * -j, they are run in parallel, each in a process of its own, and with -s
+ * each suite using the TPM is given a TPM simulator (swtpm) of its own, so
+ * that those suites neither share nor wait for one TPM.
  */
 
+#include <dirent.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
 #include <CUnit/CUnit.h>
 #include <CUnit/Basic.h>
 
+#include "defines.h"
+
 #include "file_io_test.h"
 #include "memory_util_test.h"
+#include "base64_codec_test.h"
+#include "byte_builder_test.h"
+#include "secret_cache_test.h"
+#include "timing_util_test.h"
+#include "kmyth_log_test.h"
+#include "kmyth_metrics_test.h"
+#include "config_file_test.h"
+#include "cpu_features_test.h"
+#include "batch_io_test.h"
+#include "compression_test.h"
 #include "object_tools_test.h"
 #include "formatting_tools_test.h"
 #include "tls_util_test.h"
+#include "socket_util_test.h"
+#include "unsealerd_util_test.h"
+#include "nsl_util_test.h"
 #include "aes_gcm_test.h"
 #include "aes_keywrap_test.h"
+#include "random_pool_test.h"
+#include "kdf_util_test.h"
 #include "tpm2_interface_test.h"
 #include "storage_key_tools_test.h"
 #include "pcrs_test.h"
+#include "sk_pool_test.h"
+#include "tpm2_trace_test.h"
+#include "ski_store_test.h"
 #include "kmyth_seal_unseal_impl_test.h"
+#include "kmyth_hpp_test.h"
 #include "cipher_test.h"
 
 /**
@@ -39,11 +74,372 @@ int clean_suite(void)
   return 0;
 }
 
+/**
+ * Environment variable naming the swtpm executable (default: "swtpm")
+ */
+#define KMYTH_TEST_SWTPM_ENV "KMYTH_TEST_SWTPM"
+
+/**
+ * Environment variable giving the first TCP port used by the swtpm
+ * instances: suite i uses (port + 2 * i) and, for its control channel,
+ * (port + 2 * i + 1)
+ */
+#define KMYTH_TEST_SWTPM_PORT_ENV "KMYTH_TEST_SWTPM_PORT"
+#define KMYTH_TEST_SWTPM_PORT 24321
+
+/**
+ * Names of the suites that use the TPM
+ */
+static const char *const tpm_suite_names[] = {
+  "Storage Key Tools Test Suite",
+  "TPM2 Interface Test Suite",
+  "PCRs Test Suite",
+  "C++ Wrapper Test Suite",
+  NULL
+};
+
+static void usage(const char *prog)
+{
+  fprintf(stdout,
+          "\nusage: %s [options]\n\n"
+          "options are:\n\n"
+          "  -j or --jobs     Number of test suites run at once, each in its own process.\n"
+          "                   Defaults to 1 (every suite run in this process).\n"
+          "  -s or --swtpm    Give each suite using the TPM its own TPM simulator, started\n"
+          "                   with $" KMYTH_TEST_SWTPM_ENV " (default: swtpm) on a port from\n"
+          "                   $" KMYTH_TEST_SWTPM_PORT_ENV " (default: %d) on.\n"
+          "  -h or --help     Help (displays this usage).\n\n", prog,
+          KMYTH_TEST_SWTPM_PORT);
+}
+
+//----------------------------------------------------------------------------
+// is_tpm_suite()
+//----------------------------------------------------------------------------
+static bool is_tpm_suite(CU_pSuite suite)
+{
+  for (int i = 0; tpm_suite_names[i] != NULL; i++)
+  {
+    if (strcmp(suite->pName, tpm_suite_names[i]) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+//----------------------------------------------------------------------------
+// remove_swtpm_state()
+//----------------------------------------------------------------------------
+static void remove_swtpm_state(const char *state_dir)
+{
+  DIR *dir = opendir(state_dir);
+
+  if (dir != NULL)
+  {
+    struct dirent *entry = NULL;
+    char path[512];
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+      if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+      {
+        snprintf(path, sizeof(path), "%s/%s", state_dir, entry->d_name);
+        unlink(path);
+      }
+    }
+    closedir(dir);
+  }
+  rmdir(state_dir);
+}
+
+//----------------------------------------------------------------------------
+// start_swtpm() - starts a TPM simulator, with its state in state_dir, and
+//                 waits for it to accept connections
+//----------------------------------------------------------------------------
+static pid_t start_swtpm(int port, char *state_dir)
+{
+  const char *swtpm = getenv(KMYTH_TEST_SWTPM_ENV);
+  char server[64];
+  char ctrl[64];
+  char state[512];
+
+  if (swtpm == NULL)
+  {
+    swtpm = "swtpm";
+  }
+  if (mkdtemp(state_dir) == NULL)
+  {
+    return -1;
+  }
+  snprintf(server, sizeof(server), "type=tcp,port=%d", port);
+  snprintf(ctrl, sizeof(ctrl), "type=tcp,port=%d", port + 1);
+  snprintf(state, sizeof(state), "dir=%s", state_dir);
+
+  pid_t pid = fork();
+
+  if (pid == 0)
+  {
+    execlp(swtpm, swtpm, "socket", "--tpm2", "--server", server, "--ctrl",
+           ctrl, "--tpmstate", state, "--flags",
+           "not-need-init,startup-clear", (char *) NULL);
+    _exit(127);
+  }
+  if (pid < 0)
+  {
+    remove_swtpm_state(state_dir);
+    return -1;
+  }
+
+  // the simulator is ready once it accepts connections (about 5 seconds
+  // are allowed)
+  struct sockaddr_in addr = {.sin_family = AF_INET,
+    .sin_port = htons((uint16_t) port),
+    .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+  };
+
+  for (int attempt = 0; attempt < 100; attempt++)
+  {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int connected = (fd >= 0)
+      && connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0;
+
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+    if (connected)
+    {
+      return pid;
+    }
+    if (waitpid(pid, NULL, WNOHANG) == pid)
+    {
+      remove_swtpm_state(state_dir);
+      return -1;
+    }
+    usleep(50000);
+  }
+
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+  remove_swtpm_state(state_dir);
+  return -1;
+}
+
+//----------------------------------------------------------------------------
+// run_suite_process() - runs one suite (in a process of its own), against
+//                       its own TPM simulator if asked to
+//----------------------------------------------------------------------------
+static int run_suite_process(CU_pSuite suite, int index, bool use_swtpm)
+{
+  char state_dir[] = "/tmp/kmyth-test-swtpm-XXXXXX";
+  pid_t swtpm = 0;
+
+  if (use_swtpm && is_tpm_suite(suite))
+  {
+    const char *base = getenv(KMYTH_TEST_SWTPM_PORT_ENV);
+    int port = (base == NULL) ? KMYTH_TEST_SWTPM_PORT : atoi(base);
+    char tcti[64];
+
+    port += 2 * index;
+    swtpm = start_swtpm(port, state_dir);
+    if (swtpm < 0)
+    {
+      printf("unable to start a TPM simulator for %s\n", suite->pName);
+      return 1;
+    }
+
+    // the suite's TPM connections go to its simulator, and the SRK handle
+    // it finds there is not recorded for other suites (or kmyth) to use
+    snprintf(tcti, sizeof(tcti), "swtpm:host=127.0.0.1,port=%d", port);
+    setenv(KMYTH_TCTI_ENV, tcti, 1);
+    setenv(KMYTH_SRK_STATE_FILE_ENV, "", 1);
+  }
+
+  CU_ErrorCode result = CU_basic_run_suite(suite);
+  int failures = (int) CU_get_number_of_failures();
+
+  if (swtpm > 0)
+  {
+    kill(swtpm, SIGTERM);
+    waitpid(swtpm, NULL, 0);
+    remove_swtpm_state(state_dir);
+  }
+
+  return (result != CUE_SUCCESS || failures > 0) ? 1 : 0;
+}
+
+//----------------------------------------------------------------------------
+// run_suites_parallel() - runs every registered suite in a process of its
+//                         own, at most jobs at a time, printing the output
+//                         of each as it finishes
+//----------------------------------------------------------------------------
+static int run_suites_parallel(int jobs, bool use_swtpm)
+{
+  size_t suite_count = 0;
+
+  for (CU_pSuite suite = CU_get_registry()->pSuite; suite != NULL;
+       suite = suite->pNext)
+  {
+    suite_count++;
+  }
+
+  pid_t *pids = calloc(suite_count, sizeof(pid_t));
+  FILE **outputs = calloc(suite_count, sizeof(FILE *));
+  CU_pSuite *suites = calloc(suite_count, sizeof(CU_pSuite));
+
+  if (pids == NULL || outputs == NULL || suites == NULL)
+  {
+    free(pids);
+    free(outputs);
+    free(suites);
+    return 1;
+  }
+
+  size_t next = 0;
+
+  for (CU_pSuite suite = CU_get_registry()->pSuite; suite != NULL;
+       suite = suite->pNext)
+  {
+    suites[next++] = suite;
+  }
+
+  size_t started = 0;
+  size_t finished = 0;
+  size_t failed = 0;
+  int running = 0;
+
+  while (finished < suite_count)
+  {
+    // start suites while there are free job slots
+    while (started < suite_count && running < jobs)
+    {
+      outputs[started] = tmpfile();
+      fflush(stdout);
+
+      pid_t pid = (outputs[started] == NULL) ? -1 : fork();
+
+      if (pid == 0)
+      {
+        // the suite's output is collected, so suites' outputs do not mix
+        dup2(fileno(outputs[started]), STDOUT_FILENO);
+        int result = run_suite_process(suites[started], (int) started,
+                                       use_swtpm);
+
+        fflush(stdout);
+        _exit(result);
+      }
+      if (pid < 0)
+      {
+        printf("unable to start %s\n", suites[started]->pName);
+        failed++;
+        finished++;
+      }
+      else
+      {
+        running++;
+      }
+      pids[started++] = pid;
+    }
+
+    if (running == 0)
+    {
+      continue;
+    }
+
+    int status = 0;
+    pid_t pid = wait(&status);
+
+    if (pid < 0)
+    {
+      break;
+    }
+    for (size_t i = 0; i < started; i++)
+    {
+      if (pids[i] != pid)
+      {
+        continue;
+      }
+
+      // print the suite's output, then its result
+      char buffer[4096];
+      size_t len = 0;
+
+      rewind(outputs[i]);
+      while ((len = fread(buffer, 1, sizeof(buffer), outputs[i])) > 0)
+      {
+        fwrite(buffer, 1, len, stdout);
+      }
+
+      bool passed = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+      printf("\n%s: %s\n", suites[i]->pName, passed ? "passed" : "FAILED");
+      if (!passed)
+      {
+        failed++;
+      }
+      running--;
+      finished++;
+    }
+  }
+
+  for (size_t i = 0; i < suite_count; i++)
+  {
+    if (outputs[i] != NULL)
+    {
+      fclose(outputs[i]);
+    }
+  }
+  free(pids);
+  free(outputs);
+  free(suites);
+
+  printf("\n%zu of %zu suites failed\n", failed, suite_count);
+
+  return (failed > 0) ? 1 : 0;
+}
+
 //----------------------------------------------------------------------------
 // main() - kmyth unit test suites created, populated, and run here
 //----------------------------------------------------------------------------
 int main(int argc, char **argv)
 {
+  int jobs = 1;
+  bool use_swtpm = false;
+
+  const struct option longopts[] = {
+    {"jobs", required_argument, 0, 'j'},
+    {"swtpm", no_argument, 0, 's'},
+    {"help", no_argument, 0, 'h'},
+    {0, 0, 0, 0}
+  };
+
+  int options;
+  int option_index;
+
+  while ((options = getopt_long(argc, argv, "j:sh", longopts,
+                                &option_index)) != -1)
+  {
+    switch (options)
+    {
+    case 'j':
+      jobs = atoi(optarg);
+      if (jobs < 1)
+      {
+        fprintf(stderr, "invalid number of jobs (%s)\n", optarg);
+        return 1;
+      }
+      break;
+    case 's':
+      use_swtpm = true;
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      return 1;
+    }
+  }
+
   // Initialize CUnit test registry
   if (CUE_SUCCESS != CU_initialize_registry())
   {
@@ -82,6 +478,166 @@ int main(int argc, char **argv)
     return CU_get_error();
   }
 
+  // Create and configure kmyth base64 codec test suite
+  CU_pSuite base64_codec_test_suite = NULL;
+
+  base64_codec_test_suite = CU_add_suite("Base64 Codec Test Suite",
+                                         init_suite, clean_suite);
+  if (NULL == base64_codec_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (base64_codec_add_tests(base64_codec_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure kmyth byte builder test suite
+  CU_pSuite byte_builder_test_suite = NULL;
+
+  byte_builder_test_suite = CU_add_suite("Byte Builder Test Suite",
+                                         init_suite, clean_suite);
+  if (NULL == byte_builder_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (byte_builder_add_tests(byte_builder_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure kmyth secret cache test suite
+  CU_pSuite secret_cache_test_suite = NULL;
+
+  secret_cache_test_suite = CU_add_suite("Secret Cache Test Suite",
+                                         init_suite, clean_suite);
+  if (NULL == secret_cache_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (secret_cache_add_tests(secret_cache_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure kmyth phase timing test suite
+  CU_pSuite timing_util_test_suite = NULL;
+
+  timing_util_test_suite = CU_add_suite("Timing Utility Test Suite",
+                                        init_suite, clean_suite);
+  if (NULL == timing_util_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (timing_util_add_tests(timing_util_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure kmyth logging test suite
+  CU_pSuite kmyth_log_test_suite = NULL;
+
+  kmyth_log_test_suite = CU_add_suite("Logger Test Suite", init_suite,
+                                      clean_suite);
+  if (NULL == kmyth_log_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (kmyth_log_add_tests(kmyth_log_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure kmyth metrics test suite
+  CU_pSuite kmyth_metrics_test_suite = NULL;
+
+  kmyth_metrics_test_suite = CU_add_suite("Metrics Test Suite", init_suite,
+                                          clean_suite);
+  if (NULL == kmyth_metrics_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (kmyth_metrics_add_tests(kmyth_metrics_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure kmyth configuration file test suite
+  CU_pSuite config_file_test_suite = NULL;
+
+  config_file_test_suite = CU_add_suite("Configuration File Test Suite",
+                                        init_suite, clean_suite);
+  if (NULL == config_file_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (config_file_add_tests(config_file_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure kmyth CPU feature detection test suite
+  CU_pSuite cpu_features_test_suite = NULL;
+
+  cpu_features_test_suite = CU_add_suite("CPU Feature Detection Test Suite",
+                                         init_suite, clean_suite);
+  if (NULL == cpu_features_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (cpu_features_add_tests(cpu_features_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure kmyth batch file I/O test suite
+  CU_pSuite batch_io_test_suite = NULL;
+
+  batch_io_test_suite = CU_add_suite("Batch File I/O Test Suite",
+                                     init_suite, clean_suite);
+  if (NULL == batch_io_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (batch_io_add_tests(batch_io_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure kmyth compression test suite
+  CU_pSuite compression_test_suite = NULL;
+
+  compression_test_suite = CU_add_suite("Compression Test Suite",
+                                        init_suite, clean_suite);
+  if (NULL == compression_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (compression_add_tests(compression_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
   // Create and configure storage key tools test suite
   CU_pSuite storage_key_tools_test_suite = NULL;
 
@@ -147,6 +703,55 @@ int main(int argc, char **argv)
     return CU_get_error();
   }
 
+  // Create and configure socket utility test suite
+  CU_pSuite socket_utility_test_suite = NULL;
+
+  socket_utility_test_suite = CU_add_suite("Socket Utility Test Suite",
+                                           init_suite, clean_suite);
+  if (NULL == socket_utility_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (socket_util_add_tests(socket_utility_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure kmyth-unsealerd protocol test suite
+  CU_pSuite unsealerd_util_test_suite = NULL;
+
+  unsealerd_util_test_suite =
+    CU_add_suite("kmyth-unsealerd Protocol Test Suite", init_suite,
+                 clean_suite);
+  if (NULL == unsealerd_util_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (unsealerd_util_add_tests(unsealerd_util_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure NSL protocol test suite
+  CU_pSuite nsl_util_test_suite = NULL;
+
+  nsl_util_test_suite = CU_add_suite("NSL Protocol Test Suite", init_suite,
+                                     clean_suite);
+  if (NULL == nsl_util_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (nsl_util_add_tests(nsl_util_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
   // Create and configure the AES/GCM cipher test suite
   CU_pSuite aes_gcm_test_suite = NULL;
 
@@ -179,6 +784,38 @@ int main(int argc, char **argv)
     return CU_get_error();
   }
 
+  // Create and configure the random pool test suite
+  CU_pSuite random_pool_test_suite = NULL;
+
+  random_pool_test_suite = CU_add_suite("Random Pool Test Suite",
+                                        init_suite, clean_suite);
+  if (NULL == random_pool_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (random_pool_add_tests(random_pool_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure the KDF test suite
+  CU_pSuite kdf_util_test_suite = NULL;
+
+  kdf_util_test_suite = CU_add_suite("KDF Utility Test Suite",
+                                     init_suite, clean_suite);
+  if (NULL == kdf_util_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (kdf_util_add_tests(kdf_util_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
   // Create and configure the tpm2 interface test suite
   CU_pSuite tpm2_interface_test_suite = NULL;
 
@@ -210,6 +847,54 @@ int main(int argc, char **argv)
     return CU_get_error();
   }
 
+  // Create and configure storage key pool test suite
+  CU_pSuite sk_pool_test_suite = NULL;
+
+  sk_pool_test_suite = CU_add_suite("Storage Key Pool Test Suite", init_suite,
+                                    clean_suite);
+  if (NULL == sk_pool_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (sk_pool_add_tests(sk_pool_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure TPM command trace test suite
+  CU_pSuite tpm2_trace_test_suite = NULL;
+
+  tpm2_trace_test_suite = CU_add_suite("TPM Command Trace Test Suite",
+                                       init_suite, clean_suite);
+  if (NULL == tpm2_trace_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (tpm2_trace_add_tests(tpm2_trace_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure content-addressed .ski store test suite
+  CU_pSuite ski_store_test_suite = NULL;
+
+  ski_store_test_suite = CU_add_suite("Content-Addressed .ski Store Test Suite",
+                                      init_suite, clean_suite);
+  if (NULL == ski_store_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (ski_store_add_tests(ski_store_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
   // Create and configure cipher utility test suite
   CU_pSuite cipher_test_suite = NULL;
 
@@ -226,7 +911,32 @@ int main(int argc, char **argv)
     return CU_get_error();
   }
 
-  // Run tests using basic interface
+  // Create and configure C++ wrapper (kmyth.hpp) test suite
+  CU_pSuite kmyth_hpp_test_suite = NULL;
+
+  kmyth_hpp_test_suite = CU_add_suite("C++ Wrapper Test Suite", init_suite,
+                                      clean_suite);
+  if (NULL == kmyth_hpp_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (kmyth_hpp_add_tests(kmyth_hpp_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Run the suites in parallel processes, or else one after another using
+  // the basic interface
+  if (jobs > 1 || use_swtpm)
+  {
+    int result = run_suites_parallel(jobs, use_swtpm);
+
+    CU_cleanup_registry();
+    return result;
+  }
+
   CU_basic_run_tests();
 
   CU_cleanup_registry();
@@ -0,0 +1,123 @@
+//############################################################################
+// socket_util_test.c
+//
+// Tests for socket utility functions in tpm2/src/network/socket_util.c
+//############################################################################
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <CUnit/CUnit.h>
+
+#include "socket_util_test.h"
+#include "socket_util.h"
+
+//----------------------------------------------------------------------------
+// socket_util_add_tests()
+//----------------------------------------------------------------------------
+int socket_util_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "setup_unix_*_socket() Tests",
+                          test_setup_unix_socket))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "get_peer_credentials() Tests",
+                          test_get_peer_credentials))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_setup_unix_socket()
+//----------------------------------------------------------------------------
+void test_setup_unix_socket(void)
+{
+  char dir[] = "/tmp/kmyth-socket-test-XXXXXX";
+  char path[64] = { 0 };
+  struct stat st = { 0 };
+  int server_fd = -1;
+  int client_fd = -1;
+
+  CU_ASSERT_FATAL(mkdtemp(dir) != NULL);
+  snprintf(path, sizeof(path), "%s/sock", dir);
+
+  // Check that a client cannot connect before there is a server
+  CU_ASSERT(setup_unix_client_socket(path, &client_fd) == 1);
+  CU_ASSERT(client_fd == -1);
+
+  // Check that the socket file is created with the requested mode, and
+  // that a client can connect to it
+  CU_ASSERT(setup_unix_server_socket(path, 0600, &server_fd) == 0);
+  CU_ASSERT(server_fd >= 0);
+  CU_ASSERT(lstat(path, &st) == 0);
+  CU_ASSERT(S_ISSOCK(st.st_mode));
+  CU_ASSERT((st.st_mode & 0777) == 0600);
+  CU_ASSERT(setup_unix_client_socket(path, &client_fd) == 0);
+  CU_ASSERT(client_fd >= 0);
+  close(client_fd);
+  close(server_fd);
+
+  // Check that a stale socket left at the path is replaced
+  CU_ASSERT(setup_unix_server_socket(path, 0660, &server_fd) == 0);
+  CU_ASSERT(lstat(path, &st) == 0);
+  CU_ASSERT((st.st_mode & 0777) == 0660);
+  close(server_fd);
+  unlink(path);
+
+  // Check that any other file at the path is left alone
+  int fd = open(path, O_CREAT | O_WRONLY, 0600);
+
+  CU_ASSERT(fd >= 0);
+  close(fd);
+  CU_ASSERT(setup_unix_server_socket(path, 0600, &server_fd) == 1);
+  CU_ASSERT(server_fd == -1);
+  CU_ASSERT(lstat(path, &st) == 0);
+  CU_ASSERT(S_ISREG(st.st_mode));
+  unlink(path);
+
+  // Check that a path too long for a socket address is rejected
+  char long_path[256];
+
+  memset(long_path, 'a', sizeof(long_path) - 1);
+  long_path[sizeof(long_path) - 1] = '\0';
+  CU_ASSERT(setup_unix_server_socket(long_path, 0600, &server_fd) == 1);
+  CU_ASSERT(setup_unix_client_socket(long_path, &client_fd) == 1);
+  CU_ASSERT(setup_unix_client_socket(NULL, &client_fd) == 1);
+
+  rmdir(dir);
+}
+
+//----------------------------------------------------------------------------
+// test_get_peer_credentials()
+//----------------------------------------------------------------------------
+void test_get_peer_credentials(void)
+{
+  int fds[2] = { -1, -1 };
+  uid_t uid = (uid_t) - 1;
+  gid_t gid = (gid_t) - 1;
+  pid_t pid = -1;
+
+  // Check that the peer of a connected local socket is this process
+  CU_ASSERT_FATAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  CU_ASSERT(get_peer_credentials(fds[0], &uid, &gid, &pid) == 0);
+  CU_ASSERT(uid == geteuid());
+  CU_ASSERT(gid == getegid());
+  CU_ASSERT(pid == getpid());
+  close(fds[0]);
+  close(fds[1]);
+
+  // Check that a descriptor that is not a socket is rejected
+  CU_ASSERT_FATAL(pipe(fds) == 0);
+  CU_ASSERT(get_peer_credentials(fds[0], &uid, &gid, &pid) == 1);
+  close(fds[0]);
+  close(fds[1]);
+}
@@ -6,10 +6,23 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <CUnit/CUnit.h>
+#include <kmip/kmip.h>
+#include <openssl/ec.h>
+#include <openssl/pem.h>
 #include <openssl/ssl.h>
+#include <openssl/x509.h>
 
 #include "tls_util_test.h"
+#include "defines.h"
+#include "kmip_util.h"
 #include "tls_util.h"
 
 //----------------------------------------------------------------------------
@@ -29,6 +42,17 @@ int tls_util_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "tls_client Tests", test_tls_client))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "tls_client session reuse Tests",
+                          test_tls_client_session_reuse))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "get_key_from_tls_server() Tests",
                           test_get_key_from_tls_server))
   {
@@ -41,6 +65,34 @@ int tls_util_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "get_keys_from_kmip_server() Tests",
+                          test_get_keys_from_kmip_server))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "KMIP batch Get round trip Tests",
+                          test_kmip_get_batch_round_trip))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "KMIP encoding buffer reuse Tests",
+                          test_kmip_encoding_buffer_reuse))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "kmip_pool Tests", test_kmip_pool))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "tls_async Tests", test_tls_async))
+  {
+    return 1;
+  }
+
   return 0;
 }
 
@@ -131,6 +183,369 @@ void test_tls_set_context(void)
   free(non_null_ptr);
 }
 
+//----------------------------------------------------------------------------
+// test_tls_client()
+//----------------------------------------------------------------------------
+void test_tls_client(void)
+{
+  char *non_null_ptr = malloc(1);
+  tls_client *client = (tls_client *) non_null_ptr;
+  BIO *bio = NULL;
+
+  // A null client variable should produce an error
+  CU_ASSERT(tls_client_new((unsigned char *) non_null_ptr, 1, non_null_ptr,
+                           non_null_ptr, NULL, (tls_client **) NULL) == 1);
+
+  // An invalid TLS context configuration should produce an error, and
+  // leave the client variable NULL
+  CU_ASSERT(tls_client_new((unsigned char *) NULL, 1, non_null_ptr,
+                           non_null_ptr, NULL, &client) == 1);
+  CU_ASSERT(client == NULL);
+  CU_ASSERT(tls_client_new((unsigned char *) non_null_ptr, 0, non_null_ptr,
+                           non_null_ptr, NULL, &client) == 1);
+  CU_ASSERT(client == NULL);
+
+  // A null client, server or BIO variable should produce an error
+  CU_ASSERT(tls_client_connect(NULL, "127.0.0.1", "7000", &bio) == 1);
+  CU_ASSERT(tls_client_connect((tls_client *) non_null_ptr, NULL, "7000",
+                               &bio) == 1);
+  CU_ASSERT(tls_client_connect((tls_client *) non_null_ptr, "127.0.0.1",
+                               NULL, &bio) == 1);
+  CU_ASSERT(tls_client_connect((tls_client *) non_null_ptr, "127.0.0.1",
+                               "7000", (BIO **) NULL) == 1);
+  CU_ASSERT(bio == NULL);
+
+  // No servers, too many servers, or a null server should produce an error
+  const char *server_ips[KMYTH_MAX_SERVER_ENDPOINTS + 1] = { "127.0.0.1" };
+  const char *server_ports[KMYTH_MAX_SERVER_ENDPOINTS + 1] = { "7000" };
+  size_t server_index = 0;
+
+  CU_ASSERT(tls_client_connect_any((tls_client *) non_null_ptr, server_ips,
+                                   server_ports, 0, &bio, &server_index) == 1);
+  CU_ASSERT(tls_client_connect_any((tls_client *) non_null_ptr, server_ips,
+                                   server_ports,
+                                   KMYTH_MAX_SERVER_ENDPOINTS + 1,
+                                   &bio, &server_index) == 1);
+  CU_ASSERT(tls_client_connect_any((tls_client *) non_null_ptr, server_ips,
+                                   server_ports, 2, &bio, &server_index) == 1);
+  CU_ASSERT(tls_client_connect_any((tls_client *) non_null_ptr, server_ips,
+                                   server_ports, 1, &bio,
+                                   (size_t *) NULL) == 1);
+  CU_ASSERT(bio == NULL);
+
+  // A null client or a non-positive timeout should produce an error
+  CU_ASSERT(tls_client_set_timeouts(NULL, 1000, 1000) == 1);
+  CU_ASSERT(tls_client_set_timeouts((tls_client *) non_null_ptr, 0,
+                                    1000) == 1);
+  CU_ASSERT(tls_client_set_timeouts((tls_client *) non_null_ptr, 1000,
+                                    -1) == 1);
+
+  // A null client should produce an error when setting kTLS
+  CU_ASSERT(tls_client_set_ktls(NULL, true) == 1);
+  CU_ASSERT(tls_client_set_ktls(NULL, false) == 1);
+
+  // Disconnecting or releasing a null client should be harmless
+  tls_client_disconnect(NULL);
+  tls_client_free(NULL);
+  tls_client_free(&client);
+  CU_ASSERT(client == NULL);
+
+  free(non_null_ptr);
+}
+
+//----------------------------------------------------------------------------
+// write_test_credentials(): writes a new EC private key (PEM) and a
+//                           self-signed certificate for it to the given paths
+//----------------------------------------------------------------------------
+static int write_test_credentials(const char *key_path, const char *cert_path)
+{
+  EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+  EVP_PKEY *pkey = NULL;
+  X509 *cert = X509_new();
+  FILE *fp = NULL;
+  int result = 1;
+
+  if (pctx == NULL || cert == NULL
+      || EVP_PKEY_keygen_init(pctx) != 1
+      || EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx,
+                                                NID_X9_62_prime256v1) != 1
+      || EVP_PKEY_keygen(pctx, &pkey) != 1)
+  {
+    goto out;
+  }
+
+  X509_NAME *name = X509_get_subject_name(cert);
+
+  if (X509_set_version(cert, 2) != 1
+      || ASN1_INTEGER_set(X509_get_serialNumber(cert), 1) != 1
+      || X509_gmtime_adj(X509_getm_notBefore(cert), 0) == NULL
+      || X509_gmtime_adj(X509_getm_notAfter(cert), 3600) == NULL
+      || X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                                    (const unsigned char *) "localhost",
+                                    -1, -1, 0) != 1
+      || X509_set_issuer_name(cert, name) != 1
+      || X509_set_pubkey(cert, pkey) != 1
+      || X509_sign(cert, pkey, EVP_sha256()) == 0)
+  {
+    goto out;
+  }
+
+  fp = fopen(key_path, "w");
+  if (fp == NULL || PEM_write_PrivateKey(fp, pkey, NULL, NULL, 0, NULL,
+                                         NULL) != 1)
+  {
+    goto out;
+  }
+  fclose(fp);
+  fp = fopen(cert_path, "w");
+  if (fp == NULL || PEM_write_X509(fp, cert) != 1)
+  {
+    goto out;
+  }
+  result = 0;
+
+out:
+  if (fp != NULL)
+  {
+    fclose(fp);
+  }
+  X509_free(cert);
+  EVP_PKEY_free(pkey);
+  EVP_PKEY_CTX_free(pctx);
+  return result;
+}
+
+//----------------------------------------------------------------------------
+// A TLS server for the tls_client tests, on the given port (or any free
+// port, when NULL): it serves
+// the given number of connections, one at a time, echoing back what each
+// sends until the client closes it (or, with close_after_echo, only the
+// first message)
+//----------------------------------------------------------------------------
+typedef struct test_tls_server
+{
+  SSL_CTX *ctx;
+  int listen_fd;
+  char port[8];
+  int conn_count;
+  bool close_after_echo;
+  pthread_t thread;
+} test_tls_server;
+
+static void *test_tls_server_run(void *arg)
+{
+  test_tls_server *server = arg;
+
+  for (int i = 0; i < server->conn_count; i++)
+  {
+    int socket_fd = accept(server->listen_fd, NULL, NULL);
+
+    if (socket_fd == -1)
+    {
+      break;
+    }
+
+    SSL *ssl = SSL_new(server->ctx);
+    unsigned char buf[256];
+    int len = 0;
+
+    SSL_set_fd(ssl, socket_fd);
+    if (SSL_accept(ssl) == 1)
+    {
+      while ((len = SSL_read(ssl, buf, sizeof(buf))) > 0
+             && SSL_write(ssl, buf, len) == len && !server->close_after_echo)
+      {
+      }
+      SSL_shutdown(ssl);
+    }
+    SSL_free(ssl);
+    close(socket_fd);
+  }
+
+  return NULL;
+}
+
+static int test_tls_server_start(test_tls_server * server,
+                                 const char *key_path, const char *cert_path,
+                                 const char *port, bool issue_tickets,
+                                 int conn_count, bool close_after_echo)
+{
+  struct sockaddr_in addr = {.sin_family = AF_INET };
+  socklen_t addr_len = sizeof(addr);
+  int reuse = 1;
+
+  server->conn_count = conn_count;
+  server->close_after_echo = close_after_echo;
+  server->ctx = SSL_CTX_new(TLS_server_method());
+  server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons((port == NULL) ? 0 : atoi(port));
+  if (server->ctx == NULL || server->listen_fd == -1
+      || setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse,
+                    sizeof(reuse))
+      || SSL_CTX_use_PrivateKey_file(server->ctx, key_path,
+                                     SSL_FILETYPE_PEM) != 1
+      || SSL_CTX_use_certificate_file(server->ctx, cert_path,
+                                      SSL_FILETYPE_PEM) != 1
+      || (!issue_tickets && SSL_CTX_set_num_tickets(server->ctx, 0) != 1)
+      || bind(server->listen_fd, (struct sockaddr *) &addr, addr_len)
+      || listen(server->listen_fd, conn_count)
+      || getsockname(server->listen_fd, (struct sockaddr *) &addr,
+                     &addr_len))
+  {
+    return 1;
+  }
+  snprintf(server->port, sizeof(server->port), "%d", ntohs(addr.sin_port));
+
+  return pthread_create(&server->thread, NULL, test_tls_server_run, server);
+}
+
+static void test_tls_server_stop(test_tls_server * server)
+{
+  pthread_join(server->thread, NULL);
+  close(server->listen_fd);
+  SSL_CTX_free(server->ctx);
+}
+
+//----------------------------------------------------------------------------
+// tls_client_echo(): sends a message over a tls_client connection and
+//                    checks that the test server echoes it back (which also
+//                    takes in any session tickets the server has issued)
+//----------------------------------------------------------------------------
+static bool tls_client_echo(BIO * bio)
+{
+  char buf[5] = { 0 };
+
+  return (BIO_write(bio, "ping", 4) == 4 && BIO_flush(bio) == 1
+          && BIO_read(bio, buf, 4) == 4 && strcmp(buf, "ping") == 0);
+}
+
+//----------------------------------------------------------------------------
+// tls_client_resumed(): whether a tls_client connection resumed a session
+//----------------------------------------------------------------------------
+static bool tls_client_resumed(BIO * bio)
+{
+  SSL *ssl = NULL;
+
+  BIO_get_ssl(bio, &ssl);
+  return (ssl != NULL && SSL_session_reused(ssl));
+}
+
+//----------------------------------------------------------------------------
+// test_tls_client_session_reuse()
+//----------------------------------------------------------------------------
+void test_tls_client_session_reuse(void)
+{
+  char dir[] = "/tmp/kmyth_tls_client_test_XXXXXX";
+  char key_path[sizeof(dir) + 16];
+  char cert_path[sizeof(dir) + 16];
+  char cache_path[sizeof(dir) + 16];
+  unsigned char *key = NULL;
+  size_t key_len = 0;
+  test_tls_server server;
+  tls_client *client = NULL;
+  BIO *bio = NULL;
+  BIO *first_bio = NULL;
+  struct stat st;
+
+  CU_ASSERT_FATAL(mkdtemp(dir) != NULL);
+  snprintf(key_path, sizeof(key_path), "%s/key.pem", dir);
+  snprintf(cert_path, sizeof(cert_path), "%s/cert.pem", dir);
+  snprintf(cache_path, sizeof(cache_path), "%s/sessions", dir);
+
+  // the server's self-signed certificate doubles as the client's, and as
+  // the CA certificate each verifies the other with
+  CU_ASSERT_FATAL(write_test_credentials(key_path, cert_path) == 0);
+
+  FILE *fp = fopen(key_path, "r");
+
+  CU_ASSERT_FATAL(fp != NULL);
+  key = calloc(1024, 1);
+  key_len = fread(key, 1, 1024, fp);
+  fclose(fp);
+
+  // The first connection makes a full handshake. It is handed back while
+  // it is still open, and the session the server issued on it is resumed
+  // by the next connection.
+  CU_ASSERT_FATAL(test_tls_server_start(&server, key_path, cert_path, NULL,
+                                        true, 2, false) == 0);
+  CU_ASSERT(tls_client_new(key, key_len, cert_path, cert_path, cache_path,
+                           &client) == 0);
+  CU_ASSERT_FATAL(client != NULL);
+  CU_ASSERT(tls_client_connect(client, "127.0.0.1", server.port, &bio) == 0);
+  CU_ASSERT_FATAL(bio != NULL);
+  CU_ASSERT(!tls_client_resumed(bio));
+  CU_ASSERT(tls_client_echo(bio));
+  first_bio = bio;
+  CU_ASSERT(tls_client_connect(client, "127.0.0.1", server.port, &bio) == 0);
+  CU_ASSERT(bio == first_bio);
+  CU_ASSERT(tls_client_echo(bio));
+
+  tls_client_disconnect(client);
+  CU_ASSERT(tls_client_connect(client, "127.0.0.1", server.port, &bio) == 0);
+  CU_ASSERT(tls_client_resumed(bio));
+  CU_ASSERT(tls_client_echo(bio));
+
+  // Releasing the client saves its sessions, readable by the owner only,
+  // and a new client resumes them
+  tls_client_free(&client);
+  CU_ASSERT(client == NULL);
+  test_tls_server_stop(&server);
+  CU_ASSERT(stat(cache_path, &st) == 0 && (st.st_mode & 0777) == 0600);
+
+  CU_ASSERT_FATAL(test_tls_server_start(&server, key_path, cert_path, NULL,
+                                        true, 2, true) == 0);
+  CU_ASSERT(tls_client_new(key, key_len, cert_path, cert_path, cache_path,
+                           &client) == 0);
+  CU_ASSERT_FATAL(client != NULL);
+
+  // the sessions are keyed on the server address, so another port's are
+  // not offered to this server
+  CU_ASSERT(tls_client_connect(client, "127.0.0.1", server.port, &bio) == 0);
+  CU_ASSERT(!tls_client_resumed(bio));
+
+  // a connection the server has closed is not handed back, but replaced
+  // (resuming the session just issued)
+  CU_ASSERT(tls_client_echo(bio));
+  usleep(100000);
+  CU_ASSERT(tls_client_connect(client, "127.0.0.1", server.port, &bio) == 0);
+  CU_ASSERT(tls_client_resumed(bio));
+  CU_ASSERT(tls_client_echo(bio));
+  tls_client_disconnect(client);
+  test_tls_server_stop(&server);
+
+  // A server with other session ticket keys (e.g., after a restart) does
+  // not resume the cached session, which is then dropped from the cache
+  char port[sizeof(server.port)];
+  char cached[32];
+
+  snprintf(port, sizeof(port), "%s", server.port);
+  snprintf(cached, sizeof(cached), "server 127.0.0.1:%s\n", port);
+  CU_ASSERT_FATAL(test_tls_server_start(&server, key_path, cert_path, port,
+                                        false, 1, false) == 0);
+  CU_ASSERT(tls_client_connect(client, "127.0.0.1", port, &bio) == 0);
+  CU_ASSERT(!tls_client_resumed(bio));
+  CU_ASSERT(tls_client_echo(bio));
+  tls_client_free(&client);
+  test_tls_server_stop(&server);
+
+  char *cache = calloc(8192, 1);
+
+  fp = fopen(cache_path, "r");
+  CU_ASSERT_FATAL(fp != NULL);
+  CU_ASSERT(fread(cache, 1, 8191, fp) > 0);
+  fclose(fp);
+  CU_ASSERT(strstr(cache, "server 127.0.0.1:") != NULL);
+  CU_ASSERT(strstr(cache, cached) == NULL);
+  free(cache);
+
+  free(key);
+  unlink(cache_path);
+  unlink(cert_path);
+  unlink(key_path);
+  rmdir(dir);
+}
+
 //----------------------------------------------------------------------------
 // test_get_key_from_tls_server()
 //----------------------------------------------------------------------------
@@ -146,6 +561,17 @@ void test_get_key_from_tls_server(void)
   CU_ASSERT(get_key_from_tls_server((BIO *) NULL,
                                     message, message_length, &key, &key_size));
 
+  // A key larger than the original 256 byte receive buffer should be
+  // returned whole
+  unsigned char server_key[1024] = { 0 };
+
+  memset(server_key, 0x5a, sizeof(server_key));
+  BIO_write(bio, server_key, sizeof(server_key));
+  CU_ASSERT(get_key_from_tls_server(bio, NULL, 0, &key, &key_size) == 0);
+  CU_ASSERT(key_size == sizeof(server_key));
+  CU_ASSERT(key != NULL && memcmp(key, server_key, key_size) == 0);
+  free(key);
+
   // Cleanup
   BIO_free_all(bio);
 }
@@ -176,6 +602,327 @@ void test_get_key_from_kmip_server(void)
   CU_ASSERT(key == NULL);
   CU_ASSERT(key_size == 0);
 
+  // A response whose TTLV header claims more than the largest accepted
+  // KMIP message should produce an error
+  unsigned char header[KMIP_TTLV_HEADER_SIZE] = { 0x42, 0x00, 0x7b, 0x01,
+    0x7f, 0xff, 0xff, 0xff
+  };
+
+  BIO_write(bio, header, sizeof(header));
+  CU_ASSERT(get_key_from_kmip_server(bio, message, 1, &key, &key_size) == 1);
+  CU_ASSERT(key == NULL);
+
   // Cleanup
   BIO_free_all(bio);
 }
+
+//----------------------------------------------------------------------------
+// test_get_keys_from_kmip_server()
+//----------------------------------------------------------------------------
+void test_get_keys_from_kmip_server(void)
+{
+  BIO *bio = BIO_new(BIO_s_mem());
+  char *key_ids[] = { "1", "2", "" };
+  unsigned char *keys[KMIP_GET_BATCH_MAX_ITEMS + 1] = { 0 };
+  size_t key_sizes[KMIP_GET_BATCH_MAX_ITEMS + 1] = { 0 };
+
+  // A null BIO should produce an error
+  CU_ASSERT(get_keys_from_kmip_server((BIO *) NULL, key_ids, 2,
+                                      keys, key_sizes) == 1);
+
+  // A null or empty key ID list should produce an error
+  CU_ASSERT(get_keys_from_kmip_server(bio, (char **) NULL, 2,
+                                      keys, key_sizes) == 1);
+  CU_ASSERT(get_keys_from_kmip_server(bio, key_ids, 0, keys, key_sizes) == 1);
+
+  // More key IDs than fit in one batch should produce an error
+  CU_ASSERT(get_keys_from_kmip_server(bio, key_ids,
+                                      KMIP_GET_BATCH_MAX_ITEMS + 1,
+                                      keys, key_sizes) == 1);
+
+  // Null output arrays should produce an error
+  CU_ASSERT(get_keys_from_kmip_server(bio, key_ids, 2,
+                                      (unsigned char **) NULL,
+                                      key_sizes) == 1);
+  CU_ASSERT(get_keys_from_kmip_server(bio, key_ids, 2,
+                                      keys, (size_t *) NULL) == 1);
+
+  // An empty key ID should produce an error
+  CU_ASSERT(get_keys_from_kmip_server(bio, key_ids, 3, keys, key_sizes) == 1);
+
+  // No keys should have been returned
+  CU_ASSERT(keys[0] == NULL && keys[1] == NULL);
+
+  // Cleanup
+  BIO_free_all(bio);
+}
+
+//----------------------------------------------------------------------------
+// test_kmip_get_batch_round_trip()
+//----------------------------------------------------------------------------
+void test_kmip_get_batch_round_trip(void)
+{
+  KMIP ctx = { 0 };
+  unsigned char *ids[] = { (unsigned char *) "a", (unsigned char *) "bb",
+    (unsigned char *) "ccc"
+  };
+  size_t id_lens[] = { 1, 2, 3 };
+  unsigned char *request = NULL;
+  size_t request_len = 0;
+  unsigned char *req_ids[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  size_t req_id_lens[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  unsigned char *item_ids[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  size_t item_id_lens[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  size_t count = 0;
+
+  kmip_init(&ctx, NULL, 0, KMIP_2_0);
+
+  // A batched request parses back into its IDs, each tagged with an item ID
+  CU_ASSERT(build_kmip_get_batch_request(&ctx, ids, id_lens, 3,
+                                         &request, &request_len) == 0);
+  CU_ASSERT(parse_kmip_get_batch_request(&ctx, request, request_len,
+                                         req_ids, req_id_lens,
+                                         item_ids, item_id_lens,
+                                         &count) == 0);
+  CU_ASSERT(count == 3);
+  for (size_t i = 0; i < count; i++)
+  {
+    CU_ASSERT(req_id_lens[i] == id_lens[i]);
+    CU_ASSERT(memcmp(req_ids[i], ids[i], id_lens[i]) == 0);
+    CU_ASSERT(item_ids[i] != NULL
+              && item_id_lens[i] == KMIP_GET_BATCH_ITEM_ID_SIZE);
+  }
+
+  // A truncated request should produce an error
+  CU_ASSERT(parse_kmip_get_batch_request(&ctx, request, request_len / 2,
+                                         req_ids, req_id_lens,
+                                         item_ids, item_id_lens,
+                                         &count) == 1);
+  free(request);
+
+  // Answered in reverse order, the keys still map back to their requests
+  unsigned char *resp_ids[] = { req_ids[2], req_ids[1], req_ids[0] };
+  size_t resp_id_lens[] = { req_id_lens[2], req_id_lens[1], req_id_lens[0] };
+  unsigned char *resp_item_ids[] = { item_ids[2], item_ids[1], item_ids[0] };
+  size_t resp_item_id_lens[] = { item_id_lens[2], item_id_lens[1],
+    item_id_lens[0]
+  };
+  unsigned char *resp_keys[] = { (unsigned char *) "key-c",
+    (unsigned char *) "key-b", (unsigned char *) "key-a"
+  };
+  size_t resp_key_lens[] = { 5, 5, 5 };
+  unsigned char *response = NULL;
+  size_t response_len = 0;
+
+  CU_ASSERT(build_kmip_get_batch_response(&ctx, resp_ids, resp_id_lens,
+                                          resp_item_ids, resp_item_id_lens,
+                                          resp_keys, resp_key_lens, 3,
+                                          &response, &response_len) == 0);
+
+  unsigned char *got_ids[3] = { 0 };
+  size_t got_id_lens[3] = { 0 };
+  unsigned char *got_keys[3] = { 0 };
+  size_t got_key_lens[3] = { 0 };
+
+  CU_ASSERT(parse_kmip_get_batch_response(&ctx, response, response_len, 3,
+                                          got_ids, got_id_lens,
+                                          got_keys, got_key_lens) == 0);
+  CU_ASSERT(got_key_lens[0] == 5 && memcmp(got_keys[0], "key-a", 5) == 0);
+  CU_ASSERT(got_key_lens[1] == 5 && memcmp(got_keys[1], "key-b", 5) == 0);
+  CU_ASSERT(got_key_lens[2] == 5 && memcmp(got_keys[2], "key-c", 5) == 0);
+  for (size_t i = 0; i < 3; i++)
+  {
+    CU_ASSERT(got_id_lens[i] == id_lens[i]);
+    CU_ASSERT(memcmp(got_ids[i], ids[i], id_lens[i]) == 0);
+    free(got_ids[i]);
+    free(got_keys[i]);
+    free(req_ids[i]);
+    free(item_ids[i]);
+  }
+
+  // Cleanup
+  free(response);
+  kmip_destroy(&ctx);
+}
+
+//----------------------------------------------------------------------------
+// test_kmip_encoding_buffer_reuse()
+//----------------------------------------------------------------------------
+void test_kmip_encoding_buffer_reuse(void)
+{
+  KMIP ctx = { 0 };
+  kmip_encoding_buffer buffer = { NULL, 0 };
+  size_t count = KMIP_GET_BATCH_MAX_ITEMS;
+  size_t key_len = 4096;
+  unsigned char id[] = "id";
+  unsigned char item_id[KMIP_GET_BATCH_ITEM_ID_SIZE] = { 0 };
+  unsigned char *key = malloc(key_len);
+  unsigned char *ids[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  size_t id_lens[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  unsigned char *item_ids[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  size_t item_id_lens[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  unsigned char *keys[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  size_t key_lens[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  unsigned char *got_ids[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  size_t got_id_lens[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  unsigned char *got_keys[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  size_t got_key_lens[KMIP_GET_BATCH_MAX_ITEMS] = { 0 };
+  size_t response_len = 0;
+
+  CU_ASSERT_FATAL(key != NULL);
+  memset(key, 0x5a, key_len);
+  for (size_t i = 0; i < count; i++)
+  {
+    ids[i] = id;
+    id_lens[i] = 2;
+    item_ids[i] = item_id;
+    item_id_lens[i] = KMIP_GET_BATCH_ITEM_ID_SIZE;
+    keys[i] = key;
+    key_lens[i] = key_len;
+  }
+
+  kmip_init(&ctx, NULL, 0, KMIP_2_0);
+
+  // A large response grows the empty buffer to fit, and parses back
+  CU_ASSERT(build_kmip_get_batch_response_into(&ctx, ids, id_lens,
+                                               item_ids, item_id_lens,
+                                               keys, key_lens, count,
+                                               &buffer, &response_len) == 0);
+  CU_ASSERT(buffer.data != NULL && buffer.size >= response_len);
+  CU_ASSERT(response_len > count * key_len);
+  CU_ASSERT(parse_kmip_get_batch_response(&ctx, buffer.data, response_len,
+                                          count, got_ids, got_id_lens,
+                                          got_keys, got_key_lens) == 0);
+  for (size_t i = 0; i < count; i++)
+  {
+    CU_ASSERT(got_key_lens[i] == key_len
+              && memcmp(got_keys[i], key, key_len) == 0);
+    free(got_ids[i]);
+    free(got_keys[i]);
+    got_ids[i] = NULL;
+    got_keys[i] = NULL;
+  }
+
+  // A smaller response reuses the same buffer, without shrinking it
+  unsigned char *data = buffer.data;
+  size_t size = buffer.size;
+
+  CU_ASSERT(build_kmip_get_batch_response_into(&ctx, ids, id_lens,
+                                               item_ids, item_id_lens,
+                                               keys, key_lens, 1,
+                                               &buffer, &response_len) == 0);
+  CU_ASSERT(buffer.data == data && buffer.size == size);
+  CU_ASSERT(parse_kmip_get_batch_response(&ctx, buffer.data, response_len,
+                                          1, got_ids, got_id_lens,
+                                          got_keys, got_key_lens) == 0);
+  CU_ASSERT(got_key_lens[0] == key_len
+            && memcmp(got_keys[0], key, key_len) == 0);
+  free(got_ids[0]);
+  free(got_keys[0]);
+
+  // Freeing the buffer leaves it empty, and freeing it again is harmless
+  kmip_encoding_buffer_free(&buffer);
+  CU_ASSERT(buffer.data == NULL && buffer.size == 0);
+  kmip_encoding_buffer_free(&buffer);
+  kmip_encoding_buffer_free(NULL);
+
+  // Cleanup
+  free(key);
+  kmip_destroy(&ctx);
+}
+
+//----------------------------------------------------------------------------
+// test_kmip_pool()
+//----------------------------------------------------------------------------
+void test_kmip_pool(void)
+{
+  char *non_null_ptr = malloc(1);
+  kmip_pool *pool = (kmip_pool *) non_null_ptr;
+  char *key_ids[] = { "1", "2" };
+  unsigned char *keys[2] = { 0 };
+  size_t key_sizes[2] = { 0 };
+
+  // A null pool variable should produce an error
+  CU_ASSERT(kmip_pool_new((unsigned char *) non_null_ptr, 1, non_null_ptr,
+                          non_null_ptr, "127.0.0.1", "7000", 1,
+                          (kmip_pool **) NULL) == 1);
+
+  // A null server, an invalid size or an invalid TLS context configuration
+  // should produce an error, and leave the pool variable NULL
+  CU_ASSERT(kmip_pool_new((unsigned char *) non_null_ptr, 1, non_null_ptr,
+                          non_null_ptr, NULL, "7000", 1, &pool) == 1);
+  CU_ASSERT(pool == NULL);
+  CU_ASSERT(kmip_pool_new((unsigned char *) non_null_ptr, 1, non_null_ptr,
+                          non_null_ptr, "127.0.0.1", NULL, 1, &pool) == 1);
+  CU_ASSERT(kmip_pool_new((unsigned char *) non_null_ptr, 1, non_null_ptr,
+                          non_null_ptr, "127.0.0.1", "7000", 0, &pool) == 1);
+  CU_ASSERT(kmip_pool_new((unsigned char *) non_null_ptr, 1, non_null_ptr,
+                          non_null_ptr, "127.0.0.1", "7000",
+                          KMIP_POOL_MAX_CONNECTIONS + 1, &pool) == 1);
+  CU_ASSERT(kmip_pool_new((unsigned char *) NULL, 1, non_null_ptr,
+                          non_null_ptr, "127.0.0.1", "7000", 1, &pool) == 1);
+  CU_ASSERT(pool == NULL);
+
+  // A null pool, or a null key or key size list, should produce an error
+  CU_ASSERT(kmip_pool_get_keys(NULL, key_ids, 2, keys, key_sizes) == 1);
+  CU_ASSERT(kmip_pool_get_keys((kmip_pool *) non_null_ptr, key_ids, 2,
+                               NULL, key_sizes) == 1);
+  CU_ASSERT(kmip_pool_get_keys((kmip_pool *) non_null_ptr, key_ids, 2,
+                               keys, NULL) == 1);
+  CU_ASSERT(keys[0] == NULL && keys[1] == NULL);
+
+  // Releasing a null pool should be harmless
+  kmip_pool_free(NULL);
+  kmip_pool_free(&pool);
+  CU_ASSERT(pool == NULL);
+
+  free(non_null_ptr);
+}
+
+//----------------------------------------------------------------------------
+// test_tls_async()
+//----------------------------------------------------------------------------
+void test_tls_async(void)
+{
+  SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+  char *key_ids[] = { "1", "2", "" };
+  unsigned char *keys[2] = { 0 };
+  size_t key_sizes[2] = { 0 };
+  tls_async *op = NULL;
+
+  // A null context, server or operation variable should produce an error
+  CU_ASSERT(tls_async_get_keys_start(NULL, "127.0.0.1", "7000",
+                                     key_ids, 2, &op) == 1);
+  CU_ASSERT(tls_async_get_keys_start(ctx, NULL, "7000",
+                                     key_ids, 2, &op) == 1);
+  CU_ASSERT(tls_async_get_keys_start(ctx, "127.0.0.1", NULL,
+                                     key_ids, 2, &op) == 1);
+  CU_ASSERT(tls_async_get_keys_start(ctx, "127.0.0.1", "7000",
+                                     key_ids, 2, (tls_async **) NULL) == 1);
+
+  // An invalid key ID list should produce an error, and leave the
+  // operation variable NULL
+  CU_ASSERT(tls_async_get_keys_start(ctx, "127.0.0.1", "7000",
+                                     (char **) NULL, 2, &op) == 1);
+  CU_ASSERT(tls_async_get_keys_start(ctx, "127.0.0.1", "7000",
+                                     key_ids, 0, &op) == 1);
+  CU_ASSERT(tls_async_get_keys_start(ctx, "127.0.0.1", "7000",
+                                     key_ids, KMIP_GET_BATCH_MAX_ITEMS + 1,
+                                     &op) == 1);
+  CU_ASSERT(tls_async_get_keys_start(ctx, "127.0.0.1", "7000",
+                                     key_ids, 3, &op) == 1);
+  CU_ASSERT(op == NULL);
+
+  // A null operation has no socket, cannot be stepped and has no keys
+  CU_ASSERT(tls_async_fd(NULL) == -1);
+  CU_ASSERT(tls_async_step(NULL) == TLS_ASYNC_ERROR);
+  CU_ASSERT(tls_async_get_keys_result(NULL, keys, key_sizes) == 1);
+  CU_ASSERT(keys[0] == NULL && keys[1] == NULL);
+
+  // Releasing a null operation should be harmless
+  tls_async_free(NULL);
+  tls_async_free(&op);
+  CU_ASSERT(op == NULL);
+
+  SSL_CTX_free(ctx);
+}
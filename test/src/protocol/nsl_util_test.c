@@ -0,0 +1,768 @@
+//############################################################################
+// nsl_util_test.c
+//
+// Tests for Needham-Schroeder-Lowe protocol functions in
+// tpm2/src/protocol/nsl_util.c
+//############################################################################
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <CUnit/CUnit.h>
+
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+
+#include "nsl_util_test.h"
+#include "defines.h"
+#include "memory_util.h"
+#include "nsl_util.h"
+
+//----------------------------------------------------------------------------
+// nsl_util_add_tests()
+//----------------------------------------------------------------------------
+int nsl_util_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "nsl_endpoint_init() Tests",
+                          test_nsl_endpoint_init))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "generate_session_key() Tests",
+                          test_generate_session_key))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "NSL Key Pair Context Reuse Tests",
+                          test_nsl_key_pair_reuse))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "NSL RSA Session Reuse Tests",
+                          test_nsl_rsa_session_reuse))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "NSL ECDH Endpoint Tests",
+                          test_nsl_ecdh_endpoint_init))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "NSL ECDH Session Tests",
+                          test_nsl_ecdh_session))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// Key files for the tests: a key pair for a client and one for a server,
+// in a temporary directory, and the IDs they use
+//----------------------------------------------------------------------------
+typedef struct test_nsl_keys
+{
+  char dir[32];
+  char client_pub[64];
+  char client_priv[64];
+  char server_pub[64];
+  char server_priv[64];
+} test_nsl_keys;
+
+static unsigned char client_id[] = "client";
+static unsigned char server_id[] = "server";
+
+//----------------------------------------------------------------------------
+// generate_rsa_key(): generates a new RSA key of the given size
+//----------------------------------------------------------------------------
+static EVP_PKEY *generate_rsa_key(int bits)
+{
+  EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+  EVP_PKEY *pkey = NULL;
+
+  if (pctx == NULL
+      || EVP_PKEY_keygen_init(pctx) != 1
+      || EVP_PKEY_CTX_set_rsa_keygen_bits(pctx, bits) != 1
+      || EVP_PKEY_keygen(pctx, &pkey) != 1)
+  {
+    EVP_PKEY_free(pkey);
+    pkey = NULL;
+  }
+  EVP_PKEY_CTX_free(pctx);
+  return pkey;
+}
+
+//----------------------------------------------------------------------------
+// generate_ec_key(): generates a new EC key on the given curve
+//----------------------------------------------------------------------------
+static EVP_PKEY *generate_ec_key(int nid)
+{
+  EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+  EVP_PKEY *pkey = NULL;
+
+  if (pctx == NULL
+      || EVP_PKEY_keygen_init(pctx) != 1
+      || EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, nid) != 1
+      || EVP_PKEY_keygen(pctx, &pkey) != 1)
+  {
+    EVP_PKEY_free(pkey);
+    pkey = NULL;
+  }
+  EVP_PKEY_CTX_free(pctx);
+  return pkey;
+}
+
+//----------------------------------------------------------------------------
+// write_test_key_pair(): writes the public and private halves of a key
+//                        (PEM) to the given paths, then frees the key
+//----------------------------------------------------------------------------
+static int write_test_key_pair(EVP_PKEY * pkey, const char *pub_path,
+                               const char *priv_path)
+{
+  FILE *fp = NULL;
+  int result = 1;
+
+  if (pkey == NULL)
+  {
+    return 1;
+  }
+
+  fp = fopen(pub_path, "w");
+  if (fp == NULL || PEM_write_PUBKEY(fp, pkey) != 1)
+  {
+    goto out;
+  }
+  fclose(fp);
+  fp = fopen(priv_path, "w");
+  if (fp == NULL || PEM_write_PrivateKey(fp, pkey, NULL, NULL, 0, NULL,
+                                         NULL) != 1)
+  {
+    goto out;
+  }
+  result = 0;
+
+out:
+  if (fp != NULL)
+  {
+    fclose(fp);
+  }
+  EVP_PKEY_free(pkey);
+  return result;
+}
+
+//----------------------------------------------------------------------------
+// test_nsl_keys_create(): creates the temporary directory and the paths of
+//                         the key files in it (the keys are written by the
+//                         caller)
+//----------------------------------------------------------------------------
+static int test_nsl_keys_create(test_nsl_keys * keys)
+{
+  snprintf(keys->dir, sizeof(keys->dir), "/tmp/kmyth-nsl-test-XXXXXX");
+  if (mkdtemp(keys->dir) == NULL)
+  {
+    return 1;
+  }
+  snprintf(keys->client_pub, sizeof(keys->client_pub), "%s/client_pub.pem",
+           keys->dir);
+  snprintf(keys->client_priv, sizeof(keys->client_priv),
+           "%s/client_priv.pem", keys->dir);
+  snprintf(keys->server_pub, sizeof(keys->server_pub), "%s/server_pub.pem",
+           keys->dir);
+  snprintf(keys->server_priv, sizeof(keys->server_priv),
+           "%s/server_priv.pem", keys->dir);
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_nsl_rsa_keys_create(): creates the directory and an RSA key pair for
+//                             both the client and the server
+//----------------------------------------------------------------------------
+static int test_nsl_rsa_keys_create(test_nsl_keys * keys)
+{
+  if (test_nsl_keys_create(keys)
+      || write_test_key_pair(generate_rsa_key(2048), keys->client_pub,
+                             keys->client_priv)
+      || write_test_key_pair(generate_rsa_key(2048), keys->server_pub,
+                             keys->server_priv))
+  {
+    return 1;
+  }
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_nsl_ecdh_keys_create(): creates the directory and a P-256 signing
+//                              key pair for both the client and the server
+//----------------------------------------------------------------------------
+static int test_nsl_ecdh_keys_create(test_nsl_keys * keys)
+{
+  if (test_nsl_keys_create(keys)
+      || write_test_key_pair(generate_ec_key(NSL_ECDH_CURVE_NID),
+                             keys->client_pub, keys->client_priv)
+      || write_test_key_pair(generate_ec_key(NSL_ECDH_CURVE_NID),
+                             keys->server_pub, keys->server_priv))
+  {
+    return 1;
+  }
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_nsl_keys_remove(): removes the key files and their directory
+//----------------------------------------------------------------------------
+static void test_nsl_keys_remove(test_nsl_keys * keys)
+{
+  unlink(keys->client_pub);
+  unlink(keys->client_priv);
+  unlink(keys->server_pub);
+  unlink(keys->server_priv);
+  rmdir(keys->dir);
+}
+
+//----------------------------------------------------------------------------
+// A server side session, negotiated in a thread of its own while the test
+// negotiates the client side
+//----------------------------------------------------------------------------
+typedef struct test_nsl_server_session
+{
+  int fd;
+  nsl_endpoint *endpoint;
+  unsigned char *key;
+  size_t key_len;
+  int result;
+} test_nsl_server_session;
+
+static void *test_nsl_server_negotiate(void *arg)
+{
+  test_nsl_server_session *session = (test_nsl_server_session *) arg;
+
+  session->result = negotiate_server_session_key(session->fd,
+                                                 session->endpoint,
+                                                 &session->key,
+                                                 &session->key_len);
+  return NULL;
+}
+
+//----------------------------------------------------------------------------
+// test_nsl_negotiate(): negotiates one session between the endpoints, over
+//                       a socket pair, with the client expecting the given
+//                       server ID. Returns whether both sides succeeded with
+//                       matching session keys.
+//----------------------------------------------------------------------------
+static int test_nsl_negotiate(nsl_endpoint * client, nsl_endpoint * server,
+                              unsigned char *expected_id,
+                              size_t expected_id_len,
+                              unsigned char **session_key)
+{
+  int fds[2] = { -1, -1 };
+  pthread_t server_thread;
+  test_nsl_server_session session = { 0 };
+  unsigned char *key = NULL;
+  size_t key_len = 0;
+  int result = 1;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+  {
+    return 1;
+  }
+  session.fd = fds[1];
+  session.endpoint = server;
+  if (pthread_create(&server_thread, NULL, test_nsl_server_negotiate,
+                     &session) != 0)
+  {
+    close(fds[0]);
+    close(fds[1]);
+    return 1;
+  }
+
+  int client_result = negotiate_client_session_key(fds[0], client,
+                                                   expected_id,
+                                                   expected_id_len,
+                                                   &key, &key_len);
+
+  // A client that gives up hangs up, so that the server does too
+  close(fds[0]);
+  pthread_join(server_thread, NULL);
+  close(fds[1]);
+
+  if (client_result == 0 && session.result == 0
+      && key_len == session.key_len && key_len > 0
+      && memcmp(key, session.key, key_len) == 0)
+  {
+    result = 0;
+  }
+  if (result == 0 && session_key != NULL)
+  {
+    *session_key = malloc(key_len);
+    if (*session_key != NULL)
+    {
+      memcpy(*session_key, key, key_len);
+    }
+  }
+  kmyth_clear_and_free(key, key_len);
+  kmyth_clear_and_free(session.key, session.key_len);
+  return result;
+}
+
+//----------------------------------------------------------------------------
+// test_nsl_endpoint_init()
+//----------------------------------------------------------------------------
+void test_nsl_endpoint_init(void)
+{
+  test_nsl_keys keys = { 0 };
+  nsl_endpoint endpoint = { 0 };
+
+  CU_ASSERT_FATAL(test_nsl_rsa_keys_create(&keys) == 0);
+
+  // Check that an RSA endpoint holds contexts for both keys, and its ID
+  CU_ASSERT(nsl_endpoint_init(&endpoint, NSL_PROTOCOL_RSA, keys.server_pub,
+                              keys.client_priv, client_id,
+                              sizeof(client_id)) == 0);
+  CU_ASSERT(endpoint.protocol == NSL_PROTOCOL_RSA);
+  CU_ASSERT(endpoint.public_key_ctx != NULL);
+  CU_ASSERT(endpoint.private_key_ctx != NULL);
+  CU_ASSERT(endpoint.id_len == sizeof(client_id));
+  CU_ASSERT(endpoint.id != NULL && endpoint.id != client_id
+            && memcmp(endpoint.id, client_id, sizeof(client_id)) == 0);
+  CU_ASSERT(endpoint.session_key_kdf.md != NULL);
+
+  // Check that cleanup releases everything, and can be repeated
+  nsl_endpoint_cleanup(&endpoint);
+  CU_ASSERT(endpoint.public_key_ctx == NULL);
+  CU_ASSERT(endpoint.private_key_ctx == NULL);
+  CU_ASSERT(endpoint.id == NULL);
+  CU_ASSERT(endpoint.id_len == 0);
+  nsl_endpoint_cleanup(&endpoint);
+  nsl_endpoint_cleanup(NULL);
+
+  // Check that missing parameters, a missing file, or a public key given
+  // as the private one are rejected
+  CU_ASSERT(nsl_endpoint_init(NULL, NSL_PROTOCOL_RSA, keys.server_pub,
+                              keys.client_priv, client_id,
+                              sizeof(client_id)) == 1);
+  CU_ASSERT(nsl_endpoint_init(&endpoint, NSL_PROTOCOL_RSA, NULL,
+                              keys.client_priv, client_id,
+                              sizeof(client_id)) == 1);
+  CU_ASSERT(nsl_endpoint_init(&endpoint, NSL_PROTOCOL_RSA, keys.server_pub,
+                              NULL, client_id, sizeof(client_id)) == 1);
+  CU_ASSERT(nsl_endpoint_init(&endpoint, NSL_PROTOCOL_RSA, keys.server_pub,
+                              keys.client_priv, NULL, 0) == 1);
+  CU_ASSERT(nsl_endpoint_init(&endpoint, NSL_PROTOCOL_RSA, keys.server_pub,
+                              keys.client_priv, client_id, 0) == 1);
+  CU_ASSERT(nsl_endpoint_init(&endpoint, (nsl_protocol) - 1,
+                              keys.server_pub, keys.client_priv, client_id,
+                              sizeof(client_id)) == 1);
+  CU_ASSERT(nsl_endpoint_init(&endpoint, NSL_PROTOCOL_RSA,
+                              "/tmp/kmyth-nsl-test-missing.pem",
+                              keys.client_priv, client_id,
+                              sizeof(client_id)) == 1);
+  CU_ASSERT(nsl_endpoint_init(&endpoint, NSL_PROTOCOL_RSA, keys.server_pub,
+                              keys.client_pub, client_id,
+                              sizeof(client_id)) == 1);
+  CU_ASSERT(endpoint.public_key_ctx == NULL);
+  CU_ASSERT(endpoint.private_key_ctx == NULL);
+  CU_ASSERT(endpoint.id == NULL);
+
+  test_nsl_keys_remove(&keys);
+}
+
+//----------------------------------------------------------------------------
+// test_generate_session_key()
+//----------------------------------------------------------------------------
+void test_generate_session_key(void)
+{
+  static const unsigned char info[] = "kmyth NSL session key";
+  kdf_params kdf = { 0 };
+  unsigned char nonce_a[32];
+  unsigned char nonce_b[32];
+  unsigned char nonces[64];
+  unsigned char *key = NULL;
+  size_t key_len = 0;
+  unsigned char *other = NULL;
+  size_t other_len = 0;
+  unsigned char *expected = NULL;
+  size_t expected_len = 32;
+
+  memset(nonce_a, 'a', sizeof(nonce_a));
+  memset(nonce_b, 'b', sizeof(nonce_b));
+  memcpy(nonces, nonce_a, sizeof(nonce_a));
+  memcpy(nonces + sizeof(nonce_a), nonce_b, sizeof(nonce_b));
+
+  // Check that the session key is HKDF, with the NSL label, over the
+  // concatenated nonces, and that it is the same every time
+  CU_ASSERT_FATAL(kdf_params_init(&kdf, KMYTH_KDF_HASH, NULL, 0, info,
+                                  sizeof(info) - 1) == 0);
+  CU_ASSERT_FATAL(kdf_derive_keys(&kdf, nonces, sizeof(nonces), 1,
+                                  &expected_len, &expected) == 0);
+  CU_ASSERT(generate_session_key(&kdf, nonce_a, sizeof(nonce_a), nonce_b,
+                                 sizeof(nonce_b), &key, &key_len) == 0);
+  CU_ASSERT(key_len == expected_len);
+  CU_ASSERT(key != NULL && memcmp(key, expected, expected_len) == 0);
+  CU_ASSERT(generate_session_key(&kdf, nonce_a, sizeof(nonce_a), nonce_b,
+                                 sizeof(nonce_b), &other, &other_len) == 0);
+  CU_ASSERT(other_len == key_len
+            && memcmp(other, key, key_len) == 0);
+  kmyth_clear_and_free(other, other_len);
+  other = NULL;
+
+  // Check that the order of the nonces matters
+  CU_ASSERT(generate_session_key(&kdf, nonce_b, sizeof(nonce_b), nonce_a,
+                                 sizeof(nonce_a), &other, &other_len) == 0);
+  CU_ASSERT(other != NULL && memcmp(other, key, key_len) != 0);
+  kmyth_clear_and_free(other, other_len);
+  other = NULL;
+
+  // Check that another hash derives another key
+  kdf_params sha384_kdf = { 0 };
+
+  CU_ASSERT_FATAL(kdf_params_init(&sha384_kdf, KDF_HASH_SHA384, NULL, 0,
+                                  info, sizeof(info) - 1) == 0);
+  CU_ASSERT(generate_session_key(&sha384_kdf, nonce_a, sizeof(nonce_a),
+                                 nonce_b, sizeof(nonce_b), &other,
+                                 &other_len) == 0);
+  CU_ASSERT(other_len == key_len);
+  CU_ASSERT(other != NULL && memcmp(other, key, key_len) != 0);
+  kmyth_clear_and_free(other, other_len);
+  other = NULL;
+
+  // Check that nonces of the wrong length are rejected
+  CU_ASSERT(generate_session_key(&kdf, nonce_a, sizeof(nonce_a) - 1,
+                                 nonce_b, sizeof(nonce_b), &other,
+                                 &other_len) == 1);
+  CU_ASSERT(generate_session_key(&kdf, nonce_a, sizeof(nonce_a), nonce_b,
+                                 sizeof(nonce_b) + 1, &other,
+                                 &other_len) == 1);
+  CU_ASSERT(other == NULL);
+
+  kmyth_clear_and_free(key, key_len);
+  kmyth_clear_and_free(expected, expected_len);
+}
+
+//----------------------------------------------------------------------------
+// test_nsl_key_pair_reuse()
+//----------------------------------------------------------------------------
+void test_nsl_key_pair_reuse(void)
+{
+  test_nsl_keys keys = { 0 };
+  unsigned char nonce[32] = { 0 };
+  unsigned char *ciphertext = NULL;
+  size_t ciphertext_len = 0;
+  unsigned char *plaintext = NULL;
+  size_t plaintext_len = 0;
+
+  CU_ASSERT_FATAL(test_nsl_rsa_keys_create(&keys) == 0);
+
+  EVP_PKEY_CTX *public_ctx = setup_public_evp_context(keys.server_pub);
+  EVP_PKEY_CTX *private_ctx = setup_private_evp_context(keys.server_priv);
+  EVP_PKEY_CTX *other_ctx = setup_private_evp_context(keys.client_priv);
+
+  CU_ASSERT_FATAL(public_ctx != NULL);
+  CU_ASSERT_FATAL(private_ctx != NULL);
+  CU_ASSERT_FATAL(other_ctx != NULL);
+  CU_ASSERT(setup_public_evp_context(keys.client_priv) == NULL);
+  CU_ASSERT(setup_private_evp_context(keys.client_pub) == NULL);
+
+  // Check that the contexts, initialized once, round trip message after
+  // message
+  for (int i = 0; i < 4; i++)
+  {
+    memset(nonce, 'a' + i, sizeof(nonce));
+    CU_ASSERT(encrypt_with_key_pair(public_ctx, nonce, sizeof(nonce),
+                                    &ciphertext, &ciphertext_len) == 0);
+    CU_ASSERT(ciphertext_len == 256);
+    CU_ASSERT(decrypt_with_key_pair(private_ctx, ciphertext,
+                                    ciphertext_len, &plaintext,
+                                    &plaintext_len) == 0);
+    CU_ASSERT(plaintext_len == sizeof(nonce));
+    CU_ASSERT(plaintext != NULL
+              && memcmp(plaintext, nonce, sizeof(nonce)) == 0);
+    kmyth_secure_free(plaintext, plaintext_len);
+    plaintext = NULL;
+
+    // Check that another private key, or a damaged ciphertext, fails
+    CU_ASSERT(decrypt_with_key_pair(other_ctx, ciphertext, ciphertext_len,
+                                    &plaintext, &plaintext_len) == 1);
+    CU_ASSERT(plaintext == NULL);
+    CU_ASSERT(plaintext_len == 0);
+    ciphertext[ciphertext_len / 2] ^= 0x01;
+    CU_ASSERT(decrypt_with_key_pair(private_ctx, ciphertext,
+                                    ciphertext_len, &plaintext,
+                                    &plaintext_len) == 1);
+    CU_ASSERT(plaintext == NULL);
+    free(ciphertext);
+    ciphertext = NULL;
+  }
+
+  // Check that the same message never encrypts the same way twice
+  unsigned char *other = NULL;
+  size_t other_len = 0;
+
+  CU_ASSERT(encrypt_with_key_pair(public_ctx, nonce, sizeof(nonce),
+                                  &ciphertext, &ciphertext_len) == 0);
+  CU_ASSERT(encrypt_with_key_pair(public_ctx, nonce, sizeof(nonce),
+                                  &other, &other_len) == 0);
+  CU_ASSERT(ciphertext != NULL && other != NULL
+            && other_len == ciphertext_len
+            && memcmp(ciphertext, other, ciphertext_len) != 0);
+  free(ciphertext);
+  free(other);
+
+  // Check that the nonce messages parse back with the same contexts
+  unsigned char nonce_b[32];
+  unsigned char *request = NULL;
+  size_t request_len = 0;
+  unsigned char *nonce_out = NULL;
+  size_t nonce_out_len = 0;
+  unsigned char *nonce_b_out = NULL;
+  size_t nonce_b_out_len = 0;
+  unsigned char *id_out = NULL;
+  size_t id_out_len = 0;
+
+  memset(nonce_b, 'b', sizeof(nonce_b));
+  for (int i = 0; i < 2; i++)
+  {
+    CU_ASSERT(build_nonce_request(public_ctx, nonce, sizeof(nonce),
+                                  client_id, sizeof(client_id), &request,
+                                  &request_len) == 0);
+    CU_ASSERT(parse_nonce_request(private_ctx, request, request_len,
+                                  &nonce_out, &nonce_out_len, &id_out,
+                                  &id_out_len) == 0);
+    CU_ASSERT(nonce_out_len == sizeof(nonce));
+    CU_ASSERT(nonce_out != NULL
+              && memcmp(nonce_out, nonce, sizeof(nonce)) == 0);
+    CU_ASSERT(id_out_len == sizeof(client_id));
+    CU_ASSERT(id_out != NULL
+              && memcmp(id_out, client_id, sizeof(client_id)) == 0);
+    free(request);
+    free(nonce_out);
+    free(id_out);
+    nonce_out = NULL;
+    id_out = NULL;
+
+    CU_ASSERT(build_nonce_response(public_ctx, nonce, sizeof(nonce),
+                                   nonce_b, sizeof(nonce_b), server_id,
+                                   sizeof(server_id), &request,
+                                   &request_len) == 0);
+    CU_ASSERT(parse_nonce_response(private_ctx, request, request_len,
+                                   &nonce_out, &nonce_out_len, &nonce_b_out,
+                                   &nonce_b_out_len, &id_out,
+                                   &id_out_len) == 0);
+    CU_ASSERT(nonce_out_len == sizeof(nonce));
+    CU_ASSERT(nonce_out != NULL
+              && memcmp(nonce_out, nonce, sizeof(nonce)) == 0);
+    CU_ASSERT(nonce_b_out_len == sizeof(nonce_b));
+    CU_ASSERT(nonce_b_out != NULL
+              && memcmp(nonce_b_out, nonce_b, sizeof(nonce_b)) == 0);
+    CU_ASSERT(id_out_len == sizeof(server_id));
+    CU_ASSERT(id_out != NULL
+              && memcmp(id_out, server_id, sizeof(server_id)) == 0);
+    free(request);
+    free(nonce_out);
+    free(nonce_b_out);
+    free(id_out);
+    nonce_out = NULL;
+    nonce_b_out = NULL;
+    id_out = NULL;
+
+    CU_ASSERT(build_nonce_confirmation(public_ctx, nonce_b, sizeof(nonce_b),
+                                       &request, &request_len) == 0);
+    CU_ASSERT(parse_nonce_confirmation(private_ctx, request, request_len,
+                                       &nonce_out, &nonce_out_len) == 0);
+    CU_ASSERT(nonce_out_len == sizeof(nonce_b));
+    CU_ASSERT(nonce_out != NULL
+              && memcmp(nonce_out, nonce_b, sizeof(nonce_b)) == 0);
+    free(request);
+    free(nonce_out);
+    nonce_out = NULL;
+  }
+
+  EVP_PKEY_CTX_free(public_ctx);
+  EVP_PKEY_CTX_free(private_ctx);
+  EVP_PKEY_CTX_free(other_ctx);
+  test_nsl_keys_remove(&keys);
+}
+
+//----------------------------------------------------------------------------
+// test_nsl_rsa_session_reuse()
+//----------------------------------------------------------------------------
+void test_nsl_rsa_session_reuse(void)
+{
+  test_nsl_keys keys = { 0 };
+  nsl_endpoint client = { 0 };
+  nsl_endpoint server = { 0 };
+  unsigned char *keys_out[3] = { NULL, NULL, NULL };
+
+  CU_ASSERT_FATAL(test_nsl_rsa_keys_create(&keys) == 0);
+  CU_ASSERT_FATAL(nsl_endpoint_init(&client, NSL_PROTOCOL_RSA,
+                                    keys.server_pub, keys.client_priv,
+                                    client_id, sizeof(client_id)) == 0);
+  CU_ASSERT_FATAL(nsl_endpoint_init(&server, NSL_PROTOCOL_RSA,
+                                    keys.client_pub, keys.server_priv,
+                                    server_id, sizeof(server_id)) == 0);
+
+  // Check that the same endpoints negotiate session after session, each
+  // with a session key of its own
+  for (int i = 0; i < 3; i++)
+  {
+    CU_ASSERT(test_nsl_negotiate(&client, &server, server_id,
+                                 sizeof(server_id), &keys_out[i]) == 0);
+  }
+  CU_ASSERT(keys_out[0] != NULL && keys_out[1] != NULL
+            && keys_out[2] != NULL
+            && memcmp(keys_out[0], keys_out[1], 32) != 0
+            && memcmp(keys_out[1], keys_out[2], 32) != 0);
+
+  // Check that a client expecting another server ID gives up, and that
+  // the endpoints are still good for the next session
+  CU_ASSERT(test_nsl_negotiate(&client, &server, (unsigned char *) "other",
+                               5, NULL) == 1);
+  CU_ASSERT(test_nsl_negotiate(&client, &server, server_id,
+                               sizeof(server_id), NULL) == 0);
+
+  // Check that a server holding another client's public key can't
+  // negotiate with the client
+  nsl_endpoint_cleanup(&server);
+  CU_ASSERT_FATAL(nsl_endpoint_init(&server, NSL_PROTOCOL_RSA,
+                                    keys.server_pub, keys.server_priv,
+                                    server_id, sizeof(server_id)) == 0);
+  CU_ASSERT(test_nsl_negotiate(&client, &server, server_id,
+                               sizeof(server_id), NULL) == 1);
+
+  for (int i = 0; i < 3; i++)
+  {
+    free(keys_out[i]);
+  }
+  nsl_endpoint_cleanup(&client);
+  nsl_endpoint_cleanup(&server);
+  test_nsl_keys_remove(&keys);
+}
+
+//----------------------------------------------------------------------------
+// test_nsl_ecdh_endpoint_init()
+//----------------------------------------------------------------------------
+void test_nsl_ecdh_endpoint_init(void)
+{
+  test_nsl_keys keys = { 0 };
+  test_nsl_keys other_keys = { 0 };
+  nsl_endpoint endpoint = { 0 };
+
+  CU_ASSERT_FATAL(test_nsl_ecdh_keys_create(&keys) == 0);
+
+  // Check that an ECDH endpoint holds both keys themselves, not contexts
+  CU_ASSERT(nsl_endpoint_init(&endpoint, NSL_PROTOCOL_ECDH, keys.server_pub,
+                              keys.client_priv, client_id,
+                              sizeof(client_id)) == 0);
+  CU_ASSERT(endpoint.protocol == NSL_PROTOCOL_ECDH);
+  CU_ASSERT(endpoint.public_key != NULL);
+  CU_ASSERT(endpoint.private_key != NULL);
+  CU_ASSERT(endpoint.public_key_ctx == NULL);
+  CU_ASSERT(endpoint.private_key_ctx == NULL);
+  CU_ASSERT(endpoint.id_len == sizeof(client_id));
+  nsl_endpoint_cleanup(&endpoint);
+  CU_ASSERT(endpoint.public_key == NULL);
+  CU_ASSERT(endpoint.private_key == NULL);
+
+  // Check that keys on another curve, or RSA keys, are rejected, for
+  // either half of the endpoint
+  CU_ASSERT_FATAL(test_nsl_keys_create(&other_keys) == 0);
+  CU_ASSERT_FATAL(write_test_key_pair(generate_ec_key(NID_secp384r1),
+                                      other_keys.client_pub,
+                                      other_keys.client_priv) == 0);
+  CU_ASSERT_FATAL(write_test_key_pair(generate_rsa_key(2048),
+                                      other_keys.server_pub,
+                                      other_keys.server_priv) == 0);
+  CU_ASSERT(nsl_endpoint_init(&endpoint, NSL_PROTOCOL_ECDH,
+                              other_keys.client_pub, keys.client_priv,
+                              client_id, sizeof(client_id)) == 1);
+  CU_ASSERT(nsl_endpoint_init(&endpoint, NSL_PROTOCOL_ECDH, keys.server_pub,
+                              other_keys.client_priv, client_id,
+                              sizeof(client_id)) == 1);
+  CU_ASSERT(nsl_endpoint_init(&endpoint, NSL_PROTOCOL_ECDH,
+                              other_keys.server_pub, keys.client_priv,
+                              client_id, sizeof(client_id)) == 1);
+  CU_ASSERT(nsl_endpoint_init(&endpoint, NSL_PROTOCOL_ECDH, keys.server_pub,
+                              other_keys.server_priv, client_id,
+                              sizeof(client_id)) == 1);
+  CU_ASSERT(endpoint.public_key == NULL);
+  CU_ASSERT(endpoint.private_key == NULL);
+  CU_ASSERT(endpoint.id == NULL);
+
+  test_nsl_keys_remove(&other_keys);
+  test_nsl_keys_remove(&keys);
+}
+
+//----------------------------------------------------------------------------
+// test_nsl_ecdh_session()
+//----------------------------------------------------------------------------
+void test_nsl_ecdh_session(void)
+{
+  test_nsl_keys keys = { 0 };
+  nsl_endpoint client = { 0 };
+  nsl_endpoint server = { 0 };
+  unsigned char *keys_out[3] = { NULL, NULL, NULL };
+
+  CU_ASSERT_FATAL(test_nsl_ecdh_keys_create(&keys) == 0);
+  CU_ASSERT_FATAL(nsl_endpoint_init(&client, NSL_PROTOCOL_ECDH,
+                                    keys.server_pub, keys.client_priv,
+                                    client_id, sizeof(client_id)) == 0);
+  CU_ASSERT_FATAL(nsl_endpoint_init(&server, NSL_PROTOCOL_ECDH,
+                                    keys.client_pub, keys.server_priv,
+                                    server_id, sizeof(server_id)) == 0);
+
+  // Check that the endpoints agree on a fresh session key each session
+  for (int i = 0; i < 3; i++)
+  {
+    CU_ASSERT(test_nsl_negotiate(&client, &server, server_id,
+                                 sizeof(server_id), &keys_out[i]) == 0);
+  }
+  CU_ASSERT(keys_out[0] != NULL && keys_out[1] != NULL
+            && keys_out[2] != NULL
+            && memcmp(keys_out[0], keys_out[1], 32) != 0
+            && memcmp(keys_out[1], keys_out[2], 32) != 0);
+
+  // Check that a client expecting another server ID gives up
+  CU_ASSERT(test_nsl_negotiate(&client, &server, (unsigned char *) "other",
+                               5, NULL) == 1);
+
+  // Check that a server signing with a key the client doesn't trust, or
+  // verifying the client with another key, can't negotiate
+  nsl_endpoint_cleanup(&server);
+  CU_ASSERT_FATAL(nsl_endpoint_init(&server, NSL_PROTOCOL_ECDH,
+                                    keys.client_pub, keys.client_priv,
+                                    server_id, sizeof(server_id)) == 0);
+  CU_ASSERT(test_nsl_negotiate(&client, &server, server_id,
+                               sizeof(server_id), NULL) == 1);
+  nsl_endpoint_cleanup(&server);
+  CU_ASSERT_FATAL(nsl_endpoint_init(&server, NSL_PROTOCOL_ECDH,
+                                    keys.server_pub, keys.server_priv,
+                                    server_id, sizeof(server_id)) == 0);
+  CU_ASSERT(test_nsl_negotiate(&client, &server, server_id,
+                               sizeof(server_id), NULL) == 1);
+
+  // Check that the original endpoints still negotiate
+  nsl_endpoint_cleanup(&server);
+  CU_ASSERT_FATAL(nsl_endpoint_init(&server, NSL_PROTOCOL_ECDH,
+                                    keys.client_pub, keys.server_priv,
+                                    server_id, sizeof(server_id)) == 0);
+  CU_ASSERT(test_nsl_negotiate(&client, &server, server_id,
+                               sizeof(server_id), NULL) == 0);
+
+  for (int i = 0; i < 3; i++)
+  {
+    free(keys_out[i]);
+  }
+  nsl_endpoint_cleanup(&client);
+  nsl_endpoint_cleanup(&server);
+  test_nsl_keys_remove(&keys);
+}
@@ -0,0 +1,265 @@
+//############################################################################
+// unsealerd_util_test.c
+//
+// Tests for kmyth-unsealerd protocol functions in
+// tpm2/src/protocol/unsealerd_util.c
+//############################################################################
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <CUnit/CUnit.h>
+
+#include "unsealerd_util_test.h"
+#include "defines.h"
+#include "socket_util.h"
+#include "unsealerd_util.h"
+
+//----------------------------------------------------------------------------
+// unsealerd_util_add_tests()
+//----------------------------------------------------------------------------
+int unsealerd_util_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "build/parse_unseal_request() Tests",
+                          test_unseal_request))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "send/recv_unsealerd_message() Tests",
+                          test_unsealerd_message))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "unsealerd_unseal() Tests",
+                          test_unsealerd_unseal))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_unseal_request()
+//----------------------------------------------------------------------------
+void test_unseal_request(void)
+{
+  uint8_t auth[] = { 'p', 'a', 's', 's' };
+  uint8_t ski[] = { 0x10, 0x20, 0x30 };
+  uint8_t *request = NULL;
+  size_t request_len = 0;
+  uint8_t *auth_out = NULL;
+  size_t auth_out_len = 0;
+  uint8_t *ski_out = NULL;
+  size_t ski_out_len = 0;
+
+  // Check that a request parses back to its auth and .ski, which point
+  // into the request
+  CU_ASSERT(build_unseal_request(auth, sizeof(auth), ski, sizeof(ski),
+                                 &request, &request_len) == 0);
+  CU_ASSERT(request_len == 4 + sizeof(auth) + sizeof(ski));
+  CU_ASSERT(parse_unseal_request(request, request_len, &auth_out,
+                                 &auth_out_len, &ski_out,
+                                 &ski_out_len) == 0);
+  CU_ASSERT(auth_out == request + 4);
+  CU_ASSERT(auth_out_len == sizeof(auth));
+  CU_ASSERT(memcmp(auth_out, auth, sizeof(auth)) == 0);
+  CU_ASSERT(ski_out_len == sizeof(ski));
+  CU_ASSERT(memcmp(ski_out, ski, sizeof(ski)) == 0);
+
+  // Check that a request whose auth length leaves no .ski is rejected
+  CU_ASSERT(parse_unseal_request(request, 4 + sizeof(auth), &auth_out,
+                                 &auth_out_len, &ski_out,
+                                 &ski_out_len) == 1);
+  request[0] = 0xFF;
+  CU_ASSERT(parse_unseal_request(request, request_len, &auth_out,
+                                 &auth_out_len, &ski_out,
+                                 &ski_out_len) == 1);
+  CU_ASSERT(parse_unseal_request(request, 3, &auth_out, &auth_out_len,
+                                 &ski_out, &ski_out_len) == 1);
+  free(request);
+  request = NULL;
+
+  // Check that an empty auth is allowed, but an empty .ski is not
+  CU_ASSERT(build_unseal_request(NULL, 0, ski, sizeof(ski), &request,
+                                 &request_len) == 0);
+  CU_ASSERT(parse_unseal_request(request, request_len, &auth_out,
+                                 &auth_out_len, &ski_out,
+                                 &ski_out_len) == 0);
+  CU_ASSERT(auth_out_len == 0);
+  CU_ASSERT(ski_out_len == sizeof(ski));
+  free(request);
+  request = NULL;
+  CU_ASSERT(build_unseal_request(auth, sizeof(auth), NULL, 0, &request,
+                                 &request_len) == 1);
+  CU_ASSERT(build_unseal_request(auth, sizeof(auth), ski, 0, &request,
+                                 &request_len) == 1);
+  CU_ASSERT(request == NULL);
+}
+
+//----------------------------------------------------------------------------
+// test_unsealerd_message()
+//----------------------------------------------------------------------------
+void test_unsealerd_message(void)
+{
+  int fds[2] = { -1, -1 };
+  uint8_t body[] = { 1, 2, 3, 4, 5 };
+  uint8_t type = 0;
+  uint8_t *received = NULL;
+  size_t received_len = 0;
+
+  CU_ASSERT_FATAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+  // Check that a message (with or without a body) arrives as sent
+  CU_ASSERT(send_unsealerd_message(fds[0], UNSEALERD_MSG_DATA, body,
+                                   sizeof(body)) == 0);
+  CU_ASSERT(recv_unsealerd_message(fds[1], sizeof(body), &type, &received,
+                                   &received_len) == 0);
+  CU_ASSERT(type == UNSEALERD_MSG_DATA);
+  CU_ASSERT(received_len == sizeof(body));
+  CU_ASSERT(received != NULL && memcmp(received, body, sizeof(body)) == 0);
+  free(received);
+  received = NULL;
+  CU_ASSERT(send_unsealerd_message(fds[0], UNSEALERD_MSG_ERROR, NULL,
+                                   0) == 0);
+  CU_ASSERT(recv_unsealerd_message(fds[1], 0, &type, &received,
+                                   &received_len) == 0);
+  CU_ASSERT(type == UNSEALERD_MSG_ERROR);
+  CU_ASSERT(received_len == 0);
+  free(received);
+  received = NULL;
+
+  // Check that a body larger than the receiver accepts is rejected
+  CU_ASSERT(send_unsealerd_message(fds[0], UNSEALERD_MSG_DATA, body,
+                                   sizeof(body)) == 0);
+  CU_ASSERT(recv_unsealerd_message(fds[1], sizeof(body) - 1, &type,
+                                   &received, &received_len) == 1);
+  CU_ASSERT(received == NULL);
+  close(fds[0]);
+  close(fds[1]);
+
+  // Check that another protocol version is rejected
+  uint8_t header[UNSEALERD_HEADER_SIZE] = {
+    UNSEALERD_PROTOCOL_VERSION + 1, UNSEALERD_MSG_DATA, 0, 0, 0, 0, 0, 0
+  };
+
+  CU_ASSERT_FATAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  CU_ASSERT(write(fds[0], header, sizeof(header)) == sizeof(header));
+  CU_ASSERT(recv_unsealerd_message(fds[1], sizeof(body), &type, &received,
+                                   &received_len) == 1);
+
+  // Check that a body cut short, or no message at all, is an error
+  header[0] = UNSEALERD_PROTOCOL_VERSION;
+  header[7] = sizeof(body);
+  CU_ASSERT(write(fds[0], header, sizeof(header)) == sizeof(header));
+  CU_ASSERT(write(fds[0], body, 2) == 2);
+  shutdown(fds[0], SHUT_WR);
+  CU_ASSERT(recv_unsealerd_message(fds[1], sizeof(body), &type, &received,
+                                   &received_len) == 1);
+  CU_ASSERT(received == NULL);
+  CU_ASSERT(recv_unsealerd_message(fds[1], sizeof(body), &type, &received,
+                                   &received_len) == 1);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+//----------------------------------------------------------------------------
+// unsealerd_stand_in()
+//
+// Serves two connections the way kmyth-unsealerd would, but "unseals" a
+// .ski by reversing it, and only for the auth "ok"
+//----------------------------------------------------------------------------
+static void *unsealerd_stand_in(void *arg)
+{
+  int listen_fd = *(int *) arg;
+
+  for (int i = 0; i < 2; i++)
+  {
+    int fd = accept(listen_fd, NULL, NULL);
+    uint8_t type = 0;
+    uint8_t *request = NULL;
+    size_t request_len = 0;
+    uint8_t *auth = NULL;
+    size_t auth_len = 0;
+    uint8_t *ski = NULL;
+    size_t ski_len = 0;
+
+    if (fd < 0)
+    {
+      break;
+    }
+    if (recv_unsealerd_message(fd, KMYTH_UNSEALERD_MAX_MESSAGE_SIZE, &type,
+                               &request, &request_len) == 0
+        && type == UNSEALERD_MSG_UNSEAL
+        && parse_unseal_request(request, request_len, &auth, &auth_len,
+                                &ski, &ski_len) == 0
+        && auth_len == 2 && memcmp(auth, "ok", 2) == 0)
+    {
+      for (size_t j = 0; j < ski_len / 2; j++)
+      {
+        uint8_t b = ski[j];
+
+        ski[j] = ski[ski_len - 1 - j];
+        ski[ski_len - 1 - j] = b;
+      }
+      send_unsealerd_message(fd, UNSEALERD_MSG_DATA, ski, ski_len);
+    }
+    else
+    {
+      send_unsealerd_message(fd, UNSEALERD_MSG_ERROR, NULL, 0);
+    }
+    free(request);
+    close(fd);
+  }
+  return NULL;
+}
+
+//----------------------------------------------------------------------------
+// test_unsealerd_unseal()
+//----------------------------------------------------------------------------
+void test_unsealerd_unseal(void)
+{
+  char dir[] = "/tmp/kmyth-unsealerd-test-XXXXXX";
+  char path[64] = { 0 };
+  int listen_fd = -1;
+  pthread_t daemon_thread;
+  uint8_t ski[] = { 'a', 'b', 'c', 'd' };
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+
+  CU_ASSERT_FATAL(mkdtemp(dir) != NULL);
+  snprintf(path, sizeof(path), "%s/unsealerd.sock", dir);
+
+  // Check that there is no reply without a daemon
+  CU_ASSERT(unsealerd_unseal(path, ski, sizeof(ski), (uint8_t *) "ok", 2,
+                             &output, &output_len) == 1);
+
+  CU_ASSERT_FATAL(setup_unix_server_socket(path, 0600, &listen_fd) == 0);
+  CU_ASSERT_FATAL(pthread_create(&daemon_thread, NULL, unsealerd_stand_in,
+                                 &listen_fd) == 0);
+
+  // Check that a DATA reply is returned as the unsealed data
+  CU_ASSERT(unsealerd_unseal(path, ski, sizeof(ski), (uint8_t *) "ok", 2,
+                             &output, &output_len) == 0);
+  CU_ASSERT(output_len == sizeof(ski));
+  CU_ASSERT(output != NULL && memcmp(output, "dcba", 4) == 0);
+  free(output);
+  output = NULL;
+  output_len = 0;
+
+  // Check that an ERROR reply fails the call and returns no data
+  CU_ASSERT(unsealerd_unseal(path, ski, sizeof(ski), (uint8_t *) "no", 2,
+                             &output, &output_len) == 1);
+  CU_ASSERT(output == NULL);
+  CU_ASSERT(output_len == 0);
+
+  pthread_join(daemon_thread, NULL);
+  close(listen_fd);
+  unlink(path);
+  rmdir(dir);
+}
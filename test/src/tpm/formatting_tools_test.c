@@ -82,6 +82,13 @@ int formatting_tools_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite,
+                          "pack_ski_objects() / unpack_ski_objects() Tests",
+                          test_pack_unpack_ski_objects))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "pack_pcr() / unpack_pcr() Tests",
                           test_pack_unpack_pcr))
   {
@@ -106,6 +113,13 @@ int formatting_tools_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite,
+                          "pack_bundle_payloads() / unpack_bundle_payloads() Tests",
+                          test_pack_unpack_bundle_payloads))
+  {
+    return 1;
+  }
+
   if (NULL ==
       CU_add_test(suite, "parse_ski_bytes() Tests", test_parse_ski_bytes))
   {
@@ -118,6 +132,35 @@ int formatting_tools_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "Binary (v2) .ski Format Tests",
+                          test_create_parse_ski_binary))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Stream .ski Format Tests",
+                          test_create_parse_ski_stream))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Lazy .ski View Tests", test_ski_view))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Rewrap .ski Header Tests",
+                          test_create_ski_rewrap_header))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Compressed .ski Format Tests",
+                          test_create_parse_ski_compressed))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "free_ski() Tests", test_free_ski))
   {
     return 1;
@@ -129,6 +172,12 @@ int formatting_tools_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL ==
+      CU_add_test(suite, "get_block_view() Tests", test_get_block_view))
+  {
+    return 1;
+  }
+
   if (NULL ==
       CU_add_test(suite, "get_block_bytes() Tests", test_get_block_bytes))
   {
@@ -1085,6 +1134,89 @@ void test_marshal_unmarshal_skiObjects(void)
   free(sealed_key_private_data);
 }
 
+//----------------------------------------------------------------------------
+// test_pack_unpack_ski_objects
+//----------------------------------------------------------------------------
+void test_pack_unpack_ski_objects(void)
+{
+  TPML_PCR_SELECTION pcr_selection_in = { 0 };
+  TPML_PCR_SELECTION pcr_selection_out = { 0 };
+  TPM2B_PUBLIC sk_public_in = { 0 };
+  TPM2B_PUBLIC sk_public_out = { 0 };
+  TPM2B_PRIVATE sk_private_in = { 0 };
+  TPM2B_PRIVATE sk_private_out = { 0 };
+  TPM2B_PUBLIC sealed_key_public_in = { 0 };
+  TPM2B_PUBLIC sealed_key_public_out = { 0 };
+  TPM2B_PRIVATE sealed_key_private_in = { 0 };
+  TPM2B_PRIVATE sealed_key_private_out = { 0 };
+  uint8_t *block = NULL;
+  size_t block_size = 0;
+  uint8_t *objects[KMYTH_SKI_OBJECT_COUNT] = { NULL };
+  size_t object_sizes[KMYTH_SKI_OBJECT_COUNT] = { 0 };
+
+  init_test_pcrSelect(&pcr_selection_in, 0);
+  init_test_public(&sk_public_in, 0);
+  init_test_private(&sk_private_in, 32, 0);
+  init_test_public(&sealed_key_public_in, 0);
+  init_test_private(&sealed_key_private_in, 64, 0);
+
+  // check that NULL or empty input structs error
+  CU_ASSERT(pack_ski_objects(NULL, &sk_public_in, &sk_private_in,
+                             &sealed_key_public_in, &sealed_key_private_in,
+                             &block, &block_size, objects, object_sizes) != 0);
+  CU_ASSERT(pack_ski_objects(&pcr_selection_in, &sk_public_in,
+                             &sk_private_out, &sealed_key_public_in,
+                             &sealed_key_private_in, &block, &block_size,
+                             objects, object_sizes) != 0);
+  CU_ASSERT(block == NULL);
+
+  // check that the objects are packed, in order, into one block
+  CU_ASSERT(pack_ski_objects(&pcr_selection_in, &sk_public_in,
+                             &sk_private_in, &sealed_key_public_in,
+                             &sealed_key_private_in, &block, &block_size,
+                             objects, object_sizes) == 0);
+  CU_ASSERT(objects[0] == block);
+  CU_ASSERT(object_sizes[0] == sizeof(TPML_PCR_SELECTION));
+  CU_ASSERT(object_sizes[1] == sk_public_in.size + 2);
+  CU_ASSERT(object_sizes[2] == sk_private_in.size + 2);
+  CU_ASSERT(object_sizes[3] == sealed_key_public_in.size + 2);
+  CU_ASSERT(object_sizes[4] == sealed_key_private_in.size + 2);
+  for (int i = 1; i < KMYTH_SKI_OBJECT_COUNT; i++)
+  {
+    CU_ASSERT(objects[i] == objects[i - 1] + object_sizes[i - 1]);
+  }
+  CU_ASSERT(objects[4] + object_sizes[4] == block + block_size);
+  CU_ASSERT(check_packed_pcrSelect(pcr_selection_in, objects[0],
+                                   object_sizes[0], 0));
+  CU_ASSERT(check_packed_public(sk_public_in, objects[1], object_sizes[1], 0));
+  CU_ASSERT(check_packed_private(sk_private_in, objects[2],
+                                 object_sizes[2], 0));
+  CU_ASSERT(check_packed_public(sealed_key_public_in, objects[3],
+                                object_sizes[3], 0));
+  CU_ASSERT(check_packed_private(sealed_key_private_in, objects[4],
+                                 object_sizes[4], 0));
+
+  // check that the objects unpack from slices of the block
+  CU_ASSERT(unpack_ski_objects(objects, object_sizes, &pcr_selection_out,
+                               &sk_public_out, &sk_private_out,
+                               &sealed_key_public_out,
+                               &sealed_key_private_out) == 0);
+  CU_ASSERT(match_pcrSelect(pcr_selection_out, pcr_selection_in));
+  CU_ASSERT(match_public(sk_public_out, sk_public_in));
+  CU_ASSERT(match_private(sk_private_out, sk_private_in));
+  CU_ASSERT(match_public(sealed_key_public_out, sealed_key_public_in));
+  CU_ASSERT(match_private(sealed_key_private_out, sealed_key_private_in));
+
+  // check that a truncated slice errors
+  object_sizes[4] -= 1;
+  CU_ASSERT(unpack_ski_objects(objects, object_sizes, &pcr_selection_out,
+                               &sk_public_out, &sk_private_out,
+                               &sealed_key_public_out,
+                               &sealed_key_private_out) != 0);
+
+  free(block);
+}
+
 //----------------------------------------------------------------------------
 // test_pack_unpack_pcr
 //----------------------------------------------------------------------------
@@ -1478,6 +1610,71 @@ void test_unpack_uint32_to_str(void)
   free(test_str);
 }
 
+//----------------------------------------------------------------------------
+// test_pack_unpack_bundle_payloads
+//----------------------------------------------------------------------------
+void test_pack_unpack_bundle_payloads(void)
+{
+  uint8_t p0[] = { 0x01, 0x02, 0x03 };
+  uint8_t p1[] = { 0xAA };
+  uint8_t p2[] = { 0x10, 0x20, 0x30, 0x40, 0x50 };
+  uint8_t *payloads[] = { p0, p1, p2 };
+  size_t payload_sizes[] = { sizeof(p0), sizeof(p1), sizeof(p2) };
+
+  uint8_t *block = NULL;
+  size_t block_size = 0;
+
+  // check that a valid payload list packs into the expected size
+  // (count plus a size prefix and contents for each payload)
+  CU_ASSERT(pack_bundle_payloads(payloads, payload_sizes, 3,
+                                 &block, &block_size) == 0);
+  CU_ASSERT(block_size == 4 + (4 + 3) + (4 + 1) + (4 + 5));
+  CU_ASSERT(block[3] == 3);
+
+  // check that unpacking recovers every payload, in order
+  uint8_t **out = NULL;
+  size_t *out_sizes = NULL;
+  size_t out_count = 0;
+
+  CU_ASSERT(unpack_bundle_payloads(block, block_size,
+                                   &out, &out_sizes, &out_count) == 0);
+  CU_ASSERT(out_count == 3);
+  for (size_t i = 0; i < out_count && i < 3; i++)
+  {
+    CU_ASSERT(out_sizes[i] == payload_sizes[i]);
+    CU_ASSERT(memcmp(out[i], payloads[i], payload_sizes[i]) == 0);
+  }
+  free(out);
+  free(out_sizes);
+
+  // check that truncated or padded blocks are rejected
+  CU_ASSERT(unpack_bundle_payloads(block, block_size - 1,
+                                   &out, &out_sizes, &out_count) == 1);
+
+  uint8_t *padded = calloc(block_size + 1, 1);
+
+  memcpy(padded, block, block_size);
+  CU_ASSERT(unpack_bundle_payloads(padded, block_size + 1,
+                                   &out, &out_sizes, &out_count) == 1);
+  free(padded);
+
+  // check that a zero payload count is rejected
+  uint8_t empty[] = { 0x00, 0x00, 0x00, 0x00 };
+
+  CU_ASSERT(unpack_bundle_payloads(empty, sizeof(empty),
+                                   &out, &out_sizes, &out_count) == 1);
+  free(block);
+
+  // check that empty payload lists or empty payloads are rejected
+  block = NULL;
+  CU_ASSERT(pack_bundle_payloads(payloads, payload_sizes, 0,
+                                 &block, &block_size) == 1);
+  payload_sizes[1] = 0;
+  CU_ASSERT(pack_bundle_payloads(payloads, payload_sizes, 3,
+                                 &block, &block_size) == 1);
+  CU_ASSERT(block == NULL);
+}
+
 //----------------------------------------------------------------------------
 // test_parse_ski_bytes
 //----------------------------------------------------------------------------
@@ -1568,7 +1765,7 @@ void test_create_ski_bytes(void)
   uint8_t *sb = NULL;
   size_t sb_len = 0;
 
-  CU_ASSERT(create_ski_bytes(ski, &sb, &sb_len) == 0);
+  CU_ASSERT(create_ski_bytes(ski, KMYTH_SKI_FORMAT_TEXT, &sb, &sb_len) == 0);
   CU_ASSERT(sb_len == ski_bytes_len);
   CU_ASSERT(memcmp(sb, CONST_SKI_BYTES, sb_len) == 0);
   free(sb);
@@ -1579,55 +1776,55 @@ void test_create_ski_bytes(void)
   int orig = ski.sk_pub.size;
 
   ski.sk_pub.size = 0;
-  CU_ASSERT(create_ski_bytes(ski, &sb, &sb_len) == 1);
+  CU_ASSERT(create_ski_bytes(ski, KMYTH_SKI_FORMAT_TEXT, &sb, &sb_len) == 1);
   CU_ASSERT(sb == NULL);
   CU_ASSERT(sb_len == 0);
   ski.sk_pub.size = orig;
-  CU_ASSERT(create_ski_bytes(ski, &sb, &sb_len) == 0);
+  CU_ASSERT(create_ski_bytes(ski, KMYTH_SKI_FORMAT_TEXT, &sb, &sb_len) == 0);
   free(sb);
   sb = NULL;
   sb_len = 0;
 
   orig = ski.sk_priv.size;
   ski.sk_priv.size = 0;
-  CU_ASSERT(create_ski_bytes(ski, &sb, &sb_len) == 1);
+  CU_ASSERT(create_ski_bytes(ski, KMYTH_SKI_FORMAT_TEXT, &sb, &sb_len) == 1);
   CU_ASSERT(sb == NULL);
   CU_ASSERT(sb_len == 0);
   ski.sk_priv.size = orig;
-  CU_ASSERT(create_ski_bytes(ski, &sb, &sb_len) == 0);
+  CU_ASSERT(create_ski_bytes(ski, KMYTH_SKI_FORMAT_TEXT, &sb, &sb_len) == 0);
   free(sb);
   sb = NULL;
   sb_len = 0;
 
   orig = ski.wk_pub.size;
   ski.wk_pub.size = 0;
-  CU_ASSERT(create_ski_bytes(ski, &sb, &sb_len) == 1);
+  CU_ASSERT(create_ski_bytes(ski, KMYTH_SKI_FORMAT_TEXT, &sb, &sb_len) == 1);
   CU_ASSERT(sb == NULL);
   CU_ASSERT(sb_len == 0);
   ski.wk_pub.size = orig;
-  CU_ASSERT(create_ski_bytes(ski, &sb, &sb_len) == 0);
+  CU_ASSERT(create_ski_bytes(ski, KMYTH_SKI_FORMAT_TEXT, &sb, &sb_len) == 0);
   free(sb);
   sb = NULL;
   sb_len = 0;
 
   orig = ski.wk_priv.size;
   ski.wk_priv.size = 0;
-  CU_ASSERT(create_ski_bytes(ski, &sb, &sb_len) == 1);
+  CU_ASSERT(create_ski_bytes(ski, KMYTH_SKI_FORMAT_TEXT, &sb, &sb_len) == 1);
   CU_ASSERT(sb == NULL);
   CU_ASSERT(sb_len == 0);
   ski.wk_priv.size = orig;
-  CU_ASSERT(create_ski_bytes(ski, &sb, &sb_len) == 0);
+  CU_ASSERT(create_ski_bytes(ski, KMYTH_SKI_FORMAT_TEXT, &sb, &sb_len) == 0);
   free(sb);
   sb = NULL;
   sb_len = 0;
 
   orig = ski.enc_data_size;
   ski.enc_data_size = 0;
-  CU_ASSERT(create_ski_bytes(ski, &sb, &sb_len) == 1);
+  CU_ASSERT(create_ski_bytes(ski, KMYTH_SKI_FORMAT_TEXT, &sb, &sb_len) == 1);
   CU_ASSERT(sb == NULL);
   CU_ASSERT(sb_len == 0);
   ski.enc_data_size = orig;
-  CU_ASSERT(create_ski_bytes(ski, &sb, &sb_len) == 0);
+  CU_ASSERT(create_ski_bytes(ski, KMYTH_SKI_FORMAT_TEXT, &sb, &sb_len) == 0);
   free(sb);
   sb = NULL;
   sb_len = 0;
@@ -1636,22 +1833,391 @@ void test_create_ski_bytes(void)
 
   memcpy(data, ski.enc_data, ski.enc_data_size);
   ski.enc_data = NULL;
-  CU_ASSERT(create_ski_bytes(ski, &sb, &sb_len) == 1);
+  CU_ASSERT(create_ski_bytes(ski, KMYTH_SKI_FORMAT_TEXT, &sb, &sb_len) == 1);
   CU_ASSERT(sb == NULL);
   CU_ASSERT(sb_len == 0);
   ski.enc_data = data;
-  CU_ASSERT(create_ski_bytes(ski, &sb, &sb_len) == 0);
+  CU_ASSERT(create_ski_bytes(ski, KMYTH_SKI_FORMAT_TEXT, &sb, &sb_len) == 0);
   free(sb);
   sb = NULL;
   sb_len = 0;
   free_ski(&ski);
 
   //Valid ski that has empty/NULL cannot be used
-  CU_ASSERT(create_ski_bytes(get_default_ski(), &sb, &sb_len) == 1);
+  CU_ASSERT(create_ski_bytes(get_default_ski(), KMYTH_SKI_FORMAT_TEXT,
+                             &sb, &sb_len) == 1);
   CU_ASSERT(sb == NULL);
   CU_ASSERT(sb_len == 0);
 }
 
+//----------------------------------------------------------------------------
+// test_create_parse_ski_binary
+//----------------------------------------------------------------------------
+void test_create_parse_ski_binary(void)
+{
+  size_t ski_bytes_len = strlen(CONST_SKI_BYTES);
+  Ski ski = get_default_ski();
+
+  CU_ASSERT(parse_ski_bytes((uint8_t *) CONST_SKI_BYTES, ski_bytes_len, &ski)
+            == 0);
+
+  //Valid binary .ski is smaller than the text form and begins with the magic
+  uint8_t *sb = NULL;
+  size_t sb_len = 0;
+
+  CU_ASSERT(create_ski_bytes(ski, KMYTH_SKI_FORMAT_BINARY, &sb, &sb_len) == 0);
+  CU_ASSERT(sb_len < ski_bytes_len);
+  CU_ASSERT(memcmp(sb, KMYTH_SKI_BINARY_MAGIC,
+                   KMYTH_SKI_BINARY_MAGIC_LEN) == 0);
+
+  //Parsing the binary form recovers the same ski, so re-encoding it as text
+  //reproduces the original bytes
+  Ski parsed = get_default_ski();
+  uint8_t *tb = NULL;
+  size_t tb_len = 0;
+
+  CU_ASSERT(parse_ski_bytes(sb, sb_len, &parsed) == 0);
+  CU_ASSERT(parsed.enc_data_size == ski.enc_data_size);
+  CU_ASSERT(memcmp(parsed.enc_data, ski.enc_data, ski.enc_data_size) == 0);
+  CU_ASSERT(parsed.bundle == false);
+  CU_ASSERT(create_ski_bytes(parsed, KMYTH_SKI_FORMAT_TEXT, &tb, &tb_len)
+            == 0);
+  CU_ASSERT(tb_len == ski_bytes_len);
+  CU_ASSERT(memcmp(tb, CONST_SKI_BYTES, tb_len) == 0);
+  free(tb);
+  free_ski(&parsed);
+
+  //Truncated input or trailing data
+  CU_ASSERT(parse_ski_bytes(sb, sb_len - 1, &parsed) == 1);
+  CU_ASSERT(parse_ski_bytes(sb, KMYTH_SKI_BINARY_HEADER_LEN, &parsed) == 1);
+  CU_ASSERT(parse_ski_bytes(sb, KMYTH_SKI_BINARY_MAGIC_LEN + 1, &parsed)
+            == 1);
+
+  uint8_t *longer = malloc(sb_len + 1);
+
+  memcpy(longer, sb, sb_len);
+  longer[sb_len] = 0;
+  CU_ASSERT(parse_ski_bytes(longer, sb_len + 1, &parsed) == 1);
+  free(longer);
+
+  //Unsupported version, unknown flags, or corrupt section length
+  sb[KMYTH_SKI_BINARY_MAGIC_LEN]++;
+  CU_ASSERT(parse_ski_bytes(sb, sb_len, &parsed) == 1);
+  sb[KMYTH_SKI_BINARY_MAGIC_LEN]--;
+  sb[KMYTH_SKI_BINARY_MAGIC_LEN + 1] = 0x80;
+  CU_ASSERT(parse_ski_bytes(sb, sb_len, &parsed) == 1);
+  sb[KMYTH_SKI_BINARY_MAGIC_LEN + 1] = 0;
+  sb[KMYTH_SKI_BINARY_HEADER_LEN] = 0xFF;
+  CU_ASSERT(parse_ski_bytes(sb, sb_len, &parsed) == 1);
+  sb[KMYTH_SKI_BINARY_HEADER_LEN] = 0;
+  CU_ASSERT(parse_ski_bytes(sb, sb_len, &parsed) == 0);
+  free_ski(&parsed);
+  free(sb);
+  sb = NULL;
+  sb_len = 0;
+
+  //The bundle flag is preserved
+  ski.bundle = true;
+  CU_ASSERT(create_ski_bytes(ski, KMYTH_SKI_FORMAT_BINARY, &sb, &sb_len) == 0);
+  CU_ASSERT(parse_ski_bytes(sb, sb_len, &parsed) == 0);
+  CU_ASSERT(parsed.bundle == true);
+  free_ski(&parsed);
+  free(sb);
+  sb = NULL;
+  sb_len = 0;
+
+  //Invalid format selection
+  CU_ASSERT(create_ski_bytes(ski, (kmyth_ski_format) 99, &sb, &sb_len) == 1);
+  CU_ASSERT(sb == NULL);
+  free_ski(&ski);
+}
+
+//----------------------------------------------------------------------------
+// test_ski_view
+//----------------------------------------------------------------------------
+void test_ski_view(void)
+{
+  size_t ski_bytes_len = strlen(CONST_SKI_BYTES);
+  Ski ski = get_default_ski();
+  uint8_t *sb = NULL;
+  size_t sb_len = 0;
+
+  CU_ASSERT(parse_ski_bytes((uint8_t *) CONST_SKI_BYTES, ski_bytes_len, &ski)
+            == 0);
+  CU_ASSERT(create_ski_bytes(ski, KMYTH_SKI_FORMAT_BINARY, &sb, &sb_len) == 0);
+
+  //Both formats give the same results, decoding only what is asked for
+  uint8_t *inputs[] = { (uint8_t *) CONST_SKI_BYTES, sb };
+  size_t input_lens[] = { ski_bytes_len, sb_len };
+
+  for (int i = 0; i < 2; i++)
+  {
+    SkiView view;
+    cipher_t cipher;
+    TPML_PCR_SELECTION *pcr_list = NULL;
+    Ski *view_ski = NULL;
+
+    CU_ASSERT(open_ski_view(inputs[i], input_lens[i], &view) == 0);
+    CU_ASSERT(view.encoded == (i == 0));
+    CU_ASSERT(view.decoded == 0);
+
+    CU_ASSERT(ski_view_get_cipher(&view, &cipher) == 0);
+    CU_ASSERT(strcmp(cipher.cipher_name, ski.cipher.cipher_name) == 0);
+    CU_ASSERT(ski_view_get_pcr_list(&view, &pcr_list) == 0);
+    CU_ASSERT(match_pcrSelect(*pcr_list, ski.pcr_list));
+    CU_ASSERT(view.decoded == (KMYTH_SKI_VIEW_CIPHER |
+                               KMYTH_SKI_VIEW_PCR_LIST));
+    CU_ASSERT(view.ski.enc_data == NULL);
+
+    CU_ASSERT(ski_view_get_ski(&view, &view_ski) == 0);
+    CU_ASSERT(match_public(view_ski->sk_pub, ski.sk_pub));
+    CU_ASSERT(match_private(view_ski->sk_priv, ski.sk_priv));
+    CU_ASSERT(match_public(view_ski->wk_pub, ski.wk_pub));
+    CU_ASSERT(match_private(view_ski->wk_priv, ski.wk_priv));
+    CU_ASSERT(view_ski->enc_data_size == ski.enc_data_size);
+    CU_ASSERT(memcmp(view_ski->enc_data, ski.enc_data,
+                     ski.enc_data_size) == 0);
+    free_ski_view(&view);
+    CU_ASSERT(view.decoded == 0);
+  }
+
+  //Malformed framing is caught when the view is opened
+  SkiView view;
+
+  CU_ASSERT(open_ski_view(sb, sb_len - 1, &view) == 1);
+  CU_ASSERT(open_ski_view((uint8_t *) CONST_SKI_BYTES, ski_bytes_len - 1,
+                          &view) == 1);
+  CU_ASSERT(open_ski_view(NULL, 0, &view) == 1);
+
+  free(sb);
+  free_ski(&ski);
+}
+
+//----------------------------------------------------------------------------
+// test_create_ski_rewrap_header
+//----------------------------------------------------------------------------
+void test_create_ski_rewrap_header(void)
+{
+  size_t ski_bytes_len = strlen(CONST_SKI_BYTES);
+  Ski ski = get_default_ski();
+  uint8_t *sb = NULL;
+  size_t sb_len = 0;
+
+  CU_ASSERT(parse_ski_bytes((uint8_t *) CONST_SKI_BYTES, ski_bytes_len, &ski)
+            == 0);
+  CU_ASSERT(create_ski_bytes(ski, KMYTH_SKI_FORMAT_BINARY, &sb, &sb_len) == 0);
+
+  uint8_t *inputs[] = { (uint8_t *) CONST_SKI_BYTES, sb };
+  size_t input_lens[] = { ski_bytes_len, sb_len };
+
+  for (int i = 0; i < 2; i++)
+  {
+    uint8_t *hdr = NULL;
+    size_t hdr_len = 0;
+    size_t data_offset = 0;
+
+    //The same TPM objects give back the leading bytes of the input
+    CU_ASSERT(create_ski_rewrap_header(inputs[i], input_lens[i], ski,
+                                       &hdr, &hdr_len, &data_offset) == 0);
+    CU_ASSERT(hdr_len == data_offset);
+    CU_ASSERT(memcmp(hdr, inputs[i], hdr_len) == 0);
+    free(hdr);
+
+    //New TPM objects are followed by the input's encrypted data
+    Ski new_ski = ski;
+    Ski rewrapped = get_default_ski();
+    uint8_t *out = NULL;
+    size_t out_len = 0;
+
+    new_ski.wk_priv.buffer[0] ^= 0xff;
+    CU_ASSERT(create_ski_rewrap_header(inputs[i], input_lens[i], new_ski,
+                                       &hdr, &hdr_len, &data_offset) == 0);
+    out_len = hdr_len + input_lens[i] - data_offset;
+    out = malloc(out_len);
+    memcpy(out, hdr, hdr_len);
+    memcpy(out + hdr_len, inputs[i] + data_offset,
+           input_lens[i] - data_offset);
+    CU_ASSERT(parse_ski_bytes(out, out_len, &rewrapped) == 0);
+    CU_ASSERT(match_private(rewrapped.wk_priv, new_ski.wk_priv));
+    CU_ASSERT(match_public(rewrapped.sk_pub, ski.sk_pub));
+    CU_ASSERT(rewrapped.enc_data_size == ski.enc_data_size);
+    CU_ASSERT(memcmp(rewrapped.enc_data, ski.enc_data,
+                     ski.enc_data_size) == 0);
+    free_ski(&rewrapped);
+    free(out);
+    free(hdr);
+  }
+
+  //A malformed input is not rewrapped
+  uint8_t *hdr = NULL;
+  size_t hdr_len = 0;
+  size_t data_offset = 0;
+
+  CU_ASSERT(create_ski_rewrap_header(sb, sb_len - 1, ski, &hdr, &hdr_len,
+                                     &data_offset) == 1);
+  CU_ASSERT(hdr == NULL);
+
+  free(sb);
+  free_ski(&ski);
+}
+
+//----------------------------------------------------------------------------
+// test_create_parse_ski_stream
+//----------------------------------------------------------------------------
+void test_create_parse_ski_stream(void)
+{
+  Ski ski = get_default_ski();
+
+  CU_ASSERT(parse_ski_bytes((uint8_t *) CONST_SKI_BYTES,
+                            strlen(CONST_SKI_BYTES), &ski) == 0);
+
+  //A stream .ski header is a binary .ski up to its encrypted data size,
+  //which is recorded as unknown
+  uint8_t *hdr = NULL;
+  size_t hdr_len = 0;
+
+  CU_ASSERT(create_ski_stream_header(ski, &hdr, &hdr_len) == 0);
+  CU_ASSERT(memcmp(hdr, KMYTH_SKI_BINARY_MAGIC,
+                   KMYTH_SKI_BINARY_MAGIC_LEN) == 0);
+  CU_ASSERT(hdr[KMYTH_SKI_BINARY_MAGIC_LEN + 1] ==
+            KMYTH_SKI_BINARY_FLAG_STREAM);
+  for (size_t i = hdr_len - sizeof(uint64_t); i < hdr_len; i++)
+  {
+    CU_ASSERT(hdr[i] == 0xFF);
+  }
+
+  //With the encrypted data appended, it parses as any other .ski
+  size_t sb_len = hdr_len + ski.enc_data_size;
+  uint8_t *sb = malloc(sb_len);
+  Ski parsed = get_default_ski();
+
+  memcpy(sb, hdr, hdr_len);
+  memcpy(sb + hdr_len, ski.enc_data, ski.enc_data_size);
+  CU_ASSERT(parse_ski_bytes(sb, sb_len, &parsed) == 0);
+  CU_ASSERT(parsed.enc_data_size == ski.enc_data_size);
+  CU_ASSERT(memcmp(parsed.enc_data, ski.enc_data, ski.enc_data_size) == 0);
+  free_ski(&parsed);
+
+  //No encrypted data, or a stream size without the stream flag
+  CU_ASSERT(parse_ski_bytes(sb, hdr_len, &parsed) == 1);
+  sb[KMYTH_SKI_BINARY_MAGIC_LEN + 1] = 0;
+  CU_ASSERT(parse_ski_bytes(sb, sb_len, &parsed) == 1);
+  sb[KMYTH_SKI_BINARY_MAGIC_LEN + 1] = KMYTH_SKI_BINARY_FLAG_STREAM;
+
+  //Reading the header from a stream leaves it at the encrypted data
+  FILE *in = fmemopen(sb, sb_len, "rb");
+  uint8_t magic[KMYTH_SKI_BINARY_MAGIC_LEN];
+  uint8_t *rh = NULL;
+  size_t rh_len = 0;
+  uint64_t enc_data_size = 0;
+
+  CU_ASSERT(fread(magic, 1, sizeof(magic), in) == sizeof(magic));
+  CU_ASSERT(read_ski_stream_header(in, magic, sizeof(magic),
+                                   &rh, &rh_len) == 0);
+  CU_ASSERT(rh_len == hdr_len);
+  CU_ASSERT(memcmp(rh, hdr, hdr_len) == 0);
+  CU_ASSERT(fgetc(in) == ski.enc_data[0]);
+  fclose(in);
+  CU_ASSERT(parse_ski_stream_header(rh, rh_len, &parsed, &enc_data_size)
+            == 0);
+  CU_ASSERT(enc_data_size == KMYTH_SKI_BINARY_STREAM_SIZE);
+  CU_ASSERT(parsed.enc_data == NULL);
+  CU_ASSERT(strcmp(parsed.cipher.cipher_name, ski.cipher.cipher_name) == 0);
+  CU_ASSERT(parse_ski_stream_header(rh, rh_len - 1, &parsed, &enc_data_size)
+            == 1);
+  free(rh);
+  rh = NULL;
+
+  //A truncated header cannot be read
+  in = fmemopen(sb, hdr_len - 1, "rb");
+  CU_ASSERT(read_ski_stream_header(in, NULL, 0, &rh, &rh_len) == 1);
+  CU_ASSERT(rh == NULL);
+  fclose(in);
+  free(sb);
+
+  //The header of a standard binary .ski records its encrypted data size
+  CU_ASSERT(create_ski_bytes(ski, KMYTH_SKI_FORMAT_BINARY, &sb, &sb_len)
+            == 0);
+  in = fmemopen(sb, sb_len, "rb");
+  CU_ASSERT(read_ski_stream_header(in, NULL, 0, &rh, &rh_len) == 0);
+  fclose(in);
+  CU_ASSERT(rh_len == sb_len - ski.enc_data_size);
+  CU_ASSERT(parse_ski_stream_header(rh, rh_len, &parsed, &enc_data_size)
+            == 0);
+  CU_ASSERT(enc_data_size == ski.enc_data_size);
+  free(rh);
+  free(sb);
+
+  //A bundle cannot be written as a stream
+  ski.bundle = true;
+  CU_ASSERT(create_ski_stream_header(ski, &hdr, &hdr_len) == 1);
+
+  free(hdr);
+  free_ski(&ski);
+}
+
+//----------------------------------------------------------------------------
+// test_create_parse_ski_compressed
+//----------------------------------------------------------------------------
+void test_create_parse_ski_compressed(void)
+{
+  Ski ski = get_default_ski();
+
+  CU_ASSERT(parse_ski_bytes((uint8_t *) CONST_SKI_BYTES,
+                            strlen(CONST_SKI_BYTES), &ski) == 0);
+  CU_ASSERT(ski.compression == KMYTH_COMPRESSION_NONE);
+  ski.compression = KMYTH_COMPRESSION_ZSTD;
+
+  //Only the binary format can record the compression
+  uint8_t *sb = NULL;
+  size_t sb_len = 0;
+
+  CU_ASSERT(create_ski_bytes(ski, KMYTH_SKI_FORMAT_TEXT, &sb, &sb_len) == 1);
+  CU_ASSERT(sb == NULL);
+
+  //The compression flag survives a round trip, in a standard or stream
+  //.ski, and in a bundle
+  Ski parsed = get_default_ski();
+
+  CU_ASSERT(create_ski_bytes(ski, KMYTH_SKI_FORMAT_BINARY, &sb, &sb_len)
+            == 0);
+  CU_ASSERT(sb[KMYTH_SKI_BINARY_MAGIC_LEN + 1] == KMYTH_SKI_BINARY_FLAG_ZSTD);
+  CU_ASSERT(parse_ski_bytes(sb, sb_len, &parsed) == 0);
+  CU_ASSERT(parsed.compression == KMYTH_COMPRESSION_ZSTD);
+  CU_ASSERT(!parsed.bundle);
+  free_ski(&parsed);
+  CU_ASSERT(parsed.compression == KMYTH_COMPRESSION_NONE);
+
+  //An unknown flag is rejected
+  sb[KMYTH_SKI_BINARY_MAGIC_LEN + 1] = 0x08;
+  CU_ASSERT(parse_ski_bytes(sb, sb_len, &parsed) == 1);
+  free(sb);
+
+  uint8_t *hdr = NULL;
+  size_t hdr_len = 0;
+  uint64_t enc_data_size = 0;
+
+  CU_ASSERT(create_ski_stream_header(ski, &hdr, &hdr_len) == 0);
+  CU_ASSERT(hdr[KMYTH_SKI_BINARY_MAGIC_LEN + 1] ==
+            (KMYTH_SKI_BINARY_FLAG_STREAM | KMYTH_SKI_BINARY_FLAG_ZSTD));
+  CU_ASSERT(parse_ski_stream_header(hdr, hdr_len, &parsed, &enc_data_size)
+            == 0);
+  CU_ASSERT(parsed.compression == KMYTH_COMPRESSION_ZSTD);
+  free_ski(&parsed);
+  free(hdr);
+
+  ski.bundle = true;
+  CU_ASSERT(create_ski_bytes(ski, KMYTH_SKI_FORMAT_BINARY, &sb, &sb_len)
+            == 0);
+  CU_ASSERT(parse_ski_bytes(sb, sb_len, &parsed) == 0);
+  CU_ASSERT(parsed.bundle);
+  CU_ASSERT(parsed.compression == KMYTH_COMPRESSION_ZSTD);
+  free_ski(&parsed);
+  free(sb);
+
+  free_ski(&ski);
+}
+
 //----------------------------------------------------------------------------
 // test_free_ski
 //----------------------------------------------------------------------------
@@ -1813,6 +2379,66 @@ void test_get_block_bytes(void)
   free(sb);
 }
 
+//----------------------------------------------------------------------------
+// test_get_block_view
+//----------------------------------------------------------------------------
+void test_get_block_view(void)
+{
+  size_t sb_len = strlen(CONST_SKI_BYTES);
+  uint8_t *sb = malloc(sb_len * sizeof(char));
+
+  memcpy(sb, CONST_SKI_BYTES, sb_len);
+
+  uint8_t *position = sb;
+  size_t remaining = sb_len;
+  uint8_t *block = NULL;
+  size_t block_size = 0;
+
+  // valid parse should return a view into the input, not a copy, and leave
+  // the position at the start of the next delimiter
+  CU_ASSERT(get_block_view(&position, &remaining, &block, &block_size,
+                           KMYTH_DELIM_PCR_SELECTION_LIST,
+                           strlen(KMYTH_DELIM_PCR_SELECTION_LIST),
+                           KMYTH_DELIM_STORAGE_KEY_PUBLIC,
+                           strlen(KMYTH_DELIM_STORAGE_KEY_PUBLIC)) == 0);
+  CU_ASSERT(block == sb + strlen(KMYTH_DELIM_PCR_SELECTION_LIST));
+  CU_ASSERT(block_size == strlen(RAW_PCR64));
+  CU_ASSERT(memcmp(block, RAW_PCR64, block_size) == 0);
+  CU_ASSERT(position == block + block_size);
+  CU_ASSERT(remaining == sb_len - (size_t) (position - sb));
+
+  // the delimiter prefix should stop at whichever delimiter comes next
+  CU_ASSERT(get_block_view(&position, &remaining, &block, &block_size,
+                           KMYTH_DELIM_STORAGE_KEY_PUBLIC,
+                           strlen(KMYTH_DELIM_STORAGE_KEY_PUBLIC),
+                           KMYTH_DELIM_PREFIX,
+                           strlen(KMYTH_DELIM_PREFIX)) == 0);
+  CU_ASSERT(memcmp(position, KMYTH_DELIM_STORAGE_KEY_PRIVATE,
+                   strlen(KMYTH_DELIM_STORAGE_KEY_PRIVATE)) == 0);
+
+  // a mismatched current delimiter should error and leave inputs unchanged
+  uint8_t *saved_position = position;
+  size_t saved_remaining = remaining;
+
+  CU_ASSERT(get_block_view(&position, &remaining, &block, &block_size,
+                           KMYTH_DELIM_CIPHER_SUITE,
+                           strlen(KMYTH_DELIM_CIPHER_SUITE),
+                           KMYTH_DELIM_SYM_KEY_PUBLIC,
+                           strlen(KMYTH_DELIM_SYM_KEY_PUBLIC)) == 1);
+  CU_ASSERT(position == saved_position);
+  CU_ASSERT(remaining == saved_remaining);
+
+  // a current delimiter longer than the remaining input should error
+  remaining = 3;
+  CU_ASSERT(get_block_view(&position, &remaining, &block, &block_size,
+                           KMYTH_DELIM_STORAGE_KEY_PRIVATE,
+                           strlen(KMYTH_DELIM_STORAGE_KEY_PRIVATE),
+                           KMYTH_DELIM_CIPHER_SUITE,
+                           strlen(KMYTH_DELIM_CIPHER_SUITE)) == 1);
+
+  free(sb);
+}
+
 //----------------------------------------------------------------------------
 // test_create_nkl_bytes
 //----------------------------------------------------------------------------
@@ -0,0 +1,198 @@
+//############################################################################
+// kmyth_hpp_test.cpp
+//
+// Tests the C++ wrappers of the kmyth seal/unseal library in
+// include/kmyth.hpp
+//############################################################################
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <CUnit/CUnit.h>
+
+#include "kmyth.hpp"
+extern "C"
+{
+#include "tpm2_interface.h"
+}
+#include "kmyth_hpp_test.h"
+
+//----------------------------------------------------------------------------
+// kmyth_hpp_add_tests()
+//----------------------------------------------------------------------------
+int kmyth_hpp_add_tests(CU_pSuite suite)
+{
+  // If we're running on hardware we don't do these tests
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+
+  init_tpm2_connection(&sapi_ctx);
+  bool emulator = true;
+
+  get_tpm2_impl_type(sapi_ctx, &emulator);
+  free_tpm2_resources(&sapi_ctx);
+  if (!emulator)
+  {
+    return 0;
+  }
+
+  if (NULL == CU_add_test(suite, "kmyth::TpmContext Tests",
+                          test_kmyth_hpp_tpm_context))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite, "kmyth::TpmContext Compression Tests",
+                          test_kmyth_hpp_compression))
+  {
+    return 1;
+  }
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// make_input()
+//
+// Compressible test data (a repeated pattern)
+//----------------------------------------------------------------------------
+static std::vector<std::uint8_t> make_input(std::size_t size)
+{
+  std::vector<std::uint8_t> input(size);
+
+  for (std::size_t i = 0; i < size; i++)
+  {
+    input[i] = static_cast<std::uint8_t>(i % 61);
+  }
+  return input;
+}
+
+//----------------------------------------------------------------------------
+// throws_error()
+//
+// True if calling f throws kmyth::Error
+//----------------------------------------------------------------------------
+template <typename F> static bool throws_error(F f)
+{
+  try
+  {
+    f();
+  }
+  catch (const kmyth::Error &)
+  {
+    return true;
+  }
+  return false;
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_hpp_tpm_context()
+//----------------------------------------------------------------------------
+void test_kmyth_hpp_tpm_context(void)
+{
+  std::vector<std::uint8_t> input = make_input(4096);
+
+  try
+  {
+    kmyth::TpmContext ctx;
+
+    // Check that a seal/unseal round trip through the caller-provided
+    // buffer variants recovers the input
+    kmyth::SealedBlob blob = ctx.seal(input);
+
+    CU_ASSERT(!blob.empty());
+    CU_ASSERT(blob.size() <= ctx.sealed_size(input));
+
+    kmyth::SecureBuffer plaintext = ctx.unseal(blob.span());
+
+    CU_ASSERT(plaintext.size() == input.size());
+    CU_ASSERT(std::memcmp(plaintext.data(), input.data(), input.size()) ==
+              0);
+
+    // Check that a moved-from context no longer holds the C context
+    kmyth::TpmContext moved(std::move(ctx));
+
+    CU_ASSERT(ctx.get() == nullptr);
+    CU_ASSERT(moved.get() != nullptr);
+
+    // Check that a moved-from buffer is left empty
+    kmyth::SecureBuffer taken(std::move(plaintext));
+
+    CU_ASSERT(plaintext.empty());
+    CU_ASSERT(plaintext.data() == nullptr);
+    CU_ASSERT(taken.size() == input.size());
+  }
+  catch (const kmyth::Error &)
+  {
+    CU_FAIL("kmyth::TpmContext round trip threw kmyth::Error");
+  }
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_hpp_compression()
+//----------------------------------------------------------------------------
+void test_kmyth_hpp_compression(void)
+{
+  std::vector<std::uint8_t> input = make_input(64 * 1024);
+
+  try
+  {
+    kmyth::TpmContext ctx;
+
+    ctx.set_compression(KMYTH_COMPRESSION_ZSTD);
+
+    // Check that seal() falls back to the allocating seal, whose .ski
+    // records the compression (and is smaller than the input)
+    kmyth::SealedBlob blob = ctx.seal(input);
+    kmyth_compression compression = KMYTH_COMPRESSION_NONE;
+
+    CU_ASSERT(!blob.empty());
+    CU_ASSERT(blob.size() < input.size());
+    CU_ASSERT(kmyth_ski_get_compression(blob.data(), blob.size(),
+                                        &compression) == 0);
+    CU_ASSERT(compression == KMYTH_COMPRESSION_ZSTD);
+
+    // Check that the caller-provided buffer variants still refuse
+    // compressed data
+    CU_ASSERT(throws_error([&] { ctx.sealed_size(input); }));
+    CU_ASSERT(throws_error([&] {
+                           kmyth::TpmContext::unsealed_size(blob.span());
+                           }));
+
+    // Check that unseal() falls back to the allocating unseal, even with
+    // compression no longer selected (the .ski records it)
+    ctx.set_compression(KMYTH_COMPRESSION_NONE);
+
+    kmyth::SecureBuffer plaintext = ctx.unseal(blob.span());
+
+    CU_ASSERT(plaintext.size() == input.size());
+    CU_ASSERT(std::memcmp(plaintext.data(), input.data(), input.size()) ==
+              0);
+
+    // Check that the adopted buffer is released (and emptied) by reset()
+    // and by a move assignment over it
+    kmyth::SecureBuffer other = ctx.unseal(blob.span());
+
+    other = std::move(plaintext);
+    CU_ASSERT(plaintext.empty());
+    CU_ASSERT(other.size() == input.size());
+    other.reset();
+    CU_ASSERT(other.empty());
+    CU_ASSERT(other.data() == nullptr);
+
+    // Check that a compressed blob survives being moved
+    kmyth::SealedBlob moved = std::move(blob);
+
+    CU_ASSERT(blob.empty());
+    CU_ASSERT(moved.data() != nullptr);
+  }
+  catch (const kmyth::Error &)
+  {
+    CU_FAIL("kmyth::TpmContext compressed round trip threw kmyth::Error");
+  }
+
+  // Check that the compression of an invalid .ski cannot be read
+  std::uint8_t junk[16] = { 0 };
+  kmyth_compression compression = KMYTH_COMPRESSION_NONE;
+
+  CU_ASSERT(kmyth_ski_get_compression(junk, sizeof(junk), &compression) ==
+            1);
+  CU_ASSERT(kmyth_ski_get_compression(junk, sizeof(junk), NULL) == 1);
+}
@@ -7,12 +7,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
 #include <CUnit/CUnit.h>
 
 #include "kmyth.h"
+#include "cipher/cipher.h"
+#include "cipher_test.h"
+#include "file_io.h"
 #include "pcrs.h"
 #include "formatting_tools.h"
 #include "marshalling_tools.h"
+#include "memory_util.h"
 #include "storage_key_tools.h"
 #include "tpm2_interface.h"
 #include "kmyth_seal_unseal_impl.h"
@@ -57,6 +66,37 @@ int kmyth_seal_unseal_impl_add_tests(CU_pSuite suite)
   {
     return 1;
   }
+  if (NULL ==
+      CU_add_test(suite, "tpm2_kmyth_seal_to_file() Tests",
+                  test_tpm2_kmyth_seal_to_file))
+  {
+    return 1;
+  }
+
+  if (NULL ==
+      CU_add_test(suite, "kmyth_tpm_context Tests", test_kmyth_tpm_context))
+  {
+    return 1;
+  }
+
+  if (NULL ==
+      CU_add_test(suite, "kmyth_tpm_context Concurrency Tests",
+                  test_kmyth_tpm_context_threads))
+  {
+    return 1;
+  }
+
+  if (NULL ==
+      CU_add_test(suite, "kmyth_tpm_queue Tests", test_kmyth_tpm_queue))
+  {
+    return 1;
+  }
+
+  if (NULL ==
+      CU_add_test(suite, "load_cached_sk() Tests", test_load_cached_sk))
+  {
+    return 1;
+  }
 
   if (NULL ==
       CU_add_test(suite, "tpm2_kmyth_seal_data() Tests",
@@ -70,6 +110,12 @@ int kmyth_seal_unseal_impl_add_tests(CU_pSuite suite)
   {
     return 1;
   }
+  if (NULL ==
+      CU_add_test(suite, "Seal/Unseal Large Payload Stress Tests",
+                  test_kmyth_seal_stress))
+  {
+    return 1;
+  }
   return 0;
 }
 
@@ -236,6 +282,833 @@ void test_tpm2_kmyth_unseal_file(void)
   CU_ASSERT(output_len == 0);
 }
 
+//--------------------------------------------------------------------------------
+// test_tpm2_kmyth_seal_to_file
+//--------------------------------------------------------------------------------
+void test_tpm2_kmyth_seal_to_file(void)
+{
+  uint8_t key[32] = { 0 };
+  char auth[] = "seal_to_file_auth";
+  char wrong_auth[] = "wrong_auth";
+  int *pcrs = NULL;
+  int pcrs_len = 0;
+
+  for (size_t i = 0; i < sizeof(key); i++)
+  {
+    key[i] = (uint8_t) (0xA0 + i);
+  }
+  CU_ASSERT_FATAL(parse_pcrs_string("0, 1", &pcrs, &pcrs_len) == 0);
+
+  char dir[] = "/tmp/kmyth_seal_to_file_XXXXXX";
+
+  CU_ASSERT_FATAL(mkdtemp(dir) != NULL);
+
+  char ski_path[sizeof(dir) + 16] = { 0 };
+
+  snprintf(ski_path, sizeof(ski_path), "%s/key.ski", dir);
+
+  // Check that NULL or empty input fails without writing anything
+  CU_ASSERT(tpm2_kmyth_seal_to_file(NULL, sizeof(key), ski_path,
+                                    NULL, 0, NULL, 0, NULL, 0, NULL) == 1);
+  CU_ASSERT(tpm2_kmyth_seal_to_file(key, 0, ski_path,
+                                    NULL, 0, NULL, 0, NULL, 0, NULL) == 1);
+  CU_ASSERT(access(ski_path, F_OK) != 0);
+
+  // Check that the key is sealed to the given auth and PCRs, and that the
+  // .ski file written never holds the key in the clear
+  CU_ASSERT(tpm2_kmyth_seal_to_file(key, sizeof(key), ski_path,
+                                    (uint8_t *) auth, strlen(auth),
+                                    NULL, 0, pcrs, (size_t) pcrs_len,
+                                    NULL) == 0);
+
+  uint8_t *ski_data = NULL;
+  size_t ski_len = 0;
+
+  CU_ASSERT(read_bytes_from_file(ski_path, &ski_data, &ski_len) == 0);
+  CU_ASSERT(ski_len > sizeof(key));
+  CU_ASSERT(memmem(ski_data, ski_len, key, sizeof(key)) == NULL);
+  free(ski_data);
+
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+
+  CU_ASSERT(tpm2_kmyth_unseal_file(ski_path, &output, &output_len,
+                                   (uint8_t *) auth, strlen(auth),
+                                   NULL, 0) == 0);
+  CU_ASSERT(output_len == sizeof(key));
+  CU_ASSERT(output != NULL && memcmp(output, key, sizeof(key)) == 0);
+  free(output);
+  output = NULL;
+  output_len = 0;
+
+  CU_ASSERT(tpm2_kmyth_unseal_file(ski_path, &output, &output_len,
+                                   (uint8_t *) wrong_auth,
+                                   strlen(wrong_auth), NULL, 0) == 1);
+  CU_ASSERT(output == NULL);
+  free(output);
+
+  // Check that an output path that can't be written fails
+  char bad_path[sizeof(dir) + 32] = { 0 };
+
+  snprintf(bad_path, sizeof(bad_path), "%s/missing/key.ski", dir);
+  CU_ASSERT(tpm2_kmyth_seal_to_file(key, sizeof(key), bad_path,
+                                    NULL, 0, NULL, 0, NULL, 0, NULL) == 1);
+
+  unlink(ski_path);
+  rmdir(dir);
+  free(pcrs);
+}
+
+//--------------------------------------------------------------------------------
+// thread_ctx_worker
+//--------------------------------------------------------------------------------
+static void *thread_ctx_worker(void *arg)
+{
+  kmyth_tpm_context **ctx = (kmyth_tpm_context **) arg;
+  uint8_t input[4] = { 0x04, 0x03, 0x02, 0x01 };
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+  uint8_t *plaintext = NULL;
+  size_t plaintext_len = 0;
+
+  if (kmyth_tpm_context_thread(NULL, 0, ctx)
+      || kmyth_tpm_context_seal(*ctx, input, sizeof(input), &sealed,
+                                &sealed_len, NULL, 0, NULL, 0, NULL)
+      || kmyth_tpm_context_unseal(*ctx, sealed, sealed_len, &plaintext,
+                                  &plaintext_len, NULL, 0)
+      || plaintext_len != sizeof(input)
+      || memcmp(plaintext, input, sizeof(input)) != 0)
+  {
+    *ctx = NULL;
+  }
+  free(sealed);
+  free(plaintext);
+  return NULL;
+}
+
+//--------------------------------------------------------------------------------
+// test_kmyth_tpm_context
+//--------------------------------------------------------------------------------
+void test_kmyth_tpm_context(void)
+{
+  kmyth_tpm_context *ctx = NULL;
+
+  uint8_t input[2][8] = { {0x00}, {0x01, 0x02, 0x03} };
+  size_t input_len = 8;
+
+  uint8_t *sealed[2] = { NULL, NULL };
+  size_t sealed_len[2] = { 0, 0 };
+
+  uint8_t *plaintext = NULL;
+  size_t plaintext_len = 0;
+
+  // Check that a NULL context pointer is rejected
+  CU_ASSERT(kmyth_tpm_context_open(NULL, 0, NULL) == 1);
+
+  // Check that seal/unseal with an unopened context fail
+  CU_ASSERT(kmyth_tpm_context_seal(NULL, input[0], input_len, &sealed[0],
+                                   &sealed_len[0], NULL, 0, NULL, 0,
+                                   NULL) == 1);
+  CU_ASSERT(sealed[0] == NULL);
+  CU_ASSERT(kmyth_tpm_context_unseal(NULL, input[0], input_len, &plaintext,
+                                     &plaintext_len, NULL, 0) == 1);
+  CU_ASSERT(plaintext == NULL);
+
+  uint8_t **bundle_out = NULL;
+  size_t *bundle_out_lens = NULL;
+  size_t bundle_count = 0;
+
+  CU_ASSERT(kmyth_tpm_context_unseal_bundle(NULL, input[0], input_len,
+                                            &bundle_out, &bundle_out_lens,
+                                            &bundle_count, NULL, 0) == 1);
+  CU_ASSERT(bundle_out == NULL);
+
+  // Check that an owner auth too large for the TPM is rejected
+  uint8_t big_auth[sizeof(TPM2B_AUTH)] = { 0 };
+  CU_ASSERT(kmyth_tpm_context_open(big_auth, sizeof(big_auth), &ctx) == 1);
+  CU_ASSERT(ctx == NULL);
+
+  // Check that one context can seal and unseal several inputs
+  CU_ASSERT(kmyth_tpm_context_open(NULL, 0, &ctx) == 0);
+  CU_ASSERT(ctx != NULL);
+  for (int i = 0; i < 2; i++)
+  {
+    CU_ASSERT(kmyth_tpm_context_seal(ctx, input[i], input_len, &sealed[i],
+                                     &sealed_len[i], NULL, 0, NULL, 0,
+                                     NULL) == 0);
+  }
+  for (int i = 0; i < 2; i++)
+  {
+    CU_ASSERT(kmyth_tpm_context_unseal(ctx, sealed[i], sealed_len[i],
+                                       &plaintext, &plaintext_len, NULL,
+                                       0) == 0);
+    CU_ASSERT(plaintext_len == input_len);
+    CU_ASSERT(memcmp(plaintext, input[i], input_len) == 0);
+    free(plaintext);
+    plaintext = NULL;
+    free(sealed[i]);
+  }
+
+  // Check that an ECC storage key seals data that unseals like RSA's
+  CU_ASSERT(kmyth_tpm_context_set_sk_alg(ctx, KMYTH_SK_ALG_ECC) == 0);
+  CU_ASSERT(kmyth_tpm_context_seal(ctx, input[0], input_len, &sealed[0],
+                                   &sealed_len[0], NULL, 0, NULL, 0,
+                                   NULL) == 0);
+  CU_ASSERT(kmyth_tpm_context_unseal(ctx, sealed[0], sealed_len[0],
+                                     &plaintext, &plaintext_len, NULL,
+                                     0) == 0);
+  CU_ASSERT(plaintext_len == input_len);
+  CU_ASSERT(memcmp(plaintext, input[0], input_len) == 0);
+  free(plaintext);
+  plaintext = NULL;
+  free(sealed[0]);
+  CU_ASSERT(kmyth_tpm_context_set_sk_alg(ctx, (kmyth_sk_alg) 7) == 1);
+  CU_ASSERT(kmyth_tpm_context_set_sk_alg(NULL, KMYTH_SK_ALG_RSA) == 1);
+
+  // Check that compressed data seals to a binary .ski, which unseals to the
+  // original data (but not into a caller-provided buffer)
+  CU_ASSERT(kmyth_tpm_context_set_compression(ctx,
+                                              KMYTH_COMPRESSION_ZSTD) == 0);
+  CU_ASSERT(kmyth_tpm_context_seal(ctx, input[1], input_len, &sealed[0],
+                                   &sealed_len[0], NULL, 0, NULL, 0,
+                                   NULL) == 0);
+  CU_ASSERT(sealed_len[0] > KMYTH_SKI_BINARY_HEADER_LEN);
+  CU_ASSERT(memcmp(sealed[0], KMYTH_SKI_BINARY_MAGIC,
+                   KMYTH_SKI_BINARY_MAGIC_LEN) == 0);
+  CU_ASSERT(sealed[0][KMYTH_SKI_BINARY_MAGIC_LEN + 1] ==
+            KMYTH_SKI_BINARY_FLAG_ZSTD);
+  CU_ASSERT(kmyth_tpm_context_unseal(ctx, sealed[0], sealed_len[0],
+                                     &plaintext, &plaintext_len, NULL,
+                                     0) == 0);
+  CU_ASSERT(plaintext_len == input_len);
+  CU_ASSERT(memcmp(plaintext, input[1], input_len) == 0);
+  free(plaintext);
+  plaintext = NULL;
+  plaintext_len = 0;
+  CU_ASSERT(kmyth_tpm_context_unseal_into(ctx, sealed[0], sealed_len[0],
+                                          NULL, &plaintext_len, NULL,
+                                          0) == 1);
+  free(sealed[0]);
+  CU_ASSERT(kmyth_tpm_context_set_compression(ctx,
+                                              KMYTH_COMPRESSION_NONE) == 0);
+  CU_ASSERT(kmyth_tpm_context_set_compression(ctx,
+                                              (kmyth_compression) 7) == 1);
+  CU_ASSERT(kmyth_tpm_context_set_compression(NULL,
+                                              KMYTH_COMPRESSION_ZSTD) == 1);
+
+  // Check that a seal takes a matching storage key from the SK pool, and
+  // that the key it seals with unseals
+  char pool_dir[] = "/tmp/kmyth_sk_pool_XXXXXX";
+
+  CU_ASSERT_FATAL(mkdtemp(pool_dir) != NULL);
+  CU_ASSERT(kmyth_tpm_context_fill_sk_pool(ctx, NULL, 0, NULL, 0, 1) == 1);
+  CU_ASSERT(kmyth_tpm_context_set_sk_pool(ctx, pool_dir) == 0);
+  CU_ASSERT(kmyth_tpm_context_fill_sk_pool(ctx, NULL, 0, NULL, 0, 1) == 0);
+
+  DIR *dir = opendir(pool_dir);
+  size_t pooled = 0;
+  struct dirent *entry = NULL;
+  char pooled_path[sizeof(pool_dir) + 256] = { 0 };
+
+  while (dir != NULL && (entry = readdir(dir)) != NULL)
+  {
+    if (entry->d_name[0] != '.')
+    {
+      snprintf(pooled_path, sizeof(pooled_path), "%s/%s", pool_dir,
+               entry->d_name);
+      pooled++;
+    }
+  }
+  if (dir != NULL)
+  {
+    closedir(dir);
+  }
+  CU_ASSERT(pooled == 1);
+
+  // a pool already holding the requested number of keys is left as is
+  CU_ASSERT(kmyth_tpm_context_fill_sk_pool(ctx, NULL, 0, NULL, 0, 1) == 0);
+
+  CU_ASSERT(kmyth_tpm_context_seal(ctx, input[0], input_len, &sealed[0],
+                                   &sealed_len[0], NULL, 0, NULL, 0,
+                                   NULL) == 0);
+  CU_ASSERT(access(pooled_path, F_OK) != 0);
+  CU_ASSERT(kmyth_tpm_context_unseal(ctx, sealed[0], sealed_len[0],
+                                     &plaintext, &plaintext_len, NULL,
+                                     0) == 0);
+  CU_ASSERT(plaintext_len == input_len);
+  CU_ASSERT(memcmp(plaintext, input[0], input_len) == 0);
+  free(plaintext);
+  plaintext = NULL;
+  free(sealed[0]);
+
+  // an empty pool falls back on creating a storage key
+  CU_ASSERT(kmyth_tpm_context_seal(ctx, input[0], input_len, &sealed[0],
+                                   &sealed_len[0], NULL, 0, NULL, 0,
+                                   NULL) == 0);
+  free(sealed[0]);
+  CU_ASSERT(kmyth_tpm_context_set_sk_pool(ctx, NULL) == 0);
+  rmdir(pool_dir);
+
+  // Check that seals and unseals with parameter encryption (on the reused,
+  // salted policy session) interoperate with those without it
+  CU_ASSERT(kmyth_tpm_context_seal(ctx, input[0], input_len, &sealed[0],
+                                   &sealed_len[0], NULL, 0, NULL, 0,
+                                   NULL) == 0);
+  CU_ASSERT(kmyth_tpm_context_set_param_encryption(ctx, true) == 0);
+  CU_ASSERT(kmyth_tpm_context_seal(ctx, input[1], input_len, &sealed[1],
+                                   &sealed_len[1], NULL, 0, NULL, 0,
+                                   NULL) == 0);
+  for (int i = 0; i < 2; i++)
+  {
+    CU_ASSERT(kmyth_tpm_context_unseal(ctx, sealed[i], sealed_len[i],
+                                       &plaintext, &plaintext_len, NULL,
+                                       0) == 0);
+    CU_ASSERT(plaintext_len == input_len);
+    CU_ASSERT(memcmp(plaintext, input[i], input_len) == 0);
+    free(plaintext);
+    plaintext = NULL;
+  }
+  CU_ASSERT(kmyth_tpm_context_set_param_encryption(ctx, false) == 0);
+  CU_ASSERT(kmyth_tpm_context_unseal(ctx, sealed[1], sealed_len[1],
+                                     &plaintext, &plaintext_len, NULL,
+                                     0) == 0);
+  CU_ASSERT(plaintext_len == input_len);
+  CU_ASSERT(memcmp(plaintext, input[1], input_len) == 0);
+  free(plaintext);
+  plaintext = NULL;
+  free(sealed[0]);
+  free(sealed[1]);
+  CU_ASSERT(kmyth_tpm_context_set_param_encryption(NULL, true) == 1);
+
+  // Check the PCR policy pre-flight check: a .ski sealed to the current
+  // PCR values satisfies it, one whose policy digest differs does not
+  int pcrs[1] = { 0 };
+  bool satisfied = false;
+  int *policy_pcrs = NULL;
+  size_t policy_pcrs_len = 0;
+
+  CU_ASSERT(kmyth_tpm_context_seal(ctx, input[0], input_len, &sealed[0],
+                                   &sealed_len[0], NULL, 0, pcrs, 1,
+                                   NULL) == 0);
+  CU_ASSERT(kmyth_tpm_context_check_policy(ctx, sealed[0], sealed_len[0],
+                                           &satisfied, &policy_pcrs,
+                                           &policy_pcrs_len) == 0);
+  CU_ASSERT(satisfied);
+  CU_ASSERT(policy_pcrs == NULL && policy_pcrs_len == 0);
+
+  Ski ski = get_default_ski();
+
+  CU_ASSERT(parse_ski_bytes(sealed[0], sealed_len[0], &ski) == 0);
+  ski.wk_pub.publicArea.authPolicy.buffer[0] ^= 0x01;
+  CU_ASSERT(create_ski_bytes(ski, KMYTH_SKI_FORMAT_TEXT, &sealed[1],
+                             &sealed_len[1]) == 0);
+  CU_ASSERT(kmyth_tpm_context_check_policy(ctx, sealed[1], sealed_len[1],
+                                           &satisfied, &policy_pcrs,
+                                           &policy_pcrs_len) == 0);
+  CU_ASSERT(!satisfied);
+  CU_ASSERT(policy_pcrs_len == 1 && policy_pcrs[0] == 0);
+  free(policy_pcrs);
+
+  // with the pre-flight check enabled, the unseal fails before the TPM
+  // is used, and it does not affect .ski files that satisfy the policy
+  CU_ASSERT(kmyth_tpm_context_set_policy_preflight(ctx, true) == 0);
+  CU_ASSERT(kmyth_tpm_context_unseal(ctx, sealed[1], sealed_len[1],
+                                     &plaintext, &plaintext_len, NULL,
+                                     0) == 1);
+  CU_ASSERT(kmyth_tpm_context_unseal(ctx, sealed[0], sealed_len[0],
+                                     &plaintext, &plaintext_len, NULL,
+                                     0) == 0);
+  CU_ASSERT(plaintext_len == input_len);
+  CU_ASSERT(memcmp(plaintext, input[0], input_len) == 0);
+  free(plaintext);
+  plaintext = NULL;
+  CU_ASSERT(kmyth_tpm_context_set_policy_preflight(ctx, false) == 0);
+  free_ski(&ski);
+  free(sealed[0]);
+  free(sealed[1]);
+  CU_ASSERT(kmyth_tpm_context_check_policy(NULL, NULL, 0, &satisfied,
+                                           &policy_pcrs,
+                                           &policy_pcrs_len) == 1);
+  CU_ASSERT(kmyth_tpm_context_set_policy_preflight(NULL, true) == 1);
+
+  // Check that a reseal moves a .ski to a new authorization value and PCR
+  // policy, and keeps its encrypted data as it is
+  uint8_t old_auth[3] = { 'o', 'l', 'd' };
+  uint8_t new_auth[3] = { 'n', 'e', 'w' };
+
+  CU_ASSERT(kmyth_tpm_context_seal(ctx, input[0], input_len, &sealed[0],
+                                   &sealed_len[0], old_auth, 3, NULL, 0,
+                                   NULL) == 0);
+  CU_ASSERT(kmyth_tpm_context_reseal(ctx, sealed[0], sealed_len[0],
+                                     &sealed[1], &sealed_len[1],
+                                     old_auth, 3, new_auth, 3,
+                                     pcrs, 1) == 0);
+
+  Ski resealed = get_default_ski();
+
+  ski = get_default_ski();
+  CU_ASSERT(parse_ski_bytes(sealed[0], sealed_len[0], &ski) == 0);
+  CU_ASSERT(parse_ski_bytes(sealed[1], sealed_len[1], &resealed) == 0);
+  CU_ASSERT(resealed.enc_data_size == ski.enc_data_size);
+  CU_ASSERT(memcmp(resealed.enc_data, ski.enc_data, ski.enc_data_size) == 0);
+  CU_ASSERT(resealed.pcr_list.pcrSelections[0].pcrSelect[0] == 0x01);
+  free_ski(&resealed);
+  free_ski(&ski);
+  CU_ASSERT(kmyth_tpm_context_unseal(ctx, sealed[1], sealed_len[1],
+                                     &plaintext, &plaintext_len, old_auth,
+                                     3) == 1);
+  CU_ASSERT(kmyth_tpm_context_unseal(ctx, sealed[1], sealed_len[1],
+                                     &plaintext, &plaintext_len, new_auth,
+                                     3) == 0);
+  CU_ASSERT(plaintext_len == input_len);
+  CU_ASSERT(memcmp(plaintext, input[0], input_len) == 0);
+  free(plaintext);
+  plaintext = NULL;
+  free(sealed[1]);
+
+  // the wrong authorization value reseals nothing
+  sealed[1] = NULL;
+  CU_ASSERT(kmyth_tpm_context_reseal(ctx, sealed[0], sealed_len[0],
+                                     &sealed[1], &sealed_len[1],
+                                     new_auth, 3, new_auth, 3,
+                                     NULL, 0) == 1);
+  CU_ASSERT(sealed[1] == NULL);
+  free(sealed[0]);
+
+  // Check that a batch reseal rewrites each .ski file in place, and leaves
+  // one that cannot be resealed as it is
+  char reseal_dir[] = "/tmp/kmyth_reseal_XXXXXX";
+  char reseal_paths[3][sizeof(reseal_dir) + 8];
+  char *reseal_list[3] = { reseal_paths[0], reseal_paths[1],
+    reseal_paths[2]
+  };
+
+  CU_ASSERT_FATAL(mkdtemp(reseal_dir) != NULL);
+  for (int i = 0; i < 3; i++)
+  {
+    snprintf(reseal_paths[i], sizeof(reseal_paths[i]), "%s/%d.ski",
+             reseal_dir, i);
+    CU_ASSERT(kmyth_tpm_context_seal(ctx, input[i % 2], input_len,
+                                     &sealed[0], &sealed_len[0],
+                                     (i < 2) ? old_auth : new_auth, 3,
+                                     NULL, 0, NULL) == 0);
+    CU_ASSERT(write_bytes_to_file(reseal_paths[i], sealed[0],
+                                  sealed_len[0]) == 0);
+    free(sealed[0]);
+  }
+  CU_ASSERT(kmyth_tpm_context_reseal_files(ctx, reseal_list, 3, 2,
+                                           old_auth, 3, new_auth, 3,
+                                           pcrs, 1) == 1);
+  for (int i = 0; i < 3; i++)
+  {
+    CU_ASSERT(read_bytes_from_file(reseal_paths[i], &sealed[0],
+                                   &sealed_len[0]) == 0);
+    CU_ASSERT(kmyth_tpm_context_unseal(ctx, sealed[0], sealed_len[0],
+                                       &plaintext, &plaintext_len, new_auth,
+                                       3) == 0);
+    CU_ASSERT(plaintext_len == input_len);
+    CU_ASSERT(memcmp(plaintext, input[i % 2], input_len) == 0);
+    free(plaintext);
+    plaintext = NULL;
+
+    ski = get_default_ski();
+    CU_ASSERT(parse_ski_bytes(sealed[0], sealed_len[0], &ski) == 0);
+    CU_ASSERT(ski.pcr_list.pcrSelections[0].pcrSelect[0] ==
+              ((i < 2) ? 0x01 : 0x00));
+    free_ski(&ski);
+    free(sealed[0]);
+    remove(reseal_paths[i]);
+  }
+  rmdir(reseal_dir);
+  CU_ASSERT(kmyth_tpm_context_reseal_files(NULL, reseal_list, 3, 1,
+                                           NULL, 0, NULL, 0, NULL, 0) == 1);
+
+  // Check that a secret sealed into an allocated NV index is read back
+  // under its policy only, and that the index is released by undefining it
+  uint32_t nv_index = 0;
+
+  CU_ASSERT(kmyth_tpm_context_seal_nv(ctx, input[1], input_len, &nv_index,
+                                      new_auth, 3, pcrs, 1) == 0);
+  CU_ASSERT(nv_index >= KMYTH_NV_INDEX_FIRST
+            && nv_index <= KMYTH_NV_INDEX_LAST);
+  CU_ASSERT(kmyth_tpm_context_unseal_nv(ctx, nv_index, &plaintext,
+                                        &plaintext_len, new_auth, 3, pcrs,
+                                        1) == 0);
+  CU_ASSERT(plaintext_len == input_len);
+  CU_ASSERT(memcmp(plaintext, input[1], input_len) == 0);
+  free(plaintext);
+  plaintext = NULL;
+  CU_ASSERT(kmyth_tpm_context_unseal_nv(ctx, nv_index, &plaintext,
+                                        &plaintext_len, old_auth, 3, pcrs,
+                                        1) == 1);
+  CU_ASSERT(kmyth_tpm_context_unseal_nv(ctx, nv_index, &plaintext,
+                                        &plaintext_len, new_auth, 3, NULL,
+                                        0) == 1);
+  CU_ASSERT(plaintext == NULL);
+
+  // a defined index is neither allocated again nor redefined
+  uint32_t next_index = 0;
+
+  CU_ASSERT(kmyth_tpm_context_seal_nv(ctx, input[0], input_len, &next_index,
+                                      NULL, 0, NULL, 0) == 0);
+  CU_ASSERT(next_index != nv_index);
+  CU_ASSERT(kmyth_tpm_context_seal_nv(ctx, input[0], input_len, &next_index,
+                                      NULL, 0, NULL, 0) == 1);
+  CU_ASSERT(kmyth_tpm_context_undefine_nv(ctx, next_index) == 0);
+  CU_ASSERT(kmyth_tpm_context_undefine_nv(ctx, nv_index) == 0);
+  CU_ASSERT(kmyth_tpm_context_unseal_nv(ctx, nv_index, &plaintext,
+                                        &plaintext_len, new_auth, 3, pcrs,
+                                        1) == 1);
+  CU_ASSERT(kmyth_tpm_context_undefine_nv(ctx, nv_index) == 1);
+  CU_ASSERT(kmyth_tpm_context_seal_nv(NULL, input[0], input_len, &nv_index,
+                                      NULL, 0, NULL, 0) == 1);
+
+  // Check that a thread reuses its own context until the owner auth
+  // changes, and that another thread gets (and closes) a separate one
+  kmyth_tpm_context *thread_ctx[2] = { NULL, NULL };
+  kmyth_tpm_context *worker_ctx = NULL;
+  pthread_t worker;
+
+  CU_ASSERT(kmyth_tpm_context_thread(NULL, 0, NULL) == 1);
+  CU_ASSERT(kmyth_tpm_context_thread(NULL, 0, &thread_ctx[0]) == 0);
+  CU_ASSERT(kmyth_tpm_context_thread(NULL, 0, &thread_ctx[1]) == 0);
+  CU_ASSERT(thread_ctx[0] != NULL && thread_ctx[0] == thread_ctx[1]);
+  CU_ASSERT(thread_ctx[0] != ctx);
+  CU_ASSERT(pthread_create(&worker, NULL, thread_ctx_worker,
+                           &worker_ctx) == 0);
+  CU_ASSERT(pthread_join(worker, NULL) == 0);
+  CU_ASSERT(worker_ctx != NULL && worker_ctx != thread_ctx[0]);
+  CU_ASSERT(kmyth_tpm_context_thread(big_auth, sizeof(big_auth),
+                                     &thread_ctx[1]) == 1);
+  CU_ASSERT(thread_ctx[1] == NULL);
+  CU_ASSERT(kmyth_tpm_context_thread(NULL, 0, &thread_ctx[1]) == 0);
+  CU_ASSERT(thread_ctx[1] != NULL);
+  kmyth_tpm_context_thread_close();
+  kmyth_tpm_context_thread_close();
+
+  // Check that close releases the context and tolerates a repeat call
+  kmyth_tpm_context_close(&ctx);
+  CU_ASSERT(ctx == NULL);
+  kmyth_tpm_context_close(&ctx);
+}
+
+//--------------------------------------------------------------------------------
+// context_test_thread
+//--------------------------------------------------------------------------------
+#define CONTEXT_TEST_THREADS 4
+#define CONTEXT_TEST_ROUNDS 3
+
+typedef struct context_test_arg
+{
+  kmyth_tpm_context *ctx;
+  uint8_t id;
+  int failures;
+} context_test_arg;
+
+static void *context_test_thread(void *arg)
+{
+  context_test_arg *test = (context_test_arg *) arg;
+
+  // each thread seals data and uses an auth of its own, so a mix-up between
+  // concurrent calls shows up as a failed unseal or wrong plaintext
+  uint8_t input[4096];
+  uint8_t auth[4] = { 'a', 'u', 't', test->id };
+
+  memset(input, test->id, sizeof(input));
+  for (int i = 0; i < CONTEXT_TEST_ROUNDS; i++)
+  {
+    uint8_t *sealed = NULL;
+    size_t sealed_len = 0;
+    uint8_t *plaintext = NULL;
+    size_t plaintext_len = 0;
+
+    if (kmyth_tpm_context_seal(test->ctx, input, sizeof(input), &sealed,
+                               &sealed_len, auth, sizeof(auth), NULL, 0,
+                               NULL)
+        || kmyth_tpm_context_unseal(test->ctx, sealed, sealed_len,
+                                    &plaintext, &plaintext_len, auth,
+                                    sizeof(auth))
+        || plaintext_len != sizeof(input)
+        || memcmp(plaintext, input, sizeof(input)) != 0)
+    {
+      test->failures++;
+    }
+    free(sealed);
+    kmyth_clear_and_free(plaintext, plaintext_len);
+  }
+  return NULL;
+}
+
+//--------------------------------------------------------------------------------
+// test_kmyth_tpm_context_threads
+//--------------------------------------------------------------------------------
+void test_kmyth_tpm_context_threads(void)
+{
+  kmyth_tpm_context *ctx = NULL;
+  pthread_t threads[CONTEXT_TEST_THREADS];
+  context_test_arg args[CONTEXT_TEST_THREADS];
+  int started = 0;
+
+  // Check that seals and unseals made concurrently on one context (so
+  // sharing its TPM connection, SK cache and cipher context pool) all
+  // round trip
+  CU_ASSERT_FATAL(kmyth_tpm_context_open(NULL, 0, &ctx) == 0);
+  for (int i = 0; i < CONTEXT_TEST_THREADS; i++)
+  {
+    args[i].ctx = ctx;
+    args[i].id = (uint8_t) (i + 1);
+    args[i].failures = 0;
+    if (pthread_create(&threads[i], NULL, context_test_thread, &args[i]))
+    {
+      break;
+    }
+    started++;
+  }
+  CU_ASSERT(started == CONTEXT_TEST_THREADS);
+  for (int i = 0; i < started; i++)
+  {
+    pthread_join(threads[i], NULL);
+    CU_ASSERT(args[i].failures == 0);
+  }
+
+  kmyth_tpm_context_close(&ctx);
+}
+
+//--------------------------------------------------------------------------------
+// queue_test_done
+//--------------------------------------------------------------------------------
+typedef struct queue_test_result
+{
+  int calls;
+  int result;
+  uint8_t *output;
+  size_t output_len;
+} queue_test_result;
+
+static pthread_mutex_t queue_test_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_test_cond = PTHREAD_COND_INITIALIZER;
+
+static void queue_test_done(void *arg, int result, uint8_t * output,
+                            size_t output_len)
+{
+  queue_test_result *done = (queue_test_result *) arg;
+
+  pthread_mutex_lock(&queue_test_lock);
+  done->calls++;
+  done->result = result;
+  done->output = output;
+  done->output_len = output_len;
+  pthread_cond_broadcast(&queue_test_cond);
+  pthread_mutex_unlock(&queue_test_lock);
+}
+
+static void queue_test_wait(queue_test_result * done)
+{
+  pthread_mutex_lock(&queue_test_lock);
+  while (done->calls == 0)
+  {
+    pthread_cond_wait(&queue_test_cond, &queue_test_lock);
+  }
+  pthread_mutex_unlock(&queue_test_lock);
+}
+
+//--------------------------------------------------------------------------------
+// test_kmyth_tpm_queue
+//--------------------------------------------------------------------------------
+void test_kmyth_tpm_queue(void)
+{
+  kmyth_tpm_context *ctx = NULL;
+  kmyth_tpm_queue *queue = NULL;
+
+  uint8_t input[8] = { 0x01, 0x02, 0x03 };
+  size_t input_len = 8;
+  uint8_t auth[2][3] = { {'a', 'b', 'c'}, {'x', 'y', 'z'} };
+
+  void *arg = NULL;
+  int result = 1;
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+
+  // Check that a queue needs an open context and a sane worker count
+  CU_ASSERT(kmyth_tpm_queue_open(NULL, 0, &queue) == 1);
+  CU_ASSERT(kmyth_tpm_context_open(NULL, 0, &ctx) == 0);
+  CU_ASSERT(kmyth_tpm_queue_open(ctx, KMYTH_TPM_QUEUE_MAX_WORKERS + 1,
+                                 &queue) == 1);
+  CU_ASSERT(queue == NULL);
+  CU_ASSERT(kmyth_tpm_queue_open(ctx, 0, &queue) == 0);
+  CU_ASSERT(kmyth_tpm_queue_fd(queue) >= 0);
+  CU_ASSERT(kmyth_tpm_queue_fd(NULL) == -1);
+  CU_ASSERT(kmyth_tpm_queue_reap(queue, &arg, &result, &sealed,
+                                 &sealed_len) == 1);
+  CU_ASSERT(kmyth_tpm_queue_seal(NULL, input, input_len, NULL, 0, NULL, 0,
+                                 NULL, NULL, NULL) == 1);
+  CU_ASSERT(kmyth_tpm_queue_seal(queue, NULL, 0, NULL, 0, NULL, 0, NULL,
+                                 NULL, NULL) == 1);
+
+  // Check that a job without a callback signals the eventfd and is reaped
+  struct pollfd event = {.fd = kmyth_tpm_queue_fd(queue),.events = POLLIN };
+
+  CU_ASSERT(kmyth_tpm_queue_seal(queue, input, input_len, auth[0], 3, NULL,
+                                 0, NULL, NULL, input) == 0);
+  CU_ASSERT(poll(&event, 1, 60000) == 1);
+  CU_ASSERT(kmyth_tpm_queue_reap(queue, &arg, &result, &sealed,
+                                 &sealed_len) == 0);
+  CU_ASSERT(arg == input);
+  CU_ASSERT(result == 0);
+  CU_ASSERT(sealed != NULL && sealed_len > 0);
+  CU_ASSERT(kmyth_tpm_queue_reap(queue, &arg, &result, &sealed,
+                                 &sealed_len) == 1);
+
+  // Check that callbacks report both success and failure
+  queue_test_result done[2] = { {.result = -1}, {.result = -1} };
+
+  CU_ASSERT(kmyth_tpm_queue_unseal(queue, sealed, sealed_len, auth[0], 3,
+                                   queue_test_done, &done[0]) == 0);
+  CU_ASSERT(kmyth_tpm_queue_unseal(queue, sealed, sealed_len, auth[1], 3,
+                                   queue_test_done, &done[1]) == 0);
+  queue_test_wait(&done[0]);
+  queue_test_wait(&done[1]);
+  CU_ASSERT(done[0].result == 0);
+  CU_ASSERT(done[0].output_len == input_len);
+  CU_ASSERT(done[0].output != NULL
+            && memcmp(done[0].output, input, input_len) == 0);
+  CU_ASSERT(done[1].result == 1);
+  CU_ASSERT(done[1].output == NULL);
+  free(done[0].output);
+
+  // Check that closing the queue calls back every submitted job exactly
+  // once: jobs a worker started finish, the rest fail
+  queue_test_result closed[8] = { {.result = -1} };
+  size_t closed_count = sizeof(closed) / sizeof(closed[0]);
+
+  for (size_t i = 0; i < closed_count; i++)
+  {
+    CU_ASSERT(kmyth_tpm_queue_unseal(queue, sealed, sealed_len, auth[0], 3,
+                                     queue_test_done, &closed[i]) == 0);
+  }
+  kmyth_tpm_queue_close(&queue);
+  CU_ASSERT(queue == NULL);
+  for (size_t i = 0; i < closed_count; i++)
+  {
+    CU_ASSERT(closed[i].calls == 1);
+    CU_ASSERT(closed[i].result == 0 || closed[i].result == 1);
+    CU_ASSERT((closed[i].result == 0) == (closed[i].output != NULL));
+    kmyth_clear_and_free(closed[i].output, closed[i].output_len);
+  }
+  kmyth_tpm_queue_close(&queue);
+
+  free(sealed);
+  kmyth_tpm_context_close(&ctx);
+}
+
+//--------------------------------------------------------------------------------
+// test_load_cached_sk
+//--------------------------------------------------------------------------------
+void test_load_cached_sk(void)
+{
+  kmyth_tpm_context *ctx = NULL;
+  uint8_t input[8] = { 0x00 };
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+
+  CU_ASSERT(kmyth_tpm_context_open(NULL, 0, &ctx) == 0);
+  CU_ASSERT(kmyth_tpm_context_seal(ctx, input, sizeof(input), &sealed,
+                                   &sealed_len, NULL, 0, NULL, 0, NULL) == 0);
+
+  Ski ski = get_default_ski();
+
+  CU_ASSERT(parse_ski_bytes(sealed, sealed_len, &ski) == 0);
+
+  // Check that identical public areas produce identical digests and that a
+  // different public area does not
+  uint8_t digest_a[KMYTH_DIGEST_SIZE];
+  uint8_t digest_b[KMYTH_DIGEST_SIZE];
+
+  CU_ASSERT(get_sk_cache_digest(&ski.sk_pub, digest_a) == 0);
+  CU_ASSERT(get_sk_cache_digest(&ski.sk_pub, digest_b) == 0);
+  CU_ASSERT(memcmp(digest_a, digest_b, KMYTH_DIGEST_SIZE) == 0);
+  CU_ASSERT(get_sk_cache_digest(&ski.wk_pub, digest_b) == 0);
+  CU_ASSERT(memcmp(digest_a, digest_b, KMYTH_DIGEST_SIZE) != 0);
+  CU_ASSERT(get_sk_cache_digest(NULL, digest_a) == 1);
+
+  // Check that a second load of the same SK is served from the cache
+  TPM2_HANDLE first = 0;
+  TPM2_HANDLE second = 0;
+
+  CU_ASSERT(load_cached_sk(ctx, &ski.sk_pub, &ski.sk_priv, &first) == 0);
+  CU_ASSERT(load_cached_sk(ctx, &ski.sk_pub, &ski.sk_priv, &second) == 0);
+  CU_ASSERT(first == second);
+
+  int entries = 0;
+
+  for (int i = 0; i < KMYTH_SK_CACHE_SIZE; i++)
+  {
+    if (ctx->sk_cache[i].in_use)
+    {
+      entries++;
+    }
+  }
+  CU_ASSERT(entries == 1);
+
+  // Check that loading enough other SKs to evict the first one saves its
+  // context, and that it is then restored from that saved context
+  for (int i = 0; i < KMYTH_SK_CACHE_SIZE; i++)
+  {
+    uint8_t *other = NULL;
+    size_t other_len = 0;
+    Ski other_ski = get_default_ski();
+    TPM2_HANDLE other_handle = 0;
+
+    CU_ASSERT(kmyth_tpm_context_seal(ctx, input, sizeof(input), &other,
+                                     &other_len, NULL, 0, NULL, 0,
+                                     NULL) == 0);
+    CU_ASSERT(parse_ski_bytes(other, other_len, &other_ski) == 0);
+    CU_ASSERT(load_cached_sk(ctx, &other_ski.sk_pub, &other_ski.sk_priv,
+                             &other_handle) == 0);
+    free_ski(&other_ski);
+    free(other);
+  }
+
+  int saved = -1;
+
+  CU_ASSERT(get_sk_cache_digest(&ski.sk_pub, digest_a) == 0);
+  for (int i = 0; i < KMYTH_SK_SAVED_CACHE_SIZE; i++)
+  {
+    if (ctx->sk_saved[i].context != NULL &&
+        memcmp(ctx->sk_saved[i].sk_pub_digest, digest_a,
+               KMYTH_DIGEST_SIZE) == 0)
+    {
+      saved = i;
+    }
+  }
+  CU_ASSERT(saved >= 0);
+  CU_ASSERT(load_cached_sk(ctx, &ski.sk_pub, &ski.sk_priv, &first) == 0);
+  if (saved >= 0)
+  {
+    CU_ASSERT(ctx->sk_saved[saved].context != NULL);
+  }
+
+  uint8_t *unsealed = NULL;
+  size_t unsealed_len = 0;
+
+  CU_ASSERT(kmyth_tpm_context_unseal(ctx, sealed, sealed_len, &unsealed,
+                                     &unsealed_len, NULL, 0) == 0);
+  CU_ASSERT(unsealed_len == sizeof(input));
+  free(unsealed);
+
+  // Check that flushing the cache empties it
+  flush_sk_cache(ctx);
+  CU_ASSERT(ctx->sk_cache[0].in_use == false);
+  for (int i = 0; i < KMYTH_SK_SAVED_CACHE_SIZE; i++)
+  {
+    CU_ASSERT(ctx->sk_saved[i].context == NULL);
+  }
+
+  free_ski(&ski);
+  free(sealed);
+  kmyth_tpm_context_close(&ctx);
+}
+
 //--------------------------------------------------------------------------------
 // test_tpm2_kmyth_seal_data
 //--------------------------------------------------------------------------------
@@ -261,37 +1134,41 @@ void test_tpm2_kmyth_seal_data(void)
   TPM2_HANDLE sk_handle = 0;
 
   create_and_load_sk(sapi_ctx, srk_handle, authVal, authVal, ski.pcr_list,
-                     authPolicy, &sk_handle, &ski.sk_priv, &ski.sk_pub);
+                     authPolicy, KMYTH_KEY_PUBKEY_ALG, &sk_handle, &ski.sk_priv,
+                     &ski.sk_pub);
 
   uint8_t data[8] = { 0 };
   size_t data_len = 8;
 
   // Check that seal with valid inputs works.
   CU_ASSERT(tpm2_kmyth_seal_data
-            (sapi_ctx, data, data_len, sk_handle, authVal, ski.pcr_list,
-             authVal, ski.pcr_list, authPolicy, &ski.wk_pub,
+            (sapi_ctx, NULL, data, data_len, sk_handle, authVal,
+             ski.pcr_list, authVal, ski.pcr_list, authPolicy, &ski.wk_pub,
              &ski.wk_priv) == 0);
 
   // Check failure with NULL context.
   CU_ASSERT(tpm2_kmyth_seal_data
-            (NULL, data, data_len, sk_handle, authVal, ski.pcr_list, authVal,
-             ski.pcr_list, authPolicy, &ski.wk_pub, &ski.wk_priv) == 1);
+            (NULL, NULL, data, data_len, sk_handle, authVal, ski.pcr_list,
+             authVal, ski.pcr_list, authPolicy, &ski.wk_pub,
+             &ski.wk_priv) == 1);
 
   // Failure with NULL data.
   CU_ASSERT(tpm2_kmyth_seal_data
-            (sapi_ctx, NULL, data_len, sk_handle, authVal, ski.pcr_list,
-             authVal, ski.pcr_list, authPolicy, &ski.wk_pub,
+            (sapi_ctx, NULL, NULL, data_len, sk_handle, authVal,
+             ski.pcr_list, authVal, ski.pcr_list, authPolicy, &ski.wk_pub,
              &ski.wk_priv) == 1);
 
   // Failure with length 0 data
   CU_ASSERT(tpm2_kmyth_seal_data
-            (sapi_ctx, data, 0, sk_handle, authVal, ski.pcr_list, authVal,
-             ski.pcr_list, authPolicy, &ski.wk_pub, &ski.wk_priv) == 1);
+            (sapi_ctx, NULL, data, 0, sk_handle, authVal, ski.pcr_list,
+             authVal, ski.pcr_list, authPolicy, &ski.wk_pub,
+             &ski.wk_priv) == 1);
 
   // Failure with NULL length 0 data
   CU_ASSERT(tpm2_kmyth_seal_data
-            (sapi_ctx, NULL, 0, sk_handle, authVal, ski.pcr_list, authVal,
-             ski.pcr_list, authPolicy, &ski.wk_pub, &ski.wk_priv) == 1);
+            (sapi_ctx, NULL, NULL, 0, sk_handle, authVal, ski.pcr_list,
+             authVal, ski.pcr_list, authPolicy, &ski.wk_pub,
+             &ski.wk_priv) == 1);
 
   free_tpm2_resources(&sapi_ctx);
 }
@@ -321,34 +1198,205 @@ void test_tpm2_kmyth_unseal_data(void)
   TPM2_HANDLE sk_handle = 0;
 
   create_and_load_sk(sapi_ctx, srk_handle, authVal, authVal, ski.pcr_list,
-                     authPolicy, &sk_handle, &ski.sk_priv, &ski.sk_pub);
+                     authPolicy, KMYTH_KEY_PUBKEY_ALG, &sk_handle, &ski.sk_priv,
+                     &ski.sk_pub);
 
   uint8_t input_data[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
   size_t input_data_len = 8;
 
-  tpm2_kmyth_seal_data(sapi_ctx, input_data, input_data_len, sk_handle, authVal,
-                       ski.pcr_list, authVal, ski.pcr_list, authPolicy,
-                       &ski.wk_pub, &ski.wk_priv);
+  tpm2_kmyth_seal_data(sapi_ctx, NULL, input_data, input_data_len, sk_handle,
+                       authVal, ski.pcr_list, authVal, ski.pcr_list,
+                       authPolicy, &ski.wk_pub, &ski.wk_priv);
 
   uint8_t *output_data = NULL;
   size_t output_data_len = 0;
 
   // Check that unseal works as it should.
   CU_ASSERT(tpm2_kmyth_unseal_data
-            (sapi_ctx, sk_handle, ski.wk_pub, ski.wk_priv, authVal,
+            (sapi_ctx, NULL, sk_handle, ski.wk_pub, ski.wk_priv, authVal,
              ski.pcr_list, authPolicy, &output_data, &output_data_len) == 0);
   CU_ASSERT(output_data_len == 8);
   CU_ASSERT(memcmp(output_data, input_data, 8) == 0);
 
-  free(output_data);
+  kmyth_secure_free(output_data, output_data_len);
+  output_data = NULL;
+  output_data_len = 0;
+
+  // Check that one policy session, restarted between uses, serves both
+  // the seal and the unseal.
+  SESSION policySession;
+
+  CU_ASSERT(create_policy_auth_session(sapi_ctx, &policySession) == 0);
+  CU_ASSERT(tpm2_kmyth_seal_data
+            (sapi_ctx, &policySession, input_data, input_data_len, sk_handle,
+             authVal, ski.pcr_list, authVal, ski.pcr_list, authPolicy,
+             &ski.wk_pub, &ski.wk_priv) == 0);
+  CU_ASSERT(restart_policy_auth_session(sapi_ctx, &policySession) == 0);
+  CU_ASSERT(tpm2_kmyth_unseal_data
+            (sapi_ctx, &policySession, sk_handle, ski.wk_pub, ski.wk_priv,
+             authVal, ski.pcr_list, authPolicy, &output_data,
+             &output_data_len) == 0);
+  CU_ASSERT(output_data_len == 8);
+  CU_ASSERT(memcmp(output_data, input_data, 8) == 0);
+  Tss2_Sys_FlushContext(sapi_ctx, policySession.sessionHandle);
+
+  kmyth_secure_free(output_data, output_data_len);
   output_data = NULL;
   output_data_len = 0;
 
   // Check failure with NULL context.
   CU_ASSERT(tpm2_kmyth_unseal_data
-            (NULL, sk_handle, ski.wk_pub, ski.wk_priv, authVal, ski.pcr_list,
-             authPolicy, &output_data, &output_data_len) == 1);
+            (NULL, NULL, sk_handle, ski.wk_pub, ski.wk_priv, authVal,
+             ski.pcr_list, authPolicy, &output_data, &output_data_len) == 1);
   CU_ASSERT(output_data_len == 0);
 
   free_tpm2_resources(&sapi_ctx);
 }
+
+//--------------------------------------------------------------------------------
+// test_kmyth_seal_stress
+//--------------------------------------------------------------------------------
+void test_kmyth_seal_stress(void)
+{
+  extern const cipher_t cipher_list[];
+  size_t payload = stress_payload_size();
+
+  if (payload == 0)
+  {
+    return;
+  }
+
+  kmyth_tpm_context *ctx = NULL;
+  uint8_t *data = stress_payload(payload);
+  double min_mbps = stress_min_mbps();
+  stress_probe probe;
+
+  CU_ASSERT_FATAL(data != NULL);
+  CU_ASSERT_FATAL(kmyth_tpm_context_open(NULL, 0, &ctx) == 0);
+
+  // the allocating and caller-buffer functions, through every cipher but
+  // AES Key Wrap (which is meant for keys, see test_kmyth_cipher_stress())
+  for (size_t i = 0; cipher_list[i].cipher_name != NULL; i++)
+  {
+    char *cipher = (char *) cipher_list[i].cipher_name;
+
+    if (strstr(cipher, "KeyWrap") != NULL)
+    {
+      continue;
+    }
+    printf("\n%s (%zu MiB)", cipher, payload >> 20);
+
+    uint8_t *sealed = NULL;
+    size_t sealed_len = 0;
+
+    stress_probe_begin(&probe);
+    CU_ASSERT(kmyth_tpm_context_seal(ctx, data, payload, &sealed, &sealed_len,
+                                     NULL, 0, NULL, 0, cipher) == 0);
+    stress_probe_end(&probe, payload, sealed_len, min_mbps, "seal");
+
+    uint8_t *result = NULL;
+    size_t result_len = 0;
+
+    stress_probe_begin(&probe);
+    CU_ASSERT(kmyth_tpm_context_unseal(ctx, sealed, sealed_len, &result,
+                                       &result_len, NULL, 0) == 0);
+    stress_probe_end(&probe, payload, payload, min_mbps, "unseal");
+    CU_ASSERT(result_len == payload);
+    CU_ASSERT(result != NULL && stress_payload_check(result, result_len, 0));
+    free(result);
+
+    // unsealing into a caller's buffer needs no more memory
+    CU_ASSERT(kmyth_tpm_context_unseal_into(NULL, sealed, sealed_len, NULL,
+                                            &result_len, NULL, 0) == 0);
+    result = malloc(result_len);
+    CU_ASSERT_FATAL(result != NULL);
+    memset(result, 0xA5, result_len);  // fault the buffer in beforehand
+    stress_probe_begin(&probe);
+    CU_ASSERT(kmyth_tpm_context_unseal_into(ctx, sealed, sealed_len, result,
+                                            &result_len, NULL, 0) == 0);
+    stress_probe_end(&probe, payload, 0, min_mbps, "unseal into");
+    CU_ASSERT(result_len == payload);
+    CU_ASSERT(stress_payload_check(result, result_len, 0));
+    free(result);
+
+    // nor does sealing into one
+    size_t into_len = 0;
+
+    CU_ASSERT(kmyth_tpm_context_seal_into(ctx, data, payload, NULL,
+                                          &into_len, NULL, 0, NULL, 0,
+                                          cipher) == 0);
+    free(sealed);
+    sealed = malloc(into_len);
+    CU_ASSERT_FATAL(sealed != NULL);
+    memset(sealed, 0xA5, into_len);
+    sealed_len = into_len;
+    stress_probe_begin(&probe);
+    CU_ASSERT(kmyth_tpm_context_seal_into(ctx, data, payload, sealed,
+                                          &sealed_len, NULL, 0, NULL, 0,
+                                          cipher) == 0);
+    stress_probe_end(&probe, payload, 0, min_mbps, "seal into");
+    free(sealed);
+  }
+
+  // the stream functions never hold the whole payload
+  FILE *plain = tmpfile();
+  FILE *ski = tmpfile();
+  FILE *unsealed = tmpfile();
+
+  CU_ASSERT_FATAL(plain != NULL && ski != NULL && unsealed != NULL);
+  printf("\nstream (%zu MiB)", payload >> 20);
+  CU_ASSERT(fwrite(data, 1, payload, plain) == payload);
+  rewind(plain);
+  stress_probe_begin(&probe);
+  CU_ASSERT(kmyth_tpm_context_seal_stream(ctx, plain, ski, NULL, 0, NULL, 0,
+                                          NULL) == 0);
+  CU_ASSERT(fflush(ski) == 0);
+  stress_probe_end(&probe, payload, 0, min_mbps, "seal stream");
+  rewind(ski);
+  stress_probe_begin(&probe);
+  CU_ASSERT(kmyth_tpm_context_unseal_stream(ctx, ski, unsealed, NULL,
+                                            0) == 0);
+  CU_ASSERT(fflush(unsealed) == 0);
+  stress_probe_end(&probe, payload, 0, min_mbps, "unseal stream");
+  CU_ASSERT(stress_stream_check(unsealed, payload));
+  fclose(unsealed);
+  fclose(ski);
+  fclose(plain);
+
+  // the file functions map their input, so its pages count as resident
+  char path[] = "/tmp/kmyth_seal_stress_XXXXXX";
+  int fd = mkstemp(path);
+
+  CU_ASSERT_FATAL(fd >= 0);
+  close(fd);
+  CU_ASSERT(write_bytes_to_file(path, data, payload) == 0);
+  free(data);
+  printf("\nmapped file (%zu MiB)", payload >> 20);
+
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+
+  stress_probe_begin(&probe);
+  CU_ASSERT(tpm2_kmyth_seal_file(path, &sealed, &sealed_len, NULL, 0, NULL,
+                                 0, NULL, 0, NULL) == 0);
+  stress_probe_end(&probe, payload, payload + sealed_len, min_mbps,
+                   "seal file");
+  CU_ASSERT(write_bytes_to_file(path, sealed, sealed_len) == 0);
+  free(sealed);
+
+  uint8_t *result = NULL;
+  size_t result_len = 0;
+
+  stress_probe_begin(&probe);
+  CU_ASSERT(tpm2_kmyth_unseal_file(path, &result, &result_len, NULL, 0, NULL,
+                                   0) == 0);
+  stress_probe_end(&probe, payload, sealed_len + payload, min_mbps,
+                   "unseal file");
+  CU_ASSERT(result_len == payload);
+  CU_ASSERT(result != NULL && stress_payload_check(result, result_len, 0));
+  free(result);
+  unlink(path);
+
+  kmyth_tpm_context_close(&ctx);
+  printf("\n");
+}
@@ -112,6 +112,19 @@ void test_init_kmyth_object_template(void)
   CU_ASSERT(pubArea.authPolicy.size == authPolicy.size);
   CU_ASSERT(memcmp(authPolicy.buffer, pubArea.authPolicy.buffer,
                    authPolicy.size) == 0);
+
+  // A key template can be for an ECC key instead
+  pubArea = emptyPubArea;
+  CU_ASSERT(init_kmyth_key_template(TPM2_ALG_ECC, authPolicy, &pubArea) == 0);
+  CU_ASSERT(pubArea.type == TPM2_ALG_ECC);
+  CU_ASSERT(pubArea.parameters.eccDetail.curveID == KMYTH_ECC_CURVE);
+  CU_ASSERT(pubArea.authPolicy.size == authPolicy.size);
+
+  // but not for a non-key, or with a NULL public area
+  CU_ASSERT(init_kmyth_key_template(TPM2_ALG_KEYEDHASH, authPolicy,
+                                    &pubArea) == 1);
+  CU_ASSERT(init_kmyth_key_template(TPM2_ALG_RSA, authPolicy,
+                                    (TPMT_PUBLIC *) NULL) == 1);
 }
 
 //----------------------------------------------------------------------------
@@ -6,6 +6,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <CUnit/CUnit.h>
 
 #include "tpm2_interface.h"
@@ -27,6 +28,11 @@ int pcrs_add_tests(CU_pSuite suite)
   {
     return 1;
   }
+  if (NULL == CU_add_test(suite, "read_pcr_snapshot() Tests",
+                          test_read_pcr_snapshot))
+  {
+    return 1;
+  }
 
   return 0;
 }
@@ -103,3 +109,64 @@ void test_get_pcr_count(void)
   //Test NULL context
   CU_ASSERT(get_pcr_count(NULL, &count) == 1);
 }
+
+//----------------------------------------------------------------------------
+// test_read_pcr_snapshot
+//----------------------------------------------------------------------------
+void test_read_pcr_snapshot(void)
+{
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+
+  init_tpm2_connection(&sapi_ctx);
+  bool emulator = true;
+
+  get_tpm2_impl_type(sapi_ctx, &emulator);
+  if (!emulator)
+  {
+    return;
+  }
+
+  kmyth_pcr_snapshot snapshot = {.valid = false, };
+  TPML_PCR_SELECTION pcrs_struct = {.count = 0, };
+
+  //No PCRs selected - nothing read
+  init_pcr_selection(sapi_ctx, NULL, 0, &pcrs_struct);
+  CU_ASSERT(read_pcr_snapshot(sapi_ctx, pcrs_struct, &snapshot) == 0);
+  CU_ASSERT(snapshot.valid);
+  CU_ASSERT(snapshot.count == 0);
+
+  //More PCRs selected than one TPM2_PCR_Read() returns
+  int pcrs[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+  init_pcr_selection(sapi_ctx, pcrs, 12, &pcrs_struct);
+  CU_ASSERT(read_pcr_snapshot(sapi_ctx, pcrs_struct, &snapshot) == 0);
+  CU_ASSERT(snapshot.valid);
+  CU_ASSERT(snapshot.count == 12);
+
+  TPM2B_DIGEST first = {.size = 0, };
+  TPM2B_DIGEST second = {.size = 0, };
+
+  CU_ASSERT(get_pcr_snapshot_digest(&snapshot, &first) == 0);
+  CU_ASSERT(first.size == KMYTH_DIGEST_SIZE);
+
+  //Unchanged PCRs - the snapshot is kept, with the same digest
+  uint32_t update_counter = snapshot.update_counter;
+
+  CU_ASSERT(refresh_pcr_snapshot(sapi_ctx, pcrs_struct, &snapshot) == 0);
+  CU_ASSERT(snapshot.update_counter == update_counter);
+  CU_ASSERT(get_pcr_snapshot_digest(&snapshot, &second) == 0);
+  CU_ASSERT(memcmp(first.buffer, second.buffer, first.size) == 0);
+
+  //A different selection is read again
+  init_pcr_selection(sapi_ctx, pcrs, 2, &pcrs_struct);
+  CU_ASSERT(refresh_pcr_snapshot(sapi_ctx, pcrs_struct, &snapshot) == 0);
+  CU_ASSERT(snapshot.count == 2);
+
+  //Failures: NULL snapshot, invalid snapshot, NULL TPM context
+  CU_ASSERT(read_pcr_snapshot(sapi_ctx, pcrs_struct, NULL) != 0);
+  snapshot.valid = false;
+  CU_ASSERT(get_pcr_snapshot_digest(&snapshot, &first) != 0);
+  CU_ASSERT(read_pcr_snapshot(NULL, pcrs_struct, &snapshot) != 0);
+
+  free_tpm2_resources(&sapi_ctx);
+}
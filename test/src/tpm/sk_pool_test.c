@@ -0,0 +1,236 @@
+//############################################################################
+// sk_pool_test.c
+//
+// Tests for TPM 2.0 storage key pool functions in tpm2/src/tpm/sk_pool.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <CUnit/CUnit.h>
+
+#include "sk_pool_test.h"
+#include "sk_pool.h"
+#include "object_tools.h"
+
+//----------------------------------------------------------------------------
+// sk_pool_add_tests()
+//----------------------------------------------------------------------------
+int sk_pool_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "get_sk_pool_id() Tests",
+                          test_get_sk_pool_id))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite, "sk_pool_put()/sk_pool_take() Tests",
+                          test_sk_pool_put_take))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_get_sk_pool_id
+//----------------------------------------------------------------------------
+void test_get_sk_pool_id(void)
+{
+  char pool_dir[] = "/tmp/kmyth_sk_pool_XXXXXX";
+  char other_dir[] = "/tmp/kmyth_sk_pool_XXXXXX";
+
+  CU_ASSERT_FATAL(mkdtemp(pool_dir) != NULL);
+  CU_ASSERT_FATAL(mkdtemp(other_dir) != NULL);
+
+  TPM2B_DIGEST policy = {.size = KMYTH_DIGEST_SIZE, };
+  TPM2B_AUTH authVal = {.size = KMYTH_DIGEST_SIZE, };
+  char id[KMYTH_SK_POOL_ID_LEN];
+  char other_id[KMYTH_SK_POOL_ID_LEN];
+
+  memset(policy.buffer, 0x11, policy.size);
+  memset(authVal.buffer, 0x22, authVal.size);
+
+  // the ID is a hex string, the same for the same inputs and pool
+  CU_ASSERT(get_sk_pool_id(pool_dir, TPM2_ALG_ECC, policy, authVal,
+                           id) == 0);
+  CU_ASSERT(strlen(id) == KMYTH_SK_POOL_ID_LEN - 1);
+  CU_ASSERT(strspn(id, "0123456789abcdef") == KMYTH_SK_POOL_ID_LEN - 1);
+  CU_ASSERT(get_sk_pool_id(pool_dir, TPM2_ALG_ECC, policy, authVal,
+                           other_id) == 0);
+  CU_ASSERT(strcmp(id, other_id) == 0);
+
+  // the ID is keyed with a pool key, readable only by the pool owner, so
+  // it differs from one pool to the next
+  char key_path[sizeof(pool_dir) + sizeof(KMYTH_SK_POOL_KEY_FILE) + 1];
+  struct stat st = { 0 };
+
+  snprintf(key_path, sizeof(key_path), "%s/%s", pool_dir,
+           KMYTH_SK_POOL_KEY_FILE);
+  CU_ASSERT(stat(key_path, &st) == 0);
+  CU_ASSERT((st.st_mode & 0777) == 0600);
+  CU_ASSERT(get_sk_pool_id(other_dir, TPM2_ALG_ECC, policy, authVal,
+                           other_id) == 0);
+  CU_ASSERT(strcmp(id, other_id) != 0);
+
+  // the ID changes with each of the algorithm, policy and authVal
+  CU_ASSERT(get_sk_pool_id(pool_dir, TPM2_ALG_RSA, policy, authVal,
+                           other_id) == 0);
+  CU_ASSERT(strcmp(id, other_id) != 0);
+  policy.buffer[0] ^= 1;
+  CU_ASSERT(get_sk_pool_id(pool_dir, TPM2_ALG_ECC, policy, authVal,
+                           other_id) == 0);
+  CU_ASSERT(strcmp(id, other_id) != 0);
+  policy.buffer[0] ^= 1;
+  authVal.buffer[0] ^= 1;
+  CU_ASSERT(get_sk_pool_id(pool_dir, TPM2_ALG_ECC, policy, authVal,
+                           other_id) == 0);
+  CU_ASSERT(strcmp(id, other_id) != 0);
+
+  CU_ASSERT(get_sk_pool_id(pool_dir, TPM2_ALG_ECC, policy, authVal,
+                           NULL) == 1);
+  CU_ASSERT(get_sk_pool_id(NULL, TPM2_ALG_ECC, policy, authVal, id) == 1);
+
+  // a pool directory others may write to is refused
+  chmod(other_dir, 0770);
+  CU_ASSERT(get_sk_pool_id(other_dir, TPM2_ALG_ECC, policy, authVal,
+                           other_id) == 1);
+  chmod(other_dir, 0700);
+
+  unlink(key_path);
+  rmdir(pool_dir);
+  snprintf(key_path, sizeof(key_path), "%s/%s", other_dir,
+           KMYTH_SK_POOL_KEY_FILE);
+  unlink(key_path);
+  rmdir(other_dir);
+}
+
+//----------------------------------------------------------------------------
+// test_sk_pool_put_take
+//----------------------------------------------------------------------------
+void test_sk_pool_put_take(void)
+{
+  char base_dir[] = "/tmp/kmyth_sk_pool_XXXXXX";
+
+  CU_ASSERT_FATAL(mkdtemp(base_dir) != NULL);
+
+  // the pool directory is created by the first put
+  char pool_dir[sizeof(base_dir) + 5];
+
+  snprintf(pool_dir, sizeof(pool_dir), "%s/pool", base_dir);
+
+  TPM2B_DIGEST policy = {.size = KMYTH_DIGEST_SIZE, };
+  TPM2B_PUBLIC sk_pub = {.size = 0, };
+  TPM2B_PRIVATE sk_priv = {.size = 16, };
+  TPM2B_PUBLIC out_pub = {.size = 0, };
+  TPM2B_PRIVATE out_priv = {.size = 0, };
+  bool found = true;
+  size_t count = 1;
+
+  memset(policy.buffer, 0x11, policy.size);
+  CU_ASSERT_FATAL(init_kmyth_key_template(TPM2_ALG_ECC, policy,
+                                          &sk_pub.publicArea) == 0);
+  memset(sk_priv.buffer, 0x5A, sk_priv.size);
+
+  const char *id = "0123456789abcdef";
+  const char *other_id = "fedcba9876543210";
+
+  // a pool directory that does not exist is an empty pool
+  CU_ASSERT(sk_pool_count(pool_dir, id, &count) == 0);
+  CU_ASSERT(count == 0);
+  CU_ASSERT(sk_pool_take(pool_dir, id, TPM2_ALG_ECC, policy, &out_pub,
+                         &out_priv, &found) == 0);
+  CU_ASSERT(found == false);
+
+  CU_ASSERT(sk_pool_put(pool_dir, id, &sk_pub, &sk_priv) == 0);
+  CU_ASSERT(sk_pool_put(pool_dir, id, &sk_pub, &sk_priv) == 0);
+  CU_ASSERT(sk_pool_count(pool_dir, id, &count) == 0);
+  CU_ASSERT(count == 2);
+  CU_ASSERT(sk_pool_count(pool_dir, other_id, &count) == 0);
+  CU_ASSERT(count == 0);
+
+  // the pool and its keys are private to their owner
+  struct stat st = { 0 };
+
+  CU_ASSERT(stat(pool_dir, &st) == 0);
+  CU_ASSERT((st.st_mode & 0777) == 0700);
+
+  DIR *dir = opendir(pool_dir);
+  struct dirent *entry = NULL;
+
+  while (dir != NULL && (entry = readdir(dir)) != NULL)
+  {
+    char path[sizeof(pool_dir) + 256];
+
+    if (entry->d_name[0] == '.')
+    {
+      continue;
+    }
+    snprintf(path, sizeof(path), "%s/%s", pool_dir, entry->d_name);
+    CU_ASSERT(stat(path, &st) == 0);
+    CU_ASSERT((st.st_mode & 0777) == 0600);
+  }
+  if (dir != NULL)
+  {
+    closedir(dir);
+  }
+
+  // keys are only taken for their own pool ID
+  CU_ASSERT(sk_pool_take(pool_dir, other_id, TPM2_ALG_ECC, policy, &out_pub,
+                         &out_priv, &found) == 0);
+  CU_ASSERT(found == false);
+
+  // a key that does not match the storage key template for the requested
+  // algorithm and policy is discarded, not taken
+  CU_ASSERT(sk_pool_take(pool_dir, id, TPM2_ALG_RSA, policy, &out_pub,
+                         &out_priv, &found) == 0);
+  CU_ASSERT(found == false);
+  CU_ASSERT(sk_pool_count(pool_dir, id, &count) == 0);
+  CU_ASSERT(count == 1);
+
+  // a key that matches comes out as it was put in, and is removed
+  CU_ASSERT(sk_pool_take(pool_dir, id, TPM2_ALG_ECC, policy, &out_pub,
+                         &out_priv, &found) == 0);
+  CU_ASSERT(found == true);
+  CU_ASSERT(out_pub.publicArea.type == TPM2_ALG_ECC);
+  CU_ASSERT(out_priv.size == sk_priv.size);
+  CU_ASSERT(memcmp(out_priv.buffer, sk_priv.buffer, sk_priv.size) == 0);
+  CU_ASSERT(sk_pool_count(pool_dir, id, &count) == 0);
+  CU_ASSERT(count == 0);
+
+  // a key that could be duplicated (exported by whoever created it) is
+  // discarded, whoever put it in the pool
+  sk_pub.publicArea.objectAttributes &= ~(TPMA_OBJECT_FIXEDTPM |
+                                          TPMA_OBJECT_FIXEDPARENT);
+  CU_ASSERT(sk_pool_put(pool_dir, id, &sk_pub, &sk_priv) == 0);
+  CU_ASSERT(sk_pool_take(pool_dir, id, TPM2_ALG_ECC, policy, &out_pub,
+                         &out_priv, &found) == 0);
+  CU_ASSERT(found == false);
+  CU_ASSERT(sk_pool_count(pool_dir, id, &count) == 0);
+  CU_ASSERT(count == 0);
+
+  // a pool directory others may write to, or a link to one, is refused
+  char link_dir[sizeof(base_dir) + 5];
+
+  snprintf(link_dir, sizeof(link_dir), "%s/link", base_dir);
+  CU_ASSERT(symlink(pool_dir, link_dir) == 0);
+  CU_ASSERT(sk_pool_put(link_dir, id, &sk_pub, &sk_priv) == 1);
+  CU_ASSERT(sk_pool_take(link_dir, id, TPM2_ALG_ECC, policy, &out_pub,
+                         &out_priv, &found) == 1);
+  unlink(link_dir);
+  chmod(pool_dir, 0777);
+  CU_ASSERT(sk_pool_put(pool_dir, id, &sk_pub, &sk_priv) == 1);
+  CU_ASSERT(sk_pool_take(pool_dir, id, TPM2_ALG_ECC, policy, &out_pub,
+                         &out_priv, &found) == 1);
+  chmod(pool_dir, 0700);
+
+  CU_ASSERT(sk_pool_put(NULL, id, &sk_pub, &sk_priv) == 1);
+  CU_ASSERT(sk_pool_take(pool_dir, NULL, TPM2_ALG_ECC, policy, &out_pub,
+                         &out_priv, &found) == 1);
+
+  rmdir(pool_dir);
+  rmdir(base_dir);
+}
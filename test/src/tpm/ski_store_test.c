@@ -0,0 +1,267 @@
+//############################################################################
+// ski_store_test.c
+//
+// Tests for content-addressed .ski store functions in
+// tpm2/src/tpm/ski_store.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <CUnit/CUnit.h>
+
+#include "ski_store_test.h"
+#include "ski_store.h"
+
+//----------------------------------------------------------------------------
+// ski_store_add_tests()
+//----------------------------------------------------------------------------
+int ski_store_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "ski_store_get_key() Tests",
+                          test_ski_store_get_key))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite, "ski_store_id() Tests", test_ski_store_id))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite,
+                          "ski_store_put()/ski_store_get()/ski_store_link() "
+                          "Tests", test_ski_store_put_get_link))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_ski_store_get_key
+//----------------------------------------------------------------------------
+void test_ski_store_get_key(void)
+{
+  char base_dir[] = "/tmp/kmyth_ski_store_XXXXXX";
+
+  CU_ASSERT_FATAL(mkdtemp(base_dir) != NULL);
+
+  // the store directory and its key are created on first use
+  char store_dir[sizeof(base_dir) + 6];
+  char key_path[sizeof(store_dir) + sizeof(KMYTH_SKI_STORE_KEY_FILE)];
+
+  snprintf(store_dir, sizeof(store_dir), "%s/store", base_dir);
+  snprintf(key_path, sizeof(key_path), "%s/" KMYTH_SKI_STORE_KEY_FILE,
+           store_dir);
+
+  uint8_t key[KMYTH_SKI_STORE_KEY_SIZE];
+  uint8_t other_key[KMYTH_SKI_STORE_KEY_SIZE];
+  struct stat st = { 0 };
+
+  CU_ASSERT(ski_store_get_key(store_dir, key) == 0);
+  CU_ASSERT(stat(store_dir, &st) == 0);
+  CU_ASSERT((st.st_mode & 0777) == 0700);
+  CU_ASSERT(stat(key_path, &st) == 0);
+  CU_ASSERT(st.st_size == KMYTH_SKI_STORE_KEY_SIZE);
+  CU_ASSERT((st.st_mode & 0777) == 0600);
+
+  // later calls read back the same key
+  CU_ASSERT(ski_store_get_key(store_dir, other_key) == 0);
+  CU_ASSERT(memcmp(key, other_key, sizeof(key)) == 0);
+
+  // a store directory that others could write to is not trusted
+  CU_ASSERT(chmod(store_dir, 0770) == 0);
+  CU_ASSERT(ski_store_get_key(store_dir, other_key) == 1);
+  CU_ASSERT(chmod(store_dir, 0700) == 0);
+
+  CU_ASSERT(ski_store_get_key(NULL, key) == 1);
+  CU_ASSERT(ski_store_get_key(store_dir, NULL) == 1);
+
+  unlink(key_path);
+  rmdir(store_dir);
+  rmdir(base_dir);
+}
+
+//----------------------------------------------------------------------------
+// test_ski_store_id
+//----------------------------------------------------------------------------
+void test_ski_store_id(void)
+{
+  uint8_t key[KMYTH_SKI_STORE_KEY_SIZE];
+  uint8_t input[64];
+  uint8_t auth[] = "auth";
+  int pcrs[] = { 0, 7 };
+  ski_store_policy policy = {
+    .auth_bytes = auth,
+    .auth_bytes_len = 4,
+    .pcrs = pcrs,
+    .pcrs_len = 2,
+    .cipher_string = NULL,
+  };
+  char id[KMYTH_SKI_STORE_ID_LEN];
+  char other_id[KMYTH_SKI_STORE_ID_LEN];
+
+  memset(key, 0x11, sizeof(key));
+  memset(input, 0x22, sizeof(input));
+
+  // the ID is a hex string, the same for the same inputs
+  CU_ASSERT(ski_store_id(key, input, sizeof(input), &policy, id) == 0);
+  CU_ASSERT(strlen(id) == KMYTH_SKI_STORE_ID_LEN - 1);
+  CU_ASSERT(strspn(id, "0123456789abcdef") == KMYTH_SKI_STORE_ID_LEN - 1);
+  CU_ASSERT(ski_store_id(key, input, sizeof(input), &policy, other_id) == 0);
+  CU_ASSERT(strcmp(id, other_id) == 0);
+
+  // the ID changes with the key, the data and each seal parameter
+  key[0] ^= 1;
+  CU_ASSERT(ski_store_id(key, input, sizeof(input), &policy, other_id) == 0);
+  CU_ASSERT(strcmp(id, other_id) != 0);
+  key[0] ^= 1;
+  input[0] ^= 1;
+  CU_ASSERT(ski_store_id(key, input, sizeof(input), &policy, other_id) == 0);
+  CU_ASSERT(strcmp(id, other_id) != 0);
+  input[0] ^= 1;
+  CU_ASSERT(ski_store_id(key, input, sizeof(input) - 1, &policy,
+                         other_id) == 0);
+  CU_ASSERT(strcmp(id, other_id) != 0);
+  auth[0] ^= 1;
+  CU_ASSERT(ski_store_id(key, input, sizeof(input), &policy, other_id) == 0);
+  CU_ASSERT(strcmp(id, other_id) != 0);
+  auth[0] ^= 1;
+  pcrs[1] = 8;
+  CU_ASSERT(ski_store_id(key, input, sizeof(input), &policy, other_id) == 0);
+  CU_ASSERT(strcmp(id, other_id) != 0);
+  pcrs[1] = 7;
+  policy.pcrs_len = 1;
+  CU_ASSERT(ski_store_id(key, input, sizeof(input), &policy, other_id) == 0);
+  CU_ASSERT(strcmp(id, other_id) != 0);
+  policy.pcrs_len = 2;
+  policy.cipher_string = "AES/GCM/NoPadding/128";
+  CU_ASSERT(ski_store_id(key, input, sizeof(input), &policy, other_id) == 0);
+  CU_ASSERT(strcmp(id, other_id) != 0);
+  policy.cipher_string = NULL;
+  policy.ski_format = 1;
+  CU_ASSERT(ski_store_id(key, input, sizeof(input), &policy, other_id) == 0);
+  CU_ASSERT(strcmp(id, other_id) != 0);
+  policy.ski_format = 0;
+  policy.sk_alg = 1;
+  CU_ASSERT(ski_store_id(key, input, sizeof(input), &policy, other_id) == 0);
+  CU_ASSERT(strcmp(id, other_id) != 0);
+  policy.sk_alg = 0;
+  policy.compression = 1;
+  CU_ASSERT(ski_store_id(key, input, sizeof(input), &policy, other_id) == 0);
+  CU_ASSERT(strcmp(id, other_id) != 0);
+  policy.compression = 0;
+
+  CU_ASSERT(ski_store_id(key, input, sizeof(input), &policy, other_id) == 0);
+  CU_ASSERT(strcmp(id, other_id) == 0);
+
+  CU_ASSERT(ski_store_id(NULL, input, sizeof(input), &policy, id) == 1);
+  CU_ASSERT(ski_store_id(key, input, sizeof(input), NULL, id) == 1);
+  CU_ASSERT(ski_store_id(key, input, sizeof(input), &policy, NULL) == 1);
+}
+
+//----------------------------------------------------------------------------
+// test_ski_store_put_get_link
+//----------------------------------------------------------------------------
+void test_ski_store_put_get_link(void)
+{
+  char base_dir[] = "/tmp/kmyth_ski_store_XXXXXX";
+
+  CU_ASSERT_FATAL(mkdtemp(base_dir) != NULL);
+
+  // the store directory is created by the first put
+  char store_dir[sizeof(base_dir) + 6];
+  char alias_path[sizeof(base_dir) + 10];
+
+  snprintf(store_dir, sizeof(store_dir), "%s/store", base_dir);
+  snprintf(alias_path, sizeof(alias_path), "%s/alias.ski", base_dir);
+
+  const char *id = "0123456789abcdef";
+  const char *other_id = "fedcba9876543210";
+  uint8_t ski[100];
+  uint8_t *out = NULL;
+  size_t out_len = 0;
+  bool found = true;
+
+  memset(ski, 0x5A, sizeof(ski));
+
+  // a store directory that does not exist is an empty store
+  CU_ASSERT(ski_store_get(store_dir, id, &out, &out_len, &found) == 0);
+  CU_ASSERT(found == false);
+  CU_ASSERT(out == NULL);
+
+  CU_ASSERT(ski_store_put(store_dir, id, ski, sizeof(ski)) == 0);
+  CU_ASSERT(ski_store_get(store_dir, other_id, &out, &out_len, &found) == 0);
+  CU_ASSERT(found == false);
+
+  // the .ski is stored readable only by its owner, and comes out as it
+  // was put in
+  char *stored_path = NULL;
+  struct stat st = { 0 };
+  struct stat alias_st = { 0 };
+
+  CU_ASSERT(ski_store_path(store_dir, id, &stored_path) == 0);
+  CU_ASSERT_FATAL(stored_path != NULL);
+  CU_ASSERT(stat(stored_path, &st) == 0);
+  CU_ASSERT((st.st_mode & 0777) == 0600);
+  CU_ASSERT(ski_store_get(store_dir, id, &out, &out_len, &found) == 0);
+  CU_ASSERT(found == true);
+  CU_ASSERT(out_len == sizeof(ski));
+  CU_ASSERT(out != NULL && memcmp(out, ski, sizeof(ski)) == 0);
+  free(out);
+  out = NULL;
+
+  // an alias is the stored file itself, and replaces an existing file
+  FILE *file = fopen(alias_path, "w");
+
+  CU_ASSERT_FATAL(file != NULL);
+  fputs("old", file);
+  fclose(file);
+  CU_ASSERT(ski_store_link(stored_path, alias_path) == 0);
+  CU_ASSERT(stat(stored_path, &st) == 0);
+  CU_ASSERT(stat(alias_path, &alias_st) == 0);
+  CU_ASSERT(st.st_ino == alias_st.st_ino);
+  CU_ASSERT(alias_st.st_size == sizeof(ski));
+
+  // replacing the stored .ski leaves existing aliases as they were
+  ski[0] = 0xA5;
+  CU_ASSERT(ski_store_put(store_dir, id, ski, sizeof(ski)) == 0);
+  CU_ASSERT(ski_store_get(store_dir, id, &out, &out_len, &found) == 0);
+  CU_ASSERT(found == true);
+  CU_ASSERT(out != NULL && out[0] == 0xA5);
+  free(out);
+  CU_ASSERT(stat(stored_path, &st) == 0);
+  CU_ASSERT(stat(alias_path, &alias_st) == 0);
+  CU_ASSERT(st.st_ino != alias_st.st_ino);
+
+  // an alias on another filesystem (if there is one to test with) is a
+  // regular file with the same contents, not a link into the store
+  struct stat shm_st = { 0 };
+  char shm_alias_path[] = "/dev/shm/kmyth_ski_store_alias.ski";
+
+  if (stat("/dev/shm", &shm_st) == 0 && shm_st.st_dev != st.st_dev)
+  {
+    CU_ASSERT(ski_store_link(stored_path, shm_alias_path) == 0);
+    CU_ASSERT(lstat(shm_alias_path, &alias_st) == 0);
+    CU_ASSERT(S_ISREG(alias_st.st_mode));
+    CU_ASSERT(alias_st.st_size == sizeof(ski));
+    file = fopen(shm_alias_path, "rb");
+    CU_ASSERT_FATAL(file != NULL);
+    CU_ASSERT(fgetc(file) == 0xA5);
+    fclose(file);
+    unlink(shm_alias_path);
+  }
+
+  CU_ASSERT(ski_store_put(NULL, id, ski, sizeof(ski)) == 1);
+  CU_ASSERT(ski_store_put(store_dir, id, NULL, 0) == 1);
+  CU_ASSERT(ski_store_get(store_dir, NULL, &out, &out_len, &found) == 1);
+  CU_ASSERT(ski_store_link(NULL, alias_path) == 1);
+
+  unlink(alias_path);
+  unlink(stored_path);
+  free(stored_path);
+  rmdir(store_dir);
+  rmdir(base_dir);
+}
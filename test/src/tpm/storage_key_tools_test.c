@@ -6,6 +6,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <CUnit/CUnit.h>
 
 #include "tpm2_interface.h"
@@ -34,6 +35,10 @@ int storage_key_tools_add_tests(CU_pSuite suite)
   {
     return 1;
   }
+  if (NULL == CU_add_test(suite, "set_srk_handle() Tests", test_set_srk_handle))
+  {
+    return 1;
+  }
   if (NULL == CU_add_test(suite, "get_existing_srk_handle() Tests",
                           test_get_existing_srk_handle))
   {
@@ -76,6 +81,67 @@ void test_get_srk_handle(void)
   free_tpm2_resources(&sapi_ctx);
 }
 
+//----------------------------------------------------------------------------
+// test_set_srk_handle
+//----------------------------------------------------------------------------
+void test_set_srk_handle(void)
+{
+  //Only persistent handles can be configured
+  CU_ASSERT(set_srk_handle("0x80000000") != 0);
+  CU_ASSERT(set_srk_handle("0x81000000x") != 0);
+  CU_ASSERT(set_srk_handle("") != 0);
+  CU_ASSERT(set_srk_handle("0x81000001") == 0);
+  CU_ASSERT(set_srk_handle(NULL) == 0);
+
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+
+  init_tpm2_connection(&sapi_ctx);
+
+  //The handle found is recorded in the state file
+  char state_file[] = "/tmp/kmyth_srk_state_XXXXXX";
+  int fd = mkstemp(state_file);
+
+  CU_ASSERT(fd >= 0);
+  close(fd);
+  CU_ASSERT(set_srk_state_file(state_file) == 0);
+
+  TPM2_HANDLE srk_handle = 0;
+  TPM2B_AUTH owner_auth = {.size = 0, };
+  CU_ASSERT(get_srk_handle(sapi_ctx, &srk_handle, &owner_auth) == 0);
+
+  FILE *file = fopen(state_file, "r");
+  unsigned int recorded = 0;
+
+  CU_ASSERT(file != NULL);
+  if (file != NULL)
+  {
+    CU_ASSERT(fscanf(file, "%x", &recorded) == 1);
+    fclose(file);
+  }
+  CU_ASSERT(recorded == srk_handle);
+
+  //A stale state file, or a configured handle without the SRK, only costs
+  //the full search
+  file = fopen(state_file, "w");
+  CU_ASSERT(file != NULL);
+  if (file != NULL)
+  {
+    fprintf(file, "0x%08X\n", TPM2_PERSISTENT_LAST);
+    fclose(file);
+  }
+  TPM2_HANDLE found_handle = 0;
+
+  CU_ASSERT(set_srk_handle("0x81FFFFFE") == 0);
+  CU_ASSERT(get_srk_handle(sapi_ctx, &found_handle, &owner_auth) == 0);
+  CU_ASSERT(found_handle == srk_handle);
+  CU_ASSERT(set_srk_handle(NULL) == 0);
+
+  CU_ASSERT(set_srk_state_file(NULL) == 0);
+  remove(state_file);
+
+  free_tpm2_resources(&sapi_ctx);
+}
+
 //----------------------------------------------------------------------------
 // test_get_existing_srk_handle
 //----------------------------------------------------------------------------
@@ -127,7 +193,8 @@ void test_check_if_srk(void)
   TPM2_HANDLE sk_handle = 0;
 
   create_and_load_sk(sapi_ctx, srk_handle, owner_auth, obj_auth, pcrs_struct,
-                     auth_policy, &sk_handle, &sk_priv, &sk_pub);
+                     auth_policy, KMYTH_KEY_PUBKEY_ALG, &sk_handle, &sk_priv,
+                     &sk_pub);
   CU_ASSERT(check_if_srk(sapi_ctx, sk_handle, &is_srk) == 0);
   CU_ASSERT(!is_srk);
 
@@ -180,6 +247,7 @@ void test_put_srk_into_persistent_storage(void)
   };
   //Clear all persistent storage to remove SRK and make TPM2_PERSISTENT_FIRST available
   Tss2_Sys_Clear(sapi_ctx, TPM2_RH_PLATFORM, &cmdAuth, &cmdRsp);
+  invalidate_tpm2_capability_cache(sapi_ctx);
   next = 0;
   srk_handle = 0;
   //Get the existing handle and verify it is 0
@@ -220,18 +288,41 @@ void test_create_and_load_sk(void)
   TPM2_HANDLE sk_handle = 0;
 
   CU_ASSERT(create_and_load_sk(sapi_ctx, srk_handle, owner_auth, obj_auth,
-                               pcrs_struct, auth_policy, &sk_handle, &sk_priv,
-                               &sk_pub) == 0);
+                               pcrs_struct, auth_policy, KMYTH_KEY_PUBKEY_ALG,
+                               &sk_handle, &sk_priv, &sk_pub) == 0);
   CU_ASSERT(sk_handle != 0);
   CU_ASSERT(sk_handle != srk_handle);
+  CU_ASSERT(sk_pub.publicArea.type == KMYTH_KEY_PUBKEY_ALG);
+  flush_tpm2_object(sapi_ctx, sk_handle);
+
+  //Valid test with an ECC storage key
+  TPM2_HANDLE ecc_sk_handle = 0;
+  TPM2B_PRIVATE ecc_sk_priv = {.size = 0, };
+  TPM2B_PUBLIC ecc_sk_pub = {.size = 0, };
+
+  CU_ASSERT(create_and_load_sk(sapi_ctx, srk_handle, owner_auth, obj_auth,
+                               pcrs_struct, auth_policy, TPM2_ALG_ECC,
+                               &ecc_sk_handle, &ecc_sk_priv,
+                               &ecc_sk_pub) == 0);
+  CU_ASSERT(ecc_sk_handle != 0);
+  CU_ASSERT(ecc_sk_pub.publicArea.type == TPM2_ALG_ECC);
+  flush_tpm2_object(sapi_ctx, ecc_sk_handle);
+
+  //Unsupported storage key algorithm
+  ecc_sk_handle = 0;
+  CU_ASSERT(create_and_load_sk(sapi_ctx, srk_handle, owner_auth, obj_auth,
+                               pcrs_struct, auth_policy, TPM2_ALG_KEYEDHASH,
+                               &ecc_sk_handle, &ecc_sk_priv,
+                               &ecc_sk_pub) != 0);
+  CU_ASSERT(ecc_sk_handle == 0);
 
   //Invalid context
   TPM2B_PRIVATE invalid_priv = {.size = 0, };
   TPM2B_PUBLIC invalid_pub = {.size = 0, };
   sk_handle = 0;
   CU_ASSERT(create_and_load_sk(NULL, srk_handle, owner_auth, obj_auth,
-                               pcrs_struct, auth_policy, &sk_handle,
-                               &invalid_priv, &invalid_pub) != 0);
+                               pcrs_struct, auth_policy, KMYTH_KEY_PUBKEY_ALG,
+                               &sk_handle, &invalid_priv, &invalid_pub) != 0);
   CU_ASSERT(sk_handle == 0 && invalid_priv.size == 0 && invalid_pub.size == 0);
 
   free_tpm2_resources(&sapi_ctx);
@@ -4,13 +4,16 @@
 // Tests for TPM 2.0 interface functions in tpm2/src/tpm/tpm2_interface.c
 //############################################################################
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <CUnit/CUnit.h>
 
 #include "tpm2_interface.h"
 #include "tpm2_interface_test.h"
 #include "pcrs.h"
+#include "storage_key_tools.h"
 #include "defines.h"
 
 //----------------------------------------------------------------------------
@@ -42,6 +45,17 @@ int tpm2_interface_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "init_tcti() Tests", test_init_tcti))
+  {
+    return 1;
+  }
+
+  if (NULL ==
+      CU_add_test(suite, "init_tcti_device() Tests", test_init_tcti_device))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "init_sapi() Tests", test_init_sapi))
   {
     return 1;
@@ -66,6 +80,18 @@ int tpm2_interface_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL ==
+      CU_add_test(suite, "read_tpm2_pcrs() Tests", test_read_tpm2_pcrs))
+  {
+    return 1;
+  }
+
+  if (NULL ==
+      CU_add_test(suite, "read_tpm2_public() Tests", test_read_tpm2_public))
+  {
+    return 1;
+  }
+
   if (NULL ==
       CU_add_test(suite, "get_tpm2_impl_type() Tests", test_get_tpm2_impl_type))
   {
@@ -126,6 +152,13 @@ int tpm2_interface_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL ==
+      CU_add_test(suite, "compute_policy_digest() Tests",
+                  test_compute_policy_digest))
+  {
+    return 1;
+  }
+
   if (NULL ==
       CU_add_test(suite, "create_policy_auth_session() Tests",
                   test_create_policy_auth_session))
@@ -140,6 +173,19 @@ int tpm2_interface_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL ==
+      CU_add_test(suite, "compute_kdfa() Tests", test_compute_kdfa))
+  {
+    return 1;
+  }
+
+  if (NULL ==
+      CU_add_test(suite, "crypt_session_param() Tests",
+                  test_crypt_session_param))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "apply_policy() Tests", test_apply_policy))
   {
     return 1;
@@ -183,6 +229,13 @@ void test_init_tcti_abrmd(void)
 {
   TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
 
+  // A TPM configured through KMYTH_TCTI (e.g., the TPM simulator of a
+  // 'kmyth-test -s' run) is not reached through tpm2-abrmd
+  if (getenv(KMYTH_TCTI_ENV) != NULL)
+  {
+    return;
+  }
+
   //Valid test
   CU_ASSERT(init_tcti_abrmd(&tcti_ctx) == 0);
   CU_ASSERT(tcti_ctx != NULL);
@@ -192,6 +245,48 @@ void test_init_tcti_abrmd(void)
   free(tcti_ctx);
 }
 
+//----------------------------------------------------------------------------
+// test_init_tcti
+//----------------------------------------------------------------------------
+void test_init_tcti(void)
+{
+  TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
+
+  //Valid test (the TCTI configured by the environment, if any, else abrmd)
+  CU_ASSERT(set_tcti_config(NULL) == 0);
+  CU_ASSERT(init_tcti(&tcti_ctx) == 0);
+  CU_ASSERT(tcti_ctx != NULL);
+
+  //Must have null tcti_ctx to init
+  CU_ASSERT(init_tcti(&tcti_ctx) != 0);
+  Tss2_Tcti_Finalize(tcti_ctx);
+  free(tcti_ctx);
+  tcti_ctx = NULL;
+
+  //A TCTI that cannot be loaded is an error
+  CU_ASSERT(set_tcti_config("kmyth-no-such-tcti") == 0);
+  CU_ASSERT(init_tcti(&tcti_ctx) != 0);
+  CU_ASSERT(tcti_ctx == NULL);
+
+  CU_ASSERT(set_tcti_config(NULL) == 0);
+}
+
+//----------------------------------------------------------------------------
+// test_init_tcti_device
+//----------------------------------------------------------------------------
+void test_init_tcti_device(void)
+{
+  TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
+
+  //A device that does not exist is an error
+  CU_ASSERT(init_tcti_device(&tcti_ctx, "/dev/kmyth-no-such-tpm") != 0);
+  CU_ASSERT(tcti_ctx == NULL);
+
+  //Must have null tcti_ctx to init
+  tcti_ctx = (TSS2_TCTI_CONTEXT *) &tcti_ctx;
+  CU_ASSERT(init_tcti_device(&tcti_ctx, KMYTH_BOOT_TPM_DEVICE) != 0);
+}
+
 //----------------------------------------------------------------------------
 // test_init_sapi
 //----------------------------------------------------------------------------
@@ -270,6 +365,33 @@ void test_get_tpm2_properties(void)
              TPM2_PT_GROUP, &cap_data) == 0);
   CU_ASSERT(cap_data.capability == TPM2_CAP_TPM_PROPERTIES);  //TPM_PROPERTIES constant
 
+  //Fixed properties come from the cache once read, and match the TPM's
+  TPMS_CAPABILITY_DATA cached_data;
+  TPMS_CAPABILITY_DATA fresh_data;
+
+  CU_ASSERT(get_tpm2_properties
+            (sapi_ctx, TPM2_CAP_TPM_PROPERTIES, TPM2_PT_PCR_COUNT, 1,
+             &cached_data) == 0);
+  CU_ASSERT(cached_data.data.tpmProperties.count == 1);
+  CU_ASSERT(cached_data.data.tpmProperties.tpmProperty[0].property ==
+            TPM2_PT_PCR_COUNT);
+  invalidate_tpm2_capability_cache(sapi_ctx);
+  CU_ASSERT(get_tpm2_properties
+            (sapi_ctx, TPM2_CAP_TPM_PROPERTIES, TPM2_PT_PCR_COUNT, 1,
+             &fresh_data) == 0);
+  CU_ASSERT(fresh_data.data.tpmProperties.tpmProperty[0].value ==
+            cached_data.data.tpmProperties.tpmProperty[0].value);
+
+  //The persistent handle list is the same when read from the TPM again
+  CU_ASSERT(get_tpm2_properties
+            (sapi_ctx, TPM2_CAP_HANDLES, TPM2_HR_PERSISTENT,
+             TPM2_MAX_CAP_HANDLES, &cached_data) == 0);
+  invalidate_tpm2_persistent_handle_cache(sapi_ctx);
+  CU_ASSERT(get_tpm2_properties
+            (sapi_ctx, TPM2_CAP_HANDLES, TPM2_HR_PERSISTENT,
+             TPM2_MAX_CAP_HANDLES, &fresh_data) == 0);
+  CU_ASSERT(fresh_data.data.handles.count == cached_data.data.handles.count);
+
   //Test null input
   CU_ASSERT(get_tpm2_properties
             (NULL, TPM2_CAP_TPM_PROPERTIES, TPM2_PT_MANUFACTURER, TPM2_PT_GROUP,
@@ -278,6 +400,90 @@ void test_get_tpm2_properties(void)
   free_tpm2_resources(&sapi_ctx);
 }
 
+//----------------------------------------------------------------------------
+// read_pcrs_worker
+//----------------------------------------------------------------------------
+static void *read_pcrs_worker(void *arg)
+{
+  TPML_DIGEST *values = (TPML_DIGEST *) arg;
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+  TPML_PCR_SELECTION selection;
+  TPML_PCR_SELECTION selectionOut;
+  UINT32 updateCounter = 0;
+  int pcrs[2] = { 0, 1 };
+
+  values->count = 0;
+  if (init_tpm2_connection(&sapi_ctx) == 0
+      && init_pcr_selection(sapi_ctx, pcrs, 2, &selection) == 0
+      && read_tpm2_pcrs(sapi_ctx, &selection, &updateCounter,
+                        &selectionOut, values) != TPM2_RC_SUCCESS)
+  {
+    values->count = 0;
+  }
+  free_tpm2_resources(&sapi_ctx);
+  return NULL;
+}
+
+//----------------------------------------------------------------------------
+// test_read_tpm2_pcrs
+//----------------------------------------------------------------------------
+void test_read_tpm2_pcrs(void)
+{
+  // Reads of the same PCRs on several connections at once (some of which
+  // are merged) all return the same values
+  TPML_DIGEST values[8];
+  pthread_t readers[8];
+
+  for (int i = 0; i < 8; i++)
+  {
+    CU_ASSERT(pthread_create(&readers[i], NULL, read_pcrs_worker,
+                             &values[i]) == 0);
+  }
+  for (int i = 0; i < 8; i++)
+  {
+    pthread_join(readers[i], NULL);
+  }
+  for (int i = 0; i < 8; i++)
+  {
+    CU_ASSERT(values[i].count == 2);
+    CU_ASSERT(values[i].digests[0].size == values[0].digests[0].size);
+    CU_ASSERT(memcmp(values[i].digests[0].buffer, values[0].digests[0].buffer,
+                     values[0].digests[0].size) == 0);
+    CU_ASSERT(memcmp(values[i].digests[1].buffer, values[0].digests[1].buffer,
+                     values[0].digests[1].size) == 0);
+  }
+}
+
+//----------------------------------------------------------------------------
+// test_read_tpm2_public
+//----------------------------------------------------------------------------
+void test_read_tpm2_public(void)
+{
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+  TPM2_HANDLE srk_handle = 0;
+  TPM2B_AUTH owner_auth = {.size = 0 };
+  TPM2B_PUBLIC srk_public = {.size = 0 };
+  TPM2B_NAME srk_name = {.size = 0 };
+
+  init_tpm2_connection(&sapi_ctx);
+
+  // A persistent object's public area and name can be read, and any of
+  // the outputs may be left out
+  CU_ASSERT(get_srk_handle(sapi_ctx, &srk_handle, &owner_auth) == 0);
+  CU_ASSERT(read_tpm2_public(sapi_ctx, srk_handle, &srk_public, &srk_name,
+                             NULL) == TPM2_RC_SUCCESS);
+  CU_ASSERT(srk_public.size > 0);
+  CU_ASSERT(srk_name.size > 0);
+  CU_ASSERT(read_tpm2_public(sapi_ctx, srk_handle, NULL, NULL,
+                             NULL) == TPM2_RC_SUCCESS);
+
+  // An empty persistent handle fails
+  CU_ASSERT(read_tpm2_public(sapi_ctx, TPM2_PERSISTENT_LAST, &srk_public,
+                             NULL, NULL) != TPM2_RC_SUCCESS);
+
+  free_tpm2_resources(&sapi_ctx);
+}
+
 //----------------------------------------------------------------------------
 // test_get_tpm2_impl_type
 //----------------------------------------------------------------------------
@@ -357,13 +563,15 @@ void test_init_policy_cmd_auth(void)
   init_password_cmd_auth(auth, &cmd_out, &res_out);
 
   //Valid test
-  CU_ASSERT(init_policy_cmd_auth(&session,
+  CU_ASSERT(init_policy_cmd_auth(sapi_ctx, &session,
                                  cc,
                                  auth_name,
                                  auth,
                                  cmdParams,
                                  cmdParams_size,
                                  pcrs_struct, &cmd_out, &res_out) == 0);
+  CU_ASSERT((cmd_out.auths[0].sessionAttributes &
+             (TPMA_SESSION_DECRYPT | TPMA_SESSION_ENCRYPT)) == 0);
 
   free_tpm2_resources(&sapi_ctx);
 }
@@ -374,7 +582,7 @@ void test_init_policy_cmd_auth(void)
 void test_check_response_auth(void)
 {
   //Initialize session to a valid state
-  SESSION session;
+  SESSION session = { 0 };
   TSS2_SYS_CONTEXT *sapi_ctx = NULL;
   TSS2L_SYS_AUTH_RESPONSE res_out;
   TPM2_CC cc = 0;
@@ -554,6 +762,24 @@ void test_compute_authHMAC(void)
   //NULL output
   CU_ASSERT(compute_authHMAC(session, hash, auth, session_attr, NULL) != 0);
   free_tpm2_resources(&sapi_ctx);
+
+  //Results do not depend on the HMAC key setup reused from a previous call
+  SESSION salted = { 0 };
+  TPM2B_AUTH first = {.size = 0, };
+  TPM2B_AUTH again = {.size = 0, };
+
+  salted.sessionKey.size = KMYTH_DIGEST_SIZE;
+  memset(salted.sessionKey.buffer, 0x77, salted.sessionKey.size);
+  CU_ASSERT(compute_authHMAC(salted, hash, auth, session_attr, &first) == 0);
+  CU_ASSERT(compute_authHMAC(salted, hash, auth, session_attr, &again) == 0);
+  CU_ASSERT(first.size == again.size);
+  CU_ASSERT(memcmp(first.buffer, again.buffer, first.size) == 0);
+  salted.sessionKey.buffer[0] ^= 1;
+  CU_ASSERT(compute_authHMAC(salted, hash, auth, session_attr, &again) == 0);
+  CU_ASSERT(memcmp(first.buffer, again.buffer, first.size) != 0);
+  salted.sessionKey.buffer[0] ^= 1;
+  CU_ASSERT(compute_authHMAC(salted, hash, auth, session_attr, &again) == 0);
+  CU_ASSERT(memcmp(first.buffer, again.buffer, first.size) == 0);
 }
 
 //----------------------------------------------------------------------------
@@ -607,6 +833,85 @@ void test_create_policy_digest(void)
   free_tpm2_resources(&sapi_ctx);
 }
 
+//----------------------------------------------------------------------------
+// test_compute_policy_digest
+//----------------------------------------------------------------------------
+void test_compute_policy_digest(void)
+{
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+
+  init_tpm2_connection(&sapi_ctx);
+  TPML_PCR_SELECTION pcrs_struct = {.count = 0, };
+  TPM2B_DIGEST computed = {.size = 0, };
+  TPM2B_DIGEST trial = {.size = 0, };
+
+  //Valid test with no PCRs selected - matches the trial session digest,
+  //and does not need the TPM
+  CU_ASSERT(compute_policy_digest
+            (sapi_ctx, pcrs_struct, NULL, &computed) == 0);
+  CU_ASSERT(create_policy_digest(sapi_ctx, pcrs_struct, &trial) == 0);
+  CU_ASSERT(computed.size == trial.size);
+  CU_ASSERT(memcmp(computed.buffer, trial.buffer, trial.size) == 0);
+  computed.size = 0;
+  CU_ASSERT(compute_policy_digest
+            (NULL, pcrs_struct, NULL, &computed) == 0);
+  CU_ASSERT(memcmp(computed.buffer, trial.buffer, trial.size) == 0);
+
+  //Valid test with one PCR selected
+  int pcrs[12] = { 5, 3, 0, 1, 2, 4, 6, 7, 8, 9, 10, 11 };
+  init_pcr_selection(sapi_ctx, pcrs, 1, &pcrs_struct);
+  computed.size = 0;
+  trial.size = 0;
+  CU_ASSERT(compute_policy_digest
+            (sapi_ctx, pcrs_struct, NULL, &computed) == 0);
+  CU_ASSERT(create_policy_digest(sapi_ctx, pcrs_struct, &trial) == 0);
+  CU_ASSERT(computed.size == trial.size);
+  CU_ASSERT(memcmp(computed.buffer, trial.buffer, trial.size) == 0);
+
+  //Valid test with multiple PCRs selected
+  init_pcr_selection(sapi_ctx, pcrs, 2, &pcrs_struct);
+  computed.size = 0;
+  trial.size = 0;
+  CU_ASSERT(compute_policy_digest
+            (sapi_ctx, pcrs_struct, NULL, &computed) == 0);
+  CU_ASSERT(create_policy_digest(sapi_ctx, pcrs_struct, &trial) == 0);
+  CU_ASSERT(computed.size == trial.size);
+  CU_ASSERT(memcmp(computed.buffer, trial.buffer, trial.size) == 0);
+
+  //Valid test with more PCRs selected than one TPM2_PCR_Read() returns
+  init_pcr_selection(sapi_ctx, pcrs, 12, &pcrs_struct);
+  computed.size = 0;
+  trial.size = 0;
+  CU_ASSERT(compute_policy_digest
+            (sapi_ctx, pcrs_struct, NULL, &computed) == 0);
+  CU_ASSERT(create_policy_digest(sapi_ctx, pcrs_struct, &trial) == 0);
+  CU_ASSERT(computed.size == trial.size);
+  CU_ASSERT(memcmp(computed.buffer, trial.buffer, trial.size) == 0);
+
+  //Same digest from a PCR snapshot, read once and then reused
+  kmyth_pcr_snapshot snapshot = {.valid = false, };
+
+  computed.size = 0;
+  CU_ASSERT(compute_policy_digest
+            (sapi_ctx, pcrs_struct, &snapshot, &computed) == 0);
+  CU_ASSERT(snapshot.valid);
+  CU_ASSERT(memcmp(computed.buffer, trial.buffer, trial.size) == 0);
+  computed.size = 0;
+  CU_ASSERT(compute_policy_digest
+            (sapi_ctx, pcrs_struct, &snapshot, &computed) == 0);
+  CU_ASSERT(memcmp(computed.buffer, trial.buffer, trial.size) == 0);
+
+  //Failure with PCRs selected but a null sapi_ctx
+  CU_ASSERT(compute_policy_digest
+            (NULL, pcrs_struct, NULL, &computed) != 0);
+
+  //Failure with null output
+  CU_ASSERT(compute_policy_digest
+            (sapi_ctx, pcrs_struct, NULL, NULL) != 0);
+
+  free_tpm2_resources(&sapi_ctx);
+}
+
 //----------------------------------------------------------------------------
 // test_create_policy_auth_session
 //----------------------------------------------------------------------------
@@ -663,6 +968,104 @@ void test_start_policy_auth_session(void)
   free_tpm2_resources(&sapi_ctx);
 }
 
+//----------------------------------------------------------------------------
+// test_compute_kdfa
+//----------------------------------------------------------------------------
+void test_compute_kdfa(void)
+{
+  uint8_t key[32];
+  TPM2B_NONCE u = {.size = KMYTH_DIGEST_SIZE, };
+  TPM2B_NONCE v = {.size = KMYTH_DIGEST_SIZE, };
+  uint8_t out[48];
+  uint8_t other[48];
+
+  for (int i = 0; i < 32; i++)
+  {
+    key[i] = (uint8_t) i;
+  }
+  memset(u.buffer, 0x11, u.size);
+  memset(v.buffer, 0x22, v.size);
+
+  //Known answer (SP800-108 counter mode, HMAC-SHA256)
+  uint8_t expected[32] = {
+    0xA8, 0x67, 0x94, 0x44, 0xF3, 0x20, 0xA6, 0xD0,
+    0xA0, 0x2C, 0x03, 0xCA, 0xC1, 0x53, 0xC4, 0x58,
+    0xF2, 0x87, 0x58, 0xEC, 0xA0, 0x56, 0x59, 0x4E,
+    0x88, 0x7F, 0xCE, 0xFD, 0xC2, 0xD7, 0xE9, 0x5B
+  };
+
+  CU_ASSERT(compute_kdfa(key, sizeof(key), "ATH", u, v, 256, out) == 0);
+  CU_ASSERT(memcmp(out, expected, sizeof(expected)) == 0);
+
+  //The label, the context order and the length are all KDF inputs
+  CU_ASSERT(compute_kdfa(key, sizeof(key), "CFB", u, v, 256, other) == 0);
+  CU_ASSERT(memcmp(out, other, 32) != 0);
+  CU_ASSERT(compute_kdfa(key, sizeof(key), "ATH", v, u, 256, other) == 0);
+  CU_ASSERT(memcmp(out, other, 32) != 0);
+  CU_ASSERT(compute_kdfa(key, sizeof(key), "ATH", u, v, 384, other) == 0);
+  CU_ASSERT(memcmp(out, other, 32) != 0);
+
+  //Invalid inputs
+  CU_ASSERT(compute_kdfa(NULL, sizeof(key), "ATH", u, v, 256, out) != 0);
+  CU_ASSERT(compute_kdfa(key, sizeof(key), NULL, u, v, 256, out) != 0);
+  CU_ASSERT(compute_kdfa(key, sizeof(key), "ATH", u, v, 0, out) != 0);
+  CU_ASSERT(compute_kdfa(key, sizeof(key), "ATH", u, v, 256, NULL) != 0);
+}
+
+//----------------------------------------------------------------------------
+// test_crypt_session_param
+//----------------------------------------------------------------------------
+void test_crypt_session_param(void)
+{
+  SESSION session = { 0 };
+  TPM2B_AUTH auth = {.size = KMYTH_DIGEST_SIZE, };
+  uint8_t data[40];
+  uint8_t plain[40];
+
+  session.symmetric.algorithm = TPM2_ALG_AES;
+  session.symmetric.keyBits.aes = 256;
+  session.symmetric.mode.aes = TPM2_ALG_CFB;
+  session.sessionKey.size = KMYTH_DIGEST_SIZE;
+  memset(session.sessionKey.buffer, 0x33, session.sessionKey.size);
+  session.nonceNewer.size = KMYTH_DIGEST_SIZE;
+  memset(session.nonceNewer.buffer, 0x44, session.nonceNewer.size);
+  session.nonceOlder.size = KMYTH_DIGEST_SIZE;
+  memset(session.nonceOlder.buffer, 0x55, session.nonceOlder.size);
+  memset(auth.buffer, 0x66, auth.size);
+  for (int i = 0; i < 40; i++)
+  {
+    plain[i] = (uint8_t) i;
+  }
+  memcpy(data, plain, sizeof(data));
+
+  //Valid round trip (with the same nonces, as a sender and receiver use)
+  CU_ASSERT(crypt_session_param(&session, auth, true, data, sizeof(data))
+            == 0);
+  CU_ASSERT(memcmp(data, plain, sizeof(data)) != 0);
+  CU_ASSERT(crypt_session_param(&session, auth, false, data, sizeof(data))
+            == 0);
+  CU_ASSERT(memcmp(data, plain, sizeof(data)) == 0);
+
+  //A different authValue gives a different key
+  CU_ASSERT(crypt_session_param(&session, auth, true, data, sizeof(data))
+            == 0);
+  auth.buffer[0] ^= 1;
+  CU_ASSERT(crypt_session_param(&session, auth, false, data, sizeof(data))
+            == 0);
+  CU_ASSERT(memcmp(data, plain, sizeof(data)) != 0);
+
+  //Session without parameter encryption
+  session.symmetric.algorithm = TPM2_ALG_NULL;
+  CU_ASSERT(crypt_session_param(&session, auth, true, data, sizeof(data))
+            != 0);
+
+  //NULL inputs
+  CU_ASSERT(crypt_session_param(NULL, auth, true, data, sizeof(data)) != 0);
+  session.symmetric.algorithm = TPM2_ALG_AES;
+  CU_ASSERT(crypt_session_param(&session, auth, true, NULL, sizeof(data))
+            != 0);
+}
+
 //----------------------------------------------------------------------------
 // test_apply_policy
 //----------------------------------------------------------------------------
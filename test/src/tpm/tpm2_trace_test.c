@@ -0,0 +1,386 @@
+//############################################################################
+// tpm2_trace_test.c
+//
+// Tests for TPM 2.0 command tracing functions in tpm2/src/tpm/tpm2_trace.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <CUnit/CUnit.h>
+
+#include "tpm2_trace.h"
+#include "tpm2_trace_test.h"
+#include "kmyth_metrics.h"
+#include "defines.h"
+
+//----------------------------------------------------------------------------
+// tpm2_trace_add_tests()
+//----------------------------------------------------------------------------
+int tpm2_trace_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "tpm2_command_name() Tests",
+                          test_tpm2_command_name))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "init_tcti_trace() Tests",
+                          test_init_tcti_trace))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "tpm2_trace_open() Tests",
+                          test_tpm2_trace_file))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// A fake TCTI, standing in for the TPM, that records the last command sent
+// and answers with a canned response (or fails to deliver it)
+//----------------------------------------------------------------------------
+typedef struct fake_tcti_context
+{
+  TSS2_TCTI_CONTEXT_COMMON_V2 common;
+  uint8_t command[64];
+  size_t command_size;
+  uint8_t response[10];
+  TSS2_RC receive_rc;
+  int cancels;
+  uint8_t locality;
+} fake_tcti_context;
+
+// counts fake TCTI contexts finalized, as finalizing the wrapper frees them
+static int fake_tcti_finalized = 0;
+
+static TSS2_RC fake_tcti_transmit(TSS2_TCTI_CONTEXT * tcti_ctx, size_t size,
+                                  uint8_t const *command)
+{
+  fake_tcti_context *fake = (fake_tcti_context *) tcti_ctx;
+
+  if (size > sizeof(fake->command))
+  {
+    return TSS2_TCTI_RC_IO_ERROR;
+  }
+  memcpy(fake->command, command, size);
+  fake->command_size = size;
+  return TSS2_RC_SUCCESS;
+}
+
+static TSS2_RC fake_tcti_receive(TSS2_TCTI_CONTEXT * tcti_ctx, size_t *size,
+                                 uint8_t * response, int32_t timeout)
+{
+  fake_tcti_context *fake = (fake_tcti_context *) tcti_ctx;
+
+  (void) timeout;
+  *size = sizeof(fake->response);
+  if (response == NULL)
+  {
+    return TSS2_RC_SUCCESS;
+  }
+  if (fake->receive_rc != TSS2_RC_SUCCESS)
+  {
+    return fake->receive_rc;
+  }
+  memcpy(response, fake->response, sizeof(fake->response));
+  return TSS2_RC_SUCCESS;
+}
+
+static void fake_tcti_finalize(TSS2_TCTI_CONTEXT * tcti_ctx)
+{
+  (void) tcti_ctx;
+  fake_tcti_finalized++;
+}
+
+static TSS2_RC fake_tcti_cancel(TSS2_TCTI_CONTEXT * tcti_ctx)
+{
+  ((fake_tcti_context *) tcti_ctx)->cancels++;
+  return TSS2_RC_SUCCESS;
+}
+
+static TSS2_RC fake_tcti_set_locality(TSS2_TCTI_CONTEXT * tcti_ctx,
+                                      uint8_t locality)
+{
+  ((fake_tcti_context *) tcti_ctx)->locality = locality;
+  return TSS2_RC_SUCCESS;
+}
+
+//----------------------------------------------------------------------------
+// fake_tcti_create(): allocates a fake TCTI, answering with the given
+//                     response code
+//----------------------------------------------------------------------------
+static fake_tcti_context *fake_tcti_create(uint32_t response_code)
+{
+  fake_tcti_context *fake = calloc(1, sizeof(fake_tcti_context));
+
+  if (fake == NULL)
+  {
+    return NULL;
+  }
+  fake->common.v1.version = 2;
+  fake->common.v1.transmit = fake_tcti_transmit;
+  fake->common.v1.receive = fake_tcti_receive;
+  fake->common.v1.finalize = fake_tcti_finalize;
+  fake->common.v1.cancel = fake_tcti_cancel;
+  fake->common.v1.setLocality = fake_tcti_set_locality;
+
+  // response header: tag, size, response code (big-endian)
+  uint8_t header[10] = { 0x80, 0x01, 0x00, 0x00, 0x00, 0x0A,
+    (uint8_t) (response_code >> 24), (uint8_t) (response_code >> 16),
+    (uint8_t) (response_code >> 8), (uint8_t) response_code
+  };
+
+  memcpy(fake->response, header, sizeof(header));
+  return fake;
+}
+
+//----------------------------------------------------------------------------
+// build_command(): builds a command with the given tag and code, one handle,
+//                  and (for TPM2_ST_SESSIONS) the given number of password
+//                  sessions, each with a two byte HMAC - returns its size
+//----------------------------------------------------------------------------
+static size_t build_command(uint8_t * command, uint16_t tag, uint32_t code,
+                            int sessions)
+{
+  size_t size = 0;
+
+  command[size++] = (uint8_t) (tag >> 8);
+  command[size++] = (uint8_t) tag;
+  size += 4;
+  for (int i = 3; i >= 0; i--)
+  {
+    command[size++] = (uint8_t) (code >> (8 * i));
+  }
+
+  // handle area
+  memcpy(command + size, "\x80\x00\x00\x01", 4);
+  size += 4;
+
+  if (tag == TPM2_ST_SESSIONS)
+  {
+    // authorization area: size, then handle || nonce || attributes || hmac
+    uint32_t auth_size = (uint32_t) sessions * 11;
+
+    command[size++] = 0;
+    command[size++] = 0;
+    command[size++] = (uint8_t) (auth_size >> 8);
+    command[size++] = (uint8_t) auth_size;
+    for (int i = 0; i < sessions; i++)
+    {
+      memcpy(command + size, "\x40\x00\x00\x09\x00\x00\x01\x00\x02\xAB\xCD",
+             11);
+      size += 11;
+    }
+  }
+
+  command[2] = (uint8_t) (size >> 24);
+  command[3] = (uint8_t) (size >> 16);
+  command[4] = (uint8_t) (size >> 8);
+  command[5] = (uint8_t) size;
+  return size;
+}
+
+//----------------------------------------------------------------------------
+// receive_response(): receives the response to the command in flight, as
+//                     the SAPI does (asking for its size first)
+//----------------------------------------------------------------------------
+static TSS2_RC receive_response(TSS2_TCTI_CONTEXT * tcti_ctx)
+{
+  uint8_t response[16] = { 0 };
+  size_t response_size = 0;
+  TSS2_RC rc = Tss2_Tcti_Receive(tcti_ctx, &response_size, NULL, 0);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    return rc;
+  }
+  return Tss2_Tcti_Receive(tcti_ctx, &response_size, response, 0);
+}
+
+//----------------------------------------------------------------------------
+// send_command(): sends a command over a TCTI context and receives the
+//                 response
+//----------------------------------------------------------------------------
+static TSS2_RC send_command(TSS2_TCTI_CONTEXT * tcti_ctx,
+                            uint8_t const *command, size_t command_size)
+{
+  TSS2_RC rc = Tss2_Tcti_Transmit(tcti_ctx, command_size, command);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    return rc;
+  }
+  return receive_response(tcti_ctx);
+}
+
+//----------------------------------------------------------------------------
+// read_trace(): reads a whole trace file into a (null terminated) string
+//----------------------------------------------------------------------------
+static char *read_trace(const char *path)
+{
+  FILE *file = fopen(path, "r");
+  char *trace = NULL;
+  long len = 0;
+
+  if (file == NULL)
+  {
+    return NULL;
+  }
+  if (fseek(file, 0, SEEK_END) == 0 && (len = ftell(file)) >= 0
+      && fseek(file, 0, SEEK_SET) == 0)
+  {
+    trace = calloc((size_t) len + 1, 1);
+    if (trace != NULL && fread(trace, 1, (size_t) len, file) != (size_t) len)
+    {
+      free(trace);
+      trace = NULL;
+    }
+  }
+  fclose(file);
+  return trace;
+}
+
+//----------------------------------------------------------------------------
+// test_tpm2_command_name()
+//----------------------------------------------------------------------------
+void test_tpm2_command_name(void)
+{
+  CU_ASSERT(strcmp(tpm2_command_name(TPM2_CC_Unseal), "TPM2_Unseal") == 0);
+  CU_ASSERT(strcmp(tpm2_command_name(TPM2_CC_PolicyPCR),
+                   "TPM2_PolicyPCR") == 0);
+  CU_ASSERT(strcmp(tpm2_command_name(TPM2_CC_NV_ReadPublic),
+                   "TPM2_NV_ReadPublic") == 0);
+  CU_ASSERT(tpm2_command_name(0) == NULL);
+  CU_ASSERT(tpm2_command_name(0x00000999) == NULL);
+}
+
+//----------------------------------------------------------------------------
+// test_init_tcti_trace()
+//----------------------------------------------------------------------------
+void test_init_tcti_trace(void)
+{
+  fake_tcti_context *fake = fake_tcti_create(TSS2_RC_SUCCESS);
+  TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
+  uint8_t command[64] = { 0 };
+  size_t command_size = 0;
+
+  CU_ASSERT_FATAL(fake != NULL);
+
+  // Check that invalid contexts are rejected, leaving the wrapped context
+  // to the caller
+  CU_ASSERT(init_tcti_trace(NULL, &tcti_ctx) == 1);
+  CU_ASSERT(tcti_ctx == NULL);
+  tcti_ctx = (TSS2_TCTI_CONTEXT *) fake;
+  CU_ASSERT(init_tcti_trace((TSS2_TCTI_CONTEXT *) fake, &tcti_ctx) == 1);
+  tcti_ctx = NULL;
+
+  // Check that every call is forwarded to the wrapped context unchanged
+  CU_ASSERT_FATAL(init_tcti_trace((TSS2_TCTI_CONTEXT *) fake, &tcti_ctx)
+                  == 0);
+  CU_ASSERT_FATAL(tcti_ctx != NULL);
+  CU_ASSERT(tcti_ctx != (TSS2_TCTI_CONTEXT *) fake);
+  command_size = build_command(command, TPM2_ST_SESSIONS, TPM2_CC_Unseal, 1);
+  CU_ASSERT(send_command(tcti_ctx, command, command_size) == TSS2_RC_SUCCESS);
+  CU_ASSERT(fake->command_size == command_size);
+  CU_ASSERT(memcmp(fake->command, command, command_size) == 0);
+  CU_ASSERT(Tss2_Tcti_Cancel(tcti_ctx) == TSS2_RC_SUCCESS);
+  CU_ASSERT(fake->cancels == 1);
+  CU_ASSERT(Tss2_Tcti_SetLocality(tcti_ctx, 3) == TSS2_RC_SUCCESS);
+  CU_ASSERT(fake->locality == 3);
+  fake->receive_rc = TSS2_TCTI_RC_IO_ERROR;
+  CU_ASSERT(send_command(tcti_ctx, command, command_size)
+            == TSS2_TCTI_RC_IO_ERROR);
+
+  // Check that finalizing the wrapper finalizes (and frees) the wrapped
+  // context
+  fake_tcti_finalized = 0;
+  Tss2_Tcti_Finalize(tcti_ctx);
+  CU_ASSERT(fake_tcti_finalized == 1);
+  Tss2_Tcti_Finalize(tcti_ctx);
+  CU_ASSERT(fake_tcti_finalized == 1);
+  free(tcti_ctx);
+}
+
+//----------------------------------------------------------------------------
+// test_tpm2_trace_file()
+//----------------------------------------------------------------------------
+void test_tpm2_trace_file(void)
+{
+  char dir[] = "/tmp/kmyth-trace-test-XXXXXX";
+  char path[64] = { 0 };
+  fake_tcti_context *fake = fake_tcti_create(0x0000098E);
+  TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
+  uint8_t command[64] = { 0 };
+  size_t command_size = 0;
+  char *trace = NULL;
+
+  CU_ASSERT_FATAL(fake != NULL);
+  CU_ASSERT_FATAL(mkdtemp(dir) != NULL);
+  snprintf(path, sizeof(path), "%s/trace.json", dir);
+  CU_ASSERT_FATAL(init_tcti_trace((TSS2_TCTI_CONTEXT *) fake, &tcti_ctx)
+                  == 0);
+
+  // Check that a trace file that cannot be created is reported
+  CU_ASSERT(tpm2_trace_open("/nonexistent/dir/trace.json") == 1);
+
+  // Check that a command sent while nothing traces it is not traced, even
+  // if the trace file is opened before its response arrives
+  if (!kmyth_metrics_enabled() && !kmyth_log_enabled(LOG_DEBUG))
+  {
+    command_size = build_command(command, TPM2_ST_SESSIONS, TPM2_CC_Unseal,
+                                 1);
+    CU_ASSERT(Tss2_Tcti_Transmit(tcti_ctx, command_size, command)
+              == TSS2_RC_SUCCESS);
+    CU_ASSERT(tpm2_trace_open(path) == 0);
+    CU_ASSERT(receive_response(tcti_ctx) == TSS2_RC_SUCCESS);
+    tpm2_trace_close();
+    trace = read_trace(path);
+    CU_ASSERT(trace != NULL && strcmp(trace, "[\n]\n") == 0);
+    free(trace);
+  }
+
+  // Check that each command is written as a complete event, with its name
+  // (or code, if unknown), response code, and number of sessions (or -1 if
+  // its authorization area cannot be parsed)
+  CU_ASSERT_FATAL(tpm2_trace_open(path) == 0);
+  command_size = build_command(command, TPM2_ST_SESSIONS, TPM2_CC_Unseal, 2);
+  CU_ASSERT(send_command(tcti_ctx, command, command_size) == TSS2_RC_SUCCESS);
+  command_size = build_command(command, TPM2_ST_NO_SESSIONS, 0x00000999, 0);
+  CU_ASSERT(send_command(tcti_ctx, command, command_size) == TSS2_RC_SUCCESS);
+  command_size = build_command(command, TPM2_ST_SESSIONS, TPM2_CC_Load, 1);
+  command[17]++;                // authorization area size, one too many
+  CU_ASSERT(send_command(tcti_ctx, command, command_size) == TSS2_RC_SUCCESS);
+  fake->receive_rc = TSS2_TCTI_RC_IO_ERROR;
+  command_size = build_command(command, TPM2_ST_SESSIONS, TPM2_CC_Create, 1);
+  CU_ASSERT(send_command(tcti_ctx, command, command_size)
+            == TSS2_TCTI_RC_IO_ERROR);
+  tpm2_trace_close();
+
+  trace = read_trace(path);
+  CU_ASSERT_FATAL(trace != NULL);
+  CU_ASSERT(strncmp(trace, "[\n{\"name\":\"TPM2_Unseal\",\"cat\":\"tpm\","
+                    "\"ph\":\"X\",\"ts\":", 46) == 0);
+  CU_ASSERT(strstr(trace, "\"args\":{\"rc\":\"0x0000098E\",\"sessions\":2}},"
+                   "\n{\"name\":\"0x00000999\",") != NULL);
+  CU_ASSERT(strstr(trace, "\"args\":{\"rc\":\"0x0000098E\",\"sessions\":0}},"
+                   "\n{\"name\":\"TPM2_Load\",") != NULL);
+  CU_ASSERT(strstr(trace, "\"args\":{\"rc\":\"0x0000098E\",\"sessions\":-1}},"
+                   "\n{\"name\":\"TPM2_Create\",") != NULL);
+  CU_ASSERT(strstr(trace, "\"args\":{\"rc\":\"0x000A000A\",\"sessions\":1}}"
+                   "\n]\n") != NULL);
+  free(trace);
+
+  // Check that closing the trace file again does nothing
+  tpm2_trace_close();
+
+  Tss2_Tcti_Finalize(tcti_ctx);
+  free(tcti_ctx);
+  unlink(path);
+  rmdir(dir);
+}
@@ -0,0 +1,160 @@
+//############################################################################
+// base64_codec_test.c
+//
+// Tests for kmyth base64 codec functions in utils/src/base64_codec.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CUnit/CUnit.h>
+
+#include "base64_codec_test.h"
+#include "base64_codec.h"
+
+//----------------------------------------------------------------------------
+// base64_codec_add_tests()
+//----------------------------------------------------------------------------
+int base64_codec_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "base64_encode() Tests", test_base64_encode))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "base64_decode() Tests", test_base64_decode))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Base64 Codec Implementation Match Tests",
+                          test_base64_codecs_match))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_base64_encode()
+//----------------------------------------------------------------------------
+void test_base64_encode(void)
+{
+  uint8_t out[256] = { 0 };
+  size_t out_len = 0;
+
+  // RFC 4648 test vectors (each encoding is newline terminated)
+  out_len = base64_encode((uint8_t *) "f", 1, out);
+  CU_ASSERT(out_len == base64_encoded_size(1));
+  CU_ASSERT(out_len == 5 && memcmp(out, "Zg==\n", 5) == 0);
+  out_len = base64_encode((uint8_t *) "fo", 2, out);
+  CU_ASSERT(out_len == 5 && memcmp(out, "Zm8=\n", 5) == 0);
+  out_len = base64_encode((uint8_t *) "foobar", 6, out);
+  CU_ASSERT(out_len == base64_encoded_size(6));
+  CU_ASSERT(out_len == 9 && memcmp(out, "Zm9vYmFy\n", 9) == 0);
+
+  // no input produces no output
+  CU_ASSERT(base64_encoded_size(0) == 0);
+  CU_ASSERT(base64_encode((uint8_t *) "", 0, out) == 0);
+
+  // full lines are BASE64_LINE_LEN characters
+  uint8_t raw[100] = { 0 };
+
+  out_len = base64_encode(raw, 100, out);
+  CU_ASSERT(out_len == base64_encoded_size(100));
+  CU_ASSERT(out_len == 136 + 3);
+  CU_ASSERT(out[BASE64_LINE_LEN] == '\n');
+  CU_ASSERT(out[2 * BASE64_LINE_LEN + 1] == '\n');
+  CU_ASSERT(out[out_len - 1] == '\n');
+}
+
+//----------------------------------------------------------------------------
+// test_base64_decode()
+//----------------------------------------------------------------------------
+void test_base64_decode(void)
+{
+  uint8_t out[64] = { 0 };
+  size_t out_len = 0;
+
+  // valid input, with and without whitespace and padding
+  CU_ASSERT(base64_decode((uint8_t *) "Zm9vYmFy\n", 9, out, &out_len) == 0);
+  CU_ASSERT(out_len == 6 && memcmp(out, "foobar", 6) == 0);
+  CU_ASSERT(base64_decode((uint8_t *) " Zm9v\r\n\tYmE=\n", 13, out, &out_len)
+            == 0);
+  CU_ASSERT(out_len == 5 && memcmp(out, "fooba", 5) == 0);
+  CU_ASSERT(base64_decode((uint8_t *) "Zm8", 3, out, &out_len) == 0);
+  CU_ASSERT(out_len == 2 && memcmp(out, "fo", 2) == 0);
+
+  // invalid characters
+  CU_ASSERT(base64_decode((uint8_t *) "Zm9v*mFy", 8, out, &out_len) == 1);
+  CU_ASSERT(base64_decode((uint8_t *) "-----", 5, out, &out_len) == 1);
+
+  // misplaced, insufficient, or trailing padding
+  CU_ASSERT(base64_decode((uint8_t *) "Z===", 4, out, &out_len) == 1);
+  CU_ASSERT(base64_decode((uint8_t *) "Zg=", 3, out, &out_len) == 1);
+  CU_ASSERT(base64_decode((uint8_t *) "Zg==Zg==", 8, out, &out_len) == 1);
+
+  // dangling single character
+  CU_ASSERT(base64_decode((uint8_t *) "Zm9vY", 5, out, &out_len) == 1);
+}
+
+//----------------------------------------------------------------------------
+// test_base64_codecs_match()
+//----------------------------------------------------------------------------
+void test_base64_codecs_match(void)
+{
+  base64_codec_t codecs[] = { BASE64_CODEC_AVX2, BASE64_CODEC_NEON };
+  size_t max_len = 4096;
+  uint8_t *raw = malloc(max_len);
+  uint8_t *ref = malloc(base64_encoded_size(max_len));
+  uint8_t *enc = malloc(base64_encoded_size(max_len));
+  uint8_t *dec = malloc(max_len + 4);
+
+  CU_ASSERT_FATAL(raw != NULL && ref != NULL && enc != NULL && dec != NULL);
+  for (size_t i = 0; i < max_len; i++)
+  {
+    raw[i] = (uint8_t) ((i * 167) ^ (i >> 3));
+  }
+
+  for (size_t c = 0; c < sizeof(codecs) / sizeof(codecs[0]); c++)
+  {
+    // skip implementations this build or CPU does not support
+    if (base64_set_codec(codecs[c]))
+    {
+      continue;
+    }
+
+    // lengths around the line and vector block boundaries, plus one large
+    for (size_t len = 0; len <= max_len; len = (len < 200) ? len + 1 : len * 2)
+    {
+      CU_ASSERT(base64_set_codec(BASE64_CODEC_SCALAR) == 0);
+      size_t ref_len = base64_encode(raw, len, ref);
+
+      CU_ASSERT(base64_set_codec(codecs[c]) == 0);
+      size_t enc_len = base64_encode(raw, len, enc);
+
+      CU_ASSERT(enc_len == ref_len);
+      CU_ASSERT(memcmp(enc, ref, ref_len) == 0);
+
+      size_t dec_len = 0;
+
+      CU_ASSERT(base64_decode(ref, ref_len, dec, &dec_len) == 0);
+      CU_ASSERT(dec_len == len);
+      CU_ASSERT(memcmp(dec, raw, len) == 0);
+
+      // a bad character anywhere must still be rejected
+      if (ref_len > 1)
+      {
+        ref[ref_len / 2] = '*';
+        CU_ASSERT(base64_decode(ref, ref_len, dec, &dec_len) == 1);
+      }
+    }
+  }
+
+  CU_ASSERT(base64_set_codec(BASE64_CODEC_AUTO) == 0);
+  free(raw);
+  free(ref);
+  free(enc);
+  free(dec);
+}
@@ -0,0 +1,162 @@
+//############################################################################
+// batch_io_test.c
+//
+// Tests for batched file I/O functions in utils/src/batch_io.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <CUnit/CUnit.h>
+
+#include "batch_io_test.h"
+#include "batch_io.h"
+
+// more files than fit in one batch, so that batches are chained
+#define BATCH_IO_TEST_FILES (BATCH_IO_DEPTH + 7)
+
+//----------------------------------------------------------------------------
+// batch_io_add_tests()
+//----------------------------------------------------------------------------
+int batch_io_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "Batch I/O Round Trip Tests",
+                          test_batch_io_round_trip))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Batch I/O Engine Tests",
+                          test_batch_io_set_engine))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_batch_io_round_trip()
+//----------------------------------------------------------------------------
+void test_batch_io_round_trip(void)
+{
+  char dir[] = "/tmp/kmyth_batch_io_test_XXXXXX";
+
+  CU_ASSERT_FATAL(mkdtemp(dir) != NULL);
+
+  char *paths[BATCH_IO_TEST_FILES] = { 0 };
+  uint8_t *bytes[BATCH_IO_TEST_FILES] = { 0 };
+  size_t lengths[BATCH_IO_TEST_FILES] = { 0 };
+  uint8_t *data[BATCH_IO_TEST_FILES] = { 0 };
+  size_t data_lengths[BATCH_IO_TEST_FILES] = { 0 };
+  int results[BATCH_IO_TEST_FILES] = { 0 };
+
+  // file 0 is empty, the others hold i * 100 bytes
+  for (size_t i = 0; i < BATCH_IO_TEST_FILES; i++)
+  {
+    CU_ASSERT_FATAL(asprintf(&paths[i], "%s/file%zu", dir, i) > 0);
+    lengths[i] = i * 100;
+    bytes[i] = malloc(lengths[i] + 1);
+    CU_ASSERT_FATAL(bytes[i] != NULL);
+    for (size_t j = 0; j < lengths[i]; j++)
+    {
+      bytes[i][j] = (uint8_t) (i + j);
+    }
+  }
+
+  batch_io_engine_t engines[] = { BATCH_IO_ENGINE_SYNC,
+    BATCH_IO_ENGINE_IO_URING
+  };
+
+  for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++)
+  {
+    // io_uring may not be available here
+    if (batch_io_set_engine(engines[e]))
+    {
+      continue;
+    }
+
+    // a file whose directory does not exist fails alone
+    char *good_path = paths[3];
+
+    paths[3] = "/nonexistent/kmyth_batch_io_test";
+    CU_ASSERT(write_files_batch(paths, bytes, lengths, BATCH_IO_TEST_FILES,
+                                true, results) == 1);
+    CU_ASSERT(results[3] == 1);
+    CU_ASSERT(read_files_batch(paths, BATCH_IO_TEST_FILES, data,
+                               data_lengths, results) == 1);
+    CU_ASSERT(results[3] == 1);
+    CU_ASSERT(data[3] == NULL);
+    for (size_t i = 0; i < BATCH_IO_TEST_FILES; i++)
+    {
+      if (i == 3)
+      {
+        continue;
+      }
+      CU_ASSERT(results[i] == 0);
+      CU_ASSERT(data_lengths[i] == lengths[i]);
+      if (i == 0)
+      {
+        CU_ASSERT(data[i] == NULL);
+      }
+      else if (data[i] != NULL)
+      {
+        CU_ASSERT(memcmp(data[i], bytes[i], lengths[i]) == 0);
+      }
+      free(data[i]);
+      data[i] = NULL;
+    }
+    paths[3] = good_path;
+
+    // results are optional
+    CU_ASSERT(write_files_batch(paths, bytes, lengths, BATCH_IO_TEST_FILES,
+                                false, NULL) == 0);
+    CU_ASSERT(read_files_batch(paths, BATCH_IO_TEST_FILES, data,
+                               data_lengths, NULL) == 0);
+    CU_ASSERT(data_lengths[3] == lengths[3]);
+    for (size_t i = 0; i < BATCH_IO_TEST_FILES; i++)
+    {
+      free(data[i]);
+      data[i] = NULL;
+    }
+  }
+  CU_ASSERT(batch_io_set_engine(BATCH_IO_ENGINE_AUTO) == 0);
+
+  // an empty batch does nothing
+  CU_ASSERT(read_files_batch(NULL, 0, NULL, NULL, NULL) == 0);
+  CU_ASSERT(write_files_batch(NULL, NULL, NULL, 0, true, NULL) == 0);
+
+  for (size_t i = 0; i < BATCH_IO_TEST_FILES; i++)
+  {
+    unlink(paths[i]);
+    free(paths[i]);
+    free(bytes[i]);
+  }
+  rmdir(dir);
+}
+
+//----------------------------------------------------------------------------
+// test_batch_io_set_engine()
+//----------------------------------------------------------------------------
+void test_batch_io_set_engine(void)
+{
+  CU_ASSERT(batch_io_set_engine(BATCH_IO_ENGINE_SYNC) == 0);
+  CU_ASSERT(strcmp(batch_io_engine_name(), "sync") == 0);
+
+  // io_uring is only selected where it is available
+  if (batch_io_set_engine(BATCH_IO_ENGINE_IO_URING) == 0)
+  {
+    CU_ASSERT(strcmp(batch_io_engine_name(), "io_uring") == 0);
+    CU_ASSERT(batch_io_set_engine(BATCH_IO_ENGINE_AUTO) == 0);
+    CU_ASSERT(strcmp(batch_io_engine_name(), "io_uring") == 0);
+  }
+  else
+  {
+    CU_ASSERT(strcmp(batch_io_engine_name(), "sync") == 0);
+    CU_ASSERT(batch_io_set_engine(BATCH_IO_ENGINE_AUTO) == 0);
+    CU_ASSERT(strcmp(batch_io_engine_name(), "sync") == 0);
+  }
+
+  CU_ASSERT(batch_io_set_engine((batch_io_engine_t) 42) == 1);
+}
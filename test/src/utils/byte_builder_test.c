@@ -0,0 +1,126 @@
+//############################################################################
+// byte_builder_test.c
+//
+// Tests for kmyth byte builder functions in utils/src/byte_builder.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CUnit/CUnit.h>
+
+#include "byte_builder_test.h"
+#include "byte_builder.h"
+
+//----------------------------------------------------------------------------
+// byte_builder_add_tests()
+//----------------------------------------------------------------------------
+int byte_builder_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "Byte Builder Append Tests",
+                          test_byte_builder_append))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Byte Builder Finish/Free Tests",
+                          test_byte_builder_finish_free))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_byte_builder_append()
+//----------------------------------------------------------------------------
+void test_byte_builder_append(void)
+{
+  byte_builder builder = { 0 };
+  size_t field_len = 3;
+
+  // zero capacity or NULL builder is invalid
+  CU_ASSERT(byte_builder_init(&builder, 0) == 1);
+  CU_ASSERT(byte_builder_init(NULL, 8) == 1);
+
+  // build "ab" || size_t(3) || "cde" || "xy" in an exactly sized buffer
+  CU_ASSERT(byte_builder_init(&builder, 7 + sizeof(size_t)) == 0);
+  CU_ASSERT(builder.buffer != NULL);
+  CU_ASSERT(byte_builder_append(&builder, "ab", 2) == 0);
+  CU_ASSERT(byte_builder_append_sized(&builder, "cde", field_len) == 0);
+
+  uint8_t *space = byte_builder_reserve(&builder, 2);
+
+  CU_ASSERT(space != NULL);
+  memcpy(space, "xy", 2);
+  CU_ASSERT(builder.length == builder.capacity);
+  CU_ASSERT(memcmp(builder.buffer, "ab", 2) == 0);
+  CU_ASSERT(memcmp(builder.buffer + 2, &field_len, sizeof(size_t)) == 0);
+  CU_ASSERT(memcmp(builder.buffer + 2 + sizeof(size_t), "cdexy", 5) == 0);
+
+  // a full builder accepts empty writes, but nothing more
+  CU_ASSERT(byte_builder_append(&builder, "", 0) == 0);
+  CU_ASSERT(byte_builder_append(&builder, "z", 1) == 1);
+  CU_ASSERT(byte_builder_reserve(&builder, 1) == NULL);
+  CU_ASSERT(byte_builder_append_sized(&builder, "z", 0) == 1);
+  CU_ASSERT(builder.length == builder.capacity);
+
+  // NULL data is only allowed for empty writes
+  CU_ASSERT(byte_builder_append(&builder, NULL, 1) == 1);
+
+  byte_builder_free(&builder);
+}
+
+//----------------------------------------------------------------------------
+// test_byte_builder_finish_free()
+//----------------------------------------------------------------------------
+void test_byte_builder_finish_free(void)
+{
+  byte_builder builder = { 0 };
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+
+  // finishing hands off the buffer and empties the builder
+  CU_ASSERT(byte_builder_init(&builder, 4) == 0);
+  CU_ASSERT(byte_builder_append(&builder, "abcd", 4) == 0);
+  byte_builder_finish(&builder, &output, &output_len);
+  CU_ASSERT(output != NULL);
+  CU_ASSERT(output_len == 4);
+  CU_ASSERT(memcmp(output, "abcd", 4) == 0);
+  CU_ASSERT(builder.buffer == NULL);
+  CU_ASSERT(builder.capacity == 0);
+  CU_ASSERT(builder.length == 0);
+  free(output);
+
+  // an emptied builder rejects writes
+  CU_ASSERT(byte_builder_append(&builder, "a", 1) == 1);
+
+  // freeing empties the builder, and is safe to repeat
+  CU_ASSERT(byte_builder_init(&builder, 4) == 0);
+  byte_builder_free(&builder);
+  CU_ASSERT(builder.buffer == NULL);
+  CU_ASSERT(builder.capacity == 0);
+  byte_builder_free(&builder);
+  byte_builder_free(NULL);
+
+  // a caller-provided buffer is written in place, handed back as is, and
+  // cleared (not freed) when abandoned
+  uint8_t external[4] = { 0 };
+
+  CU_ASSERT(byte_builder_init_external(&builder, NULL, 4) == 1);
+  CU_ASSERT(byte_builder_init_external(&builder, external, 0) == 1);
+  CU_ASSERT(byte_builder_init_external(&builder, external, 4) == 0);
+  CU_ASSERT(byte_builder_append(&builder, "wxyz", 4) == 0);
+  CU_ASSERT(byte_builder_append(&builder, "a", 1) == 1);
+  byte_builder_finish(&builder, &output, &output_len);
+  CU_ASSERT(output == external);
+  CU_ASSERT(output_len == 4);
+  CU_ASSERT(memcmp(external, "wxyz", 4) == 0);
+
+  CU_ASSERT(byte_builder_init_external(&builder, external, 4) == 0);
+  CU_ASSERT(byte_builder_append(&builder, "ab", 2) == 0);
+  byte_builder_free(&builder);
+  CU_ASSERT(builder.buffer == NULL);
+  CU_ASSERT(memcmp(external, "\0\0\0\0", 4) == 0);
+}
@@ -0,0 +1,194 @@
+//############################################################################
+// compression_test.c
+//
+// Tests for compression functions in utils/src/compression.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CUnit/CUnit.h>
+
+#include "compression_test.h"
+#include "compression.h"
+
+//----------------------------------------------------------------------------
+// compression_add_tests()
+//----------------------------------------------------------------------------
+int compression_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "Compression Name Tests",
+                          test_kmyth_compression_names))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Buffer Compression Tests",
+                          test_kmyth_compress_data))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Stream Compression Tests",
+                          test_kmyth_compress_streams))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// make_test_data()
+//
+// Fills a buffer with compressible (JSON-like) text, long enough to span
+// several compression blocks
+//----------------------------------------------------------------------------
+static uint8_t *make_test_data(size_t * len)
+{
+  size_t capacity = 512 * 1024;
+  char *data = malloc(capacity);
+  size_t used = 0;
+
+  for (unsigned i = 0; data != NULL && used + 128 < capacity; i++)
+  {
+    used += (size_t) snprintf(data + used, capacity - used,
+                              "{\"id\": %u, \"name\": \"host-%u\", "
+                              "\"enabled\": %s},\n", i, i % 97,
+                              (i % 3) ? "true" : "false");
+  }
+  *len = used;
+  return (uint8_t *) data;
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_compression_names()
+//----------------------------------------------------------------------------
+void test_kmyth_compression_names(void)
+{
+  kmyth_compression compression = KMYTH_COMPRESSION_NONE;
+
+  CU_ASSERT(kmyth_compression_from_string("zstd", &compression) == 0);
+  CU_ASSERT(compression == KMYTH_COMPRESSION_ZSTD);
+  CU_ASSERT(kmyth_compression_from_string("NONE", &compression) == 0);
+  CU_ASSERT(compression == KMYTH_COMPRESSION_NONE);
+  CU_ASSERT(kmyth_compression_from_string("lzma", &compression) == 1);
+  CU_ASSERT(kmyth_compression_from_string(NULL, &compression) == 1);
+  CU_ASSERT(compression == KMYTH_COMPRESSION_NONE);
+
+  CU_ASSERT(strcmp(kmyth_compression_name(KMYTH_COMPRESSION_ZSTD),
+                   "zstd") == 0);
+  CU_ASSERT(kmyth_compression_name((kmyth_compression) 42) == NULL);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_compress_data()
+//----------------------------------------------------------------------------
+void test_kmyth_compress_data(void)
+{
+  size_t data_len = 0;
+  uint8_t *data = make_test_data(&data_len);
+  uint8_t *comp = NULL;
+  size_t comp_len = 0;
+  uint8_t *plain = NULL;
+  size_t plain_len = 0;
+
+  CU_ASSERT(data != NULL);
+
+  // the data round-trips, and shrinks
+  CU_ASSERT(kmyth_compress_data(KMYTH_COMPRESSION_ZSTD, data, data_len,
+                                &comp, &comp_len) == 0);
+  CU_ASSERT(comp_len > 0 && comp_len < data_len / 4);
+  CU_ASSERT(kmyth_decompress_data(KMYTH_COMPRESSION_ZSTD, comp, comp_len,
+                                  &plain, &plain_len) == 0);
+  CU_ASSERT(plain_len == data_len);
+  CU_ASSERT(memcmp(plain, data, data_len) == 0);
+  free(plain);
+  plain = NULL;
+
+  // truncated or corrupted compressed data is rejected
+  CU_ASSERT(kmyth_decompress_data(KMYTH_COMPRESSION_ZSTD, comp, comp_len - 1,
+                                  &plain, &plain_len) == 1);
+  CU_ASSERT(plain == NULL);
+  comp[0] ^= 0xFF;
+  CU_ASSERT(kmyth_decompress_data(KMYTH_COMPRESSION_ZSTD, comp, comp_len,
+                                  &plain, &plain_len) == 1);
+  CU_ASSERT(plain == NULL);
+  free(comp);
+  comp = NULL;
+
+  // "no compression" is not an algorithm
+  CU_ASSERT(kmyth_compress_data(KMYTH_COMPRESSION_NONE, data, data_len,
+                                &comp, &comp_len) == 1);
+  CU_ASSERT(comp == NULL);
+
+  free(data);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_compress_streams()
+//----------------------------------------------------------------------------
+void test_kmyth_compress_streams(void)
+{
+  size_t data_len = 0;
+  uint8_t *data = make_test_data(&data_len);
+  uint8_t *comp = malloc(data_len);
+  size_t comp_len = 0;
+
+  CU_ASSERT(data != NULL && comp != NULL);
+
+  // read the compressed form of the data in odd-sized pieces
+  FILE *source = fmemopen(data, data_len, "rb");
+  FILE *reader = kmyth_compress_reader(source, KMYTH_COMPRESSION_ZSTD);
+
+  CU_ASSERT(reader != NULL);
+  while (reader != NULL && !feof(reader) && !ferror(reader) &&
+         comp_len < data_len)
+  {
+    comp_len += fread(comp + comp_len, 1, 1000, reader);
+  }
+  CU_ASSERT(reader != NULL && feof(reader) && !ferror(reader));
+  CU_ASSERT(comp_len > 0 && comp_len < data_len / 4);
+  CU_ASSERT(fclose(reader) == 0);
+  fclose(source);
+
+  // a stream's compressed data also decompresses as a whole
+  uint8_t *plain = NULL;
+  size_t plain_len = 0;
+
+  CU_ASSERT(kmyth_decompress_data(KMYTH_COMPRESSION_ZSTD, comp, comp_len,
+                                  &plain, &plain_len) == 0);
+  CU_ASSERT(plain_len == data_len);
+  CU_ASSERT(memcmp(plain, data, data_len) == 0);
+  free(plain);
+
+  // write it back, in pieces, through a decompressing stream
+  char *out = NULL;
+  size_t out_len = 0;
+  FILE *dest = open_memstream(&out, &out_len);
+  FILE *writer = kmyth_decompress_writer(dest, KMYTH_COMPRESSION_ZSTD);
+
+  CU_ASSERT(writer != NULL);
+  for (size_t i = 0; writer != NULL && i < comp_len; i += 777)
+  {
+    size_t n = (comp_len - i < 777) ? comp_len - i : 777;
+
+    CU_ASSERT(fwrite(comp + i, 1, n, writer) == n);
+  }
+  CU_ASSERT(fclose(writer) == 0);
+  fclose(dest);
+  CU_ASSERT(out_len == data_len);
+  CU_ASSERT(memcmp(out, data, data_len) == 0);
+  free(out);
+
+  // a stream missing its end is an error once it is closed
+  dest = open_memstream(&out, &out_len);
+  writer = kmyth_decompress_writer(dest, KMYTH_COMPRESSION_ZSTD);
+  CU_ASSERT(fwrite(comp, 1, comp_len - 1, writer) == comp_len - 1);
+  CU_ASSERT(fclose(writer) != 0);
+  fclose(dest);
+  free(out);
+
+  free(comp);
+  free(data);
+}
@@ -0,0 +1,317 @@
+//############################################################################
+// config_file_test.c
+//
+// Tests for kmyth configuration file functions in utils/src/config_file.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <CUnit/CUnit.h>
+
+#include "config_file_test.h"
+#include "config_file.h"
+#include "defines.h"
+
+static const struct option test_longopts[] = {
+  {"input", required_argument, 0, 'i'},
+  {"pcrs_list", required_argument, 0, 'p'},
+  {"tcti", required_argument, 0, 'R'},
+  {"param_enc", no_argument, 0, 'e'},
+  {"verbose", no_argument, 0, 'v'},
+  {"allow_uid", required_argument, 0, 'u'},
+  {"auth_string", required_argument, 0, 'a'},
+  {0, 0, 0, 0}
+};
+
+//----------------------------------------------------------------------------
+// config_file_add_tests()
+//----------------------------------------------------------------------------
+int config_file_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "Config File Apply Tests",
+                          test_kmyth_config_apply))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Config File Repeated Option Tests",
+                          test_kmyth_config_apply_repeated))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Config File Error Tests",
+                          test_kmyth_config_apply_errors))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// write_config()
+//----------------------------------------------------------------------------
+static void write_config(const char *path, const char *contents, mode_t mode)
+{
+  FILE *file = fopen(path, "w");
+
+  CU_ASSERT_FATAL(file != NULL);
+  fputs(contents, file);
+  fclose(file);
+  chmod(path, mode);
+}
+
+//----------------------------------------------------------------------------
+// make_config_path()
+//
+// Creates a private directory for a test configuration file (the file's
+// directory must not be writable by other users, so /tmp itself will not do)
+//----------------------------------------------------------------------------
+static void make_config_path(char *dir, char *path, size_t path_size)
+{
+  CU_ASSERT_FATAL(mkdtemp(dir) != NULL);
+  snprintf(path, path_size, "%s/kmyth.conf", dir);
+}
+
+//----------------------------------------------------------------------------
+// apply_config()
+//----------------------------------------------------------------------------
+static int apply_config(const char *profile, int *argc, char ***argv)
+{
+  if (profile == NULL)
+  {
+    unsetenv(KMYTH_PROFILE_ENV);
+  }
+  else
+  {
+    setenv(KMYTH_PROFILE_ENV, profile, 1);
+  }
+  return kmyth_config_apply(test_longopts, argc, argv);
+}
+
+//----------------------------------------------------------------------------
+// free_config_argv()
+//----------------------------------------------------------------------------
+static void free_config_argv(char **argv, int added)
+{
+  for (int i = 1; i <= added; i++)
+  {
+    free(argv[i]);
+  }
+  free(argv);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_config_apply()
+//----------------------------------------------------------------------------
+void test_kmyth_config_apply(void)
+{
+  char dir[] = "/tmp/kmyth_config_test_XXXXXX";
+  char path[sizeof(dir) + 16];
+
+  make_config_path(dir, path, sizeof(path));
+  write_config(path,
+               "# Kmyth test configuration\n"
+               "[prod]\n"
+               "  param_enc = yes\n"
+               "verbose = no\n"
+               "\n"
+               "[kmyth-seal]\n"
+               "pcrs_list = 0, 7\n"
+               "[kmyth-unseal]\n"
+               "input = unused.ski\n"
+               "[default]\n"
+               "tcti = device:/dev/tpmrm0\n"
+               "srk_handle = 0x81000001\n", 0600);
+  setenv(KMYTH_CONFIG_FILE_ENV, path, 1);
+
+  // the [default], tool and profile settings go first, in that order,
+  // skipping options the tool does not have and disabled flags
+  char *args[] = { "/usr/bin/kmyth-seal", "-i", "in.txt", NULL };
+  int argc = 3;
+  char **argv = args;
+
+  CU_ASSERT(apply_config("prod", &argc, &argv) == 0);
+  CU_ASSERT(argc == 6);
+  if (argc == 6)
+  {
+    CU_ASSERT(strcmp(argv[0], "/usr/bin/kmyth-seal") == 0);
+    CU_ASSERT(strcmp(argv[1], "--tcti=device:/dev/tpmrm0") == 0);
+    CU_ASSERT(strcmp(argv[2], "--pcrs_list=0, 7") == 0);
+    CU_ASSERT(strcmp(argv[3], "--param_enc") == 0);
+    CU_ASSERT(strcmp(argv[4], "-i") == 0);
+    CU_ASSERT(strcmp(argv[5], "in.txt") == 0);
+    CU_ASSERT(argv[6] == NULL);
+  }
+  if (argv != args)
+  {
+    free_config_argv(argv, argc - 3);
+  }
+
+  // without a profile, only the [default] and tool sections apply
+  argc = 3;
+  argv = args;
+  CU_ASSERT(apply_config(NULL, &argc, &argv) == 0);
+  CU_ASSERT(argc == 5);
+  if (argc == 5)
+  {
+    CU_ASSERT(strcmp(argv[2], "--pcrs_list=0, 7") == 0);
+    CU_ASSERT(strcmp(argv[3], "-i") == 0);
+  }
+  if (argv != args)
+  {
+    free_config_argv(argv, argc - 3);
+  }
+
+  // an empty configuration path disables the file
+  setenv(KMYTH_CONFIG_FILE_ENV, "", 1);
+  argc = 3;
+  argv = args;
+  CU_ASSERT(apply_config(NULL, &argc, &argv) == 0);
+  CU_ASSERT(argc == 3);
+  CU_ASSERT(argv == args);
+
+  unsetenv(KMYTH_CONFIG_FILE_ENV);
+  unlink(path);
+  rmdir(dir);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_config_apply_repeated()
+//----------------------------------------------------------------------------
+void test_kmyth_config_apply_repeated(void)
+{
+  char dir[] = "/tmp/kmyth_config_test_XXXXXX";
+  char path[sizeof(dir) + 16];
+
+  make_config_path(dir, path, sizeof(path));
+  write_config(path,
+               "[default]\n"
+               "allow_uid = 1000\n"
+               "param_enc = yes\n"
+               "[kmyth-unsealerd]\n"
+               "allow_uid = 1001\n", 0600);
+  setenv(KMYTH_CONFIG_FILE_ENV, path, 1);
+
+  // a repeated option collects the configured values (in section order)
+  // and then the command line ones: the command line adds to them
+  char *args[] = { "kmyth-unsealerd", "-u", "2000", NULL };
+  int argc = 3;
+  char **argv = args;
+
+  CU_ASSERT(apply_config(NULL, &argc, &argv) == 0);
+  CU_ASSERT(argc == 6);
+  if (argc == 6)
+  {
+    CU_ASSERT(strcmp(argv[1], "--allow_uid=1000") == 0);
+    CU_ASSERT(strcmp(argv[2], "--param_enc") == 0);
+    CU_ASSERT(strcmp(argv[3], "--allow_uid=1001") == 0);
+    CU_ASSERT(strcmp(argv[4], "-u") == 0);
+    CU_ASSERT(strcmp(argv[5], "2000") == 0);
+    CU_ASSERT(argv[6] == NULL);
+  }
+
+  // getopt_long() sees every value, configured ones first
+  const char *uids[4] = { NULL };
+  int uid_count = 0;
+  int option = 0;
+
+  optind = 1;
+  opterr = 0;
+  while ((option = getopt_long(argc, argv, "i:p:R:evu:a:", test_longopts,
+                               NULL)) != -1)
+  {
+    if (option == 'u' && uid_count < 4)
+    {
+      uids[uid_count++] = optarg;
+    }
+  }
+  optind = 1;
+  CU_ASSERT(uid_count == 3);
+  if (uid_count == 3)
+  {
+    CU_ASSERT(strcmp(uids[0], "1000") == 0);
+    CU_ASSERT(strcmp(uids[1], "1001") == 0);
+    CU_ASSERT(strcmp(uids[2], "2000") == 0);
+  }
+  if (argv != args)
+  {
+    free_config_argv(argv, argc - 3);
+  }
+
+  unsetenv(KMYTH_CONFIG_FILE_ENV);
+  unlink(path);
+  rmdir(dir);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_config_apply_errors()
+//----------------------------------------------------------------------------
+void test_kmyth_config_apply_errors(void)
+{
+  char dir[] = "/tmp/kmyth_config_test_XXXXXX";
+  char path[sizeof(dir) + 16];
+
+  make_config_path(dir, path, sizeof(path));
+  setenv(KMYTH_CONFIG_FILE_ENV, path, 1);
+
+  char *args[] = { "kmyth-unseal", NULL };
+  int argc = 1;
+  char **argv = args;
+
+  // a setting outside of any section
+  write_config(path, "tcti = mssim\n", 0600);
+  CU_ASSERT(apply_config(NULL, &argc, &argv) == 1);
+
+  // a malformed section header
+  write_config(path, "[default\ntcti = mssim\n", 0600);
+  CU_ASSERT(apply_config(NULL, &argc, &argv) == 1);
+
+  // a missing or invalid value
+  write_config(path, "[default]\ntcti\n", 0600);
+  CU_ASSERT(apply_config(NULL, &argc, &argv) == 1);
+  write_config(path, "[default]\nverbose = maybe\n", 0600);
+  CU_ASSERT(apply_config(NULL, &argc, &argv) == 1);
+
+  // an unknown profile
+  write_config(path, "[default]\ntcti = mssim\n", 0600);
+  CU_ASSERT(apply_config("missing", &argc, &argv) == 1);
+
+  // a file other users may change
+  write_config(path, "[default]\ntcti = mssim\n", 0620);
+  CU_ASSERT(apply_config(NULL, &argc, &argv) == 1);
+  CU_ASSERT(argc == 1);
+  CU_ASSERT(argv == args);
+
+  // a file in a directory other users may change
+  write_config(path, "[default]\ntcti = mssim\n", 0600);
+  chmod(dir, 0770);
+  CU_ASSERT(apply_config(NULL, &argc, &argv) == 1);
+  chmod(dir, 0700);
+  CU_ASSERT(apply_config(NULL, &argc, &argv) == 0);
+  CU_ASSERT(argv != args);
+  if (argv != args)
+  {
+    free_config_argv(argv, argc - 1);
+  }
+  argc = 1;
+  argv = args;
+
+  // an authorization value in a file other users may read, even in a
+  // section that does not apply to the tool
+  write_config(path, "[kmyth-seal]\nauth_string = secret\n", 0644);
+  CU_ASSERT(apply_config(NULL, &argc, &argv) == 1);
+  CU_ASSERT(argv == args);
+
+  // a configured file that does not exist
+  unlink(path);
+  CU_ASSERT(apply_config(NULL, &argc, &argv) == 1);
+
+  unsetenv(KMYTH_PROFILE_ENV);
+  unsetenv(KMYTH_CONFIG_FILE_ENV);
+  rmdir(dir);
+}
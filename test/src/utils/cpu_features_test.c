@@ -0,0 +1,101 @@
+//############################################################################
+// cpu_features_test.c
+//
+// Tests for CPU feature detection functions in utils/src/cpu_features.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CUnit/CUnit.h>
+
+#include "cpu_features_test.h"
+#include "cpu_features.h"
+#include "base64_codec.h"
+
+//----------------------------------------------------------------------------
+// cpu_features_add_tests()
+//----------------------------------------------------------------------------
+int cpu_features_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "CPU Feature Limit Tests",
+                          test_kmyth_cpu_set_limit))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "CPU Feature Dispatch Tests",
+                          test_kmyth_cpu_limit_dispatch))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_cpu_set_limit()
+//----------------------------------------------------------------------------
+void test_kmyth_cpu_set_limit(void)
+{
+  const char *levels[] = { "sse4.2", "avx2", "avx512", "neon" };
+
+  CU_ASSERT(kmyth_cpu_set_limit("native") == 0);
+  uint32_t native = kmyth_cpu_features();
+
+  CU_ASSERT(kmyth_cpu_has(native));
+  CU_ASSERT(kmyth_cpu_has(0));
+
+  // the scalar level leaves no features
+  CU_ASSERT(kmyth_cpu_set_limit("scalar") == 0);
+  CU_ASSERT(kmyth_cpu_features() == 0);
+  CU_ASSERT(strcmp(kmyth_cpu_level_name(), "scalar") == 0);
+  CU_ASSERT(kmyth_cpu_has(0));
+  CU_ASSERT(native == 0 || !kmyth_cpu_has(native));
+
+  // no level adds a feature the CPU does not have
+  for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++)
+  {
+    CU_ASSERT(kmyth_cpu_set_limit(levels[i]) == 0);
+    CU_ASSERT((kmyth_cpu_features() & ~native) == 0);
+  }
+  CU_ASSERT(kmyth_cpu_set_limit("avx2") == 0);
+  CU_ASSERT(!kmyth_cpu_has(KMYTH_CPU_AVX512F));
+  CU_ASSERT(!kmyth_cpu_has(KMYTH_CPU_NEON));
+
+  // an unknown level leaves the limit unchanged
+  uint32_t limited = kmyth_cpu_features();
+
+  CU_ASSERT(kmyth_cpu_set_limit("avx1024") == 1);
+  CU_ASSERT(kmyth_cpu_set_limit("") == 1);
+  CU_ASSERT(kmyth_cpu_features() == limited);
+
+  // removing the limit restores every feature
+  CU_ASSERT(kmyth_cpu_set_limit(NULL) == 0);
+  CU_ASSERT(kmyth_cpu_features() == native);
+  if (kmyth_cpu_has(KMYTH_CPU_AVX2))
+  {
+    CU_ASSERT(strcmp(kmyth_cpu_level_name(), "scalar") != 0);
+    CU_ASSERT(strcmp(kmyth_cpu_level_name(), "sse4.2") != 0);
+  }
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_cpu_limit_dispatch()
+//----------------------------------------------------------------------------
+void test_kmyth_cpu_limit_dispatch(void)
+{
+  CU_ASSERT(kmyth_cpu_set_limit("scalar") == 0);
+  CU_ASSERT(base64_set_codec(BASE64_CODEC_AUTO) == 0);
+  CU_ASSERT(strcmp(base64_codec_name(), "scalar") == 0);
+  CU_ASSERT(base64_set_codec(BASE64_CODEC_AVX2) == 1);
+  CU_ASSERT(base64_set_codec(BASE64_CODEC_NEON) == 1);
+  CU_ASSERT(strcmp(base64_codec_name(), "scalar") == 0);
+
+  CU_ASSERT(kmyth_cpu_set_limit(NULL) == 0);
+  CU_ASSERT(base64_set_codec(BASE64_CODEC_AUTO) == 0);
+  if (kmyth_cpu_has(KMYTH_CPU_AVX2) || kmyth_cpu_has(KMYTH_CPU_NEON))
+  {
+    CU_ASSERT(strcmp(base64_codec_name(), "scalar") != 0);
+  }
+}
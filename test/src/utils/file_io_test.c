@@ -6,6 +6,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -37,12 +38,48 @@ int file_io_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "map_bytes_from_file() Tests",
+                          test_map_bytes_from_file))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "write_bytes_to_file() Tests",
                           test_write_bytes_to_file))
   {
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "write_bytes_to_new_file() Tests",
+                          test_write_bytes_to_new_file))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "make_private_dir() Tests",
+                          test_make_private_dir))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "append_dir_files() Tests",
+                          test_append_dir_files))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "derive_unsealed_paths() Tests",
+                          test_derive_unsealed_paths))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "write_bytes_to_secret_fd() Tests",
+                          test_write_bytes_to_secret_fd))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "print_to_stdout() Tests",
                           test_print_to_stdout))
   {
@@ -156,6 +193,46 @@ void test_read_bytes_from_file(void)
   free(testdata);
 }
 
+//----------------------------------------------------------------------------
+// test_map_bytes_from_file()
+//----------------------------------------------------------------------------
+void test_map_bytes_from_file(void)
+{
+  uint8_t *testfile_data = (uint8_t *) "mapped 123 & ABC !!";
+  size_t testfile_size = strlen((char *) testfile_data);
+
+  uint8_t *testdata = NULL;
+  size_t testdata_len = 0;
+
+  // Trying to map a NULL input path should result in error
+  CU_ASSERT(map_bytes_from_file(NULL, &testdata, &testdata_len) == 1);
+
+  // Mapping an existing, but empty, file should succeed with no data
+  FILE *fp = fopen("testfile", "w");
+
+  fclose(fp);
+  CU_ASSERT(map_bytes_from_file("testfile", &testdata, &testdata_len) == 0);
+  CU_ASSERT(testdata == NULL);
+  CU_ASSERT(testdata_len == 0);
+  unmap_bytes_from_file(testdata, testdata_len);
+
+  // Mapping a file with test data should match read_bytes_from_file()
+  fp = fopen("testfile", "w");
+  fwrite(testfile_data, 1, testfile_size, fp);
+  fclose(fp);
+  CU_ASSERT(map_bytes_from_file("testfile", &testdata, &testdata_len) == 0);
+  CU_ASSERT(testdata_len == testfile_size);
+  CU_ASSERT(memcmp(testdata, testfile_data, testfile_size) == 0);
+  unmap_bytes_from_file(testdata, testdata_len);
+
+  // Mapping a directory should result in error
+  CU_ASSERT(map_bytes_from_file(".", &testdata, &testdata_len) == 1);
+
+  // Trying to map a non-existent file should result in error
+  remove("testfile");
+  CU_ASSERT(map_bytes_from_file("testfile", &testdata, &testdata_len) == 1);
+}
+
 //----------------------------------------------------------------------------
 // test_write_bytes_to_file()
 //----------------------------------------------------------------------------
@@ -198,6 +275,243 @@ void test_write_bytes_to_file(void)
   remove("testfile");
 }
 
+//----------------------------------------------------------------------------
+// test_write_bytes_to_new_file()
+//----------------------------------------------------------------------------
+void test_write_bytes_to_new_file(void)
+{
+  uint8_t *testdata = (uint8_t *) "Testing 123 ...";
+  size_t testdata_len = strlen((char *) testdata);
+  uint8_t *filedata = NULL;
+  size_t filedata_len = 0;
+  struct stat st = { 0 };
+
+  remove("testfile");
+  CU_ASSERT(write_bytes_to_new_file(NULL, testdata, testdata_len,
+                                    0600) == 1);
+  CU_ASSERT(write_bytes_to_new_file("testfile", NULL, testdata_len,
+                                    0600) == 1);
+
+  // the new file holds the data, with the requested permissions
+  CU_ASSERT(write_bytes_to_new_file("testfile", testdata, testdata_len,
+                                    0600) == 0);
+  CU_ASSERT(stat("testfile", &st) == 0);
+  CU_ASSERT((st.st_mode & 0777) == 0600);
+  CU_ASSERT(read_bytes_from_file("testfile", &filedata, &filedata_len) == 0);
+  CU_ASSERT(filedata_len == testdata_len);
+  CU_ASSERT(filedata != NULL
+            && memcmp(filedata, testdata, testdata_len) == 0);
+  free(filedata);
+
+  // an existing file (or a link planted in its place) is never written
+  CU_ASSERT(write_bytes_to_new_file("testfile", testdata, 4, 0600) == 1);
+  CU_ASSERT(symlink("testfile", "testlink") == 0);
+  CU_ASSERT(write_bytes_to_new_file("testlink", testdata, 4, 0600) == 1);
+  CU_ASSERT(stat("testfile", &st) == 0);
+  CU_ASSERT(st.st_size == (off_t) testdata_len);
+  remove("testlink");
+  remove("testfile");
+}
+
+//----------------------------------------------------------------------------
+// test_make_private_dir()
+//----------------------------------------------------------------------------
+void test_make_private_dir(void)
+{
+  struct stat st = { 0 };
+
+  rmdir("testdir");
+  CU_ASSERT(make_private_dir(NULL) == 1);
+
+  // a new directory is accessible only by its owner, and an existing one
+  // is accepted as long as only its owner may write to it
+  CU_ASSERT(make_private_dir("testdir") == 0);
+  CU_ASSERT(stat("testdir", &st) == 0);
+  CU_ASSERT(S_ISDIR(st.st_mode) && (st.st_mode & 0777) == 0700);
+  chmod("testdir", 0755);
+  CU_ASSERT(make_private_dir("testdir") == 0);
+
+  // a directory others may write to, a link to a directory, or a file is
+  // refused
+  chmod("testdir", 0770);
+  CU_ASSERT(make_private_dir("testdir") == 1);
+  chmod("testdir", 0700);
+  CU_ASSERT(symlink("testdir", "testlink") == 0);
+  CU_ASSERT(make_private_dir("testlink") == 1);
+  remove("testlink");
+  rmdir("testdir");
+
+  FILE *fp = fopen("testfile", "w");
+
+  CU_ASSERT_FATAL(fp != NULL);
+  fclose(fp);
+  CU_ASSERT(make_private_dir("testfile") == 1);
+  remove("testfile");
+}
+
+//----------------------------------------------------------------------------
+// test_append_dir_files()
+//----------------------------------------------------------------------------
+void test_append_dir_files(void)
+{
+  char **paths = NULL;
+  size_t path_count = 0;
+  const char *files[] = { "b.ski", "a.ski", "c.txt", ".ski" };
+  char path[64];
+
+  rmdir("testdir/sub.ski");
+  rmdir("testdir");
+  CU_ASSERT_FATAL(mkdir("testdir", 0700) == 0);
+  for (size_t i = 0; i < 4; i++)
+  {
+    snprintf(path, sizeof(path), "testdir/%s", files[i]);
+    CU_ASSERT(write_bytes_to_file(path, (uint8_t *) "x", 1) == 0);
+  }
+  CU_ASSERT(mkdir("testdir/sub.ski", 0700) == 0);
+
+  CU_ASSERT(append_dir_files(NULL, ".ski", &paths, &path_count) == 1);
+  CU_ASSERT(append_dir_files("nodir", ".ski", &paths, &path_count) == 1);
+  CU_ASSERT(paths == NULL && path_count == 0);
+
+  // only regular files named <name>.ski are listed, in name order, after
+  // the paths already in the list
+  paths = malloc(sizeof(char *));
+  CU_ASSERT_FATAL(paths != NULL);
+  paths[0] = strdup("first");
+  path_count = 1;
+  CU_ASSERT(append_dir_files("testdir", ".ski", &paths, &path_count) == 0);
+  CU_ASSERT_FATAL(path_count == 3);
+  CU_ASSERT(strcmp(paths[0], "first") == 0);
+  CU_ASSERT(strcmp(paths[1], "testdir/a.ski") == 0);
+  CU_ASSERT(strcmp(paths[2], "testdir/b.ski") == 0);
+
+  // with no suffix, every regular file is listed
+  CU_ASSERT(append_dir_files("testdir", NULL, &paths, &path_count) == 0);
+  CU_ASSERT_FATAL(path_count == 7);
+  CU_ASSERT(strcmp(paths[3], "testdir/.ski") == 0);
+  CU_ASSERT(strcmp(paths[4], "testdir/a.ski") == 0);
+  CU_ASSERT(strcmp(paths[6], "testdir/c.txt") == 0);
+
+  for (size_t i = 0; i < path_count; i++)
+  {
+    free(paths[i]);
+  }
+  free(paths);
+
+  for (size_t i = 0; i < 4; i++)
+  {
+    snprintf(path, sizeof(path), "testdir/%s", files[i]);
+    remove(path);
+  }
+  rmdir("testdir/sub.ski");
+  rmdir("testdir");
+}
+
+//----------------------------------------------------------------------------
+// test_derive_unsealed_paths()
+//----------------------------------------------------------------------------
+void test_derive_unsealed_paths(void)
+{
+  char *paths[] = { "in/a.ski", "b.ski", "other/a.ski", "in/c.txt" };
+  char *out_paths[4] = { NULL };
+
+  rmdir("testdir");
+  CU_ASSERT_FATAL(mkdir("testdir", 0700) == 0);
+
+  // the output directory must exist
+  CU_ASSERT(derive_unsealed_paths(paths, 2, "nodir", false, out_paths) == 1);
+  CU_ASSERT(derive_unsealed_paths(paths, 2, NULL, false, out_paths) == 1);
+  CU_ASSERT(out_paths[0] == NULL);
+
+  // each <name>.ski is unsealed into <out_dir>/<name>
+  CU_ASSERT(derive_unsealed_paths(paths, 2, "testdir", false,
+                                  out_paths) == 0);
+  CU_ASSERT(out_paths[0] != NULL
+            && strcmp(out_paths[0], "testdir/a") == 0);
+  CU_ASSERT(out_paths[1] != NULL
+            && strcmp(out_paths[1], "testdir/b") == 0);
+  for (size_t i = 0; i < 4; i++)
+  {
+    free(out_paths[i]);
+    out_paths[i] = NULL;
+  }
+
+  // an output that exists is refused, unless forced
+  CU_ASSERT(write_bytes_to_file("testdir/b", (uint8_t *) "x", 1) == 0);
+  CU_ASSERT(derive_unsealed_paths(paths, 2, "testdir", false,
+                                  out_paths) == 1);
+  for (size_t i = 0; i < 4; i++)
+  {
+    free(out_paths[i]);
+    out_paths[i] = NULL;
+  }
+  CU_ASSERT(derive_unsealed_paths(paths, 2, "testdir", true,
+                                  out_paths) == 0);
+  for (size_t i = 0; i < 4; i++)
+  {
+    free(out_paths[i]);
+    out_paths[i] = NULL;
+  }
+
+  // inputs that map to the same output, or are not <name>.ski, are refused
+  CU_ASSERT(derive_unsealed_paths(paths, 3, "testdir", true,
+                                  out_paths) == 1);
+  for (size_t i = 0; i < 4; i++)
+  {
+    free(out_paths[i]);
+    out_paths[i] = NULL;
+  }
+  CU_ASSERT(derive_unsealed_paths(paths + 3, 1, "testdir", true,
+                                  out_paths) == 1);
+  CU_ASSERT(out_paths[0] == NULL);
+
+  remove("testdir/b");
+  rmdir("testdir");
+}
+
+//----------------------------------------------------------------------------
+// test_write_bytes_to_secret_fd()
+//----------------------------------------------------------------------------
+void test_write_bytes_to_secret_fd(void)
+{
+  uint8_t *testdata = (uint8_t *) "Testing 123 ...";
+  size_t testdata_len = strlen((char *) testdata);
+  int fd = -1;
+
+  // NULL data (with a non-zero length) or output should result in error
+  CU_ASSERT(write_bytes_to_secret_fd(NULL, testdata_len, &fd) == 1);
+  CU_ASSERT(write_bytes_to_secret_fd(testdata, testdata_len, NULL) == 1);
+
+  // the memory file holds the data, and is not inherited across exec
+  CU_ASSERT(write_bytes_to_secret_fd(testdata, testdata_len, &fd) == 0);
+  CU_ASSERT(fd >= 0);
+  CU_ASSERT(fcntl(fd, F_GETFD) & FD_CLOEXEC);
+
+  uint8_t *mapdata = NULL;
+  size_t mapdata_len = 0;
+
+  CU_ASSERT(map_bytes_from_secret_fd(fd, &mapdata, &mapdata_len) == 0);
+  CU_ASSERT(mapdata_len == testdata_len);
+  CU_ASSERT(mapdata != NULL
+            && memcmp(mapdata, testdata, testdata_len) == 0);
+  unmap_bytes_from_file(mapdata, mapdata_len);
+
+  // a sealed memfd can no longer be written (a memfd_secret cannot be
+  // written, except through a mapping, at all)
+  CU_ASSERT(write(fd, "x", 1) == -1);
+  close(fd);
+
+  // an empty memory file maps to a NULL pointer
+  CU_ASSERT(write_bytes_to_secret_fd(NULL, 0, &fd) == 0);
+  CU_ASSERT(map_bytes_from_secret_fd(fd, &mapdata, &mapdata_len) == 0);
+  CU_ASSERT(mapdata == NULL);
+  CU_ASSERT(mapdata_len == 0);
+  close(fd);
+
+  // an invalid descriptor cannot be mapped
+  CU_ASSERT(map_bytes_from_secret_fd(-1, &mapdata, &mapdata_len) == 1);
+}
+
 //----------------------------------------------------------------------------
 // test_print_to_stdout()
 //----------------------------------------------------------------------------
@@ -0,0 +1,767 @@
+//############################################################################
+// kmyth_log_test.c
+//
+// Tests for kmyth logging functions in logger/src/kmyth_log.c
+//############################################################################
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <CUnit/CUnit.h>
+
+#include "kmyth_log_test.h"
+#include "kmyth_log.h"
+
+//----------------------------------------------------------------------------
+// kmyth_log_add_tests()
+//----------------------------------------------------------------------------
+int kmyth_log_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "Log File Handle Tests",
+                          test_kmyth_log_file_handles))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Concurrent Log Writer Tests",
+                          test_kmyth_log_concurrent_writers))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Async Logging Tests",
+                          test_kmyth_log_async))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Async Logging Overflow Tests",
+                          test_kmyth_log_async_overflow))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Log Severity Filtering Tests",
+                          test_kmyth_log_severity_filter))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Log Minimum Level Tests",
+                          test_kmyth_log_min_level))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "JSON Log Output Tests",
+                          test_kmyth_log_json))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Log Repeat Suppression Tests",
+                          test_kmyth_log_repeats))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Log Rate Limit Tests",
+                          test_kmyth_log_rate_limit))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// A temporary directory holding the application log files of a test
+//----------------------------------------------------------------------------
+typedef struct log_test_dir
+{
+  char dir[40];
+  char path[64];
+} log_test_dir;
+
+//----------------------------------------------------------------------------
+// log_test_begin(): creates the directory and logs every entry to the
+//                   application log file in it, and nowhere else
+//----------------------------------------------------------------------------
+static int log_test_begin(log_test_dir * log_dir)
+{
+  snprintf(log_dir->dir, sizeof(log_dir->dir), "/tmp/kmyth-log-test-XXXXXX");
+  if (mkdtemp(log_dir->dir) == NULL)
+  {
+    return 1;
+  }
+  snprintf(log_dir->path, sizeof(log_dir->path), "%s/kmyth.log",
+           log_dir->dir);
+
+  set_applog_path(log_dir->path);
+  set_applog_output_mode(2);
+  set_applog_severity_threshold(LOG_DEBUG);
+  set_syslog_severity_threshold(LOG_EMERG);
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// log_test_end(): restores the default logging settings, then removes the
+//                 given log files and the directory
+//----------------------------------------------------------------------------
+static void log_test_end(log_test_dir * log_dir, const char **names,
+                         size_t name_count)
+{
+  char path[128];
+
+  set_applog_path(DEFAULT_APPLOG_PATH);
+  set_applog_output_mode(KMYTH_APPLOG_OUTPUT_MODE_DEFAULT);
+  set_applog_severity_threshold(KMYTH_APPLOG_SEVERITY_THRESHOLD_DEFAULT);
+  set_syslog_severity_threshold(SYSLOG_SEVERITY_THRESHOLD_DEFAULT);
+
+  unlink(log_dir->path);
+  for (size_t i = 0; i < name_count; i++)
+  {
+    snprintf(path, sizeof(path), "%s/%s", log_dir->dir, names[i]);
+    unlink(path);
+  }
+  rmdir(log_dir->dir);
+}
+
+//----------------------------------------------------------------------------
+// read_log(): reads a whole log file into a (null terminated) string, or
+//             returns NULL if there is no such file
+//----------------------------------------------------------------------------
+static char *read_log(const char *path)
+{
+  FILE *fp = fopen(path, "r");
+  char *contents = NULL;
+  size_t len = 0;
+
+  if (fp == NULL)
+  {
+    return NULL;
+  }
+  if (fseek(fp, 0, SEEK_END) == 0 && ftell(fp) >= 0)
+  {
+    len = (size_t) ftell(fp);
+    rewind(fp);
+    contents = calloc(len + 1, 1);
+    if (contents != NULL && fread(contents, 1, len, fp) != len)
+    {
+      free(contents);
+      contents = NULL;
+    }
+  }
+  fclose(fp);
+  return contents;
+}
+
+//----------------------------------------------------------------------------
+// count_occurrences(): counts the occurrences of a string in a log
+//----------------------------------------------------------------------------
+static size_t count_occurrences(const char *log, const char *str)
+{
+  size_t count = 0;
+
+  for (const char *c = log; c != NULL && (c = strstr(c, str)) != NULL;
+       c += strlen(str))
+  {
+    count++;
+  }
+  return count;
+}
+
+//----------------------------------------------------------------------------
+// log_has_entry(): checks that a log holds the given (text format) entry
+//                  exactly once, as a whole line
+//----------------------------------------------------------------------------
+static bool log_has_entry(const char *path, const char *severity,
+                          const char *msg)
+{
+  char *log = read_log(path);
+  char prefix[64];
+  char suffix[128];
+
+  if (log == NULL)
+  {
+    return false;
+  }
+  snprintf(prefix, sizeof(prefix), "%s-%s %s ", DEFAULT_APP_NAME,
+           DEFAULT_APP_VERSION, severity);
+  snprintf(suffix, sizeof(suffix), ") %s\n", msg);
+
+  // the entry's line starts with the prefix and ends with the message
+  bool found = (count_occurrences(log, suffix) == 1);
+
+  if (found)
+  {
+    const char *end = strstr(log, suffix);
+    const char *line = end;
+
+    while (line > log && line[-1] != '\n')
+    {
+      line--;
+    }
+    found = (strncmp(line, prefix, strlen(prefix)) == 0);
+  }
+  free(log);
+  return found;
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_log_file_handles()
+//----------------------------------------------------------------------------
+void test_kmyth_log_file_handles(void)
+{
+  log_test_dir log_dir = { 0 };
+  const char *names[] = { "kmyth.log.1", "other.log" };
+  char rotated_path[64];
+  char other_path[64];
+  char *log = NULL;
+
+  CU_ASSERT_FATAL(log_test_begin(&log_dir) == 0);
+  snprintf(rotated_path, sizeof(rotated_path), "%s/%s", log_dir.dir,
+           names[0]);
+  snprintf(other_path, sizeof(other_path), "%s/%s", log_dir.dir, names[1]);
+
+  // Check that the file is created by the first entry
+  kmyth_log(LOG_INFO, "entry %d", 1);
+  CU_ASSERT(log_has_entry(log_dir.path, "INFO", "entry 1"));
+
+  // Check that, once the file is moved away, entries still go to it
+  CU_ASSERT_FATAL(rename(log_dir.path, rotated_path) == 0);
+  kmyth_log(LOG_INFO, "entry %d", 2);
+  CU_ASSERT(access(log_dir.path, F_OK) != 0);
+  CU_ASSERT(log_has_entry(rotated_path, "INFO", "entry 2"));
+
+  // Check that a reopen request starts a new file at the path
+  kmyth_log_reopen();
+  kmyth_log(LOG_WARNING, "entry %d", 3);
+  CU_ASSERT(log_has_entry(log_dir.path, "WARNING", "entry 3"));
+  log = read_log(rotated_path);
+  CU_ASSERT(log != NULL && count_occurrences(log, "\n") == 2);
+  free(log);
+
+  // Check that a new path is used from the next entry on
+  set_applog_path(other_path);
+  kmyth_log(LOG_INFO, "entry %d", 4);
+  CU_ASSERT(log_has_entry(other_path, "INFO", "entry 4"));
+  log = read_log(log_dir.path);
+  CU_ASSERT(log != NULL && count_occurrences(log, "\n") == 1);
+  free(log);
+
+  // Check that a path that can't be opened loses entries (output mode 2
+  // never falls back to stdout/stderr), but doesn't stop a good path from
+  // being used afterwards
+  set_applog_path("/tmp/kmyth-log-test-missing/kmyth.log");
+  kmyth_log(LOG_INFO, "entry %d", 5);
+  kmyth_log(LOG_INFO, "entry %d", 6);
+  CU_ASSERT(access("/tmp/kmyth-log-test-missing", F_OK) != 0);
+  set_applog_path(other_path);
+  kmyth_log(LOG_INFO, "entry %d", 7);
+  log = read_log(other_path);
+  CU_ASSERT(log != NULL && count_occurrences(log, "\n") == 2);
+  CU_ASSERT(log != NULL && strstr(log, "entry 5") == NULL);
+  free(log);
+  CU_ASSERT(log_has_entry(other_path, "INFO", "entry 7"));
+
+  log_test_end(&log_dir, names, 2);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_log_concurrent_writers()
+//----------------------------------------------------------------------------
+void test_kmyth_log_concurrent_writers(void)
+{
+  log_test_dir log_dir = { 0 };
+  const int writers = 4;
+  const int entries = 200;
+  pid_t pids[4];
+
+  CU_ASSERT_FATAL(log_test_begin(&log_dir) == 0);
+
+  // Each child appends its own entries to the same file (through a file
+  // descriptor of its own, as it opens the file after the fork)
+  for (int i = 0; i < writers; i++)
+  {
+    pids[i] = fork();
+    CU_ASSERT_FATAL(pids[i] >= 0);
+    if (pids[i] == 0)
+    {
+      for (int j = 0; j < entries; j++)
+      {
+        kmyth_log(LOG_INFO, "writer %d entry %d of a longer log entry, "
+                  "so that unsynchronized writes would interleave", i, j);
+      }
+      _exit(0);
+    }
+  }
+  for (int i = 0; i < writers; i++)
+  {
+    int status = 0;
+
+    CU_ASSERT(waitpid(pids[i], &status, 0) == pids[i]);
+    CU_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+
+  // Check that every entry is there, whole, on a line of its own
+  char *log = read_log(log_dir.path);
+  char prefix[64];
+
+  snprintf(prefix, sizeof(prefix), "%s-%s INFO ", DEFAULT_APP_NAME,
+           DEFAULT_APP_VERSION);
+  CU_ASSERT_FATAL(log != NULL);
+  CU_ASSERT(count_occurrences(log, "\n") == (size_t) (writers * entries));
+  CU_ASSERT(count_occurrences(log, prefix) == (size_t) (writers * entries));
+  CU_ASSERT(count_occurrences(log, "would interleave\n") ==
+            (size_t) (writers * entries));
+  for (char *line = log; *line != '\0'; line = strchr(line, '\n') + 1)
+  {
+    if (strncmp(line, prefix, strlen(prefix)) != 0
+        || strstr(line, "would interleave\n") != strchr(line, '\n') - 16)
+    {
+      CU_FAIL("log entry interleaved with another");
+      break;
+    }
+  }
+  free(log);
+
+  log_test_end(&log_dir, NULL, 0);
+}
+
+//----------------------------------------------------------------------------
+// log_entries(): logs a thread's share of the entries of the async tests
+//----------------------------------------------------------------------------
+#define ASYNC_TEST_THREADS 4
+#define ASYNC_TEST_ENTRIES 500
+
+static void *log_entries(void *arg)
+{
+  int thread = *(int *) arg;
+
+  for (int i = 0; i < ASYNC_TEST_ENTRIES; i++)
+  {
+    kmyth_log(LOG_INFO, "thread %d async entry %d", thread, i);
+  }
+  return NULL;
+}
+
+//----------------------------------------------------------------------------
+// log_from_threads(): logs the async test entries from several threads
+//----------------------------------------------------------------------------
+static void log_from_threads(void)
+{
+  pthread_t threads[ASYNC_TEST_THREADS];
+  int ids[ASYNC_TEST_THREADS];
+
+  for (int i = 0; i < ASYNC_TEST_THREADS; i++)
+  {
+    ids[i] = i;
+    CU_ASSERT_FATAL(pthread_create(&threads[i], NULL, log_entries,
+                                   &ids[i]) == 0);
+  }
+  for (int i = 0; i < ASYNC_TEST_THREADS; i++)
+  {
+    pthread_join(threads[i], NULL);
+  }
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_log_async()
+//----------------------------------------------------------------------------
+void test_kmyth_log_async(void)
+{
+  log_test_dir log_dir = { 0 };
+  char *log = NULL;
+  char entry[64];
+
+  CU_ASSERT_FATAL(log_test_begin(&log_dir) == 0);
+
+  // Check that an empty or oversized queue, or an unknown overflow
+  // policy, is rejected
+  CU_ASSERT(kmyth_log_start_async(0, KMYTH_LOG_ASYNC_BLOCK) == 1);
+  CU_ASSERT(kmyth_log_start_async(KMYTH_LOG_ASYNC_QUEUE_LEN_MAX + 1,
+                                  KMYTH_LOG_ASYNC_BLOCK) == 1);
+  CU_ASSERT(kmyth_log_start_async(8, 2) == 1);
+
+  // Check that, with a small queue that blocks when full, every entry
+  // from every thread is written once flushed
+  CU_ASSERT_FATAL(kmyth_log_start_async(8, KMYTH_LOG_ASYNC_BLOCK) == 0);
+  CU_ASSERT(kmyth_log_start_async(8, KMYTH_LOG_ASYNC_BLOCK) == 0);
+  log_from_threads();
+  kmyth_log_flush();
+  log = read_log(log_dir.path);
+  CU_ASSERT(log != NULL && count_occurrences(log, "\n") ==
+            ASYNC_TEST_THREADS * ASYNC_TEST_ENTRIES);
+  for (int i = 0; log != NULL && i < ASYNC_TEST_THREADS; i++)
+  {
+    snprintf(entry, sizeof(entry), "thread %d async entry %d\n", i,
+             ASYNC_TEST_ENTRIES - 1);
+    CU_ASSERT(count_occurrences(log, entry) == 1);
+  }
+  free(log);
+
+  // Check that entries queued just before async mode stops are written,
+  // and that entries are then written synchronously
+  kmyth_log(LOG_INFO, "queued entry");
+  kmyth_log_stop_async();
+  CU_ASSERT(log_has_entry(log_dir.path, "INFO", "queued entry"));
+  kmyth_log(LOG_INFO, "synchronous entry");
+  CU_ASSERT(log_has_entry(log_dir.path, "INFO", "synchronous entry"));
+  kmyth_log_stop_async();
+  kmyth_log_flush();
+
+  // Check that async mode can be started again
+  CU_ASSERT(kmyth_log_start_async(KMYTH_LOG_ASYNC_QUEUE_LEN_DEFAULT,
+                                  KMYTH_LOG_ASYNC_DROP) == 0);
+  kmyth_log(LOG_INFO, "restarted entry");
+  kmyth_log_flush();
+  CU_ASSERT(log_has_entry(log_dir.path, "INFO", "restarted entry"));
+  kmyth_log_stop_async();
+
+  log_test_end(&log_dir, NULL, 0);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_log_async_overflow()
+//----------------------------------------------------------------------------
+void test_kmyth_log_async_overflow(void)
+{
+  log_test_dir log_dir = { 0 };
+  size_t written = 0;
+  size_t dropped = 0;
+
+  CU_ASSERT_FATAL(log_test_begin(&log_dir) == 0);
+
+  // the drop counts are reported as warnings from one source location,
+  // which would otherwise be rate limited or suppressed as repeats
+  set_log_rate_limit(0, 0);
+  set_log_repeat_suppression(false);
+
+  // Check that, with a one entry queue that drops entries when full,
+  // every entry is either written or counted as dropped
+  CU_ASSERT_FATAL(kmyth_log_start_async(1, KMYTH_LOG_ASYNC_DROP) == 0);
+  log_from_threads();
+  kmyth_log_stop_async();
+
+  char *log = read_log(log_dir.path);
+
+  CU_ASSERT_FATAL(log != NULL);
+  for (char *line = log; *line != '\0'; line = strchr(line, '\n') + 1)
+  {
+    char *report = strstr(line, ") ");
+    size_t count = 0;
+
+    if (strstr(line, " async entry ") != NULL
+        && strstr(line, " async entry ") < strchr(line, '\n'))
+    {
+      written++;
+    }
+    else if (report != NULL
+             && sscanf(report, ") %zu log entries dropped (queue full)",
+                       &count) == 1)
+    {
+      CU_ASSERT(strncmp(line, DEFAULT_APP_NAME "-" DEFAULT_APP_VERSION
+                        " WARNING ", 20) == 0);
+      dropped += count;
+    }
+    else
+    {
+      CU_FAIL("unexpected log entry");
+    }
+  }
+  free(log);
+  CU_ASSERT(written > 0);
+  CU_ASSERT(written + dropped == ASYNC_TEST_THREADS * ASYNC_TEST_ENTRIES);
+
+  set_log_rate_limit(KMYTH_LOG_RATE_BURST_DEFAULT,
+                     KMYTH_LOG_RATE_PER_SEC_DEFAULT);
+  set_log_repeat_suppression(true);
+  log_test_end(&log_dir, NULL, 0);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_log_severity_filter()
+//----------------------------------------------------------------------------
+void test_kmyth_log_severity_filter(void)
+{
+  log_test_dir log_dir = { 0 };
+  int evaluated = 0;
+  char *log = NULL;
+
+  CU_ASSERT_FATAL(log_test_begin(&log_dir) == 0);
+
+  // Check that an entry is enabled if either threshold lets it through
+  set_applog_severity_threshold(LOG_INFO);
+  set_syslog_severity_threshold(LOG_WARNING);
+  CU_ASSERT(kmyth_log_enabled(LOG_ERR));
+  CU_ASSERT(kmyth_log_enabled(LOG_INFO));
+  CU_ASSERT(!kmyth_log_enabled(LOG_DEBUG));
+  set_applog_severity_threshold(LOG_ERR);
+  CU_ASSERT(kmyth_log_enabled(LOG_WARNING));
+  CU_ASSERT(!kmyth_log_enabled(LOG_NOTICE));
+  set_syslog_severity_threshold(LOG_NOTICE);
+  CU_ASSERT(kmyth_log_enabled(LOG_NOTICE));
+  CU_ASSERT(!kmyth_log_enabled(LOG_INFO));
+
+  // Check that an invalid threshold leaves the limit unchanged
+  set_applog_severity_threshold(8);
+  set_syslog_severity_threshold(-1);
+  CU_ASSERT(kmyth_log_enabled(LOG_NOTICE));
+  CU_ASSERT(!kmyth_log_enabled(LOG_INFO));
+  set_applog_severity_threshold(LOG_INFO);
+  set_syslog_severity_threshold(LOG_EMERG);
+
+  // Check that the arguments of a filtered out entry are never evaluated,
+  // and that nothing is written
+  kmyth_log(LOG_DEBUG, "evaluated %d", ++evaluated);
+  CU_ASSERT(evaluated == 0);
+  log_event(__FILE__, __func__, __LINE__, LOG_DEBUG, "direct %d", 1);
+  CU_ASSERT(access(log_dir.path, F_OK) != 0);
+
+  // Check that once the threshold lets them through, they are (unless
+  // this build compiles LOG_DEBUG entries out)
+  set_applog_severity_threshold(LOG_DEBUG);
+  kmyth_log(LOG_DEBUG, "evaluated %d", ++evaluated);
+  log_event(__FILE__, __func__, __LINE__, LOG_DEBUG, "direct %d", 2);
+  CU_ASSERT(evaluated == ((LOG_DEBUG <= KMYTH_LOG_MIN_LEVEL) ? 1 : 0));
+  log = read_log(log_dir.path);
+  CU_ASSERT(log != NULL && strstr(log, "direct 1") == NULL);
+  CU_ASSERT(log != NULL && count_occurrences(log, "direct 2\n") == 1);
+  CU_ASSERT(log != NULL && count_occurrences(log, "evaluated 1\n") ==
+            (size_t) evaluated);
+  free(log);
+
+  log_test_end(&log_dir, NULL, 0);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_log_json()
+//----------------------------------------------------------------------------
+void test_kmyth_log_json(void)
+{
+  log_test_dir log_dir = { 0 };
+  kmyth_log_field fields[] = {
+    KMYTH_LOG_STR("operation", "Tss2_Sys_Load"),
+    KMYTH_LOG_INT("offset", -3),
+    KMYTH_LOG_UINT("size", 42),
+    KMYTH_LOG_HEX("tpm_rc", 0x98E),
+    KMYTH_LOG_STR("path", "a\"b\\c")
+  };
+  char expected[64];
+  char *log = NULL;
+  int line = 0;
+
+  CU_ASSERT_FATAL(log_test_begin(&log_dir) == 0);
+
+  // Check that in JSON mode each entry is one line holding one object,
+  // with the message escaped and the fields following the standard members
+  set_applog_output_mode(2 | KMYTH_APPLOG_OUTPUT_JSON);
+  line = __LINE__ + 1;
+  kmyth_log_fields(LOG_ERR, fields, 5, "say \"%s\"\\\n\t\x01", "hi");
+  log = read_log(log_dir.path);
+  CU_ASSERT_FATAL(log != NULL);
+  CU_ASSERT(log[0] == '{');
+  CU_ASSERT(count_occurrences(log, "\n") == 1);
+  CU_ASSERT(strcmp(log + strlen(log) - 2, "}\n") == 0);
+  CU_ASSERT(strstr(log, "\"app\":\"kmyth\",\"version\":\"0.0.0\","
+                   "\"severity\":\"ERROR\"") != NULL);
+  CU_ASSERT(strstr(log, "\"func\":\"test_kmyth_log_json\"") != NULL);
+  snprintf(expected, sizeof(expected), "\"line\":%d,", line);
+  CU_ASSERT(strstr(log, expected) != NULL);
+  CU_ASSERT(strstr(log, "\"msg\":\"say \\\"hi\\\"\\\\\\n\\t\\u0001\","
+                   "\"operation\":\"Tss2_Sys_Load\",\"offset\":-3,"
+                   "\"size\":42,\"tpm_rc\":\"0x0000098E\","
+                   "\"path\":\"a\\\"b\\\\c\"}\n") != NULL);
+  free(log);
+  unlink(log_dir.path);
+  kmyth_log_reopen();
+
+  // Check that an invalid destination leaves the output mode unchanged
+  set_applog_output_mode(3 | KMYTH_APPLOG_OUTPUT_JSON);
+  kmyth_log(LOG_INFO, "still JSON");
+  log = read_log(log_dir.path);
+  CU_ASSERT(log != NULL && strncmp(log, "{\"time\":", 8) == 0);
+  CU_ASSERT(log != NULL && strstr(log, "\"msg\":\"still JSON\"}") != NULL);
+  free(log);
+  unlink(log_dir.path);
+  kmyth_log_reopen();
+
+  // Check that in text mode the fields follow the message text
+  set_applog_output_mode(2);
+  kmyth_log_fields(LOG_WARNING, fields, 4, "loaded");
+  CU_ASSERT(log_has_entry(log_dir.path, "WARNING",
+                          "loaded {\"operation\":\"Tss2_Sys_Load\","
+                          "\"offset\":-3,\"size\":42,"
+                          "\"tpm_rc\":\"0x0000098E\"}"));
+
+  log_test_end(&log_dir, NULL, 0);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_log_repeats()
+//----------------------------------------------------------------------------
+void test_kmyth_log_repeats(void)
+{
+  log_test_dir log_dir = { 0 };
+  char *log = NULL;
+
+  CU_ASSERT_FATAL(log_test_begin(&log_dir) == 0);
+
+  // Check that identical entries are written once, and counted in an
+  // entry written before the next different one
+  for (int i = 0; i < 5; i++)
+  {
+    kmyth_log(LOG_WARNING, "same entry");
+  }
+  CU_ASSERT(log_has_entry(log_dir.path, "WARNING", "same entry"));
+  log = read_log(log_dir.path);
+  CU_ASSERT(log != NULL && strstr(log, "repeated") == NULL);
+  free(log);
+
+  kmyth_log(LOG_WARNING, "different entry");
+  CU_ASSERT(log_has_entry(log_dir.path, "WARNING",
+                          "last message repeated 4 times"));
+  CU_ASSERT(log_has_entry(log_dir.path, "WARNING", "different entry"));
+  log = read_log(log_dir.path);
+  CU_ASSERT(log != NULL && count_occurrences(log, "\n") == 3);
+  CU_ASSERT(log != NULL && strstr(log, "repeated 4 times\n") <
+            strstr(log, "different entry\n"));
+  free(log);
+  unlink(log_dir.path);
+  kmyth_log_reopen();
+
+  // Check that with suppression off every entry is written
+  set_log_repeat_suppression(false);
+  for (int i = 0; i < 5; i++)
+  {
+    kmyth_log(LOG_WARNING, "same entry");
+  }
+  kmyth_log(LOG_WARNING, "different entry");
+  log = read_log(log_dir.path);
+  CU_ASSERT(log != NULL && count_occurrences(log, "same entry\n") == 5);
+  CU_ASSERT(log != NULL && strstr(log, "repeated") == NULL);
+  free(log);
+  set_log_repeat_suppression(true);
+
+  log_test_end(&log_dir, NULL, 0);
+}
+
+//----------------------------------------------------------------------------
+// log_failure(): logs an error entry, from the same call site every time
+//----------------------------------------------------------------------------
+static void log_failure(int n)
+{
+  kmyth_log(LOG_ERR, "failure %d", n);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_log_rate_limit()
+//----------------------------------------------------------------------------
+void test_kmyth_log_rate_limit(void)
+{
+  log_test_dir log_dir = { 0 };
+  char *log = NULL;
+
+  CU_ASSERT_FATAL(log_test_begin(&log_dir) == 0);
+
+  // Check that a call site writes a burst of entries, and then nothing
+  set_log_rate_limit(3, 1);
+  for (int i = 1; i <= 10; i++)
+  {
+    log_failure(i);
+  }
+  log = read_log(log_dir.path);
+  CU_ASSERT(log != NULL && count_occurrences(log, "\n") == 3);
+  CU_ASSERT(log != NULL && strstr(log, "failure 3\n") != NULL);
+  CU_ASSERT(log != NULL && strstr(log, "failure 4\n") == NULL);
+  free(log);
+
+  // Check that routine (less severe than warning) entries are not limited
+  for (int i = 1; i <= 10; i++)
+  {
+    kmyth_log(LOG_INFO, "routine %d", i);
+  }
+  log = read_log(log_dir.path);
+  CU_ASSERT(log != NULL && count_occurrences(log, "routine") == 10);
+  free(log);
+
+  // Check that once the bucket refills, the site's next entry follows one
+  // counting what it lost
+  sleep(1);
+  log_failure(11);
+  CU_ASSERT(log_has_entry(log_dir.path, "ERROR",
+                          "7 log entries suppressed (rate limit)"));
+  CU_ASSERT(log_has_entry(log_dir.path, "ERROR", "failure 11"));
+  log = read_log(log_dir.path);
+  CU_ASSERT(log != NULL && strstr(log, "(rate limit)\n") <
+            strstr(log, "failure 11\n"));
+  free(log);
+
+  // Check that changing the limits reports entries held back under the
+  // old ones, and that a burst of 0 turns rate limiting off
+  for (int i = 12; i <= 14; i++)
+  {
+    log_failure(i);
+  }
+  set_log_rate_limit(0, 0);
+  CU_ASSERT(log_has_entry(log_dir.path, "ERROR",
+                          "3 log entries suppressed (rate limit)"));
+  for (int i = 15; i <= 40; i++)
+  {
+    log_failure(i);
+  }
+  log = read_log(log_dir.path);
+  CU_ASSERT(log != NULL && count_occurrences(log, ") failure ") == 30);
+  free(log);
+
+  set_log_rate_limit(KMYTH_LOG_RATE_BURST_DEFAULT,
+                     KMYTH_LOG_RATE_PER_SEC_DEFAULT);
+  log_test_end(&log_dir, NULL, 0);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_log_min_level()
+//
+// Builds the kmyth_log() calls below as a build with
+// -DKMYTH_LOG_MIN_LEVEL=LOG_WARNING would
+//----------------------------------------------------------------------------
+#pragma push_macro("KMYTH_LOG_MIN_LEVEL")
+#undef KMYTH_LOG_MIN_LEVEL
+#define KMYTH_LOG_MIN_LEVEL LOG_WARNING
+
+void test_kmyth_log_min_level(void)
+{
+  log_test_dir log_dir = { 0 };
+  kmyth_log_field fields[] = { KMYTH_LOG_STR("operation", "test") };
+  int evaluated = 0;
+  char *log = NULL;
+
+  CU_ASSERT_FATAL(log_test_begin(&log_dir) == 0);
+
+  // Check that calls less severe than the minimum level are compiled out,
+  // even though the threshold lets everything through
+  kmyth_log(LOG_DEBUG, "debug %d", ++evaluated);
+  kmyth_log(LOG_INFO, "info %d", ++evaluated);
+  kmyth_log_fields(LOG_NOTICE, fields, 1, "notice %d", ++evaluated);
+  CU_ASSERT(evaluated == 0);
+  CU_ASSERT(access(log_dir.path, F_OK) != 0);
+
+  // Check that calls at or above the minimum level are still made
+  kmyth_log(LOG_WARNING, "warning %d", ++evaluated);
+  kmyth_log_fields(LOG_ERR, fields, 1, "error %d", ++evaluated);
+  CU_ASSERT(evaluated == 2);
+  log = read_log(log_dir.path);
+  CU_ASSERT(log != NULL && count_occurrences(log, "\n") == 2);
+  CU_ASSERT(log != NULL && count_occurrences(log, "warning 1\n") == 1);
+  CU_ASSERT(log != NULL && count_occurrences(log, "error 2 {") == 1);
+  free(log);
+
+  log_test_end(&log_dir, NULL, 0);
+}
+
+#pragma pop_macro("KMYTH_LOG_MIN_LEVEL")
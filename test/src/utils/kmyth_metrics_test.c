@@ -0,0 +1,292 @@
+//############################################################################
+// kmyth_metrics_test.c
+//
+// Tests for kmyth metrics functions in logger/src/kmyth_metrics.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <CUnit/CUnit.h>
+
+#include "kmyth_metrics_test.h"
+#include "kmyth_metrics.h"
+#include "socket_util.h"
+
+//----------------------------------------------------------------------------
+// kmyth_metrics_add_tests()
+//----------------------------------------------------------------------------
+int kmyth_metrics_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "Metrics Disabled Tests",
+                          test_kmyth_metrics_disabled))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Metrics Exposition Format Tests",
+                          test_kmyth_metrics_print))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Metrics Endpoint Tests",
+                          test_kmyth_metrics_serve))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// A temporary local socket for the metrics endpoint
+//----------------------------------------------------------------------------
+typedef struct metrics_test_socket
+{
+  char dir[40];
+  char path[64];
+} metrics_test_socket;
+
+//----------------------------------------------------------------------------
+// metrics_test_start(): starts the endpoint on a new local socket
+//----------------------------------------------------------------------------
+static int metrics_test_start(metrics_test_socket * sock)
+{
+  int listen_fd = -1;
+
+  snprintf(sock->dir, sizeof(sock->dir), "/tmp/kmyth-metrics-test-XXXXXX");
+  if (mkdtemp(sock->dir) == NULL)
+  {
+    return 1;
+  }
+  snprintf(sock->path, sizeof(sock->path), "%s/metrics.sock", sock->dir);
+
+  if (setup_unix_server_socket(sock->path, 0600, &listen_fd))
+  {
+    rmdir(sock->dir);
+    return 1;
+  }
+  if (kmyth_metrics_serve(listen_fd))
+  {
+    close(listen_fd);
+    unlink(sock->path);
+    rmdir(sock->dir);
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// metrics_test_stop(): stops the endpoint and removes its socket
+//----------------------------------------------------------------------------
+static void metrics_test_stop(metrics_test_socket * sock)
+{
+  kmyth_metrics_stop();
+  unlink(sock->path);
+  rmdir(sock->dir);
+}
+
+//----------------------------------------------------------------------------
+// print_metrics(): returns the output of kmyth_metrics_print() as a (null
+//                  terminated) string
+//----------------------------------------------------------------------------
+static char *print_metrics(void)
+{
+  char *text = NULL;
+  size_t text_len = 0;
+  FILE *stream = open_memstream(&text, &text_len);
+
+  if (stream == NULL)
+  {
+    return NULL;
+  }
+  kmyth_metrics_print(stream);
+  fclose(stream);
+
+  return text;
+}
+
+//----------------------------------------------------------------------------
+// scrape_metrics(): connects to the endpoint, sends the request (or, if it
+//                   is NULL, shuts down its side of the connection), and
+//                   returns the whole response as a (null terminated)
+//                   string
+//----------------------------------------------------------------------------
+static char *scrape_metrics(const char *path, const char *request)
+{
+  char *response = NULL;
+  size_t response_len = 0;
+  FILE *stream = NULL;
+  char buf[512];
+  ssize_t len = 0;
+  int fd = -1;
+
+  if (setup_unix_client_socket(path, &fd))
+  {
+    return NULL;
+  }
+  if (request != NULL)
+  {
+    len = send(fd, request, strlen(request), 0);
+  }
+  else
+  {
+    shutdown(fd, SHUT_WR);
+  }
+
+  stream = open_memstream(&response, &response_len);
+  while (stream != NULL && (len = recv(fd, buf, sizeof(buf), 0)) > 0)
+  {
+    fwrite(buf, 1, (size_t) len, stream);
+  }
+  if (stream != NULL)
+  {
+    fclose(stream);
+  }
+  close(fd);
+
+  return response;
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_metrics_disabled()
+//----------------------------------------------------------------------------
+void test_kmyth_metrics_disabled(void)
+{
+  metrics_test_socket sock = { 0 };
+  char *text = NULL;
+
+  // Check that nothing is recorded before the endpoint is started
+  CU_ASSERT(!kmyth_metrics_enabled());
+  CU_ASSERT(kmyth_metrics_clock() == 0);
+  kmyth_metrics_count("test_disabled_total", NULL, "disabled", 1);
+  kmyth_metrics_observe_latency("test_disabled_seconds", NULL, "disabled",
+                                1);
+  text = print_metrics();
+  CU_ASSERT(text != NULL && strstr(text, "test_disabled") == NULL);
+  free(text);
+
+  // Check that kmyth_metrics_serve() starts recording, and rejects an
+  // invalid socket or a second endpoint
+  CU_ASSERT(kmyth_metrics_serve(-1) == 1);
+  CU_ASSERT(!kmyth_metrics_enabled());
+  CU_ASSERT_FATAL(metrics_test_start(&sock) == 0);
+  CU_ASSERT(kmyth_metrics_enabled());
+  CU_ASSERT(kmyth_metrics_clock() != 0);
+  CU_ASSERT(kmyth_metrics_serve(STDIN_FILENO) == 1);
+  kmyth_metrics_count("test_disabled_total", NULL, "disabled", 1);
+
+  // Check that kmyth_metrics_stop() stops recording, but keeps the metrics
+  // recorded so far
+  metrics_test_stop(&sock);
+  CU_ASSERT(!kmyth_metrics_enabled());
+  kmyth_metrics_count("test_disabled_total", NULL, "disabled", 1);
+  text = print_metrics();
+  CU_ASSERT(text != NULL && strstr(text, "\ntest_disabled_total 1\n") != NULL);
+  free(text);
+
+  // Check that stopping a stopped endpoint does nothing
+  kmyth_metrics_stop();
+  CU_ASSERT(!kmyth_metrics_enabled());
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_metrics_print()
+//----------------------------------------------------------------------------
+void test_kmyth_metrics_print(void)
+{
+  metrics_test_socket sock = { 0 };
+  char long_labels[KMYTH_METRICS_MAX_LABELS_LEN + 8];
+  char *text = NULL;
+
+  CU_ASSERT_FATAL(metrics_test_start(&sock) == 0);
+
+  // Check that the samples of each label set of a counter follow a single
+  // pair of HELP and TYPE lines, even when registered around other metrics
+  kmyth_metrics_count("test_print_total", "result=\"ok\"", "Test counter",
+                      2);
+  kmyth_metrics_count("test_print_other_total", NULL, "Other counter", 5);
+  kmyth_metrics_count("test_print_total", "result=\"error\"",
+                      "Test counter", 1);
+  kmyth_metrics_count("test_print_total", "result=\"ok\"", "Test counter",
+                      3);
+
+  // Check that a latency lands in the first bucket whose bound it does not
+  // exceed, and that the buckets are cumulative
+  uint64_t begin = kmyth_metrics_clock();
+
+  CU_ASSERT_FATAL(begin > 1500000);
+  kmyth_metrics_observe_latency("test_print_seconds", "op=\"seal\"",
+                                "Test histogram", begin - 1500000);
+  kmyth_metrics_observe_latency("test_print_seconds", "op=\"seal\"",
+                                "Test histogram", begin - 20000000000);
+  kmyth_metrics_observe_latency("test_print_seconds", "op=\"seal\"",
+                                "Test histogram", 0);
+
+  // Check that a label set too long to register is not recorded
+  memset(long_labels, 'a', sizeof(long_labels) - 1);
+  long_labels[sizeof(long_labels) - 1] = '\0';
+  kmyth_metrics_count("test_print_long_total", long_labels, "Too long", 1);
+
+  text = print_metrics();
+  CU_ASSERT_FATAL(text != NULL);
+  CU_ASSERT(strstr(text, "# HELP test_print_total Test counter\n"
+                   "# TYPE test_print_total counter\n"
+                   "test_print_total{result=\"ok\"} 5\n"
+                   "test_print_total{result=\"error\"} 1\n"
+                   "# HELP test_print_other_total Other counter\n"
+                   "# TYPE test_print_other_total counter\n"
+                   "test_print_other_total 5\n") != NULL);
+  CU_ASSERT(strstr(text, "# HELP test_print_seconds Test histogram\n"
+                   "# TYPE test_print_seconds histogram\n"
+                   "test_print_seconds_bucket{op=\"seal\",le=\"0.0001\"} 0\n")
+            != NULL);
+  CU_ASSERT(strstr(text, "{op=\"seal\",le=\"0.001\"} 0\n"
+                   "test_print_seconds_bucket{op=\"seal\",le=\"0.0025\"} 1\n")
+            != NULL);
+  CU_ASSERT(strstr(text, "{op=\"seal\",le=\"10\"} 1\n"
+                   "test_print_seconds_bucket{op=\"seal\",le=\"+Inf\"} 2\n"
+                   "test_print_seconds_sum{op=\"seal\"} 20.00") != NULL);
+  CU_ASSERT(strstr(text, "\ntest_print_seconds_count{op=\"seal\"} 2\n")
+            != NULL);
+  CU_ASSERT(strstr(text, "test_print_long_total") == NULL);
+  free(text);
+
+  metrics_test_stop(&sock);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_metrics_serve()
+//----------------------------------------------------------------------------
+void test_kmyth_metrics_serve(void)
+{
+  metrics_test_socket sock = { 0 };
+  char *response = NULL;
+
+  CU_ASSERT_FATAL(metrics_test_start(&sock) == 0);
+  kmyth_metrics_count("test_serve_total", NULL, "Served counter", 7);
+
+  // Check that an HTTP GET request gets an HTTP response
+  response = scrape_metrics(sock.path, "GET /metrics HTTP/1.1\r\n"
+                            "Host: localhost\r\n\r\n");
+  CU_ASSERT_FATAL(response != NULL);
+  CU_ASSERT(strncmp(response, "HTTP/1.0 200 OK\r\n", 17) == 0);
+  CU_ASSERT(strstr(response, "\r\n\r\n# HELP ") != NULL);
+  CU_ASSERT(strstr(response, "\ntest_serve_total 7\n") != NULL);
+  free(response);
+
+  // Check that a client sending no request gets the bare metrics
+  response = scrape_metrics(sock.path, NULL);
+  CU_ASSERT_FATAL(response != NULL);
+  CU_ASSERT(strncmp(response, "# HELP ", 7) == 0);
+  CU_ASSERT(strstr(response, "\ntest_serve_total 7\n") != NULL);
+  free(response);
+
+  // Check that the endpoint is gone once stopped
+  metrics_test_stop(&sock);
+  CU_ASSERT(scrape_metrics(sock.path, NULL) == NULL);
+}
@@ -7,6 +7,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <limits.h>
 #include <CUnit/CUnit.h>
@@ -30,6 +32,18 @@ int memory_util_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "Kmyth Locked Secret Memory Tests",
+                          test_kmyth_secure_alloc))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Kmyth Huge Page Tests",
+                          test_kmyth_huge_pages))
+  {
+    return 1;
+  }
+
 //  if (NULL == CU_add_test(suite, "Kmyth Secure Memory Set Tests",
 //                          test_secure_memset))
 //  {
@@ -81,6 +95,24 @@ void test_kmyth_clear(void)
   }
   CU_ASSERT(result);
 
+  // Clearing an unaligned, odd-sized range should clear exactly that range
+  for (int i = 0; i < tmp1_size; i++)
+  {
+    *(tmp1 + i) = 0xff;
+  }
+  kmyth_clear(tmp1 + 3, 37);
+  result = true;
+  for (int i = 0; i < tmp1_size; i++)
+  {
+    if (*(tmp1 + i) != ((i >= 3 && i < 40) ? 0 : 0xff))
+    {
+      result = false;
+      break;
+    }
+  }
+  CU_ASSERT(result);
+
+  free(tmp1);
 }
 
 //----------------------------------------------------------------------------
@@ -145,3 +177,118 @@ void test_secure_memset(void)
   }
   CU_ASSERT(result);
 }
+
+//----------------------------------------------------------------------------
+// test_kmyth_secure_alloc()
+//----------------------------------------------------------------------------
+void test_kmyth_secure_alloc(void)
+{
+  // A zero-sized block is refused
+  CU_ASSERT(kmyth_secure_alloc(0) == NULL);
+
+  // A block (not a multiple of the page size) is zero-filled and writable
+  size_t block_size = 5000;
+  unsigned char *block = kmyth_secure_alloc(block_size);
+
+  CU_ASSERT(block != NULL);
+  if (block == NULL)
+  {
+    return;
+  }
+
+  bool result = true;
+
+  for (size_t i = 0; i < block_size; i++)
+  {
+    if (block[i] != 0)
+    {
+      result = false;
+      break;
+    }
+    block[i] = 0x5a;
+  }
+  CU_ASSERT(result);
+
+  kmyth_secure_free(block, block_size);
+
+  // A freed block is wiped before it is handed out again, whatever size
+  // was passed when freeing it
+  for (int round = 0; round < 2; round++)
+  {
+    block = kmyth_secure_alloc(block_size);
+    CU_ASSERT_FATAL(block != NULL);
+    CU_ASSERT(((uintptr_t) block % sizeof(void *)) == 0);
+    result = true;
+    for (size_t i = 0; i < block_size; i++)
+    {
+      if (block[i] != 0)
+      {
+        result = false;
+        break;
+      }
+    }
+    CU_ASSERT(result);
+    memset(block, 0xa5, block_size);
+    kmyth_secure_free(block, 16);
+  }
+
+  // A block too large for the arena's size classes gets its own mapping
+  size_t large_size = 200 * 1024;
+
+  block = kmyth_secure_alloc(large_size);
+  CU_ASSERT_FATAL(block != NULL);
+  CU_ASSERT(block[0] == 0 && block[large_size - 1] == 0);
+  memset(block, 0x5a, large_size);
+  kmyth_secure_free(block, large_size);
+
+  // Test that kmyth_secure_free() for a NULL pointer does not crash
+  kmyth_secure_free(NULL, block_size);
+  CU_ASSERT(true);              // if execution reaches here, test did not crash
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_huge_pages()
+//----------------------------------------------------------------------------
+void test_kmyth_huge_pages(void)
+{
+  const char *initial = kmyth_huge_pages_name();
+
+  // An unknown mode is refused, leaving the mode unchanged
+  CU_ASSERT(kmyth_set_huge_pages((kmyth_huge_pages_t) 99) == 1);
+  CU_ASSERT(strcmp(kmyth_huge_pages_name(), initial) == 0);
+
+  // A large block is zero-filled and writable in every mode (explicit huge
+  // pages fall back to transparent ones where none are reserved)
+  kmyth_huge_pages_t modes[] = { KMYTH_HUGE_PAGES_OFF,
+    KMYTH_HUGE_PAGES_TRANSPARENT,
+    KMYTH_HUGE_PAGES_EXPLICIT
+  };
+  const char *names[] = { "off", "transparent", "explicit" };
+  size_t large_size = KMYTH_HUGE_PAGES_MIN_SIZE + 4096;
+
+  for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+  {
+    CU_ASSERT(kmyth_set_huge_pages(modes[i]) == 0);
+    CU_ASSERT(strcmp(kmyth_huge_pages_name(), names[i]) == 0);
+
+    unsigned char *block = kmyth_secure_alloc(large_size);
+
+    CU_ASSERT_FATAL(block != NULL);
+    CU_ASSERT(block[0] == 0 && block[large_size - 1] == 0);
+    memset(block, 0x5a, large_size);
+    kmyth_secure_free(block, large_size);
+
+    // Advising an ordinary buffer (large or small) is harmless
+    unsigned char *buf = malloc(large_size);
+
+    CU_ASSERT_FATAL(buf != NULL);
+    kmyth_advise_huge_pages(buf, large_size);
+    kmyth_advise_huge_pages(buf, 16);
+    memset(buf, 0xa5, large_size);
+    CU_ASSERT(buf[large_size - 1] == 0xa5);
+    free(buf);
+  }
+  kmyth_advise_huge_pages(NULL, large_size);
+
+  CU_ASSERT(kmyth_set_huge_pages(KMYTH_HUGE_PAGES_TRANSPARENT) == 0);
+}
@@ -0,0 +1,156 @@
+//############################################################################
+// secret_cache_test.c
+//
+// Tests for kmyth secret cache functions in utils/src/secret_cache.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <CUnit/CUnit.h>
+
+#include "secret_cache_test.h"
+#include "secret_cache.h"
+
+//----------------------------------------------------------------------------
+// secret_cache_add_tests()
+//----------------------------------------------------------------------------
+int secret_cache_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "Secret Cache Put/Get Tests",
+                          test_secret_cache_put_get))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Secret Cache Eviction Tests",
+                          test_secret_cache_eviction))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// cache_holds()
+//----------------------------------------------------------------------------
+static int cache_holds(secret_cache * cache, uint8_t id, const char *expected)
+{
+  uint8_t key[SECRET_CACHE_KEY_SIZE];
+  uint8_t *data = NULL;
+  size_t data_len = 0;
+
+  memset(key, id, SECRET_CACHE_KEY_SIZE);
+  if (secret_cache_get(cache, key, &data, &data_len))
+  {
+    return 0;
+  }
+
+  int result = (data_len == strlen(expected)
+                && memcmp(data, expected, data_len) == 0);
+
+  free(data);
+  return result;
+}
+
+//----------------------------------------------------------------------------
+// cache_put()
+//----------------------------------------------------------------------------
+static int cache_put(secret_cache * cache, uint8_t id, const char *data)
+{
+  uint8_t key[SECRET_CACHE_KEY_SIZE];
+
+  memset(key, id, SECRET_CACHE_KEY_SIZE);
+  return secret_cache_put(cache, key, (const uint8_t *) data, strlen(data));
+}
+
+//----------------------------------------------------------------------------
+// test_secret_cache_put_get()
+//----------------------------------------------------------------------------
+void test_secret_cache_put_get(void)
+{
+  secret_cache *cache = NULL;
+
+  // zero capacity, entries, or TTL are invalid
+  CU_ASSERT(secret_cache_new(0, 4, 60, &cache) == 1);
+  CU_ASSERT(secret_cache_new(64, 0, 60, &cache) == 1);
+  CU_ASSERT(secret_cache_new(64, 4, 0, &cache) == 1);
+
+  CU_ASSERT(secret_cache_new(64, 4, 60, &cache) == 0);
+  CU_ASSERT(cache != NULL);
+
+  // a miss, then hits for stored secrets
+  CU_ASSERT(cache_holds(cache, 1, "alpha") == 0);
+  CU_ASSERT(cache_put(cache, 1, "alpha") == 0);
+  CU_ASSERT(cache_put(cache, 2, "bravo") == 0);
+  CU_ASSERT(cache_holds(cache, 1, "alpha") == 1);
+  CU_ASSERT(cache_holds(cache, 2, "bravo") == 1);
+
+  // storing under an existing key replaces the secret
+  CU_ASSERT(cache_put(cache, 1, "alpha-2") == 0);
+  CU_ASSERT(cache_holds(cache, 1, "alpha-2") == 1);
+
+  // empty secrets, or ones larger than the arena, are not cached
+  uint8_t key[SECRET_CACHE_KEY_SIZE] = { 0 };
+  uint8_t big[65] = { 0 };
+
+  CU_ASSERT(secret_cache_put(cache, key, big, 0) == 1);
+  CU_ASSERT(secret_cache_put(cache, key, big, sizeof(big)) == 1);
+
+  // clearing drops everything
+  secret_cache_clear(cache);
+  CU_ASSERT(cache_holds(cache, 1, "alpha-2") == 0);
+  CU_ASSERT(cache_holds(cache, 2, "bravo") == 0);
+
+  secret_cache_free(&cache);
+  CU_ASSERT(cache == NULL);
+  secret_cache_free(&cache);
+}
+
+//----------------------------------------------------------------------------
+// test_secret_cache_eviction()
+//----------------------------------------------------------------------------
+void test_secret_cache_eviction(void)
+{
+  secret_cache *cache = NULL;
+
+  // arena full: 16 bytes hold two 8-byte secrets, storing a third drops
+  // the least recently used one (1, as 2 was read more recently)
+  CU_ASSERT(secret_cache_new(16, 8, 60, &cache) == 0);
+  CU_ASSERT(cache_put(cache, 1, "11111111") == 0);
+  CU_ASSERT(cache_put(cache, 2, "22222222") == 0);
+  CU_ASSERT(cache_holds(cache, 2, "22222222") == 1);
+  CU_ASSERT(cache_put(cache, 3, "33333333") == 0);
+  CU_ASSERT(cache_holds(cache, 1, "11111111") == 0);
+  CU_ASSERT(cache_holds(cache, 2, "22222222") == 1);
+  CU_ASSERT(cache_holds(cache, 3, "33333333") == 1);
+
+  // gaps left by replaced entries are compacted, so a secret that fits in
+  // the space left by the live entries is stored without evicting them
+  CU_ASSERT(cache_put(cache, 2, "2222") == 0);
+  CU_ASSERT(cache_put(cache, 4, "4444") == 0);
+  CU_ASSERT(cache_holds(cache, 2, "2222") == 1);
+  CU_ASSERT(cache_holds(cache, 3, "33333333") == 1);
+  CU_ASSERT(cache_holds(cache, 4, "4444") == 1);
+  secret_cache_free(&cache);
+
+  // entry table full: the least recently used entry is dropped
+  CU_ASSERT(secret_cache_new(64, 2, 60, &cache) == 0);
+  CU_ASSERT(cache_put(cache, 1, "one") == 0);
+  CU_ASSERT(cache_put(cache, 2, "two") == 0);
+  CU_ASSERT(cache_put(cache, 3, "three") == 0);
+  CU_ASSERT(cache_holds(cache, 1, "one") == 0);
+  CU_ASSERT(cache_holds(cache, 2, "two") == 1);
+  CU_ASSERT(cache_holds(cache, 3, "three") == 1);
+  secret_cache_free(&cache);
+
+  // expired entries are not served
+  CU_ASSERT(secret_cache_new(64, 2, 1, &cache) == 0);
+  CU_ASSERT(cache_put(cache, 1, "short-lived") == 0);
+  CU_ASSERT(cache_holds(cache, 1, "short-lived") == 1);
+  sleep(2);
+  CU_ASSERT(cache_holds(cache, 1, "short-lived") == 0);
+  secret_cache_free(&cache);
+}
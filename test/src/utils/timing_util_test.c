@@ -0,0 +1,99 @@
+//############################################################################
+// timing_util_test.c
+//
+// Tests for kmyth phase timing functions in utils/src/timing_util.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CUnit/CUnit.h>
+
+#include "timing_util_test.h"
+#include "timing_util.h"
+
+//----------------------------------------------------------------------------
+// timing_util_add_tests()
+//----------------------------------------------------------------------------
+int timing_util_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "Timer Begin/End Tests",
+                          test_kmyth_timer_begin_end))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Phase Name Tests", test_kmyth_phase_name))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_timer_begin_end()
+//----------------------------------------------------------------------------
+void test_kmyth_timer_begin_end(void)
+{
+  uint64_t calls = 1;
+  uint64_t duration_ns = 1;
+
+  kmyth_timings_reset();
+
+  // while disabled (and with the tests' default log threshold), timers
+  // are not started and completing them records nothing
+  kmyth_timings_enable(false);
+  uint64_t timer = kmyth_timer_begin();
+
+  CU_ASSERT(timer == 0);
+  kmyth_timer_end(KMYTH_PHASE_ENCRYPT, timer);
+  kmyth_timings_get(KMYTH_PHASE_ENCRYPT, &calls, &duration_ns);
+  CU_ASSERT(calls == 0);
+  CU_ASSERT(duration_ns == 0);
+
+  // once enabled, each completed timer adds to its phase's totals only
+  kmyth_timings_enable(true);
+  timer = kmyth_timer_begin();
+  CU_ASSERT(timer != 0);
+  kmyth_timer_end(KMYTH_PHASE_ENCRYPT, timer);
+  kmyth_timer_end(KMYTH_PHASE_ENCRYPT, kmyth_timer_begin());
+
+  kmyth_timings_get(KMYTH_PHASE_ENCRYPT, &calls, &duration_ns);
+  CU_ASSERT(calls == 2);
+  kmyth_timings_get(KMYTH_PHASE_DECRYPT, &calls, &duration_ns);
+  CU_ASSERT(calls == 0);
+  CU_ASSERT(duration_ns == 0);
+
+  // invalid phases are ignored, and report empty totals
+  kmyth_timer_end(KMYTH_PHASE_COUNT, kmyth_timer_begin());
+  kmyth_timings_get(KMYTH_PHASE_COUNT, &calls, &duration_ns);
+  CU_ASSERT(calls == 0);
+  CU_ASSERT(duration_ns == 0);
+
+  // a reset clears every phase
+  kmyth_timings_reset();
+  kmyth_timings_get(KMYTH_PHASE_ENCRYPT, &calls, &duration_ns);
+  CU_ASSERT(calls == 0);
+  CU_ASSERT(duration_ns == 0);
+
+  kmyth_timings_enable(false);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_phase_name()
+//----------------------------------------------------------------------------
+void test_kmyth_phase_name(void)
+{
+  CU_ASSERT(strcmp(kmyth_phase_name(KMYTH_PHASE_STORAGE_KEY),
+                   "storage key") == 0);
+  CU_ASSERT(strcmp(kmyth_phase_name(KMYTH_PHASE_NETWORK), "network") == 0);
+
+  // every valid phase is named
+  for (int i = 0; i < KMYTH_PHASE_COUNT; i++)
+  {
+    CU_ASSERT(strcmp(kmyth_phase_name((kmyth_phase) i), "unknown") != 0);
+  }
+
+  CU_ASSERT(strcmp(kmyth_phase_name(KMYTH_PHASE_COUNT), "unknown") == 0);
+}
@@ -0,0 +1,108 @@
+/**
+ * @file  base64_codec.h
+ *
+ * @brief Provides the base64 codec used for Kmyth block file (.ski, .nkl)
+ *        contents, with vectorized (AVX2 or NEON) implementations selected
+ *        at runtime and a portable scalar fallback.
+ *
+ * Encoded output uses the same layout as the OpenSSL base64 BIO filter it
+ * replaces: the standard alphabet with '=' padding, broken into lines of
+ * (at most) 64 characters, each terminated by a newline. The decoder ignores
+ * ASCII whitespace anywhere in its input.
+ */
+
+#ifndef BASE64_CODEC_H
+#define BASE64_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Number of base64 characters on each full line of encoded output.
+#define BASE64_LINE_LEN 64
+
+/**
+ * @brief Identifies a base64 codec implementation.
+ */
+typedef enum base64_codec_t
+{
+  BASE64_CODEC_AUTO = 0,        ///< best implementation the CPU supports
+  BASE64_CODEC_SCALAR,          ///< portable table-driven implementation
+  BASE64_CODEC_AVX2,            ///< x86-64 AVX2 implementation
+  BASE64_CODEC_NEON,            ///< AArch64 NEON implementation
+} base64_codec_t;
+
+/**
+ * @brief Selects the codec implementation used by base64_encode() and
+ *        base64_decode(). The best supported implementation is selected
+ *        automatically on first use; this is only needed to force a
+ *        particular one (e.g., for testing or benchmarking). Safe to call
+ *        while other threads are encoding or decoding; each call uses
+ *        whichever implementation was selected when it started.
+ *
+ * @param[in]  codec  The implementation to use
+ *
+ * @return 0 on success, 1 if the implementation is not supported by this
+ *         build or CPU, or is excluded by the kmyth_cpu_set_limit() limit
+ *         (the current selection is left unchanged)
+ */
+int base64_set_codec(base64_codec_t codec);
+
+/**
+ * @brief Returns the name ("avx2", "neon", or "scalar") of the codec
+ *        implementation currently in use.
+ *
+ * @return Codec name string (static, must not be freed)
+ */
+const char *base64_codec_name(void);
+
+/**
+ * @brief Computes the exact size of the encoded form of a raw input,
+ *        including line-terminating newlines.
+ *
+ * @param[in]  raw_size  Size, in bytes, of the raw input
+ *
+ * @return Encoded size, in bytes
+ */
+size_t base64_encoded_size(size_t raw_size);
+
+/**
+ * @brief Base64 encodes raw bytes into a caller supplied buffer.
+ *
+ * @param[in]  raw_data      The raw input bytes
+ *
+ * @param[in]  raw_size      Size, in bytes, of raw_data
+ *
+ * @param[out] base64_data   Output buffer - must hold at least
+ *                           base64_encoded_size(raw_size) bytes
+ *
+ * @return Number of bytes written to base64_data
+ */
+size_t base64_encode(const uint8_t * raw_data, size_t raw_size,
+                     uint8_t * base64_data);
+
+/**
+ * @brief Base64 decodes into a caller supplied buffer.
+ *
+ * @param[in]  base64_data   The encoded input
+ *
+ * @param[in]  base64_size   Size, in bytes, of base64_data
+ *
+ * @param[out] raw_data      Output buffer - must hold at least
+ *                           (base64_size / 4) * 3 + 3 bytes
+ *
+ * @param[out] raw_size      Number of decoded bytes written to raw_data
+ *
+ * @return 0 on success, 1 if the input is not valid base64
+ */
+int base64_decode(const uint8_t * base64_data, size_t base64_size,
+                  uint8_t * raw_data, size_t * raw_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BASE64_CODEC_H */
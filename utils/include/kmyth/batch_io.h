@@ -0,0 +1,118 @@
+/**
+ * @file  batch_io.h
+ *
+ * @brief Provides batched reads and writes of many small files (e.g., the
+ *        inputs and .ski outputs of a bulk seal), which are submitted to
+ *        the kernel together through io_uring where it is available.
+ *
+ * Batching saves a system call (and a wait) per read, write and fsync:
+ * the reads or writes of up to BATCH_IO_DEPTH files are submitted at once,
+ * then the fsyncs of all the files written, so that the filesystem can
+ * commit them together. Files are still opened, checked and closed one at
+ * a time.
+ *
+ * Where io_uring is not available (a kernel without it, a container whose
+ * seccomp policy refuses it, or a memlock limit too low for the ring), the
+ * files are read with read_bytes_from_file() and written one at a time
+ * instead, with the same results. io_uring can also be turned off with the
+ * KMYTH_IO_URING environment variable ("0"), or with batch_io_set_engine().
+ */
+
+#ifndef BATCH_IO_H
+#define BATCH_IO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Largest number of files whose reads or writes are submitted to
+ *        the kernel together
+ */
+#define BATCH_IO_DEPTH 64
+
+/**
+ * @brief Identifies a batch I/O engine.
+ */
+typedef enum batch_io_engine_t
+{
+  BATCH_IO_ENGINE_AUTO = 0,     ///< io_uring where available, else sync
+  BATCH_IO_ENGINE_SYNC,         ///< one read or write system call at a time
+  BATCH_IO_ENGINE_IO_URING,     ///< io_uring submission and completion queues
+} batch_io_engine_t;
+
+/**
+ * @brief Selects the engine used by read_files_batch() and
+ *        write_files_batch().
+ *
+ * @param[in]  engine  The engine to use
+ *
+ * @return 0 on success, 1 if the engine is not available on this system
+ *         (the current engine is left unchanged)
+ */
+int batch_io_set_engine(batch_io_engine_t engine);
+
+/**
+ * @brief Returns the name ("io_uring" or "sync") of the engine in use.
+ *
+ * @return Engine name (a static string)
+ */
+const char *batch_io_engine_name(void);
+
+/**
+ * @brief Reads the contents of a list of files, as read_bytes_from_file()
+ *        would read each of them.
+ *
+ * @param[in]  paths    Paths of the files to read
+ *
+ * @param[in]  count    Number of files
+ *
+ * @param[out] data     Array (of count entries, supplied by the caller)
+ *                      receiving the contents of each file, which the
+ *                      caller must free. An entry is NULL for an empty
+ *                      file or one that could not be read.
+ *
+ * @param[out] lengths  Array (of count entries) receiving the size, in
+ *                      bytes, of each file's contents
+ *
+ * @param[out] results  Array (of count entries) receiving 0 for each file
+ *                      read, 1 for each that could not be (NULL if not
+ *                      needed)
+ *
+ * @return 0 if every file was read, 1 otherwise
+ */
+int read_files_batch(char **paths, size_t count, uint8_t ** data,
+                     size_t *lengths, int *results);
+
+/**
+ * @brief Writes a list of files, as write_bytes_to_file() would write each
+ *        of them, optionally making them durable.
+ *
+ * @param[in]  paths    Paths of the files to write
+ *
+ * @param[in]  bytes    Bytes to be written to each file
+ *
+ * @param[in]  lengths  Number of bytes to be written to each file
+ *
+ * @param[in]  count    Number of files
+ *
+ * @param[in]  sync     Whether to fsync each file written before closing it
+ *
+ * @param[out] results  Array (of count entries) receiving 0 for each file
+ *                      written, 1 for each that could not be (NULL if not
+ *                      needed)
+ *
+ * @return 0 if every file was written, 1 otherwise
+ */
+int write_files_batch(char **paths, uint8_t ** bytes, size_t *lengths,
+                      size_t count, bool sync, int *results);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BATCH_IO_H */
@@ -0,0 +1,146 @@
+/**
+ * @file  byte_builder.h
+ *
+ * @brief Provides a fixed-capacity byte buffer builder for Kmyth serialized
+ *        formats (.ski/.nkl files, NSL protocol messages).
+ *
+ * The caller computes the final size of the output up front and allocates
+ * it once with byte_builder_init(). The sections of the output are then
+ * written in place, in order - either copied (byte_builder_append()) or
+ * produced directly in the buffer (byte_builder_reserve()) - so no section
+ * is copied more than once and the buffer is never reallocated.
+ */
+
+#ifndef BYTE_BUILDER_H
+#define BYTE_BUILDER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief State of an output buffer under construction.
+ */
+typedef struct byte_builder
+{
+  /// @brief start of the output buffer
+  uint8_t *buffer;
+
+  /// @brief size, in bytes, allocated for the output buffer
+  size_t capacity;
+
+  /// @brief number of bytes written so far
+  size_t length;
+
+  /// @brief true if the buffer was provided by the caller
+  ///        (see byte_builder_init_external()) and must not be freed
+  bool external;
+} byte_builder;
+
+/**
+ * @brief Allocates the output buffer of a byte builder.
+ *
+ * @param[out] builder   The builder to initialize
+ *
+ * @param[in]  capacity  Final size, in bytes, of the output (must be
+ *                       non-zero)
+ *
+ * @return 0 on success, 1 on error
+ */
+int byte_builder_init(byte_builder * builder, size_t capacity);
+
+/**
+ * @brief Initializes a byte builder to write into a caller-provided buffer
+ *        (e.g., memory the caller reuses or has mapped), instead of
+ *        allocating one. byte_builder_finish() then hands back that same
+ *        buffer, and byte_builder_free() clears it without freeing it.
+ *
+ * @param[out] builder   The builder to initialize
+ *
+ * @param[in]  buffer    The output buffer
+ *
+ * @param[in]  capacity  Size, in bytes, of buffer (must be non-zero)
+ *
+ * @return 0 on success, 1 on error
+ */
+int byte_builder_init_external(byte_builder * builder, uint8_t * buffer,
+                               size_t capacity);
+
+/**
+ * @brief Copies bytes to the end of the output under construction.
+ *
+ * @param[in/out] builder   The builder to write to
+ *
+ * @param[in]     data      The bytes to be written
+ *
+ * @param[in]     data_len  Number of bytes in data
+ *
+ * @return 0 on success, 1 on error (data would exceed the capacity)
+ */
+int byte_builder_append(byte_builder * builder, const void *data,
+                        size_t data_len);
+
+/**
+ * @brief Writes a length-prefixed field (native size_t length, followed by
+ *        the bytes) to the end of the output under construction. This is
+ *        the field encoding used by the NSL protocol messages.
+ *
+ * @param[in/out] builder   The builder to write to
+ *
+ * @param[in]     data      The field bytes to be written
+ *
+ * @param[in]     data_len  Number of bytes in data
+ *
+ * @return 0 on success, 1 on error (field would exceed the capacity)
+ */
+int byte_builder_append_sized(byte_builder * builder, const void *data,
+                              size_t data_len);
+
+/**
+ * @brief Claims space at the end of the output under construction, so a
+ *        section can be produced directly in the output buffer.
+ *
+ * @param[in/out] builder   The builder to write to
+ *
+ * @param[in]     len       Number of bytes to claim
+ *
+ * @return Pointer to the claimed space (len bytes, which the caller must
+ *         fill), or NULL if it would exceed the capacity
+ */
+uint8_t *byte_builder_reserve(byte_builder * builder, size_t len);
+
+/**
+ * @brief Passes ownership of the completed output to the caller. The
+ *        builder is left empty.
+ *
+ * @param[in/out] builder        The builder holding the output
+ *
+ * @param[out]    output         The output buffer (to be freed by caller)
+ *
+ * @param[out]    output_length  Number of bytes written to output
+ *
+ * @return None
+ */
+void byte_builder_finish(byte_builder * builder, uint8_t ** output,
+                         size_t * output_length);
+
+/**
+ * @brief Clears and frees the output buffer of a byte builder that is
+ *        being abandoned (e.g., on an error path). A caller-provided buffer
+ *        is cleared but not freed. The builder is left empty.
+ *
+ * @param[in/out] builder  The builder to be released
+ *
+ * @return None
+ */
+void byte_builder_free(byte_builder * builder);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BYTE_BUILDER_H */
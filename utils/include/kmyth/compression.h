@@ -0,0 +1,132 @@
+/**
+ * @file  compression.h
+ *
+ * @brief Provides the compression Kmyth can apply to data before it is
+ *        encrypted (see kmyth_tpm_context_set_compression()), both to
+ *        whole buffers and to streams.
+ *
+ * Compressed data is a zstd frame, produced and consumed one block at a
+ * time, so a stream is compressed (or decompressed) in bounded memory as
+ * it passes through. The stream wrappers are stdio streams (see
+ * fopencookie(3)), so they can be handed to anything that reads or writes
+ * a FILE, such as a cipher's encrypt_stream_fn and decrypt_stream_fn.
+ */
+
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "kmyth.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Looks up a compression algorithm by name ("none" or "zstd").
+ *
+ * @param[in]  name         Name of the compression algorithm
+ *
+ * @param[out] compression  The compression algorithm
+ *
+ * @return 0 on success, 1 if the name is not recognized
+ */
+int kmyth_compression_from_string(const char *name,
+                                  kmyth_compression * compression);
+
+/**
+ * @brief Returns the name of a compression algorithm.
+ *
+ * @param[in]  compression  The compression algorithm
+ *
+ * @return Name string (static, must not be freed), or NULL if the
+ *         algorithm is not recognized
+ */
+const char *kmyth_compression_name(kmyth_compression compression);
+
+/**
+ * @brief Compresses a buffer.
+ *
+ * @param[in]  compression  Compression algorithm (not
+ *                          KMYTH_COMPRESSION_NONE)
+ *
+ * @param[in]  input        Data to be compressed
+ *
+ * @param[in]  input_len    Number of bytes in input
+ *
+ * @param[out] output       The compressed data (allocated here, to be
+ *                          freed by the caller)
+ *
+ * @param[out] output_len   Number of bytes in output
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_compress_data(kmyth_compression compression,
+                        uint8_t * input, size_t input_len,
+                        uint8_t ** output, size_t * output_len);
+
+/**
+ * @brief Decompresses a buffer produced by kmyth_compress_data() or
+ *        kmyth_compress_reader(). As the output is typically plaintext,
+ *        any intermediate buffer is cleared before it is freed.
+ *
+ * @param[in]  compression  Compression algorithm the data was compressed
+ *                          with (not KMYTH_COMPRESSION_NONE)
+ *
+ * @param[in]  input        Compressed data
+ *
+ * @param[in]  input_len    Number of bytes in input
+ *
+ * @param[out] output       The decompressed data (allocated here, to be
+ *                          cleared and freed by the caller)
+ *
+ * @param[out] output_len   Number of bytes in output
+ *
+ * @return 0 on success, 1 on error (including truncated or trailing data)
+ */
+int kmyth_decompress_data(kmyth_compression compression,
+                          uint8_t * input, size_t input_len,
+                          uint8_t ** output, size_t * output_len);
+
+/**
+ * @brief Opens a read-only stream yielding the compressed form of the
+ *        data read from another stream, which is read (in blocks) only as
+ *        the compressed data is consumed. An error reading or compressing
+ *        the source is reported by ferror() on the returned stream.
+ *
+ * @param[in]  source       Stream of data to be compressed (not closed
+ *                          with the returned stream)
+ *
+ * @param[in]  compression  Compression algorithm (not
+ *                          KMYTH_COMPRESSION_NONE)
+ *
+ * @return The compressed stream (to be closed with fclose()), or NULL on
+ *         error
+ */
+FILE *kmyth_compress_reader(FILE * source, kmyth_compression compression);
+
+/**
+ * @brief Opens a write-only stream that decompresses the data written to
+ *        it, writing the result (in blocks) to another stream. fclose()
+ *        on the returned stream fails if the compressed data written was
+ *        incomplete, or if writing to the destination failed.
+ *
+ * @param[in]  dest         Stream the decompressed data is written to
+ *                          (not closed with the returned stream)
+ *
+ * @param[in]  compression  Compression algorithm the data was compressed
+ *                          with (not KMYTH_COMPRESSION_NONE)
+ *
+ * @return The decompressing stream (to be closed with fclose()), or NULL
+ *         on error
+ */
+FILE *kmyth_decompress_writer(FILE * dest, kmyth_compression compression);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,84 @@
+/**
+ * @file  config_file.h
+ *
+ * @brief Provides the Kmyth configuration file, which supplies default
+ *        command line options to the Kmyth tools so that scripts making
+ *        repeated invocations need not repeat them.
+ *
+ * The file (KMYTH_CONFIG_FILE, or the path in $KMYTH_CONFIG) is made up of
+ * sections, each holding settings named after the tools' long options:
+ *
+ *     # applies to every tool
+ *     [default]
+ *     tcti = device:/dev/tpmrm0
+ *     srk_handle = 0x81000001
+ *
+ *     # applies to kmyth-seal only
+ *     [kmyth-seal]
+ *     pcrs_list = 0, 7
+ *
+ *     # applies when $KMYTH_PROFILE is "prod"
+ *     [prod]
+ *     param_enc = yes
+ *
+ * A tool applies the [default] section, then the section named after the
+ * tool, then the section of the selected profile. Each setting is given to
+ * the tool as if it came before its command line options, so:
+ *
+ *   - for an option taking a single value, a later setting (or a command
+ *     line option) overrides an earlier one;
+ *   - an option that may be repeated (e.g., kmyth-unsealerd's allow_uid and
+ *     allow_gid) collects every value given, configured ones first: the
+ *     command line adds to the configured values and cannot remove them;
+ *   - an option without an argument is enabled by "yes", "true", "1" or no
+ *     value, and left alone by "no", "false" or "0". Once a section enables
+ *     it, neither a later section nor the command line can turn it off;
+ *     select another profile, or set $KMYTH_CONFIG to "" to run without the
+ *     file.
+ *
+ * Settings for options a tool does not have are ignored, so one file can
+ * serve all of them.
+ *
+ * The file, and the directory holding it, must be owned by root or by the
+ * user running the tool and must not be writable by other users. A file
+ * holding an authorization value (auth_string, owner_auth or old_auth) must
+ * not be readable by other users either.
+ */
+
+#ifndef CONFIG_FILE_H
+#define CONFIG_FILE_H
+
+#include <getopt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Inserts the options configured for a tool in the Kmyth
+ *        configuration file ahead of its command line options. A missing
+ *        configuration file is not an error.
+ *
+ * @param[in]     longopts  The tool's getopt_long() option table
+ *
+ * @param[in,out] argc      The tool's argument count
+ *
+ * @param[in,out] argv      The tool's argument vector (argv[0] names the
+ *                          tool). It is replaced with a new vector, which
+ *                          (like the strings added to it) stays allocated
+ *                          for the life of the process, as getopt_long()
+ *                          hands out pointers into it.
+ *
+ * @return 0 on success, 1 on error (e.g., a malformed configuration file,
+ *         one (or one in a directory) that other users may change, one
+ *         other users may read holding an authorization value, or an
+ *         unknown profile)
+ */
+int kmyth_config_apply(const struct option *longopts, int *argc,
+                       char ***argv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CONFIG_FILE_H */
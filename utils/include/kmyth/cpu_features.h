@@ -0,0 +1,96 @@
+/**
+ * @file  cpu_features.h
+ *
+ * @brief Provides runtime detection of the instruction set extensions that
+ *        Kmyth's vectorized kernels (e.g., the base64 codec) are built for,
+ *        so that one portable build selects the fastest implementation the
+ *        host CPU supports.
+ *
+ * The CPU is probed once, when the library is loaded. Kernels with more
+ * than one implementation check kmyth_cpu_has() when choosing which to use,
+ * rather than probing the CPU themselves. The features reported can be
+ * limited, for testing or to work around a problem with one implementation,
+ * with the KMYTH_CPU_FEATURES environment variable (read when the library
+ * is loaded) or with kmyth_cpu_set_limit(). A limit only ever removes
+ * features: it never enables one the CPU does not support.
+ *
+ * The AES and hashing kernels Kmyth uses come from OpenSSL, which does its
+ * own dispatch (configurable with OPENSSL_ia32cap or OPENSSL_armcap).
+ */
+
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Instruction set extensions, as bit flags, that Kmyth kernels may
+ *        be specialized for.
+ */
+typedef enum kmyth_cpu_feature
+{
+  KMYTH_CPU_SSE2 = 1 << 0,      ///< x86 SSE2
+  KMYTH_CPU_SSSE3 = 1 << 1,     ///< x86 SSSE3
+  KMYTH_CPU_SSE4_1 = 1 << 2,    ///< x86 SSE4.1
+  KMYTH_CPU_SSE4_2 = 1 << 3,    ///< x86 SSE4.2
+  KMYTH_CPU_AVX2 = 1 << 4,      ///< x86 AVX2
+  KMYTH_CPU_AVX512F = 1 << 5,   ///< x86 AVX-512 foundation
+  KMYTH_CPU_AVX512BW = 1 << 6,  ///< x86 AVX-512 byte and word instructions
+  KMYTH_CPU_AESNI = 1 << 7,     ///< x86 AES-NI
+  KMYTH_CPU_NEON = 1 << 8,      ///< ARM NEON (Advanced SIMD)
+} kmyth_cpu_feature;
+
+/**
+ * @brief Returns the features that Kmyth kernels may use: those supported
+ *        by the CPU, less any removed by the current limit.
+ *
+ * @return Bitwise OR of kmyth_cpu_feature flags
+ */
+uint32_t kmyth_cpu_features(void);
+
+/**
+ * @brief Checks whether Kmyth kernels may use a set of features.
+ *
+ * @param[in]  features  Bitwise OR of the kmyth_cpu_feature flags required
+ *
+ * @return true if every one of the features may be used, false otherwise
+ */
+bool kmyth_cpu_has(uint32_t features);
+
+/**
+ * @brief Limits the features reported by kmyth_cpu_features() to those of
+ *        an instruction set level, replacing any earlier limit (including
+ *        one from the KMYTH_CPU_FEATURES environment variable).
+ *
+ * The levels are "scalar" (no features), "sse4.2" (SSE2 through SSE4.2 and
+ * AES-NI), "avx2" (adds AVX2), "avx512" (adds AVX-512F and AVX-512BW) and
+ * "neon"; "native" (or NULL) removes the limit. Kernels that have already
+ * chosen an implementation keep it until asked to choose again (e.g., with
+ * base64_set_codec(BASE64_CODEC_AUTO)).
+ *
+ * @param[in]  level  Name of the level to limit the features to
+ *
+ * @return 0 on success, 1 if the level is not recognized (the current
+ *         limit is left unchanged)
+ */
+int kmyth_cpu_set_limit(const char *level);
+
+/**
+ * @brief Returns the name of the highest instruction set level (as
+ *        accepted by kmyth_cpu_set_limit(), other than "native") whose
+ *        features may all be used.
+ *
+ * @return Level name string (static, must not be freed)
+ */
+const char *kmyth_cpu_level_name(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -8,9 +8,12 @@
 #ifndef FILE_IO_H
 #define FILE_IO_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+#include <sys/types.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -38,7 +41,8 @@ int verifyOutputFilePath(char *path);
 /**
  * @brief Reads raw bytes from a file, located at input_path,
  *        and stores them in the data buffer passed in. If input_path
- *        is an empty file, returns NULL pointer as data.
+ *        is an empty file, returns NULL pointer as data. For large inputs
+ *        that are only read, see map_bytes_from_file().
  * 
  * @param[in]  input_path  String representing the path to the file being read
  *
@@ -59,6 +63,40 @@ int verifyOutputFilePath(char *path);
 int read_bytes_from_file(char *input_path, uint8_t ** data,
                          size_t * data_length);
 
+/**
+ * @brief Maps the contents of a file, located at input_path, read-only into
+ *        memory. Unlike read_bytes_from_file(), no heap copy is made: the
+ *        returned buffer refers directly to the file's page cache pages, so
+ *        large inputs can be consumed without doubling their memory cost.
+ *        If input_path is an empty file, returns NULL pointer as data.
+ *
+ * @param[in]  input_path  String representing the path to the file being read
+ *
+ * @param[out] data        Read-only view of the file contents - passed as a
+ *                         pointer to the buffer. Must be released with
+ *                         unmap_bytes_from_file() (never free()) and must not
+ *                         be written to. NULL if input_path points to an
+ *                         empty file.
+ *
+ * @param[out] data_length The size, in bytes, of the mapped data -
+ *                         passed as a pointer to the length value
+ *
+ * @return 0 if success, 1 if error
+ */
+int map_bytes_from_file(char *input_path, uint8_t ** data,
+                        size_t * data_length);
+
+/**
+ * @brief Releases a mapping created by map_bytes_from_file().
+ *
+ * @param[in]  data        Mapped data buffer (NULL is ignored)
+ *
+ * @param[in]  data_length The size, in bytes, of the mapped data
+ *
+ * @return None
+ */
+void unmap_bytes_from_file(uint8_t * data, size_t data_length);
+
 /**
  * @brief Verifies output_path is valid, then writes bytes to file
  * 
@@ -74,6 +112,126 @@ int read_bytes_from_file(char *input_path, uint8_t ** data,
 int write_bytes_to_file(char *output_path,
                         uint8_t * bytes, size_t bytes_length);
 
+/**
+ * @brief Writes bytes to a new file, which must not already exist (so a
+ *        file or link planted at output_path is never written through),
+ *        and syncs it to disk. A partially written file is removed.
+ *
+ * @param[in]  output_path     Path of the file to be created
+ *
+ * @param[in]  bytes           Bytes to be written (may be NULL if
+ *                             bytes_length is 0)
+ *
+ * @param[in]  bytes_length    Number of bytes to be written
+ *
+ * @param[in]  mode            Permissions of the new file (subject to the
+ *                             umask), e.g. 0600 for one holding secrets
+ *
+ * @return 0 if success, 1 if error
+ */
+int write_bytes_to_new_file(const char *output_path, const uint8_t * bytes,
+                            size_t bytes_length, mode_t mode);
+
+/**
+ * @brief Creates a directory readable and writable only by its owner, or
+ *        checks that an existing one can be trusted to hold files only
+ *        this user put there: it must be a directory (not a symbolic link
+ *        to one), owned by the effective user, and not writable by group
+ *        or others.
+ *
+ * @param[in]  path            Path of the directory
+ *
+ * @return 0 if success, 1 if error (including an untrusted directory)
+ */
+int make_private_dir(const char *path);
+
+/**
+ * @brief Appends the regular files (following symbolic links) in a
+ *        directory to a list of paths, in name order. Sub-directories and
+ *        other special files are skipped.
+ *
+ * @param[in]     dir_path    Path of the directory
+ *
+ * @param[in]     suffix      If not NULL, only files whose names end in it
+ *                            (e.g. ".ski"), and are longer than it, are
+ *                            listed
+ *
+ * @param[in/out] paths       List of paths (allocated by the caller, or
+ *                            NULL) that is grown to hold the new ones. The
+ *                            caller must free it and each path in it.
+ *
+ * @param[in/out] path_count  Number of paths in the list
+ *
+ * @return 0 if success, 1 if error
+ */
+int append_dir_files(const char *dir_path, const char *suffix,
+                     char ***paths, size_t *path_count);
+
+/**
+ * @brief Names the output of each input <name>.ski as <out_dir>/<name>,
+ *        refusing outputs that already exist (unless forced) or that
+ *        clash with each other, so that nothing is unsealed into place
+ *        until all of them are known to be good.
+ *
+ * @param[in]  paths       Paths of the .ski files
+ *
+ * @param[in]  path_count  Number of paths
+ *
+ * @param[in]  out_dir     Directory the outputs are written to
+ *
+ * @param[in]  force       true to allow outputs that already exist to be
+ *                         overwritten
+ *
+ * @param[out] out_paths   Array (of path_count entries, initially NULL)
+ *                         that receives the output paths. On error, it
+ *                         may hold some, which the caller must free too.
+ *
+ * @return 0 if success, 1 if error
+ */
+int derive_unsealed_paths(char **paths, size_t path_count,
+                          const char *out_dir, bool force, char **out_paths);
+
+/**
+ * @brief Writes bytes to a new anonymous memory file, to be handed to
+ *        another process by file descriptor (e.g., inherited across exec,
+ *        or passed over a local socket) instead of through the filesystem.
+ *
+ * The file is a memfd_secret(2) where the kernel supports it, so that its
+ * pages are kept out of the kernel's direct map and are never swapped out.
+ * Otherwise it is a memfd(2), sealed so that it can no longer be written,
+ * resized, or resealed. Either one can only be read by mapping it (see
+ * map_bytes_from_secret_fd()); a memfd_secret cannot be read with read(2).
+ *
+ * @param[in]  bytes           Bytes to be written (may be NULL if
+ *                             bytes_length is 0)
+ *
+ * @param[in]  bytes_length    Number of bytes to be written
+ *
+ * @param[out] fd              The new file descriptor (close-on-exec),
+ *                             which the caller must close
+ *
+ * @return 0 if success, 1 if error
+ */
+int write_bytes_to_secret_fd(const uint8_t * bytes, size_t bytes_length,
+                             int *fd);
+
+/**
+ * @brief Maps the contents of a memory file created by
+ *        write_bytes_to_secret_fd() read-only into memory, without copying
+ *        them. If the file is empty, returns NULL pointer as data.
+ *
+ * @param[in]  fd          The memory file's descriptor (which may be closed
+ *                         once the file is mapped)
+ *
+ * @param[out] data        Read-only view of the file contents. Must be
+ *                         released with unmap_bytes_from_file().
+ *
+ * @param[out] data_length The size, in bytes, of the mapped data
+ *
+ * @return 0 if success, 1 if error
+ */
+int map_bytes_from_secret_fd(int fd, uint8_t ** data, size_t * data_length);
+
 /**
  * @brief Prints raw bytes to standard out.
  * 
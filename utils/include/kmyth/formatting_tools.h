@@ -72,6 +72,15 @@ extern "C" {
  */
 #define KMYTH_DELIM_ENC_DATA "-----ENC DATA-----\n"
 
+/** 
+ * @ingroup block_delim
+ *
+ * @brief   Indicates the start of a multi-payload (bundle) encrypted data
+ *          block, used in place of ENC DATA when several inputs are sealed
+ *          under one storage key and wrapping key
+ */
+#define KMYTH_DELIM_BUNDLE_DATA "-----BUNDLE DATA-----\n"
+
 /** 
  * @ingroup block_delim
  *
@@ -93,6 +102,54 @@ extern "C" {
  */
 #define KMYTH_DELIM_END_NKL "-----NKL END-----\n"
 
+/**
+ * @ingroup block_delim
+ *
+ * @brief   Common prefix of every block delimiter. Base64 block contents
+ *          never contain it, so it can be used to find the end of a block
+ *          without knowing which delimiter follows.
+ */
+#define KMYTH_DELIM_PREFIX "-----"
+
+/**
+ * @brief Locates the next "block" in the data read from a block file, if the
+ *        delimiter for the current file block matches the expected delimiter
+ *        value. Unlike get_block_bytes(), no copy is made: the block is
+ *        returned as a view into the contents buffer.
+ *
+ * @param[in/out] contents   Data buffer containing the contents (or partial
+ *                           contents) of a .ski file - passed as a pointer
+ *                           to the address of the data buffer (updated by
+ *                           this function)
+ *
+ * @param[in/out] remaining  Count of bytes remaining in data buffer -
+ *                           passed as a pointer to the count value (updated by
+ *                           this function)
+ *
+ * @param[out] block         Set to the start of the block contents, within
+ *                           the contents buffer (must not be freed)
+ *
+ * @param[out] blocksize     Size, in bytes, of the block -
+ *                           passed as a pointer to the length value
+ *
+ * @param[in]  delim         String value representing the expected delimiter
+ *
+ * @param[in]  delim_len     Length of the expected delimeter
+ *
+ * @param[in]  next_delim    String value representing the next expected
+ *                           delimiter (or KMYTH_DELIM_PREFIX to stop at
+ *                           whichever delimiter comes next)
+ *
+ * @param[in]  next_delim_len Length of the next expected delimeter
+ *
+ * @return 0 on success, 1 on failure
+ */
+int get_block_view(uint8_t ** contents,
+                   size_t * remaining,
+                   uint8_t ** block, size_t * blocksize,
+                   char *delim, size_t delim_len,
+                   char *next_delim, size_t next_delim_len);
+
 /**
  * @brief Retrieves the contents of the next "block" in the data read from a 
  *         block file, if the delimiter for the current file block matches the
@@ -41,11 +41,11 @@ void kmyth_clear(void *v, size_t size);
 void kmyth_clear_and_free(void *v, size_t size);
 
 /**
- * Clears the contents of a pointer, without running into issues of gcc optimizing around memset. 
- * Implementation obtained from:
- *    open-std WG 15 Document: N1381
- *    http://www.open-std.org/jtc1/sc22/wg14/www/docs/n1381.pdf
- *    
+ * Clears the contents of a pointer, without running into issues of gcc optimizing around memset
+ * (see open-std WG 14 Document N1381: http://www.open-std.org/jtc1/sc22/wg14/www/docs/n1381.pdf).
+ * The memset() is followed by a compiler barrier, so it keeps the speed of the C library's
+ * word-wide stores while never being removed as a dead store.
+ *
  * @param[in] v The pointer containing contents to clear
  * @param[in] c The value to fill the array with
  * @param[in] n The size of the array
@@ -54,6 +54,99 @@ void kmyth_clear_and_free(void *v, size_t size);
  */
 void *secure_memset(void *v, int c, size_t n);
 
+/**
+ * @brief Allocates a zero-filled block for holding secrets from the secure
+ *        arena. Arena memory is mapped separately from the heap, locked
+ *        into RAM (mlock) so it is never written to swap, excluded from core
+ *        dumps (MADV_DONTDUMP), and bracketed by inaccessible guard pages.
+ *        Blocks of up to 64 KiB come from per-size-class slabs and are
+ *        recycled when freed, so this is cheap enough for the temporary
+ *        buffers of hot paths (plaintext keys, unsealed data); larger blocks
+ *        get a mapping of their own. Locked memory is limited by
+ *        RLIMIT_MEMLOCK, and slabs are kept for the life of the process.
+ *
+ * @param[in] size The size (in bytes) of the block
+ *
+ * @return Pointer to the block (release with kmyth_secure_free(), never
+ *         with free()), or NULL on error
+ */
+void *kmyth_secure_alloc(size_t size);
+
+/**
+ * @brief Wipes a block allocated by kmyth_secure_alloc() and returns it to
+ *        the secure arena (a large block is unlocked and unmapped). The
+ *        whole block is wiped, so the size passed in may be smaller than
+ *        the one allocated (e.g., the length of the data actually written).
+ *        If a NULL pointer is handled, the function simply returns.
+ *
+ * @param[in,out] v    The block to be cleared then released
+ *
+ * @param[in]     size The size passed to kmyth_secure_alloc(), or less
+ *
+ */
+void kmyth_secure_free(void *v, size_t size);
+
+/**
+ * @brief Smallest buffer (in bytes) backed by huge pages: the large blocks
+ *        of the secure arena and the large buffers passed to
+ *        kmyth_advise_huge_pages()
+ */
+#define KMYTH_HUGE_PAGES_MIN_SIZE (4 * 1024 * 1024)
+
+/**
+ * @brief Identifies how large buffers are backed by huge pages, so that
+ *        the AES-GCM and base64 kernels working through tens of GB take
+ *        fewer TLB misses.
+ */
+typedef enum kmyth_huge_pages_t
+{
+  KMYTH_HUGE_PAGES_OFF = 0,     ///< base pages only
+  KMYTH_HUGE_PAGES_TRANSPARENT, ///< transparent huge pages (MADV_HUGEPAGE)
+  KMYTH_HUGE_PAGES_EXPLICIT,    ///< hugetlbfs pages (MAP_HUGETLB) for the
+                                ///< secure arena, where reserved, else
+                                ///< transparent huge pages
+} kmyth_huge_pages_t;
+
+/**
+ * @brief Selects how large buffers are backed by huge pages. The default,
+ *        KMYTH_HUGE_PAGES_TRANSPARENT, can be changed with the
+ *        KMYTH_HUGE_PAGES environment variable ("off", "transparent" or
+ *        "explicit"), read on first use.
+ *
+ * Transparent huge pages are only a hint: the kernel backs a buffer with
+ * base pages if its THP setting is "never", or no huge page is free.
+ * Explicit huge pages come from the pool reserved by the administrator
+ * (vm.nr_hugepages); a secure arena block that the pool cannot supply
+ * falls back to transparent huge pages.
+ *
+ * @param[in]  mode  The huge page mode to use
+ *
+ * @return 0 on success, 1 if the mode is not valid
+ */
+int kmyth_set_huge_pages(kmyth_huge_pages_t mode);
+
+/**
+ * @brief Returns the name ("off", "transparent" or "explicit") of the huge
+ *        page mode in use.
+ *
+ * @return Mode name (a static string)
+ */
+const char *kmyth_huge_pages_name(void);
+
+/**
+ * @brief Asks for a large buffer (e.g., an encryption output or a base64
+ *        encoding, allocated with malloc()) to be backed by transparent
+ *        huge pages, unless huge pages are turned off. Buffers smaller than
+ *        KMYTH_HUGE_PAGES_MIN_SIZE are left alone, as are the partial huge
+ *        pages at either end of a buffer. Best effort: a failure is not
+ *        reported.
+ *
+ * @param[in]  v     The buffer, before its pages are first written
+ *
+ * @param[in]  size  The size of the buffer (in bytes)
+ */
+void kmyth_advise_huge_pages(void *v, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,112 @@
+/**
+ * @file  secret_cache.h
+ *
+ * @brief Provides a bounded, expiring cache of secrets (e.g., unsealed
+ *        data) held in locked memory, for Kmyth applications that serve
+ *        the same secret repeatedly.
+ *
+ * Entries are keyed on a caller-computed digest and stored in one arena
+ * allocated with kmyth_secure_alloc(), so the cached secrets are never
+ * swapped out or written to a core dump. An entry is dropped (and its
+ * bytes cleared) once its time to live has passed, and the least recently
+ * used entries are dropped when the arena or the entry table is full. A
+ * cache may be shared by multiple threads.
+ */
+
+#ifndef SECRET_CACHE_H
+#define SECRET_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Size (in bytes) of the digest that keys a secret cache entry.
+#define SECRET_CACHE_KEY_SIZE 32
+
+/**
+ * @brief Opaque handle for a secret cache.
+ */
+typedef struct secret_cache secret_cache;
+
+/**
+ * @brief Creates a secret cache.
+ *
+ * @param[in]  capacity     Size (in bytes) of the locked arena holding the
+ *                          cached secrets (counts against RLIMIT_MEMLOCK)
+ *
+ * @param[in]  max_entries  Largest number of secrets cached at once
+ *
+ * @param[in]  ttl_seconds  Time (in seconds) an entry may be served for
+ *                          after it was stored (must be non-zero)
+ *
+ * @param[out] cache        The new cache (release with secret_cache_free())
+ *
+ * @return 0 on success, 1 on error
+ */
+int secret_cache_new(size_t capacity, size_t max_entries,
+                     unsigned int ttl_seconds, secret_cache ** cache);
+
+/**
+ * @brief Clears every cached secret and releases a secret cache. The
+ *        handle is set to NULL.
+ *
+ * @param[in,out] cache  The cache to be released
+ *
+ * @return None
+ */
+void secret_cache_free(secret_cache ** cache);
+
+/**
+ * @brief Looks up an unexpired secret in the cache.
+ *
+ * @param[in]  cache     The cache
+ *
+ * @param[in]  key       The digest (SECRET_CACHE_KEY_SIZE bytes) keying
+ *                       the secret
+ *
+ * @param[out] data      A copy of the cached secret (to be cleared and
+ *                       freed by the caller)
+ *
+ * @param[out] data_len  Length (in bytes) of the secret
+ *
+ * @return 0 on a hit, 1 on a miss (or error)
+ */
+int secret_cache_get(secret_cache * cache, const uint8_t * key,
+                     uint8_t ** data, size_t *data_len);
+
+/**
+ * @brief Stores a secret in the cache, replacing any entry with the same
+ *        key and dropping the least recently used entries as needed.
+ *
+ * @param[in]  cache     The cache
+ *
+ * @param[in]  key       The digest (SECRET_CACHE_KEY_SIZE bytes) keying
+ *                       the secret
+ *
+ * @param[in]  data      The secret to be cached (copied into the arena)
+ *
+ * @param[in]  data_len  Length (in bytes) of the secret
+ *
+ * @return 0 if the secret was stored, 1 if not (e.g., it is larger than
+ *         the arena)
+ */
+int secret_cache_put(secret_cache * cache, const uint8_t * key,
+                     const uint8_t * data, size_t data_len);
+
+/**
+ * @brief Clears and drops every entry in the cache.
+ *
+ * @param[in]  cache  The cache
+ *
+ * @return None
+ */
+void secret_cache_clear(secret_cache * cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SECRET_CACHE_H */
@@ -0,0 +1,128 @@
+/**
+ * @file  timing_util.h
+ *
+ * @brief Provides lightweight timers for the phases of Kmyth operations
+ *        (e.g., TPM key creation, policy session setup, encryption, .ski
+ *        encoding), to show where a slow seal or unseal spends its time.
+ *
+ * A phase is timed by a kmyth_timer_begin() / kmyth_timer_end() pair
+ * around it. Each completed timer is logged (at LOG_DEBUG, with structured
+ * "operation" and "duration_us" fields) and added to process-wide, per
+ * phase totals. The timers cost a single check unless timing has been
+ * enabled with kmyth_timings_enable() or debug logging is on. A phase that
+ * fails part way (and so returns early) is not recorded.
+ */
+
+#ifndef TIMING_UTIL_H
+#define TIMING_UTIL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief The timed phases of Kmyth operations. Phases do not nest, except
+ *        that the .ski encoding and parsing phases include their base64
+ *        encoding and decoding.
+ */
+typedef enum kmyth_phase
+{
+  KMYTH_PHASE_TPM_CONNECT,      // TPM resource manager connection
+  KMYTH_PHASE_SRK_LOOKUP,       // SRK handle lookup (or re-derivation)
+  KMYTH_PHASE_PCR_POLICY,       // PCR selection and policy digest
+  KMYTH_PHASE_STORAGE_KEY,      // storage key creation or loading
+  KMYTH_PHASE_POLICY_SESSION,   // policy authorization session setup
+  KMYTH_PHASE_TPM_SEAL,         // sealed (wrapping key) object creation
+  KMYTH_PHASE_TPM_UNSEAL,       // sealed object loading and unsealing
+  KMYTH_PHASE_ENCRYPT,          // symmetric encryption of the data
+  KMYTH_PHASE_DECRYPT,          // symmetric decryption of the data
+  KMYTH_PHASE_COMPRESS,         // compression and decompression of the data
+  KMYTH_PHASE_SKI_ENCODE,       // .ski bytes creation
+  KMYTH_PHASE_SKI_PARSE,        // .ski bytes parsing
+  KMYTH_PHASE_BASE64,           // base64 encoding and decoding
+  KMYTH_PHASE_FILE_IO,          // reading inputs and writing outputs
+  KMYTH_PHASE_NETWORK,          // key server connection and key retrieval
+  KMYTH_PHASE_COUNT
+} kmyth_phase;
+
+/**
+ * @brief Turns the per-phase totals (and the timers) on or off. Timers
+ *        also run, for their log entries, whenever debug logging is on.
+ *
+ * @param[in]  enable  true to enable timing, false to disable it
+ *
+ * @return None
+ */
+void kmyth_timings_enable(bool enable);
+
+/**
+ * @brief Starts timing a phase.
+ *
+ * @return The start time, to be passed to kmyth_timer_end() (0 if timing
+ *         is disabled, in which case kmyth_timer_end() does nothing)
+ */
+uint64_t kmyth_timer_begin(void);
+
+/**
+ * @brief Completes timing a phase: logs its duration and adds it to the
+ *        phase's totals.
+ *
+ * @param[in]  phase  The phase timed
+ *
+ * @param[in]  begin  The start time returned by kmyth_timer_begin()
+ *
+ * @return None
+ */
+void kmyth_timer_end(kmyth_phase phase, uint64_t begin);
+
+/**
+ * @brief Retrieves the totals for a phase, over every thread.
+ *
+ * @param[in]  phase        The phase
+ *
+ * @param[out] calls        The number of times the phase was timed
+ *
+ * @param[out] duration_ns  Total time (in nanoseconds) spent in the phase
+ *
+ * @return None
+ */
+void kmyth_timings_get(kmyth_phase phase, uint64_t *calls,
+                       uint64_t *duration_ns);
+
+/**
+ * @brief Clears the totals for every phase.
+ *
+ * @return None
+ */
+void kmyth_timings_reset(void);
+
+/**
+ * @brief Returns the name of a phase (e.g., "storage key").
+ *
+ * @param[in]  phase  The phase
+ *
+ * @return The name, or "unknown" for an invalid phase
+ */
+const char *kmyth_phase_name(kmyth_phase phase);
+
+/**
+ * @brief Prints a table of the timed phases (those timed at least once),
+ *        with their call counts and total times, e.g., for a --timings
+ *        command line option.
+ *
+ * @param[in]  stream  Where the table is printed (e.g., stderr, as stdout
+ *                     may carry unsealed data)
+ *
+ * @return None
+ */
+void kmyth_timings_print(FILE * stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,611 @@
+/**
+ * base64_codec.c:
+ *
+ * C library containing the base64 codec supporting Kmyth block files
+ */
+
+#include "base64_codec.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#include "cpu_features.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BASE64_HAVE_AVX2 1
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define BASE64_HAVE_NEON 1
+#endif
+
+// raw bytes consumed by one full line of encoded output
+#define BASE64_LINE_RAW_LEN ((BASE64_LINE_LEN / 4) * 3)
+
+// marks characters outside the base64 alphabet in the decode table
+#define BASE64_INVALID 0xFF
+
+static const uint8_t base64_alphabet[64] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// decode table, indexed by input character (built once, on first use)
+static uint8_t base64_values[256];
+static pthread_once_t base64_once = PTHREAD_ONCE_INIT;
+
+// an implementation is a full-line encoder (BASE64_LINE_RAW_LEN raw bytes to
+// BASE64_LINE_LEN characters) plus a block decoder (decode_in characters to
+// decode_out bytes), each of which may read up to 'overread' bytes past the
+// data it consumes. The block decoder returns non-zero if its block contains
+// anything other than alphabet characters, which the caller then handles
+// with the scalar path.
+typedef struct base64_impl
+{
+  const char *name;
+  void (*encode_line) (const uint8_t * in, uint8_t * out);
+  int (*decode_block) (const uint8_t * in, uint8_t * out);
+  size_t decode_in;
+  size_t decode_out;
+  size_t overread;
+} base64_impl;
+
+static const base64_impl *base64_active = NULL;
+
+//############################################################################
+// base64_init_tables()
+//############################################################################
+static void base64_init_tables(void)
+{
+  memset(base64_values, BASE64_INVALID, sizeof(base64_values));
+  for (size_t i = 0; i < 64; i++)
+  {
+    base64_values[base64_alphabet[i]] = (uint8_t) i;
+  }
+}
+
+//############################################################################
+// base64_is_space()
+//############################################################################
+static int base64_is_space(uint8_t c)
+{
+  return (c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v'
+          || c == '\f');
+}
+
+//############################################################################
+// encode_scalar()
+//############################################################################
+static size_t encode_scalar(const uint8_t * in, size_t in_len, uint8_t * out)
+{
+  uint8_t *start = out;
+
+  while (in_len >= 3)
+  {
+    uint32_t v = ((uint32_t) in[0] << 16) | ((uint32_t) in[1] << 8) | in[2];
+
+    *out++ = base64_alphabet[(v >> 18) & 0x3F];
+    *out++ = base64_alphabet[(v >> 12) & 0x3F];
+    *out++ = base64_alphabet[(v >> 6) & 0x3F];
+    *out++ = base64_alphabet[v & 0x3F];
+    in += 3;
+    in_len -= 3;
+  }
+
+  if (in_len > 0)
+  {
+    uint32_t v = (uint32_t) in[0] << 16;
+
+    if (in_len == 2)
+    {
+      v |= (uint32_t) in[1] << 8;
+    }
+    *out++ = base64_alphabet[(v >> 18) & 0x3F];
+    *out++ = base64_alphabet[(v >> 12) & 0x3F];
+    *out++ = (in_len == 2) ? base64_alphabet[(v >> 6) & 0x3F] : '=';
+    *out++ = '=';
+  }
+
+  return (size_t) (out - start);
+}
+
+//############################################################################
+// encode_line_scalar()
+//############################################################################
+static void encode_line_scalar(const uint8_t * in, uint8_t * out)
+{
+  encode_scalar(in, BASE64_LINE_RAW_LEN, out);
+}
+
+//############################################################################
+// decode_block_scalar()
+//############################################################################
+static int decode_block_scalar(const uint8_t * in, uint8_t * out)
+{
+  // the scalar implementation has no block fast path
+  (void) in;
+  (void) out;
+  return 1;
+}
+
+static const base64_impl base64_scalar_impl = {
+  .name = "scalar",
+  .encode_line = encode_line_scalar,
+  .decode_block = decode_block_scalar,
+  .decode_in = 0,
+  .decode_out = 0,
+  .overread = 0,
+};
+
+#ifdef BASE64_HAVE_AVX2
+//############################################################################
+// encode_line_avx2()
+//
+// Vectorized encoding after W. Mula and D. Lemire, "Faster Base64 Encoding
+// and Decoding Using AVX2 Instructions" (ACM TOW, 2018)
+//############################################################################
+__attribute__((target("avx2")))
+static void encode_line_avx2(const uint8_t * in, uint8_t * out)
+{
+  // place each 3-byte group in its own 32-bit lane, ordered so the four
+  // 6-bit indices can be extracted with multiplies
+  const __m256i shuf = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+                                        7, 6, 8, 7, 10, 9, 11, 10,
+                                        1, 0, 2, 1, 4, 3, 5, 4,
+                                        7, 6, 8, 7, 10, 9, 11, 10);
+  const __m256i shift_lut = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '+' - 62,
+                                             '/' - 63, 'A', 0, 0,
+                                             'a' - 26, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '+' - 62,
+                                             '/' - 63, 'A', 0, 0);
+
+  // each pass encodes 24 bytes (12 per 128-bit lane) into 32 characters
+  for (int k = 0; k < 2; k++)
+  {
+    __m128i lo = _mm_loadu_si128((const __m128i *) (in + 24 * k));
+    __m128i hi = _mm_loadu_si128((const __m128i *) (in + 24 * k + 12));
+    __m256i v =
+      _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+    v = _mm256_shuffle_epi8(v, shuf);
+
+    __m256i t0 = _mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00));
+    __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    __m256i t2 = _mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0));
+    __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    __m256i indices = _mm256_or_si256(t1, t3);
+
+    // map each 6-bit index to the offset that turns it into its character
+    __m256i r = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+
+    r = _mm256_or_si256(r, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+    r = _mm256_shuffle_epi8(shift_lut, r);
+    r = _mm256_add_epi8(r, indices);
+
+    _mm256_storeu_si256((__m256i *) (out + 32 * k), r);
+  }
+}
+
+//############################################################################
+// decode_block_avx2()
+//############################################################################
+__attribute__((target("avx2")))
+static int decode_block_avx2(const uint8_t * in, uint8_t * out)
+{
+  const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x13, 0x1A,
+                                          0x1B, 0x1B, 0x1B, 0x1A,
+                                          0x15, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x13, 0x1A,
+                                          0x1B, 0x1B, 0x1B, 0x1A);
+  const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02,
+                                          0x04, 0x08, 0x04, 0x08,
+                                          0x10, 0x10, 0x10, 0x10,
+                                          0x10, 0x10, 0x10, 0x10,
+                                          0x10, 0x10, 0x01, 0x02,
+                                          0x04, 0x08, 0x04, 0x08,
+                                          0x10, 0x10, 0x10, 0x10,
+                                          0x10, 0x10, 0x10, 0x10);
+  const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                            0, 0, 0, 0, 0, 0, 0, 0,
+                                            0, 16, 19, 4, -65, -65, -71, -71,
+                                            0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+
+  __m256i str = _mm256_loadu_si256((const __m256i *) in);
+
+  // validate: every byte must be in the alphabet (this also rejects padding
+  // and whitespace, which the scalar path handles)
+  __m256i hi_nibbles = _mm256_srli_epi32(str, 4);
+  __m256i lo_nibbles = _mm256_and_si256(str, mask_2f);
+  __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+  __m256i eq_2f = _mm256_cmpeq_epi8(str, mask_2f);
+
+  hi_nibbles = _mm256_and_si256(hi_nibbles, mask_2f);
+  __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+
+  if (!_mm256_testz_si256(lo, hi))
+  {
+    return 1;
+  }
+
+  // translate characters to 6-bit values
+  __m256i roll = _mm256_shuffle_epi8(lut_roll,
+                                     _mm256_add_epi8(eq_2f, hi_nibbles));
+
+  str = _mm256_add_epi8(str, roll);
+
+  // pack four 6-bit values per 32-bit lane into three bytes
+  __m256i merged = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+
+  merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+  merged = _mm256_shuffle_epi8(merged,
+                               _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9,
+                                                8, 14, 13, 12, -1, -1, -1, -1,
+                                                2, 1, 0, 6, 5, 4, 10, 9,
+                                                8, 14, 13, 12, -1, -1, -1,
+                                                -1));
+  merged = _mm256_permutevar8x32_epi32(merged,
+                                       _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1,
+                                                         -1));
+
+  uint8_t tmp[32];
+
+  _mm256_storeu_si256((__m256i *) tmp, merged);
+  memcpy(out, tmp, 24);
+
+  return 0;
+}
+
+static const base64_impl base64_avx2_impl = {
+  .name = "avx2",
+  .encode_line = encode_line_avx2,
+  .decode_block = decode_block_avx2,
+  .decode_in = 32,
+  .decode_out = 24,
+  .overread = 4,
+};
+#endif
+
+#ifdef BASE64_HAVE_NEON
+//############################################################################
+// base64_load_table()
+//############################################################################
+static uint8x16x4_t base64_load_table(const uint8_t * table)
+{
+  uint8x16x4_t t;
+
+  t.val[0] = vld1q_u8(table);
+  t.val[1] = vld1q_u8(table + 16);
+  t.val[2] = vld1q_u8(table + 32);
+  t.val[3] = vld1q_u8(table + 48);
+  return t;
+}
+
+//############################################################################
+// encode_line_neon()
+//############################################################################
+static void encode_line_neon(const uint8_t * in, uint8_t * out)
+{
+  const uint8x16x4_t tbl = base64_load_table(base64_alphabet);
+  const uint8x16_t mask = vdupq_n_u8(0x3F);
+
+  // the de-interleaving load splits 48 bytes into the three byte positions
+  // of each 3-byte group, and the interleaving store reverses it for the
+  // four characters of each group
+  uint8x16x3_t src = vld3q_u8(in);
+  uint8x16x4_t idx;
+
+  idx.val[0] = vshrq_n_u8(src.val[0], 2);
+  idx.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(src.val[0], 4),
+                                 vshrq_n_u8(src.val[1], 4)), mask);
+  idx.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(src.val[1], 2),
+                                 vshrq_n_u8(src.val[2], 6)), mask);
+  idx.val[3] = vandq_u8(src.val[2], mask);
+
+  uint8x16x4_t dst;
+
+  dst.val[0] = vqtbl4q_u8(tbl, idx.val[0]);
+  dst.val[1] = vqtbl4q_u8(tbl, idx.val[1]);
+  dst.val[2] = vqtbl4q_u8(tbl, idx.val[2]);
+  dst.val[3] = vqtbl4q_u8(tbl, idx.val[3]);
+  vst4q_u8(out, dst);
+}
+
+//############################################################################
+// decode_block_neon()
+//############################################################################
+static int decode_block_neon(const uint8_t * in, uint8_t * out)
+{
+  // characters 0-63 and 64-127 of the decode table (invalid entries are
+  // BASE64_INVALID, so their high bit flags an error)
+  const uint8x16x4_t tbl_lo = base64_load_table(base64_values);
+  const uint8x16x4_t tbl_hi = base64_load_table(base64_values + 64);
+  const uint8x16_t offset = vdupq_n_u8(64);
+
+  uint8x16x4_t c = vld4q_u8(in);
+  uint8x16x4_t v;
+  uint8x16_t err = vdupq_n_u8(0);
+
+  for (int k = 0; k < 4; k++)
+  {
+    v.val[k] = vqtbx4q_u8(vqtbl4q_u8(tbl_lo, c.val[k]), tbl_hi,
+                          vsubq_u8(c.val[k], offset));
+    err = vorrq_u8(err, vorrq_u8(v.val[k], c.val[k]));
+  }
+  if (vmaxvq_u8(err) & 0x80)
+  {
+    return 1;
+  }
+
+  uint8x16x3_t dst;
+
+  dst.val[0] = vorrq_u8(vshlq_n_u8(v.val[0], 2), vshrq_n_u8(v.val[1], 4));
+  dst.val[1] = vorrq_u8(vshlq_n_u8(v.val[1], 4), vshrq_n_u8(v.val[2], 2));
+  dst.val[2] = vorrq_u8(vshlq_n_u8(v.val[2], 6), v.val[3]);
+  vst3q_u8(out, dst);
+
+  return 0;
+}
+
+static const base64_impl base64_neon_impl = {
+  .name = "neon",
+  .encode_line = encode_line_neon,
+  .decode_block = decode_block_neon,
+  .decode_in = 64,
+  .decode_out = 48,
+  .overread = 0,
+};
+#endif
+
+//############################################################################
+// base64_select_impl()
+//############################################################################
+static const base64_impl *base64_select_impl(base64_codec_t codec)
+{
+  const base64_impl *impl = NULL;
+
+  switch (codec)
+  {
+  case BASE64_CODEC_AUTO:
+    impl = &base64_scalar_impl;
+#ifdef BASE64_HAVE_AVX2
+    if (kmyth_cpu_has(KMYTH_CPU_AVX2))
+    {
+      impl = &base64_avx2_impl;
+    }
+#endif
+#ifdef BASE64_HAVE_NEON
+    if (kmyth_cpu_has(KMYTH_CPU_NEON))
+    {
+      impl = &base64_neon_impl;
+    }
+#endif
+    break;
+  case BASE64_CODEC_SCALAR:
+    impl = &base64_scalar_impl;
+    break;
+  case BASE64_CODEC_AVX2:
+#ifdef BASE64_HAVE_AVX2
+    if (kmyth_cpu_has(KMYTH_CPU_AVX2))
+    {
+      impl = &base64_avx2_impl;
+    }
+#endif
+    break;
+  case BASE64_CODEC_NEON:
+#ifdef BASE64_HAVE_NEON
+    if (kmyth_cpu_has(KMYTH_CPU_NEON))
+    {
+      impl = &base64_neon_impl;
+    }
+#endif
+    break;
+  default:
+    break;
+  }
+
+  return impl;
+}
+
+//############################################################################
+// base64_init()
+//############################################################################
+static void base64_init(void)
+{
+  base64_init_tables();
+  __atomic_store_n(&base64_active, base64_select_impl(BASE64_CODEC_AUTO),
+                   __ATOMIC_RELEASE);
+}
+
+//############################################################################
+// base64_get_impl()
+//############################################################################
+static const base64_impl *base64_get_impl(void)
+{
+  pthread_once(&base64_once, base64_init);
+  return __atomic_load_n(&base64_active, __ATOMIC_ACQUIRE);
+}
+
+//############################################################################
+// base64_set_codec()
+//############################################################################
+int base64_set_codec(base64_codec_t codec)
+{
+  pthread_once(&base64_once, base64_init);
+
+  const base64_impl *impl = base64_select_impl(codec);
+
+  if (impl == NULL)
+  {
+    return 1;
+  }
+  __atomic_store_n(&base64_active, impl, __ATOMIC_RELEASE);
+  return 0;
+}
+
+//############################################################################
+// base64_codec_name()
+//############################################################################
+const char *base64_codec_name(void)
+{
+  return base64_get_impl()->name;
+}
+
+//############################################################################
+// base64_encoded_size()
+//############################################################################
+size_t base64_encoded_size(size_t raw_size)
+{
+  size_t chars = ((raw_size + 2) / 3) * 4;
+  size_t lines = (chars + BASE64_LINE_LEN - 1) / BASE64_LINE_LEN;
+
+  return chars + lines;
+}
+
+//############################################################################
+// base64_encode()
+//############################################################################
+size_t base64_encode(const uint8_t * raw_data, size_t raw_size,
+                     uint8_t * base64_data)
+{
+  const base64_impl *impl = base64_get_impl();
+  uint8_t *out = base64_data;
+
+  while (raw_size > 0)
+  {
+    if (raw_size >= BASE64_LINE_RAW_LEN + impl->overread)
+    {
+      impl->encode_line(raw_data, out);
+      raw_data += BASE64_LINE_RAW_LEN;
+      raw_size -= BASE64_LINE_RAW_LEN;
+      out += BASE64_LINE_LEN;
+    }
+    else
+    {
+      size_t chunk = (raw_size < BASE64_LINE_RAW_LEN) ?
+        raw_size : BASE64_LINE_RAW_LEN;
+
+      out += encode_scalar(raw_data, chunk, out);
+      raw_data += chunk;
+      raw_size -= chunk;
+    }
+    *out++ = '\n';
+  }
+
+  return (size_t) (out - base64_data);
+}
+
+//############################################################################
+// base64_decode()
+//############################################################################
+int base64_decode(const uint8_t * base64_data, size_t base64_size,
+                  uint8_t * raw_data, size_t * raw_size)
+{
+  const base64_impl *impl = base64_get_impl();
+  const uint8_t *in = base64_data;
+  const uint8_t *end = base64_data + base64_size;
+  uint8_t *out = raw_data;
+
+  uint32_t quad = 0;
+  size_t quad_len = 0;
+
+  while (in < end)
+  {
+    // fast path: whole blocks of alphabet characters, on a quad boundary
+    if (quad_len == 0 && impl->decode_in > 0
+        && (size_t) (end - in) >= impl->decode_in + impl->overread
+        && impl->decode_block(in, out) == 0)
+    {
+      in += impl->decode_in;
+      out += impl->decode_out;
+      continue;
+    }
+
+    uint8_t c = *in++;
+
+    if (base64_is_space(c))
+    {
+      continue;
+    }
+    if (c == '=')
+    {
+      // padding completes the final quad - one '=' after three characters,
+      // two after two - and may only be followed by whitespace
+      size_t pad_needed = 4 - quad_len;
+
+      if (quad_len < 2)
+      {
+        return 1;
+      }
+      pad_needed--;
+      while (in < end && pad_needed > 0)
+      {
+        c = *in++;
+        if (c == '=')
+        {
+          pad_needed--;
+        }
+        else if (!base64_is_space(c))
+        {
+          return 1;
+        }
+      }
+      if (pad_needed > 0)
+      {
+        return 1;
+      }
+      while (in < end)
+      {
+        if (!base64_is_space(*in++))
+        {
+          return 1;
+        }
+      }
+      break;
+    }
+
+    uint8_t v = base64_values[c];
+
+    if (v == BASE64_INVALID)
+    {
+      return 1;
+    }
+    quad = (quad << 6) | v;
+    quad_len++;
+    if (quad_len == 4)
+    {
+      *out++ = (uint8_t) (quad >> 16);
+      *out++ = (uint8_t) (quad >> 8);
+      *out++ = (uint8_t) quad;
+      quad = 0;
+      quad_len = 0;
+    }
+  }
+
+  // flush a final partial quad (padded, or tolerated without padding)
+  if (quad_len == 1)
+  {
+    return 1;
+  }
+  if (quad_len == 2)
+  {
+    *out++ = (uint8_t) (quad >> 4);
+  }
+  else if (quad_len == 3)
+  {
+    *out++ = (uint8_t) (quad >> 10);
+    *out++ = (uint8_t) (quad >> 2);
+  }
+
+  *raw_size = (size_t) (out - raw_data);
+  return 0;
+}
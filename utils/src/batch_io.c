@@ -0,0 +1,775 @@
+/**
+ * batch_io.c:
+ *
+ * C library containing the batched file reads and writes (through io_uring,
+ * where available) supporting Kmyth bulk operations
+ */
+
+#include "batch_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include "defines.h"
+
+#include "file_io.h"
+#include "memory_util.h"
+
+static pthread_once_t batch_io_once = PTHREAD_ONCE_INIT;
+static batch_io_engine_t batch_io_active = BATCH_IO_ENGINE_SYNC;
+static bool batch_io_uring_available = false;
+
+/**
+ * @brief An io_uring instance, with its submission and completion queues
+ *        mapped into this process
+ */
+typedef struct batch_ring
+{
+  int fd;
+
+  void *sq_map;
+  size_t sq_map_len;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  size_t sqes_len;
+
+  void *cq_map;
+  size_t cq_map_len;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+} batch_ring;
+
+//############################################################################
+// batch_ring_close()
+//############################################################################
+static void batch_ring_close(batch_ring * ring)
+{
+  if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+  {
+    munmap(ring->sqes, ring->sqes_len);
+  }
+  if (ring->cq_map != NULL && ring->cq_map != MAP_FAILED
+      && ring->cq_map != ring->sq_map)
+  {
+    munmap(ring->cq_map, ring->cq_map_len);
+  }
+  if (ring->sq_map != NULL && ring->sq_map != MAP_FAILED)
+  {
+    munmap(ring->sq_map, ring->sq_map_len);
+  }
+  if (ring->fd >= 0)
+  {
+    close(ring->fd);
+  }
+  memset(ring, 0, sizeof(batch_ring));
+  ring->fd = -1;
+}
+
+//############################################################################
+// batch_ring_open()
+//############################################################################
+static int batch_ring_open(unsigned entries, batch_ring * ring)
+{
+  struct io_uring_params params = { 0 };
+
+  memset(ring, 0, sizeof(batch_ring));
+  ring->fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+  if (ring->fd < 0)
+  {
+    ring->fd = -1;
+    return 1;
+  }
+  ring->sq_map_len = params.sq_off.array
+    + params.sq_entries * sizeof(unsigned);
+  ring->cq_map_len = params.cq_off.cqes
+    + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if (ring->cq_map_len > ring->sq_map_len)
+    {
+      ring->sq_map_len = ring->cq_map_len;
+    }
+    ring->cq_map_len = ring->sq_map_len;
+  }
+
+  ring->sq_map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_map == MAP_FAILED)
+  {
+    batch_ring_close(ring);
+    return 1;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    ring->cq_map = ring->sq_map;
+  }
+  else
+  {
+    ring->cq_map = mmap(NULL, ring->cq_map_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_CQ_RING);
+    if (ring->cq_map == MAP_FAILED)
+    {
+      batch_ring_close(ring);
+      return 1;
+    }
+  }
+  ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED)
+  {
+    batch_ring_close(ring);
+    return 1;
+  }
+
+  uint8_t *sq = (uint8_t *) ring->sq_map;
+  uint8_t *cq = (uint8_t *) ring->cq_map;
+
+  ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+  ring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+  ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+  ring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+  return 0;
+}
+
+//############################################################################
+// batch_ring_queue()
+//
+// Queues an operation (not yet submitted) tagged with user_data. The ring
+// is only ever used by one thread and drained between batches, so a free
+// submission queue entry is always available for up to BATCH_IO_DEPTH
+// operations.
+//############################################################################
+static void batch_ring_queue(batch_ring * ring, uint8_t opcode, int fd,
+                             const struct iovec *iov, off_t offset,
+                             uint32_t flags, uint64_t user_data)
+{
+  unsigned tail = *ring->sq_tail;
+  unsigned index = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t) (uintptr_t) iov;
+  sqe->len = (iov != NULL) ? 1 : 0;
+  sqe->off = (uint64_t) offset;
+  sqe->fsync_flags = flags;
+  sqe->user_data = user_data;
+
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+//############################################################################
+// batch_ring_reap()
+//
+// Stores the result of each completed operation (bytes transferred, or
+// -errno) in res at its user_data index, and returns how many there were
+//############################################################################
+static unsigned batch_ring_reap(batch_ring * ring, int *res)
+{
+  unsigned head = *ring->cq_head;
+  unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  unsigned reaped = 0;
+
+  while (head != tail)
+  {
+    struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+
+    res[cqe->user_data] = cqe->res;
+    head++;
+    reaped++;
+  }
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+  return reaped;
+}
+
+//############################################################################
+// batch_ring_run()
+//
+// Submits the queued operations, and waits for all of them to complete,
+// storing the result of each (bytes transferred, or -errno) in res at its
+// user_data index
+//############################################################################
+static int batch_ring_run(batch_ring * ring, unsigned queued, int *res)
+{
+  unsigned submitted = 0;
+  unsigned completed = 0;
+  bool failed = false;
+
+  // After a hard io_uring_enter() error, the operations already submitted
+  // may still be reading into (or writing from) the caller's buffers, so
+  // they are all waited for before returning: the caller then frees the
+  // buffers, closes the files and falls back to the synchronous path. The
+  // kernel posts their completions to the mapped queue whether or not
+  // io_uring_enter() works, so if it keeps failing the queue is polled.
+  while (completed < ((failed) ? submitted : queued))
+  {
+    unsigned to_submit = (failed) ? 0 : queued - submitted;
+    int rv = (int) syscall(__NR_io_uring_enter, ring->fd, to_submit, 1,
+                           IORING_ENTER_GETEVENTS, NULL, 0);
+
+    if (rv < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+    {
+      if (failed)
+      {
+        struct timespec pause = {.tv_sec = 0,.tv_nsec = 1000000 };
+
+        nanosleep(&pause, NULL);
+      }
+      failed = true;
+    }
+    else if (rv > 0)
+    {
+      submitted += (unsigned) rv;
+    }
+    completed += batch_ring_reap(ring, res);
+  }
+
+  return (failed) ? 1 : 0;
+}
+
+//############################################################################
+// batch_io_init()
+//
+// Checks whether io_uring can be used, and selects the engine (io_uring,
+// unless it is unavailable or KMYTH_IO_URING is "0")
+//############################################################################
+static void batch_io_init(void)
+{
+  batch_ring ring;
+
+  if (batch_ring_open(1, &ring) == 0)
+  {
+    batch_io_uring_available = true;
+    batch_ring_close(&ring);
+  }
+
+  const char *env = getenv(KMYTH_IO_URING_ENV);
+  bool disabled = (env != NULL && strcmp(env, "0") == 0);
+
+  __atomic_store_n(&batch_io_active,
+                   (batch_io_uring_available && !disabled)
+                   ? BATCH_IO_ENGINE_IO_URING : BATCH_IO_ENGINE_SYNC,
+                   __ATOMIC_RELEASE);
+}
+
+//############################################################################
+// batch_io_get_engine()
+//############################################################################
+static batch_io_engine_t batch_io_get_engine(void)
+{
+  pthread_once(&batch_io_once, batch_io_init);
+  return __atomic_load_n(&batch_io_active, __ATOMIC_ACQUIRE);
+}
+
+//############################################################################
+// batch_io_set_engine()
+//############################################################################
+int batch_io_set_engine(batch_io_engine_t engine)
+{
+  pthread_once(&batch_io_once, batch_io_init);
+
+  switch (engine)
+  {
+  case BATCH_IO_ENGINE_AUTO:
+    engine = (batch_io_uring_available) ? BATCH_IO_ENGINE_IO_URING
+      : BATCH_IO_ENGINE_SYNC;
+    break;
+  case BATCH_IO_ENGINE_SYNC:
+    break;
+  case BATCH_IO_ENGINE_IO_URING:
+    if (!batch_io_uring_available)
+    {
+      return 1;
+    }
+    break;
+  default:
+    return 1;
+  }
+  __atomic_store_n(&batch_io_active, engine, __ATOMIC_RELEASE);
+  return 0;
+}
+
+//############################################################################
+// batch_io_engine_name()
+//############################################################################
+const char *batch_io_engine_name(void)
+{
+  return (batch_io_get_engine() == BATCH_IO_ENGINE_IO_URING) ? "io_uring"
+    : "sync";
+}
+
+//############################################################################
+// batch_read_rest()
+//
+// Reads the rest of a file whose read was cut short
+//############################################################################
+static int batch_read_rest(int fd, uint8_t * data, size_t length,
+                           size_t done)
+{
+  while (done < length)
+  {
+    ssize_t rv = pread(fd, data + done, length - done, (off_t) done);
+
+    if (rv == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (rv <= 0)
+    {
+      return 1;
+    }
+    done += (size_t) rv;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// batch_write_rest()
+//
+// Writes the rest of a file whose write was cut short
+//############################################################################
+static int batch_write_rest(int fd, uint8_t * bytes, size_t length,
+                            size_t done)
+{
+  while (done < length)
+  {
+    ssize_t rv = pwrite(fd, bytes + done, length - done, (off_t) done);
+
+    if (rv == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (rv <= 0)
+    {
+      return 1;
+    }
+    done += (size_t) rv;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// batch_open_output()
+//
+// Checks and opens an output file (as write_bytes_to_file() does), reserving
+// its full extent
+//############################################################################
+static int batch_open_output(char *path, size_t length)
+{
+  if (verifyOutputFilePath(path))
+  {
+    kmyth_log(LOG_ERR, "invalid output path (%s) ... exiting", path);
+    return -1;
+  }
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+  if (fd == -1)
+  {
+    kmyth_log(LOG_ERR, "unable to open file: %s ... exiting", path);
+    return -1;
+  }
+  if (length > 0)
+  {
+    int rv = posix_fallocate(fd, 0, (off_t) length);
+
+    if (rv != 0 && rv != EINVAL && rv != EOPNOTSUPP)
+    {
+      kmyth_log(LOG_ERR, "unable to allocate %zu bytes for %s ... exiting",
+                length, path);
+      close(fd);
+      return -1;
+    }
+  }
+
+  return fd;
+}
+
+//############################################################################
+// batch_read_sync()
+//############################################################################
+static void batch_read_sync(char **paths, size_t count, uint8_t ** data,
+                            size_t *lengths, int *results)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    results[i] = read_bytes_from_file(paths[i], &data[i], &lengths[i]);
+    if (results[i])
+    {
+      data[i] = NULL;
+      lengths[i] = 0;
+    }
+  }
+}
+
+//############################################################################
+// batch_write_sync()
+//############################################################################
+static void batch_write_sync(char **paths, uint8_t ** bytes,
+                             size_t *lengths, size_t count, bool sync,
+                             int *results)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    int fd = batch_open_output(paths[i], lengths[i]);
+
+    results[i] = (fd < 0);
+    if (fd < 0)
+    {
+      continue;
+    }
+    if (batch_write_rest(fd, bytes[i], lengths[i], 0))
+    {
+      kmyth_log(LOG_ERR, "error writing %s ... exiting", paths[i]);
+      results[i] = 1;
+    }
+    else if (sync && fsync(fd) == -1)
+    {
+      kmyth_log(LOG_ERR, "error syncing %s ... exiting", paths[i]);
+      results[i] = 1;
+    }
+    if (close(fd) == -1 && results[i] == 0)
+    {
+      kmyth_log(LOG_ERR, "error closing %s ... exiting", paths[i]);
+      results[i] = 1;
+    }
+  }
+}
+
+//############################################################################
+// batch_read_uring()
+//
+// Reads up to BATCH_IO_DEPTH files: each is opened and sized, then all of
+// their reads are submitted together
+//############################################################################
+static int batch_read_uring(batch_ring * ring, char **paths, size_t count,
+                            uint8_t ** data, size_t *lengths, int *results)
+{
+  int fds[BATCH_IO_DEPTH];
+  int res[BATCH_IO_DEPTH];
+  struct iovec iovs[BATCH_IO_DEPTH];
+  unsigned queued = 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    struct stat st;
+
+    data[i] = NULL;
+    lengths[i] = 0;
+    results[i] = 1;
+    res[i] = 0;
+    fds[i] = (paths[i] != NULL) ? open(paths[i], O_RDONLY) : -1;
+    if (fds[i] == -1)
+    {
+      kmyth_log(LOG_ERR, "error opening input file: %s ... exiting",
+                (paths[i] != NULL) ? paths[i] : "(null)");
+      continue;
+    }
+    if (fstat(fds[i], &st) == -1 || st.st_size < 0
+        || (uintmax_t) st.st_size > SIZE_MAX)
+    {
+      kmyth_log(LOG_ERR, "input file (%s) size could not be determined "
+                "... exiting", paths[i]);
+      close(fds[i]);
+      fds[i] = -1;
+      continue;
+    }
+    results[i] = 0;
+    if (st.st_size == 0)
+    {
+      close(fds[i]);
+      fds[i] = -1;
+      continue;
+    }
+    lengths[i] = (size_t) st.st_size;
+    data[i] = malloc(lengths[i]);
+    if (data[i] == NULL)
+    {
+      kmyth_log(LOG_ERR, "could not allocate memory to read file ... exiting");
+      results[i] = 1;
+      lengths[i] = 0;
+      close(fds[i]);
+      fds[i] = -1;
+      continue;
+    }
+    iovs[i].iov_base = data[i];
+    iovs[i].iov_len = lengths[i];
+    batch_ring_queue(ring, IORING_OP_READV, fds[i], &iovs[i], 0, 0, i);
+    queued++;
+  }
+
+  int retval = (queued > 0) ? batch_ring_run(ring, queued, res) : 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    if (fds[i] == -1)
+    {
+      continue;
+    }
+    if (retval || res[i] < 0
+        || batch_read_rest(fds[i], data[i], lengths[i], (size_t) res[i]))
+    {
+      if (retval == 0)
+      {
+        kmyth_log(LOG_ERR, "error reading %s ... exiting", paths[i]);
+      }
+      kmyth_clear_and_free(data[i], lengths[i]);
+      data[i] = NULL;
+      lengths[i] = 0;
+      results[i] = 1;
+    }
+    close(fds[i]);
+  }
+
+  return retval;
+}
+
+//############################################################################
+// batch_write_uring()
+//
+// Writes up to BATCH_IO_DEPTH files: each is opened, then all of their
+// writes are submitted together, then (if sync) all of their fsyncs
+//############################################################################
+static int batch_write_uring(batch_ring * ring, char **paths,
+                             uint8_t ** bytes, size_t *lengths, size_t count,
+                             bool sync, int *results)
+{
+  int fds[BATCH_IO_DEPTH];
+  int res[BATCH_IO_DEPTH];
+  struct iovec iovs[BATCH_IO_DEPTH];
+  unsigned queued = 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    res[i] = 0;
+    fds[i] = batch_open_output(paths[i], lengths[i]);
+    results[i] = (fds[i] < 0);
+    if (fds[i] < 0 || lengths[i] == 0)
+    {
+      continue;
+    }
+    iovs[i].iov_base = bytes[i];
+    iovs[i].iov_len = lengths[i];
+    batch_ring_queue(ring, IORING_OP_WRITEV, fds[i], &iovs[i], 0, 0, i);
+    queued++;
+  }
+
+  int retval = (queued > 0) ? batch_ring_run(ring, queued, res) : 0;
+
+  queued = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    if (fds[i] < 0)
+    {
+      continue;
+    }
+    if (retval || res[i] < 0
+        || batch_write_rest(fds[i], bytes[i], lengths[i], (size_t) res[i]))
+    {
+      if (retval == 0)
+      {
+        kmyth_log(LOG_ERR, "error writing %s ... exiting", paths[i]);
+      }
+      results[i] = 1;
+      continue;
+    }
+    if (sync)
+    {
+      batch_ring_queue(ring, IORING_OP_FSYNC, fds[i], NULL, 0, 0, i);
+      queued++;
+    }
+  }
+
+  if (queued > 0 && retval == 0)
+  {
+    retval = batch_ring_run(ring, queued, res);
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    if (fds[i] < 0)
+    {
+      continue;
+    }
+    if (sync && results[i] == 0 && retval == 0 && res[i] < 0)
+    {
+      kmyth_log(LOG_ERR, "error syncing %s ... exiting", paths[i]);
+      results[i] = 1;
+    }
+    if (close(fds[i]) == -1 && results[i] == 0)
+    {
+      kmyth_log(LOG_ERR, "error closing %s ... exiting", paths[i]);
+      results[i] = 1;
+    }
+  }
+
+  return retval;
+}
+
+//############################################################################
+// batch_any_failed()
+//############################################################################
+static int batch_any_failed(const int *results, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    if (results[i])
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+//############################################################################
+// read_files_batch()
+//############################################################################
+int read_files_batch(char **paths, size_t count, uint8_t ** data,
+                     size_t *lengths, int *results)
+{
+  if (count > 0 && (paths == NULL || data == NULL || lengths == NULL))
+  {
+    kmyth_log(LOG_ERR, "invalid arguments ... exiting");
+    return 1;
+  }
+
+  int *status = (results != NULL) ? results : calloc(count, sizeof(int));
+
+  if (count > 0 && status == NULL)
+  {
+    kmyth_log(LOG_ERR, "memory allocation failed ... exiting");
+    return 1;
+  }
+
+  batch_ring ring = {.fd = -1 };
+  bool use_uring = (count > 0
+                    && batch_io_get_engine() == BATCH_IO_ENGINE_IO_URING
+                    && batch_ring_open(BATCH_IO_DEPTH, &ring) == 0);
+
+  for (size_t first = 0; first < count; first += BATCH_IO_DEPTH)
+  {
+    size_t n = count - first;
+
+    if (n > BATCH_IO_DEPTH)
+    {
+      n = BATCH_IO_DEPTH;
+    }
+    if (use_uring
+        && batch_read_uring(&ring, paths + first, n, data + first,
+                            lengths + first, status + first) == 0)
+    {
+      continue;
+    }
+
+    // if the ring itself failed, it is given up, and the batch is read
+    // again one file at a time (a failure to read one file is only
+    // reported in its result)
+    if (use_uring)
+    {
+      batch_ring_close(&ring);
+      use_uring = false;
+    }
+    batch_read_sync(paths + first, n, data + first, lengths + first,
+                    status + first);
+  }
+  if (use_uring)
+  {
+    batch_ring_close(&ring);
+  }
+
+  int retval = batch_any_failed(status, count);
+
+  if (status != results)
+  {
+    free(status);
+  }
+  return retval;
+}
+
+//############################################################################
+// write_files_batch()
+//############################################################################
+int write_files_batch(char **paths, uint8_t ** bytes, size_t *lengths,
+                      size_t count, bool sync, int *results)
+{
+  if (count > 0 && (paths == NULL || bytes == NULL || lengths == NULL))
+  {
+    kmyth_log(LOG_ERR, "invalid arguments ... exiting");
+    return 1;
+  }
+
+  int *status = (results != NULL) ? results : calloc(count, sizeof(int));
+
+  if (count > 0 && status == NULL)
+  {
+    kmyth_log(LOG_ERR, "memory allocation failed ... exiting");
+    return 1;
+  }
+
+  batch_ring ring = {.fd = -1 };
+  bool use_uring = (count > 0
+                    && batch_io_get_engine() == BATCH_IO_ENGINE_IO_URING
+                    && batch_ring_open(BATCH_IO_DEPTH, &ring) == 0);
+
+  for (size_t first = 0; first < count; first += BATCH_IO_DEPTH)
+  {
+    size_t n = count - first;
+
+    if (n > BATCH_IO_DEPTH)
+    {
+      n = BATCH_IO_DEPTH;
+    }
+    if (use_uring
+        && batch_write_uring(&ring, paths + first, bytes + first,
+                             lengths + first, n, sync, status + first) == 0)
+    {
+      continue;
+    }
+    if (use_uring)
+    {
+      batch_ring_close(&ring);
+      use_uring = false;
+    }
+    batch_write_sync(paths + first, bytes + first, lengths + first, n, sync,
+                     status + first);
+  }
+  if (use_uring)
+  {
+    batch_ring_close(&ring);
+  }
+
+  int retval = batch_any_failed(status, count);
+
+  if (status != results)
+  {
+    free(status);
+  }
+  return retval;
+}
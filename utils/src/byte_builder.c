@@ -0,0 +1,160 @@
+/**
+ * byte_builder.c:
+ *
+ * C library containing the fixed-capacity byte buffer builder supporting
+ * Kmyth serialized formats
+ */
+
+#include "byte_builder.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "defines.h"
+#include "memory_util.h"
+
+//############################################################################
+// byte_builder_init()
+//############################################################################
+int byte_builder_init(byte_builder * builder, size_t capacity)
+{
+  if (builder == NULL || capacity == 0)
+  {
+    kmyth_log(LOG_ERR, "invalid byte builder parameters ... exiting");
+    return 1;
+  }
+
+  builder->buffer = malloc(capacity);
+  if (builder->buffer == NULL)
+  {
+    kmyth_log(LOG_ERR, "malloc error (%zu bytes) ... exiting", capacity);
+    builder->capacity = 0;
+    builder->length = 0;
+    builder->external = false;
+    return 1;
+  }
+  kmyth_advise_huge_pages(builder->buffer, capacity);
+  builder->capacity = capacity;
+  builder->length = 0;
+  builder->external = false;
+
+  return 0;
+}
+
+//############################################################################
+// byte_builder_init_external()
+//############################################################################
+int byte_builder_init_external(byte_builder * builder, uint8_t * buffer,
+                               size_t capacity)
+{
+  if (builder == NULL || buffer == NULL || capacity == 0)
+  {
+    kmyth_log(LOG_ERR, "invalid byte builder parameters ... exiting");
+    return 1;
+  }
+
+  builder->buffer = buffer;
+  builder->capacity = capacity;
+  builder->length = 0;
+  builder->external = true;
+
+  return 0;
+}
+
+//############################################################################
+// byte_builder_reserve()
+//############################################################################
+uint8_t *byte_builder_reserve(byte_builder * builder, size_t len)
+{
+  if (builder == NULL || builder->buffer == NULL ||
+      len > builder->capacity - builder->length)
+  {
+    kmyth_log(LOG_ERR, "byte builder capacity exceeded ... exiting");
+    return NULL;
+  }
+
+  uint8_t *space = builder->buffer + builder->length;
+
+  builder->length += len;
+  return space;
+}
+
+//############################################################################
+// byte_builder_append()
+//############################################################################
+int byte_builder_append(byte_builder * builder, const void *data,
+                        size_t data_len)
+{
+  if (data == NULL && data_len > 0)
+  {
+    kmyth_log(LOG_ERR, "NULL input data ... exiting");
+    return 1;
+  }
+
+  uint8_t *space = byte_builder_reserve(builder, data_len);
+
+  if (space == NULL)
+  {
+    return 1;
+  }
+  if (data_len > 0)
+  {
+    memcpy(space, data, data_len);
+  }
+
+  return 0;
+}
+
+//############################################################################
+// byte_builder_append_sized()
+//############################################################################
+int byte_builder_append_sized(byte_builder * builder, const void *data,
+                              size_t data_len)
+{
+  if (byte_builder_append(builder, &data_len, sizeof(size_t)) ||
+      byte_builder_append(builder, data, data_len))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// byte_builder_finish()
+//############################################################################
+void byte_builder_finish(byte_builder * builder, uint8_t ** output,
+                         size_t * output_length)
+{
+  *output = builder->buffer;
+  *output_length = builder->length;
+
+  builder->buffer = NULL;
+  builder->capacity = 0;
+  builder->length = 0;
+  builder->external = false;
+}
+
+//############################################################################
+// byte_builder_free()
+//############################################################################
+void byte_builder_free(byte_builder * builder)
+{
+  if (builder == NULL)
+  {
+    return;
+  }
+
+  if (builder->external)
+  {
+    kmyth_clear(builder->buffer, builder->capacity);
+  }
+  else
+  {
+    kmyth_clear_and_free(builder->buffer, builder->capacity);
+  }
+  builder->buffer = NULL;
+  builder->capacity = 0;
+  builder->length = 0;
+  builder->external = false;
+}
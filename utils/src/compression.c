@@ -0,0 +1,464 @@
+/**
+ * compression.c:
+ *
+ * C library containing the compression applied to data before it is
+ * sealed by Kmyth applications
+ */
+
+#include "compression.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <zstd.h>
+
+#include "defines.h"
+#include "memory_util.h"
+
+static const struct
+{
+  const char *name;
+  kmyth_compression compression;
+} compression_names[] = {
+  {"none", KMYTH_COMPRESSION_NONE},
+  {"zstd", KMYTH_COMPRESSION_ZSTD},
+};
+
+#define COMPRESSION_NAME_COUNT \
+  (sizeof(compression_names) / sizeof(compression_names[0]))
+
+/**
+ * @brief State of a stream opened with kmyth_compress_reader()
+ */
+typedef struct compress_reader
+{
+  FILE *source;
+  ZSTD_CCtx *cctx;
+  uint8_t *in_buffer;
+  size_t in_capacity;
+  ZSTD_inBuffer in;
+  bool source_done;
+  bool finished;
+} compress_reader;
+
+/**
+ * @brief State of a stream opened with kmyth_decompress_writer()
+ */
+typedef struct decompress_writer
+{
+  FILE *dest;
+  ZSTD_DCtx *dctx;
+  uint8_t *out_buffer;
+  size_t out_capacity;
+  size_t remaining;
+  bool failed;
+} decompress_writer;
+
+//############################################################################
+// kmyth_compression_from_string()
+//############################################################################
+int kmyth_compression_from_string(const char *name,
+                                  kmyth_compression * compression)
+{
+  if (name == NULL || compression == NULL)
+  {
+    return 1;
+  }
+
+  for (size_t i = 0; i < COMPRESSION_NAME_COUNT; i++)
+  {
+    if (strcasecmp(name, compression_names[i].name) == 0)
+    {
+      *compression = compression_names[i].compression;
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+//############################################################################
+// kmyth_compression_name()
+//############################################################################
+const char *kmyth_compression_name(kmyth_compression compression)
+{
+  for (size_t i = 0; i < COMPRESSION_NAME_COUNT; i++)
+  {
+    if (compression_names[i].compression == compression)
+    {
+      return compression_names[i].name;
+    }
+  }
+
+  return NULL;
+}
+
+//############################################################################
+// kmyth_compress_data()
+//############################################################################
+int kmyth_compress_data(kmyth_compression compression,
+                        uint8_t * input, size_t input_len,
+                        uint8_t ** output, size_t * output_len)
+{
+  if (compression != KMYTH_COMPRESSION_ZSTD)
+  {
+    kmyth_log(LOG_ERR, "unsupported compression (%d) ... exiting",
+              compression);
+    return 1;
+  }
+  if ((input == NULL && input_len > 0) || output == NULL ||
+      output_len == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid compression arguments ... exiting");
+    return 1;
+  }
+
+  size_t bound = ZSTD_compressBound(input_len);
+
+  if (bound == 0 || ZSTD_isError(bound))
+  {
+    kmyth_log(LOG_ERR, "input too large to compress ... exiting");
+    return 1;
+  }
+
+  uint8_t *buffer = malloc(bound);
+
+  if (buffer == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate compression buffer ... exiting");
+    return 1;
+  }
+
+  size_t length = ZSTD_compress(buffer, bound, input, input_len,
+                                KMYTH_ZSTD_LEVEL);
+
+  if (ZSTD_isError(length))
+  {
+    kmyth_log(LOG_ERR, "compression failed (%s) ... exiting",
+              ZSTD_getErrorName(length));
+    free(buffer);
+    return 1;
+  }
+
+  *output = buffer;
+  *output_len = length;
+  return 0;
+}
+
+//############################################################################
+// kmyth_decompress_data()
+//############################################################################
+int kmyth_decompress_data(kmyth_compression compression,
+                          uint8_t * input, size_t input_len,
+                          uint8_t ** output, size_t * output_len)
+{
+  if (compression != KMYTH_COMPRESSION_ZSTD)
+  {
+    kmyth_log(LOG_ERR, "unsupported compression (%d) ... exiting",
+              compression);
+    return 1;
+  }
+  if (input == NULL || input_len == 0 || output == NULL ||
+      output_len == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid decompression arguments ... exiting");
+    return 1;
+  }
+
+  // a buffer compressed whole records its size, a compressed stream does
+  // not (the spare byte lets the loop below see that all output is out)
+  unsigned long long content_size = ZSTD_getFrameContentSize(input,
+                                                             input_len);
+
+  if (content_size == ZSTD_CONTENTSIZE_ERROR)
+  {
+    kmyth_log(LOG_ERR, "invalid compressed data ... exiting");
+    return 1;
+  }
+
+  size_t capacity = (input_len < SIZE_MAX / 4) ? input_len * 4 : input_len;
+
+  if (content_size != ZSTD_CONTENTSIZE_UNKNOWN && content_size < SIZE_MAX)
+  {
+    capacity = (size_t) content_size + 1;
+  }
+
+  uint8_t *buffer = malloc(capacity);
+  ZSTD_DCtx *dctx = ZSTD_createDCtx();
+
+  if (buffer == NULL || dctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate decompression buffer ... exiting");
+    free(buffer);
+    ZSTD_freeDCtx(dctx);
+    return 1;
+  }
+
+  ZSTD_inBuffer in = { input, input_len, 0 };
+  size_t length = 0;
+  size_t remaining = 1;
+
+  while (true)
+  {
+    // grown buffers hold plaintext, so the old one is cleared, not
+    // simply realloc()'d away
+    if (length == capacity)
+    {
+      uint8_t *grown = (capacity > SIZE_MAX / 2) ? NULL : malloc(capacity * 2);
+
+      if (grown == NULL)
+      {
+        kmyth_log(LOG_ERR, "unable to grow decompression buffer ... exiting");
+        kmyth_clear_and_free(buffer, capacity);
+        ZSTD_freeDCtx(dctx);
+        return 1;
+      }
+      memcpy(grown, buffer, length);
+      kmyth_clear_and_free(buffer, capacity);
+      buffer = grown;
+      capacity *= 2;
+    }
+
+    ZSTD_outBuffer out = { buffer + length, capacity - length, 0 };
+
+    remaining = ZSTD_decompressStream(dctx, &out, &in);
+    if (ZSTD_isError(remaining))
+    {
+      kmyth_log(LOG_ERR, "decompression failed (%s) ... exiting",
+                ZSTD_getErrorName(remaining));
+      kmyth_clear_and_free(buffer, capacity);
+      ZSTD_freeDCtx(dctx);
+      return 1;
+    }
+    length += out.pos;
+    if (in.pos == in.size && out.pos < out.size)
+    {
+      break;
+    }
+  }
+  ZSTD_freeDCtx(dctx);
+
+  if (remaining != 0)
+  {
+    kmyth_log(LOG_ERR, "truncated compressed data ... exiting");
+    kmyth_clear_and_free(buffer, capacity);
+    return 1;
+  }
+
+  *output = buffer;
+  *output_len = length;
+  return 0;
+}
+
+//############################################################################
+// compress_reader_read()
+//############################################################################
+static ssize_t compress_reader_read(void *cookie, char *buf, size_t size)
+{
+  compress_reader *reader = (compress_reader *) cookie;
+  ZSTD_outBuffer out = { buf, size, 0 };
+
+  while (out.pos < out.size && !reader->finished)
+  {
+    if (reader->in.pos == reader->in.size && !reader->source_done)
+    {
+      // return what is already compressed rather than wait on more input
+      // (e.g., from a pipe)
+      if (out.pos > 0)
+      {
+        break;
+      }
+
+      size_t in_len = fread(reader->in_buffer, 1, reader->in_capacity,
+                            reader->source);
+
+      if (ferror(reader->source))
+      {
+        return -1;
+      }
+      reader->source_done = (feof(reader->source) != 0);
+      reader->in.src = reader->in_buffer;
+      reader->in.size = in_len;
+      reader->in.pos = 0;
+    }
+
+    bool last = reader->source_done && reader->in.pos == reader->in.size;
+    size_t ret = ZSTD_compressStream2(reader->cctx, &out, &reader->in,
+                                      (last) ? ZSTD_e_end : ZSTD_e_continue);
+
+    if (ZSTD_isError(ret))
+    {
+      return -1;
+    }
+    reader->finished = (last && ret == 0);
+  }
+
+  return (ssize_t) out.pos;
+}
+
+//############################################################################
+// compress_reader_close()
+//############################################################################
+static int compress_reader_close(void *cookie)
+{
+  compress_reader *reader = (compress_reader *) cookie;
+
+  kmyth_clear_and_free(reader->in_buffer, reader->in_capacity);
+  ZSTD_freeCCtx(reader->cctx);
+  free(reader);
+  return 0;
+}
+
+//############################################################################
+// kmyth_compress_reader()
+//############################################################################
+FILE *kmyth_compress_reader(FILE * source, kmyth_compression compression)
+{
+  if (source == NULL || compression != KMYTH_COMPRESSION_ZSTD)
+  {
+    kmyth_log(LOG_ERR, "invalid compression stream arguments ... exiting");
+    return NULL;
+  }
+
+  compress_reader *reader = calloc(1, sizeof(compress_reader));
+
+  if (reader == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate compression stream ... exiting");
+    return NULL;
+  }
+  reader->source = source;
+  reader->in_capacity = ZSTD_CStreamInSize();
+  reader->in_buffer = malloc(reader->in_capacity);
+  reader->cctx = ZSTD_createCCtx();
+  if (reader->in_buffer == NULL || reader->cctx == NULL ||
+      ZSTD_isError(ZSTD_CCtx_setParameter(reader->cctx,
+                                          ZSTD_c_compressionLevel,
+                                          KMYTH_ZSTD_LEVEL)))
+  {
+    kmyth_log(LOG_ERR, "unable to set up compression stream ... exiting");
+    compress_reader_close(reader);
+    return NULL;
+  }
+
+  cookie_io_functions_t functions = {
+    .read = compress_reader_read,
+    .close = compress_reader_close,
+  };
+  FILE *stream = fopencookie(reader, "r", functions);
+
+  if (stream == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to open compression stream ... exiting");
+    compress_reader_close(reader);
+    return NULL;
+  }
+
+  // reads go straight to the compressor, so no copy of the data is left
+  // in a stdio buffer
+  setvbuf(stream, NULL, _IONBF, 0);
+  return stream;
+}
+
+//############################################################################
+// decompress_writer_write()
+//############################################################################
+static ssize_t decompress_writer_write(void *cookie, const char *buf,
+                                       size_t size)
+{
+  decompress_writer *writer = (decompress_writer *) cookie;
+  ZSTD_inBuffer in = { buf, size, 0 };
+  ZSTD_outBuffer out = { writer->out_buffer, writer->out_capacity, 0 };
+
+  if (writer->failed)
+  {
+    return 0;
+  }
+
+  // keep going while input remains, or while a full output buffer says
+  // more output may be pending
+  do
+  {
+    out.pos = 0;
+
+    size_t ret = ZSTD_decompressStream(writer->dctx, &out, &in);
+
+    if (ZSTD_isError(ret) ||
+        fwrite(writer->out_buffer, 1, out.pos, writer->dest) != out.pos)
+    {
+      writer->failed = true;
+      return 0;
+    }
+    writer->remaining = ret;
+  }
+  while (in.pos < in.size || out.pos == out.size);
+
+  return (ssize_t) size;
+}
+
+//############################################################################
+// decompress_writer_close()
+//############################################################################
+static int decompress_writer_close(void *cookie)
+{
+  decompress_writer *writer = (decompress_writer *) cookie;
+  int retval = (writer->failed || writer->remaining != 0) ? -1 : 0;
+
+  kmyth_clear_and_free(writer->out_buffer, writer->out_capacity);
+  ZSTD_freeDCtx(writer->dctx);
+  free(writer);
+  return retval;
+}
+
+//############################################################################
+// kmyth_decompress_writer()
+//############################################################################
+FILE *kmyth_decompress_writer(FILE * dest, kmyth_compression compression)
+{
+  if (dest == NULL || compression != KMYTH_COMPRESSION_ZSTD)
+  {
+    kmyth_log(LOG_ERR, "invalid decompression stream arguments ... exiting");
+    return NULL;
+  }
+
+  decompress_writer *writer = calloc(1, sizeof(decompress_writer));
+
+  if (writer == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate decompression stream ... exiting");
+    return NULL;
+  }
+  writer->dest = dest;
+  writer->remaining = 1;
+  writer->out_capacity = ZSTD_DStreamOutSize();
+  writer->out_buffer = malloc(writer->out_capacity);
+  writer->dctx = ZSTD_createDCtx();
+  if (writer->out_buffer == NULL || writer->dctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to set up decompression stream ... exiting");
+    writer->remaining = 0;
+    decompress_writer_close(writer);
+    return NULL;
+  }
+
+  cookie_io_functions_t functions = {
+    .write = decompress_writer_write,
+    .close = decompress_writer_close,
+  };
+  FILE *stream = fopencookie(writer, "w", functions);
+
+  if (stream == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to open decompression stream ... exiting");
+    writer->remaining = 0;
+    decompress_writer_close(writer);
+    return NULL;
+  }
+
+  // writes go straight to the decompressor, so no copy of the data is left
+  // in a stdio buffer
+  setvbuf(stream, NULL, _IONBF, 0);
+  return stream;
+}
@@ -0,0 +1,457 @@
+/**
+ * config_file.c:
+ *
+ * C library containing the Kmyth configuration file support for Kmyth
+ * applications
+ */
+
+#include "config_file.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "defines.h"
+
+/**
+ * @brief Settings holding TPM authorization values, which are only read
+ *        from a configuration file that other users cannot read
+ */
+static const char *const config_auth_settings[] = {
+  "auth_string",
+  "owner_auth",
+  "old_auth",
+  NULL
+};
+
+/**
+ * @brief Rank of a configuration file section: the settings of the
+ *        sections that apply to a tool are given to it in this order
+ */
+typedef enum config_rank
+{
+  CONFIG_RANK_DEFAULT = 0,
+  CONFIG_RANK_TOOL,
+  CONFIG_RANK_PROFILE,
+  CONFIG_RANK_COUNT,
+  CONFIG_RANK_NONE = CONFIG_RANK_COUNT,
+} config_rank;
+
+/**
+ * @brief Options collected, per section rank, from a configuration file
+ */
+typedef struct config_args
+{
+  char **args[CONFIG_RANK_COUNT];
+  size_t count[CONFIG_RANK_COUNT];
+} config_args;
+
+//############################################################################
+// config_trim()
+//############################################################################
+static char *config_trim(char *str)
+{
+  while (isspace((unsigned char) *str))
+  {
+    str++;
+  }
+
+  char *end = str + strlen(str);
+
+  while (end > str && isspace((unsigned char) end[-1]))
+  {
+    end--;
+  }
+  *end = '\0';
+
+  return str;
+}
+
+//############################################################################
+// config_is_auth_setting()
+//############################################################################
+static bool config_is_auth_setting(const char *name)
+{
+  for (size_t i = 0; config_auth_settings[i] != NULL; i++)
+  {
+    if (strcmp(name, config_auth_settings[i]) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+//############################################################################
+// config_is_trusted()
+//
+// A configuration file, or the directory holding it, is trusted when it is
+// owned by root or by the user running the tool and others cannot change it
+//############################################################################
+static bool config_is_trusted(const struct stat *st)
+{
+  return (st->st_uid == 0 || st->st_uid == geteuid())
+    && !(st->st_mode & (S_IWGRP | S_IWOTH));
+}
+
+//############################################################################
+// config_args_free()
+//############################################################################
+static void config_args_free(config_args * args)
+{
+  for (int rank = 0; rank < CONFIG_RANK_COUNT; rank++)
+  {
+    for (size_t i = 0; i < args->count[rank]; i++)
+    {
+      free(args->args[rank][i]);
+    }
+    free(args->args[rank]);
+  }
+}
+
+//############################################################################
+// config_add_setting()
+//
+// Adds a setting (of a section applying to the tool) as a long option,
+// when the tool has that option
+//############################################################################
+static int config_add_setting(const struct option *longopts,
+                              config_args * args, config_rank rank,
+                              const char *name, const char *value,
+                              const char *path, size_t line_number)
+{
+  const struct option *opt = longopts;
+
+  while (opt->name != NULL && strcmp(opt->name, name) != 0)
+  {
+    opt++;
+  }
+  if (opt->name == NULL)
+  {
+    kmyth_log(LOG_DEBUG, "ignoring setting %s (%s:%zu) this tool does not "
+              "have", name, path, line_number);
+    return 0;
+  }
+
+  char *arg = NULL;
+
+  if (opt->has_arg == no_argument)
+  {
+    if (*value == '\0' || strcasecmp(value, "yes") == 0
+        || strcasecmp(value, "true") == 0 || strcmp(value, "1") == 0)
+    {
+      if (asprintf(&arg, "--%s", name) < 0)
+      {
+        arg = NULL;
+      }
+    }
+    else if (strcasecmp(value, "no") == 0 || strcasecmp(value, "false") == 0
+             || strcmp(value, "0") == 0)
+    {
+      return 0;
+    }
+    else
+    {
+      kmyth_log(LOG_ERR, "invalid value for %s (%s:%zu) ... exiting", name,
+                path, line_number);
+      return 1;
+    }
+  }
+  else
+  {
+    if (*value == '\0' && opt->has_arg == required_argument)
+    {
+      kmyth_log(LOG_ERR, "no value for %s (%s:%zu) ... exiting", name, path,
+                line_number);
+      return 1;
+    }
+    if (asprintf(&arg, "--%s=%s", name, value) < 0)
+    {
+      arg = NULL;
+    }
+  }
+
+  char **grown = NULL;
+
+  if (arg == NULL
+      || (grown = realloc(args->args[rank],
+                          (args->count[rank] + 1) * sizeof(char *))) == NULL)
+  {
+    kmyth_log(LOG_ERR, "memory allocation failed ... exiting");
+    free(arg);
+    return 1;
+  }
+  grown[args->count[rank]++] = arg;
+  args->args[rank] = grown;
+
+  return 0;
+}
+
+//############################################################################
+// config_read()
+//
+// Collects the settings of the sections of a configuration file that apply
+// to a tool
+//############################################################################
+static int config_read(FILE * file, const char *path,
+                       const struct option *longopts, const char *tool,
+                       const char *profile, bool readable_by_others,
+                       bool *profile_found, config_args * args)
+{
+  char *line = NULL;
+  size_t line_size = 0;
+  size_t line_number = 0;
+  bool in_section = false;
+  config_rank rank = CONFIG_RANK_NONE;
+  int retval = 0;
+
+  while (retval == 0 && getline(&line, &line_size, file) != -1)
+  {
+    char *text = config_trim(line);
+
+    line_number++;
+    if (*text == '\0' || *text == '#' || *text == ';')
+    {
+      continue;
+    }
+
+    // a section header: '[name]'
+    if (*text == '[')
+    {
+      size_t len = strlen(text);
+
+      if (text[len - 1] != ']')
+      {
+        kmyth_log(LOG_ERR, "malformed section header (%s:%zu) ... exiting",
+                  path, line_number);
+        retval = 1;
+        break;
+      }
+      text[len - 1] = '\0';
+
+      char *name = config_trim(text + 1);
+
+      in_section = true;
+      rank = CONFIG_RANK_NONE;
+      if (strcmp(name, "default") == 0)
+      {
+        rank = CONFIG_RANK_DEFAULT;
+      }
+      else if (strcmp(name, tool) == 0)
+      {
+        rank = CONFIG_RANK_TOOL;
+      }
+      else if (profile != NULL && strcmp(name, profile) == 0)
+      {
+        rank = CONFIG_RANK_PROFILE;
+        *profile_found = true;
+      }
+      continue;
+    }
+
+    // a setting: 'name = value' or (for an option without an argument) 'name'
+    if (!in_section)
+    {
+      kmyth_log(LOG_ERR, "setting outside of a section (%s:%zu) ... exiting",
+                path, line_number);
+      retval = 1;
+      break;
+    }
+    char *value = strchr(text, '=');
+
+    if (value != NULL)
+    {
+      *value++ = '\0';
+      value = config_trim(value);
+    }
+    else
+    {
+      value = "";
+    }
+
+    char *name = config_trim(text);
+
+    if (*name == '\0')
+    {
+      kmyth_log(LOG_ERR, "malformed setting (%s:%zu) ... exiting", path,
+                line_number);
+      retval = 1;
+      break;
+    }
+
+    // an authorization value in a file others may read is refused, even
+    // in a section that does not apply to this tool
+    if (readable_by_others && config_is_auth_setting(name))
+    {
+      kmyth_log(LOG_ERR, "configuration file %s holds %s (%s:%zu) but is "
+                "readable by other users ... exiting", path, name, path,
+                line_number);
+      retval = 1;
+      break;
+    }
+    if (rank == CONFIG_RANK_NONE)
+    {
+      continue;
+    }
+    retval = config_add_setting(longopts, args, rank, name, value, path,
+                                line_number);
+  }
+
+  free(line);
+  return retval;
+}
+
+//############################################################################
+// kmyth_config_apply()
+//############################################################################
+int kmyth_config_apply(const struct option *longopts, int *argc,
+                       char ***argv)
+{
+  if (longopts == NULL || argc == NULL || argv == NULL || *argc < 1)
+  {
+    kmyth_log(LOG_ERR, "invalid arguments ... exiting");
+    return 1;
+  }
+
+  const char *path = getenv(KMYTH_CONFIG_FILE_ENV);
+  bool path_configured = (path != NULL);
+
+  if (path == NULL)
+  {
+    path = KMYTH_CONFIG_FILE;
+  }
+
+  const char *profile = getenv(KMYTH_PROFILE_ENV);
+
+  if (profile != NULL && *profile == '\0')
+  {
+    profile = NULL;
+  }
+
+  // an empty path disables the configuration file
+  if (*path == '\0')
+  {
+    return 0;
+  }
+
+  FILE *file = fopen(path, "r");
+
+  if (file == NULL)
+  {
+    // the file is optional, unless it or a profile in it was asked for
+    if (errno == ENOENT && !path_configured && profile == NULL)
+    {
+      return 0;
+    }
+    kmyth_log(LOG_ERR, "unable to open configuration file %s ... exiting",
+              path);
+    return 1;
+  }
+
+  // the file may hold authorization values and decides the TPM and key
+  // servers a tool uses, so one that others may change (or replace, through
+  // its directory) is not trusted
+  struct stat st = { 0 };
+
+  if (fstat(fileno(file), &st) != 0 || !config_is_trusted(&st))
+  {
+    kmyth_log(LOG_ERR, "configuration file %s is not owned by root or the "
+              "current user, or is writable by other users ... exiting",
+              path);
+    fclose(file);
+    return 1;
+  }
+
+  const char *base = strrchr(path, '/');
+  char *dir = (base == NULL) ? strdup(".")
+    : (base == path) ? strdup("/") : strndup(path, base - path);
+  struct stat dir_st = { 0 };
+
+  if (dir == NULL || stat(dir, &dir_st) != 0 || !config_is_trusted(&dir_st))
+  {
+    kmyth_log(LOG_ERR, "directory of configuration file %s is not owned by "
+              "root or the current user, or is writable by other users "
+              "... exiting", path);
+    free(dir);
+    fclose(file);
+    return 1;
+  }
+  free(dir);
+
+  const char *tool = strrchr((*argv)[0], '/');
+
+  tool = (tool == NULL) ? (*argv)[0] : tool + 1;
+
+  config_args args = { 0 };
+  bool profile_found = false;
+
+  if (config_read(file, path, longopts, tool, profile,
+                  (st.st_mode & (S_IRGRP | S_IROTH)) != 0, &profile_found,
+                  &args))
+  {
+    fclose(file);
+    config_args_free(&args);
+    return 1;
+  }
+  fclose(file);
+
+  if (profile != NULL && !profile_found)
+  {
+    kmyth_log(LOG_ERR, "no profile %s in configuration file %s ... exiting",
+              profile, path);
+    config_args_free(&args);
+    return 1;
+  }
+
+  size_t added = 0;
+
+  for (int rank = 0; rank < CONFIG_RANK_COUNT; rank++)
+  {
+    added += args.count[rank];
+  }
+  if (added == 0)
+  {
+    config_args_free(&args);
+    return 0;
+  }
+
+  // argv[0], then the configured options, then the command line options
+  char **new_argv = calloc(*argc + added + 1, sizeof(char *));
+
+  if (new_argv == NULL)
+  {
+    kmyth_log(LOG_ERR, "memory allocation failed ... exiting");
+    config_args_free(&args);
+    return 1;
+  }
+
+  size_t index = 0;
+
+  new_argv[index++] = (*argv)[0];
+  for (int rank = 0; rank < CONFIG_RANK_COUNT; rank++)
+  {
+    for (size_t i = 0; i < args.count[rank]; i++)
+    {
+      new_argv[index++] = args.args[rank][i];
+    }
+    free(args.args[rank]);
+  }
+  for (int i = 1; i < *argc; i++)
+  {
+    new_argv[index++] = (*argv)[i];
+  }
+  new_argv[index] = NULL;
+
+  kmyth_log(LOG_DEBUG, "applied %zu setting(s) from %s", added, path);
+
+  *argc = (int) index;
+  *argv = new_argv;
+
+  return 0;
+}
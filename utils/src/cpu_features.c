@@ -0,0 +1,205 @@
+/**
+ * cpu_features.c:
+ *
+ * C library containing the CPU feature detection used to select among
+ * Kmyth's vectorized kernel implementations
+ */
+
+#include "cpu_features.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "defines.h"
+
+// set in cpu_hw_features once the CPU has been probed
+#define KMYTH_CPU_DETECTED (1u << 31)
+
+#define KMYTH_CPU_LEVEL_SSE4_2 (KMYTH_CPU_SSE2 | KMYTH_CPU_SSSE3 | \
+                                KMYTH_CPU_SSE4_1 | KMYTH_CPU_SSE4_2 | \
+                                KMYTH_CPU_AESNI)
+#define KMYTH_CPU_LEVEL_AVX2 (KMYTH_CPU_LEVEL_SSE4_2 | KMYTH_CPU_AVX2)
+#define KMYTH_CPU_LEVEL_AVX512 (KMYTH_CPU_LEVEL_AVX2 | KMYTH_CPU_AVX512F | \
+                                KMYTH_CPU_AVX512BW)
+
+// the instruction set levels, from lowest to highest, each listing the
+// features a limit to it allows
+static const struct
+{
+  const char *name;
+  uint32_t features;
+} cpu_levels[] = {
+  {"scalar", 0},
+  {"sse4.2", KMYTH_CPU_LEVEL_SSE4_2},
+  {"avx2", KMYTH_CPU_LEVEL_AVX2},
+  {"avx512", KMYTH_CPU_LEVEL_AVX512},
+  {"neon", KMYTH_CPU_NEON},
+};
+
+#define KMYTH_CPU_LEVEL_COUNT (sizeof(cpu_levels) / sizeof(cpu_levels[0]))
+
+static atomic_uint cpu_hw_features = 0;
+static atomic_uint cpu_limit = UINT32_MAX;
+
+//############################################################################
+// cpu_probe()
+//############################################################################
+static uint32_t cpu_probe(void)
+{
+  uint32_t features = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+  // __builtin_cpu_supports() also checks that the OS saves the extended
+  // (AVX and AVX-512) register state
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+  {
+    features |= KMYTH_CPU_SSE2;
+  }
+  if (__builtin_cpu_supports("ssse3"))
+  {
+    features |= KMYTH_CPU_SSSE3;
+  }
+  if (__builtin_cpu_supports("sse4.1"))
+  {
+    features |= KMYTH_CPU_SSE4_1;
+  }
+  if (__builtin_cpu_supports("sse4.2"))
+  {
+    features |= KMYTH_CPU_SSE4_2;
+  }
+  if (__builtin_cpu_supports("avx2"))
+  {
+    features |= KMYTH_CPU_AVX2;
+  }
+  if (__builtin_cpu_supports("avx512f"))
+  {
+    features |= KMYTH_CPU_AVX512F;
+  }
+  if (__builtin_cpu_supports("avx512bw"))
+  {
+    features |= KMYTH_CPU_AVX512BW;
+  }
+  if (__builtin_cpu_supports("aes"))
+  {
+    features |= KMYTH_CPU_AESNI;
+  }
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+  // Advanced SIMD is a mandatory part of AArch64
+  features |= KMYTH_CPU_NEON;
+#endif
+
+  return features;
+}
+
+//############################################################################
+// cpu_find_level()
+//############################################################################
+static int cpu_find_level(const char *level, uint32_t * features)
+{
+  if (level == NULL || strcmp(level, "native") == 0)
+  {
+    *features = UINT32_MAX;
+    return 0;
+  }
+
+  for (size_t i = 0; i < KMYTH_CPU_LEVEL_COUNT; i++)
+  {
+    if (strcmp(level, cpu_levels[i].name) == 0)
+    {
+      *features = cpu_levels[i].features;
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+//############################################################################
+// cpu_hw()
+//############################################################################
+static uint32_t cpu_hw(void)
+{
+  uint32_t hw = atomic_load(&cpu_hw_features);
+
+  // probing is idempotent, so concurrent first calls may each probe
+  if (!(hw & KMYTH_CPU_DETECTED))
+  {
+    hw = cpu_probe() | KMYTH_CPU_DETECTED;
+    atomic_store(&cpu_hw_features, hw);
+  }
+
+  return hw & ~KMYTH_CPU_DETECTED;
+}
+
+//############################################################################
+// cpu_features_init()
+//
+// Probes the CPU, and applies any KMYTH_CPU_FEATURES limit, as the library
+// is loaded. An unrecognized KMYTH_CPU_FEATURES value is ignored.
+//############################################################################
+__attribute__((constructor))
+static void cpu_features_init(void)
+{
+  uint32_t limit = UINT32_MAX;
+
+  cpu_hw();
+  if (cpu_find_level(getenv(KMYTH_CPU_FEATURES_ENV), &limit) == 0)
+  {
+    atomic_store(&cpu_limit, limit);
+  }
+}
+
+//############################################################################
+// kmyth_cpu_features()
+//############################################################################
+uint32_t kmyth_cpu_features(void)
+{
+  return cpu_hw() & atomic_load(&cpu_limit);
+}
+
+//############################################################################
+// kmyth_cpu_has()
+//############################################################################
+bool kmyth_cpu_has(uint32_t features)
+{
+  return (kmyth_cpu_features() & features) == features;
+}
+
+//############################################################################
+// kmyth_cpu_set_limit()
+//############################################################################
+int kmyth_cpu_set_limit(const char *level)
+{
+  uint32_t limit = UINT32_MAX;
+
+  if (cpu_find_level(level, &limit))
+  {
+    return 1;
+  }
+  atomic_store(&cpu_limit, limit);
+  return 0;
+}
+
+//############################################################################
+// kmyth_cpu_level_name()
+//############################################################################
+const char *kmyth_cpu_level_name(void)
+{
+  // AES-NI is allowed from the sse4.2 level up, but not required for it
+  uint32_t features = kmyth_cpu_features() | KMYTH_CPU_AESNI;
+  const char *name = cpu_levels[0].name;
+
+  for (size_t i = 1; i < KMYTH_CPU_LEVEL_COUNT; i++)
+  {
+    if ((features & cpu_levels[i].features) == cpu_levels[i].features)
+    {
+      name = cpu_levels[i].name;
+    }
+  }
+
+  return name;
+}
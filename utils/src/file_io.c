@@ -7,12 +7,19 @@
 
 #include "file_io.h"
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <libgen.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <openssl/bio.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 
 #include "defines.h"
 
@@ -126,96 +133,177 @@ int verifyOutputFilePath(char *path)
 int read_bytes_from_file(char *input_path, uint8_t ** data,
                          size_t * data_length)
 {
-
-  // Create a BIO for the input file
-  BIO *bio = NULL;
-
-  if ((bio = BIO_new(BIO_s_file())) == NULL)
+  if (input_path == NULL)
   {
-    kmyth_log(LOG_ERR, "unable to create BIO ... exiting");
+    kmyth_log(LOG_ERR, "NULL input path ... exiting");
     return 1;
   }
 
-  // Assign the input file to the BIO 
-  if (!BIO_read_filename(bio, input_path))
+  int fd = open(input_path, O_RDONLY);
+
+  if (fd == -1)
   {
     kmyth_log(LOG_ERR, "error opening input file: %s ... exiting", input_path);
-    if (!BIO_free(bio))
-    {
-      kmyth_log(LOG_ERR, "error freeing BIO ... exiting");
-    }
     return 1;
   }
 
-  // Determine size of file
+  // Determine size of file (from the open descriptor, so that the size and
+  // the data read are guaranteed to refer to the same file)
   struct stat st;
 
-  if (stat(input_path, &st) == -1)
+  if (fstat(fd, &st) == -1)
   {
     kmyth_log(LOG_ERR,
               "input file (%s) stats could not be retrieved ... exiting",
               input_path);
-    if (!BIO_free(bio))
-    {
-      kmyth_log(LOG_ERR, "error freeing BIO ... exiting");
-    }
+    close(fd);
+    return 1;
+  }
+  if (st.st_size < 0 || (uintmax_t) st.st_size > SIZE_MAX)
+  {
+    kmyth_log(LOG_ERR, "input file (%s) too large ... exiting", input_path);
+    close(fd);
     return 1;
   }
-  int input_size = st.st_size;
+  size_t input_size = (size_t) st.st_size;
 
   if (input_size == 0)
   {
-    if (!BIO_free(bio))
-    {
-      kmyth_log(LOG_ERR, "error freeing BIO ... exiting");
-    }
+    close(fd);
     *data_length = 0;
     *data = NULL;
     return 0;
   }
 
-  // Create data buffer and read file into it
+  // Create data buffer and read file directly into it
   *data = (uint8_t *) malloc(input_size);
-  if (data == NULL)
+  if (*data == NULL)
   {
     kmyth_log(LOG_ERR, "could not allocate memory to read file ... exiting");
-    if (!BIO_free(bio))
-    {
-      kmyth_log(LOG_ERR, "error freeing BIO ... exiting");
-    }
+    close(fd);
     return 1;
   }
-  *data_length = BIO_read(bio, *data, input_size);
-  if (*data_length <= 0)
+
+  size_t bytes_read = 0;
+
+  while (bytes_read < input_size)
   {
-    kmyth_log(LOG_ERR, "no data read from input file ... exiting");
-    if (!BIO_free(bio))
+    ssize_t rv = read(fd, *data + bytes_read, input_size - bytes_read);
+
+    if (rv == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (rv <= 0)
     {
-      kmyth_log(LOG_ERR, "error freeing BIO ... exiting");
+      break;
     }
+    bytes_read += (size_t) rv;
+  }
+  close(fd);
+
+  if (bytes_read != input_size)
+  {
+    kmyth_log(LOG_ERR, "file size = %zu bytes, bytes read = %zu "
+              "... exiting", input_size, bytes_read);
+    kmyth_clear_and_free(*data, input_size);
+    *data = NULL;
     return 1;
   }
+  *data_length = input_size;
+
+  return 0;
+}
 
-  if (*data_length != input_size)
+//############################################################################
+// map_bytes_from_file()
+//############################################################################
+int map_bytes_from_file(char *input_path, uint8_t ** data,
+                        size_t * data_length)
+{
+  if (input_path == NULL)
   {
-    kmyth_log(LOG_ERR, "file size = %d bytes, buffer size = %d bytes "
-              "... exiting", input_size, *data_length);
-    if (!BIO_free(bio))
-    {
-      kmyth_log(LOG_ERR, "error freeing BIO ... exiting");
-    }
+    kmyth_log(LOG_ERR, "NULL input path ... exiting");
     return 1;
   }
 
-  if (!BIO_free(bio))
+  int fd = open(input_path, O_RDONLY);
+
+  if (fd == -1)
   {
-    kmyth_log(LOG_ERR, "error freeing BIO ... exiting");
+    kmyth_log(LOG_ERR, "error opening input file: %s ... exiting", input_path);
     return 1;
   }
 
+  struct stat st;
+
+  if (fstat(fd, &st) == -1)
+  {
+    kmyth_log(LOG_ERR,
+              "input file (%s) stats could not be retrieved ... exiting",
+              input_path);
+    close(fd);
+    return 1;
+  }
+  if (!S_ISREG(st.st_mode))
+  {
+    kmyth_log(LOG_ERR,
+              "input file (%s) is not a regular file ... exiting", input_path);
+    close(fd);
+    return 1;
+  }
+  if (st.st_size < 0 || (uintmax_t) st.st_size > SIZE_MAX)
+  {
+    kmyth_log(LOG_ERR, "input file (%s) too large ... exiting", input_path);
+    close(fd);
+    return 1;
+  }
+
+  // an empty file cannot be mapped - report it the same way
+  // read_bytes_from_file() does
+  if (st.st_size == 0)
+  {
+    close(fd);
+    *data_length = 0;
+    *data = NULL;
+    return 0;
+  }
+
+  void *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  // the mapping holds its own reference to the file
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    kmyth_log(LOG_ERR, "unable to map input file (%s) ... exiting",
+              input_path);
+    return 1;
+  }
+
+  // inputs are consumed front to back, so ask for aggressive read-ahead
+  madvise(map, (size_t) st.st_size, MADV_SEQUENTIAL);
+
+  *data = (uint8_t *) map;
+  *data_length = (size_t) st.st_size;
+
   return 0;
 }
 
+//############################################################################
+// unmap_bytes_from_file()
+//############################################################################
+void unmap_bytes_from_file(uint8_t * data, size_t data_length)
+{
+  if (data == NULL || data_length == 0)
+  {
+    return;
+  }
+  if (munmap(data, data_length) == -1)
+  {
+    kmyth_log(LOG_WARNING, "error unmapping input file data");
+  }
+}
+
 //############################################################################
 // write_bytes_to_file
 //############################################################################
@@ -227,23 +315,455 @@ int write_bytes_to_file(char *output_path, uint8_t * bytes, size_t bytes_length)
     kmyth_log(LOG_ERR, "invalid output path (%s) ... exiting", output_path);
     return 1;
   }
-  FILE *file = fopen(output_path, "w");
+  int fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
 
-  if (file == NULL)
+  if (fd == -1)
   {
     kmyth_log(LOG_ERR, "unable to open file: %s ... exiting", output_path);
     return 1;
   }
   kmyth_log(LOG_DEBUG, "opened file \"%s\" for writing", output_path);
 
-  if (fwrite(bytes, sizeof(uint8_t), bytes_length, file) != bytes_length)
+  // reserve the full extent up front so a large output is laid out in one
+  // allocation (and a full filesystem is reported before anything is written)
+  if (bytes_length > 0)
   {
-    kmyth_log(LOG_ERR, "Error writing file ... exiting");
-    return 1;
+    int rv = posix_fallocate(fd, 0, (off_t) bytes_length);
+
+    if (rv != 0 && rv != EINVAL && rv != EOPNOTSUPP)
+    {
+      kmyth_log(LOG_ERR, "unable to allocate %zu bytes for %s ... exiting",
+                bytes_length, output_path);
+      close(fd);
+      return 1;
+    }
+  }
+
+  size_t bytes_written = 0;
+
+  while (bytes_written < bytes_length)
+  {
+    ssize_t rv = write(fd, bytes + bytes_written,
+                       bytes_length - bytes_written);
+
+    if (rv == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (rv <= 0)
+    {
+      kmyth_log(LOG_ERR, "Error writing file ... exiting");
+      close(fd);
+      return 1;
+    }
+    bytes_written += (size_t) rv;
   }
 
   // close the output .ski file
-  fclose(file);
+  if (close(fd) == -1)
+  {
+    kmyth_log(LOG_ERR, "Error closing file ... exiting");
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// write_bytes_to_new_file()
+//############################################################################
+int write_bytes_to_new_file(const char *output_path, const uint8_t * bytes,
+                            size_t bytes_length, mode_t mode)
+{
+  if (output_path == NULL || (bytes == NULL && bytes_length > 0))
+  {
+    kmyth_log(LOG_ERR, "NULL input ... exiting");
+    return 1;
+  }
+
+  int fd = open(output_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+
+  if (fd == -1)
+  {
+    kmyth_log(LOG_ERR, "unable to create file: %s ... exiting", output_path);
+    return 1;
+  }
+
+  size_t bytes_written = 0;
+
+  while (bytes_written < bytes_length)
+  {
+    ssize_t rv = write(fd, bytes + bytes_written,
+                       bytes_length - bytes_written);
+
+    if (rv == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (rv <= 0)
+    {
+      break;
+    }
+    bytes_written += (size_t) rv;
+  }
+
+  int retval = (bytes_written != bytes_length || fsync(fd) != 0);
+
+  if (close(fd) != 0)
+  {
+    retval = 1;
+  }
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error writing file: %s ... exiting", output_path);
+    unlink(output_path);
+  }
+
+  return retval;
+}
+
+//############################################################################
+// make_private_dir()
+//############################################################################
+int make_private_dir(const char *path)
+{
+  if (path == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input ... exiting");
+    return 1;
+  }
+  if (mkdir(path, 0700) == 0)
+  {
+    return 0;
+  }
+  if (errno != EEXIST)
+  {
+    kmyth_log(LOG_ERR, "unable to create directory (%s) ... exiting", path);
+    return 1;
+  }
+
+  // an existing directory is only trusted if no one else could have put
+  // (or replaced) files in it: it must be a directory (not a link to one),
+  // owned by this user, and not writable by group or others
+  struct stat st = { 0 };
+
+  if (lstat(path, &st) != 0 || !S_ISDIR(st.st_mode)
+      || st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0)
+  {
+    kmyth_log(LOG_ERR, "%s is not a directory owned by this user and "
+              "writable only by it ... exiting", path);
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// compare_paths()
+//############################################################################
+static int compare_paths(const void *a, const void *b)
+{
+  return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+//############################################################################
+// has_suffix()
+//############################################################################
+static bool has_suffix(const char *name, const char *suffix)
+{
+  size_t name_len = strlen(name);
+  size_t suffix_len = strlen(suffix);
+
+  return (name_len > suffix_len
+          && strcmp(name + name_len - suffix_len, suffix) == 0);
+}
+
+//############################################################################
+// append_dir_files()
+//############################################################################
+int append_dir_files(const char *dir_path, const char *suffix,
+                     char ***paths, size_t *path_count)
+{
+  if (dir_path == NULL || paths == NULL || path_count == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input ... exiting");
+    return 1;
+  }
+
+  DIR *dir = opendir(dir_path);
+
+  if (dir == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to open input directory (%s) ... exiting",
+              dir_path);
+    return 1;
+  }
+
+  size_t first = *path_count;
+  struct dirent *entry = NULL;
+
+  while ((entry = readdir(dir)) != NULL)
+  {
+    // only regular files (following symbolic links) are listed, so
+    // sub-directories and the '.' and '..' entries are skipped
+    if (suffix != NULL && !has_suffix(entry->d_name, suffix))
+    {
+      continue;
+    }
+
+    size_t entry_path_len = strlen(dir_path) + strlen(entry->d_name) + 2;
+    char *entry_path = malloc(entry_path_len);
+
+    if (entry_path == NULL)
+    {
+      kmyth_log(LOG_ERR, "failed to allocate input path ... exiting");
+      closedir(dir);
+      return 1;
+    }
+    snprintf(entry_path, entry_path_len, "%s/%s", dir_path, entry->d_name);
+
+    struct stat st = { 0 };
+    if (stat(entry_path, &st) || !S_ISREG(st.st_mode))
+    {
+      free(entry_path);
+      continue;
+    }
+
+    char **new_paths = realloc(*paths, (*path_count + 1) * sizeof(char *));
+
+    if (new_paths == NULL)
+    {
+      kmyth_log(LOG_ERR, "failed to allocate input path list ... exiting");
+      free(entry_path);
+      closedir(dir);
+      return 1;
+    }
+    *paths = new_paths;
+    (*paths)[(*path_count)++] = entry_path;
+  }
+  closedir(dir);
+
+  // list the directory's files in name order, so runs are reproducible
+  qsort(*paths + first, *path_count - first, sizeof(char *), compare_paths);
+
+  return 0;
+}
+
+//############################################################################
+// derive_unsealed_paths()
+//############################################################################
+int derive_unsealed_paths(char **paths, size_t path_count,
+                          const char *out_dir, bool force, char **out_paths)
+{
+  struct stat dir_st = { 0 };
+
+  if (out_dir == NULL || stat(out_dir, &dir_st) || !S_ISDIR(dir_st.st_mode))
+  {
+    kmyth_log(LOG_ERR, "output directory (%s) not valid ... exiting",
+              (out_dir == NULL) ? "NULL" : out_dir);
+    return 1;
+  }
+
+  for (size_t i = 0; i < path_count; i++)
+  {
+    const char *name = strrchr(paths[i], '/');
+
+    name = (name == NULL) ? paths[i] : name + 1;
+    if (!has_suffix(name, ".ski"))
+    {
+      kmyth_log(LOG_ERR, "input %s is not a <name>.ski file ... exiting",
+                paths[i]);
+      return 1;
+    }
+
+    size_t name_len = strlen(name) - 4;
+    size_t out_path_len = strlen(out_dir) + name_len + 2;
+
+    out_paths[i] = malloc(out_path_len);
+    if (out_paths[i] == NULL)
+    {
+      kmyth_log(LOG_ERR, "failed to allocate output path ... exiting");
+      return 1;
+    }
+    snprintf(out_paths[i], out_path_len, "%s/%.*s", out_dir,
+             (int) name_len, name);
+
+    struct stat st = { 0 };
+    if (!stat(out_paths[i], &st) && !force)
+    {
+      kmyth_log(LOG_ERR, "output file (%s) already exists ... exiting",
+                out_paths[i]);
+      return 1;
+    }
+    for (size_t j = 0; j < i; j++)
+    {
+      if (strcmp(out_paths[i], out_paths[j]) == 0)
+      {
+        kmyth_log(LOG_ERR, "inputs %s and %s both map to %s ... exiting",
+                  paths[j], paths[i], out_paths[i]);
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+//############################################################################
+// create_secret_memfd()
+//
+// Creates a memfd_secret of the given size, with the bytes written into it
+// through a temporary mapping. Returns -1, with errno set, if memfd_secret
+// is not available.
+//############################################################################
+static int create_secret_memfd(const uint8_t * bytes, size_t bytes_length)
+{
+#ifdef __NR_memfd_secret
+  int fd = (int) syscall(__NR_memfd_secret, O_CLOEXEC);
+
+  if (fd == -1)
+  {
+    return -1;
+  }
+  if (ftruncate(fd, (off_t) bytes_length) == -1)
+  {
+    close(fd);
+    return -1;
+  }
+  if (bytes_length > 0)
+  {
+    void *map = mmap(NULL, bytes_length, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd, 0);
+
+    // the pages are only allocated (and charged to the locked memory
+    // limit) as they are written, so a failure may show up here
+    if (map == MAP_FAILED)
+    {
+      close(fd);
+      return -1;
+    }
+    memcpy(map, bytes, bytes_length);
+    munmap(map, bytes_length);
+  }
+
+  return fd;
+#else
+  (void) bytes;
+  (void) bytes_length;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+//############################################################################
+// create_sealed_memfd()
+//############################################################################
+static int create_sealed_memfd(const uint8_t * bytes, size_t bytes_length)
+{
+  int fd = memfd_create("kmyth-secret", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+  if (fd == -1)
+  {
+    return -1;
+  }
+
+  size_t bytes_written = 0;
+
+  while (bytes_written < bytes_length)
+  {
+    ssize_t rv = write(fd, bytes + bytes_written,
+                       bytes_length - bytes_written);
+
+    if (rv == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (rv <= 0)
+    {
+      close(fd);
+      return -1;
+    }
+    bytes_written += (size_t) rv;
+  }
+
+  if (fcntl(fd, F_ADD_SEALS,
+            F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1)
+  {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+//############################################################################
+// write_bytes_to_secret_fd()
+//############################################################################
+int write_bytes_to_secret_fd(const uint8_t * bytes, size_t bytes_length,
+                             int *fd)
+{
+  if (fd == NULL || (bytes == NULL && bytes_length > 0))
+  {
+    kmyth_log(LOG_ERR, "invalid arguments ... exiting");
+    return 1;
+  }
+
+  *fd = create_secret_memfd(bytes, bytes_length);
+  if (*fd != -1)
+  {
+    kmyth_log(LOG_DEBUG, "wrote %zu bytes to a memfd_secret", bytes_length);
+    return 0;
+  }
+  kmyth_log(LOG_DEBUG, "memfd_secret not available (%s), using a sealed "
+            "memfd", strerror(errno));
+
+  *fd = create_sealed_memfd(bytes, bytes_length);
+  if (*fd == -1)
+  {
+    kmyth_log(LOG_ERR, "unable to create a memory file (%s) ... exiting",
+              strerror(errno));
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// map_bytes_from_secret_fd()
+//############################################################################
+int map_bytes_from_secret_fd(int fd, uint8_t ** data, size_t * data_length)
+{
+  struct stat st;
+
+  if (data == NULL || data_length == NULL || fstat(fd, &st) == -1)
+  {
+    kmyth_log(LOG_ERR, "invalid memory file descriptor ... exiting");
+    return 1;
+  }
+  if (st.st_size < 0 || (uintmax_t) st.st_size > SIZE_MAX)
+  {
+    kmyth_log(LOG_ERR, "memory file too large ... exiting");
+    return 1;
+  }
+  if (st.st_size == 0)
+  {
+    *data = NULL;
+    *data_length = 0;
+    return 0;
+  }
+
+  // a memfd_secret can only be mapped shared
+  void *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+  if (map == MAP_FAILED)
+  {
+    kmyth_log(LOG_ERR, "unable to map memory file (%s) ... exiting",
+              strerror(errno));
+    return 1;
+  }
+
+  *data = (uint8_t *) map;
+  *data_length = (size_t) st.st_size;
 
   return 0;
 }
@@ -6,79 +6,96 @@
 
 #include "formatting_tools.h"
 
+#include <limits.h>
 #include <string.h>
 
-#include <openssl/bio.h>
-#include <openssl/buffer.h>
-#include <openssl/evp.h>
-
+#include "base64_codec.h"
+#include "byte_builder.h"
 #include "defines.h"
+#include "memory_util.h"
 
 //############################################################################
-// get_block_bytes()
+// get_block_view()
 //############################################################################
-int get_block_bytes(char **contents,
-                    size_t * remaining,
-                    uint8_t ** block, size_t * blocksize,
-                    char *delim, size_t delim_len,
-                    char *next_delim, size_t next_delim_len)
+int get_block_view(uint8_t ** contents,
+                   size_t * remaining,
+                   uint8_t ** block, size_t * blocksize,
+                   char *delim, size_t delim_len,
+                   char *next_delim, size_t next_delim_len)
 {
   // check that next (current) block begins with expected delimiter
-  if (strncmp(*contents, delim, delim_len))
+  if (*remaining < delim_len || memcmp(*contents, delim, delim_len))
   {
     kmyth_log(LOG_ERR, "unexpected delimiter ... exiting");
     return 1;
   }
-  *contents += delim_len;
-  (*remaining) -= delim_len;
 
-  // find the end of the block 
-  size_t size = 0;
+  // find the end of the block (start of the next delimiter)
+  uint8_t *start = *contents + delim_len;
+  size_t avail = *remaining - delim_len;
+  uint8_t *end = NULL;
 
-  if (next_delim_len > *remaining)
+  if (next_delim_len <= avail)
   {
-    kmyth_log(LOG_ERR, "unexpectedly reached end of file ... exiting");
-    return 1;
+    end = memmem(start, avail, next_delim, next_delim_len);
   }
-  while (strncmp(*contents + size, next_delim, next_delim_len))
+  if (end == NULL)
   {
-    size++;
-    if (size + next_delim_len > *remaining)
-    {
-      kmyth_log(LOG_ERR, "unexpectedly reached end of file ... exiting");
-      return 1;
-    }
+    kmyth_log(LOG_ERR, "unexpectedly reached end of file ... exiting");
+    return 1;
   }
 
   // check that the block is not empty
+  size_t size = (size_t) (end - start);
+
   if (size == 0)
   {
     kmyth_log(LOG_ERR, "empty block ... exiting");
     return 1;
   }
 
-  else
+  // update output parameters before exiting
+  //   - *block      : start of block data, within the input buffer
+  //   - *blocksize  : block data size (for block just parsed)
+  //   - *contents   : pointer to start of next block in .ski file buffer
+  //   - *remaining  : count of bytes yet to be parsed in .ski file buffer
+  *block = start;
+  *blocksize = size;
+  *contents = end;
+  *remaining = avail - size;
+
+  return 0;
+}
+
+//############################################################################
+// get_block_bytes()
+//############################################################################
+int get_block_bytes(char **contents,
+                    size_t * remaining,
+                    uint8_t ** block, size_t * blocksize,
+                    char *delim, size_t delim_len,
+                    char *next_delim, size_t next_delim_len)
+{
+  uint8_t *view = NULL;
+  size_t size = 0;
+
+  if (get_block_view((uint8_t **) contents, remaining, &view, &size,
+                     delim, delim_len, next_delim, next_delim_len))
+  {
+    return 1;
+  }
+
+  // allocate enough memory for output parameter to hold parsed block data
+  //   - must be allocated here because size is calculated here
+  //   - must be freed by caller because data must be passed back
+  *block = (uint8_t *) malloc(size);
+  if (*block == NULL)
   {
-    // allocate enough memory for output parameter to hold parsed block data
-    //   - must be allocated here because size is calculated here
-    //   - must be freed by caller because data must be passed back
-    *block = (uint8_t *) malloc(size);
-    if (*block == NULL)
-    {
-      kmyth_log(LOG_ERR, "malloc (%d bytes) error ... exiting", size);
-      return 1;
-    }
-
-    // update output parameters before exiting
-    //   - *block      : block data (for block just parsed)
-    //   - *blocksize  : block data size (for block just parsed)
-    //   - *contents   : pointer to start of next block in .ski file buffer
-    //   - *remaining  : count of bytes yet to be parsed in .ski file buffer
-    memcpy(*block, *contents, size);
-    *blocksize = size;
-    *contents += size;
-    *remaining -= size;
+    kmyth_log(LOG_ERR, "malloc (%zu bytes) error ... exiting", size);
+    return 1;
   }
+  memcpy(*block, view, size);
+  *blocksize = size;
 
   return 0;
 }
@@ -96,33 +113,24 @@ int create_nkl_bytes(uint8_t * input, size_t input_length,
     return 1;
   }
 
-  //Encode each portion of the file in base64
-  uint8_t *nkl_data = NULL;
-  size_t nkl_data_size = 0;
+  // allocate the output once, and encode the data directly into place
+  size_t encoded_size = base64_encoded_size(input_length);
+  byte_builder out = { 0 };
 
-  if (encodeBase64Data(input, input_length, &nkl_data, &nkl_data_size))
+  if (byte_builder_init(&out, strlen(KMYTH_DELIM_NKL_DATA) + encoded_size +
+                        strlen(KMYTH_DELIM_END_NKL)))
   {
-    kmyth_log(LOG_ERR, "error base64 encoding nkl string ... exiting");
-    free(nkl_data);
+    kmyth_log(LOG_ERR, "unable to allocate nkl output ... exiting");
     return 1;
   }
 
-  //At this point the data is all formatted, it's time to create the string
-
-  uint8_t *out = NULL;
-  size_t out_length = 0;
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_NKL_DATA,
-         strlen(KMYTH_DELIM_NKL_DATA));
-  concat(&out, &out_length, nkl_data, nkl_data_size);
-  free(nkl_data);
-  nkl_data = NULL;
+  // (the capacity is exact, so none of these writes can fail)
+  byte_builder_append(&out, KMYTH_DELIM_NKL_DATA,
+                      strlen(KMYTH_DELIM_NKL_DATA));
+  base64_encode(input, input_length, byte_builder_reserve(&out, encoded_size));
+  byte_builder_append(&out, KMYTH_DELIM_END_NKL, strlen(KMYTH_DELIM_END_NKL));
 
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_END_NKL,
-         strlen(KMYTH_DELIM_END_NKL));
-
-  *output = out;
-  *output_length = out_length;
+  byte_builder_finish(&out, output, output_length);
 
   return 0;
 }
@@ -141,75 +149,25 @@ int encodeBase64Data(uint8_t * raw_data,
     return 1;
   }
 
-  BIO *bio_mem = NULL;
-  BIO *bio64 = NULL;
-  BUF_MEM *bioptr = NULL;
-
-  // create a base64 encoding filter BIO
-  if ((bio64 = BIO_new(BIO_f_base64())) == NULL)
-  {
-    kmyth_log(LOG_ERR, "create base64 filter BIO error ... exiting");
-    return 1;
-  }
-
-  // create a 'sink' BIO to write to memory
-  if ((bio_mem = BIO_new(BIO_s_mem())) == NULL)
-  {
-    kmyth_log(LOG_ERR, "create read/write memory sink BIO error" "... exiting");
-    BIO_free_all(bio64);
-    return 1;
-  }
-
-  // assemble the BIO chain in the order bio64 -> bio_mem
-  bio64 = BIO_push(bio64, bio_mem);
-
-  // write the input 'raw data' to the BIO chain
-  if (BIO_write(bio64, raw_data, raw_data_size) != raw_data_size)
-  {
-    kmyth_log(LOG_ERR, "BIO_write() error ... exiting");
-    BIO_free_all(bio64);
-    return 1;
-  }
-
-  // ensure all written data is flushed all the way through chain
-  if (BIO_flush(bio64) != 1)
-  {
-    kmyth_log(LOG_ERR, "BIO_flush() error ... exiting");
-    BIO_free_all(bio64);
-    return 1;
-  }
-
-  // compute memory size of encoded data
-  BIO_get_mem_ptr(bio64, &bioptr);
-  if (bioptr == NULL)
-  {
-    kmyth_log(LOG_ERR, "no underlying BIO_MEM structure ... exiting");
-    BIO_free_all(bio64);
-    return 1;
-  }
-  *base64_data_size = bioptr->length;
-
   // allocate memory for 'base64_data' output parameter
   //   - memory allocated here because the encoded data size is known here
   //   - memory must be freed by the caller because the data passed back
-  *base64_data = (uint8_t *) malloc(*base64_data_size + 1);
+  //   - the encoded data ends with a newline, and is null terminated
+  size_t encoded_size = base64_encoded_size(raw_data_size);
+
+  *base64_data = (uint8_t *) malloc(encoded_size + 1);
   if (*base64_data == NULL)
   {
     kmyth_log(LOG_ERR, "malloc error (%lu bytes) ... exiting",
-              base64_data_size);
-    BIO_free_all(bio64);
+              encoded_size + 1);
     return 1;
   }
+  kmyth_advise_huge_pages(*base64_data, encoded_size + 1);
 
-  // copy encoded data to output parameter and terminate with newline and
-  // null terminator
-  memcpy(*base64_data, bioptr->data, (*base64_data_size) - 1);
-  (*base64_data)[(*base64_data_size) - 1] = '\n';
+  *base64_data_size = base64_encode(raw_data, raw_data_size, *base64_data);
   (*base64_data)[(*base64_data_size)] = '\0';
-  kmyth_log(LOG_DEBUG, "encoded %lu bytes into %lu base-64 symbols",
-            raw_data_size, *base64_data_size - 1);
-  // clean-up
-  BIO_free_all(bio64);
+  kmyth_log(LOG_DEBUG, "encoded %lu bytes into %lu base-64 symbols (%s)",
+            raw_data_size, *base64_data_size - 1, base64_codec_name());
   return 0;
 }
 
@@ -236,51 +194,30 @@ int decodeBase64Data(uint8_t * base64_data,
     return 1;
   }
 
-  // allocate memory for decoded result - size of encoded input is worst case
-  *raw_data = (uint8_t *) malloc(base64_data_size);
+  // allocate memory for decoded result - size of encoded input (plus room
+  // for an unpadded final quad and the null terminator) is worst case
+  *raw_data = (uint8_t *) malloc(base64_data_size + 4);
   if (*raw_data == NULL)
   {
     kmyth_log(LOG_ERR, "malloc error (%lu bytes) for b64 decode ... exiting",
-              base64_data_size);
-    return 1;
-  }
-
-  // create a base64 decoding filter BIO
-  BIO *bio64 = NULL;
-
-  if ((bio64 = BIO_new(BIO_f_base64())) == NULL)
-  {
-    kmyth_log(LOG_ERR, "create base64 filter BIO error ... exiting");
-    return 1;
-  }
-
-  // create a 'source' BIO to read from memory
-  BIO *bio_mem = NULL;
-
-  if ((bio_mem = BIO_new_mem_buf(base64_data, base64_data_size)) == NULL)
-  {
-    kmyth_log(LOG_ERR, "create source BIO error ... exiting");
-    BIO_free_all(bio64);
+              base64_data_size + 4);
     return 1;
   }
+  kmyth_advise_huge_pages(*raw_data, base64_data_size + 4);
 
-  // assemble the BIO chain to base64 decode data read from memory
-  bio64 = BIO_push(bio64, bio_mem);
-  // read encoded data through chain, into 'raw_data' decoded output parameter
-  // and terminate with newline
-  int bytes_read = BIO_read(bio64, *raw_data, base64_data_size);
+  // decode into 'raw_data' output parameter and null terminate
+  size_t bytes_read = 0;
 
-  if (bytes_read < 0)
+  if (base64_decode(base64_data, base64_data_size, *raw_data, &bytes_read))
   {
-    kmyth_log(LOG_ERR, "error reading bytes from BIO chain ... exiting");
-    BIO_free_all(bio64);
+    kmyth_log(LOG_ERR, "invalid base64 input data ... exiting");
+    free(*raw_data);
+    *raw_data = NULL;
     return 1;
   }
 
   (*raw_data)[bytes_read] = '\0';
   *raw_data_size = bytes_read;
-  // clean-up
-  BIO_free_all(bio64);
   return 0;
 }
 
@@ -7,7 +7,35 @@
 
 #include "memory_util.h"
 
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "defines.h"
+
+/*
+ * Clearing is done with memset(), which the C library implements with the
+ * widest stores available, followed by a compiler barrier that takes the
+ * cleared pointer as an input and clobbers memory: the compiler must assume
+ * the cleared bytes are then read, so it cannot drop the memset() as a dead
+ * store. Without GNU inline assembly, memset() is called through a volatile
+ * function pointer, which the compiler cannot assume still points to it.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define SECURE_MEMSET(v, c, n) \
+  do { \
+    memset((v), (c), (n)); \
+    __asm__ __volatile__("" : : "r"(v) : "memory"); \
+  } while (0)
+#else
+static void *(*const volatile memset_ptr) (void *, int, size_t) = memset;
+#define SECURE_MEMSET(v, c, n) memset_ptr((v), (c), (n))
+#endif
 
 //############################################################################
 // kmyth_clear()
@@ -17,10 +45,7 @@ void kmyth_clear(void *v, size_t size)
   if (v == NULL)
     return;
 
-  volatile unsigned char *p = v;
-
-  while (size--)
-    *p++ = '\0';
+  SECURE_MEMSET(v, 0, size);
 }
 
 //############################################################################
@@ -39,10 +64,387 @@ void kmyth_clear_and_free(void *v, size_t size)
 //############################################################################
 void *secure_memset(void *v, int c, size_t n)
 {
-  volatile unsigned char *p = v;
+  SECURE_MEMSET(v, c, n);
+
+  return v;
+}
+
+/*
+ * Huge pages: the mode in use (see kmyth_set_huge_pages()), and the size of
+ * a huge page, both set up on first use
+ */
+#define HUGE_PAGE_SIZE_DEFAULT (2 * 1024 * 1024)
+
+static pthread_once_t huge_pages_once = PTHREAD_ONCE_INIT;
+static kmyth_huge_pages_t huge_pages_mode = KMYTH_HUGE_PAGES_TRANSPARENT;
+static size_t huge_page_size = HUGE_PAGE_SIZE_DEFAULT;
+
+//############################################################################
+// huge_pages_init()
+//
+// Reads the huge page size from /proc/meminfo, and the mode from the
+// KMYTH_HUGE_PAGES environment variable
+//############################################################################
+static void huge_pages_init(void)
+{
+  FILE *meminfo = fopen("/proc/meminfo", "re");
+
+  if (meminfo != NULL)
+  {
+    char line[128];
+    size_t kib = 0;
+
+    while (fgets(line, sizeof(line), meminfo) != NULL)
+    {
+      if (sscanf(line, "Hugepagesize: %zu kB", &kib) == 1)
+      {
+        break;
+      }
+    }
+    fclose(meminfo);
+
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+
+    // a huge page is a power-of-two multiple of the base page size
+    if (kib > 0 && kib <= SIZE_MAX / 1024 && (kib * 1024) % page_size == 0
+        && ((kib * 1024) & (kib * 1024 - 1)) == 0)
+    {
+      huge_page_size = kib * 1024;
+    }
+  }
+
+  const char *env = getenv(KMYTH_HUGE_PAGES_ENV);
+
+  if (env == NULL)
+  {
+    return;
+  }
+  if (strcmp(env, "off") == 0 || strcmp(env, "0") == 0)
+  {
+    huge_pages_mode = KMYTH_HUGE_PAGES_OFF;
+  }
+  else if (strcmp(env, "explicit") == 0)
+  {
+    huge_pages_mode = KMYTH_HUGE_PAGES_EXPLICIT;
+  }
+  else if (strcmp(env, "transparent") == 0)
+  {
+    huge_pages_mode = KMYTH_HUGE_PAGES_TRANSPARENT;
+  }
+}
+
+//############################################################################
+// huge_pages_get_mode()
+//############################################################################
+static kmyth_huge_pages_t huge_pages_get_mode(void)
+{
+  pthread_once(&huge_pages_once, huge_pages_init);
+  return __atomic_load_n(&huge_pages_mode, __ATOMIC_ACQUIRE);
+}
+
+//############################################################################
+// kmyth_set_huge_pages()
+//############################################################################
+int kmyth_set_huge_pages(kmyth_huge_pages_t mode)
+{
+  pthread_once(&huge_pages_once, huge_pages_init);
+
+  if (mode != KMYTH_HUGE_PAGES_OFF && mode != KMYTH_HUGE_PAGES_TRANSPARENT
+      && mode != KMYTH_HUGE_PAGES_EXPLICIT)
+  {
+    return 1;
+  }
+  __atomic_store_n(&huge_pages_mode, mode, __ATOMIC_RELEASE);
+  return 0;
+}
+
+//############################################################################
+// kmyth_huge_pages_name()
+//############################################################################
+const char *kmyth_huge_pages_name(void)
+{
+  switch (huge_pages_get_mode())
+  {
+  case KMYTH_HUGE_PAGES_OFF:
+    return "off";
+  case KMYTH_HUGE_PAGES_EXPLICIT:
+    return "explicit";
+  default:
+    return "transparent";
+  }
+}
+
+//############################################################################
+// kmyth_advise_huge_pages()
+//############################################################################
+void kmyth_advise_huge_pages(void *v, size_t size)
+{
+#ifdef MADV_HUGEPAGE
+  if (v == NULL || size < KMYTH_HUGE_PAGES_MIN_SIZE
+      || huge_pages_get_mode() == KMYTH_HUGE_PAGES_OFF)
+  {
+    return;
+  }
+
+  // only the whole huge pages within the buffer can be backed by them
+  uintptr_t start = ((uintptr_t) v + huge_page_size - 1)
+    / huge_page_size * huge_page_size;
+  uintptr_t end = ((uintptr_t) v + size) / huge_page_size * huge_page_size;
+
+  if (end > start)
+  {
+    madvise((void *) start, end - start, MADV_HUGEPAGE);
+  }
+#else
+  (void) v;
+  (void) size;
+#endif
+}
+
+/*
+ * Secure arena: a requested block of up to SECURE_ARENA_MAX_SIZE bytes is
+ * rounded up to a power-of-two size class and carved out of a locked slab
+ * shared by the blocks of that class. Freed blocks are wiped and kept on
+ * the class free list for reuse, so hot paths stop paying for mmap(),
+ * mlock() and page faults on every secret. Larger blocks get their own
+ * locked mapping, released when freed. Each slab or large mapping is
+ * surrounded by PROT_NONE guard pages, so overruns fault instead of reaching
+ * other memory.
+ *
+ * Every block starts with a header recording its class (or the size of its
+ * own mapping) so that it is released correctly whatever size the caller
+ * passes to kmyth_secure_free().
+ *
+ * A large block of KMYTH_HUGE_PAGES_MIN_SIZE or more is aligned on a huge
+ * page boundary and, unless huge pages are turned off, backed by huge pages
+ * (explicit ones, in a mapping rounded up to whole huge pages, when they
+ * are selected and available; else transparent ones), so that streaming
+ * through tens of GB of it takes fewer TLB misses. Its guard pages are
+ * still single base pages.
+ */
+#define SECURE_ARENA_MIN_SIZE 64
+#define SECURE_ARENA_CLASSES 11 // 64 bytes ... 64 KiB
+#define SECURE_ARENA_MAX_SIZE (SECURE_ARENA_MIN_SIZE << (SECURE_ARENA_CLASSES - 1))
+#define SECURE_ARENA_SLAB_SIZE (64 * 1024)
+#define SECURE_ARENA_LARGE SECURE_ARENA_CLASSES
+
+typedef union secure_block_header
+{
+  struct
+  {
+    size_t size_class;
+    size_t map_size;
+  } info;
+  max_align_t align;            // keeps the caller's bytes malloc() aligned
+} secure_block_header;
+
+#define SECURE_BLOCK_SIZE(c) \
+  (sizeof(secure_block_header) + ((size_t) SECURE_ARENA_MIN_SIZE << (c)))
+
+static pthread_mutex_t secure_arena_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *secure_arena_free_list[SECURE_ARENA_CLASSES] = { NULL };
+
+//############################################################################
+// secure_map()
+//   - align: alignment of the block (page_size, or a huge page size for a
+//     block backed by huge pages)
+//   - hugetlb: back the block with explicit huge pages (size must be a
+//     multiple of align)
+//############################################################################
+static void *secure_map(size_t size, size_t page_size, size_t align,
+                        bool hugetlb)
+{
+  // reserve the guard pages with the block (and the slack needed to align
+  // it), then give back the slack and open up the block itself
+  size_t slack = align - page_size;
+  uint8_t *base = mmap(NULL, size + 2 * page_size + slack, PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (base == MAP_FAILED)
+    return NULL;
+
+  uint8_t *v = (uint8_t *) (((uintptr_t) base + page_size + align - 1)
+                            / align * align);
+  size_t head = (size_t) (v - page_size - base);
+
+  if (head > 0)
+    munmap(base, head);
+  if (slack > head)
+    munmap(v + size + page_size, slack - head);
+
+  bool mapped = false;
 
-  while (n--)
-    *p++ = c;
+#ifdef MAP_HUGETLB
+  if (hugetlb)
+  {
+    mapped = (mmap(v, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1,
+                   0) != MAP_FAILED);
+    if (!mapped)
+    {
+      munmap(v - page_size, size + 2 * page_size);
+      return NULL;
+    }
+  }
+#endif
+  if (!mapped && mprotect(v, size, PROT_READ | PROT_WRITE))
+  {
+    munmap(v - page_size, size + 2 * page_size);
+    return NULL;
+  }
+
+  // ask for transparent huge pages before mlock() faults the block in
+#ifdef MADV_HUGEPAGE
+  if (!hugetlb && align > page_size)
+    madvise(v, size, MADV_HUGEPAGE);
+#endif
+
+  if (mlock(v, size))
+  {
+    munmap(v - page_size, size + 2 * page_size);
+    return NULL;
+  }
+
+  // Best effort: kernels without MADV_DONTDUMP still get a locked block
+#ifdef MADV_DONTDUMP
+  madvise(v, size, MADV_DONTDUMP);
+#endif
 
   return v;
 }
+
+//############################################################################
+// secure_unmap()
+//############################################################################
+static void secure_unmap(void *v, size_t size, size_t page_size)
+{
+  munlock(v, size);
+  munmap((uint8_t *) v - page_size, size + 2 * page_size);
+}
+
+//############################################################################
+// secure_arena_refill()
+//############################################################################
+static int secure_arena_refill(size_t size_class, size_t page_size)
+{
+  size_t block_size = SECURE_BLOCK_SIZE(size_class);
+  size_t slab_size = (block_size > SECURE_ARENA_SLAB_SIZE) ?
+    block_size : SECURE_ARENA_SLAB_SIZE;
+
+  slab_size = (slab_size + page_size - 1) / page_size * page_size;
+
+  uint8_t *slab = secure_map(slab_size, page_size, page_size, false);
+
+  if (slab == NULL)
+    return 1;
+
+  // slabs stay mapped for the life of the process, their blocks recycled
+  for (size_t offset = 0; offset + block_size <= slab_size;
+       offset += block_size)
+  {
+    void **block = (void **) (slab + offset);
+
+    *block = secure_arena_free_list[size_class];
+    secure_arena_free_list[size_class] = block;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_secure_alloc()
+//############################################################################
+void *kmyth_secure_alloc(size_t size)
+{
+  if (size == 0 || size > SIZE_MAX / 2)
+    return NULL;
+
+  size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+  secure_block_header *header = NULL;
+
+  if (size > SECURE_ARENA_MAX_SIZE)
+  {
+    size_t map_size = (sizeof(secure_block_header) + size + page_size - 1)
+      / page_size * page_size;
+    kmyth_huge_pages_t huge_mode = (map_size >= KMYTH_HUGE_PAGES_MIN_SIZE) ?
+      huge_pages_get_mode() : KMYTH_HUGE_PAGES_OFF;
+
+    // an anonymous mapping is zero-filled
+    if (huge_mode == KMYTH_HUGE_PAGES_EXPLICIT
+        && map_size <= SIZE_MAX - huge_page_size)
+    {
+      size_t huge_map_size = (map_size + huge_page_size - 1)
+        / huge_page_size * huge_page_size;
+
+      header = secure_map(huge_map_size, page_size, huge_page_size, true);
+      if (header != NULL)
+        map_size = huge_map_size;
+    }
+    if (header == NULL)
+    {
+      header = secure_map(map_size, page_size,
+                          (huge_mode == KMYTH_HUGE_PAGES_OFF) ? page_size
+                          : huge_page_size, false);
+    }
+    if (header == NULL)
+      return NULL;
+    header->info.size_class = SECURE_ARENA_LARGE;
+    header->info.map_size = map_size;
+
+    return header + 1;
+  }
+
+  size_t size_class = 0;
+
+  while (((size_t) SECURE_ARENA_MIN_SIZE << size_class) < size)
+    size_class++;
+
+  pthread_mutex_lock(&secure_arena_lock);
+  if (secure_arena_free_list[size_class] == NULL
+      && secure_arena_refill(size_class, page_size))
+  {
+    pthread_mutex_unlock(&secure_arena_lock);
+    return NULL;
+  }
+  header = secure_arena_free_list[size_class];
+  secure_arena_free_list[size_class] = *(void **) header;
+  pthread_mutex_unlock(&secure_arena_lock);
+
+  // a free block is all zero but for its free list link
+  memset(header, 0, sizeof(void *));
+  header->info.size_class = size_class;
+
+  return header + 1;
+}
+
+//############################################################################
+// kmyth_secure_free()
+//############################################################################
+void kmyth_secure_free(void *v, size_t size)
+{
+  if (v == NULL)
+    return;
+
+  // the block's own header, not the size passed in, says what to release
+  (void) size;
+
+  secure_block_header *header = (secure_block_header *) v - 1;
+  size_t size_class = header->info.size_class;
+
+  if (size_class == SECURE_ARENA_LARGE)
+  {
+    size_t map_size = header->info.map_size;
+
+    kmyth_clear(header, map_size);
+    secure_unmap(header, map_size, (size_t) sysconf(_SC_PAGESIZE));
+    return;
+  }
+
+  // wipe the whole block at once, header included, before it is reused
+  kmyth_clear(header, SECURE_BLOCK_SIZE(size_class));
+
+  pthread_mutex_lock(&secure_arena_lock);
+  *(void **) header = secure_arena_free_list[size_class];
+  secure_arena_free_list[size_class] = header;
+  pthread_mutex_unlock(&secure_arena_lock);
+}
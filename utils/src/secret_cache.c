@@ -0,0 +1,344 @@
+/**
+ * secret_cache.c:
+ *
+ * C library containing the bounded, expiring cache of secrets held in
+ * locked memory supporting Kmyth applications
+ */
+
+#include "secret_cache.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "defines.h"
+#include "memory_util.h"
+
+/**
+ * @brief Secret cache entry: the secret's bytes are in the arena, at
+ *        [offset, offset + len)
+ */
+typedef struct secret_cache_entry
+{
+  bool in_use;
+  uint8_t key[SECRET_CACHE_KEY_SIZE];
+  size_t offset;
+  size_t len;
+  time_t expires;
+  uint64_t last_used;
+} secret_cache_entry;
+
+struct secret_cache
+{
+  pthread_mutex_t lock;
+
+  // locked arena holding the cached secrets, packed from its start:
+  // [0, used) is either live entries or cleared gaps left by dropped ones
+  uint8_t *arena;
+  size_t capacity;
+  size_t used;
+  size_t live_bytes;
+
+  secret_cache_entry *entries;
+  size_t max_entries;
+
+  unsigned int ttl_seconds;
+
+  // use counter used to find the least recently used entry
+  uint64_t clock;
+};
+
+//############################################################################
+// secret_cache_now()
+//############################################################################
+static time_t secret_cache_now(void)
+{
+  // monotonic, so that setting the wall clock back cannot extend a TTL
+  struct timespec ts = { 0 };
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+
+//############################################################################
+// drop_entry()
+//############################################################################
+static void drop_entry(secret_cache * cache, secret_cache_entry * entry)
+{
+  kmyth_clear(cache->arena + entry->offset, entry->len);
+  cache->live_bytes -= entry->len;
+  entry->in_use = false;
+}
+
+//############################################################################
+// drop_expired_entries()
+//############################################################################
+static void drop_expired_entries(secret_cache * cache, time_t now)
+{
+  for (size_t i = 0; i < cache->max_entries; i++)
+  {
+    if (cache->entries[i].in_use && cache->entries[i].expires <= now)
+    {
+      drop_entry(cache, &cache->entries[i]);
+    }
+  }
+}
+
+//############################################################################
+// compact_arena()
+//############################################################################
+static void compact_arena(secret_cache * cache)
+{
+  // Move the live entries, in arena order, down over the gaps left by
+  // dropped ones. Compaction is only needed when an insert does not fit
+  // at the end of the arena, so the quadratic scan is not a concern.
+  size_t dest = 0;
+  size_t floor = 0;
+
+  while (true)
+  {
+    secret_cache_entry *next = NULL;
+
+    for (size_t i = 0; i < cache->max_entries; i++)
+    {
+      secret_cache_entry *entry = &cache->entries[i];
+
+      if (entry->in_use && entry->offset >= floor
+          && (next == NULL || entry->offset < next->offset))
+      {
+        next = entry;
+      }
+    }
+    if (next == NULL)
+    {
+      break;
+    }
+
+    floor = next->offset + next->len;
+    if (next->offset != dest)
+    {
+      memmove(cache->arena + dest, cache->arena + next->offset, next->len);
+      next->offset = dest;
+    }
+    dest += next->len;
+  }
+
+  // nothing of a moved secret may be left behind in the freed space
+  kmyth_clear(cache->arena + dest, cache->used - dest);
+  cache->used = dest;
+}
+
+//############################################################################
+// find_entry()
+//############################################################################
+static secret_cache_entry *find_entry(secret_cache * cache,
+                                      const uint8_t * key)
+{
+  for (size_t i = 0; i < cache->max_entries; i++)
+  {
+    if (cache->entries[i].in_use
+        && memcmp(cache->entries[i].key, key, SECRET_CACHE_KEY_SIZE) == 0)
+    {
+      return &cache->entries[i];
+    }
+  }
+  return NULL;
+}
+
+//############################################################################
+// secret_cache_new()
+//############################################################################
+int secret_cache_new(size_t capacity, size_t max_entries,
+                     unsigned int ttl_seconds, secret_cache ** cache)
+{
+  if (cache == NULL || capacity == 0 || max_entries == 0 || ttl_seconds == 0)
+  {
+    kmyth_log(LOG_ERR, "invalid secret cache parameters ... exiting");
+    return 1;
+  }
+  *cache = NULL;
+
+  secret_cache *new_cache = calloc(1, sizeof(secret_cache));
+
+  if (new_cache == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate secret cache ... exiting");
+    return 1;
+  }
+
+  new_cache->entries = calloc(max_entries, sizeof(secret_cache_entry));
+  new_cache->arena = kmyth_secure_alloc(capacity);
+  if (new_cache->entries == NULL || new_cache->arena == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate %zu byte locked secret cache "
+              "arena (check RLIMIT_MEMLOCK) ... exiting", capacity);
+    free(new_cache->entries);
+    kmyth_secure_free(new_cache->arena, capacity);
+    free(new_cache);
+    return 1;
+  }
+
+  pthread_mutex_init(&new_cache->lock, NULL);
+  new_cache->capacity = capacity;
+  new_cache->max_entries = max_entries;
+  new_cache->ttl_seconds = ttl_seconds;
+
+  *cache = new_cache;
+
+  return 0;
+}
+
+//############################################################################
+// secret_cache_free()
+//############################################################################
+void secret_cache_free(secret_cache ** cache)
+{
+  if (cache == NULL || *cache == NULL)
+  {
+    return;
+  }
+
+  kmyth_secure_free((*cache)->arena, (*cache)->capacity);
+  free((*cache)->entries);
+  pthread_mutex_destroy(&(*cache)->lock);
+  free(*cache);
+  *cache = NULL;
+}
+
+//############################################################################
+// secret_cache_get()
+//############################################################################
+int secret_cache_get(secret_cache * cache, const uint8_t * key,
+                     uint8_t ** data, size_t *data_len)
+{
+  if (cache == NULL || key == NULL || data == NULL || data_len == NULL)
+  {
+    return 1;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+
+  secret_cache_entry *entry = find_entry(cache, key);
+
+  if (entry != NULL && entry->expires <= secret_cache_now())
+  {
+    drop_entry(cache, entry);
+    entry = NULL;
+  }
+  if (entry == NULL)
+  {
+    pthread_mutex_unlock(&cache->lock);
+    return 1;
+  }
+
+  *data = malloc(entry->len);
+  if (*data == NULL)
+  {
+    pthread_mutex_unlock(&cache->lock);
+    return 1;
+  }
+  memcpy(*data, cache->arena + entry->offset, entry->len);
+  *data_len = entry->len;
+  entry->last_used = ++cache->clock;
+
+  pthread_mutex_unlock(&cache->lock);
+
+  return 0;
+}
+
+//############################################################################
+// secret_cache_put()
+//############################################################################
+int secret_cache_put(secret_cache * cache, const uint8_t * key,
+                     const uint8_t * data, size_t data_len)
+{
+  if (cache == NULL || key == NULL || data == NULL || data_len == 0
+      || data_len > cache->capacity)
+  {
+    return 1;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+
+  drop_expired_entries(cache, secret_cache_now());
+
+  secret_cache_entry *entry = find_entry(cache, key);
+
+  if (entry != NULL)
+  {
+    drop_entry(cache, entry);
+  }
+
+  // Make room: compact if the live entries leave enough space, otherwise
+  // drop the least recently used entry and try again
+  while (true)
+  {
+    entry = NULL;
+    for (size_t i = 0; i < cache->max_entries && entry == NULL; i++)
+    {
+      if (!cache->entries[i].in_use)
+      {
+        entry = &cache->entries[i];
+      }
+    }
+
+    if (entry != NULL && cache->used + data_len <= cache->capacity)
+    {
+      break;
+    }
+    if (entry != NULL && cache->live_bytes + data_len <= cache->capacity)
+    {
+      compact_arena(cache);
+      continue;
+    }
+
+    secret_cache_entry *lru = NULL;
+
+    for (size_t i = 0; i < cache->max_entries; i++)
+    {
+      if (cache->entries[i].in_use
+          && (lru == NULL || cache->entries[i].last_used < lru->last_used))
+      {
+        lru = &cache->entries[i];
+      }
+    }
+    drop_entry(cache, lru);
+  }
+
+  memcpy(entry->key, key, SECRET_CACHE_KEY_SIZE);
+  entry->offset = cache->used;
+  entry->len = data_len;
+  entry->expires = secret_cache_now() + cache->ttl_seconds;
+  entry->last_used = ++cache->clock;
+  entry->in_use = true;
+  memcpy(cache->arena + entry->offset, data, data_len);
+  cache->used += data_len;
+  cache->live_bytes += data_len;
+
+  pthread_mutex_unlock(&cache->lock);
+
+  return 0;
+}
+
+//############################################################################
+// secret_cache_clear()
+//############################################################################
+void secret_cache_clear(secret_cache * cache)
+{
+  if (cache == NULL)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  for (size_t i = 0; i < cache->max_entries; i++)
+  {
+    cache->entries[i].in_use = false;
+  }
+  kmyth_clear(cache->arena, cache->capacity);
+  cache->used = 0;
+  cache->live_bytes = 0;
+  pthread_mutex_unlock(&cache->lock);
+}
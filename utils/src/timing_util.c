@@ -0,0 +1,161 @@
+/**
+ * timing_util.c:
+ *
+ * C library containing the phase timers supporting Kmyth applications
+ */
+
+#include "timing_util.h"
+
+#include <stdatomic.h>
+#include <time.h>
+
+#include "defines.h"
+
+static atomic_bool timings_enabled = false;
+
+// totals over every thread, so that threads time phases without locking
+static atomic_uint_fast64_t phase_calls[KMYTH_PHASE_COUNT];
+static atomic_uint_fast64_t phase_ns[KMYTH_PHASE_COUNT];
+
+static const char *const phase_names[KMYTH_PHASE_COUNT] = {
+  [KMYTH_PHASE_TPM_CONNECT] = "tpm connect",
+  [KMYTH_PHASE_SRK_LOOKUP] = "srk lookup",
+  [KMYTH_PHASE_PCR_POLICY] = "pcr policy",
+  [KMYTH_PHASE_STORAGE_KEY] = "storage key",
+  [KMYTH_PHASE_POLICY_SESSION] = "policy session",
+  [KMYTH_PHASE_TPM_SEAL] = "tpm seal",
+  [KMYTH_PHASE_TPM_UNSEAL] = "tpm unseal",
+  [KMYTH_PHASE_ENCRYPT] = "encrypt",
+  [KMYTH_PHASE_DECRYPT] = "decrypt",
+  [KMYTH_PHASE_COMPRESS] = "compress",
+  [KMYTH_PHASE_SKI_ENCODE] = "ski encode",
+  [KMYTH_PHASE_SKI_PARSE] = "ski parse",
+  [KMYTH_PHASE_BASE64] = "base64",
+  [KMYTH_PHASE_FILE_IO] = "file i/o",
+  [KMYTH_PHASE_NETWORK] = "network",
+};
+
+//############################################################################
+// monotonic_ns()
+//############################################################################
+static uint64_t monotonic_ns(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+//############################################################################
+// kmyth_timings_enable()
+//############################################################################
+void kmyth_timings_enable(bool enable)
+{
+  atomic_store(&timings_enabled, enable);
+}
+
+//############################################################################
+// kmyth_timer_begin()
+//############################################################################
+uint64_t kmyth_timer_begin(void)
+{
+  if (!atomic_load_explicit(&timings_enabled, memory_order_relaxed)
+      && !kmyth_log_enabled(LOG_DEBUG))
+  {
+    return 0;
+  }
+
+  // the monotonic clock never reads zero once the system is up
+  return monotonic_ns();
+}
+
+//############################################################################
+// kmyth_timer_end()
+//############################################################################
+void kmyth_timer_end(kmyth_phase phase, uint64_t begin)
+{
+  if (begin == 0 || phase < 0 || phase >= KMYTH_PHASE_COUNT)
+  {
+    return;
+  }
+
+  uint64_t duration_ns = monotonic_ns() - begin;
+
+  atomic_fetch_add_explicit(&phase_calls[phase], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&phase_ns[phase], duration_ns,
+                            memory_order_relaxed);
+
+  kmyth_log_field fields[] = {
+    KMYTH_LOG_STR("operation", phase_names[phase]),
+    KMYTH_LOG_UINT("duration_us", duration_ns / 1000)
+  };
+
+  kmyth_log_fields(LOG_DEBUG, fields, 2, "%s took %.3f ms",
+                   phase_names[phase], duration_ns / 1000000.0);
+}
+
+//############################################################################
+// kmyth_timings_get()
+//############################################################################
+void kmyth_timings_get(kmyth_phase phase, uint64_t *calls,
+                       uint64_t *duration_ns)
+{
+  bool valid = (phase >= 0 && phase < KMYTH_PHASE_COUNT);
+
+  if (calls != NULL)
+  {
+    *calls = (valid) ? atomic_load(&phase_calls[phase]) : 0;
+  }
+  if (duration_ns != NULL)
+  {
+    *duration_ns = (valid) ? atomic_load(&phase_ns[phase]) : 0;
+  }
+}
+
+//############################################################################
+// kmyth_timings_reset()
+//############################################################################
+void kmyth_timings_reset(void)
+{
+  for (int i = 0; i < KMYTH_PHASE_COUNT; i++)
+  {
+    atomic_store(&phase_calls[i], 0);
+    atomic_store(&phase_ns[i], 0);
+  }
+}
+
+//############################################################################
+// kmyth_phase_name()
+//############################################################################
+const char *kmyth_phase_name(kmyth_phase phase)
+{
+  if (phase < 0 || phase >= KMYTH_PHASE_COUNT)
+  {
+    return "unknown";
+  }
+  return phase_names[phase];
+}
+
+//############################################################################
+// kmyth_timings_print()
+//############################################################################
+void kmyth_timings_print(FILE * stream)
+{
+  uint64_t total_ns = 0;
+
+  fprintf(stream, "%-16s %8s %14s\n", "phase", "calls", "total (ms)");
+  for (int i = 0; i < KMYTH_PHASE_COUNT; i++)
+  {
+    uint64_t calls = 0;
+    uint64_t duration_ns = 0;
+
+    kmyth_timings_get((kmyth_phase) i, &calls, &duration_ns);
+    if (calls > 0)
+    {
+      fprintf(stream, "%-16s %8llu %14.3f\n", phase_names[i],
+              (unsigned long long) calls, duration_ns / 1000000.0);
+      total_ns += duration_ns;
+    }
+  }
+  fprintf(stream, "%-16s %8s %14.3f\n", "total", "", total_ns / 1000000.0);
+}